@@ -62,6 +62,9 @@ ifeq ($(CONFIG_SQUASHFS_XZ),y)
   endif
   SQUASHFSCOMP := xz $(LZMA_XZ_OPTIONS) $(BCJ_FILTER)
 endif
+ifeq ($(CONFIG_TARGET_SQUASHFS_COMPRESSION_LZO),y)
+  SQUASHFSCOMP := lzo -Xalgorithm lzo1x_999 -Xcompression-level 9
+endif
 
 JFFS2_BLOCKSIZE ?= 64k 128k
 
@@ -106,8 +109,9 @@ $(call split_args,$(1),build_cmd)
 endef
 
 # pad to 4k, 8k, 16k, 64k, 128k, 256k and add jffs2 end-of-filesystem mark
+# $(2): extra padjffs2 options, e.g. -o <pad>:<file> for single-size copies
 define prepare_generic_squashfs
-	$(STAGING_DIR_HOST)/bin/padjffs2 $(1) 4 8 16 64 128 256
+	$(STAGING_DIR_HOST)/bin/padjffs2 $(1) $(2) 4 8 16 64 128 256
 endef
 
 define Image/BuildKernel/Initramfs
@@ -29,6 +29,9 @@ endef
 define PackageDir
   $(TMP_DIR)/.$(SCAN_TARGET): $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1)
   $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(SCAN_STAMP) $(foreach DEP,$(DEPS_$(SCAN_DIR)/$(2)/Makefile) $(SCAN_DEPS),$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(2)/$(DEP))))
+	MD5SUM=$$$$( { echo "$$(filter-out $(SCAN_STAMP),$$^) $(3)"; cat $$(filter-out $(SCAN_STAMP),$$^); } | (md5sum || md5) 2>/dev/null | awk '{print $$$$1}'); \
+	[ -f "$$@" -a "$$$$(cat "$$@.md5" 2>/dev/null)" = "$$$$MD5SUM" ] && { touch "$$@"; exit 0; }; \
+	rm -f "$$@.md5"; \
 	{ \
 		$$(call progress,Collecting $(SCAN_NAME) info: $(SCAN_DIR)/$(2)) \
 		echo Source-Makefile: $(SCAN_DIR)/$(2)/Makefile; \
@@ -40,7 +43,8 @@ define PackageDir
 			rm -f $$@; \
 		}; \
 		echo; \
-	} > $$@ || true
+	} > $$@ || true; \
+	[ -f "$$@" ] && echo "$$$$MD5SUM" > "$$@.md5" || true
 endef
 
 $(OVERRIDELIST):
@@ -99,4 +103,3 @@ $(TMP_DIR)/.$(SCAN_TARGET): $(TARGET_STAMP) $(SCAN_STAMP)
 
 FORCE:
 .PHONY: FORCE
-.NOTPARALLEL:
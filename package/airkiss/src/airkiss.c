@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/types.h>
@@ -14,6 +15,13 @@
 #include <linux/wireless.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netpacket/packet.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
 
 #include "airkiss.h"
 
@@ -25,9 +33,31 @@
 #endif
 #define RTPRIV_IOCTL_GET_80211_DATA	(SIOCIWFIRSTPRIV + 0x1D)
 #define RTPRIV_IOCTL_SHOW_CONNSTATUS	(SIOCIWFIRSTPRIV + 0x1B)
+#define RTPRIV_IOCTL_ELIAN		(SIOCIWFIRSTPRIV + 0x1B)	/* "iwpriv ra0 elian", in place of show_connstatus */
+#define ELIAN_CMD_SIZE			512				/* char args of the elian iwpriv */
 
 #define RX_80211_PKT_SIZE   (1500)
 #define RX_BUF_SIZE         (3000)
+#define RX_MON_BUF_SIZE     (4096)
+#define RX_BATCH            (32)	/* frames handed to airkiss per wakeup */
+#define RX_IDLE_MAX_MS      (8)		/* longest sleep on an empty elian queue */
+#define RX_LOCKED_WAIT_MS   (1000)
+
+#ifndef ARPHRD_IEEE80211_PRISM
+#define ARPHRD_IEEE80211_PRISM		802
+#endif
+#ifndef ARPHRD_IEEE80211_RADIOTAP
+#define ARPHRD_IEEE80211_RADIOTAP	803
+#endif
+#define PRISM_HEADER_LEN    (144)
+
+/* channel hopping: how long to stay on a channel, in ms */
+#define CHANNEL_MAX		13
+#define DWELL_QUIET_MS		50	/* nothing received there last time */
+#define DWELL_MS		100	/* traffic, or not visited yet */
+#define DWELL_CANDIDATE_MS	300	/* airkiss like frames seen there */
+#define DWELL_EXTEND_MS		50	/* more for each one seen now */
+#define DWELL_MAX_MS		600
 
 
 typedef struct _RX_PKT
@@ -36,28 +66,137 @@ typedef struct _RX_PKT
 	unsigned char  data[RX_80211_PKT_SIZE];
 }RX_PKT;
 
+typedef struct _CHANNEL_STAT
+{
+	unsigned int visits;
+	unsigned int frames;		/* during the last visit */
+	unsigned int candidates;	/* airkiss like frames, halved on every visit */
+}CHANNEL_STAT;
+
 
 airkiss_context_t akcontext;
 uint8_t cur_channel = 1;
 airkiss_config_t config;
 airkiss_result_t ak_result;
 
-int set_channel(int channel)
+static CHANNEL_STAT channel_stat[CHANNEL_MAX + 1];
+static uint8_t scan_channel;
+static int revisit;
+static long long dwell_start, dwell_end;
+static int locked;
+static long long start;
+static int mon_fd = -1;
+static int mon_type;
+
+static long long now_ms(void)
 {
-        char cmd[128] = "\0";
-	snprintf(cmd,128,"iwpriv ra0 elian set_ch=%d",channel);
-	system(cmd);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* what "iwpriv ra0 elian ..." does, without the fork and exec */
+static int elian_cmd(int socket_id, const char *fmt, ...)
+{
+	char cmd[ELIAN_CMD_SIZE];
+	struct iwreq wrq;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+
+	memset(&wrq, 0, sizeof(wrq));
+	strncpy(wrq.ifr_name, "ra0", IFNAMSIZ);
+	wrq.u.data.length = strlen(cmd) + 1;
+	wrq.u.data.pointer = cmd;
+	wrq.u.data.flags = 0;
+	return ioctl(socket_id, RTPRIV_IOCTL_ELIAN, &wrq);
+}
+
+int set_channel(int socket_id, int channel)
+{
+	if(elian_cmd(socket_id, "set_ch=%d", channel) != 0)
+	{
+		printf("error::set channel %d\n", channel);
+		return -1;
+	}
 	return 0;
 }
 
-void time_callback(int signo)
+/* airkiss sends its data in the lengths of broadcast or multicast data frames */
+static int is_candidate(const unsigned char *frame, unsigned int length)
 {
-        if(cur_channel >= 13)
-	    cur_channel = 1;
+	const unsigned char *da;
+
+	if(length < 24 || (frame[0] & 0x0c) != 0x08)
+		return 0;
+	da = ((frame[1] & 0x03) == 0x01) ? frame + 16 : frame + 4;	/* ToDS: DA is addr3 */
+	return da[0] & 0x01;
+}
+
+static void dwell_begin(void)
+{
+	CHANNEL_STAT *st = &channel_stat[cur_channel];
+	int dwell;
+
+	if(st->candidates)
+		dwell = DWELL_CANDIDATE_MS;
+	else if(st->visits && !st->frames)
+		dwell = DWELL_QUIET_MS;
 	else
-	    cur_channel ++;
-	set_channel(cur_channel);
+		dwell = DWELL_MS;
+
+	st->visits++;
+	st->frames = 0;
+	st->candidates /= 2;
+	dwell_start = now_ms();
+	dwell_end = dwell_start + dwell;
+}
+
+static void dwell_frame(const unsigned char *frame, unsigned int length)
+{
+	CHANNEL_STAT *st = &channel_stat[cur_channel];
+
+	st->frames++;
+	if(is_candidate(frame, length))
+	{
+		st->candidates++;
+		dwell_end += DWELL_EXTEND_MS;
+		if(dwell_end > dwell_start + DWELL_MAX_MS)
+			dwell_end = dwell_start + DWELL_MAX_MS;
+	}
+}
+
+/* round robin over all channels, with every other hop going back to the
+ * channel with the most airkiss like frames, if there is one */
+static int next_channel(void)
+{
+	int ch, best = 0;
+
+	for(ch = 1; ch <= CHANNEL_MAX; ch++)
+		if(channel_stat[ch].candidates > channel_stat[best].candidates)
+			best = ch;
+
+	if(best && !revisit && best != cur_channel)
+	{
+		revisit = 1;
+		return best;
+	}
+	revisit = 0;
+	scan_channel = scan_channel % CHANNEL_MAX + 1;
+	if(scan_channel == cur_channel)
+		scan_channel = scan_channel % CHANNEL_MAX + 1;
+	return scan_channel;
+}
+
+static void hop_channel(int socket_id)
+{
+	cur_channel = next_channel();
+	set_channel(socket_id, cur_channel);
 	airkiss_change_channel(&akcontext);
+	dwell_begin();
 }
 
 static void exit_airkiss(int sig)
@@ -66,13 +205,13 @@ static void exit_airkiss(int sig)
 	int    socket_id;
 	struct   iwreq wrq;
 	char data[64];
-	system("iwpriv ra0 elian monitor_off");
 	socket_id = socket(AF_INET, SOCK_DGRAM, 0);
 	if(socket_id < 0)
 	{
 		printf("error::Open socket error!\n\n");
 		exit(1);
 	}
+	elian_cmd(socket_id, "monitor_off");
 	memset(data, 0x00, 64);
 	strcpy(data,"mangop");
 	strcpy(wrq.ifr_name, "ra0");
@@ -98,16 +237,202 @@ static void signal_handle(void)
     signal(SIGBUS,  &exit_airkiss);//bus error/**/
 }
 
-int main(int argc, char* argv[])
+/* takes one frame to airkiss, returns 1 when done */
+static int handle_frame(const unsigned char *frame, unsigned int length)
 {
-	int length;
+	int ret;
+
+	if(!locked)
+		dwell_frame(frame, length);
+	ret = airkiss_recv(&akcontext, frame, length);
+	if(ret == AIRKISS_STATUS_CHANNEL_LOCKED)
+	{
+		locked = 1;
+		printf("channel %d locked after %lld ms\n", cur_channel, now_ms() - start);
+	}
+	else if(ret == AIRKISS_STATUS_COMPLETE)
+	{
+		if(airkiss_get_result(&akcontext , &ak_result) < 0)
+			printf("airkiss get result fail\n");
+		else
+			printf("result ok!ssid is %s , key is %s\n" , ak_result.ssid , ak_result.pwd);
+		return 1;
+	}
+	return 0;
+}
+
+/* the elian session queue can only be polled: take all that is queued at
+ * once, and sleep a little longer each time it was found empty */
+static int rx_elian(int socket_id, int wait_ms)
+{
+	static int idle_ms = 1;
+	struct iwreq wrq;
+	char data[RX_BUF_SIZE];
 	RX_PKT * mp;
+	int n;
+
+	for(n = 0; n < RX_BATCH; n++)
+	{
+		strcpy(data,"mangor");
+		strcpy(wrq.ifr_name, "ra0");
+		wrq.u.data.length = RX_BUF_SIZE;
+		wrq.u.data.pointer = data;
+		wrq.u.data.flags = 0;
+		if(ioctl(socket_id, RTPRIV_IOCTL_GET_80211_DATA, &wrq) != 0)
+			break;
+		mp = (RX_PKT *)wrq.u.data.pointer;
+		if(handle_frame(mp->data, mp->length))
+			return -1;
+	}
+	if(n)
+	{
+		idle_ms = 1;
+		return n;
+	}
+
+	usleep((idle_ms < wait_ms ? idle_ms : wait_ms) * 1000);
+	if(idle_ms < RX_IDLE_MAX_MS)
+		idle_ms *= 2;
+	return 0;
+}
+
+/* data frames only, after the radiotap header (of little endian length) */
+static struct sock_filter mon_filter_radiotap[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 3),
+	BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 2),
+	BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+	BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0c),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x08, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/* data frames only, after a fixed size header (prism or none) */
+static struct sock_filter mon_filter_fixed[] = {
+	BPF_STMT(BPF_LDX | BPF_IMM, 0),
+	BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+	BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0c),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x08, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/* a monitor netdev of the driver (iwpriv ra0 set MonitorMode=...) can be
+ * slept on: frames come through a packet socket, filtered in the kernel */
+static int mon_open(const char *ifname)
+{
+	struct ifreq ifr;
+	struct sockaddr_ll sll;
+	struct sock_fprog prog;
+
+	mon_fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if(mon_fd < 0)
+	{
+		printf("error::Open packet socket error!\n");
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if(ioctl(mon_fd, SIOCGIFHWADDR, &ifr) < 0)
+		goto fail;
+	mon_type = ifr.ifr_hwaddr.sa_family;
+	if(ioctl(mon_fd, SIOCGIFINDEX, &ifr) < 0)
+		goto fail;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifr.ifr_ifindex;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	if(bind(mon_fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+		goto fail;
+
+	switch(mon_type)
+	{
+	case ARPHRD_IEEE80211_RADIOTAP:
+		prog.len = sizeof(mon_filter_radiotap) / sizeof(mon_filter_radiotap[0]);
+		prog.filter = mon_filter_radiotap;
+		break;
+	case ARPHRD_IEEE80211_PRISM:
+		mon_filter_fixed[0].k = PRISM_HEADER_LEN;
+		/* fall through */
+	case ARPHRD_IEEE80211:
+		prog.len = sizeof(mon_filter_fixed) / sizeof(mon_filter_fixed[0]);
+		prog.filter = mon_filter_fixed;
+		break;
+	default:
+		printf("error::%s is not a monitor interface\n", ifname);
+		goto fail;
+	}
+	if(setsockopt(mon_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+		printf("no socket filter on %s, taking all frames\n", ifname);
+
+	printf("receiving on %s\n", ifname);
+	return 0;
+
+fail:
+	printf("error::monitor interface %s: %s\n", ifname, strerror(errno));
+	close(mon_fd);
+	mon_fd = -1;
+	return -1;
+}
+
+/* sleeps until frames arrive or wait_ms passed, then takes all queued */
+static int rx_monitor(int wait_ms)
+{
+	unsigned char buf[RX_MON_BUF_SIZE];
+	struct pollfd pfd;
+	int n, len, hdr;
+
+	pfd.fd = mon_fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, wait_ms) <= 0)
+		return 0;
+
+	for(n = 0; n < RX_BATCH; n++)
+	{
+		len = recv(mon_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if(len <= 0)
+			break;
+		if(mon_type == ARPHRD_IEEE80211_RADIOTAP)
+			hdr = len >= 4 ? buf[2] | (buf[3] << 8) : len;
+		else if(mon_type == ARPHRD_IEEE80211_PRISM)
+			hdr = PRISM_HEADER_LEN;
+		else
+			hdr = 0;
+		if(len - hdr < 24)
+			continue;
+		if(handle_frame(buf + hdr, len - hdr))
+			return -1;
+	}
+	return n;
+}
+
+int main(int argc, char* argv[])
+{
 	int ret= -1;
-	int i;
+	int opt, wait_ms;
+	char *mon_ifname = NULL;
         int socket_id;
         struct iwreq wrq;
 	char data[RX_BUF_SIZE];
-	struct itimerval tick;
+
+	while((opt = getopt(argc, argv, "i:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'i':
+			mon_ifname = optarg;
+			break;
+		default:
+			printf("Usage: %s [-i <monitor interface>]\n", argv[0]);
+			return -1;
+		}
+	}
 
 	signal_handle();
 
@@ -129,8 +454,10 @@ int main(int argc, char* argv[])
 	        printf("error::Open socket error!\n");
 		return -1;
 	}
+	if(mon_ifname && mon_open(mon_ifname) < 0)
+		printf("falling back to the elian queue\n");
 	printf("start monitor mode\n");
-	system("iwpriv ra0 elian monitor_on");
+	elian_cmd(socket_id, "monitor_on");
 
 
 	memset(data, 0x00, RX_BUF_SIZE);
@@ -143,70 +470,30 @@ int main(int argc, char* argv[])
 	if(ret != 0)
 	{
 		printf("error::start monitor mode\n\n");
-		system("iwpriv ra0 elian monitor_off");
+		elian_cmd(socket_id, "monitor_off");
 		return -1;
 	}
 
-	signal(SIGALRM, time_callback);
-
-	memset(&tick, 0, sizeof(tick));
-
-	tick.it_interval.tv_sec = 0;
-	tick.it_interval.tv_usec = 100000;//100000;
-	tick.it_value.tv_sec = 0;
-	tick.it_value.tv_usec = 100000;//100000;
-	if(setitimer(ITIMER_REAL, &tick, NULL) < 0)
-	    printf("Set timer failed!\n");
+	start = now_ms();
+	hop_channel(socket_id);
     while(1)
     {
-	memset(data, 0x00, RX_BUF_SIZE);
-	strcpy(data,"mangor");
-	strcpy(wrq.ifr_name, "ra0");
-	wrq.u.data.length = RX_BUF_SIZE;
-	wrq.u.data.pointer = data;
-	wrq.u.data.flags = 0;
-	ret = ioctl(socket_id, RTPRIV_IOCTL_GET_80211_DATA, &wrq);
-	if(ret != 0)
-	{
-	                usleep(1000);
-	                continue;
-	}
-	else
-	{
-	    mp = (RX_PKT *)wrq.u.data.pointer;
-#if 0
-	    for(i=0;i<((mp->length > 24)? 24:mp->length);i++)
-	    {
-		printf("%02X ",mp->data[i]);
-	    }
-	    printf("\n");
-#endif
-	                ret = airkiss_recv(&akcontext,mp->data,mp->length);
-			if(ret == AIRKISS_STATUS_CHANNEL_LOCKED)
-			{
-			tick.it_value.tv_usec = 0;
-			tick.it_interval.tv_usec = 0;
-			if(setitimer(ITIMER_REAL, &tick, NULL) < 0)
-			    printf("Set timer failed!\n");
-			printf("channel locked\n");
-			}
-			else if(ret == AIRKISS_STATUS_COMPLETE)
-			{
-			if(airkiss_get_result(&akcontext , &ak_result) < 0)
-			    {
-			        printf("airkiss get result fail\n");
-				break;
-			    }
-			    else
-			    {
-			        printf("result ok!ssid is %s , key is %s\n" , ak_result.ssid , ak_result.pwd);
-				break;
-			    }
-			}
+	if(!locked && now_ms() >= dwell_end)
+		hop_channel(socket_id);
 
-	}
+	wait_ms = locked ? RX_LOCKED_WAIT_MS : (int)(dwell_end - now_ms());
+	if(wait_ms < 0)
+		wait_ms = 0;
+	if(mon_fd >= 0)
+		ret = rx_monitor(wait_ms);
+	else
+		ret = rx_elian(socket_id, wait_ms);
+	if(ret < 0)
+		break;
     }
-	system("iwpriv ra0 elian monitor_off");
+	if(mon_fd >= 0)
+		close(mon_fd);
+	elian_cmd(socket_id, "monitor_off");
 	memset(data, 0x00, RX_BUF_SIZE);
 	strcpy(data,"mangop");
 	strcpy(wrq.ifr_name, "ra0");
@@ -357,8 +357,9 @@ static int ag71xx_recv(struct eth_device *dev)
 {
     struct ag71xx *ag = (struct ag71xx *) dev->priv;
 	struct ag71xx_ring *ring = &ag->rx_ring;
+	int done;
 
-    for (;;) {
+	for (done = 0; done < AG71XX_RX_RING_SIZE; done++) {
 		unsigned int i = ring->curr % AG71XX_RX_RING_SIZE;
 		struct ag71xx_desc *desc = ring->buf[i].desc;
 		int pktlen;
@@ -375,7 +376,9 @@ static int ag71xx_recv(struct eth_device *dev)
 		NetReceive(NetRxPackets[i] , pktlen);
 		flush_cache( (u32) NetRxPackets[i], PKTSIZE_ALIGN);
 
+		/* hand the buffer straight back and ack it in the packet counter */
         ring->buf[i].desc->ctrl = DESC_EMPTY;
+		ag71xx_wr(ag, AG71XX_REG_RX_STATUS, RX_STATUS_PR);
 		ring->curr++;
 		if (ring->curr >= AG71XX_RX_RING_SIZE){
 			ring->curr = 0;
@@ -383,6 +386,14 @@ static int ag71xx_recv(struct eth_device *dev)
 
     }
 
+	/*
+	 * The DMA engine stops when it runs into a descriptor that is still
+	 * owned by us; clear the overflow and let it continue with the ones
+	 * recycled above.
+	 */
+	if (ag71xx_rr(ag, AG71XX_REG_RX_STATUS) & RX_STATUS_OF)
+		ag71xx_wr(ag, AG71XX_REG_RX_STATUS, RX_STATUS_OF);
+
 	if ((ag71xx_rr(ag, AG71XX_REG_RX_CTRL) & RX_CTRL_RXE) == 0) {
 		/* start RX engine */
 		ag71xx_wr(ag, AG71XX_REG_RX_CTRL, RX_CTRL_RXE);
@@ -42,11 +42,15 @@
 #define AG71XX_RX_PKT_SIZE	\
 	(AG71XX_RX_PKT_RESERVE + ETH_HLEN + ETH_FRAME_LEN + ETH_FCS_LEN)
 
-#ifndef CONFIG_SYS_RX_ETH_BUFFER
+/*
+ * send() waits for every frame to go out, so a short TX ring is enough.
+ * The RX ring maps 1:1 onto NetRxPackets[] and should be deep enough to
+ * absorb a whole TFTP window while the CPU writes the previous one away.
+ */
 #define AG71XX_TX_RING_SIZE	4
+#ifndef CONFIG_SYS_RX_ETH_BUFFER
 #define AG71XX_RX_RING_SIZE	4
 #else
-#define AG71XX_TX_RING_SIZE	CONFIG_SYS_RX_ETH_BUFFER
 #define AG71XX_RX_RING_SIZE	CONFIG_SYS_RX_ETH_BUFFER
 #endif
 
@@ -67,7 +67,8 @@
 
 /* Net support */
 #define CONFIG_ETHADDR_ADDR     0xbfc0fff8
-#define CONFIG_SYS_RX_ETH_BUFFER  	16
+#define CONFIG_SYS_RX_ETH_BUFFER  	64
+#define CONFIG_TFTP_BLOCKSIZE	1468
 #define CONFIG_AG71XX
 #define CONFIG_AG71XX_PORTS     { 1, 1 }
 #define CONFIG_AG71XX_MII0_IIF  MII0_CTRL_IF_RGMII
@@ -21,6 +21,7 @@
  * MA 02111-1307 USA
  */
 #include <common.h>
+#include <part.h>
 #include <asm/arch/clock.h>
 
 /**
@@ -388,6 +389,26 @@ static inline int wait_sata_command_not_busy(int device)
 	return status;
 }
 
+static void send_command(int device)
+{
+	u32 command;
+
+	wait_sata_command_not_busy(device);
+	command = *(sata_regs_base[device] + SATA_COMMAND_OFF);
+	command &= ~SATA_OPCODE_MASK;
+	command |= SATA_CMD_WRITE_TO_ORB_REGS;
+	xfer_wr_shadow_to_orbs(device);
+	wait_sata_command_not_busy(device);
+	*(sata_regs_base[device] + SATA_COMMAND_OFF) = command;
+	if (!wait_no_error(device)) {
+		printf("ide_outb() Wait for ATA no-error timed-out\n");
+	}
+}
+
+#ifdef CONFIG_SYS_IDE_PLX_READAHEAD
+static int readahead_command(int device, unsigned char cmd);
+#endif
+
 void ide_outb(int device, int port, unsigned char val)
 {
 	typedef enum send_method {
@@ -480,16 +501,13 @@ void ide_outb(int device, int port, unsigned char val)
 	u32 command;
 	switch (send_regs) {
 	case SEND_CMD:
-		wait_sata_command_not_busy(device);
-		command = *(sata_regs_base[device] + SATA_COMMAND_OFF);
-		command &= ~SATA_OPCODE_MASK;
-		command |= SATA_CMD_WRITE_TO_ORB_REGS;
-		xfer_wr_shadow_to_orbs(device);
-		wait_sata_command_not_busy(device);
-		*(sata_regs_base[device] + SATA_COMMAND_OFF) = command;
-		if (!wait_no_error(device)) {
-			printf("ide_outb() Wait for ATA no-error timed-out\n");
+#ifdef CONFIG_SYS_IDE_PLX_READAHEAD
+		/* Sequential reads may be satisfied without touching the disk */
+		if (readahead_command(device, val)) {
+			break;
 		}
+#endif
+		send_command(device);
 		break;
 	case SEND_CTL:
 		wait_sata_command_not_busy(device);
@@ -832,7 +850,7 @@ void ide_output_data(int device, const ulong *sect_buf, int words)
  * memory.
  *
  */
-static void sata_bug_6320_workaround(int port, ulong *candidate)
+static void sata_bug_6320_workaround(int port, ulong *candidate, int total_len)
 {
 	int is_read;
 	int quads_transferred;
@@ -856,7 +874,6 @@ static void sata_bug_6320_workaround(int port, ulong *candidate)
 			"sector_quads_remaining %d, port %d\n",
 			quads_transferred, sector_quads_remaining, port);
 
-		int total_len = ATA_SECT_SIZE;
 		ulong *sata_data_ptr = (void*) (
 			port ? SATA_DATA_MUX_RAM1 : SATA_DATA_MUX_RAM0)
 			+ ((total_len - 8) % 2048);
@@ -867,36 +884,202 @@ static void sata_bug_6320_workaround(int port, ulong *candidate)
 }
 
 
-void ide_input_data(int device, ulong *sect_buf, int words)
+/**
+ * Receive words of data for the command just issued on the device
+ * @returns An int which is zero on error
+ */
+static int input_data(int device, ulong *buf, int words)
 {
-	/* Only permit accesses to disks found to be present during ide_preinit() */
-	if (!disk_present[device]) {
-		return;
-	}
-
-	/* Select the required internal SATA drive */
-	device_select(device);
+	int status = 1;
 
 	/* Start the DMA channel receiving data from the SATA core into the passed buffer */
-	dma_start_read(sect_buf, words << 2);
+	dma_start_read(buf, words << 2);
 
 	/* Sata core should finish before DMA */
 	if (wait_not_busy(device, 30)) {
 		printf("Timed out of wait for SATA device %d to have BUSY clear\n",
 			device);
+		status = 0;
 	}
 	if (!wait_no_error(device)) {
 		printf("oxnas_sata_output_data() Wait for ATA no-error timed-out\n");
+		status = 0;
 	}
 
 	/* Wait for DMA to finish */
 	if (!wait_dma_not_busy(device)) {
 		printf("Timed out of wait for DMA channel for SATA device %d to have in-progress clear\n",
 			device);
+		status = 0;
 	}
 
-	if (words == ATA_SECTORWORDS)
-		sata_bug_6320_workaround(device, sect_buf + words - 2);
+	/* Only the tail of the whole transfer needs checking, however many
+	 sectors it spans */
+	if (!(words % ATA_SECTORWORDS))
+		sata_bug_6320_workaround(device, buf + words - 2, words << 2);
+
+	return status;
+}
+
+#ifdef CONFIG_SYS_IDE_PLX_READAHEAD
+/**
+ * The generic IDE code issues one READ command per sector, so loading a
+ * kernel costs a command round trip and a DMA setup for every 512 bytes.
+ * Instead, a single sector read is turned into one command fetching up to
+ * CONFIG_SYS_IDE_PLX_READAHEAD sectors with a single DMA transfer, and the
+ * sequential reads that follow are answered from that buffer.
+ */
+#define RA_SECTORS	CONFIG_SYS_IDE_PLX_READAHEAD
+
+#if RA_SECTORS > 256
+#error "CONFIG_SYS_IDE_PLX_READAHEAD must fit a 28-bit READ sector count"
+#endif
+
+static ulong ra_buf[RA_SECTORS * ATA_SECTORWORDS];
+static int ra_device = -1;
+static unsigned long long ra_lba;
+static unsigned long ra_count;
+
+/* Sector of ra_buf to hand out on the next ide_input_data(), if any */
+static ulong *ra_pending[CONFIG_SYS_IDE_MAXDEVICE];
+
+static unsigned long long shadow_lba(int device, int ext)
+{
+	unsigned long long lba;
+
+	lba = wr_sata_orb3[device] & 0xFFFFFFUL;
+	if (ext) {
+		lba |= (unsigned long long) ((wr_sata_orb3[device]
+			>> SATA_HOB_LBAH_BIT) & 0xFFUL) << 24;
+		lba |= (unsigned long long) (wr_sata_orb4[device]
+			& 0xFFFFUL) << 32;
+	} else {
+		lba |= (unsigned long long) ((wr_sata_orb1[device]
+			>> SATA_DEVICE_BIT) & 0x0FUL) << 24;
+	}
+
+	return lba;
+}
+
+static unsigned long shadow_nsect(int device, int ext)
+{
+	unsigned long nsect;
+
+	nsect = (wr_sata_orb2[device] >> SATA_NSECT_BIT) & 0xFFUL;
+	if (ext) {
+		nsect |= ((wr_sata_orb2[device] >> SATA_HOB_NSECT_BIT)
+			& 0xFFUL) << 8;
+	}
+
+	return nsect;
+}
+
+static void set_shadow_nsect(int device, int ext, unsigned long nsect)
+{
+	wr_sata_orb2[device] &= ~(0xFFUL << SATA_NSECT_BIT);
+	wr_sata_orb2[device] |= (nsect & 0xFFUL) << SATA_NSECT_BIT;
+	if (ext) {
+		wr_sata_orb2[device] &= ~(0xFFUL << SATA_HOB_NSECT_BIT);
+		wr_sata_orb2[device] |= ((nsect >> 8) & 0xFFUL)
+			<< SATA_HOB_NSECT_BIT;
+	}
+}
+
+/**
+ * Called with the shadow registers loaded for a command about to be sent
+ * @returns An int which is non-zero if the command has been dealt with and
+ * must not be sent to the disk
+ */
+static int readahead_command(int device, unsigned char cmd)
+{
+	block_dev_desc_t *dev_desc;
+	unsigned long long lba;
+	unsigned long count;
+	int ext = 0;
+
+	ra_pending[device] = NULL;
+
+	switch (cmd) {
+	case ATA_CMD_WRITE:
+#ifdef CONFIG_LBA48
+	case ATA_CMD_WRITE_EXT:
+#endif
+		if (ra_device == device) {
+			ra_device = -1;
+		}
+		return 0;
+#ifdef CONFIG_LBA48
+	case ATA_CMD_READ_EXT:
+		ext = 1;
+		/* fall through */
+#endif
+	case ATA_CMD_READ:
+		break;
+	default:
+		return 0;
+	}
+
+	if (shadow_nsect(device, ext) != 1) {
+		return 0;
+	}
+
+	lba = shadow_lba(device, ext);
+	if (ra_device == device && lba >= ra_lba && lba < ra_lba + ra_count) {
+		ra_pending[device] = ra_buf + (lba - ra_lba) * ATA_SECTORWORDS;
+		return 1;
+	}
+	ra_device = -1;
+
+	/* Never read beyond the end of the disk */
+	dev_desc = ide_get_dev(device);
+	if (!dev_desc || lba >= dev_desc->lba) {
+		return 0;
+	}
+	count = RA_SECTORS;
+	if (dev_desc->lba - lba < count) {
+		count = dev_desc->lba - lba;
+	}
+	if (count < 2) {
+		return 0;
+	}
+
+	set_shadow_nsect(device, ext, count);
+	send_command(device);
+	if (!input_data(device, ra_buf, count * ATA_SECTORWORDS)) {
+		/* Let the single sector command go to the disk as asked */
+		set_shadow_nsect(device, ext, 1);
+		return 0;
+	}
+	set_shadow_nsect(device, ext, 1);
+
+	ra_device = device;
+	ra_lba = lba;
+	ra_count = count;
+	ra_pending[device] = ra_buf;
+
+	return 1;
+}
+#endif
+
+void ide_input_data(int device, ulong *sect_buf, int words)
+{
+	/* Only permit accesses to disks found to be present during ide_preinit() */
+	if (!disk_present[device]) {
+		return;
+	}
+
+#ifdef CONFIG_SYS_IDE_PLX_READAHEAD
+	if (ra_pending[device]) {
+		memcpy(sect_buf, ra_pending[device], words << 2);
+		ra_pending[device] = NULL;
+		return;
+	}
+#endif
+
+	/* Select the required internal SATA drive */
+	device_select(device);
+
+	input_data(device, sect_buf, words);
 }
 
 static u32 scr_read(int device, unsigned int sc_reg)
@@ -56,6 +56,7 @@
 #define CONFIG_SYS_IDE_MAXBUS		1
 #define CONFIG_IDE_PREINIT
 #define CONFIG_LBA48
+#define CONFIG_SYS_IDE_PLX_READAHEAD	256	/* sectors per READ command */
 
 /* nand */
 #define CONFIG_NAND
@@ -10,96 +10,110 @@
 
 #include "blackbody.h"
 
+// X-list of the curve: every table below is generated from it by the compiler
+#define BB_CURVE( P ) \
+    P( 1000, 0.649900, 0.347400, 255, 51, 0 ) \
+    P( 1100, 0.636100, 0.359400, 255, 69, 0 ) \
+    P( 1200, 0.622600, 0.370300, 255, 82, 0 ) \
+    P( 1300, 0.609500, 0.380100, 255, 93, 0 ) \
+    P( 1400, 0.596600, 0.388700, 255, 102, 0 ) \
+    P( 1500, 0.584100, 0.396200, 255, 111, 0 ) \
+    P( 1600, 0.572000, 0.402500, 255, 118, 0 ) \
+    P( 1700, 0.560100, 0.407600, 255, 124, 0 ) \
+    P( 1800, 0.548600, 0.411800, 255, 130, 0 ) \
+    P( 1900, 0.537500, 0.415000, 255, 135, 0 ) \
+    P( 2000, 0.526700, 0.417300, 255, 141, 11 ) \
+    P( 2100, 0.516200, 0.418800, 255, 146, 29 ) \
+    P( 2200, 0.506200, 0.419600, 255, 152, 41 ) \
+    P( 2300, 0.496500, 0.419800, 255, 157, 51 ) \
+    P( 2400, 0.487200, 0.419400, 255, 162, 60 ) \
+    P( 2500, 0.478200, 0.418600, 255, 166, 69 ) \
+    P( 2600, 0.469600, 0.417300, 255, 170, 77 ) \
+    P( 2700, 0.461400, 0.415800, 255, 174, 84 ) \
+    P( 2800, 0.453500, 0.413900, 255, 178, 91 ) \
+    P( 2900, 0.446000, 0.411800, 255, 182, 98 ) \
+    P( 3000, 0.438800, 0.409500, 255, 185, 105 ) \
+    P( 3100, 0.432000, 0.407000, 255, 189, 111 ) \
+    P( 3200, 0.425400, 0.404400, 255, 192, 118 ) \
+    P( 3300, 0.419200, 0.401800, 255, 195, 124 ) \
+    P( 3400, 0.413200, 0.399000, 255, 198, 130 ) \
+    P( 3500, 0.407500, 0.396200, 255, 201, 135 ) \
+    P( 3600, 0.402100, 0.393400, 255, 203, 141 ) \
+    P( 3700, 0.396900, 0.390500, 255, 206, 146 ) \
+    P( 3800, 0.391900, 0.387700, 255, 208, 151 ) \
+    P( 3900, 0.387200, 0.384900, 255, 211, 156 ) \
+    P( 4000, 0.382700, 0.382000, 255, 213, 161 ) \
+    P( 4100, 0.378400, 0.379300, 255, 215, 166 ) \
+    P( 4200, 0.374300, 0.376500, 255, 217, 171 ) \
+    P( 4300, 0.370400, 0.373800, 255, 219, 175 ) \
+    P( 4400, 0.366600, 0.371100, 255, 221, 180 ) \
+    P( 4500, 0.363100, 0.368500, 255, 223, 184 ) \
+    P( 4600, 0.359600, 0.365900, 255, 225, 188 ) \
+    P( 4700, 0.356300, 0.363400, 255, 226, 192 ) \
+    P( 4800, 0.353200, 0.360900, 255, 228, 196 ) \
+    P( 4900, 0.350200, 0.358500, 255, 229, 200 ) \
+    P( 5000, 0.347300, 0.356100, 255, 231, 204 ) \
+    P( 5100, 0.344600, 0.353800, 255, 232, 208 ) \
+    P( 5200, 0.341900, 0.351600, 255, 234, 211 ) \
+    P( 5300, 0.339400, 0.349400, 255, 235, 215 ) \
+    P( 5400, 0.336900, 0.347200, 255, 237, 218 ) \
+    P( 5500, 0.334600, 0.345100, 255, 238, 222 ) \
+    P( 5600, 0.332300, 0.343100, 255, 239, 225 ) \
+    P( 5700, 0.330200, 0.341100, 255, 240, 228 ) \
+    P( 5800, 0.328100, 0.339200, 255, 241, 231 ) \
+    P( 5900, 0.326100, 0.337300, 255, 243, 234 ) \
+    P( 6000, 0.324200, 0.335500, 255, 244, 237 ) \
+    P( 6100, 0.322300, 0.333700, 255, 245, 240 ) \
+    P( 6200, 0.320500, 0.331900, 255, 246, 243 ) \
+    P( 6300, 0.318800, 0.330200, 255, 247, 245 ) \
+    P( 6400, 0.317100, 0.328600, 255, 248, 248 ) \
+    P( 6500, 0.315500, 0.327000, 255, 249, 251 ) \
+    P( 6600, 0.314000, 0.325400, 255, 249, 253 ) \
+    P( 6700, 0.312500, 0.323800, 254, 250, 255 ) \
+    P( 6800, 0.311000, 0.322400, 252, 248, 255 ) \
+    P( 6900, 0.309700, 0.320900, 250, 247, 255 ) \
+    P( 7000, 0.308300, 0.319500, 247, 245, 255 ) \
+    P( 7100, 0.307000, 0.318100, 245, 244, 255 ) \
+    P( 7200, 0.305800, 0.316800, 243, 243, 255 ) \
+    P( 7300, 0.304500, 0.315400, 241, 241, 255 ) \
+    P( 7400, 0.303400, 0.314200, 239, 240, 255 ) \
+    P( 7500, 0.302200, 0.312900, 238, 239, 255 ) \
+    P( 7600, 0.301100, 0.311700, 236, 238, 255 ) \
+    P( 7700, 0.300000, 0.310500, 234, 237, 255 ) \
+    P( 7800, 0.299000, 0.309400, 233, 236, 255 ) \
+    P( 7900, 0.298000, 0.308200, 231, 234, 255 ) \
+    P( 8000, 0.297000, 0.307100, 229, 233, 255 ) \
+    P( 8100, 0.296100, 0.306100, 228, 233, 255 ) \
+    P( 8200, 0.295200, 0.305000, 227, 232, 255 ) \
+    P( 8300, 0.294300, 0.304000, 225, 231, 255 ) \
+    P( 8400, 0.293400, 0.303000, 224, 230, 255 ) \
+    P( 8500, 0.292600, 0.302000, 223, 229, 255 ) \
+    P( 8600, 0.291700, 0.301100, 221, 228, 255 ) \
+    P( 8700, 0.291000, 0.300100, 220, 227, 255 ) \
+    P( 8800, 0.290200, 0.299200, 219, 226, 255 ) \
+    P( 8900, 0.289400, 0.298300, 218, 226, 255 ) \
+    P( 9000, 0.288700, 0.297500, 217, 225, 255 ) \
+    P( 9100, 0.288000, 0.296600, 216, 224, 255 ) \
+    P( 9200, 0.287300, 0.295800, 215, 223, 255 ) \
+    P( 9300, 0.286600, 0.295000, 214, 223, 255 ) \
+    P( 9400, 0.286000, 0.294200, 213, 222, 255 ) \
+    P( 9500, 0.285300, 0.293400, 212, 221, 255 ) \
+    P( 9600, 0.284700, 0.292700, 211, 221, 255 ) \
+    P( 9700, 0.284100, 0.291900, 210, 220, 255 ) \
+    P( 9800, 0.283500, 0.291200, 209, 220, 255 ) \
+    P( 9900, 0.282900, 0.290500, 208, 219, 255 ) \
+    P( 10000, 0.282400, 0.289800, 207, 218, 255 )
+
+#define BB_POINT( k, x, y, r, g, b )    { k, x, y, r, g, b },
+
+// Done in float like (int)( bb_curve[i].x * BB_MAX_XY ), but folded at compile time
+#define BB_XY( k, x, y, r, g, b )       { (unsigned short)( (float)(x) * (float)BB_MAX_XY ), \
+                                          (unsigned short)( (float)(y) * (float)BB_MAX_XY ) },
+
 bb_point bb_curve[] = {
-    { 1000, 0.649900, 0.347400, 255, 51, 0 },
-    { 1100, 0.636100, 0.359400, 255, 69, 0 },
-    { 1200, 0.622600, 0.370300, 255, 82, 0 },
-    { 1300, 0.609500, 0.380100, 255, 93, 0 },
-    { 1400, 0.596600, 0.388700, 255, 102, 0 },
-    { 1500, 0.584100, 0.396200, 255, 111, 0 },
-    { 1600, 0.572000, 0.402500, 255, 118, 0 },
-    { 1700, 0.560100, 0.407600, 255, 124, 0 },
-    { 1800, 0.548600, 0.411800, 255, 130, 0 },
-    { 1900, 0.537500, 0.415000, 255, 135, 0 },
-    { 2000, 0.526700, 0.417300, 255, 141, 11 },
-    { 2100, 0.516200, 0.418800, 255, 146, 29 },
-    { 2200, 0.506200, 0.419600, 255, 152, 41 },
-    { 2300, 0.496500, 0.419800, 255, 157, 51 },
-    { 2400, 0.487200, 0.419400, 255, 162, 60 },
-    { 2500, 0.478200, 0.418600, 255, 166, 69 },
-    { 2600, 0.469600, 0.417300, 255, 170, 77 },
-    { 2700, 0.461400, 0.415800, 255, 174, 84 },
-    { 2800, 0.453500, 0.413900, 255, 178, 91 },
-    { 2900, 0.446000, 0.411800, 255, 182, 98 },
-    { 3000, 0.438800, 0.409500, 255, 185, 105 },
-    { 3100, 0.432000, 0.407000, 255, 189, 111 },
-    { 3200, 0.425400, 0.404400, 255, 192, 118 },
-    { 3300, 0.419200, 0.401800, 255, 195, 124 },
-    { 3400, 0.413200, 0.399000, 255, 198, 130 },
-    { 3500, 0.407500, 0.396200, 255, 201, 135 },
-    { 3600, 0.402100, 0.393400, 255, 203, 141 },
-    { 3700, 0.396900, 0.390500, 255, 206, 146 },
-    { 3800, 0.391900, 0.387700, 255, 208, 151 },
-    { 3900, 0.387200, 0.384900, 255, 211, 156 },
-    { 4000, 0.382700, 0.382000, 255, 213, 161 },
-    { 4100, 0.378400, 0.379300, 255, 215, 166 },
-    { 4200, 0.374300, 0.376500, 255, 217, 171 },
-    { 4300, 0.370400, 0.373800, 255, 219, 175 },
-    { 4400, 0.366600, 0.371100, 255, 221, 180 },
-    { 4500, 0.363100, 0.368500, 255, 223, 184 },
-    { 4600, 0.359600, 0.365900, 255, 225, 188 },
-    { 4700, 0.356300, 0.363400, 255, 226, 192 },
-    { 4800, 0.353200, 0.360900, 255, 228, 196 },
-    { 4900, 0.350200, 0.358500, 255, 229, 200 },
-    { 5000, 0.347300, 0.356100, 255, 231, 204 },
-    { 5100, 0.344600, 0.353800, 255, 232, 208 },
-    { 5200, 0.341900, 0.351600, 255, 234, 211 },
-    { 5300, 0.339400, 0.349400, 255, 235, 215 },
-    { 5400, 0.336900, 0.347200, 255, 237, 218 },
-    { 5500, 0.334600, 0.345100, 255, 238, 222 },
-    { 5600, 0.332300, 0.343100, 255, 239, 225 },
-    { 5700, 0.330200, 0.341100, 255, 240, 228 },
-    { 5800, 0.328100, 0.339200, 255, 241, 231 },
-    { 5900, 0.326100, 0.337300, 255, 243, 234 },
-    { 6000, 0.324200, 0.335500, 255, 244, 237 },
-    { 6100, 0.322300, 0.333700, 255, 245, 240 },
-    { 6200, 0.320500, 0.331900, 255, 246, 243 },
-    { 6300, 0.318800, 0.330200, 255, 247, 245 },
-    { 6400, 0.317100, 0.328600, 255, 248, 248 },
-    { 6500, 0.315500, 0.327000, 255, 249, 251 },
-    { 6600, 0.314000, 0.325400, 255, 249, 253 },
-    { 6700, 0.312500, 0.323800, 254, 250, 255 },
-    { 6800, 0.311000, 0.322400, 252, 248, 255 },
-    { 6900, 0.309700, 0.320900, 250, 247, 255 },
-    { 7000, 0.308300, 0.319500, 247, 245, 255 },
-    { 7100, 0.307000, 0.318100, 245, 244, 255 },
-    { 7200, 0.305800, 0.316800, 243, 243, 255 },
-    { 7300, 0.304500, 0.315400, 241, 241, 255 },
-    { 7400, 0.303400, 0.314200, 239, 240, 255 },
-    { 7500, 0.302200, 0.312900, 238, 239, 255 },
-    { 7600, 0.301100, 0.311700, 236, 238, 255 },
-    { 7700, 0.300000, 0.310500, 234, 237, 255 },
-    { 7800, 0.299000, 0.309400, 233, 236, 255 },
-    { 7900, 0.298000, 0.308200, 231, 234, 255 },
-    { 8000, 0.297000, 0.307100, 229, 233, 255 },
-    { 8100, 0.296100, 0.306100, 228, 233, 255 },
-    { 8200, 0.295200, 0.305000, 227, 232, 255 },
-    { 8300, 0.294300, 0.304000, 225, 231, 255 },
-    { 8400, 0.293400, 0.303000, 224, 230, 255 },
-    { 8500, 0.292600, 0.302000, 223, 229, 255 },
-    { 8600, 0.291700, 0.301100, 221, 228, 255 },
-    { 8700, 0.291000, 0.300100, 220, 227, 255 },
-    { 8800, 0.290200, 0.299200, 219, 226, 255 },
-    { 8900, 0.289400, 0.298300, 218, 226, 255 },
-    { 9000, 0.288700, 0.297500, 217, 225, 255 },
-    { 9100, 0.288000, 0.296600, 216, 224, 255 },
-    { 9200, 0.287300, 0.295800, 215, 223, 255 },
-    { 9300, 0.286600, 0.295000, 214, 223, 255 },
-    { 9400, 0.286000, 0.294200, 213, 222, 255 },
-    { 9500, 0.285300, 0.293400, 212, 221, 255 },
-    { 9600, 0.284700, 0.292700, 211, 221, 255 },
-    { 9700, 0.284100, 0.291900, 210, 220, 255 },
-    { 9800, 0.283500, 0.291200, 209, 220, 255 },
-    { 9900, 0.282900, 0.290500, 208, 219, 255 },
-    { 10000, 0.282400, 0.289800, 207, 218, 255 }
+    BB_CURVE( BB_POINT )
+};
+
+unsigned short bb_xy[][2] = {
+    BB_CURVE( BB_XY )
 };
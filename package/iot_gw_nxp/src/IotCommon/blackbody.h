@@ -11,5 +11,11 @@ typedef struct {
     int   b;
 } bb_point;
 
-extern bb_point bb_curve[91];
+#define BB_NUM_POINTS   91
+#define BB_KELVIN_MIN   1000        // bb_curve runs in steps of BB_KELVIN_STEP
+#define BB_KELVIN_STEP  100
+#define BB_MAX_XY       0xFEFF      // Zigbee x/y scale
+
+extern bb_point bb_curve[BB_NUM_POINTS];
+extern unsigned short bb_xy[BB_NUM_POINTS][2];    // bb_curve x/y scaled to 0...BB_MAX_XY
 
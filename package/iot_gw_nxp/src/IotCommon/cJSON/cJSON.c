@@ -338,6 +338,144 @@ cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int r
 /* Default options for cJSON_Parse */
 cJSON *cJSON_Parse(const char *value) {return cJSON_ParseWithOpts(value,0,0);}
 
+/* Arena allocation: bump pointer in a caller supplied buffer, free is a no-op. */
+static cJSON_Arena *cJSON_arena;
+
+static void *cJSON_arena_malloc(size_t sz)
+{
+	cJSON_Arena *a=cJSON_arena;void *p;
+	size_t used=(a->used+sizeof(double)-1)&~(sizeof(double)-1);	/* keep nodes aligned for valuedouble */
+	if (used>a->size || sz>a->size-used) return 0;
+	p=a->buffer+used;a->used=used+sz;
+	return p;
+}
+static void cJSON_arena_free(void *ptr) {(void)ptr;}
+
+void cJSON_ArenaInit(cJSON_Arena *arena,void *buffer,size_t size)	{arena->buffer=(char*)buffer;arena->size=buffer?size:0;arena->used=0;}
+void cJSON_ArenaReset(cJSON_Arena *arena)							{arena->used=0;}
+
+/* Run the parser with cJSON_malloc/cJSON_free redirected to the arena. */
+cJSON *cJSON_ParseInArena(const char *value,cJSON_Arena *arena)
+{
+	void *(*malloc_fn)(size_t sz)=cJSON_malloc;void (*free_fn)(void *ptr)=cJSON_free;
+	size_t mark=arena->used;cJSON *c;
+
+	cJSON_arena=arena;cJSON_malloc=cJSON_arena_malloc;cJSON_free=cJSON_arena_free;
+	c=cJSON_ParseWithOpts(value,0,0);
+	cJSON_malloc=malloc_fn;cJSON_free=free_fn;cJSON_arena=0;
+
+	if (!c) arena->used=mark;	/* drop what the failed parse took */
+	return c;
+}
+
+/* Step over one value of the input text without building anything. Returns 0 when malformed. */
+static const char *skip_value(const char *value)
+{
+	int depth=0;
+	if (!value) return 0;
+	do
+	{
+		value=skip(value);
+		switch (*value)
+		{
+			case '\"':	value++;while (*value!='\"') {if (!*value) return 0;if (*value++=='\\' && *value) value++;}
+						value++;break;
+			case '{':case '[':	depth++;value++;break;
+			case '}':case ']':	if (!depth) return 0;depth--;value++;break;
+			case ',':case ':':	if (!depth) return 0;value++;break;
+			default:
+				if (!strncmp(value,"null",4) || !strncmp(value,"true",4)) value+=4;
+				else if (!strncmp(value,"false",5)) value+=5;
+				else if (*value=='-' || (*value>='0' && *value<='9')) {value++;while ((*value>='0' && *value<='9') || *value=='.' || *value=='e' || *value=='E' || *value=='+' || *value=='-') value++;}
+				else return 0;
+				break;
+		}
+	} while (depth);
+	return value;
+}
+
+/* Compare a (raw, unescaped) object key in the text with a path segment, case insensitive like cJSON_GetObjectItem. */
+static int key_matches(const char *key,const char *seg,size_t seglen)
+{
+	size_t i;
+	for (i=0;i<seglen;i++) if (key[i]=='\"' || key[i]=='\\' || tolower(key[i])!=tolower(seg[i])) return 0;
+	return key[seglen]=='\"';
+}
+
+/* Walk "name.name.index" through the text and return where the value starts. */
+const char *cJSON_GetPath(const char *value,const char *path)
+{
+	const char *seg;size_t seglen;int index,found;
+	value=skip(value);
+	while (value && path && *path)
+	{
+		seg=path;while (*path && *path!='.') path++;
+		seglen=path-seg;if (*path=='.') path++;
+
+		if (*value=='{')
+		{
+			found=0;value=skip(value+1);
+			while (!found && *value=='\"')
+			{
+				found=key_matches(value+1,seg,seglen);
+				value=skip(skip_value(value));
+				if (!value || *value!=':') return 0;
+				value=skip(value+1);
+				if (found) break;
+				value=skip(skip_value(value));
+				if (!value || *value!=',') return 0;
+				value=skip(value+1);
+			}
+			if (!found) return 0;
+		}
+		else if (*value=='[')
+		{
+			if (!seglen || strspn(seg,"0123456789")<seglen) return 0;
+			index=atoi(seg);
+			value=skip(value+1);
+			if (*value==']') return 0;
+			while (index--)
+			{
+				value=skip(skip_value(value));
+				if (!value || *value!=',') return 0;
+				value=skip(value+1);
+			}
+		}
+		else return 0;
+	}
+	return (value && *value)?value:0;
+}
+
+int cJSON_GetPathInt(const char *value,const char *path,int *out)
+{
+	cJSON item;
+	value=cJSON_GetPath(value,path);
+	if (!value) return 0;
+	if (!strncmp(value,"true",4))	{*out=1;return 1;}
+	if (!strncmp(value,"false",5))	{*out=0;return 1;}
+	if (*value!='-' && (*value<'0' || *value>'9')) return 0;
+	parse_number(&item,value);
+	*out=item.valueint;
+	return 1;
+}
+
+int cJSON_GetPathString(const char *value,const char *path,char *buffer,int size)
+{
+	cJSON_Arena arena;void *(*malloc_fn)(size_t sz)=cJSON_malloc;
+	cJSON item;const char *end;
+
+	value=cJSON_GetPath(value,path);
+	if (!value || *value!='\"' || size<1) return 0;
+
+	/* parse_string() takes exactly one allocation for the result: let that be buffer */
+	cJSON_ArenaInit(&arena,buffer,size);
+	cJSON_arena=&arena;cJSON_malloc=cJSON_arena_malloc;
+	end=parse_string(&item,value);
+	cJSON_malloc=malloc_fn;cJSON_arena=0;
+	if (!end) {*buffer=0;return 0;}
+	return 1;
+}
+
 /* Render a cJSON item/entity/structure to text. */
 char *cJSON_Print(cJSON *item)				{return print_value(item,0,1,0);}
 char *cJSON_PrintUnformatted(cJSON *item)	{return print_value(item,0,0,0);}
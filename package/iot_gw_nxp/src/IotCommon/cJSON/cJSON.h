@@ -54,6 +54,13 @@ typedef struct cJSON {
 	char *string;				/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
 } cJSON;
 
+/* A caller supplied buffer that cJSON_ParseInArena allocates from. */
+typedef struct cJSON_Arena {
+	char *buffer;
+	size_t size;
+	size_t used;
+} cJSON_Arena;
+
 typedef struct cJSON_Hooks {
       void *(*malloc_fn)(size_t sz);
       void (*free_fn)(void *ptr);
@@ -130,6 +137,19 @@ extern cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_en
 
 extern void cJSON_Minify(char *json);
 
+/* Arena parsing: every node and string of the document comes from the arena buffer. Do not cJSON_Delete the result,
+cJSON_ArenaReset releases the whole document in one step. Returns 0 when the text is malformed or the arena is too small. */
+extern void   cJSON_ArenaInit(cJSON_Arena *arena,void *buffer,size_t size);
+extern void   cJSON_ArenaReset(cJSON_Arena *arena);
+extern cJSON *cJSON_ParseInArena(const char *value,cJSON_Arena *arena);
+
+/* Lookup by path without building a tree. path is "name.name.index", e.g. "lamp.rgb" or "devs.2.mac"; names are matched
+case insensitive and must not contain escapes. GetPath returns where the value starts in the text, or 0 when not found.
+GetPathInt accepts numbers and true/false, GetPathString unescapes into buffer; both return 1 on success, 0 on error. */
+extern const char *cJSON_GetPath(const char *value,const char *path);
+extern int    cJSON_GetPathInt(const char *value,const char *path,int *out);
+extern int    cJSON_GetPathString(const char *value,const char *path,char *buffer,int size);
+
 /* Macros for creating things quickly. */
 #define cJSON_AddNullToObject(object,name)		cJSON_AddItemToObject(object, name, cJSON_CreateNull())
 #define cJSON_AddTrueToObject(object,name)		cJSON_AddItemToObject(object, name, cJSON_CreateTrue())
@@ -20,13 +20,29 @@
 
 #include <stdio.h>
 
-#include "RgbSpaceMatrices.h"
+#include "colorConv.h"
+#include "blackbody.h"
+
+#define MAX_XY  BB_MAX_XY
 
-#define MATRIX  14         // sRGB D65
+// No FPU on the target: the conversions run in fixed point. The matrices
+// are RgbSpaceMatrices[14] (sRGB D65), scaled by the compiler. XYZ -> rgb
+// gets more bits, as X and Z grow large for small y
+#define FIX( f, q )     ( (int)( (f) * (double)( 1 << (q) ) + ( ( (f) < 0 ) ? -0.5 : 0.5 ) ) )
+#define Q16( f )        FIX( f, 16 )
+#define Q24( f )        FIX( f, 24 )
 
-#define MAX_XY  0xFEFF
-#define MAX_Y   100
+static const int rgb2xyz[9] = {
+    Q16(  0.4124564 ), Q16(  0.3575761 ), Q16(  0.1804375 ),
+    Q16(  0.2126729 ), Q16(  0.7151522 ), Q16(  0.0721750 ),
+    Q16(  0.0193339 ), Q16(  0.1191920 ), Q16(  0.9503041 ),
+};
 
+static const int xyz2rgb[9] = {
+    Q24(  3.2404542 ), Q24( -1.5371385 ), Q24( -0.4985314 ),
+    Q24( -0.9692660 ), Q24(  1.8760108 ), Q24(  0.0415560 ),
+    Q24(  0.0556434 ), Q24( -0.2040259 ), Q24(  1.0572252 ),
+};
 
 /**
  * \brief Converts an rgb value into x/y space
@@ -36,42 +52,39 @@
  * \returns x,y scaled between 0-0xFEFF or 0,0 in case of an error
  */
 void rgb2xy( int rgb, int * x, int * y ) {
-    float r, g, b, fx, fy, fz;
+    int r = ( rgb >> 16 ) & 0xFF;
+    int g = ( rgb >> 8  ) & 0xFF;
+    int b = ( rgb       ) & 0xFF;
 
-    // Unpack and scale to 0...1
-    r = (float)( ( rgb >> 16 ) & 0xFF ) / (float)0xFF;
-    g = (float)( ( rgb >> 8  ) & 0xFF ) / (float)0xFF;
-    b = (float)( ( rgb       ) & 0xFF ) / (float)0xFF;
+    // x and y are ratios, so the 1/255 scaling of r,g,b drops out
+    long long fx = rgb2xyz[0] * r + rgb2xyz[1] * g + rgb2xyz[2] * b;
+    long long fy = rgb2xyz[3] * r + rgb2xyz[4] * g + rgb2xyz[5] * b;
+    long long fz = rgb2xyz[6] * r + rgb2xyz[7] * g + rgb2xyz[8] * b;
 
-    fx = ( RgbSpaceMatrices[ (MATRIX*18) + 0 ] * r ) +
-         ( RgbSpaceMatrices[ (MATRIX*18) + 1 ] * g ) +
-         ( RgbSpaceMatrices[ (MATRIX*18) + 2 ] * b );
-    fy = ( RgbSpaceMatrices[ (MATRIX*18) + 3 ] * r ) +
-         ( RgbSpaceMatrices[ (MATRIX*18) + 4 ] * g ) +
-         ( RgbSpaceMatrices[ (MATRIX*18) + 5 ] * b );
-    fz = ( RgbSpaceMatrices[ (MATRIX*18) + 6 ] * r ) +
-         ( RgbSpaceMatrices[ (MATRIX*18) + 7 ] * g ) +
-         ( RgbSpaceMatrices[ (MATRIX*18) + 8 ] * b );
-
-    float sum = ( fx + fy + fz );
+    long long sum = ( fx + fy + fz );
 
     if ( sum != 0 ) {
-        fx = fx / sum;
-        fy = fy / sum;
-
-        // Clipping
-        if ( fx < 0 ) fx=0; if ( fx > 1.0 ) fx=1.0;
-        if ( fy < 0 ) fy=0; if ( fy > 1.0 ) fy=1.0;
-
-        // Scale to 0...MAX
-        *x = (int)( fx * (float)MAX_XY );
-        *y = (int)( fy * (float)MAX_XY );
+        // Scale to 0...MAX (the coefficients are positive: no clipping needed)
+        *x = (int)( ( fx * MAX_XY ) / sum );
+        *y = (int)( ( fy * MAX_XY ) / sum );
     } else {
         *x = 0;
         *y = 0;
     }
 };
 
+/**
+ * \brief One channel of XYZ -> rgb, where XYZ all have the same denominator
+ * \returns The channel clipped to 0...1 and scaled to 0...scale
+ */
+static int xyzChannel( const int * m, long long fx, long long fY, long long fz,
+                       long long den, int scale ) {
+    long long c = m[0] * fx + m[1] * fY + m[2] * fz;
+    if ( c <= 0 ) return( 0 );
+    den <<= 24;
+    if ( c >= den ) return( scale );
+    return( (int)( ( c * scale ) / den ) );
+}
 
 /**
  * \brief Converts x/y space color into rgb
@@ -81,37 +94,20 @@ void rgb2xy( int rgb, int * x, int * y ) {
  * \returns rgb color
  */
 void xy2rgb( int x, int y, int * rgb ) {
-    float fx, fy, fz = 0, fY;
-
-    // Scale back to 0...1
-    fx = (float)x / (float)MAX_XY;
-    fy = (float)y / (float)MAX_XY;
-    fY = 1.0;
-
-    if ( y != 0 ) {
-        fz = ( 1 - fx - fy ) * fY / fy ;
-        fx = fx * fY / fy;
+    // With Y = 1: X = x/y and Z = (1-x-y)/y, all over the same denominator y
+    long long fx = x, fY = y, fz = MAX_XY - x - y, den = y;
+
+    if ( y == 0 ) {
+        // X keeps x, Z stays 0
+        fY  = MAX_XY;
+        fz  = 0;
+        den = MAX_XY;
     }
 
-    float fr = RgbSpaceMatrices[ (MATRIX*18) +  9 ] * fx +
-               RgbSpaceMatrices[ (MATRIX*18) + 10 ] * fY +
-               RgbSpaceMatrices[ (MATRIX*18) + 11 ] * fz;
-    float fg = RgbSpaceMatrices[ (MATRIX*18) + 12 ] * fx +
-               RgbSpaceMatrices[ (MATRIX*18) + 13 ] * fY +
-               RgbSpaceMatrices[ (MATRIX*18) + 14 ] * fz;
-    float fb = RgbSpaceMatrices[ (MATRIX*18) + 15 ] * fx +
-               RgbSpaceMatrices[ (MATRIX*18) + 16 ] * fY +
-               RgbSpaceMatrices[ (MATRIX*18) + 17 ] * fz;
-
-    // Clipping
-    if ( fr < 0 ) fr=0; if ( fr > 1 ) fr=1;
-    if ( fg < 0 ) fg=0; if ( fg > 1 ) fg=1;
-    if ( fb < 0 ) fb=0; if ( fb > 1 ) fb=1;
-
     // Scale to 0...255 and pack
-    int r = (int)( fr * 0xFE );
-    int g = (int)( fg * 0xFF );
-    int b = (int)( fb * 0xFF );
+    int r = xyzChannel( &xyz2rgb[0], fx, fY, fz, den, 0xFE );
+    int g = xyzChannel( &xyz2rgb[3], fx, fY, fz, den, 0xFF );
+    int b = xyzChannel( &xyz2rgb[6], fx, fY, fz, den, 0xFF );
     *rgb = ( r << 16 ) + ( g << 8 ) + b;
 };
 
@@ -119,28 +115,16 @@ void xy2rgb( int x, int y, int * rgb ) {
 // Kelvin interface
 // ---------------------------------------------------------------------
 
-#include "blackbody.h"
-
 /**
  * \brief Finds closest entry in blackbody curve table
  * \param kelvin Kelvin color value
  * \returns index to closest blackbody curve color
  */
 static int findbestkelvin( int kelvin ) {
-    // printf( "sizeof( bb_curve ) = %d\n", (int)sizeof( bb_curve ) );
-    int len = sizeof( bb_curve ) / sizeof( bb_point );
-    // printf( "#bb_points = %d\n", len );
-
-    bb_point * p;
-    int i, dkelvin, dbest = 10000, index = 0;
-    for ( i=0; i<len; i++ ) {
-        p = &bb_curve[i];
-        dkelvin = kelvin - p->kelvin; if ( dkelvin < 0 ) dkelvin = -dkelvin;
-        if ( dkelvin < dbest ) {
-           dbest = dkelvin;
-           index = i;
-        }
-    }
+    // The curve has fixed steps: round to the nearest, the lower one on a tie
+    int index = ( kelvin - BB_KELVIN_MIN + ( BB_KELVIN_STEP / 2 ) - 1 ) / BB_KELVIN_STEP;
+    if ( kelvin < BB_KELVIN_MIN ) index = 0;
+    if ( index >= BB_NUM_POINTS ) index = BB_NUM_POINTS - 1;
     return( index );
 }
 
@@ -152,6 +136,39 @@ static int findbestkelvin( int kelvin ) {
  */
 void kelvin2xy( int kelvin, int * x, int * y ) {
     int index = findbestkelvin( kelvin );
-    *x = (int)( bb_curve[index].x * MAX_XY );
-    *y = (int)( bb_curve[index].y * MAX_XY );
+    *x = bb_xy[index][0];
+    *y = bb_xy[index][1];
+}
+
+// ---------------------------------------------------------------------
+// Batches
+// ---------------------------------------------------------------------
+
+/**
+ * \brief Converts the colors of num lamps (e.g. for a group scene) into x/y.
+ * Runs of the same color are converted once
+ * \param num Number of lamps
+ * \param rgb Per lamp: RGB color, or < 0 to use kelvin
+ * \param kelvin Per lamp: Kelvin color when rgb < 0 (may be NULL when all have rgb)
+ * \param x Array to receive the X coordinates
+ * \param y Array to receive the Y coordinates
+ */
+void color2xyBatch( int num, const int * rgb, const int * kelvin, int * x, int * y ) {
+    int i, prgb = -1, pkelvin = -1;
+
+    for ( i=0; i<num; i++ ) {
+        int k = ( kelvin ) ? kelvin[i] : -1;
+        if ( i > 0 && rgb[i] == prgb && ( rgb[i] >= 0 || k == pkelvin ) ) {
+            x[i] = x[i-1];
+            y[i] = y[i-1];
+        } else if ( rgb[i] >= 0 ) {
+            rgb2xy( rgb[i], &x[i], &y[i] );
+        } else if ( k >= 0 ) {
+            kelvin2xy( k, &x[i], &y[i] );
+        } else {
+            x[i] = y[i] = 0;
+        }
+        prgb    = rgb[i];
+        pkelvin = k;
+    }
 }
@@ -11,3 +11,5 @@ void xy2rgb( int x, int y, int * rgb );
 
 void kelvin2xy( int kelvin, int * x, int * y );
 
+void color2xyBatch( int num, const int * rgb, const int * kelvin, int * x, int * y );
+
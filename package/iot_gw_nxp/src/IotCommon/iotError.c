@@ -35,6 +35,10 @@ char * iotErrorStringRaw( int err ) {
         return( "Authorize response" );
         break;
 
+    case IOT_ERROR_AUTHORIZE_BUSY:
+        return( "Authorize busy" );
+        break;
+
     case IOT_ERROR_NO_TLS_RECEIVED:
         return( "No TLS received" );
         break;
@@ -12,6 +12,7 @@
 // #define IOT_ERROR_NOT_AUTHORIZED          3
 #define IOT_ERROR_AUTHORIZE_TIMEOUT       4
 #define IOT_ERROR_AUTHORIZE_RESPONSE      5
+#define IOT_ERROR_AUTHORIZE_BUSY          7
 #define IOT_ERROR_NO_TLS_RECEIVED         6
 
 #define IOT_ERROR_NO_MAC                  11
@@ -0,0 +1,182 @@
+// ------------------------------------------------------------------
+// IoT Stats - Latency histograms in shared memory
+// ------------------------------------------------------------------
+// Each stage of a command (queue, serial link, database) adds its
+// duration to a log2 histogram. The histograms live in one shared
+// memory segment, so all daemons report into it and a CGI script or
+// the iot_st tool can read them while the gateway runs.
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2015. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \brief IoT Stats - Latency histograms in shared memory
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "iotStats.h"
+
+#define IOT_STATS_SHMKEY   99637
+
+// #define STATS_DEBUG
+
+#ifdef STATS_DEBUG
+#define DEBUG_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif /* STATS_DEBUG */
+
+// Updates are atomic adds, no semaphore: a stage must never wait for its own statistics.
+// A fresh segment is all zeroes, which is an empty set of histograms
+typedef struct iot_stats {
+    int reserve[8];
+    iotStatsHist_t hist[IOT_STATS_NUM];
+} iot_stats_t;
+
+// ------------------------------------------------------------------
+// Globals
+// ------------------------------------------------------------------
+
+char * statsNames[IOT_STATS_NUM] = {
+    "queue",              // 0
+    "sl-lock",            // 1
+    "sl-write",           // 2
+    "sl-status",          // 3
+    "db-lock",            // 4
+    "db-commit",          // 5
+    "zb-report",          // 6
+    "dbp-publish" };      // 7
+
+static iot_stats_t * iotStatsSharedMemory = NULL;
+static int iotStatsFailed = 0;
+
+// ------------------------------------------------------------------
+// Open
+// ------------------------------------------------------------------
+
+/**
+ * \brief Attach the stats segment, create it when it does not exist yet.
+ * Only tried once per process: without it the stats are just not kept
+ * \returns The stats, or NULL on error
+ */
+static iot_stats_t * iotStatsOpen( void ) {
+    int shmid;
+    char * shm;
+
+    if ( iotStatsSharedMemory || iotStatsFailed ) return( iotStatsSharedMemory );
+
+    if ( ( shmid = shmget( IOT_STATS_SHMKEY, sizeof( iot_stats_t ), 0666 | IPC_CREAT ) ) < 0 ) {
+        perror( "shmget-stats" );
+        iotStatsFailed = 1;
+    } else if ( ( shm = shmat( shmid, NULL, 0 ) ) == (char *) -1 ) {
+        perror( "shmat-stats" );
+        iotStatsFailed = 1;
+    } else {
+        DEBUG_PRINTF( "Attached SHM for Stats (%d)\n", shmid );
+        iotStatsSharedMemory = (iot_stats_t *)shm;
+    }
+    return( iotStatsSharedMemory );
+}
+
+// ------------------------------------------------------------------
+// Measure
+// ------------------------------------------------------------------
+
+/**
+ * \brief Timestamp for the stats: monotonic and the same clock in all processes.
+ * Wraps every 71 minutes, differences stay valid across the wrap
+ * \returns Time in micro-seconds
+ */
+unsigned int iotStatsNow( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (unsigned int)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 );
+}
+
+/**
+ * \brief Add a duration to the histogram of a stage
+ * \param stage One of iotStatsStage
+ * \param usec Duration in micro-seconds
+ */
+void iotStatsAdd( int stage, unsigned int usec ) {
+    iot_stats_t * pstats;
+    iotStatsHist_t * phist;
+    unsigned int max;
+    int b = 0;
+
+    if ( stage < 0 || stage >= IOT_STATS_NUM || ( pstats = iotStatsOpen() ) == NULL ) return;
+    phist = &pstats->hist[stage];
+
+    while ( b < IOT_STATS_BUCKETS - 1 && ( usec >> b ) ) b++;
+    __sync_fetch_and_add( &phist->buckets[b], 1 );
+    __sync_fetch_and_add( &phist->count, 1 );
+
+    while ( usec > ( max = phist->max ) ) {
+        if ( __sync_bool_compare_and_swap( &phist->max, max, usec ) ) break;
+    }
+}
+
+/**
+ * \brief Add the time since <start> to the histogram of a stage
+ * \param stage One of iotStatsStage
+ * \param start Start of the stage, from iotStatsNow()
+ */
+void iotStatsSince( int stage, unsigned int start ) {
+    iotStatsAdd( stage, iotStatsNow() - start );
+}
+
+// ------------------------------------------------------------------
+// Read
+// ------------------------------------------------------------------
+
+/**
+ * \brief Copy the histogram of a stage. Taken while other processes keep
+ * adding, so the count may be off from the bucket sum by a few
+ * \param stage One of iotStatsStage
+ * \param phist Receives the histogram
+ * \returns 1 on success, 0 on error
+ */
+int iotStatsGet( int stage, iotStatsHist_t * phist ) {
+    iot_stats_t * pstats;
+    if ( stage < 0 || stage >= IOT_STATS_NUM || ( pstats = iotStatsOpen() ) == NULL ) return( 0 );
+    memcpy( phist, &pstats->hist[stage], sizeof( iotStatsHist_t ) );
+    return( 1 );
+}
+
+/**
+ * \brief Percentile of a histogram, rounded up to its bucket
+ * \param phist Histogram
+ * \param percent Percentile, e.g. 50 or 99
+ * \returns Upper bound of the bucket in micro-seconds (capped at the maximum), 0 when empty
+ */
+unsigned int iotStatsPercentile( iotStatsHist_t * phist, int percent ) {
+    unsigned int total = 0, seen = 0, want;
+    int b;
+    for ( b=0; b<IOT_STATS_BUCKETS; b++ ) total += phist->buckets[b];
+    if ( total == 0 ) return( 0 );
+    want = (unsigned int)( ( (unsigned long long)total * percent + 99 ) / 100 );
+    for ( b=0; b<IOT_STATS_BUCKETS - 1; b++ ) {
+        if ( ( seen += phist->buckets[b] ) >= want ) break;
+    }
+    if ( b >= IOT_STATS_BUCKETS - 1 || ( 1u << b ) > phist->max ) return( phist->max );
+    return( 1u << b );
+}
+
+/**
+ * \brief Clear all histograms
+ * \returns 1 on success, 0 on error
+ */
+int iotStatsReset( void ) {
+    iot_stats_t * pstats;
+    if ( ( pstats = iotStatsOpen() ) == NULL ) return( 0 );
+    memset( pstats->hist, 0, sizeof( pstats->hist ) );
+    return( 1 );
+}
+
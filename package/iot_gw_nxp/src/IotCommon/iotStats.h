@@ -0,0 +1,40 @@
+// ------------------------------------------------------------------
+// IoT Stats - Latency histograms in shared memory - include file
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2015. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \brief IoT Stats - Latency histograms in shared memory
+ */
+
+#define IOT_STATS_BUCKETS     32    // Bucket b counts durations below 2^b usec (and at least 2^(b-1))
+
+typedef enum {
+    IOT_STATS_QUEUE = 0,            // 0 Queue write -> queue read
+    IOT_STATS_SL_LOCK,              // 1 Wait for the SerialLink write mutex
+    IOT_STATS_SL_WRITE,             // 2 eSL_WriteMessage()
+    IOT_STATS_SL_STATUS,            // 3 Command written -> its status received
+    IOT_STATS_DB_LOCK,              // 4 Wait for the database semaphore
+    IOT_STATS_DB_COMMIT,            // 5 Database write section
+    IOT_STATS_ZB_REPORT,            // 6 Sensor report received -> stored and teed to DBP
+    IOT_STATS_DBP_PUBLISH,          // 7 Reading handed to the DBP publisher -> MQTT publish
+    IOT_STATS_NUM                   //   See statsNames in .c file
+} iotStatsStage;
+
+typedef struct iot_stats_hist {
+    unsigned int count;
+    unsigned int max;                          // usec
+    unsigned int buckets[IOT_STATS_BUCKETS];
+} iotStatsHist_t;
+
+extern char * statsNames[IOT_STATS_NUM];
+
+unsigned int iotStatsNow( void );
+void iotStatsAdd( int stage, unsigned int usec );
+void iotStatsSince( int stage, unsigned int start );
+int iotStatsGet( int stage, iotStatsHist_t * phist );
+unsigned int iotStatsPercentile( iotStatsHist_t * phist, int percent );
+int iotStatsReset( void );
+
@@ -6,134 +6,343 @@
 // ------------------------------------------------------------------
 
 /** \file
- * \brief Friendly IoT timer interface
+ * \brief Friendly IoT timer interface: a timer wheel driven by one timerfd
  */
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
-#include <signal.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <sys/timerfd.h>
 
 #include "iotTimer.h"
 
-#define CLOCKID    CLOCK_REALTIME
-#define SIG        SIGRTMIN
-// #define TIMERSIG   9961
+#define TW_TICK_MSEC    10
+#define TW_BITS         6
+#define TW_SIZE         ( 1 << TW_BITS )
+#define TW_MASK         ( TW_SIZE - 1 )
+#define TW_LEVELS       4
+#define TW_MAX_TICKS    ( ( 1UL << ( TW_BITS * TW_LEVELS ) ) - 1 )
+
+// Level n holds the timers that were less than TW_SIZE^(n+1) ticks away
+// when added, in slot ( expires >> ( n * TW_BITS ) ) & TW_MASK. Each time
+// the lower level wraps, the next slot of a level is cascaded down
 
 // ------------------------------------------------------------------
 // Globals
 // ------------------------------------------------------------------
 
-static timer_t timerid = 0;
-static int     cbPar;
-static timerCb cbFunction;
+static iotTimer_t *  wheel[TW_LEVELS][TW_SIZE];
+static unsigned long twNow     = 0;     // Next tick to process
+static int           twPending = 0;
+static int           twFd      = -1;
+static unsigned long twArmed   = 0;     // Tick the timerfd is set for, 0 when idle
 
 // ------------------------------------------------------------------
-// Handler
+// Wheel
 // ------------------------------------------------------------------
 
+static unsigned long twClock( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (unsigned long)ts.tv_sec * ( 1000 / TW_TICK_MSEC ) +
+            (unsigned long)ts.tv_nsec / ( TW_TICK_MSEC * 1000000 ) );
+}
+
+static void twLink( iotTimer_t ** head, iotTimer_t * t ) {
+    t->next = *head;
+    if ( t->next ) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void twUnlink( iotTimer_t * t ) {
+    *t->pprev = t->next;
+    if ( t->next ) t->next->pprev = t->pprev;
+    t->next  = NULL;
+    t->pprev = NULL;
+}
+
+static void twInsert( iotTimer_t * t ) {
+    long delta = (long)( t->expires - twNow );
+    int level = 0;
+
+    if ( delta < 0 ) {
+        // Overdue: the next tick processed
+        t->expires = twNow;
+        delta = 0;
+    } else if ( (unsigned long)delta > TW_MAX_TICKS ) {
+        t->expires = twNow + TW_MAX_TICKS;
+        delta = TW_MAX_TICKS;
+    }
+    while ( level < TW_LEVELS - 1 &&
+            (unsigned long)delta >= ( 1UL << ( TW_BITS * ( level + 1 ) ) ) ) {
+        level++;
+    }
+    twLink( &wheel[level][( t->expires >> ( TW_BITS * level ) ) & TW_MASK], t );
+}
+
 /**
- * \brief Timer handler that will call our call-back function with parameter <par>
+ * \brief Moves slot <index> of <level> one level down
+ * \returns index, which is 0 when the next level has to cascade too
  */
-static void timerHandler(int sig, siginfo_t *si, void *uc)
-{
-    /* Note: calling printf() from a signal handler is not
-       strictly correct, since printf() is not async-signal-safe;
-       see signal(7) */
-
-    printf("************* Caught signal %d - %d *****************\n", sig, cbPar );
-    
-    cbFunction( cbPar );
+static int twCascade( int level, int index ) {
+    iotTimer_t * t = wheel[level][index];
+    wheel[level][index] = NULL;
+    while ( t ) {
+        iotTimer_t * next = t->next;
+        t->pprev = NULL;
+        twInsert( t );
+        t = next;
+    }
+    return( index );
+}
+
+/**
+ * \brief Processes tick twNow: cascades, then runs what expires
+ * \returns Number of call-backs called
+ */
+static int twTick( void ) {
+    int level, ran = 0, index = twNow & TW_MASK;
+    iotTimer_t * list;
+
+    for ( level = 1; index == 0 && level < TW_LEVELS; level++ ) {
+        index = twCascade( level, ( twNow >> ( TW_BITS * level ) ) & TW_MASK );
+    }
+
+    // Detach the slot: call-backs may add and cancel timers
+    list = wheel[0][twNow & TW_MASK];
+    wheel[0][twNow & TW_MASK] = NULL;
+    if ( list ) list->pprev = &list;
+    twNow++;
 
-    signal(sig, SIG_IGN);
-    
-    timer_delete( timerid );
-    timerid = 0;
+    while ( list ) {
+        iotTimer_t * t = list;
+        twUnlink( t );
+        twPending--;
+        if ( t->period > 0 ) {
+            t->expires += t->period;
+            twInsert( t );
+            twPending++;
+        }
+        ran++;
+        t->cb( t, t->arg );
+    }
+    return( ran );
 }
 
 /**
- * \brief Stop a previously started timer (if it did not fire yet)
+ * \brief Finds the first tick with work: an expiry, or a cascade of a non-empty slot
+ * \returns 1 when there is one, 0 when nothing is pending
  */
-int timerStop( void ) {
-    if ( timerid ) {
-        printf( "================================ Stopping timer 0x%x\n", (int)timerid );
-        if (timer_delete(timerid) == -1) {
-            perror("timer_delete");
-            return 0;
+static int twNext( unsigned long * next ) {
+    int i, level;
+
+    if ( twPending <= 0 ) return( 0 );
+
+    // Level 0: still to come in this rotation
+    for ( i = twNow & TW_MASK; i < TW_SIZE; i++ ) {
+        if ( wheel[0][i] ) {
+            *next = ( twNow & ~(unsigned long)TW_MASK ) + i;
+            return( 1 );
         }
-        timerid = 0;
     }
-    return 1;
+    // Level 0 slots already passed belong to the next rotation: wake on the wrap
+    *next = ( twNow | TW_MASK ) + 1;
+    for ( i = 0; i < (int)( twNow & TW_MASK ); i++ ) {
+        if ( wheel[0][i] ) return( 1 );
+    }
+
+    // Higher levels: the earliest cascade of a non-empty slot
+    int found = 0;
+    for ( level = 1; level < TW_LEVELS; level++ ) {
+        int shift = TW_BITS * level;
+        unsigned long pos = twNow >> shift;
+        // Not cascaded yet when twNow is right on the boundary
+        i = ( twNow & ( ( 1UL << shift ) - 1 ) ) ? 1 : 0;
+        for ( ; i <= TW_SIZE; i++ ) {
+            if ( wheel[level][( pos + i ) & TW_MASK] ) {
+                unsigned long at = ( pos + i ) << shift;
+                if ( !found || (long)( at - *next ) < 0 ) *next = at;
+                found = 1;
+                break;
+            }
+        }
+    }
+    return( 1 );
 }
 
 /**
- * \brief Start a timer that fires after <msec> milli-seconds to call the <cb> callback function with
- * parameter <par>
- * \param msec Number of milli-seconds after which timer fires
- * \param cb Call-back function
- * \param par Paramater to be supplied to the call-back function
+ * \brief Sets the timerfd for the first tick with work (or disarms it)
  */
-int timerStart( int msec, timerCb cb, int par ) {
-  
-    cbFunction = cb;
-    cbPar      = par;
-    
-    struct sigaction sa;
-    sigset_t mask;
-    struct sigevent sev;
+static void twArm( void ) {
+    unsigned long next = 0;
     struct itimerspec its;
-    
-    if ( timerid ) {
-        printf( "Timer: already busy\n" );
-        return 0;
+
+    if ( twFd < 0 ) return;
+    if ( !twNext( &next ) ) next = 0;
+    else if ( next == 0 ) next = 1;
+    if ( next == twArmed ) return;
+
+    memset( &its, 0, sizeof( its ) );
+    if ( next ) {
+        its.it_value.tv_sec  = next / ( 1000 / TW_TICK_MSEC );
+        its.it_value.tv_nsec = ( next % ( 1000 / TW_TICK_MSEC ) ) * TW_TICK_MSEC * 1000000;
     }
-    
-    printf("Establishing handler for signal %d\n", SIG);
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = timerHandler;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIG, &sa, NULL) == -1) {
-        perror("sigaction");
-        return 0;
+    if ( timerfd_settime( twFd, TFD_TIMER_ABSTIME, &its, NULL ) == -1 ) {
+        perror( "timerfd_settime" );
+        next = 0;
     }
-    
-    printf("Blocking signal %d\n", SIG);
-    sigemptyset(&mask);
-    sigaddset(&mask, SIG);
-    if (sigprocmask(SIG_SETMASK, &mask, NULL) == -1) {
-        perror("sigprocmask");
-        return 0;
+    twArmed = next;
+}
+
+// ------------------------------------------------------------------
+// Interface
+// ------------------------------------------------------------------
+
+/**
+ * \brief Opens the timerfd of this process' timer wheel
+ * \returns The fd to poll for reading (then call iotTimerRun), or -1 on error
+ */
+int iotTimerInit( void ) {
+    if ( twFd < 0 ) {
+        if ( ( twFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) < 0 ) {
+            perror( "timerfd_create" );
+            return( -1 );
+        }
+        if ( twPending == 0 ) twNow = twClock();
+        twArmed = 0;
+        twArm();
     }
+    return( twFd );
+}
 
-    /* Create the timer */
-    sev.sigev_notify = SIGEV_SIGNAL;
-    sev.sigev_signo = SIG;
-    sev.sigev_value.sival_ptr = &timerid;
-    if (timer_create(CLOCKID, &sev, &timerid) == -1) {
-        perror("timer_create");
-        return 0;
+/**
+ * \brief Initializes a (not pending) timer
+ * \param cb Call-back function, called from iotTimerRun
+ * \param arg Parameter for the call-back
+ */
+void iotTimerSet( iotTimer_t * timer, iotTimerCb_t cb, void * arg ) {
+    memset( timer, 0, sizeof( iotTimer_t ) );
+    timer->cb  = cb;
+    timer->arg = arg;
+}
+
+/**
+ * \brief (Re)starts a timer: when it was pending, it now only fires after <msec>
+ * \param msec Milli-seconds from now
+ * \param period Milli-seconds between later expiries, or 0 for a one-shot
+ * \returns 1 on success, 0 on error
+ */
+int iotTimerAdd( iotTimer_t * timer, int msec, int period ) {
+    if ( !timer->cb ) return( 0 );
+    if ( timer->pprev ) {
+        twUnlink( timer );
+    } else {
+        if ( twPending == 0 ) twNow = twClock();   // Nothing to catch up on
+        twPending++;
     }
+    if ( msec < 0 ) msec = 0;
+    // The current tick already started: one more, so it never fires early
+    timer->expires = twClock() + 1 + ( msec + TW_TICK_MSEC - 1 ) / TW_TICK_MSEC;
+    timer->period  = ( period > 0 ) ? ( period + TW_TICK_MSEC - 1 ) / TW_TICK_MSEC : 0;
+    twInsert( timer );
+    twArm();
+    return( 1 );
+}
 
-    printf("timer ID is 0x%lx\n", (long) timerid);
+/**
+ * \brief Stops a timer, when it is pending
+ */
+void iotTimerCancel( iotTimer_t * timer ) {
+    if ( timer->pprev ) {
+        twUnlink( timer );
+        twPending--;
+        // The timerfd may still fire once: iotTimerRun then finds nothing
+    }
+}
 
-    /* Start the timer */
-    its.it_value.tv_sec = msec / 1000;
-    its.it_value.tv_nsec = ( msec % 1000 ) * 1000;
-    its.it_interval.tv_sec = 0;   // its.it_value.tv_sec;
-    its.it_interval.tv_nsec = 0;  // its.it_value.tv_nsec;
+/**
+ * \returns 1 when the timer is pending, 0 otherwise
+ */
+int iotTimerPending( iotTimer_t * timer ) {
+    return( timer->pprev != NULL );
+}
 
-    if (timer_settime(timerid, 0, &its, NULL) == -1) {
-        perror("timer_settime");
-        return 0;
+/**
+ * \brief For loops that wait on something else than an fd (e.g. a queue)
+ * \returns Milli-seconds until iotTimerRun has work, or -1 when no timer is pending
+ */
+int iotTimerNextMsec( void ) {
+    unsigned long next;
+    if ( !twNext( &next ) ) return( -1 );
+    long ticks = (long)( next - twClock() );
+    return( ( ticks > 0 ) ? (int)( ticks * TW_TICK_MSEC ) : 0 );
+}
+
+/**
+ * \brief Runs the call-backs of all expired timers and sets the timerfd for the next one
+ * \returns Number of call-backs called
+ */
+int iotTimerRun( void ) {
+    unsigned long now = twClock(), next;
+    uint64_t expirations;
+    int ran = 0;
+
+    if ( twFd >= 0 ) {
+        if ( read( twFd, &expirations, sizeof( expirations ) ) < 0 ) {
+            // EAGAIN: not fired (yet)
+        }
+        twArmed = 0;
     }
 
-    printf("Unblocking signal %d\n", SIG);
-    if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1) {
-        perror("sigprocmask");
-        return 0;
+    while ( twNext( &next ) && (long)( next - now ) <= 0 ) {
+        // Nothing in between: skip to it
+        if ( (long)( next - twNow ) > 0 ) twNow = next;
+        ran += twTick();
     }
-    
+    if ( (long)( now + 1 - twNow ) > 0 ) twNow = now + 1;
+
+    twArm();
+    return( ran );
+}
+
+// ------------------------------------------------------------------
+// Single timer interface
+// ------------------------------------------------------------------
+
+static iotTimer_t singleTimer;
+static int        cbPar;
+static timerCb    cbFunction;
+
+static void singleTimerCb( iotTimer_t * timer, void * arg ) {
+    cbFunction( cbPar );
+}
+
+/**
+ * \brief Stop a previously started timer (if it did not fire yet)
+ */
+int timerStop( void ) {
+    iotTimerCancel( &singleTimer );
     return 1;
 }
 
+/**
+ * \brief Start a timer that fires after <msec> milli-seconds to call the <cb> callback function with
+ * parameter <par>. It fires from iotTimerRun()
+ * \param msec Number of milli-seconds after which timer fires
+ * \param cb Call-back function
+ * \param par Paramater to be supplied to the call-back function
+ */
+int timerStart( int msec, timerCb cb, int par ) {
+    if ( iotTimerPending( &singleTimer ) ) {
+        printf( "Timer: already busy\n" );
+        return 0;
+    }
+    cbFunction = cb;
+    cbPar      = par;
+    iotTimerSet( &singleTimer, singleTimerCb, NULL );
+    return( iotTimerAdd( &singleTimer, msec, 0 ) );
+}
@@ -4,7 +4,38 @@
 // Author:    nlv10677
 // Copyright: NXP B.V. 2015. All rights reserved
 // ------------------------------------------------------------------
+//
+// Any number of timers per process in a hierarchical timer wheel
+// (10 msec ticks, 4 levels of 64 slots: up to ~46 hours ahead).
+// Adding and cancelling are O(1). Nothing runs from a signal handler:
+// the owning loop polls iotTimerInit()'s timerfd, or waits at most
+// iotTimerNextMsec(), and then calls iotTimerRun() which runs the
+// call-backs of the timers that expired. Use from that thread only.
+//
+// ------------------------------------------------------------------
+
+typedef struct iotTimer iotTimer_t;
+
+typedef void (*iotTimerCb_t)( iotTimer_t * timer, void * arg );
+
+struct iotTimer {
+    iotTimer_t *  next;
+    iotTimer_t ** pprev;        // NULL when not pending
+    unsigned long expires;      // Tick
+    int           period;       // Ticks, 0 for a one-shot
+    iotTimerCb_t  cb;
+    void *        arg;
+};
+
+int  iotTimerInit( void );
+void iotTimerSet( iotTimer_t * timer, iotTimerCb_t cb, void * arg );
+int  iotTimerAdd( iotTimer_t * timer, int msec, int period );
+void iotTimerCancel( iotTimer_t * timer );
+int  iotTimerPending( iotTimer_t * timer );
+int  iotTimerNextMsec( void );
+int  iotTimerRun( void );
 
+// Single timer interface, now on top of the wheel: fires from iotTimerRun()
 typedef void (*timerCb)( int );
 
 int timerStart( int msec, timerCb cb, int par );
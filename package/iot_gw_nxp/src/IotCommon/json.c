@@ -62,6 +62,7 @@ firstName=Brett
 
 #include "atoi.h"
 #include "json.h"
+#include "tlv.h"
 
 #define MAXPARSERS           2
 
@@ -460,6 +461,43 @@ void jsonEat(char c) {//-
 
     jsonEatNoLog(c);
 }
+
+/**
+ * \brief Parse a complete queue message, either JSON or its TLV twin (see tlv.h).
+ * TLV messages give the same callbacks as their JSON text, without parsing it
+ * \param message Message
+ * \param len Message length
+ */
+void jsonEatMessage(char * message, int len) {
+    int i;
+    if (tlvIsMessage(message, len)) {
+        tlv_field_t field;
+        int pos = 0;
+        char * object = "";
+        while (tlvNext(message, len, &pos, &field)) {
+            switch (field.type) {
+                case TLV_OBJECT:
+                    object = field.name;
+                    if (parser->onObjectStart != NULL) parser->onObjectStart(object);
+                    break;
+                case TLV_END:
+                    if (parser->onObjectComplete != NULL) parser->onObjectComplete(object);
+                    object = "";
+                    break;
+                case TLV_INTEGER:
+                    if (parser->onInteger != NULL) parser->onInteger(field.name, field.num);
+                    break;
+                case TLV_STRING:
+                    if (parser->onString != NULL) parser->onString(field.name, field.str);
+                    break;
+            }
+        }
+    } else {
+        for (i = 0; i < len; i++) {
+            jsonEat(message[i]);
+        }
+    }
+}
 //-涼Ǹһṹֵ,Ͷ̬Ĵһ
 void jsonSetOnError(OnError oe) {
     parser->onError = oe;
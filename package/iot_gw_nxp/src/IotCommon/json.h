@@ -50,6 +50,7 @@ typedef void (*OnInteger)( char * name, int value );
 
 void jsonReset( void );
 void jsonEat( char c );
+void jsonEatMessage( char * message, int len );
 void jsonSetOnError( OnError oe );
 void jsonSetOnObjectStart( OnObjectStart oos );
 void jsonSetOnObjectComplete( OnObjectComplete oo );
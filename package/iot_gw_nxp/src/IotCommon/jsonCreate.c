@@ -17,10 +17,10 @@
 #include <limits.h>
 
 #include "colorConv.h"
+#include "tlv.h"
+#include "jsonWriter.h"
 
 #define MAXJSONMESSAGE    500
-#define MAXNAME           30
-#define MAXNAMEVALUE      160   // was 80
 
 // #define JSON_DEBUG
 
@@ -35,35 +35,71 @@
 // ------------------------------------------------------------------
 
 static char jsonMessage[MAXJSONMESSAGE+2];
+static jsonWriter_t jsonWriter;     // Cursor in jsonMessage
 
 // ------------------------------------------------------------------
 // Constructors
 // ------------------------------------------------------------------
 
-static void catString( char * String ) {//-ӵַĺ
-    if ( ( strlen( jsonMessage ) + strlen( String ) ) < MAXJSONMESSAGE ) {
-        strcat( jsonMessage, String );	//-char
-    } else {
+// The constructors start a message by emptying jsonMessage
+static jsonWriter_t * catWriter( void ) {
+    if ( jsonMessage[0] == '\0' ) {
+        // New message: also start its TLV twin
+        jsonWriterInit( &jsonWriter, jsonMessage, MAXJSONMESSAGE, -1 );
+        tlvStart();
+    }
+    return( &jsonWriter );
+}
+
+static void catCheck( int error ) {
+    if ( jsonWriter.error && !error ) {
         printf( "Error: overflow in jsonCreate\n" );
+        tlvInvalidate();
+    }
+}
+
+static void catText( char * String ) {//-ӵַĺ
+    jsonWriter_t * w = catWriter();
+    int error = w->error;
+    jsonWriterText( w, String );
+    catCheck( error );
+}
+
+// Structure of the flat messages. Anything else has no TLV twin
+static void catString( char * String ) {
+    catText( String );
+    if ( strcmp( String, " }\n" ) == 0 ) {
+        tlvObjectEnd();
+        tlvBind( jsonMessage );
+    } else if ( strcmp( String, "\n" ) == 0 ) {
+        tlvBind( jsonMessage );
+    } else if ( strcmp( String, " : { " ) != 0 && strcmp( String, ", " ) != 0 ) {
+        tlvInvalidate();
     }
 }
 
 static void catName( char * name ) {//-γJSON﷨е
-    char buf[MAXNAME+2];
-    sprintf( buf, "\"%s\"", name );
-    catString( buf );	//-ӵǰַĺ
+    jsonWriter_t * w = catWriter();
+    int error = w->error;
+    jsonWriterString( w, name );	//-ӵǰַĺ
+    catCheck( error );
+    tlvObject( name );
 }
 
 static void catNameValueInt( char * name, int value ) {//-ǰֵֺ
-    char buf[MAXNAMEVALUE+2];
-    sprintf( buf, "\"%s\":%d", name, value );
-    catString( buf );
+    jsonWriter_t * w = catWriter();
+    int error = w->error;
+    jsonWriterNameInt( w, name, value );
+    catCheck( error );
+    tlvInteger( name, value );
 }
 
 static void catNameValueString( char * name, char * value ) {
-    char buf[MAXNAMEVALUE+2];
-    sprintf( buf, "\"%s\":\"%s\"", name, value );
-    catString( buf );
+    jsonWriter_t * w = catWriter();
+    int error = w->error;
+    jsonWriterNameString( w, name, value );
+    catCheck( error );
+    tlvString( name, value );
 }
 
 // ------------------------------------------------------------------------
@@ -816,8 +852,7 @@ char * jsonLampToZigbee( char * mac, char * cmd, int lvl, int rgb, int kelvin )
     if ( ( kelvin == 0 ) && ( rgb == 0 ) ) {
         // Choose white (0xFFFFFF), then we convert that to the xy color space
         rgb2xy( 0xFFFFFF, &xcr, &ycr );
-        printf( "x,y = %f,%f\n", (float)xcr / (float)0xFEFF,
-                                 (float)ycr / (float)0xFEFF );
+        printf( "x,y = 0x%04X,0x%04X (of 0xFEFF)\n", xcr, ycr );
         catString( ", " );
         catNameValueInt( "xcr", xcr );
         catString( ", " );
@@ -833,8 +868,7 @@ char * jsonLampToZigbee( char * mac, char * cmd, int lvl, int rgb, int kelvin )
     } else if ( rgb >= 0 ) {
         // If RGB is specified, then we convert that to the xy color space
         rgb2xy( rgb, &xcr, &ycr );
-        printf( "x,y = %f,%f\n", (float)xcr / (float)0xFEFF,
-                                 (float)ycr / (float)0xFEFF );
+        printf( "x,y = 0x%04X,0x%04X (of 0xFEFF)\n", xcr, ycr );
         catString( ", " );
         catNameValueInt( "xcr", xcr );
         catString( ", " );
@@ -1198,8 +1232,8 @@ char * jsonLampGroup( char * mac, char * grp, int grpid,
     return( jsonMessage );
 }
 
-char * jsonGroup( int grpid, char * scn, int scnid, char * cmd,
-                  int lvl, int rgb, int kelvin, int xcr, int ycr ) {
+static char * jsonGroupCmd( int grpid, char * lamps, char * scn, int scnid, char * cmd,
+                            int lvl, int rgb, int kelvin, int xcr, int ycr ) {
 
     if ( rgb >= 0 ) {
         // If RGB is specified, then we convert that to the xy color space
@@ -1225,7 +1259,11 @@ char * jsonGroup( int grpid, char * scn, int scnid, char * cmd,
     jsonMessage[0] = '\0';
     catName( "grp" );
     catString( " : { " );
-    catNameValueInt( "grpid", grpid );
+    if ( lamps != NULL ) {
+        catNameValueString( "lamps", lamps );
+    } else {
+        catNameValueInt( "grpid", grpid );
+    }
     if ( scn != NULL ) {
         catString( ", " );
         catNameValueString( "scn", scn );
@@ -1255,6 +1293,18 @@ char * jsonGroup( int grpid, char * scn, int scnid, char * cmd,
     return( jsonMessage );
 }
 
+char * jsonGroup( int grpid, char * scn, int scnid, char * cmd,
+                  int lvl, int rgb, int kelvin, int xcr, int ycr ) {
+    return( jsonGroupCmd( grpid, NULL, scn, scnid, cmd, lvl, rgb, kelvin, xcr, ycr ) );
+}
+
+// Group command to a set of lamps (comma separated device ids): ZCB finds or makes
+// a group with exactly these lamps and sends the command as one groupcast
+char * jsonGroupLamps( char * lamps, char * cmd,
+                       int lvl, int rgb, int kelvin, int xcr, int ycr ) {
+    return( jsonGroupCmd( -1, lamps, NULL, -1, cmd, lvl, rgb, kelvin, xcr, ycr ) );
+}
+
 // ------------------------------------------------------------------------
 // Gateway properties
 // ------------------------------------------------------------------------
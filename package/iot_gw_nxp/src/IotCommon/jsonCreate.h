@@ -256,6 +256,8 @@ char * jsonLampGroup( char * mac, char * grp, int grpid,
                       char * scn, int scnid );
 char * jsonGroup( int grpid, char * scn, int scnid,
             char * cmd, int lvl, int rgb, int kelvin, int xcr, int ycr );
+char * jsonGroupLamps( char * lamps, char * cmd,
+            int lvl, int rgb, int kelvin, int xcr, int ycr );
 
 // ------------------------------------------------------------------------
 // Gateway properties
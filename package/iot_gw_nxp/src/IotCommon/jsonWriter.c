@@ -0,0 +1,205 @@
+// ------------------------------------------------------------------
+// Streaming writer
+// ------------------------------------------------------------------
+// Builds (JSON) text at an explicit cursor in a preallocated buffer,
+// flushing it to a socket or stdout when it fills up
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2014. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \brief Streaming writer for JSON messages and DB serializations
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "jsonWriter.h"
+
+// -------------------------------------------------------------
+// Buffer
+// -------------------------------------------------------------
+
+static int jsonWriterWrite( jsonWriter_t * w, const char * data, int len ) {
+    while ( len > 0 ) {
+        int n = write( w->fd, data, len );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) {
+            w->error = 1;
+            return( 0 );
+        }
+        data += n;
+        len -= n;
+        w->flushed += n;
+    }
+    return( 1 );
+}
+
+/**
+ * \brief Start writing
+ * \param buf Output area
+ * \param cap Size of buf, including the '\0'
+ * \param fd Descriptor to flush to when buf is full, or -1 to keep all text in buf
+ */
+void jsonWriterInit( jsonWriter_t * w, char * buf, int cap, int fd ) {
+    w->buf     = buf;
+    w->cap     = cap;
+    w->len     = 0;
+    w->fd      = fd;
+    w->flushed = 0;
+    w->error   = ( buf == NULL || cap < 1 );
+    if ( !w->error ) buf[0] = '\0';
+}
+
+/**
+ * \brief Write the buffered text to the fd, when there is one
+ * \returns 1 on success, 0 on error
+ */
+int jsonWriterFlush( jsonWriter_t * w ) {
+    if ( w->fd >= 0 && w->len > 0 && !w->error ) {
+        jsonWriterWrite( w, w->buf, w->len );
+        w->len = 0;
+        w->buf[0] = '\0';
+    }
+    return( !w->error );
+}
+
+/**
+ * \brief Complete the text: flushes the rest when writing to an fd
+ * \returns The buffer, or NULL when something was lost
+ */
+char * jsonWriterEnd( jsonWriter_t * w ) {
+    jsonWriterFlush( w );
+    return( ( w->error ) ? NULL : w->buf );
+}
+
+/**
+ * \returns Total characters written so far, flushed or not
+ */
+int jsonWriterLength( jsonWriter_t * w ) {
+    return( w->flushed + w->len );
+}
+
+// -------------------------------------------------------------
+// Text
+// -------------------------------------------------------------
+
+/**
+ * \brief Append len characters of str
+ */
+void jsonWriterRaw( jsonWriter_t * w, const char * str, int len ) {
+    if ( w->error || len <= 0 ) return;
+    if ( w->len + len >= w->cap ) {
+        if ( w->fd < 0 ) {
+            w->error = 1;
+            return;
+        }
+        if ( !jsonWriterFlush( w ) ) return;
+        if ( len >= w->cap ) {
+            // Does not fit at all: straight through
+            jsonWriterWrite( w, str, len );
+            return;
+        }
+    }
+    memcpy( w->buf + w->len, str, len );
+    w->len += len;
+    w->buf[w->len] = '\0';
+}
+
+void jsonWriterText( jsonWriter_t * w, const char * str ) {
+    if ( str ) jsonWriterRaw( w, str, strlen( str ) );
+}
+
+void jsonWriterChar( jsonWriter_t * w, char c ) {
+    if ( !w->error && w->len + 1 < w->cap ) {
+        w->buf[w->len++] = c;
+        w->buf[w->len] = '\0';
+    } else {
+        jsonWriterRaw( w, &c, 1 );
+    }
+}
+
+/**
+ * \brief Append an integer in decimal
+ */
+void jsonWriterInt( jsonWriter_t * w, int value ) {
+    char digits[12];
+    int n = sizeof( digits );
+    unsigned int u = ( value < 0 ) ? 0u - (unsigned int)value : (unsigned int)value;
+
+    do {
+        digits[--n] = '0' + ( u % 10 );
+        u /= 10;
+    } while ( u );
+    if ( value < 0 ) digits[--n] = '-';
+
+    jsonWriterRaw( w, &digits[n], sizeof( digits ) - n );
+}
+
+// -------------------------------------------------------------
+// JSON
+// -------------------------------------------------------------
+
+/**
+ * \brief Append a quoted JSON string. Runs of plain characters are copied
+ * as they are, only quotes, backslashes and control characters are escaped
+ */
+void jsonWriterString( jsonWriter_t * w, const char * str ) {
+    static const char hex[] = "0123456789abcdef";
+    const char * p, * run;
+    char esc[6];
+
+    jsonWriterChar( w, '"' );
+    for ( p = run = ( str ) ? str : ""; *p; p++ ) {
+        unsigned char c = (unsigned char)*p;
+        if ( c != '"' && c != '\\' && c >= 0x20 ) continue;
+
+        jsonWriterRaw( w, run, (int)( p - run ) );
+        run = p + 1;
+        switch ( c ) {
+        case '"':  jsonWriterRaw( w, "\\\"", 2 ); break;
+        case '\\': jsonWriterRaw( w, "\\\\", 2 ); break;
+        case '\n': jsonWriterRaw( w, "\\n", 2 );  break;
+        case '\r': jsonWriterRaw( w, "\\r", 2 );  break;
+        case '\t': jsonWriterRaw( w, "\\t", 2 );  break;
+        default:
+            esc[0] = '\\';
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xF];
+            jsonWriterRaw( w, esc, 6 );
+            break;
+        }
+    }
+    jsonWriterRaw( w, run, (int)( p - run ) );
+    jsonWriterChar( w, '"' );
+}
+
+/**
+ * \brief Append "name":
+ */
+void jsonWriterName( jsonWriter_t * w, const char * name ) {
+    jsonWriterString( w, name );
+    jsonWriterChar( w, ':' );
+}
+
+/**
+ * \brief Append "name":value
+ */
+void jsonWriterNameInt( jsonWriter_t * w, const char * name, int value ) {
+    jsonWriterName( w, name );
+    jsonWriterInt( w, value );
+}
+
+/**
+ * \brief Append "name":"value"
+ */
+void jsonWriterNameString( jsonWriter_t * w, const char * name, const char * value ) {
+    jsonWriterName( w, name );
+    jsonWriterString( w, value );
+}
@@ -0,0 +1,38 @@
+// ------------------------------------------------------------------
+// Streaming writer - include file
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2014. All rights reserved
+// ------------------------------------------------------------------
+//
+// Appends text at a cursor in a caller supplied buffer, without
+// strlen/strcat/sprintf. With fd < 0 the buffer is the result: it is
+// kept '\0'-terminated and an overflow is an error that drops the rest.
+// With fd >= 0 the buffer is flushed to the fd (socket, stdout) each
+// time it fills, so the output has no size limit.
+//
+// ------------------------------------------------------------------
+
+typedef struct jsonWriter {
+    char * buf;
+    int    cap;             // Size of buf, including the '\0'
+    int    len;             // Cursor: characters in buf
+    int    fd;              // Flush target, or -1
+    int    flushed;         // Characters already written to fd
+    int    error;           // Overflow or write error: nothing is added anymore
+} jsonWriter_t;
+
+void   jsonWriterInit( jsonWriter_t * w, char * buf, int cap, int fd );
+int    jsonWriterFlush( jsonWriter_t * w );
+char * jsonWriterEnd( jsonWriter_t * w );
+int    jsonWriterLength( jsonWriter_t * w );
+
+void   jsonWriterRaw( jsonWriter_t * w, const char * str, int len );
+void   jsonWriterText( jsonWriter_t * w, const char * str );
+void   jsonWriterChar( jsonWriter_t * w, char c );
+void   jsonWriterInt( jsonWriter_t * w, int value );
+
+void   jsonWriterString( jsonWriter_t * w, const char * str );
+void   jsonWriterName( jsonWriter_t * w, const char * name );
+void   jsonWriterNameInt( jsonWriter_t * w, const char * name, int value );
+void   jsonWriterNameString( jsonWriter_t * w, const char * name, const char * value );
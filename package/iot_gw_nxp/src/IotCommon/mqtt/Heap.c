@@ -45,6 +45,10 @@ char* Broker_recordFFDC(char* symptoms);
 #undef realloc
 #undef free
 
+static heap_info state = {0, 0}; /**< global heap state information */
+static char* errmsg = "Memory allocation error";
+
+#if !defined(HEAP_POOLS)
 #if defined(WIN32) || defined(WIN64)
 mutex_type heap_mutex;
 #else
@@ -52,7 +56,6 @@ static pthread_mutex_t heap_mutex_store = PTHREAD_MUTEX_INITIALIZER;	//-
 static mutex_type heap_mutex = &heap_mutex_store;
 #endif
 
-static heap_info state = {0, 0}; /**< global heap state information */
 static int eyecatcher = 0x88888888;		//-ʶ
 
 /**
@@ -67,7 +70,7 @@ typedef struct
 } storageElement;	//-ڶеÿԱṹ¼.
 
 static Tree heap;	/**< Tree that holds the allocation records */
-static char* errmsg = "Memory allocation error";
+#endif
 
 /**
  * Round allocation size up to a multiple of the size of an int.  Apart from possibly reducing fragmentation,
@@ -86,6 +89,7 @@ int Heap_roundup(int size)	//-
 }
 
 
+#if !defined(HEAP_POOLS)
 /**
  * List callback function for comparing storage elements
  * @param a pointer to the current content in the tree (storageElement*)
@@ -376,6 +380,334 @@ void Heap_terminate()	//-
 }
 
 
+#else /* HEAP_POOLS */
+
+/*
+ * Release builds: size-class pools instead of the tracked heap.
+ *
+ * Blocks of up to 512 bytes (packets, Messages, list elements, topics) are recycled through
+ * one free list per size class, each with its own lock; larger blocks go straight to the
+ * system allocator.  Every block carries a small header naming its class.  There is no
+ * per-allocation record, so Heap_findItem cannot answer and the heap statistics come from
+ * the per-class counters.
+ */
+#if defined(WIN32) || defined(WIN64)
+#error "HEAP_POOLS is only implemented for pthreads"
+#endif
+
+#define HEAP_POOL_MAGIC 0x4850		/**< "HP", block handed out */
+#define HEAP_POOL_FREED 0x4846		/**< "HF", block on a free list */
+#define HEAP_POOL_LARGE -1			/**< class of blocks that bypass the pools */
+#define HEAP_POOL_MAX_CACHED 256	/**< free blocks kept per class, the rest go back to the system */
+
+/**
+ * Header in front of every block.
+ */
+typedef union
+{
+	struct
+	{
+		short magic;
+		short pool;		/**< index into pools, or HEAP_POOL_LARGE */
+		int size;		/**< usable size of the block */
+	} h;
+	double align;
+} poolHeader;
+
+/**
+ * One size class.
+ */
+typedef struct
+{
+	int size;				/**< usable size of the blocks in this class */
+	pthread_mutex_t lock;
+	void* free;				/**< cached free blocks, linked through their first bytes */
+	int cached;				/**< number of blocks on the free list */
+	int in_use;				/**< blocks handed out and not yet freed */
+	int max_in_use;			/**< high water mark of in_use */
+	unsigned long allocs;	/**< allocations served by this class */
+} poolClass;
+
+static poolClass pools[] =
+{
+	{16, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0},
+	{32, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0},
+	{64, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0},
+	{128, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0},
+	{256, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0},
+	{512, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0},
+};
+#define HEAP_POOL_COUNT (int)(sizeof(pools) / sizeof(pools[0]))
+
+static int large_in_use = 0;	/**< blocks handed out past the largest class */
+
+
+/**
+ * Keep the global heap state up to date without a global lock
+ * @param delta change in the number of bytes in use
+ */
+static void Heap_account(int delta)
+{
+	int now = __sync_add_and_fetch(&state.current_size, delta);
+	int max;
+
+	while (now > (max = state.max_size) && !__sync_bool_compare_and_swap(&state.max_size, max, now))
+		;
+}
+
+
+/**
+ * Find the size class for an allocation
+ * @param size the size actually needed
+ * @return index into pools, or HEAP_POOL_LARGE
+ */
+static int Heap_poolclass(size_t size)
+{
+	int i;
+
+	for (i = 0; i < HEAP_POOL_COUNT; i++)
+	{
+		if (size <= pools[i].size)
+			return i;
+	}
+	return HEAP_POOL_LARGE;
+}
+
+
+/**
+ * Allocates a block of memory from its size class, or from the system for large blocks.
+ * @param file use the __FILE__ macro to indicate which file this item was allocated in
+ * @param line use the __LINE__ macro to indicate which line this item was allocated at
+ * @param size the size of the item to be allocated
+ * @return pointer to the allocated item, or NULL if there was an error
+ */
+void* mymalloc(char* file, int line, size_t size)
+{
+	int pool = Heap_poolclass(size);
+	poolHeader* hdr = NULL;
+
+	if (pool == HEAP_POOL_LARGE)
+	{
+		size = Heap_roundup(size);
+		if ((hdr = malloc(sizeof(poolHeader) + size)) != NULL)
+			__sync_add_and_fetch(&large_in_use, 1);
+	}
+	else
+	{
+		poolClass* pc = &pools[pool];
+
+		size = pc->size;
+		pthread_mutex_lock(&pc->lock);
+		if (pc->free != NULL)
+		{
+			hdr = ((poolHeader*)pc->free) - 1;
+			pc->free = *(void**)pc->free;
+			pc->cached--;
+		}
+		pthread_mutex_unlock(&pc->lock);
+		if (hdr == NULL)
+			hdr = malloc(sizeof(poolHeader) + size);
+		if (hdr != NULL)
+		{
+			pthread_mutex_lock(&pc->lock);
+			pc->allocs++;
+			if (++pc->in_use > pc->max_in_use)
+				pc->max_in_use = pc->in_use;
+			pthread_mutex_unlock(&pc->lock);
+		}
+	}
+	if (hdr == NULL)
+	{
+		Log(LOG_ERROR, 13, errmsg);
+		return NULL;
+	}
+	hdr->h.magic = HEAP_POOL_MAGIC;
+	hdr->h.pool = pool;
+	hdr->h.size = size;
+	Heap_account(size);
+	return hdr + 1;
+}
+
+
+/**
+ * Frees a block of memory, returning it to its size class.
+ * @param file use the __FILE__ macro to indicate which file this item was allocated in
+ * @param line use the __LINE__ macro to indicate which line this item was allocated at
+ * @param p pointer to the item to be freed
+ */
+void myfree(char* file, int line, void* p)
+{
+	poolHeader* hdr;
+	poolClass* pc;
+
+	if (p == NULL)
+		return;
+	hdr = ((poolHeader*)p) - 1;
+	if (hdr->h.magic != HEAP_POOL_MAGIC)
+	{
+		Log(LOG_ERROR, 13, "Failed to remove heap item at file %s line %d", file, line);
+		return;
+	}
+	Heap_account(-hdr->h.size);
+	if (hdr->h.pool == HEAP_POOL_LARGE)
+	{
+		hdr->h.magic = HEAP_POOL_FREED;
+		__sync_sub_and_fetch(&large_in_use, 1);
+		free(hdr);
+		return;
+	}
+
+	pc = &pools[hdr->h.pool];
+	hdr->h.magic = HEAP_POOL_FREED;
+	pthread_mutex_lock(&pc->lock);
+	pc->in_use--;
+	if (pc->cached < HEAP_POOL_MAX_CACHED)
+	{
+		*(void**)p = pc->free;
+		pc->free = p;
+		pc->cached++;
+		hdr = NULL;
+	}
+	pthread_mutex_unlock(&pc->lock);
+	if (hdr != NULL)
+		free(hdr);
+}
+
+
+/**
+ * There is no allocation record to remove an item from in a pooled heap.
+ * @param file use the __FILE__ macro to indicate which file this item was allocated in
+ * @param line use the __LINE__ macro to indicate which line this item was allocated at
+ * @param p pointer to the item to be removed
+ */
+void Heap_unlink(char* file, int line, void* p)
+{
+}
+
+
+/**
+ * Reallocates a block of memory.  The block stays where it is while the new size
+ * still falls in its class.
+ * @param file use the __FILE__ macro to indicate which file this item was reallocated in
+ * @param line use the __LINE__ macro to indicate which line this item was reallocated at
+ * @param p pointer to the item to be reallocated
+ * @param size the new size of the item
+ * @return pointer to the allocated item, or NULL if there was an error
+ */
+void *myrealloc(char* file, int line, void* p, size_t size)
+{
+	poolHeader* hdr;
+	int pool = Heap_poolclass(size);
+	void* rc = NULL;
+
+	if (p == NULL)
+		return mymalloc(file, line, size);
+	hdr = ((poolHeader*)p) - 1;
+	if (hdr->h.magic != HEAP_POOL_MAGIC)
+	{
+		Log(LOG_ERROR, 13, "Failed to reallocate heap item at file %s line %d", file, line);
+		return NULL;
+	}
+	if (pool == hdr->h.pool && size <= hdr->h.size)
+		return p;
+	if (pool == HEAP_POOL_LARGE && hdr->h.pool == HEAP_POOL_LARGE)
+	{
+		int oldsize = hdr->h.size;
+
+		size = Heap_roundup(size);
+		if ((hdr = realloc(hdr, sizeof(poolHeader) + size)) == NULL)
+		{
+			Log(LOG_ERROR, 13, errmsg);
+			return NULL;
+		}
+		hdr->h.size = size;
+		Heap_account(size - oldsize);
+		return hdr + 1;
+	}
+	if ((rc = mymalloc(file, line, size)) != NULL)
+	{
+		memcpy(rc, p, (size < hdr->h.size) ? size : hdr->h.size);
+		myfree(file, line, p);
+	}
+	return rc;
+}
+
+
+/**
+ * Allocation records are not kept in a pooled heap, so no item can be found.
+ * @param p pointer to a memory location
+ * @return NULL
+ */
+void* Heap_findItem(void* p)
+{
+	return NULL;
+}
+
+
+/**
+ * Reports the per-class counters of the pooled heap.
+ */
+void HeapScan(int log_level)
+{
+	int i;
+
+	Log(log_level, -1, "Heap scan start, total %d bytes", state.current_size);
+	for (i = 0; i < HEAP_POOL_COUNT; i++)
+	{
+		poolClass* pc = &pools[i];
+
+		pthread_mutex_lock(&pc->lock);
+		Log(log_level, -1, "Heap pool %d bytes: in use %d, max %d, cached %d, allocations %lu",
+				pc->size, pc->in_use, pc->max_in_use, pc->cached, pc->allocs);
+		pthread_mutex_unlock(&pc->lock);
+	}
+	Log(log_level, -1, "Heap large blocks in use %d", large_in_use);
+	Log(log_level, -1, "Heap scan end");
+}
+
+
+/**
+ * Heap initialization.
+ */
+int Heap_initialize()
+{
+	return 0;
+}
+
+
+/**
+ * Heap termination.  Gives the cached free blocks back to the system.
+ */
+void Heap_terminate()
+{
+	int i;
+
+	Log(TRACE_MIN, -1, "Maximum heap use was %d bytes", state.max_size);
+	if (state.current_size > 20) /* One log list is freed after this function is called */
+	{
+		Log(LOG_ERROR, -1, "Some memory not freed at shutdown, possible memory leak");
+		HeapScan(LOG_ERROR);
+	}
+	for (i = 0; i < HEAP_POOL_COUNT; i++)
+	{
+		poolClass* pc = &pools[i];
+
+		pthread_mutex_lock(&pc->lock);
+		while (pc->free != NULL)
+		{
+			void* next = *(void**)pc->free;
+
+			free(((poolHeader*)pc->free) - 1);
+			pc->free = next;
+		}
+		pc->cached = 0;
+		pthread_mutex_unlock(&pc->lock);
+	}
+}
+
+#endif /* HEAP_POOLS */
+
+
 /**
  * Access to heap state
  * @return pointer to the heap state structure
@@ -413,6 +745,7 @@ int HeapDumpString(FILE* file, char* str)	//-ת
 int HeapDump(FILE* file)	//-תѵ״̬
 {
 	int rc = 0;
+#if !defined(HEAP_POOLS)
 	Node* current = NULL;
 
 	while (rc == 0 && (current = TreeNextElement(&heap, current)))
@@ -426,6 +759,7 @@ int HeapDump(FILE* file)	//-ת
 		else if (fwrite(s->ptr, current->size, 1, file) != 1)
 			rc = -1;
 	}
+#endif
 	return rc;
 }
 
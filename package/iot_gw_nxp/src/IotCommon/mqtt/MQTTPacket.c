@@ -29,6 +29,7 @@
 	#include "MQTTPersistence.h"
 #endif
 #include "Messages.h"
+#include "SocketBuffer.h"
 #include "StackTrace.h"
 
 #include <stdlib.h>
@@ -192,10 +193,9 @@ exit:
 int MQTTPacket_send(networkHandles* net, Header header, char* buffer, size_t buflen, int free)
 {
 	int rc, buf0len;
-	char *buf;
+	char buf[5];	/* header byte and up to 4 remaining length bytes */
 
 	FUNC_ENTRY;
-	buf = malloc(10);
 	buf[0] = header.byte;
 	buf0len = 1 + MQTTPacket_encode(&buf[1], buflen);	//-͵ݳ,иʽת
 #if !defined(NO_PERSISTENCE)
@@ -214,12 +214,9 @@ int MQTTPacket_send(networkHandles* net, Header header, char* buffer, size_t buf
 	else
 #endif
 		rc = Socket_putdatas(net->socket, buf, buf0len, 1, &buffer, &buflen, &free);	//-ʵݷ
-		
+
 	if (rc == TCPSOCKET_COMPLETE)
 		time(&(net->lastSent));		//-¼һη͵ʱ
-	
-	if (rc != TCPSOCKET_INTERRUPTED)
-	  free(buf);	//-˿ռͿͷ
 
 	FUNC_EXIT_RC(rc);
 	return rc;
@@ -227,46 +224,72 @@ int MQTTPacket_send(networkHandles* net, Header header, char* buffer, size_t buf
 
 
 /**
- * Sends an MQTT packet from multiple buffers in one system call write
- * @param socket the socket to which to write the data
+ * Sends an MQTT packet whose fixed header the caller has already encoded on its stack,
+ * followed by the other buffers, in one system call write.  Nothing is copied unless
+ * the write is interrupted, see SocketBuffer_pendingWrite.
+ * @param net the network handles to which to write the data
  * @param header the one-byte MQTT header
+ * @param buf0 the encoded fixed header, remaining length and any bytes that directly follow
+ * @param buf0len the length of buf0
  * @param count the number of buffers
- * @param buffers the rest of the buffers to write (not including remaining length)
+ * @param buffers the rest of the buffers to write
  * @param buflens the lengths of the data in the array of buffers to be written
+ * @param frees SOCKETBUFFER_FREE, SOCKETBUFFER_REFERENCED or SOCKETBUFFER_TRANSIENT for each buffer
+ * @param msgId the message id, used to persist QoS 1 and 2 publishes
  * @return the completion code (TCPSOCKET_COMPLETE etc)
  */
-int MQTTPacket_sends(networkHandles* net, Header header, int count, char** buffers, size_t* buflens, int* frees)
+static int MQTTPacket_sendv(networkHandles* net, Header header, char* buf0, size_t buf0len, int count,
+		char** buffers, size_t* buflens, int* frees, int msgId)
 {
-	int i, rc, buf0len, total = 0;
-	char *buf;
+	int rc;
 
 	FUNC_ENTRY;
-	buf = malloc(10);
-	buf[0] = header.byte;	//-Message TypeϢͣFlagsDUPQoSRETAINֶ
-	for (i = 0; i < count; i++)
-		total += buflens[i];	//-ͬڵֽ
-	buf0len = 1 + MQTTPacket_encode(&buf[1], total);	//-ֽתΪMQTT֡ʣ೤ֶ,ձʾǹ̶ͷĳ
 #if !defined(NO_PERSISTENCE)
-	if (header.bits.type == PUBLISH && header.bits.qos != 0)	//-ݹ̶ͷвͬ֡Ϳʼ֯
+	if (header.bits.type == PUBLISH && header.bits.qos != 0)
 	{   /* persist PUBLISH QoS1 and Qo2 */
-		char *ptraux = buffers[2];
-		int msgId = readInt(&ptraux);
-		rc = MQTTPersistence_put(net->socket, buf, buf0len, count, buffers, buflens,
+		rc = MQTTPersistence_put(net->socket, buf0, buf0len, count, buffers, buflens,
 			header.bits.type, msgId, 0);
 	}
 #endif
 #if defined(OPENSSL)
 	if (net->ssl)
-		rc = SSLSocket_putdatas(net->ssl, net->socket, buf, buf0len, count, buffers, buflens, frees);
+		rc = SSLSocket_putdatas(net->ssl, net->socket, buf0, buf0len, count, buffers, buflens, frees);
 	else
 #endif
-		rc = Socket_putdatas(net->socket, buf, buf0len, count, buffers, buflens, frees);
-		
+		rc = Socket_putdatas(net->socket, buf0, buf0len, count, buffers, buflens, frees);
+
 	if (rc == TCPSOCKET_COMPLETE)
 		time(&(net->lastSent));
-	
-	if (rc != TCPSOCKET_INTERRUPTED)
-	  free(buf);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Sends an MQTT packet from multiple buffers in one system call write
+ * @param socket the socket to which to write the data
+ * @param header the one-byte MQTT header
+ * @param count the number of buffers
+ * @param buffers the rest of the buffers to write (not including remaining length)
+ * @param buflens the lengths of the data in the array of buffers to be written
+ * @return the completion code (TCPSOCKET_COMPLETE etc)
+ */
+int MQTTPacket_sends(networkHandles* net, Header header, int count, char** buffers, size_t* buflens, int* frees)
+{
+	int i, rc, buf0len, total = 0, msgId = 0;
+	char buf[5];	/* header byte and up to 4 remaining length bytes */
+
+	FUNC_ENTRY;
+	buf[0] = header.byte;	//-Message TypeϢͣFlagsDUPQoSRETAINֶ
+	for (i = 0; i < count; i++)
+		total += buflens[i];	//-ͬڵֽ
+	buf0len = 1 + MQTTPacket_encode(&buf[1], total);	//-ֽתΪMQTT֡ʣ೤ֶ,ձʾǹ̶ͷĳ
+	if (header.bits.type == PUBLISH && header.bits.qos != 0)
+	{
+		char *ptraux = buffers[2];
+		msgId = readInt(&ptraux);
+	}
+	rc = MQTTPacket_sendv(net, header, buf, buf0len, count, buffers, buflens, frees, msgId);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -688,43 +711,41 @@ void* MQTTPacket_ack(unsigned char aHeader, char* data, size_t datalen)
 int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, networkHandles* net, const char* clientID)	//-ͷ֡
 {
 	Header header;
-	char *topiclen;
-	int rc = -1;
+	char buf0[7];	/* header byte, up to 4 remaining length bytes and the topic length */
+	char msgid[2];
+	char *ptr;
+	size_t topiclen = strlen(pack->topic);
+	int buf0len, rc = -1;
 
 	FUNC_ENTRY;
-	topiclen = malloc(2);
-
 	header.bits.type = PUBLISH;
 	header.bits.dup = dup;
 	header.bits.qos = qos;
 	header.bits.retain = retained;
+	buf0[0] = header.byte;
+	buf0len = 1 + MQTTPacket_encode(&buf0[1], 2 + topiclen + ((qos > 0) ? 2 : 0) + pack->payloadlen);
+	ptr = &buf0[buf0len];
+	writeInt(&ptr, topiclen);
+	buf0len += 2;
+	/* topic and payload are written from the caller's (or the stored Publications') buffers */
 	if (qos > 0)
 	{
-		char *buf = malloc(2);
-		char *ptr = buf;
-		char* bufs[4] = {topiclen, pack->topic, buf, pack->payload};
-		size_t lens[4] = {2, strlen(pack->topic), 2, pack->payloadlen};
-		int frees[4] = {1, 0, 1, 0};
+		char* bufs[3] = {pack->topic, msgid, pack->payload};
+		size_t lens[3] = {topiclen, 2, pack->payloadlen};
+		int frees[3] = {SOCKETBUFFER_REFERENCED, SOCKETBUFFER_TRANSIENT, SOCKETBUFFER_REFERENCED};
 
+		ptr = msgid;
 		writeInt(&ptr, pack->msgId);
-		ptr = topiclen;
-		writeInt(&ptr, lens[1]);
-		rc = MQTTPacket_sends(net, header, 4, bufs, lens, frees);
-		if (rc != TCPSOCKET_INTERRUPTED)
-			free(buf);
+		rc = MQTTPacket_sendv(net, header, buf0, buf0len, 3, bufs, lens, frees, pack->msgId);
 	}
 	else
 	{
-		char* ptr = topiclen;
-		char* bufs[3] = {topiclen, pack->topic, pack->payload};
-		size_t lens[3] = {2, strlen(pack->topic), pack->payloadlen};
-		int frees[3] = {1, 0, 0};
+		char* bufs[2] = {pack->topic, pack->payload};
+		size_t lens[2] = {topiclen, pack->payloadlen};
+		int frees[2] = {SOCKETBUFFER_REFERENCED, SOCKETBUFFER_REFERENCED};
 
-		writeInt(&ptr, lens[1]);
-		rc = MQTTPacket_sends(net, header, 3, bufs, lens, frees);
+		rc = MQTTPacket_sendv(net, header, buf0, buf0len, 2, bufs, lens, frees, 0);
 	}
-	if (rc != TCPSOCKET_INTERRUPTED)
-		free(topiclen);
 	if (qos == 0)
 		Log(LOG_PROTOCOL, 27, NULL, net->socket, clientID, retained, rc);
 	else
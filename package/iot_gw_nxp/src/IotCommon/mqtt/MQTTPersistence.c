@@ -200,7 +200,6 @@ int MQTTPersistence_restore(Clients *c)	//-
 						msg->nextMessageType = PUBREL;
 						/* order does not matter for persisted received messages */
 						ListAppend(c->inboundMsgs, msg, msg->len);
-						publish->topic = NULL;
 						MQTTPacket_freePublish(publish);
 						msgs_rcvd++;
 					}
@@ -218,7 +217,6 @@ int MQTTPersistence_restore(Clients *c)	//-
 						/* retry at the first opportunity */
 						msg->lastTouch = 0;
 						MQTTPersistence_insertInOrder(c->outboundMsgs, msg, msg->len);
-						publish->topic = NULL;
 						MQTTPacket_freePublish(publish);
 						free(key);
 						msgs_sent++;
@@ -0,0 +1,620 @@
+/*******************************************************************************
+ * Copyright (c) 2009, 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief An append-log persistence implementation.
+ *
+ * Uses the same client directory as the file system persistence (see ::pstopen),
+ * but keeps all messages in one segment file instead of a file per message.
+ * Every put or remove appends a record; an index in memory maps each key to its
+ * latest record. Syncs to flash are batched (::PSTLOG_SYNC_COUNT, ::PSTLOG_SYNC_SECS),
+ * so after a power cut the last records may be gone, never half there: a torn
+ * record at the end fails its checksum and is cut off when the store is opened.
+ * When more than half the segment is removed or replaced records, the live ones
+ * are copied to a new segment which then replaces the old one.
+ *
+ * Use it with ::MQTTCLIENT_PERSISTENCE_USER and a structure filled in by
+ * MQTTPersistenceLog_init().
+ */
+
+#if !defined(NO_PERSISTENCE) && !defined(WIN32) && !defined(WIN64)
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "MQTTClientPersistence.h"
+#include "MQTTPersistenceDefault.h"
+#include "MQTTPersistenceLog.h"
+#include "Tree.h"
+#include "Log.h"
+#include "StackTrace.h"
+#include "Heap.h"
+
+#define PSTLOG_MAGIC 0x4C54514D	/* "MQTL" */
+#define PSTLOG_REMOVED 0xFFFFFFFF /* datalen of a remove record */
+#define PSTLOG_MAX_KEY 256
+#define PSTLOG_MAX_BUFFERS 8
+
+/** Record header, followed by the key (with its '\0') and the data */
+typedef struct
+{
+	unsigned int magic;
+	unsigned int keylen;
+	unsigned int datalen;
+	unsigned int sum;	/**< over key and data */
+} pstlog_header;
+
+/** Index entry: where the latest record of a key is */
+typedef struct
+{
+	char* key;
+	long offset;	/**< of the record in the segment */
+	int len;		/**< of the data */
+} pstlog_entry;
+
+/** Handle of an open store */
+typedef struct
+{
+	char* clientDir;
+	char* file;
+	int fd;
+	long size;		/**< bytes in the segment */
+	long live;		/**< bytes of records the index points to */
+	Tree* index;
+	int unsynced;
+	time_t synced;
+} pstlog;
+
+static int pstlogload(pstlog* log);
+static int pstlogappend(pstlog* log, char* key, int bufcount, char* buffers[], int buflens[], int remove);
+static void pstlogsync(pstlog* log, int force);
+static void pstlogcompact(pstlog* log);
+static void pstlogfreeindex(pstlog* log);
+
+
+static int pstlogcompare(void* a, void* b, int content)
+{
+	char* key = (content) ? ((pstlog_entry*)b)->key : (char*)b;
+
+	return strcmp(((pstlog_entry*)a)->key, key);
+}
+
+
+static unsigned int pstlogsum(unsigned int sum, char* data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		sum = (sum ^ (unsigned char)data[i]) * 16777619;	/* FNV-1a */
+	return sum;
+}
+
+
+static long pstlogrecordlen(int keylen, int datalen)
+{
+	return sizeof(pstlog_header) + keylen + datalen;
+}
+
+
+/** Fill in a persistence structure for use with ::MQTTCLIENT_PERSISTENCE_USER.
+ *  @param directory base directory, as the context of the file system persistence
+ */
+void MQTTPersistenceLog_init(MQTTClient_persistence* per, char* directory)
+{
+	per->context      = (directory != NULL) ? directory : ".";
+	per->popen        = pstlogopen;
+	per->pclose       = pstlogclose;
+	per->pput         = pstlogput;
+	per->pget         = pstlogget;
+	per->premove      = pstlogremove;
+	per->pkeys        = pstlogkeys;
+	per->pclear       = pstlogclear;
+	per->pcontainskey = pstlogcontainskey;
+}
+
+
+/** Create the client directory as ::pstopen does and load the segment in it.
+ *  See ::Persistence_open
+ */
+int pstlogopen(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+	int rc = 0;
+	char* clientDir = NULL;
+	pstlog* log = NULL;
+
+	FUNC_ENTRY;
+	if ((rc = pstopen((void**)&clientDir, clientID, serverURI, context)) != 0)
+		goto exit;
+
+	log = malloc(sizeof(pstlog));
+	memset(log, '\0', sizeof(pstlog));
+	log->clientDir = clientDir;
+	/* consider '/' + '\0' */
+	log->file = malloc(strlen(clientDir) + strlen(PSTLOG_FILENAME) + 2);
+	sprintf(log->file, "%s/%s", clientDir, PSTLOG_FILENAME);
+	log->index = TreeInitialize(pstlogcompare);
+	log->synced = time(NULL);
+
+	if ((log->fd = open(log->file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0 || pstlogload(log) != 0)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		if (log->fd >= 0)
+			close(log->fd);
+		pstlogfreeindex(log);
+		TreeFree(log->index);
+		free(log->file);
+		free(log);
+		pstclose(clientDir);
+		goto exit;
+	}
+
+	*handle = log;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Rebuild the index from the segment. A record that is cut short or fails its
+ *  checksum ends the segment: it and anything after it are truncated.
+ */
+static int pstlogload(pstlog* log)
+{
+	int rc = 0;
+	pstlog_header hdr;
+	char* buf = NULL;
+	int buflen = 0;
+	long offset = 0;
+
+	FUNC_ENTRY;
+	lseek(log->fd, 0, SEEK_SET);
+	while (read(log->fd, &hdr, sizeof(hdr)) == sizeof(hdr))
+	{
+		int datalen = (hdr.datalen == PSTLOG_REMOVED) ? 0 : hdr.datalen;
+		pstlog_entry* entry;
+
+		if (hdr.magic != PSTLOG_MAGIC || hdr.keylen < 2 || hdr.keylen > PSTLOG_MAX_KEY ||
+			(hdr.datalen != PSTLOG_REMOVED && hdr.datalen > 0x7FFFFFF))
+			break;
+		if (hdr.keylen + datalen > buflen)
+		{
+			free(buf);
+			buflen = hdr.keylen + datalen;
+			buf = malloc(buflen);
+		}
+		if (read(log->fd, buf, hdr.keylen + datalen) != hdr.keylen + datalen ||
+			buf[hdr.keylen - 1] != '\0' || pstlogsum(0, buf, hdr.keylen + datalen) != hdr.sum)
+			break;
+
+		/* the latest record of a key wins */
+		if ((entry = TreeRemoveKey(log->index, buf)) != NULL)
+		{
+			log->live -= pstlogrecordlen(strlen(entry->key) + 1, entry->len);
+			free(entry->key);
+			free(entry);
+		}
+		if (hdr.datalen != PSTLOG_REMOVED)
+		{
+			entry = malloc(sizeof(pstlog_entry));
+			entry->key = malloc(hdr.keylen);
+			strcpy(entry->key, buf);
+			entry->offset = offset;
+			entry->len = datalen;
+			TreeAdd(log->index, entry, sizeof(pstlog_entry));
+			log->live += pstlogrecordlen(hdr.keylen, datalen);
+		}
+		offset += pstlogrecordlen(hdr.keylen, datalen);
+	}
+	free(buf);
+
+	if (offset != lseek(log->fd, 0, SEEK_END))
+	{
+		Log(TRACE_MIN, -1, "Truncating persistence segment %s at %ld", log->file, offset);
+		if (ftruncate(log->fd, offset) != 0)
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	}
+	log->size = offset;
+
+	if (rc == 0)
+		pstlogcompact(log);
+
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Append one record to the segment; on a short write the segment is cut back. */
+static int pstlogappend(pstlog* log, char* key, int bufcount, char* buffers[], int buflens[], int remove)
+{
+	int rc = 0;
+	pstlog_header hdr;
+	struct iovec iov[PSTLOG_MAX_BUFFERS + 2];
+	long total;
+	int i;
+
+	FUNC_ENTRY;
+	if (bufcount > PSTLOG_MAX_BUFFERS || strlen(key) + 1 > PSTLOG_MAX_KEY)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	hdr.magic = PSTLOG_MAGIC;
+	hdr.keylen = strlen(key) + 1;
+	hdr.datalen = 0;
+	hdr.sum = pstlogsum(0, key, hdr.keylen);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = key;
+	iov[1].iov_len = hdr.keylen;
+	for (i = 0; i < bufcount; i++)
+	{
+		hdr.datalen += buflens[i];
+		hdr.sum = pstlogsum(hdr.sum, buffers[i], buflens[i]);
+		iov[i + 2].iov_base = buffers[i];
+		iov[i + 2].iov_len = buflens[i];
+	}
+	if (remove)
+		hdr.datalen = PSTLOG_REMOVED;
+	total = pstlogrecordlen(hdr.keylen, (remove) ? 0 : hdr.datalen);
+
+	if (lseek(log->fd, log->size, SEEK_SET) != log->size || writev(log->fd, iov, bufcount + 2) != total)
+	{
+		if (ftruncate(log->fd, log->size) != 0)
+			Log(TRACE_MIN, -1, "Persistence segment %s could not be cut back", log->file);
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	log->size += total;
+	pstlogsync(log, 0);
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static void pstlogsync(pstlog* log, int force)
+{
+	time_t now = time(NULL);
+
+	if (!force && ++(log->unsynced) < PSTLOG_SYNC_COUNT && now - log->synced < PSTLOG_SYNC_SECS)
+		return;
+	fsync(log->fd);
+	log->unsynced = 0;
+	log->synced = now;
+}
+
+
+/** Copy the live records to a new segment when most of the old one is dead.
+ *  The new segment only replaces the old one once it is complete and synced,
+ *  so a failure leaves the old one in use.
+ */
+static void pstlogcompact(pstlog* log)
+{
+	char* tmpfile = NULL;
+	char* buf = NULL;
+	int buflen = 0;
+	int fd = -1;
+	long offset = 0;
+	Node* cur = NULL;
+
+	FUNC_ENTRY;
+	if (log->size < PSTLOG_COMPACT_MIN || log->live * 2 > log->size)
+		goto exit;
+
+	Log(TRACE_MIN, -1, "Compacting persistence segment %s: %ld of %ld bytes live", log->file, log->live, log->size);
+	/* consider ".tmp" + '\0' */
+	tmpfile = malloc(strlen(log->file) + 5);
+	sprintf(tmpfile, "%s.tmp", log->file);
+	if ((fd = open(tmpfile, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0)
+		goto exit;
+
+	while ((cur = TreeNextElement(log->index, cur)) != NULL)
+	{
+		pstlog_entry* entry = (pstlog_entry*)(cur->content);
+		long len = pstlogrecordlen(strlen(entry->key) + 1, entry->len);
+
+		if (len > buflen)
+		{
+			free(buf);
+			buflen = len;
+			buf = malloc(buflen);
+		}
+		if (pread(log->fd, buf, len, entry->offset) != len || write(fd, buf, len) != len)
+			goto exit;
+	}
+	if (fsync(fd) != 0 || rename(tmpfile, log->file) != 0)
+		goto exit;
+
+	/* same order as they were copied in */
+	while ((cur = TreeNextElement(log->index, cur)) != NULL)
+	{
+		pstlog_entry* entry = (pstlog_entry*)(cur->content);
+
+		entry->offset = offset;
+		offset += pstlogrecordlen(strlen(entry->key) + 1, entry->len);
+	}
+	close(log->fd);
+	log->fd = fd;
+	fd = -1;
+	log->size = log->live = offset;
+	log->unsynced = 0;
+	log->synced = time(NULL);
+
+exit:
+	if (fd >= 0)
+	{
+		Log(TRACE_MIN, -1, "Compacting persistence segment %s failed", log->file);
+		close(fd);
+		unlink(tmpfile);
+	}
+	free(tmpfile);
+	free(buf);
+	FUNC_EXIT;
+}
+
+
+static void pstlogfreeindex(pstlog* log)
+{
+	Node* cur;
+
+	while ((cur = TreeNextElement(log->index, NULL)) != NULL)
+	{
+		pstlog_entry* entry = TreeRemove(log->index, cur->content);
+
+		free(entry->key);
+		free(entry);
+	}
+	log->live = 0;
+}
+
+
+/** Sync and close the segment; delete it and the client directory when empty.
+ *  See ::Persistence_close
+ */
+int pstlogclose(void* handle)
+{
+	int rc = 0;
+	pstlog* log = handle;
+
+	FUNC_ENTRY;
+	if (log == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	pstlogsync(log, 1);
+	close(log->fd);
+	if (log->index->count == 0)
+		unlink(log->file);
+	pstlogfreeindex(log);
+	TreeFree(log->index);
+	rc = pstclose(log->clientDir);
+	free(log->file);
+	free(log);
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Append a wire message to the segment.
+ *  See ::Persistence_put
+ */
+int pstlogput(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	int rc = 0;
+	pstlog* log = handle;
+	pstlog_entry* entry;
+	long offset;
+
+	FUNC_ENTRY;
+	if (log == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	offset = log->size;
+	if ((rc = pstlogappend(log, key, bufcount, buffers, buflens, 0)) != 0)
+		goto exit;
+
+	if ((entry = TreeRemoveKey(log->index, key)) != NULL)
+		log->live -= pstlogrecordlen(strlen(entry->key) + 1, entry->len);
+	else
+	{
+		entry = malloc(sizeof(pstlog_entry));
+		entry->key = malloc(strlen(key) + 1);
+		strcpy(entry->key, key);
+	}
+	entry->offset = offset;
+	entry->len = log->size - offset - pstlogrecordlen(strlen(key) + 1, 0);
+	TreeAdd(log->index, entry, sizeof(pstlog_entry));
+	log->live += log->size - offset;
+
+	pstlogcompact(log);
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Read a wire message from the segment.
+ *  See ::Persistence_get
+ */
+int pstlogget(void* handle, char* key, char** buffer, int* buflen)
+{
+	int rc = 0;
+	pstlog* log = handle;
+	Node* node;
+	pstlog_entry* entry;
+	char* buf;
+
+	FUNC_ENTRY;
+	if (log == NULL || (node = TreeFind(log->index, key)) == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	entry = (pstlog_entry*)(node->content);
+	buf = malloc((entry->len > 0) ? entry->len : 1);
+	if (pread(log->fd, buf, entry->len, entry->offset + pstlogrecordlen(strlen(key) + 1, 0)) != entry->len)
+	{
+		free(buf);
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	*buffer = buf;
+	*buflen = entry->len;
+	/* the caller must free buf */
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Append a remove record for a key; an unknown key is not an error.
+ *  See ::Persistence_remove
+ */
+int pstlogremove(void* handle, char* key)
+{
+	int rc = 0;
+	pstlog* log = handle;
+	pstlog_entry* entry;
+
+	FUNC_ENTRY;
+	if (log == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	if (TreeFind(log->index, key) == NULL)
+		goto exit;
+
+	if ((rc = pstlogappend(log, key, 0, NULL, NULL, 1)) != 0)
+		goto exit;
+
+	entry = TreeRemoveKey(log->index, key);
+	log->live -= pstlogrecordlen(strlen(entry->key) + 1, entry->len);
+	free(entry->key);
+	free(entry);
+
+	pstlogcompact(log);
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns the keys of the index.
+ *  See ::Persistence_keys
+ */
+int pstlogkeys(void* handle, char*** keys, int* nkeys)
+{
+	int rc = 0;
+	pstlog* log = handle;
+	char** fkeys = NULL;
+	Node* cur = NULL;
+	int i = 0;
+
+	FUNC_ENTRY;
+	if (log == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	if (log->index->count > 0)
+	{
+		fkeys = (char**)malloc(log->index->count * sizeof(char*));
+		while ((cur = TreeNextElement(log->index, cur)) != NULL)
+		{
+			pstlog_entry* entry = (pstlog_entry*)(cur->content);
+
+			fkeys[i] = malloc(strlen(entry->key) + 1);
+			strcpy(fkeys[i++], entry->key);
+		}
+	}
+	*nkeys = i;
+	*keys = fkeys;
+	/* the caller must free keys */
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Empty the index and the segment.
+ *  See ::Persistence_clear
+ */
+int pstlogclear(void* handle)
+{
+	int rc = 0;
+	pstlog* log = handle;
+
+	FUNC_ENTRY;
+	if (log == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+
+	pstlogfreeindex(log);
+	if (ftruncate(log->fd, 0) != 0)
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	log->size = 0;
+	pstlogsync(log, 1);
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns whether a key is in the index.
+ *  See ::Persistence_containskey
+ */
+int pstlogcontainskey(void* handle, char* key)
+{
+	int rc = 0;
+	pstlog* log = handle;
+
+	FUNC_ENTRY;
+	if (log == NULL || TreeFind(log->index, key) == NULL)
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*******************************************************************************
+ * Copyright (c) 2009, 2013 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution. 
+ *
+ * The Eclipse Public License is available at 
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at 
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+#if !defined(MQTTPERSISTENCELOG_H)
+#define MQTTPERSISTENCELOG_H
+
+#include "MQTTClientPersistence.h"
+
+/** Name of the segment file in the client persistence directory */
+#define PSTLOG_FILENAME "mqtt.log"
+/** Records written before the segment is synced to flash */
+#define PSTLOG_SYNC_COUNT 16
+/** Seconds after which a write syncs the segment anyway */
+#define PSTLOG_SYNC_SECS 1
+/** Segment size below which it is never compacted */
+#define PSTLOG_COMPACT_MIN (64 * 1024)
+
+/* prototypes of the functions for the append-log persistence */
+int pstlogopen(void** handle, const char* clientID, const char* serverURI, void* context);
+int pstlogclose(void* handle);
+int pstlogput(void* handle, char* key, int bufcount, char* buffers[], int buflens[]);
+int pstlogget(void* handle, char* key, char** buffer, int* buflen);
+int pstlogremove(void* handle, char* key);
+int pstlogkeys(void* handle, char*** keys, int* nkeys);
+int pstlogclear(void* handle);
+int pstlogcontainskey(void* handle, char* key);
+
+void MQTTPersistenceLog_init(MQTTClient_persistence* per, char* directory);
+
+#endif
@@ -211,13 +211,9 @@ Publications* MQTTProtocol_storePublication(Publish* publish, int* len)	//-
 	p->refcount = 1;
 
 	*len = strlen(publish->topic)+1;
-	if (Heap_findItem(publish->topic))
-		p->topic = publish->topic;	//-һķ֡ȡҪϢһ洢ķ֡
-	else
-	{
-		p->topic = malloc(*len);
-		strcpy(p->topic, publish->topic);
-	}
+	/* always a copy: whether the caller's topic is on the heap can only be told by the tracked heap */
+	p->topic = malloc(*len);
+	strcpy(p->topic, publish->topic);
 	*len += sizeof(Publications);
 
 	p->topiclen = publish->topiclen;
@@ -301,7 +297,6 @@ int MQTTProtocol_handlePublishes(void* pack, int sock)	//-
 		} else
 			ListAppend(client->inboundMsgs, m, sizeof(Messages) + len);
 		rc = MQTTPacket_send_pubrec(publish->msgId, &client->net, client->clientID);
-		publish->topic = NULL;
 	}
 	MQTTPacket_freePublish(publish);
 	FUNC_EXIT_RC(rc);
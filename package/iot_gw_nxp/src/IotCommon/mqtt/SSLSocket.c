@@ -757,10 +757,9 @@ int SSLSocket_putdatas(SSL* ssl, int socket, char* buf0, size_t buf0len, int cou
 	else
 	{
 		int i;
-		free(buf0);
 		for (i = 0; i < count; ++i)
 		{
-			if (frees[i])
+			if (frees[i] == SOCKETBUFFER_FREE)
 				free(buffers[i]);
 		}	
 	}
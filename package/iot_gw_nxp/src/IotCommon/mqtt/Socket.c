@@ -445,11 +445,13 @@ int Socket_writev(int socket, iobuf* iovecs, int count, unsigned long* bytes)	//
  *  Attempts to write a series of buffers to a socket in *one* system call so that they are
  *  sent as one packet.
  *  @param socket the socket to write to
- *  @param buf0 the first buffer
+ *  @param buf0 the first buffer, normally the fixed header on the caller's stack; it is copied if
+ *  the write is interrupted and never freed
  *  @param buf0len the length of data in the first buffer
  *  @param count number of buffers
  *  @param buffers an array of buffers to write
  *  @param buflens an array of corresponding buffer lengths
+ *  @param frees SOCKETBUFFER_FREE, SOCKETBUFFER_REFERENCED or SOCKETBUFFER_TRANSIENT for each buffer
  *  @return completion code, especially TCPSOCKET_INTERRUPTED
  */
 int Socket_putdatas(int socket, char* buf0, size_t buf0len, int count, char** buffers, size_t* buflens, int* frees)	//-ͳȥ,ǲȫܷ͵,ûед뻺
@@ -472,7 +474,7 @@ int Socket_putdatas(int socket, char* buf0, size_t buf0len, int count, char** bu
 	//-ΪյӲд,֯
 	iovecs[0].iov_base = buf0;
 	iovecs[0].iov_len = buf0len;
-	frees1[0] = 1;
+	frees1[0] = SOCKETBUFFER_TRANSIENT;
 	for (i = 0; i < count; i++)	//-лݻط洢,ṹʽд
 	{
 		iovecs[i+1].iov_base = buffers[i];
@@ -756,7 +758,6 @@ int Socket_continueWrite(int socket)	//-
 			int offset = pw->bytes - curbuflen;
 			iovecs1[++curbuf].iov_len = pw->iovecs[i].iov_len - offset;
 			iovecs1[curbuf].iov_base = pw->iovecs[i].iov_base + offset;
-			break;
 		}
 		curbuflen += pw->iovecs[i].iov_len;
 	}
@@ -298,6 +298,7 @@ void SocketBuffer_queueChar(int socket, char c)
  * @param socket the socket for which the write was interrupted
  * @param count the number of iovec buffers
  * @param iovecs buffer array
+ * @param frees SOCKETBUFFER_FREE, SOCKETBUFFER_REFERENCED or SOCKETBUFFER_TRANSIENT for each buffer
  * @param total total data length to be written
  * @param bytes actual data length that was written
  */
@@ -308,6 +309,7 @@ void SocketBuffer_pendingWrite(int socket, int count, iobuf* iovecs, int* frees,
 #endif
 {//-׽джԴ洢ʣ
 	int i = 0;
+	size_t used = 0;
 	pending_writes* pw = NULL;
 
 	FUNC_ENTRY;
@@ -324,6 +326,21 @@ void SocketBuffer_pendingWrite(int socket, int count, iobuf* iovecs, int* frees,
 	{
 		pw->iovecs[i] = iovecs[i];
 		pw->frees[i] = frees[i];
+		if (frees[i] == SOCKETBUFFER_TRANSIENT)
+		{	/* the caller's stack copy is gone once we return */
+			if (used + iovecs[i].iov_len <= sizeof(pw->transient))
+			{
+				pw->iovecs[i].iov_base = &pw->transient[used];
+				used += iovecs[i].iov_len;
+				pw->frees[i] = SOCKETBUFFER_REFERENCED;
+			}
+			else
+			{
+				pw->iovecs[i].iov_base = malloc(iovecs[i].iov_len);
+				pw->frees[i] = SOCKETBUFFER_FREE;
+			}
+			memcpy(pw->iovecs[i].iov_base, iovecs[i].iov_base, iovecs[i].iov_len);
+		}
 	}
 	ListAppend(&writes, pw, sizeof(pw) + total);	//-ﴫݹȥĽһֵ,ʵбҪٴռ
 	FUNC_EXIT;
@@ -381,10 +398,10 @@ pending_writes* SocketBuffer_updateWrite(int socket, char* topic, char* payload)
 	if ((le = ListFindItem(&writes, &socket, pending_socketcompare)) != NULL)
 	{
 		pw = (pending_writes*)(le->content);
-		if (pw->count == 4)
-		{
-			pw->iovecs[2].iov_base = topic;
-			pw->iovecs[3].iov_base = payload;
+		if (pw->count == 3)
+		{	/* header and topic length, topic, payload - see MQTTPacket_send_publish */
+			pw->iovecs[1].iov_base = topic;
+			pw->iovecs[2].iov_base = payload;
 		}
 	}
 
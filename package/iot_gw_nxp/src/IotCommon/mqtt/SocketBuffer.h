@@ -75,6 +75,16 @@ typedef struct
 	char* buf;
 } socket_queue;	//-һṹڴ洢׽ֶϢ
 
+/**
+ * Values of the frees array passed with a write.  Buffers marked SOCKETBUFFER_TRANSIENT
+ * live on the caller's stack (fixed headers, message ids); they are only copied, into
+ * pending_writes.transient, if the write is interrupted.
+ */
+#define SOCKETBUFFER_REFERENCED 0	/**< owned elsewhere, e.g. by a reference counted Publications */
+#define SOCKETBUFFER_FREE 1			/**< heap buffer, freed once written */
+#define SOCKETBUFFER_TRANSIENT 2
+#define PENDING_TRANSIENT_SIZE 16
+
 typedef struct
 {
 	int socket, total, count;
@@ -84,6 +94,7 @@ typedef struct
 	unsigned long bytes;
 	iobuf iovecs[5];
 	int frees[5];
+	char transient[PENDING_TRANSIENT_SIZE];	/**< copies of the SOCKETBUFFER_TRANSIENT buffers */
 } pending_writes;
 
 #define SOCKETBUFFER_COMPLETE 0
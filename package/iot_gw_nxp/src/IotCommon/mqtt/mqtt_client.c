@@ -11,6 +11,15 @@
 #include <errno.h>
 #include "mqtt_client.h"
 #include "MQTTClientPersistence.h"
+#include "MQTTPersistenceLog.h"
+
+/* directory of the append-log store for in-flight QoS 1/2 messages;
+ * left undefined they are only kept in memory */
+//-#define MQTT_PERSISTENCE_DIR  "/usr/share/iot/mqtt"
+
+#if defined(MQTT_PERSISTENCE_DIR)
+static MQTTClient_persistence mqtt_persistence;
+#endif
 
 /**
  * create a MQTT client
@@ -29,7 +38,12 @@ mqtt_client * mqtt_new(char * host, int port, char *client_id)	//-
 	m = malloc(sizeof(mqtt_client));	//-ʹʱռ,кôĲ̶ռڴռ
 	if ( m != NULL) {	//-ȴMQTTͻʵ
 		memset(m , 0, sizeof(mqtt_client));	//-ʼ
+#if defined(MQTT_PERSISTENCE_DIR)
+		MQTTPersistenceLog_init(&mqtt_persistence, MQTT_PERSISTENCE_DIR);
+		rc = MQTTClient_create(&(m->client), host, client_id, MQTTCLIENT_PERSISTENCE_USER, &mqtt_persistence);
+#else
 		rc = MQTTClient_create(&(m->client), host, client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL);	//-ﴴͻ,û׽ֵĲ,ڲϢ
+#endif
 		if ( rc == MQTTCLIENT_SUCCESS ) {
 			m->timeout = MQTT_DEFAULT_TIME_OUT;	//-һЧĳʼֵ
 			m->received_msg = NULL;
@@ -21,12 +21,16 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sched.h>
+#include <stddef.h>
 
 #include "dump.h"
 #include "iotSemaphore.h"
+#include "iotStats.h"
 #include "fileCreate.h"
 #include "newLog.h"
 #include "newDb.h"
+#include "jsonWriter.h"
 
 #ifdef TARGET_LINUX_PC
 #define DB_FILEPATH     "/tmp/iot-test/usr/share/iot/"
@@ -34,12 +38,19 @@
 #define DB_FILEPATH     "/usr/share/iot/"
 #endif
 
+#ifdef TARGET_LINUX_PC
+#define DB_UCIFILE      "/tmp/iot-test/etc/config/iot"
+#else
+#define DB_UCIFILE      "/etc/config/iot"
+#endif
+
 #define DB_FILENAME     DB_FILEPATH "/iot_newdb.db"
 #define DB_FILENAME_BCK DB_FILEPATH "/iot_newdb.bck"
 
 #define NEWDB_SHMKEY      86156
 #define NEWDB_SEMKEY      8616
 #define NEWDB_SEMSAVEKEY  8620
+#define NEWDB_SEMCACHEKEY 8624
 
 // #define DB_DEBUG
 
@@ -52,17 +63,51 @@
 #define LL_LOG( f, t )
 // #define LL_LOG( f, t ) filelog( f, t )
 
-#define NEWDB_VERSION         1
+#define NEWDB_VERSION         7     // 1: fixed table sizes, 2: table layout in header, 3: plugseries,
+                                    // 4: serialization caches (same file layout as 3), 5: groups,
+                                    // 6: plugseries aggregates, 7: links
 
+// Default table capacities. Can be overruled per gateway in UCI (iot.newdb.<table>)
+// or by newDbSetCapacity() before the SHM gets created. Version 1 had these fixed.
 #define NEWDB_MAX_SYSTEM      20
 #define NEWDB_MAX_ROOMS       10
 #define NEWDB_MAX_DEVICES     20
 #define NEWDB_MAX_PLUGHIST    400
 #define NEWDB_MAX_ZCB         40
+#define NEWDB_MAX_PLUGSERIES  20
+#define NEWDB_MAX_GROUPS      16
+#define NEWDB_MAX_LINKS       64
+
+#define NEWDB_MAX_CAPACITY    0xFFFE    // Index buckets are uint16 <slot+1>
+
+#define NEWDB_HASH_DEVICES_MAC      0
+#define NEWDB_HASH_PLUGHIST_MACMIN  1
+#define NEWDB_HASH_ZCB_MAC          2
+#define NEWDB_HASH_ZCB_SADDR        3
+#define NEWDB_HASH_PLUGSERIES_MAC   4
+#define NEWDB_NUM_HASH              5
+
+// Room for the layout in the header, so that new tables do not change the header again
+#define NEWDB_LAYOUT_TABLES   8
+#define NEWDB_LAYOUT_HASH     8
+#define NEWDB_LAYOUT_CACHE    16
+
+// Tables that hold network state rather than configuration: a change does not make the
+// database dirty, so it causes no save of its own (ZCB refills them after a restart)
+#define NEWDB_VOLATILE        ( NEWDB_DIRTY( NEWDB_TABLE_LINKS ) )
+
+// Size estimate of the serialization caches: header row plus the widest row per table row
+#define NEWDB_CACHE_HEADER    512
 
 // #define DB_MULTIPLE_FILES    1
 // #define ALSO_SAVE_PLUGHIST   1
 #define PLUGHIST_AUTO_REMOVE_OLDEST
+#define DB_JOURNAL           1      // Single file + append-only journal of changed rows
+
+#define NEWDB_JOURNAL_MAX    ( 64 * 1024 )  // Compact the journal into the .db file beyond this size
+
+#define NEWDB_WAIT_POLL      100    // ms between the generation checks of newDbWaitGenerations()
+#define NEWDB_WRITE_CHUNK    1024   // Output buffer of newDbSerializeWrite()
 
 //-zcbʾһն豸,deviceszcbĲ,һն豸м,ǵĹϵǼȶԵֲַĹϵ
 typedef struct newdb {
@@ -76,31 +121,109 @@ typedef struct newdb {
     int lastupdate_plughist;
     int lastupdate_zcb;
     
-    int reserve[11];
+    unsigned int seqcount;    // Odd while a writer is busy, see newDbWriteLock()
+    
+    int journalgen;           // Only valid in the saved file: journal that belongs to it
+    
+    unsigned int dirty;                      // NEWDB_DIRTY() bits of tables changed since the last save
+    unsigned int generation[NEWDB_NUM_TABLES];  // Incremented on each change of a table
+    
+    int reserve[2];           // generation[] grows into this: the header stays 19 ints
 
-    newdb_system_t system[NEWDB_MAX_SYSTEM];
+    // Everything above is the version 1 header. The segment is self-describing from here:
+    // all offsets are in bytes from the start of newdb_t, tables follow this header
     
-//    newdb_room_t rooms[NEWDB_MAX_ROOMS];
+    int datasize;                              // Header + tables: the part that is saved
+    int shmsize;                               // Complete segment
     
-    newdb_dev_t devices[NEWDB_MAX_DEVICES];
+    int numtables;                             // Valid entries in tables[]
+    struct newdb_layout {
+        int offset;
+        int rowsize;
+        int capacity;
+    } tables[NEWDB_LAYOUT_TABLES];
     
-    newdb_plughist_t plughist[NEWDB_MAX_PLUGHIST];
+    int hashoffset[NEWDB_LAYOUT_HASH];
+    int hashsize[NEWDB_LAYOUT_HASH];
     
-    newdb_zcb_t zcb[NEWDB_MAX_ZCB];
+    int journaloffset;
+    
+    int cacheoffset[NEWDB_LAYOUT_CACHE];
+    int cachesize[NEWDB_LAYOUT_CACHE];         // Bytes per text slot
     
 } newdb_t;
 
+// Version 2 header: the first four tables, no room for more
+typedef struct newdb_v2 {
+    int header[18];
+    int datasize;
+    int shmsize;
+    struct newdb_layout tables[4];
+    int hashoffset[4];
+    int hashsize[4];
+    int journaloffset;
+} newdb_v2_t;
+
+// Version 1 database file; its tables had the default capacities
+typedef struct newdb_v1 {
+    int header[18];
+    newdb_system_t system[NEWDB_MAX_SYSTEM];
+    newdb_dev_t devices[NEWDB_MAX_DEVICES];
+    newdb_plughist_t plughist[NEWDB_MAX_PLUGHIST];
+    newdb_zcb_t zcb[NEWDB_MAX_ZCB];
+} newdb_v1_t;
+
+#define NEWDB_V1_HDRSIZE  offsetof( newdb_t, datasize )
+
+#define DB_MAX( p, t )    ( (p)->tables[NEWDB_TABLE_##t].capacity )
+#define DB_ROWS( p, t )   ( (char *)(p) + (p)->tables[t].offset )
+#define DB_SYSTEM( p )    ( (newdb_system_t *)  DB_ROWS( p, NEWDB_TABLE_SYSTEM ) )
+#define DB_DEVICES( p )   ( (newdb_dev_t *)     DB_ROWS( p, NEWDB_TABLE_DEVICES ) )
+#define DB_PLUGHIST( p )  ( (newdb_plughist_t *)DB_ROWS( p, NEWDB_TABLE_PLUGHIST ) )
+#define DB_ZCB( p )       ( (newdb_zcb_t *)     DB_ROWS( p, NEWDB_TABLE_ZCB ) )
+#define DB_PLUGSERIES( p ) ( (newdb_plugseries_t *)DB_ROWS( p, NEWDB_TABLE_PLUGSERIES ) )
+#define DB_GROUPS( p )    ( (newdb_group_t *)   DB_ROWS( p, NEWDB_TABLE_GROUPS ) )
+#define DB_LINKS( p )     ( (newdb_link_t *)    DB_ROWS( p, NEWDB_TABLE_LINKS ) )
+
+// Open-addressing (linear probing) lookup index. Lives in the same SHM
+// segment, directly behind the tables, so it is shared by all processes but
+// is never part of the saved database: it is rebuilt after a restore.
+// Buckets hold <slot+1>, 0 means empty. Sizes are powers of 2 and
+// well above the table sizes to keep the probe sequences short.
+#define DB_HASH( p, h )   ( (uint16_t *)( (char *)(p) + (p)->hashoffset[h] ) )
+
+// Journal administration, also in the SHM segment since any process may save.
+// <saved> (datasize bytes) is the database as it is on file (snapshot + journal),
+// changed rows are found by comparing against it. Protected by the save lock.
+typedef struct newdb_journal {
+    int valid;
+    int gen;
+    char saved[];
+} newdb_journal_t;
+
+// Serialization cache, also in the SHM segment but never saved. Each cache has two text
+// slots: a rebuild fills the slot that readers are not pointed at and then flips <cur>,
+// so readers take no lock and a text stays valid until its table changed twice.
+// Rebuilds are serialized by NEWDB_SEMCACHEKEY.
+typedef struct newdb_cache {
+    int valid;                // Slot <cur> holds the text of generation <gen>
+    unsigned int gen;
+    int cur;
+    int len[2];               // Text length per slot, -1 when the serialization failed
+    char text[];              // Two slots of cachesize[] bytes
+} newdb_cache_t;
+
+#define DB_CACHE( p, c )  ( (newdb_cache_t *)( (char *)(p) + (p)->cacheoffset[c] ) )
+
 // ------------------------------------------------------------------
 // Globals
 // ------------------------------------------------------------------
 
 static char * newDbSharedMemory = NULL;
+static newdb_journal_t * newDbJournal = NULL;
+
+static int newDbCapacity[NEWDB_NUM_TABLES];  // From newDbSetCapacity(), 0 = not set
 
-static int lastupdate_sys = 0;
-static int lastupdate_rooms = 0;
-static int lastupdate_devices = 0;
-static int lastupdate_plughist = 0;
-static int lastupdate_zcb = 0;
 
 // ------------------------------------------------------------------
 // Tables
@@ -169,6 +292,569 @@ static char * newdb_zcb_columns[NUM_COLUMNS_ZCB] = {
     "lastupdate"
 };
 
+#define NUM_COLUMNS_LINKS 8
+
+static char * newdb_links_columns[NUM_COLUMNS_LINKS] = {
+    "id",
+    "src",
+    "mac",
+    "saddr",
+    "depth",
+    "lqi",
+    "rel",
+    "lastupdate"
+};
+
+// ------------------------------------------------------------------
+// Index
+// ------------------------------------------------------------------
+
+typedef int (*newDbIndexMatch_t)( newdb_t * pnewdb, int slot, const void * key );
+
+typedef struct newdb_macmin {
+    char * mac;
+    int min;
+} newdb_macmin_t;
+
+/**
+ * \brief FNV-1a hash over a mac nibble string
+ * \param mac Mac string
+ * \returns Hash value
+ */
+static unsigned int newDbHashMac( const char * mac ) {
+    unsigned int hash = 2166136261u;
+    while ( *mac ) {
+        hash ^= (unsigned char)*mac++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned int newDbHashSaddr( int saddr ) {
+    return ( (unsigned int)saddr & 0xFFFF ) * 2654435761u;
+}
+
+static unsigned int newDbHashMacMin( const char * mac, int min ) {
+    return newDbHashMac( mac ) ^ ( (unsigned int)min * 2654435761u );
+}
+
+// Note: rows may be compared while a writer changes them (see newDbReadBegin), hence the
+// bounded string compares
+
+static int newDbMatchDeviceMac( newdb_t * pnewdb, int slot, const void * key ) {
+    return( slot < DB_MAX( pnewdb, DEVICES ) &&
+            strncmp( DB_DEVICES( pnewdb )[slot].mac, (const char *)key, LEN_MAC_NIBBLE+1 ) == 0 );
+}
+
+static int newDbMatchZcbMac( newdb_t * pnewdb, int slot, const void * key ) {
+    return( slot < DB_MAX( pnewdb, ZCB ) &&
+            DB_ZCB( pnewdb )[slot].status != ZCB_STATUS_FREE &&
+            strncmp( DB_ZCB( pnewdb )[slot].mac, (const char *)key, LEN_MAC_NIBBLE+1 ) == 0 );
+}
+
+static int newDbMatchZcbSaddr( newdb_t * pnewdb, int slot, const void * key ) {
+    return( slot < DB_MAX( pnewdb, ZCB ) &&
+            DB_ZCB( pnewdb )[slot].status != ZCB_STATUS_FREE &&
+            DB_ZCB( pnewdb )[slot].saddr == *(const int *)key );
+}
+
+static int newDbMatchPlugSeriesMac( newdb_t * pnewdb, int slot, const void * key ) {
+    return( slot < DB_MAX( pnewdb, PLUGSERIES ) &&
+            strncmp( DB_PLUGSERIES( pnewdb )[slot].mac, (const char *)key, LEN_MAC_NIBBLE+1 ) == 0 );
+}
+
+static int newDbMatchPlugHist( newdb_t * pnewdb, int slot, const void * key ) {
+    const newdb_macmin_t * pkey = (const newdb_macmin_t *)key;
+    return( slot < DB_MAX( pnewdb, PLUGHIST ) &&
+            DB_PLUGHIST( pnewdb )[slot].mac[0] != '\0' &&
+            ( DB_PLUGHIST( pnewdb )[slot].lastupdate / 60 ) == pkey->min &&
+            strncmp( DB_PLUGHIST( pnewdb )[slot].mac, pkey->mac, LEN_MAC_NIBBLE+1 ) == 0 );
+}
+
+/**
+ * \brief Find a table slot via an index. Buckets are verified against the table row itself,
+ * so stale buckets are harmless. Note: needs to be called inside semaphore section
+ * \param pnewdb Database
+ * \param h Index, one of NEWDB_HASH_*
+ * \param hash Hash of the key
+ * \param match Row compare function
+ * \param key Key to look for
+ * \returns Slot number, or -1 when not found
+ */
+static int newDbIndexLookup( newdb_t * pnewdb, int h, unsigned int hash,
+                             newDbIndexMatch_t match, const void * key ) {
+    uint16_t * index = DB_HASH( pnewdb, h );
+    int size = pnewdb->hashsize[h];
+    int i, pos = (int)( hash & ( size - 1 ) );
+    for ( i=0; i<size && index[pos] != 0; i++ ) {
+        if ( match( pnewdb, index[pos] - 1, key ) ) {
+            return( index[pos] - 1 );
+        }
+        pos = ( pos + 1 ) & ( size - 1 );
+    }
+    return -1;
+}
+
+/**
+ * \brief Add a table slot to an index. Note: needs to be called inside semaphore section
+ * \param pnewdb Database
+ * \param h Index, one of NEWDB_HASH_*
+ * \param hash Hash of the key of the row in <slot>
+ * \param slot Table slot
+ */
+static void newDbIndexInsert( newdb_t * pnewdb, int h, unsigned int hash, int slot ) {
+    uint16_t * index = DB_HASH( pnewdb, h );
+    int size = pnewdb->hashsize[h];
+    int i, pos = (int)( hash & ( size - 1 ) );
+    for ( i=0; i<size; i++ ) {
+        if ( index[pos] == 0 ) {
+            index[pos] = (uint16_t)( slot + 1 );
+            return;
+        }
+        pos = ( pos + 1 ) & ( size - 1 );
+    }
+    printf( "DB index full\n" );
+}
+
+// Rows can be removed or re-keyed in many ways (delete, empty, overwrite oldest, set with
+// another key). Instead of deleting buckets (which breaks probe sequences), the index of
+// that table is simply rebuilt: the tables are small and these events are rare compared
+// to the lookups.
+
+static void newDbIndexRebuildDevices( newdb_t * pnewdb ) {
+    int i;
+    memset( DB_HASH( pnewdb, NEWDB_HASH_DEVICES_MAC ), 0, pnewdb->hashsize[NEWDB_HASH_DEVICES_MAC] * sizeof( uint16_t ) );
+    for ( i=0; i<DB_MAX( pnewdb, DEVICES ); i++ ) {
+        if ( DB_DEVICES( pnewdb )[i].mac[0] != '\0' ) {
+            newDbIndexInsert( pnewdb, NEWDB_HASH_DEVICES_MAC,
+                              newDbHashMac( DB_DEVICES( pnewdb )[i].mac ), i );
+        }
+    }
+}
+
+static void newDbIndexRebuildPlugHist( newdb_t * pnewdb ) {
+    int i;
+    memset( DB_HASH( pnewdb, NEWDB_HASH_PLUGHIST_MACMIN ), 0, pnewdb->hashsize[NEWDB_HASH_PLUGHIST_MACMIN] * sizeof( uint16_t ) );
+    for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ); i++ ) {
+        if ( DB_PLUGHIST( pnewdb )[i].mac[0] != '\0' ) {
+            newDbIndexInsert( pnewdb, NEWDB_HASH_PLUGHIST_MACMIN,
+                              newDbHashMacMin( DB_PLUGHIST( pnewdb )[i].mac, DB_PLUGHIST( pnewdb )[i].lastupdate / 60 ), i );
+        }
+    }
+}
+
+static void newDbIndexRebuildZcb( newdb_t * pnewdb ) {
+    int i;
+    memset( DB_HASH( pnewdb, NEWDB_HASH_ZCB_MAC ),   0, pnewdb->hashsize[NEWDB_HASH_ZCB_MAC] * sizeof( uint16_t ) );
+    memset( DB_HASH( pnewdb, NEWDB_HASH_ZCB_SADDR ), 0, pnewdb->hashsize[NEWDB_HASH_ZCB_SADDR] * sizeof( uint16_t ) );
+    for ( i=0; i<DB_MAX( pnewdb, ZCB ); i++ ) {
+        if ( DB_ZCB( pnewdb )[i].status != ZCB_STATUS_FREE ) {
+            newDbIndexInsert( pnewdb, NEWDB_HASH_ZCB_MAC,
+                              newDbHashMac( DB_ZCB( pnewdb )[i].mac ), i );
+            newDbIndexInsert( pnewdb, NEWDB_HASH_ZCB_SADDR,
+                              newDbHashSaddr( DB_ZCB( pnewdb )[i].saddr ), i );
+        }
+    }
+}
+
+static void newDbIndexRebuildPlugSeries( newdb_t * pnewdb ) {
+    int i;
+    memset( DB_HASH( pnewdb, NEWDB_HASH_PLUGSERIES_MAC ), 0, pnewdb->hashsize[NEWDB_HASH_PLUGSERIES_MAC] * sizeof( uint16_t ) );
+    for ( i=0; i<DB_MAX( pnewdb, PLUGSERIES ); i++ ) {
+        if ( DB_PLUGSERIES( pnewdb )[i].mac[0] != '\0' ) {
+            newDbIndexInsert( pnewdb, NEWDB_HASH_PLUGSERIES_MAC,
+                              newDbHashMac( DB_PLUGSERIES( pnewdb )[i].mac ), i );
+        }
+    }
+}
+
+static void newDbIndexRebuild( newdb_t * pnewdb ) {
+    newDbIndexRebuildDevices( pnewdb );
+    newDbIndexRebuildPlugHist( pnewdb );
+    newDbIndexRebuildZcb( pnewdb );
+    newDbIndexRebuildPlugSeries( pnewdb );
+}
+
+// ------------------------------------------------------------------
+// Locking
+// ------------------------------------------------------------------
+
+// Writers are serialized by the NEWDB_SEMKEY semaphore and increment seqcount before and
+// after changing the SHM (so it is odd while they are busy). Readers do not use the
+// semaphore: they copy what they need and start over when seqcount moved meanwhile.
+
+#define NEWDB_READ_SPINS   100
+
+static unsigned int newDbLockedAt;    // iotStatsNow() when this process took the semaphore
+
+/**
+ * \brief Start a write section
+ * \param pnewdb Database
+ */
+static void newDbWriteLock( newdb_t * pnewdb ) {
+    unsigned int start = iotStatsNow();
+    semP( NEWDB_SEMKEY );
+    newDbLockedAt = iotStatsNow();
+    iotStatsAdd( IOT_STATS_DB_LOCK, newDbLockedAt - start );
+    pnewdb->seqcount++;
+    __sync_synchronize();
+}
+
+/**
+ * \brief End a write section
+ * \param pnewdb Database
+ */
+static void newDbWriteUnlock( newdb_t * pnewdb ) {
+    unsigned int lockedAt = newDbLockedAt;
+    __sync_synchronize();
+    pnewdb->seqcount++;
+    semV( NEWDB_SEMKEY );
+    iotStatsSince( IOT_STATS_DB_COMMIT, lockedAt );
+}
+
+/**
+ * \brief Start an optimistic read section. Waits for a busy writer. When that takes too long
+ * (e.g. the writer died halfway), fall back to the (auto-unlocking) semaphore
+ * \param pnewdb Database
+ * \returns Sequence count to be passed to newDbReadRetry()
+ */
+static unsigned int newDbReadBegin( newdb_t * pnewdb ) {
+    unsigned int seq;
+    int spins = 0;
+    while ( ( seq = *(volatile unsigned int *)&pnewdb->seqcount ) & 1 ) {
+        if ( ++spins < NEWDB_READ_SPINS ) {
+            sched_yield();
+        } else {
+            semPautounlock( NEWDB_SEMKEY, 10 );
+            if ( pnewdb->seqcount & 1 ) {
+                printf( "DB writer did not finish: repair sequence count\n" );
+                pnewdb->seqcount++;
+            }
+            semV( NEWDB_SEMKEY );
+            spins = 0;
+        }
+    }
+    __sync_synchronize();
+    return seq;
+}
+
+/**
+ * \brief End an optimistic read section
+ * \param pnewdb Database
+ * \param seq Sequence count from newDbReadBegin()
+ * \returns 1 when a writer interfered and the read must be redone, 0 when the read is valid
+ */
+static int newDbReadRetry( newdb_t * pnewdb, unsigned int seq ) {
+    __sync_synchronize();
+    return( *(volatile unsigned int *)&pnewdb->seqcount != seq );
+}
+
+/**
+ * \brief Mark a table as changed. Note: needs to be called inside a write section
+ * \param pnewdb Database
+ * \param table One of NEWDB_TABLE_*
+ */
+static void newDbTouch( newdb_t * pnewdb, int table ) {
+    if ( ( NEWDB_VOLATILE & NEWDB_DIRTY( table ) ) == 0 ) {
+        pnewdb->dirty |= NEWDB_DIRTY( table );
+    }
+    pnewdb->generation[table]++;
+}
+
+/**
+ * \brief Clear the dirty bits of saved tables, unless they were changed again after
+ * the copy was taken
+ * \param pcopy Copy of the database that was saved
+ * \param saved NEWDB_DIRTY() bits of the saved tables
+ */
+static void newDbClearDirty( newdb_t * pcopy, unsigned int saved ) {
+    newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+    int t;
+    if ( saved ) {
+        newDbWriteLock( pnewdb );
+        for ( t=0; t<NEWDB_NUM_TABLES; t++ ) {
+            if ( ( saved & NEWDB_DIRTY( t ) ) && pnewdb->generation[t] == pcopy->generation[t] ) {
+                pnewdb->dirty &= ~NEWDB_DIRTY( t );
+            }
+        }
+        newDbWriteUnlock( pnewdb );
+    }
+}
+
+/**
+ * \brief Take a consistent copy of a part of the database
+ * \param pnewdb Database
+ * \param dst Caller's buffer
+ * \param src Part of the database
+ * \param len Size in bytes
+ */
+static void newDbReadCopy( newdb_t * pnewdb, void * dst, const void * src, int len ) {
+    unsigned int seq;
+    do {
+        seq = newDbReadBegin( pnewdb );
+        memcpy( dst, src, len );
+    } while ( newDbReadRetry( pnewdb, seq ) );
+}
+
+// ------------------------------------------------------------------
+// Layout
+// ------------------------------------------------------------------
+
+#define DB_ALIGN( n )   ( ( (n) + 7 ) & ~7 )
+
+static char * newdb_table_names[NEWDB_NUM_TABLES] = {
+    "system",
+    "devices",
+    "plughist",
+    "zcb",
+    "plugseries",
+    "groups",
+    "links"
+};
+
+static int newdb_table_rowsizes[NEWDB_NUM_TABLES] = {
+    sizeof( newdb_system_t ),
+    sizeof( newdb_dev_t ),
+    sizeof( newdb_plughist_t ),
+    sizeof( newdb_zcb_t ),
+    sizeof( newdb_plugseries_t ),
+    sizeof( newdb_group_t ),
+    sizeof( newdb_link_t )
+};
+
+static int newdb_table_defaults[NEWDB_NUM_TABLES] = {
+    NEWDB_MAX_SYSTEM,
+    NEWDB_MAX_DEVICES,
+    NEWDB_MAX_PLUGHIST,
+    NEWDB_MAX_ZCB,
+    NEWDB_MAX_PLUGSERIES,
+    NEWDB_MAX_GROUPS,
+    NEWDB_MAX_LINKS
+};
+
+// Table that each index (NEWDB_HASH_*) points into
+static int newdb_hash_tables[NEWDB_NUM_HASH] = {
+    NEWDB_TABLE_DEVICES,
+    NEWDB_TABLE_PLUGHIST,
+    NEWDB_TABLE_ZCB,
+    NEWDB_TABLE_ZCB,
+    NEWDB_TABLE_PLUGSERIES
+};
+
+// Table that each serialization cache (NEWDB_CACHE_*) is built from
+static int newdb_cache_tables[NEWDB_NUM_CACHE] = {
+    NEWDB_TABLE_SYSTEM,
+    NEWDB_TABLE_DEVICES,
+    NEWDB_TABLE_DEVICES,
+    NEWDB_TABLE_DEVICES,
+    NEWDB_TABLE_DEVICES,
+    NEWDB_TABLE_DEVICES,
+    NEWDB_TABLE_ZCB,
+    NEWDB_TABLE_PLUGSERIES,
+    NEWDB_TABLE_LINKS
+};
+
+// Widest serialized row of those tables: ints take 11 characters, strings their length
+static int newdb_cache_rowchars[NEWDB_NUM_CACHE] = {
+    80,
+    340,
+    340,
+    340,
+    340,
+    340,
+    80,
+    64,
+    96
+};
+
+static int newDbTableSize( newdb_t * pnewdb, int table ) {
+    return( pnewdb->tables[table].rowsize * pnewdb->tables[table].capacity );
+}
+
+/**
+ * \brief Read a table capacity from UCI: option <table> in the 'newdb' section of iot.
+ * Read straight from the config file, this library does not depend on libuci
+ * \param table One of NEWDB_TABLE_*
+ * \returns Capacity, 0 when not configured
+ */
+static int newDbConfigCapacity( int table ) {
+    char line[120], type[40], name[40], value[40];
+    int capacity = 0, insection = 0;
+    FILE * fp = fopen( DB_UCIFILE, "r" );
+    if ( fp ) {
+        while ( fgets( line, sizeof( line ), fp ) ) {
+            int n = sscanf( line, "%39s %39s %39s", type, name, value );
+            if ( n >= 2 && strcmp( type, "config" ) == 0 ) {
+                insection = ( strcmp( name, "newdb" ) == 0 || strcmp( name, "'newdb'" ) == 0 );
+            } else if ( insection && n == 3 && strcmp( type, "option" ) == 0 &&
+                        strcmp( name, newdb_table_names[table] ) == 0 ) {
+                capacity = atoi( ( value[0] == '\'' || value[0] == '"' ) ? &value[1] : value );
+            }
+        }
+        fclose( fp );
+    }
+    return capacity;
+}
+
+/**
+ * \brief Fill the layout part of a new header: tables, then the indices, the serialization
+ * caches and the journal administration. Capacities come from newDbSetCapacity(), UCI or the defaults (in that order)
+ * \param pnewdb Header
+ */
+static void newDbLayout( newdb_t * pnewdb ) {
+    int t, h, c, offset = DB_ALIGN( sizeof( newdb_t ) );
+
+    pnewdb->numtables = NEWDB_NUM_TABLES;
+    for ( t=0; t<NEWDB_NUM_TABLES; t++ ) {
+        int capacity = newDbCapacity[t];
+        if ( capacity <= 0 ) capacity = newDbConfigCapacity( t );
+        if ( capacity <= 0 ) capacity = newdb_table_defaults[t];
+        if ( capacity > NEWDB_MAX_CAPACITY ) capacity = NEWDB_MAX_CAPACITY;
+        pnewdb->tables[t].offset   = offset;
+        pnewdb->tables[t].rowsize  = newdb_table_rowsizes[t];
+        pnewdb->tables[t].capacity = capacity;
+        offset = DB_ALIGN( offset + newDbTableSize( pnewdb, t ) );
+    }
+    pnewdb->datasize = offset;
+
+    for ( h=0; h<NEWDB_NUM_HASH; h++ ) {
+        // Power of 2, more than twice the table size
+        int size = 16;
+        while ( size <= 2 * pnewdb->tables[newdb_hash_tables[h]].capacity ) size <<= 1;
+        pnewdb->hashoffset[h] = offset;
+        pnewdb->hashsize[h]   = size;
+        offset = DB_ALIGN( offset + size * sizeof( uint16_t ) );
+    }
+
+    for ( c=0; c<NEWDB_NUM_CACHE; c++ ) {
+        pnewdb->cacheoffset[c] = offset;
+        pnewdb->cachesize[c]   = NEWDB_CACHE_HEADER +
+            newdb_cache_rowchars[c] * pnewdb->tables[newdb_cache_tables[c]].capacity;
+        offset = DB_ALIGN( offset + sizeof( newdb_cache_t ) + 2 * pnewdb->cachesize[c] );
+    }
+
+    pnewdb->journaloffset = offset;
+    pnewdb->shmsize = offset + DB_ALIGN( sizeof( newdb_journal_t ) + pnewdb->datasize );
+
+    DEBUG_PRINTF( "DB layout: %d/%d/%d/%d rows, %d bytes data, %d bytes SHM\n",
+                  DB_MAX( pnewdb, SYSTEM ), DB_MAX( pnewdb, DEVICES ),
+                  DB_MAX( pnewdb, PLUGHIST ), DB_MAX( pnewdb, ZCB ),
+                  pnewdb->datasize, pnewdb->shmsize );
+}
+
+/**
+ * \brief Fill the layout of a restored file header. Version 1 files had no layout, version 2
+ * had a smaller one. Tables that are not in the file get capacity 0
+ * \param phdr Header as read from file
+ * \returns Size of the file data, 0 when the file is not compatible
+ */
+static int newDbFileLayout( newdb_t * phdr ) {
+    int t;
+    if ( phdr->version == 1 ) {
+        memset( phdr->tables, 0, sizeof( phdr->tables ) );
+        phdr->tables[NEWDB_TABLE_SYSTEM].offset     = offsetof( newdb_v1_t, system );
+        phdr->tables[NEWDB_TABLE_SYSTEM].capacity   = NEWDB_MAX_SYSTEM;
+        phdr->tables[NEWDB_TABLE_DEVICES].offset    = offsetof( newdb_v1_t, devices );
+        phdr->tables[NEWDB_TABLE_DEVICES].capacity  = NEWDB_MAX_DEVICES;
+        phdr->tables[NEWDB_TABLE_PLUGHIST].offset   = offsetof( newdb_v1_t, plughist );
+        phdr->tables[NEWDB_TABLE_PLUGHIST].capacity = NEWDB_MAX_PLUGHIST;
+        phdr->tables[NEWDB_TABLE_ZCB].offset        = offsetof( newdb_v1_t, zcb );
+        phdr->tables[NEWDB_TABLE_ZCB].capacity      = NEWDB_MAX_ZCB;
+        for ( t=0; t<NEWDB_NUM_TABLES; t++ ) {
+            phdr->tables[t].rowsize = newdb_table_rowsizes[t];
+        }
+        for ( t=0; t<NEWDB_TABLE_PLUGSERIES; t++ ) {
+            phdr->tables[t].rowsize = newdb_table_rowsizes[t];
+        }
+        phdr->numtables = NEWDB_TABLE_PLUGSERIES;
+        phdr->datasize = sizeof( newdb_v1_t );
+        return phdr->datasize;
+    }
+    if ( phdr->version == 2 ) {
+        newdb_v2_t v2;
+        memcpy( &v2, phdr, sizeof( v2 ) );
+        memset( phdr->tables, 0, sizeof( phdr->tables ) );
+        memcpy( phdr->tables, v2.tables, sizeof( v2.tables ) );
+        phdr->numtables = 4;
+        phdr->datasize  = v2.datasize;
+    } else if ( phdr->version < 3 || phdr->version > NEWDB_VERSION ||
+                phdr->numtables < 0 || phdr->numtables > NEWDB_LAYOUT_TABLES ) {
+        return 0;
+    }
+    for ( t=0; t<NEWDB_LAYOUT_TABLES; t++ ) {
+        struct newdb_layout * pl = &phdr->tables[t];
+        if ( t >= phdr->numtables ) {
+            memset( pl, 0, sizeof( struct newdb_layout ) );
+        } else if ( pl->offset < NEWDB_V1_HDRSIZE || pl->rowsize <= 0 || pl->capacity < 0 ||
+                    pl->capacity > NEWDB_MAX_CAPACITY ||
+                    pl->offset + pl->rowsize * pl->capacity > phdr->datasize ) {
+            return 0;
+        }
+    }
+    return phdr->datasize;
+}
+
+/**
+ * \brief Make rows empty
+ * \param pnewdb Database
+ * \param table One of NEWDB_TABLE_*
+ * \param from First row
+ */
+static void newDbInitRows( newdb_t * pnewdb, int table, int from ) {
+    int i;
+    memset( DB_ROWS( pnewdb, table ) + from * pnewdb->tables[table].rowsize, 0,
+            ( pnewdb->tables[table].capacity - from ) * pnewdb->tables[table].rowsize );
+    for ( i=from; i<pnewdb->tables[table].capacity; i++ ) {
+        switch ( table ) {
+        case NEWDB_TABLE_SYSTEM:   DB_SYSTEM( pnewdb )[i].id   = i; break;
+        case NEWDB_TABLE_DEVICES:  DB_DEVICES( pnewdb )[i].id  = i; break;
+        case NEWDB_TABLE_PLUGHIST: DB_PLUGHIST( pnewdb )[i].id = i; break;
+        case NEWDB_TABLE_ZCB:      DB_ZCB( pnewdb )[i].id      = i;
+                                   DB_ZCB( pnewdb )[i].status  = ZCB_STATUS_FREE; break;
+        case NEWDB_TABLE_PLUGSERIES:
+                                   DB_PLUGSERIES( pnewdb )[i].id     = i;
+                                   DB_PLUGSERIES( pnewdb )[i].minute = -1; break;
+        case NEWDB_TABLE_GROUPS:   DB_GROUPS( pnewdb )[i].id   = i; break;
+        case NEWDB_TABLE_LINKS:    DB_LINKS( pnewdb )[i].id    = i; break;
+        }
+    }
+}
+
+/**
+ * \brief Copy a restored file into the (empty) SHM tables, converting between layouts
+ * \param pnewdb Database
+ * \param pfile File data
+ * \param phdr Layout of the file data, see newDbFileLayout()
+ * \returns 1 when the layouts differ, 0 when the file was copied as-is
+ */
+static int newDbMigrate( newdb_t * pnewdb, char * pfile, newdb_t * phdr ) {
+    int t, i, migrated = ( phdr->version != NEWDB_VERSION );
+
+    // All versions share the version 1 header
+    memcpy( pnewdb, pfile, NEWDB_V1_HDRSIZE );
+    pnewdb->version = NEWDB_VERSION;
+
+    for ( t=0; t<NEWDB_NUM_TABLES; t++ ) {
+        struct newdb_layout * pfrom = &phdr->tables[t];
+        struct newdb_layout * pto   = &pnewdb->tables[t];
+        int rows    = ( pfrom->capacity < pto->capacity ) ? pfrom->capacity : pto->capacity;
+        int rowsize = ( pfrom->rowsize  < pto->rowsize )  ? pfrom->rowsize  : pto->rowsize;
+        if ( pfrom->capacity != pto->capacity || pfrom->rowsize != pto->rowsize ) {
+            printf( "DB migrate %s: %d -> %d rows of %d -> %d bytes\n", newdb_table_names[t],
+                    pfrom->capacity, pto->capacity, pfrom->rowsize, pto->rowsize );
+            newLogAddCode( NEWLOG_FROM_DATABASE, NEWLOG_DB_MIGRATE, newdb_table_names[t],
+                           pfrom->capacity, pto->capacity, pfrom->rowsize, pto->rowsize );
+            migrated = 1;
+        }
+        // Rows beyond a smaller capacity are lost
+        for ( i=0; i<rows; i++ ) {
+            memcpy( DB_ROWS( pnewdb, t ) + i * pto->rowsize,
+                    pfile + pfrom->offset + i * pfrom->rowsize, rowsize );
+        }
+    }
+    return migrated;
+}
+
 // ------------------------------------------------------------------
 // File lock
 // ------------------------------------------------------------------
@@ -284,104 +970,336 @@ static int newDbSaveTable( char * tablename, char * data, int len ) {//-
     return 0;
 }
 
-/**
- * \brief Save the IoT database as different tables
- * \returns 1 on success, 0 on error
- */
-int newDbSave( void ) {//-ݿݵıָͨļ洢ʵֵ,ֻڲʹÿռ,Ա̷߳
-    DEBUG_PRINTF( "DB save\n" );
-    
-    if ( newDbSharedMemory ) {
-        // First make a DB copy so that we do not block the database too long
-        int len = sizeof( newdb_t );
-        char * dbCopy = malloc( len );
-        if ( dbCopy ) {
-            semPautounlock( NEWDB_SEMKEY, 10 );
-            memcpy( dbCopy, newDbSharedMemory, sizeof( newdb_t ) );
-            semV( NEWDB_SEMKEY );
+// ------------------------------------------------------------------
+// Journal
+// ------------------------------------------------------------------
 
-            newdb_t * pnewdb = (newdb_t *)dbCopy;
+#if DB_JOURNAL
 
-#if DB_MULTIPLE_FILES
+// The journal file starts with a header that ties it to the .db snapshot it belongs to,
+// followed by records that each hold one changed row (or the newdb_t header fields)
 
-            if ( pnewdb->lastupdate_sys != lastupdate_sys ) {
-                if ( newDbSaveTable( "sys", (char *)pnewdb->system, sizeof( pnewdb->system ) ) ) {
-                    lastupdate_sys = pnewdb->lastupdate_sys;
-                }
-            }
-            if ( pnewdb->lastupdate_rooms != lastupdate_rooms ) {
-                if ( newDbSaveTable( "rooms", (char *)pnewdb->rooms, sizeof( pnewdb->rooms ) ) ) {
-                    lastupdate_rooms = pnewdb->lastupdate_rooms;
-                }
-            }
-            if ( pnewdb->lastupdate_devices != lastupdate_devices ) {
-                if ( newDbSaveTable( "devs", (char *)pnewdb->devices, sizeof( pnewdb->devices ) ) ) {
-                    lastupdate_devices = pnewdb->lastupdate_devices;
-                }
-            }
-            if ( pnewdb->lastupdate_plughist != lastupdate_plughist ) {
-#if ALSO_SAVE_PLUGHIST
-                if ( newDbSaveTable( "plughist", (char *)pnewdb->plughist, sizeof( pnewdb->plughist ) ) ) {
-                    lastupdate_plughist = pnewdb->lastupdate_plughist;
-                }
-#else
-                    lastupdate_plughist = pnewdb->lastupdate_plughist;
-#endif
-            }
-            if ( pnewdb->lastupdate_zcb != lastupdate_zcb ) {
-                if ( newDbSaveTable( "zcb", (char *)pnewdb->zcb, sizeof( pnewdb->zcb ) ) ) {
-                    lastupdate_zcb = pnewdb->lastupdate_zcb;
-                }
-            }
+#define NEWDB_JOURNAL_MAGIC  0x4E444A4C
 
-#else // DB_MULTIPLE_FILES
+typedef struct newdb_journal_hdr {
+    int magic;
+    int gen;
+} newdb_journal_hdr_t;
 
-            // Use single file
-            if ( pnewdb->lastupdate_sys      != lastupdate_sys ||
-                 pnewdb->lastupdate_rooms    != lastupdate_rooms ||
-                 pnewdb->lastupdate_devices  != lastupdate_devices ||
-                 pnewdb->lastupdate_plughist != lastupdate_plughist ||
-                 pnewdb->lastupdate_zcb      != lastupdate_zcb ) {
-                
-                if ( newDbSaveTable( "database", (char *)dbCopy, sizeof( newdb_t ) ) ) {
-                    lastupdate_sys      = pnewdb->lastupdate_sys;
-                    lastupdate_rooms    = pnewdb->lastupdate_rooms;
-                    lastupdate_devices  = pnewdb->lastupdate_devices;
-                    lastupdate_plughist = pnewdb->lastupdate_plughist;
-                    lastupdate_zcb      = pnewdb->lastupdate_zcb;
-                    DEBUG_PRINTF( "db Save done\n" );
-                } else {
-                    DEBUG_PRINTF( "db Save error\n" );
-                }
-            }
-            
-#endif // DB_MULTIPLE_FILES
+typedef struct newdb_journal_rec {
+    int offset;
+    int len;
+    unsigned int check;
+} newdb_journal_rec_t;
 
-            free( dbCopy );
-            
-        } else {
-            printf( "Error mallocing memory for dbCopy: %d - %s\n", errno, strerror( errno ) );
-            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for dbCopy" );
-        }
+typedef struct newdb_journal_region {
+    int table;                 // -1 for the newdb_t header
+    int offset;
+    int rowsize;
+    int rows;
+} newdb_journal_region_t;
+
+#define NUM_JOURNAL_REGIONS  ( 1 + NEWDB_NUM_TABLES )
+
+/**
+ * \brief Get a journal region from the layout: 0 is the newdb_t header, followed by the tables
+ * \param pnewdb Database
+ * \param r Region number
+ * \param preg Filled with the region
+ */
+static void newDbJournalRegion( newdb_t * pnewdb, int r, newdb_journal_region_t * preg ) {
+    if ( r == 0 ) {
+        preg->table   = -1;
+        preg->offset  = 0;
+        preg->rowsize = pnewdb->tables[0].offset;
+        preg->rows    = 1;
+    } else {
+        preg->table   = r - 1;
+        preg->offset  = pnewdb->tables[r-1].offset;
+        preg->rowsize = pnewdb->tables[r-1].rowsize;
+        preg->rows    = pnewdb->tables[r-1].capacity;
     }
-    
-    return 0;
 }
 
-// ------------------------------------------------------------------
-// Restore
-// ------------------------------------------------------------------
+static void newDbJournalFilename( char * filename ) {
+    sprintf( filename, "%siot_%s.jnl", DB_FILEPATH, "database" );
+}
+
+static unsigned int newDbJournalCheck( newdb_journal_rec_t * prec, char * data ) {
+    unsigned int check = 2166136261u;
+    int i;
+    check = ( check ^ (unsigned int)prec->offset ) * 16777619u;
+    check = ( check ^ (unsigned int)prec->len ) * 16777619u;
+    for ( i=0; i<prec->len; i++ ) {
+        check = ( check ^ (unsigned char)data[i] ) * 16777619u;
+    }
+    return check;
+}
 
 /**
- * \brief Restore a certain table in the IoT database
- * \param tablename Name of the table
- * \param data Table-part of the database
- * \param len Size in bytes of this table-part
+ * \brief Write all of <len> bytes and sync to flash
  * \returns 1 on success, 0 on error
  */
-static int newDbRestoreTable( char * tablename, char * data, int len ) {//-ָĳ
-    DEBUG_PRINTF( "DB restore table %s (%d)\n", tablename, len );
-
+static int newDbJournalWrite( int fd, char * buf, int len ) {
+    int byteswritten;
+    while ( ( len > 0 ) && ( byteswritten = write( fd, buf, len ) ) >= 0 ) {
+        len -= byteswritten;
+        buf += byteswritten;
+    }
+    fsync( fd );
+    return( len == 0 );
+}
+
+/**
+ * \brief Compact: write the complete database as new snapshot and start an empty journal for it.
+ * Note: needs to be called inside the save lock
+ * \param pnewdb Copy of the database
+ * \returns 1 on success, 0 on error
+ */
+static int newDbJournalCompact( newdb_t * pnewdb ) {
+    char filename[80];
+    newdb_journal_hdr_t hdr;
+    int ok = 0;
+
+    pnewdb->journalgen = newDbJournal->gen + 1;
+    if ( newDbSaveTable( "database", (char *)pnewdb, pnewdb->datasize ) ) {
+        // From here the old journal does not match the snapshot anymore
+        newDbJournal->gen = pnewdb->journalgen;
+        newDbJournalFilename( filename );
+        int fd = fileCreateRW( filename ) ? open( filename, O_WRONLY | O_TRUNC ) : -1;
+        if ( fd >= 0 ) {
+            hdr.magic = NEWDB_JOURNAL_MAGIC;
+            hdr.gen   = newDbJournal->gen;
+            ok = newDbJournalWrite( fd, (char *)&hdr, sizeof( hdr ) );
+            close( fd );
+        }
+        if ( !ok ) {
+            printf( "Error starting database journal %s\n", filename );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error starting database journal" );
+        }
+        // The snapshot is complete anyway
+        memcpy( newDbJournal->saved, pnewdb, pnewdb->datasize );
+        newDbJournal->valid = ok;
+        DEBUG_PRINTF( "DB journal compacted (gen %d)\n", newDbJournal->gen );
+    }
+    return ok;
+}
+
+/**
+ * \brief Append all rows that differ from what is on file to the journal, compact when no
+ * valid journal exists or when it grew too large. Note: needs to be called inside the save lock
+ * \param pnewdb Copy of the database
+ * \param dirty NEWDB_DIRTY() bits of the tables to look at
+ * \returns 1 on success, 0 on error
+ */
+static int newDbJournalSave( newdb_t * pnewdb, unsigned int dirty ) {
+    char filename[80];
+    struct stat sb;
+    int r, row, ok = 0;
+
+    newDbJournalFilename( filename );
+    if ( !newDbJournal->valid || stat( filename, &sb ) == -1 || sb.st_size > NEWDB_JOURNAL_MAX ) {
+        return newDbJournalCompact( pnewdb );
+    }
+
+    // Collect the changed rows in one buffer to append them with a single write
+    int maxrows = 1;
+    for ( r=0; r<NEWDB_NUM_TABLES; r++ ) {
+        maxrows += pnewdb->tables[r].capacity;
+    }
+    int maxlen = pnewdb->datasize + maxrows * sizeof( newdb_journal_rec_t );
+    char * buf = malloc( maxlen );
+    if ( buf == NULL ) {
+        printf( "Error mallocing memory for journal: %d - %s\n", errno, strerror( errno ) );
+        newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for journal" );
+        return 0;
+    }
+
+    int len = 0, numrows = 0;
+    char * saved = newDbJournal->saved;
+    char * now   = (char *)pnewdb;
+    for ( r=0; r<NUM_JOURNAL_REGIONS; r++ ) {
+        newdb_journal_region_t reg, * preg = &reg;
+        newDbJournalRegion( pnewdb, r, preg );
+        if ( preg->table >= 0 && !( dirty & NEWDB_DIRTY( preg->table ) ) ) {
+            // Clean table
+            continue;
+        }
+        for ( row=0; row<preg->rows; row++ ) {
+            int offset = preg->offset + row * preg->rowsize;
+            if ( memcmp( &saved[offset], &now[offset], preg->rowsize ) != 0 ) {
+                newdb_journal_rec_t rec;
+                rec.offset = offset;
+                rec.len    = preg->rowsize;
+                rec.check  = newDbJournalCheck( &rec, &now[offset] );
+                memcpy( &buf[len], &rec, sizeof( rec ) );
+                len += sizeof( rec );
+                memcpy( &buf[len], &now[offset], preg->rowsize );
+                len += preg->rowsize;
+                numrows++;
+            }
+        }
+    }
+
+    if ( numrows == 0 ) {
+        ok = 1;
+    } else {
+        int fd = open( filename, O_WRONLY | O_APPEND );
+        if ( fd >= 0 ) {
+            ok = newDbJournalWrite( fd, buf, len );
+            close( fd );
+        }
+        if ( ok ) {
+            DEBUG_PRINTF( "DB journal: appended %d rows (%d bytes)\n", numrows, len );
+            memcpy( newDbJournal->saved, pnewdb, pnewdb->datasize );
+        } else {
+            // Partly written: the replay stops at the broken record, but be sure with a fresh snapshot
+            printf( "Error appending database journal %s\n", filename );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error appending database journal" );
+            newDbJournal->valid = 0;
+        }
+    }
+
+    free( buf );
+    return ok;
+}
+
+/**
+ * \brief Replay the journal that belongs to a just restored snapshot
+ * \param pnewdb Restored snapshot (in the layout of the file), updated with the journal records
+ * \param len Size of the snapshot
+ * \returns Number of replayed records
+ */
+static int newDbJournalReplay( newdb_t * pnewdb, int len ) {
+    char filename[80];
+    newdb_journal_hdr_t hdr;
+    newdb_journal_rec_t rec;
+    int numrecs = 0;
+    char * row = malloc( len );
+
+    newDbJournalFilename( filename );
+    int fd = open( filename, O_RDONLY );
+    if ( fd >= 0 && row ) {
+        if ( read( fd, &hdr, sizeof( hdr ) ) == sizeof( hdr ) &&
+             hdr.magic == NEWDB_JOURNAL_MAGIC && hdr.gen == pnewdb->journalgen ) {
+            // Stop at the first incomplete or corrupt record (e.g. power-off during append)
+            while ( read( fd, &rec, sizeof( rec ) ) == sizeof( rec ) &&
+                    rec.offset >= 0 && rec.len > 0 && rec.offset + rec.len <= len &&
+                    read( fd, row, rec.len ) == rec.len &&
+                    newDbJournalCheck( &rec, row ) == rec.check ) {
+                memcpy( (char *)pnewdb + rec.offset, row, rec.len );
+                numrecs++;
+            }
+        } else {
+            DEBUG_PRINTF( "DB journal %s does not belong to the snapshot: ignored\n", filename );
+        }
+    }
+    if ( fd >= 0 ) close( fd );
+    free( row );
+    DEBUG_PRINTF( "DB journal: replayed %d records\n", numrecs );
+    return numrecs;
+}
+
+#endif // DB_JOURNAL
+
+/**
+ * \brief Save the IoT database as different tables
+ * \returns 1 on success, 0 on error
+ */
+int newDbSave( void ) {//-ݿݵıָͨļ洢ʵֵ,ֻڲʹÿռ,Ա̷߳
+    DEBUG_PRINTF( "DB save\n" );
+    
+    if ( newDbSharedMemory ) {
+        // First make a DB copy so that we do not block the database too long
+        int len = ((newdb_t *)newDbSharedMemory)->datasize;
+        char * dbCopy = malloc( len );
+        if ( dbCopy ) {
+            newDbReadCopy( (newdb_t *)newDbSharedMemory, dbCopy, newDbSharedMemory, len );
+
+            newdb_t * pnewdb = (newdb_t *)dbCopy;
+            unsigned int dirty = pnewdb->dirty, saved = 0;
+
+#if DB_MULTIPLE_FILES
+
+            if ( dirty & NEWDB_DIRTY( NEWDB_TABLE_SYSTEM ) ) {
+                if ( newDbSaveTable( "sys", (char *)DB_SYSTEM( pnewdb ), newDbTableSize( pnewdb, NEWDB_TABLE_SYSTEM ) ) ) {
+                    saved |= NEWDB_DIRTY( NEWDB_TABLE_SYSTEM );
+                }
+            }
+            if ( dirty & NEWDB_DIRTY( NEWDB_TABLE_DEVICES ) ) {
+                if ( newDbSaveTable( "devs", (char *)DB_DEVICES( pnewdb ), newDbTableSize( pnewdb, NEWDB_TABLE_DEVICES ) ) ) {
+                    saved |= NEWDB_DIRTY( NEWDB_TABLE_DEVICES );
+                }
+            }
+            if ( dirty & NEWDB_DIRTY( NEWDB_TABLE_PLUGHIST ) ) {
+#if ALSO_SAVE_PLUGHIST
+                if ( newDbSaveTable( "plughist", (char *)DB_PLUGHIST( pnewdb ), newDbTableSize( pnewdb, NEWDB_TABLE_PLUGHIST ) ) ) {
+                    saved |= NEWDB_DIRTY( NEWDB_TABLE_PLUGHIST );
+                }
+#else
+                saved |= NEWDB_DIRTY( NEWDB_TABLE_PLUGHIST );
+#endif
+            }
+            if ( dirty & NEWDB_DIRTY( NEWDB_TABLE_ZCB ) ) {
+                if ( newDbSaveTable( "zcb", (char *)DB_ZCB( pnewdb ), newDbTableSize( pnewdb, NEWDB_TABLE_ZCB ) ) ) {
+                    saved |= NEWDB_DIRTY( NEWDB_TABLE_ZCB );
+                }
+            }
+
+#elif DB_JOURNAL
+
+            // Use single file plus journal, shared by all processes
+            // Note: callers hold the save lock (newDbFileLock)
+            if ( dirty ) {
+                if ( newDbJournalSave( pnewdb, dirty ) ) {
+                    saved = dirty;
+                    DEBUG_PRINTF( "db Save done\n" );
+                } else {
+                    DEBUG_PRINTF( "db Save error\n" );
+                }
+            }
+
+#else // DB_MULTIPLE_FILES
+
+            // Use single file
+            if ( dirty ) {
+                if ( newDbSaveTable( "database", (char *)dbCopy, len ) ) {
+                    saved = dirty;
+                    DEBUG_PRINTF( "db Save done\n" );
+                } else {
+                    DEBUG_PRINTF( "db Save error\n" );
+                }
+            }
+            
+#endif // DB_MULTIPLE_FILES
+
+            newDbClearDirty( pnewdb, saved );
+
+            free( dbCopy );
+            
+        } else {
+            printf( "Error mallocing memory for dbCopy: %d - %s\n", errno, strerror( errno ) );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for dbCopy" );
+        }
+    }
+    
+    return 0;
+}
+
+// ------------------------------------------------------------------
+// Restore
+// ------------------------------------------------------------------
+
+/**
+ * \brief Restore a certain table in the IoT database
+ * \param tablename Name of the table
+ * \param data Table-part of the database
+ * \param len Size in bytes of this table-part
+ * \returns 1 on success, 0 on error
+ */
+static int newDbRestoreTable( char * tablename, char * data, int len ) {//-ָĳ
+    DEBUG_PRINTF( "DB restore table %s (%d)\n", tablename, len );
+
     char filename[40];    
     char backup[40];    
     
@@ -430,54 +1348,70 @@ static int newDbRestore( void ) {//-
     newDbFileLock();
     
     if ( newDbSharedMemory ) {//-ڴ,ôͲ
-        int len = sizeof( newdb_t );
-        // Create a tmp buffer
-        char * dbCopy = malloc( len );
-        if ( dbCopy ) {
-
-            memset( dbCopy, 0, len );
-
-            newdb_t * pnewdb = (newdb_t *)dbCopy;
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
             
 #if DB_MULTIPLE_FILES
 
-            newDbRestoreTable( "sys",      (char *)pnewdb->system,   sizeof( pnewdb->system ) );
-            newDbRestoreTable( "rooms",    (char *)pnewdb->rooms,    sizeof( pnewdb->rooms ) );
-            newDbRestoreTable( "devs",     (char *)pnewdb->devices,  sizeof( pnewdb->devices ) );
+        // Table files are plain rows: with another capacity only the first rows are restored,
+        // or the remaining rows stay empty
+        newDbRestoreTable( "sys",      (char *)DB_SYSTEM( pnewdb ),   newDbTableSize( pnewdb, NEWDB_TABLE_SYSTEM ) );
+        newDbRestoreTable( "devs",     (char *)DB_DEVICES( pnewdb ),  newDbTableSize( pnewdb, NEWDB_TABLE_DEVICES ) );
 #if ALSO_SAVE_PLUGHIST
-            newDbRestoreTable( "plughist", (char *)pnewdb->plughist, sizeof( pnewdb->plughist ) );
+        newDbRestoreTable( "plughist", (char *)DB_PLUGHIST( pnewdb ), newDbTableSize( pnewdb, NEWDB_TABLE_PLUGHIST ) );
 #endif
-            newDbRestoreTable( "zcb",      (char *)pnewdb->zcb,      sizeof( pnewdb->zcb ) );
-
-            memcpy( newDbSharedMemory, dbCopy, len );	//-ɢ֮֯һθƵݿ
-            ret = 1;
+        newDbRestoreTable( "zcb",      (char *)DB_ZCB( pnewdb ),      newDbTableSize( pnewdb, NEWDB_TABLE_ZCB ) );
+        ret = 1;
             
 #else // DB_MULTIPLE_FILES
 
-            // Use single file
-            if ( newDbRestoreTable( "database", (char *)pnewdb,   sizeof( newdb_t ) ) ) {
-
-                // Check version on DB restore
-                if ( pnewdb->version == NEWDB_VERSION ) {
-                    LL_LOG( "/tmp/dbby", "\tDB version is OK" );
-                    memcpy( newDbSharedMemory, dbCopy, len );
-                    ret = 1;
+        // Use single file: first its header to learn the layout
+        newdb_t hdr;
+        memset( &hdr, 0, sizeof( hdr ) );
+        if ( newDbRestoreTable( "database", (char *)&hdr, sizeof( newdb_t ) ) ) {
+
+            // Check version on DB restore
+            int len = newDbFileLayout( &hdr );
+            if ( len > 0 ) {
+                LL_LOG( "/tmp/dbby", "\tDB version is OK" );
+                // Create a tmp buffer
+                char * dbCopy = malloc( len );
+                if ( dbCopy ) {
+                    if ( newDbRestoreTable( "database", dbCopy, len ) ) {
+#if DB_JOURNAL
+                        // The journal records are in the layout of the file
+                        int gen = ((newdb_t *)dbCopy)->journalgen;
+                        newDbJournalReplay( (newdb_t *)dbCopy, len );
+                        ((newdb_t *)dbCopy)->journalgen = gen;
+#endif
+                        int migrated = newDbMigrate( pnewdb, dbCopy, &hdr );
+                        pnewdb->dirty = 0;
+                        if ( migrated ) {
+                            // Rewrite the file in the new layout
+                            int t;
+                            for ( t=0; t<NEWDB_NUM_TABLES; t++ ) newDbTouch( pnewdb, t );
+                        }
+#if DB_JOURNAL
+                        // What is on file now equals the restored database, unless migrated
+                        memcpy( newDbJournal->saved, pnewdb, pnewdb->datasize );
+                        newDbJournal->gen   = gen;
+                        newDbJournal->valid = !migrated;
+#endif
+                        ret = 1;
+                    }
+                    free( dbCopy );
                 } else {
-                    sprintf( logbuffer, "Incompatible database version: %d != %d", pnewdb->version, NEWDB_VERSION );
-                    printf( "%s\n", logbuffer );
-                    newLogAdd( NEWLOG_FROM_DATABASE, logbuffer );
-                    LL_LOG( "/tmp/dbby", logbuffer );
+                    printf( "Error mallocing memory for dbCopy: %d - %s\n", errno, strerror( errno ) );
+                    newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for dbCopy" );
+                    LL_LOG( "/tmp/dbby", "\tMalloc error" );
                 }
+            } else {
+                printf( "Incompatible database version: %d != %d\n", hdr.version, NEWDB_VERSION );
+                newLogAddCode( NEWLOG_FROM_DATABASE, NEWLOG_DB_VERSION, NULL, hdr.version, NEWDB_VERSION );
+                LL_LOG( "/tmp/dbby", "Incompatible database version" );
             }
+        }
 
 #endif // DB_MULTIPLE_FILES
-
-            free( dbCopy );
-        } else {
-            printf( "Error mallocing memory for dbCopy: %d - %s\n", errno, strerror( errno ) );
-            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for dbCopy" );
-            LL_LOG( "/tmp/dbby", "\tMalloc error" );
-        }
     }
     
     newDbFileUnlock();	//-
@@ -504,16 +1438,23 @@ static int newDbRestore( void ) {//-
 int newDbOpen( void ) {//-ݿʵǴһռԷ,ϻһݽṹ
 
     int shmid = -1, created = 0, ret = 0;
+    newdb_t layout;
     
+    // Already attached: a long-lived process (the CGI worker) opens per request
+    if ( newDbSharedMemory ) return( 1 );
+
     LL_LOG( "/tmp/dbby", "In newDbOpen" );
     
     semPautounlock( NEWDB_SEMKEY, 10 );	//-Ϊ˽̼Э,ﴴһź
 
     // Locate the segment
-    if ((shmid = shmget(NEWDB_SHMKEY, sizeof(newdb_t), 0666)) < 0) {//-õһڴʶ򴴽һڴ󲢷عڴʶ
+    if ((shmid = shmget(NEWDB_SHMKEY, 0, 0666)) < 0) {//-õһڴʶ򴴽һڴ󲢷عڴʶ
         LL_LOG( "/tmp/dbby", "\tDB SHM not found" );
-        // SHM not found: try to create
-        if ((shmid = shmget(NEWDB_SHMKEY, sizeof(newdb_t), IPC_CREAT | 0666)) < 0) {
+        // SHM not found: try to create, with the layout for the configured capacities
+        memset( &layout, 0, sizeof( layout ) );
+        layout.version = NEWDB_VERSION;
+        newDbLayout( &layout );
+        if ((shmid = shmget(NEWDB_SHMKEY, layout.shmsize, IPC_CREAT | 0666)) < 0) {
             // Create error
             perror("shmget-create");
             printf( "Error creating SHM for DB\n" );
@@ -542,44 +1483,42 @@ int newDbOpen( void ) {//-
             
         } else {//-ɹӺõĹڴַ
             DEBUG_PRINTF( "Successfully attached SHM for DB (%d)\n", created );
+            newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
             LL_LOG( "/tmp/dbby", "\tAttached to DB SHM" );
             if ( created ) {
                 
                 LL_LOG( "/tmp/dbby", "\tDB SHM created thus try to restore" );
-                // Wipe memory
-                memset( newDbSharedMemory, 0, sizeof( newdb_t ) );	//-ʱؿռһʹڴ
+                // Wipe memory, then lay out empty tables
+                memset( newDbSharedMemory, 0, layout.shmsize );
+                memcpy( newDbSharedMemory, &layout, sizeof( newdb_t ) );
+                newDbJournal = (newdb_journal_t *)( newDbSharedMemory + pnewdb->journaloffset );
+                
+                int t;
+                for ( t=0; t<NEWDB_NUM_TABLES; t++ ) {
+                    newDbInitRows( pnewdb, t, 0 );
+                }
                 
                 // Newly created: Try read from file
-                if ( !newDbRestore() ) {//-Ŭԭݿ,ʧܵĻ¸Ĭֵ
+                if ( !newDbRestore() ) {
                     LL_LOG( "/tmp/dbby", "\tDB Restore failed: init" );
                     DEBUG_PRINTF( "dB Restore from file failed: init structure\n" );
-                    newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;	//-׼ʼĬֵ
-                    
-                    pnewdb->version = NEWDB_VERSION;	//-ݿ汾,ݿҲһṹ,ֻڿڴ,Ҷķ
-                    
-                    int i;
-                    
-                    for ( i=0; i<NEWDB_MAX_SYSTEM; i++ ) {
-                        pnewdb->system[i].id      = i;
-                        pnewdb->system[i].name[0] = '\0';
-                    }
-                    for ( i=0; i<NEWDB_MAX_DEVICES; i++ ) {
-                        pnewdb->devices[i].id     = i;
-                        pnewdb->devices[i].mac[0] = '\0';
-                    }
-                    for ( i=0; i<NEWDB_MAX_PLUGHIST; i++ ) {
-                        pnewdb->plughist[i].id     = i;
-                        pnewdb->plughist[i].mac[0] = '\0';
-                    }
-                    for ( i=0; i<NEWDB_MAX_ZCB; i++ ) {
-                        pnewdb->zcb[i].id     = i;
-                        pnewdb->zcb[i].status = ZCB_STATUS_FREE;
-                    }
                 }
                 
+                newDbIndexRebuild( pnewdb );
+                // A restored seqcount is meaningless: start with no writer busy
+                pnewdb->seqcount = 0;
                 DEBUG_PRINTF( "Initialized new SHM for DB\n" );
+                ret = 1;
+            } else if ( pnewdb->version != NEWDB_VERSION ) {
+                // Left behind by another software version
+                printf( "Incompatible DB SHM version: %d != %d\n", pnewdb->version, NEWDB_VERSION );
+                newLogAddCode( NEWLOG_FROM_DATABASE, NEWLOG_DB_SHM_VERSION, NULL, pnewdb->version, NEWDB_VERSION );
+                shmdt( newDbSharedMemory );
+                newDbSharedMemory = NULL;
+            } else {
+                newDbJournal = (newdb_journal_t *)( newDbSharedMemory + pnewdb->journaloffset );
+                ret = 1;
             }
-            ret = 1;
         }
     }
 
@@ -640,16 +1579,18 @@ int newDbGetSystem( char * name, newdb_system_t * psys ) {
     if ( newDbSharedMemory && name && psys) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );	//-
-        for ( i=0; i<NEWDB_MAX_SYSTEM && !found; i++ ) {
-            DEBUG_PRINTF( "Search system %s (%d) with name %s\n", pnewdb->system[i].name, i, name );
-            if ( strcmp( pnewdb->system[i].name, name ) == 0 ) {
-                memcpy( psys, &pnewdb->system[i], sizeof( newdb_system_t ) );	//-ָ븳ֵ
-                found = 1;
-                index = i;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            for ( i=0; i<DB_MAX( pnewdb, SYSTEM ) && !found; i++ ) {
+                if ( strncmp( DB_SYSTEM( pnewdb )[i].name, name, LEN_SYSNM+1 ) == 0 ) {
+                    memcpy( psys, &DB_SYSTEM( pnewdb )[i], sizeof( newdb_system_t ) );
+                    found = 1;
+                    index = i;
+                }
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         if ( found ) {
             DEBUG_PRINTF( "Found system with name %s (%d)\n", name, index );
         } else {
@@ -676,27 +1617,28 @@ int newDbGetNewSystem( char * name, newdb_system_t * psys ) {//-
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_SYSTEM && !added; i++ ) {
-            if ( pnewdb->system[i].name[0] == '\0' ) {
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, SYSTEM ) && !added; i++ ) {
+            if ( DB_SYSTEM( pnewdb )[i].name[0] == '\0' ) {
                 DEBUG_PRINTF( "Adding %s to system (%d)\n", name, i );
-                memset( &pnewdb->system[i], 0, sizeof( newdb_system_t ) );
-                pnewdb->system[i].id = i;
-                pnewdb->system[i].lastupdate = now;
-                newDbStrNcpy( pnewdb->system[i].name, name, LEN_NM );
-                memcpy( psys, &pnewdb->system[i], sizeof( newdb_system_t ) );
+                memset( &DB_SYSTEM( pnewdb )[i], 0, sizeof( newdb_system_t ) );
+                DB_SYSTEM( pnewdb )[i].id = i;
+                DB_SYSTEM( pnewdb )[i].lastupdate = now;
+                newDbStrNcpy( DB_SYSTEM( pnewdb )[i].name, name, LEN_NM );
+                memcpy( psys, &DB_SYSTEM( pnewdb )[i], sizeof( newdb_system_t ) );
                 added = 1;
                 index = i;
                 pnewdb->numwrites++;
                 pnewdb->lastupdate_sys = now;
+                newDbTouch( pnewdb, NEWDB_TABLE_SYSTEM );
             }
         }
-        semV( NEWDB_SEMKEY );
+        newDbWriteUnlock( pnewdb );
         if ( added ) {
             DEBUG_PRINTF( "Adding system %s succeeded\n", name );
             newLogAdd( NEWLOG_FROM_DATABASE, "Inserted entry in system table" );
 #ifdef DB_DEBUG
-            dump( (char *)&pnewdb->system[index], sizeof( newdb_system_t ) );
+            dump( (char *)&DB_SYSTEM( pnewdb )[index], sizeof( newdb_system_t ) );
 #endif
         } else {
             printf( "Error adding system %s\n", name );
@@ -715,15 +1657,16 @@ int newDbGetNewSystem( char * name, newdb_system_t * psys ) {//-
  * \returns 1 on success, 0 on error
  */
 int newDbSetSystem( newdb_system_t * psys ) {//-ʱ,˵ַ
-    if ( newDbSharedMemory && psys && ( psys->id >= 0 && psys->id < NEWDB_MAX_SYSTEM ) ) {
+    if ( newDbSharedMemory && psys && ( psys->id >= 0 && psys->id < newDbGetCapacity( NEWDB_TABLE_SYSTEM ) ) ) {
         int now = (int)time( NULL );
         psys->lastupdate = now;
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        semP( NEWDB_SEMKEY );
-        memcpy( &pnewdb->system[psys->id], psys, sizeof( newdb_system_t ) );
+        newDbWriteLock( pnewdb );
+        memcpy( &DB_SYSTEM( pnewdb )[psys->id], psys, sizeof( newdb_system_t ) );
         pnewdb->numwrites++;
         pnewdb->lastupdate_sys = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_SYSTEM );
+        newDbWriteUnlock( pnewdb );
         DEBUG_PRINTF( "Setting system %s succeeded (%d): %d, '%s'\n", psys->name, psys->id, psys->intval, psys->strval );
         newLogAdd( NEWLOG_FROM_DATABASE, "Updated system table" );
         return 1;
@@ -743,14 +1686,15 @@ int newDbEmptySystem( void ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_SYSTEM; i++ ) {
-            pnewdb->system[i].id      = i;
-            pnewdb->system[i].name[0] = '\0';
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, SYSTEM ); i++ ) {
+            DB_SYSTEM( pnewdb )[i].id      = i;
+            DB_SYSTEM( pnewdb )[i].name[0] = '\0';
         }
         pnewdb->numwrites++;
         pnewdb->lastupdate_sys = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_SYSTEM );
+        newDbWriteUnlock( pnewdb );
         newLogAdd( NEWLOG_FROM_DATABASE, "Emptied system table" );
         return 1;
     }
@@ -773,14 +1717,17 @@ int newDbGetDevice( char * mac, newdb_dev_t * pdev ) {//-ͨ
     if ( newDbSharedMemory && mac && pdev ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES && !found; i++ ) {
-            if ( strcmp( pnewdb->devices[i].mac, mac ) == 0 ) {
-                memcpy( pdev, &pnewdb->devices[i], sizeof( newdb_dev_t ) );
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            i = newDbIndexLookup( pnewdb, NEWDB_HASH_DEVICES_MAC, newDbHashMac( mac ),
+                                  newDbMatchDeviceMac, mac );
+            if ( i >= 0 ) {
+                memcpy( pdev, &DB_DEVICES( pnewdb )[i], sizeof( newdb_dev_t ) );
                 found = 1;
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         if ( found ) {
             DEBUG_PRINTF( "Found device with mac %s\n", mac );
         } else {
@@ -800,11 +1747,9 @@ int newDbGetDevice( char * mac, newdb_dev_t * pdev ) {//-ͨ
  * \returns 1 when found, 0 when not found
  */
 int newDbGetDeviceId( int id, newdb_dev_t * pdev ) {
-    if ( newDbSharedMemory && pdev && ( id >= 0 && id < NEWDB_MAX_DEVICES ) ) {
+    if ( newDbSharedMemory && pdev && ( id >= 0 && id < newDbGetCapacity( NEWDB_TABLE_DEVICES ) ) ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        semP( NEWDB_SEMKEY );
-        memcpy( pdev, &pnewdb->devices[id], sizeof( newdb_dev_t ) );
-        semV( NEWDB_SEMKEY );
+        newDbReadCopy( pnewdb, pdev, &DB_DEVICES( pnewdb )[id], sizeof( newdb_dev_t ) );
         DEBUG_PRINTF( "Found device with id %d\n", id );
         return 1;
     } else {
@@ -828,25 +1773,28 @@ int newDbGetNewDevice( char * mac, newdb_dev_t * pdev ) {//-
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES && !added; i++ ) {
-            if ( pnewdb->devices[i].mac[0] == '\0' ) {
-                memset( &pnewdb->devices[i], 0, sizeof( newdb_dev_t ) );
-                pnewdb->devices[i].id = i;
-                newDbStrNcpy( pnewdb->devices[i].mac, mac, LEN_MAC_NIBBLE );
-                pnewdb->devices[i].lastupdate = now;
-                memcpy( pdev, &pnewdb->devices[i], sizeof( newdb_dev_t ) );
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, DEVICES ) && !added; i++ ) {
+            if ( DB_DEVICES( pnewdb )[i].mac[0] == '\0' ) {
+                memset( &DB_DEVICES( pnewdb )[i], 0, sizeof( newdb_dev_t ) );
+                DB_DEVICES( pnewdb )[i].id = i;
+                newDbStrNcpy( DB_DEVICES( pnewdb )[i].mac, mac, LEN_MAC_NIBBLE );
+                DB_DEVICES( pnewdb )[i].lastupdate = now;
+                newDbIndexInsert( pnewdb, NEWDB_HASH_DEVICES_MAC,
+                                  newDbHashMac( DB_DEVICES( pnewdb )[i].mac ), i );
+                memcpy( pdev, &DB_DEVICES( pnewdb )[i], sizeof( newdb_dev_t ) );
                 added = 1;
                 index = i;
                 pnewdb->numwrites++;
                 pnewdb->lastupdate_devices = now;
+                newDbTouch( pnewdb, NEWDB_TABLE_DEVICES );
             }
         }
-        semV( NEWDB_SEMKEY );
+        newDbWriteUnlock( pnewdb );
         if ( added ) {
             DEBUG_PRINTF( "Adding device %s succeeded\n", mac );
             newLogAdd( NEWLOG_FROM_DATABASE, "Inserted entry in device table" );
-            dump( (char *)&pnewdb->devices[index], sizeof( newdb_dev_t ) );
+            dump( (char *)&DB_DEVICES( pnewdb )[index], sizeof( newdb_dev_t ) );
         } else {
             printf( "Error adding device %s\n", mac );
             newLogAdd( NEWLOG_FROM_DATABASE, "Error adding device" );
@@ -864,19 +1812,24 @@ int newDbGetNewDevice( char * mac, newdb_dev_t * pdev ) {//-
  * \returns 1 on success, 0 on error
  */
 int newDbSetDevice( newdb_dev_t * pdev ) {//-ݿڵˢʱ
-    if ( newDbSharedMemory && pdev && ( pdev->id >= 0 && pdev->id < NEWDB_MAX_DEVICES ) ) {
+    if ( newDbSharedMemory && pdev && ( pdev->id >= 0 && pdev->id < newDbGetCapacity( NEWDB_TABLE_DEVICES ) ) ) {
         int now = (int)time( NULL );
         pdev->lastupdate = now;
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        semP( NEWDB_SEMKEY );
-        memcpy( &pnewdb->devices[pdev->id], pdev, sizeof( newdb_dev_t ) );
+        newDbWriteLock( pnewdb );
+        int rekeyed = ( strcmp( DB_DEVICES( pnewdb )[pdev->id].mac, pdev->mac ) != 0 );
+        memcpy( &DB_DEVICES( pnewdb )[pdev->id], pdev, sizeof( newdb_dev_t ) );
+        if ( rekeyed ) {
+            newDbIndexRebuildDevices( pnewdb );
+        }
         pnewdb->numwrites++;
         pnewdb->lastupdate_devices = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_DEVICES );
+        newDbWriteUnlock( pnewdb );
         DEBUG_PRINTF( "Setting device %s succeeded\n", pdev->mac );
         newLogAdd( NEWLOG_FROM_DATABASE, "Updated device table" );
 #ifdef DB_DEBUG
-        dump( (char *)&pnewdb->devices[pdev->id], sizeof( newdb_dev_t ) );
+        dump( (char *)&DB_DEVICES( pnewdb )[pdev->id], sizeof( newdb_dev_t ) );
 #endif
         return 1;
     } else {
@@ -886,6 +1839,57 @@ int newDbSetDevice( newdb_dev_t * pdev ) {//-
     return 0;
 }
 
+/**
+ * \brief Modifies several device rows in one write section (no autoinsert), so a batch of
+ * updates costs one lock cycle instead of a get/set round trip each.
+ * Note: <updateCb> is called with the database locked and must not call newDb functions
+ * \param macs Macs of the devices to modify
+ * \param num Number of macs
+ * \param updateCb Called with a writable copy of each row found and the index of its mac.
+ * Returns 1 to store the row, 0 to leave it unchanged
+ * \param arg User argument passed to updateCb
+ * \returns Number of rows stored
+ */
+int newDbUpdateDevices( char * macs[], int num, deviceUpdateCb_t updateCb, void * arg ) {
+    int updated = 0;
+    if ( newDbSharedMemory && macs && updateCb ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_dev_t device;
+        int i, id;
+        int now = (int)time( NULL );
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<num; i++ ) {
+            id = newDbIndexLookup( pnewdb, NEWDB_HASH_DEVICES_MAC, newDbHashMac( macs[i] ),
+                                   newDbMatchDeviceMac, macs[i] );
+            if ( id >= 0 ) {
+                memcpy( &device, &DB_DEVICES( pnewdb )[id], sizeof( newdb_dev_t ) );
+                if ( updateCb( &device, i, arg ) ) {
+                    // Keys stay: the index needs no rebuild
+                    device.id = id;
+                    newDbStrNcpy( device.mac, DB_DEVICES( pnewdb )[id].mac, LEN_MAC_NIBBLE );
+                    device.lastupdate = now;
+                    memcpy( &DB_DEVICES( pnewdb )[id], &device, sizeof( newdb_dev_t ) );
+                    updated++;
+                }
+            }
+        }
+        if ( updated ) {
+            pnewdb->numwrites++;
+            pnewdb->lastupdate_devices = now;
+            newDbTouch( pnewdb, NEWDB_TABLE_DEVICES );
+        }
+        newDbWriteUnlock( pnewdb );
+        if ( updated ) {
+            DEBUG_PRINTF( "Updated %d of %d devices\n", updated, num );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Updated device table" );
+        }
+    } else {
+        printf( "Error updating devices\n" );
+        newLogAdd( NEWLOG_FROM_DATABASE, "Error updating devices" );
+    }
+    return( updated );
+}
+
 /**
  * \brief Gets the mac of a device row with key <id>
  * \param id Key of the table row
@@ -893,11 +1897,10 @@ int newDbSetDevice( newdb_dev_t * pdev ) {//-
  * \returns mac pointer on success, or NULL on error
  */
 char * newDbDeviceGetMac( int id, char * mac ) {
-    if ( newDbSharedMemory && mac && ( id >= 0 && id < NEWDB_MAX_DEVICES ) ) {
+    if ( newDbSharedMemory && mac && ( id >= 0 && id < newDbGetCapacity( NEWDB_TABLE_DEVICES ) ) ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        semP( NEWDB_SEMKEY );
-        strcpy( mac, pnewdb->devices[id].mac );
-        semV( NEWDB_SEMKEY );
+        newDbReadCopy( pnewdb, mac, DB_DEVICES( pnewdb )[id].mac, LEN_MAC_NIBBLE+1 );
+        mac[LEN_MAC_NIBBLE] = '\0';
         return mac;
     }
     return NULL;
@@ -914,34 +1917,36 @@ int newDbEmptyDevices( int mode ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES; i++ ) {
-            int dev = pnewdb->devices[i].dev;
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, DEVICES ); i++ ) {
+            int dev = DB_DEVICES( pnewdb )[i].dev;
             switch ( mode ) {
                 case MODE_DEV_EMPTY_ALL:
-                    pnewdb->devices[i].mac[0] = '\0';
+                    DB_DEVICES( pnewdb )[i].mac[0] = '\0';
                     break;
                 case MODE_DEV_EMPTY_CLIMATE:
                     if ( dev >= DEVICE_DEV_MANAGER && dev <= DEVICE_DEV_PUMP ) {
-                        pnewdb->devices[i].mac[0] = '\0';
+                        DB_DEVICES( pnewdb )[i].mac[0] = '\0';
                     }
                     break;
                 case MODE_DEV_EMPTY_LAMPS:
                     if ( dev == DEVICE_DEV_LAMP ) {
-                        pnewdb->devices[i].mac[0] = '\0';
+                        DB_DEVICES( pnewdb )[i].mac[0] = '\0';
                     }
                     break;
                 case MODE_DEV_EMPTY_PLUGS:
                     if ( dev == DEVICE_DEV_PLUG ) {
-                        pnewdb->devices[i].mac[0] = '\0';
+                        DB_DEVICES( pnewdb )[i].mac[0] = '\0';
                     }
                     break;
             }
-            pnewdb->devices[i].id = i;
+            DB_DEVICES( pnewdb )[i].id = i;
         }
+        newDbIndexRebuildDevices( pnewdb );
         pnewdb->numwrites++;
         pnewdb->lastupdate_devices = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_DEVICES );
+        newDbWriteUnlock( pnewdb );
         newLogAdd( NEWLOG_FROM_DATABASE, "(Partially) Emptied device table" );
         return 1;
     }
@@ -957,17 +1962,21 @@ int newDbDevicesCalcChecksumRoom( int room ) {
     if ( newDbSharedMemory ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i, len = 0, lastupdate = 0;
+        unsigned int seq;
         
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES; i++ ) {
-            if ( pnewdb->devices[i].mac[0] != '\0' ) {
-                if ( pnewdb->devices[i].lastupdate > lastupdate ) {
-                    lastupdate = pnewdb->devices[i].lastupdate;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            len = 0;
+            lastupdate = 0;
+            for ( i=0; i<DB_MAX( pnewdb, DEVICES ); i++ ) {
+                if ( DB_DEVICES( pnewdb )[i].mac[0] != '\0' ) {
+                    if ( DB_DEVICES( pnewdb )[i].lastupdate > lastupdate ) {
+                        lastupdate = DB_DEVICES( pnewdb )[i].lastupdate;
+                    }
+                    len++;
                 }
-                len++;
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         
         int chksum = ( len * 100000 ) + ( lastupdate % 100000 );
         
@@ -985,14 +1994,14 @@ int newDbDevicesSetClearFlag( void ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES; i++ ) {
-            if ( pnewdb->devices[i].mac[0] != '\0' ) {
-                pnewdb->devices[i].flags |= FLAG_TOPO_CLEAR;
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, DEVICES ); i++ ) {
+            if ( DB_DEVICES( pnewdb )[i].mac[0] != '\0' ) {
+                DB_DEVICES( pnewdb )[i].flags |= FLAG_TOPO_CLEAR;
             }
         }
         // Do not count this as a DB-write
-        semV( NEWDB_SEMKEY );
+        newDbWriteUnlock( pnewdb );
         return 1;
     }
     return 0;
@@ -1007,13 +2016,17 @@ int newDbDevicesRemoveWithClearFlag( void ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES; i++ ) {
-            if ( pnewdb->devices[i].flags & FLAG_TOPO_CLEAR ) {
-                pnewdb->devices[i].mac[0] = '\0';
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, DEVICES ); i++ ) {
+            if ( DB_DEVICES( pnewdb )[i].flags & FLAG_TOPO_CLEAR ) {
+                if ( DB_DEVICES( pnewdb )[i].mac[0] != '\0' ) {
+                    DB_DEVICES( pnewdb )[i].mac[0] = '\0';
+                    newDbTouch( pnewdb, NEWDB_TABLE_DEVICES );
+                }
             }
         }
-        semV( NEWDB_SEMKEY );
+        newDbIndexRebuildDevices( pnewdb );
+        newDbWriteUnlock( pnewdb );
         return 1;
     }
     return 0;
@@ -1029,16 +2042,16 @@ int newDbPlugHistRemoveOldest( char * mac ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i, oldest = -1, ts = (int)time( NULL );
         semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST; i++ ) {
-            if ( !mac || strcmp( pnewdb->plughist[i].mac, mac ) == 0 ) {
-                if ( ts > pnewdb->plughist[i].lastupdate ) {
-                    ts = pnewdb->plughist[i].lastupdate;
+        for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ); i++ ) {
+            if ( !mac || strcmp( DB_PLUGHIST( pnewdb )[i].mac, mac ) == 0 ) {
+                if ( ts > DB_PLUGHIST( pnewdb )[i].lastupdate ) {
+                    ts = DB_PLUGHIST( pnewdb )[i].lastupdate;
                     oldest = i;
                 }
             }
         }
         if ( oldest >= 0 ) {
-            pnewdb->plughist[i].mac[0] = '\0';
+            DB_PLUGHIST( pnewdb )[i].mac[0] = '\0';
         }
         semV( NEWDB_SEMKEY );
         return( oldest >= 0 );
@@ -1063,29 +2076,28 @@ int newDbGetMatchingOrNewPlugHist( char * mac, int min, newdb_plughist_t * phist
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i, firstempty = -1, matching = -1, oldest = -1, ts = -1;
         
-        // First scan all samples to find a) first empty slot, b) matching hist, c) oldest slot
-        // When we find a matching slot, then we can stop immediately
-        semP( NEWDB_SEMKEY );
+        // First look for a matching hist in the index. When not found, scan all samples
+        // to find a) first empty slot, b) oldest slot
+        newDbWriteLock( pnewdb );
+        
+        newdb_macmin_t key;
+        key.mac = mac;
+        key.min = min;
+        matching = newDbIndexLookup( pnewdb, NEWDB_HASH_PLUGHIST_MACMIN,
+                                     newDbHashMacMin( mac, min ), newDbMatchPlugHist, &key );
         
-        for ( i=0; i<NEWDB_MAX_PLUGHIST && ( matching < 0 ); i++ ) {
-            if ( pnewdb->plughist[i].mac[0] == '\0' ) {
+        for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ) && ( matching < 0 ); i++ ) {
+            if ( DB_PLUGHIST( pnewdb )[i].mac[0] == '\0' ) {
                 // empty: save first one
                 if ( firstempty < 0 ) {
                     firstempty = i;
                 }
             } else {
                 // occupied: save oldest and look for match
-                if ( ts < 0 || ts > pnewdb->plughist[i].lastupdate ) {
-                    ts = pnewdb->plughist[i].lastupdate;
+                if ( ts < 0 || ts > DB_PLUGHIST( pnewdb )[i].lastupdate ) {
+                    ts = DB_PLUGHIST( pnewdb )[i].lastupdate;
                     oldest = i;
                 }
-                if ( ( pnewdb->plughist[i].lastupdate / 60 ) == min ) {
-                    // Same minute sample
-                    if ( strcmp( pnewdb->plughist[i].mac, mac ) == 0 ) {
-                        // Same plug
-                        matching = i;
-                    }
-                }
             }
         }
         
@@ -1102,16 +2114,24 @@ int newDbGetMatchingOrNewPlugHist( char * mac, int min, newdb_plughist_t * phist
         if ( index >= 0 ) {
             // Fill the slot with initial data
             int now = (int)time( NULL );
-            memset( &pnewdb->plughist[index], 0, sizeof( newdb_plughist_t ) );
-            pnewdb->plughist[index].id = index;
-            newDbStrNcpy( pnewdb->plughist[index].mac, mac, LEN_MAC_NIBBLE );
-            pnewdb->plughist[index].lastupdate = now;
-            memcpy( phist, &pnewdb->plughist[index], sizeof( newdb_plughist_t ) );
+            int oldmin = DB_PLUGHIST( pnewdb )[index].lastupdate / 60;
+            memset( &DB_PLUGHIST( pnewdb )[index], 0, sizeof( newdb_plughist_t ) );
+            DB_PLUGHIST( pnewdb )[index].id = index;
+            newDbStrNcpy( DB_PLUGHIST( pnewdb )[index].mac, mac, LEN_MAC_NIBBLE );
+            DB_PLUGHIST( pnewdb )[index].lastupdate = now;
+            if ( index == firstempty ) {
+                newDbIndexInsert( pnewdb, NEWDB_HASH_PLUGHIST_MACMIN,
+                                  newDbHashMacMin( DB_PLUGHIST( pnewdb )[index].mac, now / 60 ), index );
+            } else if ( index != matching || oldmin != now / 60 ) {
+                newDbIndexRebuildPlugHist( pnewdb );
+            }
+            memcpy( phist, &DB_PLUGHIST( pnewdb )[index], sizeof( newdb_plughist_t ) );
             pnewdb->numwrites++;
             pnewdb->lastupdate_plughist = now;
+            newDbTouch( pnewdb, NEWDB_TABLE_PLUGHIST );
         }
         
-        semV( NEWDB_SEMKEY );
+        newDbWriteUnlock( pnewdb );
         
         if ( index >= 0 ) {
             DEBUG_PRINTF( "Adding plughist for device %s succeeded: ", mac );
@@ -1126,7 +2146,7 @@ int newDbGetMatchingOrNewPlugHist( char * mac, int min, newdb_plughist_t * phist
                 newLogAdd( NEWLOG_FROM_DATABASE, "Updated plughist table" );
             }
 #ifdef DB_DEBUG
-            dump( (char *)&pnewdb->plughist[index], sizeof( newdb_plughist_t ) );
+            dump( (char *)&DB_PLUGHIST( pnewdb )[index], sizeof( newdb_plughist_t ) );
 #endif
         } else {
             printf( "Error adding plughist for device %s\n", mac );
@@ -1147,9 +2167,9 @@ void newDbPrintPlugHist( void ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST; i++ ) {
+        for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ); i++ ) {
             printf( "%4d : ", i );
-            dump( (char *)&pnewdb->plughist[i], sizeof( newdb_plughist_t ) );
+            dump( (char *)&DB_PLUGHIST( pnewdb )[i], sizeof( newdb_plughist_t ) );
         }
         semV( NEWDB_SEMKEY );
     }
@@ -1161,15 +2181,21 @@ void newDbPrintPlugHist( void ) {
  * \returns 1 on success, 0 on error
  */
 int newDbSetPlugHist( newdb_plughist_t * phist ) {
-    if ( newDbSharedMemory && phist && ( phist->id >= 0 && phist->id < NEWDB_MAX_PLUGHIST ) ) {
+    if ( newDbSharedMemory && phist && ( phist->id >= 0 && phist->id < newDbGetCapacity( NEWDB_TABLE_PLUGHIST ) ) ) {
         int now = (int)time( NULL );
         phist->lastupdate = now;
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        semP( NEWDB_SEMKEY );
-        memcpy( &pnewdb->plughist[phist->id], phist, sizeof( newdb_plughist_t ) );
+        newDbWriteLock( pnewdb );
+        int rekeyed = ( ( DB_PLUGHIST( pnewdb )[phist->id].lastupdate / 60 ) != ( now / 60 ) ||
+                        strcmp( DB_PLUGHIST( pnewdb )[phist->id].mac, phist->mac ) != 0 );
+        memcpy( &DB_PLUGHIST( pnewdb )[phist->id], phist, sizeof( newdb_plughist_t ) );
+        if ( rekeyed ) {
+            newDbIndexRebuildPlugHist( pnewdb );
+        }
         pnewdb->numwrites++;
         pnewdb->lastupdate_plughist = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_PLUGHIST );
+        newDbWriteUnlock( pnewdb );
         DEBUG_PRINTF( "Setting plughist for device %s succeeded\n", phist->mac );
         return 1;
     } else {
@@ -1188,13 +2214,16 @@ int newDbGetNumOfPlughist( void ) {
     if ( newDbSharedMemory ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST; i++ ) {
-            if ( pnewdb->plughist[i].mac[0] != '\0' ) {
-                cnt++;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            cnt = 0;
+            for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ); i++ ) {
+                if ( DB_PLUGHIST( pnewdb )[i].mac[0] != '\0' ) {
+                    cnt++;
+                }
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
     }
     return cnt;
 }
@@ -1208,14 +2237,19 @@ int newDbEmptyPlugHist( void ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST; i++ ) {
-            pnewdb->plughist[i].id     = i;
-            pnewdb->plughist[i].mac[0] = '\0';
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ); i++ ) {
+            DB_PLUGHIST( pnewdb )[i].id     = i;
+            DB_PLUGHIST( pnewdb )[i].mac[0] = '\0';
         }
+        newDbIndexRebuildPlugHist( pnewdb );
+        newDbInitRows( pnewdb, NEWDB_TABLE_PLUGSERIES, 0 );
+        newDbIndexRebuildPlugSeries( pnewdb );
         pnewdb->numwrites++;
         pnewdb->lastupdate_plughist = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_PLUGHIST );
+        newDbTouch( pnewdb, NEWDB_TABLE_PLUGSERIES );
+        newDbWriteUnlock( pnewdb );
         newLogAdd( NEWLOG_FROM_DATABASE, "Emptied plughist table" );
         return 1;
     }
@@ -1223,63 +2257,692 @@ int newDbEmptyPlugHist( void ) {
 }
 
 // ------------------------------------------------------------------
-// Zcb
+// Plug series
 // ------------------------------------------------------------------
 
+#define SERIES_MINUTES  0
+#define SERIES_HOURS    1
+#define SERIES_DAYS     2
+#define SERIES_NUM      3
+
+static int newdb_series_units[SERIES_NUM]   = { 1, 60, 60 * 24 };
+static int newdb_series_sizes[SERIES_NUM]   = { NEWDB_SERIES_MINUTES, NEWDB_SERIES_HOURS, NEWDB_SERIES_DAYS };
+static int newdb_series_windows[SERIES_NUM] = { 60, 24, 0 };     // Buckets of the running sums
+
+static uint16_t * newDbSeriesRing( newdb_plugseries_t * pseries, int ring ) {
+    switch ( ring ) {
+    case SERIES_MINUTES: return pseries->minutes;
+    case SERIES_HOURS:   return pseries->hours;
+    default:             return pseries->days;
+    }
+}
+
+static int * newDbSeriesWindow( newdb_plugseries_t * pseries, int ring ) {
+    switch ( ring ) {
+    case SERIES_MINUTES: return &pseries->hour;
+    case SERIES_HOURS:   return &pseries->day;
+    default:             return NULL;
+    }
+}
+
 /**
- * \brief Get a personal/writable copy from the zcb table row with key <mac>
- * \param mac Key to the table row
- * \param pzcb Pointer to a caller's entry structure
- * \returns 1 when found, 0 when not found
+ * \brief Get a bucket from a ring
+ * \param pseries Series
+ * \param ring SERIES_MINUTES, SERIES_HOURS or SERIES_DAYS
+ * \param t Absolute bucket number (minute, hour or day since the epoch)
+ * \returns Wh used in that bucket, 0 when outside the ring
  */
-int newDbGetZcb( char * mac, newdb_zcb_t * pzcb ) {//-macȡzcbϢ
-    int found = 0;
-    if ( newDbSharedMemory && mac && pzcb ) {
-        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB && !found; i++ ) {
-            if ( pnewdb->zcb[i].status != ZCB_STATUS_FREE ) {
-                if ( strcmp( pnewdb->zcb[i].mac, mac ) == 0 ) {
-                    memcpy( pzcb, &pnewdb->zcb[i], sizeof( newdb_zcb_t ) );
-                    found = 1;
-                }
-            }
-        }
-        semV( NEWDB_SEMKEY );
-        if ( found ) {
-            DEBUG_PRINTF( "Found zcb with mac %s\n", mac );
-        } else {
-            DEBUG_PRINTF( "Zcb %s not found\n", mac );
-        }
-    } else {
-        printf( "Error getting zcb\n" );
-        newLogAdd( NEWLOG_FROM_DATABASE, "Error getting zcb" );
+static int newDbSeriesGet( newdb_plugseries_t * pseries, int ring, int t ) {
+    int size   = newdb_series_sizes[ring];
+    int newest = pseries->minute / newdb_series_units[ring];
+    if ( pseries->minute < 0 || t > newest || t <= newest - size ) {
+        return 0;
     }
-    return( found );
+    return newDbSeriesRing( pseries, ring )[t % size];
 }
 
 /**
- * \brief Get a personal/writable copy from the zcb table row with key <saddr>
- * \param saddr Key to the table row
- * \param pzcb Pointer to a caller's entry structure
- * \returns 1 when found, 0 when not found
+ * \brief Sum the buckets of the window of a running sum that ends in bucket <to>
  */
-int newDbGetZcbSaddr( int saddr, newdb_zcb_t * pzcb ) {//-ݶ̵ַȡϢ
-    int found = 0;
-    if ( newDbSharedMemory && pzcb ) {
-        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB && !found; i++ ) {
-            if ( pnewdb->zcb[i].status != ZCB_STATUS_FREE ) {
-                if ( pnewdb->zcb[i].saddr == saddr ) {
-                    memcpy( pzcb, &pnewdb->zcb[i], sizeof( newdb_zcb_t ) );
-                    found = 1;
-                }
+static int newDbSeriesSum( newdb_plugseries_t * pseries, int ring, int to ) {
+    int t, sum = 0;
+    for ( t=to-newdb_series_windows[ring]+1; t<=to; t++ ) {
+        sum += newDbSeriesGet( pseries, ring, t );
+    }
+    return sum;
+}
+
+/**
+ * \brief Recalculate the aggregates from the rings, for rows that come from an older
+ * database version. The total can only go back as far as the days ring
+ */
+static void newDbSeriesAggregate( newdb_plugseries_t * pseries ) {
+    int r, t;
+    pseries->total = 0;
+    pseries->hour  = 0;
+    pseries->day   = 0;
+    pseries->power = -1;
+    if ( pseries->minute >= 0 ) {
+        for ( r=0; r<SERIES_NUM; r++ ) {
+            int * pwin = newDbSeriesWindow( pseries, r );
+            if ( pwin ) *pwin = newDbSeriesSum( pseries, r, pseries->minute / newdb_series_units[r] );
+        }
+        for ( t=0; t<NEWDB_SERIES_DAYS; t++ ) pseries->total += pseries->days[t];
+    }
+    pseries->aggrminute = pseries->minute;
+}
+
+/**
+ * \brief Get a running sum at a later bucket than the last sample. Only the buckets
+ * that left the window since then are read
+ * \param pseries Series, with valid aggregates
+ * \param ring SERIES_MINUTES or SERIES_HOURS
+ * \param min Minute of now
+ * \returns Wh used in the window that ends at <min>
+ */
+static int newDbSeriesWindowAt( newdb_plugseries_t * pseries, int ring, int min ) {
+    int w      = newdb_series_windows[ring];
+    int newest = pseries->minute / newdb_series_units[ring];
+    int to     = min / newdb_series_units[ring];
+    int t, sum;
+    if ( pseries->minute < 0 || to - newest >= w ) return 0;
+    if ( to < newest ) return newDbSeriesSum( pseries, ring, to );   // Clock went back
+    sum = *newDbSeriesWindow( pseries, ring );
+    for ( t=newest-w+1; t<=to-w; t++ ) {
+        sum -= newDbSeriesGet( pseries, ring, t );
+    }
+    return sum;
+}
+
+/**
+ * \brief Add a sample to a series: advance the rings to the sample's buckets and add the
+ * Wh used since the previous sample to them. The running sums drop the buckets that
+ * leave their window and get the new Wh. Note: needs to be called inside a write section
+ * \param pseries Series
+ * \param sum Wh counter of the plug
+ * \param now Timestamp of the sample
+ */
+static void newDbSeriesAdd( newdb_plugseries_t * pseries, int sum, int now ) {
+    int r, t, min = now / 60;
+    if ( pseries->minute >= 0 && min < pseries->minute ) {
+        // Clock went back: the rings cannot be trusted anymore
+        DEBUG_PRINTF( "Plug series %s: time went back, restart\n", pseries->mac );
+        pseries->minute = -1;
+    }
+    if ( pseries->minute < 0 ) {
+        memset( pseries->minutes, 0, sizeof( pseries->minutes ) );
+        memset( pseries->hours,   0, sizeof( pseries->hours ) );
+        memset( pseries->days,    0, sizeof( pseries->days ) );
+        pseries->total = 0;
+        pseries->hour  = 0;
+        pseries->day   = 0;
+        pseries->power = -1;
+    } else {
+        if ( pseries->aggrminute != pseries->minute ) newDbSeriesAggregate( pseries );
+
+        // A lower counter means the plug was reset: only the new base is taken
+        int delta = ( sum > pseries->sum ) ? sum - pseries->sum : 0;
+        for ( r=0; r<SERIES_NUM; r++ ) {
+            uint16_t * pring = newDbSeriesRing( pseries, r );
+            int * pwin = newDbSeriesWindow( pseries, r );
+            int size = newdb_series_sizes[r];
+            int from = pseries->minute / newdb_series_units[r];
+            int to   = min / newdb_series_units[r];
+            if ( pwin ) {
+                int w = newdb_series_windows[r];
+                if ( to - from >= w ) {
+                    *pwin = 0;
+                } else {
+                    for ( t=from-w+1; t<=to-w; t++ ) *pwin -= pring[t % size];
+                }
+            }
+            if ( to - from >= size ) {
+                memset( pring, 0, size * sizeof( uint16_t ) );
+            } else {
+                for ( t=from+1; t<=to; t++ ) pring[t % size] = 0;
             }
+            t = pring[to % size] + delta;
+            if ( t > 0xFFFF ) t = 0xFFFF;
+            if ( pwin ) *pwin += t - pring[to % size];
+            pring[to % size] = t;
         }
-        semV( NEWDB_SEMKEY );
+        pseries->total += delta;
+
+        // Exponential moving average over the samples, restarted after a gap
+        int secs = now - pseries->lastupdate;
+        if ( secs > 0 ) {
+            int watt = (int)( (long long)delta * 3600 / secs );
+            if ( pseries->power < 0 || secs > NEWDB_SERIES_POWER_GAP ) {
+                pseries->power = watt;
+            } else {
+                pseries->power += ( watt - pseries->power ) / 4;
+            }
+        }
+    }
+    pseries->sum        = sum;
+    pseries->minute     = min;
+    pseries->aggrminute = min;
+}
+
+/**
+ * \brief Add a Wh counter sample of a plug to its series. A new series is made when needed,
+ * when the table is full the series that was not updated for the longest time is re-used
+ * \param mac Mac of the plug
+ * \param sum Wh counter of the plug
+ * \param now Timestamp of the sample
+ * \returns 1 on success, 0 on error
+ */
+int newDbAddPlugSample( char * mac, int sum, int now ) {
+    int index = -1;
+    if ( newDbSharedMemory && mac && mac[0] != '\0' ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, oldest = -1;
+
+        newDbWriteLock( pnewdb );
+
+        index = newDbIndexLookup( pnewdb, NEWDB_HASH_PLUGSERIES_MAC, newDbHashMac( mac ),
+                                  newDbMatchPlugSeriesMac, mac );
+        if ( index < 0 ) {
+            for ( i=0; i<DB_MAX( pnewdb, PLUGSERIES ) && index < 0; i++ ) {
+                if ( DB_PLUGSERIES( pnewdb )[i].mac[0] == '\0' ) {
+                    index = i;
+                } else if ( oldest < 0 ||
+                            DB_PLUGSERIES( pnewdb )[i].lastupdate < DB_PLUGSERIES( pnewdb )[oldest].lastupdate ) {
+                    oldest = i;
+                }
+            }
+            int reused = ( index < 0 );
+            if ( reused ) index = oldest;
+            if ( index >= 0 ) {
+                newdb_plugseries_t * pseries = &DB_PLUGSERIES( pnewdb )[index];
+                memset( pseries, 0, sizeof( newdb_plugseries_t ) );
+                pseries->id     = index;
+                pseries->minute = -1;
+                newDbStrNcpy( pseries->mac, mac, LEN_MAC_NIBBLE );
+                if ( reused ) {
+                    newDbIndexRebuildPlugSeries( pnewdb );
+                } else {
+                    newDbIndexInsert( pnewdb, NEWDB_HASH_PLUGSERIES_MAC, newDbHashMac( pseries->mac ), index );
+                }
+            }
+        }
+
+        if ( index >= 0 ) {
+            newDbSeriesAdd( &DB_PLUGSERIES( pnewdb )[index], sum, now );
+            DB_PLUGSERIES( pnewdb )[index].lastupdate = now;
+            pnewdb->numwrites++;
+            pnewdb->lastupdate_plughist = now;
+            newDbTouch( pnewdb, NEWDB_TABLE_PLUGSERIES );
+        }
+
+        newDbWriteUnlock( pnewdb );
+    }
+    if ( index < 0 ) {
+        printf( "Error adding plug sample\n" );
+        newLogAdd( NEWLOG_FROM_DATABASE, "Error adding plug sample" );
+    }
+    return( index >= 0 );
+}
+
+/**
+ * \brief Get the usage of a plug over a window of <num> periods back from <now>. Only the
+ * requested buckets are read, periods are aligned to the buckets of the used ring
+ * \param mac Mac of the plug
+ * \param period Period length (in minutes)
+ * \param now Timestamp of now
+ * \param num Number of periods
+ * \param usage User supplied array for the Wh used per period, [0] is the period of now
+ * \param psum When not NULL: filled with the last Wh counter
+ * \returns 1 when the plug has a series, 0 when not
+ */
+int newDbGetPlugUsage( char * mac, int period, int now, int num, int * usage, int * psum ) {
+    int found = 0;
+    if ( newDbSharedMemory && mac && usage && period > 0 && num > 0 ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_plugseries_t series;
+        int i, k, r, ring = -1;
+        unsigned int seq;
+
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            i = newDbIndexLookup( pnewdb, NEWDB_HASH_PLUGSERIES_MAC, newDbHashMac( mac ),
+                                  newDbMatchPlugSeriesMac, mac );
+            if ( i >= 0 ) {
+                memcpy( &series, &DB_PLUGSERIES( pnewdb )[i], sizeof( newdb_plugseries_t ) );
+                found = 1;
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+
+        // The finest ring that covers the window, else the one that covers most of it
+        for ( r=0; r<SERIES_NUM && newdb_series_units[r] <= period; r++ ) {
+            ring = r;
+            if ( period * num <= newdb_series_units[r] * newdb_series_sizes[r] ) break;
+        }
+
+        // Periods that are no multiple of the bucket size are rounded up
+        int unit  = newdb_series_units[ring];
+        int step  = ( period + unit - 1 ) / unit;
+        int first = ( now / 60 ) / unit;
+        for ( i=0; i<num; i++ ) {
+            usage[i] = 0;
+            for ( k=0; found && k<step; k++ ) {
+                usage[i] += newDbSeriesGet( &series, ring, first - ( i * step ) - k );
+            }
+        }
+        if ( psum ) *psum = ( found ) ? series.sum : 0;
+    }
+    return found;
+}
+
+/**
+ * \brief Get the running totals of a plug. They are kept up to date by newDbAddPlugSample,
+ * so this only reads the few buckets that passed since the last sample
+ * \param mac Mac of the plug
+ * \param now Timestamp of now
+ * \param ptotals User supplied struct that receives the totals
+ * \returns 1 when the plug has a series, 0 when not (the totals are all 0 then)
+ */
+int newDbGetPlugTotals( char * mac, int now, newdb_plugtotals_t * ptotals ) {
+    int found = 0;
+    if ( ptotals ) memset( ptotals, 0, sizeof( newdb_plugtotals_t ) );
+    if ( newDbSharedMemory && mac && ptotals ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_plugseries_t series;
+        unsigned int seq;
+        int i;
+
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            i = newDbIndexLookup( pnewdb, NEWDB_HASH_PLUGSERIES_MAC, newDbHashMac( mac ),
+                                  newDbMatchPlugSeriesMac, mac );
+            if ( i >= 0 ) {
+                memcpy( &series, &DB_PLUGSERIES( pnewdb )[i], sizeof( newdb_plugseries_t ) );
+                found = 1;
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+
+        if ( found ) {
+            // Not sampled since it came from an older database version
+            if ( series.aggrminute != series.minute ) newDbSeriesAggregate( &series );
+
+            ptotals->sum   = series.sum;
+            ptotals->total = series.total;
+            ptotals->hour  = newDbSeriesWindowAt( &series, SERIES_MINUTES, now / 60 );
+            ptotals->day   = newDbSeriesWindowAt( &series, SERIES_HOURS,   now / 60 );
+            if ( series.power > 0 && now - series.lastupdate <= NEWDB_SERIES_POWER_GAP ) {
+                ptotals->power = series.power;
+            }
+        }
+    }
+    return found;
+}
+
+// ------------------------------------------------------------------
+// Groups
+// ------------------------------------------------------------------
+
+/**
+ * \brief Get a personal/writable copy from the group table row with key <grpid>
+ * \param grpid Zigbee group address
+ * \param pgroup Pointer to a caller's entry structure
+ * \returns 1 when found, 0 when not found
+ */
+int newDbGetGroup( int grpid, newdb_group_t * pgroup ) {
+    int found = 0;
+    if ( newDbSharedMemory && grpid > 0 && pgroup ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            for ( i=0; i<DB_MAX( pnewdb, GROUPS ) && !found; i++ ) {
+                if ( DB_GROUPS( pnewdb )[i].grpid == grpid ) {
+                    memcpy( pgroup, &DB_GROUPS( pnewdb )[i], sizeof( newdb_group_t ) );
+                    found = 1;
+                }
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+    }
+    return( found );
+}
+
+/**
+ * \brief Adds a new (empty) row to the group table and returns a personal/writable copy of
+ * this table row with key <grpid>. When the group is already there, that row is returned
+ * \param grpid Zigbee group address
+ * \param pgroup Pointer to a caller's entry structure
+ * \returns 1 on success, 0 when the table is full
+ */
+int newDbGetNewGroup( int grpid, newdb_group_t * pgroup ) {
+    int i, index = -1, added = 0;
+    if ( newDbSharedMemory && grpid > 0 && pgroup ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int now = (int)time( NULL );
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, GROUPS ) && index < 0; i++ ) {
+            if ( DB_GROUPS( pnewdb )[i].grpid == grpid ) index = i;
+        }
+        for ( i=0; i<DB_MAX( pnewdb, GROUPS ) && index < 0; i++ ) {
+            if ( DB_GROUPS( pnewdb )[i].grpid == 0 ) {
+                memset( &DB_GROUPS( pnewdb )[i], 0, sizeof( newdb_group_t ) );
+                DB_GROUPS( pnewdb )[i].id         = i;
+                DB_GROUPS( pnewdb )[i].grpid      = grpid;
+                DB_GROUPS( pnewdb )[i].lastupdate = now;
+                pnewdb->numwrites++;
+                newDbTouch( pnewdb, NEWDB_TABLE_GROUPS );
+                index = i;
+                added = 1;
+            }
+        }
+        if ( index >= 0 ) {
+            memcpy( pgroup, &DB_GROUPS( pnewdb )[index], sizeof( newdb_group_t ) );
+        }
+        newDbWriteUnlock( pnewdb );
+        if ( added ) {
+            DEBUG_PRINTF( "Adding group 0x%04x succeeded\n", grpid );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Inserted entry in group table" );
+        } else if ( index < 0 ) {
+            printf( "Error adding group 0x%04x\n", grpid );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error adding group" );
+        }
+    }
+    return( index >= 0 );
+}
+
+/**
+ * \brief Sets the group table row with the same id as the row data. A grpid of 0 frees the row
+ * \param pgroup Pointer to an entry structure that was obtained by a get-function
+ * \returns 1 on success, 0 on error
+ */
+int newDbSetGroup( newdb_group_t * pgroup ) {
+    if ( newDbSharedMemory && pgroup && ( pgroup->id >= 0 && pgroup->id < newDbGetCapacity( NEWDB_TABLE_GROUPS ) ) ) {
+        pgroup->lastupdate = (int)time( NULL );
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newDbWriteLock( pnewdb );
+        memcpy( &DB_GROUPS( pnewdb )[pgroup->id], pgroup, sizeof( newdb_group_t ) );
+        pnewdb->numwrites++;
+        newDbTouch( pnewdb, NEWDB_TABLE_GROUPS );
+        newDbWriteUnlock( pnewdb );
+        DEBUG_PRINTF( "Setting group 0x%04x succeeded\n", pgroup->grpid );
+        return 1;
+    } else {
+        printf( "Error setting group\n" );
+        newLogAdd( NEWLOG_FROM_DATABASE, "Error setting group" );
+    }
+    return 0;
+}
+
+/**
+ * \brief Delete one entry in the group table
+ * \param grpid Zigbee group address
+ * \returns 1 on success, 0 when not found
+ */
+int newDbDeleteGroup( int grpid ) {
+    int i, found = 0;
+    if ( newDbSharedMemory && grpid > 0 ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, GROUPS ) && !found; i++ ) {
+            if ( DB_GROUPS( pnewdb )[i].grpid == grpid ) {
+                memset( &DB_GROUPS( pnewdb )[i], 0, sizeof( newdb_group_t ) );
+                DB_GROUPS( pnewdb )[i].id = i;
+                pnewdb->numwrites++;
+                newDbTouch( pnewdb, NEWDB_TABLE_GROUPS );
+                found = 1;
+            }
+        }
+        newDbWriteUnlock( pnewdb );
+        if ( found ) {
+            newLogAdd( NEWLOG_FROM_DATABASE, "Deleted entry from group table" );
+        }
+    }
+    return( found );
+}
+
+/**
+ * \brief Remove a lamp from all groups, e.g. when it left the network
+ * \param mac Lamp
+ * \returns Number of groups the lamp was removed from
+ */
+int newDbGroupsRemoveMember( char * mac ) {
+    int i, num = 0;
+    if ( newDbSharedMemory && mac ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, GROUPS ); i++ ) {
+            if ( DB_GROUPS( pnewdb )[i].grpid != 0 &&
+                 newDbGroupRemoveMember( &DB_GROUPS( pnewdb )[i], mac ) ) {
+                num++;
+            }
+        }
+        if ( num > 0 ) {
+            pnewdb->numwrites++;
+            newDbTouch( pnewdb, NEWDB_TABLE_GROUPS );
+        }
+        newDbWriteUnlock( pnewdb );
+    }
+    return( num );
+}
+
+/**
+ * \brief Find the position of a member in a group row
+ * \param pgroup Group row (a copy)
+ * \param mac Lamp
+ * \param pfound Set to 1 when the lamp is a member
+ * \returns Index of the lamp, or where it would be inserted
+ */
+static int newDbGroupFind( newdb_group_t * pgroup, char * mac, int * pfound ) {
+    int i, cmp = 1;
+    for ( i=0; i<pgroup->nummembers; i++ ) {
+        if ( ( cmp = strncmp( pgroup->members[i], mac, LEN_MAC_NIBBLE ) ) >= 0 ) break;
+    }
+    *pfound = ( cmp == 0 );
+    return( i );
+}
+
+/**
+ * \brief Check the membership of a lamp in a group row
+ * \returns 1 when <mac> is a member
+ */
+int newDbGroupHasMember( newdb_group_t * pgroup, char * mac ) {
+    int found = 0;
+    if ( pgroup && mac ) {
+        newDbGroupFind( pgroup, mac, &found );
+    }
+    return( found );
+}
+
+/**
+ * \brief Add a lamp to a group row (a copy, see newDbSetGroup()), keeping the members sorted
+ * \returns 1 when <mac> is a member now, 0 when the group is full
+ */
+int newDbGroupAddMember( newdb_group_t * pgroup, char * mac ) {
+    int i, j, found = 0;
+    if ( pgroup == NULL || mac == NULL ) return 0;
+    i = newDbGroupFind( pgroup, mac, &found );
+    if ( found ) return 1;
+    if ( pgroup->nummembers >= NEWDB_GROUP_MEMBERS ) return 0;
+    for ( j=pgroup->nummembers; j>i; j-- ) {
+        memcpy( pgroup->members[j], pgroup->members[j-1], LEN_MAC_NIBBLE+2 );
+    }
+    newDbStrNcpy( pgroup->members[i], mac, LEN_MAC_NIBBLE );
+    pgroup->nummembers++;
+    return 1;
+}
+
+/**
+ * \brief Remove a lamp from a group row
+ * \returns 1 when <mac> was a member
+ */
+int newDbGroupRemoveMember( newdb_group_t * pgroup, char * mac ) {
+    int i, found = 0;
+    if ( pgroup == NULL || mac == NULL ) return 0;
+    i = newDbGroupFind( pgroup, mac, &found );
+    if ( !found ) return 0;
+    for ( ; i<pgroup->nummembers-1; i++ ) {
+        memcpy( pgroup->members[i], pgroup->members[i+1], LEN_MAC_NIBBLE+2 );
+    }
+    pgroup->nummembers--;
+    memset( pgroup->members[pgroup->nummembers], 0, LEN_MAC_NIBBLE+2 );
+    return 1;
+}
+
+// ------------------------------------------------------------------
+// Links
+// ------------------------------------------------------------------
+
+/**
+ * \brief Find the row of a link
+ * \param pnewdb Database
+ * \param src Short address of the node whose neighbour table lists the link
+ * \param mac Neighbour
+ * \returns Row index, -1 when not found
+ */
+static int newDbLinkFind( newdb_t * pnewdb, int src, char * mac ) {
+    int i;
+    for ( i=0; i<DB_MAX( pnewdb, LINKS ); i++ ) {
+        if ( DB_LINKS( pnewdb )[i].src == src &&
+             strncmp( DB_LINKS( pnewdb )[i].mac, mac, LEN_MAC_NIBBLE ) == 0 ) {
+            return( i );
+        }
+    }
+    return( -1 );
+}
+
+/**
+ * \brief Insert or update the link from <plink->src> to neighbour <plink->mac>.
+ * The row id is filled in
+ * \param plink Link as read from the neighbour table
+ * \returns 1 on success, 0 when the table is full
+ */
+int newDbSetLink( newdb_link_t * plink ) {
+    int i, index = -1;
+    if ( newDbSharedMemory && plink && plink->mac[0] != '\0' ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newDbWriteLock( pnewdb );
+        if ( ( index = newDbLinkFind( pnewdb, plink->src, plink->mac ) ) < 0 ) {
+            for ( i=0; i<DB_MAX( pnewdb, LINKS ) && index < 0; i++ ) {
+                if ( DB_LINKS( pnewdb )[i].mac[0] == '\0' ) index = i;
+            }
+        }
+        if ( index >= 0 ) {
+            plink->id = index;
+            plink->lastupdate = (int)time( NULL );
+            memcpy( &DB_LINKS( pnewdb )[index], plink, sizeof( newdb_link_t ) );
+            pnewdb->numwrites++;
+            newDbTouch( pnewdb, NEWDB_TABLE_LINKS );
+        }
+        newDbWriteUnlock( pnewdb );
+        if ( index < 0 ) {
+            printf( "Error adding link %s\n", plink->mac );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error adding link" );
+        }
+    }
+    return( index >= 0 );
+}
+
+/**
+ * \brief Delete the link from <src> to neighbour <mac>
+ * \param src Short address of the node whose neighbour table listed the link
+ * \param mac Neighbour
+ * \returns 1 on success, 0 when not found
+ */
+int newDbDeleteLink( int src, char * mac ) {
+    int index = -1;
+    if ( newDbSharedMemory && mac ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newDbWriteLock( pnewdb );
+        if ( ( index = newDbLinkFind( pnewdb, src, mac ) ) >= 0 ) {
+            memset( &DB_LINKS( pnewdb )[index], 0, sizeof( newdb_link_t ) );
+            DB_LINKS( pnewdb )[index].id = index;
+            pnewdb->numwrites++;
+            newDbTouch( pnewdb, NEWDB_TABLE_LINKS );
+        }
+        newDbWriteUnlock( pnewdb );
+    }
+    return( index >= 0 );
+}
+
+/**
+ * \brief Empty the link table, e.g. when ZCB starts to read the neighbour tables again
+ * \returns 1 on success, 0 on error
+ */
+int newDbEmptyLinks( void ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newDbWriteLock( pnewdb );
+        newDbInitRows( pnewdb, NEWDB_TABLE_LINKS, 0 );
+        pnewdb->numwrites++;
+        newDbTouch( pnewdb, NEWDB_TABLE_LINKS );
+        newDbWriteUnlock( pnewdb );
+        return 1;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------------
+// Zcb
+// ------------------------------------------------------------------
+
+/**
+ * \brief Get a personal/writable copy from the zcb table row with key <mac>
+ * \param mac Key to the table row
+ * \param pzcb Pointer to a caller's entry structure
+ * \returns 1 when found, 0 when not found
+ */
+int newDbGetZcb( char * mac, newdb_zcb_t * pzcb ) {//-macȡzcbϢ
+    int found = 0;
+    if ( newDbSharedMemory && mac && pzcb ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            i = newDbIndexLookup( pnewdb, NEWDB_HASH_ZCB_MAC, newDbHashMac( mac ),
+                                  newDbMatchZcbMac, mac );
+            if ( i >= 0 ) {
+                memcpy( pzcb, &DB_ZCB( pnewdb )[i], sizeof( newdb_zcb_t ) );
+                found = 1;
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+        if ( found ) {
+            DEBUG_PRINTF( "Found zcb with mac %s\n", mac );
+        } else {
+            DEBUG_PRINTF( "Zcb %s not found\n", mac );
+        }
+    } else {
+        printf( "Error getting zcb\n" );
+        newLogAdd( NEWLOG_FROM_DATABASE, "Error getting zcb" );
+    }
+    return( found );
+}
+
+/**
+ * \brief Get a personal/writable copy from the zcb table row with key <saddr>
+ * \param saddr Key to the table row
+ * \param pzcb Pointer to a caller's entry structure
+ * \returns 1 when found, 0 when not found
+ */
+int newDbGetZcbSaddr( int saddr, newdb_zcb_t * pzcb ) {//-ݶ̵ַȡϢ
+    int found = 0;
+    if ( newDbSharedMemory && pzcb ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            found = 0;
+            i = newDbIndexLookup( pnewdb, NEWDB_HASH_ZCB_SADDR, newDbHashSaddr( saddr ),
+                                  newDbMatchZcbSaddr, &saddr );
+            if ( i >= 0 ) {
+                memcpy( pzcb, &DB_ZCB( pnewdb )[i], sizeof( newdb_zcb_t ) );
+                found = 1;
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
         if ( found ) {
             DEBUG_PRINTF( "Found zcb with saddr 0x%04X\n", saddr );
         } else {
@@ -1306,27 +2969,36 @@ int newDbGetNewZcb( char * mac, newdb_zcb_t * pzcb ) {
         int i;
         int now = (int)time( NULL );
         int oldest = now;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB && !added; i++ ) {
-            if ( pnewdb->zcb[i].status == ZCB_STATUS_FREE ) {
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, ZCB ) && !added; i++ ) {
+            if ( DB_ZCB( pnewdb )[i].status == ZCB_STATUS_FREE ) {
                 added = 1;
                 index = i;
-            } else if ( pnewdb->zcb[i].lastupdate < oldest ) {
-                oldest = pnewdb->zcb[i].lastupdate;
+            } else if ( DB_ZCB( pnewdb )[i].lastupdate < oldest ) {
+                oldest = DB_ZCB( pnewdb )[i].lastupdate;
                 index = i;
             }
         }
         if ( index >= 0 ) {
-            memset( &pnewdb->zcb[index], 0, sizeof( newdb_zcb_t ) );
-            pnewdb->zcb[index].id = index;
-            pnewdb->zcb[index].status = ZCB_STATUS_USED;
-            newDbStrNcpy( pnewdb->zcb[index].mac, mac, LEN_MAC_NIBBLE );
-            pnewdb->zcb[index].lastupdate = now;
-            memcpy( pzcb, &pnewdb->zcb[index], sizeof( newdb_zcb_t ) );
+            memset( &DB_ZCB( pnewdb )[index], 0, sizeof( newdb_zcb_t ) );
+            DB_ZCB( pnewdb )[index].id = index;
+            DB_ZCB( pnewdb )[index].status = ZCB_STATUS_USED;
+            newDbStrNcpy( DB_ZCB( pnewdb )[index].mac, mac, LEN_MAC_NIBBLE );
+            DB_ZCB( pnewdb )[index].lastupdate = now;
+            if ( added ) {
+                newDbIndexInsert( pnewdb, NEWDB_HASH_ZCB_MAC,
+                                  newDbHashMac( DB_ZCB( pnewdb )[index].mac ), index );
+                newDbIndexInsert( pnewdb, NEWDB_HASH_ZCB_SADDR,
+                                  newDbHashSaddr( DB_ZCB( pnewdb )[index].saddr ), index );
+            } else {
+                newDbIndexRebuildZcb( pnewdb );
+            }
+            memcpy( pzcb, &DB_ZCB( pnewdb )[index], sizeof( newdb_zcb_t ) );
             pnewdb->numwrites++;
             pnewdb->lastupdate_zcb = now;
+            newDbTouch( pnewdb, NEWDB_TABLE_ZCB );
         }        
-        semV( NEWDB_SEMKEY );
+        newDbWriteUnlock( pnewdb );
 
         if ( index >= 0 ) {
             if ( added ) {
@@ -1337,7 +3009,7 @@ int newDbGetNewZcb( char * mac, newdb_zcb_t * pzcb ) {
                 newLogAdd( NEWLOG_FROM_DATABASE, "Updated zcb table" );
             }
 #ifdef DB_DEBUG
-            dump( (char *)&pnewdb->zcb[index], sizeof( newdb_zcb_t ) );
+            dump( (char *)&DB_ZCB( pnewdb )[index], sizeof( newdb_zcb_t ) );
 #endif
         } else {
             printf( "Error adding zcb %s\n", mac );
@@ -1356,15 +3028,23 @@ int newDbGetNewZcb( char * mac, newdb_zcb_t * pzcb ) {
  * \returns 1 on success, 0 on error
  */
 int newDbSetZcb( newdb_zcb_t * pzcb ) {
-    if ( newDbSharedMemory && pzcb && ( pzcb->id >= 0 && pzcb->id < NEWDB_MAX_ZCB ) ) {
+    if ( newDbSharedMemory && pzcb && ( pzcb->id >= 0 && pzcb->id < newDbGetCapacity( NEWDB_TABLE_ZCB ) ) ) {
         int now = (int)time( NULL );
         pzcb->lastupdate = now;
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        semP( NEWDB_SEMKEY );
-        memcpy( &pnewdb->zcb[pzcb->id], pzcb, sizeof( newdb_zcb_t ) );	//-дݿ
+        newDbWriteLock( pnewdb );
+        newdb_zcb_t * pold = &DB_ZCB( pnewdb )[pzcb->id];
+        int rekeyed = ( pold->saddr != pzcb->saddr ||
+                        ( pold->status == ZCB_STATUS_FREE ) != ( pzcb->status == ZCB_STATUS_FREE ) ||
+                        strcmp( pold->mac, pzcb->mac ) != 0 );
+        memcpy( &DB_ZCB( pnewdb )[pzcb->id], pzcb, sizeof( newdb_zcb_t ) );	//-дݿ
+        if ( rekeyed ) {
+            newDbIndexRebuildZcb( pnewdb );
+        }
         pnewdb->numwrites++;
         pnewdb->lastupdate_zcb = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_ZCB );
+        newDbWriteUnlock( pnewdb );
         DEBUG_PRINTF( "Setting zcb %s succeeded\n", pzcb->mac );
         newLogAdd( NEWLOG_FROM_DATABASE, "Updated zcb table" );
         return 1;
@@ -1384,14 +3064,16 @@ int newDbEmptyZcb( void ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB; i++ ) {
-            pnewdb->zcb[i].id     = i;
-            pnewdb->zcb[i].status = ZCB_STATUS_FREE;
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, ZCB ); i++ ) {
+            DB_ZCB( pnewdb )[i].id     = i;
+            DB_ZCB( pnewdb )[i].status = ZCB_STATUS_FREE;
         }
+        newDbIndexRebuildZcb( pnewdb );
         pnewdb->numwrites++;
         pnewdb->lastupdate_zcb = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_ZCB );
+        newDbWriteUnlock( pnewdb );
         newLogAdd( NEWLOG_FROM_DATABASE, "Emptied zcb table" );
         return 1;
     }
@@ -1403,169 +3085,455 @@ int newDbEmptyZcb( void ) {
 // ------------------------------------------------------------------
 
 /**
- * \brief Concatenates string <str> to string <buf>, proceeded by a comma when requested.
- * \param MAXBUF Maximum length of the serialized string
- * \param buf User allocated area to store the serialization result
- * \param str String to concatenate
+ * \brief Appends string <str>, proceeded by a comma when requested.
+ * \param w Writer for the serialization
+ * \param str String to append
  * \param proceedComma Boolean indicating that first a comma needs to be added
- * \returns A pointer to the end of the string, or NULL in case of an error
- */
-static char * newDbSerializeHelperStr( int MAXBUF, char * buf, char * str, int proceedComma ) {
-    if ( buf == NULL || str == NULL ) return NULL;
-    int blen = strlen( buf );
-    int slen = strlen( str );
-    if ( ( blen + slen + 1 ) < MAXBUF ) {
-        if ( proceedComma ) strcat( buf, "," );
-        strcat( buf, str );
-        return( &buf[blen+slen] );  // Address of '\0' character
-    } else {
-        printf( "Serialization buffer overrun\n" );
+ */
+static void newDbSerializeHelperStr( jsonWriter_t * w, char * str, int proceedComma ) {
+    if ( proceedComma ) jsonWriterChar( w, ',' );
+    jsonWriterText( w, str );
+}
+
+/**
+ * \brief Appends integer <num>, proceeded by a comma when requested.
+ * \param w Writer for the serialization
+ * \param num Number to append
+ * \param proceedComma Boolean indicating that first a comma needs to be added
+ */
+static void newDbSerializeHelperInt( jsonWriter_t * w, int num, int proceedComma ) {
+    if ( proceedComma ) jsonWriterChar( w, ',' );
+    jsonWriterInt( w, num );
+}
+
+/**
+ * \brief Appends a header row
+ * \param w Writer for the serialization
+ * \param num Number of header strings to append
+ * \param headers Array of header strings (of length <num>) to be added
+ */
+static void newDbSerializeHelperHeader( jsonWriter_t * w, int num, char * headers[] ) {
+    int i;
+    for ( i=0; i<num; i++ ) {
+        newDbSerializeHelperStr( w, headers[i], i > 0 );
+    }
+}
+
+// ------------------------------------------------------------------
+// Serialization
+// ------------------------------------------------------------------
+
+/**
+ * \brief Serialize the system table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildSystem( jsonWriter_t * w ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, num = DB_MAX( pnewdb, SYSTEM );
+        newdb_system_t * system = malloc( num * sizeof( newdb_system_t ) );
+        if ( system == NULL ) {
+            printf( "Error mallocing memory for serialize: %d - %s\n", errno, strerror( errno ) );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for serialize" );
+            return( 0 );
+        }
+        
+        // Headers
+        newDbSerializeHelperHeader( w, NUM_COLUMNS_SYSTEM, newdb_system_columns );
+
+        // Data
+        newDbReadCopy( pnewdb, system, DB_SYSTEM( pnewdb ), num * sizeof( newdb_system_t ) );
+        for ( i=0; i<num && !w->error; i++ ) {
+            if ( system[i].name[0] != '\0' ) {
+                jsonWriterChar( w, ';' );
+                newDbSerializeHelperInt( w, system[i].id, 0 );
+                newDbSerializeHelperStr( w, system[i].name, 1 );
+                newDbSerializeHelperInt( w, system[i].intval, 1 );
+                newDbSerializeHelperStr( w, system[i].strval, 1 );
+                newDbSerializeHelperInt( w, system[i].lastupdate, 1 );
+            }
+        }
+        
+        free( system );
+        return( !w->error );
+    }
+    return( 0 );
+}
+
+/**
+ * \brief Serialize the device table from device type <dev1> to <dev2> (and including)
+ * \param dev1 From (and including) device type. When 0 (= DEVICE_DEV_UNKNOWN), then all
+ * devices are serialized
+ * \param dev2 To (and including) device type
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbSerializeDevsDev( int dev1, int dev2, jsonWriter_t * w ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, num = DB_MAX( pnewdb, DEVICES );
+        newdb_dev_t * devices = malloc( num * sizeof( newdb_dev_t ) );
+        if ( devices == NULL ) {
+            printf( "Error mallocing memory for serialize: %d - %s\n", errno, strerror( errno ) );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for serialize" );
+            return( 0 );
+        }
+        
+        // Headers
+        newDbSerializeHelperHeader( w, sizeof(newdb_devs_columns)/sizeof(char*), newdb_devs_columns );
+
+        // Data
+        newDbReadCopy( pnewdb, devices, DB_DEVICES( pnewdb ), num * sizeof( newdb_dev_t ) );
+        for ( i=0; i<num && !w->error; i++ ) {
+            if ( !dev1 || ( devices[i].dev >= dev1 && devices[i].dev <= dev2 ) ) {
+                if ( devices[i].mac[0] != '\0' ) {
+                    jsonWriterChar( w, ';' );
+                    newDbSerializeHelperInt( w, devices[i].id, 0 );
+                    newDbSerializeHelperStr( w, devices[i].mac, 1 );
+                    newDbSerializeHelperInt( w, devices[i].dev, 1 );
+                    newDbSerializeHelperStr( w, devices[i].ty, 1 );
+                    newDbSerializeHelperInt( w, devices[i].par, 1 );
+                    newDbSerializeHelperStr( w, devices[i].nm, 1 );
+                    newDbSerializeHelperInt( w, devices[i].heat, 1 );
+                    newDbSerializeHelperInt( w, devices[i].cool, 1 );
+                    newDbSerializeHelperInt( w, devices[i].tmp, 1 );
+                    newDbSerializeHelperInt( w, devices[i].hum, 1 );
+                    newDbSerializeHelperInt( w, devices[i].prs, 1 );
+                    newDbSerializeHelperInt( w, devices[i].co2, 1 );
+                    newDbSerializeHelperInt( w, devices[i].bat, 1 );
+                    newDbSerializeHelperInt( w, devices[i].batl, 1 );
+                    newDbSerializeHelperInt( w, devices[i].als, 1 );
+                    newDbSerializeHelperInt( w, devices[i].xloc, 1 );
+                    newDbSerializeHelperInt( w, devices[i].yloc, 1 );
+                    newDbSerializeHelperInt( w, devices[i].zloc, 1 );
+                    newDbSerializeHelperInt( w, devices[i].sid, 1 );
+                    newDbSerializeHelperStr( w, devices[i].cmd, 1 );
+                    newDbSerializeHelperInt( w, devices[i].lvl, 1 );
+                    newDbSerializeHelperInt( w, devices[i].rgb, 1 );
+                    newDbSerializeHelperInt( w, devices[i].kelvin, 1 );
+                    newDbSerializeHelperInt( w, devices[i].act, 1 );
+                    newDbSerializeHelperInt( w, devices[i].sum, 1 );
+                    newDbSerializeHelperInt( w, devices[i].flags, 1 );
+                    newDbSerializeHelperInt( w, devices[i].lastupdate, 1 );
+                }
+            }
+        }
+        
+        free( devices );
+        return( !w->error );
+    }
+    return( 0 );
+}
+
+/**
+ * \brief Serialize the complete device table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildDevs( jsonWriter_t * w ) {
+    return newDbSerializeDevsDev( DEVICE_DEV_UNKNOWN, DEVICE_DEV_UNKNOWN, w );
+}
+
+/**
+ * \brief Serialize the subset of plugs in the device table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildPlugs( jsonWriter_t * w ) {
+    return newDbSerializeDevsDev( DEVICE_DEV_PLUG, DEVICE_DEV_PLUG, w );
+}
+
+/**
+ * \brief Serialize the subset of lamps in the device table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildLamps( jsonWriter_t * w ) {
+    return newDbSerializeDevsDev( DEVICE_DEV_LAMP, DEVICE_DEV_LAMP, w );
+}
+
+/**
+ * \brief Serialize the subset of lamps and plugs in the device table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildLampsAndPlugs( jsonWriter_t * w ) {
+    return newDbSerializeDevsDev( DEVICE_DEV_LAMP, DEVICE_DEV_PLUG, w );
+}
+
+/**
+ * \brief Serialize the subset of climate devices in the device table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildClimate( jsonWriter_t * w ) {
+    return newDbSerializeDevsDev( DEVICE_DEV_MANAGER, DEVICE_DEV_PUMP, w );
+}
+
+/**
+ * \brief Serialize the plughistory: the last counter of each plug series
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildPlugHist( jsonWriter_t * w ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, num = DB_MAX( pnewdb, PLUGSERIES );
+        newdb_plugseries_t * plughist = malloc( num * sizeof( newdb_plugseries_t ) );
+        if ( plughist == NULL ) {
+            printf( "Error mallocing memory for serialize: %d - %s\n", errno, strerror( errno ) );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for serialize" );
+            return( 0 );
+        }
+        
+        // Headers
+        newDbSerializeHelperHeader( w, NUM_COLUMNS_PLUGHIST, newdb_plughist_columns );
+
+        // Data
+        newDbReadCopy( pnewdb, plughist, DB_PLUGSERIES( pnewdb ), num * sizeof( newdb_plugseries_t ) );
+        for ( i=0; i<num && !w->error; i++ ) {
+            if ( plughist[i].mac[0] != '\0' ) {
+                jsonWriterChar( w, ';' );
+                newDbSerializeHelperInt( w, plughist[i].id, 0 );
+                newDbSerializeHelperStr( w, plughist[i].mac, 1 );
+                newDbSerializeHelperInt( w, plughist[i].sum, 1 );
+                newDbSerializeHelperInt( w, plughist[i].lastupdate, 1 );
+            }
+        }
+        
+        free( plughist );
+        return( !w->error );
+    }
+    return( 0 );
+}
+
+/**
+ * \brief Serialize the zcb table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildZcb( jsonWriter_t * w ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, num = DB_MAX( pnewdb, ZCB );
+        newdb_zcb_t * zcb = malloc( num * sizeof( newdb_zcb_t ) );
+        if ( zcb == NULL ) {
+            printf( "Error mallocing memory for serialize: %d - %s\n", errno, strerror( errno ) );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for serialize" );
+            return( 0 );
+        }
+        
+        // Headers
+        newDbSerializeHelperHeader( w, NUM_COLUMNS_ZCB, newdb_zcb_columns );
+
+        // Data
+        newDbReadCopy( pnewdb, zcb, DB_ZCB( pnewdb ), num * sizeof( newdb_zcb_t ) );
+        for ( i=0; i<num && !w->error; i++ ) {
+            if ( zcb[i].status != ZCB_STATUS_FREE ) {
+                jsonWriterChar( w, ';' );
+                newDbSerializeHelperInt( w, zcb[i].id, 0 );
+                newDbSerializeHelperStr( w, zcb[i].mac, 1 );
+                newDbSerializeHelperInt( w, zcb[i].status, 1 );
+                newDbSerializeHelperInt( w, zcb[i].saddr, 1 );
+                newDbSerializeHelperInt( w, zcb[i].type, 1 );
+                newDbSerializeHelperInt( w, zcb[i].lastupdate, 1 );
+            }
+        }
+        
+        free( zcb );
+        return( !w->error );
+    }
+    return( 0 );
+}
+
+/**
+ * \brief Serialize the link table
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 in case of an error
+ */
+static int newDbBuildLinks( jsonWriter_t * w ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, num = DB_MAX( pnewdb, LINKS );
+        newdb_link_t * links = malloc( num * sizeof( newdb_link_t ) );
+        if ( links == NULL ) {
+            printf( "Error mallocing memory for serialize: %d - %s\n", errno, strerror( errno ) );
+            newLogAdd( NEWLOG_FROM_DATABASE, "Error mallocing memory for serialize" );
+            return( 0 );
+        }
+        
+        // Headers
+        newDbSerializeHelperHeader( w, NUM_COLUMNS_LINKS, newdb_links_columns );
+
+        // Data
+        newDbReadCopy( pnewdb, links, DB_LINKS( pnewdb ), num * sizeof( newdb_link_t ) );
+        for ( i=0; i<num && !w->error; i++ ) {
+            if ( links[i].mac[0] != '\0' ) {
+                jsonWriterChar( w, ';' );
+                newDbSerializeHelperInt( w, links[i].id, 0 );
+                newDbSerializeHelperInt( w, links[i].src, 1 );
+                newDbSerializeHelperStr( w, links[i].mac, 1 );
+                newDbSerializeHelperInt( w, links[i].saddr, 1 );
+                newDbSerializeHelperInt( w, links[i].depth, 1 );
+                newDbSerializeHelperInt( w, links[i].lqi, 1 );
+                newDbSerializeHelperInt( w, links[i].rel, 1 );
+                newDbSerializeHelperInt( w, links[i].lastupdate, 1 );
+            }
+        }
+        
+        free( links );
+        return( !w->error );
     }
-    return NULL;
+    return( 0 );
 }
 
+// ------------------------------------------------------------------
+// Serialization cache
+// ------------------------------------------------------------------
+
+// Builder of each serialization cache (NEWDB_CACHE_*)
+static int (*newdb_cache_builders[NEWDB_NUM_CACHE])( jsonWriter_t * w ) = {
+    newDbBuildSystem,
+    newDbBuildDevs,
+    newDbBuildPlugs,
+    newDbBuildLamps,
+    newDbBuildLampsAndPlugs,
+    newDbBuildClimate,
+    newDbBuildZcb,
+    newDbBuildPlugHist,
+    newDbBuildLinks
+};
+
 /**
- * \brief Concatenates integer <num> to string <buf>, proceeded by a comma when requested.
- * \param MAXBUF Maximum length of the serialized string
- * \param buf User allocated area to store the serialization result
- * \param num Number to concatenate
- * \param proceedComma Boolean indicating that first a comma needs to be added
- * \returns A pointer to the end of the string, or NULL in case of an error
+ * \brief Run the builder of a serialization cache
+ * \param cache One of NEWDB_CACHE_*
+ * \param w Writer for the serialization
+ * \returns 1 on success, 0 when it did not fit or in case of an error
  */
-static char * newDbSerializeHelperInt( int MAXBUF, char * buf, int num, int proceedComma ) {
-    char intbuf[20];
-    sprintf( intbuf, "%d", num );
-    return newDbSerializeHelperStr( MAXBUF, buf, intbuf, proceedComma );
+static int newDbBuild( int cache, jsonWriter_t * w ) {
+    if ( newdb_cache_builders[cache]( w ) && jsonWriterEnd( w ) ) return( 1 );
+    if ( w->error && w->fd < 0 ) printf( "Serialization buffer overrun\n" );
+    return( 0 );
 }
 
 /**
- * \brief Concatenates a header row to string <buf>
- * \param MAXBUF Maximum length of the serialized string
- * \param buf User allocated area to store the serialization result
- * \param num Number of header strings to concatenate
- * \param headers Array of header strings (of length <num>) to be added
- * \returns A pointer to the end of the string, or NULL in case of an error
+ * \brief Get a serialization from its cache in the SHM. It is only rebuilt when its table
+ * changed since the last build, so polling clients mostly cost nothing. The text is not
+ * copied: it stays valid until the table changed twice, copy it when it is kept longer
+ * \param cache One of NEWDB_CACHE_*
+ * \param plen Optional, returns the length of the text
+ * \returns Pointer to the serialization, or NULL in case of an error
  */
-static char * newDbSerializeHelperHeader( int MAXBUF, char * buf, int num, char * headers[] ) {       
-    // Headers
-    int i, addComma = 0;
-    char * start = buf;
-    for ( i=0; i<num && buf != NULL; i++ ) {
-        buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, headers[i], addComma );
-        addComma = 1;
+char * newDbSerializeCached( int cache, int * plen ) {
+    if ( newDbSharedMemory && cache >= 0 && cache < NEWDB_NUM_CACHE ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_cache_t * pcache = DB_CACHE( pnewdb, cache );
+        volatile unsigned int * pgen = &pnewdb->generation[newdb_cache_tables[cache]];
+        int slot;
+
+        if ( !pcache->valid || pcache->gen != *pgen ) {
+            semPautounlock( NEWDB_SEMCACHEKEY, 5 );
+            // Another process may have rebuilt it meanwhile
+            unsigned int gen = *pgen;
+            if ( !pcache->valid || pcache->gen != gen ) {
+                // A change during the build leaves a newer text labelled with the older
+                // generation: it is just rebuilt once more on the next call
+                jsonWriter_t w;
+                slot = !pcache->cur;
+                jsonWriterInit( &w, pcache->text + slot * pnewdb->cachesize[cache],
+                                pnewdb->cachesize[cache], -1 );
+                if ( newDbBuild( cache, &w ) ) {
+                    pcache->len[slot] = jsonWriterLength( &w );
+                } else {
+                    pcache->len[slot] = -1;
+                }
+                __sync_synchronize();
+                pcache->cur   = slot;
+                pcache->gen   = gen;
+                pcache->valid = 1;
+            }
+            semV( NEWDB_SEMCACHEKEY );
+        }
+
+        slot = pcache->cur;
+        if ( pcache->len[slot] >= 0 ) {
+            if ( plen ) *plen = pcache->len[slot];
+            return( pcache->text + slot * pnewdb->cachesize[cache] );
+        }
     }
-    return buf;
+    return( NULL );
 }
 
-// ------------------------------------------------------------------
-// Serialization
-// ------------------------------------------------------------------
-
 /**
- * \brief Serialize the system table
+ * \brief Copy a cached serialization into a user buffer
+ * \param cache One of NEWDB_CACHE_*
  * \param MAXBUF Maximum length of the serialized string
  * \param buf User allocated area to store the serialization result
  * \returns The buf pointer, or NULL in case of an error
  */
-char * newDbSerializeSystem( int MAXBUF, char * buf ) {
-    if ( newDbSharedMemory && buf ) {
-        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        int i;
-        char * start = buf;
-        buf[0] = '\0';
-        
-        // Headers
-        buf = newDbSerializeHelperHeader( MAXBUF, buf, NUM_COLUMNS_SYSTEM, newdb_system_columns );
+static char * newDbSerializeCopy( int cache, int MAXBUF, char * buf ) {
+    int len;
+    char * text;
+    if ( buf == NULL ) return( NULL );
+    if ( ( text = newDbSerializeCached( cache, &len ) ) == NULL ) {
+        // Did not fit the cache: try the user buffer
+        jsonWriter_t w;
+        jsonWriterInit( &w, buf, MAXBUF, -1 );
+        return ( newDbBuild( cache, &w ) ) ? buf : NULL;
+    }
+    if ( len >= MAXBUF ) {
+        printf( "Serialization buffer overrun\n" );
+        return( NULL );
+    }
+    memcpy( buf, text, len + 1 );
+    return( buf );
+}
 
-        // Data
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_SYSTEM && buf != NULL; i++ ) {
-            if ( pnewdb->system[i].name[0] != '\0' ) {
-                strcat( buf, ";" );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->system[i].id, 0 );
-                buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->system[i].name, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->system[i].intval, 1 );
-                buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->system[i].strval, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->system[i].lastupdate, 1 );
-            }
-        }
-        semV( NEWDB_SEMKEY );
-        
-        if ( buf ) return( start );
+/**
+ * \brief Write a serialization to a file descriptor (socket, stdout). It is taken from its
+ * cache when it fits there, otherwise it is built straight through a small buffer, so there
+ * is no size limit. Flush stdout before passing STDOUT_FILENO
+ * \param cache One of NEWDB_CACHE_*
+ * \param fd Descriptor to write to
+ * \returns Number of characters written, or -1 in case of an error
+ */
+int newDbSerializeWrite( int cache, int fd ) {
+    char chunk[NEWDB_WRITE_CHUNK];
+    jsonWriter_t w;
+    char * text;
+    int len;
+
+    if ( !newDbSharedMemory || cache < 0 || cache >= NEWDB_NUM_CACHE ) return( -1 );
+
+    jsonWriterInit( &w, chunk, sizeof( chunk ), fd );
+    if ( ( text = newDbSerializeCached( cache, &len ) ) != NULL ) {
+        jsonWriterRaw( &w, text, len );
+        jsonWriterEnd( &w );
+    } else {
+        newDbBuild( cache, &w );
     }
-    return( NULL );
+    return ( w.error ) ? -1 : jsonWriterLength( &w );
 }
 
 /**
- * \brief Serialize the device table from device type <dev1> to <dev2> (and including)
- * \param dev1 From (and including) device type. When 0 (= DEVICE_DEV_UNKNOWN), then all
- * devices are serialized
- * \param dev2 To (and including) device type
+ * \brief Serialize the system table
  * \param MAXBUF Maximum length of the serialized string
  * \param buf User allocated area to store the serialization result
  * \returns The buf pointer, or NULL in case of an error
  */
-static char * newDbSerializeDevsDev( int dev1, int dev2, int MAXBUF, char * buf ) {
-    if ( newDbSharedMemory && buf ) {
-        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        int i;
-        char * start = buf;
-        buf[0] = '\0';
-        
-        // Headers
-        buf = newDbSerializeHelperHeader( MAXBUF, buf, sizeof(newdb_devs_columns)/sizeof(char*), newdb_devs_columns );
-
-        // Data
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES && buf != NULL; i++ ) {
-            if ( !dev1 || ( pnewdb->devices[i].dev >= dev1 && pnewdb->devices[i].dev <= dev2 ) ) {
-                if ( pnewdb->devices[i].mac[0] != '\0' ) {
-                    strcat( buf, ";" );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].id, 0 );
-                    buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].mac, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].dev, 1 );
-                    buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].ty, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].par, 1 );
-                    buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].nm, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].heat, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].cool, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].tmp, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].hum, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].prs, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].co2, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].bat, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].batl, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].als, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].xloc, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].yloc, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].zloc, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].sid, 1 );
-                    buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].cmd, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].lvl, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].rgb, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].kelvin, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].act, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].sum, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].flags, 1 );
-                    buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->devices[i].lastupdate, 1 );
-                }
-            }
-        }
-        semV( NEWDB_SEMKEY );
-        
-        if ( buf ) return( start );
-    }
-    return( NULL );
+char * newDbSerializeSystem( int MAXBUF, char * buf ) {
+    return newDbSerializeCopy( NEWDB_CACHE_SYSTEM, MAXBUF, buf );
 }
 
 /**
- * \brief Serialize the complete device table
+ * \brief Serialize the device table
  * \param MAXBUF Maximum length of the serialized string
  * \param buf User allocated area to store the serialization result
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializeDevs( int MAXBUF, char * buf ) {
-    return newDbSerializeDevsDev( DEVICE_DEV_UNKNOWN, DEVICE_DEV_UNKNOWN, MAXBUF, buf );
+    return newDbSerializeCopy( NEWDB_CACHE_DEVS, MAXBUF, buf );
 }
 
 /**
@@ -1575,7 +3543,7 @@ char * newDbSerializeDevs( int MAXBUF, char * buf ) {
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializePlugs( int MAXBUF, char * buf ) {
-    return newDbSerializeDevsDev( DEVICE_DEV_PLUG, DEVICE_DEV_PLUG, MAXBUF, buf );
+    return newDbSerializeCopy( NEWDB_CACHE_PLUGS, MAXBUF, buf );
 }
 
 /**
@@ -1585,7 +3553,7 @@ char * newDbSerializePlugs( int MAXBUF, char * buf ) {
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializeLamps( int MAXBUF, char * buf ) {
-    return newDbSerializeDevsDev( DEVICE_DEV_LAMP, DEVICE_DEV_LAMP, MAXBUF, buf );
+    return newDbSerializeCopy( NEWDB_CACHE_LAMPS, MAXBUF, buf );
 }
 
 /**
@@ -1595,7 +3563,7 @@ char * newDbSerializeLamps( int MAXBUF, char * buf ) {
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializeLampsAndPlugs( int MAXBUF, char * buf ) {
-    return newDbSerializeDevsDev( DEVICE_DEV_LAMP, DEVICE_DEV_PLUG, MAXBUF, buf );
+    return newDbSerializeCopy( NEWDB_CACHE_LAMPSANDPLUGS, MAXBUF, buf );
 }
 
 /**
@@ -1605,41 +3573,17 @@ char * newDbSerializeLampsAndPlugs( int MAXBUF, char * buf ) {
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializeClimate( int MAXBUF, char * buf ) {
-    return newDbSerializeDevsDev( DEVICE_DEV_MANAGER, DEVICE_DEV_PUMP, MAXBUF, buf );
+    return newDbSerializeCopy( NEWDB_CACHE_CLIMATE, MAXBUF, buf );
 }
 
 /**
- * \brief Serialize the plughistory table
+ * \brief Serialize the plughistory: the last counter of each plug series
  * \param MAXBUF Maximum length of the serialized string
  * \param buf User allocated area to store the serialization result
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializePlugHist( int MAXBUF, char * buf ) {
-    if ( newDbSharedMemory && buf ) {
-        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        int i;
-        char * start = buf;
-        buf[0] = '\0';
-        
-        // Headers
-        buf = newDbSerializeHelperHeader( MAXBUF, buf, NUM_COLUMNS_PLUGHIST, newdb_plughist_columns );
-
-        // Data
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST && buf != NULL; i++ ) {
-            if ( pnewdb->plughist[i].mac[0] != '\0' ) {
-                strcat( buf, ";" );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->plughist[i].id, 0 );
-                buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->plughist[i].mac, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->plughist[i].sum, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->plughist[i].lastupdate, 1 );
-            }
-        }
-        semV( NEWDB_SEMKEY );
-        
-        if ( buf ) return( start );
-    }
-    return( NULL );
+    return newDbSerializeCopy( NEWDB_CACHE_PLUGHIST, MAXBUF, buf );
 }
 
 /**
@@ -1649,33 +3593,17 @@ char * newDbSerializePlugHist( int MAXBUF, char * buf ) {
  * \returns The buf pointer, or NULL in case of an error
  */
 char * newDbSerializeZcb( int MAXBUF, char * buf ) {
-    if ( newDbSharedMemory && buf ) {
-        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
-        int i;
-        char * start = buf;
-        buf[0] = '\0';
-        
-        // Headers
-        buf = newDbSerializeHelperHeader( MAXBUF, buf, NUM_COLUMNS_ZCB, newdb_zcb_columns );
+    return newDbSerializeCopy( NEWDB_CACHE_ZCB, MAXBUF, buf );
+}
 
-        // Data
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB && buf != NULL; i++ ) {
-            if ( pnewdb->zcb[i].status != ZCB_STATUS_FREE ) {
-                strcat( buf, ";" );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->zcb[i].id, 0 );
-                buf = newDbSerializeHelperStr( MAXBUF - (int)( buf-start ), buf, pnewdb->zcb[i].mac, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->zcb[i].status, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->zcb[i].saddr, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->zcb[i].type, 1 );
-                buf = newDbSerializeHelperInt( MAXBUF - (int)( buf-start ), buf, pnewdb->zcb[i].lastupdate, 1 );
-            }
-        }
-        semV( NEWDB_SEMKEY );
-        
-        if ( buf ) return( start );
-    }
-    return( NULL );
+/**
+ * \brief Serialize the link table
+ * \param MAXBUF Maximum length of the serialized string
+ * \param buf User allocated area to store the serialization result
+ * \returns The buf pointer, or NULL in case of an error
+ */
+char * newDbSerializeLinks( int MAXBUF, char * buf ) {
+    return newDbSerializeCopy( NEWDB_CACHE_LINKS, MAXBUF, buf );
 }
 
 // ------------------------------------------------------------------
@@ -1691,16 +3619,20 @@ int newDbGetLastupdateSystem( void ) {
     if ( newDbSharedMemory ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_SYSTEM; i++ ) {
-            if ( pnewdb->system[i].name[0] != '\0' ) {
-                if ( pnewdb->system[i].lastupdate > lastupdate ) {
-                    lastupdate = pnewdb->system[i].lastupdate;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            lastupdate = 0;
+            sum = 0;
+            for ( i=0; i<DB_MAX( pnewdb, SYSTEM ); i++ ) {
+                if ( DB_SYSTEM( pnewdb )[i].name[0] != '\0' ) {
+                    if ( DB_SYSTEM( pnewdb )[i].lastupdate > lastupdate ) {
+                        lastupdate = DB_SYSTEM( pnewdb )[i].lastupdate;
+                    }
+                    sum++;
                 }
-                sum++;
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         lastupdate += sum;
     }
     return lastupdate;
@@ -1719,17 +3651,21 @@ static int newDbGetLastupdateDevicesDev( int dev1, int dev2 ) {
     if ( newDbSharedMemory ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES; i++ ) {
-            if ( ( pnewdb->devices[i].mac[0] != '\0' ) &&
-                 ( !dev1 || ( pnewdb->devices[i].dev >= dev1 && pnewdb->devices[i].dev <= dev2 ) ) ) {
-                if ( pnewdb->devices[i].lastupdate > lastupdate ) {
-                    lastupdate = pnewdb->devices[i].lastupdate;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            lastupdate = 0;
+            sum = 0;
+            for ( i=0; i<DB_MAX( pnewdb, DEVICES ); i++ ) {
+                if ( ( DB_DEVICES( pnewdb )[i].mac[0] != '\0' ) &&
+                     ( !dev1 || ( DB_DEVICES( pnewdb )[i].dev >= dev1 && DB_DEVICES( pnewdb )[i].dev <= dev2 ) ) ) {
+                    if ( DB_DEVICES( pnewdb )[i].lastupdate > lastupdate ) {
+                        lastupdate = DB_DEVICES( pnewdb )[i].lastupdate;
+                    }
+                    sum++;
                 }
-                sum++;
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         lastupdate += sum;
     }
     return lastupdate;
@@ -1776,16 +3712,20 @@ int newDbGetLastupdateZcb( void ) {
     if ( newDbSharedMemory ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB; i++ ) {
-            if ( pnewdb->zcb[i].status != ZCB_STATUS_FREE ) {
-                if ( pnewdb->zcb[i].lastupdate > lastupdate ) {
-                    lastupdate = pnewdb->zcb[i].lastupdate;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            lastupdate = 0;
+            sum = 0;
+            for ( i=0; i<DB_MAX( pnewdb, ZCB ); i++ ) {
+                if ( DB_ZCB( pnewdb )[i].status != ZCB_STATUS_FREE ) {
+                    if ( DB_ZCB( pnewdb )[i].lastupdate > lastupdate ) {
+                        lastupdate = DB_ZCB( pnewdb )[i].lastupdate;
+                    }
+                    sum++;
                 }
-                sum++;
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         lastupdate += sum;
     }
     return lastupdate;
@@ -1800,21 +3740,146 @@ int newDbGetLastupdatePlugHist( void ) {
     if ( newDbSharedMemory ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST; i++ ) {
-            if ( pnewdb->plughist[i].mac[0] != '\0' ) {
-                if ( pnewdb->plughist[i].lastupdate > lastupdate ) {
-                    lastupdate = pnewdb->plughist[i].lastupdate;
+        unsigned int seq;
+        do {
+            seq = newDbReadBegin( pnewdb );
+            lastupdate = 0;
+            sum = 0;
+            for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ); i++ ) {
+                if ( DB_PLUGHIST( pnewdb )[i].mac[0] != '\0' ) {
+                    if ( DB_PLUGHIST( pnewdb )[i].lastupdate > lastupdate ) {
+                        lastupdate = DB_PLUGHIST( pnewdb )[i].lastupdate;
+                    }
+                    sum++;
                 }
-                sum++;
             }
-        }
-        semV( NEWDB_SEMKEY );
+        } while ( newDbReadRetry( pnewdb, seq ) );
         lastupdate += sum;
     }
     return lastupdate;
 }
 
+/**
+ * \brief Get the tables that changed since they were last saved
+ * \returns NEWDB_DIRTY() bits of the changed tables
+ */
+unsigned int newDbGetDirtyTables( void ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        return *(volatile unsigned int *)&pnewdb->dirty;
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the generation of a table, which is incremented on each change
+ * \param table One of NEWDB_TABLE_*
+ * \returns Generation count
+ */
+unsigned int newDbGetGeneration( int table ) {
+    if ( newDbSharedMemory && table >= 0 && table < NEWDB_NUM_TABLES ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        return *(volatile unsigned int *)&pnewdb->generation[table];
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the generation of the table behind a serialization cache
+ * \param cache One of NEWDB_CACHE_*
+ * \returns Generation count
+ */
+unsigned int newDbGetCacheGeneration( int cache ) {
+    if ( cache >= 0 && cache < NEWDB_NUM_CACHE ) {
+        return newDbGetGeneration( newdb_cache_tables[cache] );
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the combined generation of a set of tables, which changes on each change of one of them
+ * \param tables NEWDB_DIRTY() bits of the tables
+ * \returns Sum of the generation counts
+ */
+unsigned int newDbGetGenerations( unsigned int tables ) {
+    unsigned int gen = 0;
+    int t;
+    for ( t=0; t<NEWDB_NUM_TABLES; t++ ) {
+        if ( tables & NEWDB_DIRTY( t ) ) gen += newDbGetGeneration( t );
+    }
+    return gen;
+}
+
+/**
+ * \brief Wait until one of a set of tables changed, for long-polling clients
+ * \param tables NEWDB_DIRTY() bits of the tables
+ * \param gen The newDbGetGenerations() the client has seen
+ * \param timeout Maximum wait in ms
+ * \returns The current newDbGetGenerations(): still gen when the wait timed out
+ */
+unsigned int newDbWaitGenerations( unsigned int tables, unsigned int gen, int timeout ) {
+    unsigned int now;
+    while ( ( now = newDbGetGenerations( tables ) ) == gen && timeout > 0 ) {
+        usleep( NEWDB_WAIT_POLL * 1000 );
+        timeout -= NEWDB_WAIT_POLL;
+    }
+    return now;
+}
+
+/**
+ * \brief Get the total number of DB writes
+ * \returns Number of writes
+ */
+int newDbGetNumWrites( void ) {
+    if ( newDbSharedMemory ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        return *(volatile int *)&pnewdb->numwrites;
+    }
+    return 0;
+}
+
+/**
+ * \brief Set the capacity of a table, to be used when the SHM does not exist yet at newDbOpen().
+ * Overrules UCI (iot.newdb.<table>) and the defaults
+ * \param table One of NEWDB_TABLE_*
+ * \param capacity Number of rows, 0 for UCI or default
+ */
+void newDbSetCapacity( int table, int capacity ) {
+    if ( table >= 0 && table < NEWDB_NUM_TABLES ) {
+        newDbCapacity[table] = capacity;
+    }
+}
+
+/**
+ * \brief Set a table capacity from a command line argument
+ * \param arg <table>=<rows>, e.g. "devices=100"
+ * \returns 1 on success, 0 on error
+ */
+int newDbParseCapacity( char * arg ) {
+    int t;
+    for ( t=0; arg && t<NEWDB_NUM_TABLES; t++ ) {
+        int len = strlen( newdb_table_names[t] );
+        if ( strncmp( arg, newdb_table_names[t], len ) == 0 && arg[len] == '=' ) {
+            newDbSetCapacity( t, atoi( &arg[len+1] ) );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the capacity of a table
+ * \param table One of NEWDB_TABLE_*
+ * \returns Number of rows, 0 on error
+ */
+int newDbGetCapacity( int table ) {
+    if ( newDbSharedMemory && table >= 0 && table < NEWDB_NUM_TABLES ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        return pnewdb->tables[table].capacity;
+    }
+    return 0;
+}
+
 // ------------------------------------------------------------------
 // Clear
 // ------------------------------------------------------------------
@@ -1825,14 +3890,16 @@ int newDbGetLastupdatePlugHist( void ) {
  * \returns 1 on success, 0 on error
  */
 int newDbDeletePlugHist( int id ) {
-    if ( newDbSharedMemory && id >= 0 && id < NEWDB_MAX_PLUGHIST ) {
+    if ( newDbSharedMemory && id >= 0 && id < newDbGetCapacity( NEWDB_TABLE_PLUGHIST ) ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        pnewdb->plughist[id].mac[0] = '\0';
+        newDbWriteLock( pnewdb );
+        DB_PLUGHIST( pnewdb )[id].mac[0] = '\0';
+        newDbIndexRebuildPlugHist( pnewdb );
         pnewdb->numwrites++;
         pnewdb->lastupdate_plughist = now;
-        semV( NEWDB_SEMKEY );
+        newDbTouch( pnewdb, NEWDB_TABLE_PLUGHIST );
+        newDbWriteUnlock( pnewdb );
         newLogAdd( NEWLOG_FROM_DATABASE, "Deleted entry from plughist table" );
         return 1;
     }
@@ -1850,16 +3917,17 @@ int newDbDeleteSystem( char * name ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_SYSTEM && !found; i++ ) {
-            if ( strcmp( pnewdb->system[i].name, name ) == 0 ) {
-                pnewdb->system[i].name[0] = '\0';
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, SYSTEM ) && !found; i++ ) {
+            if ( strcmp( DB_SYSTEM( pnewdb )[i].name, name ) == 0 ) {
+                DB_SYSTEM( pnewdb )[i].name[0] = '\0';
                 pnewdb->numwrites++;
                 pnewdb->lastupdate_sys = now;
+                newDbTouch( pnewdb, NEWDB_TABLE_SYSTEM );
                 found = 1;
             }
         }
-        semV( NEWDB_SEMKEY );
+        newDbWriteUnlock( pnewdb );
         if ( found ) {
             DEBUG_PRINTF( "Deleting system %s succeeded\n", name );
             newLogAdd( NEWLOG_FROM_DATABASE, "Deleted entry from system table" );
@@ -1886,16 +3954,20 @@ int newDbDeleteDevice( char * mac ) {
         newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;	//-ָڴ
         int i;
         int now = (int)time( NULL );
-        semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES && !found; i++ ) {
-            if ( strcmp( pnewdb->devices[i].mac, mac ) == 0 ) {//-ͨmacַ豸
-                pnewdb->devices[i].mac[0] = '\0';	//-macַɾ豸
+        newDbWriteLock( pnewdb );
+        for ( i=0; i<DB_MAX( pnewdb, DEVICES ) && !found; i++ ) {
+            if ( strcmp( DB_DEVICES( pnewdb )[i].mac, mac ) == 0 ) {//-ͨmacַ豸
+                DB_DEVICES( pnewdb )[i].mac[0] = '\0';	//-macַɾ豸
                 pnewdb->numwrites++;	//-¼ȷݵĴ?
                 pnewdb->lastupdate_devices = now;	//-ʾݿ
+                newDbTouch( pnewdb, NEWDB_TABLE_DEVICES );
                 found = 1;
             }
         }
-        semV( NEWDB_SEMKEY );
+        if ( found ) {
+            newDbIndexRebuildDevices( pnewdb );
+        }
+        newDbWriteUnlock( pnewdb );
         if ( found ) {
             DEBUG_PRINTF( "Deleting device %s succeeded\n", mac );
             newLogAdd( NEWLOG_FROM_DATABASE, "Deleted entry from device table" );
@@ -1922,8 +3994,8 @@ int newDbLoopDevices( deviceCb_t deviceCb ) {
         int i, ok = 1;
         
         semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_DEVICES && ok; i++ ) {
-            ok = deviceCb( &pnewdb->devices[i] );
+        for ( i=0; i<DB_MAX( pnewdb, DEVICES ) && ok; i++ ) {
+            ok = deviceCb( &DB_DEVICES( pnewdb )[i] );
         }
         semV( NEWDB_SEMKEY );
         
@@ -1948,9 +4020,9 @@ int newDbLoopPlugHist( char * mac, plughistCb_t plugHistCb ) {
         int i, ok = 1;
         
         semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_PLUGHIST && ok; i++ ) {
-            if ( strcmp( pnewdb->plughist[i].mac, mac ) == 0 ) {
-                ok = plugHistCb( &pnewdb->plughist[i] );
+        for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ) && ok; i++ ) {
+            if ( strcmp( DB_PLUGHIST( pnewdb )[i].mac, mac ) == 0 ) {
+                ok = plugHistCb( &DB_PLUGHIST( pnewdb )[i] );
             }
         }
         semV( NEWDB_SEMKEY );
@@ -1972,9 +4044,33 @@ int newDbLoopZcb( zcbCb_t zcbCb ) {
         int i, ok = 1;
         
         semP( NEWDB_SEMKEY );
-        for ( i=0; i<NEWDB_MAX_ZCB && ok; i++ ) {
-            if ( pnewdb->zcb[i].status != ZCB_STATUS_FREE ) {
-                ok = zcbCb( &pnewdb->zcb[i] );
+        for ( i=0; i<DB_MAX( pnewdb, ZCB ) && ok; i++ ) {
+            if ( DB_ZCB( pnewdb )[i].status != ZCB_STATUS_FREE ) {
+                ok = zcbCb( &DB_ZCB( pnewdb )[i] );
+            }
+        }
+        semV( NEWDB_SEMKEY );
+        
+        return( ok );
+    }
+    return 0;
+}
+
+/**
+ * \brief Loop through the group table and call call-back with each used row. Note that
+ * the call-back may not alter the table row as it peeks right into the database
+ * \param groupCb Call-back function
+ * \returns 1 on success, 0 on error
+ */
+int newDbLoopGroups( groupCb_t groupCb ) {
+    if ( newDbSharedMemory && groupCb ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        int i, ok = 1;
+        
+        semP( NEWDB_SEMKEY );
+        for ( i=0; i<DB_MAX( pnewdb, GROUPS ) && ok; i++ ) {
+            if ( DB_GROUPS( pnewdb )[i].grpid != 0 ) {
+                ok = groupCb( &DB_GROUPS( pnewdb )[i] );
             }
         }
         semV( NEWDB_SEMKEY );
@@ -1983,3 +4079,220 @@ int newDbLoopZcb( zcbCb_t zcbCb ) {
     }
     return 0;
 }
+
+// ------------------------------------------------------------------
+// Queries
+// ------------------------------------------------------------------
+
+typedef struct newdb_column {
+    unsigned short offset;
+    unsigned short size;
+} newdb_column_t;
+
+#define NEWDB_DEV_COLUMN( f )   { offsetof( newdb_dev_t, f ), sizeof( ((newdb_dev_t *)0)->f ) }
+
+// Same order as newdb_devs_columns[] and the NEWDB_COL_* bits
+static newdb_column_t newdb_devs_layout[NUM_COLUMNS_DEV] = {
+    NEWDB_DEV_COLUMN( id ),
+    NEWDB_DEV_COLUMN( mac ),
+    NEWDB_DEV_COLUMN( dev ),
+    NEWDB_DEV_COLUMN( ty ),
+    NEWDB_DEV_COLUMN( par ),
+    NEWDB_DEV_COLUMN( nm ),
+    NEWDB_DEV_COLUMN( heat ),
+    NEWDB_DEV_COLUMN( cool ),
+    NEWDB_DEV_COLUMN( tmp ),
+    NEWDB_DEV_COLUMN( hum ),
+    NEWDB_DEV_COLUMN( prs ),
+    NEWDB_DEV_COLUMN( co2 ),
+    NEWDB_DEV_COLUMN( bat ),
+    NEWDB_DEV_COLUMN( batl ),
+    NEWDB_DEV_COLUMN( als ),
+    NEWDB_DEV_COLUMN( xloc ),
+    NEWDB_DEV_COLUMN( yloc ),
+    NEWDB_DEV_COLUMN( zloc ),
+    NEWDB_DEV_COLUMN( sid ),
+    NEWDB_DEV_COLUMN( cmd ),
+    NEWDB_DEV_COLUMN( lvl ),
+    NEWDB_DEV_COLUMN( rgb ),
+    NEWDB_DEV_COLUMN( kelvin ),
+    NEWDB_DEV_COLUMN( act ),
+    NEWDB_DEV_COLUMN( sum ),
+    NEWDB_DEV_COLUMN( flags ),
+    NEWDB_DEV_COLUMN( lastupdate )
+};
+
+/**
+ * \brief Initialize a query that matches all used rows and copies all columns
+ * \param pq Query
+ */
+void newDbQueryInit( newdb_query_t * pq ) {
+    memset( pq, 0, sizeof( newdb_query_t ) );
+    pq->par = -1;
+}
+
+/**
+ * \brief Only match rows of which the mac starts with <prefix>
+ * \param pq Query
+ * \param prefix Start of the mac nibble string, NULL or "" matches all
+ */
+void newDbQueryMacPrefix( newdb_query_t * pq, char * prefix ) {
+    newDbStrNcpy( pq->macprefix, ( prefix ) ? prefix : "", LEN_MAC_NIBBLE );
+    pq->prefixlen = strlen( pq->macprefix );
+}
+
+/**
+ * \brief The filters that all tables have. Note: the row may be halfway a write, so
+ * the mac is compared with a fixed length, and the result only counts when
+ * the read section turns out valid
+ */
+static int newDbQueryMatch( newdb_query_t * pq, const char * mac, int lastupdate ) {
+    if ( mac[0] == '\0' ) return( 0 );
+    if ( pq->since && lastupdate < pq->since ) return( 0 );
+    if ( pq->prefixlen && memcmp( mac, pq->macprefix, pq->prefixlen ) != 0 ) return( 0 );
+    return( 1 );
+}
+
+/**
+ * \brief Get the devices that match query <pq>, from one consistent snapshot of the table.
+ * The rows are checked in the SHM: only matching rows are copied, and only their
+ * columns in pq->columns. No lock is taken and no call-back is called
+ * \param pq Query, see newDbQueryInit()
+ * \param devs User array that receives the matching rows
+ * \param max Size of the user array (newDbGetCapacity( NEWDB_TABLE_DEVICES ) fits all)
+ * \returns Number of rows in devs
+ */
+int newDbQueryDevices( newdb_query_t * pq, newdb_dev_t * devs, int max ) {
+    if ( newDbSharedMemory && pq && devs ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_dev_t * pdev;
+        int i, c, num;
+        unsigned int seq;
+
+        do {
+            seq = newDbReadBegin( pnewdb );
+            num = 0;
+            for ( i=0; i<DB_MAX( pnewdb, DEVICES ) && num < max; i++ ) {
+                pdev = &DB_DEVICES( pnewdb )[i];
+                if ( pq->devmask && ( pdev->dev < 0 || pdev->dev > 31 ||
+                                      !( pq->devmask & NEWDB_DEVMASK( pdev->dev ) ) ) ) continue;
+                if ( pq->par >= 0 && pdev->par != pq->par ) continue;
+                if ( !newDbQueryMatch( pq, pdev->mac, pdev->lastupdate ) ) continue;
+
+                if ( pq->columns == NEWDB_COL_ALL ) {
+                    memcpy( &devs[num], pdev, sizeof( newdb_dev_t ) );
+                } else {
+                    memset( &devs[num], 0, sizeof( newdb_dev_t ) );
+                    for ( c=0; c<NUM_COLUMNS_DEV; c++ ) {
+                        if ( pq->columns & ( 1u << c ) ) {
+                            memcpy( (char *)&devs[num] + newdb_devs_layout[c].offset,
+                                    (char *)pdev + newdb_devs_layout[c].offset,
+                                    newdb_devs_layout[c].size );
+                        }
+                    }
+                }
+                num++;
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+
+        return( num );
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the plughist rows that match query <pq> (mac prefix, since), from one
+ * consistent snapshot of the table
+ * \param pq Query, see newDbQueryInit()
+ * \param phist User array that receives the matching rows
+ * \param max Size of the user array
+ * \returns Number of rows in phist
+ */
+int newDbQueryPlugHist( newdb_query_t * pq, newdb_plughist_t * phist, int max ) {
+    if ( newDbSharedMemory && pq && phist ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_plughist_t * prow;
+        int i, num;
+        unsigned int seq;
+
+        do {
+            seq = newDbReadBegin( pnewdb );
+            num = 0;
+            for ( i=0; i<DB_MAX( pnewdb, PLUGHIST ) && num < max; i++ ) {
+                prow = &DB_PLUGHIST( pnewdb )[i];
+                if ( newDbQueryMatch( pq, prow->mac, prow->lastupdate ) ) {
+                    memcpy( &phist[num++], prow, sizeof( newdb_plughist_t ) );
+                }
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+
+        return( num );
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the used zcb rows that match query <pq> (mac prefix, since), from one
+ * consistent snapshot of the table
+ * \param pq Query, see newDbQueryInit()
+ * \param pzcb User array that receives the matching rows
+ * \param max Size of the user array
+ * \returns Number of rows in pzcb
+ */
+int newDbQueryZcb( newdb_query_t * pq, newdb_zcb_t * pzcb, int max ) {
+    if ( newDbSharedMemory && pq && pzcb ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_zcb_t * prow;
+        int i, num;
+        unsigned int seq;
+
+        do {
+            seq = newDbReadBegin( pnewdb );
+            num = 0;
+            for ( i=0; i<DB_MAX( pnewdb, ZCB ) && num < max; i++ ) {
+                prow = &DB_ZCB( pnewdb )[i];
+                if ( prow->status != ZCB_STATUS_FREE &&
+                     newDbQueryMatch( pq, prow->mac, prow->lastupdate ) ) {
+                    memcpy( &pzcb[num++], prow, sizeof( newdb_zcb_t ) );
+                }
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+
+        return( num );
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the used link rows that match query <pq> (mac prefix of the neighbour, since),
+ * from one consistent snapshot of the table, with the generation of that snapshot
+ * \param pq Query, see newDbQueryInit()
+ * \param plinks User array that receives the matching rows
+ * \param max Size of the user array
+ * \param pgen Optional, returns the newDbGetGeneration() of the link table the rows belong to
+ * \returns Number of rows in plinks
+ */
+int newDbQueryLinks( newdb_query_t * pq, newdb_link_t * plinks, int max, unsigned int * pgen ) {
+    if ( newDbSharedMemory && pq && plinks ) {
+        newdb_t * pnewdb = (newdb_t *)newDbSharedMemory;
+        newdb_link_t * prow;
+        int i, num;
+        unsigned int seq, gen;
+
+        do {
+            seq = newDbReadBegin( pnewdb );
+            gen = pnewdb->generation[NEWDB_TABLE_LINKS];
+            num = 0;
+            for ( i=0; i<DB_MAX( pnewdb, LINKS ) && num < max; i++ ) {
+                prow = &DB_LINKS( pnewdb )[i];
+                if ( newDbQueryMatch( pq, prow->mac, prow->lastupdate ) ) {
+                    memcpy( &plinks[num++], prow, sizeof( newdb_link_t ) );
+                }
+            }
+        } while ( newDbReadRetry( pnewdb, seq ) );
+
+        if ( pgen ) *pgen = gen;
+        return( num );
+    }
+    return 0;
+}
@@ -50,6 +50,29 @@ typedef enum {
     ZCB_STATUS_LEFT,
 } zcbNodeStatus;
 
+#define NEWDB_TABLE_SYSTEM       0
+#define NEWDB_TABLE_DEVICES      1
+#define NEWDB_TABLE_PLUGHIST     2
+#define NEWDB_TABLE_ZCB          3
+#define NEWDB_TABLE_PLUGSERIES   4
+#define NEWDB_TABLE_GROUPS       5
+#define NEWDB_TABLE_LINKS        6
+#define NEWDB_NUM_TABLES         7
+
+#define NEWDB_DIRTY( table )     ( 1u << ( table ) )
+
+// Serializations that are cached in the SHM, see newDbSerializeCached()
+#define NEWDB_CACHE_SYSTEM          0
+#define NEWDB_CACHE_DEVS            1
+#define NEWDB_CACHE_PLUGS           2
+#define NEWDB_CACHE_LAMPS           3
+#define NEWDB_CACHE_LAMPSANDPLUGS   4
+#define NEWDB_CACHE_CLIMATE         5
+#define NEWDB_CACHE_ZCB             6
+#define NEWDB_CACHE_PLUGHIST        7
+#define NEWDB_CACHE_LINKS           8
+#define NEWDB_NUM_CACHE             9
+
 #define LEN_MAC_NIBBLE  16
 #define LEN_TY          8
 #define LEN_NM          20
@@ -129,9 +152,135 @@ typedef struct newdb_zcb {
     uint8_t  u8DeviceVersion;
 } newdb_zcb_t;
 
+// Per-plug energy time-series: rings of Wh used per minute, hour and day. The rings are
+// indexed by absolute minute/hour/day number modulo their size, all three are updated with
+// each sample so older minutes are already rolled up in their hour and day buckets.
+// Running aggregates are kept next to the rings, so the totals need no scan of them.
+#define NEWDB_SERIES_MINUTES     120           // 2 hours
+#define NEWDB_SERIES_HOURS       ( 24 * 14 )   // 2 weeks
+#define NEWDB_SERIES_DAYS        62            // 2 months
+
+#define NEWDB_SERIES_POWER_GAP   ( 15 * 60 )   // Secs without samples that restart the power average
+
+typedef struct newdb_plugseries {
+    int id;
+    char mac[LEN_MAC_NIBBLE+2];
+    int sum;               // Last reported Wh counter
+    int minute;            // time/60 of the last sample, -1 = no sample yet
+    int lastupdate;
+    uint16_t minutes[NEWDB_SERIES_MINUTES];
+    uint16_t hours[NEWDB_SERIES_HOURS];
+    uint16_t days[NEWDB_SERIES_DAYS];
+    // Aggregates, valid for the rings when aggrminute == minute (added behind the rings
+    // so that migrated rows keep their layout: they are recalculated on first use)
+    int total;             // Wh since the series started
+    int hour;              // Wh in the 60 minute buckets up to minute
+    int day;               // Wh in the 24 hour buckets up to minute
+    int power;             // Moving average of the power in W, -1 = not known yet
+    int aggrminute;
+} newdb_plugseries_t;
+
+typedef struct newdb_plugtotals {
+    int sum;               // Last Wh counter
+    int total;             // Wh since the series started
+    int hour;              // Wh used in the last hour (60 minute buckets up to now)
+    int day;               // Wh used in the last day (24 hour buckets up to now)
+    int power;             // Moving average of the power in W, 0 when the plug went silent
+} newdb_plugtotals_t;
+
+// Zigbee groups as they were programmed into the lamps, so that group and scene membership
+// need not be queried from the network. Members are lamp macs, kept sorted.
+#define NEWDB_GROUP_MEMBERS      32
+#define NEWDB_GROUP_SCENES       256
+
+#define FLAG_GROUP_PLANNED       0x01   // Made by the lamp planner, may be re-arranged
+
+#define NEWDB_GROUP_HAS_SCENE( g, s )   ( (g)->scenes[(s) >> 3] & ( 1 << ( (s) & 7 ) ) )
+#define NEWDB_GROUP_SET_SCENE( g, s )   ( (g)->scenes[(s) >> 3] |= ( 1 << ( (s) & 7 ) ) )
+#define NEWDB_GROUP_CLR_SCENE( g, s )   ( (g)->scenes[(s) >> 3] &= ~( 1 << ( (s) & 7 ) ) )
+
+typedef struct newdb_group {
+    int id;
+    int grpid;             // Zigbee group address, 0 = free row
+    int flags;
+    int nummembers;
+    char members[NEWDB_GROUP_MEMBERS][LEN_MAC_NIBBLE+2];
+    uint8_t scenes[NEWDB_GROUP_SCENES / 8];   // Stored scene ids
+    int lastused;          // Last groupcast
+    int lastupdate;
+} newdb_group_t;
+
+// Radio links of the mesh, as ZCB reads them from the neighbour tables (management LQI).
+// One row per node and neighbour; a change bumps the table generation, so topology views
+// built from it only need to be rebuilt when the mesh really changed.
+#define LINK_REL_PARENT          0
+#define LINK_REL_CHILD           1
+#define LINK_REL_SIBLING         2
+#define LINK_REL_NONE            3
+#define LINK_REL_PREVCHILD       4
+
+typedef struct newdb_link {
+    int id;
+    int src;               // Short address of the node whose table lists the link, 0 = coordinator
+    char mac[LEN_MAC_NIBBLE+2];   // Neighbour, "" = free row
+    int saddr;             // Short address of the neighbour
+    int depth;
+    int lqi;
+    int rel;               // LINK_REL_*
+    int lastupdate;
+} newdb_link_t;
+
+// Queries, see newDbQueryDevices(): a filter that is checked right on the rows in the SHM,
+// so only the rows that match are copied, and of devices only the columns that are asked for.
+// All filters that are set must match. Columns that are not asked for are left zero.
+#define NEWDB_DEVMASK( dev )     ( 1u << ( dev ) )
+#define NEWDB_DEVMASK_CLIMATE    ( NEWDB_DEVMASK( DEVICE_DEV_MANAGER ) | NEWDB_DEVMASK( DEVICE_DEV_UI ) | \
+                                   NEWDB_DEVMASK( DEVICE_DEV_SENSOR ) | NEWDB_DEVMASK( DEVICE_DEV_UISENSOR ) | \
+                                   NEWDB_DEVMASK( DEVICE_DEV_PUMP ) )
+
+#define NEWDB_COL_ID             ( 1u << 0 )     // In the order of the device serialization
+#define NEWDB_COL_MAC            ( 1u << 1 )
+#define NEWDB_COL_DEV            ( 1u << 2 )
+#define NEWDB_COL_TY             ( 1u << 3 )
+#define NEWDB_COL_PAR            ( 1u << 4 )
+#define NEWDB_COL_NM             ( 1u << 5 )
+#define NEWDB_COL_HEAT           ( 1u << 6 )
+#define NEWDB_COL_COOL           ( 1u << 7 )
+#define NEWDB_COL_TMP            ( 1u << 8 )
+#define NEWDB_COL_HUM            ( 1u << 9 )
+#define NEWDB_COL_PRS            ( 1u << 10 )
+#define NEWDB_COL_CO2            ( 1u << 11 )
+#define NEWDB_COL_BAT            ( 1u << 12 )
+#define NEWDB_COL_BATL           ( 1u << 13 )
+#define NEWDB_COL_ALS            ( 1u << 14 )
+#define NEWDB_COL_XLOC           ( 1u << 15 )
+#define NEWDB_COL_YLOC           ( 1u << 16 )
+#define NEWDB_COL_ZLOC           ( 1u << 17 )
+#define NEWDB_COL_SID            ( 1u << 18 )
+#define NEWDB_COL_CMD            ( 1u << 19 )
+#define NEWDB_COL_LVL            ( 1u << 20 )
+#define NEWDB_COL_RGB            ( 1u << 21 )
+#define NEWDB_COL_KELVIN         ( 1u << 22 )
+#define NEWDB_COL_ACT            ( 1u << 23 )
+#define NEWDB_COL_SUM            ( 1u << 24 )
+#define NEWDB_COL_FLAGS          ( 1u << 25 )
+#define NEWDB_COL_LASTUPDATE     ( 1u << 26 )
+#define NEWDB_COL_ALL            0
+
+typedef struct newdb_query {
+    unsigned int devmask;                   // Devices: NEWDB_DEVMASK() bits, 0 = any type
+    int par;                                // Devices: parent id (the manager or UI of a room), -1 = any
+    char macprefix[LEN_MAC_NIBBLE+2];       // Mac starts with, "" = any
+    int prefixlen;
+    int since;                              // lastupdate >= since, 0 = any
+    unsigned int columns;                   // Devices: NEWDB_COL_* bits to copy, NEWDB_COL_ALL = all
+} newdb_query_t;
+
 typedef int (*deviceCb_t)( newdb_dev_t * pdev );
+typedef int (*deviceUpdateCb_t)( newdb_dev_t * pdev, int index, void * arg );
 typedef int (*plughistCb_t)( newdb_plughist_t * phist );
 typedef int (*zcbCb_t)( newdb_zcb_t * pzcb );
+typedef int (*groupCb_t)( newdb_group_t * pgroup );
 
 int newDbOpen( void );
 int newDbClose( void );
@@ -152,6 +301,7 @@ int newDbGetDevice( char * mac, newdb_dev_t * pdev );
 int newDbGetNewDevice( char * mac, newdb_dev_t * pdev );
 int newDbGetDeviceId( int id, newdb_dev_t * pdev );
 int newDbSetDevice( newdb_dev_t * pdev );
+int newDbUpdateDevices( char * macs[], int num, deviceUpdateCb_t updateCb, void * arg );
 char * newDbDeviceGetMac( int id, char * mac );
 int newDbDeleteDevice( char * mac );
 int newDbEmptyDevices( int mode );
@@ -169,24 +319,53 @@ int newDbDeletePlugHist( int id );
 int newDbGetNumOfPlughist( void );
 int newDbEmptyPlugHist( void );
 
+int newDbAddPlugSample( char * mac, int sum, int now );
+int newDbGetPlugUsage( char * mac, int period, int now, int num, int * usage, int * psum );
+int newDbGetPlugTotals( char * mac, int now, newdb_plugtotals_t * ptotals );
+
+int newDbGetGroup( int grpid, newdb_group_t * pgroup );
+int newDbGetNewGroup( int grpid, newdb_group_t * pgroup );
+int newDbSetGroup( newdb_group_t * pgroup );
+int newDbDeleteGroup( int grpid );
+int newDbGroupsRemoveMember( char * mac );
+int newDbGroupHasMember( newdb_group_t * pgroup, char * mac );
+int newDbGroupAddMember( newdb_group_t * pgroup, char * mac );
+int newDbGroupRemoveMember( newdb_group_t * pgroup, char * mac );
+
 int newDbGetZcb( char * mac, newdb_zcb_t * pzcb );
 int newDbGetZcbSaddr( int saddr, newdb_zcb_t * pzcb );
 int newDbGetNewZcb( char * mac, newdb_zcb_t * pzcb );
 int newDbSetZcb( newdb_zcb_t * pzcb );
 int newDbEmptyZcb( void );
 int newDbLoopZcb( zcbCb_t zcbCb );
+int newDbLoopGroups( groupCb_t groupCb );
+
+int newDbSetLink( newdb_link_t * plink );
+int newDbDeleteLink( int src, char * mac );
+int newDbEmptyLinks( void );
+int newDbQueryLinks( newdb_query_t * pq, newdb_link_t * plinks, int max, unsigned int * pgen );
+
+void newDbQueryInit( newdb_query_t * pq );
+void newDbQueryMacPrefix( newdb_query_t * pq, char * prefix );
+int newDbQueryDevices( newdb_query_t * pq, newdb_dev_t * devs, int max );
+int newDbQueryPlugHist( newdb_query_t * pq, newdb_plughist_t * phist, int max );
+int newDbQueryZcb( newdb_query_t * pq, newdb_zcb_t * pzcb, int max );
 
 char * newDbSerializeSystem( int MAXBUF, char * buf );
 char * newDbSerializeRooms( int MAXBUF, char * buf );
 char * newDbSerializeDevs( int MAXBUF, char * buf );
 char * newDbSerializePlugHist( int MAXBUF, char * buf );
 char * newDbSerializeZcb( int MAXBUF, char * buf );
+char * newDbSerializeLinks( int MAXBUF, char * buf );
 
 char * newDbSerializePlugs( int MAXBUF, char * buf );
 char * newDbSerializeLamps( int MAXBUF, char * buf );
 char * newDbSerializeLampsAndPlugs( int MAXBUF, char * buf );
 char * newDbSerializeClimate( int MAXBUF, char * buf );
 
+char * newDbSerializeCached( int cache, int * plen );
+int newDbSerializeWrite( int cache, int fd );
+
 int newDbGetLastupdateRooms( void );
 int newDbGetLastupdateDevices( void );
 int newDbGetLastupdateSystem( void );
@@ -197,5 +376,16 @@ int newDbGetLastupdatePlug( void );
 int newDbGetLastupdateLamp( void );
 int newDbGetLastupdateClimate( void );
 
+unsigned int newDbGetDirtyTables( void );
+unsigned int newDbGetGeneration( int table );
+unsigned int newDbGetCacheGeneration( int cache );
+unsigned int newDbGetGenerations( unsigned int tables );
+unsigned int newDbWaitGenerations( unsigned int tables, unsigned int gen, int timeout );
+int newDbGetNumWrites( void );
+
+void newDbSetCapacity( int table, int capacity );
+int newDbParseCapacity( char * arg );
+int newDbGetCapacity( int table );
+
 void newDbPrintPlugHist( void );
 
@@ -16,6 +16,7 @@
 // #include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -27,8 +28,8 @@
 // #include "fileCreate.h"
 #include "newLog.h"
 
-#define NEWLOG_SHMKEY   99613
-#define NEWLOG_SEMKEY   99621
+#define NEWLOG_SHMKEY   99614           // 99613 was the ring of 120 text lines below a semaphore
+#define NEWLOG_SEMKEY   99621           // Only taken to create the SHM
 
 // #define LOG_DEBUG
 
@@ -41,21 +42,46 @@
 #define LL_LOG( f, t )
 // #define LL_LOG( f, t ) filelog( f, t )
 
-#define NEWLOG_MAX_LOGS        120
+// Records in the ring. Only used by the process that creates the SHM,
+// all others take the capacity from the ring header
+#ifndef NEWLOG_MAX_LOGS
+#define NEWLOG_MAX_LOGS        512
+#endif
 
+#define NEWLOG_MAGIC           0x4C4F4732       // "LOG2"
+
+// Indexes handed out are the tickets, limited to a positive int
+#define NEWLOG_INDEX_MASK      0x7FFFFFFF
+#define NEWLOG_INDEX( t )      ( (int)( (t) & NEWLOG_INDEX_MASK ) )
+
+typedef struct newlogrec {
+    volatile unsigned int seq;  // Ticket + 1 when complete, 0 while being written
+    short from;
+    short code;                 // newLogCode
+    int ts;
+    int args[NEWLOG_MAX_ARGS];
+    char str[NEWLOG_MAX_TEXT+2];    // Text, or the %s argument of the code
+} newlogrec_t;
 
 typedef struct newlog {
 
-    int cnt;
-    int index;
-    int lastupdate;
-    
+    int magic;
+    int capacity;
+    volatile unsigned int ticket;   // Next record to write: only ever incremented
+    volatile unsigned int base;     // First record after the last newLogEmpty
+    volatile int lastupdate;
+
     int reserve[7];
 
-    onelog_t log[NEWLOG_MAX_LOGS];
-    
+    newlogrec_t log[];
+
 } newlog_t;
 
+typedef struct newlogformat {
+    char * fmt;                 // Only %s (the string) and %d (next int)
+    int    nargs;
+} newlogformat_t;
+
 // ------------------------------------------------------------------
 // Globals
 // ------------------------------------------------------------------
@@ -72,6 +98,18 @@ char * logNames[11] = { "none",
     "Gw Discovery",       // 9
     "Test" };             // 10
 
+static newlogformat_t newLogFormats[NEWLOG_NUM_CODES] = {
+    { "%s", 0 },                                                // NEWLOG_TEXT
+    { "DB migrate %s: %d -> %d rows of %d -> %d bytes", 4 },    // NEWLOG_DB_MIGRATE
+    { "Incompatible database version: %d != %d", 2 },           // NEWLOG_DB_VERSION
+    { "Incompatible DB SHM version: %d != %d", 2 },             // NEWLOG_DB_SHM_VERSION
+    { "Announce %s", 0 },                                       // NEWLOG_ZCB_ANNOUNCE
+    { "UI %s: heat %d", 1 },                                    // NEWLOG_ZCB_UI_HEAT
+    { "UI %s: cool %d", 1 },                                    // NEWLOG_ZCB_UI_COOL
+    { "Sensors: %d reports, %d of %d devices updated", 3 },     // NEWLOG_ZCB_SENSORS
+    { "Plug %d/%d", 2 },                                        // NEWLOG_ZCB_PLUG
+};
+
 static char * newLogSharedMemory = NULL;
 
 char logbuffer[MAX_LOG_BUFFER];
@@ -87,18 +125,19 @@ char logbuffer[MAX_LOG_BUFFER];
 static int newLogOpen( void ) {
 
     int shmid = -1, created = 0, ret = 0;
+    size_t size = sizeof( newlog_t ) + NEWLOG_MAX_LOGS * sizeof( newlogrec_t );
     
     LL_LOG( "/tmp/loggy", "In newLogOpen" );
 
     semPautounlock( NEWLOG_SEMKEY, 10 );
 
-    // Locate the segment
-    if ((shmid = shmget(NEWLOG_SHMKEY, sizeof(newlog_t), 0666)) < 0) {
+    // Locate the segment, whatever capacity it was created with
+    if ((shmid = shmget(NEWLOG_SHMKEY, 0, 0666)) < 0) {
         
         LL_LOG( "/tmp/loggy", "SHM not found" );
         
         // SHM not found: try to create
-        if ((shmid = shmget(NEWLOG_SHMKEY, sizeof(newlog_t), IPC_CREAT | 0666)) < 0) {
+        if ((shmid = shmget(NEWLOG_SHMKEY, size, IPC_CREAT | 0666)) < 0) {
             // Create error
             perror("shmget-create");
             printf( "Error creating SHM for Logs\n" );
@@ -127,26 +166,23 @@ static int newLogOpen( void ) {
         } else {
             DEBUG_PRINTF( "Successfully attached SHM for Logs\n" );
             LL_LOG( "/tmp/loggy", "Attached to SHM" );
+            newlog_t * pnewlog = (newlog_t *)newLogSharedMemory;
             if ( created ) {
                 LL_LOG( "/tmp/loggy", "Created, thus initialize" );
-                // Wipe memory
-                memset( newLogSharedMemory, 0, sizeof( newlog_t ) );
-                
-                // Newly created:  init structure
-                newlog_t * pnewlog = (newlog_t *)newLogSharedMemory;
-                    
-                pnewlog->index = 0;
-                
-                int i;
-                
-                for ( i=0; i<NEWLOG_MAX_LOGS; i++ ) {
-                    pnewlog->log[i].from    = 0;
-                    pnewlog->log[i].text[0] = '\0';
-                }
-                
-                DEBUG_PRINTF( "Initialized new SHM for DB\n" );
+                // Wipe memory: all records have seq 0, i.e. not written
+                memset( newLogSharedMemory, 0, size );
+                pnewlog->capacity = NEWLOG_MAX_LOGS;
+                __sync_synchronize();
+                pnewlog->magic    = NEWLOG_MAGIC;
+                DEBUG_PRINTF( "Initialized new SHM for Logs (%d records)\n", NEWLOG_MAX_LOGS );
+            }
+            if ( pnewlog->magic == NEWLOG_MAGIC && pnewlog->capacity > 0 ) {
+                ret = 1;
+            } else {
+                printf( "Error: SHM for Logs has an unknown layout\n" );
+                shmdt( newLogSharedMemory );
+                newLogSharedMemory = NULL;
             }
-            ret = 1;
         }
     } else {
         LL_LOG( "/tmp/loggy", "SHM error" );
@@ -165,6 +201,73 @@ static int newLogOpen( void ) {
     return( ret );
 }
 
+// -------------------------------------------------------------
+// Records
+// -------------------------------------------------------------
+
+/**
+ * \brief Takes the next ticket and marks its record as being written.
+ * Any number of writers can do this at the same time, no lock involved
+ */
+static newlogrec_t * newLogClaim( newlog_t * pnewlog, unsigned int * ticket ) {
+    *ticket = __sync_fetch_and_add( &pnewlog->ticket, 1 );
+    newlogrec_t * rec = &pnewlog->log[*ticket % (unsigned int)pnewlog->capacity];
+    rec->seq = 0;
+    __sync_synchronize();
+    return( rec );
+}
+
+/**
+ * \brief Makes a claimed record visible to the readers
+ */
+static void newLogPublish( newlog_t * pnewlog, newlogrec_t * rec, unsigned int ticket, int now ) {
+    __sync_synchronize();
+    rec->seq = ticket + 1;
+    pnewlog->lastupdate = now;
+}
+
+/**
+ * \brief Copies record <ticket> out of the ring
+ * \returns 1 on success, 0 when it is being written or already overwritten
+ */
+static int newLogRead( newlog_t * pnewlog, unsigned int ticket, newlogrec_t * rec ) {
+    newlogrec_t * src = &pnewlog->log[ticket % (unsigned int)pnewlog->capacity];
+    if ( src->seq != ticket + 1 ) return( 0 );
+    __sync_synchronize();
+    memcpy( rec, (void *)src, sizeof( newlogrec_t ) );
+    __sync_synchronize();
+    return( src->seq == ticket + 1 );
+}
+
+/**
+ * \brief Makes the text of a record, from the format of its code
+ */
+static void newLogFormat( newlogrec_t * rec, char * text ) {
+    int code = ( rec->code > 0 && rec->code < NEWLOG_NUM_CODES ) ? rec->code : NEWLOG_TEXT;
+    char * fmt = newLogFormats[code].fmt;
+    char * end = text + NEWLOG_MAX_TEXT;
+    char num[12];
+    int a = 0;
+
+    rec->str[NEWLOG_MAX_TEXT] = '\0';
+    while ( *fmt && text < end ) {
+        char * s = NULL;
+        if ( fmt[0] == '%' && fmt[1] == 's' ) {
+            s = rec->str;
+        } else if ( fmt[0] == '%' && fmt[1] == 'd' && a < NEWLOG_MAX_ARGS ) {
+            sprintf( num, "%d", rec->args[a++] );
+            s = num;
+        }
+        if ( s ) {
+            while ( *s && text < end ) *text++ = *s++;
+            fmt += 2;
+        } else {
+            *text++ = *fmt++;
+        }
+    }
+    *text = '\0';
+}
+
 // -------------------------------------------------------------
 // Add
 // -------------------------------------------------------------
@@ -181,25 +284,21 @@ int newLogAdd( newLogFrom from, char * text ) {
         int now = (int)time( NULL );      
         int len = strlen( text );
         
-        semP( NEWLOG_SEMKEY );
-        
         while ( len > 0 ) {
-            pnewlog->log[pnewlog->index].from = from;
-            pnewlog->log[pnewlog->index].ts = now;
+            unsigned int ticket;
+            newlogrec_t * rec = newLogClaim( pnewlog, &ticket );
+            rec->from = from;
+            rec->code = NEWLOG_TEXT;
+            rec->ts   = now;
             
-            strncpy( pnewlog->log[pnewlog->index].text, text, NEWLOG_MAX_TEXT );
-            pnewlog->log[pnewlog->index].text[NEWLOG_MAX_TEXT] = '\0';
+            strncpy( rec->str, text, NEWLOG_MAX_TEXT );
+            rec->str[NEWLOG_MAX_TEXT] = '\0';
+            newLogPublish( pnewlog, rec, ticket, now );
             
             text += NEWLOG_MAX_TEXT;
             len -= NEWLOG_MAX_TEXT;
-            
-            if ( ++pnewlog->index >= NEWLOG_MAX_LOGS ) pnewlog->index = 0;
-            pnewlog->cnt++;
         }            
         
-        pnewlog->lastupdate = now;
-        semV( NEWLOG_SEMKEY );
-        
         return 1;
     } else {
         printf( "Error adding log\n" );
@@ -207,6 +306,48 @@ int newLogAdd( newLogFrom from, char * text ) {
     return 0;
 }
 
+/**
+ * \brief Adds a binary log record: the text is only made when the log is read
+ * \param from Where the log comes from
+ * \param code What happened, see newLogFormats
+ * \param str String argument of the code (or NULL)
+ * \param ... Integer arguments of the code
+ * \returns 1 when ok, 0 on error
+ */
+int newLogAddCode( newLogFrom from, newLogCode code, char * str, ... ) {
+    if ( code <= NEWLOG_TEXT || code >= NEWLOG_NUM_CODES ) {
+        return( newLogAdd( from, ( str ) ? str : "" ) );
+    }
+    if ( newLogSharedMemory || newLogOpen() ) {
+        newlog_t * pnewlog = (newlog_t *)newLogSharedMemory;
+        int i, now = (int)time( NULL );
+        unsigned int ticket;
+        va_list ap;
+
+        newlogrec_t * rec = newLogClaim( pnewlog, &ticket );
+        rec->from = from;
+        rec->code = code;
+        rec->ts   = now;
+
+        va_start( ap, str );
+        for ( i=0; i<NEWLOG_MAX_ARGS; i++ ) {
+            rec->args[i] = ( i < newLogFormats[code].nargs ) ? va_arg( ap, int ) : 0;
+        }
+        va_end( ap );
+
+        if ( str ) {
+            strncpy( rec->str, str, NEWLOG_MAX_TEXT );
+            rec->str[NEWLOG_MAX_TEXT] = '\0';
+        } else {
+            rec->str[0] = '\0';
+        }
+        newLogPublish( pnewlog, rec, ticket, now );
+        return 1;
+    } else {
+        printf( "Error adding log\n" );
+    }
+    return 0;
+}
 
 /**
  * \brief Empty the Log module
@@ -215,12 +356,8 @@ int newLogAdd( newLogFrom from, char * text ) {
 int newLogEmpty( void ) {
     if ( newLogSharedMemory || newLogOpen() ) {
         newlog_t * pnewlog = (newlog_t *)newLogSharedMemory;
-        int now = (int)time( NULL );
-        semP( NEWLOG_SEMKEY );
-        pnewlog->cnt        = 0;
-        pnewlog->index      = 0;
-        pnewlog->lastupdate = now;
-        semV( NEWLOG_SEMKEY );
+        pnewlog->base       = pnewlog->ticket;
+        pnewlog->lastupdate = (int)time( NULL );
         return 1;
     }
     return 0;
@@ -234,9 +371,8 @@ int newLogGetIndex( void ) {
     int index = -1;
     if ( newLogSharedMemory || newLogOpen() ) {
         newlog_t * pnewlog = (newlog_t *)newLogSharedMemory;
-        semP( NEWLOG_SEMKEY );
-        if ( pnewlog->cnt > 0 ) index = pnewlog->index;
-        semV( NEWLOG_SEMKEY );
+        unsigned int ticket = pnewlog->ticket;
+        if ( ticket != pnewlog->base ) index = NEWLOG_INDEX( ticket );
     }
     return index;
 }
@@ -247,35 +383,41 @@ int newLogGetIndex( void ) {
 
 /**
  * \brief Loops the current Log module from <fromindex> to current index, or all when <fromindex> < 0. 
- * Note that the call-back may not alter the logs as it peeks right into the shared memory
+ * Records are formatted into a copy, so writers are never held up. Records
+ * that are being written while looping are skipped
  * \param cb Call-back function
  * \returns Last index on success, -1 on error
  */
 int newLogLoop( int from, int startIndex, newlogCb_t cb ) {
     if ( cb && ( newLogSharedMemory || newLogOpen() ) ) {
         newlog_t * pnewlog = (newlog_t *)newLogSharedMemory;
-        int i, cnt;
-        
-        semP( NEWLOG_SEMKEY );
+        unsigned int ticket = pnewlog->ticket;
+        unsigned int avail  = ticket - pnewlog->base;
+        unsigned int cnt, t;
+        newlogrec_t rec;
+        onelog_t l;
+        int ok = 1;
+
+        if ( avail > (unsigned int)pnewlog->capacity ) avail = pnewlog->capacity;
         if ( startIndex < 0 ) {
             // Loop all
-            cnt = pnewlog->cnt % NEWLOG_MAX_LOGS;
+            cnt = avail;
         } else {
             // Loop since
-            cnt = pnewlog->index - startIndex;
-            if ( cnt < 0 ) cnt += NEWLOG_MAX_LOGS;
+            cnt = ( ticket - (unsigned int)startIndex ) & NEWLOG_INDEX_MASK;
+            if ( cnt > avail ) cnt = avail;
         }
-        int ok = 1, start = pnewlog->index - cnt;
-        if ( start < 0 ) start += NEWLOG_MAX_LOGS;
-        for ( i=0; i<cnt && ok; i++ ) {
-            if ( from == NEWLOG_FROM_NONE || pnewlog->log[start].from == from ) {
-                ok = cb( start, &pnewlog->log[start] );
+        for ( t = ticket - cnt; t != ticket && ok; t++ ) {
+            if ( newLogRead( pnewlog, t, &rec ) &&
+                 ( from == NEWLOG_FROM_NONE || rec.from == from ) ) {
+                l.from = rec.from;
+                l.ts   = rec.ts;
+                newLogFormat( &rec, l.text );
+                ok = cb( NEWLOG_INDEX( t ), &l );
             }
-            if ( ++start >= NEWLOG_MAX_LOGS ) start = 0;
         }
-        semV( NEWLOG_SEMKEY );
     
-        return( start );
+        return( NEWLOG_INDEX( t ) );
     }
     return -1;
 }
@@ -26,6 +26,24 @@ typedef enum {
     NEWLOG_FROM_TEST,                // 10    See logNames in .c file and in logs.js
 } newLogFrom;
 
+// Binary log records: only the code and its arguments are stored when
+// logging, the text is made from newLogFormats[code] when the logs are read
+typedef enum {
+    NEWLOG_TEXT = 0,                 // Plain text, no formatting
+    NEWLOG_DB_MIGRATE,               // %s table, 4 ints
+    NEWLOG_DB_VERSION,               // 2 ints
+    NEWLOG_DB_SHM_VERSION,           // 2 ints
+    NEWLOG_ZCB_ANNOUNCE,             // %s device
+    NEWLOG_ZCB_UI_HEAT,              // %s mac, 1 int
+    NEWLOG_ZCB_UI_COOL,              // %s mac, 1 int
+    NEWLOG_ZCB_SENSORS,              // 3 ints
+    NEWLOG_ZCB_PLUG,                 // 2 ints
+    NEWLOG_NUM_CODES
+} newLogCode;
+
+#define NEWLOG_MAX_ARGS       4
+
+// What a looper call-back gets: the record formatted
 typedef struct onelog {
     int from;
     int ts;
@@ -39,6 +57,7 @@ extern char * logNames[11];
 extern char logbuffer[MAX_LOG_BUFFER];
 
 int newLogAdd( newLogFrom from, char * text );
+int newLogAddCode( newLogFrom from, newLogCode code, char * str, ... );
 int newLogEmpty( void );
 int newLogGetIndex( void );
 int newLogLoop( int from, int startIndex, newlogCb_t cb );
@@ -22,11 +22,20 @@
 #include <sys/msg.h>
 #include <sys/ipc.h>
 #include <sys/stat.h>
+#include <sys/shm.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
 
 #include "iotError.h"
+#include "iotStats.h"
 #include "newLog.h"
 #include "dump.h"
 #include "fileCreate.h"
+#include "tlv.h"
 #include "queue.h"
 
 #define QUEUE_DEBUG
@@ -47,11 +56,312 @@
 
 #define QUEUE_KEYS_OFFSET 3773   // Magic number
 
+// Transport: a ring buffer in shared memory per queue instead of a SysV message queue.
+// Messages are copied once on each side and, unless a side has to wait, no system call is made
+#define QUEUE_SHM_RING    1
+
 typedef struct msgbuf {
     long mtype;
     char mdata[MAXMESSAGESIZE];
 } msgbuf_t;
 
+#if QUEUE_SHM_RING
+
+// -------------------------------------------------------------
+// Shared memory ring
+// -------------------------------------------------------------
+// Each queue has one reader (the daemon that owns it) and one or more writers.
+// Records are a queue_record_t followed by the (not terminated) message, padded to
+// a multiple of 4. Positions are free running byte counters: the ring is empty
+// when head == tail. Writers serialize on <lock>; waiting sides sleep on a futex
+// on the message counter of the other side. A fresh segment is all zeroes,
+// which is an empty ring.
+
+#define QUEUE_RING_SIZE     ( 16 * 1024 )  // Same as the default SysV queue limit (msgmnb)
+#define QUEUE_RING_KEYS     8
+#define QUEUE_LOCK_SPINS    1000
+#define QUEUE_WRITE_WAIT    100            // Msec, bounds a missed wakeup of a waiting writer
+
+#define QUEUE_RECORD( len ) ( sizeof( queue_record_t ) + ( ( (len) + 3 ) & ~3 ) )
+
+typedef struct queue_record {
+    int len;
+    unsigned int stamp;              // iotStatsNow() of the writer, for IOT_STATS_QUEUE
+} queue_record_t;
+
+typedef struct queue_ring {
+    volatile unsigned int head;      // Write position
+    volatile unsigned int tail;      // Read position
+    volatile unsigned int written;   // Messages written, the reader waits on it
+    volatile unsigned int read;      // Messages read, writers wait on it when the ring is full
+    volatile int readerWaits;
+    volatile int writerWaits;
+    volatile int lock;               // PID of the writer in the ring, 0 when free
+    volatile int formats;            // QUEUE_FORMAT_* the reader accepts
+    volatile int watermark;          // Messages at which the reader is congested, 0 is never
+    char data[QUEUE_RING_SIZE];
+} queue_ring_t;
+
+// Attached rings. Handles are the queue keys, rings stay attached until exit
+static queue_ring_t * queueRings[QUEUE_RING_KEYS];
+
+static int queueFutexWait( volatile unsigned int * addr, unsigned int val, int msec ) {
+    struct timespec ts, * pts = NULL;
+    if ( msec >= 0 ) {
+        ts.tv_sec  = msec / 1000;
+        ts.tv_nsec = ( msec % 1000 ) * 1000000;
+        pts = &ts;
+    }
+    return syscall( SYS_futex, addr, FUTEX_WAIT, val, pts, NULL, 0 );
+}
+
+static void queueFutexWake( volatile unsigned int * addr ) {
+    syscall( SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+}
+
+static int queueMsecSince( struct timeval * start ) {
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    return( ( now.tv_sec - start->tv_sec ) * 1000 + ( now.tv_usec - start->tv_usec ) / 1000 );
+}
+
+/**
+ * \brief Take the writer lock of a ring. A lock held by a process that no longer
+ * exists (e.g. killed halfway a write) is released
+ * \param ring Ring
+ */
+static void queueRingLock( queue_ring_t * ring ) {
+    int spins = 0, pid = getpid();
+    while ( !__sync_bool_compare_and_swap( &ring->lock, 0, pid ) ) {
+        if ( ++spins < QUEUE_LOCK_SPINS ) {
+            sched_yield();
+        } else {
+            int owner = ring->lock;
+            if ( owner && kill( owner, 0 ) < 0 && errno == ESRCH ) {
+                printf( "Queue writer %d did not finish: unlock\n", owner );
+                __sync_bool_compare_and_swap( &ring->lock, owner, 0 );
+            }
+            spins = 0;
+        }
+    }
+    __sync_synchronize();
+}
+
+static void queueRingUnlock( queue_ring_t * ring ) {
+    __sync_synchronize();
+    ring->lock = 0;
+}
+
+/**
+ * \brief Copy from/to the ring, wrapping at its end
+ * \param ring Ring
+ * \param pos Position in the ring
+ * \param buf Message buffer
+ * \param len Number of bytes
+ * \param towrite 1 copies <buf> into the ring, 0 copies the ring into <buf>
+ */
+static void queueRingCopy( queue_ring_t * ring, unsigned int pos, char * buf, int len, int towrite ) {
+    int offset = pos % QUEUE_RING_SIZE;
+    int first  = ( len < QUEUE_RING_SIZE - offset ) ? len : QUEUE_RING_SIZE - offset;
+    if ( towrite ) {
+        memcpy( &ring->data[offset], buf, first );
+        memcpy( ring->data, buf + first, len - first );
+    } else {
+        memcpy( buf, &ring->data[offset], first );
+        memcpy( buf + first, ring->data, len - first );
+    }
+}
+
+/**
+ * \brief Attach the ring of a queue, create it when it does not exist yet
+ * \param key Unique ID of the queue
+ * \returns A handle to the queue, or -1 in case of an error (and sets the global iotError)
+ */
+static int queueRingOpen( queueKey key ) {
+    int shmid;
+    if ( key <= QUEUE_KEY_NONE || key >= QUEUE_RING_KEYS ) {
+        iotError = IOT_ERROR_QUEUE_OPEN;
+        return( -1 );
+    }
+    if ( queueRings[key] ) return( key );
+
+    key_t kt = key + QUEUE_KEYS_OFFSET;
+    if ( ( shmid = shmget( kt, sizeof( queue_ring_t ), 0666 ) ) < 0 ) {
+        if ( errno == ENOENT ) {
+            DEBUG_PRINTF( "Queue does not exist yet, create it\n" );
+            if ( ( shmid = shmget( kt, sizeof( queue_ring_t ), 0666 | IPC_CREAT ) ) < 0 ) {
+                printf( "Error creating queue %d (%d - %s)\n", key, errno, strerror( errno ) );
+                iotError = IOT_ERROR_QUEUE_CREATE;
+                return( -1 );
+            }
+        } else {
+            printf( "Error opening queue %d (%d - %s)\n", key, errno, strerror( errno ) );
+            iotError = IOT_ERROR_QUEUE_OPEN;
+            return( -1 );
+        }
+    }
+
+    void * shm = shmat( shmid, NULL, 0 );
+    if ( shm == (void *)-1 ) {
+        printf( "Error attaching queue %d (%d - %s)\n", key, errno, strerror( errno ) );
+        iotError = IOT_ERROR_QUEUE_OPEN;
+        return( -1 );
+    }
+    queueRings[key] = (queue_ring_t *)shm;
+    DEBUG_DETAIL( "Queue %d attached\n", key );
+    return( key );
+}
+
+static queue_ring_t * queueRingGet( int queue ) {
+    return( ( queue > QUEUE_KEY_NONE && queue < QUEUE_RING_KEYS ) ? queueRings[queue] : NULL );
+}
+
+/**
+ * \brief Write messages into a ring, taking the writer lock once and waking the
+ * reader once. Waits while the ring is full (after waking the reader for the
+ * messages already written)
+ * \param queue Handle to the queue
+ * \param messages Messages
+ * \param lens Message lengths
+ * \param num Number of messages
+ * \returns 1 on success, or 0 on error (and sets the global iotError)
+ */
+static int queueRingWriteV( int queue, char * messages[], int lens[], int num ) {
+    queue_ring_t * ring = queueRingGet( queue );
+    queue_record_t rec;
+    int i, wake, pending = 0;
+    if ( ring == NULL ) {
+        iotError = IOT_ERROR_QUEUE_WRITE;
+        return( 0 );
+    }
+
+    // Stamped on entry: time spent waiting for a full ring counts as queueing
+    rec.stamp = iotStatsNow();
+
+    queueRingLock( ring );
+    for ( i=0; i<num; i++ ) {
+        unsigned int need = QUEUE_RECORD( lens[i] );
+        while ( QUEUE_RING_SIZE - ( ring->head - ring->tail ) < need ) {
+            unsigned int read = ring->read;
+            ring->writerWaits = 1;
+            __sync_synchronize();
+            wake = pending && ring->readerWaits;
+            queueRingUnlock( ring );
+            if ( wake ) queueFutexWake( &ring->written );
+            pending = 0;
+            if ( QUEUE_RING_SIZE - ( ring->head - ring->tail ) < need ) {
+                queueFutexWait( &ring->read, read, QUEUE_WRITE_WAIT );
+            }
+            queueRingLock( ring );
+        }
+
+        unsigned int head = ring->head;
+        rec.len = lens[i];
+        queueRingCopy( ring, head, (char *)&rec, sizeof( rec ), 1 );
+        queueRingCopy( ring, head + sizeof( rec ), messages[i], lens[i], 1 );
+        __sync_synchronize();
+        ring->head = head + need;
+        ring->written++;
+        pending++;
+    }
+    __sync_synchronize();
+    wake = pending && ring->readerWaits;
+    queueRingUnlock( ring );
+
+    if ( wake ) queueFutexWake( &ring->written );
+    return( 1 );
+}
+
+static int queueRingWrite( int queue, char * message, int len ) {
+    return queueRingWriteV( queue, &message, &len, 1 );
+}
+
+/**
+ * \brief Read the messages that are in a ring, at most <max>, with one wait.
+ * Messages are stored back to back in <buf>, each terminated. The first message
+ * is truncated when it does not fit, later ones that do not fit stay in the ring
+ * \param queue Handle to the queue
+ * \param buf User provided string buffer to receive the queue messages
+ * \param size Size of the user provided string buffer
+ * \param lens Receives the length of each message
+ * \param max Maximum number of messages
+ * \param msec Wait at most <msec> milli-seconds for a message, -1 waits forever
+ * \returns The number of received messages, or -1 on timeout or error
+ */
+static int queueRingReadV( int queue, char * buf, int size, int lens[], int max, int msec ) {
+    queue_ring_t * ring = queueRingGet( queue );
+    queue_record_t rec;
+    struct timeval start;
+    unsigned int now;
+    int len, num = 0, pos = 0;
+    if ( ring == NULL ) {
+        errno = EINVAL;
+        return( -1 );
+    }
+
+    gettimeofday( &start, NULL );
+    while ( ring->head == ring->tail ) {
+        int left = -1;
+        if ( msec >= 0 && ( left = msec - queueMsecSince( &start ) ) <= 0 ) {
+            errno = ENOMSG;
+            return( -1 );
+        }
+        unsigned int written = ring->written;
+        ring->readerWaits = 1;
+        __sync_synchronize();
+        if ( ring->head == ring->tail ) {
+            queueFutexWait( &ring->written, written, left );
+        }
+        ring->readerWaits = 0;
+    }
+    __sync_synchronize();
+
+    unsigned int head = ring->head;
+    unsigned int tail = ring->tail;
+    now = iotStatsNow();
+    while ( num < max && tail != head ) {
+        queueRingCopy( ring, tail, (char *)&rec, sizeof( rec ), 0 );
+        len = rec.len;
+        if ( len < 0 || QUEUE_RECORD( len ) > head - tail ) {
+            printf( "Queue %d corrupt: flush\n", queue );
+            tail = head;
+            break;
+        }
+        int copy = len;
+        if ( pos + len >= size ) {
+            if ( num > 0 ) break;
+            copy = size - 1;
+        }
+        queueRingCopy( ring, tail + sizeof( rec ), buf + pos, copy, 0 );
+        buf[pos + copy] = '\0';
+        iotStatsAdd( IOT_STATS_QUEUE, now - rec.stamp );
+        lens[num++] = copy;
+        pos += copy + 1;
+        tail += QUEUE_RECORD( len );
+    }
+    __sync_synchronize();
+    ring->tail = tail;
+    ring->read += num;
+    __sync_synchronize();
+
+    if ( ring->writerWaits ) {
+        ring->writerWaits = 0;
+        queueFutexWake( &ring->read );
+    }
+    if ( num == 0 ) {
+        errno = EIO;
+        return( -1 );
+    }
+    return( num );
+}
+
+static int queueRingRead( int queue, char * message, int size, int msec ) {
+    int len;
+    return ( queueRingReadV( queue, message, size, &len, 1, msec ) > 0 ) ? len : -1;
+}
+
+#endif // QUEUE_SHM_RING
+
 // -------------------------------------------------------------
 // Open
 // -------------------------------------------------------------
@@ -64,6 +374,10 @@ typedef struct msgbuf {
  */
 int queueOpen( queueKey key, int forwrite ) {//-ʹϢ,طԼһݽṹ,ʹõϵͳ
 
+#if QUEUE_SHM_RING
+    DEBUG_DETAIL( "Opening queue %d (%d) ...\n", key, forwrite );
+    return queueRingOpen( key );
+#else
     int mq = -1;
     DEBUG_DETAIL( "Opening queue %d and configure (%d) ...\n", key, forwrite );
 
@@ -90,6 +404,7 @@ int queueOpen( queueKey key, int forwrite ) {//-ʹ
         DEBUG_DETAIL( "Queue %d opened\n", mq );
     }
     return( mq );
+#endif
 }
 
 // -------------------------------------------------------------
@@ -104,6 +419,29 @@ int queueOpen( queueKey key, int forwrite ) {//-ʹ
  */
 int queueWrite( int queue, char * message ) {
 
+#if QUEUE_SHM_RING
+    int len = strlen( message );
+
+    DEBUG_PRINTF( "QW (%d): %s", len, message );
+
+    if ( len > ( MAXMESSAGESIZE - 2 ) ) {
+        iotError = IOT_ERROR_QUEUE_BUFSIZE;
+        return( 0 );
+    }
+
+#ifdef QUEUE_DEBUG_DUMP
+    dump( message, len );
+#endif
+
+    // Send the TLV twin of a constructed JSON message when the reader accepts it
+    queue_ring_t * ring = queueRingGet( queue );
+    char * tlv;
+    int tlvlen;
+    if ( ring && ( ring->formats & QUEUE_FORMAT_TLV ) && ( tlvlen = tlvGet( message, &tlv ) ) > 0 ) {
+        return queueRingWrite( queue, tlv, tlvlen );
+    }
+    return queueRingWrite( queue, message, len );
+#else
     msgbuf_t SEND_BUFFER;
 
     // int len = strlen( message ) + 1;     // Inclusive '\0'
@@ -130,6 +468,7 @@ int queueWrite( int queue, char * message ) {
         return( 0 );
     }
     return( 1 );
+#endif
 }
 
 // -------------------------------------------------------------
@@ -145,6 +484,15 @@ int queueWrite( int queue, char * message ) {
  */
 int queueRead( int queue, char * message, int size ) {//-ܼ򵥵һ,ֱӵĿ⺯,˼򵥵Ĵʾת,û߼
 
+#if QUEUE_SHM_RING
+    int len = queueRingRead( queue, message, size, -1 );
+    if ( len < 0 ) {
+        printf( "Error reading from queue (%d - %s)\n",
+             errno, strerror( errno ) );
+        iotError = IOT_ERROR_QUEUE_READ;
+        message[0] = '\0';
+    }
+#else
     msgbuf_t RECEIVE_BUFFER;
 
     memset( message, 0, size );
@@ -160,6 +508,7 @@ int queueRead( int queue, char * message, int size ) {//-
         RECEIVE_BUFFER.mdata[len] = '\0';
         strcpy( message, RECEIVE_BUFFER.mdata );
     }
+#endif
 
     DEBUG_PRINTF( "QR (%d): %s", len, message );
 
@@ -185,10 +534,18 @@ int queueRead( int queue, char * message, int size ) {//-
  */
 int queueReadWithMsecTimeout( int queue, char * message, int size, int msec ) {//-һʱȴĹ
 
-    msgbuf_t RECEIVE_BUFFER;
-
     DEBUG_DETAIL( "QRt %d - %d msec...\n", queue, msec );
 
+#if QUEUE_SHM_RING
+    int len = -1, cnt = 0;
+    if ( msec > 0 ) {
+        len = queueRingRead( queue, message, size, msec );
+    } else {
+        errno = ENOMSG;
+    }
+#else
+    msgbuf_t RECEIVE_BUFFER;
+
     int len = 0, cnt = 0;
     while ( len <= 0 && msec > 0 ) {
         len = msgrcv( queue, &RECEIVE_BUFFER, MAXMESSAGESIZE, 1,
@@ -214,6 +571,7 @@ int queueReadWithMsecTimeout( int queue, char * message, int size, int msec ) {/
             message[len] = '\0';
 	}
     }
+#endif
         
     if ( len < 0 ) {
         if ( errno != ENOMSG ) {
@@ -230,6 +588,121 @@ int queueReadWithMsecTimeout( int queue, char * message, int size, int msec ) {/
     return( len );
 }
 
+// -------------------------------------------------------------
+// Batches
+// - Move several messages per call, with one wakeup of the other side
+// -------------------------------------------------------------
+
+/**
+ * \brief Write messages into a queue in one go. The reader is woken once instead of per message
+ * \param queue Handle to the queue
+ * \param messages Message strings to write
+ * \param num Number of messages
+ * \returns 1 on success, or 0 on error (and sets the global iotError). Nothing is written
+ * when one of the messages is too long
+ */
+int queueWriteBatch( int queue, char * messages[], int num ) {
+    int i;
+
+    for ( i=0; i<num; i++ ) {
+        if ( strlen( messages[i] ) > ( MAXMESSAGESIZE - 2 ) ) {
+            iotError = IOT_ERROR_QUEUE_BUFSIZE;
+            return( 0 );
+        }
+    }
+
+#if QUEUE_SHM_RING
+    queue_ring_t * ring = queueRingGet( queue );
+    char * texts[QUEUE_BATCH_MAX];
+    int lens[QUEUE_BATCH_MAX];
+    int n = 0;
+
+    for ( i=0; i<num; i++ ) {
+        DEBUG_PRINTF( "QWb (%d/%d): %s", i + 1, num, messages[i] );
+
+        // TLV twin, as in queueWrite()
+        if ( !( ring && ( ring->formats & QUEUE_FORMAT_TLV ) &&
+                ( lens[n] = tlvGet( messages[i], &texts[n] ) ) > 0 ) ) {
+            texts[n] = messages[i];
+            lens[n]  = strlen( messages[i] );
+        }
+        if ( ++n == QUEUE_BATCH_MAX || i == num - 1 ) {
+            if ( !queueRingWriteV( queue, texts, lens, n ) ) return( 0 );
+            n = 0;
+        }
+    }
+    return( 1 );
+#else
+    for ( i=0; i<num; i++ ) {
+        if ( !queueWrite( queue, messages[i] ) ) return( 0 );
+    }
+    return( 1 );
+#endif
+}
+
+/**
+ * \brief Reads the messages that are in a queue, at most <max>, waiting once.
+ * Messages are stored back to back in <buf>, each terminated: the next one starts
+ * at lens[i] + 1. A first message that does not fit is truncated, later ones stay in the queue
+ * \param queue Handle to the queue
+ * \param buf User provided string buffer to receive the queue messages
+ * \param size Size of the user provided string buffer
+ * \param lens Receives the length of each message
+ * \param max Maximum number of messages (size of <lens>)
+ * \param msec Wait at most <msec> milli-seconds for the first message, 0 does not wait and -1 waits forever
+ * \returns The number of received messages, 0 on timeout
+ */
+int queueReadBatch( int queue, char * buf, int size, int lens[], int max, int msec ) {
+
+    DEBUG_DETAIL( "QRb %d - %d msec...\n", queue, msec );
+
+#if QUEUE_SHM_RING
+    int num = queueRingReadV( queue, buf, size, lens, max, msec );
+    if ( num < 0 ) {
+        if ( errno != ENOMSG ) {
+            DEBUG_PRINTF( "ERROR reading from queue (%d - %s)\n",
+             errno, strerror( errno ) );
+        }
+        num = 0;
+    }
+#else
+    msgbuf_t RECEIVE_BUFFER;
+    int num = 0, pos = 0;
+
+    // msgrcv() cannot peek the length: only receive when any message fits
+    while ( num < max && ( num == 0 || size - pos >= MAXMESSAGESIZE ) ) {
+        int flags = ( num == 0 && msec < 0 ) ? MSG_NOERROR : MSG_NOERROR | IPC_NOWAIT;
+        int len = msgrcv( queue, &RECEIVE_BUFFER, MAXMESSAGESIZE, 1, flags );
+        if ( len < 0 ) {
+            if ( num == 0 && errno == ENOMSG && msec > 0 ) {
+                msec -= QREAD_POLL;
+                if ( msec > 0 ) {
+                    usleep( QREAD_POLL * 1000 );
+                    continue;
+                }
+            }
+            break;
+        }
+        if ( pos + len >= size ) {
+            len = size - 1 - pos;
+        }
+        memcpy( buf + pos, RECEIVE_BUFFER.mdata, len );
+        buf[pos + len] = '\0';
+        lens[num++] = len;
+        pos += len + 1;
+    }
+#endif
+
+#ifdef QUEUE_DEBUG
+    int i, at = 0;
+    for ( i=0; i<num; i++ ) {
+        DEBUG_PRINTF( "QRb (%d/%d, %d): %s", i + 1, num, lens[i], buf + at );
+        at += lens[i] + 1;
+    }
+#endif
+    return( num );
+}
+
 // -------------------------------------------------------------
 // Write one message
 // - Opens a queue, writes the message and closes queue again
@@ -267,6 +740,14 @@ int queueWriteOneMessage( queueKey key, char * message ) {//-
  */
 int queueGetNumMessages( int queue ) {
     int num = -1;
+#if QUEUE_SHM_RING
+    queue_ring_t * ring = queueRingGet( queue );
+    if ( ring ) {
+        num = ring->written - ring->read;
+    } else {
+        printf( "Error checking queue %d\n", queue );
+    }
+#else
     struct msqid_ds buf;
     if ( msgctl( queue, IPC_STAT, &buf ) != -1 ) {//-ƶϢеĲ:ȡϢеݽṹmsqid_ds洢b u fָĵַС
         num = buf.msg_qnum;	//-Current number of messagesin queue
@@ -274,9 +755,64 @@ int queueGetNumMessages( int queue ) {
         printf( "Error checking queue %d (%d - %s)\n",
                   queue, errno, strerror( errno ) );
     }
+#endif
     return( num );
 }
 
+// -------------------------------------------------------------
+// Formats
+// -------------------------------------------------------------
+
+/**
+ * \brief Tell the writers which message formats the reader of a queue accepts besides JSON.
+ * Readers that accept QUEUE_FORMAT_TLV must parse with jsonEatMessage()
+ * \param queue Handle to the queue
+ * \param formats QUEUE_FORMAT_* bits
+ */
+void queueSetFormats( int queue, int formats ) {
+#if QUEUE_SHM_RING
+    queue_ring_t * ring = queueRingGet( queue );
+    if ( ring ) ring->formats = formats;
+#else
+    // Message queues carry text only
+#endif
+}
+
+// -------------------------------------------------------------
+// Watermark
+// -------------------------------------------------------------
+
+/**
+ * \brief Set the number of pending messages at which the reader of a queue is congested,
+ * see queueIsCongested()
+ * \param queue Handle to the queue
+ * \param num Number of messages, 0 is never congested
+ */
+void queueSetWatermark( int queue, int num ) {
+#if QUEUE_SHM_RING
+    queue_ring_t * ring = queueRingGet( queue );
+    if ( ring ) ring->watermark = num;
+#else
+    // Message queues have no room for it: never congested
+#endif
+}
+
+/**
+ * \brief Checks if the reader of a queue lags behind its watermark. Producers of
+ * messages that may be skipped can back off instead of filling the queue
+ * \param queue Handle to the queue
+ * \returns 1 when at or above the watermark, 0 otherwise
+ */
+int queueIsCongested( int queue ) {
+#if QUEUE_SHM_RING
+    queue_ring_t * ring = queueRingGet( queue );
+    return( ring && ring->watermark > 0 &&
+            (int)( ring->written - ring->read ) >= ring->watermark );
+#else
+    return( 0 );
+#endif
+}
+
 // -------------------------------------------------------------
 // Close
 // -------------------------------------------------------------
@@ -287,5 +823,6 @@ int queueGetNumMessages( int queue ) {
  */
 void queueClose( int queue ) {
     DEBUG_DETAIL( "Close Queue %d\n", queue );
-    // Normal (non-POSIX) Linux message queues do not need closing
+    // Normal (non-POSIX) Linux message queues do not need closing.
+    // Rings stay attached: queueWriteOneMessage() re-opens them for each message
 }
@@ -8,6 +8,12 @@
 #define MAXQUEUESIZE     10
 #define MAXMESSAGESIZE   300
 
+// Maximum number of messages per (ring) transfer of queueWriteBatch()
+#define QUEUE_BATCH_MAX  16
+
+// Message formats a reader accepts besides JSON, see queueSetFormats()
+#define QUEUE_FORMAT_TLV 1
+
 typedef enum {
     QUEUE_KEY_NONE = 0,
     QUEUE_KEY_CONTROL_INTERFACE,   // 1
@@ -20,8 +26,13 @@ int  queueOpen( queueKey key, int forwrite );
 int  queueWrite( int queue, char * message );
 int  queueRead( int queue, char * message, int size );
 int  queueReadWithMsecTimeout( int queue, char * message, int size, int msec );
+int  queueWriteBatch( int queue, char * messages[], int num );
+int  queueReadBatch( int queue, char * buf, int size, int lens[], int max, int msec );
 
 int  queueWriteOneMessage( queueKey key, char * message );
 int  queueGetNumMessages( int queue );
+void queueSetFormats( int queue, int formats );
+void queueSetWatermark( int queue, int num );
+int  queueIsCongested( int queue );
 
 void queueClose( int queue );
@@ -0,0 +1,215 @@
+// ------------------------------------------------------------------
+// TLV messages
+// ------------------------------------------------------------------
+// Binary twin of the JSON messages that the daemons send to each
+// other over the queues. Saves the receiver the character-by-character
+// JSON parsing: see jsonEatMessage()
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2014. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \brief TLV messages: binary twin of the JSON messages between the daemons
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tlv.h"
+
+// -------------------------------------------------------------
+// Globals
+// -------------------------------------------------------------
+
+// Twin of the last constructed JSON message, see jsonCreate.c
+static char tlvMessage[TLV_MAXMESSAGE];
+static int  tlvLen     = 0;      // 0 = no (valid) twin
+static char * tlvText  = NULL;   // JSON message that the twin belongs to
+static int  tlvTextLen = 0;
+
+// -------------------------------------------------------------
+// Encoding
+// -------------------------------------------------------------
+
+static void tlvAdd( int type, char * name, void * value, int len ) {
+    int nlen = strlen( name ) + 1;
+    if ( tlvLen > 0 && ( tlvLen + 1 + nlen + len ) <= TLV_MAXMESSAGE ) {
+        tlvMessage[tlvLen++] = type;
+        memcpy( &tlvMessage[tlvLen], name, nlen );
+        tlvLen += nlen;
+        if ( len > 0 ) memcpy( &tlvMessage[tlvLen], value, len );
+        tlvLen += len;
+    } else {
+        tlvLen = 0;
+    }
+}
+
+/**
+ * \brief Start a new twin
+ */
+void tlvStart( void ) {
+    tlvMessage[0] = TLV_MAGIC;
+    tlvLen  = 1;
+    tlvText = NULL;
+}
+
+/**
+ * \brief Start an object
+ * \param name Object name
+ */
+void tlvObject( char * name ) {
+    tlvAdd( TLV_OBJECT, name, NULL, 0 );
+}
+
+/**
+ * \brief Complete the current object
+ */
+void tlvObjectEnd( void ) {
+    tlvAdd( TLV_END, "", NULL, 0 );
+}
+
+/**
+ * \brief Add an integer name/value pair
+ * \param name Name
+ * \param value Value
+ */
+void tlvInteger( char * name, int value ) {
+    tlvAdd( TLV_INTEGER, name, &value, sizeof( int ) );
+}
+
+/**
+ * \brief Add a string name/value pair
+ * \param name Name
+ * \param value Value
+ */
+void tlvString( char * name, char * value ) {
+    tlvAdd( TLV_STRING, name, value, strlen( value ) + 1 );
+}
+
+/**
+ * \brief The JSON message got something that has no TLV equivalent: no twin
+ */
+void tlvInvalidate( void ) {
+    tlvLen = 0;
+}
+
+/**
+ * \brief The twin is complete: bind it to its JSON message
+ * \param text JSON message
+ */
+void tlvBind( char * text ) {
+    tlvText    = text;
+    tlvTextLen = strlen( text );
+}
+
+/**
+ * \brief Get the twin of a JSON message
+ * \param text JSON message
+ * \param ptlv Returns the twin
+ * \returns Length of the twin, 0 when <text> has none
+ */
+int tlvGet( char * text, char ** ptlv ) {
+    if ( tlvLen > 0 && text == tlvText && (int)strlen( text ) == tlvTextLen ) {
+        *ptlv = tlvMessage;
+        return( tlvLen );
+    }
+    return( 0 );
+}
+
+// -------------------------------------------------------------
+// Decoding
+// -------------------------------------------------------------
+
+/**
+ * \brief Check if a received message is TLV
+ * \param message Message
+ * \param len Message length
+ * \returns 1 when TLV, 0 when JSON
+ */
+int tlvIsMessage( char * message, int len ) {
+    return( len > 0 && message[0] == TLV_MAGIC );
+}
+
+/**
+ * \brief Get the next field of a TLV message. <name> and <str> point into the message
+ * \param message Message
+ * \param len Message length
+ * \param ppos Position in the message, start with 0
+ * \param pfield Returns the field
+ * \returns 1 when a field is returned, 0 at the end of the message or on a malformed message
+ */
+int tlvNext( char * message, int len, int * ppos, tlv_field_t * pfield ) {
+    int pos = ( *ppos > 0 ) ? *ppos : 1;
+    if ( pos >= len ) return( 0 );
+
+    pfield->type = message[pos++];
+    pfield->name = &message[pos];
+    pfield->str  = NULL;
+    pfield->num  = 0;
+    char * end = memchr( &message[pos], '\0', len - pos );
+    if ( end == NULL ) return( 0 );
+    pos = (int)( end - message ) + 1;
+
+    switch ( pfield->type ) {
+    case TLV_OBJECT:
+    case TLV_END:
+        break;
+    case TLV_INTEGER:
+        if ( pos + (int)sizeof( int ) > len ) return( 0 );
+        memcpy( &pfield->num, &message[pos], sizeof( int ) );
+        pos += sizeof( int );
+        break;
+    case TLV_STRING:
+        pfield->str = &message[pos];
+        if ( ( end = memchr( &message[pos], '\0', len - pos ) ) == NULL ) return( 0 );
+        pos = (int)( end - message ) + 1;
+        break;
+    default:
+        printf( "TLV: unknown field type %d\n", pfield->type );
+        return( 0 );
+    }
+    *ppos = pos;
+    return( 1 );
+}
+
+/**
+ * \brief Render a TLV message as JSON text, e.g. for logging
+ * \param message Message
+ * \param len Message length
+ * \param text User allocated area to store the text
+ * \param size Size of <text>
+ * \returns The text pointer
+ */
+char * tlvToText( char * message, int len, char * text, int size ) {
+    tlv_field_t field;
+    int pos = 0, tlen = 0, comma = 0;
+    char buf[TLV_MAXMESSAGE];
+
+    text[0] = '\0';
+    while ( tlvNext( message, len, &pos, &field ) ) {
+        switch ( field.type ) {
+        case TLV_OBJECT:
+            snprintf( buf, sizeof( buf ), "%s\"%s\" : { ", comma ? ", " : "", field.name );
+            comma = 0;
+            break;
+        case TLV_END:
+            snprintf( buf, sizeof( buf ), " }" );
+            comma = 1;
+            break;
+        case TLV_INTEGER:
+            snprintf( buf, sizeof( buf ), "%s\"%s\":%d", comma ? ", " : "", field.name, field.num );
+            comma = 1;
+            break;
+        case TLV_STRING:
+            snprintf( buf, sizeof( buf ), "%s\"%s\":\"%s\"", comma ? ", " : "", field.name, field.str );
+            comma = 1;
+            break;
+        }
+        int blen = strlen( buf );
+        if ( tlen + blen >= size ) break;
+        strcpy( &text[tlen], buf );
+        tlen += blen;
+    }
+    return( text );
+}
@@ -0,0 +1,57 @@
+// ------------------------------------------------------------------
+// TLV message format - include file
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2014. All rights reserved
+// ------------------------------------------------------------------
+//
+// Compact binary twin of the flat JSON messages between the daemons:
+//
+//    <message>    TLV_MAGIC + <field>*
+//    <field>      <type> + <name> + '\0' + <value>
+//    <value>      TLV_OBJECT:  none, starts object <name>
+//                 TLV_END:     none (empty name), completes the object
+//                 TLV_INTEGER: 4 bytes, host byte order
+//                 TLV_STRING:  characters + '\0'
+//
+// Example: "lmp" : { "mac" : "00158D0000000001", "lvl" : 50 }
+//    becomes: 01 'O' lmp\0 'S' mac\0 00158D0000000001\0 'I' lvl\0 <50> 'E' \0
+//
+// ------------------------------------------------------------------
+
+#define TLV_MAGIC        0x01    // Never the first character of a JSON message
+
+#define TLV_OBJECT       'O'
+#define TLV_END          'E'
+#define TLV_INTEGER      'I'
+#define TLV_STRING       'S'
+
+#define TLV_MAXMESSAGE   500
+
+typedef struct tlv_field {
+    int type;
+    char * name;
+    char * str;
+    int num;
+} tlv_field_t;
+
+// ------------------------------------------------------------------
+// Encoding (filled by the JSON message constructors)
+// ------------------------------------------------------------------
+
+void tlvStart( void );
+void tlvObject( char * name );
+void tlvObjectEnd( void );
+void tlvInteger( char * name, int value );
+void tlvString( char * name, char * value );
+void tlvInvalidate( void );
+void tlvBind( char * text );
+int  tlvGet( char * text, char ** ptlv );
+
+// ------------------------------------------------------------------
+// Decoding
+// ------------------------------------------------------------------
+
+int  tlvIsMessage( char * message, int len );
+int  tlvNext( char * message, int len, int * ppos, tlv_field_t * pfield );
+char * tlvToText( char * message, int len, char * text, int size );
@@ -0,0 +1,243 @@
+// ------------------------------------------------------------------
+// Performance Tester
+// ------------------------------------------------------------------
+// Microbenchmarks of the IoT database lookups and the serial link
+// framing towards the Control Bridge
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2015. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \section perftest Performance Testing
+ * \brief Times newDbGetDevice() lookups and the eSL_WriteMessage() framing.
+ * Prints one "<name>\t<value>\t<unit>" line per result, as expected by
+ * scripts/perf-tests.sh of the build system.
+ *
+ * Without -s only an existing database (of a running gateway) is used, read-only.
+ * With -s (scratch) a database is created and filled when there is none, and
+ * removed again afterwards.
+ */
+
+// The serial link is built in, with the serial port replaced by the stubs below
+#include "SerialLink.c"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "newDb.h"
+
+#define PERF_MIN_NS     ( 500 * 1000 * 1000LL )
+#define PERF_SHMKEY     86156       // NEWDB_SHMKEY of newDb.c
+#define PERF_MAX_MACS   256
+
+int verbosity = 0;
+
+static uint32_t perfSerialBytes;
+
+// -------------------------------------------------------------
+// Serial port stubs
+// -------------------------------------------------------------
+
+teSerial_Status eSerial_Init( char * name, uint32_t baud, int * piserial_fd ) {
+    return( E_SERIAL_ERROR );
+}
+
+teSerial_Status eSerial_ReadBuffer( unsigned char * data, uint32_t * count ) {
+    *count = 0;
+    return( E_SERIAL_NODATA );
+}
+
+teSerial_Status eSerial_WriteBuffer( unsigned char * data, uint32_t count ) {
+    perfSerialBytes += count;
+    return( E_SERIAL_OK );
+}
+
+// -------------------------------------------------------------
+// Helpers
+// -------------------------------------------------------------
+
+static int64_t perfNow( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( ts.tv_sec * 1000000000LL + ts.tv_nsec );
+}
+
+static void perfReport( char * name, int64_t ns, long ops ) {
+    printf( "%s\t%.1f\tns/op\n", name, (double)ns / ops );
+}
+
+// -------------------------------------------------------------
+// Database
+// -------------------------------------------------------------
+
+static char perfMacs[PERF_MAX_MACS][LEN_MAC_NIBBLE+2];
+
+/**
+ * \brief Fills the device table with made-up devices, with the (chatty)
+ * database output kept away from the results on stdout
+ * \returns Number of devices added
+ */
+static int perfDbPopulate( void ) {
+    newdb_dev_t device;
+    int i, num = 0, out;
+    int cap = newDbGetCapacity( NEWDB_TABLE_DEVICES );
+
+    fflush( stdout );
+    out = dup( 1 );
+    int null = open( "/dev/null", O_WRONLY );
+    if ( null >= 0 ) {
+        dup2( null, 1 );
+        close( null );
+    }
+
+    for ( i = 0; i < cap && num < PERF_MAX_MACS; i++ ) {
+        sprintf( perfMacs[num], "00158D00%08X", 0x00A10000 + i );
+        if ( newDbGetNewDevice( perfMacs[num], &device ) ) num++;
+    }
+
+    fflush( stdout );
+    if ( out >= 0 ) {
+        dup2( out, 1 );
+        close( out );
+    }
+    return( num );
+}
+
+/**
+ * \brief Collects the macs of the devices already in the database
+ * \returns Number of devices found
+ */
+static int perfDbCollect( void ) {
+    newdb_dev_t device;
+    int i, num = 0;
+    int cap = newDbGetCapacity( NEWDB_TABLE_DEVICES );
+
+    for ( i = 0; i < cap && num < PERF_MAX_MACS; i++ ) {
+        if ( newDbGetDeviceId( i, &device ) && device.mac[0] != '\0' ) {
+            newDbStrNcpy( perfMacs[num++], device.mac, LEN_MAC_NIBBLE );
+        }
+    }
+    return( num );
+}
+
+static void perfDbGetDevice( int num ) {
+    newdb_dev_t device;
+    int64_t start, ns;
+    long ops = 0, i, n = 1, found = 0;
+
+    start = perfNow();
+    do {
+        for ( i = 0; i < n; i++ ) {
+            found += newDbGetDevice( perfMacs[( ops + i ) % num], &device );
+        }
+        ops += n;
+        n *= 2;
+        ns = perfNow() - start;
+    } while ( ns < PERF_MIN_NS );
+
+    if ( found != ops ) {
+        fprintf( stderr, "newDbGetDevice: %ld of %ld lookups failed\n", ops - found, ops );
+    }
+    perfReport( "newDbGetDevice_hit", ns, ops );
+
+    // Misses walk the whole bucket chain
+    ops = 0;
+    n = 1;
+    start = perfNow();
+    do {
+        for ( i = 0; i < n; i++ ) {
+            newDbGetDevice( "FFFFFFFFFFFFFFFF", &device );
+        }
+        ops += n;
+        n *= 2;
+        ns = perfNow() - start;
+    } while ( ns < PERF_MIN_NS );
+
+    perfReport( "newDbGetDevice_miss", ns, ops );
+}
+
+// -------------------------------------------------------------
+// Serial link
+// -------------------------------------------------------------
+
+static void perfSlWriteMessage( int len ) {
+    uint8_t payload[SL_MAX_MESSAGE_LENGTH];
+    char name[40];
+    int64_t start, ns;
+    long ops = 0, i, n = 1;
+
+    // Mix of plain and escaped (< 0x10) bytes, like addresses and attributes
+    for ( i = 0; i < len; i++ ) {
+        payload[i] = (uint8_t)( i * 37 );
+    }
+
+    perfSerialBytes = 0;
+    start = perfNow();
+    do {
+        for ( i = 0; i < n; i++ ) {
+            eSL_WriteMessage( 0x0092, len, payload );
+        }
+        ops += n;
+        n *= 2;
+        ns = perfNow() - start;
+    } while ( ns < PERF_MIN_NS );
+
+    sprintf( name, "eSL_WriteMessage_%d", len );
+    perfReport( name, ns, ops );
+    printf( "%s_rate\t%.2f\tMB/s\n", name, (double)perfSerialBytes * 1000 / ns );
+}
+
+// -------------------------------------------------------------
+// Main
+// -------------------------------------------------------------
+
+/**
+ * \brief Performance Test's main entry point
+ */
+int main( int argc, char * argv[] ) {
+    int scratch = 0, created = 0, num = 0, c;
+
+    while ( ( c = getopt( argc, argv, "s" ) ) != -1 ) {
+        switch ( c ) {
+        case 's':
+            scratch = 1;
+            break;
+        default:
+            fprintf( stderr, "Usage: %s [-s]\n", argv[0] );
+            return( 1 );
+        }
+    }
+
+    perfSlWriteMessage( 8 );
+    perfSlWriteMessage( 64 );
+    perfSlWriteMessage( SL_MAX_MESSAGE_LENGTH - 1 );
+
+    if ( shmget( PERF_SHMKEY, 0, 0666 ) < 0 ) {
+        if ( !scratch ) {
+            fprintf( stderr, "No IoT database running, skipping its tests (see -s)\n" );
+            return( 0 );
+        }
+        created = 1;
+    }
+
+    if ( newDbOpen() ) {
+        num = created ? perfDbPopulate() : perfDbCollect();
+        if ( num > 0 ) {
+            perfDbGetDevice( num );
+        } else {
+            fprintf( stderr, "No devices in the IoT database, skipping its tests\n" );
+        }
+        newDbClose();
+    }
+
+    if ( created ) {
+        int shmid = shmget( PERF_SHMKEY, 0, 0666 );
+        if ( shmid >= 0 ) shmctl( shmid, IPC_RMID, NULL );
+    }
+
+    return( 0 );
+}
@@ -44,7 +44,6 @@ int main( int argc, char * argv[] ) {
     newLogAdd( NEWLOG_FROM_TEST, "Plug meter testing started" );
 
     char * mac = "ABC0000001";
-    int cleanupCnt = 0;
 
     srand( (unsigned)time(NULL) );
     
@@ -73,18 +72,7 @@ int main( int argc, char * argv[] ) {
 
             int now = (int)time( NULL );
         
-            newdb_plughist_t plughist;
-            if ( newDbGetMatchingOrNewPlugHist( mac, now/60, &plughist ) ) {
-                plughist.sum = device.sum;
-                newDbSetPlugHist( &plughist );
-            
-                // Clean history entries older than one day
-                if ( cleanupCnt-- < 0 ) {
-                    if ( plugHistoryCleanup( mac, now ) ) {
-                        cleanupCnt = 25;
-                    }
-                }
-            }
+            newDbAddPlugSample( mac, device.sum, now );
         }
         
         sprintf( logbuffer, "MAC %s: Act = %d", mac, act );
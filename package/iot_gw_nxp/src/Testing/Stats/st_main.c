@@ -0,0 +1,91 @@
+// ------------------------------------------------------------------
+// Stats dump
+// ------------------------------------------------------------------
+// Prints the latency histograms of the IoT daemons
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2015. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \section stats Stats Dump
+ * \brief Prints the latency histograms of the IoT daemons
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "iotStats.h"
+
+/**
+ * \brief Prints one stage: a summary line and its non-empty buckets
+ * \param stage One of iotStatsStage
+ * \param buckets 1 also prints the buckets
+ */
+static void printStage( int stage, int buckets ) {
+    iotStatsHist_t hist;
+    int b;
+
+    if ( !iotStatsGet( stage, &hist ) ) return;
+
+    printf( "%-10s count %8u  p50 %8u  p90 %8u  p99 %8u  max %8u usec\n",
+            statsNames[stage], hist.count,
+            iotStatsPercentile( &hist, 50 ), iotStatsPercentile( &hist, 90 ),
+            iotStatsPercentile( &hist, 99 ), hist.max );
+
+    for ( b=0; b<IOT_STATS_BUCKETS && buckets; b++ ) {
+        if ( hist.buckets[b] ) {
+            printf( "%12s < %10u : %u\n", "", ( b < 31 ) ? 1u << b : 0xFFFFFFFF, hist.buckets[b] );
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Main
+// -------------------------------------------------------------
+
+/**
+ * \brief Stats dump's main entry point: Prints the histograms once, or every
+ * <secs> seconds
+ * \param argc Number of command-line parameters
+ * \param argv Parameter list (-h = help, -b = also print the buckets, -r = reset after printing, -i <secs> = repeat)
+ */
+int main( int argc, char * argv[] ) {
+    signed char opt;
+    int s, buckets = 0, reset = 0, interval = 0;
+
+    while ( ( opt = getopt( argc, argv, "hbri:" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'h':
+            printf( "Usage: iot_st [-b] [-r] [-i <secs>]\n" );
+            printf( "\t-b        Also print the buckets\n" );
+            printf( "\t-r        Reset after printing\n" );
+            printf( "\t-i <secs> Print every <secs> seconds\n" );
+            exit( 0 );
+        case 'b':
+            buckets = 1;
+            break;
+        case 'r':
+            reset = 1;
+            break;
+        case 'i':
+            interval = atoi( optarg );
+            break;
+        }
+    }
+
+    do {
+        for ( s=0; s<IOT_STATS_NUM; s++ ) {
+            printStage( s, buckets );
+        }
+        if ( reset ) iotStatsReset();
+        if ( interval > 0 ) {
+            printf( "\n" );
+            sleep( interval );
+        }
+    } while ( interval > 0 );
+
+    return( 0 );
+}
+
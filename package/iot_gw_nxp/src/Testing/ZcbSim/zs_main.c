@@ -0,0 +1,1095 @@
+// ------------------------------------------------------------------
+// ZCB Simulator
+// ------------------------------------------------------------------
+// Emulates the JN516x control bridge on a pty, so iot_zb can be load
+// tested without hardware: answers each command with a status, lets
+// simulated nodes announce and report, replays recorded traffic and
+// measures the latency of lamp commands from the ZCB-in queue to the
+// serial link. In bench mode the nodes are temperature sensors and
+// their reports are followed through the gateway to the MQTT broker.
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2015. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \section zcbsim ZCB Simulator
+ * \brief Emulates the control bridge on a pty for load tests of iot_zb
+ *
+ * Start the simulator first, then iot_zb on its pty:
+ *
+ *     iot_zs -n 40 -r 50 -c 10 -t 60 -l /tmp/ttyZCB &
+ *     iot_zb -s /tmp/ttyZCB
+ *
+ * Replay files have one frame per line: <delay msec> <type> [<payload>], type
+ * and payload in hex (spaces in the payload are ignored), # starts a comment.
+ *
+ * Bench mode (-b <broker>) measures the whole report path: serial link, iot_zb
+ * and newDb, the DBP queue, iot_dbp and its MQTT publish. The nodes join as
+ * temperature sensors and every report carries a new value, so the simulator
+ * finds it back in what iot_dbp publishes on the broker (it subscribes like a
+ * client would) and takes the time from the serial frame to the publish. Reports
+ * merged by the write-behind windows of iot_zb and iot_dbp count as merged, not
+ * lost. The stage histograms (iot_st) are reset at the start and printed at the
+ * end. With -R the rate goes up by -r every -s seconds until a step drops
+ * frames, loses more than 1% or its p99 exceeds -p msec, or -R is reached:
+ *
+ *     iot_zs -b localhost:1883 -n 20 -r 20 -R 400 -s 10 -l /tmp/ttyZCB &
+ *     iot_zb -s /tmp/ttyZCB
+ *
+ * iot_dbp only forwards sensor reports while a DBP client is connected, so the
+ * simulator connects to it as one. iot_dbp must publish to the same broker.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "queue.h"
+#include "iotStats.h"
+#include "mqtt_client.h"
+
+// -------------------------------------------------------------
+// Macros
+// -------------------------------------------------------------
+
+#define SL_START_CHAR           0x01
+#define SL_ESC_CHAR             0x02
+#define SL_END_CHAR             0x03
+#define SL_MAX_MESSAGE_LENGTH   256
+
+// Message types, see SerialLink.h
+#define MSG_STATUS              0x8000
+#define MSG_GET_VERSION         0x0010
+#define MSG_VERSION_LIST        0x8010
+#define MSG_DEVICE_ANNOUNCE     0x004D
+#define MSG_MANAGEMENT_LQI_REQUEST  0x004E
+#define MSG_MANAGEMENT_LQI_RESPONSE 0x804E
+#define MSG_ONOFF               0x0092
+#define MSG_ATTRIBUTE_REPORT    0x8102
+#define MSG_NETWORK_JOINED_FORMED       0x8024
+#define MSG_SIMPLE_DESCRIPTOR_REQUEST   0x0043
+#define MSG_SIMPLE_DESCRIPTOR_RESPONSE  0x8043
+
+#define ZS_VERSION              0x00030102   // Reported firmware version
+#define ZS_MAX_NODES            256
+#define ZS_SADDR_FIRST          0x1000
+#define ZS_IEEE_FIRST           0x00158D0000000000ULL
+#define ZS_ANNOUNCE_INTERVAL    20000        // usec between device announces
+#define ZS_MAX_PENDING          256          // Commands in flight
+#define ZS_CMD_TIMEOUT          2000000      // usec: a command without frame by then is lost
+#define ZS_MAX_REPLAY           1024
+
+// Bench mode
+#define ZS_IEEE_COORD           0x00158D00FFFF0000ULL
+#define ZS_PROFILE_ZHA          0x0104
+#define ZS_SIMPLE_SENSOR        0x000C       // SIMPLE_DESCR_SIMPLE_SENSOR
+#define ZS_CLUSTER_TEMP         0x0402
+#define ZS_DBP_PORT             2002         // DBP_PORT in dbp_main.c
+#define ZS_TOPIC                "iot_td/ZigBee/HA/NXP/#"   // TOPIC_ROOT in dbp_main.c
+#define ZS_BENCH_PENDING        1024         // Reports in flight per node
+#define ZS_BENCH_TIMEOUT        10000000     // usec: a report not published by then is lost
+#define ZS_BENCH_MAX_LOSS       1            // Percent lost for a step to pass
+#define ZS_BENCH_STEPS          64
+
+// -------------------------------------------------------------
+// Globals
+// -------------------------------------------------------------
+
+static volatile int running = 1;
+
+static int master = -1;                      // Our side of the pty
+static int slave  = -1;                      // Kept open: the pty survives restarts of iot_zb
+
+static int numNodes = 10;
+static int reportRate = 0;                   // Per second
+static int commandRate = 0;                  // Per second
+static int speed = 100;                      // Replay speed in percent
+static int settle = 3;                       // Seconds between the announces and the load: iot_zb sleeps 2 after connecting
+static int verbose = 0;
+
+static int connected = 0;                    // iot_zb asked for the version
+static int announced = 0;
+static uint8_t sequenceNo = 0;
+
+typedef struct frame_rx {
+    int state;                               // 0 = wait start, 1 = in frame
+    int esc;
+    int num;
+    uint8_t buf[SL_MAX_MESSAGE_LENGTH + 5];  // Type, length, crc, payload
+} frame_rx_t;
+
+static frame_rx_t rx;
+
+typedef struct pending_cmd {
+    uint16_t saddr;
+    unsigned int sent;                       // iotStatsNow()
+} pending_cmd_t;
+
+static pending_cmd_t pending[ZS_MAX_PENDING];
+static int numPending = 0;
+
+typedef struct replay_frame {
+    int delay;                               // msec after the previous frame
+    uint16_t type;
+    uint16_t len;
+    uint8_t data[SL_MAX_MESSAGE_LENGTH];
+} replay_frame_t;
+
+static replay_frame_t * replay = NULL;
+static int numReplay = 0;
+
+static struct zs_counters {
+    unsigned int framesIn;
+    unsigned int framesOut;
+    unsigned int badFrames;
+    unsigned int status;
+    unsigned int announces;
+    unsigned int reports;
+    unsigned int reportsDropped;
+    unsigned int replayed;
+    unsigned int replayDropped;
+    unsigned int commands;
+    unsigned int commandsFailed;
+    unsigned int commandsDone;
+    unsigned int commandsLost;
+} cnt;
+
+static iotStatsHist_t latency;
+
+static char * broker = NULL;                 // Bench mode when set
+static int maxRate = 0;                      // Ramp up to this rate, 0 = no ramp
+static int stepSecs = 10;
+static int maxP99 = 5000;                    // msec
+
+typedef struct bench_report {
+    uint16_t value;
+    uint8_t  step;
+    unsigned int sent;                       // iotStatsNow()
+} bench_report_t;
+
+typedef struct bench_node {
+    bench_report_t ring[ZS_BENCH_PENDING];   // Oldest first from head
+    int head;
+    int num;
+    uint16_t value;
+} bench_node_t;
+
+typedef struct bench_step {
+    int rate;
+    unsigned int start;
+    unsigned int end;                        // 0 while running
+    unsigned int sent;
+    unsigned int dropped;
+    unsigned int delivered;
+    unsigned int merged;
+    unsigned int lost;
+    int done;                                // Evaluated: 1 passed, -1 failed
+    iotStatsHist_t latency;
+} bench_step_t;
+
+// Shared with the MQTT thread
+static pthread_mutex_t benchMutex = PTHREAD_MUTEX_INITIALIZER;
+static bench_node_t * benchNodes = NULL;
+static bench_step_t steps[ZS_BENCH_STEPS];
+static int numSteps = 0;
+static unsigned int benchUnknown = 0;        // Published values we did not send (or no longer wait for)
+static unsigned int benchPublishes = 0;
+static iotStatsHist_t benchLatency;
+
+static int dbpSocket = -1;
+static volatile int subscribing = 1;         // Outlives running: publishes are awaited after a stop
+
+// -------------------------------------------------------------
+// Helpers
+// -------------------------------------------------------------
+
+static void vQuitSignalHandler( int sig ) {
+    running = 0;
+    signal( sig, vQuitSignalHandler );
+}
+
+static void histAdd( iotStatsHist_t * phist, unsigned int usec ) {
+    int b = 0;
+    while ( b < IOT_STATS_BUCKETS - 1 && ( usec >> b ) ) b++;
+    phist->buckets[b]++;
+    phist->count++;
+    if ( usec > phist->max ) phist->max = usec;
+}
+
+static int hex2num( int c ) {
+    if ( c >= '0' && c <= '9' ) return( c - '0' );
+    if ( c >= 'a' && c <= 'f' ) return( c - 'a' + 10 );
+    if ( c >= 'A' && c <= 'F' ) return( c - 'A' + 10 );
+    return( -1 );
+}
+
+// -------------------------------------------------------------
+// Serial link framing
+// -------------------------------------------------------------
+
+static uint8_t calculateCRC( uint16_t type, uint16_t len, uint8_t * data ) {
+    uint8_t crc = ( type >> 8 ) ^ ( type & 0xff ) ^ ( len >> 8 ) ^ ( len & 0xff );
+    int i;
+    for ( i=0; i<len; i++ ) crc ^= data[i];
+    return( crc );
+}
+
+static int txByte( uint8_t * buf, int pos, uint8_t b ) {
+    if ( b < 0x10 ) {
+        buf[pos++] = SL_ESC_CHAR;
+        b ^= 0x10;
+    }
+    buf[pos++] = b;
+    return( pos );
+}
+
+/**
+ * \brief Send a frame to iot_zb
+ * \param type Message type
+ * \param len Payload length
+ * \param data Payload
+ * \param must 0 drops the frame when the pty is full (like a node whose report is
+ * lost), 1 waits for room
+ * \returns 1 when sent, 0 when dropped
+ */
+static int sendFrame( uint16_t type, uint16_t len, uint8_t * data, int must ) {
+    uint8_t buf[ 2 * ( SL_MAX_MESSAGE_LENGTH + 5 ) + 2 ];
+    int i, pos = 0, done = 0;
+
+    buf[pos++] = SL_START_CHAR;
+    pos = txByte( buf, pos, type >> 8 );
+    pos = txByte( buf, pos, type & 0xff );
+    pos = txByte( buf, pos, len >> 8 );
+    pos = txByte( buf, pos, len & 0xff );
+    pos = txByte( buf, pos, calculateCRC( type, len, data ) );
+    for ( i=0; i<len; i++ ) pos = txByte( buf, pos, data[i] );
+    buf[pos++] = SL_END_CHAR;
+
+    while ( done < pos ) {
+        int n = write( master, buf + done, pos - done );
+        if ( n > 0 ) {
+            done += n;
+        } else if ( n < 0 && errno != EAGAIN && errno != EINTR ) {
+            perror( "write pty" );
+            return( 0 );
+        } else if ( done == 0 && !must ) {
+            return( 0 );
+        } else {
+            // Never leave half a frame: wait for room
+            struct pollfd p = { master, POLLOUT, 0 };
+            poll( &p, 1, 100 );
+        }
+    }
+    cnt.framesOut++;
+    return( 1 );
+}
+
+/**
+ * \brief Send the status of a command
+ * \returns The sequence number it carries, answers to the command refer to it
+ */
+static uint8_t sendStatus( uint16_t type ) {
+    uint8_t msg[4];
+    msg[0] = 0;                              // Success
+    msg[1] = sequenceNo++;
+    msg[2] = type >> 8;
+    msg[3] = type & 0xff;
+    sendFrame( MSG_STATUS, sizeof( msg ), msg, 1 );
+    cnt.status++;
+    return( msg[1] );
+}
+
+// -------------------------------------------------------------
+// Coordinator
+// -------------------------------------------------------------
+
+/**
+ * \brief Match a lamp frame to the oldest command in flight for that node
+ * \param saddr Short address the frame is sent to
+ */
+static void commandDone( uint16_t saddr ) {
+    int i;
+    for ( i=0; i<numPending; i++ ) {
+        if ( pending[i].saddr == saddr ) {
+            histAdd( &latency, iotStatsNow() - pending[i].sent );
+            cnt.commandsDone++;
+            memmove( &pending[i], &pending[i+1], ( numPending - i - 1 ) * sizeof( pending_cmd_t ) );
+            numPending--;
+            return;
+        }
+    }
+}
+
+/**
+ * \brief Network formed with the simulator as coordinator
+ */
+static void sendNetworkFormed( void ) {
+    uint8_t msg[12];
+    int i;
+    msg[0] = 1;                              // Formed
+    msg[1] = msg[2] = 0;                     // Coordinator
+    for ( i=0; i<8; i++ ) msg[3+i] = ( ZS_IEEE_COORD >> ( 56 - 8 * i ) ) & 0xff;
+    msg[11] = 11;                            // Channel
+    sendFrame( MSG_NETWORK_JOINED_FORMED, sizeof( msg ), msg, 1 );
+}
+
+/**
+ * \brief Bench nodes are simple sensors with a temperature cluster
+ */
+static void sendSimpleDescriptor( uint8_t seq, uint16_t saddr ) {
+    uint8_t msg[] = { seq, 0, saddr >> 8, saddr & 0xff,
+                      10,                    // Length of what follows the length
+                      1,                     // Endpoint
+                      ZS_PROFILE_ZHA >> 8, ZS_PROFILE_ZHA & 0xff,
+                      ZS_SIMPLE_SENSOR >> 8, ZS_SIMPLE_SENSOR & 0xff,
+                      0,                     // Device version
+                      1, ZS_CLUSTER_TEMP >> 8, ZS_CLUSTER_TEMP & 0xff,
+                      0 };                   // No output clusters
+    sendFrame( MSG_SIMPLE_DESCRIPTOR_RESPONSE, sizeof( msg ), msg, 1 );
+}
+
+/**
+ * \brief Handle a frame from iot_zb: every command gets a status, a few get
+ * the answer iot_zb waits for
+ */
+static void handleFrame( uint16_t type, uint16_t len, uint8_t * data ) {
+    uint8_t seq;
+
+    cnt.framesIn++;
+    if ( verbose ) printf( "RX 0x%04X (%d)\n", type, len );
+
+    seq = sendStatus( type );
+
+    switch ( type ) {
+    case MSG_GET_VERSION:
+        {
+            uint8_t msg[4] = { ZS_VERSION >> 24, ( ZS_VERSION >> 16 ) & 0xff,
+                               ( ZS_VERSION >> 8 ) & 0xff, ZS_VERSION & 0xff };
+            sendFrame( MSG_VERSION_LIST, sizeof( msg ), msg, 1 );
+            if ( !connected ) printf( "iot_zb connected\n" );
+            // iot_dbp takes its topic from the coordinator's address
+            if ( !connected && broker ) sendNetworkFormed();
+            connected = 1;
+        }
+        break;
+    case MSG_ONOFF:
+        // Address mode, short address, ...
+        if ( len >= 3 ) commandDone( ( data[1] << 8 ) | data[2] );
+        break;
+    case MSG_SIMPLE_DESCRIPTOR_REQUEST:
+        // Short address, endpoint
+        if ( broker && len >= 2 ) sendSimpleDescriptor( seq, ( data[0] << 8 ) | data[1] );
+        break;
+    case MSG_MANAGEMENT_LQI_REQUEST:
+        {
+            // Empty neighbour table, so the neighbour sweep does not wait for a timeout
+            uint8_t msg[5] = { seq, 0, 0, 0, 0 };
+            sendFrame( MSG_MANAGEMENT_LQI_RESPONSE, sizeof( msg ), msg, 1 );
+        }
+        break;
+    }
+}
+
+/**
+ * \brief Decode what iot_zb wrote
+ */
+static void receive( void ) {
+    uint8_t buf[512];
+    int i, n;
+    while ( ( n = read( master, buf, sizeof( buf ) ) ) > 0 ) {
+        for ( i=0; i<n; i++ ) {
+            uint8_t b = buf[i];
+            if ( b == SL_START_CHAR ) {
+                rx.state = 1;
+                rx.esc = rx.num = 0;
+            } else if ( b == SL_ESC_CHAR ) {
+                rx.esc = 1;
+            } else if ( b == SL_END_CHAR ) {
+                if ( rx.state ) {
+                    uint16_t type = ( rx.buf[0] << 8 ) | rx.buf[1];
+                    uint16_t len  = ( rx.buf[2] << 8 ) | rx.buf[3];
+                    if ( rx.num >= 5 && len == rx.num - 5 &&
+                         rx.buf[4] == calculateCRC( type, len, &rx.buf[5] ) ) {
+                        handleFrame( type, len, &rx.buf[5] );
+                    } else {
+                        cnt.badFrames++;
+                    }
+                }
+                rx.state = 0;
+            } else if ( rx.state ) {
+                if ( rx.esc ) b ^= 0x10;
+                rx.esc = 0;
+                if ( rx.num < (int)sizeof( rx.buf ) ) {
+                    rx.buf[rx.num++] = b;
+                } else {
+                    cnt.badFrames++;
+                    rx.state = 0;
+                }
+            }
+        }
+    }
+}
+
+static void sendAnnounce( int node ) {
+    uint16_t saddr = ZS_SADDR_FIRST + node;
+    uint64_t ieee  = ZS_IEEE_FIRST + node;
+    uint8_t msg[11];
+    int i;
+    msg[0] = saddr >> 8;
+    msg[1] = saddr & 0xff;
+    for ( i=0; i<8; i++ ) msg[2+i] = ( ieee >> ( 56 - 8 * i ) ) & 0xff;
+    msg[10] = 0x8E;                          // Mains powered router
+    sendFrame( MSG_DEVICE_ANNOUNCE, sizeof( msg ), msg, 1 );
+    cnt.announces++;
+}
+
+/**
+ * \brief On/off attribute report of a node, the state toggles on each report
+ */
+static void sendReport( int node ) {
+    static uint8_t onoff[ZS_MAX_NODES];
+    uint16_t saddr = ZS_SADDR_FIRST + node;
+    uint8_t msg[] = { sequenceNo++, saddr >> 8, saddr & 0xff, 1,
+                      0x00, 0x06,            // On/off cluster
+                      0x00, 0x00,            // On/off attribute
+                      0x00,                  // Status
+                      0x10,                  // Boolean
+                      0x00, 0x01,            // Size
+                      onoff[node] ^= 1 };
+    if ( sendFrame( MSG_ATTRIBUTE_REPORT, sizeof( msg ), msg, 0 ) ) {
+        cnt.reports++;
+    } else {
+        cnt.reportsDropped++;
+    }
+}
+
+/**
+ * \brief Lamp command to a node via the ZCB-in queue, as the Control Interface does
+ */
+static void sendCommand( int queue, int node ) {
+    static int on = 0;
+    char msg[80];
+    if ( numPending >= ZS_MAX_PENDING ) {
+        cnt.commandsLost++;
+        numPending--;
+        memmove( &pending[0], &pending[1], numPending * sizeof( pending_cmd_t ) );
+    }
+    sprintf( msg, "{\"lmp\":{\"mac\":\"%016llX\",\"cmd\":\"%s\"}}",
+             (unsigned long long)( ZS_IEEE_FIRST + node ), ( on ^= 1 ) ? "on" : "off" );
+    pending[numPending].saddr = ZS_SADDR_FIRST + node;
+    pending[numPending].sent  = iotStatsNow();
+    if ( queueWrite( queue, msg ) ) {
+        numPending++;
+        cnt.commands++;
+    } else {
+        cnt.commandsFailed++;
+    }
+}
+
+static void expireCommands( void ) {
+    unsigned int now = iotStatsNow();
+    while ( numPending > 0 && now - pending[0].sent > ZS_CMD_TIMEOUT ) {
+        cnt.commandsLost++;
+        numPending--;
+        memmove( &pending[0], &pending[1], numPending * sizeof( pending_cmd_t ) );
+    }
+}
+
+// -------------------------------------------------------------
+// Bench
+// -------------------------------------------------------------
+
+/**
+ * \brief Temperature report of a node for step <step>. Each report carries the
+ * next value of the node, which is how it is found back in the publishes
+ */
+static void benchSendReport( int node, int step ) {
+    bench_node_t * pn = &benchNodes[node];
+    uint16_t saddr = ZS_SADDR_FIRST + node;
+    uint16_t value = pn->value = ( pn->value + 1 ) & 0x7fff;
+    uint8_t msg[] = { sequenceNo++, saddr >> 8, saddr & 0xff, 1,
+                      ZS_CLUSTER_TEMP >> 8, ZS_CLUSTER_TEMP & 0xff,
+                      0x00, 0x00,            // Measured value
+                      0x00,                  // Status
+                      0x29,                  // Int16
+                      0x00, 0x02,            // Size
+                      value >> 8, value & 0xff };
+    unsigned int now = iotStatsNow();
+    int sent = sendFrame( MSG_ATTRIBUTE_REPORT, sizeof( msg ), msg, 0 );
+
+    pthread_mutex_lock( &benchMutex );
+    if ( sent ) {
+        bench_report_t * pr;
+        cnt.reports++;
+        steps[step].sent++;
+        if ( pn->num == ZS_BENCH_PENDING ) {
+            steps[pn->ring[pn->head].step].lost++;
+            pn->head = ( pn->head + 1 ) % ZS_BENCH_PENDING;
+            pn->num--;
+        }
+        pr = &pn->ring[( pn->head + pn->num++ ) % ZS_BENCH_PENDING];
+        pr->value = value;
+        pr->step  = step;
+        pr->sent  = now;
+    } else {
+        cnt.reportsDropped++;
+        steps[step].dropped++;
+    }
+    pthread_mutex_unlock( &benchMutex );
+}
+
+/**
+ * \brief A value of a node was published: the reports before it were merged
+ * into it on the way
+ */
+static void benchDelivered( int node, int value ) {
+    bench_node_t * pn = &benchNodes[node];
+    unsigned int now = iotStatsNow();
+    int i;
+
+    pthread_mutex_lock( &benchMutex );
+    benchPublishes++;
+    for ( i=0; i<pn->num && pn->ring[( pn->head + i ) % ZS_BENCH_PENDING].value != value; i++ );
+    if ( i == pn->num ) {
+        benchUnknown++;
+    } else {
+        bench_report_t * pr;
+        while ( i-- > 0 ) {
+            steps[pn->ring[pn->head].step].merged++;
+            pn->head = ( pn->head + 1 ) % ZS_BENCH_PENDING;
+            pn->num--;
+        }
+        pr = &pn->ring[pn->head];
+        histAdd( &steps[pr->step].latency, now - pr->sent );
+        histAdd( &benchLatency, now - pr->sent );
+        steps[pr->step].delivered++;
+        pn->head = ( pn->head + 1 ) % ZS_BENCH_PENDING;
+        pn->num--;
+    }
+    pthread_mutex_unlock( &benchMutex );
+}
+
+/**
+ * \brief Count reports that were not published in time as lost
+ * \param all 1 also counts those still in time, at the end
+ * \returns Reports still in flight
+ */
+static int benchExpire( int all ) {
+    unsigned int now = iotStatsNow();
+    int i, pending = 0;
+
+    pthread_mutex_lock( &benchMutex );
+    for ( i=0; i<numNodes; i++ ) {
+        bench_node_t * pn = &benchNodes[i];
+        while ( pn->num > 0 && ( all || now - pn->ring[pn->head].sent > ZS_BENCH_TIMEOUT ) ) {
+            steps[pn->ring[pn->head].step].lost++;
+            pn->head = ( pn->head + 1 ) % ZS_BENCH_PENDING;
+            pn->num--;
+        }
+        pending += pn->num;
+    }
+    pthread_mutex_unlock( &benchMutex );
+    return( pending );
+}
+
+/**
+ * \brief Pick node and temperature out of a publish of iot_dbp:
+ * <root>device<mac> with {"tmp":<value>,...}, or <root>device<mac>/tmp with <value>
+ */
+static void benchPublish( char * topic, char * payload, int len ) {
+    char buf[256], * p, * end;
+    unsigned long long ieee;
+
+    if ( ( p = strstr( topic, "device" ) ) == NULL ) return;
+    ieee = strtoull( p + 6, &end, 16 );
+    if ( end != p + 22 || ieee < ZS_IEEE_FIRST || ieee >= ZS_IEEE_FIRST + numNodes ) return;
+
+    if ( len >= (int)sizeof( buf ) ) len = sizeof( buf ) - 1;
+    memcpy( buf, payload, len );
+    buf[len] = '\0';
+
+    if ( strcmp( end, "/tmp" ) == 0 ) {
+        benchDelivered( ieee - ZS_IEEE_FIRST, atoi( buf ) );
+    } else if ( *end == '\0' && ( p = strstr( buf, "\"tmp\":" ) ) != NULL ) {
+        benchDelivered( ieee - ZS_IEEE_FIRST, atoi( p + 6 ) );
+    }
+}
+
+/**
+ * \brief MQTT client thread: subscribes to what iot_dbp publishes
+ */
+static void * benchSubscriber( void * arg ) {
+    mqtt_client * m = mqtt_new( broker, MQTT_PORT, "iot_zs" );
+    int subscribed = 0;
+
+    if ( m == NULL ) {
+        printf( "Could not create the MQTT client for %s\n", broker );
+        return( NULL );
+    }
+    mqtt_set_timeout( m, 1000 );
+    while ( subscribing ) {
+        if ( !mqtt_is_connected( m ) ) {
+            subscribed = 0;
+            if ( mqtt_connect( m, NULL, NULL ) != MQTT_SUCCESS ) {
+                sleep( 1 );
+                continue;
+            }
+        }
+        if ( !subscribed ) {
+            if ( mqtt_subscribe( m, ZS_TOPIC, QOS_AT_MOST_ONCE ) != MQTT_SUCCESS ) {
+                sleep( 1 );
+                continue;
+            }
+            printf( "Subscribed to %s on %s\n", ZS_TOPIC, broker );
+            subscribed = 1;
+        }
+        if ( mqtt_receive( m, 100 ) == MQTT_SUCCESS ) {
+            benchPublish( m->received_topic, m->received_message, m->received_message_len );
+        }
+    }
+    mqtt_disconnect( m );
+    mqtt_delete( m );
+    return( NULL );
+}
+
+/**
+ * \brief Connect to iot_dbp as a client: it only forwards sensor reports to
+ * the broker while it has one
+ */
+static void benchConnectDbp( void ) {
+    struct sockaddr_in addr;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( ZS_DBP_PORT );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    if ( ( dbpSocket = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 ||
+         connect( dbpSocket, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 ) {
+        printf( "Could not connect to iot_dbp on port %d, no reports will be published\n", ZS_DBP_PORT );
+        if ( dbpSocket >= 0 ) close( dbpSocket );
+        dbpSocket = -1;
+        return;
+    }
+    fcntl( dbpSocket, F_SETFL, fcntl( dbpSocket, F_GETFL ) | O_NONBLOCK );
+}
+
+/**
+ * \brief Read away what iot_dbp sends its clients
+ */
+static void benchReadDbp( void ) {
+    char buf[512];
+    int n;
+
+    if ( dbpSocket < 0 ) return;
+    while ( ( n = read( dbpSocket, buf, sizeof( buf ) ) ) > 0 );
+    if ( n == 0 || ( errno != EAGAIN && errno != EINTR ) ) {
+        printf( "iot_dbp closed the connection\n" );
+        close( dbpSocket );
+        dbpSocket = -1;
+    }
+}
+
+/**
+ * \brief Start the next step of the ramp at <now>
+ * \returns 1 when started, 0 when the ramp is at its end
+ */
+static int benchNextStep( unsigned int now ) {
+    int rate = reportRate * ( numSteps + 1 );
+
+    if ( numSteps == ZS_BENCH_STEPS || ( numSteps > 0 && ( maxRate == 0 || rate > maxRate ) ) ) return( 0 );
+
+    pthread_mutex_lock( &benchMutex );
+    if ( numSteps > 0 ) steps[numSteps-1].end = now;
+    steps[numSteps].rate  = rate;
+    steps[numSteps].start = now;
+    numSteps++;
+    pthread_mutex_unlock( &benchMutex );
+    return( 1 );
+}
+
+static void benchPrintStep( int step ) {
+    bench_step_t * ps = &steps[step];
+
+    printf( "step %2d %5d rep/s: sent %u drop %u published %u merged %u lost %u | "
+            "e2e p50 %u p90 %u p99 %u max %u usec: %s\n",
+            step, ps->rate, ps->sent, ps->dropped, ps->delivered, ps->merged, ps->lost,
+            iotStatsPercentile( &ps->latency, 50 ), iotStatsPercentile( &ps->latency, 90 ),
+            iotStatsPercentile( &ps->latency, 99 ), ps->latency.max,
+            ( ps->done > 0 ) ? "ok" : ( ps->done < 0 ) ? "FAIL" : "-" );
+    fflush( stdout );
+}
+
+/**
+ * \brief Judge a step once all its reports are published or timed out: it passes
+ * without dropped frames, with at most ZS_BENCH_MAX_LOSS percent lost and a
+ * p99 within -p
+ * \returns 1 passed, -1 failed, 0 not yet
+ */
+static int benchJudge( int step, unsigned int now ) {
+    bench_step_t * ps = &steps[step];
+
+    pthread_mutex_lock( &benchMutex );
+    if ( !ps->done && ps->end &&
+         ( ps->delivered + ps->merged + ps->lost >= ps->sent || now - ps->end > ZS_BENCH_TIMEOUT ) ) {
+        ps->done = ( ps->dropped == 0 && ps->delivered > 0 &&
+                     ps->lost * 100 <= ps->sent * ZS_BENCH_MAX_LOSS &&
+                     iotStatsPercentile( &ps->latency, 99 ) <= maxP99 * 1000u ) ? 1 : -1;
+        benchPrintStep( step );
+    }
+    pthread_mutex_unlock( &benchMutex );
+    return( ps->done );
+}
+
+/**
+ * \brief Summary at the end: the steps, the stages as kept by the daemons, end-to-end
+ */
+static void benchSummary( void ) {
+    iotStatsHist_t hist;
+    int s, best = 0;
+
+    printf( "\nBench: %d nodes\n", numNodes );
+    for ( s=0; s<numSteps; s++ ) {
+        benchPrintStep( s );
+    }
+    for ( s=0; s<numSteps && steps[s].done > 0; s++ ) {
+        best = steps[s].rate;
+    }
+    if ( maxRate ) {
+        if ( best ) {
+            printf( "Max sustainable rate: %d reports/s%s\n", best,
+                    ( s == numSteps ) ? " (end of the ramp)" : "" );
+        } else {
+            printf( "Max sustainable rate: below %d reports/s\n", steps[0].rate );
+        }
+    }
+
+    for ( s=0; s<IOT_STATS_NUM; s++ ) {
+        if ( !iotStatsGet( s, &hist ) ) break;
+        printf( "%-12s count %8u  p50 %8u  p90 %8u  p99 %8u  max %8u usec\n",
+                statsNames[s], hist.count,
+                iotStatsPercentile( &hist, 50 ), iotStatsPercentile( &hist, 90 ),
+                iotStatsPercentile( &hist, 99 ), hist.max );
+    }
+    printf( "%-12s count %8u  p50 %8u  p90 %8u  p99 %8u  max %8u usec\n",
+            "end-to-end", benchLatency.count,
+            iotStatsPercentile( &benchLatency, 50 ), iotStatsPercentile( &benchLatency, 90 ),
+            iotStatsPercentile( &benchLatency, 99 ), benchLatency.max );
+    printf( "Publishes %u, of values not waited for %u\n", benchPublishes, benchUnknown );
+}
+
+// -------------------------------------------------------------
+// Replay
+// -------------------------------------------------------------
+
+/**
+ * \brief Read a replay file
+ * \returns Number of frames, -1 on error
+ */
+static int readReplay( char * filename ) {
+    char line[1024];
+    FILE * fp = fopen( filename, "r" );
+    if ( fp == NULL ) {
+        perror( filename );
+        return( -1 );
+    }
+    replay = calloc( ZS_MAX_REPLAY, sizeof( replay_frame_t ) );
+    while ( replay && numReplay < ZS_MAX_REPLAY && fgets( line, sizeof( line ), fp ) ) {
+        replay_frame_t * pf = &replay[numReplay];
+        unsigned int type;
+        int n, hi = -1;
+        char * p;
+        if ( ( p = strchr( line, '#' ) ) != NULL ) *p = '\0';
+        if ( sscanf( line, "%d %x %n", &pf->delay, &type, &n ) < 2 ) continue;
+        pf->type = type;
+        for ( p = line + n; *p && pf->len < SL_MAX_MESSAGE_LENGTH; p++ ) {
+            int v = hex2num( *p );
+            if ( v < 0 ) continue;
+            if ( hi < 0 ) {
+                hi = v;
+            } else {
+                pf->data[pf->len++] = ( hi << 4 ) | v;
+                hi = -1;
+            }
+        }
+        numReplay++;
+    }
+    fclose( fp );
+    return( numReplay );
+}
+
+// -------------------------------------------------------------
+// Report
+// -------------------------------------------------------------
+
+static void printCounters( int secs ) {
+    printf( "%4ds in %u out %u bad %u | ann %u rep %u (drop %u) replay %u (drop %u) | "
+            "cmd %u ok %u lost %u fail %u | lat p50 %u p99 %u max %u usec\n",
+            secs, cnt.framesIn, cnt.framesOut, cnt.badFrames,
+            cnt.announces, cnt.reports, cnt.reportsDropped, cnt.replayed, cnt.replayDropped,
+            cnt.commands, cnt.commandsDone, cnt.commandsLost, cnt.commandsFailed,
+            iotStatsPercentile( &latency, 50 ), iotStatsPercentile( &latency, 99 ), latency.max );
+    if ( broker ) {
+        pthread_mutex_lock( &benchMutex );
+        printf( "%4ds bench step %d | pub %u e2e p50 %u p99 %u max %u usec\n",
+                secs, numSteps - 1, benchPublishes, iotStatsPercentile( &benchLatency, 50 ),
+                iotStatsPercentile( &benchLatency, 99 ), benchLatency.max );
+        pthread_mutex_unlock( &benchMutex );
+    }
+    fflush( stdout );
+}
+
+/**
+ * \brief Open the pty iot_zb connects to
+ * \param link Also make this symlink to the pty, or NULL
+ * \returns 1 on success
+ */
+static int openPty( char * link ) {
+    struct termios options;
+    char * name;
+
+    if ( ( master = posix_openpt( O_RDWR | O_NOCTTY ) ) < 0 ||
+         grantpt( master ) < 0 || unlockpt( master ) < 0 ||
+         ( name = ptsname( master ) ) == NULL ) {
+        perror( "pty" );
+        return( 0 );
+    }
+
+    // Raw until iot_zb sets it up itself, so nothing is echoed back to us
+    if ( ( slave = open( name, O_RDWR | O_NOCTTY ) ) < 0 || tcgetattr( slave, &options ) < 0 ) {
+        perror( name );
+        return( 0 );
+    }
+    cfmakeraw( &options );
+    tcsetattr( slave, TCSANOW, &options );
+    fcntl( master, F_SETFL, fcntl( master, F_GETFL ) | O_NONBLOCK );
+
+    printf( "Control bridge simulated on %s\n", name );
+    if ( link ) {
+        unlink( link );
+        if ( symlink( name, link ) < 0 ) {
+            perror( link );
+            return( 0 );
+        }
+        printf( "Linked as %s\n", link );
+    }
+    return( 1 );
+}
+
+// -------------------------------------------------------------
+// Main
+// -------------------------------------------------------------
+
+/**
+ * \brief ZCB Simulator's main entry point: opens the pty and runs the simulated
+ * network until the duration has passed or it is stopped. Prints the counters
+ * every second and at exit
+ * \param argc Number of command-line parameters
+ * \param argv Parameter list (-h = help, -n <nodes>, -r <reports/s>, -c <commands/s>,
+ * -f <replay file>, -x <replay speed %>, -w <settle secs>, -t <secs>, -l <symlink>, -v = verbose,
+ * -b <broker> = bench mode, -R <max reports/s> = ramp, -s <step secs>, -p <max p99 msec>)
+ */
+int main( int argc, char * argv[] ) {
+    signed char opt;
+    char * link = NULL, * replayFile = NULL;
+    int duration = 0, queue = -1, judged = 0;
+    pthread_t subscriber;
+
+    while ( ( opt = getopt( argc, argv, "hn:r:c:f:x:w:t:l:vb:R:s:p:" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'h':
+            printf( "Usage: iot_zs [-n <nodes>] [-r <reports/s>] [-c <commands/s>] [-f <replay file>]\n" );
+            printf( "              [-x <replay speed %%>] [-w <settle secs>] [-t <secs>] [-l <symlink>] [-v]\n" );
+            printf( "              [-b <broker host:port> [-R <max reports/s>] [-s <step secs>] [-p <max p99 msec>]]\n" );
+            printf( "Then start: iot_zb -s <pty or symlink>\n" );
+            exit( 0 );
+        case 'n':
+            numNodes = atoi( optarg );
+            if ( numNodes < 1 ) numNodes = 1;
+            if ( numNodes > ZS_MAX_NODES ) numNodes = ZS_MAX_NODES;
+            break;
+        case 'r':
+            reportRate = atoi( optarg );
+            break;
+        case 'c':
+            commandRate = atoi( optarg );
+            break;
+        case 'f':
+            replayFile = optarg;
+            break;
+        case 'x':
+            speed = atoi( optarg );
+            if ( speed < 1 ) speed = 1;
+            break;
+        case 'w':
+            settle = atoi( optarg );
+            break;
+        case 't':
+            duration = atoi( optarg );
+            break;
+        case 'l':
+            link = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'b':
+            broker = optarg;
+            break;
+        case 'R':
+            maxRate = atoi( optarg );
+            break;
+        case 's':
+            stepSecs = atoi( optarg );
+            if ( stepSecs < 1 ) stepSecs = 1;
+            break;
+        case 'p':
+            maxP99 = atoi( optarg );
+            break;
+        }
+    }
+
+    signal( SIGTERM, vQuitSignalHandler );
+    signal( SIGINT, vQuitSignalHandler );
+
+    if ( replayFile && readReplay( replayFile ) < 0 ) exit( 1 );
+    if ( !openPty( link ) ) exit( 1 );
+
+    if ( commandRate > 0 && ( queue = queueOpen( QUEUE_KEY_ZCB_IN, 1 ) ) == -1 ) {
+        printf( "Could not open the ZCB-in queue\n" );
+        exit( 1 );
+    }
+
+    if ( broker ) {
+        if ( reportRate <= 0 ) reportRate = numNodes;
+        if ( ( benchNodes = calloc( numNodes, sizeof( bench_node_t ) ) ) == NULL ) exit( 1 );
+        benchConnectDbp();
+        if ( pthread_create( &subscriber, NULL, benchSubscriber, NULL ) != 0 ) {
+            printf( "Could not start the MQTT client\n" );
+            exit( 1 );
+        }
+    }
+
+    unsigned int start = iotStatsNow(), now, lastPrint = start;
+    unsigned int nextAnnounce = start, nextReport = start, nextCommand = start, nextReplay = start;
+    unsigned int loadStart = start;
+    int reportNode = 0, commandNode = 0, replayIndex = 0, secs = 0;
+
+    while ( running && ( duration == 0 || secs < duration ) ) {
+        struct pollfd p = { master, POLLIN, 0 };
+        poll( &p, 1, 1 );
+        receive();
+
+        now = iotStatsNow();
+
+        // Nodes join once iot_zb is listening, then they report and get commands
+        if ( connected && announced < numNodes && (int)( now - nextAnnounce ) >= 0 ) {
+            sendAnnounce( announced++ );
+            nextAnnounce = now + ZS_ANNOUNCE_INTERVAL;
+            loadStart = now + settle * 1000000;
+        }
+        if ( broker && announced == numNodes && (int)( now - loadStart ) >= 0 ) {
+            // Stages and end-to-end are measured from the same start
+            if ( numSteps == 0 ) {
+                iotStatsReset();
+                benchNextStep( now );
+                nextReport = now;
+            }
+            while ( (int)( now - nextReport ) >= 0 ) {
+                benchSendReport( reportNode++ % numNodes, numSteps - 1 );
+                nextReport += 1000000 / steps[numSteps - 1].rate;
+            }
+            if ( maxRate && now - steps[numSteps - 1].start >= stepSecs * 1000000u && !benchNextStep( now ) ) {
+                break;
+            }
+            while ( judged < numSteps - 1 && benchJudge( judged, now ) ) {
+                if ( steps[judged++].done < 0 ) break;
+            }
+            if ( judged > 0 && steps[judged - 1].done < 0 ) break;
+        } else if ( announced == numNodes && (int)( now - loadStart ) >= 0 ) {
+            while ( reportRate > 0 && (int)( now - nextReport ) >= 0 ) {
+                sendReport( reportNode++ % numNodes );
+                nextReport += 1000000 / reportRate;
+            }
+            while ( queue != -1 && (int)( now - nextCommand ) >= 0 ) {
+                sendCommand( queue, commandNode++ % numNodes );
+                nextCommand += 1000000 / commandRate;
+            }
+            while ( numReplay > 0 && (int)( now - nextReplay ) >= 0 ) {
+                replay_frame_t * pf = &replay[replayIndex];
+                if ( sendFrame( pf->type, pf->len, pf->data, 0 ) ) {
+                    cnt.replayed++;
+                } else {
+                    cnt.replayDropped++;
+                }
+                replayIndex = ( replayIndex + 1 ) % numReplay;
+                nextReplay += replay[replayIndex].delay * 1000 * 100 / speed;
+            }
+        } else {
+            nextReport = nextCommand = nextReplay = now;
+        }
+
+        expireCommands();
+        if ( broker ) {
+            benchExpire( 0 );
+            benchReadDbp();
+        }
+
+        if ( now - lastPrint >= 1000000 ) {
+            lastPrint += 1000000;
+            printCounters( ++secs );
+        }
+    }
+
+    // Wait for what is still on its way, then judge the last steps
+    if ( broker && numSteps > 0 ) {
+        unsigned int end = iotStatsNow();
+        steps[numSteps - 1].end = end;
+        printf( "Waiting for the last publishes\n" );
+        while ( benchExpire( 0 ) > 0 && iotStatsNow() - end <= ZS_BENCH_TIMEOUT ) {
+            struct pollfd p = { master, POLLIN, 0 };
+            poll( &p, 1, 10 );
+            receive();
+            benchReadDbp();
+        }
+        benchExpire( 1 );
+        for ( ; judged < numSteps; judged++ ) {
+            benchJudge( judged, end + ZS_BENCH_TIMEOUT + 1 );
+        }
+    }
+    if ( broker ) {
+        subscribing = 0;
+        pthread_join( subscriber, NULL );
+        if ( dbpSocket >= 0 ) close( dbpSocket );
+    }
+
+    printf( "\nDone\n" );
+    printCounters( secs );
+    if ( broker ) benchSummary();
+
+    if ( link ) unlink( link );
+    close( slave );
+    close( master );
+    return( 0 );
+}
+
+// -------------------------------------------------------------
+// End of file
+// -------------------------------------------------------------
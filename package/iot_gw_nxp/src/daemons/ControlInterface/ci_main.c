@@ -64,6 +64,9 @@
 
 #define MAXCHILDREN   10
 
+#define DBSAVE_INTERVAL    10     // Max seconds that changes stay unsaved
+#define DBSAVE_WATERMARK   50     // Save earlier when this many writes are pending
+
 // -------------------------------------------------------------
 // Globals
 // -------------------------------------------------------------
@@ -81,6 +84,8 @@ static pid_t children[MAXCHILDREN];
 
 static char socketHost[80];
 static char socketPort[80];
+static int dbSaveInterval  = DBSAVE_INTERVAL;
+static int dbSaveWatermark = DBSAVE_WATERMARK;
 
 
 //-mqtt
@@ -389,20 +394,35 @@ static void handleMqttMessage( mqtt_client *m) {//-
 // -------------------------------------------------------------
 
 /**
- * \brief Background thread that saves the IoT Database from shared-memory to file 
- * when updates are available in a rate of once per 10 seconds.
+ * \brief Background thread that saves the IoT Database from shared-memory to file.
+ * Only when tables are dirty: changes are coalesced for at most dbSaveInterval seconds,
+ * or until dbSaveWatermark writes are pending.
  * \param arg Not used
  * \retval NULL Null pointer
  */
 
 static void * dbSaveThread( void * arg ) {//-߳ʵڱݿĹ
     int running = *((int *)arg);
+    int dirtysince = 0;
+    int savedwrites = newDbGetNumWrites();
     sleep( 5 );
     while ( running ) {
-        newDbFileLock();
-        newDbSave();
-        newDbFileUnlock();
-        sleep( 10 );
+        if ( newDbGetDirtyTables() ) {
+            int now = (int)time( NULL );
+            int writes = newDbGetNumWrites();
+            if ( !dirtysince ) dirtysince = now;
+            if ( ( now - dirtysince ) >= dbSaveInterval ||
+                 ( writes - savedwrites ) >= dbSaveWatermark ) {
+                newDbFileLock();
+                newDbSave();
+                newDbFileUnlock();
+                dirtysince  = 0;
+                savedwrites = writes;
+            }
+        } else {
+            dirtysince = 0;
+        }
+        sleep( 1 );
     }
     return NULL;
 }
@@ -456,7 +476,8 @@ static void vQuitSignalHandler (int sig) {
  * Each client gets its own (forked) child process to handle the commands.
  * When there are too many clients, then the oldest one is killed (could be a hangup).
  * \param argc Number of command-line parameters
- * \param argv Parameter list (-h = help, -H <ip> is IP address, -P <port> = TCP port, -c = empty DB and exit immediately)
+ * \param argv Parameter list (-h = help, -H <ip> is IP address, -P <port> = TCP port, -c = empty DB and exit immediately,
+ * -i <secs> = max DB save delay, -w <writes> = DB save watermark, -m <table>=<rows> = DB table capacity)
  */
 
 int main( int argc, char * argv[] ) {
@@ -483,11 +504,22 @@ int main( int argc, char * argv[] ) {
     strcpy( socketHost, SOCKET_HOST );
     strcpy( socketPort, SOCKET_PORT );
 
-    while ( ( opt = getopt( argc, argv, "hH:P:c" ) ) != -1 ) {//-ʱĲвֲ
+    while ( ( opt = getopt( argc, argv, "hH:P:ci:w:m:" ) ) != -1 ) {//-ʱĲвֲ
         switch ( opt ) {
         case 'h':
-            printf( "Usage: ci [-H host] [-P port] [-c]\n\n");
+            printf( "Usage: ci [-H host] [-P port] [-c] [-i save-interval] [-w save-watermark] [-m table=rows]\n\n");
             exit(0);
+        case 'm':
+            if ( !newDbParseCapacity( optarg ) ) {
+                printf( "Unknown DB table capacity %s\n", optarg );
+            }
+            break;
+        case 'i':
+            dbSaveInterval = atoi( optarg );
+            break;
+        case 'w':
+            dbSaveWatermark = atoi( optarg );
+            break;
         case 'H':
             strcpy( socketHost, optarg );
             break;
@@ -38,9 +38,9 @@
 static char * intAttrs[NUMINTATTRS] =
        { "grpid", "scnid", "lvl", "rgb", "kelvin", "xcr", "ycr" };
 
-#define NUMSTRINGATTRS  3
-static char * stringAttrs[NUMSTRINGATTRS] = { "mac", "cmd", "scn" };
-static int    stringMaxlens[NUMSTRINGATTRS] = { 16,   16,    16 };
+#define NUMSTRINGATTRS  4
+static char * stringAttrs[NUMSTRINGATTRS] = { "mac", "cmd", "scn", "lamps" };
+static int    stringMaxlens[NUMSTRINGATTRS] = { 16,   16,    16,    120 };
 
 // ------------------------------------------------------------------
 // Functions
@@ -90,6 +90,7 @@ int grpHandle( void ) {
 
     char * cmd = parsingGetStringAttr0( "cmd" );
     char * scn = parsingGetStringAttr0( "scn" );
+    char * lamps = parsingGetStringAttr0( "lamps" );
     int grpid  = parsingGetIntAttr( "grpid" );
     int scnid  = parsingGetIntAttr( "scnid" );
     int lvl    = parsingGetIntAttr( "lvl" );
@@ -103,8 +104,14 @@ int grpHandle( void ) {
         ( scn != NULL ) ? scn : "NULL", scnid,
         ( cmd != NULL ) ? cmd : "NULL", lvl, rgb, kelvin, xcr, ycr );
 
-    queueWriteOneMessage( QUEUE_KEY_ZCB_IN,
-            jsonGroup( grpid, scn, scnid, cmd, lvl, rgb, kelvin, xcr, ycr ) );
+    if ( lamps != NULL ) {
+        // Set of lamps (device ids): ZCB plans a group for them
+        queueWriteOneMessage( QUEUE_KEY_ZCB_IN,
+                jsonGroupLamps( lamps, cmd, lvl, rgb, kelvin, xcr, ycr ) );
+    } else {
+        queueWriteOneMessage( QUEUE_KEY_ZCB_IN,
+                jsonGroup( grpid, scn, scnid, cmd, lvl, rgb, kelvin, xcr, ycr ) );
+    }
 
     return( iotError == IOT_ERROR_NONE );
 }
@@ -57,7 +57,7 @@
 // Globals
 // ------------------------------------------------------------------
 
-//extern void sendResponse( char * jsonResponseString );
+extern void sendResponse( char * jsonResponseString );
 
 // ------------------------------------------------------------------
 // Attributes
@@ -208,11 +208,15 @@ static int uploadTopo( void ) {
             DEBUG_PRINTF( "Generate Topo string (%d)\n", getpid() );
             int numTopoStrings = topoGenerate();
 
-            // Flush the Control Queue
+            // Flush the Control Queue (what is in it, without waiting for more)
             DEBUG_PRINTF( "Control queue flushing (%s)\n", cqName );
-            while ( queueReadWithMsecTimeout( controlQueue,
-                        queueInputBuffer, MAXMESSAGESIZE, 100 ) > 0 ) {
-                DEBUG_PRINTF( "Flushed %s\n", queueInputBuffer );
+            {
+                char flushBuffer[QUEUE_BATCH_MAX * ( MAXMESSAGESIZE + 1 )];
+                int  flushLens[QUEUE_BATCH_MAX], flushed;
+                while ( ( flushed = queueReadBatch( controlQueue, flushBuffer,
+                            sizeof( flushBuffer ), flushLens, QUEUE_BATCH_MAX, 0 ) ) > 0 ) {
+                    DEBUG_PRINTF( "Flushed %d\n", flushed );
+                }
             }
 
 #ifdef TIMING_DEBUG
@@ -601,7 +605,7 @@ static void uploadTopoCb( int par ) {
  * After "endconf" is received, the composed topo is uploaded to the (heating) manager 
  * via the tunnel interface in the ZCB.
  * A topo (re-)upload can also be forced with the "upload" command, typically called via
- * the Control web page.
+ * the Control web page. The "graph" command returns the mesh links that ZCB found.
  * \retval 0 When OK
  * \retval iotError In case of an error
  */
@@ -644,6 +648,17 @@ int topoHandle( void ) {
             // sleep(3);
             status = 1;
 
+        } else if ( strcmp( cmd, "graph" ) == 0 ) {
+            // Mesh links as JSON, or as a Graphviz graph with ty "dot"
+            char * ty = parsingGetStringAttr0( "ty" );
+            char * view = topoGenView( ( ty && strcmp( ty, "dot" ) == 0 ) ?
+                                       TOPO_VIEW_DOT : TOPO_VIEW_JSON, NULL );
+            if ( view != NULL ) {
+                sendResponse( view );
+            } else {
+                error = IOT_ERROR_TOPO_OVERRUN;
+            }
+
         } else {
             error = IOT_ERROR_TOPO_ILLEGAL_CMD;
         }
@@ -20,6 +20,7 @@
 #include "newDb.h"
 #include "queue.h"
 #include "jsonCreate.h"
+#include "jsonWriter.h"
 #include "topoGen.h"
 #include "iotError.h"
 
@@ -44,6 +45,10 @@ int  numTopoStrings = 0;
 
 static int  manId = 0;
 
+// The commands only depend on the device table: they are kept for its generation
+static int          topoCmdsValid = 0;
+static unsigned int topoCmdsGen;
+
 // -------------------------------------------------------------
 // Add string helper with error handling
 // -------------------------------------------------------------
@@ -107,6 +112,21 @@ static int getTopoDevsCb( newdb_dev_t * pdev ) {
     return 1;
 }
 
+static void getTopoDevs( void ) {
+    newdb_query_t query;
+    newdb_dev_t   devs[MAXTOPODEVS+1];
+    int i, num;
+
+    newDbQueryInit( &query );
+    query.devmask = NEWDB_DEVMASK_CLIMATE;
+    query.columns = NEWDB_COL_ID | NEWDB_COL_DEV | NEWDB_COL_PAR | NEWDB_COL_SID |
+                    NEWDB_COL_MAC | NEWDB_COL_NM | NEWDB_COL_TY;
+
+    topoDevCnt = 0;
+    num = newDbQueryDevices( &query, devs, MAXTOPODEVS+1 );
+    for ( i=0; i<num && getTopoDevsCb( &devs[i] ); i++ ) ;
+}
+
 // -------------------------------------------------------------
 // Device handlers
 // -------------------------------------------------------------
@@ -182,11 +202,17 @@ static void topoLoopMan( void ) {
 
 /**
  * \brief Build a list of JSON topology commands based on the IoT device table.
+ * The previous list is returned as long as the device table did not change
  * \retval <N> Number of JSON topology commands in the list
  * \return Fills global JSON topology commands list, waiting times and manager IDs for topo.c
  */
 
 int topoGenerate( void ) {
+    unsigned int gen = newDbGetGeneration( NEWDB_TABLE_DEVICES );
+
+    if ( topoCmdsValid && topoCmdsGen == gen ) {
+        return( numTopoStrings );
+    }
 
     if ( iotError == IOT_ERROR_TOPO_OVERRUN ) {
         iotError = IOT_ERROR_NONE;
@@ -194,7 +220,8 @@ int topoGenerate( void ) {
     numTopoStrings = 0;
 
     // Get the list of devices (column subset) into local memory
-    
+    getTopoDevs();
+
     // Loop through the list from the managere hierarchy down to the pumps
     topoLoopMan();
 
@@ -212,6 +239,151 @@ int topoGenerate( void ) {
     }
 #endif /* TOPOGEN_DEBUG */
 
+    topoCmdsValid = ( iotError != IOT_ERROR_TOPO_OVERRUN );
+    topoCmdsGen   = gen;
+
     return( numTopoStrings );
 }
 
+// -------------------------------------------------------------
+// Views
+// -------------------------------------------------------------
+
+#define TOPO_MAXLINKS     64
+#define TOPO_MAXNODES     64
+#define TOPO_VIEW_MAX     ( 512 + TOPO_MAXLINKS * 160 )
+
+typedef struct topo_view {
+    int          valid;
+    unsigned int gen;
+    int          len;
+    char         text[TOPO_VIEW_MAX];
+} topo_view_t;
+
+static topo_view_t topoViews[TOPO_NUM_VIEWS];
+
+static newdb_link_t topoLinks[TOPO_MAXLINKS];
+static newdb_dev_t  topoNodes[TOPO_MAXNODES];
+
+static void topoWriteSaddr( jsonWriter_t * w, int saddr ) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[6];
+    buf[0] = '0';
+    buf[1] = 'x';
+    buf[2] = hex[( saddr >> 12 ) & 0xF];
+    buf[3] = hex[( saddr >> 8 ) & 0xF];
+    buf[4] = hex[( saddr >> 4 ) & 0xF];
+    buf[5] = hex[saddr & 0xF];
+    jsonWriterRaw( w, buf, sizeof( buf ) );
+}
+
+static newdb_dev_t * topoFindNode( char * mac, int numNodes ) {
+    int i;
+    for ( i=0; i<numNodes; i++ ) {
+        if ( strcmp( topoNodes[i].mac, mac ) == 0 ) return( &topoNodes[i] );
+    }
+    return( NULL );
+}
+
+static void topoBuildJson( jsonWriter_t * w, unsigned int gen, int numLinks, int numNodes ) {
+    int i;
+    newdb_dev_t * pnode;
+
+    jsonWriterText( w, "{\"topo\":{" );
+    jsonWriterNameInt( w, "gen", (int)gen );
+    jsonWriterText( w, ",\"links\":[" );
+    for ( i=0; i<numLinks; i++ ) {
+        pnode = topoFindNode( topoLinks[i].mac, numNodes );
+        if ( i > 0 ) jsonWriterChar( w, ',' );
+        jsonWriterChar( w, '{' );
+        jsonWriterNameInt( w, "src", topoLinks[i].src );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameString( w, "mac", topoLinks[i].mac );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameInt( w, "saddr", topoLinks[i].saddr );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameString( w, "nm", ( pnode ) ? pnode->nm : "" );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameInt( w, "dev", ( pnode ) ? pnode->dev : DEVICE_DEV_UNKNOWN );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameInt( w, "depth", topoLinks[i].depth );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameInt( w, "lqi", topoLinks[i].lqi );
+        jsonWriterChar( w, ',' );
+        jsonWriterNameInt( w, "rel", topoLinks[i].rel );
+        jsonWriterChar( w, '}' );
+    }
+    jsonWriterText( w, "]}}\n" );
+}
+
+static void topoBuildDot( jsonWriter_t * w, int numLinks, int numNodes ) {
+    int i;
+    newdb_dev_t * pnode;
+
+    jsonWriterText( w, "graph topo {\n  \"0x0000\" [label=\"Gateway\",shape=box];\n" );
+    for ( i=0; i<numLinks; i++ ) {
+        pnode = topoFindNode( topoLinks[i].mac, numNodes );
+        jsonWriterText( w, "  \"" );
+        topoWriteSaddr( w, topoLinks[i].saddr );
+        jsonWriterText( w, "\" [label=" );
+        jsonWriterString( w, ( pnode && pnode->nm[0] ) ? pnode->nm : topoLinks[i].mac );
+        jsonWriterText( w, "];\n  \"" );
+        topoWriteSaddr( w, topoLinks[i].src );
+        jsonWriterText( w, "\" -- \"" );
+        topoWriteSaddr( w, topoLinks[i].saddr );
+        jsonWriterText( w, "\" [label=\"" );
+        jsonWriterInt( w, topoLinks[i].lqi );
+        jsonWriterChar( w, '"' );
+        if ( topoLinks[i].rel != LINK_REL_PARENT && topoLinks[i].rel != LINK_REL_CHILD ) {
+            jsonWriterText( w, ",style=dashed" );
+        }
+        jsonWriterText( w, "];\n" );
+    }
+    jsonWriterText( w, "}\n" );
+}
+
+/**
+ * \brief Get a view of the mesh, built in one pass from the link table and the device names.
+ * It is kept until one of those tables changed, so polling a view costs nothing
+ * \param view TOPO_VIEW_JSON or TOPO_VIEW_DOT
+ * \param plen Optional, returns the length of the text
+ * \returns The text, valid until the next call, or NULL when it did not fit
+ */
+char * topoGenView( int view, int * plen ) {
+    topo_view_t * pview;
+    newdb_query_t query;
+    jsonWriter_t w;
+    unsigned int gen, linkgen;
+    int numLinks, numNodes;
+
+    if ( view < 0 || view >= TOPO_NUM_VIEWS ) return( NULL );
+    pview = &topoViews[view];
+
+    // Taken before the snapshots: a change meanwhile only causes one rebuild too many
+    gen = newDbGetGenerations( NEWDB_DIRTY( NEWDB_TABLE_LINKS ) | NEWDB_DIRTY( NEWDB_TABLE_DEVICES ) );
+
+    if ( !pview->valid || pview->gen != gen ) {
+        newDbQueryInit( &query );
+        numLinks = newDbQueryLinks( &query, topoLinks, TOPO_MAXLINKS, &linkgen );
+
+        query.columns = NEWDB_COL_MAC | NEWDB_COL_DEV | NEWDB_COL_NM;
+        numNodes = newDbQueryDevices( &query, topoNodes, TOPO_MAXNODES );
+
+        jsonWriterInit( &w, pview->text, sizeof( pview->text ), -1 );
+        if ( view == TOPO_VIEW_DOT ) {
+            topoBuildDot( &w, numLinks, numNodes );
+        } else {
+            topoBuildJson( &w, linkgen, numLinks, numNodes );
+        }
+
+        pview->valid = ( jsonWriterEnd( &w ) != NULL );
+        pview->gen   = gen;
+        pview->len   = jsonWriterLength( &w );
+        if ( !pview->valid ) printf( "---> Topo view overrun\n" );
+    }
+
+    if ( !pview->valid ) return( NULL );
+    if ( plen ) *plen = pview->len;
+    return( pview->text );
+}
+
@@ -12,6 +12,10 @@
 #define MAX_TOPOSTRINGS   60
 #define MAX_JSONLENGTH    100
 
+#define TOPO_VIEW_JSON    0
+#define TOPO_VIEW_DOT     1
+#define TOPO_NUM_VIEWS    2
+
 // -------------------------------------------------------------
 // GLOBALS
 // -------------------------------------------------------------
@@ -25,4 +29,5 @@ extern int  topoManIds[MAX_TOPOSTRINGS];
 // -------------------------------------------------------------
 
 int topoGenerate( void );
+char * topoGenView( int view, int * plen );
 
@@ -4,6 +4,8 @@
 // Sends authorize CMD to Zigbee Coordinator.
 // The response ZCB is expected from the joiner queue
 // and translated into a secure join message towards the called.
+// Each joining device is a small state machine with its own
+// deadline, so many joins can be in flight over the one queue.
 // ------------------------------------------------------------------
 // Author:    nlv10677
 // Copyright: NXP B.V. 2014. All rights reserved
@@ -30,6 +32,7 @@
 #include "jsonCreate.h"
 #include "nibbles.h"
 #include "dump.h"
+#include "iotTimer.h"
 #include "commission.h"
 
 // #define COMM_DEBUG
@@ -145,103 +148,229 @@ void zcb_onInteger(char * name, int value) {	//-
 }
 
 // ------------------------------------------------------------------
-// Handle
+// Joins
 // ------------------------------------------------------------------
 
-/**
- * \brief Receives credentials (mac, linkkey) of the device that wants to join, packs that into
- * a JSON request towards the ZCB-JenOS, reads from the joiner queue for the commissioning response,
- * parses that, packs the results in a JSON message, and sends that back to the caller client
- * \param socketHandle Handle to the client socket to which the commissioning result must be sent
- * \param mac Mac of the device that wants to join
- * \param linkkey Link-key of the device that wants to join
- */
-void commission( int socketHandle,
-                 char * mac,
-                 char * linkkey ) {
-    // linkinfoDump();
+#define COMMISSION_MAXJOINS      16
+#define COMMISSION_TIMEOUT_MSEC  2000
 
-    newLogAdd( NEWLOG_FROM_SECURE_JOINER, "Handle authorization request" );
+#define JOIN_FREE                0
+#define JOIN_AUTHORIZING         1      // Authorize request sent, waiting for the ZCB
 
-    int joinerQueue = -1;
-    
-    strtoupper( mac );	//-ĸתΪд
+typedef struct join {
+    int        state;
+    int        socketHandle;            // Client that gets the result
+    char       mac[LEN_AUTH+2];
+    iotTimer_t deadline;
+} join_t;
 
-    // Assemble JSON authorize-message towards coordinator
-    char * message = jsonCmdAuthorizeRequest( mac, linkkey );	//-֯һJSON,׼ͳȥͨѶָ
-    char * response;
+static join_t joins[COMMISSION_MAXJOINS];
+static int    numJoins    = 0;
+static int    joinerQueue = -1;
 
-    // Send message to the ZCB and Wait for response on joiner queue
-    // - First open my own joiner queue (for the answer) and flush it
-    if ( ( joinerQueue = queueOpen( QUEUE_KEY_SECURE_JOINER, 0 ) ) != -1 ) {
-        // printf( "Joiner queue opened\n" );
+static join_t * joinFind( char * mac ) {
+    int i;
+    for ( i=0; i<COMMISSION_MAXJOINS; i++ ) {
+        if ( joins[i].state != JOIN_FREE && strcmp( joins[i].mac, mac ) == 0 ) {
+            return( &joins[i] );
+        }
+    }
+    return( NULL );
+}
+
+static join_t * joinAlloc( void ) {
+    int i;
+    for ( i=0; i<COMMISSION_MAXJOINS; i++ ) {
+        if ( joins[i].state == JOIN_FREE ) return( &joins[i] );
+    }
+    return( NULL );
+}
+
+static void joinFree( join_t * join ) {
+    iotTimerCancel( &join->deadline );
+    join->state = JOIN_FREE;
+    numJoins--;
+}
 
-        int numBytes = 0;
-        char queueInputBuffer[MAXMESSAGESIZE+2];
+/**
+ * \brief Sends the result to the client of a join and ends the join
+ */
+static void joinFinish( join_t * join, char * response ) {
+    socketWrite( join->socketHandle, response, strlen( response ) );	//-׼õϢͨ׽ַͳȥ
+    joinFree( join );
+}
 
-        // Flush the joiner queue
-        while ( queueReadWithMsecTimeout( joinerQueue, queueInputBuffer,
-                                          MAXMESSAGESIZE, 100 ) > 0 ) ;	//-Ϣлȡ
+static void joinTimeout( iotTimer_t * timer, void * arg ) {
+    join_t * join = (join_t *)arg;
 
-        // Send to the ZCB message queue
-        if ( queueWriteOneMessage( QUEUE_KEY_ZCB_IN, message ) ) {//-ضϢд
+    sprintf( logbuffer, "Authorize timeout for %s", join->mac );
+    newLogAdd( NEWLOG_FROM_SECURE_JOINER, logbuffer );
 
-            printf( "Wait for a response on the joiner queue ...\n" );
+    joinFinish( join, jsonError( IOT_ERROR_AUTHORIZE_TIMEOUT ) );
+}
 
-            numBytes = queueReadWithMsecTimeout( joinerQueue,
-                      queueInputBuffer, MAXMESSAGESIZE, 2000 );
+/**
+ * \brief Parses one ZCB authorize response and completes the join it belongs to
+ */
+static void joinHandleResponse( char * message, int len ) {
+    // Parse (ZCB authorize) message
+    jsonSelectNext();	//-лһṹ
+
+    jsonSetOnError(zcb_onError);
+    jsonSetOnObjectStart(zcb_onObjectStart);
+    jsonSetOnObjectComplete(zcb_onObjectComplete);
+    jsonSetOnArrayStart(zcb_onArrayStart);
+    jsonSetOnArrayComplete(zcb_onArrayComplete);
+    jsonSetOnString(zcb_onString);
+    jsonSetOnInteger(zcb_onInteger);	//-յϢֵ֮,Ȼͼ¼
+    jsonReset();
+
+    zcbOk = 0;
+    authorize[0] = '\0';
 
-            if ( numBytes > 0 ) {
+    int i;
+    for ( i=0; i<len; i++ ) {
+        DEBUG_PRINTF( "%c", message[i] );
+        jsonEat( message[i] );	//-ԽյϢнӦ
+    }
 
-                // Parse (ZCB authorize) message
-                jsonSelectNext();	//-лһṹ
+    jsonSelectPrev();
 
-                jsonSetOnError(zcb_onError);
-                jsonSetOnObjectStart(zcb_onObjectStart);
-                jsonSetOnObjectComplete(zcb_onObjectComplete);
-                jsonSetOnArrayStart(zcb_onArrayStart);
-                jsonSetOnArrayComplete(zcb_onArrayComplete);
-                jsonSetOnString(zcb_onString);
-                jsonSetOnInteger(zcb_onInteger);	//-յϢֵ֮,Ȼͼ¼
-                jsonReset();
+    join_t * join = joinFind( authorize );
+    if ( join == NULL ) {
+        // Late (after the deadline) or for a client that left
+        DEBUG_PRINTF( "No join for authorize response %s\n", authorize );
+    } else if ( zcbOk ) {
+        // Assemble JSON join-secure-message towards client
+        joinFinish( join, jsonJoinSecure( channel, keyseq,
+               pan, extpan, nwkey, mic, tcaddress ) );	//-γһָ,ֱӷͨѶ
+    } else {
+        joinFinish( join, jsonError( IOT_ERROR_AUTHORIZE_RESPONSE ) );
+    }
+}
 
-                zcbOk = 0;
+// ------------------------------------------------------------------
+// Handle
+// ------------------------------------------------------------------
 
-                int i;
-                for ( i=0; i<numBytes; i++ ) {
-                    DEBUG_PRINTF( "%c", queueInputBuffer[i] );
-                    jsonEat( queueInputBuffer[i] );	//-ԽյϢнӦ
-                }
+/**
+ * \brief Opens the joiner queue, on which the ZCB-JenOS answers the authorize requests,
+ * and flushes what is left in it
+ * \returns 1 on success, 0 on error
+ */
+int commissionInit( void ) {
+    int i;
+    for ( i=0; i<COMMISSION_MAXJOINS; i++ ) {
+        joins[i].state = JOIN_FREE;
+        iotTimerSet( &joins[i].deadline, joinTimeout, &joins[i] );
+    }
+    numJoins = 0;
 
-                jsonSelectPrev();
+    if ( ( joinerQueue = queueOpen( QUEUE_KEY_SECURE_JOINER, 0 ) ) == -1 ) {
+        printf( "Error opening joiner queue\n" );
+        return( 0 );
+    }
 
-                // Parsing went OK and the response matches the request
-                if ( zcbOk && ( strcmp( mac, authorize ) == 0 ) ) {
+    // Flush the joiner queue (what is in it, without waiting for more)
+    char flushBuffer[QUEUE_BATCH_MAX * ( MAXMESSAGESIZE + 1 )];
+    int  flushLens[QUEUE_BATCH_MAX];
+    while ( queueReadBatch( joinerQueue, flushBuffer, sizeof( flushBuffer ),
+                            flushLens, QUEUE_BATCH_MAX, 0 ) > 0 ) ;
 
-                    // Assemble JSON join-secure-message towards client
-                    response = jsonJoinSecure( channel, keyseq,
-                           pan, extpan, nwkey, mic, tcaddress );	//-γһָ,ֱӷͨѶ
+    return( 1 );
+}
 
-                } else {
-                    response = jsonError( IOT_ERROR_AUTHORIZE_RESPONSE );
-                }
+/**
+ * \brief Receives credentials (mac, linkkey) of the device that wants to join and sends them
+ * as a JSON authorize request towards the ZCB-JenOS, without waiting for the answer: any number
+ * of joins (up to COMMISSION_MAXJOINS) can be in flight. commissionPoll completes them
+ * \param socketHandle Handle to the client socket to which the commissioning result must be sent
+ * \param mac Mac of the device that wants to join
+ * \param linkkey Link-key of the device that wants to join
+ * \returns 1 when the request was sent, 0 on error (the client got an error message then)
+ */
+int commissionStart( int socketHandle,
+                     char * mac,
+                     char * linkkey ) {
+    newLogAdd( NEWLOG_FROM_SECURE_JOINER, "Handle authorization request" );
 
-            } else {
-                // Create timeout error message
-                response = jsonError( IOT_ERROR_AUTHORIZE_TIMEOUT );
-            }
+    strtoupper( mac );	//-ĸתΪд
 
-            // Output the response over the socket to the client
-            socketWrite( socketHandle, response, strlen( response ) );	//-׼õϢͨ׽ַͳȥ
+    if ( joinerQueue == -1 || strlen( mac ) > LEN_AUTH ) {
+        socketWriteString( socketHandle, jsonError( IOT_ERROR_AUTHORIZE_RESPONSE ) );
+        return( 0 );
+    }
 
-        } else {
-            printf( "Error sending authorize to the ZCB queue\n" );
+    // A repeated request for the same device takes over the join in flight
+    join_t * join = joinFind( mac );
+    if ( join != NULL ) {
+        if ( join->socketHandle != socketHandle ) {
+            socketWriteString( join->socketHandle, jsonError( IOT_ERROR_AUTHORIZE_BUSY ) );
         }
+    } else if ( ( join = joinAlloc() ) != NULL ) {
+        strcpy( join->mac, mac );
+        join->state = JOIN_AUTHORIZING;
+        numJoins++;
+    } else {
+        newLogAdd( NEWLOG_FROM_SECURE_JOINER, "Too many joins in flight" );
+        socketWriteString( socketHandle, jsonError( IOT_ERROR_AUTHORIZE_BUSY ) );
+        return( 0 );
+    }
+    join->socketHandle = socketHandle;
 
-        queueClose( joinerQueue );
+    // Assemble JSON authorize-message towards coordinator and send it to the ZCB message queue
+    if ( !queueWriteOneMessage( QUEUE_KEY_ZCB_IN, jsonCmdAuthorizeRequest( mac, linkkey ) ) ) {//-ضϢд
+        printf( "Error sending authorize to the ZCB queue\n" );
+        joinFinish( join, jsonError( IOT_ERROR_AUTHORIZE_RESPONSE ) );
+        return( 0 );
+    }
 
-    } else {
-        printf( "Error opening joiner queue\n" );
+    iotTimerAdd( &join->deadline, COMMISSION_TIMEOUT_MSEC, 0 );
+    return( 1 );
+}
+
+/**
+ * \brief Reads the authorize responses from the joiner queue and completes their joins.
+ * Joins that pass their deadline get a timeout error from the timer wheel (iotTimerRun)
+ * \param msec Wait at most <msec> milli-seconds for a first response, 0 does not wait
+ * \returns Number of joins still in flight
+ */
+int commissionPoll( int msec ) {
+    char queueInputBuffer[QUEUE_BATCH_MAX * ( MAXMESSAGESIZE + 1 )];
+    int  lens[QUEUE_BATCH_MAX];
+    int  num, i;
+
+    if ( joinerQueue == -1 ) return( numJoins );
+
+    while ( ( num = queueReadBatch( joinerQueue, queueInputBuffer, sizeof( queueInputBuffer ),
+                                    lens, QUEUE_BATCH_MAX, msec ) ) > 0 ) {
+        char * message = queueInputBuffer;
+        for ( i=0; i<num; i++ ) {
+            joinHandleResponse( message, lens[i] );
+            message += lens[i] + 1;
+        }
+        msec = 0;
     }
+
+    return( numJoins );
+}
+
+/**
+ * \returns Number of joins in flight
+ */
+int commissionPending( void ) {
+    return( numJoins );
 }
 
+/**
+ * \brief Forgets the joins of a client that disconnected: their answers are dropped
+ * \param socketHandle Handle to the client socket that is about to be closed
+ */
+void commissionDropClient( int socketHandle ) {
+    int i;
+    for ( i=0; i<COMMISSION_MAXJOINS; i++ ) {
+        if ( joins[i].state != JOIN_FREE && joins[i].socketHandle == socketHandle ) {
+            joinFree( &joins[i] );
+        }
+    }
+}
@@ -5,7 +5,11 @@
 // Copyright: NXP B.V. 2014. All rights reserved
 // ------------------------------------------------------------------
 
-void commission( int socketHandle,
-                 char * mac,
-                 char * linkkey );
+int  commissionInit( void );
+int  commissionStart( int socketHandle,
+                      char * mac,
+                      char * linkkey );
+int  commissionPoll( int msec );
+int  commissionPending( void );
+void commissionDropClient( int socketHandle );
 
@@ -21,6 +21,7 @@
 #include <signal.h>
 #include <string.h>
 #include <mqueue.h>
+#include <sys/select.h>
 
 #include "iotError.h"
 #include "parsing.h"
@@ -31,6 +32,7 @@
 #include "newDb.h"
 #include "newLog.h"
 #include "gateway.h"
+#include "iotTimer.h"
 
 #include "linkinfo.h"
 #include "commission.h"
@@ -40,6 +42,9 @@
 
 #define INPUTBUFFERLEN        200
 
+#define SJ_MAXCLIENTS         8
+#define SJ_POLL_MSEC          10    // Joiner queue wait while joins are in flight
+
 // #define MAIN_DEBUG
 
 #ifdef MAIN_DEBUG
@@ -61,6 +66,17 @@ static char socketPort[80];
 
 static int  globalClientSocketHandle;
 
+typedef struct client {
+    int  socketHandle;              // -1 when free
+    int  len;                       // Bytes of the current object in buffer
+    int  depth;
+    int  inString;
+    int  escape;
+    char buffer[INPUTBUFFERLEN + 2];
+} client_t;
+
+static client_t clients[SJ_MAXCLIENTS];
+
 // -------------------------------------------------------------
 // Parsing
 // -------------------------------------------------------------
@@ -76,7 +92,8 @@ static void sj_onObjectStart(char * name) {
 
 /**
  * \brief Object parser: Calls LinkInfo parser in case of a linkinfo object
- * and then starts a commissioning sequence with the ZCB-JenOS.
+ * and then starts a commissioning sequence with the ZCB-JenOS. The answer goes
+ * to the client later, when the ZCB responds or the join's deadline passes.
  */
 static void sj_onObjectComplete(char * name) {
     // printf("onObjectComplete( %s )\n", name);
@@ -84,9 +101,9 @@ static void sj_onObjectComplete(char * name) {
         linkinfo_read = linkinfoHandle();	//-ȡڲ
 
         if ( linkinfo_read != NULL ) {
-            commission( globalClientSocketHandle,
-                        linkinfo_read->mac,
-                        linkinfo_read->linkkey );	//-һ͵ĽսӦ
+            commissionStart( globalClientSocketHandle,
+                             linkinfo_read->mac,
+                             linkinfo_read->linkkey );	//-һ͵ĽսӦ
         }
     }
 }
@@ -110,43 +127,139 @@ static void sj_onInteger(char * name, int value) {
 }
 
 // ------------------------------------------------------------------------
-// Handle client
+// Handle clients
 // ------------------------------------------------------------------------
 
 /**
- * \brief Client child process to parse and handle the JSON commands.
- * \param socketHandle Handle to the client's TCP socket
+ * \brief Frames the input of a client into complete top-level JSON objects,
+ * so that the clients can share the one parser: each object is parsed in one go
+ * \param client Client that sent the data
+ * \param data Data read from the client's socket
+ * \param len Length of the data
  */
+static void handleClientInput( client_t * client, char * data, int len ) {
+    int i;
+    for ( i=0; i<len; i++ ) {
+        char c = data[i];
+
+        if ( client->len >= INPUTBUFFERLEN ) {
+            printf( "Client %d: input too long, discarded\n", client->socketHandle );
+            client->len      = 0;
+            client->depth    = 0;
+            client->inString = 0;
+            client->escape   = 0;
+        }
+        client->buffer[client->len++] = c;
+
+        if ( client->inString ) {
+            if ( client->escape )  client->escape = 0;
+            else if ( c == '\\' )  client->escape = 1;
+            else if ( c == '"' )   client->inString = 0;
+        } else if ( c == '"' ) {
+            client->inString = 1;
+        } else if ( c == '{' ) {
+            client->depth++;
+        } else if ( c == '}' && client->depth > 0 && --client->depth == 0 ) {
+            // Start with clean sheet
+            globalClientSocketHandle = client->socketHandle;
+            iotError      = IOT_ERROR_NONE;
+            linkinfo_read = NULL;
+            jsonReset();
+
+            int j;
+            for ( j=0; j<client->len; j++ ) {
+                jsonEat( client->buffer[j] );	//-յ,Ӧ
+            }
+            client->len = 0;
+        }
+    }
+}
 
-void handleClient( int socketHandle ) {
-    // printf( "Handling client %d\n", socketHandle );
-    globalClientSocketHandle = socketHandle;
+static void clientOpen( int serverSocketHandle ) {
+    int i, socketHandle = socketAccept( serverSocketHandle );
+    if ( socketHandle < 0 ) return;
 
-    // Start with clean sheet
-    iotError = IOT_ERROR_NONE;
-    int ok = 1;
+    for ( i=0; i<SJ_MAXCLIENTS; i++ ) {
+        if ( clients[i].socketHandle < 0 ) {
+            memset( &clients[i], 0, sizeof( client_t ) );
+            clients[i].socketHandle = socketHandle;
+            return;
+        }
+    }
 
-    char socketInputBuffer[INPUTBUFFERLEN + 2];
+    printf( "Too many clients, closing %d\n", socketHandle );
+    socketClose( socketHandle );
+}
 
-    jsonReset();
+static void clientClose( client_t * client ) {
+    int i;
+    // printf( "Closing client %d\n", client->socketHandle );
+    commissionDropClient( client->socketHandle );
+    socketClose( client->socketHandle );
+    client->socketHandle = -1;
 
-    linkinfo_read  = NULL;
+    for ( i=0; i<SJ_MAXCLIENTS; i++ ) {
+        if ( clients[i].socketHandle >= 0 ) return;
+    }
+    checkOpenFiles( 7 );   // STDIN, STDOUT, STDERR, ServerSocket, DB, Timer wheel
+}
 
-    while( ok ) {
-        int len;
-        len = socketRead( socketHandle, socketInputBuffer, INPUTBUFFERLEN ); 
-        if ( len <= 0 ) {//-ϿӾ˳
-            ok = 0;
-        } else {
-            // printf( "Incoming packet, length %d\n", len );
+/**
+ * \brief Serves the clients: waits for new clients, client data and deadlines while
+ * no join is in flight, else only looks at the sockets in between polling the joiner queue
+ * \param serverSocketHandle Handle to the server socket
+ * \param timerFd Timer wheel fd, or -1
+ */
+static void handleClients( int serverSocketHandle, int timerFd ) {
+    char socketInputBuffer[INPUTBUFFERLEN + 2];
+    struct timeval tv, * ptv = NULL;
+    fd_set fds;
+    int i, maxFd = serverSocketHandle;
+
+    if ( commissionPoll( 0 ) > 0 ) {
+        // Joins in flight: answers from the ZCB come first
+        commissionPoll( SJ_POLL_MSEC );
+        tv.tv_sec  = 0;
+        tv.tv_usec = 0;
+        ptv = &tv;
+    }
+
+    FD_ZERO( &fds );
+    FD_SET( serverSocketHandle, &fds );
+    if ( timerFd >= 0 ) {
+        FD_SET( timerFd, &fds );
+        if ( timerFd > maxFd ) maxFd = timerFd;
+    }
+    for ( i=0; i<SJ_MAXCLIENTS; i++ ) {
+        if ( clients[i].socketHandle >= 0 ) {
+            FD_SET( clients[i].socketHandle, &fds );
+            if ( clients[i].socketHandle > maxFd ) maxFd = clients[i].socketHandle;
+        }
+    }
+
+    if ( select( maxFd + 1, &fds, NULL, NULL, ptv ) < 0 ) {
+        if ( errno != EINTR ) perror( "select" );
+        return;
+    }
 
-            int i;
-            for ( i=0; i<len; i++ ) {
-                // printf( "%c", socketInputBuffer[i] );
-                jsonEat( socketInputBuffer[i] );	//-յ,Ӧ
+    // Deadlines of the joins
+    iotTimerRun();
+
+    for ( i=0; i<SJ_MAXCLIENTS; i++ ) {
+        if ( clients[i].socketHandle >= 0 && FD_ISSET( clients[i].socketHandle, &fds ) ) {
+            int len = socketRead( clients[i].socketHandle, socketInputBuffer, INPUTBUFFERLEN );
+            if ( len <= 0 ) {//-ϿӾ˳
+                clientClose( &clients[i] );
+            } else {
+                // printf( "Incoming packet, length %d\n", len );
+                handleClientInput( &clients[i], socketInputBuffer, len );
             }
         }
     }
+
+    if ( FD_ISSET( serverSocketHandle, &fds ) ) {
+        clientOpen( serverSocketHandle );
+    }
 }
 
 // ------------------------------------------------------------------------
@@ -174,7 +287,8 @@ static void vQuitSignalHandler( int sig ) {
 
 /**
  * \brief Secure Joiner's main entry point: initializes the JSON parsers and opens the
- * server socket to wait for clients. The server can handle one client at a time.
+ * server socket to wait for clients. The server handles up to SJ_MAXCLIENTS clients,
+ * with their joins in flight at the same time.
  * \param argc Number of command-line parameters
  * \param argv Parameter list (-h = help, -H <ip> is IP address, -P <port> = TCP port)
  */
@@ -226,15 +340,20 @@ int main( int argc, char * argv[] ) {//-
         printf( "Waiting for clients to serve from socket %s/%s ...\n",
             socketHost, socketPort );
 
+        int i, timerFd = iotTimerInit();
+        for ( i=0; i<SJ_MAXCLIENTS; i++ ) clients[i].socketHandle = -1;
+
+        if ( !commissionInit() ) {
+            newLogAdd( NEWLOG_FROM_SECURE_JOINER, "Error opening joiner queue" );
+        }
+
         while ( running ) {
 
-            int clientSocketHandle = socketAccept( serverSocketHandle );
-            if ( clientSocketHandle >= 0 ) {
-                handleClient( clientSocketHandle );
-                socketClose( clientSocketHandle );
-            }
+            handleClients( serverSocketHandle, timerFd );
+        }
 
-            checkOpenFiles( 6 );   // STDIN, STDOUT, STDERR, ServerSocket, DB
+        for ( i=0; i<SJ_MAXCLIENTS; i++ ) {
+            if ( clients[i].socketHandle >= 0 ) clientClose( &clients[i] );
         }
 
         // printf( "Secure Joiner exit\n");
@@ -46,6 +46,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/signal.h>
 #include <sys/types.h>
 #include <errno.h>
@@ -64,6 +65,8 @@
 #define DEBUG_PRINTF(...)
 #endif /* SERIAL_DEBUG */
 
+#define SERIAL_WRITE_TIMEOUT 100    /* Msec to wait for room in the transmit buffer */
+
 extern int verbosity;
 
 extern volatile sig_atomic_t bRunning;
@@ -300,35 +303,39 @@ teSerial_Status eSerial_ReadBuffer(unsigned char *data, uint32_t *count)
 
 teSerial_Status eSerial_WriteBuffer(unsigned char *data, uint32_t count)
 {
-    int attempts = 0;
-    //printf("send char %d\n", data);
-    int total_sent_bytes = 0, sent_bytes = 0;
+    struct pollfd sPoll;
+    uint32_t total_sent_bytes = 0;
+    int sent_bytes, res;
+    
+    sPoll.fd     = serial_fd;
+    sPoll.events = POLLOUT;
     
     while (total_sent_bytes < count)
     {
         sent_bytes = write(serial_fd, &data[total_sent_bytes], count - total_sent_bytes);
-        if (sent_bytes <= 0)
+        if (sent_bytes > 0)
         {
-            if (errno == EAGAIN)
+            total_sent_bytes += sent_bytes;
+        }
+        else if ((sent_bytes == 0) || (errno == EAGAIN))
+        {
+            /* Driver buffer full: wait until it takes more instead of sleeping */
+            res = poll(&sPoll, 1, SERIAL_WRITE_TIMEOUT);
+            if (res == 0)
             {
-                DEBUG_PRINTF( "Serial Write Error (%s), retrying..\n", strerror(errno));
-                if (++attempts >= 5)
-                {
-                    DEBUG_PRINTF( "Error writing to module(%s)\n", strerror(errno));
-                    return E_SERIAL_ERROR;
-                }
-                IOT_MSLEEP(1);
+                DEBUG_PRINTF( "Error writing to module: no room after %d ms\n", SERIAL_WRITE_TIMEOUT);
+                return E_SERIAL_ERROR;
             }
-            else
+            if ((res < 0) && (errno != EINTR))
             {
-                DEBUG_PRINTF( "Error writing to module(%s)\n", strerror(errno));
-                return -1;
+                DEBUG_PRINTF( "Error waiting for module(%s)\n", strerror(errno));
+                return E_SERIAL_ERROR;
             }
         }
-        else
+        else if (errno != EINTR)
         {
-            attempts = 0;
-            total_sent_bytes += sent_bytes;
+            DEBUG_PRINTF( "Error writing to module(%s)\n", strerror(errno));
+            return E_SERIAL_ERROR;
         }
     }
     return E_SERIAL_OK;
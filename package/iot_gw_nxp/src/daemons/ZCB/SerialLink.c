@@ -45,12 +45,15 @@
 /***        Include files                                                 ***/
 /****************************************************************************/
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -58,6 +61,7 @@
 #include "Serial.h"
 #include "Utils.h"
 #include "iotSleep.h"
+#include "iotStats.h"
 #include "dump.h"
 
 /****************************************************************************/
@@ -76,10 +80,32 @@
 
 #define SL_MAX_MESSAGE_LENGTH 256
 
+/* Room for an escaped frame of a maximum length message: sent with one write */
+#define SL_TX_BUFFER_LENGTH   (2 * (SL_MAX_MESSAGE_LENGTH + 5) + 2)
+
+/* Bytes taken from the serial port per read, may hold several frames */
+#define SL_RX_BUFFER_LENGTH   1024
+
+/* Wait for the Status of a command (ms) */
+#define SL_STATUS_TIMEOUT     500
+
+/* Re-check of command timeouts while idle or while the window is full (ms) */
+#define SL_PENDING_POLL       100
+
 #define SL_MAX_MESSAGE_QUEUES 3
 
 #define SL_MAX_CALLBACK_QUEUES 3
 
+/* Maximum number of callbacks for one message type */
+#define SL_MAX_TYPE_HANDLERS   16
+
+/* Received messages held at a time: being read, waited for, queued for and in a callback.
+ * Beyond that they are taken from the heap */
+#define SL_MESSAGE_POOL_SIZE   16
+
+/* Messages handed to the callback thread at a time, as above */
+#define SL_CALLBACK_POOL_SIZE  16
+
 #if DEBUG_SERIALLINK
 #define DEBUG_PRINTF(...) printf(__VA_ARGS__)
 #else
@@ -108,18 +134,26 @@ typedef enum
 } teSL_RxState;
 
 
-/** Forward definition of callback function entry */
-struct _tsSL_CallbackEntry;
-
-/** Linked list structure for a callback function entry */
-typedef struct _tsSL_CallbackEntry
+/** Callback function entry */
+typedef struct
 {
-    uint16_t                u16Type;        /**< Message type for this callback */
     tprSL_MessageCallback   prCallback;     /**< User supplied callback function for this message type */
     void                    *pvUser;        /**< User supplied data for the callback function */
-    struct _tsSL_CallbackEntry *psNext;     /**< Pointer to next in linked list */
 } tsSL_CallbackEntry;
 
+/** Callbacks of one message type. Never changed once published, updates replace it */
+typedef struct
+{
+    int                     iNum;
+    tsSL_CallbackEntry      asEntry[];
+} tsSL_CallbackList;
+
+/** Page of the dispatch table: callbacks indexed by the LSB of the message type */
+typedef struct
+{
+    tsSL_CallbackList * volatile apsType[256];
+} tsSL_CallbackPage;
+
 
 /** Structure used to contain a message */
 typedef struct
@@ -130,6 +164,81 @@ typedef struct
 } tsSL_Message;
 
 
+/** Link to the next free entry of a pool, starts every pool entry */
+typedef struct
+{
+    volatile uint16_t       u16Next;        /**< Index + 1 of the next free entry, 0 at the end */
+    uint16_t                u16Index;       /**< Index + 1 of this entry, 0 if taken from the heap */
+} tsSL_PoolLink;
+
+
+/** Free list of fixed size entries, taken from and given back without locking */
+typedef struct
+{
+    volatile uint32_t       u32Head;        /**< Index + 1 of the first free entry (bits 0-15) and change count (bits 16-31) */
+    uint8_t                 *pu8Entries;
+    uint32_t                u32Size;        /**< Size of one entry */
+} tsSL_Pool;
+
+
+/** Received message, shared by its waiter and callbacks. Back to the pool with the last reference */
+typedef struct
+{
+    tsSL_PoolLink           sLink;
+    volatile int            iRefCount;
+    uint16_t                u16Dirty;       /**< Bytes of the payload area that may not be zero */
+    tsSL_Message            sMessage;
+} tsSL_Buffer;
+
+
+/** Message handed to the callback handler thread */
+typedef struct
+{
+    tsSL_PoolLink           sLink;
+    tsSL_Buffer             *psBuffer;      /**< The received message, one reference held */
+    tprSL_MessageCallback   prCallback;     /**< User supplied callback function for this message type */
+    void *                  pvUser;         /**< User supplied data for the callback function */
+} tsCallbackThreadData;
+
+
+/** Receive state: bytes read from the serial port and the frame being reassembled from them */
+typedef struct
+{
+    uint8_t                 au8Buffer[SL_RX_BUFFER_LENGTH];
+    uint32_t                u32Length;      /**< Number of bytes in the buffer */
+    uint32_t                u32Position;    /**< Next byte to parse */
+    teSL_RxState            eState;
+    bool                    bInEsc;
+    uint8_t                 u8CRC;
+    uint16_t                u16Bytes;       /**< Payload bytes received */
+    tsSL_Message            sFrame;         /**< Frame being received */
+} tsSL_Receiver;
+
+
+typedef enum
+{
+    E_PENDING_FREE,
+    E_PENDING_CLAIMED,      /**< Slot taken, command not sent yet */
+    E_PENDING_WAITING,      /**< Sent, waiting for its Status message */
+    E_PENDING_DONE,         /**< Completed, to be collected with eSL_SendMessageWait() */
+} teSL_PendingState;
+
+
+/** Command in flight */
+typedef struct
+{
+    teSL_PendingState       eState;
+    uint16_t                u16Type;        /**< Type of the command: its Status message refers to it */
+    uint32_t                u32Order;       /**< Send order. Status messages come in this order */
+    uint32_t                u32Sent;        /**< iotStatsNow() at the write, for IOT_STATS_SL_STATUS */
+    struct timespec         sDeadline;
+    teSL_Status             eStatus;
+    uint8_t                 u8SequenceNo;
+    tprSL_StatusCallback    prCallback;     /**< NULL when collected with eSL_SendMessageWait() */
+    void                    *pvUser;
+} tsSL_Pending;
+
+
 /** Structure of data for the serial link */
 typedef struct
 {
@@ -139,14 +248,42 @@ typedef struct
     pthread_mutex_t         mutex;
 #endif /* WIN32 */
     
+    /* Frame being transmitted, guarded by mutex */
+    struct
+    {
+        uint8_t                 au8Buffer[SL_TX_BUFFER_LENGTH];
+        int                     iLength;
+    } sTx;
+    
+    /* Receive state, used by the reader thread only */
+    tsSL_Receiver           sRx;
+    
+    /* Commands in flight */
     struct
     {
-#ifndef WIN32
         pthread_mutex_t         mutex;
+        pthread_cond_t          cond;       /**< Broadcast when a command completes or a slot frees */
+        uint32_t                u32Order;
+        tsSL_Pending            asCommands[SL_MAX_PENDING];
+    } sPending;
+    
+    /* Dispatch table. The reader thread looks up without locking (RCU style):
+     * updates publish a new list and free the old one once no dispatch uses it */
+    struct
+    {
+#ifndef WIN32
+        pthread_mutex_t         mutex;      /**< Serializes updates */
 #endif /* WIN32 */
-        tsSL_CallbackEntry      *psListHead;
+        tsSL_CallbackPage * volatile apsPage[256];  /**< Indexed by the MSB of the message type */
+        volatile uint32_t       u32Epoch;   /**< Odd while the reader thread looks up */
     } sCallbacks;
     
+    /* Preallocated received messages and callback hand-offs */
+    tsSL_Pool               sBufferPool;
+    tsSL_Buffer             asBuffers[SL_MESSAGE_POOL_SIZE];
+    tsSL_Pool               sCallbackPool;
+    tsCallbackThreadData    asCallbackData[SL_CALLBACK_POOL_SIZE];
+    
     tsUtilsQueue sCallbackQueue;
     tsUtilsThread sCallbackThread;
     
@@ -154,9 +291,9 @@ typedef struct
     // eSL_MessageWait uses this array to wait on incoming messages.
     struct 
     {
-        uint16_t u16Type;
-        uint16_t u16Length;
-        uint8_t *pu8Message;
+        volatile uint16_t u16Type;      /* Read without lock by the reader thread */
+        uint8_t *pu8Message;            /* Status waited for, to match the command type */
+        tsSL_Buffer *psBuffer;          /* Message received, one reference held */
 #ifndef WIN32
         pthread_mutex_t mutex;
         pthread_cond_t cond_data_available;
@@ -170,15 +307,6 @@ typedef struct
 } tsSerialLink;
 
 
-/** Structure allocated and passed to callback handler thread */
-typedef struct
-{
-    tsSL_Message            sMessage;       /** The received message */ 
-    tprSL_MessageCallback   prCallback;     /**< User supplied callback function for this message type */
-    void *                  pvUser;         /**< User supplied data for the callback function */
-} tsCallbackThreadData;
-
-
 
 
 /****************************************************************************/
@@ -188,10 +316,29 @@ typedef struct
 static uint8_t u8SL_CalculateCRC(uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
 
 static int iSL_TxByte(bool bSpecialCharacter, uint8_t u8Data);
+static int iSL_TxFlush(void);
 
-static bool bSL_RxByte(uint8_t *pu8Data);
 
 static teSL_Status eSL_WriteMessage(uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
+
+static void vSL_PoolInit(tsSL_Pool *psPool, void *pvEntries, uint32_t u32Size, uint16_t u16Num);
+static void *pvSL_PoolGet(tsSL_Pool *psPool);
+static void vSL_PoolPut(tsSL_Pool *psPool, void *pvEntry);
+static tsSL_Buffer *psSL_BufferGet(void);
+static void vSL_BufferClear(tsSL_Buffer *psBuffer);
+static tsSL_Buffer *psSL_BufferTake(tsSL_Buffer *psBuffer, bool bLast);
+static void vSL_BufferRelease(tsSL_Buffer *psBuffer);
+static teSL_Status eSL_MessageQueue(tsSerialLink *psSerialLink, tsSL_Buffer *psBuffer, bool bLast);
+
+static void vSL_Deadline(struct timespec *psDeadline, uint32_t u32Timeout);
+static int iSL_PendingExpire(tsSL_Pending *asExpired);
+static void vSL_PendingTimeouts(void);
+static void vSL_PendingCallbacks(tsSL_Pending *asDone, int iNum);
+static bool bSL_PendingComplete(tsSerialLink *psSerialLink, tsSL_Msg_Status *psStatus);
+
+static tsSL_CallbackList * volatile *ppsSL_CallbackSlot(uint16_t u16Type, bool bCreate);
+static void vSL_CallbackPublish(uint16_t u16Type, tsSL_CallbackList *psNew);
+static int iSL_CallbackLookup(uint16_t u16Type, tsSL_CallbackEntry *asEntry);
 static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uint16_t u16MaxLength, uint8_t *pu8Message);
 
 static void *pvReaderThread(tsUtilsThread *psThreadInfo);
@@ -228,9 +375,22 @@ teSL_Status eSL_Init(char *cpSerialDevice, uint32_t u32BaudRate)
     /* Initialise serial link mutex */
     pthread_mutex_init(&sSerialLink.mutex, NULL);
     
+    /* Initialise commands in flight */
+    pthread_mutex_init(&sSerialLink.sPending.mutex, NULL);
+    pthread_cond_init(&sSerialLink.sPending.cond, NULL);
+    for (i = 0; i < SL_MAX_PENDING; i++)
+    {
+        sSerialLink.sPending.asCommands[i].eState = E_PENDING_FREE;
+    }
+    
     /* Initialise message callbacks */
     pthread_mutex_init(&sSerialLink.sCallbacks.mutex, NULL);
-    sSerialLink.sCallbacks.psListHead = NULL;	//-ʼص
+    memset((void *)sSerialLink.sCallbacks.apsPage, 0, sizeof(sSerialLink.sCallbacks.apsPage));
+    sSerialLink.sCallbacks.u32Epoch = 0;
+    
+    /* Initialise message pools */
+    vSL_PoolInit(&sSerialLink.sBufferPool, sSerialLink.asBuffers, sizeof(tsSL_Buffer), SL_MESSAGE_POOL_SIZE);
+    vSL_PoolInit(&sSerialLink.sCallbackPool, sSerialLink.asCallbackData, sizeof(tsCallbackThreadData), SL_CALLBACK_POOL_SIZE);
     
     /* Initialise message wait queue */
     for (i = 0; i < SL_MAX_MESSAGE_QUEUES; i++)	//-ԼάϢ,Ҫı־λ
@@ -238,6 +398,7 @@ teSL_Status eSL_Init(char *cpSerialDevice, uint32_t u32BaudRate)
         pthread_mutex_init(&sSerialLink.asReaderMessageQueue[i].mutex, NULL);
         pthread_cond_init(&sSerialLink.asReaderMessageQueue[i].cond_data_available, NULL);
         sSerialLink.asReaderMessageQueue[i].u16Type = 0;
+        sSerialLink.asReaderMessageQueue[i].psBuffer = NULL;
     }
     
     /* Initialise callback queue */
@@ -269,12 +430,25 @@ teSL_Status eSL_Init(char *cpSerialDevice, uint32_t u32BaudRate)
 
 teSL_Status eSL_Destroy(void)
 {
+    int i, j;
+    
     eUtils_ThreadStop(&sSerialLink.sSerialReader);
 
-    while (sSerialLink.sCallbacks.psListHead)
-    {   
-        eSL_RemoveListener(sSerialLink.sCallbacks.psListHead->u16Type, sSerialLink.sCallbacks.psListHead->prCallback);
+    pthread_mutex_lock(&sSerialLink.sCallbacks.mutex);
+    for (i = 0; i < 256; i++)
+    {
+        tsSL_CallbackPage *psPage = sSerialLink.sCallbacks.apsPage[i];
+        if (psPage)
+        {
+            for (j = 0; j < 256; j++)
+            {
+                free(psPage->apsType[j]);
+            }
+            free(psPage);
+            sSerialLink.sCallbacks.apsPage[i] = NULL;
+        }
     }
+    pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
     
     return E_SL_OK;
 }
@@ -283,65 +457,155 @@ teSL_Status eSL_Destroy(void)
 teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)	//-ֲĶ,ʵϢװ
 {
     teSL_Status eStatus;
+    int iHandle;
+    
+    /* Other threads may have commands in flight meanwhile: the status is matched to this one */
+    eStatus = eSL_SendMessageAsync(u16Type, u16Length, pvMessage, SL_STATUS_TIMEOUT, NULL, NULL, &iHandle);
+    
+    if (eStatus == E_SL_OK)
+    {
+        /* Command sent successfully, expect a status response within 500ms */
+        eStatus = eSL_SendMessageWait(iHandle, pu8SequenceNo);
+        DBG_vPrintf(DBG_SERIALLINK, "Status: %d\n", eStatus);
+    }
+    return eStatus;
+}
+
+
+teSL_Status eSL_SendMessageNoWait(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+{
+    teSL_Status eStatus;
+    uint32_t u32Start = iotStatsNow();
     
     /* Make sure there is only one thread sending messages to the node at a time. */
     pthread_mutex_lock(&sSerialLink.mutex);
+    iotStatsSince(IOT_STATS_SL_LOCK, u32Start);
     
-// printf( "a: 0x%04x - %d\n", u16Type, u16Length );
-// dump( (char *)pvMessage, u16Length );
+//printf( "a: 0x%02x - %d\n", u16Type, u16Length );
+//dump( (char *)pvMessage, u16Length );
+    u32Start = iotStatsNow();
     eStatus = eSL_WriteMessage(u16Type, u16Length, (uint8_t *)pvMessage);
+    iotStatsSince(IOT_STATS_SL_WRITE, u32Start);
     
-    if (eStatus == E_SL_OK)
-    {
+    pthread_mutex_unlock(&sSerialLink.mutex);
 // printf( "b\n" );
-        /* Command sent successfully */
+    return eStatus;
+}
 
-        uint16_t    u16Length;
-        tsSL_Msg_Status sStatus;
-        tsSL_Msg_Status *psStatus = &sStatus;
-        
-        sStatus.u16MessageType = u16Type;
 
-        /* Expect a status response within 500ms */
-        eStatus = eSL_MessageWait(E_SL_MSG_STATUS, 500, &u16Length, (void**)&psStatus);
-// printf( "c\n" );
+teSL_Status eSL_SendMessageAsync(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint32_t u32Timeout,
+                                 tprSL_StatusCallback prCallback, void *pvUser, int *piHandle)
+{
+    tsSL_Pending asExpired[SL_MAX_PENDING];
+    tsSL_Pending *psCommand = NULL;
+    teSL_Status eStatus;
+    uint32_t u32Start;
+    int i, iExpired;
+    
+    /* Claim a slot in the window */
+    while (psCommand == NULL)
+    {
+        pthread_mutex_lock(&sSerialLink.sPending.mutex);
         
-        if (eStatus == E_SL_OK)
+        iExpired = iSL_PendingExpire(asExpired);
+        for (i = 0; i < SL_MAX_PENDING; i++)
         {
-// printf( "d\n" );
-            DBG_vPrintf(DBG_SERIALLINK, "Status: %d, Sequence %d\n", psStatus->eStatus, psStatus->u8SequenceNo);
-            eStatus = psStatus->eStatus;
-            if (eStatus == E_SL_OK)
+            if (sSerialLink.sPending.asCommands[i].eState == E_PENDING_FREE)
             {
-                if (pu8SequenceNo)	//*仰ر𾫲,ܺõķ
-                {
-                    *pu8SequenceNo = psStatus->u8SequenceNo;	//-0x8000Як
-                }
+                psCommand = &sSerialLink.sPending.asCommands[i];
+                psCommand->eState       = E_PENDING_CLAIMED;
+                psCommand->u16Type      = u16Type;
+                psCommand->prCallback   = prCallback;
+                psCommand->pvUser       = pvUser;
+                psCommand->eStatus      = E_SL_NOMESSAGE;
+                psCommand->u8SequenceNo = 0;
+                break;
             }
-            free(psStatus);
-        } else {
-            printf("*** eSL_SendMessage : error 0x%2x\n", eStatus);
         }
+        if ((psCommand == NULL) && (iExpired == 0))
+        {
+            struct timespec sPoll;
+            
+            DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Window full, waiting\n");
+            vSL_Deadline(&sPoll, SL_PENDING_POLL);
+            pthread_cond_timedwait(&sSerialLink.sPending.cond, &sSerialLink.sPending.mutex, &sPoll);
+        }
+        
+        pthread_mutex_unlock(&sSerialLink.sPending.mutex);
+        vSL_PendingCallbacks(asExpired, iExpired);
     }
+    
+    /* Make sure there is only one thread sending messages to the node at a time.
+     * The send order is taken under the same lock, so it is the order on the wire */
+    u32Start = iotStatsNow();
+    pthread_mutex_lock(&sSerialLink.mutex);
+    iotStatsSince(IOT_STATS_SL_LOCK, u32Start);
+    
+    pthread_mutex_lock(&sSerialLink.sPending.mutex);
+    psCommand->u32Order = sSerialLink.sPending.u32Order++;
+    vSL_Deadline(&psCommand->sDeadline, u32Timeout);
+    psCommand->u32Sent  = u32Start = iotStatsNow();
+    psCommand->eState   = E_PENDING_WAITING;
+    pthread_mutex_unlock(&sSerialLink.sPending.mutex);
+    
+    eStatus = eSL_WriteMessage(u16Type, u16Length, (uint8_t *)pvMessage);
+    iotStatsSince(IOT_STATS_SL_WRITE, u32Start);
+    
     pthread_mutex_unlock(&sSerialLink.mutex);
-// printf( "f\n" );
-    return eStatus;
+    
+    if (eStatus != E_SL_OK)
+    {
+        /* Nothing to wait for: release the slot */
+        pthread_mutex_lock(&sSerialLink.sPending.mutex);
+        psCommand->eState = E_PENDING_FREE;
+        pthread_cond_broadcast(&sSerialLink.sPending.cond);
+        pthread_mutex_unlock(&sSerialLink.sPending.mutex);
+        return eStatus;
+    }
+    
+    if (piHandle)
+    {
+        *piHandle = psCommand - sSerialLink.sPending.asCommands;
+    }
+    return E_SL_OK;
 }
 
 
-teSL_Status eSL_SendMessageNoWait(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+teSL_Status eSL_SendMessageWait(int iHandle, uint8_t *pu8SequenceNo)
 {
+    tsSL_Pending *psCommand;
     teSL_Status eStatus;
     
-    /* Make sure there is only one thread sending messages to the node at a time. */
-    pthread_mutex_lock(&sSerialLink.mutex);
+    if ((iHandle < 0) || (iHandle >= SL_MAX_PENDING))
+    {
+        return E_SL_ERROR;
+    }
+    psCommand = &sSerialLink.sPending.asCommands[iHandle];
     
-//printf( "a: 0x%02x - %d\n", u16Type, u16Length );
-//dump( (char *)pvMessage, u16Length );
-    eStatus = eSL_WriteMessage(u16Type, u16Length, (uint8_t *)pvMessage);
+    pthread_mutex_lock(&sSerialLink.sPending.mutex);
+    
+    while (psCommand->eState == E_PENDING_WAITING)
+    {
+        if ((pthread_cond_timedwait(&sSerialLink.sPending.cond, &sSerialLink.sPending.mutex, &psCommand->sDeadline) == ETIMEDOUT) &&
+            (psCommand->eState == E_PENDING_WAITING))
+        {
+            printf("*** eSL_SendMessage : no status for 0x%04x\n", psCommand->u16Type);
+            psCommand->eStatus = E_SL_NOMESSAGE;
+            break;
+        }
+    }
+    
+    eStatus = psCommand->eStatus;
+    if ((eStatus == E_SL_OK) && pu8SequenceNo)
+    {
+        *pu8SequenceNo = psCommand->u8SequenceNo;	//-0x8000 status carries the sequence number
+    }
+    
+    /* Release the slot */
+    psCommand->eState = E_PENDING_FREE;
+    pthread_cond_broadcast(&sSerialLink.sPending.cond);
+    pthread_mutex_unlock(&sSerialLink.sPending.mutex);
     
-    pthread_mutex_unlock(&sSerialLink.mutex);
-// printf( "b\n" );
     return eStatus;
 }
 
@@ -361,6 +625,8 @@ teSL_Status eSL_MessageWait(uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t
         {
             struct timeval sNow;
             struct timespec sTimeout;
+            tsSL_Buffer *psBuffer;
+            int iResult;
             
             DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Found free slot %d to wait for message 0x%04X\n", i, u16Type);
         
@@ -383,34 +649,31 @@ teSL_Status eSL_MessageWait(uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t
             DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Time now    %lu s, %lu ns\n", sNow.tv_sec, sNow.tv_usec * 1000);
             DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Wait until  %lu s, %lu ns\n", sTimeout.tv_sec, sTimeout.tv_nsec);
 
-            switch (pthread_cond_timedwait(&psSerialLink->asReaderMessageQueue[i].cond_data_available, &psSerialLink->asReaderMessageQueue[i].mutex, &sTimeout))
+            do
             {
-                case (0):
-                    DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Got message type 0x%04x, length %d\n", 
-                                psSerialLink->asReaderMessageQueue[i].u16Type, 
-                                psSerialLink->asReaderMessageQueue[i].u16Length);
-                    *pu16Length = psSerialLink->asReaderMessageQueue[i].u16Length;
-                    *ppvMessage = psSerialLink->asReaderMessageQueue[i].pu8Message;
-                    
-                    /* Reset queue for next user */
-                    psSerialLink->asReaderMessageQueue[i].u16Type = 0;
-                    pthread_mutex_unlock(&psSerialLink->asReaderMessageQueue[i].mutex);
-                    return E_SL_OK;
-                
-                case (ETIMEDOUT):
-                    DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Timed out\n");
-                    /* Reset queue for next user */
-                    psSerialLink->asReaderMessageQueue[i].u16Type = 0;
-                    pthread_mutex_unlock(&psSerialLink->asReaderMessageQueue[i].mutex);
-                    return E_SL_NOMESSAGE;
-                    break;
-                
-                default:
-                    /* Reset queue for next user */
-                    psSerialLink->asReaderMessageQueue[i].u16Type = 0;
-                    pthread_mutex_unlock(&psSerialLink->asReaderMessageQueue[i].mutex);
-                    return E_SL_ERROR;
+                iResult = pthread_cond_timedwait(&psSerialLink->asReaderMessageQueue[i].cond_data_available, &psSerialLink->asReaderMessageQueue[i].mutex, &sTimeout);
+                psBuffer = psSerialLink->asReaderMessageQueue[i].psBuffer;
+            } while (!psBuffer && (iResult == 0) && (psSerialLink->sSerialReader.eState == E_THREAD_RUNNING));
+            
+            /* Reset queue for next user. A message that came in as the wait timed out is still taken */
+            psSerialLink->asReaderMessageQueue[i].psBuffer = NULL;
+            psSerialLink->asReaderMessageQueue[i].u16Type = 0;
+            pthread_mutex_unlock(&psSerialLink->asReaderMessageQueue[i].mutex);
+            
+            if (psBuffer)
+            {
+                DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Got message type 0x%04x, length %d\n", 
+                            psBuffer->sMessage.u16Type, psBuffer->sMessage.u16Length);
+                *pu16Length = psBuffer->sMessage.u16Length;
+                *ppvMessage = psBuffer->sMessage.au8Message;
+                return E_SL_OK;
+            }
+            else if (iResult == ETIMEDOUT)
+            {
+                DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Timed out\n");
+                return E_SL_NOMESSAGE;
             }
+            return E_SL_ERROR;
         }
         else
         {
@@ -422,41 +685,53 @@ teSL_Status eSL_MessageWait(uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t
 }
 
 
+void vSL_MessageRelease(void *pvMessage)
+{
+    if (pvMessage)
+    {
+        vSL_BufferRelease((tsSL_Buffer *)((uint8_t *)pvMessage - offsetof(tsSL_Buffer, sMessage.au8Message)));
+    }
+}
+
+
 teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback, void *pvUser)	//-һԪ
 {
-    tsSL_CallbackEntry *psCurrentEntry;
-    tsSL_CallbackEntry *psNewEntry;
+    tsSL_CallbackList *psOld, *psNew;
+    int iNum;
     
     DBG_vPrintf(DBG_SERIALLINK_CB, "Register handler %p for message type 0x%04x\n", prCallback, u16Type);
     
-    psNewEntry = malloc(sizeof(tsSL_CallbackEntry));	//-һڵ
-    if (!psNewEntry)
+    pthread_mutex_lock(&sSerialLink.sCallbacks.mutex);
+    
+    if (!ppsSL_CallbackSlot(u16Type, TRUE))
     {
+        pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
+        return E_SL_ERROR_NOMEM;
+    }
+    psOld = *ppsSL_CallbackSlot(u16Type, FALSE);
+    iNum  = psOld ? psOld->iNum : 0;
+    if (iNum >= SL_MAX_TYPE_HANDLERS)
+    {
+        pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
         return E_SL_ERROR_NOMEM;
     }
-    //-ڵ㸳ֵ
-    psNewEntry->u16Type     = u16Type;
-    psNewEntry->prCallback  = prCallback;
-    psNewEntry->pvUser      = pvUser;
-    psNewEntry->psNext      = NULL;
     
-    pthread_mutex_lock(&sSerialLink.sCallbacks.mutex);
-    if (sSerialLink.sCallbacks.psListHead == NULL)	//-¼ͷ
+    /* New list: the old entries plus the new one at the end */
+    psNew = malloc(sizeof(tsSL_CallbackList) + (iNum + 1) * sizeof(tsSL_CallbackEntry));
+    if (!psNew)
     {
-        /* Insert at start of list */
-        sSerialLink.sCallbacks.psListHead = psNewEntry;
+        pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
+        return E_SL_ERROR_NOMEM;
     }
-    else
+    if (iNum)
     {
-        /* Insert at end of list */
-        psCurrentEntry = sSerialLink.sCallbacks.psListHead;
-        while (psCurrentEntry->psNext)	//-ͷʼֱҵһյĽڵ
-        {
-            psCurrentEntry = psCurrentEntry->psNext;
-        }
-        
-        psCurrentEntry->psNext = psNewEntry;
+        memcpy(psNew->asEntry, psOld->asEntry, iNum * sizeof(tsSL_CallbackEntry));
     }
+    psNew->asEntry[iNum].prCallback = prCallback;
+    psNew->asEntry[iNum].pvUser     = pvUser;
+    psNew->iNum = iNum + 1;
+    
+    vSL_CallbackPublish(u16Type, psNew);
     pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
     return E_SL_OK;
 }
@@ -464,42 +739,47 @@ teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback,
 
 teSL_Status eSL_RemoveListener(uint16_t u16Type, tprSL_MessageCallback prCallback)	//-Ƴһڵܼ,ıָ,ͷſռ
 {
-    tsSL_CallbackEntry *psCurrentEntry;
-    tsSL_CallbackEntry *psOldEntry = NULL;
+    tsSL_CallbackList *psOld, *psNew = NULL;
+    tsSL_CallbackList * volatile *ppsSlot;
+    int i, iFound = -1;
     
     DBG_vPrintf(DBG_SERIALLINK_CB, "Remove handler %p for message type 0x%04x\n", prCallback, u16Type);
     
     pthread_mutex_lock(&sSerialLink.sCallbacks.mutex);
     
-    if (sSerialLink.sCallbacks.psListHead->prCallback == prCallback)
-    {
-        /* Start of the list */
-        psOldEntry = sSerialLink.sCallbacks.psListHead;
-        sSerialLink.sCallbacks.psListHead = psOldEntry->psNext;
-    }
-    else
+    ppsSlot = ppsSL_CallbackSlot(u16Type, FALSE);
+    psOld   = ppsSlot ? *ppsSlot : NULL;
+    for (i = 0; psOld && (i < psOld->iNum); i++)
     {
-        psCurrentEntry = sSerialLink.sCallbacks.psListHead;
-        while (psCurrentEntry->psNext)
+        if (psOld->asEntry[i].prCallback == prCallback)
         {
-            if (psCurrentEntry->psNext->prCallback == prCallback)
-            {
-                psOldEntry = psCurrentEntry->psNext;
-                psCurrentEntry->psNext = psCurrentEntry->psNext->psNext;
-                break;
-            }
+            iFound = i;
+            break;
         }
     }
-    pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
-    
-    if (!psOldEntry)
+    if (iFound < 0)
     {
+        pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
         DBG_vPrintf(DBG_SERIALLINK_CB, "Entry not found\n");
         return E_SL_ERROR;
     }
     
-    /* Free removed entry from list */
-    free(psOldEntry);
+    /* New list without the entry, none when it was the last one */
+    if (psOld->iNum > 1)
+    {
+        psNew = malloc(sizeof(tsSL_CallbackList) + (psOld->iNum - 1) * sizeof(tsSL_CallbackEntry));
+        if (!psNew)
+        {
+            pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
+            return E_SL_ERROR_NOMEM;
+        }
+        memcpy(psNew->asEntry, psOld->asEntry, iFound * sizeof(tsSL_CallbackEntry));
+        memcpy(&psNew->asEntry[iFound], &psOld->asEntry[iFound + 1], (psOld->iNum - iFound - 1) * sizeof(tsSL_CallbackEntry));
+        psNew->iNum = psOld->iNum - 1;
+    }
+    
+    vSL_CallbackPublish(u16Type, psNew);
+    pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
     return E_SL_OK;
 }
 
@@ -511,68 +791,93 @@ teSL_Status eSL_RemoveListener(uint16_t u16Type, tprSL_MessageCallback prCallbac
 //-,û,ôײת,У,ձĽз
 static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uint16_t u16MaxLength, uint8_t *pu8Message)
 {
-
-    static teSL_RxState eRxState = E_STATE_RX_WAIT_START;
-    static uint8_t u8CRC;
+    /* Only the reader thread receives: no locking */
+    tsSL_Receiver *psRx = &sSerialLink.sRx;
     uint8_t u8Data;
-    static uint16_t u16Bytes;
-    static bool bInEsc = FALSE;
 
-    while(bSL_RxByte(&u8Data))	//-"ײ"Ķֽ
+    for (;;)
     {
+        if (psRx->u32Position >= psRx->u32Length)
+        {
+            /* All parsed: read what the port has in one go. A partial frame carries over */
+            uint32_t u32Count = SL_RX_BUFFER_LENGTH;
+            struct pollfd sPoll;
+
+            psRx->u32Position = psRx->u32Length = 0;
+
+            /* Wake up now and then to time out the commands in flight, and to let
+             * the reader thread see that it is being stopped */
+            sPoll.fd     = sSerialLink.iSerialFd;
+            sPoll.events = POLLIN;
+            if (poll(&sPoll, 1, SL_PENDING_POLL) <= 0)
+            {
+                vSL_PendingTimeouts();
+                return E_SL_NOMESSAGE;
+            }
+            if (eSerial_ReadBuffer(psRx->au8Buffer, &u32Count) != E_SERIAL_OK)
+            {
+                return E_SL_NOMESSAGE;
+            }
+            psRx->u32Length = u32Count;
+        }
+        u8Data = psRx->au8Buffer[psRx->u32Position++];
+
         DBG_vPrintf(DBG_SERIALLINK_COMMS, "0x%02x\n", u8Data);
         switch(u8Data)
         {
 
         case SL_START_CHAR:
-            u16Bytes = 0;
-            bInEsc = FALSE;
+            psRx->u16Bytes = 0;
+            psRx->bInEsc = FALSE;
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "RX Start\n");
-            eRxState = E_STATE_RX_WAIT_TYPEMSB;
+            psRx->eState = E_STATE_RX_WAIT_TYPEMSB;
             break;
 
         case SL_ESC_CHAR:
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "Got ESC\n");
-            bInEsc = TRUE;
+            psRx->bInEsc = TRUE;
             break;
 
         case SL_END_CHAR:
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "Got END\n");
             
-            if(*pu16Length > u16MaxLength)
+            if ((psRx->eState != E_STATE_RX_WAIT_DATA) || (psRx->u16Bytes != psRx->sFrame.u16Length))
             {
-                /* Sanity check length before attempting to CRC the message */
-                DBG_vPrintf(DBG_SERIALLINK_COMMS, "Length > MaxLength\n");
-                eRxState = E_STATE_RX_WAIT_START;
+                /* Header or payload incomplete */
+                DBG_vPrintf(DBG_SERIALLINK_COMMS, "Frame incomplete\n");
+                psRx->eState = E_STATE_RX_WAIT_START;
                 break;
             }
+            psRx->eState = E_STATE_RX_WAIT_START;
             
-            if(u8CRC == u8SL_CalculateCRC(*pu16Type, *pu16Length, pu8Message))
+            if(psRx->u8CRC == u8SL_CalculateCRC(psRx->sFrame.u16Type, psRx->sFrame.u16Length, psRx->sFrame.au8Message))
             {
 #if DBG_SERIALLINK
                 int i;
-                DBG_vPrintf(DBG_SERIALLINK, "RX Message type 0x%04x length %d: { ", *pu16Type, *pu16Length);
-                for (i = 0; i < *pu16Length; i++)
+                DBG_vPrintf(DBG_SERIALLINK, "RX Message type 0x%04x length %d: { ", psRx->sFrame.u16Type, psRx->sFrame.u16Length);
+                for (i = 0; i < psRx->sFrame.u16Length; i++)
                 {
-                    printf("0x%02x ", pu8Message[i]);
+                    printf("0x%02x ", psRx->sFrame.au8Message[i]);
                 }
                 printf("}\n");
 #endif /* DBG_SERIALLINK */
                 
-                eRxState = E_STATE_RX_WAIT_START;
+                *pu16Type   = psRx->sFrame.u16Type;
+                *pu16Length = psRx->sFrame.u16Length;
+                memcpy(pu8Message, psRx->sFrame.au8Message, psRx->sFrame.u16Length);
                 return E_SL_OK;
             }
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "CRC BAD\n");
             break;
 
         default:
-            if(bInEsc)
+            if(psRx->bInEsc)
             {
                 u8Data ^= 0x10;
-                bInEsc = FALSE;
+                psRx->bInEsc = FALSE;
             }
 
-            switch(eRxState)
+            switch(psRx->eState)
             {
 
                 case E_STATE_RX_WAIT_START:
@@ -580,59 +885,57 @@ static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uin
                     
 
                 case E_STATE_RX_WAIT_TYPEMSB:
-                    *pu16Type = (uint16_t)u8Data << 8;
-                    eRxState++;
+                    psRx->sFrame.u16Type = (uint16_t)u8Data << 8;
+                    psRx->eState++;
                     break;
 
                 case E_STATE_RX_WAIT_TYPELSB:
-                    *pu16Type += (uint16_t)u8Data;
-                    eRxState++;
+                    psRx->sFrame.u16Type += (uint16_t)u8Data;
+                    psRx->eState++;
                     break;
 
                 case E_STATE_RX_WAIT_LENMSB:
-                    *pu16Length = (uint16_t)u8Data << 8;
-                    eRxState++;
+                    psRx->sFrame.u16Length = (uint16_t)u8Data << 8;
+                    psRx->eState++;
                     break;
 
                 case E_STATE_RX_WAIT_LENLSB:
-                    *pu16Length += (uint16_t)u8Data;
-                    DBG_vPrintf(DBG_SERIALLINK_COMMS, "Length %d\n", *pu16Length);
-                    if(*pu16Length > u16MaxLength)
+                    psRx->sFrame.u16Length += (uint16_t)u8Data;
+                    DBG_vPrintf(DBG_SERIALLINK_COMMS, "Length %d\n", psRx->sFrame.u16Length);
+                    if(psRx->sFrame.u16Length > u16MaxLength)
                     {
                         DBG_vPrintf(DBG_SERIALLINK_COMMS, "Length > MaxLength\n");
-                        eRxState = E_STATE_RX_WAIT_START;
+                        psRx->eState = E_STATE_RX_WAIT_START;
                     }
                     else
                     {
-                        eRxState++;
+                        psRx->eState++;
                     }
                     break;
 
                 case E_STATE_RX_WAIT_CRC:
                     DBG_vPrintf(DBG_SERIALLINK_COMMS, "CRC %02x\n", u8Data);
-                    u8CRC = u8Data;
-                    eRxState++;
+                    psRx->u8CRC = u8Data;
+                    psRx->eState++;
                     break;
 
                 case E_STATE_RX_WAIT_DATA:
-                    if(u16Bytes < *pu16Length)
+                    if(psRx->u16Bytes < psRx->sFrame.u16Length)
                     {
                         DBG_vPrintf(DBG_SERIALLINK_COMMS, "Data\n");
-                        pu8Message[u16Bytes++] = u8Data;
+                        psRx->sFrame.au8Message[psRx->u16Bytes++] = u8Data;
                     }
                     break;
 
                 default:
                     DBG_vPrintf(DBG_SERIALLINK_COMMS, "Unknown state\n");
-                    eRxState = E_STATE_RX_WAIT_START;
+                    psRx->eState = E_STATE_RX_WAIT_START;
             }
             break;
 
         }
 
     }
-
-    return E_SL_NOMESSAGE;
 }
 
 
@@ -669,6 +972,9 @@ static teSL_Status eSL_WriteMessage(uint16_t u16Type, uint16_t u16Length, uint8_
         DEBUG_PRINTF( "%s", acBuffer);
     }
     
+    /* Start a new frame, dropping what an earlier failed one left behind */
+    sSerialLink.sTx.iLength = 0;
+
     /* Send start character */
     if (iSL_TxByte(TRUE, SL_START_CHAR) < 0) return E_SL_ERROR;
 
@@ -692,6 +998,9 @@ static teSL_Status eSL_WriteMessage(uint16_t u16Type, uint16_t u16Length, uint8_
     /* Send end character */
     if (iSL_TxByte(TRUE, SL_END_CHAR) < 0) return E_SL_ERROR;
 
+    /* Hand the frame to the serial port */
+    if (iSL_TxFlush() < 0) return E_SL_ERROR;
+
     return E_SL_OK;
 }
 
@@ -718,65 +1027,218 @@ static uint8_t u8SL_CalculateCRC(uint16_t u16Type, uint16_t u16Length, uint8_t *
 * NAME: vSL_TxByte
 *
 * DESCRIPTION:
+* Add a byte, escaped where needed, to the frame in the transmit buffer
 *
 * PARAMETERS:  Name                RW  Usage
 *
 * RETURNS:
-* void
+* 0 on success, -1 on error
 ****************************************************************************/
 static int iSL_TxByte(bool bSpecialCharacter, uint8_t u8Data)	//-ֽڷ֮ǰַת,һֱһ,ֵѧϰ
 {
+    /* Make sure an escaped byte fits */
+    if ((sSerialLink.sTx.iLength > SL_TX_BUFFER_LENGTH - 2) && (iSL_TxFlush() < 0)) return -1;
+
     if(!bSpecialCharacter && (u8Data < 0x10))
     {
         u8Data ^= 0x10;
 
-        if (eSerial_Write(SL_ESC_CHAR) != E_SERIAL_OK) return -1;
+        sSerialLink.sTx.au8Buffer[sSerialLink.sTx.iLength++] = SL_ESC_CHAR;
         //DBG_vPrintf(DBG_SERIALLINK_COMMS, " 0x%02x", SL_ESC_CHAR);
     }
     //DBG_vPrintf(DBG_SERIALLINK_COMMS, " 0x%02x", u8Data);
 
-    return eSerial_Write(u8Data);
+    sSerialLink.sTx.au8Buffer[sSerialLink.sTx.iLength++] = u8Data;
+    return 0;
 }
 
 
 /****************************************************************************
 *
-* NAME: bSL_RxByte
+* NAME: iSL_TxFlush
 *
 * DESCRIPTION:
+* Write the buffered (part of the) frame to the serial port in one go
 *
 * PARAMETERS:  Name                RW  Usage
 *
 * RETURNS:
-* void
+* 0 on success, -1 on error
 ****************************************************************************/
-static bool bSL_RxByte(uint8_t *pu8Data)
+static int iSL_TxFlush(void)
 {
-    if (eSerial_Read(pu8Data) == E_SERIAL_OK)
+    int iLength = sSerialLink.sTx.iLength;
+
+    sSerialLink.sTx.iLength = 0;
+    if (iLength == 0) return 0;
+
+    return (eSerial_WriteBuffer(sSerialLink.sTx.au8Buffer, iLength) == E_SERIAL_OK) ? 0 : -1;
+}
+
+
+
+/** Set up a free list over <u16Num> entries of <u32Size> bytes at <pvEntries> */
+static void vSL_PoolInit(tsSL_Pool *psPool, void *pvEntries, uint32_t u32Size, uint16_t u16Num)
+{
+    uint16_t i;
+    
+    memset(pvEntries, 0, u32Size * u16Num);
+    psPool->pu8Entries = pvEntries;
+    psPool->u32Size    = u32Size;
+    for (i = 0; i < u16Num; i++)
     {
-        return TRUE;
+        tsSL_PoolLink *psLink = (tsSL_PoolLink *)(psPool->pu8Entries + i * u32Size);
+        
+        psLink->u16Index = i + 1;
+        psLink->u16Next  = (i + 1 < u16Num) ? i + 2 : 0;
     }
-    else
+    psPool->u32Head = (u16Num > 0) ? 1 : 0;
+}
+
+
+/** Take an entry from the pool, or from the heap if the pool is empty.
+ *  \return Pointer to the entry, NULL if out of memory
+ */
+static void *pvSL_PoolGet(tsSL_Pool *psPool)
+{
+    uint32_t u32Head, u32New;
+    tsSL_PoolLink *psLink;
+    
+    do
+    {
+        u32Head = psPool->u32Head;
+        if ((u32Head & 0xFFFF) == 0)
+        {
+            psLink = malloc(psPool->u32Size);
+            if (psLink)
+            {
+                psLink->u16Index = 0;
+            }
+            return psLink;
+        }
+        psLink = (tsSL_PoolLink *)(psPool->pu8Entries + ((u32Head & 0xFFFF) - 1) * psPool->u32Size);
+        
+        /* If another thread took this entry meanwhile, u16Next may be stale: 
+         * the change count in the head then differs and the exchange fails */
+        u32New = ((u32Head + 0x10000) & 0xFFFF0000) | psLink->u16Next;
+    } while (!__sync_bool_compare_and_swap(&psPool->u32Head, u32Head, u32New));
+    
+    return psLink;
+}
+
+
+/** Give an entry taken with pvSL_PoolGet() back */
+static void vSL_PoolPut(tsSL_Pool *psPool, void *pvEntry)
+{
+    tsSL_PoolLink *psLink = (tsSL_PoolLink *)pvEntry;
+    uint32_t u32Head;
+    
+    if (psLink->u16Index == 0)
+    {
+        free(psLink);
+        return;
+    }
+    do
+    {
+        u32Head = psPool->u32Head;
+        psLink->u16Next = u32Head & 0xFFFF;
+    } while (!__sync_bool_compare_and_swap(&psPool->u32Head, u32Head, 
+                                           ((u32Head + 0x10000) & 0xFFFF0000) | psLink->u16Index));
+}
+
+
+/** Take a message buffer, with one reference for the caller.
+ *  \return Pointer to the buffer, NULL if out of memory
+ */
+static tsSL_Buffer *psSL_BufferGet(void)
+{
+    tsSL_Buffer *psBuffer = pvSL_PoolGet(&sSerialLink.sBufferPool);
+    
+    if (psBuffer)
+    {
+        if (psBuffer->sLink.u16Index == 0)
+        {
+            /* From the heap: nothing known to be zero */
+            psBuffer->u16Dirty = SL_MAX_MESSAGE_LENGTH;
+        }
+        psBuffer->iRefCount = 1;
+    }
+    return psBuffer;
+}
+
+
+/** Zero the payload area after the message (handlers may rely on it), as far as an earlier message used it */
+static void vSL_BufferClear(tsSL_Buffer *psBuffer)
+{
+    tsSL_Message *psMessage = &psBuffer->sMessage;
+    
+    if (psBuffer->u16Dirty > psMessage->u16Length)
+    {
+        memset(&psMessage->au8Message[psMessage->u16Length], 0, psBuffer->u16Dirty - psMessage->u16Length);
+    }
+    psBuffer->u16Dirty = psMessage->u16Length;
+}
+
+
+/** Reference to a received message for one of its consumers.
+ *  Handlers convert fields in place, so only the last consumer shares the buffer of the
+ *  reader thread. Earlier ones get a copy, made while the message is still untouched.
+ *  \return Buffer with a reference for the consumer, NULL if out of memory
+ */
+static tsSL_Buffer *psSL_BufferTake(tsSL_Buffer *psBuffer, bool bLast)
+{
+    tsSL_Buffer *psCopy;
+    
+    if (bLast)
+    {
+        __sync_fetch_and_add(&psBuffer->iRefCount, 1);
+        return psBuffer;
+    }
+    
+    psCopy = psSL_BufferGet();
+    if (psCopy)
+    {
+        psCopy->sMessage.u16Type   = psBuffer->sMessage.u16Type;
+        psCopy->sMessage.u16Length = psBuffer->sMessage.u16Length;
+        memcpy(psCopy->sMessage.au8Message, psBuffer->sMessage.au8Message, psBuffer->sMessage.u16Length);
+        vSL_BufferClear(psCopy);
+    }
+    return psCopy;
+}
+
+
+/** Drop a reference to a message buffer, giving it back with the last one */
+static void vSL_BufferRelease(tsSL_Buffer *psBuffer)
+{
+    if (__sync_sub_and_fetch(&psBuffer->iRefCount, 1) == 0)
     {
-        return FALSE;
+        vSL_PoolPut(&sSerialLink.sBufferPool, psBuffer);
     }
 }
 
 
-static teSL_Status eSL_MessageQueue(tsSerialLink *psSerialLink, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Message)	//-жϢ߳
+static teSL_Status eSL_MessageQueue(tsSerialLink *psSerialLink, tsSL_Buffer *psBuffer, bool bLast)	//-жϢ߳
 {
+    uint16_t u16Type = psBuffer->sMessage.u16Type;
     int i;
     for (i = 0; i < SL_MAX_MESSAGE_QUEUES; i++)
     {
+        /* Only lock the slot of a waiter for this type (checked again under the lock) */
+        if (psSerialLink->asReaderMessageQueue[i].u16Type != u16Type)
+        {
+            continue;
+        }
         pthread_mutex_lock(&psSerialLink->asReaderMessageQueue[i].mutex);
 
-        if (psSerialLink->asReaderMessageQueue[i].u16Type == u16Type)	//-߳ҪϢ
+        /* A waiter that has a message already but is not awake yet is left alone */
+        if ((psSerialLink->asReaderMessageQueue[i].u16Type == u16Type) &&
+            (psSerialLink->asReaderMessageQueue[i].psBuffer == NULL))	//-߳ҪϢ
         {
             DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Found listener for message type 0x%04x in slot %d\n", u16Type, i);
             
             if (u16Type == E_SL_MSG_STATUS)	//-жϽյϢʲô,ȻӦ
             {
-                tsSL_Msg_Status *psRxStatus = (tsSL_Msg_Status*)pu8Message;
+                tsSL_Msg_Status *psRxStatus = (tsSL_Msg_Status*)psBuffer->sMessage.au8Message;
                 tsSL_Msg_Status *psWaitStatus = (tsSL_Msg_Status*)psSerialLink->asReaderMessageQueue[i].pu8Message;
                 
                 /* Also check the type of the message that this is status to. */
@@ -793,17 +1255,14 @@ static teSL_Status eSL_MessageQueue(tsSerialLink *psSerialLink, uint16_t u16Type
                 }
             }
             
-            uint8_t  *pu8MessageCopy = malloc(u16Length);	//-ʼٿռ,ѽյϢת,ͷ˿ռ,Ҳں洦
-            if (!pu8MessageCopy)
+            psBuffer = psSL_BufferTake(psBuffer, bLast);
+            if (!psBuffer)
             {
+                pthread_mutex_unlock(&psSerialLink->asReaderMessageQueue[i].mutex);
                 printf( "Memory allocation failure");
                 return E_SL_ERROR_NOMEM;
             }
-            memcpy(pu8MessageCopy, pu8Message, u16Length);
-            
-            
-            psSerialLink->asReaderMessageQueue[i].u16Length = u16Length;
-            psSerialLink->asReaderMessageQueue[i].pu8Message = pu8MessageCopy;
+            psSerialLink->asReaderMessageQueue[i].psBuffer = psBuffer;
 
             /* Signal data available */
             DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Unlocking queue %d mutex\n", i);
@@ -821,11 +1280,207 @@ static teSL_Status eSL_MessageQueue(tsSerialLink *psSerialLink, uint16_t u16Type
 }
 
 
+/** Absolute time <u32Timeout> ms from now, as used by pthread_cond_timedwait() */
+static void vSL_Deadline(struct timespec *psDeadline, uint32_t u32Timeout)
+{
+    struct timeval sNow;
+    
+    gettimeofday(&sNow, NULL);
+    psDeadline->tv_sec  = sNow.tv_sec + (u32Timeout / 1000);
+    psDeadline->tv_nsec = (sNow.tv_usec + ((u32Timeout % 1000) * 1000)) * 1000;
+    if (psDeadline->tv_nsec >= 1000000000)
+    {
+        psDeadline->tv_sec++;
+        psDeadline->tv_nsec -= 1000000000;
+    }
+}
+
+
+/** Time out the commands in flight of which the Status did not come in time.
+ *  Must be called with the pending mutex held. Commands with a completion function
+ *  are freed and copied to <asExpired>, to be called back after unlocking.
+ *  \return Number of commands in <asExpired>
+ */
+static int iSL_PendingExpire(tsSL_Pending *asExpired)
+{
+    struct timeval sNow;
+    int i, iNum = 0;
+    
+    gettimeofday(&sNow, NULL);
+    for (i = 0; i < SL_MAX_PENDING; i++)
+    {
+        tsSL_Pending *psCommand = &sSerialLink.sPending.asCommands[i];
+        
+        if ((psCommand->eState == E_PENDING_WAITING) && psCommand->prCallback &&
+            ((sNow.tv_sec > psCommand->sDeadline.tv_sec) ||
+             ((sNow.tv_sec == psCommand->sDeadline.tv_sec) && (sNow.tv_usec * 1000 >= psCommand->sDeadline.tv_nsec))))
+        {
+            DBG_vPrintf(DBG_SERIALLINK_QUEUE, "No status for 0x%04x\n", psCommand->u16Type);
+            psCommand->eStatus = E_SL_NOMESSAGE;
+            asExpired[iNum++]  = *psCommand;
+            psCommand->eState  = E_PENDING_FREE;
+        }
+    }
+    if (iNum)
+    {
+        pthread_cond_broadcast(&sSerialLink.sPending.cond);
+    }
+    return iNum;
+}
+
+
+static void vSL_PendingTimeouts(void)
+{
+    tsSL_Pending asExpired[SL_MAX_PENDING];
+    int iExpired;
+    
+    pthread_mutex_lock(&sSerialLink.sPending.mutex);
+    iExpired = iSL_PendingExpire(asExpired);
+    pthread_mutex_unlock(&sSerialLink.sPending.mutex);
+    vSL_PendingCallbacks(asExpired, iExpired);
+}
+
+
+static void vSL_PendingCallbacks(tsSL_Pending *asDone, int iNum)
+{
+    int i;
+    for (i = 0; i < iNum; i++)
+    {
+        asDone[i].prCallback(asDone[i].pvUser, asDone[i].eStatus, asDone[i].u8SequenceNo);
+    }
+}
+
+
+/** Give a Status message to the command in flight it belongs to: the oldest one of
+ *  the message type the status refers to.
+ *  \return TRUE if the status completed a command
+ */
+static bool bSL_PendingComplete(tsSerialLink *psSerialLink, tsSL_Msg_Status *psStatus)
+{
+    tsSL_Pending asDone[SL_MAX_PENDING + 1];
+    tsSL_Pending *psCommand = NULL;
+    uint16_t u16Type = ntohs(psStatus->u16MessageType);
+    int i, iNum;
+    
+    pthread_mutex_lock(&psSerialLink->sPending.mutex);
+    
+    for (i = 0; i < SL_MAX_PENDING; i++)
+    {
+        tsSL_Pending *psEntry = &psSerialLink->sPending.asCommands[i];
+        
+        if ((psEntry->eState == E_PENDING_WAITING) && (psEntry->u16Type == u16Type) &&
+            ((psCommand == NULL) || ((int32_t)(psEntry->u32Order - psCommand->u32Order) < 0)))
+        {
+            psCommand = psEntry;
+        }
+    }
+    
+    /* Also time out what is overdue, the reader thread is the one that is always running */
+    iNum = iSL_PendingExpire(asDone);
+    
+    if (psCommand && (psCommand->eState == E_PENDING_WAITING))
+    {
+        DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Status %d, sequence %d for command 0x%04X\n", psStatus->eStatus, psStatus->u8SequenceNo, u16Type);
+        psCommand->eStatus      = psStatus->eStatus;
+        psCommand->u8SequenceNo = psStatus->u8SequenceNo;
+        iotStatsSince(IOT_STATS_SL_STATUS, psCommand->u32Sent);
+        if (psCommand->prCallback)
+        {
+            asDone[iNum++]    = *psCommand;
+            psCommand->eState = E_PENDING_FREE;
+        }
+        else
+        {
+            psCommand->eState = E_PENDING_DONE;
+        }
+        pthread_cond_broadcast(&psSerialLink->sPending.cond);
+    }
+    else
+    {
+        psCommand = NULL;
+    }
+    
+    pthread_mutex_unlock(&psSerialLink->sPending.mutex);
+    vSL_PendingCallbacks(asDone, iNum);
+    
+    return psCommand ? TRUE : FALSE;
+}
+
+
+/** Slot of a message type in the dispatch table. Must be called with the callbacks mutex held.
+ *  \param bCreate  Create the page of the type when it does not exist yet
+ *  \return The slot, or NULL if there is none (or no memory for it)
+ */
+static tsSL_CallbackList * volatile *ppsSL_CallbackSlot(uint16_t u16Type, bool bCreate)
+{
+    tsSL_CallbackPage *psPage = sSerialLink.sCallbacks.apsPage[u16Type >> 8];
+    
+    if (!psPage && bCreate)
+    {
+        psPage = calloc(1, sizeof(tsSL_CallbackPage));
+        if (!psPage)
+        {
+            return NULL;
+        }
+        __sync_synchronize();
+        sSerialLink.sCallbacks.apsPage[u16Type >> 8] = psPage;
+    }
+    return psPage ? &psPage->apsType[u16Type & 0xff] : NULL;
+}
+
+
+/** Replace the callbacks of a message type. Must be called with the callbacks mutex held.
+ *  The old list is freed once the reader thread cannot be using it anymore.
+ */
+static void vSL_CallbackPublish(uint16_t u16Type, tsSL_CallbackList *psNew)
+{
+    tsSL_CallbackList * volatile *ppsSlot = ppsSL_CallbackSlot(u16Type, FALSE);
+    tsSL_CallbackList *psOld = *ppsSlot;
+    uint32_t u32Epoch;
+    
+    __sync_synchronize();
+    *ppsSlot = psNew;
+    __sync_synchronize();
+    
+    /* Grace period: wait for a lookup in progress, which may have the old list */
+    u32Epoch = sSerialLink.sCallbacks.u32Epoch;
+    while ((u32Epoch & 1) && (sSerialLink.sCallbacks.u32Epoch == u32Epoch))
+    {
+        sched_yield();
+    }
+    free(psOld);
+}
+
+
+/** Copy the callbacks of a message type, without locking.
+ *  \return Number of callbacks in <asEntry>
+ */
+static int iSL_CallbackLookup(uint16_t u16Type, tsSL_CallbackEntry *asEntry)
+{
+    tsSL_CallbackPage *psPage;
+    tsSL_CallbackList *psList;
+    int iNum = 0;
+    
+    __sync_fetch_and_add(&sSerialLink.sCallbacks.u32Epoch, 1);
+    psPage = sSerialLink.sCallbacks.apsPage[u16Type >> 8];
+    psList = psPage ? psPage->apsType[u16Type & 0xff] : NULL;
+    if (psList)
+    {
+        iNum = psList->iNum;
+        memcpy(asEntry, psList->asEntry, iNum * sizeof(tsSL_CallbackEntry));
+    }
+    __sync_fetch_and_add(&sSerialLink.sCallbacks.u32Epoch, 1);
+    return iNum;
+}
+
+
 static void *pvReaderThread(tsUtilsThread *psThreadInfo)	//-̻߳һֱڴӴлȡ,Ȼװ,д
 {
     tsSerialLink *psSerialLink = (tsSerialLink *)psThreadInfo->pvThreadData;
-    tsSL_Message  sMessage;
-    int iHandled;
+    tsSL_Buffer   *psBuffer;
+    tsSL_Message  *psMessage;
+    tsSL_CallbackEntry asEntry[SL_MAX_TYPE_HANDLERS];
+    int iHandled, iEntry, iNum;
     
     DBG_vPrintf(DBG_SERIALLINK, "Starting reader thread\n");
     
@@ -833,118 +1488,119 @@ static void *pvReaderThread(tsUtilsThread *psThreadInfo)	//-
 
     while (psThreadInfo->eState == E_THREAD_RUNNING)
     {
-        /* Initialise buffer */
-        memset(&sMessage, 0, sizeof(tsSL_Message));
-        /* Initialise length to large value so CRC is skipped if end received */
-        sMessage.u16Length = 0xFFFF;
+        psBuffer = psSL_BufferGet();
+        if (!psBuffer)
+        {
+            printf( "Memory allocation error");
+            IOT_MSLEEP(SL_PENDING_POLL);
+            continue;
+        }
+        psMessage = &psBuffer->sMessage;
         
-        if (eSL_ReadMessage(&sMessage.u16Type, &sMessage.u16Length, SL_MAX_MESSAGE_LENGTH, sMessage.au8Message) == E_SL_OK)
+        if (eSL_ReadMessage(&psMessage->u16Type, &psMessage->u16Length, SL_MAX_MESSAGE_LENGTH, psMessage->au8Message) == E_SL_OK)
         {//-ǶԻõЧĵĴ,жǷǵȴϢ,߰Ϣݹȥ,ͨеʽʵֵ
+            vSL_BufferClear(psBuffer);
             iHandled = 0;
             
+            // Look up the callback handlers for this message type
+            iNum = iSL_CallbackLookup(psMessage->u16Type, asEntry);
+            
             if (verbosity >= 10)
             {
                 char acBuffer[4096];
                 int iPosition = 0, i;
                 
-                iPosition = sprintf(&acBuffer[iPosition], "Node->Host 0x%04X (Length % 4d)", sMessage.u16Type, sMessage.u16Length);
-                for (i = 0; i < sMessage.u16Length; i++)
+                iPosition = sprintf(&acBuffer[iPosition], "Node->Host 0x%04X (Length % 4d)", psMessage->u16Type, psMessage->u16Length);
+                for (i = 0; i < psMessage->u16Length; i++)
                 {
-                    iPosition += sprintf(&acBuffer[iPosition], " 0x%02X", sMessage.au8Message[i]);
+                    iPosition += sprintf(&acBuffer[iPosition], " 0x%02X", psMessage->au8Message[i]);
                 }
                 DEBUG_PRINTF( "%s", acBuffer);
             }
             
-            if (sMessage.u16Type == E_SL_MSG_LOG)
+            if (psMessage->u16Type == E_SL_MSG_LOG)
             {
                 /* Log messages handled here first, and passsed to new thread in case user has added another handler */
-                sMessage.au8Message[sMessage.u16Length] = '\0';
+                psMessage->au8Message[(psMessage->u16Length < SL_MAX_MESSAGE_LENGTH) ? psMessage->u16Length : SL_MAX_MESSAGE_LENGTH - 1] = '\0';
 #ifdef DEBUG_SERIALLINK
-                uint8_t u8LogLevel = sMessage.au8Message[0];
-                char *pcMessage = (char *)&sMessage.au8Message[1];
+                uint8_t u8LogLevel = psMessage->au8Message[0];
+                char *pcMessage = (char *)&psMessage->au8Message[1];
                 DEBUG_PRINTF( "Module: %s (%d)", pcMessage, u8LogLevel);
 #endif
                 iHandled = 1; /* Message handled by logger */
             }
+            else if ((psMessage->u16Type == E_SL_MSG_STATUS) &&
+                     bSL_PendingComplete(psSerialLink, (tsSL_Msg_Status *)psMessage->au8Message))
+            {
+                DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Status matched a command in flight\n");
+                iHandled = 1;
+            }
             else
             {
-                // See if any threads are waiting for this message
-                int i;
-                for (i = 0; i < 2; i++)
+                // See if any threads are waiting for this message. The callbacks come after it
+                teSL_Status eStatus = eSL_MessageQueue(psSerialLink, psBuffer, iNum == 0);	//-ж,߳
+                if (eStatus == E_SL_OK)
                 {
-                    teSL_Status eStatus = eSL_MessageQueue(psSerialLink, sMessage.u16Type, sMessage.u16Length, sMessage.au8Message);	//-ж,߳
-                    if (eStatus == E_SL_OK)
-                    {
-                        DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Message queued for listener\n");
-                        iHandled = 1;
-                        break;
-                    }
-                    else if (eStatus == E_SL_NOMESSAGE)
-                    {
-                        DBG_vPrintf(DBG_SERIALLINK_QUEUE, "No listener waiting for message type 0x%04X\n", sMessage.u16Type);
-                        break;
-                    }
-                    else
-                    {
-                        DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Error enqueueing message attempt %d\n", i);
-                        /* Wait 200ms before submitting again */
-                        printf( "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n" );
-                        IOT_MSLEEP(200);
-                    }
+                    DBG_vPrintf(DBG_SERIALLINK_QUEUE, "Message queued for listener\n");
+                    iHandled = 1;
+                }
+                else if (eStatus == E_SL_NOMESSAGE)
+                {
+                    DBG_vPrintf(DBG_SERIALLINK_QUEUE, "No listener waiting for message type 0x%04X\n", psMessage->u16Type);
                 }
             }
 
+            for (iEntry = 0; iEntry < iNum; iEntry++)
             {
-                // Search for callback handlers foe this message type
-                tsSL_CallbackEntry *psCurrentEntry;
-                /* Search through list of registered callbacks */
-                pthread_mutex_lock(&psSerialLink->sCallbacks.mutex);
+                tsCallbackThreadData *psCallbackData;
+                DBG_vPrintf(DBG_SERIALLINK_CB, "Found callback routine %p for message 0x%04x\n", asEntry[iEntry].prCallback, psMessage->u16Type);
                 
-                for (psCurrentEntry = psSerialLink->sCallbacks.psListHead; psCurrentEntry; psCurrentEntry = psCurrentEntry->psNext)	//-ڻصбвҶӦĻص
+                // Put the message into the queue for the callback handler thread
+                psCallbackData = pvSL_PoolGet(&psSerialLink->sCallbackPool);
+                if (psCallbackData)
                 {
-                    if (psCurrentEntry->u16Type == sMessage.u16Type)	//-ͬϢӦͬĻص
+                    psCallbackData->psBuffer = psSL_BufferTake(psBuffer, iEntry == iNum - 1);
+                    if (!psCallbackData->psBuffer)
                     {
-                        tsCallbackThreadData *psCallbackData;
-                        DBG_vPrintf(DBG_SERIALLINK_CB, "Found callback routine %p for message 0x%04x\n", psCurrentEntry->prCallback, sMessage.u16Type);
-                        
-                        // Put the message into the queue for the callback handler thread
-                        psCallbackData = malloc(sizeof(tsCallbackThreadData));
-                        if (!psCallbackData)
-                        {
-                            printf( "Memory allocation error");
-                        }
-                        else
-                        {
-                            memcpy(&psCallbackData->sMessage, &sMessage, sizeof(tsSL_Message));	//-ѽյϢת
-                            psCallbackData->prCallback = psCurrentEntry->prCallback;	//-ضϢӦضĻص
-                            psCallbackData->pvUser = psCurrentEntry->pvUser;
-                            
-                            if (eUtils_QueueQueue(&psSerialLink->sCallbackQueue, psCallbackData) == E_UTILS_OK)	//-ѽյѹ뵽˶,ȴ
-                            {
-                                iHandled = 1;
-                            }
-                            else
-                            {
-                                DEBUG_PRINTF( "Failed to queue message for callback");
-                                free(psCallbackData);
-                            }
-                        }
+                        vSL_PoolPut(&psSerialLink->sCallbackPool, psCallbackData);
+                        psCallbackData = NULL;
+                    }
+                }
+                if (!psCallbackData)
+                {
+                    printf( "Memory allocation error");
+                }
+                else
+                {
+                    psCallbackData->prCallback = asEntry[iEntry].prCallback;
+                    psCallbackData->pvUser = asEntry[iEntry].pvUser;
+                    
+                    if (eUtils_QueueQueue(&psSerialLink->sCallbackQueue, psCallbackData) == E_UTILS_OK)
+                    {
+                        iHandled = 1;
+                    }
+                    else
+                    {
+                        DEBUG_PRINTF( "Failed to queue message for callback");
+                        vSL_BufferRelease(psCallbackData->psBuffer);
+                        vSL_PoolPut(&psSerialLink->sCallbackPool, psCallbackData);
                     }
                 }
-                pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
             }
             if (!iHandled)
             {
-                DEBUG_PRINTF( "Message 0x%04X was not handled", sMessage.u16Type);
+                DEBUG_PRINTF( "Message 0x%04X was not handled", psMessage->u16Type);
             }
         }
+        
+        /* The consumers hold their own references */
+        vSL_BufferRelease(psBuffer);
     }
     
     {
         int i;
         for (i = 0; i < SL_MAX_MESSAGE_QUEUES; i++)
         {
-            psSerialLink->asReaderMessageQueue[i].u16Length  = 0;
             psSerialLink->asReaderMessageQueue[i].pu8Message = NULL;
             //-溯еȴcondָ߳̽óɹ0򷵻ش롣
             pthread_cond_broadcast(&psSerialLink->asReaderMessageQueue[i].cond_data_available);
@@ -976,11 +1632,12 @@ static void *pvCallbackHandlerThread(tsUtilsThread *psThreadInfo)	//-һֱ
         if (stat == E_UTILS_OK)
         {
             DBG_vPrintf(DBG_SERIALLINK_CB, "++++++++++++++++++++++ Calling callback\n" );   // RH
-            DBG_vPrintf(DBG_SERIALLINK_CB, "Calling callback %p for message 0x%04X\n", psCallbackData->prCallback, psCallbackData->sMessage.u16Type);
+            DBG_vPrintf(DBG_SERIALLINK_CB, "Calling callback %p for message 0x%04X\n", psCallbackData->prCallback, psCallbackData->psBuffer->sMessage.u16Type);
             //-ɹӶлȡ֮Ϳʼ,Ԥ趨˺ܶص,ľ֮,Ҫ޸Ŀ,ӻصͿʵûеĹ
-            psCallbackData->prCallback(psCallbackData->pvUser, psCallbackData->sMessage.u16Length, psCallbackData->sMessage.au8Message);
+            psCallbackData->prCallback(psCallbackData->pvUser, psCallbackData->psBuffer->sMessage.u16Length, psCallbackData->psBuffer->sMessage.au8Message);
             
-            free(psCallbackData);	//-ͷϢռ
+            vSL_BufferRelease(psCallbackData->psBuffer);
+            vSL_PoolPut(&psSerialLink->sCallbackPool, psCallbackData);	//-ͷϢռ
             DBG_vPrintf(DBG_SERIALLINK_CB, "++++++++++++++++++++++ Callback ready\n" );   // RH
         } else if ( stat == E_UTILS_ERROR_TIMEOUT ) {
             // printf( "CB heartbeat\n" );
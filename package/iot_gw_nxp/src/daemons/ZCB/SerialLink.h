@@ -58,6 +58,9 @@ extern "C" {
 
 #define PACKED __attribute__((__packed__))
 
+/** Maximum number of commands in flight, see eSL_SendMessageAsync() */
+#define SL_MAX_PENDING  8
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -330,6 +333,17 @@ typedef struct
 typedef void (*tprSL_MessageCallback)(void *pvUser, uint16_t u16Length, void *pvMessage);
 
 
+/** Completion function for a command sent with eSL_SendMessageAsync()
+ *  It is called in the context of the serial reader thread (or of a sending thread
+ *  for a command that timed out), so it should return quickly and not send commands itself.
+ *  \param pvUser           User supplied pointer to be passed to the completion function
+ *  \param eStatus          Status of the command, E_SL_NOMESSAGE if no status came in time
+ *  \param u8SequenceNo     Outgoing sequence number of the command
+ *  \return Nothing
+ */
+typedef void (*tprSL_StatusCallback)(void *pvUser, teSL_Status eStatus, uint8_t u8SequenceNo);
+
+
 
 /****************************************************************************/
 /***        Local Function Prototypes                                     ***/
@@ -365,18 +379,50 @@ teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessag
 teSL_Status eSL_SendMessageNoWait(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo);
 
 
+/** Send a command message to the serial device without waiting for its Status message.
+ *  Up to SL_MAX_PENDING commands can be in flight; Status messages are matched to them
+ *  by message type, in the order the commands were sent.
+ *  When the window is full, this waits until a command completes.
+ *  \param u16Type          Type of message to send
+ *  \param u16Length        Message length
+ *  \param pvMessage        Message data buffer
+ *  \param u32Timeout       Maximum time to wait for the Status message (ms)
+ *  \param prCallback       Completion function, or NULL to collect the status with eSL_SendMessageWait().
+ *                          A timed out command is completed within 100ms after its timeout.
+ *  \param pvUser           User supplied pointer to be passed to the completion function
+ *  \param piHandle         Pointer to location to receive the handle for eSL_SendMessageWait(). May be NULL with a callback.
+ *  \return E_SL_OK if the command was sent
+ */
+teSL_Status eSL_SendMessageAsync(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint32_t u32Timeout,
+                                 tprSL_StatusCallback prCallback, void *pvUser, int *piHandle);
+
+
+/** Wait for the Status message of a command sent with eSL_SendMessageAsync() without completion function.
+ *  \param iHandle          Handle returned by eSL_SendMessageAsync()
+ *  \param pu8SequenceNo    Pointer to location to receive the outgoing sequence number. May be NULL if no sequence expected.
+ *  \return The status for the message, or E_SL_NOMESSAGE if none came in time
+ */
+teSL_Status eSL_SendMessageWait(int iHandle, uint8_t *pu8SequenceNo);
+
+
 /** Wait for a message of the given type to be received from the serial device
  *  \param u16Type          Type of message to wait for
  *  \param u32WaitTimeout   Maximum time to wait for messages (ms)
  *  \param pu16Length       Pointer to location to receive message length
  *  \param ppvMessage       Pointer to location to receive a pointer to the message buffer
  *                          Once a message buffer has been returned, the calling function 
- *                          has the responsibility of freeing the buffer,
+ *                          has the responsibility of releasing it with vSL_MessageRelease()
  *  \return E_SL_OK on success
  */
 teSL_Status eSL_MessageWait(uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t *pu16Length, void **ppvMessage);
 
 
+/** Give back a message buffer returned by eSL_MessageWait() to the preallocated pool.
+ *  \param pvMessage        Message buffer, may be NULL
+ */
+void vSL_MessageRelease(void *pvMessage);
+
+
 /** Add a callback function for a particular message type
  *  The callback function will be called in the context of a new thread that exists 
  *  only to service the incoming message and will subsequently be destroyed.
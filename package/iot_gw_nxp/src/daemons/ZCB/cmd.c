@@ -353,7 +353,7 @@ int cmdHandle( void ) {//-
             
                 if (eStatus == E_SL_OK) {
                     eStatus = psStatus->eStatus;
-                    free(psStatus);
+                    vSL_MessageRelease(psStatus);
                 } else {            
                     return E_ZCB_COMMS_FAILED;
                 }
@@ -17,6 +17,7 @@
 #include "zcb.h"
 #include "lmpgrp.h"
 #include "SerialLink.h"
+#include "newDb.h"
 
 #include "nibbles.h"
 #include "jsonCreate.h"
@@ -31,9 +32,11 @@
 #define NUMINTATTRS  5
 static char * intAttrs[NUMINTATTRS] = { "lvl", "xcr", "ycr", "grpid", "scnid" };
 
-#define NUMSTRINGATTRS  2
-static char * stringAttrs[NUMSTRINGATTRS]   = { "cmd", "scn" };
-static int    stringMaxlens[NUMSTRINGATTRS] = {   6,    8 };
+#define GRP_LAMPS_MAXLEN  120   // Comma separated device ids
+
+#define NUMSTRINGATTRS  3
+static char * stringAttrs[NUMSTRINGATTRS]   = { "cmd", "scn", "lamps" };
+static int    stringMaxlens[NUMSTRINGATTRS] = {   6,    8,    GRP_LAMPS_MAXLEN };
 
 // ------------------------------------------------------------------
 // Functions
@@ -68,6 +71,78 @@ void grpDump ( void ) {
 // Handle
 // ------------------------------------------------------------------
 
+/**
+ * \brief Sends the on/off, level and color of the message to a group (u16ShortAddress 0xFFFF)
+ * or to one lamp
+ */
+
+static void grpLampCommand( uint16_t u16ShortAddress, uint16_t u16GroupAddress ) {
+    char * cmd = parsingGetStringAttr0( "cmd" );
+    if ( cmd ) {
+        // on, off
+        printf( "Group cmd %s\n", cmd );
+        if ( strcmp( cmd, "on" ) == 0 ) {
+            lmpgrp_OnOff( u16ShortAddress, u16GroupAddress, 1 );
+        } else if ( strcmp( cmd, "off" ) == 0 ) {
+            lmpgrp_OnOff( u16ShortAddress, u16GroupAddress, 0 );
+        }
+    }
+
+    int lvl = parsingGetIntAttr( "lvl" );
+    if ( lvl >= 0 ) {
+        printf( "Group level %d\n", lvl );
+        
+        // In JSON we specify level from 0-100
+        // In Zigbee, however, level has to be specified from 0-255
+        lvl = ( lvl * 255 ) / 100;
+        lmpgrp_MoveToLevel( u16ShortAddress, u16GroupAddress, lvl, 5 );
+    }
+
+    int xcr = parsingGetIntAttr( "xcr" );
+    int ycr = parsingGetIntAttr( "ycr" );
+    if ( xcr >= 0 && ycr >= 0 ) {
+        printf( "Group color %d, %d\n", xcr, ycr );
+        lmpgrp_MoveToColour( u16ShortAddress, u16GroupAddress, xcr, ycr, 5 );
+    }
+}
+
+/**
+ * \brief Command to a set of lamps: one groupcast to a group that holds exactly these
+ * lamps (see lmpgrpPlan), or one unicast per lamp when no such group can be made
+ * \param lamps Comma separated device ids
+ */
+
+static void grpHandleLamps( char * lamps ) {
+    char list[GRP_LAMPS_MAXLEN+2];
+    char macs[NEWDB_GROUP_MEMBERS][LEN_MAC_NIBBLE+2];
+    char * pmacs[NEWDB_GROUP_MEMBERS];
+    char * id;
+    int i, num = 0;
+    newdb_dev_t device;
+
+    newDbStrNcpy( list, lamps, GRP_LAMPS_MAXLEN );
+    for ( id = strtok( list, ", " ); id != NULL && num < NEWDB_GROUP_MEMBERS;
+          id = strtok( NULL, ", " ) ) {
+        if ( newDbGetDeviceId( atoi( id ), &device ) && device.dev == DEVICE_DEV_LAMP ) {
+            newDbStrNcpy( macs[num], device.mac, LEN_MAC_NIBBLE );
+            pmacs[num] = macs[num];
+            num++;
+        }
+    }
+
+    int gid = lmpgrpPlan( pmacs, num );
+    if ( gid >= 0 ) {
+        grpLampCommand( 0xFFFF, gid );
+    } else {
+        for ( i=0; i<num; i++ ) {
+            uint16_t u16ShortAddress = zcbNodeGetShortAddress( pmacs[i] );
+            if ( u16ShortAddress != 0xFFFF ) {
+                grpLampCommand( u16ShortAddress, 0 );
+            }
+        }
+    }
+}
+
 /**
  * \brief JSON Parser for group/scene commands, which are typically sent to Zigbee lamps
  */
@@ -75,21 +150,18 @@ void grpDump ( void ) {
 void grpHandle( void ) {
     grpDump();
 
+    char * lamps = parsingGetStringAttr0( "lamps" );
+    if ( lamps ) {
+        grpHandleLamps( lamps );
+        return;
+    }
+
     int gid = parsingGetIntAttr( "grpid" );
     if ( gid >= 0 ) {
 
-        char * cmd = parsingGetStringAttr0( "cmd" );
         char * scn = parsingGetStringAttr0( "scn" );
 
-        if ( cmd ) {
-            // on, off
-            printf( "Group cmd %s\n", cmd );
-            if ( strcmp( cmd, "on" ) == 0 ) {
-                lmpgrp_OnOff( 0xFFFF, gid, 1 );
-            } else if ( strcmp( cmd, "off" ) == 0 ) {
-                lmpgrp_OnOff( 0xFFFF, gid, 0 );
-            }
-        }
+        grpLampCommand( 0xFFFF, gid );
 
         if ( scn ) {
             // recall <sid>, remall
@@ -101,26 +173,11 @@ void grpHandle( void ) {
                 }
             } else if ( strcmp( scn, "remall" ) == 0 ) {
                 printf( "Group scn %s\n", scn );
-                eZCB_RemoveAllScenes( 0xFFFF, gid );
+                if ( eZCB_RemoveAllScenes( 0xFFFF, gid ) == E_ZCB_OK ) {
+                    lmpgrpCacheScene( gid, -1, 0 );
+                }
             }
         }
-
-        int lvl = parsingGetIntAttr( "lvl" );
-        if ( lvl >= 0 ) {
-            printf( "Group level %d\n", lvl );
-            
-            // In JSON we specify level from 0-100
-            // In Zigbee, however, level has to be specified from 0-255
-            lvl = ( lvl * 255 ) / 100;
-            lmpgrp_MoveToLevel( 0xFFFF, gid, lvl, 5 );
-        }
-
-        int xcr = parsingGetIntAttr( "xcr" );
-        int ycr = parsingGetIntAttr( "ycr" );
-        if ( xcr >= 0 && ycr >= 0 ) {
-            printf( "Group color %d, %d\n", xcr, ycr );
-            lmpgrp_MoveToColour( 0xFFFF, gid, xcr, ycr, 5 );
-        }
     }
 }
 
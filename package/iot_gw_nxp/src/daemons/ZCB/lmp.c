@@ -16,6 +16,7 @@
 
 #include "zcb.h"
 #include "lmpgrp.h"
+#include "newDb.h"
 
 #include "nibbles.h"
 #include "jsonCreate.h"
@@ -134,13 +135,19 @@ void lmpHandle( void ) {
 
                 if ( strcmp( grp, "remall" ) == 0 ) {
                     DEBUG_PRINTF( "Lamp group remall\n" );
-                    eZCB_ClearGroupMemberships( u16ShortAddress );
+                    if ( eZCB_ClearGroupMemberships( u16ShortAddress ) == E_ZCB_OK ) {
+                        newDbGroupsRemoveMember( mac );
+                    }
                 } else if ( gid >= 0 ) {
                     DEBUG_PRINTF( "Lamp group %s %d\n", grp, gid );
                     if ( strcmp( grp, "add" ) == 0 ) {
-                        eZCB_AddGroupMembership( u16ShortAddress, gid );
+                        if ( eZCB_AddGroupMembership( u16ShortAddress, gid ) == E_ZCB_OK ) {
+                            lmpgrpCacheMember( mac, gid, 1 );
+                        }
                     } else if ( strcmp( grp, "rem" ) == 0 ) {
-                        eZCB_RemoveGroupMembership( u16ShortAddress, gid );
+                        if ( eZCB_RemoveGroupMembership( u16ShortAddress, gid ) == E_ZCB_OK ) {
+                            lmpgrpCacheMember( mac, gid, 0 );
+                        }
                     }
                 }
             }
@@ -154,18 +161,21 @@ void lmpHandle( void ) {
                 if ( gid >= 0 ) {
                     if ( strcmp( scn, "remall" ) == 0 ) {
                         DEBUG_PRINTF( "Scene: remove all for group 0x%04x\n", gid );
-                        eZCB_RemoveAllScenes( u16ShortAddress, gid );
+                        if ( eZCB_RemoveAllScenes( u16ShortAddress, gid ) == E_ZCB_OK ) {
+                            lmpgrpCacheScene( gid, -1, 0 );
+                        }
                     } else if ( sid >= 0 ) {
-                        if ( strcmp( scn, "add" ) == 0 ) {
-                            DEBUG_PRINTF( "Scene: add scene %d for group 0x%04x\n", sid, gid );
-                            // Same effect as Store-Scene
-                            eZCB_StoreScene( u16ShortAddress, gid, sid );
+                        if ( strcmp( scn, "add" ) == 0 || strcmp( scn, "store" ) == 0 ) {
+                            // Add has the same effect as Store-Scene
+                            DEBUG_PRINTF( "Scene: %s scene %d for group 0x%04x\n", scn, sid, gid );
+                            if ( eZCB_StoreScene( u16ShortAddress, gid, sid ) == E_ZCB_OK ) {
+                                lmpgrpCacheScene( gid, sid, 1 );
+                            }
                         } else if ( strcmp( scn, "rem" ) == 0 ) {
                             DEBUG_PRINTF( "Scene: remove scene %d for group 0x%04x\n", sid, gid );
-                            eZCB_RemoveScene( u16ShortAddress, gid, sid );
-                        } else if ( strcmp( scn, "store" ) == 0 ) {
-                            DEBUG_PRINTF( "Scene: store scene %d for group 0x%04x\n", sid, gid );
-                            eZCB_StoreScene( u16ShortAddress, gid, sid );
+                            if ( eZCB_RemoveScene( u16ShortAddress, gid, sid ) == E_ZCB_OK ) {
+                                lmpgrpCacheScene( gid, sid, 0 );
+                            }
                         } else if ( strcmp( scn, "recall" ) == 0 ) {
                             DEBUG_PRINTF( "Scene: recall scene %d for group 0x%04x\n", sid, gid );
                             eZCB_RecallScene( u16ShortAddress, gid, sid );
@@ -10,8 +10,14 @@
  * \brief Lamp/group helpers
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
 #include "zcb.h"
 #include "SerialLink.h"
+#include "newDb.h"
+#include "lmpgrp.h"
 
 // ------------------------------------------------------------------
 // Macros
@@ -25,6 +31,11 @@
 #define DEBUG_PRINTF(...)
 #endif /* LMPGRP_DEBUG */
 
+#define LMPGRP_STATUS_TIMEOUT  500   // Msec
+
+#define LMPGRP_PLAN_FIRST      0xF000   // Group addresses that the planner hands out
+#define LMPGRP_PLAN_LAST       0xF0FF
+
 // ------------------------------------------------------------------
 // Message helper
 // ------------------------------------------------------------------
@@ -54,13 +65,26 @@ static void initDefaultHeader( void * mess,
     }
 }
 
+static void lmpgrpStatus( void * pvUser, teSL_Status eStatus, uint8_t u8SequenceNo ) {
+    if ( eStatus != E_SL_OK ) {
+        printf( "Lamp command 0x%04x failed (%d)\n", (int)(intptr_t)pvUser, eStatus );
+    }
+}
+
+/**
+ * \brief Sends a lamp command without waiting for its status, so commands to
+ * several lamps overlap. Failures are reported by lmpgrpStatus()
+ */
+static teSL_Status lmpgrpSend( uint16_t u16Type, uint16_t u16Length, void * pvMessage ) {
+    return eSL_SendMessageAsync( u16Type, u16Length, pvMessage, LMPGRP_STATUS_TIMEOUT,
+                                 lmpgrpStatus, (void *)(intptr_t)u16Type, NULL );
+}
+
 // ------------------------------------------------------------------
 // Exported Functions
 // ------------------------------------------------------------------
 
 teZcbStatus lmpgrp_OnOff(uint16_t u16ShortAddress, uint16_t u16GroupAddress, uint8_t u8Mode) {
-    uint8_t u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -81,7 +105,7 @@ teZcbStatus lmpgrp_OnOff(uint16_t u16ShortAddress, uint16_t u16GroupAddress, uin
 
     sOnOffMessage.u8Mode = u8Mode;
     
-    if (eSL_SendMessage(E_SL_MSG_ONOFF, sizeof(sOnOffMessage), &sOnOffMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_ONOFF, sizeof(sOnOffMessage), &sOnOffMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -91,8 +115,6 @@ teZcbStatus lmpgrp_OnOff(uint16_t u16ShortAddress, uint16_t u16GroupAddress, uin
 
 teZcbStatus lmpgrp_MoveToLevel(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                                uint8_t u8Level, uint16_t u16TransitionTime) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -116,8 +138,8 @@ teZcbStatus lmpgrp_MoveToLevel(uint16_t u16ShortAddress, uint16_t u16GroupAddres
     sLevelMessage.u8Level               = u8Level;
     sLevelMessage.u16TransitionTime     = htons(u16TransitionTime);
     
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_LEVEL_ONOFF, sizeof(sLevelMessage),
-                  &sLevelMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_TO_LEVEL_ONOFF, sizeof(sLevelMessage),
+                  &sLevelMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -127,8 +149,6 @@ teZcbStatus lmpgrp_MoveToLevel(uint16_t u16ShortAddress, uint16_t u16GroupAddres
 
 teZcbStatus lmpgrp_MoveToHue(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                              uint8_t u8Hue, uint16_t u16TransitionTime) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -148,8 +168,8 @@ teZcbStatus lmpgrp_MoveToHue(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
     sMoveToHueMessage.u8Direction         = 0;
     sMoveToHueMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_HUE, sizeof(sMoveToHueMessage),
-              &sMoveToHueMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_TO_HUE, sizeof(sMoveToHueMessage),
+              &sMoveToHueMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -159,8 +179,6 @@ teZcbStatus lmpgrp_MoveToHue(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
 
 teZcbStatus lmpgrp_MoveToSaturation(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                                     uint8_t u8Saturation, uint16_t u16TransitionTime) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -178,8 +196,8 @@ teZcbStatus lmpgrp_MoveToSaturation(uint16_t u16ShortAddress, uint16_t u16GroupA
     sMoveToSaturationMessage.u8Saturation        = u8Saturation;
     sMoveToSaturationMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_SATURATION, sizeof(sMoveToSaturationMessage),
-             &sMoveToSaturationMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_TO_SATURATION, sizeof(sMoveToSaturationMessage),
+             &sMoveToSaturationMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -190,8 +208,6 @@ teZcbStatus lmpgrp_MoveToSaturation(uint16_t u16ShortAddress, uint16_t u16GroupA
 
 teZcbStatus lmpgrp_MoveToHueSaturation(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                       uint8_t u8Hue, uint8_t u8Saturation, uint16_t u16TransitionTime) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -211,8 +227,8 @@ teZcbStatus lmpgrp_MoveToHueSaturation(uint16_t u16ShortAddress, uint16_t u16Gro
     sMoveToHueSaturationMessage.u8Saturation        = u8Saturation;
     sMoveToHueSaturationMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_HUE_SATURATION, sizeof(sMoveToHueSaturationMessage),
-             &sMoveToHueSaturationMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_TO_HUE_SATURATION, sizeof(sMoveToHueSaturationMessage),
+             &sMoveToHueSaturationMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -222,8 +238,6 @@ teZcbStatus lmpgrp_MoveToHueSaturation(uint16_t u16ShortAddress, uint16_t u16Gro
 
 teZcbStatus lmpgrp_MoveToColour(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                                 uint16_t u16X, uint16_t u16Y, uint16_t u16TransitionTime) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -243,8 +257,8 @@ teZcbStatus lmpgrp_MoveToColour(uint16_t u16ShortAddress, uint16_t u16GroupAddre
     sMoveToColourMessage.u16Y                = htons(u16Y);
     sMoveToColourMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_COLOUR, sizeof(sMoveToColourMessage),
-              &sMoveToColourMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_TO_COLOUR, sizeof(sMoveToColourMessage),
+              &sMoveToColourMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -254,8 +268,6 @@ teZcbStatus lmpgrp_MoveToColour(uint16_t u16ShortAddress, uint16_t u16GroupAddre
 
 teZcbStatus lmpgrp_MoveToColourTemperature(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
               uint16_t u16ColourTemperature, uint16_t u16TransitionTime) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -273,8 +285,8 @@ teZcbStatus lmpgrp_MoveToColourTemperature(uint16_t u16ShortAddress, uint16_t u1
     sMoveToColourTemperatureMessage.u16ColourTemperature    = htons(u16ColourTemperature);
     sMoveToColourTemperatureMessage.u16TransitionTime       = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE, sizeof(sMoveToColourTemperatureMessage),
-         &sMoveToColourTemperatureMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE, sizeof(sMoveToColourTemperatureMessage),
+         &sMoveToColourTemperatureMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -285,8 +297,6 @@ teZcbStatus lmpgrp_MoveToColourTemperature(uint16_t u16ShortAddress, uint16_t u1
 teZcbStatus lmpgrp_MoveColourTemperature(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                uint8_t u8Mode, uint16_t u16Rate,
                uint16_t u16ColourTemperatureMin, uint16_t u16ColourTemperatureMax) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -308,8 +318,8 @@ teZcbStatus lmpgrp_MoveColourTemperature(uint16_t u16ShortAddress, uint16_t u16G
     sMoveColourTemperatureMessage.u16ColourTemperatureMin   = htons(u16ColourTemperatureMin);
     sMoveColourTemperatureMessage.u16ColourTemperatureMax   = htons(u16ColourTemperatureMax);
     
-    if (eSL_SendMessage(E_SL_MSG_MOVE_COLOUR_TEMPERATURE, sizeof(sMoveColourTemperatureMessage),
-              &sMoveColourTemperatureMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_MOVE_COLOUR_TEMPERATURE, sizeof(sMoveColourTemperatureMessage),
+              &sMoveColourTemperatureMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -320,8 +330,6 @@ teZcbStatus lmpgrp_MoveColourTemperature(uint16_t u16ShortAddress, uint16_t u16G
 teZcbStatus lmpgrp_ColourLoopSet(uint16_t u16ShortAddress, uint16_t u16GroupAddress,
                uint8_t u8UpdateFlags, uint8_t u8Action, uint8_t u8Direction,
                uint16_t u16Time, uint16_t u16StartHue) {
-    uint8_t             u8SequenceNo;
-    
     struct {
         uint8_t     u8TargetAddressMode;
         uint16_t    u16TargetAddress;
@@ -345,8 +353,8 @@ teZcbStatus lmpgrp_ColourLoopSet(uint16_t u16ShortAddress, uint16_t u16GroupAddr
     sColourLoopSetMessage.u16Time                   = htons(u16Time);
     sColourLoopSetMessage.u16StartHue               = htons(u16StartHue);
     
-    if (eSL_SendMessage(E_SL_MSG_COLOUR_LOOP_SET, sizeof(sColourLoopSetMessage),
-            &sColourLoopSetMessage, &u8SequenceNo) != E_SL_OK) {
+    if (lmpgrpSend(E_SL_MSG_COLOUR_LOOP_SET, sizeof(sColourLoopSetMessage),
+            &sColourLoopSetMessage) != E_SL_OK) {
         return E_ZCB_COMMS_FAILED;
     }
     
@@ -354,6 +362,194 @@ teZcbStatus lmpgrp_ColourLoopSet(uint16_t u16ShortAddress, uint16_t u16GroupAddr
 }
 
 
+// ------------------------------------------------------------------
+// Group/scene membership cache
+// ------------------------------------------------------------------
+
+/**
+ * \brief Records a group add/remove of one lamp in newDb
+ * \param mac Lamp
+ * \param gid Group address
+ * \param add 1 when added, 0 when removed
+ */
+void lmpgrpCacheMember( char * mac, int gid, int add ) {
+    newdb_group_t group;
+    if ( add ) {
+        if ( newDbGetNewGroup( gid, &group ) && newDbGroupAddMember( &group, mac ) ) {
+            newDbSetGroup( &group );
+        }
+    } else if ( newDbGetGroup( gid, &group ) && newDbGroupRemoveMember( &group, mac ) ) {
+        newDbSetGroup( &group );
+    }
+}
+
+/**
+ * \brief Records a stored or removed scene of a group in newDb
+ * \param gid Group address
+ * \param sid Scene id, -1 for all scenes
+ * \param store 1 when stored, 0 when removed
+ */
+void lmpgrpCacheScene( int gid, int sid, int store ) {
+    newdb_group_t group;
+    if ( sid >= NEWDB_GROUP_SCENES ) return;
+    if ( ( store ? newDbGetNewGroup( gid, &group ) : newDbGetGroup( gid, &group ) ) ) {
+        if ( sid < 0 ) {
+            memset( group.scenes, 0, sizeof( group.scenes ) );
+        } else if ( store ) {
+            NEWDB_GROUP_SET_SCENE( &group, sid );
+        } else {
+            NEWDB_GROUP_CLR_SCENE( &group, sid );
+        }
+        newDbSetGroup( &group );
+    }
+}
+
+// ------------------------------------------------------------------
+// Group planner
+// ------------------------------------------------------------------
+
+// State of one planning round, filled by lmpgrpPlanGroup()
+static newdb_group_t planTarget;             // Wanted members
+static newdb_group_t planBest;               // Planned group that is cheapest to re-arrange
+static int planBestCost;
+static int planExact;                        // Group with exactly the wanted members
+static uint8_t planTaken[( LMPGRP_PLAN_LAST - LMPGRP_PLAN_FIRST + 1 ) / 8];
+
+/**
+ * \brief Number of membership changes to turn a group into the target set
+ */
+static int lmpgrpPlanCost( newdb_group_t * pgroup ) {
+    int i, cost = 0;
+    for ( i=0; i<planTarget.nummembers; i++ ) {
+        if ( !newDbGroupHasMember( pgroup, planTarget.members[i] ) ) cost++;
+    }
+    for ( i=0; i<pgroup->nummembers; i++ ) {
+        if ( !newDbGroupHasMember( &planTarget, pgroup->members[i] ) ) cost++;
+    }
+    return( cost );
+}
+
+static int lmpgrpPlanGroup( newdb_group_t * pgroup ) {
+    int cost = lmpgrpPlanCost( pgroup );
+
+    if ( pgroup->grpid >= LMPGRP_PLAN_FIRST && pgroup->grpid <= LMPGRP_PLAN_LAST ) {
+        int n = pgroup->grpid - LMPGRP_PLAN_FIRST;
+        planTaken[n >> 3] |= ( 1 << ( n & 7 ) );
+    }
+    if ( cost == 0 ) {
+        // Any group will do, also one that was made by the user
+        planExact = pgroup->grpid;
+        return 0;
+    }
+    // Only the planner's own groups may be re-arranged
+    if ( ( pgroup->flags & FLAG_GROUP_PLANNED ) &&
+         ( planBestCost < 0 || cost < planBestCost ||
+           ( cost == planBestCost && pgroup->lastused < planBest.lastused ) ) ) {
+        memcpy( &planBest, pgroup, sizeof( newdb_group_t ) );
+        planBestCost = cost;
+    }
+    return 1;
+}
+
+/**
+ * \brief Changes the lamps' group memberships so that <pgroup> holds the target set.
+ * The row copy follows what succeeded
+ * \returns 1 when the group holds exactly the target set
+ */
+static int lmpgrpArrange( newdb_group_t * pgroup ) {
+    char mac[LEN_MAC_NIBBLE+2];
+    uint16_t u16ShortAddress;
+    int i, ok = 1;
+
+    DEBUG_PRINTF( "Arrange group 0x%04x: %d -> %d lamps\n", pgroup->grpid,
+                  pgroup->nummembers, planTarget.nummembers );
+
+    for ( i=pgroup->nummembers-1; i>=0; i-- ) {
+        if ( !newDbGroupHasMember( &planTarget, pgroup->members[i] ) ) {
+            newDbStrNcpy( mac, pgroup->members[i], LEN_MAC_NIBBLE );
+            u16ShortAddress = zcbNodeGetShortAddress( mac );
+            // A lamp that is not in the network any more is just forgotten
+            if ( u16ShortAddress == 0xFFFF ||
+                 eZCB_RemoveGroupMembership( u16ShortAddress, pgroup->grpid ) == E_ZCB_OK ) {
+                newDbGroupRemoveMember( pgroup, mac );
+            } else {
+                ok = 0;
+            }
+        }
+    }
+
+    for ( i=0; i<planTarget.nummembers; i++ ) {
+        if ( !newDbGroupHasMember( pgroup, planTarget.members[i] ) ) {
+            u16ShortAddress = zcbNodeGetShortAddress( planTarget.members[i] );
+            if ( u16ShortAddress != 0xFFFF &&
+                 eZCB_AddGroupMembership( u16ShortAddress, pgroup->grpid ) == E_ZCB_OK ) {
+                newDbGroupAddMember( pgroup, planTarget.members[i] );
+            } else {
+                ok = 0;
+            }
+        }
+    }
+
+    // Scenes stored for the previous members do not apply to the new set
+    memset( pgroup->scenes, 0, sizeof( pgroup->scenes ) );
+    pgroup->flags |= FLAG_GROUP_PLANNED;
+    return( ok );
+}
+
+/**
+ * \brief Finds or makes a group that holds exactly the lamps <macs>, so that a command to
+ * all of them takes one groupcast. Memberships come from the newDb cache: a group that
+ * matches costs no radio traffic, otherwise a free planner group is used or the cheapest
+ * one to re-arrange
+ * \param macs Lamps
+ * \param num Number of lamps
+ * \returns Group address, -1 when the lamps have to be addressed one by one
+ */
+int lmpgrpPlan( char * macs[], int num ) {
+    newdb_group_t group;
+    int i, ok;
+
+    if ( num < 2 || num > NEWDB_GROUP_MEMBERS ) {
+        // A single lamp takes one frame anyway
+        return -1;
+    }
+
+    memset( &planTarget, 0, sizeof( planTarget ) );
+    for ( i=0; i<num; i++ ) {
+        newDbGroupAddMember( &planTarget, macs[i] );
+    }
+    planExact    = -1;
+    planBestCost = -1;
+    memset( planTaken, 0, sizeof( planTaken ) );
+    newDbLoopGroups( lmpgrpPlanGroup );
+
+    if ( planExact > 0 ) {
+        if ( !newDbGetGroup( planExact, &group ) ) return -1;
+        ok = 1;
+    } else {
+        // Rather a new group than re-arranging one that may be used for another set
+        int grpid = -1;
+        for ( i=0; i<=LMPGRP_PLAN_LAST-LMPGRP_PLAN_FIRST && grpid < 0; i++ ) {
+            if ( !( planTaken[i >> 3] & ( 1 << ( i & 7 ) ) ) ) grpid = LMPGRP_PLAN_FIRST + i;
+        }
+        if ( grpid > 0 && newDbGetNewGroup( grpid, &group ) ) {
+            // New row
+        } else if ( planBestCost > 0 ) {
+            memcpy( &group, &planBest, sizeof( newdb_group_t ) );
+        } else {
+            return -1;
+        }
+        ok = lmpgrpArrange( &group );
+    }
+
+    group.lastused = (int)time( NULL );
+    newDbSetGroup( &group );
+
+    DEBUG_PRINTF( "Planned group 0x%04x for %d lamps (%s)\n", group.grpid, num,
+                  ( planExact > 0 ) ? "cached" : ( ok ) ? "arranged" : "failed" );
+    return( ( ok ) ? group.grpid : -1 );
+}
+
 // ------------------------------------------------------------------
 // END OF FILE
 // ------------------------------------------------------------------
@@ -34,6 +34,10 @@ teZcbStatus lmpgrp_ColourLoopSet(uint16_t u16ShortAddress, uint16_t u16GroupAddr
                uint8_t u8UpdateFlags, uint8_t u8Action, uint8_t u8Direction,
                uint16_t u16Time, uint16_t u16StartHue);
 
+void lmpgrpCacheMember( char * mac, int gid, int add );
+void lmpgrpCacheScene( int gid, int sid, int store );
+int lmpgrpPlan( char * macs[], int num );
+
 // ------------------------------------------------------------------
 // END OF FILE
 // ------------------------------------------------------------------
@@ -33,17 +33,22 @@
 #include <signal.h>
 #include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "queue.h"
 #include "socket.h"
 #include "parsing.h"
 #include "nibbles.h"
 #include "iotSleep.h"
+#include "iotTimer.h"
 #include "plugUsage.h"
 #include "jsonCreate.h"
 #include "json.h"
+#include "tlv.h"
 #include "newLog.h"
 #include "dump.h"
+#include "iotStats.h"
 
 #include "cmd.h"
 #include "lmp.h"
@@ -96,6 +101,21 @@ volatile int   bRunning            = 1;
 // -------------------------------------------------------------
 
 static char inputBuffer[INPUTBUFFERLEN+2];
+static char inputText[TLV_MAXMESSAGE];
+
+// Background work once the queue was quiet for this long (and then periodically)
+#define ZCB_IDLE_MSEC     4000
+
+static iotTimer_t zcbIdleTimer;
+
+static void zcbIdle( iotTimer_t * timer, void * arg ) {
+    // newLogAdd( NEWLOG_FROM_ZCB_IN, "ZCB-R heartbeat" );
+#if 1
+    eZCB_NeighbourTableUpdate();
+#else           
+    eGetPermitJoining();
+#endif
+}
 
 // -------------------------------------------------------------
 // Quit-Signal handler
@@ -189,8 +209,7 @@ static void zcbHandleAnnounce( char * mac, char * devstr, char * ty ) {
     }
 
     // printf( "Joined %s, %s = %d\n", mac, devstr, dev );
-    sprintf( logbuffer, "Announce %s", devstr );
-    newLogAdd( NEWLOG_FROM_ZCB_OUT, logbuffer );
+    newLogAddCode( NEWLOG_FROM_ZCB_OUT, NEWLOG_ZCB_ANNOUNCE, devstr );
 
     newdb_zcb_t sNode;
     newdb_dev_t device;
@@ -261,8 +280,7 @@ static void zcbHandleUI( char * mac, int heat, int cool ) {
     newdb_dev_t device;
     if ( newDbGetDevice( mac, &device ) ) {
         if ( heat != INT_MIN ) {
-            sprintf( logbuffer, "UI %s: heat %d", mac, heat );
-            newLogAdd( NEWLOG_FROM_ZCB_OUT, logbuffer );
+            newLogAddCode( NEWLOG_FROM_ZCB_OUT, NEWLOG_ZCB_UI_HEAT, mac, heat );
         
             if ( !( device.flags & FLAG_UI_IGNORENEXT_HEAT ) ) {
                 device.heat = heat;
@@ -271,8 +289,7 @@ static void zcbHandleUI( char * mac, int heat, int cool ) {
             }
         }
         if ( cool != INT_MIN ) {
-            sprintf( logbuffer, "UI %s: cool %d", mac, cool );
-            newLogAdd( NEWLOG_FROM_ZCB_OUT, logbuffer );
+            newLogAddCode( NEWLOG_FROM_ZCB_OUT, NEWLOG_ZCB_UI_COOL, mac, cool );
         
             if ( !( device.flags & FLAG_UI_IGNORENEXT_COOL ) ) {
                 device.cool = cool;
@@ -289,47 +306,223 @@ static void zcbHandleUI( char * mac, int heat, int cool ) {
 // Handle Sensor device
 // -------------------------------------------------------------
 
+// Sensor reports are written behind: they are merged per (short address, cluster,
+// attribute) for up to REPORT_WINDOW_MS, keeping the last value, and then stored in
+// one database write section with one DBP tee per device. The window starts with
+// the first report after a commit, so a steady stream commits REPORT_WINDOW_MS apart
+
+#define REPORT_WINDOW_MS    500
+#define REPORT_BUFFER_MAX   64
+
+#define REPORT_TMP          0
+#define REPORT_HUM          1
+#define REPORT_ALS          2
+
+typedef struct {
+    uint16_t u16ShortAddress;
+    uint16_t u16ClusterID;
+    uint16_t u16AttributeID;
+    uint64_t u64IEEEAddress;
+    int      modality;              // One of REPORT_*
+    int      value;
+    unsigned int stamp;             // iotStatsNow() of the value, for IOT_STATS_ZB_REPORT
+} report_t;
+
+typedef struct {
+    uint64_t u64IEEEAddress;
+    char     mac[LEN_MAC_NIBBLE+2];
+    int      modality[3];           // Indexed by REPORT_*, -1 when not reported
+    int      found;
+} reportDevice_t;
+
+static pthread_mutex_t reportMutex      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  reportCond       = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t reportCommitMutex = PTHREAD_MUTEX_INITIALIZER;
+static report_t        reportBuffer[REPORT_BUFFER_MAX];
+static int             reportNum        = 0;
+static struct timespec reportDeadline;
+static int             reportRunning    = 0;
+static pthread_t       reportThread;
+
 /**
- * \brief Updates sensor device modalities in the database (no autoinsert). Also forward to DBP.
+ * \brief Updates the sensor modalities of one device row, called by newDbUpdateDevices()
  */
-static void zcbHandleSensor( char * mac, int tmp, int hum, int als, int bat, int batl ) {
+static int reportUpdateDevice( newdb_dev_t * pdev, int index, void * arg ) {
+    reportDevice_t * prd = &((reportDevice_t *)arg)[index];
+
+    if ( prd->modality[REPORT_TMP] >= 0 ) pdev->tmp = prd->modality[REPORT_TMP];
+    if ( prd->modality[REPORT_HUM] >= 0 ) pdev->hum = prd->modality[REPORT_HUM];
+    if ( prd->modality[REPORT_ALS] >= 0 ) pdev->als = prd->modality[REPORT_ALS];
+    pdev->flags |= FLAG_DEV_JOINED;
+    prd->found = 1;
+    return( 1 );
+}
 
-    sprintf( logbuffer, "Sensor %s: tmp %d", mac, tmp );
+/**
+ * \brief Takes the buffered reports and stores them in the database (no autoinsert).
+ * Also forward to DBP
+ */
+static void reportCommit( void ) {
+    // Only used with reportCommitMutex held
+    static report_t       reports[REPORT_BUFFER_MAX];
+    static reportDevice_t devices[REPORT_BUFFER_MAX];
+    static char           messages[REPORT_BUFFER_MAX][MAXMESSAGESIZE+1];
+    char * macs[REPORT_BUFFER_MAX];
+    char * tees[REPORT_BUFFER_MAX];
+    int i, d, num, numDevices = 0, numTees = 0;
+
+    pthread_mutex_lock( &reportCommitMutex );
+
+    pthread_mutex_lock( &reportMutex );
+    num = reportNum;
+    memcpy( reports, reportBuffer, num * sizeof( report_t ) );
+    reportNum = 0;
+    pthread_mutex_unlock( &reportMutex );
+
+    // One row update per device, with all its modalities
+    for ( i=0; i<num; i++ ) {
+        for ( d=0; d<numDevices && devices[d].u64IEEEAddress != reports[i].u64IEEEAddress; d++ );
+        if ( d == numDevices ) {
+            devices[d].u64IEEEAddress = reports[i].u64IEEEAddress;
+            u642nibblestr( reports[i].u64IEEEAddress, devices[d].mac );
+            devices[d].modality[REPORT_TMP] = -1;
+            devices[d].modality[REPORT_HUM] = -1;
+            devices[d].modality[REPORT_ALS] = -1;
+            devices[d].found = 0;
+            macs[d] = devices[d].mac;
+            numDevices++;
+        }
+        devices[d].modality[reports[i].modality] = reports[i].value;
+    }
 
-    newdb_dev_t device;
-    if ( newDbGetDevice( mac, &device ) ) {//-ͨmacַݿѰҵӦ豸
-        if ( tmp  >= 0 ) {
-            sprintf( logbuffer, "Sensor %s: tmp %d", mac, tmp );
-            device.tmp = tmp;	//-ʵʵʵݿд,嶨λڹڴ
+    if ( numDevices > 0 ) {
+        int updated = newDbUpdateDevices( macs, numDevices, reportUpdateDevice, devices );
+
+        newLogAddCode( NEWLOG_FROM_ZCB_OUT, NEWLOG_ZCB_SENSORS, NULL, num, updated, numDevices );
+
+        // Tee to DBP, one message per device
+        for ( d=0; d<numDevices; d++ ) {
+            if ( devices[d].found ) {
+                char * message = jsonSensor( -1, devices[d].mac, NULL, -1, -1,
+                                             devices[d].modality[REPORT_TMP], devices[d].modality[REPORT_HUM],
+                                             -1, -1, -1, -1, devices[d].modality[REPORT_ALS],
+                                             INT_MIN, INT_MIN, INT_MIN, -1 );
+                newDbStrNcpy( messages[numTees], message, MAXMESSAGESIZE );
+                tees[numTees] = messages[numTees];
+                numTees++;
+            }
         }
-        if ( hum  >= 0 ) {
-            sprintf( logbuffer, "Sensor %s: hum %d", mac, hum );
-            device.hum = hum;
+        // Skip the tee when DBP lags behind (e.g. many nodes rejoining), rather than
+        // blocking the ZCB on a full queue: the database has been updated anyway
+        int dbpQueue;
+        if ( numTees > 0 && ( dbpQueue = queueOpen( QUEUE_KEY_DBP, 1 ) ) != -1 ) {
+            if ( queueIsCongested( dbpQueue ) ) {
+                printf( "DBP queue congested: skip sensor tee\n" );
+            } else {
+                queueWriteBatch( dbpQueue, tees, numTees );
+            }
+            queueClose( dbpQueue );
         }
-        if ( als  >= 0 ) {
-            sprintf( logbuffer, "Sensor %s: als %d", mac, als );
-            device.als = als;
+    }
+
+    // One sample per stored value: a report replaced within the window is not counted
+    for ( i=0; i<num; i++ ) {
+        iotStatsSince( IOT_STATS_ZB_REPORT, reports[i].stamp );
+    }
+
+    pthread_mutex_unlock( &reportCommitMutex );
+}
+
+/**
+ * \brief Buffers a sensor report, replacing an earlier value of the same attribute.
+ * Commits right away when the buffer is full
+ */
+static void reportAdd( uint16_t u16ShortAddress, uint16_t u16ClusterID, uint16_t u16AttributeID,
+                       uint64_t u64IEEEAddress, int modality, int value ) {
+    int i;
+
+    DEBUG_PRINTF( "Sensor report 0x%04x/0x%04x/0x%04x = %d\n",
+                  u16ShortAddress, u16ClusterID, u16AttributeID, value );
+    pthread_mutex_lock( &reportMutex );
+    for ( i=0; i<reportNum; i++ ) {
+        if ( reportBuffer[i].u16ShortAddress == u16ShortAddress &&
+             reportBuffer[i].u16ClusterID    == u16ClusterID &&
+             reportBuffer[i].u16AttributeID  == u16AttributeID ) {
+            break;
         }
-        if ( bat  >= 0 ) {
-            sprintf( logbuffer, "Sensor %s: bat %d", mac, bat );
-            device.bat = bat;
+    }
+    while ( i == REPORT_BUFFER_MAX ) {
+        pthread_mutex_unlock( &reportMutex );
+        reportCommit();
+        pthread_mutex_lock( &reportMutex );
+        i = reportNum;
+    }
+    if ( i == reportNum ) {
+        if ( reportNum == 0 ) {
+            struct timeval now;
+            gettimeofday( &now, NULL );
+            reportDeadline.tv_sec  = now.tv_sec + ( REPORT_WINDOW_MS / 1000 );
+            reportDeadline.tv_nsec = ( now.tv_usec + ( REPORT_WINDOW_MS % 1000 ) * 1000 ) * 1000;
+            if ( reportDeadline.tv_nsec >= 1000000000 ) {
+                reportDeadline.tv_sec++;
+                reportDeadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_signal( &reportCond );
         }
-        if ( batl >= 0 ) {
-            sprintf( logbuffer, "Sensor %s: batl %d", mac, batl );
-            device.batl = batl;
+        reportBuffer[i].u16ShortAddress = u16ShortAddress;
+        reportBuffer[i].u16ClusterID    = u16ClusterID;
+        reportBuffer[i].u16AttributeID  = u16AttributeID;
+        reportBuffer[i].u64IEEEAddress  = u64IEEEAddress;
+        reportBuffer[i].modality        = modality;
+        reportNum++;
+    }
+    reportBuffer[i].value = value;
+    reportBuffer[i].stamp = iotStatsNow();
+    pthread_mutex_unlock( &reportMutex );
+}
+
+/**
+ * \brief Commits the buffered reports when their window has passed
+ */
+static void * reportThreadMain( void * arg ) {
+    pthread_mutex_lock( &reportMutex );
+    while ( reportRunning ) {
+        if ( reportNum == 0 ) {
+            pthread_cond_wait( &reportCond, &reportMutex );
+        } else if ( pthread_cond_timedwait( &reportCond, &reportMutex, &reportDeadline ) == ETIMEDOUT ) {
+            pthread_mutex_unlock( &reportMutex );
+            reportCommit();
+            pthread_mutex_lock( &reportMutex );
         }
-        device.flags |= FLAG_DEV_JOINED;
-        newDbSetDevice( &device );	//-趨ݿһЩֵ,ˢʱ
-        
-        // Tee to DBP
-        char * message = jsonSensor( -1, mac, NULL, -1, -1,
-                                    tmp, hum, -1, -1, bat, batl, als,
-                                    INT_MIN, INT_MIN, INT_MIN, -1 );	//-֯JSON
-        queueWriteOneMessage( QUEUE_KEY_DBP, message );	//-ͨϢзͳȥ
     }
- 
-     newLogAdd( NEWLOG_FROM_ZCB_OUT, logbuffer );
- }
+    pthread_mutex_unlock( &reportMutex );
+    return( NULL );
+}
+
+/**
+ * \brief Starts the commit thread of the sensor reports
+ */
+static void reportStart( void ) {
+    reportRunning = 1;
+    if ( pthread_create( &reportThread, NULL, reportThreadMain, NULL ) != 0 ) {
+        printf( "Could not start sensor report thread\n" );
+        reportRunning = 0;
+    }
+}
+
+/**
+ * \brief Stops the commit thread and commits what is left
+ */
+static void reportStop( void ) {
+    if ( reportRunning ) {
+        pthread_mutex_lock( &reportMutex );
+        reportRunning = 0;
+        pthread_cond_signal( &reportCond );
+        pthread_mutex_unlock( &reportMutex );
+        pthread_join( reportThread, NULL );
+    }
+    reportCommit();
+}
 
 // -------------------------------------------------------------
 // Parsing
@@ -688,47 +881,6 @@ static void sendActuatorLevel( uint64_t u64IEEEAddress, int data ) {
     zcbHandleActuator( mac, -1, NULL, data );
 }
 
-// ------------------------------------------------------------------
-// Send thermostat/sensing messages to IoT
-// ------------------------------------------------------------------
-
-static void sendTemperature( uint64_t u64IEEEAddress, int data ) {//-ѽյնʪݷͳȥ
-    char  mac[16+2];
-    u642nibblestr( u64IEEEAddress, mac );
-    DEBUG_PRINTF( "Temperature 0x%x\n", data );
-    zcbHandleSensor( mac, data, -1, -1, -1, -1 );
-}
-
-static void sendHumidity( uint64_t u64IEEEAddress, int data ) {
-    char  mac[16+2];
-    u642nibblestr( u64IEEEAddress, mac );
-    DEBUG_PRINTF( "Humidity 0x%x\n", data );
-    zcbHandleSensor( mac, -1, data, -1, -1, -1 );
-}
-
-static void sendIllumination( uint64_t u64IEEEAddress, int data ) {
-    char  mac[16+2];
-    u642nibblestr( u64IEEEAddress, mac );
-    DEBUG_PRINTF( "Illumination 0x%x\n", data );
-    zcbHandleSensor( mac, -1, -1, data, -1, -1 );
-}
-
-#if 0
-static void sendBattery( uint64_t u64IEEEAddress, int data ) {
-    char  mac[16+2];
-    u642nibblestr( u64IEEEAddress, mac );
-    DEBUG_PRINTF( "Battery 0x%x\n", data );
-    zcbHandleSensor( mac, -1, -1, -1, data, -1 );
-}
-
-static void sendBatteryLevel( uint64_t u64IEEEAddress, int data ) {
-    char  mac[16+2];
-    u642nibblestr( u64IEEEAddress, mac );
-    DEBUG_PRINTF( "BatteryLevel 0x%x\n", data );
-    zcbHandleSensor( mac, -1, -1, -1, -1, data );
-}
-#endif
-
 // ------------------------------------------------------------------
 // Send setpoint messages to IoT
 // ------------------------------------------------------------------
@@ -760,7 +912,6 @@ static uint64_t eDivisor             = 0;
 
 static void handlePlugData( uint64_t u64IEEEAddress ) {
     
-    static int cleanupCnt = 0;
     char  mac[16+2];
     u642nibblestr( u64IEEEAddress, mac );
     
@@ -798,8 +949,7 @@ static void handlePlugData( uint64_t u64IEEEAddress ) {
         eInstDemand = (eInstantaneousDemand * eMultiplier * 1000) / eDivisor; // now in Watt
         if ( (int)eInstDemand < 0 ) eInstDemand = 0;
         
-        sprintf( logbuffer, "Plug %d/%d", (int)eInstDemand, (int)eSumDeliv );
-        newLogAdd( NEWLOG_FROM_ZCB_OUT, logbuffer );
+        newLogAddCode( NEWLOG_FROM_ZCB_OUT, NEWLOG_ZCB_PLUG, NULL, (int)eInstDemand, (int)eSumDeliv );
 
         // Add to dB (no auto-insert)
         newdb_dev_t device;
@@ -811,18 +961,8 @@ static void handlePlugData( uint64_t u64IEEEAddress ) {
         
             int now = (int)time( NULL );
         
-            newdb_plughist_t plughist;
-            if ( newDbGetMatchingOrNewPlugHist( mac, now/60, &plughist ) ) {
-                plughist.sum = eSumDeliv;
-                newDbSetPlugHist( &plughist );
-            
-                // Clean history entries older than one day
-                if ( cleanupCnt-- < 0 ) {
-                    if ( plugHistoryCleanup( mac, now ) ) {
-                        cleanupCnt = 25;
-                    }
-                }
-            }
+            // The plug series rolls up and drops old samples itself
+            newDbAddPlugSample( mac, eSumDeliv, now );
         }
     }
 }
@@ -912,7 +1052,8 @@ void handleAttribute( uint16_t u16ShortAddress,
         case E_ZB_CLUSTERID_THERMOSTAT:
             switch ( u16AttributeID ) {
             case E_ZB_ATTRIBUTEID_TSTAT_LOCALTEMPERATURE:
-                sendTemperature( u64IEEEAddress, (int)u64Data );
+                reportAdd( u16ShortAddress, u16ClusterID, u16AttributeID,
+                           u64IEEEAddress, REPORT_TMP, (int)u64Data );
                 break;
 
             case E_ZB_ATTRIBUTEID_TSTAT_OCCUPIEDCOOLSETPOINT:
@@ -942,7 +1083,8 @@ void handleAttribute( uint16_t u16ShortAddress,
         case E_ZB_CLUSTERID_MEASUREMENTSENSING_ILLUM:
             switch ( u16AttributeID ) {
             case E_ZB_ATTRIBUTEID_MS_ILLUM_MEASURED:
-                sendIllumination( u64IEEEAddress, (int)u64Data );
+                reportAdd( u16ShortAddress, u16ClusterID, u16AttributeID,
+                           u64IEEEAddress, REPORT_ALS, (int)u64Data );
                 break;
 
             default:
@@ -955,7 +1097,8 @@ void handleAttribute( uint16_t u16ShortAddress,
         case E_ZB_CLUSTERID_MEASUREMENTSENSING_TEMP:
             switch ( u16AttributeID ) {
             case E_ZB_ATTRIBUTEID_MS_TEMP_MEASURED:
-                sendTemperature( u64IEEEAddress, (int)u64Data );
+                reportAdd( u16ShortAddress, u16ClusterID, u16AttributeID,
+                           u64IEEEAddress, REPORT_TMP, (int)u64Data );
                 break;
 
             default:	//-ԴṩĽһ,кܶûд,ܾԹ
@@ -968,7 +1111,8 @@ void handleAttribute( uint16_t u16ShortAddress,
         case E_ZB_CLUSTERID_MEASUREMENTSENSING_HUM:
             switch ( u16AttributeID ) {
             case E_ZB_ATTRIBUTEID_MS_HUM_MEASURED:
-                sendHumidity( u64IEEEAddress, (int)u64Data );
+                reportAdd( u16ShortAddress, u16ClusterID, u16AttributeID,
+                           u64IEEEAddress, REPORT_HUM, (int)u64Data );
                 break;
 
             default:
@@ -1132,18 +1276,34 @@ void handleAttribute( uint16_t u16ShortAddress,
  * initializes the JSON parsers,
  * and waits for incoming queue messages to parse and handle.
  * \param argc Number of command-line parameters
- * \param argv Parameter list (-h = help, -a = set auto-insert, -c = empty DB and exit immediately)
+ * \param argv Parameter list (-h = help, -a = set auto-insert, -c = empty DB and exit immediately,
+ * -s <port> = serial port of the control bridge, e.g. the pty of the iot_zs simulator)
  */
 
 int main(int argc, char *argv[])
 {    
+    char *pcSerialPort = SERIAL_PORT;
+    signed char opt;
+    
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            pcSerialPort = optarg;
+        }
+    }
+    
     /* Install signal handlers */
     signal(SIGTERM, vQuitSignalHandler);
     signal(SIGINT, vQuitSignalHandler);
     
     newDbOpen();
+
+    // The neighbour cache starts empty: so do the links that were published from it
+    newDbEmptyLinks();
+
+    // Attribute reports may come in as soon as the serial link is up
+    reportStart();
      
-    if (eZCB_Init(SERIAL_PORT, SERIAL_BAUDRATE) != E_ZCB_OK) {	//-һ̺߳һص߳
+    if (eZCB_Init(pcSerialPort, SERIAL_BAUDRATE) != E_ZCB_OK) {	//-һ̺߳һص߳
         goto finish;
     }
 
@@ -1159,7 +1319,6 @@ int main(int argc, char *argv[])
         }
     }
 
-    int i;
     int numBytes = 0;
 
     newLogAdd( NEWLOG_FROM_ZCB_OUT, "ZCB-out started" );
@@ -1177,6 +1336,9 @@ int main(int argc, char *argv[])
         jsonSetOnInteger( zcb_onInteger );
         jsonReset();
 
+        // The loop below parses with jsonEatMessage(): writers may send TLV
+        queueSetFormats( zcbQueue, QUEUE_FORMAT_TLV );
+
         DEBUG_PRINTF( "Init parsers ...\n" );
 
         cmdInit();	//-ĳʼʵڽṹдƺֵ,ԸԻĲ,Ӧϵͳ
@@ -1188,44 +1350,36 @@ int main(int argc, char *argv[])
         tunnelInit();
 
         printf( "Going to read from data queue endlessly...\n\n" );
-        
-        int start = 0;
 
+        iotTimerSet( &zcbIdleTimer, zcbIdle, NULL );
+        iotTimerAdd( &zcbIdleTimer, ZCB_IDLE_MSEC, ZCB_IDLE_MSEC );
+        
         while ( bRunning ) {	//-ϲĿ
+            // Sleep on the queue until the next timer is due
+            int msec = iotTimerNextMsec();
             numBytes = queueReadWithMsecTimeout( zcbQueue,
-                              inputBuffer, INPUTBUFFERLEN, 4000 );
+                              inputBuffer, INPUTBUFFERLEN, ( msec < 0 ) ? ZCB_IDLE_MSEC : msec );
             if ( numBytes > 0 ) {
+                // Not quiet: push the idle work back
+                iotTimerAdd( &zcbIdleTimer, ZCB_IDLE_MSEC, ZCB_IDLE_MSEC );
+
 #ifdef MAIN_DEBUG
                 dump( inputBuffer, numBytes );
 #endif
 
-                newLogAdd( NEWLOG_FROM_ZCB_IN, inputBuffer );
+                if ( tlvIsMessage( inputBuffer, numBytes ) ) {
+                    newLogAdd( NEWLOG_FROM_ZCB_IN,
+                               tlvToText( inputBuffer, numBytes, inputText, sizeof( inputText ) ) );
+                } else {
+                    newLogAdd( NEWLOG_FROM_ZCB_IN, inputBuffer );
+                }
 
                 // Reset parser (each line is one command)
                 jsonReset();
 
-                for ( i=0; i<numBytes; i++ ) {
-                    jsonEat( inputBuffer[i] );
-                }
-            } else { 
-                // newLogAdd( NEWLOG_FROM_ZCB_IN, "ZCB-R heartbeat" );
-#if 1
-                int ret = eZCB_NeighbourTableRequest(start);
-                if ( ret >= 0 )
-                {
-                  /* Request is successful, ask for more */
-                  start = ret;
-                }
-                else
-                {
-                  /* Error, or empty list, or no more entry, or ... */
-                  /* restart from beginning */
-                  start = 0;
-                }
-#else           
-                eGetPermitJoining();
-#endif
+                jsonEatMessage( inputBuffer, numBytes );
             }
+            iotTimerRun();
         }
 
         // dispatchClose();
@@ -1241,6 +1395,7 @@ int main(int argc, char *argv[])
     
 finish:
     DEBUG_PRINTF( "Exiting");
+    reportStop();
     newDbClose();
     return 0;
 }
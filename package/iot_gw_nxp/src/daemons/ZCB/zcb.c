@@ -21,6 +21,7 @@
 #include "systemtable.h"
 #include "newDb.h"
 #include "dump.h"
+#include "newLog.h"
 #include "jsonCreate.h"
 #include "ZigbeeConstant.h"
 #include "SerialLink.h"
@@ -155,6 +156,10 @@ int zcbNodeLeft( uint64_t extendedAddress, int keep ) {
     if ( newDbGetZcb( mac, &zcb ) ) {
         zcb.status = (keep) ? ZCB_STATUS_LEFT : ZCB_STATUS_FREE;
         newDbSetZcb( &zcb );
+        if ( !keep ) {
+            // Its group table is gone with it
+            newDbGroupsRemoveMember( mac );
+        }
         return 1;
     }
     return 0;
@@ -227,7 +232,7 @@ teZcbStatus eZCB_EstablishComms(void) {//-
             newDbSystemSaveIntval( "zcb_version", version );	//-ֵǱݿе,Ӧһʶ
             
             DEBUG_PRINTF( "Connected to control bridge version 0x%08x\n", version ); 
-            free(u32Version);
+            vSL_MessageRelease(u32Version);
             
             DEBUG_PRINTF( "Reset control bridge\n");
             if (eSL_SendMessage(E_SL_MSG_RESET, 0, NULL, NULL) != E_SL_OK) {
@@ -333,6 +338,114 @@ teZcbStatus SimpleDescriptorRequest(uint16_t u16ShortAddress) {
 // Check Neighbours
 // ------------------------------------------------------------------
 
+#define ZCB_NEIGHBOUR_MAX        64     // Entries cached from the coordinator's table
+#define ZCB_NEIGHBOUR_MAXAGE     600    // Seconds before the table is read again without events
+#define ZCB_NEIGHBOUR_LQI_DELTA  32     // LQI drift that is reported as a change
+
+typedef struct {
+    uint16_t u16ShortAddress;
+    uint64_t u64IEEEAddress;
+    uint8_t  u8Depth;
+    uint8_t  u8LQI;
+    uint8_t  u8Relationship;
+    time_t   lastseen;
+} zcbNeighbour_t;
+
+// The cache is only touched from the main loop, the announce/leave
+// handlers (callback thread) merely set the dirty flag
+static zcbNeighbour_t zcbNeighbours[ZCB_NEIGHBOUR_MAX];
+static int zcbNumNeighbours = 0;
+static int zcbNeighbourStart = 0;           // Next index while a sweep is running
+static time_t zcbNeighbourSweep = 0;        // Start of the running sweep
+static time_t zcbNeighbourRefreshed = 0;    // End of the last complete sweep
+static volatile int zcbNeighbourDirty = 1;
+
+static void zcbNeighbourLog( char change, zcbNeighbour_t * pn ) {
+    char text[NEWLOG_MAX_TEXT];
+    snprintf( text, sizeof( text ), "Neighbour %c 0x%04X (%016llX) depth %d lqi %d rel %d",
+              change, pn->u16ShortAddress, (unsigned long long int)pn->u64IEEEAddress,
+              pn->u8Depth, pn->u8LQI, pn->u8Relationship );
+    DEBUG_PRINTF( "%s\n", text );
+    newLogAdd( NEWLOG_FROM_ZCB_OUT, text );
+}
+
+/**
+ * \brief Publishes a new or changed entry in the link table of the DB, where the
+ * topology views are built from
+ */
+static void zcbNeighbourStore( zcbNeighbour_t * pn ) {
+    newdb_link_t link;
+    memset( &link, 0, sizeof( link ) );
+    link.src   = 0;    // The coordinator's own table
+    u642nibblestr( pn->u64IEEEAddress, link.mac );
+    link.saddr = pn->u16ShortAddress;
+    link.depth = pn->u8Depth;
+    link.lqi   = pn->u8LQI;
+    link.rel   = pn->u8Relationship;
+    newDbSetLink( &link );
+}
+
+/**
+ * \brief Merges one neighbour table entry into the cache, logging only
+ * the entries that are new or whose position in the mesh changed
+ */
+static void zcbNeighbourSeen( uint16_t u16ShortAddress, uint64_t u64IEEEAddress,
+                              uint8_t u8Depth, uint8_t u8LQI, uint8_t u8Relationship ) {
+    int i;
+    zcbNeighbour_t * pn = NULL;
+
+    for ( i=0; i<zcbNumNeighbours; i++ ) {
+        if ( zcbNeighbours[i].u64IEEEAddress == u64IEEEAddress ) {
+            pn = &zcbNeighbours[i];
+            break;
+        }
+    }
+
+    if ( pn == NULL ) {
+        if ( zcbNumNeighbours >= ZCB_NEIGHBOUR_MAX ) {
+            DEBUG_PRINTF( "Neighbour cache full\n" );
+            return;
+        }
+        pn = &zcbNeighbours[zcbNumNeighbours++];
+        pn->u16ShortAddress = u16ShortAddress;
+        pn->u64IEEEAddress  = u64IEEEAddress;
+        pn->u8Depth         = u8Depth;
+        pn->u8LQI           = u8LQI;
+        pn->u8Relationship  = u8Relationship;
+        zcbNeighbourLog( '+', pn );
+        zcbNeighbourStore( pn );
+    } else if ( ( pn->u16ShortAddress != u16ShortAddress ) ||
+                ( pn->u8Depth != u8Depth ) ||
+                ( pn->u8Relationship != u8Relationship ) ||
+                ( abs( (int)pn->u8LQI - (int)u8LQI ) >= ZCB_NEIGHBOUR_LQI_DELTA ) ) {
+        pn->u16ShortAddress = u16ShortAddress;
+        pn->u8Depth         = u8Depth;
+        pn->u8LQI           = u8LQI;
+        pn->u8Relationship  = u8Relationship;
+        zcbNeighbourLog( '~', pn );
+        zcbNeighbourStore( pn );
+    }
+    pn->lastseen = time( NULL );
+}
+
+/**
+ * \brief Drops the entries, and their links, that were not seen in the sweep started at since
+ */
+static void zcbNeighbourExpire( time_t since ) {
+    char mac[LEN_MAC_NIBBLE+2];
+    int i = 0;
+    while ( i < zcbNumNeighbours ) {
+        if ( zcbNeighbours[i].lastseen < since ) {
+            zcbNeighbourLog( '-', &zcbNeighbours[i] );
+            u642nibblestr( zcbNeighbours[i].u64IEEEAddress, mac );
+            newDbDeleteLink( 0, mac );
+            zcbNeighbours[i] = zcbNeighbours[--zcbNumNeighbours];
+        } else {
+            i++;
+        }
+    }
+}
+
 int eZCB_NeighbourTableRequest( int start ) {
     struct _ManagementLQIRequest
     {
@@ -408,7 +521,7 @@ int eZCB_NeighbourTableRequest( int start ) {
         {
             DEBUG_PRINTF( "IEEE Address sequence number received 0x%02X does not match that sent 0x%02X\n", 
                           psManagementLQIResponse->u8SequenceNo, u8SequenceNo);
-            free(psManagementLQIResponse);
+            vSL_MessageRelease(psManagementLQIResponse);
             psManagementLQIResponse = NULL;
         }
     }
@@ -448,6 +561,12 @@ int eZCB_NeighbourTableRequest( int start ) {
             psManagementLQIResponse->asNeighbours[i].u8Depth,
             psManagementLQIResponse->asNeighbours[i].u8LQI);
 
+        zcbNeighbourSeen( psManagementLQIResponse->asNeighbours[i].u16ShortAddress,
+            psManagementLQIResponse->asNeighbours[i].u64IEEEAddress,
+            psManagementLQIResponse->asNeighbours[i].u8Depth,
+            psManagementLQIResponse->asNeighbours[i].u8LQI,
+            psManagementLQIResponse->asNeighbours[i].sBitmap.uRelationship );
+
         newdb_zcb_t zcb;
         if ( newDbGetZcbSaddr( psManagementLQIResponse->asNeighbours[i].u16ShortAddress, &zcb ) ) {
           // Existing node
@@ -488,10 +607,43 @@ int eZCB_NeighbourTableRequest( int start ) {
           psManagementLQIResponse->u8Status);
     }
 done:
-    free(psManagementLQIResponse);
+    vSL_MessageRelease(psManagementLQIResponse);
     return( ret );
 }
 
+int eZCB_NeighbourTableUpdate( void ) {
+    int ret;
+    time_t now = time( NULL );
+
+    if ( zcbNeighbourStart == 0 ) {
+        // Between sweeps: only read the table when the mesh changed
+        // or the cache aged out (a clock step back also refreshes)
+        if ( !zcbNeighbourDirty && zcbNeighbourRefreshed != 0 &&
+             now >= zcbNeighbourRefreshed &&
+             ( now - zcbNeighbourRefreshed ) < ZCB_NEIGHBOUR_MAXAGE ) {
+            return( 0 );
+        }
+        zcbNeighbourDirty = 0;
+        zcbNeighbourSweep = now;
+    }
+
+    ret = eZCB_NeighbourTableRequest( zcbNeighbourStart );
+    if ( ret > 0 ) {
+        // Request is successful, ask for more next time
+        zcbNeighbourStart = ret;
+    } else if ( ret == 0 ) {
+        // Table read to the end
+        zcbNeighbourExpire( zcbNeighbourSweep );
+        zcbNeighbourRefreshed = now;
+        zcbNeighbourStart = 0;
+    } else {
+        // Error: restart from beginning at the next idle moment
+        zcbNeighbourDirty = 1;
+        zcbNeighbourStart = 0;
+    }
+    return( 1 );
+}
+
 // ------------------------------------------------------------------
 // Write attribute
 // ------------------------------------------------------------------
@@ -683,7 +835,7 @@ teZcbStatus eZCB_WriteAttributeRequest(uint16_t u16ShortAddress,
     eStatus = psDataIndication->u8Status;
 
 done:
-    free(psDataIndication);
+    vSL_MessageRelease(psDataIndication);
 // printf( "kok3\n" );
     return eStatus;
 }
@@ -771,7 +923,7 @@ teZcbStatus eZCB_SendBindCommand(uint64_t u64IEEEAddress,
     eStatus = psBindUnbindResp->u8Status;
 
 done:
-    free(psBindUnbindResp);
+    vSL_MessageRelease(psBindUnbindResp);
  printf( "bind 3\n" );
     return eStatus;
 }
@@ -867,7 +1019,7 @@ teZcbStatus eZCB_SendConfigureReportingCommand(uint16_t u16ShortAddress,
     eStatus = psAttributeReportingConfigurationResponse->u8Status;
 
 done:
-    free(psAttributeReportingConfigurationResponse);
+    vSL_MessageRelease(psAttributeReportingConfigurationResponse);
 // printf( "kok3\n" );
     return eStatus;
 }
@@ -1278,6 +1430,7 @@ static void ZCB_HandleDeviceAnnounce(void *pvUser, uint16_t u16Length, void *pvM
             );
 
 
+    zcbNeighbourDirty = 1;
     zcbAddNode(psMessage->u16ShortAddress, psMessage->u64IEEEAddress);	//-ͨ汨ڰն豸Ķ̵ַ,macַ
     newDbGetZcbSaddr(psMessage->u16ShortAddress, &sZcb);
 
@@ -1308,6 +1461,7 @@ static void ZCB_HandleDeviceLeave(void *pvUser, uint16_t u16Length, void *pvMess
                 psMessage->bRejoin
             );
 
+    zcbNeighbourDirty = 1;
     zcbNodeLeft( psMessage->u64IEEEAddress, psMessage->bRejoin );
 
     return;
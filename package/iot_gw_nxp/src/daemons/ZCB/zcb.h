@@ -139,6 +139,13 @@ teZcbStatus eOnOff( uint16_t u16ShortAddress, uint8_t u8Mode );
 
 int eZCB_NeighbourTableRequest( int start );
 
+/** Reads the next page of the coordinator's neighbour table, but only
+ *  while a sweep is due: after a device announce/leave or once the
+ *  cached table aged out. Changes are logged per neighbour.
+ *  \return 1 when a request was sent, 0 when the cache is current
+ */
+int eZCB_NeighbourTableUpdate( void );
+
 teZcbStatus eZCB_WriteAttributeRequest(uint16_t u16ShortAddress,
 				       uint16_t u16ClusterID,
                                        uint8_t u8Direction, 
@@ -82,7 +82,7 @@ int bufman_write(bufman_t *bufman, void *buffer, int bufsize)
 	p = buffer;
 	
 	for(i=0; i<bufsize; i++){
-		if( (bufman->head + 1 == bufman->tail) || ( (bufman->head + 1 == bufman->size) && (bufman->tail == 0) ){
+		if( (bufman->head + 1 == bufman->tail) || ( (bufman->head + 1 == bufman->size) && (bufman->tail == 0) ) ){
 			return i;
 		}else{
 			bufman->buf[bufman->head] = *p++;
@@ -95,3 +95,44 @@ int bufman_write(bufman_t *bufman, void *buffer, int bufsize)
 	
 	return bufsize;
 }
+
+/* read without taking the data out, e.g. to find out how much a socket accepts */
+int bufman_peek(bufman_t *bufman, void *buffer, int bufsize)
+{
+	bufman_t copy;
+	
+	if(bufman == NULL){
+		return -1;
+	}
+	
+	copy = *bufman;
+	return bufman_read(&copy, buffer, bufsize);
+}
+
+/* take out what bufman_peek() returned and was used */
+int bufman_drop(bufman_t *bufman, int bufsize)
+{
+	int used;
+	
+	if((bufman == NULL) || (bufsize < 0)){
+		return -1;
+	}
+	
+	used = (bufman->head - bufman->tail + bufman->size) % bufman->size;
+	if(bufsize > used){
+		bufsize = used;
+	}
+	bufman->tail = (bufman->tail + bufsize) % bufman->size;
+	
+	return bufsize;
+}
+
+/* bytes that bufman_write() still accepts */
+int bufman_room(bufman_t *bufman)
+{
+	if(bufman == NULL){
+		return -1;
+	}
+	
+	return bufman->size - 1 - (bufman->head - bufman->tail + bufman->size) % bufman->size;
+}
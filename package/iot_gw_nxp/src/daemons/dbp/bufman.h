@@ -42,5 +42,8 @@ typedef struct{
 int bufman_init(bufman_t *bufman, char *buffer, int bufsize);
 int bufman_read(bufman_t *bufman, void *buffer, int bufsize);
 int bufman_write(bufman_t *bufman, void *buffer, int bufsize);
+int bufman_peek(bufman_t *bufman, void *buffer, int bufsize);
+int bufman_drop(bufman_t *bufman, int bufsize);
+int bufman_room(bufman_t *bufman);
 
 #endif
\ No newline at end of file
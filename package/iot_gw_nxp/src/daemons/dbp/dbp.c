@@ -32,9 +32,11 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <strings.h>
 #include "dbp.h"
 #include "newLog.h"
 #include "newDb.h"
+#include "jsonWriter.h"
 
 #define MAC_STRING_LEN				16
 #define MAX_NUMBER_OF_SENSOR_NODES	200
@@ -74,9 +76,21 @@ const battery_t battery_capacity_table[] = {
 
 /* default parent's mac address in case of failing retrieving it from database */
 char temp_parent[] = "0123456789ABCDEF"; /* Dummy Parent Address */
-bool node_list_flag = false;
 char sensor_node_buffer[DBP_NODE_BUFFER_SIZE+1] = {0};
 
+/* metrics of a batch query, in the order of their entries in the state line */
+static const struct{
+        const char *name;
+        unsigned int column;
+}batch_metrics[] = {
+        {"tmp", NEWDB_COL_TMP},
+        {"hum", NEWDB_COL_HUM},
+        {"als", NEWDB_COL_ALS},
+        {"bat", NEWDB_COL_BAT},
+        {"batl", NEWDB_COL_BATL}
+};
+static char batch_macs[DBP_BATCH_MAX_MACS][MAC_STRING_LEN+1];
+
 /* external function */
 int dbTableGetKeyWhere(char *tablename, char *key, char *value, char *wherekey, char *wherevalue);
 
@@ -87,7 +101,11 @@ static void get_mac_address(char *input, char *mac, int cmd_len);
 static uint16_t dbp_swap_uint16(uint16_t val);
 static uint8_t battery_get_percent(uint16_t voltage);
 static uint64_t get_xor(uint64_t x, uint64_t y);
-int database_callback(newdb_dev_t * pdev);
+static void sensor_node_list(void);
+static int batch_parse(char *input, unsigned int *columns, int *num_macs);
+static void batch_state(jsonWriter_t *w, newdb_dev_t *node, unsigned int columns, int now);
+static uint16_t batch_pack_percent(int percent, uint16_t stype);
+static void batch_hex(jsonWriter_t *w, unsigned int value, int digits);
 
 int dbp_parse_data(char *input, uint32_t input_len, char *output, uint32_t output_len, char **extra)
 {
@@ -159,6 +177,86 @@ int dbp_parse_data(char *input, uint32_t input_len, char *output, uint32_t outpu
         return 0;
 }
 
+/* upper bound of the lines in the reply to a batch query, -1 when input is no batch query */
+int dbp_batch_lines(char *input)
+{
+        unsigned int columns;
+        int num_macs;
+        
+        if( (input == NULL) || !check_dbp(input, NULL) || (strstr(input, QUERY_BATCH) == NULL) ){
+                return -1;
+        }
+        
+        if(batch_parse(input, &columns, &num_macs) < 0){
+                return 1;
+        }
+        
+        /* one line per mac, or per sensor, and the count */
+        return ( (num_macs > 0) ? num_macs : MAX_NUMBER_OF_SENSOR_NODES ) + 1;
+}
+
+/* answer "dbp query:<metrics>:<macs>" with a state line per mac, all from one
+ * snapshot of the device table, formatted straight into output.
+ * metrics: tmp,hum,als,bat,batl; macs: [0x]<mac>,... or * for all sensors.
+ * returns the length of the reply, -1 when it did not fit */
+int dbp_batch_query(char *input, char *output, uint32_t output_len)
+{
+        static newdb_dev_t nodes[MAX_NUMBER_OF_SENSOR_NODES];
+        newdb_query_t query;
+        jsonWriter_t w;
+        unsigned int columns;
+        int num_macs, num, lines = 0;
+        int i, j;
+        int now = (int) time(NULL);
+        
+        jsonWriterInit(&w, output, output_len, -1);
+        
+        if(batch_parse(input, &columns, &num_macs) < 0){
+                jsonWriterText(&w, "dbp error query\r\n");
+                return (w.error) ? -1 : jsonWriterLength(&w);
+        }
+        
+        if( !newDbOpen() ){
+                newLogAdd( NEWLOG_FROM_DBP,"Failed to open database");
+                return 0;
+        }
+        
+        /* only the requested columns of the sensors */
+        newDbQueryInit(&query);
+        query.devmask = NEWDB_DEVMASK(DEVICE_DEV_SENSOR) | NEWDB_DEVMASK(DEVICE_DEV_UISENSOR);
+        query.columns = columns | NEWDB_COL_MAC;
+        num = newDbQueryDevices(&query, nodes, MAX_NUMBER_OF_SENSOR_NODES);
+        
+        newDbClose();
+        
+        if(num_macs == 0){
+                for(i = 0; i < num; i++){
+                        batch_state(&w, &nodes[i], columns, now);
+                        lines++;
+                }
+        }else{
+                for(j = 0; j < num_macs; j++){
+                        for(i = 0; i < num; i++){
+                                if(strcasecmp(nodes[i].mac, batch_macs[j]) == 0) break;
+                        }
+                        if(i < num){
+                                batch_state(&w, &nodes[i], columns, now);
+                                lines++;
+                        }else{
+                                jsonWriterText(&w, "dbp error mac ");
+                                jsonWriterText(&w, batch_macs[j]);
+                                jsonWriterText(&w, "\r\n");
+                        }
+                }
+        }
+        
+        jsonWriterText(&w, "dbp query ");
+        jsonWriterInt(&w, lines);
+        jsonWriterText(&w, "\r\n");
+        
+        return (w.error) ? -1 : jsonWriterLength(&w);
+}
+
 int dbp_report_temp(int temp, char *mac, char *output)	//-ѯض豸Ϣ,˺ʵ˲ѯһ豸ݿм¼¶ֵ
 {
         char parent_mac[MAC_STRING_LEN+1] = {0};
@@ -394,7 +492,6 @@ static int query_handle(DBP_CMD cmd, char *mac, char *output)	//-ִ
         float max_value = 1023.0;
         uint16_t humidity_result;
         uint16_t packed_data;
-        unsigned int wait_time = 0;
         
         printf("DBP Handled\n");
         
@@ -459,22 +556,8 @@ static int query_handle(DBP_CMD cmd, char *mac, char *output)	//-ִ
 #endif
                         break;
                 case DBP_CMD_SENSOR_NODES:
-                        if(node_list_flag == false){
-                                sprintf(output, "dbp node");
-                                node_list_flag = true;
-                                while(node_list_flag == true){
-                                        /* this will block forever if callback isn't called */
-                                        usleep(5*1000);
-                                        wait_time++;
-                                        if(wait_time >= (200*60)){
-                                                /* break : 1 minute has passed */
-                                                wait_time = 0;
-                                                node_list_flag = false;
-                                                memset(sensor_node_buffer, 0, sizeof(sensor_node_buffer));
-                                                strcat(sensor_node_buffer, "dbp mac unknown\r\n");
-                                        }
-                                }
-                        }
+                        sprintf(output, "dbp node");
+                        sensor_node_list();
                         break;
                 case DBP_CMD_ROUTERS:
                         sprintf(output, "dbp router 'not available'\r\n");
@@ -504,33 +587,143 @@ static int query_handle(DBP_CMD cmd, char *mac, char *output)	//-ִ
         return 0;
 }
 
-int database_callback( newdb_dev_t * pdev )
+/* list the macs of all sensor nodes, and their xor as checksum, into sensor_node_buffer */
+static void sensor_node_list(void)
 {
-        int max = 0;
+        static newdb_dev_t nodes[MAX_NUMBER_OF_SENSOR_NODES];
+        newdb_query_t query;
         uint64_t chksum = 0;
-        uint64_t temp = 0;
-        char *pEnd;
-        char chksum_str[30] = {0};
-        
-        /* init buffer */
-        memset(sensor_node_buffer, 0, sizeof(sensor_node_buffer));
+        char *pos = sensor_node_buffer;
+        int i, num;
+        
+        /* only the macs of the sensors, straight from one snapshot of the device table */
+        newDbQueryInit(&query);
+        query.devmask = NEWDB_DEVMASK(DEVICE_DEV_SENSOR) | NEWDB_DEVMASK(DEVICE_DEV_UISENSOR);
+        query.columns = NEWDB_COL_MAC;
+        num = newDbQueryDevices(&query, nodes, MAX_NUMBER_OF_SENSOR_NODES);
+        
+        if(num == 0){
+                strcpy(sensor_node_buffer, "dbp mac unknown\r\n");
+                return;
+        }
         
-        temp = strtoll(pdev->mac, &pEnd, 16);
-        chksum = get_xor(chksum, temp);
-        max++;
-        strcat(sensor_node_buffer, "dbp mac ");
-        strcat(sensor_node_buffer, pdev->mac);
-        strcat(sensor_node_buffer, "\r\n");
+        for(i = 0; i < num; i++){
+                chksum = get_xor(chksum, strtoull(nodes[i].mac, NULL, 16));
+                pos += sprintf(pos, "dbp mac %s\r\n", nodes[i].mac);
+        }
         
         /* checksum */
-        sprintf(chksum_str, "dbp chksum %llx", chksum);
-        strcat(sensor_node_buffer, chksum_str);
-        strcat(sensor_node_buffer, "\r\n");
+        sprintf(pos, "dbp chksum %llx\r\n", (unsigned long long)chksum);
+}
+
+/* split "dbp query:<metrics>:<macs>" into the NEWDB_COL_* bits of the metrics and batch_macs[],
+ * num_macs 0 means all sensors */
+static int batch_parse(char *input, unsigned int *columns, int *num_macs)
+{
+        char *pos = strstr(input, QUERY_BATCH) + strlen(QUERY_BATCH);
+        char *end;
+        int len, i;
+        
+        *columns = 0;
+        *num_macs = 0;
+        
+        /* metrics, up to the ':' */
+        while( (*pos != ':') && (*pos != '\0') ){
+                for(end = pos; (*end != ',') && (*end != ':') && (*end != '\0'); end++);
+                len = end - pos;
+                for(i = 0; i < (int)(sizeof(batch_metrics) / sizeof(batch_metrics[0])); i++){
+                        if( (strlen(batch_metrics[i].name) == len) && (strncmp(pos, batch_metrics[i].name, len) == 0) ) break;
+                }
+                if(i == (int)(sizeof(batch_metrics) / sizeof(batch_metrics[0]))){
+                        printf("%s: unknown metric\n", __func__);
+                        return -1;
+                }
+                *columns |= batch_metrics[i].column;
+                pos = (*end == ',') ? end + 1 : end;
+        }
+        
+        if( (*columns == 0) || (*pos != ':') ) return -1;
+        pos++;
+        
+        if( (pos[0] == '*') && (pos[1] == '\0') ) return 0;
+        
+        /* macs */
+        while(*pos != '\0'){
+                if(strncmp(pos, QUERY_PREFIX, strlen(QUERY_PREFIX)) == 0) pos += strlen(QUERY_PREFIX);
+                for(end = pos; (*end != ',') && (*end != '\0'); end++);
+                len = end - pos;
+                if( (len != MAC_STRING_LEN) || (*num_macs == DBP_BATCH_MAX_MACS) ){
+                        printf("%s: bad mac\n", __func__);
+                        return -1;
+                }
+                memcpy(batch_macs[*num_macs], pos, len);
+                batch_macs[*num_macs][len] = '\0';
+                (*num_macs)++;
+                pos = (*end == ',') ? end + 1 : end;
+        }
+        
+        return (*num_macs > 0) ? 0 : -1;
+}
+
+/* one state line: the entries of the requested metrics, encoded as in the dbp_report_*() */
+static void batch_state(jsonWriter_t *w, newdb_dev_t *node, unsigned int columns, int now)
+{
+        int i, count = 0;
+        
+        for(i = 0; i < (int)(sizeof(batch_metrics) / sizeof(batch_metrics[0])); i++){
+                if(columns & batch_metrics[i].column) count++;
+        }
+        
+        jsonWriterText(w, "dbp state ");
+        batch_hex(w, now, 8);
+        jsonWriterChar(w, ' ');
+        jsonWriterText(w, node->mac);
+        jsonWriterChar(w, ' ');
+        batch_hex(w, count, 2);
+        
+        if(columns & NEWDB_COL_TMP){
+                jsonWriterText(w, "05");
+                batch_hex(w, dbp_swap_uint16((int16_t) node->tmp), 4);
+        }
+        if(columns & NEWDB_COL_HUM){
+                batch_hex(w, batch_pack_percent(node->hum, 0x0f), 4);
+        }
+        if(columns & NEWDB_COL_ALS){
+                jsonWriterText(w, "08");
+                batch_hex(w, dbp_swap_uint16(node->als), 4);
+        }
+        if(columns & NEWDB_COL_BAT){
+                jsonWriterText(w, "11");
+                batch_hex(w, dbp_swap_uint16(node->bat*100), 4);
+        }
+        if(columns & NEWDB_COL_BATL){
+                batch_hex(w, batch_pack_percent(node->batl, 0x10), 4);
+        }
         
-        /* tell the client that data is ready */
-        node_list_flag = false;
+        jsonWriterChar(w, ' ');
+        jsonWriterText(w, temp_parent);
+        jsonWriterText(w, "\r\n");
+}
+
+/* a percentage as 10 bits around the stype, like dbp_report_rh() and dbp_report_bat_lvl() */
+static uint16_t batch_pack_percent(int percent, uint16_t stype)
+{
+        uint16_t value = (uint16_t) (((float) percent / 100.0) * 1023.0);
+        
+        return ((value & 0x0003) << 14) | (stype << 8) | ((value >> 2) & 0x00ff);
+}
+
+static void batch_hex(jsonWriter_t *w, unsigned int value, int digits)
+{
+        static const char hex[] = "0123456789abcdef";
+        char buf[8];
+        int i;
         
-        return 1;
+        for(i = digits - 1; i >= 0; i--){
+                buf[i] = hex[value & 0xf];
+                value >>= 4;
+        }
+        jsonWriterRaw(w, buf, digits);
 }
 
 static uint64_t get_xor(uint64_t x, uint64_t y)
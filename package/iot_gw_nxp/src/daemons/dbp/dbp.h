@@ -44,8 +44,13 @@
 #define QUERY_PARENT		"parent:"
 #define QUERY_KEEPALIVE		"keepalive:"
 #define QUERY_CLOSE			"close:"
+#define QUERY_BATCH			"query:"
 #define QUERY_PREFIX		"0x"
 
+/* batch query: "dbp query:tmp,hum:<mac>,<mac>" */
+#define DBP_BATCH_MAX_MACS	32
+#define DBP_BATCH_LINE_SIZE	96		/* longest line of its reply */
+
 typedef enum{
 	DBP_CMD_LOCATION = 0,
 	DBP_CMD_STATE_REPORT,
@@ -59,6 +64,8 @@ typedef enum{
 }DBP_CMD;
 
 int dbp_parse_data(char *input, uint32_t input_len, char *output, uint32_t output_len, char **extra);
+int dbp_batch_lines(char *input);
+int dbp_batch_query(char *input, char *output, uint32_t output_len);
 int dbp_report_temp(int temp, char *mac, char *output);
 int dbp_report_rh(uint16_t rh, char *mac, char *output);
 int dbp_report_als(uint16_t als, char *mac, char *output);
@@ -42,6 +42,8 @@
 #include <pthread.h>
 #include <netinet/tcp.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 /* local include */
 #include "queue.h"
@@ -54,6 +56,7 @@
 #include "dbp.h"
 #include "dbp_search.h"
 #include "dbp_loc_receiver.h"
+#include "dbp_publish.h"
 #include "mqtt_client.h"
 
 /* version */
@@ -64,6 +67,18 @@
 #define DBP_PORT     "2002"
 #define INPUTBUFFERLEN  MAXMESSAGESIZE
 #define MAX_NUM_OF_CONN    100
+#define DBP_QUEUE_WATERMARK  32    // Pending messages at which producers may back off
+
+/* 1: one thread serves all clients with epoll, 0: one thread per client */
+#define DBP_EPOLL_SERVER   1
+#define DBP_MAX_EVENTS     16
+#define DBP_INPUT_SIZE     512
+#define DBP_OUTPUT_MSGS    64      // Per client, replies and reports that did not fit the socket yet
+
+/* what to do when a client's output queue is full */
+#define DBP_SLOW_DROP_OLDEST   0
+#define DBP_SLOW_DISCONNECT    1
+#define DBP_SLOW_POLICY    DBP_SLOW_DROP_OLDEST
 
 /* struct */
 typedef struct{
@@ -72,14 +87,41 @@ typedef struct{
     int sock_fd[MAX_NUM_OF_CONN];
 }connection_t;
 
+#if DBP_EPOLL_SERVER
+/* one copy of a message, queued by reference on every client it goes to */
+typedef struct{
+    int refs;                         // queues holding it, under dbp_mutex
+    int len;
+    char data[];
+}dbp_msg_t;
+
+typedef struct{
+    int fd;
+    int events;                       // what epoll currently waits for
+    bool closing;                     // slow client shut down, loop closes it
+    char in[DBP_INPUT_SIZE+1];
+    dbp_msg_t *out[DBP_OUTPUT_MSGS];
+    int out_head;
+    int out_tail;
+    int out_sent;                     // bytes of out[out_tail] already sent
+    unsigned int dropped;
+}dbp_conn_t;
+#endif
+
 /* global variable */
 pthread_t zb_msg_thread, dbp_msg_thread;
 pthread_mutex_t dbp_mutex = PTHREAD_MUTEX_INITIALIZER;
 int dbpQueue = -1;
-char inputBuffer[INPUTBUFFERLEN+2];
+char inputBuffer[QUEUE_BATCH_MAX * (INPUTBUFFERLEN+1)];
+int inputLens[QUEUE_BATCH_MAX];
 connection_t connection;
 char version[13] = {0};
 
+#if DBP_EPOLL_SERVER
+static int epoll_fd = -1;
+static dbp_conn_t *conns[MAX_NUM_OF_CONN];    // same index as connection.sock_fd
+#endif
+
 #define NUMINTATTRS  9
 char * intAttrs[NUMINTATTRS] = {"tmp", "hum", "als", "lqi", "bat", "batl", "xloc", "yloc", "zloc"};
 
@@ -89,7 +131,8 @@ int    stringMaxlens[NUMSTRINGATTRS] = {16, 16, 16};
 
 //-MQTT
 mqtt_client *m; //mqtt_client ָ
-char *topic = "iot_td/ZigBee/HA/NXP/"; //
+#define TOPIC_ROOT "iot_td/ZigBee/HA/NXP/"
+char topic[DBP_PUBLISH_TOPIC_LEN] = TOPIC_ROOT; //
 int topic_flags = 0;	//-0 ûгɹ,	1 
 int mqtt_client_connect_flags = 0;	//-0 ,1 
 char *host = "messagesight.demos.ibm.com:1883";//Է
@@ -102,8 +145,24 @@ void dbp_external_send_data_to_clients(char *data);
 
 /* local function prototypes */
 static void *zigbee_msg_receiver(void *arg);
+#if DBP_EPOLL_SERVER
+static void dbp_event_loop(int listen_fd);
+static void dbp_conn_accept(int listen_fd);
+static void dbp_conn_receive(int index);
+static int dbp_conn_command(int index, char *cmd, int len);
+static int dbp_conn_batch(int index, char *cmd, int lines);
+static dbp_msg_t *dbp_msg_alloc(int len);
+static dbp_msg_t *dbp_msg_new(char *data, int len);
+static void dbp_msg_release(dbp_msg_t *msg);
+static int dbp_conn_queue(int index, dbp_msg_t *msg);
+static int dbp_conn_send(int index, char *data, int len);
+static void dbp_conn_flush(int index);
+static void dbp_conn_close(int index);
+#else
 static void *dbp_client_handler(void *arg);
 static void dbp_msg_receiver(int socket_fd);
+static int dbp_get_socket(int index);
+#endif
 static void dbp_init(void);
 static int dbp_update_battery(char *mac);
 static int dbp_update_battery_lvl(char *mac);
@@ -116,12 +175,11 @@ static int dbp_update_temperature(char *mac);
 static int dbp_get_index_number(void);
 static void dbp_add_socket(int sock_fd, int index);
 static void dbp_remove_socket(int index);
-static int dbp_get_socket(int index);
 static int dbp_send_data_to_clients(char *data);
 static void dbp_location_info(char *mac);
 
 static void mqtt_Pclient_connect(void);
-int dbp_send_data_to_clients_mqtt(char *buf,int data);
+int dbp_send_data_to_clients_mqtt(char *mac, char *attr, int data);
 
 int supplement_topic(void)
 {
@@ -132,12 +190,11 @@ int supplement_topic(void)
     
   newdb_zcb_t zcb;
   if ( newDbGetZcbSaddr( shortAddress, &zcb ) ) {
-      strcat(topic,"Coordinator");  
-			strcat(topic,zcb.mac);
-			strcat(topic,"/");
+      snprintf(topic, sizeof(topic), "%sCoordinator%s/", TOPIC_ROOT, zcb.mac);
 			//-DEBUG_PRINTF( "sectional topic = %s\n", topic );
 			topic_flags = 1;
   }
+  return topic_flags;
 }
 
 static void dbp_onError(int error, char * errtext, char * lastchars) {
@@ -264,12 +321,15 @@ zb_msg_thread 
 */
 int main(int argc, char *argv[])
 {
-    int sockfd, new_fd;
+    int sockfd;
     struct addrinfo hints, *servinfo, *p;
+#if !DBP_EPOLL_SERVER
+    int new_fd;
     struct sockaddr_storage their_addr;
     socklen_t sin_size;
-    int yes=1;
     char s[INET6_ADDRSTRLEN];
+#endif
+    int yes=1;
     int rv;
     
     /* version number */
@@ -358,6 +418,9 @@ int main(int argc, char *argv[])
     
     //-mqtt_Sclient_receiver();	//-ն
     
+#if DBP_EPOLL_SERVER
+    dbp_event_loop(sockfd);
+#else
     while(1){//-ûпͻ,еĻרŴһ߳
         //-sĵȴӶгȡһӣһsͬµ׽ӿڲؾ
         //-޵ȴӣ׽ӿΪʽaccept()ýֱµӳ֡
@@ -376,6 +439,7 @@ int main(int argc, char *argv[])
         dbp_msg_receiver(new_fd);
         
     }
+#endif
     
     //-ǺͷϿ,ΪӶϵл
 		mqtt_disconnect(m); //disconnect
@@ -386,7 +450,6 @@ int main(int argc, char *argv[])
 
 static void *zigbee_msg_receiver(void *arg)	//-zigbeeϢմ
 {
-    int i;
 #if 0
     int cnt = 0;
 #endif
@@ -405,17 +468,24 @@ static void *zigbee_msg_receiver(void *arg)	//-zigbee
         jsonSetOnInteger(dbp_onInteger);
         jsonReset();	//-Խṹ帳ֵ
         
-        int numBytes = 0;
+        // Parsed with jsonEatMessage(): writers may send TLV
+        queueSetFormats(dbpQueue, QUEUE_FORMAT_TLV);
+        queueSetWatermark(dbpQueue, DBP_QUEUE_WATERMARK);
+        
+        int i, num = 0;
         
         while(1){
         
-            numBytes = queueRead(dbpQueue, inputBuffer, INPUTBUFFERLEN);
-            printf("Message received. numBytes = %d\n", numBytes);
-            
-            jsonReset();	//-λ
+            // Take all pending messages (e.g. reports of rejoining nodes) per wakeup
+            num = queueReadBatch(dbpQueue, inputBuffer, sizeof(inputBuffer),
+                                 inputLens, QUEUE_BATCH_MAX, -1);
+            printf("Messages received. num = %d\n", num);
             
-            for(i=0; i<numBytes; i++){
-                jsonEat(inputBuffer[i]);	//-һֽһֽڵĽ
+            char * message = inputBuffer;
+            for(i = 0; i < num; i++){
+                jsonReset();	//-λ
+                jsonEatMessage(message, inputLens[i]);
+                message += inputLens[i] + 1;
             }
             
 #if 0
@@ -436,6 +506,7 @@ static void *zigbee_msg_receiver(void *arg)	//-zigbee
     return NULL;
 }
 
+#if !DBP_EPOLL_SERVER
 static void *dbp_client_handler(void *arg)
 {
     int byte_count;
@@ -491,6 +562,7 @@ static void *dbp_client_handler(void *arg)
     
     return NULL;
 }
+#endif
 
 void *mqtt_Pclient_handler(void *arg)	//-̴߳һֱάͷ,ֻҪоҪ
 {
@@ -498,7 +570,6 @@ void *mqtt_Pclient_handler(void *arg)	//-
     char buf[512];
     char output[512];
     int bytes_sent;
-    int index = *((int *) arg);
     int ret; //ֵ
     
     
@@ -537,8 +608,17 @@ void *mqtt_Pclient_handler(void *arg)	//-
 						//-һ̽,Эӿһ߳ʵֵ
 					}
         }
-        	
-        
+        else if(topic_flags == 1)
+        {
+        	// Send the readings collected since the last poll, see dbp_publish.c
+        	dbp_publish_poll(m, topic);
+        	usleep(DBP_PUBLISH_POLL_MS*1000);
+        }
+        else
+        {
+        	supplement_topic();
+        	usleep(DBP_PUBLISH_POLL_MS*1000);
+        }
     }
     
     pthread_exit(NULL);
@@ -602,6 +682,7 @@ static void mqtt_Sclient_receiver(int socket_fd)
 }
 #endif
 
+#if !DBP_EPOLL_SERVER
 static void dbp_msg_receiver(int socket_fd)
 {
     pthread_t client_handler_thread;
@@ -635,6 +716,413 @@ static void dbp_msg_receiver(int socket_fd)
     
     usleep(100*1000);
 }
+
+static int dbp_get_socket(int index)	//-öӦ̵߳׽
+{
+    return connection.sock_fd[index];
+}
+#endif
+
+#if DBP_EPOLL_SERVER
+static int dbp_set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    
+    if(flags == -1){
+        return -1;
+    }
+    
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* serve the listening socket and all clients from this thread */
+static void dbp_event_loop(int listen_fd)
+{
+    struct epoll_event ev, events[DBP_MAX_EVENTS];
+    uint32_t index;
+    int n, i;
+    
+    if( (epoll_fd = epoll_create(MAX_NUM_OF_CONN)) == -1 ){
+        perror("epoll_create");
+        exit(1);
+    }
+    
+    dbp_set_nonblocking(listen_fd);
+    
+    /* clients use their connection index, the listening socket the one after the last */
+    ev.events = EPOLLIN;
+    ev.data.u32 = MAX_NUM_OF_CONN;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1){
+        perror("epoll_ctl");
+        exit(1);
+    }
+    
+    while(1){
+        
+        n = epoll_wait(epoll_fd, events, DBP_MAX_EVENTS, -1);
+        if(n == -1){
+            if(errno != EINTR){
+                perror("epoll_wait");
+            }
+            continue;
+        }
+        
+        for(i=0; i<n; i++){
+            
+            index = events[i].data.u32;
+            
+            if(index == MAX_NUM_OF_CONN){
+                dbp_conn_accept(listen_fd);
+                continue;
+            }
+            
+            /* closed earlier in this round */
+            if(conns[index] == NULL) continue;
+            
+            if(events[i].events & EPOLLERR){
+                newLogAdd( NEWLOG_FROM_DBP,"Connection error");
+                dbp_conn_close(index);
+                continue;
+            }
+            
+            if(events[i].events & (EPOLLIN | EPOLLHUP)){
+                dbp_conn_receive(index);
+                if(conns[index] == NULL) continue;
+            }
+            
+            if(events[i].events & EPOLLOUT){
+                pthread_mutex_lock(&dbp_mutex);
+                dbp_conn_flush(index);
+                pthread_mutex_unlock(&dbp_mutex);
+            }
+        }
+    }
+}
+
+static void dbp_conn_accept(int listen_fd)
+{
+    struct sockaddr_storage their_addr;
+    socklen_t sin_size;
+    char s[INET6_ADDRSTRLEN];
+    struct epoll_event ev;
+    dbp_conn_t *conn;
+    int new_fd, index;
+    
+    while(1){
+        
+        sin_size = sizeof their_addr;
+        new_fd = accept(listen_fd, (struct sockaddr *) &their_addr, &sin_size);
+        if(new_fd == -1){
+            if(errno == EINTR) continue;
+            if( (errno != EAGAIN) && (errno != EWOULDBLOCK) ){
+                perror("accept");
+            }
+            break;
+        }
+        
+        inet_ntop(their_addr.ss_family, get_in_addr( (struct sockaddr *) &their_addr ), s, sizeof s);
+        printf("server: got connection from %s\n", s);
+        
+        index = dbp_get_index_number();
+        if(index < 0){
+            printf("%s: index = %d. error, reached max number of connection\n", __func__, index);
+            close(new_fd);
+            continue;
+        }
+        
+        if( (conn = malloc(sizeof(dbp_conn_t))) == NULL ){
+            printf("%s: error, out of memory\n", __func__);
+            close(new_fd);
+            continue;
+        }
+        
+        dbp_set_nonblocking(new_fd);
+        
+        conn->fd = new_fd;
+        conn->events = EPOLLIN;
+        conn->closing = false;
+        conn->out_head = 0;
+        conn->out_tail = 0;
+        conn->out_sent = 0;
+        conn->dropped = 0;
+        
+        ev.events = EPOLLIN;
+        ev.data.u32 = index;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_fd, &ev) == -1){
+            perror("epoll_ctl");
+            close(new_fd);
+            free(conn);
+            continue;
+        }
+        
+        /* conns[] first: senders only look at it for a registered socket */
+        pthread_mutex_lock(&dbp_mutex);
+        conns[index] = conn;
+        pthread_mutex_unlock(&dbp_mutex);
+        
+        dbp_add_socket(new_fd, index);
+    }
+}
+
+/* one recv per wakeup: epoll is level triggered, so a busy client
+ * comes back next round instead of starving the others */
+static void dbp_conn_receive(int index)
+{
+    dbp_conn_t *conn = conns[index];
+    int byte_count;
+    int i, start;
+    
+    byte_count = recv(conn->fd, conn->in, DBP_INPUT_SIZE, 0);
+    
+    if(byte_count == 0){
+        newLogAdd( NEWLOG_FROM_DBP,"Connection has been closed");
+        dbp_conn_close(index);
+        return;
+    }else if(byte_count < 0){
+        if( (errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK) ) return;
+        /* something wrong has happened */
+        newLogAdd( NEWLOG_FROM_DBP,"Connection error");
+        dbp_conn_close(index);
+        return;
+    }
+    
+    /* pass every command to the parser; clients send one command per write
+     * without a terminator, so like the thread handler the rest is one too */
+    conn->in[byte_count] = '\0';
+    for(i=0, start=0; i<=byte_count; i++){
+        if( (conn->in[i] == '\n') || (conn->in[i] == '\r') || (conn->in[i] == '\0') ){
+            if(i > start){
+                conn->in[i] = '\0';
+                if(dbp_conn_command(index, conn->in + start, i - start) < 0) return;
+            }
+            start = i + 1;
+        }
+    }
+}
+
+/* returns -1 when the command closed the connection */
+static int dbp_conn_command(int index, char *cmd, int len)
+{
+    char output[512];
+    char *node_cmd = NULL;
+    int lines;
+    
+    printf("Message received from client\n");
+    
+    if( (lines = dbp_batch_lines(cmd)) >= 0 ){
+        return dbp_conn_batch(index, cmd, lines);
+    }
+    
+    output[0] = '\0';
+    /* pass it to dpb parser */
+    dbp_parse_data(cmd, len, output, sizeof(output), &node_cmd);
+    
+    /* if it is close link command stop here */
+    if(strcmp(output, "dbp close") == 0){
+        dbp_conn_close(index);
+        return -1;
+    }
+    
+    if(strcmp(output, "dbp node") == 0){
+        if(node_cmd != NULL){
+            dbp_conn_send(index, node_cmd, strlen(node_cmd));
+        }
+    }else{
+        dbp_conn_send(index, output, strlen(output));
+    }
+    
+    return 0;
+}
+
+/* the reply of a batch query is formatted right into the message that is queued */
+static int dbp_conn_batch(int index, char *cmd, int lines)
+{
+    dbp_msg_t *msg, *fit;
+    int size = lines * DBP_BATCH_LINE_SIZE + 1;
+    int len;
+    
+    if( (msg = dbp_msg_alloc(size)) == NULL ) return 0;
+    
+    len = dbp_batch_query(cmd, msg->data, size);
+    if(len <= 0){
+        free(msg);
+        return 0;
+    }
+    
+    /* give back what the reply did not need */
+    if( (fit = realloc(msg, sizeof(dbp_msg_t) + len)) != NULL ) msg = fit;
+    msg->len = len;
+    
+    pthread_mutex_lock(&dbp_mutex);
+    if(conns[index] != NULL){
+        dbp_conn_queue(index, msg);
+    }
+    dbp_msg_release(msg);
+    pthread_mutex_unlock(&dbp_mutex);
+    
+    return 0;
+}
+
+static dbp_msg_t *dbp_msg_alloc(int len)
+{
+    dbp_msg_t *msg = malloc(sizeof(dbp_msg_t) + len);
+    
+    if(msg == NULL){
+        printf("%s: error, out of memory\n", __func__);
+        return NULL;
+    }
+    
+    /* the caller's own reference, dropped with dbp_msg_release() once queued */
+    msg->refs = 1;
+    msg->len = len;
+    
+    return msg;
+}
+
+static dbp_msg_t *dbp_msg_new(char *data, int len)
+{
+    dbp_msg_t *msg = dbp_msg_alloc(len);
+    
+    if(msg != NULL){
+        memcpy(msg->data, data, len);
+    }
+    
+    return msg;
+}
+
+/* called with dbp_mutex held, by the creator and once per queue it leaves */
+static void dbp_msg_release(dbp_msg_t *msg)
+{
+    if(--msg->refs <= 0){
+        free(msg);
+    }
+}
+
+/* reply to one client */
+static int dbp_conn_send(int index, char *data, int len)
+{
+    dbp_msg_t *msg;
+    int ret = -1;
+    
+    if(len <= 0) return 0;
+    
+    if( (msg = dbp_msg_new(data, len)) == NULL ) return -1;
+    
+    pthread_mutex_lock(&dbp_mutex);
+    if(conns[index] != NULL){
+        ret = dbp_conn_queue(index, msg);
+    }
+    dbp_msg_release(msg);
+    pthread_mutex_unlock(&dbp_mutex);
+    
+    return ret;
+}
+
+/* called with dbp_mutex held. When a client does not keep up either its
+ * oldest unsent message goes, or the client, as DBP_SLOW_POLICY says;
+ * a message that was partly sent is always finished first */
+static int dbp_conn_queue(int index, dbp_msg_t *msg)
+{
+    dbp_conn_t *conn = conns[index];
+    int next = (conn->out_head + 1) % DBP_OUTPUT_MSGS;
+#if (DBP_SLOW_POLICY != DBP_SLOW_DISCONNECT)
+    int oldest;
+#endif
+    
+    if(conn->closing) return -1;
+    
+    if(next == conn->out_tail){
+        
+        conn->dropped++;
+        
+#if (DBP_SLOW_POLICY == DBP_SLOW_DISCONNECT)
+        printf("%s: client %d is not reading, disconnected\n", __func__, index);
+        /* the event loop sees the hang-up and closes it */
+        conn->closing = true;
+        shutdown(conn->fd, SHUT_RDWR);
+        return -1;
+#else
+        if(conn->out_sent == 0){
+            dbp_msg_release(conn->out[conn->out_tail]);
+            conn->out_tail = (conn->out_tail + 1) % DBP_OUTPUT_MSGS;
+        }else{
+            /* keep the one on the wire in the slot of the one after it */
+            oldest = (conn->out_tail + 1) % DBP_OUTPUT_MSGS;
+            dbp_msg_release(conn->out[oldest]);
+            conn->out[oldest] = conn->out[conn->out_tail];
+            conn->out_tail = oldest;
+        }
+        if( (conn->dropped % 100) == 1 ){
+            printf("%s: client %d is not reading, %u messages dropped\n", __func__, index, conn->dropped);
+        }
+#endif
+    }
+    
+    msg->refs++;
+    conn->out[conn->out_head] = msg;
+    conn->out_head = next;
+    
+    dbp_conn_flush(index);
+    
+    return 0;
+}
+
+/* called with dbp_mutex held */
+static void dbp_conn_flush(int index)
+{
+    dbp_conn_t *conn = conns[index];
+    struct epoll_event ev;
+    dbp_msg_t *msg;
+    int bytes_sent;
+    int events = EPOLLIN;
+    
+    while(conn->out_tail != conn->out_head){
+        msg = conn->out[conn->out_tail];
+        bytes_sent = send(conn->fd, msg->data + conn->out_sent, msg->len - conn->out_sent, MSG_NOSIGNAL);
+        if(bytes_sent <= 0){
+            /* full, or broken: the latter shows up as an epoll error */
+            break;
+        }
+        conn->out_sent += bytes_sent;
+        if(conn->out_sent >= msg->len){
+            dbp_msg_release(msg);
+            conn->out_tail = (conn->out_tail + 1) % DBP_OUTPUT_MSGS;
+            conn->out_sent = 0;
+        }
+    }
+    
+    /* wait for room only while something is left */
+    if(conn->out_tail != conn->out_head){
+        events |= EPOLLOUT;
+    }
+    
+    if(events != conn->events){
+        ev.events = events;
+        ev.data.u32 = index;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+static void dbp_conn_close(int index)
+{
+    dbp_conn_t *conn = conns[index];
+    
+    dbp_remove_socket(index);
+    
+    pthread_mutex_lock(&dbp_mutex);
+    conns[index] = NULL;
+    while(conn->out_tail != conn->out_head){
+        dbp_msg_release(conn->out[conn->out_tail]);
+        conn->out_tail = (conn->out_tail + 1) % DBP_OUTPUT_MSGS;
+    }
+    pthread_mutex_unlock(&dbp_mutex);
+    
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn);
+}
+#endif
  
 static void dbp_init(void)
 {
@@ -663,7 +1151,11 @@ static int dbp_update_battery(char *mac)
     printf("%s: value = %d\n", __func__, value);
     if(value >= 0){
         if(dbp_report_bat((uint16_t) value, mac, output) == 0){
+#if DBP_SUPPORT_clients_mode
             dbp_send_data_to_clients(output);
+#else
+            dbp_send_data_to_clients_mqtt(mac, "bat", value);
+#endif
             printf("bat voltage sent to client");
         }
     }else{
@@ -683,7 +1175,11 @@ static int dbp_update_battery_lvl(char *mac)
     printf("%s: value = %d\n", __func__, value);
     if(value >= 0){
         if(dbp_report_bat_lvl((uint16_t) value, mac, output) == 0){
+#if DBP_SUPPORT_clients_mode
             dbp_send_data_to_clients(output);
+#else
+            dbp_send_data_to_clients_mqtt(mac, "batl", value);
+#endif
             printf("bat level sent to client");
         }
     }else{
@@ -750,7 +1246,11 @@ static int dbp_update_illuminance(char *mac)
     value = parsingGetIntAttr("als");
     if(value >= 0){
         if(dbp_report_als((uint16_t) value, mac, output) == 0){
+#if DBP_SUPPORT_clients_mode
             dbp_send_data_to_clients(output);
+#else
+            dbp_send_data_to_clients_mqtt(mac, "als", value);
+#endif
             printf("als sent to client");
         }
     }else{
@@ -769,7 +1269,11 @@ static int dbp_update_humidity(char *mac)
     value = parsingGetIntAttr("hum");
     if(value >= 0){
         if(dbp_report_rh((uint16_t) value, mac, output) == 0){
+#if DBP_SUPPORT_clients_mode
             dbp_send_data_to_clients(output);
+#else
+            dbp_send_data_to_clients_mqtt(mac, "hum", value);
+#endif
             printf("hum sent to client");
         }
     }else{
@@ -791,7 +1295,7 @@ static int dbp_update_temperature(char *mac)
 #if DBP_SUPPORT_clients_mode			
 			dbp_send_data_to_clients(output);	//-¶ȷ͸˿ͻ,ײ
 #else
-			dbp_send_data_to_clients_mqtt(output, value);
+			dbp_send_data_to_clients_mqtt(mac, "tmp", value);
 #endif			
 			printf("temp sent to client");
 		}
@@ -855,11 +1359,6 @@ static void dbp_remove_socket(int index)
     pthread_mutex_unlock(&dbp_mutex);
 }
 
-static int dbp_get_socket(int index)	//-öӦ̵߳׽
-{
-    return connection.sock_fd[index];
-}
-
 void dbp_external_send_data_to_clients(char *data)
 {
     dbp_send_data_to_clients(data);
@@ -868,51 +1367,56 @@ void dbp_external_send_data_to_clients(char *data)
 static int dbp_send_data_to_clients(char *data)	//-ݿݷ͸ͻͨ׽
 {
     int i, j;
+#if DBP_EPOLL_SERVER
+    dbp_msg_t *msg;
+#else
     int bytes_sent = 0;
+#endif
     
     if(data == NULL) return -1;
     
     if(connection.connected == false) return -1;
     
+#if DBP_EPOLL_SERVER
+    /* one copy for all clients */
+    if( (msg = dbp_msg_new(data, strlen(data)+1)) == NULL ) return -1;
+#endif
+    
     pthread_mutex_lock(&dbp_mutex);
     
     for(i=0, j=0; i<MAX_NUM_OF_CONN; i++){
         if(connection.sock_fd[i] != 0){
             j++;
+#if DBP_EPOLL_SERVER
+            /* queued; the event loop sends what the socket does not take now */
+            if(conns[i] != NULL){
+                dbp_conn_queue(i, msg);
+            }
+#else
             bytes_sent = send(connection.sock_fd[i], data, strlen(data)+1, 0);
             printf("%s: %d bytes sent\n", __func__, bytes_sent);
             usleep(1000); /* 1ms delay */
+#endif
             if(j >= connection.conn_number){
                 break;
             }
         }
     }
     
+#if DBP_EPOLL_SERVER
+    dbp_msg_release(msg);
+#endif
+    
     pthread_mutex_unlock(&dbp_mutex);
     
     return 0;
 }
 
-int dbp_send_data_to_clients_mqtt(char *buf,int data)
+int dbp_send_data_to_clients_mqtt(char *mac, char *attr, int data)
 {
-	int ret; //ֵ
-	int Qos; //Quality of Service
-	
-	if(topic_flags == 1)
-	{
-		//publish message
-		Qos = QOS_EXACTLY_ONCE; //Qos
-		strcat(topic,buf);
-		if ( m != NULL )
-			ret = mqtt_publish(m, topic, data, Qos);//Ϣ
-		printf("mqtt client publish,  return code = %d\n", ret);
-	}
-	else
-	{//-ûк峢Բһ
-		supplement_topic();
-		printf("mqtt topic is bad\n");
-	}
-	
+	// Only queued here; mqtt_Pclient_handler publishes it with the other
+	// readings of the node once the DBP_PUBLISH_WINDOW_MS window expires
+	return dbp_publish_reading(mac, attr, data);
 }
 
 
@@ -0,0 +1,311 @@
+/****************************************************************************
+ *
+ * PROJECT:            	Wireless Sensor Network for Green Building
+ *
+ * AUTHOR:          	Debby Nirwan
+ *
+ * DESCRIPTION:        	DBP MQTT publish scheduler
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dbp_publish.h"
+#include "iotStats.h"
+
+#define DBP_PUBLISH_MAC_LEN         17
+#define DBP_PUBLISH_PAYLOAD_LEN     160
+
+typedef struct {
+    char *name;
+    int   topic_class;
+} dbp_publish_attr_t;
+
+static const dbp_publish_attr_t attrs[] = {
+    { "tmp",  DBP_PUB_TELEMETRY },
+    { "hum",  DBP_PUB_TELEMETRY },
+    { "als",  DBP_PUB_TELEMETRY },
+    { "bat",  DBP_PUB_STATUS    },
+    { "batl", DBP_PUB_STATUS    },
+};
+#define NUM_PUBLISH_ATTRS   (int)(sizeof(attrs) / sizeof(attrs[0]))
+
+// Latest unpublished values of one node. Bit n of dirty is set while
+// values[n] (attribute attrs[n]) still has to be sent.
+typedef struct {
+    char            mac[DBP_PUBLISH_MAC_LEN];
+    int             values[NUM_PUBLISH_ATTRS];
+    unsigned int    dirty;
+    struct timespec since;      // time of the oldest unpublished value
+    unsigned int    stamps[NUM_PUBLISH_ATTRS];  // iotStatsNow() of each value, for IOT_STATS_DBP_PUBLISH
+} dbp_publish_slot_t;
+
+// One message taken out of the table by a poll
+typedef struct {
+    char            topic[DBP_PUBLISH_TOPIC_LEN];
+    char            payload[DBP_PUBLISH_PAYLOAD_LEN];
+    char            mac[DBP_PUBLISH_MAC_LEN];
+    int             values[NUM_PUBLISH_ATTRS];
+    unsigned int    stamps[NUM_PUBLISH_ATTRS];
+    unsigned int    mask;
+    int             qos;
+    int             token;
+} dbp_publish_msg_t;
+
+static dbp_publish_slot_t slots[DBP_PUBLISH_MAX_NODES];
+static int                num_slots = 0;
+static pthread_mutex_t    publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int dbp_publish_attr_index(char *attr)
+{
+    int i;
+
+    for(i = 0; i < NUM_PUBLISH_ATTRS; i++){
+        if(strcmp(attrs[i].name, attr) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int dbp_publish_class_qos(int topic_class)
+{
+    return (topic_class == DBP_PUB_STATUS) ? DBP_PUBLISH_QOS_STATUS : DBP_PUBLISH_QOS_TELEMETRY;
+}
+
+static long dbp_publish_elapsed_ms(struct timespec *since, struct timespec *now)
+{
+    return (now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// Must be called with publish_mutex held
+static dbp_publish_slot_t *dbp_publish_find_slot(char *mac, bool create)
+{
+    int i;
+
+    for(i = 0; i < num_slots; i++){
+        if(strcmp(slots[i].mac, mac) == 0){
+            return &slots[i];
+        }
+    }
+    if(!create){
+        return NULL;
+    }
+    // Reuse a slot whose node has nothing pending before growing the table
+    for(i = 0; i < num_slots; i++){
+        if(slots[i].dirty == 0){
+            break;
+        }
+    }
+    if(i == num_slots){
+        if(num_slots == DBP_PUBLISH_MAX_NODES){
+            return NULL;
+        }
+        num_slots++;
+    }
+    memset(&slots[i], 0, sizeof(slots[i]));
+    strncpy(slots[i].mac, mac, DBP_PUBLISH_MAC_LEN - 1);
+    return &slots[i];
+}
+
+/**
+ * \brief Queue a reading of a node for publishing. Readings of the same node
+ *        are collected for DBP_PUBLISH_WINDOW_MS and then sent together; a
+ *        second value of an attribute within the window replaces the first.
+ * \retval 0 on success, -1 for an unknown attribute or a full node table
+ */
+int dbp_publish_reading(char *mac, char *attr, int value)
+{
+    dbp_publish_slot_t *slot;
+    int index;
+
+    index = dbp_publish_attr_index(attr);
+    if(index < 0 || mac == NULL){
+        return -1;
+    }
+
+    pthread_mutex_lock(&publish_mutex);
+    slot = dbp_publish_find_slot(mac, true);
+    if(slot == NULL){
+        pthread_mutex_unlock(&publish_mutex);
+        printf("dbp publish: node table full, %s dropped\n", mac);
+        return -1;
+    }
+    if(slot->dirty == 0){
+        clock_gettime(CLOCK_MONOTONIC, &slot->since);
+    }
+    slot->values[index] = value;
+    slot->stamps[index] = iotStatsNow();
+    slot->dirty |= (1u << index);
+    pthread_mutex_unlock(&publish_mutex);
+
+    return 0;
+}
+
+static void dbp_publish_format(dbp_publish_msg_t *msg, char *root, int index)
+{
+    int i, len;
+
+    if(index >= 0){
+        snprintf(msg->topic, sizeof(msg->topic), "%sdevice%s/%s", root, msg->mac, attrs[index].name);
+        snprintf(msg->payload, sizeof(msg->payload), "%d", msg->values[index]);
+        msg->qos = dbp_publish_class_qos(attrs[index].topic_class);
+        return;
+    }
+
+    snprintf(msg->topic, sizeof(msg->topic), "%sdevice%s", root, msg->mac);
+    msg->qos = QOS_AT_MOST_ONCE;
+    len = snprintf(msg->payload, sizeof(msg->payload), "{");
+    for(i = 0; i < NUM_PUBLISH_ATTRS; i++){
+        if(msg->mask & (1u << i)){
+            len += snprintf(msg->payload + len, sizeof(msg->payload) - len, "%s\"%s\":%d",
+                            (len > 1) ? "," : "", attrs[i].name, msg->values[i]);
+            // The packed message goes with the strongest QoS of its readings
+            if(dbp_publish_class_qos(attrs[i].topic_class) > msg->qos){
+                msg->qos = dbp_publish_class_qos(attrs[i].topic_class);
+            }
+        }
+    }
+    snprintf(msg->payload + len, sizeof(msg->payload) - len, "}");
+}
+
+// Take up to max due messages out of the table
+static int dbp_publish_collect(dbp_publish_msg_t *msgs, int max, char *root)
+{
+    struct timespec now;
+    int i, n = 0;
+#if !DBP_PUBLISH_PACK
+    int a;
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&publish_mutex);
+    for(i = 0; i < num_slots && n < max; i++){
+        if(slots[i].dirty == 0 ||
+           dbp_publish_elapsed_ms(&slots[i].since, &now) < DBP_PUBLISH_WINDOW_MS){
+            continue;
+        }
+#if DBP_PUBLISH_PACK
+        strcpy(msgs[n].mac, slots[i].mac);
+        memcpy(msgs[n].values, slots[i].values, sizeof(msgs[n].values));
+        memcpy(msgs[n].stamps, slots[i].stamps, sizeof(msgs[n].stamps));
+        msgs[n].mask = slots[i].dirty;
+        slots[i].dirty = 0;
+        dbp_publish_format(&msgs[n], root, -1);
+        n++;
+#else
+        for(a = 0; a < NUM_PUBLISH_ATTRS && n < max; a++){
+            if(slots[i].dirty & (1u << a)){
+                strcpy(msgs[n].mac, slots[i].mac);
+                memcpy(msgs[n].values, slots[i].values, sizeof(msgs[n].values));
+                memcpy(msgs[n].stamps, slots[i].stamps, sizeof(msgs[n].stamps));
+                msgs[n].mask = (1u << a);
+                slots[i].dirty &= ~(1u << a);
+                dbp_publish_format(&msgs[n], root, a);
+                n++;
+            }
+        }
+#endif
+    }
+    pthread_mutex_unlock(&publish_mutex);
+
+    return n;
+}
+
+// Put the readings of a failed publish back, unless newer values came in meanwhile
+static void dbp_publish_restore(dbp_publish_msg_t *msg)
+{
+    dbp_publish_slot_t *slot;
+    int i;
+
+    pthread_mutex_lock(&publish_mutex);
+    slot = dbp_publish_find_slot(msg->mac, true);
+    if(slot != NULL){
+        if(slot->dirty == 0){
+            clock_gettime(CLOCK_MONOTONIC, &slot->since);
+        }
+        for(i = 0; i < NUM_PUBLISH_ATTRS; i++){
+            if((msg->mask & (1u << i)) && !(slot->dirty & (1u << i))){
+                slot->values[i] = msg->values[i];
+                slot->stamps[i] = msg->stamps[i];
+                slot->dirty |= (1u << i);
+            }
+        }
+    }
+    pthread_mutex_unlock(&publish_mutex);
+}
+
+/**
+ * \brief Publish the readings whose window has expired. All messages of one
+ *        poll are handed to the client first and only then waited for, so a
+ *        poll costs one broker round trip instead of one per reading.
+ * \param m     connected MQTT client
+ * \param root  topic prefix, e.g. "iot_td/ZigBee/HA/NXP/Coordinator<mac>/"
+ * \retval number of messages published, -1 when the client is not connected
+ */
+int dbp_publish_poll(mqtt_client *m, char *root)
+{
+    dbp_publish_msg_t msgs[DBP_PUBLISH_BATCH];
+    int i, a, n, rc, timeout;
+    int published = 0;
+
+    if(mqtt_is_connected(m) == 0){
+        return -1;
+    }
+
+    n = dbp_publish_collect(msgs, DBP_PUBLISH_BATCH, root);
+    if(n == 0){
+        return 0;
+    }
+
+    // Hand all messages to the client without waiting for each handshake
+    timeout = m->timeout;
+    mqtt_set_timeout(m, 0);
+    for(i = 0; i < n; i++){
+        msgs[i].token = mqtt_publish(m, msgs[i].topic, msgs[i].payload, msgs[i].qos);
+    }
+    mqtt_set_timeout(m, timeout);
+
+    for(i = 0; i < n; i++){
+        rc = msgs[i].token;
+        if(rc >= 0 && msgs[i].qos > QOS_AT_MOST_ONCE && timeout > 0){
+            rc = MQTTClient_waitForCompletion(m->client, msgs[i].token, timeout);
+        }
+        if(rc < 0){
+            printf("dbp publish %s failed, return code = %d\n", msgs[i].topic, rc);
+            dbp_publish_restore(&msgs[i]);
+        }else{
+            published++;
+            for(a = 0; a < NUM_PUBLISH_ATTRS; a++){
+                if(msgs[i].mask & (1u << a)){
+                    iotStatsSince(IOT_STATS_DBP_PUBLISH, msgs[i].stamps[a]);
+                }
+            }
+        }
+    }
+
+    return published;
+}
@@ -0,0 +1,59 @@
+/****************************************************************************
+ *
+ * PROJECT:            	Wireless Sensor Network for Green Building
+ *
+ * AUTHOR:          	Debby Nirwan
+ *
+ * DESCRIPTION:        	DBP MQTT publish scheduler
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+#ifndef __DBP_PUBLISH_H__
+#define __DBP_PUBLISH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mqtt_client.h"
+
+// Readings for one node are held for at most this long and then sent as one
+// publish; a newer value for the same attribute replaces the older one.
+#define DBP_PUBLISH_WINDOW_MS       1000
+// How often dbp_publish_poll() is expected to run
+#define DBP_PUBLISH_POLL_MS         100
+// 1: one JSON payload per node ({"tmp":2150,"hum":4500}) on <root>device<mac>
+// 0: one plain payload per attribute on <root>device<mac>/<attr>
+#define DBP_PUBLISH_PACK            1
+
+// Topic classes and the QoS they are published with
+#define DBP_PUB_TELEMETRY           0   // periodic readings, superseded by the next window
+#define DBP_PUB_STATUS              1   // rarely changing node state, must reach the broker
+#define DBP_PUBLISH_QOS_TELEMETRY   QOS_AT_MOST_ONCE
+#define DBP_PUBLISH_QOS_STATUS      QOS_AT_LEAST_ONCE
+
+#define DBP_PUBLISH_MAX_NODES       64
+#define DBP_PUBLISH_BATCH           16  // publishes in flight per poll
+#define DBP_PUBLISH_TOPIC_LEN       128
+
+int dbp_publish_reading(char *mac, char *attr, int value);
+int dbp_publish_poll(mqtt_client *m, char *root);
+
+#endif
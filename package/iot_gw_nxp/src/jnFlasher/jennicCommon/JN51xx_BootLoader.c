@@ -755,6 +755,27 @@ teStatus eBL_FlashErase(tsPRG_Context *psContext)
 }
 
 
+/****************************************************************************
+ *
+ * NAME: eBL_FlashSectorErase
+ *
+ * DESCRIPTION:
+ * Erase one sector of the selected flash
+ *
+ * RETURNS:
+ * teStatus     E_PRG_UNSUPPORTED_OPERATION if the bootloader can only erase all
+ *
+ ****************************************************************************/
+teStatus eBL_FlashSectorErase(tsPRG_Context *psContext, uint8_t u8Sector)
+{
+    teBL_Response eResponse = 0;
+    teBL_MessageType eRxType = 0;
+
+    eResponse = eBL_Request(psContext, BL_TIMEOUT_10S, E_BL_MSG_TYPE_FLASH_SECTOR_ERASE_REQUEST, 1, &u8Sector, 0, NULL, &eRxType, NULL, NULL);
+    return eBL_CheckResponse(__FUNCTION__, eResponse, eRxType, E_BL_MSG_TYPE_FLASH_SECTOR_ERASE_RESPONSE);
+}
+
+
 /****************************************************************************
  *
  * NAME: iBL_ReadFlash
@@ -770,12 +791,39 @@ teStatus eBL_FlashErase(tsPRG_Context *psContext)
  ****************************************************************************/
 teStatus eBL_FlashRead(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer)
 {
-    uint8_t u8RxDataLen = 0;
+    teStatus eStatus;
+
+    if(pu8Buffer == NULL)
+    {
+        DBG_vPrintf(TRACE_BOOTLOADER, "Parameter error\n");
+        return E_PRG_BAD_PARAMETER;
+    }
+
+    if ((eStatus = eBL_FlashReadRequest(psContext, u32Address, u8Length)) != E_PRG_OK)
+    {
+        return eStatus;
+    }
+    return eBL_FlashReadResponse(psContext, u8Length, pu8Buffer);
+}
+
+
+/****************************************************************************
+ *
+ * NAME: eBL_FlashReadRequest
+ *
+ * DESCRIPTION:
+ * Send a flash read request without waiting for the data. Collect the data
+ * with eBL_FlashReadResponse, in the order the requests were sent.
+ *
+ * RETURNS:
+ * teStatus
+ *
+ ****************************************************************************/
+teStatus eBL_FlashReadRequest(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length)
+{
     uint8_t au8CmdBuffer[6];
-    teBL_Response eResponse = 0;
-    teBL_MessageType eRxType = 0;
 
-    if(u8Length > 0xfc || pu8Buffer == NULL)
+    if(u8Length > 0xfc)
     {
         DBG_vPrintf(TRACE_BOOTLOADER, "Parameter error\n");
         return E_PRG_BAD_PARAMETER;
@@ -788,7 +836,17 @@ teStatus eBL_FlashRead(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8
     au8CmdBuffer[4] = u8Length;
     au8CmdBuffer[5] = 0;
 
-    eResponse = eBL_Request(psContext, BL_TIMEOUT_1S, E_BL_MSG_TYPE_FLASH_READ_REQUEST, 6, au8CmdBuffer, 0, NULL, &eRxType, &u8RxDataLen, pu8Buffer);
+    return eBL_WriteMessage(psContext, E_BL_MSG_TYPE_FLASH_READ_REQUEST, 6, au8CmdBuffer, 0, NULL);
+}
+
+
+teStatus eBL_FlashReadResponse(tsPRG_Context *psContext, uint8_t u8Length, uint8_t *pu8Buffer)
+{
+    uint8_t u8RxDataLen = 0;
+    teBL_Response eResponse = 0;
+    teBL_MessageType eRxType = 0;
+
+    eResponse = eBL_ReadMessage(psContext, BL_TIMEOUT_1S, &eRxType, &u8RxDataLen, pu8Buffer);
 
     if (u8RxDataLen != u8Length)
     {
@@ -814,12 +872,35 @@ teStatus eBL_FlashRead(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8
  *
  ****************************************************************************/
 teStatus eBL_FlashWrite(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer)
+{
+    teStatus eStatus;
+
+    if ((eStatus = eBL_FlashWriteRequest(psContext, u32Address, u8Length, pu8Buffer)) != E_PRG_OK)
+    {
+        return eStatus;
+    }
+    return eBL_FlashWriteResponse(psContext);
+}
+
+
+/****************************************************************************
+ *
+ * NAME: eBL_FlashWriteRequest
+ *
+ * DESCRIPTION:
+ * Send a flash program request without waiting for the result, so that the
+ * next one can be on the wire while the device programs this one. Each
+ * request must be matched by one eBL_FlashWriteResponse, in order.
+ *
+ * RETURNS:
+ * teStatus
+ *
+ ****************************************************************************/
+teStatus eBL_FlashWriteRequest(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer)
 {
     uint8_t au8CmdBuffer[4];
-    teBL_Response eResponse = 0;
-    teBL_MessageType eRxType = 0;
 
-    if(u8Length > 0xfc || pu8Buffer == NULL)
+    if(u8Length > 0xf9 || pu8Buffer == NULL)
     {
         return E_PRG_BAD_PARAMETER;
     }
@@ -829,8 +910,17 @@ teStatus eBL_FlashWrite(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u
     au8CmdBuffer[2] = (uint8_t)(u32Address >> 16) & 0xff;
     au8CmdBuffer[3] = (uint8_t)(u32Address >> 24) & 0xff;
 
-    eResponse = eBL_Request(psContext, BL_TIMEOUT_1S, E_BL_MSG_TYPE_FLASH_PROGRAM_REQUEST, 4, au8CmdBuffer, u8Length, pu8Buffer, &eRxType, NULL, NULL);
-    return eBL_CheckResponse(__FUNCTION__, eResponse, eRxType, E_BL_MSG_TYPE_FLASH_PROGRAM_RESPONSE);
+    return eBL_WriteMessage(psContext, E_BL_MSG_TYPE_FLASH_PROGRAM_REQUEST, 4, au8CmdBuffer, u8Length, pu8Buffer);
+}
+
+
+teStatus eBL_FlashWriteResponse(tsPRG_Context *psContext)
+{
+    teBL_Response eResponse = 0;
+    teBL_MessageType eRxType = 0;
+
+    eResponse = eBL_ReadMessage(psContext, BL_TIMEOUT_1S, &eRxType, NULL, NULL);
+    return eBL_CheckResponse("eBL_FlashWrite", eResponse, eRxType, E_BL_MSG_TYPE_FLASH_PROGRAM_RESPONSE);
 }
 
 
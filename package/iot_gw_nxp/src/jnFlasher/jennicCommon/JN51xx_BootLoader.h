@@ -103,9 +103,16 @@ teStatus eBL_FlashIdRead(tsPRG_Context *psContext, uint8_t *pu8ManufacturerID, u
 
 teStatus eBL_FlashStatusRegisterWrite(tsPRG_Context *psContext, uint8_t u8StatusReg);
 teStatus eBL_FlashErase(tsPRG_Context *psContext);
+teStatus eBL_FlashSectorErase(tsPRG_Context *psContext, uint8_t u8Sector);
 teStatus eBL_FlashRead(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer);
 teStatus eBL_FlashWrite(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer);
 
+/* Split flash requests: send several, then collect the responses in order */
+teStatus eBL_FlashReadRequest(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length);
+teStatus eBL_FlashReadResponse(tsPRG_Context *psContext, uint8_t u8Length, uint8_t *pu8Buffer);
+teStatus eBL_FlashWriteRequest(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer);
+teStatus eBL_FlashWriteResponse(tsPRG_Context *psContext);
+
 teStatus eBL_EEPROMErase(tsPRG_Context *psContext, int iEraseAll);
 teStatus eBL_EEPROMRead(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer);
 teStatus eBL_EEPROMWrite(tsPRG_Context *psContext, uint32_t u32Address, uint8_t u8Length, uint8_t *pu8Buffer);
@@ -95,6 +95,18 @@
 
 #define BL_MAX_CHUNK_SIZE   248
 
+/* Flash chunks: the JN514x compatible size, and for fast programming the largest
+ * multiple of the 16 byte flash word that fits in a bootloader frame */
+#define BL_FLASH_CHUNK_SIZE         128
+#define BL_FAST_FLASH_CHUNK_SIZE    240
+
+/* Most requests kept in flight in fast programming */
+#define BL_MAX_WINDOW               8
+
+/* JN516x internal flash is erased in 32kB sectors, up to 512kB on the JN5169 */
+#define JN516X_FLASH_SECTOR_SIZE    0x8000
+#define JN516X_MAX_FLASH_SECTORS    16
+
 #define RSTCTRL_REGISTER_ADDRESS                0x0200104C
 #define RSTCTRL_CPU_REBOOT_MASK                 (1 << 1)
 
@@ -193,6 +205,13 @@ static teStatus ePRG_FlashProgrammerExtensionLoad(tsPRG_Context *psContext, cons
 static teStatus ePRG_FlashProgrammerExtensionReturn(tsPRG_Context *psContext);
 static teStatus ePRG_SetUpImage(tsPRG_Context *psContext, tsFW_Info *psFWImage, tsChipDetails *psChipDetails);
 static teStatus ePRG_ConfirmAlways(void *pvUser, const char *pcTitle, const char *pcText);
+static teStatus ePRG_FlashWriteImage(tsPRG_Context *psContext, uint32_t u32Start, uint32_t u32Length, uint8_t u8ChunkSize, uint8_t u8Window,
+                                     const char *pcOperationText, tcbFW_Progress cbProgress, void *pvUser);
+static teStatus ePRG_FlashVerifyImage(tsPRG_Context *psContext, uint32_t u32Start, uint32_t u32Length, uint8_t u8ChunkSize, uint8_t u8Window, uint32_t u32Stride,
+                                      const char *pcOperationText, const char *pcStepText, tcbFW_Progress cbProgress, void *pvUser);
+static teStatus ePRG_FlashProgramChanged(tsPRG_Context *psContext, uint8_t u8ChunkSize, uint8_t u8Window, const char *pcOperationText, tcbFW_Progress cbProgress, void *pvUser,
+                                         uint32_t *pu32Changed, uint32_t *pu32Sectors);
+static teStatus ePRG_FlashEraseWrite(tsPRG_Context *psContext, uint8_t u8ChunkSize, uint8_t u8Window, const char *pcOperationText, tcbFW_Progress cbProgress, void *pvUser);
 #if 0
 static teStatus ePRG_ResetDevice(tsPRG_Context *psContext);
 #endif
@@ -422,6 +441,64 @@ teStatus ePRG_ConnectionUpdate(tsPRG_Context *psContext, tsConnection *psConnect
 #endif
 
 
+teStatus ePRG_BaudRateNegotiate(tsPRG_Context *psContext, uint32_t u32CurrentRate, const uint32_t *pu32Rates, uint32_t *pu32Rate)
+{
+    uint32_t u32ChipId;
+    uint32_t u32BootloaderVersion;
+
+    if ((!psContext) || (!pu32Rates) || (!pu32Rate))
+    {
+        return E_PRG_NULL_PARAMETER;
+    }
+
+    *pu32Rate = u32CurrentRate;
+
+    for (; *pu32Rates != 0; pu32Rates++)
+    {
+        if (*pu32Rates == u32CurrentRate)
+        {
+            /* The rest are no faster than what we have */
+            break;
+        }
+
+        /* Don't move the device to a rate the local port can't follow */
+        if (eUART_SetBaudRate(psContext->iUartFD, &psContext->sUartOptions, *pu32Rates) != E_PRG_OK)
+        {
+            DBG_vPrintf(TRACE_PROGRAMMER, "Port does not support %d\n", *pu32Rates);
+            eUART_SetBaudRate(psContext->iUartFD, &psContext->sUartOptions, u32CurrentRate);
+            continue;
+        }
+        eUART_SetBaudRate(psContext->iUartFD, &psContext->sUartOptions, u32CurrentRate);
+
+        /* Some 4x bootloaders corrupt the CRC of this response, the chip id read below decides */
+        eBL_SetBaudrate(psContext, *pu32Rates);
+        eUART_SetBaudRate(psContext->iUartFD, &psContext->sUartOptions, *pu32Rates);
+
+        if (eBL_ChipIdRead(psContext, &u32ChipId, &u32BootloaderVersion) == E_PRG_OK)
+        {
+            DBG_vPrintf(TRACE_PROGRAMMER, "Selected baud rate %d\n", *pu32Rates);
+            psContext->u32BaudRate = *pu32Rates;
+            *pu32Rate = *pu32Rates;
+            return ePRG_SetStatus(psContext, E_PRG_OK, "");
+        }
+
+        /* The link is not clean at this rate: move the device back, in case it did switch */
+        DBG_vPrintf(TRACE_PROGRAMMER, "No response at %d\n", *pu32Rates);
+        eBL_SetBaudrate(psContext, u32CurrentRate);
+        eUART_SetBaudRate(psContext->iUartFD, &psContext->sUartOptions, u32CurrentRate);
+        eUART_Flush(psContext->iUartFD);
+
+        if (eBL_ChipIdRead(psContext, &u32ChipId, &u32BootloaderVersion) != E_PRG_OK)
+        {
+            return ePRG_SetStatus(psContext, E_PRG_COMMS_FAILED, "selecting baud rate");
+        }
+    }
+
+    psContext->u32BaudRate = u32CurrentRate;
+    return ePRG_SetStatus(psContext, E_PRG_OK, "");
+}
+
+
 teStatus ePRG_ChipGetDetails(tsPRG_Context *psContext)
 {
     teStatus eStatus;
@@ -640,8 +717,10 @@ teStatus ePRG_FlashErase(tsPRG_Context *psContext, tcbFW_Progress cbProgress, vo
 teStatus ePRG_FlashProgram(tsPRG_Context *psContext, tcbFW_Progress cbProgress, tcbFW_Confirm cbConfirm, void *pvUser)
 {
     teStatus eStatus;
-    int n;
     uint8_t u8ChunkSize;
+    uint8_t u8Window;
+    uint32_t u32Changed = 0;
+    uint32_t u32Sectors = 0;
     tsChipDetails *psChipDetails;
     tsFW_Info *psFWImage;
     char acOperationText[256];
@@ -697,42 +776,50 @@ teStatus ePRG_FlashProgram(tsPRG_Context *psContext, tcbFW_Progress cbProgress,
 
     snprintf(acOperationText, sizeof(acOperationText), "Programming %s", psContext->sChipDetails.asFlashes[psContext->u32SelectedFlash].pcFlashName);
 
-    if ((eStatus = ePRG_FlashErase(psContext, cbProgress, pvUser)) != E_PRG_OK)
-    {
-        return ePRG_SetStatus(psContext, eStatus, "erasing flash");
-    }
-
-    if (cbProgress)
+    u8ChunkSize = BL_FLASH_CHUNK_SIZE;
+    u8Window = 1;
+    if (psContext->sFlags.bFastProgram)
     {
-        if (cbProgress(pvUser, acOperationText, "Writing", 0, 0) != E_PRG_OK)
+        u8ChunkSize = BL_FAST_FLASH_CHUNK_SIZE;
+        u8Window = psContext->u8WriteWindow ? psContext->u8WriteWindow : PRG_FAST_WRITE_WINDOW;
+        if (u8Window > BL_MAX_WINDOW)
         {
-            return ePRG_SetStatus(psContext, E_PRG_ABORTED, "");
+            u8Window = BL_MAX_WINDOW;
         }
     }
 
-    for(n = 0; n < psFWImage->u32ImageLength; n += u8ChunkSize)
+    eStatus = E_PRG_UNSUPPORTED_OPERATION;
+    if (psContext->sFlags.bDifferential)
     {
-        if((psFWImage->u32ImageLength - n) > 128)
-        {
-            u8ChunkSize = 128;
-        }
-        else
-        {
-            u8ChunkSize = psFWImage->u32ImageLength - n;
-        }
-
-        if((eStatus = eBL_FlashWrite(psContext, psContext->u32FlashOffset + n, u8ChunkSize, psFWImage->pu8ImageData + n)) != E_PRG_OK)
-        {
-            return ePRG_SetStatus(psContext, eStatus, "writing flash at address 0x%08X", psContext->u32FlashOffset + n);
-        }
-
         if (cbProgress)
         {
-            if (cbProgress(pvUser, acOperationText, "Writing", psFWImage->u32ImageLength, n) != E_PRG_OK)
+            if (cbProgress(pvUser, acOperationText, "Comparing", 0, 0) != E_PRG_OK)
             {
                 return ePRG_SetStatus(psContext, E_PRG_ABORTED, "");
             }
         }
+        eStatus = ePRG_FlashProgramChanged(psContext, u8ChunkSize, u8Window, acOperationText, cbProgress, pvUser, &u32Changed, &u32Sectors);
+        DBG_vPrintf(TRACE_PROGRAMMER, "Sector programming: %s\n", psContext->acStatusMessage);
+    }
+    if (eStatus == E_PRG_UNSUPPORTED_OPERATION)
+    {
+        u32Sectors = 0;
+        eStatus = ePRG_FlashEraseWrite(psContext, u8ChunkSize, u8Window, acOperationText, cbProgress, pvUser);
+    }
+    if ((eStatus != E_PRG_OK) && (eStatus != E_PRG_ABORTED) && (u8Window > 1))
+    {
+        /* The UART has no flow control, so the device may have dropped a frame that arrived
+         * while it was programming. Let it finish, then start over one write at a time. */
+        DBG_vPrintf(TRACE_PROGRAMMER, "Pipelined write failed (%s), retrying\n", psContext->acStatusMessage);
+        vPRG_WaitMs(100);
+        eUART_Flush(psContext->iUartFD);
+
+        u32Sectors = 0;
+        eStatus = ePRG_FlashEraseWrite(psContext, u8ChunkSize, 1, acOperationText, cbProgress, pvUser);
+    }
+    if (eStatus != E_PRG_OK)
+    {
+        return eStatus;
     }
     
     if (cbProgress)
@@ -743,6 +830,10 @@ teStatus ePRG_FlashProgram(tsPRG_Context *psContext, tcbFW_Progress cbProgress,
         }
     }
 
+    if (u32Sectors)
+    {
+        return ePRG_SetStatus(psContext, E_PRG_OK, "flash written succesfully, %d of %d sectors changed", u32Changed, u32Sectors);
+    }
     return ePRG_SetStatus(psContext, E_PRG_OK, "flash written succesfully");
 }
 
@@ -750,9 +841,8 @@ teStatus ePRG_FlashProgram(tsPRG_Context *psContext, tcbFW_Progress cbProgress,
 teStatus ePRG_FlashVerify(tsPRG_Context *psContext, tcbFW_Progress cbProgress, void *pvUser)
 {
     teStatus eStatus;
-    int n;
-    uint8_t u8ChunkSize;
-    uint8_t au8Buffer1[BL_MAX_CHUNK_SIZE + 1];
+    uint8_t u8Window;
+    uint32_t u32Stride;
     tsChipDetails *psChipDetails;
     tsFW_Info *psFWImage;
     char acOperationText[256];
@@ -790,36 +880,27 @@ teStatus ePRG_FlashVerify(tsPRG_Context *psContext, tcbFW_Progress cbProgress, v
         return eStatus;
     }
 
-    for(n = 0; n < psFWImage->u32ImageLength; n += u8ChunkSize)
+    if (!psContext->sFlags.bFastProgram)
     {
-        if((psFWImage->u32ImageLength - n) > 128)
-        {
-            u8ChunkSize = 128;
-        }
-        else
-        {
-            u8ChunkSize = psFWImage->u32ImageLength - n;
-        }
-
-        if ((eStatus = eBL_FlashRead(psContext, psContext->u32FlashOffset + n, u8ChunkSize, au8Buffer1)) != E_PRG_OK)
-        {
-            return ePRG_SetStatus(psContext, eStatus, "reading Flash at address 0x%08X", psContext->u32FlashOffset + n);
-        }
-        else
+        eStatus = ePRG_FlashVerifyImage(psContext, 0, psFWImage->u32ImageLength, BL_FLASH_CHUNK_SIZE, 1, 1, acOperationText, "Verifying", cbProgress, pvUser);
+    }
+    else
+    {
+        /* Read requests are short enough to queue in the device UART, so they are
+         * always pipelined. There is no on-chip checksum command in the bootloader:
+         * every write was acknowledged, so sample the image rather than read it all. */
+        u8Window = psContext->u8WriteWindow ? psContext->u8WriteWindow : PRG_FAST_WRITE_WINDOW;
+        if (u8Window > BL_MAX_WINDOW)
         {
-            if (memcmp(psFWImage->pu8ImageData + n, au8Buffer1, u8ChunkSize))
-            {
-                return ePRG_SetStatus(psContext, E_PRG_VERIFICATION_FAILED, "at address 0x%08X", psContext->u32FlashOffset + n);
-            }
+            u8Window = BL_MAX_WINDOW;
         }
+        u32Stride = psContext->u32VerifyStride ? psContext->u32VerifyStride : PRG_FAST_VERIFY_STRIDE;
 
-        if (cbProgress)
-        {
-            if (cbProgress(pvUser, acOperationText, "Verifying", psFWImage->u32ImageLength, n) != E_PRG_OK)
-            {
-                return ePRG_SetStatus(psContext, E_PRG_ABORTED, "");
-            }
-        }
+        eStatus = ePRG_FlashVerifyImage(psContext, 0, psFWImage->u32ImageLength, BL_MAX_CHUNK_SIZE, u8Window, u32Stride, acOperationText, "Verifying", cbProgress, pvUser);
+    }
+    if (eStatus != E_PRG_OK)
+    {
+        return eStatus;
     }
 
     if (cbProgress)
@@ -2516,6 +2597,254 @@ static teStatus ePRG_ConfirmAlways(void *pvUser, const char *pcTitle, const char
     return E_PRG_OK;
 }
 
+
+/* Write u32Length bytes of the image from u32Start in u8ChunkSize pieces, keeping up to u8Window writes in flight */
+static teStatus ePRG_FlashWriteImage(tsPRG_Context *psContext, uint32_t u32Start, uint32_t u32Length, uint8_t u8ChunkSize, uint8_t u8Window,
+                                     const char *pcOperationText, tcbFW_Progress cbProgress, void *pvUser)
+{
+    teStatus eStatus;
+    tsFW_Info *psFWImage = &psContext->sFirmwareInfo;
+    uint32_t u32End = u32Start + u32Length;
+    uint32_t u32Sent = u32Start;
+    uint32_t u32Done = u32Start;
+    uint8_t u8Length;
+    int iInFlight = 0;
+
+    while (u32Done < u32End)
+    {
+        /* Fill the window */
+        while ((iInFlight < u8Window) && (u32Sent < u32End))
+        {
+            u8Length = ((u32End - u32Sent) > u8ChunkSize) ? u8ChunkSize : (u32End - u32Sent);
+
+            if ((eStatus = eBL_FlashWriteRequest(psContext, psContext->u32FlashOffset + u32Sent, u8Length, psFWImage->pu8ImageData + u32Sent)) != E_PRG_OK)
+            {
+                return ePRG_SetStatus(psContext, eStatus, "writing flash at address 0x%08X", psContext->u32FlashOffset + u32Sent);
+            }
+            u32Sent += u8Length;
+            iInFlight++;
+        }
+
+        /* Responses come back in order: the oldest is for u32Done */
+        if ((eStatus = eBL_FlashWriteResponse(psContext)) != E_PRG_OK)
+        {
+            return ePRG_SetStatus(psContext, eStatus, "writing flash at address 0x%08X", psContext->u32FlashOffset + u32Done);
+        }
+        iInFlight--;
+
+        if (cbProgress)
+        {
+            if (cbProgress(pvUser, pcOperationText, "Writing", psFWImage->u32ImageLength, u32Done) != E_PRG_OK)
+            {
+                return ePRG_SetStatus(psContext, E_PRG_ABORTED, "");
+            }
+        }
+        u32Done += ((u32End - u32Done) > u8ChunkSize) ? u8ChunkSize : (u32End - u32Done);
+    }
+
+    return ePRG_SetStatus(psContext, E_PRG_OK, "");
+}
+
+
+/* Next chunk to verify: every u32Stride'th one, and always the last one */
+static uint32_t u32PRG_VerifyChunkNext(uint32_t u32Chunk, uint32_t u32Stride, uint32_t u32NumChunks)
+{
+    if ((u32Chunk + u32Stride >= u32NumChunks) && (u32Chunk != u32NumChunks - 1))
+    {
+        return u32NumChunks - 1;
+    }
+    return u32Chunk + u32Stride;
+}
+
+
+/* Compare one in u32Stride chunks of u32Length bytes from u32Start with the flash, keeping up to
+ * u8Window reads in flight. Flash past the end of the image must be blank. */
+static teStatus ePRG_FlashVerifyImage(tsPRG_Context *psContext, uint32_t u32Start, uint32_t u32Length, uint8_t u8ChunkSize, uint8_t u8Window, uint32_t u32Stride,
+                                      const char *pcOperationText, const char *pcStepText, tcbFW_Progress cbProgress, void *pvUser)
+{
+    teStatus eStatus = E_PRG_OK;
+    tsFW_Info *psFWImage = &psContext->sFirmwareInfo;
+    uint8_t au8Buffer[BL_MAX_CHUNK_SIZE + 1];
+    uint32_t u32NumChunks = (u32Length + u8ChunkSize - 1) / u8ChunkSize;
+    uint32_t u32Sent = 0;
+    uint32_t u32Done = 0;
+    uint32_t u32Offset;
+    uint32_t u32ImageBytes;
+    uint32_t i;
+    uint8_t u8Length;
+    int iInFlight = 0;
+
+    while ((u32Done < u32NumChunks) && (eStatus == E_PRG_OK))
+    {
+        while ((iInFlight < u8Window) && (u32Sent < u32NumChunks))
+        {
+            u32Offset = u32Sent * u8ChunkSize;
+            u8Length = ((u32Length - u32Offset) > u8ChunkSize) ? u8ChunkSize : (u32Length - u32Offset);
+
+            if ((eStatus = eBL_FlashReadRequest(psContext, psContext->u32FlashOffset + u32Start + u32Offset, u8Length)) != E_PRG_OK)
+            {
+                return ePRG_SetStatus(psContext, eStatus, "reading Flash at address 0x%08X", psContext->u32FlashOffset + u32Start + u32Offset);
+            }
+            u32Sent = u32PRG_VerifyChunkNext(u32Sent, u32Stride, u32NumChunks);
+            iInFlight++;
+        }
+
+        u32Offset = u32Done * u8ChunkSize;
+        u8Length = ((u32Length - u32Offset) > u8ChunkSize) ? u8ChunkSize : (u32Length - u32Offset);
+
+        if ((eStatus = eBL_FlashReadResponse(psContext, u8Length, au8Buffer)) != E_PRG_OK)
+        {
+            return ePRG_SetStatus(psContext, eStatus, "reading Flash at address 0x%08X", psContext->u32FlashOffset + u32Start + u32Offset);
+        }
+        iInFlight--;
+
+        /* Bytes of the image in this chunk, the rest must be blank */
+        u32Offset += u32Start;
+        u32ImageBytes = 0;
+        if (u32Offset < psFWImage->u32ImageLength)
+        {
+            u32ImageBytes = ((psFWImage->u32ImageLength - u32Offset) > u8Length) ? u8Length : (psFWImage->u32ImageLength - u32Offset);
+        }
+        for (i = u32ImageBytes; (i < u8Length) && (au8Buffer[i] == 0xFF); i++)
+        {
+        }
+
+        if ((i < u8Length) || memcmp(psFWImage->pu8ImageData + u32Offset, au8Buffer, u32ImageBytes))
+        {
+            eStatus = ePRG_SetStatus(psContext, E_PRG_VERIFICATION_FAILED, "at address 0x%08X", psContext->u32FlashOffset + u32Offset);
+        }
+        else if (cbProgress)
+        {
+            if (cbProgress(pvUser, pcOperationText, pcStepText, psFWImage->u32ImageLength, u32Offset) != E_PRG_OK)
+            {
+                eStatus = ePRG_SetStatus(psContext, E_PRG_ABORTED, "");
+            }
+        }
+        u32Done = u32PRG_VerifyChunkNext(u32Done, u32Stride, u32NumChunks);
+    }
+
+    /* Collect the reads still in flight, so that the next request starts clean */
+    for (; iInFlight > 0; iInFlight--)
+    {
+        eBL_FlashReadResponse(psContext, u8ChunkSize, au8Buffer);
+    }
+
+    if (eStatus != E_PRG_OK)
+    {
+        return eStatus;
+    }
+    return ePRG_SetStatus(psContext, E_PRG_OK, "");
+}
+
+
+/* Erase and write only the sectors of the JN516x internal flash that differ from the image.
+ * E_PRG_UNSUPPORTED_OPERATION is returned before anything was changed: use a full erase. */
+static teStatus ePRG_FlashProgramChanged(tsPRG_Context *psContext, uint8_t u8ChunkSize, uint8_t u8Window, const char *pcOperationText, tcbFW_Progress cbProgress, void *pvUser,
+                                         uint32_t *pu32Changed, uint32_t *pu32Sectors)
+{
+    teStatus eStatus;
+    tsFW_Info *psFWImage = &psContext->sFirmwareInfo;
+    tsFlashDetails *psFlash = &psContext->sChipDetails.asFlashes[psContext->u32SelectedFlash];
+    uint32_t u32NumSectors = psFlash->u32FlashSize / JN516X_FLASH_SECTOR_SIZE;
+    uint32_t u32FirstSector = psContext->u32FlashOffset / JN516X_FLASH_SECTOR_SIZE;
+    uint32_t u32ImageSectors = (psFWImage->u32ImageLength + JN516X_FLASH_SECTOR_SIZE - 1) / JN516X_FLASH_SECTOR_SIZE;
+    uint32_t u32Sector;
+    uint32_t u32Start;
+    uint32_t u32Length;
+    uint32_t u32Changed = 0;
+    uint8_t au8Changed[JN516X_MAX_FLASH_SECTORS];
+
+    /* Only for the internal flash, starting on a sector, and readable. The index sector is
+     * memory mapped above the flash: sector numbers never reach it. */
+    if ((psFlash->u8ManufacturerID != FLASH_MANUFACTURER_JN516X) || (psFlash->u8DeviceID != FLASH_DEVICE_JN516X) ||
+        (psContext->sDeviceConfig.eCRP == E_DC_CRP_LEVEL1) || (psContext->sDeviceConfig.eCRP == E_DC_CRP_LEVEL2) ||
+        (psContext->u32FlashOffset % JN516X_FLASH_SECTOR_SIZE) || (u32NumSectors > JN516X_MAX_FLASH_SECTORS) ||
+        (psFlash->u32FlashSize > u32PRG_JN516x_index_sector_address(0, 0)))
+    {
+        return E_PRG_UNSUPPORTED_OPERATION;
+    }
+
+    /* Read back each sector of the image: there is no checksum request in the bootloader */
+    for (u32Sector = u32FirstSector; u32Sector < u32FirstSector + u32ImageSectors; u32Sector++)
+    {
+        u32Start = (u32Sector - u32FirstSector) * JN516X_FLASH_SECTOR_SIZE;
+        eStatus = ePRG_FlashVerifyImage(psContext, u32Start, JN516X_FLASH_SECTOR_SIZE, BL_MAX_CHUNK_SIZE, u8Window, 1, pcOperationText, "Comparing", cbProgress, pvUser);
+        if ((eStatus != E_PRG_OK) && (eStatus != E_PRG_VERIFICATION_FAILED))
+        {
+            return eStatus;
+        }
+        au8Changed[u32Sector] = (eStatus != E_PRG_OK);
+        u32Changed += au8Changed[u32Sector];
+    }
+    DBG_vPrintf(TRACE_PROGRAMMER, "%d of %d sectors changed\n", u32Changed, u32ImageSectors);
+    *pu32Changed = u32Changed;
+    *pu32Sectors = u32ImageSectors;
+
+    /* Sectors past the image are erased as a full erase would, unless they are blank already.
+     * An earlier image is contiguous, so a used sector doesn't start with a blank chunk. */
+    for (; u32Sector < u32NumSectors; u32Sector++)
+    {
+        u32Start = (u32Sector - u32FirstSector) * JN516X_FLASH_SECTOR_SIZE;
+        eStatus = ePRG_FlashVerifyImage(psContext, u32Start, BL_MAX_CHUNK_SIZE, BL_MAX_CHUNK_SIZE, 1, 1, pcOperationText, "Comparing", NULL, NULL);
+        if ((eStatus != E_PRG_OK) && (eStatus != E_PRG_VERIFICATION_FAILED))
+        {
+            return eStatus;
+        }
+        au8Changed[u32Sector] = (eStatus != E_PRG_OK);
+    }
+
+    for (u32Sector = u32FirstSector; u32Sector < u32NumSectors; u32Sector++)
+    {
+        if (!au8Changed[u32Sector])
+        {
+            continue;
+        }
+
+        if ((eStatus = eBL_FlashSectorErase(psContext, (uint8_t)u32Sector)) != E_PRG_OK)
+        {
+            if ((eStatus == E_PRG_UNSUPPORTED_OPERATION) && (u32Sector == u32FirstSector))
+            {
+                return eStatus;
+            }
+            return ePRG_SetStatus(psContext, eStatus, "erasing sector %d", u32Sector);
+        }
+
+        u32Start = (u32Sector - u32FirstSector) * JN516X_FLASH_SECTOR_SIZE;
+        if (u32Start < psFWImage->u32ImageLength)
+        {
+            u32Length = ((psFWImage->u32ImageLength - u32Start) > JN516X_FLASH_SECTOR_SIZE) ? JN516X_FLASH_SECTOR_SIZE : (psFWImage->u32ImageLength - u32Start);
+            if ((eStatus = ePRG_FlashWriteImage(psContext, u32Start, u32Length, u8ChunkSize, u8Window, pcOperationText, cbProgress, pvUser)) != E_PRG_OK)
+            {
+                return eStatus;
+            }
+        }
+    }
+
+    return ePRG_SetStatus(psContext, E_PRG_OK, "%d of %d sectors changed", u32Changed, u32ImageSectors);
+}
+
+
+/* Erase the whole flash and write the image */
+static teStatus ePRG_FlashEraseWrite(tsPRG_Context *psContext, uint8_t u8ChunkSize, uint8_t u8Window, const char *pcOperationText, tcbFW_Progress cbProgress, void *pvUser)
+{
+    teStatus eStatus;
+
+    if ((eStatus = ePRG_FlashErase(psContext, cbProgress, pvUser)) != E_PRG_OK)
+    {
+        return ePRG_SetStatus(psContext, eStatus, "erasing flash");
+    }
+
+    if (cbProgress)
+    {
+        if (cbProgress(pvUser, pcOperationText, "Writing", 0, 0) != E_PRG_OK)
+        {
+            return ePRG_SetStatus(psContext, E_PRG_ABORTED, "");
+        }
+    }
+
+    return ePRG_FlashWriteImage(psContext, 0, psContext->sFirmwareInfo.u32ImageLength, u8ChunkSize, u8Window, pcOperationText, cbProgress, pvUser);
+}
+
 #if 0
 static teStatus ePRG_ResetDevice(tsPRG_Context *psContext)
 {
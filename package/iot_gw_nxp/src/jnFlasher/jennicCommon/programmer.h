@@ -82,6 +82,10 @@ extern "C" {
 
 #define PRG_MAX_STATUS_LENGTH 1024
 
+/** Fast program defaults, see \ref tsPRG_Context */
+#define PRG_FAST_WRITE_WINDOW   2
+#define PRG_FAST_VERIFY_STRIDE  8
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -300,8 +304,14 @@ typedef struct
     struct
     {
         unsigned        bAutoProgramReset : 1;  /**< If possible, automatically assert the program / reset lines. Default true. */
+        unsigned        bFastProgram : 1;       /**< Program in maximum size chunks with several writes in flight and verify
+                                                  *  a sample of the chunks instead of all of them. Default false. */
+        unsigned        bDifferential : 1;      /**< JN516x: erase and write only the flash sectors that differ from the image. Default false. */
     } sFlags;
     
+    uint8_t             u8WriteWindow;          /**< Fast program: flash writes in flight. Default (0) is \ref PRG_FAST_WRITE_WINDOW */
+    uint32_t            u32VerifyStride;        /**< Fast program: verify one in this many chunks. Default (0) is \ref PRG_FAST_VERIFY_STRIDE */
+    
     char            acStatusMessage[PRG_MAX_STATUS_LENGTH];
     char            acErrorMsgBuffer[PRG_MAX_STATUS_LENGTH];
 
@@ -410,6 +420,18 @@ teStatus LIBPROGRAMMER ePRG_ConnectionClose(tsPRG_Context *psContext);
 teStatus LIBPROGRAMMER ePRG_ConnectionUpdate(tsPRG_Context *psContext, tsConnection *psConnection);
 
 
+/** Move the bootloader and the local port to the fastest of a list of baud rates.
+ *  Each rate is confirmed by reading the chip id at it, a rate the port or the link
+ *  can't carry is skipped and the device is moved back to u32CurrentRate.
+ *  \param          psContext Pointer to programmer context, with the UART open at u32CurrentRate
+ *  \param          u32CurrentRate Baud rate the device is talking at now
+ *  \param          pu32Rates Candidate baud rates, fastest first, terminated by 0
+ *  \param[out]     pu32Rate Location to store the selected baud rate
+ *  \return E_PRG_OK on success, also when no faster rate was found
+ */
+teStatus LIBPROGRAMMER ePRG_BaudRateNegotiate(tsPRG_Context *psContext, uint32_t u32CurrentRate, const uint32_t *pu32Rates, uint32_t *pu32Rate);
+
+
 /** Open a firmware file and get information about it using \ref ePRG_FwGetInfo
  *  This populates psContext->sFirmwareInfo with the necessary data for programming this firmware.
  *  \param          psContext Pointer to programmer context
@@ -483,6 +505,10 @@ teStatus LIBPROGRAMMER ePRG_FlashErase(tsPRG_Context *psContext, tcbFW_Progress
 
 /** Reprogram the connected device flash with the given image. This call will block until the request has completed.
  *  During programming the library will call cbProgress periodically to update the caller with progress.
+ *  With sFlags.bFastProgram set, u8WriteWindow writes are kept in flight. If that fails the flash is erased
+ *  and written again one write at a time.
+ *  With sFlags.bDifferential set the internal flash of a JN516x is read back sector by sector, and only the
+ *  sectors that differ from the image are erased and written. Other devices get a full erase.
  *  \param          psContext Pointer to programmer context
  *  \param          cbProgress Callback routine to update operation progress. May be NULL for no feedback.
  *  \param          cbConfirm Callback routine to confirm operation. May be NULL, in which case an operation requiring confirmation will fail.
@@ -494,6 +520,7 @@ teStatus LIBPROGRAMMER ePRG_FlashProgram(tsPRG_Context *psContext, tcbFW_Progres
 
 /** Verify the connected device flash with the given image.
  *  During verification the library will call cbProgress periodically to update the caller with progress.
+ *  With sFlags.bFastProgram set, only one in u32VerifyStride chunks and the last chunk are read back.
  *  \param          psContext Pointer to programmer context
  *  \param          cbProgress Callback routine to update operation progress. May be NULL for no feedback.
  *  \param          pvUser  Pointer to user data that is passed back to the application when cbProgress is called. May be NULL for no user data
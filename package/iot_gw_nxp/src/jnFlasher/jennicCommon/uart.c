@@ -67,6 +67,7 @@
 #include <errno.h>
 
 #include <linux/types.h>
+#include <linux/serial.h>
 
 #include "programmer.h"
 #include "uart.h"
@@ -386,6 +387,40 @@ teStatus eUART_Write(int iFileDescriptor, uint8_t *pu8Data, int iLength)
 }
 
 
+/****************************************************************************
+ *
+ * NAME: UART_eSetLowLatency
+ *
+ * DESCRIPTION:
+ * Ask the serial driver to pass received bytes up without delay. USB bridges
+ * such as the FTDI otherwise hold a short response for their latency timer
+ * (16ms by default), which dominates a request / response protocol.
+ *
+ * RETURNS:
+ * teStatus
+ *
+ ****************************************************************************/
+teStatus eUART_SetLowLatency(int iFileDescriptor)
+{
+    struct serial_struct sSerial;
+
+    if (ioctl(iFileDescriptor, TIOCGSERIAL, &sSerial) == -1)
+    {
+        DBG_vPrintf(TRACE_UART, "Error getting serial settings\n");
+        return E_PRG_UNSUPPORTED_OPERATION;
+    }
+
+    sSerial.flags |= ASYNC_LOW_LATENCY;
+
+    if (ioctl(iFileDescriptor, TIOCSSERIAL, &sSerial) == -1)
+    {
+        DBG_vPrintf(TRACE_UART, "Error setting low latency\n");
+        return E_PRG_UNSUPPORTED_OPERATION;
+    }
+    return E_PRG_OK;
+}
+
+
 /****************************************************************************/
 /***        Local Functions                                               ***/
 /****************************************************************************/
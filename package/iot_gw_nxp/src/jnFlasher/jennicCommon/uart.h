@@ -80,6 +80,7 @@ teStatus eUART_SetBaudRate(int iFileDescriptor, struct termios *psOptions, int i
 teStatus eUART_Flush(int iFileDescriptor);
 teStatus eUART_Read(int iFileDescriptor, int iTimeoutMicroseconds, int iBufferLen, uint8_t *pu8Buffer, int *piBytesRead);
 teStatus eUART_Write(int iFileDescriptor, uint8_t *pu8Data, int iLength);
+teStatus eUART_SetLowLatency(int iFileDescriptor);
 
 /****************************************************************************/
 /***        Exported Variables                                            ***/
@@ -96,6 +96,11 @@ uint64_t *pu64MAC_Address = NULL;
 int iInitialSpeed=38400;
 int iProgramSpeed=1000000;
 
+/* Fast mode: the bootloader divides 1MHz, so these are the fastest rates it can match exactly */
+int iFast = 0;
+int iDifferential = 0;
+static const uint32_t au32FastSpeeds[] = { 1000000, 500000, 0 };
+
 
 void print_usage_exit(char *argv[])
 {
@@ -106,6 +111,8 @@ void print_usage_exit(char *argv[])
     fprintf(stderr, "    -V --verbosity     <verbosity>     Verbosity level. Increses amount of debug information. Default 0.\n");
     fprintf(stderr, "    -I --initialbaud   <rate>          Set initial baud rate\n");
     fprintf(stderr, "    -P --programbaud   <rate>          Set programming baud rate\n");
+    fprintf(stderr, "    -F --fast                          Fast mode. Negotiate the highest baud rate (instead of -P), pipeline large writes and verify a sample.\n");
+    fprintf(stderr, "    -d --differential                  Only erase and write the flash sectors that changed (JN516x).\n");
     fprintf(stderr, "    -f --firmware      <firmware>      Load module flash with the given firmware file.\n");
     fprintf(stderr, "    -v --verify                        Verify image. If specified, verify the image programmedwas loaded correctly.\n");
     fprintf(stderr, "    -m --mac           <MAC Address>   Set MAC address of device. If this is not specified, the address is read from flash.\n");
@@ -222,6 +229,8 @@ int main(int argc, char *argv[])
             {"verbosity",               required_argument,  NULL,       'V'},
             {"initialbaud",             required_argument,  NULL,       'I'},
             {"programbaud",             required_argument,  NULL,       'P'},
+            {"fast",                    no_argument,        NULL,       'F'},
+            {"differential",            no_argument,        NULL,       'd'},
             {"serial",                  required_argument,  NULL,       's'},
             {"firmware",                required_argument,  NULL,       'f'},
             {"verify",                  no_argument,        NULL,       'v'},
@@ -231,7 +240,7 @@ int main(int argc, char *argv[])
         signed char opt;
         int option_index;
         
-        while ((opt = getopt_long(argc, argv, "hs:V:f:vI:P:m:", long_options, &option_index)) != -1) 
+        while ((opt = getopt_long(argc, argv, "hs:V:f:vFdI:P:m:", long_options, &option_index)) != -1) 
         {
             switch (opt) 
             {
@@ -246,6 +255,12 @@ int main(int argc, char *argv[])
                 case 'v':
                     iVerify = 1;
                     break;
+                case 'F':
+                    iFast = 1;
+                    break;
+                case 'd':
+                    iDifferential = 1;
+                    break;
                 case 'I':
                 {
                     char *pcEnd;
@@ -317,7 +332,30 @@ int main(int argc, char *argv[])
     }
     LL_LOG( "Serial port opened at iInitialSpeed (= 38400)" );
 
-    if (iInitialSpeed != iProgramSpeed)
+    if (iFast)
+    {
+        uint32_t u32Speed;
+
+        sPRG_Context.sFlags.bFastProgram = 1;
+
+        /* Don't let the USB bridge sit on each response for its latency timer */
+        if (eUART_SetLowLatency(sPRG_Context.iUartFD) != E_PRG_OK && iVerbosity > 1)
+        {
+            printf("Serial port has no low latency mode\n");
+        }
+
+        if (ePRG_BaudRateNegotiate(&sPRG_Context, iInitialSpeed, au32FastSpeeds, &u32Speed) != E_PRG_OK)
+        {
+            printf("Error negotiating baudrate: %s\n", sPRG_Context.acStatusMessage);
+            LL_LOG( "Error negotiating baudrate" );
+            ret = 2;
+        }
+        else if (iVerbosity > 1)
+        {
+            printf("Programming at %d baud\n", u32Speed);
+        }
+    }
+    else if (iInitialSpeed != iProgramSpeed)
     {
         if (iVerbosity > 1)
         {
@@ -400,6 +438,8 @@ int main(int argc, char *argv[])
     {
         /* Have file to program */
     
+        sPRG_Context.sFlags.bDifferential = iDifferential;
+
         if (ePRG_FwOpen(&sPRG_Context, (char *)pcFirmwareFile)) {
             /* Error with file. FW module has displayed error so just exit. */
             LL_LOG( "Error with firmware file" );
@@ -407,9 +447,14 @@ int main(int argc, char *argv[])
         } else if ( ePRG_FlashProgram(&sPRG_Context, cbProgress, NULL, NULL) != E_PRG_OK ) {
             LL_LOG( "Error with flashing" );
             ret = 6;
-        } else if ( iVerify && ePRG_FlashVerify(&sPRG_Context, cbProgress, NULL) != E_PRG_OK ) {
-            LL_LOG( "Error in verification" );
-            ret = 7;
+        } else {
+            if ( iVerbosity > 1 ) {
+                printf( "%s\n", sPRG_Context.acStatusMessage );
+            }
+            if ( iVerify && ePRG_FlashVerify(&sPRG_Context, cbProgress, NULL) != E_PRG_OK ) {
+                LL_LOG( "Error in verification" );
+                ret = 7;
+            }
         }
         
         if ( ret == 0 ) {
@@ -13,4 +13,5 @@ killbyname iot_ci
 killbyname iot_nd
 killbyname iot_gd
 killbyname iot_dbp
+killbyname iot_cgi_worker
 killbyname iot_su
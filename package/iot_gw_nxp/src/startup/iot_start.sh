@@ -10,4 +10,5 @@
 /etc/init.d/iot_nd_initd  start > /dev/null
 /etc/init.d/iot_gd_initd  start > /dev/null
 /etc/init.d/iot_dbp_initd start > /dev/null
+/etc/init.d/iot_cw_initd  start > /dev/null
 /etc/init.d/iot_su_initd  start > /dev/null
@@ -11,5 +11,6 @@
 /etc/init.d/iot_nd_initd  stop
 /etc/init.d/iot_gd_initd  stop
 /etc/init.d/iot_dbp_initd stop
+/etc/init.d/iot_cw_initd  stop
 /etc/init.d/iot_pt_initd  stop
 /etc/init.d/iot_su_initd  stop
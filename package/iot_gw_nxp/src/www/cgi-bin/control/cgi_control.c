@@ -290,6 +290,10 @@ int main( int argc, char * argv[] ) {
     char * qs;
     int    lastupdate;
     
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command = chanmask = nfcmode = browsertime = site = released = 0;
+#endif
     if ( argc > 1 ) {
         printf( "Help: %s <command> <site> <released> <chanmask> <nfcmode> <browsertime>\n", argv[0] );
         // Called from command line
@@ -541,7 +545,7 @@ int main( int argc, char * argv[] ) {
     case COMMAND_GET_SYSTEMTABLE:
         xmlOpen();
         newDbOpen();
-        sys = newDbSerializeSystem( MAXBUFFER, buf );
+        sys = newDbSerializeCached( NEWDB_CACHE_SYSTEM, NULL );
         newDbClose();
         xmlError( ( sys == NULL ) ? ERROR_EMPTY_SYSTEMTABLE : 0 );
         printf( "    <clk>%d</clk>\n", clk );
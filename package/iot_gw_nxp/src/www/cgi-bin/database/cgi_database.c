@@ -50,6 +50,12 @@
 
 #define MAXBUF    10000
 
+// Tables behind the TSCHECK lastupdates, and the longest long-poll
+#define TSCHECK_TABLES  ( NEWDB_DIRTY( NEWDB_TABLE_DEVICES ) | NEWDB_DIRTY( NEWDB_TABLE_SYSTEM ) | \
+                          NEWDB_DIRTY( NEWDB_TABLE_ZCB ) | NEWDB_DIRTY( NEWDB_TABLE_PLUGHIST ) | \
+                          NEWDB_DIRTY( NEWDB_TABLE_PLUGSERIES ) )
+#define MAX_WAIT        30
+
 // -------------------------------------------------------------
 // Globals
 // -------------------------------------------------------------
@@ -76,6 +82,8 @@ static char buf[MAXBUF];
 
 static int command  = 0;
 static int tableno  = 0;
+static int postwait = 0;
+static int postgen  = 0;
 
 // -------------------------------------------------------------
 // Post Variables
@@ -93,6 +101,10 @@ static void parseNameValue( char * name, char * value ) {
         command = Atoi( value );
     } else if ( strcmp( name, "tableno" ) == 0 ) {
         tableno = Atoi( value );
+    } else if ( strcmp( name, "wait" ) == 0 ) {
+        postwait = Atoi( value );
+    } else if ( strcmp( name, "gen" ) == 0 ) {
+        postgen = Atoi( value );
     }
 }
 
@@ -150,6 +162,30 @@ static void xmlClose( void ) {
     printf( "</database>\n" );
 }
 
+// -------------------------------------------------------------
+// Conditional requests
+// -------------------------------------------------------------
+
+/**
+ * \brief Print the ETag header of a cached serialization, or the complete 304
+ * response when the client sent this ETag in If-None-Match. Call before xmlOpen()
+ * \param cache One of NEWDB_CACHE_*
+ * \param lastupdate Its newDbGetLastupdate*(): keeps the ETag unique when the DB was re-created
+ * \returns 1 when the 304 was sent
+ */
+static int etagCheck( int cache, int lastupdate ) {
+    char etag[40];
+    char * match = getenv( "HTTP_IF_NONE_MATCH" );
+
+    sprintf( etag, "\"%x-%x\"", newDbGetCacheGeneration( cache ), lastupdate );
+    if ( match != NULL && strstr( match, etag ) != NULL ) {
+        printf( "Status: 304 Not Modified\r\nETag: %s\r\n\r\n", etag );
+        return( 1 );
+    }
+    printf( "ETag: %s\r\n", etag );
+    return( 0 );
+}
+
 // -------------------------------------------------------------
 // Button helper
 // -------------------------------------------------------------
@@ -205,9 +241,14 @@ static int writeControl( char * cmd ) {
  * \param argv Syntax: <progname> [ <command> <tableno> ]
  */
 int main( int argc, char * argv[] ) {
-    int i = 0, err = 0;
+    int i = 0, err = 0, cache = 0;
     char * table = NULL; 
     
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command = tableno = 0;
+    postwait = postgen = 0;
+#endif
     if ( argc > 1 ) {
         // Called from command line
         while ( i < argc ) {
@@ -344,9 +385,18 @@ int main( int argc, char * argv[] ) {
         break;
 
     case COMMAND_TSCHECK:
+        newDbOpen();
+        unsigned int gen = newDbGetGenerations( TSCHECK_TABLES );
+#ifndef CGI_WORKER
+        // Long-poll: with wait=<s>&gen=<gen> only answer when there is a change.
+        // Not in iot_cgi_worker, which serves one request at a time
+        if ( postwait > 0 && gen == (unsigned int)postgen ) {
+            gen = newDbWaitGenerations( TSCHECK_TABLES, gen,
+                    1000 * ( ( postwait < MAX_WAIT ) ? postwait : MAX_WAIT ) );
+        }
+#endif
         xmlOpen();
         buf[0] = '\0';
-        newDbOpen();
         int lupDevs, lupSys, lupZcb, lupPlug;
         lupDevs  = newDbGetLastupdateDevices();
         lupSys   = newDbGetLastupdateSystem();
@@ -360,39 +410,52 @@ int main( int argc, char * argv[] ) {
         printf( "    <clk>%d</clk>\n", clk );
         printf( "    <pid>%d</pid>\n", getpid() );
         printf( "    <lus>%s</lus>\n", buf );
+        printf( "    <gen>%u</gen>\n", gen );
         xmlClose();
         break;
 
     case COMMAND_GET_TABLE:
+        newDbOpen();
+        if ( ( tableno == DEVICESTABLE     && etagCheck( NEWDB_CACHE_DEVS,     newDbGetLastupdateDevices() ) ) ||
+             ( tableno == SYSTEMTABLE      && etagCheck( NEWDB_CACHE_SYSTEM,   newDbGetLastupdateSystem() ) ) ||
+             ( tableno == ZCBTABLE         && etagCheck( NEWDB_CACHE_ZCB,      newDbGetLastupdateZcb() ) ) ||
+             ( tableno == PLUGHISTORYTABLE && etagCheck( NEWDB_CACHE_PLUGHIST, newDbGetLastupdatePlugHist() ) ) ) {
+            break;
+        }
         xmlOpen();
         buf[0] = '\0';
-        newDbOpen();
         switch ( tableno ) {   
             case DEVICESTABLE:
-                table = newDbSerializeDevs( MAXBUF, buf );
+                cache = NEWDB_CACHE_DEVS;
                 break;
             case SYSTEMTABLE:
-                table = newDbSerializeSystem( MAXBUF, buf );
+                cache = NEWDB_CACHE_SYSTEM;
                 break;
             case ZCBTABLE:
-                table = newDbSerializeZcb( MAXBUF, buf );
+                cache = NEWDB_CACHE_ZCB;
                 break;
             case PLUGHISTORYTABLE:
-                table = newDbSerializePlugHist( MAXBUF, buf );
-                if ( !table ) {
-                    xmlDebugInt( 1, newDbGetNumOfPlughist() );
-                    table = "+";
-                }
+                cache = NEWDB_CACHE_PLUGHIST;
                 break;
             default:
                 err = 1;
                 break;
         }
-        newDbClose();
+        if ( !err ) table = newDbSerializeCached( cache, NULL );
 
         xmlError( err );
         printf( "    <tableno>%d</tableno>\n", tableno );
-        printf( "    <table>%s</table>\n", ( table ) ? table : "-" );
+        if ( !err && !table ) {
+            // Too big for its cache: stream it instead
+            printf( "    <table>" );
+            fflush( stdout );
+            int written = newDbSerializeWrite( cache, STDOUT_FILENO );
+            printf( "</table>\n" );
+            if ( written < 0 ) xmlDebugInt( 1, newDbGetNumOfPlughist() );
+        } else {
+            printf( "    <table>%s</table>\n", ( table ) ? table : "-" );
+        }
+        newDbClose();
         xmlClose();
         break;
 
@@ -57,8 +57,6 @@
 
 #define WHO "lamp.cgi"
 
-#define MAXBUF  2000
-
 // -------------------------------------------------------------
 // Globals
 // -------------------------------------------------------------
@@ -71,7 +69,6 @@ static int  postsid    = -1;
 static int  postlvl    = -1;
 static int  postrgb    = -1;
 static int  postkelvin = -1;
-static char buf[MAXBUF];
 
 // -------------------------------------------------------------
 // Variables
@@ -165,6 +162,12 @@ int main( int argc, char * argv[] ) {
 
     int clk = (int)time( NULL );
 
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command = COMMAND_NONE;
+    postmac[0] = postcmd[0] = '\0';
+    postgid = postsid = postlvl = postrgb = postkelvin = -1;
+#endif
     // char * formdata = (char *)getenv( "QUERY_STRING" );
 
     char postdata[200];
@@ -282,7 +285,7 @@ int main( int argc, char * argv[] ) {
         printf( "<?xml version='1.0' encoding='utf-8'?>\n" );
         printf( "<groups>\n" );
         newDbOpen();
-        list = newDbSerializeLamps( MAXBUF, buf );
+        list = newDbSerializeCached( NEWDB_CACHE_LAMPS, NULL );
         newDbClose();
         printf( "    <err>%d</err>\n", list == NULL );
         printf( "    <cmd>%d</cmd>\n", command );
@@ -49,8 +49,6 @@
 
 #define WHO "lamp.cgi"
 
-#define MAXBUF  2000
-
 // -------------------------------------------------------------
 // Globals
 // -------------------------------------------------------------
@@ -61,7 +59,6 @@ static char cmd[8];
 static int postlvl    = -1;
 static int postrgb    = -1;
 static int postkelvin = -1;
-static char buf[MAXBUF];
 
 // -------------------------------------------------------------
 // Variables
@@ -160,6 +157,12 @@ int main( int argc, char * argv[] ) {
 
     mac[0] = '\0';
 
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command = COMMAND_NONE;
+    cmd[0] = '\0';
+    postlvl = postrgb = postkelvin = -1;
+#endif
     char * formdata = (char *)getenv( "QUERY_STRING" );
     char formdata_cpy[200];
     formdata_cpy[0] = '\0';
@@ -313,7 +316,7 @@ int main( int argc, char * argv[] ) {
    case COMMAND_GET_LIST:
         xmlOpen();
         newDbOpen();
-        list = newDbSerializeLamps( MAXBUF, buf );
+        list = newDbSerializeCached( NEWDB_CACHE_LAMPS, NULL );
         newDbClose();
         xmlError( list == NULL );
         printf( "    <list>%s</list>\n", ( list ) ? list : "-" );
@@ -130,6 +130,13 @@ static int logCb( int i, onelog_t * l ) {
 int main( int argc, char * argv[] ) {
     int i, err = 0;
     
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    startIndex  = -1;
+    postcommand = COMMAND_NONE;
+    postfilename[0] = '\0';
+    numLogs     = 0;
+#endif
     if ( argc > 1 ) {
         // Called from command line
         while ( i < argc ) {
@@ -61,6 +61,10 @@
 
 #define MAXBUF    5000
 
+// Tables behind the TSCHECK lastupdates, and the longest long-poll
+#define TSCHECK_TABLES  ( NEWDB_DIRTY( NEWDB_TABLE_DEVICES ) | NEWDB_DIRTY( NEWDB_TABLE_SYSTEM ) )
+#define MAX_WAIT        30
+
 // -------------------------------------------------------------
 // Globals
 // -------------------------------------------------------------
@@ -75,6 +79,8 @@ static char cmd[8];
 static int postlvl    = -1;
 static int postrgb    = -1;
 static int postkelvin = -1;
+static int postwait   = 0;
+static int postgen    = 0;
 
 static char buf[MAXBUF];
 
@@ -129,6 +135,10 @@ static void parseNameValue( char * name, char * value ) {
         postkelvin = Atoi( value );
     } else if ( strcmp( name, "nfcmode" ) == 0 ) {
         nfcmode = Atoi( value );
+    } else if ( strcmp( name, "wait" ) == 0 ) {
+        postwait = Atoi( value );
+    } else if ( strcmp( name, "gen" ) == 0 ) {
+        postgen = Atoi( value );
     }
 }
 
@@ -185,6 +195,30 @@ static void xmlClose( void ) {
     printf( "</mobile>\n" );
 }
 
+// -------------------------------------------------------------
+// Conditional requests
+// -------------------------------------------------------------
+
+/**
+ * \brief Print the ETag header of a cached serialization, or the complete 304
+ * response when the client sent this ETag in If-None-Match. Call before xmlOpen()
+ * \param cache One of NEWDB_CACHE_*
+ * \param lastupdate Its newDbGetLastupdate*(): keeps the ETag unique when the DB was re-created
+ * \returns 1 when the 304 was sent
+ */
+static int etagCheck( int cache, int lastupdate ) {
+    char etag[40];
+    char * match = getenv( "HTTP_IF_NONE_MATCH" );
+
+    sprintf( etag, "\"%x-%x\"", newDbGetCacheGeneration( cache ), lastupdate );
+    if ( match != NULL && strstr( match, etag ) != NULL ) {
+        printf( "Status: 304 Not Modified\r\nETag: %s\r\n\r\n", etag );
+        return( 1 );
+    }
+    printf( "ETag: %s\r\n", etag );
+    return( 0 );
+}
+
 // -------------------------------------------------------------
 // Main
 // -------------------------------------------------------------
@@ -196,12 +230,20 @@ int main( int argc, char * argv[] ) {
     int err = 0;
     char * list;
     int lus, lus2, lus3;
+    unsigned int gen;
     int downtime;
     
     int clk = time( NULL );
 
     mac[0] = '\0';
 
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command = tableno = nfcmode = 0;
+    cmd[0] = '\0';
+    postlvl = postrgb = postkelvin = -1;
+    postwait = postgen = 0;
+#endif
     // char * formdata = (char *)getenv( "QUERY_STRING" );
 
     char postdata[200];
@@ -333,9 +375,18 @@ int main( int argc, char * argv[] ) {
         break;
 
     case COMMAND_TSCHECK:
+        newDbOpen();
+        gen = newDbGetGenerations( TSCHECK_TABLES );
+#ifndef CGI_WORKER
+        // Long-poll: with wait=<s>&gen=<gen> only answer when there is a change.
+        // Not in iot_cgi_worker, which serves one request at a time
+        if ( postwait > 0 && gen == (unsigned int)postgen ) {
+            gen = newDbWaitGenerations( TSCHECK_TABLES, gen,
+                    1000 * ( ( postwait < MAX_WAIT ) ? postwait : MAX_WAIT ) );
+        }
+#endif
         xmlOpen();
         buf[0] = '\0';
-        newDbOpen();
         lus  = newDbGetLastupdatePlug();
         lus2 = newDbGetLastupdateLamp();
         lus3 = newDbGetLastupdateSystem();
@@ -347,13 +398,15 @@ int main( int argc, char * argv[] ) {
         printf( "    <lus>%d</lus>\n", lus );
         printf( "    <lus2>%d</lus2>\n", lus2);
         printf( "    <lus3>%d</lus3>\n", lus3);
+        printf( "    <gen>%u</gen>\n", gen );
         xmlClose();
         break;
 
     case COMMAND_GET_SYSTEMTABLE:
-        xmlOpen();
         newDbOpen();
-        list = newDbSerializeSystem( MAXBUF, buf );
+        if ( etagCheck( NEWDB_CACHE_SYSTEM, newDbGetLastupdateSystem() ) ) break;
+        xmlOpen();
+        list = newDbSerializeCached( NEWDB_CACHE_SYSTEM, NULL );
         newDbClose();
         xmlError( list == NULL );
         printf( "    <clk>%d</clk>\n", clk );
@@ -362,9 +415,10 @@ int main( int argc, char * argv[] ) {
         break;
 
     case COMMAND_GET_DEVS:
-        xmlOpen();
         newDbOpen();
-        list = newDbSerializeLampsAndPlugs( MAXBUF, buf );
+        if ( etagCheck( NEWDB_CACHE_LAMPSANDPLUGS, newDbGetLastupdateDevices() ) ) break;
+        xmlOpen();
+        list = newDbSerializeCached( NEWDB_CACHE_LAMPSANDPLUGS, NULL );
         newDbClose();
         xmlError( list == NULL );
         printf( "    <devs>%s</devs>\n", ( list ) ? list : "-" );
@@ -45,8 +45,6 @@
 
 #define CONTROL_PORT    "2001"
 
-#define MAXBUF   2000
-
 // -------------------------------------------------------------
 // Globals
 // -------------------------------------------------------------
@@ -54,7 +52,6 @@
 static int command = COMMAND_NONE;
 static char mac[40];
 static char cmd[8];
-static char buf[MAXBUF];
 
 // -------------------------------------------------------------
 // Variables
@@ -139,6 +136,11 @@ int main( int argc, char * argv[] ) {
 
     int clk = (int)time( NULL );
 
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command = COMMAND_NONE;
+    mac[0] = cmd[0] = '\0';
+#endif
     char * formdata = (char *)getenv( "QUERY_STRING" );
     char formdata_cpy[200];
     formdata_cpy[0] = '\0';
@@ -241,7 +243,7 @@ int main( int argc, char * argv[] ) {
     case COMMAND_GET_LIST:
         xmlOpen();
         newDbOpen();
-        list = newDbSerializePlugs( MAXBUF, buf );
+        list = newDbSerializeCached( NEWDB_CACHE_PLUGS, NULL );
         newDbClose();
         xmlError( list == NULL );
         printf( "    <clk>%d</clk>\n", clk );
@@ -259,9 +261,11 @@ int main( int argc, char * argv[] ) {
 
             int hourHistory[60];
             int dayHistory[24];
+            newdb_plugtotals_t totals;
 
             plugGetHistory( mac, (int)clk, 1,  60, hourHistory );
             plugGetHistory( mac, (int)clk, 60, 24, dayHistory );
+            newDbGetPlugTotals( mac, (int)clk, &totals );
 
             printf( "<time>%s</time>",     timeString( clk ) );
             printf( "<mac>%s</mac>\n",     mac );
@@ -269,6 +273,9 @@ int main( int argc, char * argv[] ) {
             printf( "<act>%d</act>\n",     device.act );
             printf( "<sum>%d</sum>\n",     device.sum );
             printf( "<ts>%s</ts>\n",       timeString( device.lastupdate ) );
+            printf( "<hourwh>%d</hourwh>\n", totals.hour );
+            printf( "<daywh>%d</daywh>\n",   totals.day );
+            printf( "<avg>%d</avg>\n",       totals.power );
 
             printf( "<hourhistory>\n" );
             int i, first=1;
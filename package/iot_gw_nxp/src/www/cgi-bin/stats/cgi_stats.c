@@ -0,0 +1,143 @@
+// ------------------------------------------------------------------
+// CGI program - Stats
+// ------------------------------------------------------------------
+// Program that reports the latency histograms of the IoT daemons
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2015. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \brief CGI Program for the latency statistics
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atoi.h"
+#include "iotStats.h"
+
+// #define MAIN_DEBUG
+
+#ifdef MAIN_DEBUG
+#define DEBUG_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif /* MAIN_DEBUG */
+
+#define COMMAND_GET_STATS     0
+#define COMMAND_RESET_STATS   1
+
+// -------------------------------------------------------------
+// Globals
+// -------------------------------------------------------------
+
+static int  postcommand = COMMAND_GET_STATS;
+
+// -------------------------------------------------------------
+// Variables
+// -------------------------------------------------------------
+
+static int strpos( char * haystack, char * needle ) {
+    char * p = strstr( haystack, needle );
+    if ( p ) return( (int)( p-haystack ) );
+    return( -1 );
+}
+
+static void parseNameValue( char * name, char * value ) {
+    DEBUG_PRINTF( "Name/Value: %s/%s\n", name, value );
+    if ( strcmp( name, "command" ) == 0 ) {
+        postcommand = Atoi( value );
+    }
+}
+
+static void parsePostdata( char * formdata ) {
+    DEBUG_PRINTF( "Parse: %s\n", formdata );
+    int pos;
+    if ( ( pos = strpos( formdata, "&" ) ) != -1 ) {
+        formdata[pos] = '\0';
+        parsePostdata( formdata );
+        parsePostdata( &formdata[pos+1] );
+    } else {
+        // One name/value pair
+        if ( ( pos = strpos( formdata, "=" ) ) != -1 ) {
+            formdata[pos] = '\0';
+            parseNameValue( formdata, &formdata[pos+1] );
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Main
+// -------------------------------------------------------------
+
+/**
+ * \brief CGI's main entry point: Sends the histograms of all stages as XML.
+ * Buckets are sent as a ';' separated list, bucket b counts durations below 2^b usec
+ * \param argc Number of command-line parameters
+ * \param argv Syntax: <progname> [ <command> ]
+ */
+int main( int argc, char * argv[] ) {
+    iotStatsHist_t hist;
+    int s, b, last, err = 0;
+
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    postcommand = COMMAND_GET_STATS;
+#endif
+    if ( argc > 1 ) {
+        // Called from command line
+        postcommand = atoi( argv[1] );
+    }
+
+    char postdata[200];
+    char * lenstr = (char *)getenv( "CONTENT_LENGTH" );
+    if ( lenstr != NULL ) {
+        int len = Atoi( lenstr );
+        if ( len > (int)sizeof( postdata ) - 1 ) len = sizeof( postdata ) - 1;
+        if ( fgets( postdata, len+1, stdin ) ) {
+            parsePostdata( postdata );
+        }
+    }
+
+    if ( postcommand == COMMAND_RESET_STATS ) {
+        err = !iotStatsReset();
+    }
+
+    printf( "Content-type: text/xml\r\n\r\n" );
+    printf( "<?xml version='1.0' encoding='utf-8'?>\n" );
+    printf( "<stats>\n" );
+    printf( "    <cmd>%d</cmd>\n", postcommand );
+    printf( "    <clk>%d</clk>\n", (int)time( NULL ) );
+
+    for ( s=0; s<IOT_STATS_NUM && !err; s++ ) {
+        if ( !iotStatsGet( s, &hist ) ) {
+            err = 1;
+            break;
+        }
+        printf( "    <stage name='%s'>\n", statsNames[s] );
+        printf( "        <count>%u</count>\n", hist.count );
+        printf( "        <max>%u</max>\n", hist.max );
+        printf( "        <p50>%u</p50>\n", iotStatsPercentile( &hist, 50 ) );
+        printf( "        <p90>%u</p90>\n", iotStatsPercentile( &hist, 90 ) );
+        printf( "        <p99>%u</p99>\n", iotStatsPercentile( &hist, 99 ) );
+
+        // Trailing empty buckets are left out
+        for ( last = IOT_STATS_BUCKETS - 1; last > 0 && hist.buckets[last] == 0; last-- );
+        printf( "        <buckets>" );
+        for ( b=0; b<=last; b++ ) {
+            printf( "%s%u", ( b ) ? ";" : "", hist.buckets[b] );
+        }
+        printf( "</buckets>\n" );
+        printf( "    </stage>\n" );
+    }
+
+    printf( "    <err>%d</err>\n", err );
+    printf( "</stats>\n" );
+
+    return( 0 );
+}
+
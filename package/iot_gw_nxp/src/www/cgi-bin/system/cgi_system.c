@@ -174,6 +174,11 @@ int main( int argc, char * argv[] ) {
     char buf[MAXBUFFER];
     int downtime;
     
+#ifdef CGI_WORKER
+    // Called once per request by iot_cgi_worker: start from the initial state
+    command   = 0;
+    strval[0] = '\0';
+#endif
     if ( argc > 1 ) {
         printf( "Help: %s <command> [ <hostname> | <ssid> | <channel> | <timezone> | <browsertime> ]\n", argv[0] );
         // Called from command line
@@ -0,0 +1,490 @@
+// ------------------------------------------------------------------
+// CGI worker
+// ------------------------------------------------------------------
+// Long-lived FastCGI responder that runs the web UI CGI programs
+// in-process: a UI poll no longer costs a fork+exec, a DB attach
+// and fresh libc/heap setup per request
+// ------------------------------------------------------------------
+// Author:    nlv10677
+// Copyright: NXP B.V. 2014. All rights reserved
+// ------------------------------------------------------------------
+
+/** \file
+ * \brief FastCGI worker for the web UI CGI programs
+ *
+ * Each CGI program is linked in with its main() renamed (-Dmain=cgiXxxMain)
+ * and is routed to on the basename of SCRIPT_NAME, so the web UI URLs stay
+ * the same. With lighttpd:
+ *
+ *   fastcgi.server = ( ".cgi" => (( "socket" => "/tmp/iot_cgi.sock",
+ *                                   "check-local" => "disable" )) )
+ *
+ * Requests are served one at a time: the CGI programs keep their request
+ * state in globals and print their response on stdout. For every request
+ * the CGI environment is set from the PARAMS, stdin is rewound onto the
+ * posted data and stdout is captured, then sent back as STDOUT records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "newDb.h"
+
+// #define CW_DEBUG
+
+#ifdef CW_DEBUG
+#define DEBUG_PRINTF(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif /* CW_DEBUG */
+
+// -------------------------------------------------------------
+// Macros
+// -------------------------------------------------------------
+
+#define CGI_WORKER_SOCKET       "/tmp/iot_cgi.sock"
+
+// FastCGI 1.0 protocol
+#define FCGI_VERSION_1          1
+#define FCGI_HEADER_LEN         8
+#define FCGI_MAX_CONTENT        65535
+
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_GET_VALUES         9
+#define FCGI_GET_VALUES_RESULT  10
+#define FCGI_UNKNOWN_TYPE       11
+
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+
+#define FCGI_REQUEST_COMPLETE   0
+#define FCGI_CANT_MPX_CONN      1
+#define FCGI_UNKNOWN_ROLE       3
+
+#define MAXPARAMS               4096    // CGI environment per request
+#define MAXINPUT                2048    // Posted data per request (the CGIs read < 200)
+#define MAXCHUNK                16384   // STDOUT record size
+
+// -------------------------------------------------------------
+// Types
+// -------------------------------------------------------------
+
+typedef struct cgiRoute {
+    char * script;
+    int ( * main )( int argc, char * argv[] );
+} cgiRoute_t;
+
+typedef struct fcgiRequest {
+    int  id;                    // 0 = idle
+    int  keep;
+    int  paramslen;
+    int  inputlen;
+    char params[MAXPARAMS];
+    char input[MAXINPUT];
+} fcgiRequest_t;
+
+// -------------------------------------------------------------
+// Globals
+// -------------------------------------------------------------
+
+int cgiControlMain( int argc, char * argv[] );
+int cgiDatabaseMain( int argc, char * argv[] );
+int cgiGroupsMain( int argc, char * argv[] );
+int cgiLampMain( int argc, char * argv[] );
+int cgiLogsMain( int argc, char * argv[] );
+int cgiMobileMain( int argc, char * argv[] );
+int cgiPlugsMain( int argc, char * argv[] );
+int cgiStatsMain( int argc, char * argv[] );
+int cgiSystemMain( int argc, char * argv[] );
+
+static cgiRoute_t routes[] = {
+    { "iot_control.cgi",  cgiControlMain },
+    { "iot_database.cgi", cgiDatabaseMain },
+    { "iot_groups.cgi",   cgiGroupsMain },
+    { "iot_lamp.cgi",     cgiLampMain },
+    { "iot_logs.cgi",     cgiLogsMain },
+    { "iot_mobile.cgi",   cgiMobileMain },
+    { "iot_plugs.cgi",    cgiPlugsMain },
+    { "iot_stats.cgi",    cgiStatsMain },
+    { "iot_system.cgi",   cgiSystemMain },
+    { NULL, NULL }
+};
+
+static fcgiRequest_t request;
+static unsigned char content[FCGI_MAX_CONTENT + 255];
+static char chunk[MAXCHUNK];
+
+static int inFd  = -1;          // Behind fd 0 while a request runs
+static int outFd = -1;          // Behind fd 1 while a request runs
+
+// -------------------------------------------------------------
+// Socket I/O
+// -------------------------------------------------------------
+
+static int readFull( int fd, void * buf, int len ) {
+    char * p = (char *)buf;
+    while ( len > 0 ) {
+        int n = read( fd, p, len );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) return( 0 );
+        p += n;
+        len -= n;
+    }
+    return( 1 );
+}
+
+static int writeFull( int fd, void * buf, int len ) {
+    char * p = (char *)buf;
+    while ( len > 0 ) {
+        int n = write( fd, p, len );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) return( 0 );
+        p += n;
+        len -= n;
+    }
+    return( 1 );
+}
+
+/**
+ * \brief Send one record, padded to a multiple of 8 bytes
+ * \returns 1 on success, 0 when the web server went away
+ */
+static int sendRecord( int fd, int type, int id, char * data, int len ) {
+    static char padding[8];
+    unsigned char hdr[FCGI_HEADER_LEN];
+    int pad = ( 8 - ( len % 8 ) ) % 8;
+
+    hdr[0] = FCGI_VERSION_1;
+    hdr[1] = type;
+    hdr[2] = ( id >> 8 ) & 0xFF;
+    hdr[3] = id & 0xFF;
+    hdr[4] = ( len >> 8 ) & 0xFF;
+    hdr[5] = len & 0xFF;
+    hdr[6] = pad;
+    hdr[7] = 0;
+
+    return( writeFull( fd, hdr, FCGI_HEADER_LEN ) &&
+            ( len == 0 || writeFull( fd, data, len ) ) &&
+            ( pad == 0 || writeFull( fd, padding, pad ) ) );
+}
+
+static int sendEndRequest( int fd, int id, int appStatus, int protocolStatus ) {
+    char body[8];
+    memset( body, 0, sizeof( body ) );
+    body[0] = ( appStatus >> 24 ) & 0xFF;
+    body[1] = ( appStatus >> 16 ) & 0xFF;
+    body[2] = ( appStatus >> 8 ) & 0xFF;
+    body[3] = appStatus & 0xFF;
+    body[4] = protocolStatus;
+    return( sendRecord( fd, FCGI_END_REQUEST, id, body, sizeof( body ) ) );
+}
+
+// -------------------------------------------------------------
+// Name-value pairs
+// -------------------------------------------------------------
+
+static int pairLength( unsigned char ** pp, unsigned char * end, int * len ) {
+    unsigned char * p = *pp;
+    if ( p >= end ) return( 0 );
+    if ( p[0] & 0x80 ) {
+        if ( p + 4 > end ) return( 0 );
+        *len = ( ( p[0] & 0x7F ) << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+        *pp = p + 4;
+    } else {
+        *len = p[0];
+        *pp = p + 1;
+    }
+    return( 1 );
+}
+
+/**
+ * \brief Walk the PARAMS of the request and setenv() (set = 1) or
+ * unsetenv() (set = 0) each of them
+ */
+static void paramsApply( fcgiRequest_t * req, int set ) {
+    unsigned char * p   = (unsigned char *)req->params;
+    unsigned char * end = p + req->paramslen;
+    char name[128];
+    char value[MAXPARAMS];
+    int nlen, vlen;
+
+    while ( pairLength( &p, end, &nlen ) && pairLength( &p, end, &vlen ) ) {
+        if ( nlen < 0 || vlen < 0 || p + nlen + vlen > end ) break;
+        if ( nlen < (int)sizeof( name ) ) {
+            memcpy( name, p, nlen );
+            name[nlen] = '\0';
+            memcpy( value, p + nlen, vlen );
+            value[vlen] = '\0';
+            if ( set ) {
+                setenv( name, value, 1 );
+            } else {
+                unsetenv( name );
+            }
+        }
+        p += nlen + vlen;
+    }
+}
+
+/**
+ * \brief Answer FCGI_GET_VALUES: one connection, one request at a time
+ */
+static int sendValues( int fd, unsigned char * data, int len ) {
+    static char * names[]  = { "FCGI_MAX_CONNS", "FCGI_MAX_REQS", "FCGI_MPXS_CONNS" };
+    static char * values[] = { "1", "1", "0" };
+    unsigned char * p   = data;
+    unsigned char * end = data + len;
+    char reply[128];
+    int  replylen = 0;
+    int  nlen, vlen, i;
+
+    while ( pairLength( &p, end, &nlen ) && pairLength( &p, end, &vlen ) ) {
+        if ( nlen < 0 || vlen < 0 || p + nlen + vlen > end ) break;
+        for ( i = 0; i < 3; i++ ) {
+            int n = strlen( names[i] );
+            if ( n == nlen && memcmp( p, names[i], n ) == 0 &&
+                 replylen + 2 + n + 1 <= (int)sizeof( reply ) ) {
+                reply[replylen++] = n;
+                reply[replylen++] = 1;
+                memcpy( reply + replylen, names[i], n );
+                replylen += n;
+                reply[replylen++] = values[i][0];
+            }
+        }
+        p += nlen + vlen;
+    }
+    return( sendRecord( fd, FCGI_GET_VALUES_RESULT, 0, reply, replylen ) );
+}
+
+// -------------------------------------------------------------
+// Run a request
+// -------------------------------------------------------------
+
+static cgiRoute_t * findRoute( char * script ) {
+    cgiRoute_t * route;
+    char * base;
+
+    if ( script == NULL ) return( NULL );
+    base = strrchr( script, '/' );
+    base = ( base ) ? base + 1 : script;
+
+    for ( route = routes; route->script; route++ ) {
+        if ( strcmp( route->script, base ) == 0 ) return( route );
+    }
+    return( NULL );
+}
+
+/**
+ * \brief Run the CGI program for the request and send its output
+ * \returns 1 on success, 0 when the web server went away
+ */
+static int runRequest( int fd, fcgiRequest_t * req ) {
+    cgiRoute_t * route;
+    char * script;
+    char * argv[2];
+    int status = 0, ok = 1, n;
+    off_t pos = 0;
+
+    paramsApply( req, 1 );
+    script = getenv( "SCRIPT_NAME" );
+    route  = findRoute( script );
+
+    // Posted data on stdin
+    if ( ftruncate( inFd, 0 ) < 0 ||
+         pwrite( inFd, req->input, req->inputlen, 0 ) != req->inputlen ) {
+        perror( "cgi_worker stdin" );
+    }
+    fseek( stdin, 0, SEEK_SET );
+    clearerr( stdin );
+
+    // Capture stdout
+    fflush( stdout );
+    if ( ftruncate( outFd, 0 ) < 0 ) perror( "cgi_worker stdout" );
+    fseek( stdout, 0, SEEK_SET );
+    clearerr( stdout );
+
+    if ( route ) {
+        DEBUG_PRINTF( "Request %d: %s\n", req->id, route->script );
+        argv[0] = route->script;
+        argv[1] = NULL;
+        status = route->main( 1, argv );
+    } else {
+        printf( "Status: 404 Not Found\r\nContent-type: text/plain\r\n\r\nNo such CGI: %s\n",
+                ( script ) ? script : "-" );
+    }
+    fflush( stdout );
+
+    while ( ok && ( n = pread( outFd, chunk, sizeof( chunk ), pos ) ) > 0 ) {
+        ok = sendRecord( fd, FCGI_STDOUT, req->id, chunk, n );
+        pos += n;
+    }
+
+    paramsApply( req, 0 );
+
+    return( ok &&
+            sendRecord( fd, FCGI_STDOUT, req->id, NULL, 0 ) &&
+            sendEndRequest( fd, req->id, status, FCGI_REQUEST_COMPLETE ) );
+}
+
+// -------------------------------------------------------------
+// Connection
+// -------------------------------------------------------------
+
+/**
+ * \brief Serve the records of one web server connection until it closes,
+ * or until a request without FCGI_KEEP_CONN completes
+ */
+static void serveConnection( int fd ) {
+    unsigned char hdr[FCGI_HEADER_LEN];
+    fcgiRequest_t * req = &request;
+    int type, id, len, role, done;
+
+    req->id = 0;
+
+    while ( readFull( fd, hdr, FCGI_HEADER_LEN ) ) {
+        type = hdr[1];
+        id   = ( hdr[2] << 8 ) | hdr[3];
+        len  = ( hdr[4] << 8 ) | hdr[5];
+
+        if ( hdr[0] != FCGI_VERSION_1 ) break;
+        if ( !readFull( fd, content, len + hdr[6] ) ) break;
+
+        done = 0;
+        switch ( type ) {
+        case FCGI_BEGIN_REQUEST:
+            if ( len < 8 ) return;
+            role = ( content[0] << 8 ) | content[1];
+            if ( req->id != 0 ) {
+                if ( !sendEndRequest( fd, id, 0, FCGI_CANT_MPX_CONN ) ) return;
+            } else if ( role != FCGI_RESPONDER ) {
+                if ( !sendEndRequest( fd, id, 0, FCGI_UNKNOWN_ROLE ) ) return;
+                if ( !( content[2] & FCGI_KEEP_CONN ) ) return;
+            } else {
+                req->id        = id;
+                req->keep      = content[2] & FCGI_KEEP_CONN;
+                req->paramslen = 0;
+                req->inputlen  = 0;
+            }
+            break;
+
+        case FCGI_PARAMS:
+            if ( id != req->id || id == 0 ) break;
+            if ( req->paramslen + len <= MAXPARAMS ) {
+                memcpy( req->params + req->paramslen, content, len );
+                req->paramslen += len;
+            } else {
+                fprintf( stderr, "cgi_worker: PARAMS too large, truncated\n" );
+            }
+            break;
+
+        case FCGI_STDIN:
+            if ( id != req->id || id == 0 ) break;
+            if ( len > 0 ) {
+                if ( req->inputlen + len <= MAXINPUT ) {
+                    memcpy( req->input + req->inputlen, content, len );
+                    req->inputlen += len;
+                }
+                break;
+            }
+            // Empty STDIN record: all input present
+            if ( !runRequest( fd, req ) ) return;
+            done = 1;
+            break;
+
+        case FCGI_ABORT_REQUEST:
+            if ( id != req->id || id == 0 ) break;
+            if ( !sendEndRequest( fd, id, 0, FCGI_REQUEST_COMPLETE ) ) return;
+            done = 1;
+            break;
+
+        case FCGI_GET_VALUES:
+            if ( !sendValues( fd, content, len ) ) return;
+            break;
+
+        default:
+            memset( chunk, 0, 8 );
+            chunk[0] = type;
+            if ( !sendRecord( fd, FCGI_UNKNOWN_TYPE, 0, chunk, 8 ) ) return;
+            break;
+        }
+
+        if ( done ) {
+            req->id = 0;
+            if ( !req->keep ) return;
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Main
+// -------------------------------------------------------------
+
+/**
+ * \brief Usage: iot_cgi_worker [ <socket path> ]
+ */
+int main( int argc, char * argv[] ) {
+    struct sockaddr_un addr;
+    char * path = ( argc > 1 ) ? argv[1] : CGI_WORKER_SOCKET;
+    FILE * in, * out;
+    int listenFd, fd;
+
+    signal( SIGPIPE, SIG_IGN );
+
+    // Requests run against stdin/stdout: back them by two scratch files
+    if ( ( in = tmpfile() ) == NULL || ( out = tmpfile() ) == NULL ) {
+        perror( "tmpfile" );
+        return( 1 );
+    }
+    inFd  = fileno( in );
+    outFd = fileno( out );
+    if ( dup2( inFd, 0 ) < 0 || dup2( outFd, 1 ) < 0 ) {
+        perror( "dup2" );
+        return( 1 );
+    }
+
+    if ( ( listenFd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 ) {
+        perror( "socket" );
+        return( 1 );
+    }
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path, sizeof( addr.sun_path ) - 1 );
+    unlink( path );
+    if ( bind( listenFd, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 ) {
+        perror( "bind" );
+        return( 1 );
+    }
+    chmod( path, 0666 );
+    if ( listen( listenFd, 8 ) < 0 ) {
+        perror( "listen" );
+        return( 1 );
+    }
+
+    // Attach the DB once, the newDbOpen() calls of the CGIs then return at once
+    newDbOpen();
+
+    fprintf( stderr, "iot_cgi_worker: listening on %s\n", path );
+
+    for ( ;; ) {
+        if ( ( fd = accept( listenFd, NULL, NULL ) ) < 0 ) {
+            if ( errno != EINTR ) perror( "accept" );
+            continue;
+        }
+        serveConnection( fd );
+        close( fd );
+    }
+
+    return( 0 );
+}
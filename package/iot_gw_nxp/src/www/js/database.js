@@ -70,6 +70,10 @@ function getXmlVal( xmlDoc, tag ) {
     return( v );
 }
 
+// ETag of the last answer to each request, sent back as If-None-Match: when
+// nothing changed the CGI answers 304 and onReady is not called
+var etags = {};
+
 function doHttp( posts, onReady ) {
     var xmlhttp;
     if ( window.XMLHttpRequest ) {
@@ -81,12 +85,15 @@ function doHttp( posts, onReady ) {
     }
     xmlhttp.onreadystatechange=function() {
         if ( xmlhttp.readyState==4 && xmlhttp.status==200 ) {
+            var etag = xmlhttp.getResponseHeader( 'ETag' );
+            if ( etag ) etags[posts] = etag;
             onReady( xmlhttp );
         }
     }
     xmlhttp.open( 'POST', 'iot_database.cgi', true );
     xmlhttp.setRequestHeader( 'Content-type',
                               'application/x-www-form-urlencoded' );
+    if ( etags[posts] ) xmlhttp.setRequestHeader( 'If-None-Match', etags[posts] );
     xmlhttp.send( posts );
 }
 
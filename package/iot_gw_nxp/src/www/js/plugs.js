@@ -428,11 +428,14 @@ function PlugExec( post ) {
                     break;
 
                 case COMMAND_GET_PLUG:
-                    var time, onoff, act, sum, dayhistory;
+                    var time, onoff, act, sum, dayhistory, hourwh, daywh, avg;
                     mac         = getXmlVal( xmlDoc, 'mac' );
                     onoff       = parseInt( getXmlVal( xmlDoc, 'onoff' ) );
                     act         = getXmlVal( xmlDoc, 'act' );
                     sum         = getXmlVal( xmlDoc, 'sum' );
+                    hourwh      = getXmlVal( xmlDoc, 'hourwh' );
+                    daywh       = getXmlVal( xmlDoc, 'daywh' );
+                    avg         = getXmlVal( xmlDoc, 'avg' );
                     hourhistory = getXmlVal( xmlDoc, 'hourhistory' );
                     dayhistory  = getXmlVal( xmlDoc, 'dayhistory' );
 
@@ -445,7 +448,8 @@ function PlugExec( post ) {
                                "<img src='/img/noplug.png' width='36'/>";
                     }
                     document.getElementById('actsum').innerHTML =
-                         'Actual: '+num1(act)+', Sum: '+num1(sum)+' ('+ts+')';
+                         'Actual: '+num1(act)+', Sum: '+num1(sum)+' ('+ts+')' +
+                         '<br/>Average: '+avg+' W, last hour: '+hourwh+' Wh, last day: '+daywh+' Wh';
                     // console.log( 'dayhistory=' + dayhistory );
                     setChartData( hourhistory, dayhistory );
                     gotoPlug( mac, onoff, act, sum );
@@ -393,7 +393,8 @@ enable_broadcom() {
 		}
 		_c=$(($_c + 1))
 	done
-	wlc ifname "$device" stdin <<EOF
+	# apply: settings the driver already has are not written again
+	wlc ifname "$device" apply stdin <<EOF
 ${macaddr:+bssid $macaddr}
 ${macaddr:+cur_etheraddr $macaddr}
 band ${band:-0}
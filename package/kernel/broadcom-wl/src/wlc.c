@@ -59,6 +59,10 @@ static char interface[16] = "wl0";
 static unsigned long kmem_offset = 0;
 static int vif = 0, debug = 1, fromstdin = 0;
 
+/* apply mode: skip sets that change nothing, one down/up around the rest */
+static int applymode = 0;
+static int apply_pending_down = 0, apply_went_down = 0;
+
 typedef enum {
 	NONE =   0x00,
 
@@ -71,6 +75,7 @@ typedef enum {
 	/* options */
 	PARAM_OPTIONS = 0x0f0,
 	NOARG =  0x010,
+	NOCMP =  0x020,	/* get does not return what set takes */
 
 	/* modes */
 	PARAM_MODE =    0xf00,
@@ -566,6 +571,13 @@ static const struct wlc_call wlc_calls[] = {
 		.data.ptr = &fromstdin,
 		.desc = "Accept input from stdin"
 	},
+	{
+		.name = "apply",
+		.param = NOARG,
+		.handler = wlc_flag,
+		.data.ptr = &applymode,
+		.desc = "Skip unchanged settings, single down/up"
+	},
 	{
 		.name = "ifname",
 		.param = STRING,
@@ -643,7 +655,7 @@ static const struct wlc_call wlc_calls[] = {
 	},
 	{
 		.name = "channel",
-		.param = INT,
+		.param = INT|NOCMP,
 		.handler = wlc_ioctl,
 		.data.num = ((WLC_GET_CHANNEL << 16) | WLC_SET_CHANNEL),
 		.desc = "Channel",
@@ -1023,6 +1035,93 @@ static void usage(char *cmd)
 	exit(1);
 }
 
+#ifndef WLC_GET_UP
+#define WLC_GET_UP 1
+#endif
+
+static int apply_is_up(void)
+{
+	int up = 0;
+
+	if (wl_ioctl(interface, WLC_GET_UP, &up, sizeof(up)))
+		return 1;
+
+	return up;
+}
+
+/* a setting is about to change, do the down that was asked for */
+static void apply_down(void)
+{
+	if (!apply_pending_down)
+		return;
+
+	apply_pending_down = 0;
+	if (apply_is_up()) {
+		wl_ioctl(interface, WLC_DOWN, NULL, 0);
+		apply_went_down = 1;
+	}
+}
+
+/*
+ * Returns 1 if the command was taken care of: down is deferred until a
+ * setting really changes, up is only done if the interface is down, and
+ * settings that can be read back are skipped if they already match.
+ */
+static int apply_command(const struct wlc_call *cmd, void *value)
+{
+	static char cur[BUFSIZE];
+	int len;
+
+	if (cmd->handler == wlc_ioctl && (cmd->param & NOARG)) {
+		if (cmd->data.num == WLC_DOWN) {
+			if (!apply_went_down)
+				apply_pending_down = 1;
+			return 1;
+		}
+		if (cmd->data.num == WLC_UP) {
+			apply_pending_down = 0;
+			if (!apply_went_down && apply_is_up())
+				return 1;
+			apply_went_down = 0;
+		}
+		return 0;
+	}
+
+	/* local state only */
+	if (cmd->handler == wlc_int || cmd->handler == wlc_flag ||
+	    cmd->handler == wlc_ifname || cmd->handler == wlc_string)
+		return 0;
+
+	switch (cmd->param & PARAM_TYPE) {
+		case INT:
+			len = sizeof(int);
+			break;
+		case MAC:
+			len = 6;
+			break;
+		default:
+			len = 0;
+			break;
+	}
+
+	if (len && !(cmd->param & (NOARG | NOCMP)) &&
+	    (cmd->handler == wlc_iovar || cmd->handler == wlc_bssiovar ||
+	     cmd->handler == wlc_radio || cmd->handler == wlc_vif_enabled ||
+	     (cmd->handler == wlc_ioctl && (cmd->data.num >> 16)))) {
+		memset(cur, 0, len);
+		if (!cmd->handler((cmd->param & ~PARAM_MODE) | GET,
+				  (void *) &cmd->data, cur) &&
+		    !memcmp(cur, value, len)) {
+			if (debug >= 10)
+				fprintf(stderr, "apply: %s unchanged\n", cmd->name);
+			return 1;
+		}
+	}
+
+	apply_down();
+	return 0;
+}
+
 static int do_command(const struct wlc_call *cmd, char *arg)
 {
 	static char buf[BUFSIZE];
@@ -1087,6 +1186,9 @@ static int do_command(const struct wlc_call *cmd, char *arg)
 				break;
 		}
 
+		if (applymode && apply_command(cmd, ptr))
+			return 0;
+
 		ret = cmd->handler(cmd->param | SET, (void *) &cmd->data, ptr);
 	}
 	
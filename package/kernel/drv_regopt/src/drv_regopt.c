@@ -12,77 +12,268 @@
 #include <asm/atomic.h>  
 #include <linux/slab.h>  
 #include <linux/device.h>  
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+
+#include "drv_regopt.h"
 
 #define DEV_NAME    "regopt"
 
 static struct class             *reg_opt_class;
 static struct class_device	*reg_opt_class_dev;
 
-struct s_reg_param{
-	volatile unsigned long reg_add;	//寄存器物理地址
-	volatile unsigned long reg_val;	//寄存器值
-	volatile unsigned long *vm_add;	//寄存器映射地址
+/* 映射以页为单位缓存在每个打开的文件里，不再每次访问都 ioremap/iounmap */
+#define REG_OPT_MAX_BLOCKS	16
+#define REG_OPT_CHUNK		32	//批量操作每次从用户区复制的个数
+
+struct reg_opt_block {
+	unsigned long phys;
+	void __iomem *virt;
 };
 
-/*user 和kenel交互数据的结构体，
- * reg_add 寄存器地址
- * reg_val 寄存器的值
- * vm_add  映射到虚拟地址
- */
-static struct s_reg_param reg_param = {
-	.reg_add = 0,
-	.reg_val = 0,
-	.vm_add  = NULL,
+struct reg_opt_file {
+	struct mutex lock;
+	int nr_blocks;
+	int next;	//缓存满时下一个被替换的块
+	struct reg_opt_block blocks[REG_OPT_MAX_BLOCKS];
 };
 
+/* 读改写要和其他打开的文件互斥 */
+static DEFINE_SPINLOCK(reg_opt_lock);
+
+/* 允许 mmap 的寄存器块（物理地址，一页） */
+static unsigned long mmap_blocks[8] = {
+#ifdef CONFIG_RALINK
+	0x10000000,	//SYSCTL、GPIO、pinmux、时钟
+#endif
+};
+static int nr_mmap_blocks = ARRAY_SIZE(mmap_blocks);
+module_param_array(mmap_blocks, ulong, &nr_mmap_blocks, 0444);
+MODULE_PARM_DESC(mmap_blocks, "physical register pages that may be mmapped");
+
 static int reg_opt_open(struct inode *inode, struct file *file)
 {
-	//printk("reg_opt_open\n");
+	struct reg_opt_file *rf;
+
+	rf = kzalloc(sizeof(*rf), GFP_KERNEL);
+	if (!rf)
+		return -ENOMEM;
+
+	mutex_init(&rf->lock);
+	file->private_data = rf;
 	return 0;
 }
 
 static int reg_opt_close(struct inode *inode, struct file *file)
 {
-	//printk("reg_opt_close\n");
+	struct reg_opt_file *rf = file->private_data;
+	int i;
+
+	for (i = 0; i < rf->nr_blocks; i++)
+		iounmap(rf->blocks[i].virt);
+	kfree(rf);
 	return 0;
 }
 
-static int reg_opt_read(struct file *filp, char __user *buff, size_t count, loff_t *offp)
+/* 取寄存器的映射地址，调用时持有 rf->lock */
+static void __iomem *reg_opt_map(struct reg_opt_file *rf, unsigned long addr)
 {
-	//一定要先设置用户区的buff（即应用层read函数到第二个参数），就是要修改到物理寄存器地址
-	copy_from_user(&reg_param, buff, 4);	//物理地址4字节
-
-//	printk("reg_add = %x\n", reg_param.reg_add);
-	reg_param.vm_add = (volatile unsigned long *)ioremap(reg_param.reg_add, 0x4);	//映射寄存器
-	
-//	printk("reg_vmadd = %x\n", reg_param.vm_add);
-	reg_param.reg_val = *(reg_param.vm_add);	//取出寄存器
-//	printk("reg_val = %x\n", reg_param.reg_val);
-	copy_to_user(buff,&reg_param, 8);	//物理地址和值，2个4字节
-	iounmap(reg_param.vm_add);	//取消映射
-    	return 0;
+	unsigned long phys = addr & PAGE_MASK;
+	struct reg_opt_block *b;
+	void __iomem *virt;
+	int i;
+
+	if (addr & 3)
+		return NULL;
+
+	for (i = 0; i < rf->nr_blocks; i++)
+		if (rf->blocks[i].phys == phys)
+			return rf->blocks[i].virt + (addr & ~PAGE_MASK);
+
+	virt = ioremap(phys, PAGE_SIZE);
+	if (!virt)
+		return NULL;
+
+	if (rf->nr_blocks < REG_OPT_MAX_BLOCKS) {
+		b = &rf->blocks[rf->nr_blocks++];
+	} else {
+		b = &rf->blocks[rf->next];
+		rf->next = (rf->next + 1) % REG_OPT_MAX_BLOCKS;
+		iounmap(b->virt);
+	}
+
+	b->phys = phys;
+	b->virt = virt;
+	return virt + (addr & ~PAGE_MASK);
 }
 
-static int reg_opt_write(struct file *filp, char __user *buff, size_t count, loff_t *offp)
+static int reg_opt_do(struct reg_opt_file *rf, struct reg_opt_op *op)
 {
-	//把要修改的参数复制到内核reg_param中
-	copy_from_user(&reg_param, buff, 8);	//物理地址和值，2个4字节
-//	printk("reg_add = %x\n", reg_param.reg_add);
-//	printk("reg_val = %x\n", reg_param.reg_val);
-	reg_param.vm_add = (volatile unsigned long *)ioremap(reg_param.reg_add, 0x4);	//映射寄存器
-//	printk("reg_vmadd = %x\n", reg_param.vm_add);
-	*(reg_param.vm_add) = reg_param.reg_val;
-//	printk("reg_val = %x\n", *(reg_param.vm_add));
-	iounmap(reg_param.vm_add);	//取消映射
+	void __iomem *reg;
+	unsigned long flags;
+	u32 val;
+
+	reg = reg_opt_map(rf, op->addr);
+	if (!reg)
+		return -EINVAL;
+
+	switch (op->op) {
+	case REG_OPT_OP_READ:
+		op->val = __raw_readl(reg) & op->mask;
+		break;
+
+	case REG_OPT_OP_WRITE:
+		if (op->mask == 0xffffffff) {
+			__raw_writel(op->val, reg);
+			break;
+		}
+		spin_lock_irqsave(&reg_opt_lock, flags);
+		val = __raw_readl(reg);
+		val = (val & ~op->mask) | (op->val & op->mask);
+		__raw_writel(val, reg);
+		spin_unlock_irqrestore(&reg_opt_lock, flags);
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static ssize_t reg_opt_read(struct file *filp, char __user *buff, size_t count, loff_t *offp)
+{
+	struct reg_opt_file *rf = filp->private_data;
+	struct reg_opt_op op = {
+		.mask = 0xffffffff,
+		.op = REG_OPT_OP_READ,
+	};
+	u32 param[2];
+	int ret;
+
+	//一定要先设置用户区的buff（即应用层read函数到第二个参数），就是要修改到物理寄存器地址
+	if (count < 8 || copy_from_user(param, buff, 4))	//物理地址4字节
+		return -EFAULT;
+
+	op.addr = param[0];
+	mutex_lock(&rf->lock);
+	ret = reg_opt_do(rf, &op);
+	mutex_unlock(&rf->lock);
+	if (ret)
+		return ret;
+
+	param[1] = op.val;
+	if (copy_to_user(buff, param, 8))	//物理地址和值，2个4字节
+		return -EFAULT;
+
 	return 0;
 }
 
+static ssize_t reg_opt_write(struct file *filp, const char __user *buff, size_t count, loff_t *offp)
+{
+	struct reg_opt_file *rf = filp->private_data;
+	struct reg_opt_op op = {
+		.mask = 0xffffffff,
+		.op = REG_OPT_OP_WRITE,
+	};
+	u32 param[2];
+	int ret;
+
+	//把要修改的参数复制到内核中
+	if (count < 8 || copy_from_user(param, buff, 8))	//物理地址和值，2个4字节
+		return -EFAULT;
+
+	op.addr = param[0];
+	op.val = param[1];
+	mutex_lock(&rf->lock);
+	ret = reg_opt_do(rf, &op);
+	mutex_unlock(&rf->lock);
+
+	return ret;
+}
+
+/* 批量操作，返回执行完的个数，第一个就失败时返回错误 */
+static long reg_opt_batch(struct reg_opt_file *rf, struct reg_opt_batch __user *arg)
+{
+	struct reg_opt_op ops[REG_OPT_CHUNK];
+	struct reg_opt_batch batch;
+	struct reg_opt_op __user *uops;
+	u32 done = 0, n, i;
+	int ret = 0;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count > REG_OPT_BATCH_MAX)
+		return -E2BIG;
+
+	uops = (struct reg_opt_op __user *)(unsigned long)batch.ops;
+
+	mutex_lock(&rf->lock);
+	while (done < batch.count) {
+		n = min_t(u32, batch.count - done, REG_OPT_CHUNK);
+		if (copy_from_user(ops, uops + done, n * sizeof(ops[0]))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			ret = reg_opt_do(rf, &ops[i]);
+			if (ret)
+				break;
+		}
+
+		if (copy_to_user(uops + done, ops, i * sizeof(ops[0]))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		done += i;
+		if (ret)
+			break;
+	}
+	mutex_unlock(&rf->lock);
+
+	return done ? done : ret;
+}
+
+static long reg_opt_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case REG_OPT_IOC_BATCH:
+		return reg_opt_batch(filp->private_data, (void __user *)arg);
+	}
+
+	return -ENOTTY;
+}
+
+/* 把白名单中的寄存器块映射到用户区，应用层可以直接操作 GPIO */
+static int reg_opt_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	unsigned long phys = vma->vm_pgoff << PAGE_SHIFT;
+	int i;
+
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	for (i = 0; i < nr_mmap_blocks; i++)
+		if (mmap_blocks[i] && mmap_blocks[i] == phys)
+			break;
+	if (i == nr_mmap_blocks)
+		return -EPERM;
+
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	return io_remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff,
+				  PAGE_SIZE, vma->vm_page_prot);
+}
+
 static struct file_operations reg_opt_fops = {
 	.owner   =  THIS_MODULE,    /* 这是一个宏，推向编译模块时自动创建的__this_module变量 */
 	.open    =  reg_opt_open,
 	.release =  reg_opt_close,
 	.read    =  reg_opt_read,
 	.write	  =  reg_opt_write,	   
+	.unlocked_ioctl = reg_opt_ioctl,
+	.mmap    =  reg_opt_mmap,
 };
 
 static int major;
@@ -0,0 +1,37 @@
+/*
+ * drv_regopt 的 ioctl/mmap 接口
+ *
+ * 批量操作：ioctl(fd, REG_OPT_IOC_BATCH, &batch)，一次执行 batch.count 个
+ * reg_opt_op，返回执行完的个数。读操作把 (寄存器值 & mask) 写回 val。
+ * 写操作只改 mask 中的位，mask 为 0xffffffff 时直接写，不先读。
+ *
+ * mmap：offset 为寄存器块的物理地址，长度一页，只允许模块参数
+ * mmap_blocks 中列出的块。
+ */
+#ifndef __DRV_REGOPT_H
+#define __DRV_REGOPT_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define REG_OPT_OP_READ		0
+#define REG_OPT_OP_WRITE	1
+
+struct reg_opt_op {
+	__u32 addr;	//寄存器物理地址，4 字节对齐
+	__u32 mask;
+	__u32 val;
+	__u32 op;	//REG_OPT_OP_*
+};
+
+struct reg_opt_batch {
+	__u32 count;
+	__u32 pad;
+	__u64 ops;	//struct reg_opt_op 数组的用户地址
+};
+
+#define REG_OPT_BATCH_MAX	1024
+
+#define REG_OPT_IOC_BATCH	_IOWR('r', 1, struct reg_opt_batch)
+
+#endif
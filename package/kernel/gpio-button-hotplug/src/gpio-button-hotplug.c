@@ -44,6 +44,13 @@
 
 #define BH_ERR(fmt, args...) printk(KERN_ERR "%s: " fmt, DRV_NAME, ##args )
 
+/* polling step of gpio-keys while debouncing, if no button has one set */
+#define GPIO_KEYS_DEBOUNCE	5
+
+static bool use_irq = true;
+module_param(use_irq, bool, 0444);
+MODULE_PARM_DESC(use_irq, "Use edge interrupts for gpio-keys-polled buttons where available");
+
 struct bh_priv {
 	unsigned long		seen;
 };
@@ -63,13 +70,17 @@ struct bh_map {
 	const char	*name;
 };
 
+struct gpio_keys_button_dev;
+
 struct gpio_keys_button_data {
-	struct delayed_work work;
+	struct gpio_keys_button_dev *bdev;
 	struct bh_priv bh;
 	int last_state;
 	int count;
 	int threshold;
 	int can_sleep;
+	int irq;
+	atomic_t pending;
 	struct gpio_keys_button *b;
 };
 
@@ -256,8 +267,15 @@ static void button_hotplug_event(struct gpio_keys_button_data *data,
 	priv->seen = seen;
 }
 
+/*
+ * All buttons of a device share one delayed work. Buttons with an irq are
+ * only read from it while their debounce window is open (pending set by the
+ * irq handler), buttons without one on every run of gpio-keys-polled. The
+ * work stops rescheduling itself once neither is left.
+ */
 struct gpio_keys_button_dev {
 	int polled;
+	unsigned int interval;
 	struct delayed_work work;
 
 	struct device *dev;
@@ -277,7 +295,8 @@ static int gpio_button_get_value(struct gpio_keys_button_data *bdata)
 	return val ^ bdata->b->active_low;
 }
 
-static void gpio_keys_polled_check_state(struct gpio_keys_button_data *bdata)
+/* returns 0 while the button is still debouncing */
+static int gpio_keys_polled_check_state(struct gpio_keys_button_data *bdata)
 {
 	int state = gpio_button_get_value(bdata);
 
@@ -286,7 +305,7 @@ static void gpio_keys_polled_check_state(struct gpio_keys_button_data *bdata)
 
 		if (bdata->count < bdata->threshold) {
 			bdata->count++;
-			return;
+			return 0;
 		}
 
 		if ((bdata->last_state != -1) || (type == EV_SW))
@@ -296,12 +315,12 @@ static void gpio_keys_polled_check_state(struct gpio_keys_button_data *bdata)
 	}
 
 	bdata->count = 0;
+	return 1;
 }
 
 static void gpio_keys_polled_queue_work(struct gpio_keys_button_dev *bdev)
 {
-	struct gpio_keys_platform_data *pdata = bdev->pdata;
-	unsigned long delay = msecs_to_jiffies(pdata->poll_interval);
+	unsigned long delay = msecs_to_jiffies(bdev->interval);
 
 	if (delay >= HZ)
 		delay = round_jiffies_relative(delay);
@@ -312,34 +331,88 @@ static void gpio_keys_polled_poll(struct work_struct *work)
 {
 	struct gpio_keys_button_dev *bdev =
 		container_of(work, struct gpio_keys_button_dev, work.work);
+	int busy = 0;
 	int i;
 
 	for (i = 0; i < bdev->pdata->nbuttons; i++) {
 		struct gpio_keys_button_data *bdata = &bdev->data[i];
-		gpio_keys_polled_check_state(bdata);
+
+		if (bdata->irq > 0) {
+			/* cleared before the read, a later edge queues us again */
+			if (!atomic_xchg(&bdata->pending, 0))
+				continue;
+
+			if (!gpio_keys_polled_check_state(bdata)) {
+				atomic_set(&bdata->pending, 1);
+				busy = 1;
+			}
+		} else if (bdev->polled) {
+			gpio_keys_polled_check_state(bdata);
+			busy = 1;
+		}
 	}
-	gpio_keys_polled_queue_work(bdev);
+
+	if (busy)
+		gpio_keys_polled_queue_work(bdev);
 }
 
-static void gpio_keys_polled_close(struct gpio_keys_button_dev *bdev)
+static void gpio_keys_close(struct gpio_keys_button_dev *bdev)
 {
 	struct gpio_keys_platform_data *pdata = bdev->pdata;
+	int i;
+
+	/* no edge may queue the work once it is cancelled */
+	for (i = 0; i < pdata->nbuttons; i++)
+		if (bdev->data[i].irq > 0)
+			devm_free_irq(bdev->dev, bdev->data[i].irq, &bdev->data[i]);
 
 	cancel_delayed_work_sync(&bdev->work);
 
-	if (pdata->disable)
+	if (bdev->polled && pdata->disable)
 		pdata->disable(bdev->dev);
 }
 
+/*
+ * Only opens the debounce window, the gpio is read from the work. This
+ * works for gpios that can sleep as well, and for irq chips that only
+ * support nested threaded handlers (see gpio_keys_request_irq).
+ */
 static irqreturn_t button_handle_irq(int irq, void *_bdata)
 {
 	struct gpio_keys_button_data *bdata = (struct gpio_keys_button_data *) _bdata;
 
-	button_hotplug_event(bdata, bdata->b->type ?: EV_KEY, gpio_button_get_value(bdata));
+	atomic_set(&bdata->pending, 1);
+	gpio_keys_polled_queue_work(bdata->bdev);
 
 	return IRQ_HANDLED;
 }
 
+static int gpio_keys_request_irq(struct gpio_keys_button_dev *bdev,
+				 struct gpio_keys_button_data *bdata)
+{
+	struct gpio_keys_button *button = bdata->b;
+	int irq = button->irq;
+	int ret;
+
+	if (!irq)
+		irq = gpio_to_irq(button->gpio);
+	if (irq <= 0)
+		return irq ? irq : -EINVAL;
+
+	ret = devm_request_any_context_irq(bdev->dev, irq, button_handle_irq,
+				IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+				dev_name(bdev->dev), bdata);
+	if (ret < 0)
+		return ret;
+
+	bdata->irq = irq;
+
+	/* have the work pick up the initial state */
+	atomic_set(&bdata->pending, 1);
+
+	return 0;
+}
+
 #ifdef CONFIG_OF
 static struct gpio_keys_platform_data *
 gpio_keys_get_devtree_pdata(struct device *dev)
@@ -480,6 +553,24 @@ static int gpio_keys_button_probe(struct platform_device *pdev,
 	}
 
 	bdev->polled = polled;
+	INIT_DELAYED_WORK(&bdev->work, gpio_keys_polled_poll);
+
+	/*
+	 * gpio-keys has no poll interval, the shortest debounce interval is
+	 * the step of the shared work there
+	 */
+	if (polled) {
+		bdev->interval = pdata->poll_interval;
+	} else {
+		for (i = 0; i < pdata->nbuttons; i++) {
+			unsigned int d = pdata->buttons[i].debounce_interval;
+
+			if (d && (!bdev->interval || d < bdev->interval))
+				bdev->interval = d;
+		}
+		if (!bdev->interval)
+			bdev->interval = GPIO_KEYS_DEBOUNCE;
+	}
 
 	for (i = 0; i < pdata->nbuttons; i++) {
 		struct gpio_keys_button *button = &buttons[i];
@@ -509,13 +600,9 @@ static int gpio_keys_button_probe(struct platform_device *pdev,
 
 		bdata->can_sleep = gpio_cansleep(gpio);
 		bdata->last_state = -1;
-
-		if (bdev->polled)
-			bdata->threshold = DIV_ROUND_UP(button->debounce_interval,
-						pdata->poll_interval);
-		else
-			bdata->threshold = 1;
-
+		bdata->threshold = DIV_ROUND_UP(button->debounce_interval,
+						bdev->interval);
+		bdata->bdev = bdev;
 		bdata->b = &pdata->buttons[i];
 	}
 
@@ -545,28 +632,16 @@ static int gpio_keys_probe(struct platform_device *pdev)
 		struct gpio_keys_button *button = &pdata->buttons[i];
 		struct gpio_keys_button_data *bdata = &bdev->data[i];
 
-		if (bdata->can_sleep) {
-			dev_err(&pdev->dev, "skipping gpio:%d, it can sleep\n", button->gpio);
-			continue;
-		}
-		if (!button->irq)
-			button->irq = gpio_to_irq(button->gpio);
-		if (button->irq < 0) {
-			dev_err(&pdev->dev, "failed to get irq for gpio:%d\n", button->gpio);
-			continue;
-		}
-		ret = devm_request_irq(&pdev->dev, button->irq, button_handle_irq,
-					IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
-					dev_name(&pdev->dev), bdata);
+		ret = gpio_keys_request_irq(bdev, bdata);
 		if (ret)
-			dev_err(&pdev->dev, "failed to request irq:%d for gpio:%d\n", button->irq, button->gpio);
+			dev_err(&pdev->dev, "failed to request irq for gpio:%d, err=%d\n", button->gpio, ret);
 		else
-			dev_dbg(&pdev->dev, "gpio:%d has irq:%d\n", button->gpio, button->irq);
-
-		if (bdata->b->type == EV_SW)
-			button_hotplug_event(bdata, EV_SW, gpio_button_get_value(bdata));
+			dev_dbg(&pdev->dev, "gpio:%d has irq:%d\n", button->gpio, bdata->irq);
 	}
 
+	/* initial state, reported for switches */
+	schedule_delayed_work(&bdev->work, 0);
+
 	return 0;
 }
 
@@ -582,17 +657,21 @@ static int gpio_keys_polled_probe(struct platform_device *pdev)
 	if (ret)
 		return ret;
 
-	INIT_DELAYED_WORK(&bdev->work, gpio_keys_polled_poll);
-
 	pdata = bdev->pdata;
 
 	if (pdata->enable)
 		pdata->enable(bdev->dev);
 
-	for (i = 0; i < pdata->nbuttons; i++)
-		gpio_keys_polled_check_state(&bdev->data[i]);
+	/* buttons left without an irq are polled */
+	for (i = 0; use_irq && i < pdata->nbuttons; i++) {
+		struct gpio_keys_button_data *bdata = &bdev->data[i];
+
+		if (!gpio_keys_request_irq(bdev, bdata))
+			dev_dbg(&pdev->dev, "gpio:%d has irq:%d\n",
+				bdata->b->gpio, bdata->irq);
+	}
 
-	gpio_keys_polled_queue_work(bdev);
+	schedule_delayed_work(&bdev->work, 0);
 
 	return ret;
 }
@@ -603,8 +682,7 @@ static int gpio_keys_remove(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, NULL);
 
-	if (bdev->polled)
-		gpio_keys_polled_close(bdev);
+	gpio_keys_close(bdev);
 
 	return 0;
 }
@@ -191,6 +191,11 @@ ugly_hack_sleep_on_timeout(wait_queue_head_t *q, long timeout)
 
 #define CMV_TIMEOUT		1000	//jiffies
 
+// CMV read cache, see DSL_FIO_BSP_CMV_BATCH
+#define CMV_CACHE_SIZE		32
+#define CMV_BATCH_MAX		64
+#define CMV_DATA_LENGTH		(MSG_LENGTH - 4)	// x16 bits
+
 //  Block size per BAR
 #define SDRAM_SEGMENT_SIZE	(64*1024)
 // Number of Bar registers
@@ -431,6 +436,15 @@ typedef struct smmu_mem_info {
 } smmu_mem_info_t;
 
 #ifdef __KERNEL__
+typedef struct cmv_cache_entry {
+	u8 group;
+	u16 address;
+	u16 index;
+	u16 size;
+	unsigned long stamp;	// jiffies of the mailbox read, 0 if unused
+	u16 data[CMV_DATA_LENGTH];
+} cmv_cache_entry_t;
+
 typedef struct ifx_mei_device_private {
 	int modem_ready;
 	int arcmsgav;
@@ -452,6 +466,8 @@ typedef struct ifx_mei_device_private {
 	wait_queue_head_t wait_queue_arcmsgav;
 	wait_queue_head_t wait_queue_modemready;
 	struct semaphore mei_cmv_sema;
+	spinlock_t cmv_cache_lock;
+	cmv_cache_entry_t cmv_cache[CMV_CACHE_SIZE];
 } ifx_mei_device_private_t;
 #endif
 typedef struct winhost_message {
@@ -486,6 +502,7 @@ typedef struct winhost_message {
 #define DSL_FIO_BSP_DEBUG_READ		_IOWR(DSL_IOC_MEI_BSP_MAGIC, 17, DSL_DEV_MeiDebug_t)
 #define DSL_FIO_BSP_DEBUG_WRITE		_IOWR(DSL_IOC_MEI_BSP_MAGIC, 18, DSL_DEV_MeiDebug_t)
 #define DSL_FIO_BSP_GET_CHIP_INFO	_IOR (DSL_IOC_MEI_BSP_MAGIC, 19, DSL_DEV_HwVersion_t)
+#define DSL_FIO_BSP_CMV_BATCH		_IOWR(DSL_IOC_MEI_BSP_MAGIC, 20, DSL_DEV_CmvBatch_t)
 
 #define DSL_DEV_MEIDEBUG_BUFFER_SIZES	512
 
@@ -510,6 +527,36 @@ typedef struct struct_meireg
 	unsigned long iData;
 } DSL_DEV_MeiReg_t;					/* meireg */
 
+/**
+ *    One CMV read of a DSL_FIO_BSP_CMV_BATCH request. */
+typedef struct DSL_DEV_CmvQuery
+{
+	/*
+	*       CMV group, address, index and number of 16 bit words to read,
+	*             at most CMV_DATA_LENGTH */
+	DSL_uint8_t group;
+	DSL_uint16_t address;
+	DSL_uint16_t index;
+	DSL_uint16_t size;
+	/*
+	*       Returns DSL_DEV_MEI_ERR_SUCCESS or the error of the mailbox read */
+	DSL_int32_t status;
+	/*
+	*       Returns the age of the data in ms, 0 if it was read just now */
+	DSL_uint32_t age;
+	DSL_uint16_t data[CMV_DATA_LENGTH];
+} DSL_DEV_CmvQuery_t;
+
+/**
+ *    Reads a set of CMVs with one ioctl. Values read from the mailbox less
+ *    than maxAge ms ago are answered from a cache instead. */
+typedef struct DSL_DEV_CmvBatch
+{
+	DSL_uint32_t maxAge;
+	DSL_uint32_t count;
+	DSL_DEV_CmvQuery_t *queries;
+} DSL_DEV_CmvBatch_t;
+
 typedef struct DSL_DEV_Device
 {
 	DSL_int_t nInUse;                /* modem state, update by bsp driver, */
@@ -296,6 +296,7 @@ IFX_MEI_DMAWrite (DSL_DEV_Device_t * pDev, u32 destaddr,
 			u32 * databuff, u32 databuffsize)
 {
 	u32 *p = databuff;
+	u32 data = pDev->base_address + ME_DX_DATA;
 	u32 temp;
 
 	if (destaddr & 3)
@@ -305,13 +306,25 @@ IFX_MEI_DMAWrite (DSL_DEV_Device_t * pDev, u32 destaddr,
 	IFX_MEI_LongWordWriteOffset (pDev, ME_DX_AD, destaddr);
 
 	//      Write the data pushed across DMA
-	while (databuffsize--) {
-		temp = *p;
-		if (destaddr == MEI_TO_ARC_MAILBOX)
+	//      The address auto-increments, so the words are streamed into the
+	//      data port back to back with one barrier at the end
+	if (destaddr == MEI_TO_ARC_MAILBOX) {
+		while (databuffsize--) {
+			temp = *p++;
 			MEI_HALF_WORD_SWAP (temp);
-		IFX_MEI_LongWordWriteOffset (pDev, (u32) ME_DX_DATA, temp);
-		p++;
+			IFX_MEI_WRITE_REGISTER_L (temp, data);
+		}
+	} else {
+		for (; databuffsize >= 4; databuffsize -= 4, p += 4) {
+			IFX_MEI_WRITE_REGISTER_L (p[0], data);
+			IFX_MEI_WRITE_REGISTER_L (p[1], data);
+			IFX_MEI_WRITE_REGISTER_L (p[2], data);
+			IFX_MEI_WRITE_REGISTER_L (p[3], data);
+		}
+		while (databuffsize--)
+			IFX_MEI_WRITE_REGISTER_L (*p++, data);
 	}
+	wmb();
 
 	return DSL_DEV_MEI_ERR_SUCCESS;
 
@@ -333,6 +346,8 @@ IFX_MEI_DMARead (DSL_DEV_Device_t * pDev, u32 srcaddr, u32 * databuff,
 		       u32 databuffsize)
 {
 	u32 *p = databuff;
+	u32 data = pDev->base_address + ME_DX_DATA;
+	int swap = databuff == (u32 *) DSL_DEV_PRIVATE(pDev)->CMV_RxMsg;
 	u32 temp;
 
 	if (srcaddr & 3)
@@ -343,12 +358,12 @@ IFX_MEI_DMARead (DSL_DEV_Device_t * pDev, u32 srcaddr, u32 * databuff,
 
 	//      Read the data popped across DMA
 	while (databuffsize--) {
-		IFX_MEI_LongWordReadOffset (pDev, (u32) ME_DX_DATA, &temp);
-		if (databuff == (u32 *) DSL_DEV_PRIVATE(pDev)->CMV_RxMsg)	// swap half word
+		temp = IFX_MEI_READ_REGISTER_L (data);
+		if (swap)	// swap half word
 			MEI_HALF_WORD_SWAP (temp);
-		*p = temp;
-		p++;
+		*p++ = temp;
 	}
+	rmb();
 
 	return DSL_DEV_MEI_ERR_SUCCESS;
 
@@ -1273,6 +1288,94 @@ DSL_BSP_SendCMV (DSL_DEV_Device_t * pDev, u16 * request, int reply, u16 * respon
 	return DSL_DEV_MEI_ERR_SUCCESS;
 }
 
+/**
+ * Drop all cached CMV reads
+ * This function is called whenever the modem state or its CMVs may change.
+ *
+ * \param 	pDev		the device pointer
+ * \ingroup	Internal
+ */
+static void
+IFX_MEI_CmvCacheFlush (DSL_DEV_Device_t * pDev)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave (&DSL_DEV_PRIVATE(pDev)->cmv_cache_lock, flags);
+	memset (DSL_DEV_PRIVATE(pDev)->cmv_cache, 0,
+		sizeof (DSL_DEV_PRIVATE(pDev)->cmv_cache));
+	spin_unlock_irqrestore (&DSL_DEV_PRIVATE(pDev)->cmv_cache_lock, flags);
+}
+
+/**
+ * Read one CMV, from the cache if it is recent enough
+ * This function answers a query from the cache if the cached value is at most
+ * max_age jiffies old, and reads it from the mailbox and caches it otherwise.
+ *
+ * \param 	pDev		the device pointer
+ * \param	q		The query, status, age and data are filled in
+ * \param	max_age		Maximum age of a cached value in jiffies
+ * \ingroup	Internal
+ */
+static void
+IFX_MEI_CmvQuery (DSL_DEV_Device_t * pDev, DSL_DEV_CmvQuery_t * q,
+		  unsigned long max_age)
+{
+	ifx_mei_device_private_t *priv = DSL_DEV_PRIVATE(pDev);
+	cmv_cache_entry_t *e, *slot = NULL;
+	DSL_DEV_WinHost_Message_t m;
+	unsigned long flags, now;
+	int i;
+
+	if (q->size == 0 || q->size > CMV_DATA_LENGTH) {
+		q->status = DSL_DEV_MEI_ERR_FAILURE;
+		return;
+	}
+
+	spin_lock_irqsave (&priv->cmv_cache_lock, flags);
+	now = jiffies;
+	for (i = 0; i < CMV_CACHE_SIZE; i++) {
+		e = &priv->cmv_cache[i];
+		if (e->stamp && e->group == q->group && e->address == q->address &&
+		    e->index == q->index && e->size >= q->size) {
+			if (time_before_eq (now, e->stamp + max_age)) {
+				memcpy (q->data, e->data, q->size * 2);
+				q->age = jiffies_to_msecs (now - e->stamp);
+				q->status = DSL_DEV_MEI_ERR_SUCCESS;
+				spin_unlock_irqrestore (&priv->cmv_cache_lock, flags);
+				return;
+			}
+			slot = e;
+		}
+	}
+	spin_unlock_irqrestore (&priv->cmv_cache_lock, flags);
+
+	makeCMV (H2D_CMV_READ, q->group, q->address, q->index, q->size, NULL, m.msg.TxMessage);
+	q->status = DSL_BSP_SendCMV (pDev, m.msg.TxMessage, YES_REPLY, m.msg.RxMessage);
+	if (q->status != DSL_DEV_MEI_ERR_SUCCESS)
+		return;
+
+	memcpy (q->data, &m.msg.RxMessage[4], q->size * 2);
+	q->age = 0;
+
+	spin_lock_irqsave (&priv->cmv_cache_lock, flags);
+	if (!slot) {
+		// an unused entry, or else the oldest one
+		slot = &priv->cmv_cache[0];
+		for (i = 0; i < CMV_CACHE_SIZE && slot->stamp; i++) {
+			e = &priv->cmv_cache[i];
+			if (!e->stamp || time_before (e->stamp, slot->stamp))
+				slot = e;
+		}
+	}
+	slot->group = q->group;
+	slot->address = q->address;
+	slot->index = q->index;
+	slot->size = q->size;
+	slot->stamp = jiffies ? : 1;
+	memcpy (slot->data, q->data, q->size * 2);
+	spin_unlock_irqrestore (&priv->cmv_cache_lock, flags);
+}
+
 /**
  * Reset the ARC, download boot codes, and run the ARC.
  * This function resets the ARC, downloads boot codes to ARC, and runs the ARC.
@@ -2322,6 +2425,7 @@ IFX_MEI_InitDevice (int num)
 	MEI_INIT_WAKELIST ("arcr", DSL_DEV_PRIVATE(pDev)->wait_queue_modemready);	// for arc modem ready
 
 	MEI_MUTEX_INIT (DSL_DEV_PRIVATE(pDev)->mei_cmv_sema, 1);	// semaphore initialization, mutex
+	spin_lock_init (&DSL_DEV_PRIVATE(pDev)->cmv_cache_lock);
 #if 0
 	MEI_MASK_AND_ACK_IRQ (pDev->nIrq[IFX_DFEIR]);
 	MEI_MASK_AND_ACK_IRQ (pDev->nIrq[IFX_DYING_GASP]);
@@ -2451,7 +2555,7 @@ IFX_MEI_IoctlCopyFrom (int from_kernel, char *dest, char *from, int size)
 	if (!from_kernel)
 		ret = copy_from_user ((char *) dest, (char *) from, size);
 	else
-		ret = (int)memcpy ((char *) dest, (char *) from, size);
+		memcpy ((char *) dest, (char *) from, size);
 	return ret;
 }
 
@@ -2463,7 +2567,7 @@ IFX_MEI_IoctlCopyTo (int from_kernel, char *dest, char *from, int size)
 	if (!from_kernel)
 		ret = copy_to_user ((char *) dest, (char *) from, size);
 	else
-		ret = (int)memcpy ((char *) dest, (char *) from, size);
+		memcpy ((char *) dest, (char *) from, size);
 	return ret;
 }
 
@@ -2474,6 +2578,8 @@ IFX_MEI_Ioctls (DSL_DEV_Device_t * pDev, int from_kernel, unsigned int command,
 	int meierr = DSL_DEV_MEI_ERR_SUCCESS;
 	u32 base_address = LTQ_MEI_BASE_ADDR;
 	DSL_DEV_WinHost_Message_t winhost_msg, m;
+	DSL_DEV_CmvBatch_t batch;
+	DSL_DEV_CmvQuery_t query;
 //	DSL_DEV_MeiDebug_t debugrdwr;
 	DSL_DEV_MeiReg_t regrdwr;
 
@@ -2483,6 +2589,10 @@ IFX_MEI_Ioctls (DSL_DEV_Device_t * pDev, int from_kernel, unsigned int command,
 		IFX_MEI_IoctlCopyFrom (from_kernel, (char *) winhost_msg.msg.TxMessage,
 					     (char *) lon, MSG_LENGTH * 2);
 
+		// anything but a read may change what the cache holds
+		if ((winhost_msg.msg.TxMessage[0] >> 4) != H2D_CMV_READ)
+			IFX_MEI_CmvCacheFlush (pDev);
+
 		if ((meierr = DSL_BSP_SendCMV (pDev, winhost_msg.msg.TxMessage, YES_REPLY,
 					   winhost_msg.msg.RxMessage)) != DSL_DEV_MEI_ERR_SUCCESS) {
 			IFX_MEI_EMSG ("WINHOST CMV fail :TxMessage:%X %X %X %X, RxMessage:%X %X %X %X %X\n",
@@ -2498,6 +2608,28 @@ IFX_MEI_Ioctls (DSL_DEV_Device_t * pDev, int from_kernel, unsigned int command,
 		}
 		break;
 
+	case DSL_FIO_BSP_CMV_BATCH:
+		if (IFX_MEI_IoctlCopyFrom (from_kernel, (char *) (&batch),
+					   (char *) lon, sizeof (batch)))
+			return -EFAULT;
+		if (batch.count > CMV_BATCH_MAX)
+			return -EINVAL;
+
+		for (i = 0; i < batch.count; i++) {
+			if (IFX_MEI_IoctlCopyFrom (from_kernel, (char *) (&query),
+						   (char *) (&batch.queries[i]),
+						   sizeof (query)))
+				return -EFAULT;
+
+			IFX_MEI_CmvQuery (pDev, &query, msecs_to_jiffies (batch.maxAge));
+
+			if (IFX_MEI_IoctlCopyTo (from_kernel, (char *) (&batch.queries[i]),
+						 (char *) (&query), sizeof (query)))
+				return -EFAULT;
+		}
+		meierr = DSL_DEV_MEI_ERR_SUCCESS;
+		break;
+
 	case DSL_FIO_BSP_CMV_READ:
 		IFX_MEI_IoctlCopyFrom (from_kernel, (char *) (&regrdwr),
 					     (char *) lon, sizeof (DSL_DEV_MeiReg_t));
@@ -2533,6 +2665,7 @@ IFX_MEI_Ioctls (DSL_DEV_Device_t * pDev, int from_kernel, unsigned int command,
 		break;
 	case DSL_FIO_BSP_RESET:
 	case DSL_FIO_BSP_REBOOT:
+		IFX_MEI_CmvCacheFlush (pDev);
 		meierr = IFX_MEI_CpuModeSet (pDev, DSL_CPU_RESET);
 		meierr = IFX_MEI_CpuModeSet (pDev, DSL_CPU_HALT);
 		break;
@@ -2560,6 +2693,7 @@ IFX_MEI_Ioctls (DSL_DEV_Device_t * pDev, int from_kernel, unsigned int command,
 
 	case DSL_FIO_BSP_DSL_START:
 		IFX_MEI_DMSG("DSL_FIO_BSP_DSL_START\n");
+		IFX_MEI_CmvCacheFlush (pDev);
 		if ((meierr = IFX_MEI_RunAdslModem (pDev)) != DSL_DEV_MEI_ERR_SUCCESS) {
 			IFX_MEI_EMSG ("IFX_MEI_RunAdslModem() error...");
 			meierr = DSL_DEV_MEI_ERR_FAILURE;
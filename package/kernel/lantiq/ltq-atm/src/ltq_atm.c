@@ -39,6 +39,7 @@
 #include <linux/atm.h>
 #include <linux/clk.h>
 #include <linux/interrupt.h>
+#include <linux/netdevice.h>
 #ifdef CONFIG_XFRM
   #include <net/xfrm.h>
 #endif
@@ -105,6 +106,7 @@ static int dma_tx_descriptor_length = 64;       /*  Number of descriptors per DM
   \brief PPE core clock cycles between descriptor write and effectiveness in external RAM
  */
 static int dma_rx_clp1_descriptor_threshold = 38;
+static int rx_napi_weight = NAPI_POLL_WEIGHT;    /*  AAL5 frames handled per NAPI poll               */
 /*@}*/
 
 MODULE_PARM(qsb_tau, "i");
@@ -136,6 +138,8 @@ MODULE_PARM(dma_tx_descriptor_length, "i");
 MODULE_PARM_DESC(dma_tx_descriptor_length, "Number of descriptor assigned to DMA TX channel (>16)");
 MODULE_PARM(dma_rx_clp1_descriptor_threshold, "i");
 MODULE_PARM_DESC(dma_rx_clp1_descriptor_threshold, "Descriptor threshold for cells with cell loss priority 1");
+MODULE_PARM(rx_napi_weight, "i");
+MODULE_PARM_DESC(rx_napi_weight, "Number of AAL5 frames received per NAPI poll");
 
 
 
@@ -196,11 +200,10 @@ static struct sk_buff* skb_break_away_from_protocol(struct sk_buff *);
  *  mailbox handler and signal function
  */
 static inline void mailbox_oam_rx_handler(void);
-static inline void mailbox_aal_rx_handler(void);
+static inline int mailbox_aal_rx_handler(int);
 static irqreturn_t mailbox_irq_handler(int, void *);
 static inline void mailbox_signal(unsigned int, int);
-static void do_ppe_tasklet(unsigned long);
-DECLARE_TASKLET(g_dma_tasklet, do_ppe_tasklet, 0);
+static int ppe_napi_poll(struct napi_struct *, int);
 
 /*
  *  QSB & HTU setting functions
@@ -265,6 +268,10 @@ static struct sk_buff* (*ifx_atm_alloc_tx)(struct atm_vcc *, unsigned int) = NUL
 
 static struct atm_priv_data g_atm_priv_data;
 
+/*  ATM devices are no net_device, NAPI runs on a dummy one */
+static struct net_device g_napi_dev;
+static struct napi_struct g_napi;
+
 static struct atmdev_ops g_ifx_atm_ops = {
 	.open = ppe_open,
 	.close = ppe_close,
@@ -494,7 +501,7 @@ static void ppe_close(struct atm_vcc *vcc)
 	}
 
 	/* wait for incoming packets to be processed by upper layers */
-	tasklet_unlock_wait(&g_dma_tasklet);
+	napi_synchronize(&g_napi);
 
 PPE_CLOSE_EXIT:
 	return;
@@ -531,19 +538,24 @@ static int ppe_send(struct atm_vcc *vcc, struct sk_buff *skb)
 		int datalen;
 		struct tx_inband_header *header;
 
-		byteoff = (unsigned int)skb->data & (DATA_BUFFER_ALIGNMENT - 1);
-		if ( skb_headroom(skb) < byteoff + TX_INBAND_HEADER_LENGTH )
-			new_skb = skb_duplicate(skb);
-		else
-			new_skb = skb_break_away_from_protocol(skb);
+		new_skb = skb_break_away_from_protocol(skb);
 		if ( new_skb == NULL ) {
-			pr_err("either skb_duplicate or skb_break_away_from_protocol fail\n");
+			pr_err("skb_break_away_from_protocol fail\n");
 			ret = -ENOMEM;
 			goto PPE_SEND_FAIL;
 		}
 		dev_kfree_skb_any(skb);
 		skb = new_skb;
 
+		/*  short of headroom, only grow the head instead of copying into a new sk_buff */
+		byteoff = (unsigned int)skb->data & (DATA_BUFFER_ALIGNMENT - 1);
+		if ( skb_headroom(skb) < byteoff + TX_INBAND_HEADER_LENGTH
+		  && skb_cow_head(skb, DATA_BUFFER_ALIGNMENT + TX_INBAND_HEADER_LENGTH) ) {
+			pr_err("skb_cow_head fail\n");
+			ret = -ENOMEM;
+			goto PPE_SEND_FAIL;
+		}
+
 		datalen = skb->len;
 		byteoff = (unsigned int)skb->data & (DATA_BUFFER_ALIGNMENT - 1);
 
@@ -950,7 +962,7 @@ static inline void mailbox_oam_rx_handler(void)
 	}
 }
 
-static inline void mailbox_aal_rx_handler(void)
+static inline int mailbox_aal_rx_handler(int budget)
 {
 	unsigned int vlddes = WRX_DMA_CHANNEL_CONFIG(RX_DMA_CH_AAL)->vlddes;
 	struct rx_descriptor reg_desc;
@@ -960,6 +972,9 @@ static inline void mailbox_aal_rx_handler(void)
 	struct rx_inband_trailer *trailer;
 	unsigned int i;
 
+	if ( vlddes > (unsigned int)budget )
+		vlddes = budget;
+
 	for ( i = 0; i < vlddes; i++ ) {
 		unsigned int loop_count = 0;
 
@@ -1040,18 +1055,25 @@ static inline void mailbox_aal_rx_handler(void)
 
 		mailbox_signal(RX_DMA_CH_AAL, 0);
 	}
+
+	return vlddes;
 }
 
-static void do_ppe_tasklet(unsigned long data)
+static int ppe_napi_poll(struct napi_struct *napi, int budget)
 {
+	int work_done;
+
 	*MBOX_IGU1_ISRC = *MBOX_IGU1_ISR;
 	mailbox_oam_rx_handler();
-	mailbox_aal_rx_handler();
+	work_done = mailbox_aal_rx_handler(budget);
 
-	if ((*MBOX_IGU1_ISR & ((1 << RX_DMA_CH_AAL) | (1 << RX_DMA_CH_OAM))) != 0)
-		tasklet_schedule(&g_dma_tasklet);
-	else
+	/*  descriptors left over keep us in polling mode   */
+	if ( work_done < budget ) {
+		napi_complete(napi);
 		enable_irq(PPE_MAILBOX_IGU1_INT);
+	}
+
+	return work_done;
 }
 
 static irqreturn_t mailbox_irq_handler(int irq, void *dev_id)
@@ -1060,7 +1082,7 @@ static irqreturn_t mailbox_irq_handler(int irq, void *dev_id)
 		return IRQ_HANDLED;
 
 	disable_irq_nosync(PPE_MAILBOX_IGU1_INT);
-	tasklet_schedule(&g_dma_tasklet);
+	napi_schedule(&g_napi);
 
 	return IRQ_HANDLED;
 }
@@ -1410,6 +1432,9 @@ static inline void check_parameters(void)
 
 	if ( dma_tx_descriptor_length < 2 )
 		dma_tx_descriptor_length = 2;
+
+	if ( rx_napi_weight < 1 )
+		rx_napi_weight = NAPI_POLL_WEIGHT;
 }
 
 static inline int init_priv_data(void)
@@ -1817,6 +1842,10 @@ static int ltq_atm_probe(struct platform_device *pdev)
 		}
 	}
 
+	init_dummy_netdev(&g_napi_dev);
+	netif_napi_add(&g_napi_dev, &g_napi, ppe_napi_poll, rx_napi_weight);
+	napi_enable(&g_napi);
+
 	/*  register interrupt handler  */
 	ret = request_irq(PPE_MAILBOX_IGU1_INT, mailbox_irq_handler, IRQF_DISABLED, "atm_mailbox_isr", &g_atm_priv_data);
 	if ( ret ) {
@@ -1863,6 +1892,8 @@ static int ltq_atm_probe(struct platform_device *pdev)
 PP32_START_FAIL:
 	free_irq(PPE_MAILBOX_IGU1_INT, &g_atm_priv_data);
 REQUEST_IRQ_PPE_MAILBOX_IGU1_INT_FAIL:
+	napi_disable(&g_napi);
+	netif_napi_del(&g_napi);
 ATM_DEV_REGISTER_FAIL:
 	while ( port_num-- > 0 )
 		atm_dev_deregister(g_atm_priv_data.port[port_num].dev);
@@ -1885,6 +1916,8 @@ static int ltq_atm_remove(struct platform_device *pdev)
 	ops->stop(0);
 
 	free_irq(PPE_MAILBOX_IGU1_INT, &g_atm_priv_data);
+	napi_disable(&g_napi);
+	netif_napi_del(&g_napi);
 
 	for ( port_num = 0; port_num < ATM_PORT_NUMBER; port_num++ )
 		atm_dev_deregister(g_atm_priv_data.port[port_num].dev);
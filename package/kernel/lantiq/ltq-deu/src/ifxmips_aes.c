@@ -119,6 +119,24 @@ struct aes_ctx {
 extern int disable_deudma;
 extern int disable_multiblock; 
 
+/* context whose key currently sits in K0R..K7R, protected by aes_lock */
+static struct aes_ctx *aes_loaded_ctx;
+
+/*! \fn static void aes_forget_key (struct aes_ctx *ctx)
+ *  \ingroup IFX_AES_FUNCTIONS
+ *  \brief forces a key reload on the next request of this context
+ *  \param ctx crypto algo context
+*/
+static void aes_forget_key (struct aes_ctx *ctx)
+{
+    unsigned long flag;
+
+    CRTCL_SECT_START;
+    if (aes_loaded_ctx == ctx)
+        aes_loaded_ctx = NULL;
+    CRTCL_SECT_END;
+}
+
 /*! \fn int aes_set_key (struct crypto_tfm *tfm, const uint8_t *in_key, unsigned int key_len)
  *  \ingroup IFX_AES_FUNCTIONS 
  *  \brief sets the AES keys    
@@ -141,6 +159,7 @@ int aes_set_key (struct crypto_tfm *tfm, const u8 *in_key, unsigned int key_len)
         return -EINVAL;
     }
 
+    aes_forget_key(ctx);
     ctx->key_length = key_len;
     DPRINTF(0, "ctx @%p, key_len %d, ctx->key_length %d\n", ctx, key_len, ctx->key_length);
     memcpy ((u8 *) (ctx->buf), in_key, key_len);
@@ -178,6 +197,12 @@ void ifx_deu_aes (void *ctx_arg, u8 *out_arg, const u8 *in_arg,
 
 
     CRTCL_SECT_START;
+    /* the key registers survive between requests, so only reload
+       them (and redo the decryption key pre-processing) when another
+       context has used the engine in the meantime */
+    if (aes_loaded_ctx == ctx)
+        goto key_loaded;
+
     /* 128, 192 or 256 bit key length */
     aes->controlr.K = key_len / 8 - 2;
         if (key_len == 128 / 8) {
@@ -214,7 +239,9 @@ void ifx_deu_aes (void *ctx_arg, u8 *out_arg, const u8 *in_arg,
        ENcryption is used). Key Valid (KV) bit is then only
        checked in decryption routine! */
     aes->controlr.PNK = 1;
+    aes_loaded_ctx = ctx;
 
+key_loaded:
 
     aes->controlr.E_D = !encdec;    //encryption
     aes->controlr.O = mode; //0 ECB 1 CBC 2 OFB 3 CFB 4 CTR 
@@ -288,6 +315,7 @@ int ctr_rfc3686_aes_set_key (struct crypto_tfm *tfm, const uint8_t *in_key, unsi
         return -EINVAL;
     }
 
+    aes_forget_key(ctx);
     ctx->key_length = key_len;
     
     memcpy ((u8 *) (ctx->buf), in_key, key_len);
@@ -115,6 +115,24 @@ struct des_ctx {
 extern int disable_multiblock;
 extern int disable_deudma;
 
+/* context whose key currently sits in K1HR..K3LR, protected by des_lock */
+static struct des_ctx *des_loaded_ctx;
+
+/*! \fn static void des_forget_key (struct des_ctx *dctx)
+ *  \ingroup IFX_DES_FUNCTIONS
+ *  \brief forces a key reload on the next request of this context
+ *  \param dctx crypto algo context
+*/
+static void des_forget_key (struct des_ctx *dctx)
+{
+        unsigned long flag;
+
+        CRTCL_SECT_START;
+        if (des_loaded_ctx == dctx)
+                des_loaded_ctx = NULL;
+        CRTCL_SECT_END;
+}
+
 
 /*! \fn	int des_setkey(struct crypto_tfm *tfm, const u8 *key, unsigned int keylen)
  *  \ingroup IFX_DES_FUNCTIONS
@@ -130,6 +148,7 @@ int des_setkey(struct crypto_tfm *tfm, const u8 *key,
 
         //printk("setkey in %s\n", __FILE__);
 
+        des_forget_key(dctx);
         dctx->controlr_M = 0;   // des
         dctx->key_length = keylen;
 
@@ -164,6 +183,11 @@ void ifx_deu_des (void *ctx_arg, u8 *out_arg, const u8 *in_arg,
         
         CRTCL_SECT_START;
 
+        /* keys and mode stay programmed between requests of the
+           same context */
+        if (des_loaded_ctx == dctx)
+                goto key_loaded;
+
         des->controlr.M = dctx->controlr_M;
         if (dctx->controlr_M == 0)      // des
         {
@@ -194,7 +218,9 @@ void ifx_deu_des (void *ctx_arg, u8 *out_arg, const u8 *in_arg,
                         return;
                 }
         }
+        des_loaded_ctx = dctx;
 
+key_loaded:
         des->controlr.E_D = !encdec;    //encryption
         des->controlr.O = mode; //0 ECB 1 CBC 2 OFB 3 CFB 4 CTR hexdump(prin,sizeof(*des));
 
@@ -402,6 +428,7 @@ int des3_ede_setkey(struct crypto_tfm *tfm, const u8 *key,
 
         //printk("setkey in %s\n", __FILE__);
 
+        des_forget_key(dctx);
         dctx->controlr_M = keylen / 8 + 1;      // 3DES EDE1 / EDE2 / EDE3 Mode
         dctx->key_length = keylen;
 
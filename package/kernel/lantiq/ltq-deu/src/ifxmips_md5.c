@@ -98,13 +98,16 @@ static u32 endian_swap(u32 input)
     return ((ptr[3] << 24) | (ptr[2] << 16) | (ptr[1] << 8) | ptr[0]);     
 }
 
-/*! \fn static void md5_transform(u32 *hash, u32 const *in)
+/*! \fn static void md5_transform(struct md5_ctx *mctx, u32 *hash, u32 const *in, unsigned int nblocks)
  *  \ingroup IFX_MD5_FUNCTIONS
  *  \brief main interface to md5 hardware   
+ *  \param mctx md5 context
  *  \param hash current hash value  
- *  \param in 64-byte block of input  
+ *  \param in nblocks 64-byte blocks of input  
+ *  \param nblocks number of blocks, all fed in one hardware session
 */                                 
-static void md5_transform(struct md5_ctx *mctx, u32 *hash, u32 const *in)
+static void md5_transform(struct md5_ctx *mctx, u32 *hash, u32 const *in,
+                          unsigned int nblocks)
 {
     int i;
     volatile struct deu_hash_t *hashs = (struct deu_hash_t *) HASH_START;
@@ -118,15 +121,27 @@ static void md5_transform(struct md5_ctx *mctx, u32 *hash, u32 const *in)
         hashs->D3R = endian_swap(*((u32 *) hash + 2));
         hashs->D4R = endian_swap(*((u32 *) hash + 3));
     }
+    else {
+        /* program the initial vector inside the critical section,
+           another context may have used the engine since md5_init() */
+        hashs->controlr.ENDI = 0;
+        hashs->controlr.SM = 1;
+        hashs->controlr.ALGO = 1;    // 1 = md5  0 = sha1
+        hashs->controlr.INIT = 1;    // Initialize the hash operation by writing a '1' to the INIT bit.
+    }
+
+    while (nblocks--) {
+        for (i = 0; i < 16; i++) {
+            hashs->MR = endian_swap(in[i]);
+//	    printk("in[%d]: %08x\n", i, endian_swap(in[i]));
+        };
 
-    for (i = 0; i < 16; i++) {
-        hashs->MR = endian_swap(in[i]);
-//	printk("in[%d]: %08x\n", i, endian_swap(in[i]));
-    };
+        //wait for processing
+        while (hashs->controlr.BSY) {
+            // this will not take long
+        }
 
-    //wait for processing
-    while (hashs->controlr.BSY) {
-        // this will not take long
+        in += MD5_BLOCK_WORDS;
     }
 
     *((u32 *) hash + 0) = endian_swap (hashs->D1R);
@@ -147,23 +162,17 @@ static void md5_transform(struct md5_ctx *mctx, u32 *hash, u32 const *in)
 static inline void md5_transform_helper(struct md5_ctx *ctx)
 {
     //le32_to_cpu_array(ctx->block, sizeof(ctx->block) / sizeof(u32));
-    md5_transform(ctx, ctx->hash, ctx->block);
+    md5_transform(ctx, ctx->hash, ctx->block, 1);
 }
 
 /*! \fn static void md5_init(struct crypto_tfm *tfm)
  *  \ingroup IFX_MD5_FUNCTIONS
- *  \brief initialize md5 hardware   
+ *  \brief initialize md5 context, the hardware is set up on the first block
  *  \param tfm linux crypto algo transform  
 */                                 
 static int md5_init(struct shash_desc *desc)
 {
     struct md5_ctx *mctx = shash_desc_ctx(desc);
-    volatile struct deu_hash_t *hash = (struct deu_hash_t *) HASH_START;
-
-    hash->controlr.ENDI = 0;
-    hash->controlr.SM = 1;
-    hash->controlr.ALGO = 1;    // 1 = md5  0 = sha1
-    hash->controlr.INIT = 1;    // Initialize the hash operation by writing a '1' to the INIT bit.
 
     mctx->byte_count = 0;
     mctx->started = 0;
@@ -197,6 +206,15 @@ static int md5_update(struct shash_desc *desc, const u8 *data, unsigned int len)
     data += avail;
     len -= avail;
 
+    /* word aligned input can be fed to the hardware directly */
+    if (len >= sizeof(mctx->block) && IS_ALIGNED((unsigned long)data, 4)) {
+        unsigned int nblocks = len / sizeof(mctx->block);
+
+        md5_transform(mctx, mctx->hash, (const u32 *)data, nblocks);
+        data += nblocks * sizeof(mctx->block);
+        len -= nblocks * sizeof(mctx->block);
+    }
+
     while (len >= sizeof(mctx->block)) {
         memcpy(mctx->block, data, sizeof(mctx->block));
         md5_transform_helper(mctx);
@@ -220,8 +238,6 @@ static int md5_final(struct shash_desc *desc, u8 *out)
     const unsigned int offset = mctx->byte_count & 0x3f;
     char *p = (char *)mctx->block + offset;
     int padding = 56 - (offset + 1);
-    volatile struct deu_hash_t *hashs = (struct deu_hash_t *) HASH_START;
-    unsigned long flag;
 
     *p++ = 0x80;
     if (padding < 0) {
@@ -240,16 +256,11 @@ static int md5_final(struct shash_desc *desc, u8 *out)
                       sizeof(u64)) / sizeof(u32));
 #endif
 
-    md5_transform(mctx, mctx->hash, mctx->block);                                                 
-
-    CRTCL_SECT_START;
-
-    *((u32 *) out + 0) = endian_swap (hashs->D1R);
-    *((u32 *) out + 1) = endian_swap (hashs->D2R);
-    *((u32 *) out + 2) = endian_swap (hashs->D3R);
-    *((u32 *) out + 3) = endian_swap (hashs->D4R);
+    md5_transform(mctx, mctx->hash, mctx->block, 1);
 
-    CRTCL_SECT_END;
+    /* the digest was saved by the last transform, the registers may
+       already belong to another context */
+    memcpy(out, mctx->hash, MD5_DIGEST_SIZE);
 
     // Wipe context
     memset(mctx, 0, sizeof(*mctx));
@@ -92,13 +92,16 @@ struct sha1_ctx {
 extern int disable_deudma;
 
 
-/*! \fn static void sha1_transform (u32 *state, const u32 *in)
+/*! \fn static void sha1_transform (struct sha1_ctx *sctx, u32 *state, const u32 *in, unsigned int nblocks)
  *  \ingroup IFX_SHA1_FUNCTIONS
  *  \brief main interface to sha1 hardware   
+ *  \param sctx sha1 context
  *  \param state current state 
- *  \param in 64-byte block of input  
+ *  \param in nblocks 64-byte blocks of input  
+ *  \param nblocks number of blocks, all fed in one hardware session
 */                                 
-static void sha1_transform (struct sha1_ctx *sctx, u32 *state, const u32 *in)
+static void sha1_transform (struct sha1_ctx *sctx, u32 *state, const u32 *in,
+                            unsigned int nblocks)
 {
     int i = 0;
     volatile struct deu_hash_t *hashs = (struct deu_hash_t *) HASH_START;
@@ -116,14 +119,25 @@ static void sha1_transform (struct sha1_ctx *sctx, u32 *state, const u32 *in)
         hashs->D4R = *((u32 *) sctx->hash + 3);
         hashs->D5R = *((u32 *) sctx->hash + 4);
     }
+    else {
+        /* start from the initial vector inside the same critical
+         * section, another context may have used the engine since
+         * sha1_init()
+        */
+        SHA_HASH_INIT;
+    }
+
+    while (nblocks--) {
+        for (i = 0; i < 16; i++) {
+            hashs->MR = in[i];
+        };
 
-    for (i = 0; i < 16; i++) {
-        hashs->MR = in[i];
-    };
+        //wait for processing
+        while (hashs->controlr.BSY) {
+            // this will not take long
+        }
 
-    //wait for processing
-    while (hashs->controlr.BSY) {
-        // this will not take long
+        in += 16;
     }
    
     /* For context switching purposes, the output is saved into a 
@@ -142,15 +156,13 @@ static void sha1_transform (struct sha1_ctx *sctx, u32 *state, const u32 *in)
 
 /*! \fn static void sha1_init(struct crypto_tfm *tfm)
  *  \ingroup IFX_SHA1_FUNCTIONS
- *  \brief initialize sha1 hardware   
+ *  \brief initialize sha1 context, the hardware is set up on the first block
  *  \param tfm linux crypto algo transform  
 */                                 
 static int sha1_init(struct shash_desc *desc)
 {
     struct sha1_ctx *sctx = shash_desc_ctx(desc);
     
-    SHA_HASH_INIT;
-
     sctx->started = 0;
     sctx->count = 0;
     return 0;
@@ -174,9 +186,12 @@ static int sha1_update(struct shash_desc * desc, const u8 *data,
 
     if ((j + len) > 63) {
         memcpy (&sctx->buffer[j], data, (i = 64 - j));
-        sha1_transform (sctx, sctx->state, (const u32 *)sctx->buffer);
-        for (; i + 63 < len; i += 64) {
-            sha1_transform (sctx, sctx->state, (const u32 *)&data[i]);
+        sha1_transform (sctx, sctx->state, (const u32 *)sctx->buffer, 1);
+        if (i + 63 < len) {
+            unsigned int nblocks = (len - i) / 64;
+
+            sha1_transform (sctx, sctx->state, (const u32 *)&data[i], nblocks);
+            i += nblocks * 64;
         }
 
         j = 0;
@@ -201,8 +216,6 @@ static int sha1_final(struct shash_desc *desc, u8 *out)
     u64 t;
     u8 bits[8] = { 0, };
     static const u8 padding[64] = { 0x80, };
-    volatile struct deu_hash_t *hashs = (struct deu_hash_t *) HASH_START;
-    unsigned long flag;
 
     t = sctx->count;
     bits[7] = 0xff & t;
@@ -229,15 +242,9 @@ static int sha1_final(struct shash_desc *desc, u8 *out)
     /* Append length */
     sha1_update (desc, bits, sizeof bits);
 
-    CRTCL_SECT_START;
-
-    *((u32 *) out + 0) = hashs->D1R;
-    *((u32 *) out + 1) = hashs->D2R;
-    *((u32 *) out + 2) = hashs->D3R;
-    *((u32 *) out + 3) = hashs->D4R;
-    *((u32 *) out + 4) = hashs->D5R;
-
-    CRTCL_SECT_END;
+    /* the last transform saved the digest, the registers may
+     * already belong to another context */
+    memcpy (out, sctx->hash, SHA1_DIGEST_SIZE);
 
     // Wipe context
     memset (sctx, 0, sizeof *sctx);
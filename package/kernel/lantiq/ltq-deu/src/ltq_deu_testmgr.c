@@ -3733,6 +3733,18 @@ static int do_test(int m)
 	case 399:
 		break;
 
+	/* DEU hash engine against the generic C code, to pick
+	 * cra_priority from numbers measured on the SoC */
+	case 320:
+		test_hash_speed("ifxdeu-md5", sec, generic_hash_speed_template);
+		test_hash_speed("md5-generic", sec, generic_hash_speed_template);
+		break;
+
+	case 321:
+		test_hash_speed("ifxdeu-sha1", sec, generic_hash_speed_template);
+		test_hash_speed("sha1-generic", sec, generic_hash_speed_template);
+		break;
+
         /* Modified speed test for async block cipher mode */
         case 400:
 	  	tcrypt_speedtest("ecb(aes)", NULL, 0,
@@ -3885,13 +3897,13 @@ aes_err:
          goto speed_err;
 #endif
 #if defined (CONFIG_CRYPTO_DEV_MD5)
-      mode = 302;
+      mode = 320;
       err = do_test(mode);
       if (err)
           goto speed_err;  
 #endif 
 #if defined (CONFIG_CRYPTO_DEV_SHA1)
-      mode = 303;
+      mode = 321;
       err = do_test(mode); 
       if (err)
           goto speed_err;
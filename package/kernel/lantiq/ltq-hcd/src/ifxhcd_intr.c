@@ -74,6 +74,9 @@
 
 #include "ifxhcd.h"
 
+/* Passes over HAINT in one host channel interrupt */
+#define HCINT_MAX_PASSES 4
+
 /* Macro used to clear one channel interrupt */
 #define clear_hc_int(_hc_regs_,_intr_) \
 	do { \
@@ -4231,6 +4234,22 @@ void init_hc(ifxhcd_epqh_t *_epqh)
 }
 
 
+/*!
+ \brief Tells whether a host channel is left for assign_hc(), from the software
+ state only, so that a busy schedule is not walked with register reads.
+ \param _ifxhcd The HCD state structure.
+ */
+static
+int idle_hc_left(ifxhcd_hcd_t *_ifxhcd)
+{
+	int i;
+	int num_channels = _ifxhcd->core_if.params.host_channels;
+	for(i=0;i<num_channels ; i++)
+		if(_ifxhcd->ifxhc[i].phase==HC_IDLE)
+			return 1;
+	return 0;
+}
+
 static
 void select_eps_sub(ifxhcd_hcd_t *_ifxhcd)
 {
@@ -4242,6 +4261,7 @@ void select_eps_sub(ifxhcd_hcd_t *_ifxhcd)
 
 	hfnum_data_t hfnum;
 	uint32_t fndiff;
+	int hc_left;
 
 	if(_ifxhcd->disconnecting)
 	{
@@ -4364,6 +4384,7 @@ void select_eps_sub(ifxhcd_hcd_t *_ifxhcd)
 			update_interval_counter(epqh,fndiff);
 	}
 
+	hc_left=idle_hc_left(_ifxhcd);
 	epqh_ptr       = _ifxhcd->epqh_list_np.next;
 	while (epqh_ptr != &_ifxhcd->epqh_list_np)  // may need to preserve at lease one for period
 	{
@@ -4375,6 +4396,8 @@ void select_eps_sub(ifxhcd_hcd_t *_ifxhcd)
 		#endif
 		if(epqh->pause)
 			continue;
+		if(!hc_left)
+			continue;
 		if(epqh->phase==EPQH_READY)
 		{
 			LOCK_URBD_LIST(epqh);
@@ -4398,6 +4421,7 @@ void select_eps_sub(ifxhcd_hcd_t *_ifxhcd)
 						urbd->phase=URBD_ACTIVE;
 						epqh->hc->phase=HC_WAITING;
 						ifxhcd_hc_start(_ifxhcd, epqh->hc);
+						hc_left=idle_hc_left(_ifxhcd);
 					}
 					break;
 				}
@@ -4830,12 +4854,21 @@ int32_t ifxhcd_handle_intr (ifxhcd_hcd_t *_ifxhcd)
 	}
 	if (gintsts.b.hcintr)
 	{
-		int i;
+		int i, pass;
 		haint_data_t haint;
-		haint.d32 = ifxusb_read_host_all_channels_intr(core_if);
-		for (i=0; i<MAX_EPS_CHANNELS && i< core_if->params.host_channels; i++)
-			if (haint.b2.chint & (1 << i))
-				retval |= handle_hc_n_intr (_ifxhcd, i);
+		uint32_t haintmsk;
+		/* Channels that halt while others are being handled are serviced
+		   in the same interrupt, instead of raising another one each. */
+		haintmsk = ifxusb_rreg(&core_if->host_global_regs->haintmsk);
+		for (pass=0; pass<HCINT_MAX_PASSES; pass++)
+		{
+			haint.d32 = ifxusb_read_host_all_channels_intr(core_if) & haintmsk;
+			if (!haint.b2.chint)
+				break;
+			for (i=0; i<MAX_EPS_CHANNELS && i< core_if->params.host_channels; i++)
+				if (haint.b2.chint & (1 << i))
+					retval |= handle_hc_n_intr (_ifxhcd, i);
+		}
 		gintsts.b.hcintr=0;
 		gintsts2.b.hcintr=1;
 	}
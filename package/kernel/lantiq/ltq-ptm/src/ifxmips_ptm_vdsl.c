@@ -48,6 +48,11 @@ MODULE_PARM_DESC(wanqos_en, "WAN QoS support, 1 - enabled, 0 - disabled.");
 MODULE_PARM_ARRAY(queue_gamma_map, "4-4i");
 MODULE_PARM_DESC(queue_gamma_map, "TX QoS queues mapping to 4 TX Gamma interfaces.");
 
+static int napi_weight = 16;
+
+MODULE_PARM(napi_weight, "i");
+MODULE_PARM_DESC(napi_weight, "NAPI weight, frames handled per poll (1 - 64).");
+
 extern int (*ifx_mei_atm_showtime_enter)(struct port_cell_info *, void *);
 extern int (*ifx_mei_atm_showtime_exit)(void);
 extern int ifx_mei_atm_showtime_check(int *is_showtime, struct port_cell_info *port_cell, void **xdata_addr);
@@ -73,6 +78,7 @@ static int ptm_stop(struct net_device *);
   static unsigned int ptm_poll(int, unsigned int);
   static int ptm_napi_poll(struct napi_struct *, int);
 static int ptm_hard_start_xmit(struct sk_buff *, struct net_device *);
+static u16 ptm_select_queue(struct net_device *, struct sk_buff *, void *, select_queue_fallback_t);
 static int ptm_ioctl(struct net_device *, struct ifreq *, int);
 static void ptm_tx_timeout(struct net_device *);
 
@@ -80,6 +86,7 @@ static inline struct sk_buff* alloc_skb_rx(void);
 static inline struct sk_buff* alloc_skb_tx(unsigned int);
 static inline struct sk_buff *get_skb_pointer(unsigned int);
 static inline int get_tx_desc(unsigned int, unsigned int *);
+static inline void free_tx_skb(struct sk_buff *);
 
 /*
  *  Mailbox handler and signal function
@@ -87,8 +94,9 @@ static inline int get_tx_desc(unsigned int, unsigned int *);
 static irqreturn_t mailbox_irq_handler(int, void *);
 
 /*
- *  Tasklet to Handle Swap Descriptors
+ *  Swap Descriptors, handled in NAPI while the interface is up, tasklet otherwise
  */
+static int swap_desc(int);
 static void do_swap_desc_tasklet(unsigned long);
 
 
@@ -102,6 +110,8 @@ static inline void clear_tables(void);
 
 static int g_wanqos_en = 0;
 
+static int g_napi_weight;
+
 static int g_queue_gamma_map[4];
 
 static struct ptm_priv_data g_ptm_priv_data;
@@ -111,6 +121,7 @@ static struct net_device_ops g_ptm_netdev_ops = {
     .ndo_open            = ptm_open,
     .ndo_stop            = ptm_stop,
     .ndo_start_xmit      = ptm_hard_start_xmit,
+    .ndo_select_queue    = ptm_select_queue,
     .ndo_validate_addr   = eth_validate_addr,
     .ndo_set_mac_address = eth_mac_addr,
     .ndo_change_mtu      = eth_change_mtu,
@@ -125,6 +136,9 @@ static int g_ptm_prio_queue_map[8];
 
 static DECLARE_TASKLET(g_swap_desc_tasklet, do_swap_desc_tasklet, 0);
 
+//  TX queues of ptm0 share the CPU to WAN descriptors
+static DEFINE_SPINLOCK(g_ptm_tx_lock);
+
 
 unsigned int ifx_ptm_dbg_enable = DBG_ENABLE_MASK_ERR;
 
@@ -137,7 +151,7 @@ unsigned int ifx_ptm_dbg_enable = DBG_ENABLE_MASK_ERR;
 static void ptm_setup(struct net_device *dev, int ndev)
 {
     dev->netdev_ops      = &g_ptm_netdev_ops;
-    netif_napi_add(dev, &g_ptm_priv_data.itf[ndev].napi, ptm_napi_poll, 16);
+    netif_napi_add(dev, &g_ptm_priv_data.itf[ndev].napi, ptm_napi_poll, g_napi_weight);
     dev->watchdog_timeo  = ETH_WATCHDOG_TIMEOUT;
 
     dev->dev_addr[0] = 0x00;
@@ -167,7 +181,7 @@ static int ptm_open(struct net_device *dev)
 
     IFX_REG_W32_MASK(0, 1, MBOX_IGU1_IER);
 
-    netif_start_queue(dev);
+    netif_tx_start_all_queues(dev);
 
     return 0;
 }
@@ -180,7 +194,10 @@ static int ptm_stop(struct net_device *dev)
 
     napi_disable(&g_ptm_priv_data.itf[0].napi);
 
-    netif_stop_queue(dev);
+    //  NAPI may have left swap interrupt disabled, tasklet takes over
+    tasklet_hi_schedule(&g_swap_desc_tasklet);
+
+    netif_tx_stop_all_queues(dev);
 
     return 0;
 }
@@ -244,6 +261,10 @@ static int ptm_napi_poll(struct napi_struct *napi, int budget)
 {
     int ndev = 0;
     unsigned int work_done;
+    int swap_done;
+
+    //  release transmitted buffers first, it restarts TX queues
+    swap_done = swap_desc(budget);
 
     work_done = ptm_poll(ndev, budget);
 
@@ -254,16 +275,22 @@ static int ptm_napi_poll(struct napi_struct *napi, int budget)
     }
 
     //  clear interrupt
-    IFX_REG_W32_MASK(0, 1, MBOX_IGU1_ISRC);
+    IFX_REG_W32_MASK(0, 1 | (1 << 16), MBOX_IGU1_ISRC);
     //  no more traffic
-    if (work_done < budget) {
+    if ( work_done < budget && swap_done < budget
+        && WAN_SWAP_DESC_BASE[g_ptm_priv_data.itf[0].tx_swap_desc_pos].own ) {
 	napi_complete(napi);
-        IFX_REG_W32_MASK(0, 1, MBOX_IGU1_IER);
+        IFX_REG_W32_MASK(0, 1 | (1 << 16), MBOX_IGU1_IER);
         return work_done;
     }
 
     //  next round
-    return work_done;
+    return budget;
+}
+
+static u16 ptm_select_queue(struct net_device *dev, struct sk_buff *skb, void *accel_priv, select_queue_fallback_t fallback)
+{
+    return g_ptm_prio_queue_map[skb->priority > 7 ? 7 : skb->priority];
 }
 
 static int ptm_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
@@ -274,6 +301,7 @@ static int ptm_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
     struct tx_descriptor reg_desc = {0};
     struct sk_buff *skb_to_free;
     unsigned int byteoff;
+    unsigned int qid = skb_get_queue_mapping(skb);
 
     ASSERT(dev == g_net_dev[0], "incorrect device");
 
@@ -282,19 +310,6 @@ static int ptm_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
         goto PTM_HARD_START_XMIT_FAIL;
     }
 
-    /*  allocate descriptor */
-    desc_base = get_tx_desc(0, &f_full);
-    if ( f_full ) {
-        dev->trans_start = jiffies;
-        netif_stop_queue(dev);
-
-        IFX_REG_W32_MASK(0, 1 << 17, MBOX_IGU1_ISRC);
-        IFX_REG_W32_MASK(0, 1 << 17, MBOX_IGU1_IER);
-    }
-    if ( desc_base < 0 )
-        goto PTM_HARD_START_XMIT_FAIL;
-    desc = &CPU_TO_WAN_TX_DESC_BASE[desc_base];
-
     byteoff = (unsigned int)skb->data & (DATA_BUFFER_ALIGNMENT - 1);
     if ( skb_headroom(skb) < sizeof(struct sk_buff *) + byteoff || skb_cloned(skb) ) {
         struct sk_buff *new_skb;
@@ -309,6 +324,7 @@ static int ptm_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
         }
         skb_put(new_skb, skb->len);
         memcpy(new_skb->data, skb->data, skb->len);
+        skb_set_queue_mapping(new_skb, qid);
         dev_kfree_skb_any(skb);
         skb = new_skb;
         byteoff = (unsigned int)skb->data & (DATA_BUFFER_ALIGNMENT - 1);
@@ -320,16 +336,33 @@ static int ptm_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
     /*  write back to physical memory   */
     dma_cache_wback((unsigned long)skb->data - byteoff - sizeof(struct sk_buff *), skb->len + byteoff + sizeof(struct sk_buff *));
 
+    spin_lock(&g_ptm_tx_lock);
+
+    /*  allocate descriptor */
+    desc_base = get_tx_desc(0, &f_full);
+    if ( f_full ) {
+        dev->trans_start = jiffies;
+        netif_tx_stop_all_queues(dev);
+
+        IFX_REG_W32_MASK(0, 1 << 17, MBOX_IGU1_ISRC);
+        IFX_REG_W32_MASK(0, 1 << 17, MBOX_IGU1_IER);
+    }
+    if ( desc_base < 0 ) {
+        spin_unlock(&g_ptm_tx_lock);
+        goto PTM_HARD_START_XMIT_FAIL;
+    }
+    desc = &CPU_TO_WAN_TX_DESC_BASE[desc_base];
+
     /*  free previous skb   */
     skb_to_free = get_skb_pointer(desc->dataptr);
     if ( skb_to_free != NULL )
-        dev_kfree_skb_any(skb_to_free);
+        free_tx_skb(skb_to_free);
 
     /*  update descriptor   */
     reg_desc.small   = 0;
     reg_desc.dataptr = (unsigned int)skb->data & (0x0FFFFFFF ^ (DATA_BUFFER_ALIGNMENT - 1));
     reg_desc.datalen = skb->len < ETH_ZLEN ? ETH_ZLEN : skb->len;
-    reg_desc.qid     = g_ptm_prio_queue_map[skb->priority > 7 ? 7 : skb->priority];
+    reg_desc.qid     = qid;
     reg_desc.byteoff = byteoff;
     reg_desc.own     = 1;
     reg_desc.c       = 1;
@@ -339,11 +372,16 @@ static int ptm_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
     g_ptm_priv_data.itf[0].stats.tx_packets++;
     g_ptm_priv_data.itf[0].stats.tx_bytes += reg_desc.datalen;
 
+    /*  account before firmware may give it back */
+    netdev_tx_sent_queue(netdev_get_tx_queue(dev, qid), skb->len);
+
     /*  write discriptor to memory  */
     *((volatile unsigned int *)desc + 1) = *((unsigned int *)&reg_desc + 1);
     wmb();
     *(volatile unsigned int *)desc = *(unsigned int *)&reg_desc;
 
+    spin_unlock(&g_ptm_tx_lock);
+
     dev->trans_start = jiffies;
 
     return 0;
@@ -452,7 +490,7 @@ static void ptm_tx_timeout(struct net_device *dev)
     IFX_REG_W32_MASK(1 << 17, 0, MBOX_IGU1_IER);
 
     /*  wake up TX queue    */
-    netif_wake_queue(dev);
+    netif_tx_wake_all_queues(dev);
 
     return;
 }
@@ -514,6 +552,18 @@ static inline struct sk_buff *get_skb_pointer(unsigned int dataptr)
     return skb;
 }
 
+/*
+ *  Buffers sent by ptm_hard_start_xmit come back through the swap or the
+ *  CPU to WAN descriptors, they complete the BQL accounting of their queue.
+ *  Swap buffers of the firmware carry no data.
+ */
+static inline void free_tx_skb(struct sk_buff *skb)
+{
+    if ( skb->len != 0 )
+        netdev_tx_completed_queue(netdev_get_tx_queue(g_net_dev[0], skb_get_queue_mapping(skb)), 1, skb->len);
+    dev_kfree_skb_any(skb);
+}
+
 static inline int get_tx_desc(unsigned int itf, unsigned int *f_full)
 {
     int desc_base = -1;
@@ -559,24 +609,27 @@ static irqreturn_t mailbox_irq_handler(int irq, void *dev_id)
             }
 	   if (isr & BIT(16)) {
                 IFX_REG_W32_MASK(1 << 16, 0, MBOX_IGU1_IER);
-                tasklet_hi_schedule(&g_swap_desc_tasklet);
+                if ( netif_running(g_net_dev[0]) )
+                    napi_schedule(&g_ptm_priv_data.itf[0].napi);
+                else
+                    tasklet_hi_schedule(&g_swap_desc_tasklet);
             }
 	    if (isr & BIT(17)) {
                 IFX_REG_W32_MASK(1 << 17, 0, MBOX_IGU1_IER);
-                netif_wake_queue(g_net_dev[0]);
+                netif_tx_wake_all_queues(g_net_dev[0]);
         	}
 
     return IRQ_HANDLED;
 }
 
-static void do_swap_desc_tasklet(unsigned long arg)
+static int swap_desc(int budget)
 {
-    int budget = 32;
     volatile struct tx_descriptor *desc;
     struct sk_buff *skb;
     unsigned int byteoff;
+    int done = 0;
 
-    while ( budget-- > 0 ) {
+    while ( done < budget ) {
 	if ( WAN_SWAP_DESC_BASE[g_ptm_priv_data.itf[0].tx_swap_desc_pos].own )  //  if PP32 hold descriptor
             break;
 
@@ -586,7 +639,7 @@ static void do_swap_desc_tasklet(unsigned long arg)
 
         skb = get_skb_pointer(desc->dataptr);
         if ( skb != NULL )
-            dev_kfree_skb_any(skb);
+            free_tx_skb(skb);
 
         skb = alloc_skb_tx(RX_MAX_BUFFER_SIZE);
         if ( skb == NULL )
@@ -596,10 +649,18 @@ static void do_swap_desc_tasklet(unsigned long arg)
 
         desc->dataptr = (unsigned int)skb->data & 0x0FFFFFFF;
         desc->own = 1;
+        done++;
     }
 
+    return done;
+}
+
+static void do_swap_desc_tasklet(unsigned long arg)
+{
+    swap_desc(32);
+
     //  clear interrupt
-    IFX_REG_W32_MASK(0, 16, MBOX_IGU1_ISRC);
+    IFX_REG_W32_MASK(0, 1 << 16, MBOX_IGU1_ISRC);
     //  no more skb to be replaced
     if ( WAN_SWAP_DESC_BASE[g_ptm_priv_data.itf[0].tx_swap_desc_pos].own ) {    //  if PP32 hold descriptor
         IFX_REG_W32_MASK(0, 1 << 16, MBOX_IGU1_IER);
@@ -632,6 +693,12 @@ static inline int init_priv_data(void)
     if ( g_wanqos_en > 8 )
         g_wanqos_en = 8;
 
+    g_napi_weight = napi_weight;
+    if ( g_napi_weight < 1 )
+        g_napi_weight = 1;
+    else if ( g_napi_weight > NAPI_POLL_WEIGHT )
+        g_napi_weight = NAPI_POLL_WEIGHT;
+
     for ( i = 0; i < ARRAY_SIZE(g_queue_gamma_map); i++ )
     {
         g_queue_gamma_map[i] = queue_gamma_map[i] & ((1 << g_wanqos_en) - 1);
@@ -951,7 +1018,8 @@ static int ifx_ptm_init(void)
     }
 
     for ( i = 0; i < ARRAY_SIZE(g_net_dev); i++ ) {
-        g_net_dev[i] = alloc_netdev(0, g_net_dev_name[i], NET_NAME_UNKNOWN, ether_setup);
+        //  one TX queue per firmware QoS queue
+        g_net_dev[i] = alloc_netdev_mqs(0, g_net_dev_name[i], NET_NAME_UNKNOWN, ether_setup, __ETH_WAN_TX_QUEUE_NUM, 1);
         if ( g_net_dev[i] == NULL )
             goto ALLOC_NETDEV_FAIL;
         ptm_setup(g_net_dev[i], i);
@@ -24,10 +24,10 @@
 
 #include "LzmaTypes.h"
 
-/* #define _LZMA_IN_CB */
+#define _LZMA_IN_CB
 /* Use callback for input data */
 
-/* #define _LZMA_OUT_READ */
+#define _LZMA_OUT_READ
 /* Use read function for output data */
 
 /* #define _LZMA_PROB32 */
@@ -21,10 +21,12 @@
 ** 2 Nov 2006   Lin Mars        init version which derived from LzmaTest.c from
 **                              LZMA v4.43 SDK
 ** 24 May 2007	Lin Mars	Fix issue for multiple lzma_inflate involved
+**              OpenWrt         stream from a read callback into a file
 *******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "LzmaDecode.h"
 #include "LzmaWrapper.h"
@@ -34,18 +36,16 @@ static const char *kCantReadMessage = "Can not read from source buffer";
 static const char *kCantAllocateMessage = "Not enough buffer for decompression";
 #endif
 
-static size_t rpos=0, dpos=0;
-
-static int MyReadFileAndCheck(unsigned char *src, void *dest, size_t size)
+static int lzma_stream_read(void *object, const unsigned char **buffer, SizeT *size)
 {
-  if (size == 0)
-    return 0;
-  memcpy(dest, src + rpos, size);
-  rpos += size;
-  return 1;
+  struct lzma_stream_in *in = object;
+
+  *size = in->read(in, in->buffer, sizeof(in->buffer));
+  *buffer = in->buffer;
+  return LZMA_RESULT_OK;
 }
 
-int lzma_inflate(unsigned char *source, int s_len, unsigned char *dest, int *d_len)
+int lzma_inflate_stream(struct lzma_stream_in *in, int fd, int *d_len)
 {
   /* We use two 32-bit integers to construct 64-bit integer for file size.
      You can remove outSizeHigh, if you don't need >= 4GB supporting,
@@ -53,21 +53,19 @@ int lzma_inflate(unsigned char *source, int s_len, unsigned char *dest, int *d_l
   UInt32 outSize = 0;
   UInt32 outSizeHigh = 0;
   SizeT outSizeFull;
+  SizeT outDone = 0;
   unsigned char *outStream;
-  
+
   int waitEOS = 1; 
   /* waitEOS = 1, if there is no uncompressed size in headers, 
    so decoder will wait EOS (End of Stream Marker) in compressed stream */
 
-  SizeT compressedSize;
-  unsigned char *inStream;
-
   CLzmaDecoderState state;  /* it's about 24-80 bytes structure, if int is 32-bit */
-  unsigned char properties[LZMA_PROPERTIES_SIZE];
+  unsigned char header[LZMA_PROPERTIES_SIZE + 8];
 
-  int res;
+  int res = LZMA_RESULT_OK;
 
-  rpos=0; dpos=0;
+  *d_len = 0;
 
   if (sizeof(UInt32) < 4)
   {
@@ -77,21 +75,8 @@ int lzma_inflate(unsigned char *source, int s_len, unsigned char *dest, int *d_l
     return LZMA_RESULT_DATA_ERROR;
   }
 
-  {
-    long length=s_len;
-    if ((long)(SizeT)length != length)
-    {
-#if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
-      printf("Too big compressed stream\n");
-#endif
-      return LZMA_RESULT_DATA_ERROR;
-    }
-    compressedSize = (SizeT)(length - (LZMA_PROPERTIES_SIZE + 8));
-  }
-
-  /* Read LZMA properties for compressed stream */
-
-  if (!MyReadFileAndCheck(source, properties, sizeof(properties)))
+  /* Read LZMA properties and uncompressed size */
+  if (in->read(in, header, sizeof(header)) != sizeof(header))
   {
 #if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
     printf("%s\n", kCantReadMessage);
@@ -99,19 +84,11 @@ int lzma_inflate(unsigned char *source, int s_len, unsigned char *dest, int *d_l
     return LZMA_RESULT_DATA_ERROR;
   }
 
-  /* Read uncompressed size */
   {
     int i;
     for (i = 0; i < 8; i++)
     {
-      unsigned char b;
-      if (!MyReadFileAndCheck(source, &b, 1))
-      {
-#if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
-        printf("%s\n", kCantReadMessage);
-#endif
-        return LZMA_RESULT_DATA_ERROR;
-      }
+      unsigned char b = header[LZMA_PROPERTIES_SIZE + i];
       if (b != 0xFF)
         waitEOS = 0;
       if (i < 4)
@@ -140,67 +117,71 @@ int lzma_inflate(unsigned char *source, int s_len, unsigned char *dest, int *d_l
   }
 
   /* Decode LZMA properties and allocate memory */
-  if (LzmaDecodeProperties(&state.Properties, properties, LZMA_PROPERTIES_SIZE) != LZMA_RESULT_OK)
+  if (LzmaDecodeProperties(&state.Properties, header, LZMA_PROPERTIES_SIZE) != LZMA_RESULT_OK)
   {
 #if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
     printf("Incorrect stream properties");
 #endif
     return LZMA_RESULT_DATA_ERROR;
   }
-  state.Probs = (CProb *)malloc(LzmaGetNumProbs(&state.Properties) * sizeof(CProb));
 
-  if (outSizeFull == 0)
-    outStream = 0;
-  else
-  {
-    if (outSizeFull > d_len)
-      outStream = 0;
-    else
-      outStream = dest;
-  }
+  /* nothing can refer further back than the start of the output */
+  if (outSizeFull < state.Properties.DictionarySize)
+    state.Properties.DictionarySize = outSizeFull ? outSizeFull : 1;
 
-  if (compressedSize == 0)
-    inStream = 0;
-  else
-  {
-    if ((compressedSize+rpos) > s_len )
-      inStream = 0;
-    else
-      inStream = source + rpos;
-  }
+  state.Probs = (CProb *)malloc(LzmaGetNumProbs(&state.Properties) * sizeof(CProb));
+  state.Dictionary = (unsigned char *)malloc(state.Properties.DictionarySize);
+  outStream = (unsigned char *)malloc(LZMA_STREAM_CHUNK);
 
-  if (state.Probs == 0 
-    || (outStream == 0 && outSizeFull != 0)
-    || (inStream == 0 && compressedSize != 0)
-    )
+  if (state.Probs == 0 || state.Dictionary == 0 || outStream == 0)
   {
     free(state.Probs);
+    free(state.Dictionary);
+    free(outStream);
 #if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
     printf("%s\n", kCantAllocateMessage);
 #endif
     return LZMA_RESULT_DATA_ERROR;
   }
 
+  in->InCallback.Read = lzma_stream_read;
+  LzmaDecoderInit(&state);
+
   /* Decompress */
+  while (outDone < outSizeFull)
   {
-    SizeT inProcessed;
     SizeT outProcessed;
-    res = LzmaDecode(&state,
-      inStream, compressedSize, &inProcessed,
-      outStream, outSizeFull, &outProcessed);
-    if (res != 0)
+    SizeT chunk = outSizeFull - outDone;
+
+    if (chunk > LZMA_STREAM_CHUNK)
+      chunk = LZMA_STREAM_CHUNK;
+
+    res = LzmaDecode(&state, &in->InCallback,
+      outStream, chunk, &outProcessed);
+    if (res != 0 || outProcessed == 0)
     {
 #if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
       printf("\nDecoding error = %d\n", res);
 #endif
       res = 1;
+      break;
     }
-    else
+
+    if (write(fd, outStream, outProcessed) != (ssize_t)outProcessed)
     {
-      *d_len = outProcessed;
+#if defined(DEBUG_ENABLE_BOOTSTRAP_PRINTF) || !defined(CFG_BOOTSTRAP_CODE)
+      printf("\nWrite error\n");
+#endif
+      res = 1;
+      break;
     }
+    outDone += outProcessed;
   }
 
+  *d_len = outDone;
+
   free(state.Probs);
+  free(state.Dictionary);
+  free(outStream);
   return res;
 }
@@ -20,6 +20,7 @@
 ** $Date        $Author         $Comment
 ** 2 Nov 2006   Lin Mars        init version which derived from LzmaTest.c from
 **                              LZMA v4.43 SDK
+**              OpenWrt         stream from a read callback into a file
 *******************************************************************************/
 #ifndef  __LZMA_WRAPPER_H__
 #define  __LZMA_WRAPPER_H__
@@ -31,6 +32,21 @@
 #define LZMA_RESULT_DATA_ERROR 1
 #endif
 
-extern int lzma_inflate(unsigned char *source, int s_len, unsigned char *dest, int *d_len);
+#include "LzmaDecode.h"
+
+#define LZMA_STREAM_CHUNK	(16 * 1024)
+
+/* Compressed input. read() returns up to size bytes, 0 at the end. */
+struct lzma_stream_in {
+  ILzmaInCallback InCallback;	/* filled in by lzma_inflate_stream */
+  size_t (*read)(struct lzma_stream_in *in, unsigned char *buf, size_t size);
+  unsigned char buffer[LZMA_STREAM_CHUNK];
+};
+
+/*
+ * Decodes a .lzma stream (properties, 64 bit size, data) to fd. Memory use
+ * is the dictionary, capped at the uncompressed size, plus one chunk.
+ */
+extern int lzma_inflate_stream(struct lzma_stream_in *in, int fd, int *d_len);
 
 #endif /*__LZMA_WRAPPER_H__*/
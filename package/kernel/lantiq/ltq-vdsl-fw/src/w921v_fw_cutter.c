@@ -17,6 +17,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -55,16 +56,98 @@ const char* part_type(unsigned int id)
 	return "/tmp/unknown.lzma";
 }
 
+/*
+ * The image is used straight from the mapped file. Its first byte is
+ * dropped, the first MAGIC_SZ bytes are XORed with MAGIC, the first three
+ * bytes of every 16 come from the next 16 and three bytes behind MAGIC_SZ
+ * are skipped. fw_byte() undoes that for one byte of the result.
+ */
+static const unsigned char *fw;
+static size_t fw_len;
+
+static inline unsigned char fw_byte(size_t i)
+{
+	if (i < MAGIC_SZ)
+		return fw[1 + i + ((i % 16) < 3 ? 16 : 0)] ^ MAGIC;
+	return fw[1 + i + 3];
+}
+
+static unsigned int fw_word(size_t idx)
+{
+	unsigned char b[4];
+	unsigned int w;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		b[i] = fw_byte(idx * 4 + i);
+	memcpy(&w, b, sizeof(w));
+
+	return w;
+}
+
+struct fw_in {
+	struct lzma_stream_in in;
+	size_t pos;
+	size_t end;
+};
+
+static size_t fw_read(struct lzma_stream_in *in, unsigned char *buf, size_t size)
+{
+	struct fw_in *f = (struct fw_in *) in;
+	size_t i;
+
+	if (size > f->end - f->pos)
+		size = f->end - f->pos;
+	for (i = 0; i < size; i++)
+		buf[i] = fw_byte(f->pos + i);
+	f->pos += size;
+
+	return size;
+}
+
+static int extract(size_t start, size_t len, const char *type)
+{
+	struct fw_in *f;
+	int dest_len;
+	int fd, err;
+
+	f = malloc(sizeof(*f));
+	if (!f) {
+		printf("Failed to alloc input buffer\n");
+		return -1;
+	}
+	f->in.read = fw_read;
+	f->pos = start;
+	f->end = (len > fw_len - start) ? fw_len : start + len;
+
+	fd = creat(type, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		printf("\tFailed to open %s\n", type);
+		free(f);
+		return 0;
+	}
+
+	err = lzma_inflate_stream(&f->in, fd, &dest_len);
+	close(fd);
+	free(f);
+
+	if (err) {
+		printf("Failed to decompress data\n");
+		unlink(type);
+		return -1;
+	}
+	printf("\tWrote %d bytes to %s\n", dest_len, type);
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct stat s;
-	unsigned char *buf_orig;
-	unsigned int *buf;
-	int buflen;
+	void *map;
+	size_t words;
 	int fd;
-	int i;
-	int err;
-	int start = 0, end = 0;
+	size_t start = 0, end = 0;
 
 	printf("Arcadyan Firmware cutter v0.1\n");
 	printf("-----------------------------\n");
@@ -82,10 +165,8 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	buf_orig = malloc(s.st_size);
-	buf = malloc(s.st_size);
-	if (!buf_orig || !buf) {
-		printf("Failed to alloc %d bytes\n", s.st_size);
+	if (s.st_size < MAGIC_SZ + 20) {
+		printf("%s is too small\n", FW_NAME);
 		return -1;
 	}
 
@@ -95,63 +176,31 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-
-	buflen = read(fd, buf_orig, s.st_size);
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
-	if (buflen != s.st_size) {
-		printf("Loaded %d instead of %d bytes inside %s\n", buflen, s.st_size, FW_NAME);
+	if (map == MAP_FAILED) {
+		printf("Unable to map %s\n", FW_NAME);
 		return -1;
 	}
+	madvise(map, s.st_size, MADV_SEQUENTIAL);
 
-	/* <magic> */
-	buf_orig++;
-	buflen -= 1;
-	for (i = 0; i < MAGIC_SZ; i++) {
-		if ((i % 16) < 3)
-			buf_orig[i] = buf_orig[i + 16] ^ MAGIC;
-		else
-			buf_orig[i] = buf_orig[i] ^ MAGIC;
-	}
-	buflen -= 3;
-	memmove(&buf_orig[MAGIC_SZ], &buf_orig[MAGIC_SZ + 3], buflen - MAGIC_SZ);
-	memcpy(buf, buf_orig, s.st_size);
+	fw = map;
+	fw_len = s.st_size - 4;
+	words = fw_len / sizeof(unsigned int);
 
-	/* </magic> */
 	do {
-		if (buf[end] == MAGIC_PART) {
+		if (fw_word(end) == MAGIC_PART) {
 			end += 2;
 			printf("Found partition at 0x%08X with size %d\n",
-				start * sizeof(unsigned int),
-				(end - start) * sizeof(unsigned int));
-			if (buf[start] == MAGIC_LZMA) {
-				int dest_len = 1024 * 1024;
-				int len = buf[end - 3];
-				unsigned int id = buf[end - 6];
+				(unsigned int)(start * sizeof(unsigned int)),
+				(int)((end - start) * sizeof(unsigned int)));
+			if (fw_word(start) == MAGIC_LZMA) {
+				unsigned int len = fw_word(end - 3);
+				unsigned int id = fw_word(end - 6);
 				const char *type = part_type(id);
-				unsigned char *dest;
-
-				dest = malloc(dest_len);
-				if (!dest) {
-					printf("Failed to alloc dest buffer\n");
-					return -1;
-				}
 
-				if (lzma_inflate((unsigned char*)&buf[start], len, dest, &dest_len)) {
-					printf("Failed to decompress data\n");
+				if (extract(start * sizeof(unsigned int), len, type))
 					return -1;
-				}
-
-				fd = creat(type, S_IRUSR | S_IWUSR);
-				if (fd != -1) {
-					if (write(fd, dest, dest_len) != dest_len)
-						printf("\tFailed to write %d bytes\n", dest_len);
-					else
-						printf("\tWrote %d bytes to %s\n", dest_len, type);
-					close(fd);
-				} else {
-					printf("\tFailed to open %s\n", type);
-				}
-				free(dest);
 			} else {
 				printf("\tThis is not lzma\n");
 			}
@@ -159,7 +208,9 @@ int main(int argc, char **argv)
 		} else {
 			end++;
 		}
-	} while(end < buflen / sizeof(unsigned int));
+	} while(end < words);
+
+	munmap(map, s.st_size);
 
 	return 0;
 }
@@ -47,6 +47,17 @@
  *	spi-gpio-custom.bus1
  *	spi-gpio-custom.bus2
  *	spi-gpio-custom.bus3
+ *
+ *  On ath79 a bus whose SCK, MOSI and MISO are all SoC GPIOs is driven by a
+ *  bit-banger of this driver instead of spi_gpio. It writes the GPIO set and
+ *  clear registers directly, changes SCK and MOSI with the same write where
+ *  it can, and only waits for what is left of each half clock period after
+ *  the calibrated cost of a register write. Two more parameters apply there:
+ *
+ *	fast		use the bit-banger where possible (default 1)
+ *	benchmark	log the throughput of every such bus at load (default 0);
+ *			the bus is clocked with all chip selects inactive, so
+ *			buses with a slave without CS are skipped
  */
 
 #include <linux/kernel.h>
@@ -58,6 +69,16 @@
 #include <linux/spi/spi.h>
 #include <linux/spi/spi_gpio.h>
 
+#ifdef CONFIG_ATH79
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/gpio/driver.h>
+#include <linux/spi/spi_bitbang.h>
+
+#include <asm/mach-ath79/ath79.h>
+#include <asm/mach-ath79/ar71xx_regs.h>
+#endif
+
 #define DRV_NAME	"spi-gpio-custom"
 #define DRV_DESC	"Custom GPIO-based SPI driver"
 #define DRV_VERSION	"0.1"
@@ -98,15 +119,26 @@ module_param_array(bus3, uint, &bus_nump[3], 0);
 MODULE_PARM_DESC(bus3, "bus3" BUS_PARM_DESC);
 
 static struct platform_device *devices[BUS_COUNT_MAX];
+static struct spi_master *fast_masters[BUS_COUNT_MAX];
 static unsigned int nr_devices;
 
+static void spi_gpio_fast_remove(struct spi_master *master);
+
+static void spi_gpio_custom_remove_bus(struct platform_device *pdev,
+				       struct spi_master *master)
+{
+	if (master)
+		spi_gpio_fast_remove(master);
+	platform_device_unregister(pdev);
+}
+
 static void spi_gpio_custom_cleanup(void)
 {
 	int i;
 
 	for (i = 0; i < nr_devices; i++)
 		if (devices[i])
-			platform_device_unregister(devices[i]);
+			spi_gpio_custom_remove_bus(devices[i], fast_masters[i]);
 }
 
 static int spi_gpio_custom_get_slave_mode(unsigned int id,
@@ -191,6 +223,352 @@ static int spi_gpio_custom_check_params(unsigned int id, unsigned int *params)
 	return 0;
 }
 
+#ifdef CONFIG_ATH79
+static bool fast = 1;
+module_param(fast, bool, 0);
+MODULE_PARM_DESC(fast, "drive ath79 SoC GPIO buses without gpiolib");
+
+static bool benchmark;
+module_param(benchmark, bool, 0);
+MODULE_PARM_DESC(benchmark, "log the throughput of the fast buses at load");
+
+#define FAST_CALIBRATE_WRITES	1000
+#define FAST_BENCH_BYTES	4096
+
+struct spi_gpio_fast {
+	struct spi_bitbang bitbang;
+	void __iomem *base;
+	u32 sck;
+	u32 mosi;
+	u32 miso;
+	unsigned int write_ns;		/* calibrated cost of one register write */
+	int gpios[3 + BUS_SLAVE_COUNT_MAX];
+	int nr_gpios;
+};
+
+/* the bit of an ath79 SoC GPIO, 0 for an unused signal */
+static int spi_gpio_fast_mask(unsigned int gpio, u32 *mask)
+{
+	struct gpio_chip *chip;
+
+	*mask = 0;
+	if (!gpio_is_valid(gpio))
+		return 0;
+
+	chip = gpiod_to_chip(gpio_to_desc(gpio));
+	if (!chip || !chip->label || strcmp(chip->label, "ath79") ||
+	    gpio - chip->base >= 32)
+		return -ENODEV;
+
+	*mask = BIT(gpio - chip->base);
+	return 0;
+}
+
+static inline void spi_gpio_fast_write(struct spi_gpio_fast *p, u32 set,
+				       u32 clear)
+{
+	if (clear)
+		__raw_writel(clear, p->base + AR71XX_GPIO_REG_CLEAR);
+	if (set)
+		__raw_writel(set, p->base + AR71XX_GPIO_REG_SET);
+}
+
+/*
+ * Moves SCK to the given level and, if mosi differs from what is on the
+ * wire, MOSI along with it. Mostly that is a single register write.
+ */
+static inline void spi_gpio_fast_edge(struct spi_gpio_fast *p, int sck,
+				      u32 mosi, u32 *cur)
+{
+	u32 set = sck ? p->sck : 0;
+	u32 clear = sck ? 0 : p->sck;
+
+	if (mosi != *cur) {
+		set |= mosi;
+		clear |= *cur;
+		*cur = mosi;
+	}
+
+	spi_gpio_fast_write(p, set, clear);
+}
+
+static inline void spi_gpio_fast_delay(unsigned int ns)
+{
+	if (ns)
+		ndelay(ns);
+}
+
+/* MSB first, as spi-bitbang-txrx.h; nsecs is half a clock period */
+static inline u32 spi_gpio_fast_txrx(struct spi_gpio_fast *p,
+				     unsigned int nsecs, u32 word, u8 bits,
+				     int cpol, int cpha)
+{
+	unsigned int delay = nsecs > p->write_ns ? nsecs - p->write_ns : 0;
+	u32 bit = 1U << (bits - 1);
+	u32 cur, in = 0;
+
+	/* SCK is idle, put the first bit out on its own */
+	cur = (word & bit) ? p->mosi : 0;
+	spi_gpio_fast_write(p, cur, p->mosi & ~cur);
+
+	for (; bit; bit >>= 1) {
+		if (!cpha) {
+			spi_gpio_fast_delay(delay);
+			spi_gpio_fast_edge(p, !cpol, cur, &cur);
+			spi_gpio_fast_delay(delay);
+			in = (in << 1) |
+			     !!(__raw_readl(p->base + AR71XX_GPIO_REG_IN) & p->miso);
+			/* the next bit goes out with the trailing edge */
+			spi_gpio_fast_edge(p, cpol,
+					   (word & (bit >> 1)) ? p->mosi : 0,
+					   &cur);
+		} else {
+			spi_gpio_fast_edge(p, !cpol, (word & bit) ? p->mosi : 0,
+					   &cur);
+			spi_gpio_fast_delay(delay);
+			/* sample on the trailing edge */
+			spi_gpio_fast_edge(p, cpol, cur, &cur);
+			in = (in << 1) |
+			     !!(__raw_readl(p->base + AR71XX_GPIO_REG_IN) & p->miso);
+			spi_gpio_fast_delay(delay);
+		}
+	}
+
+	return in;
+}
+
+#define SPI_GPIO_FAST_TXRX(cpol, cpha)					\
+static u32 spi_gpio_fast_txrx_mode##cpol##cpha(struct spi_device *spi,	\
+					       unsigned nsecs, u32 word,	\
+					       u8 bits)				\
+{									\
+	return spi_gpio_fast_txrx(spi_master_get_devdata(spi->master),	\
+				  nsecs, word, bits, cpol, cpha);	\
+}
+
+SPI_GPIO_FAST_TXRX(0, 0)
+SPI_GPIO_FAST_TXRX(0, 1)
+SPI_GPIO_FAST_TXRX(1, 0)
+SPI_GPIO_FAST_TXRX(1, 1)
+
+static void spi_gpio_fast_chipselect(struct spi_device *spi, int is_active)
+{
+	struct spi_gpio_fast *p = spi_master_get_devdata(spi->master);
+	unsigned long cs = (unsigned long) spi->controller_data;
+
+	/* set initial clock polarity */
+	if (is_active) {
+		if (spi->mode & SPI_CPOL)
+			spi_gpio_fast_write(p, p->sck, 0);
+		else
+			spi_gpio_fast_write(p, 0, p->sck);
+	}
+
+	if (cs != SPI_GPIO_NO_CHIPSELECT)
+		gpio_set_value(cs, (spi->mode & SPI_CS_HIGH) ? is_active : !is_active);
+}
+
+/*
+ * Writing 0 to the set register changes no pin but costs as much as any
+ * other write, so this is safe with slaves listening.
+ */
+static void spi_gpio_fast_calibrate(struct spi_gpio_fast *p)
+{
+	unsigned long flags;
+	ktime_t start;
+	s64 ns;
+	int i;
+
+	local_irq_save(flags);
+	start = ktime_get();
+	for (i = 0; i < FAST_CALIBRATE_WRITES; i++)
+		__raw_writel(0, p->base + AR71XX_GPIO_REG_SET);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	local_irq_restore(flags);
+
+	p->write_ns = div_s64(ns, FAST_CALIBRATE_WRITES);
+}
+
+static void __init spi_gpio_fast_benchmark(struct spi_gpio_fast *p,
+					   unsigned int bus, int gpio_sck)
+{
+	unsigned long flags;
+	ktime_t start;
+	s64 fast_ns, lib_ns;
+	int i;
+
+	/* all chip selects are inactive, only SCK and MOSI move */
+	start = ktime_get();
+	for (i = 0; i < FAST_BENCH_BYTES; i++)
+		spi_gpio_fast_txrx(p, 0, i, 8, 0, 0);
+	fast_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	/* what spi_gpio pays for the same register write */
+	local_irq_save(flags);
+	start = ktime_get();
+	for (i = 0; i < FAST_CALIBRATE_WRITES; i++)
+		gpio_set_value(gpio_sck, 0);
+	lib_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	local_irq_restore(flags);
+
+	printk(KERN_INFO PFX "bus %u: %llu kbit/s, register write %u ns, gpio_set_value %llu ns\n",
+	       bus, div64_u64(FAST_BENCH_BYTES * 8ULL * 1000000, fast_ns ? : 1),
+	       p->write_ns, div_s64(lib_ns, FAST_CALIBRATE_WRITES));
+}
+
+static int __init spi_gpio_fast_request(struct spi_gpio_fast *p, int gpio,
+					unsigned long flags)
+{
+	int err;
+
+	if (!gpio_is_valid(gpio))
+		return 0;
+
+	err = gpio_request_one(gpio, flags, DRV_NAME);
+	if (err)
+		return err;
+
+	p->gpios[p->nr_gpios++] = gpio;
+	return 0;
+}
+
+static void spi_gpio_fast_free(struct spi_gpio_fast *p)
+{
+	while (p->nr_gpios)
+		gpio_free(p->gpios[--p->nr_gpios]);
+}
+
+static void spi_gpio_fast_remove(struct spi_master *master)
+{
+	struct spi_gpio_fast *p = spi_master_get_devdata(master);
+
+	spi_bitbang_stop(&p->bitbang);
+	spi_gpio_fast_free(p);
+	spi_master_put(master);
+}
+
+/* returns -ENODEV if the bus has to be left to spi_gpio */
+static int __init spi_gpio_fast_add(unsigned int id, unsigned int *params,
+				    int num_cs, struct platform_device **pdevp,
+				    struct spi_master **masterp)
+{
+	struct platform_device *pdev;
+	struct spi_master *master;
+	struct spi_gpio_fast *p;
+	u32 sck, mosi, miso;
+	int i, mode, cs;
+	bool all_cs = true;
+	int err;
+
+	if (!fast || !ath79_gpio_base)
+		return -ENODEV;
+
+	if (spi_gpio_fast_mask(params[BUS_PARAM_SCK], &sck) ||
+	    spi_gpio_fast_mask(params[BUS_PARAM_MOSI], &mosi) ||
+	    spi_gpio_fast_mask(params[BUS_PARAM_MISO], &miso))
+		return -ENODEV;
+
+	for (i = 0; i < BUS_SLAVE_COUNT_MAX; i++) {
+		mode = spi_gpio_custom_get_slave_mode(id, params, i);
+		if (mode < 0)
+			break;
+		/* spi_gpio handles these */
+		if (mode & (SPI_LSB_FIRST | SPI_3WIRE))
+			return -ENODEV;
+		if (spi_gpio_custom_get_slave_cs(id, params, i) < 0)
+			all_cs = false;
+	}
+
+	pdev = platform_device_register_simple(DRV_NAME, params[BUS_PARAM_ID],
+					       NULL, 0);
+	if (IS_ERR(pdev))
+		return PTR_ERR(pdev);
+
+	master = spi_alloc_master(&pdev->dev, sizeof(*p));
+	if (!master) {
+		err = -ENOMEM;
+		goto err_pdev;
+	}
+
+	p = spi_master_get_devdata(master);
+	p->base = ath79_gpio_base;
+	p->sck = sck;
+	p->mosi = mosi;
+	p->miso = miso;
+
+	err = spi_gpio_fast_request(p, params[BUS_PARAM_SCK],
+				    GPIOF_OUT_INIT_LOW);
+	if (!err)
+		err = spi_gpio_fast_request(p, params[BUS_PARAM_MOSI],
+					    GPIOF_OUT_INIT_LOW);
+	if (!err)
+		err = spi_gpio_fast_request(p, params[BUS_PARAM_MISO],
+					    GPIOF_IN);
+	for (i = 0; !err && i < BUS_SLAVE_COUNT_MAX; i++) {
+		mode = spi_gpio_custom_get_slave_mode(id, params, i);
+		if (mode < 0)
+			break;
+		cs = spi_gpio_custom_get_slave_cs(id, params, i);
+		err = spi_gpio_fast_request(p, cs, (mode & SPI_CS_HIGH)
+					    ? GPIOF_OUT_INIT_LOW
+					    : GPIOF_OUT_INIT_HIGH);
+	}
+	if (err) {
+		printk(KERN_ERR PFX "unable to request gpios for bus %d\n",
+		       params[BUS_PARAM_ID]);
+		goto err_gpios;
+	}
+
+	spi_gpio_fast_calibrate(p);
+
+	master->bus_num = params[BUS_PARAM_ID];
+	master->num_chipselect = num_cs;
+
+	p->bitbang.master = master;
+	p->bitbang.flags = SPI_CS_HIGH;
+	p->bitbang.chipselect = spi_gpio_fast_chipselect;
+	p->bitbang.txrx_word[SPI_MODE_0] = spi_gpio_fast_txrx_mode00;
+	p->bitbang.txrx_word[SPI_MODE_1] = spi_gpio_fast_txrx_mode01;
+	p->bitbang.txrx_word[SPI_MODE_2] = spi_gpio_fast_txrx_mode10;
+	p->bitbang.txrx_word[SPI_MODE_3] = spi_gpio_fast_txrx_mode11;
+
+	err = spi_bitbang_start(&p->bitbang);
+	if (err)
+		goto err_gpios;
+
+	if (benchmark) {
+		if (all_cs)
+			spi_gpio_fast_benchmark(p, params[BUS_PARAM_ID],
+						params[BUS_PARAM_SCK]);
+		else
+			printk(KERN_INFO PFX "bus %d: slave without CS, not benchmarked\n",
+			       params[BUS_PARAM_ID]);
+	}
+
+	*pdevp = pdev;
+	*masterp = master;
+	return 0;
+
+err_gpios:
+	spi_gpio_fast_free(p);
+	spi_master_put(master);
+err_pdev:
+	platform_device_unregister(pdev);
+	return err;
+}
+#else
+static void spi_gpio_fast_remove(struct spi_master *master)
+{
+}
+
+static inline int spi_gpio_fast_add(unsigned int id, unsigned int *params,
+				    int num_cs, struct platform_device **pdevp,
+				    struct spi_master **masterp)
+{
+	return -ENODEV;
+}
+#endif /* CONFIG_ATH79 */
+
 static int __init spi_gpio_custom_add_one(unsigned int id, unsigned int *params)
 {
 	struct platform_device *pdev;
@@ -199,6 +577,7 @@ static int __init spi_gpio_custom_add_one(unsigned int id, unsigned int *params)
 	int num_cs;
 	int err;
 	struct spi_master *master;
+	struct spi_master *fast_master = NULL;
 	struct spi_device *slave;
 	struct spi_board_info slave_info;
 	int mode, maxfreq, cs;
@@ -211,14 +590,6 @@ static int __init spi_gpio_custom_add_one(unsigned int id, unsigned int *params)
 	if (err)
 		goto err;
 
-	/* Create BUS device node */
-
-	pdev = platform_device_alloc("spi_gpio", params[BUS_PARAM_ID]);
-	if (!pdev) {
-		err = -ENOMEM;
-		goto err;
-	}
-
 	num_cs = 0;
 	for (i = 0; i < BUS_SLAVE_COUNT_MAX; i++) {
 		/* no more slaves? */
@@ -236,6 +607,20 @@ static int __init spi_gpio_custom_add_one(unsigned int id, unsigned int *params)
 		num_cs = 1;
 	}
 
+	/* Create BUS device node */
+
+	err = spi_gpio_fast_add(id, params, num_cs, &pdev, &fast_master);
+	if (!err)
+		goto slaves;
+	if (err != -ENODEV)
+		goto err;
+
+	pdev = platform_device_alloc("spi_gpio", params[BUS_PARAM_ID]);
+	if (!pdev) {
+		err = -ENOMEM;
+		goto err;
+	}
+
 	pdata.sck = params[BUS_PARAM_SCK];
 	pdata.mosi = gpio_is_valid(params[BUS_PARAM_MOSI])
 		? params[BUS_PARAM_MOSI]
@@ -261,6 +646,7 @@ static int __init spi_gpio_custom_add_one(unsigned int id, unsigned int *params)
 
 	/* Register SLAVE devices */
 
+slaves:
 	for (i = 0; i < BUS_SLAVE_COUNT_MAX; i++) {
 		mode = spi_gpio_custom_get_slave_mode(id, params, i);
 		maxfreq = spi_gpio_custom_get_slave_maxfreq(id, params, i);
@@ -298,12 +684,13 @@ static int __init spi_gpio_custom_add_one(unsigned int id, unsigned int *params)
 		}
 	}
 
+	fast_masters[nr_devices] = fast_master;
 	devices[nr_devices++] = pdev;
 
 	return 0;
 
 err_unregister:
-	platform_device_unregister(pdev);
+	spi_gpio_custom_remove_bus(pdev, fast_master);
 err:
 	return err;
 }
@@ -17,35 +17,122 @@
 #include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/netdevice.h>
+#include <linux/if_vlan.h>
 #include <linux/rtnetlink.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/u64_stats_sync.h>
 
 static LIST_HEAD(trelay_devs);
 static struct dentry *debugfs_dir;
 
+static bool direct_xmit;
+module_param(direct_xmit, bool, 0644);
+MODULE_PARM_DESC(direct_xmit, "Default for the per-relay direct_xmit switch");
+
+struct trelay_stats {
+	u64 packets;
+	u64 bytes;
+	u64 direct;
+	u64 dropped;
+	struct u64_stats_sync syncp;
+};
+
+/* one per direction, used as rx_handler_data of the ingress device */
+struct trelay_port {
+	struct net_device *peer;
+	struct trelay *tr;
+	struct trelay_stats __percpu *stats;
+};
+
 struct trelay {
 	struct list_head list;
 	struct net_device *dev1, *dev2;
 	struct dentry *debugfs;
+	u32 direct_xmit;
+	struct trelay_port port[2];
 	char name[];
 };
 
+/*
+ * Hands the frame straight to the driver of the egress device, skipping the
+ * qdisc. Only frames the driver can take as they are qualify: anything that
+ * still needs segmenting (GRO merged frames on a device without TSO),
+ * linearizing, checksumming or a software VLAN tag is left to
+ * dev_queue_xmit, as is everything while the queue is stopped.
+ * Returns -EBUSY if the frame was not taken.
+ */
+static int trelay_direct_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct netdev_queue *txq;
+	netdev_tx_t ret = NETDEV_TX_BUSY;
+
+	if (dev->real_num_tx_queues != 1 || !netif_carrier_ok(dev))
+		return -EBUSY;
+
+	if (skb_is_gso(skb) || skb_has_frag_list(skb) ||
+	    skb->ip_summed == CHECKSUM_PARTIAL || vlan_tx_tag_present(skb))
+		return -EBUSY;
+
+	if (skb_shinfo(skb)->nr_frags && !(dev->features & NETIF_F_SG))
+		return -EBUSY;
+
+	skb_set_queue_mapping(skb, 0);
+	txq = netdev_get_tx_queue(dev, 0);
+
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	if (!netif_xmit_frozen_or_stopped(txq))
+		ret = netdev_start_xmit(skb, dev, txq, false);
+	HARD_TX_UNLOCK(dev, txq);
+
+	if (!dev_xmit_complete(ret))
+		return -EBUSY;
+
+	return ret == NETDEV_TX_OK ? 0 : -ENOBUFS;
+}
+
 rx_handler_result_t trelay_handle_frame(struct sk_buff **pskb)
 {
+	struct trelay_port *port;
+	struct trelay_stats *stats;
 	struct net_device *dev;
 	struct sk_buff *skb = *pskb;
+	unsigned int len;
+	bool direct = false;
+	int ret = -EBUSY;
 
-	dev = rcu_dereference(skb->dev->rx_handler_data);
-	if (!dev)
+	port = rcu_dereference(skb->dev->rx_handler_data);
+	if (!port)
 		return RX_HANDLER_PASS;
 
 	if (skb->protocol == htons(ETH_P_PAE))
 		return RX_HANDLER_PASS;
 
+	dev = port->peer;
 	skb_push(skb, ETH_HLEN);
 	skb->dev = dev;
 	skb_forward_csum(skb);
-	dev_queue_xmit(skb);
+	len = skb->len;
+
+	if (ACCESS_ONCE(port->tr->direct_xmit)) {
+		ret = trelay_direct_xmit(skb, dev);
+		direct = ret != -EBUSY;
+	}
+
+	if (!direct)
+		ret = net_xmit_eval(dev_queue_xmit(skb));
+
+	stats = this_cpu_ptr(port->stats);
+	u64_stats_update_begin(&stats->syncp);
+	if (ret) {
+		stats->dropped++;
+	} else {
+		stats->packets++;
+		stats->bytes += len;
+		if (direct)
+			stats->direct++;
+	}
+	u64_stats_update_end(&stats->syncp);
 
 	return RX_HANDLER_CONSUMED;
 }
@@ -56,6 +143,13 @@ static int trelay_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static void trelay_free(struct trelay *tr)
+{
+	free_percpu(tr->port[0].stats);
+	free_percpu(tr->port[1].stats);
+	kfree(tr);
+}
+
 static int trelay_do_remove(struct trelay *tr)
 {
 	list_del(&tr->list);
@@ -67,7 +161,7 @@ static int trelay_do_remove(struct trelay *tr)
 	netdev_rx_handler_unregister(tr->dev2);
 
 	debugfs_remove_recursive(tr->debugfs);
-	kfree(tr);
+	trelay_free(tr);
 
 	return 0;
 }
@@ -125,6 +219,58 @@ static const struct file_operations fops_remove = {
 	.llseek = default_llseek,
 };
 
+static void trelay_port_stats(struct seq_file *s, struct net_device *dev,
+			      struct trelay_port *port)
+{
+	u64 packets = 0, bytes = 0, direct = 0, dropped = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct trelay_stats *stats = per_cpu_ptr(port->stats, cpu);
+		u64 p, b, d, x;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_irq(&stats->syncp);
+			p = stats->packets;
+			b = stats->bytes;
+			d = stats->direct;
+			x = stats->dropped;
+		} while (u64_stats_fetch_retry_irq(&stats->syncp, start));
+
+		packets += p;
+		bytes += b;
+		direct += d;
+		dropped += x;
+	}
+
+	seq_printf(s, "%s -> %s: packets %llu bytes %llu direct %llu dropped %llu\n",
+		   dev->name, port->peer->name, packets, bytes, direct, dropped);
+}
+
+static int trelay_stats_show(struct seq_file *s, void *unused)
+{
+	struct trelay *tr = s->private;
+
+	trelay_port_stats(s, tr->dev1, &tr->port[0]);
+	trelay_port_stats(s, tr->dev2, &tr->port[1]);
+
+	return 0;
+}
+
+static int trelay_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, trelay_stats_show, inode->i_private);
+}
+
+static const struct file_operations fops_stats = {
+	.owner = THIS_MODULE,
+	.open = trelay_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 
 static int trelay_do_add(char *name, char *devn1, char *devn2)
 {
@@ -136,6 +282,13 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!tr)
 		return -ENOMEM;
 
+	tr->port[0].stats = netdev_alloc_pcpu_stats(struct trelay_stats);
+	tr->port[1].stats = netdev_alloc_pcpu_stats(struct trelay_stats);
+	if (!tr->port[0].stats || !tr->port[1].stats) {
+		trelay_free(tr);
+		return -ENOMEM;
+	}
+
 	rtnl_lock();
 	rcu_read_lock();
 
@@ -151,11 +304,17 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!dev1 || !dev2)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, dev2);
+	tr->direct_xmit = direct_xmit;
+	tr->port[0].peer = dev2;
+	tr->port[0].tr = tr;
+	tr->port[1].peer = dev1;
+	tr->port[1].tr = tr;
+
+	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, &tr->port[0]);
 	if (ret < 0)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, dev1);
+	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, &tr->port[1]);
 	if (ret < 0) {
 		netdev_rx_handler_unregister(dev1);
 		goto out;
@@ -171,13 +330,16 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 
 	tr->debugfs = debugfs_create_dir(name, debugfs_dir);
 	debugfs_create_file("remove", S_IWUSR, tr->debugfs, tr, &fops_remove);
+	debugfs_create_file("stats", S_IRUSR, tr->debugfs, tr, &fops_stats);
+	debugfs_create_bool("direct_xmit", S_IRUSR | S_IWUSR, tr->debugfs,
+			    &tr->direct_xmit);
 	ret = 0;
 
 out:
 	rcu_read_unlock();
 	rtnl_unlock();
 	if (ret < 0)
-		kfree(tr);
+		trelay_free(tr);
 
 	return ret;
 }
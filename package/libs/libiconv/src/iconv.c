@@ -244,6 +244,147 @@ static inline int utf8dec_wchar(wchar_t *c, unsigned char *in, size_t inb)
 	return -1;
 }
 
+/*
+ * Fast paths for the common pairs. They convert what they can do cheaply
+ * and stop at anything else (errors, short buffers, rare characters),
+ * which the generic loop in iconv() then handles one character at a time,
+ * so errors and partial conversions come out exactly as before.
+ */
+#ifdef ICONV_PERF
+static int iconv_fast = 1;	/* the benchmark compares both paths */
+#else
+#define iconv_fast 1
+#endif
+
+#define ONES	((size_t)-1 / 0xff)
+#define HIGHS	(ONES * 0x80)
+
+/* length of the leading run of ASCII bytes, checked a word at a time */
+static size_t ascii_run(const unsigned char *s, size_t n)
+{
+	const unsigned char *p = s, *e = s + n;
+
+	while (p < e && ((uintptr_t)p & (sizeof(size_t) - 1))) {
+		if (*p & 0x80)
+			return p - s;
+		p++;
+	}
+
+	while (e - p >= sizeof(size_t)) {
+		size_t w;
+
+		memcpy(&w, p, sizeof(w));
+		if (w & HIGHS)
+			break;
+		p += sizeof(size_t);
+	}
+
+	while (p < e && !(*p & 0x80))
+		p++;
+
+	return p - s;
+}
+
+/* from and to pass bytes below 0x80 through unchanged */
+static inline int ascii_compat(unsigned char charset)
+{
+	return charset == UTF_8 || charset == US_ASCII ||
+	       charset == LATIN_1 || charset == LATIN_9;
+}
+
+static void iconv_fast_run(unsigned char from, unsigned char to,
+                           const unsigned char *map,
+                           char **in, size_t *inb, char **out, size_t *outb)
+{
+	unsigned char *s = (unsigned char *)*in, *d = (unsigned char *)*out;
+	unsigned char *se = s + *inb, *de = d + *outb;
+	wchar_t c;
+	size_t i, n;
+	int l;
+
+	while (s < se) {
+		/* runs of ASCII, copied or widened */
+		if (*s < 0x80 && from >= UTF_8) {
+			if (ascii_compat(to)) {
+				n = se - s < de - d ? se - s : de - d;
+				n = ascii_run(s, n);
+				memcpy(d, s, n);
+				d += n;
+			} else if (to == UTF_16LE || to == UTF_16BE) {
+				n = se - s < (de - d) / 2 ? se - s : (de - d) / 2;
+				n = ascii_run(s, n);
+				for (i = 0; i < n; i++, d += 2)
+					put_16(d, s[i], to);
+			} else {
+				break;
+			}
+			if (!n)
+				break;
+			s += n;
+			continue;
+		}
+
+		if (from == UTF_8 && to == LATIN_1) {
+			/* U+0080..U+00FF are C2/C3 and one continuation byte */
+			if ((*s & 0xfe) != 0xc2 || se - s < 2 ||
+			    (s[1] & 0xc0) != 0x80 || d == de)
+				break;
+			*d++ = (*s << 6) | (s[1] & 0x3f);
+			s += 2;
+		} else if (from == UTF_8 &&
+		           (to == UTF_16LE || to == UTF_16BE)) {
+			/* the BMP, validated by the generic decoder */
+			l = utf8dec_wchar(&c, s, se - s);
+			if (l < 2 || c >= 0x10000 || de - d < 2 ||
+			    (unsigned)c - 0xd800 < 0x800)
+				break;
+			put_16(d, c, to);
+			d += 2;
+			s += l;
+		} else if ((from == UTF_16LE || from == UTF_16BE) &&
+		           ascii_compat(to)) {
+			if (se - s < 2)
+				break;
+			c = get_16(s, from);
+			if ((unsigned)c - 0xd800 < 0x800)
+				break;
+			if (c < 0x80) {
+				if (d == de)
+					break;
+				*d++ = c;
+			} else if (to == UTF_8 && de - d >= 3) {
+				d += utf8enc_wchar((char *)d, c);
+			} else if (to == LATIN_1 && c < 0x100 && d != de) {
+				*d++ = c;
+			} else {
+				break;
+			}
+			s += 2;
+		} else if ((from == LATIN_1 || map) && to == UTF_8) {
+			c = *s;
+			if (map) {
+				/* UCS2_8BIT code pages only */
+				if (map[0] != UCS2_8BIT)
+					break;
+				c = get_16(map + 4 + 2 * (c - 0x80), 0);
+				if (c == 0xffff)
+					break;
+			}
+			if (de - d < 3)
+				break;
+			d += utf8enc_wchar((char *)d, c);
+			s++;
+		} else {
+			break;
+		}
+	}
+
+	*inb -= s - (unsigned char *)*in;
+	*outb -= d - (unsigned char *)*out;
+	*in = (char *)s;
+	*out = (char *)d;
+}
+
 static inline wchar_t latin9_translit(wchar_t c)
 {
 	/* a number of trivial iso-8859-15 <> utf-8 transliterations */
@@ -269,7 +410,7 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	char tmp[MB_LEN_MAX];
 	wchar_t c, d;
 	size_t k, l;
-	int err;
+	int err, fast;
 
 	if (!in || !*in || !*inb) return 0;
 
@@ -278,7 +419,16 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	else
 		from = cd>>8;
 
+	fast = iconv_fast &&
+	       (ascii_compat(to) || to == UTF_16LE || to == UTF_16BE);
+
 	for (; *inb; *in+=l, *inb-=l) {
+		if (fast) {
+			iconv_fast_run(from, to, map, in, inb, out, outb);
+			if (!*inb)
+				break;
+		}
+
 		c = *(unsigned char *)*in;
 		l = 1;
 		if (from >= UTF_8 && c < 0x80) goto charok;
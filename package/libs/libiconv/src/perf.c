@@ -0,0 +1,129 @@
+/*
+ * Microbenchmark for the iconv fast paths
+ *
+ * Converts file name like text, mostly ASCII with some accented letters,
+ * between the common pairs once with and once without the fast paths and
+ * checks that both give the same output.
+ *
+ * Prints one "<name>\t<value>\t<unit>" line per result, as expected by
+ * scripts/perf-tests.sh.
+ */
+
+#define ICONV_PERF
+#include "iconv.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define PERF_MIN_NS	(200 * 1000 * 1000LL)
+#define PERF_LEN	(64 * 1024)
+
+static const char sample[] =
+	"Music/Die \xc3\x84rzte - Gr\xc3\xbc\xc3\x9f" "e/01 Intro.mp3\n"
+	"Photos/2015/IMG_4711.JPG\n"
+	"Documents/Rechnung M\xc3\xbcller \xc3\x96l.pdf\n"
+	"Video/Caf\xc3\xa9 - Making of (1080p).mkv\n";
+
+/* code pages are only supported as source, the sample letters are at the
+ * same positions in ISO-8859-1 and WINDOWS-1250 */
+static const struct {
+	const char *name;
+	const char *from;
+	const char *to;
+	const char *gen;
+} pairs[] = {
+	{ "utf8_latin1",   "UTF-8",        "ISO-8859-1", "UTF-8"      },
+	{ "latin1_utf8",   "ISO-8859-1",   "UTF-8",      "ISO-8859-1" },
+	{ "utf8_utf16le",  "UTF-8",        "UTF-16LE",   "UTF-8"      },
+	{ "utf16le_utf8",  "UTF-16LE",     "UTF-8",      "UTF-16LE"   },
+	{ "cp1250_utf8",   "WINDOWS-1250", "UTF-8",      "ISO-8859-1" },
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t convert(iconv_t cd, const char *src, size_t len,
+                      char *dst, size_t size)
+{
+	char *in = (char *)src, *out = dst;
+	size_t inb = len, outb = size;
+
+	if (iconv(cd, &in, &inb, &out, &outb) == (size_t)-1)
+		return (size_t)-1;
+
+	return size - outb;
+}
+
+static double run(iconv_t cd, const char *src, size_t len,
+                  char *dst, size_t size)
+{
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; i++)
+			convert(cd, src, len, dst, size);
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while (ns < PERF_MIN_NS);
+
+	return (double)ops * len * 1000 / ns;
+}
+
+int main(int argc, char **argv)
+{
+	static char utf8[PERF_LEN], src[4 * PERF_LEN];
+	static char out_generic[4 * PERF_LEN], out_fast[4 * PERF_LEN];
+	size_t len, src_len, l_generic, l_fast;
+	unsigned int i;
+	iconv_t cd;
+	int ret = 0;
+
+	for (len = 0; len + sizeof(sample) - 1 <= sizeof(utf8); len += sizeof(sample) - 1)
+		memcpy(utf8 + len, sample, sizeof(sample) - 1);
+
+	for (i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+		/* the input in the source charset */
+		cd = iconv_open(pairs[i].gen, "UTF-8");
+		if (cd == (iconv_t)-1)
+			continue;
+		src_len = convert(cd, utf8, len, src, sizeof(src));
+		iconv_close(cd);
+
+		cd = iconv_open(pairs[i].to, pairs[i].from);
+		if (src_len == (size_t)-1 || cd == (iconv_t)-1) {
+			fprintf(stderr, "%s: cannot convert\n", pairs[i].name);
+			ret = 1;
+			continue;
+		}
+
+		iconv_fast = 0;
+		l_generic = convert(cd, src, src_len, out_generic, sizeof(out_generic));
+		iconv_fast = 1;
+		l_fast = convert(cd, src, src_len, out_fast, sizeof(out_fast));
+		if (l_generic != l_fast || l_fast == (size_t)-1 ||
+		    memcmp(out_generic, out_fast, l_fast)) {
+			fprintf(stderr, "%s: fast path output differs\n", pairs[i].name);
+			ret = 1;
+			continue;
+		}
+
+		iconv_fast = 0;
+		printf("%s_generic\t%.2f\tMB/s\n", pairs[i].name,
+		       run(cd, src, src_len, out_generic, sizeof(out_generic)));
+		iconv_fast = 1;
+		printf("%s_fast\t%.2f\tMB/s\n", pairs[i].name,
+		       run(cd, src, src_len, out_fast, sizeof(out_fast)));
+
+		iconv_close(cd);
+	}
+
+	return ret;
+}
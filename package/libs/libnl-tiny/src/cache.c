@@ -68,6 +68,20 @@ struct nl_cache *nl_cache_alloc(struct nl_cache_ops *ops)
 	nl_init_list_head(&cache->c_items);
 	cache->c_ops = ops;
 
+	if (ops->co_obj_ops && ops->co_obj_ops->oo_keygen) {
+		int i;
+
+		cache->c_hash = calloc(NL_CACHE_HASH_SIZE,
+				       sizeof(*cache->c_hash));
+		if (!cache->c_hash) {
+			free(cache);
+			return NULL;
+		}
+
+		for (i = 0; i < NL_CACHE_HASH_SIZE; i++)
+			nl_init_list_head(&cache->c_hash[i]);
+	}
+
 	NL_DBG(2, "Allocated cache %p <%s>.\n", cache, nl_cache_name(cache));
 
 	return cache;
@@ -122,6 +136,7 @@ void nl_cache_free(struct nl_cache *cache)
 
 	nl_cache_clear(cache);
 	NL_DBG(1, "Freeing cache %p <%s>...\n", cache, nl_cache_name(cache));
+	free(cache->c_hash);
 	free(cache);
 }
 
@@ -139,6 +154,13 @@ static int __cache_add(struct nl_cache *cache, struct nl_object *obj)
 	nl_list_add_tail(&obj->ce_list, &cache->c_items);
 	cache->c_nitems++;
 
+	if (cache->c_hash) {
+		uint32_t key = obj->ce_ops->oo_keygen(obj);
+
+		nl_list_add_tail(&obj->ce_hash_list,
+			&cache->c_hash[key % NL_CACHE_HASH_SIZE]);
+	}
+
 	NL_DBG(1, "Added %p to cache %p <%s>.\n",
 	       obj, cache, nl_cache_name(cache));
 
@@ -190,6 +212,10 @@ void nl_cache_remove(struct nl_object *obj)
 		return;
 
 	nl_list_del(&obj->ce_list);
+	if (cache->c_hash) {
+		nl_list_del(&obj->ce_hash_list);
+		nl_init_list_head(&obj->ce_hash_list);
+	}
 	obj->ce_cache = NULL;
 	nl_object_put(obj);
 	cache->c_nitems--;
@@ -198,6 +224,57 @@ void nl_cache_remove(struct nl_object *obj)
 	       obj, cache, nl_cache_name(cache));
 }
 
+static int cache_obj_match(struct nl_object *obj, struct nl_object *needle)
+{
+	struct nl_object_ops *ops = obj->ce_ops;
+
+	if (obj->ce_ops != needle->ce_ops)
+		return 0;
+
+	return !ops->oo_compare(obj, needle, ops->oo_id_attrs, 0);
+}
+
+/**
+ * Search for an object in a cache
+ * @arg cache		Cache to search in.
+ * @arg needle		Object carrying the identity attributes to look for.
+ *
+ * Looks up the object matching \c needle in all attributes listed in
+ * oo_id_attrs. Uses the hash index of the cache if the object type
+ * provides a key generator, otherwise walks the object list.
+ *
+ * @return Reference to the matching object or NULL.
+ */
+struct nl_object *nl_cache_search(struct nl_cache *cache,
+				  struct nl_object *needle)
+{
+	struct nl_object *obj;
+
+	if (cache->c_hash) {
+		uint32_t key = needle->ce_ops->oo_keygen(needle);
+		struct nl_list_head *head;
+
+		head = &cache->c_hash[key % NL_CACHE_HASH_SIZE];
+		nl_list_for_each_entry(obj, head, ce_hash_list) {
+			if (cache_obj_match(obj, needle))
+				goto found;
+		}
+
+		return NULL;
+	}
+
+	nl_list_for_each_entry(obj, &cache->c_items, ce_list) {
+		if (cache_obj_match(obj, needle))
+			goto found;
+	}
+
+	return NULL;
+
+found:
+	nl_object_get(obj);
+	return obj;
+}
+
 /** @} */
 
 /**
@@ -157,19 +157,21 @@ int genl_ctrl_alloc_cache(struct nl_sock *sock, struct nl_cache **result)
  */
 struct genl_family *genl_ctrl_search(struct nl_cache *cache, int id)
 {
-	struct genl_family *fam;
+	struct genl_family *needle, *fam;
 
 	if (cache->c_ops != &genl_ctrl_ops)
 		BUG();
 
-	nl_list_for_each_entry(fam, &cache->c_items, ce_list) {
-		if (fam->gf_id == id) {
-			nl_object_get((struct nl_object *) fam);
-			return fam;
-		}
-	}
+	needle = genl_family_alloc();
+	if (!needle)
+		return NULL;
 
-	return NULL;
+	genl_family_set_id(needle, id);
+	fam = (struct genl_family *)
+		nl_cache_search(cache, (struct nl_object *) needle);
+	genl_family_put(needle);
+
+	return fam;
 }
 
 /**
@@ -207,6 +209,109 @@ struct genl_family *genl_ctrl_search_by_name(struct nl_cache *cache,
 	return NULL;
 }
 
+static int probe_valid_handler(struct nl_msg *msg, void *arg)
+{
+	struct nlattr *tb[CTRL_ATTR_MAX+1];
+	struct genl_family **result = arg;
+	struct genl_family *family;
+
+	if (genlmsg_parse(nlmsg_hdr(msg), 0, tb, CTRL_ATTR_MAX,
+			  ctrl_policy) < 0)
+		return NL_SKIP;
+
+	if (!tb[CTRL_ATTR_FAMILY_ID] || !tb[CTRL_ATTR_FAMILY_NAME] || *result)
+		return NL_SKIP;
+
+	family = genl_family_alloc();
+	if (!family)
+		return NL_SKIP;
+
+	genl_family_set_id(family, nla_get_u16(tb[CTRL_ATTR_FAMILY_ID]));
+	genl_family_set_name(family, nla_get_string(tb[CTRL_ATTR_FAMILY_NAME]));
+
+	if (tb[CTRL_ATTR_VERSION])
+		genl_family_set_version(family,
+					nla_get_u32(tb[CTRL_ATTR_VERSION]));
+
+	if (tb[CTRL_ATTR_HDRSIZE])
+		genl_family_set_hdrsize(family,
+					nla_get_u32(tb[CTRL_ATTR_HDRSIZE]));
+
+	if (tb[CTRL_ATTR_MAXATTR])
+		genl_family_set_maxattr(family,
+					nla_get_u32(tb[CTRL_ATTR_MAXATTR]));
+
+	*result = family;
+	return NL_SKIP;
+}
+
+static int probe_ack_handler(struct nl_msg *msg, void *arg)
+{
+	int *done = arg;
+
+	*done = 1;
+	return NL_STOP;
+}
+
+/**
+ * Look up generic netlink family by name in the kernel.
+ * @arg sk		Netlink socket.
+ * @arg name		Family name.
+ *
+ * Asks the controller for this one family (CTRL_CMD_GETFAMILY with
+ * CTRL_ATTR_FAMILY_NAME) instead of dumping all of them into a cache.
+ * Identifier, name, version, header size and maximum attribute are
+ * filled in, the operations list is not. The caller owns the returned
+ * object and must give it back using genl_family_put().
+ *
+ * @return Generic netlink family object or NULL if no match was found.
+ */
+struct genl_family *genl_ctrl_probe_by_name(struct nl_sock *sk,
+					    const char *name)
+{
+	struct genl_family *family = NULL;
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	int done = 0, err;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+		return NULL;
+
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb)
+		goto out_msg;
+
+	if (!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, GENL_ID_CTRL, 0,
+			 NLM_F_ACK, CTRL_CMD_GETFAMILY, CTRL_VERSION) ||
+	    nla_put_string(msg, CTRL_ATTR_FAMILY_NAME, name) < 0)
+		goto out;
+
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, probe_valid_handler, &family);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, probe_ack_handler, &done);
+
+	if (nl_send_auto_complete(sk, msg) < 0)
+		goto out;
+
+	/* the reply and the ack may arrive as separate datagrams */
+	while (!done) {
+		err = nl_recvmsgs(sk, cb);
+		if (err < 0)
+			break;
+	}
+
+	if (!done && family) {
+		genl_family_put(family);
+		family = NULL;
+	}
+
+out:
+	nl_cb_put(cb);
+out_msg:
+	nlmsg_free(msg);
+	return family;
+}
+
 /** @} */
 
 /**
@@ -225,6 +330,14 @@ int genl_ctrl_resolve(struct nl_sock *sk, const char *name)
 	struct genl_family *family;
 	int err;
 
+	family = genl_ctrl_probe_by_name(sk, name);
+	if (family) {
+		err = genl_family_get_id(family);
+		genl_family_put(family);
+		return err;
+	}
+
+	/* old kernels can't look up a single family, dump them all */
 	if ((err = genl_ctrl_alloc_cache(sk, &cache)) < 0)
 		return err;
 
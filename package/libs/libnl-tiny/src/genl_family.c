@@ -83,6 +83,16 @@ static int family_compare(struct nl_object *_a, struct nl_object *_b,
 	return diff;
 }
 
+static uint32_t family_keygen(struct nl_object *obj)
+{
+	struct genl_family *family = (struct genl_family *) obj;
+
+	if (!(family->ce_mask & FAMILY_ATTR_ID))
+		return 0;
+
+	return family->gf_id;
+}
+
 
 /**
  * @name Family Object
@@ -130,6 +140,7 @@ struct nl_object_ops genl_family_ops = {
 	.oo_clone		= family_clone,
 	.oo_compare		= family_compare,
 	.oo_id_attrs		= FAMILY_ATTR_ID,
+	.oo_keygen		= family_keygen,
 };
 /** @endcond */
 
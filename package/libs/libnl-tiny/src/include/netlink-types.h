@@ -25,8 +25,11 @@ struct nl_cache
 	int                     c_iarg1;
 	int                     c_iarg2;
 	struct nl_cache_ops *   c_ops;
+	struct nl_list_head *	c_hash;		/* NL_CACHE_HASH_SIZE buckets */
 };
 
+#define NL_CACHE_HASH_SIZE	64
+
 struct nl_cache_assoc
 {
 	struct nl_cache *	ca_cache;
@@ -53,6 +53,8 @@ extern int			nl_cache_add(struct nl_cache *,
 extern int			nl_cache_parse_and_add(struct nl_cache *,
 						       struct nl_msg *);
 extern void			nl_cache_remove(struct nl_object *);
+extern struct nl_object *	nl_cache_search(struct nl_cache *,
+						struct nl_object *);
 extern int			nl_cache_refill(struct nl_sock *,
 						struct nl_cache *);
 extern int			nl_cache_pickup(struct nl_sock *,
@@ -188,7 +188,8 @@ extern "C" {
 	struct nl_list_head	ce_list;	\
 	int			ce_msgtype;	\
 	int			ce_flags;	\
-	uint32_t		ce_mask;
+	uint32_t		ce_mask;	\
+	struct nl_list_head	ce_hash_list;
 
 /**
  * Return true if attribute is available in both objects
@@ -320,6 +321,15 @@ struct nl_object_ops
 
 
 	char *(*oo_attrs2str)(int, char *, size_t);
+
+	/**
+	 * Hash key generator
+	 *
+	 * Optional. Returns a hash over the attributes listed in
+	 * oo_id_attrs. Caches of objects providing it keep a hash
+	 * index so nl_cache_search() does not need to walk the list.
+	 */
+	uint32_t (*oo_keygen)(struct nl_object *);
 };
 
 /** @} */
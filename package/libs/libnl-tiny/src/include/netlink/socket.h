@@ -36,6 +36,8 @@ struct nl_sock
 	unsigned int		s_seq_expect;
 	int			s_flags;
 	struct nl_cb *		s_cb;
+	unsigned char *		s_buf;		/* receive buffer, reused by nl_recvmsgs */
+	size_t			s_buflen;
 };
 
 
@@ -356,32 +356,21 @@ errout:
  * @{
  */
 
-/**
- * Receive data from netlink socket
- * @arg sk		Netlink socket.
- * @arg nla		Destination pointer for peer's netlink address.
- * @arg buf		Destination pointer for message content.
- * @arg creds		Destination pointer for credentials.
- *
- * Receives a netlink message, allocates a buffer in \c *buf and
- * stores the message content. The peer's netlink address is stored
- * in \c *nla. The caller is responsible for freeing the buffer allocated
- * in \c *buf if a positive value is returned.  Interruped system calls
- * are handled by repeating the read. The input buffer size is determined
- * by peeking before the actual read is done.
- *
- * A non-blocking sockets causes the function to return immediately with
- * a return value of 0 if no data is available.
- *
- * @return Number of octets read, 0 on EOF or a negative error code.
+/*
+ * Read one datagram into *buf, a buffer of *buflen bytes that is grown
+ * (and reallocated) until the datagram fits. The buffer stays owned by
+ * the caller on every return path. Credentials, if any, are copied to
+ * *creds and *has_creds is set.
  */
-int nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
-	    unsigned char **buf, struct ucred **creds)
+static int __nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
+		     unsigned char **buf, size_t *buflen,
+		     struct ucred *creds, int *has_creds)
 {
 	int n;
 	int flags = 0;
 	static int page_size = 0;
 	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(struct ucred))];
 	struct msghdr msg = {
 		.msg_name = (void *) nla,
 		.msg_namelen = sizeof(struct sockaddr_nl),
@@ -392,6 +381,9 @@ int nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
 		.msg_flags = 0,
 	};
 	struct cmsghdr *cmsg;
+	unsigned char *tmp;
+
+	*has_creds = 0;
 
 	if (sk->s_flags & NL_MSG_PEEK)
 		flags |= MSG_PEEK;
@@ -399,42 +391,50 @@ int nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
 	if (page_size == 0)
 		page_size = getpagesize() * 4;
 
-	iov.iov_len = page_size;
-	iov.iov_base = *buf = malloc(iov.iov_len);
+	if (*buflen < page_size) {
+		tmp = realloc(*buf, page_size);
+		if (!tmp)
+			return -NLE_NOMEM;
+		*buf = tmp;
+		*buflen = page_size;
+	}
+
+	iov.iov_len = *buflen;
+	iov.iov_base = *buf;
 
+	/* only SCM_CREDENTIALS is ever requested, so a fixed control
+	 * buffer is always large enough */
 	if (sk->s_flags & NL_SOCK_PASSCRED) {
-		msg.msg_controllen = CMSG_SPACE(sizeof(struct ucred));
-		msg.msg_control = calloc(1, msg.msg_controllen);
+		msg.msg_controllen = sizeof(cbuf);
+		msg.msg_control = cbuf;
 	}
 retry:
 
 	n = recvmsg(sk->s_fd, &msg, flags);
 	if (!n)
-		goto abort;
+		return 0;
 	else if (n < 0) {
 		if (errno == EINTR) {
 			NL_DBG(3, "recvmsg() returned EINTR, retrying\n");
 			goto retry;
 		} else if (errno == EAGAIN) {
 			NL_DBG(3, "recvmsg() returned EAGAIN, aborting\n");
-			goto abort;
-		} else {
-			free(msg.msg_control);
-			free(*buf);
+			return 0;
+		} else
 			return -nl_syserr2nlerr(errno);
-		}
 	}
 
 	if (iov.iov_len < n ||
 	    msg.msg_flags & MSG_TRUNC) {
 		/* Provided buffer is not long enough, enlarge it
 		 * and try again. */
-		iov.iov_len *= 2;
-		iov.iov_base = *buf = realloc(*buf, iov.iov_len);
-		goto retry;
-	} else if (msg.msg_flags & MSG_CTRUNC) {
-		msg.msg_controllen *= 2;
-		msg.msg_control = realloc(msg.msg_control, msg.msg_controllen);
+		tmp = realloc(*buf, iov.iov_len * 2);
+		if (!tmp)
+			return -NLE_NOMEM;
+		*buf = tmp;
+		*buflen = iov.iov_len * 2;
+		iov.iov_len = *buflen;
+		iov.iov_base = *buf;
 		goto retry;
 	} else if (flags != 0) {
 		/* Buffer is big enough, do the actual reading */
@@ -442,28 +442,62 @@ retry:
 		goto retry;
 	}
 
-	if (msg.msg_namelen != sizeof(struct sockaddr_nl)) {
-		free(msg.msg_control);
-		free(*buf);
+	if (msg.msg_namelen != sizeof(struct sockaddr_nl))
 		return -NLE_NOADDR;
-	}
 
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET &&
 		    cmsg->cmsg_type == SCM_CREDENTIALS) {
-			*creds = calloc(1, sizeof(struct ucred));
-			memcpy(*creds, CMSG_DATA(cmsg), sizeof(struct ucred));
+			memcpy(creds, CMSG_DATA(cmsg), sizeof(struct ucred));
+			*has_creds = 1;
 			break;
 		}
 	}
 
-	free(msg.msg_control);
 	return n;
+}
 
-abort:
-	free(msg.msg_control);
-	free(*buf);
-	return 0;
+/**
+ * Receive data from netlink socket
+ * @arg sk		Netlink socket.
+ * @arg nla		Destination pointer for peer's netlink address.
+ * @arg buf		Destination pointer for message content.
+ * @arg creds		Destination pointer for credentials.
+ *
+ * Receives a netlink message, allocates a buffer in \c *buf and
+ * stores the message content. The peer's netlink address is stored
+ * in \c *nla. The caller is responsible for freeing the buffer allocated
+ * in \c *buf if a positive value is returned.  Interruped system calls
+ * are handled by repeating the read. The input buffer size is determined
+ * by peeking before the actual read is done.
+ *
+ * A non-blocking sockets causes the function to return immediately with
+ * a return value of 0 if no data is available.
+ *
+ * @return Number of octets read, 0 on EOF or a negative error code.
+ */
+int nl_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
+	    unsigned char **buf, struct ucred **creds)
+{
+	struct ucred tmp_creds;
+	size_t buflen = 0;
+	int n, has_creds;
+
+	*buf = NULL;
+	n = __nl_recv(sk, nla, buf, &buflen, &tmp_creds, &has_creds);
+	if (n <= 0) {
+		free(*buf);
+		*buf = NULL;
+		return n;
+	}
+
+	if (has_creds && creds) {
+		*creds = calloc(1, sizeof(struct ucred));
+		if (*creds)
+			memcpy(*creds, &tmp_creds, sizeof(struct ucred));
+	}
+
+	return n;
 }
 
 #define NL_CB_CALL(cb, type, msg) \
@@ -490,16 +524,27 @@ static int recvmsgs(struct nl_sock *sk, struct nl_cb *cb)
 	struct sockaddr_nl nla = {0};
 	struct nl_msg *msg = NULL;
 	struct ucred *creds = NULL;
+	struct ucred sk_creds;
+	int has_creds;
 
 continue_reading:
 	NL_DBG(3, "Attempting to read from %p\n", sk);
 	if (cb->cb_recv_ow)
 		n = cb->cb_recv_ow(sk, &nla, &buf, &creds);
-	else
-		n = nl_recv(sk, &nla, &buf, &creds);
+	else {
+		/* read into the socket's buffer, it is kept for the
+		 * next datagram instead of being freed after parsing */
+		n = __nl_recv(sk, &nla, &sk->s_buf, &sk->s_buflen,
+			      &sk_creds, &has_creds);
+		buf = sk->s_buf;
+		creds = has_creds ? &sk_creds : NULL;
+	}
 
-	if (n <= 0)
+	if (n <= 0) {
+		if (cb->cb_recv_ow)
+			free(buf);
 		return n;
+	}
 
 	NL_DBG(3, "recvmsgs(%p): Read %d bytes\n", sk, n);
 
@@ -642,8 +687,10 @@ skip:
 	}
 	
 	nlmsg_free(msg);
-	free(buf);
-	free(creds);
+	if (cb->cb_recv_ow) {
+		free(buf);
+		free(creds);
+	}
 	buf = NULL;
 	msg = NULL;
 	creds = NULL;
@@ -656,8 +703,10 @@ stop:
 	err = 0;
 out:
 	nlmsg_free(msg);
-	free(buf);
-	free(creds);
+	if (cb->cb_recv_ow) {
+		free(buf);
+		free(creds);
+	}
 
 	return err;
 }
@@ -52,6 +52,7 @@ struct nl_object *nl_object_alloc(struct nl_object_ops *ops)
 
 	new->ce_refcnt = 1;
 	nl_init_list_head(&new->ce_list);
+	nl_init_list_head(&new->ce_hash_list);
 
 	new->ce_ops = ops;
 	if (ops->oo_constructor)
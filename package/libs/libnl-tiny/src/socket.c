@@ -138,6 +138,7 @@ void nl_socket_free(struct nl_sock *sk)
 		release_local_port(sk->s_local.nl_pid);
 
 	nl_cb_put(sk->s_cb);
+	free(sk->s_buf);
 	free(sk);
 }
 
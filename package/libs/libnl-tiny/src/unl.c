@@ -35,10 +35,7 @@ int unl_genl_init(struct unl *unl, const char *family)
 	if (genl_connect(unl->sock))
 		goto error;
 
-	if (genl_ctrl_alloc_cache(unl->sock, &unl->cache))
-		goto error;
-
-	unl->family = genl_ctrl_search_by_name(unl->cache, family);
+	unl->family = genl_ctrl_probe_by_name(unl->sock, family);
 	if (!unl->family)
 		goto error;
 
@@ -61,6 +58,9 @@ void unl_free(struct unl *unl)
 	if (unl->cache)
 		nl_cache_free(unl->cache);
 
+	if (unl->family)
+		genl_family_put(unl->family);
+
 	memset(unl, 0, sizeof(*unl));
 }
 
@@ -175,7 +175,6 @@ int unl_genl_multicast_id(struct unl *unl, const char *name)
 	struct nlattr *tb[CTRL_ATTR_MCAST_GRP_MAX + 1];
 	struct nlattr *groups, *group;
 	struct nl_msg *msg;
-	int ctrlid;
 	int ret = -1;
 	int rem;
 
@@ -183,8 +182,7 @@ int unl_genl_multicast_id(struct unl *unl, const char *name)
 	if (!msg)
 		return -1;
 
-	ctrlid = genl_ctrl_resolve(unl->sock, "nlctrl");
-	genlmsg_put(msg, 0, 0, ctrlid, 0, 0, CTRL_CMD_GETFAMILY, 0);
+	genlmsg_put(msg, 0, 0, GENL_ID_CTRL, 0, 0, CTRL_CMD_GETFAMILY, 0);
 	NLA_PUT_STRING(msg, CTRL_ATTR_FAMILY_NAME, unl->family_name);
 	unl_genl_request_single(unl, msg, &msg);
 	if (!msg)
@@ -12,6 +12,10 @@ scan_mt7628() {
 }
 
 
+reload_mt7628() {
+	reload_ralink_wifi mt7628
+}
+
 disable_mt7628() {
 	disable_ralink_wifi mt7628
 }
@@ -166,6 +166,33 @@ reinit_wifi() {
     chk8021x $device
 }
 
+# $1=device, returns 0 if the running driver took the new config as is
+reload_ralink_wifi() {
+    echo "reload_ralink_wifi($1,$2,$3,$4)" >>/tmp/wifi.log
+    local device="$1"
+    local datpath=/etc/wireless/$device/$device.dat
+    config_get vifs "$device" vifs
+
+    # iwpriv needs the interfaces up, and an interface that was enabled
+    # or disabled has to go through the full path anyway.
+    for vif in $vifs; do
+        local up=0
+        config_get ifname $vif ifname
+        config_get disabled $vif disabled
+        [ -n "$ifname" ] || return 1
+        ifconfig $ifname 2>/dev/null | grep -q "UP " && up=1
+        if [ "$disabled" == "1" ]; then
+            [ "$up" == "0" ] || return 1
+        else
+            [ "$up" == "1" ] || return 1
+        fi
+    done
+    [ -f "$datpath" ] || return 1
+
+    repair_wireless_uci
+    uci2dat -d $device -f $datpath -a > /tmp/uci2dat.log
+}
+
 prepare_ralink_wifi() {
     echo "prepare_ralink_wifi($1,$2,$3,$4)" >>/tmp/wifi.log
     local device=$1
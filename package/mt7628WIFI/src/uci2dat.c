@@ -35,6 +35,7 @@
 #define SHDBG(...)   printf(__VA_ARGS__);
 #define DEVNUM_MAX (4)
 #define MBSSID_MAX (4)
+#define DATLINE_MAX (512)
 
 
 #define FPRINT(fp, e, ...) \
@@ -82,6 +83,7 @@ typedef struct  _param
 
 typedef struct _vif
 {
+    param ifname;
     param ssid;
     param authmode;        /* wep, wpa, ... */
     param hidden;          /* Hidden SSID */
@@ -120,6 +122,7 @@ void hooker(FILE * fp, param * p, const char * devname);
 */
 vif VIF =
 {
+    .ifname             = {NULL, "ifname", {0}, NULL,  NULL},
     .ssid               = {NULL, "ssid", {0}, NULL,  NULL},
     .authmode           = {NULL, "encryption", {0}, NULL,  NULL},
     .hidden             = {NULL, "hidden", {0}, NULL,  NULL},
@@ -418,6 +421,44 @@ param CFG_ELEMENTS[] =
 
 };
 
+/* dat keys the driver also takes through "iwpriv <ifname> set", a change
+   to any other key only shows up after the interfaces went down and up.
+*/
+#define RT_GLOBAL  (0)  /* one value, set on the first interface */
+#define RT_LIST    (1)  /* "v1;v2;...", one value per interface */
+#define RT_INDEXED (2)  /* "Key0".."Key3", one key per interface */
+
+typedef struct
+{
+    const char *    dat_key;
+    const char *    iwpriv_key;
+    int             scope;
+} runtime_param;
+
+runtime_param RUNTIME_ELEMENTS[] =
+{
+    {"TxPower", "TxPower", RT_GLOBAL},
+    {"Channel", "Channel", RT_GLOBAL},
+    {"BeaconPeriod", "BeaconPeriod", RT_GLOBAL},
+    {"DtimPeriod", "DtimPeriod", RT_GLOBAL},
+    {"TxPreamble", "TxPreamble", RT_GLOBAL},
+    {"RTSThreshold", "RTSThreshold", RT_GLOBAL},
+    {"FragThreshold", "FragThreshold", RT_GLOBAL},
+    {"TxBurst", "TxBurst", RT_GLOBAL},
+    {"BGProtection", "BGProtection", RT_GLOBAL},
+    {"ShortSlot", "ShortSlot", RT_GLOBAL},
+    {"RadioOn", "RadioOn", RT_GLOBAL},
+    {"HideSSID", "HideSSID", RT_LIST},
+    {"AccessPolicy?", "AccessPolicy", RT_INDEXED},
+    {"AccessControlList?", NULL, RT_INDEXED},   /* ACLClearAll + ACLAddEntry */
+};
+
+typedef struct
+{
+    char key[64];
+    char value[DATLINE_MAX];
+} datline;
+
 static struct uci_context * uci_ctx;
 static struct uci_package * uci_wireless;
 static wifi_params wifi_cfg[DEVNUM_MAX];
@@ -648,6 +689,7 @@ void parse_uci(char * arg)
 
             cur_vif = wifi_cfg[cur_dev].vifnum;
 
+            PARSE_UCI_OPTION(wifi_cfg[cur_dev].vifs[cur_vif].ifname, value);
             PARSE_UCI_OPTION(wifi_cfg[cur_dev].vifs[cur_vif].ssid, value);
             PARSE_UCI_OPTION(wifi_cfg[cur_dev].vifs[cur_vif].hidden, value);
             PARSE_UCI_OPTION(wifi_cfg[cur_dev].vifs[cur_vif].key, value);
@@ -1153,6 +1195,250 @@ void gen_dat(char * devname, char * datpath)
     return;
 }
 
+
+/* read a dat file into key/value pairs, returns the number of pairs or NG */
+int load_dat(const char * datpath, datline * lines, int max)
+{
+    FILE * fp = NULL;
+    char buffer[DATLINE_MAX+64] = {0};
+    char * p = NULL;
+    char * q = NULL;
+    int n = 0;
+
+    fp = fopen(datpath, "rb");
+    if(!fp)
+    {
+        printf("%s() %s: %s!\n", __FUNCTION__, datpath, strerror(errno));
+        return NG;
+    }
+
+    while(n < max && fgets(buffer, sizeof(buffer), fp))
+    {
+        q = strchr(buffer, '\n');
+        if(q) *q = 0;
+        q = strchr(buffer, '\r');
+        if(q) *q = 0;
+
+        p = buffer;
+        while(*p == ' '|| *p == '\t') p++;
+        if(*p == 0 || *p == '#') continue;
+
+        q = strchr(p, '=');
+        if(!q) continue;
+        *q++ = 0;
+
+        strncpy(lines[n].key, p, sizeof(lines[n].key)-1);
+        strncpy(lines[n].value, q, sizeof(lines[n].value)-1);
+        n++;
+    }
+
+    fclose(fp);
+    return n;
+}
+
+
+const char * find_dat(datline * lines, int num, const char * key)
+{
+    int i;
+
+    for(i=0; i<num; i++)
+    {
+        if(0 == strcmp(lines[i].key, key))
+            return lines[i].value;
+    }
+    return NULL;
+}
+
+
+runtime_param * find_runtime(const char * datkey)
+{
+    int i;
+
+    for(i=0; i<sizeof(RUNTIME_ELEMENTS)/sizeof(RUNTIME_ELEMENTS[0]); i++)
+    {
+        if(0 == strmatch(datkey, RUNTIME_ELEMENTS[i].dat_key))
+            return &RUNTIME_ELEMENTS[i];
+    }
+    return NULL;
+}
+
+
+/* "a;b;c" -> idx-th field, copied to out */
+int list_item(const char * list, int idx, char * out, int len)
+{
+    const char * p = list;
+    const char * q = NULL;
+
+    while(idx-- > 0)
+    {
+        p = strchr(p, ';');
+        if(!p) return NG;
+        p++;
+    }
+
+    q = strchr(p, ';');
+    if(!q) q = p + strlen(p);
+    if(q - p >= len) return NG;
+
+    memcpy(out, p, q - p);
+    out[q - p] = 0;
+    return OK;
+}
+
+
+const char * vif_ifname(wifi_params * cfg, int i)
+{
+    static char name[16];
+
+    if(strlen(cfg->vifs[i].ifname.value) > 0)
+        return cfg->vifs[i].ifname.value;
+
+    snprintf(name, sizeof(name), "ra%d", i);
+    return name;
+}
+
+
+int iwpriv_set(const char * ifname, const char * key, const char * value)
+{
+    char cmd[DATLINE_MAX+64] = {0};
+
+    /* values end up inside '' on the shell command line */
+    if(strchr(value, '\'') || strchr(ifname, '\''))
+        return NG;
+
+    snprintf(cmd, sizeof(cmd), "iwpriv %s set %s='%s'", ifname, key, value);
+    printf("%s(), %s\n", __FUNCTION__, cmd);
+
+    return system(cmd) == 0 ? OK : NG;
+}
+
+
+int runtime_set(wifi_params * cfg, runtime_param * r, int i, const char * value)
+{
+    const char * ifname = vif_ifname(cfg, i);
+
+    if(r->iwpriv_key)
+        return iwpriv_set(ifname, r->iwpriv_key, value);
+
+    /* AccessControlList: there is no "set the whole list" command */
+    if(OK != iwpriv_set(ifname, "ACLClearAll", "1"))
+        return NG;
+    if(strlen(value) > 0 && OK != iwpriv_set(ifname, "ACLAddEntry", value))
+        return NG;
+
+    return OK;
+}
+
+
+/* Compare the dat in use with a freshly generated one. If only runtime
+   settable keys differ, push them to the driver with iwpriv and return OK,
+   NG means the new dat needs the interfaces to be brought up again.
+*/
+int apply_dat(char * devname, char * olddat, char * newdat)
+{
+    datline * oldl = NULL;
+    datline * newl = NULL;
+    int oldn = 0, newn = 0;
+    int i = 0, j = 0, idx = 0;
+    int ret = NG;
+    const char * v = NULL;
+    char a[DATLINE_MAX] = {0};
+    char b[DATLINE_MAX] = {0};
+    runtime_param * r = NULL;
+    wifi_params * cfg = NULL;
+
+    printf("API: %s(%s, %s, %s)\n", __FUNCTION__, devname, olddat, newdat);
+
+    for (i=0; i<DEVNUM_MAX; i++)
+    {
+        if(0 == strcmp(devname, wifi_cfg[i].devname))
+            cfg = &wifi_cfg[i];
+    }
+    if(!cfg)
+    {
+        printf("%s(), device (%s) not found!\n", __FUNCTION__, devname);
+        return NG;
+    }
+
+    oldl = (datline *)calloc(DATLINE_MAX, sizeof(datline));
+    newl = (datline *)calloc(DATLINE_MAX, sizeof(datline));
+    if(!oldl || !newl)
+        goto __error;
+
+    oldn = load_dat(olddat, oldl, DATLINE_MAX);
+    newn = load_dat(newdat, newl, DATLINE_MAX);
+    if(oldn < 0 || newn < 0)
+        goto __error;
+
+    /* a key that came or went is not something iwpriv can fix */
+    for(i=0; i<oldn; i++)
+    {
+        if(!find_dat(newl, newn, oldl[i].key))
+        {
+            printf("%s(), <%s> removed, reload\n", __FUNCTION__, oldl[i].key);
+            goto __error;
+        }
+    }
+
+    /* first pass: classify, nothing is touched unless all of it can be */
+    for(i=0; i<newn; i++)
+    {
+        v = find_dat(oldl, oldn, newl[i].key);
+        if(v && 0 == strcmp(v, newl[i].value))
+            continue;
+
+        r = find_runtime(newl[i].key);
+        if(!v || !r)
+        {
+            printf("%s(), <%s> changed, reload\n", __FUNCTION__, newl[i].key);
+            goto __error;
+        }
+        if(r->scope == RT_INDEXED && atoi(newl[i].key+strlen(newl[i].key)-1) >= cfg->vifnum)
+            continue;   /* no such interface, nothing to update */
+        printf("%s(), <%s> changed, runtime\n", __FUNCTION__, newl[i].key);
+    }
+
+    /* second pass: apply */
+    for(i=0; i<newn; i++)
+    {
+        v = find_dat(oldl, oldn, newl[i].key);
+        if(0 == strcmp(v, newl[i].value))
+            continue;
+
+        r = find_runtime(newl[i].key);
+        switch(r->scope)
+        {
+            case RT_GLOBAL:
+                if(OK != runtime_set(cfg, r, 0, newl[i].value))
+                    goto __error;
+                break;
+            case RT_LIST:
+                for(j=0; j<cfg->vifnum; j++)
+                {
+                    if(OK != list_item(v, j, a, sizeof(a)) ||
+                       OK != list_item(newl[i].value, j, b, sizeof(b)))
+                        goto __error;
+                    if(0 != strcmp(a, b) && OK != runtime_set(cfg, r, j, b))
+                        goto __error;
+                }
+                break;
+            case RT_INDEXED:
+                idx = atoi(newl[i].key+strlen(newl[i].key)-1);
+                if(idx < cfg->vifnum && OK != runtime_set(cfg, r, idx, newl[i].value))
+                    goto __error;
+                break;
+        }
+    }
+
+    ret = OK;
+
+__error:
+    if(oldl) free(oldl);
+    if(newl) free(newl);
+
+    return ret;
+}
+
 void init_wifi_cfg(void)
 {
     struct uci_element *e   = NULL;
@@ -1199,11 +1485,13 @@ void usage(void)
     printf("uci2dat  -- a tool to translate uci config (/etc/config/wireless)\n");
     printf("            into ralink driver dat.\n");
     printf("\nUsage:\n");
-    printf("    uci2dat -d <dev-name> -f <dat-path>\n");
+    printf("    uci2dat -d <dev-name> -f <dat-path> [-a]\n");
 
     printf("\nArguments:\n");
     printf("    -d <dev-name>   device name, mt7620, eg.\n");
     printf("    -f <dat-path>   dat file path.\n");
+    printf("    -a              apply changes to a running driver with iwpriv,\n");
+    printf("                    exits non-zero if the interfaces need a reload.\n");
 
     printf("\nSupported keywords:\n");
     printf("     %-16s\t%-16s\t%s\n", "[uci-key]", "[dat-key]", "[default]");
@@ -1232,9 +1520,12 @@ int main(int argc, char ** argv)
     char * dev = NULL;
     char * dat = NULL;
     char olddat[128] = {0};
+    char newdat[128] = {0};
     int test = 0;
+    int apply = 0;
+    int ret = OK;
 
-    while ((opt = getopt (argc, argv, "htf:d:")) != -1)
+    while ((opt = getopt (argc, argv, "hatf:d:")) != -1)
     {
         switch (opt)
         {
@@ -1246,6 +1537,10 @@ int main(int argc, char ** argv)
                 dev = optarg;
                 printf("---- devname=\"%s\"\n", dev);
                 break;
+            case 'a':
+                apply = 1;
+                printf("---- APPLY MODE ----\n");
+                break;
             case 't':
                 test = 1;
                 printf("---- TEST MODE ----\n");
@@ -1336,13 +1631,25 @@ int main(int argc, char ** argv)
         __dump_all();
 
     }
+    else if(dev && dat && apply)
+    {
+        /* the dat always follows uci, whatever the driver could take */
+        snprintf(newdat, sizeof(newdat), "%s.new", dat);
+        gen_dat(dev, newdat);
+        ret = apply_dat(dev, dat, newdat);
+        if(0 != rename(newdat, dat))
+        {
+            printf("%s(), rename %s: %s\n", __FUNCTION__, newdat, strerror(errno));
+            ret = NG;
+        }
+    }
     else if(dev && dat)
         gen_dat(dev, dat);
     else
         usage();
 
     uci_unload(uci_ctx, uci_wireless);
-    return OK;
+    return ret;
 }
 
 
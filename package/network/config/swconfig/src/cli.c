@@ -109,9 +109,71 @@ print_attr_val(const struct switch_attr *attr, const struct switch_val *val)
 	}
 }
 
+static void
+free_attr_val(const struct switch_attr *attr, const struct switch_val *val)
+{
+	switch (attr->type) {
+	case SWITCH_TYPE_STRING:
+		free((void *) val->value.s);
+		break;
+	case SWITCH_TYPE_PORTS:
+		free(val->value.ports);
+		break;
+	}
+}
+
+/* fetch all attributes of a group with one batched request */
+static int
+show_attrs_batch(struct switch_dev *dev, struct switch_attr *attr, int port_vlan)
+{
+	struct switch_attr *a;
+	struct switch_val *vals;
+	int i, n = 0;
+
+	for (a = attr; a; a = a->next)
+		if (a->type != SWITCH_TYPE_NOVAL)
+			n++;
+
+	if (!n)
+		return 0;
+
+	vals = calloc(n, sizeof(*vals));
+	if (!vals)
+		return -1;
+
+	for (a = attr, i = 0; a; a = a->next) {
+		if (a->type == SWITCH_TYPE_NOVAL)
+			continue;
+		vals[i].attr = a;
+		vals[i].port_vlan = port_vlan;
+		i++;
+	}
+
+	if (swlib_get_attr_batch(dev, vals, n) < 0) {
+		free(vals);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		printf("\t%s: ", vals[i].attr->name);
+		if (vals[i].err < 0)
+			printf("???");
+		else
+			print_attr_val(vals[i].attr, &vals[i]);
+		putchar('\n');
+		free_attr_val(vals[i].attr, &vals[i]);
+	}
+	free(vals);
+
+	return 0;
+}
+
 static void
 show_attrs(struct switch_dev *dev, struct switch_attr *attr, struct switch_val *val)
 {
+	if (!show_attrs_batch(dev, attr, val->port_vlan))
+		return;
+
 	while (attr) {
 		if (attr->type != SWITCH_TYPE_NOVAL) {
 			printf("\t%s: ", attr->name);
@@ -165,6 +227,95 @@ show_vlan(struct switch_dev *dev, int vlan, bool all)
 	show_attrs(dev, dev->vlan_ops, &val);
 }
 
+/* show all vlans that have member ports, looking them up in one go */
+static void
+show_vlans(struct switch_dev *dev)
+{
+	struct switch_attr *attr;
+	struct switch_val *vals;
+	int i;
+
+	attr = swlib_lookup_attr(dev, SWLIB_ATTR_GROUP_VLAN, "ports");
+	vals = calloc(dev->vlans, sizeof(*vals));
+	if (!attr || !vals)
+		goto fallback;
+
+	for (i = 0; i < dev->vlans; i++) {
+		vals[i].attr = attr;
+		vals[i].port_vlan = i;
+	}
+
+	if (swlib_get_attr_batch(dev, vals, dev->vlans) < 0)
+		goto fallback;
+
+	for (i = 0; i < dev->vlans; i++) {
+		if (!vals[i].err && vals[i].len)
+			show_vlan(dev, i, false);
+		free(vals[i].value.ports);
+	}
+	free(vals);
+	return;
+
+fallback:
+	free(vals);
+	for (i = 0; i < dev->vlans; i++)
+		show_vlan(dev, i, true);
+}
+
+struct show_all_arg {
+	int group;
+	int port_vlan;
+	int shown;
+};
+
+static int
+show_all_val(struct switch_attr *attr, struct switch_val *val, void *arg)
+{
+	struct show_all_arg *s = arg;
+
+	if (!s->shown) {
+		printf("Global attributes:\n");
+		s->group = SWLIB_ATTR_GROUP_GLOBAL;
+		s->port_vlan = 0;
+	}
+
+	if (attr->atype != s->group || val->port_vlan != s->port_vlan) {
+		if (attr->atype == SWLIB_ATTR_GROUP_PORT)
+			printf("Port %d:\n", val->port_vlan);
+		else if (attr->atype == SWLIB_ATTR_GROUP_VLAN)
+			printf("VLAN %d:\n", val->port_vlan);
+		s->group = attr->atype;
+		s->port_vlan = val->port_vlan;
+	}
+	s->shown++;
+
+	printf("\t%s: ", attr->name);
+	if (val->err < 0)
+		printf("???");
+	else
+		print_attr_val(attr, val);
+	putchar('\n');
+
+	return 0;
+}
+
+/* show everything with a single dump of all values if the kernel has it */
+static void
+show_all(struct switch_dev *dev)
+{
+	struct show_all_arg arg;
+	int i;
+
+	memset(&arg, 0, sizeof(arg));
+	if (!swlib_dump_values(dev, show_all_val, &arg) || arg.shown)
+		return;
+
+	show_global(dev);
+	for (i=0; i < dev->ports; i++)
+		show_port(dev, i);
+	show_vlans(dev);
+}
+
 static void
 print_usage(void)
 {
@@ -339,11 +490,7 @@ int main(int argc, char **argv)
 			else
 				show_vlan(dev, cvlan, false);
 		} else {
-			show_global(dev);
-			for (i=0; i < dev->ports; i++)
-				show_port(dev, i);
-			for (i=0; i < dev->vlans; i++)
-				show_vlan(dev, i, true);
+			show_all(dev);
 		}
 		break;
 	}
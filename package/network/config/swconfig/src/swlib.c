@@ -28,6 +28,9 @@
 #include <netlink/genl/genl.h>
 #include <netlink/genl/family.h>
 
+/* size of the messages used for batched requests */
+#define SWLIB_BATCH_MSG_SIZE	16384
+
 //#define DEBUG 1
 #ifdef DEBUG
 #define DPRINTF(fmt, ...) fprintf(stderr, "%s(%d): " fmt, __func__, __LINE__, ##__VA_ARGS__)
@@ -36,7 +39,6 @@
 #endif
 
 static struct nl_sock *handle;
-static struct nl_cache *cache;
 static struct genl_family *family;
 static struct nlattr *tb[SWITCH_ATTR_MAX + 1];
 static int refcount = 0;
@@ -76,24 +78,23 @@ wait_handler(struct nl_msg *msg, void *arg)
 
 /* helper function for performing netlink requests */
 static int
-swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
-		int (*data)(struct nl_msg *, void *), void *arg)
+__swlib_call(int cmd, int flags, int (*call)(struct nl_msg *, void *),
+		int (*data)(struct nl_msg *, void *), void *arg, size_t size)
 {
 	struct nl_msg *msg;
 	struct nl_cb *cb = NULL;
 	int finished;
-	int flags = 0;
-	int err;
+	int err = -1;
 
-	msg = nlmsg_alloc();
+	if (size)
+		msg = nlmsg_alloc_size(size);
+	else
+		msg = nlmsg_alloc();
 	if (!msg) {
 		fprintf(stderr, "Out of memory!\n");
 		exit(1);
 	}
 
-	if (!data)
-		flags |= NLM_F_DUMP;
-
 	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, genl_family_get_id(family), 0, flags, cmd, 0);
 	if (data) {
 		if (data(msg, arg) < 0)
@@ -117,10 +118,10 @@ swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
 	if (call)
 		nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, call, arg);
 
-	if (data)
-		nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, wait_handler, &finished);
-	else
+	if (flags & NLM_F_DUMP)
 		nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, wait_handler, &finished);
+	else
+		nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, wait_handler, &finished);
 
 	err = nl_recvmsgs(handle, cb);
 	if (err < 0) {
@@ -139,12 +140,17 @@ nla_put_failure:
 }
 
 static int
-send_attr(struct nl_msg *msg, void *arg)
+swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
+		int (*data)(struct nl_msg *, void *), void *arg)
+{
+	return __swlib_call(cmd, data ? 0 : NLM_F_DUMP, call, data, arg, 0);
+}
+
+static int
+put_attr_op(struct nl_msg *msg, struct switch_val *val)
 {
-	struct switch_val *val = arg;
 	struct switch_attr *attr = val->attr;
 
-	NLA_PUT_U32(msg, SWITCH_ATTR_ID, attr->dev->id);
 	NLA_PUT_U32(msg, SWITCH_ATTR_OP_ID, attr->id);
 	switch(attr->atype) {
 	case SWLIB_ATTR_GROUP_PORT:
@@ -163,6 +169,19 @@ nla_put_failure:
 	return -1;
 }
 
+static int
+send_attr(struct nl_msg *msg, void *arg)
+{
+	struct switch_val *val = arg;
+
+	NLA_PUT_U32(msg, SWITCH_ATTR_ID, val->attr->dev->id);
+
+	return put_attr_op(msg, val);
+
+nla_put_failure:
+	return -1;
+}
+
 static int
 store_port_val(struct nl_msg *msg, struct nlattr *nla, struct switch_val *val)
 {
@@ -295,14 +314,10 @@ nla_put_failure:
 }
 
 static int
-send_attr_val(struct nl_msg *msg, void *arg)
+put_attr_value(struct nl_msg *msg, struct switch_val *val)
 {
-	struct switch_val *val = arg;
 	struct switch_attr *attr = val->attr;
 
-	if (send_attr(msg, arg))
-		goto nla_put_failure;
-
 	switch(attr->type) {
 	case SWITCH_TYPE_NOVAL:
 		break;
@@ -327,6 +342,17 @@ nla_put_failure:
 	return -1;
 }
 
+static int
+send_attr_val(struct nl_msg *msg, void *arg)
+{
+	struct switch_val *val = arg;
+
+	if (send_attr(msg, arg))
+		return -1;
+
+	return put_attr_value(msg, val);
+}
+
 int
 swlib_set_attr(struct switch_dev *dev, struct switch_attr *attr, struct switch_val *val)
 {
@@ -350,25 +376,29 @@ swlib_set_attr(struct switch_dev *dev, struct switch_attr *attr, struct switch_v
 	return swlib_call(cmd, NULL, send_attr_val, val);
 }
 
-int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int port_vlan, const char *str)
+int swlib_parse_attr_string(struct switch_dev *dev, struct switch_attr *a, int port_vlan, const char *str, struct switch_val *val)
 {
 	struct switch_port *ports;
-	struct switch_val val;
 	char *ptr;
 
-	memset(&val, 0, sizeof(val));
-	val.port_vlan = port_vlan;
+	val->attr = a;
+	val->port_vlan = port_vlan;
 	switch(a->type) {
 	case SWITCH_TYPE_INT:
-		val.value.i = atoi(str);
+		val->value.i = atoi(str);
 		break;
 	case SWITCH_TYPE_STRING:
-		val.value.s = str;
+		val->value.s = str;
 		break;
 	case SWITCH_TYPE_PORTS:
-		ports = alloca(sizeof(struct switch_port) * dev->ports);
+		ports = val->value.ports;
+		if (!ports)
+			ports = malloc(sizeof(struct switch_port) * dev->ports);
+		if (!ports)
+			return -1;
+		val->value.ports = ports;
 		memset(ports, 0, sizeof(struct switch_port) * dev->ports);
-		val.len = 0;
+		val->len = 0;
 		ptr = (char *)str;
 		while(ptr && *ptr)
 		{
@@ -381,14 +411,14 @@ int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int por
 			if (!isdigit(*ptr))
 				return -1;
 
-			if (val.len >= dev->ports)
+			if (val->len >= dev->ports)
 				return -1;
 
-			ports[val.len].flags = 0;
-			ports[val.len].id = strtoul(ptr, &ptr, 10);
+			ports[val->len].flags = 0;
+			ports[val->len].id = strtoul(ptr, &ptr, 10);
 			while(*ptr && !isspace(*ptr)) {
 				if (*ptr == 't')
-					ports[val.len].flags |= SWLIB_PORT_FLAG_TAGGED;
+					ports[val->len].flags |= SWLIB_PORT_FLAG_TAGGED;
 				else
 					return -1;
 
@@ -396,21 +426,330 @@ int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int por
 			}
 			if (*ptr)
 				ptr++;
-			val.len++;
+			val->len++;
 		}
-		val.value.ports = ports;
 		break;
 	case SWITCH_TYPE_NOVAL:
 		if (str && !strcmp(str, "0"))
-			return 0;
+			return 1;
 
 		break;
 	default:
 		return -1;
 	}
+	return 0;
+}
+
+int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int port_vlan, const char *str)
+{
+	struct switch_val val;
+	int ret;
+
+	memset(&val, 0, sizeof(val));
+	if (a->type == SWITCH_TYPE_PORTS)
+		val.value.ports = alloca(sizeof(struct switch_port) * dev->ports);
+
+	ret = swlib_parse_attr_string(dev, a, port_vlan, str, &val);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	return swlib_set_attr(dev, a, &val);
 }
 
+struct batch_arg {
+	struct switch_dev *dev;
+	struct switch_val *vals;
+	int n;
+	int start;	/* first entry of the current message */
+	int end;	/* one past the last entry that fit into it */
+	int cur;	/* next entry to receive a reply */
+	int set;
+};
+
+static int
+swlib_has_batch(void)
+{
+	return genl_family_get_version(family) >= SWITCH_BATCH_VERSION;
+}
+
+static int
+swlib_group(int atype)
+{
+	switch(atype) {
+	case SWLIB_ATTR_GROUP_PORT:
+		return SWITCH_GROUP_PORT;
+	case SWLIB_ATTR_GROUP_VLAN:
+		return SWITCH_GROUP_VLAN;
+	default:
+		return SWITCH_GROUP_GLOBAL;
+	}
+}
+
+static int
+put_batch_op(struct nl_msg *msg, struct switch_val *val, int set)
+{
+	struct nlattr *n;
+
+	n = nla_nest_start(msg, SWITCH_ATTR_OP);
+	if (!n)
+		goto nla_put_failure;
+
+	NLA_PUT_U32(msg, SWITCH_ATTR_OP_GROUP, swlib_group(val->attr->atype));
+	if (put_attr_op(msg, val) < 0)
+		goto nla_put_failure;
+	if (set && put_attr_value(msg, val) < 0)
+		goto nla_put_failure;
+
+	nla_nest_end(msg, n);
+	return 0;
+
+nla_put_failure:
+	return -1;
+}
+
+/* pack as many entries as fit, the rest go out in the next message */
+static int
+send_batch(struct nl_msg *msg, void *arg)
+{
+	struct batch_arg *b = arg;
+	struct nlattr *n;
+	int i;
+
+	NLA_PUT_U32(msg, SWITCH_ATTR_ID, b->dev->id);
+	n = nla_nest_start(msg, SWITCH_ATTR_OP_LIST);
+	if (!n)
+		goto nla_put_failure;
+
+	for (i = b->start; i < b->n; i++) {
+		uint32_t len = nlmsg_hdr(msg)->nlmsg_len;
+
+		if (put_batch_op(msg, &b->vals[i], b->set) < 0) {
+			/* drop the partial entry */
+			nlmsg_hdr(msg)->nlmsg_len = len;
+			break;
+		}
+	}
+	if (i == b->start)
+		goto nla_put_failure;
+
+	nla_nest_end(msg, n);
+	b->end = i;
+	return 0;
+
+nla_put_failure:
+	return -1;
+}
+
+static int
+store_batch_val(struct nl_msg *msg, void *arg)
+{
+	struct batch_arg *b = arg;
+	struct switch_val *val;
+
+	if (b->cur >= b->end)
+		return NL_SKIP;
+
+	val = &b->vals[b->cur++];
+	store_val(msg, val);
+	if (tb[SWITCH_ATTR_OP_ERROR])
+		val->err = -nla_get_u32(tb[SWITCH_ATTR_OP_ERROR]);
+
+	return NL_SKIP;
+}
+
+static int
+swlib_call_batch(struct switch_dev *dev, struct switch_val *vals, int n, int set)
+{
+	struct batch_arg b;
+	int ret = 0;
+	int err;
+
+	memset(&b, 0, sizeof(b));
+	b.dev = dev;
+	b.vals = vals;
+	b.n = n;
+	b.set = set;
+
+	while (b.start < n) {
+		b.end = b.start;
+		b.cur = b.start;
+		if (set)
+			err = __swlib_call(SWITCH_CMD_SET_BATCH, 0, NULL,
+				send_batch, &b, SWLIB_BATCH_MSG_SIZE);
+		else
+			err = __swlib_call(SWITCH_CMD_GET_BATCH, 0, store_batch_val,
+				send_batch, &b, SWLIB_BATCH_MSG_SIZE);
+		if (b.end == b.start)
+			return err ? err : -1;
+		if (err && !ret)
+			ret = err;
+		b.start = b.end;
+	}
+
+	return ret;
+}
+
+int
+swlib_set_attr_batch(struct switch_dev *dev, struct switch_val *vals, int n)
+{
+	int ret = 0;
+	int err;
+	int i;
+
+	if (swlib_has_batch())
+		return swlib_call_batch(dev, vals, n, 1);
+
+	for (i = 0; i < n; i++) {
+		err = swlib_set_attr(dev, vals[i].attr, &vals[i]);
+		if (err && !ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+int
+swlib_get_attr_batch(struct switch_dev *dev, struct switch_val *vals, int n)
+{
+	int i;
+
+	if (!swlib_has_batch()) {
+		for (i = 0; i < n; i++)
+			vals[i].err = swlib_get_attr(dev, vals[i].attr, &vals[i]);
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		memset(&vals[i].value, 0, sizeof(vals[i].value));
+		vals[i].len = 0;
+		vals[i].err = -EINVAL;
+	}
+
+	return swlib_call_batch(dev, vals, n, 0);
+}
+
+struct dump_arg {
+	struct switch_dev *dev;
+	struct switch_val val;
+	int (*cb)(struct switch_attr *attr, struct switch_val *val, void *arg);
+	void *arg;
+	int ret;
+};
+
+static struct switch_attr *
+swlib_find_attr_id(struct switch_dev *dev, int group, int id)
+{
+	struct switch_attr *a;
+
+	switch(group) {
+	case SWITCH_GROUP_PORT:
+		a = dev->port_ops;
+		break;
+	case SWITCH_GROUP_VLAN:
+		a = dev->vlan_ops;
+		break;
+	default:
+		a = dev->ops;
+		break;
+	}
+
+	for (; a; a = a->next)
+		if (a->id == id)
+			return a;
+
+	return NULL;
+}
+
+static int
+send_dump(struct nl_msg *msg, void *arg)
+{
+	struct dump_arg *d = arg;
+
+	NLA_PUT_U32(msg, SWITCH_ATTR_ID, d->dev->id);
+
+	return 0;
+
+nla_put_failure:
+	return -1;
+}
+
+static int
+store_dump_val(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct dump_arg *d = arg;
+	struct switch_val *val = &d->val;
+	struct switch_port *ports = val->value.ports;
+	struct switch_attr *attr;
+	int group = SWITCH_GROUP_GLOBAL;
+
+	if (d->ret)
+		return NL_SKIP;
+
+	if (nla_parse(tb, SWITCH_ATTR_MAX - 1, genlmsg_attrdata(gnlh, 0),
+			genlmsg_attrlen(gnlh, 0), NULL) < 0)
+		return NL_SKIP;
+
+	if (!tb[SWITCH_ATTR_OP_ID])
+		return NL_SKIP;
+
+	if (tb[SWITCH_ATTR_OP_GROUP])
+		group = nla_get_u32(tb[SWITCH_ATTR_OP_GROUP]);
+
+	attr = swlib_find_attr_id(d->dev, group,
+		nla_get_u32(tb[SWITCH_ATTR_OP_ID]));
+	if (!attr)
+		return NL_SKIP;
+
+	/* the port buffer is shared by all entries of the dump */
+	memset(val, 0, sizeof(*val));
+	val->attr = attr;
+	if (attr->type == SWITCH_TYPE_PORTS)
+		val->value.ports = ports;
+	if (tb[SWITCH_ATTR_OP_PORT])
+		val->port_vlan = nla_get_u32(tb[SWITCH_ATTR_OP_PORT]);
+	else if (tb[SWITCH_ATTR_OP_VLAN])
+		val->port_vlan = nla_get_u32(tb[SWITCH_ATTR_OP_VLAN]);
+
+	store_val(msg, val);
+	if (tb[SWITCH_ATTR_OP_ERROR])
+		val->err = -nla_get_u32(tb[SWITCH_ATTR_OP_ERROR]);
+
+	d->ret = d->cb(attr, val, d->arg);
+
+	if (attr->type == SWITCH_TYPE_STRING && val->value.s)
+		free((void *) val->value.s);
+	val->value.ports = ports;
+
+	return NL_SKIP;
+}
+
+int
+swlib_dump_values(struct switch_dev *dev,
+		int (*cb)(struct switch_attr *attr, struct switch_val *val, void *arg),
+		void *arg)
+{
+	struct dump_arg d;
+	int err;
+
+	if (genl_family_get_version(family) < SWITCH_DUMP_VERSION)
+		return -EOPNOTSUPP;
+
+	memset(&d, 0, sizeof(d));
+	d.dev = dev;
+	d.cb = cb;
+	d.arg = arg;
+	d.val.value.ports = malloc(sizeof(struct switch_port) * dev->ports);
+	if (!d.val.value.ports)
+		return -ENOMEM;
+
+	err = __swlib_call(SWITCH_CMD_DUMP_VALUES, NLM_F_DUMP, store_dump_val,
+		send_dump, &d, 0);
+	free(d.val.value.ports);
+
+	return err ? err : d.ret;
+}
+
 
 struct attrlist_arg {
 	int id;
@@ -470,6 +809,57 @@ done:
 	return NL_SKIP;
 }
 
+/* name index over the attributes of all groups, kept in dev->priv */
+#define SWLIB_ATTR_HASH_SIZE	32
+
+struct swlib_attr_hash {
+	struct switch_attr *bucket[3][SWLIB_ATTR_HASH_SIZE];
+};
+
+static unsigned int
+swlib_hash_name(const char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char) *name++;
+
+	return h % SWLIB_ATTR_HASH_SIZE;
+}
+
+static void
+swlib_hash_list(struct switch_attr **bucket, struct switch_attr *a)
+{
+	for (; a; a = a->next) {
+		struct switch_attr **b;
+
+		if (!a->name)
+			continue;
+
+		/* keep list order within a bucket, first match wins */
+		b = &bucket[swlib_hash_name(a->name)];
+		while (*b)
+			b = &(*b)->hash_next;
+		a->hash_next = NULL;
+		*b = a;
+	}
+}
+
+static void
+swlib_hash_attrs(struct switch_dev *dev)
+{
+	struct swlib_attr_hash *h;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return;
+
+	swlib_hash_list(h->bucket[SWLIB_ATTR_GROUP_GLOBAL], dev->ops);
+	swlib_hash_list(h->bucket[SWLIB_ATTR_GROUP_PORT], dev->port_ops);
+	swlib_hash_list(h->bucket[SWLIB_ATTR_GROUP_VLAN], dev->vlan_ops);
+	dev->priv = h;
+}
+
 int
 swlib_scan(struct switch_dev *dev)
 {
@@ -495,17 +885,30 @@ swlib_scan(struct switch_dev *dev)
 	arg.head = &dev->vlan_ops;
 	swlib_call(SWITCH_CMD_LIST_VLAN, add_attr, add_id, &arg);
 
+	swlib_hash_attrs(dev);
+
 	return 0;
 }
 
 struct switch_attr *swlib_lookup_attr(struct switch_dev *dev,
 		enum swlib_attr_group atype, const char *name)
 {
+	struct swlib_attr_hash *h;
 	struct switch_attr *head;
 
 	if (!name || !dev)
 		return NULL;
 
+	h = dev->priv;
+	if (h && atype <= SWLIB_ATTR_GROUP_PORT) {
+		head = h->bucket[atype][swlib_hash_name(name)];
+		for (; head; head = head->hash_next)
+			if (!strcmp(name, head->name))
+				return head;
+
+		return NULL;
+	}
+
 	switch(atype) {
 	case SWLIB_ATTR_GROUP_GLOBAL:
 		head = dev->ops;
@@ -529,19 +932,17 @@ struct switch_attr *swlib_lookup_attr(struct switch_dev *dev,
 static void
 swlib_priv_free(void)
 {
-	if (cache)
-		nl_cache_free(cache);
+	if (family)
+		genl_family_put(family);
 	if (handle)
 		nl_socket_free(handle);
 	handle = NULL;
-	cache = NULL;
+	family = NULL;
 }
 
 static int
 swlib_priv_init(void)
 {
-	int ret;
-
 	handle = nl_socket_alloc();
 	if (!handle) {
 		DPRINTF("Failed to create handle\n");
@@ -553,13 +954,7 @@ swlib_priv_init(void)
 		goto err;
 	}
 
-	ret = genl_ctrl_alloc_cache(handle, &cache);
-	if (ret < 0) {
-		DPRINTF("Failed to allocate netlink cache\n");
-		goto err;
-	}
-
-	family = genl_ctrl_search_by_name(cache, "switch");
+	family = genl_ctrl_probe_by_name(handle, "switch");
 	if (!family) {
 		DPRINTF("Switch API not present\n");
 		goto err;
@@ -761,6 +1156,7 @@ swlib_free(struct switch_dev *dev)
 	swlib_free_attributes(&dev->ops);
 	swlib_free_attributes(&dev->port_ops);
 	swlib_free_attributes(&dev->vlan_ops);
+	free(dev->priv);
 	free(dev);
 
 	if (--refcount == 0)
@@ -149,6 +149,7 @@ struct switch_attr {
 	const char *name;
 	const char *description;
 	struct switch_attr *next;
+	struct switch_attr *hash_next;
 };
 
 struct switch_port {
@@ -231,6 +232,58 @@ int swlib_set_attr(struct switch_dev *dev, struct switch_attr *attr,
 int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *attr,
 		int port_vlan, const char *str);
 
+/**
+ * swlib_parse_attr_string: convert a string into an attribute value
+ * @dev: switch device struct
+ * @attr: switch attribute struct
+ * @port_vlan: port or vlan (if applicable)
+ * @str: string value
+ * @val: attribute value pointer, filled in
+ * returns 0 on success, 1 if there is nothing to set
+ * for port list attributes, val->value.ports is allocated with malloc()
+ * unless it already points to a buffer of dev->ports entries
+ */
+int swlib_parse_attr_string(struct switch_dev *dev, struct switch_attr *attr,
+		int port_vlan, const char *str, struct switch_val *val);
+
+/**
+ * swlib_set_attr_batch: set the values for a list of attributes
+ * @dev: switch device struct
+ * @vals: array of attribute values, each with ->attr set
+ * @n: number of entries
+ * returns 0 on success, or the first error
+ * entries are applied in order with as few requests as possible;
+ * all of them are tried even if one of them fails
+ */
+int swlib_set_attr_batch(struct switch_dev *dev, struct switch_val *vals,
+		int n);
+
+/**
+ * swlib_get_attr_batch: get the values for a list of attributes
+ * @dev: switch device struct
+ * @vals: array of attribute values, each with ->attr and ->port_vlan set
+ * @n: number of entries
+ * returns 0 if the request went through, the result of each entry
+ * is stored in its ->err member
+ * string and port list results must be freed by the caller
+ */
+int swlib_get_attr_batch(struct switch_dev *dev, struct switch_val *vals,
+		int n);
+
+/**
+ * swlib_dump_values: get the values of all attributes in one request
+ * @dev: switch device struct
+ * @cb: called for each value, in the order global, port, vlan
+ * @arg: passed to @cb
+ * returns 0 on success, or the first non-zero result of @cb
+ * the value passed to @cb, including strings and port lists, is only
+ * valid for the duration of the call; vlans without member ports are
+ * left out
+ */
+int swlib_dump_values(struct switch_dev *dev,
+		int (*cb)(struct switch_attr *attr, struct switch_val *val, void *arg),
+		void *arg);
+
 /**
  * swlib_get_attr: get the value for an attribute
  * @dev: switch device struct
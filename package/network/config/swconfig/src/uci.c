@@ -105,6 +105,20 @@ skip:
 	}
 }
 
+static int
+swlib_add_setting(struct switch_dev *dev, struct switch_val *val,
+		  struct swlib_setting *st)
+{
+	memset(val, 0, sizeof(*val));
+	if (swlib_parse_attr_string(dev, st->attr, st->port_vlan, st->val, val) == 0)
+		return 1;
+
+	if (st->attr->type == SWITCH_TYPE_PORTS)
+		free(val->value.ports);
+
+	return 0;
+}
+
 int swlib_apply_from_uci(struct switch_dev *dev, struct uci_package *p)
 {
 	struct switch_attr *attr;
@@ -112,8 +126,9 @@ int swlib_apply_from_uci(struct switch_dev *dev, struct uci_package *p)
 	struct uci_section *s;
 	struct uci_option *o;
 	struct uci_ptr ptr;
-	struct switch_val val;
-	int i;
+	struct swlib_setting *st;
+	struct switch_val *vals;
+	int i, n;
 
 	settings = NULL;
 	head = &settings;
@@ -217,18 +232,28 @@ found:
 		}
 	}
 
+	/* early settings, the others and the final apply go out as a
+	 * single batch, in that order */
+	n = ARRAY_SIZE(early_settings) + 1;
+	for (st = settings; st; st = st->next)
+		n++;
+
+	vals = calloc(n, sizeof(*vals));
+	if (!vals)
+		return -1;
+
+	n = 0;
 	for (i = 0; i < ARRAY_SIZE(early_settings); i++) {
-		struct swlib_setting *st = &early_settings[i];
+		st = &early_settings[i];
 		if (!st->attr || !st->val)
 			continue;
-		swlib_set_attr_string(dev, st->attr, st->port_vlan, st->val);
-
+		n += swlib_add_setting(dev, &vals[n], st);
 	}
 
 	while (settings) {
-		struct swlib_setting *st = settings;
+		st = settings;
 
-		swlib_set_attr_string(dev, st->attr, st->port_vlan, st->val);
+		n += swlib_add_setting(dev, &vals[n], st);
 		st = st->next;
 		free(settings);
 		settings = st;
@@ -236,11 +261,15 @@ found:
 
 	/* Apply the config */
 	attr = swlib_lookup_attr(dev, SWLIB_ATTR_GROUP_GLOBAL, "apply");
-	if (!attr)
-		return 0;
+	if (attr)
+		vals[n++].attr = attr;
+
+	swlib_set_attr_batch(dev, vals, n);
 
-	memset(&val, 0, sizeof(val));
-	swlib_set_attr(dev, attr, &val);
+	for (i = 0; i < n; i++)
+		if (vals[i].attr->type == SWITCH_TYPE_PORTS)
+			free(vals[i].value.ports);
+	free(vals);
 
 	return 0;
 }
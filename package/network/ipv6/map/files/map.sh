@@ -56,7 +56,7 @@ proto_map_setup() {
 	fi
 
 	echo "rule=$rule" > /tmp/map-$cfg.rules
-	RULE_DATA=$(mapcalc ${tunlink:-\*} $rule)
+	RULE_DATA=$(mapcalc -c /tmp/map-$cfg.cache ${tunlink:-\*} $rule)
 	if [ "$?" != 0 ]; then
 		proto_notify_error "$cfg" "INVALID_MAP_RULE"
 		proto_block_restart "$cfg"
@@ -72,27 +72,36 @@ proto_map_setup() {
 		return
 	fi
 
-	k=$RULE_BMR
+	# the RULE_<n>_* values are copied with eval assignments, one subshell
+	# per value adds up with many rules and port sets
+	local k=$RULE_BMR
+	local ipv4addr ipv6addr br pd6iface dmr portsets
+	local ipv4prefix prefix4len ipv6prefix prefix6len rule_ealen rule_offset
+	eval "ipv4addr=\$RULE_${k}_IPV4ADDR ipv6addr=\$RULE_${k}_IPV6ADDR br=\$RULE_${k}_BR"
+	eval "pd6iface=\$RULE_${k}_PD6IFACE dmr=\$RULE_${k}_DMR portsets=\$RULE_${k}_PORTSETS"
+
 	if [ "$type" = "lw4o6" -o "$type" = "map-e" ]; then
 		proto_init_update "$link" 1
-		proto_add_ipv4_address $(eval "echo \$RULE_${k}_IPV4ADDR") "" "" ""
+		proto_add_ipv4_address $ipv4addr "" "" ""
 
 		proto_add_tunnel
 		json_add_string mode ipip6
 		json_add_int mtu "${mtu:-1280}"
 		json_add_int ttl "${ttl:-64}"
-		json_add_string local $(eval "echo \$RULE_${k}_IPV6ADDR")
-		json_add_string remote $(eval "echo \$RULE_${k}_BR")
-		json_add_string link $(eval "echo \$RULE_${k}_PD6IFACE")
+		json_add_string local $ipv6addr
+		json_add_string remote $br
+		json_add_string link $pd6iface
 
 		if [ "$type" = "map-e" ]; then
 			json_add_array "fmrs"
-				for i in $(seq $RULE_COUNT); do
-					[ "$(eval "echo \$RULE_${i}_FMR")" != 1 ] && continue
-					fmr="$(eval "echo \$RULE_${i}_IPV6PREFIX")/$(eval "echo \$RULE_${i}_PREFIX6LEN")"
-					fmr="$fmr,$(eval "echo \$RULE_${i}_IPV4PREFIX")/$(eval "echo \$RULE_${i}_PREFIX4LEN")"
-					fmr="$fmr,$(eval "echo \$RULE_${i}_EALEN"),$(eval "echo \$RULE_${i}_OFFSET")"
-					json_add_string "" "$fmr"
+				i=0
+				while [ $((i += 1)) -le $RULE_COUNT ]; do
+					eval "fmr=\$RULE_${i}_FMR"
+					[ "$fmr" != 1 ] && continue
+					eval "ipv6prefix=\$RULE_${i}_IPV6PREFIX prefix6len=\$RULE_${i}_PREFIX6LEN"
+					eval "ipv4prefix=\$RULE_${i}_IPV4PREFIX prefix4len=\$RULE_${i}_PREFIX4LEN"
+					eval "rule_ealen=\$RULE_${i}_EALEN rule_offset=\$RULE_${i}_OFFSET"
+					json_add_string "" "$ipv6prefix/$prefix6len,$ipv4prefix/$prefix4len,$rule_ealen,$rule_offset"
 				done
 			json_close_array
 		fi
@@ -104,17 +113,25 @@ proto_map_setup() {
 		[ "$LEGACY" = 1 ] && style="MAP0"
 
 		echo add $link > /proc/net/nat46/control
-		local cfgstr="local.style $style local.v4 $(eval "echo \$RULE_${k}_IPV4PREFIX")/$(eval "echo \$RULE_${k}_PREFIX4LEN")"
-		cfgstr="$cfgstr local.v6 $(eval "echo \$RULE_${k}_IPV6PREFIX")/$(eval "echo \$RULE_${k}_PREFIX6LEN")"
-		cfgstr="$cfgstr local.ea-len $(eval "echo \$RULE_${k}_EALEN") local.psid-offset $(eval "echo \$RULE_${k}_OFFSET")"
-		cfgstr="$cfgstr remote.v4 0.0.0.0/0 remote.v6 $(eval "echo \$RULE_${k}_DMR") remote.style RFC6052 remote.ea-len 0 remote.psid-offset 0"
+		eval "ipv6prefix=\$RULE_${k}_IPV6PREFIX prefix6len=\$RULE_${k}_PREFIX6LEN"
+		eval "ipv4prefix=\$RULE_${k}_IPV4PREFIX prefix4len=\$RULE_${k}_PREFIX4LEN"
+		eval "rule_ealen=\$RULE_${k}_EALEN rule_offset=\$RULE_${k}_OFFSET"
+		local cfgstr="local.style $style local.v4 $ipv4prefix/$prefix4len"
+		cfgstr="$cfgstr local.v6 $ipv6prefix/$prefix6len"
+		cfgstr="$cfgstr local.ea-len $rule_ealen local.psid-offset $rule_offset"
+		cfgstr="$cfgstr remote.v4 0.0.0.0/0 remote.v6 $dmr remote.style RFC6052 remote.ea-len 0 remote.psid-offset 0"
 		echo config $link $cfgstr > /proc/net/nat46/control
 
-		for i in $(seq $RULE_COUNT); do
-			[ "$(eval "echo \$RULE_${i}_FMR")" != 1 ] && continue
-			local cfgstr="remote.style $style remote.v4 $(eval "echo \$RULE_${i}_IPV4PREFIX")/$(eval "echo \$RULE_${i}_PREFIX4LEN")"
-			cfgstr="$cfgstr remote.v6 $(eval "echo \$RULE_${i}_IPV6PREFIX")/$(eval "echo \$RULE_${i}_PREFIX6LEN")"
-			cfgstr="$cfgstr remote.ea-len $(eval "echo \$RULE_${i}_EALEN") remote.psid-offset $(eval "echo \$RULE_${i}_OFFSET")"
+		i=0
+		while [ $((i += 1)) -le $RULE_COUNT ]; do
+			eval "fmr=\$RULE_${i}_FMR"
+			[ "$fmr" != 1 ] && continue
+			eval "ipv6prefix=\$RULE_${i}_IPV6PREFIX prefix6len=\$RULE_${i}_PREFIX6LEN"
+			eval "ipv4prefix=\$RULE_${i}_IPV4PREFIX prefix4len=\$RULE_${i}_PREFIX4LEN"
+			eval "rule_ealen=\$RULE_${i}_EALEN rule_offset=\$RULE_${i}_OFFSET"
+			local cfgstr="remote.style $style remote.v4 $ipv4prefix/$prefix4len"
+			cfgstr="$cfgstr remote.v6 $ipv6prefix/$prefix6len"
+			cfgstr="$cfgstr remote.ea-len $rule_ealen remote.psid-offset $rule_offset"
 			echo insert $link $cfgstr > /proc/net/nat46/control
 		done
 	else
@@ -127,15 +144,15 @@ proto_map_setup() {
 	[ "$zone" != "-" ] && json_add_string zone "$zone"
 
 	json_add_array firewall
-	  if [ -z "$(eval "echo \$RULE_${k}_PORTSETS")" ]; then
+	  if [ -z "$portsets" ]; then
 	    json_add_object ""
 	      json_add_string type nat
 	      json_add_string target SNAT
 	      json_add_string family inet
-	      json_add_string snat_ip $(eval "echo \$RULE_${k}_IPV4ADDR")
+	      json_add_string snat_ip $ipv4addr
 	    json_close_object
 	  else
-	    for portset in $(eval "echo \$RULE_${k}_PORTSETS"); do
+	    for portset in $portsets; do
               for proto in icmp tcp udp; do
 	        json_add_object ""
 	          json_add_string type nat
@@ -143,7 +160,7 @@ proto_map_setup() {
 	          json_add_string family inet
 	          json_add_string proto "$proto"
                   json_add_boolean connlimit_ports 1
-                  json_add_string snat_ip $(eval "echo \$RULE_${k}_IPV4ADDR")
+                  json_add_string snat_ip $ipv4addr
                   json_add_string snat_port "$portset"
 	        json_close_object
               done
@@ -157,7 +174,7 @@ proto_map_setup() {
 	  		json_add_string direction in
 			json_add_string dest "$zone"
 			json_add_string src "$zone"
-	  		json_add_string src_ip $(eval "echo \$RULE_${k}_IPV6ADDR")
+	  		json_add_string src_ip $ipv6addr
 	  		json_add_string target ACCEPT
 	  	json_close_object
 	  	json_add_object ""
@@ -167,10 +184,10 @@ proto_map_setup() {
 	  		json_add_string direction out
 			json_add_string dest "$zone"
 			json_add_string src "$zone"
-	  		json_add_string dest_ip $(eval "echo \$RULE_${k}_IPV6ADDR")
+	  		json_add_string dest_ip $ipv6addr
 	  		json_add_string target ACCEPT
 	  	json_close_object
-		proto_add_ipv6_route $(eval "echo \$RULE_${k}_IPV6ADDR") 128
+		proto_add_ipv6_route $ipv6addr 128
 	  fi
 	json_close_array
 	proto_close_data
@@ -180,10 +197,10 @@ proto_map_setup() {
 	if [ "$type" = "lw4o6" -o "$type" = "map-e" ]; then
 		json_init
 		json_add_string name "${cfg}_"
-		json_add_string ifname "@$(eval "echo \$RULE_${k}_PD6IFACE")"
+		json_add_string ifname "@$pd6iface"
 		json_add_string proto "static"
 		json_add_array ip6addr
-		json_add_string "" "$(eval "echo \$RULE_${k}_IPV6ADDR")"
+		json_add_string "" "$ipv6addr"
 		json_close_array
 		json_close_object
 		ubus call network add_dynamic "$(json_dump)"
@@ -16,13 +16,17 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <libubus.h>
 #include <libubox/utils.h>
+#include <libubox/md5.h>
 
 
 struct blob_attr *dump = NULL;
+static FILE *cache_out = NULL;
 
 enum {
 	DUMP_ATTR_INTERFACE,
@@ -99,6 +103,22 @@ static void bmemcpys64(void *av, const void *bv, size_t frombits, size_t nbits)
 	bmemcpy(av, &buf, nbits);
 }
 
+// rule output goes to stdout and, on a cache miss, to the new cache file
+static void out(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+
+	if (cache_out) {
+		va_start(ap, fmt);
+		vfprintf(cache_out, fmt, ap);
+		va_end(ap);
+	}
+}
+
 static void handle_dump(struct ubus_request *req __attribute__((unused)),
 		int type __attribute__((unused)), struct blob_attr *msg)
 {
@@ -177,20 +197,92 @@ static char *const token[] = {
 };
 
 
+// The result depends on the rules, LEGACY and the prefixes and addresses of
+// the interfaces searched for a PD, i.e. on the lease.
+static void cache_key(char *key, int argc, char *argv[], bool legacy)
+{
+	uint32_t digest[4];
+	md5_ctx_t ctx;
+	struct blob_attr *c;
+	unsigned rem;
+
+	md5_begin(&ctx);
+	md5_hash(legacy ? "1" : "0", 2, &ctx);
+
+	for (int i = 1; i < argc; ++i)
+		md5_hash(argv[i], strlen(argv[i]) + 1, &ctx);
+
+	if (dump) {
+		blobmsg_for_each_attr(c, dump, rem) {
+			struct blob_attr *tb[IFACE_ATTR_MAX];
+			blobmsg_parse(iface_attrs, IFACE_ATTR_MAX, tb, blobmsg_data(c), blobmsg_data_len(c));
+
+			if (!tb[IFACE_ATTR_INTERFACE] || (strcmp(argv[1], "*") && strcmp(argv[1],
+					blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]))))
+				continue;
+
+			md5_hash(blob_data(tb[IFACE_ATTR_INTERFACE]), blob_len(tb[IFACE_ATTR_INTERFACE]), &ctx);
+			for (int i = IFACE_ATTR_PREFIX; i <= IFACE_ATTR_ADDRESS; ++i)
+				if (tb[i])
+					md5_hash(blob_data(tb[i]), blob_len(tb[i]), &ctx);
+		}
+	}
+
+	md5_end(digest, &ctx);
+	sprintf(key, "# mapcalc %08x%08x%08x%08x\n", digest[0], digest[1], digest[2], digest[3]);
+}
+
+// prints the cached result if it was computed for the same key
+static bool cache_lookup(const char *cache, const char *key)
+{
+	char buf[512];
+	size_t len;
+	FILE *f = fopen(cache, "r");
+
+	if (!f)
+		return false;
+
+	if (!fgets(buf, sizeof(buf), f) || strcmp(buf, key)) {
+		fclose(f);
+		return false;
+	}
+
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, len, stdout);
+
+	fclose(f);
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 	int status = 0;
-	const char *iface = argv[1];
+	const char *cache = NULL;
+	char cache_tmp[256];
+	char key[64];
+	int opt;
 
 	const char *legacy_env = getenv("LEGACY");
 	bool legacy = legacy_env && atoi(legacy_env);
 
+	while ((opt = getopt(argc, argv, "+c:")) != -1) {
+		if (opt == 'c' && strlen(optarg) < sizeof(cache_tmp) - 4)
+			cache = optarg;
+		else
+			argc = 0;
+	}
 
-	if (argc < 3) {
-		fprintf(stderr, "Usage: %s <interface|*> <rule1> [rule2] [...]\n", argv[0]);
+	if (argc - optind < 2) {
+		fprintf(stderr, "Usage: %s [-c <cachefile>] <interface|*> <rule1> [rule2] [...]\n", argv[0]);
 		return 1;
 	}
 
+	// keep argv[1] the interface
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	const char *iface = argv[1];
+
 	uint32_t network_interface;
 	struct ubus_context *ubus = ubus_connect(NULL);
 	if (ubus) {
@@ -198,6 +290,17 @@ int main(int argc, char *argv[])
 		ubus_invoke(ubus, network_interface, "dump", NULL, handle_dump, NULL, 5000);
 	}
 
+	if (cache) {
+		cache_key(key, argc, argv, legacy);
+		if (cache_lookup(cache, key))
+			return 0;
+
+		snprintf(cache_tmp, sizeof(cache_tmp), "%s.tmp", cache);
+		cache_out = fopen(cache_tmp, "w");
+		if (cache_out)
+			fputs(key, cache_out);
+	}
+
 	int rulecnt = 0;
 	for (int i = 2; i < argc; ++i) {
 		bool lw4o6 = false;
@@ -345,31 +448,31 @@ int main(int argc, char *argv[])
 		inet_ntop(AF_INET6, &ipv6addr, ipv6addrbuf, sizeof(ipv6addrbuf));
 		inet_ntop(AF_INET6, &pd, pdbuf, sizeof(pdbuf));
 
-		printf("RULE_%d_FMR=%d\n", rulecnt, fmr);
-		printf("RULE_%d_EALEN=%d\n", rulecnt, ealen);
-		printf("RULE_%d_PSIDLEN=%d\n", rulecnt, psidlen);
-		printf("RULE_%d_OFFSET=%d\n", rulecnt, offset);
-		printf("RULE_%d_PREFIX4LEN=%d\n", rulecnt, prefix4len);
-		printf("RULE_%d_PREFIX6LEN=%d\n", rulecnt, prefix6len);
-		printf("RULE_%d_IPV4PREFIX=%s\n", rulecnt, ipv4prefixbuf);
-		printf("RULE_%d_IPV6PREFIX=%s\n", rulecnt, ipv6prefixbuf);
+		out("RULE_%d_FMR=%d\n", rulecnt, fmr);
+		out("RULE_%d_EALEN=%d\n", rulecnt, ealen);
+		out("RULE_%d_PSIDLEN=%d\n", rulecnt, psidlen);
+		out("RULE_%d_OFFSET=%d\n", rulecnt, offset);
+		out("RULE_%d_PREFIX4LEN=%d\n", rulecnt, prefix4len);
+		out("RULE_%d_PREFIX6LEN=%d\n", rulecnt, prefix6len);
+		out("RULE_%d_IPV4PREFIX=%s\n", rulecnt, ipv4prefixbuf);
+		out("RULE_%d_IPV6PREFIX=%s\n", rulecnt, ipv6prefixbuf);
 
 		if (pdlen >= 0) {
-			printf("RULE_%d_IPV6PD=%s\n", rulecnt, pdbuf);
-			printf("RULE_%d_PD6LEN=%d\n", rulecnt, pdlen);
-			printf("RULE_%d_PD6IFACE=%s\n", rulecnt, iface);
-			printf("RULE_%d_IPV6ADDR=%s\n", rulecnt, ipv6addrbuf);
-			printf("RULE_BMR=%d\n", rulecnt);
+			out("RULE_%d_IPV6PD=%s\n", rulecnt, pdbuf);
+			out("RULE_%d_PD6LEN=%d\n", rulecnt, pdlen);
+			out("RULE_%d_PD6IFACE=%s\n", rulecnt, iface);
+			out("RULE_%d_IPV6ADDR=%s\n", rulecnt, ipv6addrbuf);
+			out("RULE_BMR=%d\n", rulecnt);
 		}
 
 		if (ipv4addr.s_addr) {
-			printf("RULE_%d_IPV4ADDR=%s\n", rulecnt, ipv4addrbuf);
-			printf("RULE_%d_ADDR4LEN=%d\n", rulecnt, addr4len);
+			out("RULE_%d_IPV4ADDR=%s\n", rulecnt, ipv4addrbuf);
+			out("RULE_%d_ADDR4LEN=%d\n", rulecnt, addr4len);
 		}
 
 
 		if (psidlen > 0 && psid >= 0) {
-			printf("RULE_%d_PORTSETS='", rulecnt);
+			out("RULE_%d_PORTSETS='", rulecnt);
 			for (int k = (offset) ? 1 : 0; k < (1 << offset); ++k) {
 				int start = (k << (16 - offset)) | (psid >> offset);
 				int end = start + (1 << (16 - offset - psidlen)) - 1;
@@ -378,18 +481,25 @@ int main(int argc, char *argv[])
 					start = 1;
 
 				if (start <= end)
-					printf("%d-%d ", start, end);
+					out("%d-%d ", start, end);
 			}
-			printf("'\n");
+			out("'\n");
 		}
 
 		if (dmr)
-			printf("RULE_%d_DMR=%s\n", rulecnt, dmr);
+			out("RULE_%d_DMR=%s\n", rulecnt, dmr);
 
 		if (br)
-			printf("RULE_%d_BR=%s\n", rulecnt, br);
+			out("RULE_%d_BR=%s\n", rulecnt, br);
+	}
+
+	out("RULE_COUNT=%d\n", rulecnt);
+
+	// only complete results are reused
+	if (cache_out) {
+		if (fclose(cache_out) || status || rename(cache_tmp, cache))
+			unlink(cache_tmp);
 	}
 
-	printf("RULE_COUNT=%d\n", rulecnt);
 	return status;
 }
@@ -651,31 +651,13 @@ handle_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 {
 	struct ead_packet *pkt = (struct ead_packet *) bytes;
 
+	/* everything else is matched by pktfilter already */
 	if (h->len < sizeof(struct ead_packet))
 		return;
 
-	if (pkt->eh.ether_type != htons(ETHERTYPE_IP))
-		return;
-
-	if (memcmp(pkt->eh.ether_dhost, "\xff\xff\xff\xff\xff\xff", 6) != 0)
-		return;
-
-	if (pkt->proto != UIP_PROTO_UDP)
-		return;
-
-	if (pkt->destport != htons(EAD_PORT))
-		return;
-
-	if (pkt->msg.magic != htonl(EAD_MAGIC))
-		return;
-
 	if (h->len < sizeof(struct ead_packet) + ntohl(pkt->msg.len))
 		return;
 
-	if ((pkt->msg.nid != 0xffff) &&
-		(pkt->msg.nid != htons(nid)))
-		return;
-
 	parse_message(pkt, h->len);
 }
 
@@ -708,6 +690,7 @@ ead_pcap_reopen(bool first)
 		if (!pcap_fp)
 			sleep(1);
 	} while (!pcap_fp);
+	pktfilter_insns[PKTFILTER_NID].k = nid;
 	pcap_setfilter(pcap_fp_rx, &pktfilter);
 }
 
@@ -716,7 +699,7 @@ static void
 ead_pktloop(void)
 {
 	while (1) {
-		if (pcap_dispatch(pcap_fp_rx, 1, handle_packet, NULL) < 0) {
+		if (pcap_dispatch(pcap_fp_rx, -1, handle_packet, NULL) < 0) {
 			ead_pcap_reopen(false);
 			continue;
 		}
@@ -1,25 +1,40 @@
-/* precompiled expression: udp and dst port 56026 */
+/*
+ * broadcast ipv4 udp to EAD_PORT carrying EAD_MAGIC, addressed to any node
+ * or to our node id, with the full message present. The node id compare
+ * (PKTFILTER_NID) is filled in before the filter is attached.
+ */
+
+#define EAD_MSG_OFS(_f)	(offsetof(struct ead_packet, msg) + offsetof(struct ead_msg, _f))
+#define PKTFILTER_NID	16
 
 static struct bpf_insn pktfilter_insns[] = {
-	{ .code = 0x0028, .jt = 0x00, .jf = 0x00, .k = 0x0000000c },
-	{ .code = 0x0015, .jt = 0x00, .jf = 0x04, .k = 0x000086dd },
-	{ .code = 0x0030, .jt = 0x00, .jf = 0x00, .k = 0x00000014 },
-	{ .code = 0x0015, .jt = 0x00, .jf = 0x0b, .k = 0x00000011 },
-	{ .code = 0x0028, .jt = 0x00, .jf = 0x00, .k = 0x00000038 },
-	{ .code = 0x0015, .jt = 0x08, .jf = 0x09, .k = 0x0000dada },
-	{ .code = 0x0015, .jt = 0x00, .jf = 0x08, .k = 0x00000800 },
-	{ .code = 0x0030, .jt = 0x00, .jf = 0x00, .k = 0x00000017 },
-	{ .code = 0x0015, .jt = 0x00, .jf = 0x06, .k = 0x00000011 },
-	{ .code = 0x0028, .jt = 0x00, .jf = 0x00, .k = 0x00000014 },
-	{ .code = 0x0045, .jt = 0x04, .jf = 0x00, .k = 0x00001fff },
-	{ .code = 0x00b1, .jt = 0x00, .jf = 0x00, .k = 0x0000000e },
-	{ .code = 0x0048, .jt = 0x00, .jf = 0x00, .k = 0x00000010 },
-	{ .code = 0x0015, .jt = 0x00, .jf = 0x01, .k = 0x0000dada },
-	{ .code = 0x0006, .jt = 0x00, .jf = 0x00, .k = 0x000005dc },
-	{ .code = 0x0006, .jt = 0x00, .jf = 0x00, .k = 0x00000000 },
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, offsetof(struct ether_header, ether_type)),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 21),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xffffffff, 0, 19),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 4),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xffff, 0, 17),
+	BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, offsetof(struct ead_packet, proto)),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, UIP_PROTO_UDP, 0, 15),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, offsetof(struct ead_packet, ipoffset)),
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 13, 0),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, offsetof(struct ead_packet, destport)),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EAD_PORT, 0, 11),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, EAD_MSG_OFS(magic)),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EAD_MAGIC, 0, 9),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, EAD_MSG_OFS(nid)),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xffff, 1, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xffff, 0, 6),	/* PKTFILTER_NID */
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, EAD_MSG_OFS(len)),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, sizeof(struct ead_packet)),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0x000005dc),
+	BPF_STMT(BPF_RET | BPF_K, 0),
 };
 
 static struct bpf_program pktfilter = {
-	.bf_len = 16,
+	.bf_len = sizeof(pktfilter_insns) / sizeof(pktfilter_insns[0]),
 	.bf_insns = pktfilter_insns,
 };
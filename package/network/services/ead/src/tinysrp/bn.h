@@ -90,6 +90,12 @@ extern "C" {
 
 #undef BN_LLONG
 
+/* gcc provides a 64 bit unsigned long long on 32 bit targets, use it for
+ * the word multiplications instead of the half word fallback */
+#if defined(THIRTY_TWO_BIT) && defined(__GNUC__)
+#define BN_LLONG
+#endif
+
 /* assuming long is 64bit - this is the DEC Alpha
  * unsigned long long is only 64 bits :-(, don't define
  * BN_LLONG for the DEC Alpha */
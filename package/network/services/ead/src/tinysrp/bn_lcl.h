@@ -264,7 +264,33 @@ extern "C" {
 	bn_set_max(r); \
 	}
 
-#ifdef BN_LLONG
+#if defined(BN_LLONG) && defined(THIRTY_TWO_BIT) && defined(__GNUC__) && \
+    defined(__mips) && (__mips >= 32) && (__mips_isa_rev < 6) && \
+    !defined(NO_ASM) && !defined(NO_INLINE_ASM) && !defined(PEDANTIC)
+/* MIPS32: keep the product in HI/LO and accumulate with maddu, the sum
+ * w*a + r + c always fits into 64 bits */
+#define mul_add(r,a,w,c) { \
+	BN_ULLONG t=(BN_ULLONG)(r) + (c); \
+	asm ("maddu	%1,%2" : "+x"(t) : "r"(w), "r"(a)); \
+	(r)= Lw(t); \
+	(c)= Hw(t); \
+	}
+
+#define mul(r,a,w,c) { \
+	BN_ULLONG t=(c); \
+	asm ("maddu	%1,%2" : "+x"(t) : "r"(w), "r"(a)); \
+	(r)= Lw(t); \
+	(c)= Hw(t); \
+	}
+
+#define sqr(r0,r1,a) { \
+	BN_ULLONG t; \
+	asm ("multu	%1,%1" : "=x"(t) : "r"(a)); \
+	(r0)=Lw(t); \
+	(r1)=Hw(t); \
+	}
+
+#elif defined(BN_LLONG)
 #define mul_add(r,a,w,c) { \
 	BN_ULLONG t; \
 	t=(BN_ULLONG)w * (a) + (r) + (c); \
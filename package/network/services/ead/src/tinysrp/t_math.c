@@ -146,12 +146,52 @@ BigIntegerModMul(r, m1, m2, modulus)
   BN_CTX_free(ctx);
 }
 
+/* Montgomery context of the last odd modulus, every session of a server
+ * or client uses the same one */
+static BN_MONT_CTX * mont_cache = NULL;
+
+static BN_MONT_CTX *
+BigIntegerMontCtx(m, ctx)
+     BigInteger m;
+     BN_CTX * ctx;
+{
+  if (!BN_is_odd(m))
+    return NULL;
+
+  if (mont_cache && BN_cmp(&mont_cache->N, m) == 0)
+    return mont_cache;
+
+  if (mont_cache)
+    BN_MONT_CTX_free(mont_cache);
+
+  mont_cache = BN_MONT_CTX_new();
+  if (mont_cache && !BN_MONT_CTX_set(mont_cache, m, ctx)) {
+    BN_MONT_CTX_free(mont_cache);
+    mont_cache = NULL;
+  }
+
+  return mont_cache;
+}
+
+static void
+BigIntegerModExpCtx(r, b, e, m, ctx)
+     BigInteger r, b, e, m;
+     BN_CTX * ctx;
+{
+  BN_MONT_CTX * mont = BigIntegerMontCtx(m, ctx);
+
+  if (mont)
+    BN_mod_exp_mont(r, b, e, m, ctx, mont);
+  else
+    BN_mod_exp(r, b, e, m, ctx);
+}
+
 void
 BigIntegerModExp(r, b, e, m)
      BigInteger r, b, e, m;
 {
   BN_CTX * ctx = BN_CTX_new();
-  BN_mod_exp(r, b, e, m, ctx);
+  BigIntegerModExpCtx(r, b, e, m, ctx);
   BN_CTX_free(ctx);
 }
 
@@ -164,7 +204,7 @@ BigIntegerModExpInt(r, b, e, m)
   BN_CTX * ctx = BN_CTX_new();
   BIGNUM * p = BN_new();
   BN_set_word(p, e);
-  BN_mod_exp(r, b, p, m, ctx);
+  BigIntegerModExpCtx(r, b, p, m, ctx);
   BN_free(p);
   BN_CTX_free(ctx);
 }
@@ -30,7 +30,10 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -45,6 +48,9 @@
 #define FRAMETYPE_BEACON			0x80
 #define FRAMETYPE_DATA				0x08
 
+#define STREAM_SNAPLEN				8192
+#define STREAM_BATCH				64
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define le16(x) __bswap_16(x)
 #else
@@ -55,6 +61,9 @@ uint8_t run_dump   = 0;
 uint8_t run_stop   = 0;
 uint8_t run_daemon = 0;
 
+uint8_t filter_data   = 0;
+uint8_t filter_beacon = 0;
+
 uint32_t frames_captured = 0;
 uint32_t frames_filtered = 0;
 
@@ -69,6 +78,18 @@ struct ringbuf {
 	void *buf;               /* ring memory */
 };
 
+struct rxring {
+	uint8_t *map;            /* mmap()ed kernel ring */
+	uint32_t maplen;         /* mapping length */
+	uint32_t block_size;     /* ring block size */
+	uint32_t frame_size;     /* ring frame size */
+	uint32_t frame_nr;       /* number of frames */
+	uint32_t frames_per_block;
+	uint32_t head;           /* next frame to look at */
+	uint32_t tail;           /* oldest frame not yet returned */
+	uint32_t held_max;       /* frames kept before returning the oldest */
+};
+
 struct ringbuf_entry {
 	uint32_t len;            /* used slot memory */
 	uint32_t olen;           /* original data size */
@@ -254,6 +275,91 @@ void ringbuf_free(struct ringbuf *r)
 }
 
 
+int rxring_init(struct rxring *r, uint32_t size, uint32_t snaplen)
+{
+	int ver = TPACKET_V2;
+	long pagesz = sysconf(_SC_PAGESIZE);
+	struct tpacket_req req;
+	uint32_t blocks;
+
+	memset(r, 0, sizeof(*r));
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_VERSION,
+				   &ver, sizeof(ver)))
+		return -1;
+
+	/* the kernel places the frame data behind the aligned tpacket2_hdr
+	 * and sockaddr_ll, reserve that on top of the wanted snap length */
+	r->frame_size = TPACKET_ALIGN(TPACKET2_HDRLEN + 16) +
+		TPACKET_ALIGN(snaplen);
+
+	for (r->block_size = pagesz;
+		 r->block_size < 4 * r->frame_size;
+		 r->block_size <<= 1);
+
+	r->frames_per_block = r->block_size / r->frame_size;
+
+	blocks = size / r->block_size;
+
+	if (blocks * r->frames_per_block < 2)
+		blocks = 2;
+
+	r->frame_nr = blocks * r->frames_per_block;
+	r->maplen = blocks * r->block_size;
+
+	/* keep some frames free for the kernel to fill while we hold
+	 * on to the rest */
+	r->held_max = r->frame_nr - ((r->frame_nr >= 8) ? r->frame_nr / 8 : 1);
+
+	req.tp_block_size = r->block_size;
+	req.tp_block_nr   = blocks;
+	req.tp_frame_size = r->frame_size;
+	req.tp_frame_nr   = r->frame_nr;
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_RX_RING,
+				   &req, sizeof(req)))
+		return -1;
+
+	r->map = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+				  capture_sock, 0);
+
+	if (r->map == MAP_FAILED)
+	{
+		memset(&req, 0, sizeof(req));
+		setsockopt(capture_sock, SOL_PACKET, PACKET_RX_RING,
+				   &req, sizeof(req));
+
+		r->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct tpacket2_hdr * rxring_frame(struct rxring *r, uint32_t i)
+{
+	i %= r->frame_nr;
+
+	return (struct tpacket2_hdr *)(r->map +
+		(i / r->frames_per_block) * r->block_size +
+		(i % r->frames_per_block) * r->frame_size);
+}
+
+void rxring_release(struct rxring *r)
+{
+	struct tpacket2_hdr *h = rxring_frame(r, r->tail++);
+
+	__sync_synchronize();
+	h->tp_status = TP_STATUS_KERNEL;
+}
+
+void rxring_free(struct rxring *r)
+{
+	munmap(r->map, r->maplen);
+	memset(r, 0, sizeof(*r));
+}
+
+
 void msg(const char *fmt, ...)
 {
 	va_list ap;
@@ -268,19 +374,219 @@ void msg(const char *fmt, ...)
 }
 
 
+int frame_filtered(uint8_t *buf, uint32_t len)
+{
+	radiotap_hdr_t *rhdr = (radiotap_hdr_t *)buf;
+	uint8_t frametype;
+
+	/* reject short frames and those whose radiotap header overruns them */
+	if (len <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= len)
+		return 1;
+
+	frametype = *(uint8_t *)(buf + le16(rhdr->it_len));
+
+	if ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
+	    (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON))
+		return 1;
+
+	return 0;
+}
+
+
+int writev_all(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t len;
+
+	while (cnt > 0)
+	{
+		len = writev(fd, iov, cnt);
+
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		while (cnt > 0 && len >= iov->iov_len)
+		{
+			len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if (cnt > 0)
+		{
+			iov->iov_base = (uint8_t *)iov->iov_base + len;
+			iov->iov_len  -= len;
+		}
+	}
+
+	return 0;
+}
+
+/* stream all held frames with a single writev and return them to the kernel */
+int rxring_stream(struct rxring *r)
+{
+	struct iovec iov[2 * STREAM_BATCH];
+	pcaprec_hdr_t fhdr[STREAM_BATCH];
+	struct tpacket2_hdr *h;
+	uint32_t i;
+	int n = 0, rv = 0;
+
+	for (i = r->tail; i != r->head; i++)
+	{
+		h = rxring_frame(r, i);
+
+		if (!h->tp_snaplen)
+			continue;
+
+		fhdr[n].ts_sec   = h->tp_sec;
+		fhdr[n].ts_usec  = h->tp_nsec / 1000;
+		fhdr[n].incl_len = h->tp_snaplen;
+		fhdr[n].orig_len = h->tp_len;
+
+		iov[2 * n].iov_base     = &fhdr[n];
+		iov[2 * n].iov_len      = sizeof(fhdr[n]);
+		iov[2 * n + 1].iov_base = (uint8_t *)h + h->tp_mac;
+		iov[2 * n + 1].iov_len  = h->tp_snaplen;
+
+		n++;
+	}
+
+	if (n > 0)
+		rv = writev_all(1, iov, 2 * n);
+
+	while (r->tail != r->head)
+		rxring_release(r);
+
+	return rv;
+}
+
+/* write all held frames in place, the ring itself is the dump buffer */
+int rxring_dump(struct rxring *r, FILE *o, uint16_t pktcap)
+{
+	struct tpacket2_hdr *h;
+	uint32_t i, sec, usec, len;
+	int n = 0;
+
+	write_pcap_header(o);
+
+	for (i = r->tail; i != r->head; i++)
+	{
+		h = rxring_frame(r, i);
+
+		if (!h->tp_snaplen)
+			continue;
+
+		sec  = h->tp_sec;
+		usec = h->tp_nsec / 1000;
+		len  = (h->tp_snaplen > pktcap) ? pktcap : h->tp_snaplen;
+
+		write_pcap_frame(o, &sec, &usec, len, h->tp_len);
+		fwrite((uint8_t *)h + h->tp_mac, 1, len, o);
+		n++;
+	}
+
+	return n;
+}
+
+void rxring_capture(struct rxring *r, uint8_t streaming,
+					uint16_t pktcap, const char *output)
+{
+	struct pollfd pfd = { .fd = capture_sock, .events = POLLIN };
+	struct tpacket2_hdr *h;
+	uint32_t batch;
+	FILE *o;
+	int n;
+
+	batch = (r->held_max < STREAM_BATCH) ? r->held_max : STREAM_BATCH;
+
+	if (streaming)
+	{
+		write_pcap_header(stdout);
+		fflush(stdout);
+	}
+
+	while (!run_stop)
+	{
+		if (run_dump)
+		{
+			msg("Dumping ring to %s ...\n", output);
+
+			if (!(o = fopen(output, "w")))
+			{
+				msg("Unable to open %s: %s\n",
+					output, strerror(errno));
+			}
+			else
+			{
+				n = rxring_dump(r, o, pktcap);
+
+				fclose(o);
+
+				msg(" * %d frames captured\n", frames_captured);
+				msg(" * %d frames filtered\n", frames_filtered);
+				msg(" * %d frames dumped\n", n);
+			}
+
+			run_dump = 0;
+		}
+
+		h = rxring_frame(r, r->head);
+
+		if (!(*(volatile uint32_t *)&h->tp_status & TP_STATUS_USER))
+		{
+			if (streaming && r->tail != r->head && rxring_stream(r))
+				break;
+
+			poll(&pfd, 1, -1);
+			continue;
+		}
+
+		__sync_synchronize();
+
+		frames_captured++;
+
+		/* filtered frames stay in sequence but are marked empty, slots
+		 * can only be handed back to the kernel in ring order */
+		if (frame_filtered((uint8_t *)h + h->tp_mac, h->tp_snaplen))
+		{
+			frames_filtered++;
+			h->tp_snaplen = 0;
+		}
+
+		r->head++;
+
+		if (streaming)
+		{
+			if ((r->head - r->tail) >= batch && rxring_stream(r))
+				break;
+		}
+		else
+		{
+			while ((r->head - r->tail) > r->held_max)
+				rxring_release(r);
+		}
+	}
+
+	if (streaming && !run_stop)
+		msg("Unable to write stream: %s\n", strerror(errno));
+}
+
+
 int main(int argc, char **argv)
 {
 	int i, n;
-	struct ringbuf *ring;
+	struct ringbuf *ring = NULL;
 	struct ringbuf_entry *e;
+	struct rxring rx;
 	struct sockaddr_ll local = {
 		.sll_family   = AF_PACKET,
 		.sll_protocol = htons(ETH_P_ALL)
 	};
 
-	radiotap_hdr_t *rhdr;
-
-	uint8_t frametype;
 	uint8_t pktbuf[0xFFFF];
 	ssize_t pktlen;
 
@@ -291,8 +597,6 @@ int main(int argc, char **argv)
 	uint8_t promisc        = 0;
 	uint8_t streaming      = 0;
 	uint8_t foreground     = 0;
-	uint8_t filter_data    = 0;
-	uint8_t filter_beacon  = 0;
 	uint8_t header_written = 0;
 
 	uint32_t ringsz   = 1024 * 1024; /* 1 Mbyte ring buffer */
@@ -460,14 +764,23 @@ int main(int argc, char **argv)
 
 		msg("Monitoring interface %s ...\n", ifname);
 
-		if (!(ring = ringbuf_init(ringsz / pktcap, pktcap)))
+		if (!rxring_init(&rx, ringsz, pktcap))
+		{
+			msg(" * Using %d bytes kernel ring with %d frames\n",
+				rx.maplen, rx.held_max);
+		}
+		else if (!(ring = ringbuf_init(ringsz / pktcap, pktcap)))
 		{
 			msg("Unable to allocate ring buffer: %s\n",
 				strerror(errno));
 			return 5;
 		}
+		else
+		{
+			msg(" * Using %d bytes ringbuffer with %d slots\n",
+				ringsz, ring->len);
+		}
 
-		msg(" * Using %d bytes ringbuffer with %d slots\n", ringsz, ring->len);
 		msg(" * Truncating frames at %d bytes\n", pktcap);
 		msg(" * Dumping data to file %s\n", output);
 
@@ -476,6 +789,11 @@ int main(int argc, char **argv)
 	else
 	{
 		msg("Monitoring interface %s ...\n", ifname);
+
+		if (!rxring_init(&rx, ringsz, STREAM_SNAPLEN))
+			msg(" * Using %d bytes kernel ring with %d frames\n",
+				rx.maplen, rx.frame_nr);
+
 		msg(" * Streaming data to stdout\n");
 	}
 
@@ -487,6 +805,20 @@ int main(int argc, char **argv)
 
 	promisc = set_promisc(1);
 
+	if (rx.map)
+	{
+		rxring_capture(&rx, streaming, pktcap, output);
+
+		msg("Shutting down ...\n");
+
+		if (promisc)
+			set_promisc(0);
+
+		rxring_free(&rx);
+
+		return 0;
+	}
+
 	/* capture loop */
 	while (1)
 	{
@@ -540,18 +872,7 @@ int main(int argc, char **argv)
 		frames_captured++;
 
 		/* check received frametype, if we should filter it, rewind the ring */
-		rhdr = (radiotap_hdr_t *)pktbuf;
-
-		if (pktlen <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= pktlen)
-		{
-			frames_filtered++;
-			continue;
-		}
-
-		frametype = *(uint8_t *)(pktbuf + le16(rhdr->it_len));
-
-		if ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
-		    (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON))
+		if (frame_filtered(pktbuf, (pktlen > 0) ? pktlen : 0))
 		{
 			frames_filtered++;
 			continue;
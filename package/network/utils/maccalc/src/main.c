@@ -10,6 +10,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -21,6 +22,8 @@
 #define ERR_INVALID		1
 #define ERR_IO			2
 
+#define BATCH_LINE_LEN		256
+
 static void usage(void);
 
 char *maccalc_name;
@@ -44,12 +47,31 @@ static void print_mac(unsigned char *buf)
 	       buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
 }
 
+static void mac_add(unsigned char *mac, int i)
+{
+	uint32_t t;
+
+	t = (mac[3] << 16) | (mac[4] << 8) | mac[5];
+	t += i;
+	mac[3] = (t >> 16) & 0xff;
+	mac[4] = (t >> 8) & 0xff;
+	mac[5] = t & 0xff;
+}
+
+static void mac_logical(unsigned char *mac1, const unsigned char *mac2,
+			unsigned char (*op)(unsigned char n1,
+					    unsigned char n2))
+{
+	int i;
+
+	for (i = 0; i < MAC_ADDRESS_LEN; i++)
+		mac1[i] = op(mac1[i],mac2[i]);
+}
+
 static int maccalc_do_add(int argc, const char *argv[])
 {
 	unsigned char mac[MAC_ADDRESS_LEN];
-	uint32_t t;
 	int err;
-	int i;
 
 	if (argc != 2) {
 		usage();
@@ -60,13 +82,7 @@ static int maccalc_do_add(int argc, const char *argv[])
 	if (err)
 		return err;
 
-	i = atoi(argv[1]);
-
-	t = (mac[3] << 16) | (mac[4] << 8) | mac[5];
-	t += i;
-	mac[3] = (t >> 16) & 0xff;
-	mac[4] = (t >> 8) & 0xff;
-	mac[5] = t & 0xff;
+	mac_add(mac, atoi(argv[1]));
 
 	print_mac(mac);
 	return 0;
@@ -79,7 +95,6 @@ static int maccalc_do_logical(int argc, const char *argv[],
 	unsigned char mac1[MAC_ADDRESS_LEN];
 	unsigned char mac2[MAC_ADDRESS_LEN];
 	int err;
-	int i;
 
 	if (argc != 2) {
 		usage();
@@ -94,8 +109,7 @@ static int maccalc_do_logical(int argc, const char *argv[],
 	if (err)
 		return err;
 
-	for (i = 0; i < MAC_ADDRESS_LEN; i++)
-		mac1[i] = op(mac1[i],mac2[i]);
+	mac_logical(mac1, mac2, op);
 
 	print_mac(mac1);
 	return 0;
@@ -203,6 +217,173 @@ static int maccalc_do_xor(int argc, const char *argv[])
 	return maccalc_do_logical(argc, argv, op_xor);
 }
 
+/*
+ * Reads the binary base address of the batch command from <file>@<offset>
+ * or mtd:<partition>@<offset>, the offset may be given in hex.
+ */
+static int read_mac_at(const char *spec, unsigned char *mac)
+{
+	char path[64], line[128], name[64];
+	const char *at;
+	unsigned long offset;
+	char *end;
+	FILE *f;
+	ssize_t c;
+	int fd, idx;
+
+	at = strrchr(spec, '@');
+	offset = strtoul(at + 1, &end, 0);
+	if (at == spec || !at[1] || *end) {
+		fprintf(stderr, "invalid base '%s'\n", spec);
+		return ERR_INVALID;
+	}
+
+	if (strncmp(spec, "mtd:", 4) == 0) {
+		snprintf(name, sizeof(name), "\"%.*s\"", (int) (at - spec - 4),
+			 spec + 4);
+
+		f = fopen("/proc/mtd", "r");
+		if (!f) {
+			fprintf(stderr, "failed to open /proc/mtd\n");
+			return ERR_IO;
+		}
+
+		idx = -1;
+		while (fgets(line, sizeof(line), f)) {
+			line[strcspn(line, "\n")] = 0;
+			end = strrchr(line, ' ');
+			if (end && !strcmp(end + 1, name) &&
+			    sscanf(line, "mtd%d:", &idx) == 1)
+				break;
+			idx = -1;
+		}
+		fclose(f);
+
+		if (idx < 0) {
+			fprintf(stderr, "partition %s not found\n", name);
+			return ERR_INVALID;
+		}
+
+		snprintf(path, sizeof(path), "/dev/mtd%d", idx);
+		if (access(path, F_OK))
+			snprintf(path, sizeof(path), "/dev/mtd/%d", idx);
+	} else {
+		snprintf(path, sizeof(path), "%.*s", (int) (at - spec), spec);
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return ERR_IO;
+	}
+
+	c = -1;
+	if (lseek(fd, offset, SEEK_SET) == (off_t) offset)
+		c = read_safe(fd, mac, MAC_ADDRESS_LEN);
+	close(fd);
+
+	if (c != MAC_ADDRESS_LEN) {
+		fprintf(stderr, "failed to read from %s\n", path);
+		return ERR_IO;
+	}
+
+	return 0;
+}
+
+/* applies the comma separated steps of one batch operation to the base */
+static int batch_op(const unsigned char *base, const char *op)
+{
+	unsigned char mac[MAC_ADDRESS_LEN];
+	unsigned char mac2[MAC_ADDRESS_LEN];
+	char buf[BATCH_LINE_LEN];
+	char *step, *arg, *end, *saveptr;
+	long n;
+
+	if (strlen(op) >= sizeof(buf)) {
+		fprintf(stderr, "operation too long\n");
+		return ERR_INVALID;
+	}
+
+	strcpy(buf, op);
+	memcpy(mac, base, sizeof(mac));
+
+	for (step = strtok_r(buf, ",", &saveptr); step;
+	     step = strtok_r(NULL, ",", &saveptr)) {
+		arg = strchr(step, ':');
+		if (arg)
+			*arg++ = 0;
+
+		if (!strcmp(step, "la") && !arg) {
+			mac[0] |= 0x02;
+		} else if (!strcmp(step, "add") && arg) {
+			n = strtol(arg, &end, 0);
+			if (!*arg || *end)
+				goto invalid;
+			mac_add(mac, n);
+		} else if (arg && (!strcmp(step, "and") ||
+				   !strcmp(step, "or") ||
+				   !strcmp(step, "xor"))) {
+			if (parse_mac(arg, mac2))
+				goto invalid;
+			mac_logical(mac, mac2, step[0] == 'a' ? op_and :
+					       step[0] == 'o' ? op_or : op_xor);
+		} else {
+			goto invalid;
+		}
+	}
+
+	print_mac(mac);
+	return 0;
+
+invalid:
+	fprintf(stderr, "invalid operation '%s'\n", op);
+	return ERR_INVALID;
+}
+
+static int maccalc_do_batch(int argc, const char *argv[])
+{
+	unsigned char base[MAC_ADDRESS_LEN];
+	char line[BATCH_LINE_LEN];
+	char *op, *saveptr;
+	int err;
+	int i;
+
+	if (argc < 1) {
+		usage();
+		return ERR_INVALID;
+	}
+
+	if (strchr(argv[0], '@'))
+		err = read_mac_at(argv[0], base);
+	else
+		err = parse_mac(argv[0], base);
+	if (err)
+		return err;
+
+	for (i = 1; i < argc; i++) {
+		err = batch_op(base, argv[i]);
+		if (err)
+			return err;
+	}
+
+	if (argc > 1)
+		return 0;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		if (line[0] == '#')
+			continue;
+
+		for (op = strtok_r(line, " \t\n", &saveptr); op;
+		     op = strtok_r(NULL, " \t\n", &saveptr)) {
+			err = batch_op(base, op);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
 static void usage(void)
 {
 	fprintf(stderr,
@@ -211,8 +392,17 @@ static void usage(void)
 		"  add <mac> <number>\n"
 		"  and|or|xor <mac1> <mac2>\n"
 		"  mac2bin <mac>\n"
-		"  bin2mac\n",
-		maccalc_name);
+		"  bin2mac\n"
+		"  batch <base> [<operation>...]\n"
+		"\n"
+		"batch prints one address per operation, each derived from <base>.\n"
+		"<base> is a mac, or the binary address at <file>@<offset> or\n"
+		"mtd:<partition>@<offset>. An operation is a comma separated list\n"
+		"of add:<number>, and:<mac>, or:<mac>, xor:<mac> and la (set the\n"
+		"locally administered bit), applied in order. Without operations\n"
+		"on the command line they are read from stdin.\n"
+		"Example: %s batch mtd:art@0 add:0 add:1 add:2,la\n",
+		maccalc_name, maccalc_name);
 }
 
 int main(int argc, const char *argv[])
@@ -239,6 +429,8 @@ int main(int argc, const char *argv[])
 		op = maccalc_do_mac2bin;
 	} else if (strcmp(argv[1], "bin2mac") == 0) {
 		op = maccalc_do_bin2mac;
+	} else if (strcmp(argv[1], "batch") == 0) {
+		op = maccalc_do_batch;
 	} else {
 		fprintf(stderr, "unknown command '%s'\n", argv[1]);
 		usage();
@@ -41,6 +41,26 @@ struct cidr {
 	struct cidr *next;
 };
 
+struct tnode {
+	uint32_t child[2];       /* node index, 0 = none (root is never a child) */
+	bool set;                /* whole prefix is part of the set */
+};
+
+struct trie {
+	struct tnode *nodes;     /* node pool, nodes[0] is the root */
+	uint32_t size;           /* allocated nodes */
+	uint32_t used;           /* nodes handed out from the pool */
+	uint32_t free;           /* free list, chained through child[0] */
+	uint8_t family;
+	uint8_t bits;
+};
+
+struct bop {
+	const char *name;
+	const char *desc;
+	bool (*f)(struct trie *t, uint8_t *key, uint32_t prefix);
+};
+
 struct op {
 	const char *name;
 	const char *desc;
@@ -782,6 +802,419 @@ struct op ops[] = {
 	  .f6.a1 = cidr_print6 },
 };
 
+static bool key_bit(const uint8_t *key, uint32_t i)
+{
+	return (key[i / 8] >> (7 - (i % 8))) & 1;
+}
+
+static void key_mask(uint8_t *key, uint32_t prefix)
+{
+	uint32_t i;
+
+	for (i = prefix; i < 128; i++)
+		key[i / 8] &= ~(1 << (7 - (i % 8)));
+}
+
+/* advance key to the following prefix of given size, false on overflow */
+static bool key_next(uint8_t *key, uint32_t prefix)
+{
+	int idx;
+	uint8_t bit;
+
+	if (prefix == 0)
+		return false;
+
+	key_mask(key, prefix);
+
+	idx = (prefix - 1) / 8;
+	bit = 1 << (7 - ((prefix - 1) % 8));
+
+	do {
+		key[idx] += bit;
+
+		if (key[idx] >= bit)
+			return true;
+
+		bit = 1;
+	}
+	while (idx-- > 0);
+
+	return false;
+}
+
+static void trie_init(struct trie *t, uint8_t family)
+{
+	memset(t, 0, sizeof(*t));
+
+	t->family = family;
+	t->bits = (family == AF_INET) ? 32 : 128;
+}
+
+static uint32_t tnode_alloc(struct trie *t)
+{
+	uint32_t idx;
+	struct tnode *n;
+
+	if (t->free)
+	{
+		idx = t->free;
+		t->free = t->nodes[idx].child[0];
+	}
+	else
+	{
+		if (t->used == t->size)
+		{
+			t->size = t->size ? t->size * 2 : 256;
+			n = realloc(t->nodes, t->size * sizeof(*n));
+
+			if (!n)
+			{
+				fprintf(stderr, "out of memory\n");
+				exit(255);
+			}
+
+			t->nodes = n;
+		}
+
+		idx = t->used++;
+	}
+
+	memset(&t->nodes[idx], 0, sizeof(t->nodes[idx]));
+
+	return idx;
+}
+
+static void tnode_clear(struct trie *t, uint32_t idx)
+{
+	uint32_t i, c;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (!(c = t->nodes[idx].child[i]))
+			continue;
+
+		tnode_clear(t, c);
+
+		t->nodes[c].child[0] = t->free;
+		t->nodes[c].child[1] = 0;
+		t->free = c;
+
+		t->nodes[idx].child[i] = 0;
+	}
+
+	t->nodes[idx].set = false;
+}
+
+static bool trie_add(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	uint32_t path[129];
+	uint32_t d, c, c0, c1;
+
+	if (!t->used)
+		tnode_alloc(t);
+
+	path[0] = 0;
+
+	for (d = 0; d < prefix; d++)
+	{
+		if (t->nodes[path[d]].set)
+			return true;
+
+		if (!(c = t->nodes[path[d]].child[key_bit(key, d)]))
+		{
+			c = tnode_alloc(t);
+			t->nodes[path[d]].child[key_bit(key, d)] = c;
+		}
+
+		path[d+1] = c;
+	}
+
+	if (t->nodes[path[prefix]].set)
+		return true;
+
+	tnode_clear(t, path[prefix]);
+	t->nodes[path[prefix]].set = true;
+
+	/* fold complete sibling pairs into their parent */
+	for (d = prefix; d > 0; d--)
+	{
+		c0 = t->nodes[path[d-1]].child[0];
+		c1 = t->nodes[path[d-1]].child[1];
+
+		if (!c0 || !c1 || !t->nodes[c0].set || !t->nodes[c1].set)
+			break;
+
+		tnode_clear(t, path[d-1]);
+		t->nodes[path[d-1]].set = true;
+	}
+
+	return true;
+}
+
+static bool trie_sub(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	uint32_t path[129];
+	uint32_t d, c;
+
+	if (!t->used)
+		return true;
+
+	path[0] = 0;
+
+	for (d = 0; d < prefix; d++)
+	{
+		/* split a covering prefix into its halves */
+		if (t->nodes[path[d]].set)
+		{
+			t->nodes[path[d]].set = false;
+
+			c = tnode_alloc(t);
+			t->nodes[c].set = true;
+			t->nodes[path[d]].child[0] = c;
+
+			c = tnode_alloc(t);
+			t->nodes[c].set = true;
+			t->nodes[path[d]].child[1] = c;
+		}
+
+		if (!(c = t->nodes[path[d]].child[key_bit(key, d)]))
+			return true;
+
+		path[d+1] = c;
+	}
+
+	tnode_clear(t, path[prefix]);
+
+	/* unlink nodes left empty */
+	for (d = prefix; d > 0; d--)
+	{
+		c = path[d];
+
+		if (t->nodes[c].set || t->nodes[c].child[0] || t->nodes[c].child[1])
+			break;
+
+		t->nodes[path[d-1]].child[key_bit(key, d-1)] = 0;
+
+		t->nodes[c].child[0] = t->free;
+		t->free = c;
+	}
+
+	return true;
+}
+
+static bool trie_contains(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	uint32_t d, c = 0;
+
+	if (!t->used)
+		return false;
+
+	for (d = 0; ; d++)
+	{
+		if (t->nodes[c].set)
+			return true;
+
+		if ((d == prefix) || !(c = t->nodes[c].child[key_bit(key, d)]))
+			break;
+	}
+
+	return false;
+}
+
+/* find the first prefix of given size at or after key outside the set */
+static bool trie_next(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	uint32_t d, c;
+
+	key_mask(key, prefix);
+
+	while (t->used)
+	{
+		for (d = 0, c = 0; !t->nodes[c].set && (d < prefix); d++)
+			if (!(c = t->nodes[c].child[key_bit(key, d)]))
+				return true;
+
+		/* covered at depth d or overlapping below, skip past it */
+		if (!key_next(key, d))
+			return false;
+	}
+
+	return true;
+}
+
+static void trie_key_print(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	struct cidr a;
+
+	a.family = t->family;
+	a.prefix = prefix;
+	memcpy(&a.addr, key, (t->family == AF_INET) ? 4 : 16);
+
+	if (!inet_ntop(a.family, &a.addr, a.buf.v6, sizeof(a.buf.v6)))
+		return;
+
+	if (prefix < t->bits)
+		printf("%s/%u\n", a.buf.v6, prefix);
+	else
+		printf("%s\n", a.buf.v6);
+}
+
+static void trie_print(struct trie *t, uint32_t idx, uint8_t *key, uint32_t d)
+{
+	uint32_t i;
+
+	if (t->nodes[idx].set)
+	{
+		trie_key_print(t, key, d);
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		if (!t->nodes[idx].child[i])
+			continue;
+
+		if (i)
+			key[d / 8] |= (1 << (7 - (d % 8)));
+
+		trie_print(t, t->nodes[idx].child[i], key, d + 1);
+		key_mask(key, d);
+	}
+}
+
+static bool trie_aggregate(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	uint8_t k[16] = { 0 };
+
+	if (t->used)
+		trie_print(t, 0, k, 0);
+
+	return true;
+}
+
+static bool trie_query_contains(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	printf("%u\n", trie_contains(t, key, prefix));
+	return true;
+}
+
+static bool trie_query_next(struct trie *t, uint8_t *key, uint32_t prefix)
+{
+	if (!trie_next(t, key, prefix))
+	{
+		fprintf(stderr, "overflow during 'next'\n");
+		return false;
+	}
+
+	trie_key_print(t, key, prefix);
+	return true;
+}
+
+struct bop bops[] = {
+	{ .name = "add",
+	  .desc = "Add prefix to the set, a line without operation does the same",
+	  .f = trie_add },
+
+	{ .name = "sub",
+	  .desc = "Remove prefix from the set, splitting covering prefixes",
+	  .f = trie_sub },
+
+	{ .name = "contains",
+	  .desc = "Print '1' if prefix is fully covered by the set or '0' if not",
+	  .f = trie_query_contains },
+
+	{ .name = "next",
+	  .desc = "Print first prefix of given size at or after the address "
+	          "outside the set",
+	  .f = trie_query_next },
+
+	{ .name = "aggregate",
+	  .desc = "Print the minimal list of prefixes covering the set, ipv4 "
+	          "first",
+	  .f = trie_aggregate },
+};
+
+static int batch(FILE *in)
+{
+	char line[256], *op, *arg;
+	int i, status = 0;
+	unsigned int lineno = 0;
+	uint8_t key[16];
+	struct cidr *a;
+	struct trie t4, t6;
+
+	trie_init(&t4, AF_INET);
+	trie_init(&t6, AF_INET6);
+
+	while (fgets(line, sizeof(line), in))
+	{
+		lineno++;
+
+		if (!(op = strtok(line, " \t\r\n")) || (*op == '#'))
+			continue;
+
+		arg = strtok(NULL, " \t\r\n");
+
+		for (i = 0; i < sizeof(bops) / sizeof(bops[0]); i++)
+			if (!strcmp(bops[i].name, op))
+				break;
+
+		if (i == sizeof(bops) / sizeof(bops[0]))
+		{
+			if (arg)
+			{
+				fprintf(stderr, "line %u: unknown operation '%s'\n",
+				        lineno, op);
+				status = 6;
+				continue;
+			}
+
+			arg = op;
+			i = 0;
+		}
+
+		if (bops[i].f == trie_aggregate)
+		{
+			trie_aggregate(&t4, NULL, 0);
+			trie_aggregate(&t6, NULL, 0);
+			continue;
+		}
+
+		if (!arg)
+		{
+			fprintf(stderr, "line %u: '%s' requires an argument\n",
+			        lineno, bops[i].name);
+			status = 2;
+			continue;
+		}
+
+		a = strchr(arg, ':') ? cidr_parse6(arg) : cidr_parse4(arg);
+
+		if (!a)
+		{
+			fprintf(stderr, "line %u: invalid address argument for '%s'\n",
+			        lineno, bops[i].name);
+			status = 3;
+			continue;
+		}
+
+		memset(key, 0, sizeof(key));
+		memcpy(key, &a->addr, (a->family == AF_INET) ? 4 : 16);
+		key_mask(key, a->prefix);
+
+		if (!bops[i].f((a->family == AF_INET) ? &t4 : &t6, key, a->prefix) &&
+		    !status)
+			status = 1;
+
+		free(a);
+	}
+
+	free(t4.nodes);
+	free(t6.nodes);
+
+	return status;
+}
+
 static void usage(const char *prog)
 {
 	int i;
@@ -818,6 +1251,17 @@ static void usage(const char *prog)
 			fprintf(stderr, "    Only applicable to ipv4-addresses.\n\n");
 	}
 
+	fprintf(stderr,
+	        "  %s batch\n"
+	        "    Read one operation per line from stdin and apply it to a "
+	        "prefix set,\n    results are printed one per line. "
+	        "Batch operations:\n\n", prog);
+
+	for (i = 0; i < sizeof(bops) / sizeof(bops[0]); i++)
+		fprintf(stderr, "    %s%s\n      %s.\n\n", bops[i].name,
+		        (bops[i].f == trie_aggregate) ? "" : " {ipv4/ipv6}",
+		        bops[i].desc);
+
 	fprintf(stderr,
 	        "Examples:\n\n"
 	        " Calculate a DHCP range:\n\n"
@@ -826,8 +1270,11 @@ static void usage(const char *prog)
 			"  192.168.1.250\n\n"
 			" Count number of prefixes:\n\n"
 			"  $ %s 2001:0DB8:FDEF::/48 howmany ::/64\n"
-			"  65536\n\n",
-	        prog, prog);
+			"  65536\n\n"
+			" Aggregate a prefix list:\n\n"
+			"  $ printf '10.0.0.0/25\\n10.0.0.128/25\\naggregate\\n' | %s batch\n"
+			"  10.0.0.0/24\n\n",
+	        prog, prog, prog);
 
 	exit(1);
 }
@@ -919,6 +1366,9 @@ int main(int argc, char **argv)
 	char **arg = argv+2;
 	struct cidr *a;
 
+	if ((argc == 2) && !strcmp(argv[1], "batch"))
+		return batch(stdin);
+
 	if (argc < 3)
 		usage(argv[0]);
 
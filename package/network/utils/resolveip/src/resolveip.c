@@ -3,43 +3,207 @@
  * Extended by Jo-Philipp Wich <jow@openwrt.org> for use in OpenWrt.
  *
  * You may use this program under the terms of the GPLv2 license.
+ *
+ * Every name is looked up by a child process of its own, so slow lookups
+ * run side by side and a lookup past its timeout can simply be killed;
+ * getaddrinfo() itself can not be interrupted.
  */
 
 #include <string.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+
+#define MAX_PARALLEL	8
 
+/* exit codes, also used per name */
+#define RES_OK		0
+#define RES_TIMEOUT	1
+#define RES_NOTFOUND	2
+#define RES_FORMAT	3
 
-static void abort_query(int sig)
+struct query {
+	const char *name;
+	pid_t pid;
+	int fd;
+	int status;
+	long long deadline;
+	char *buf;
+	size_t len;
+};
+
+static long long now_ms(void)
 {
-	exit(1);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
 static void show_usage(void)
 {
 	printf("Usage:\n");
 	printf("	resolveip -h\n");
-	printf("	resolveip [-t timeout] hostname\n");
-	printf("	resolveip -4 [-t timeout] hostname\n");
-	printf("	resolveip -6 [-t timeout] hostname\n");
+	printf("	resolveip [-t timeout] [-T deadline] [-p parallel] hostname...\n");
+	printf("	resolveip -4 [-t timeout] [-T deadline] [-p parallel] hostname...\n");
+	printf("	resolveip -6 [-t timeout] [-T deadline] [-p parallel] hostname...\n");
+	printf("\n");
+	printf("	-t  seconds per name (default 3)\n");
+	printf("	-T  seconds for all names (default none)\n");
+	printf("	-p  names looked up at the same time (default %d)\n", MAX_PARALLEL);
+	printf("\n");
+	printf("	With several names every address is printed as \"hostname address\",\n");
+	printf("	in the order the names were given.\n");
 	exit(255);
 }
 
-int main(int argc, char **argv)
+static int resolve(const char *name, const struct addrinfo *hints, FILE *out)
 {
-	int timeout = 3;
-	int opt;
 	char ipaddr[INET6_ADDRSTRLEN];
 	void *addr;
 	struct addrinfo *res, *rp;
-	struct sigaction sa = {	.sa_handler = &abort_query };
+
+	if (getaddrinfo(name, NULL, hints, &res))
+		return RES_NOTFOUND;
+
+	for (rp = res; rp != NULL; rp = rp->ai_next)
+	{
+		addr = (rp->ai_family == AF_INET)
+			? (void *)&((struct sockaddr_in *)rp->ai_addr)->sin_addr
+			: (void *)&((struct sockaddr_in6 *)rp->ai_addr)->sin6_addr
+		;
+
+		if (!inet_ntop(rp->ai_family, addr, ipaddr, INET6_ADDRSTRLEN - 1))
+			return RES_FORMAT;
+
+		fprintf(out, "%s\n", ipaddr);
+	}
+
+	freeaddrinfo(res);
+	return RES_OK;
+}
+
+static int query_start(struct query *q, const struct addrinfo *hints,
+                       long long deadline)
+{
+	int fds[2];
+	FILE *out;
+	int ret;
+
+	if (pipe(fds))
+		return -1;
+
+	q->pid = fork();
+	if (q->pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (q->pid == 0)
+	{
+		close(fds[0]);
+		out = fdopen(fds[1], "w");
+		if (!out)
+			_exit(RES_NOTFOUND);
+
+		ret = resolve(q->name, hints, out);
+		if (fclose(out) && ret == RES_OK)
+			ret = RES_NOTFOUND;
+
+		_exit(ret);
+	}
+
+	close(fds[1]);
+	q->fd = fds[0];
+	q->deadline = deadline;
+	return 0;
+}
+
+static void query_finish(struct query *q, int timed_out)
+{
+	int status;
+
+	if (timed_out)
+		kill(q->pid, SIGKILL);
+
+	close(q->fd);
+	q->fd = -1;
+
+	while (waitpid(q->pid, &status, 0) < 0 && errno == EINTR);
+
+	if (timed_out)
+		q->status = RES_TIMEOUT;
+	else if (WIFEXITED(status))
+		q->status = WEXITSTATUS(status);
+	else
+		q->status = RES_TIMEOUT;
+
+	/* partial answers are no answers */
+	if (q->status != RES_OK)
+		q->len = 0;
+}
+
+/* returns -1 once the child closed its end */
+static int query_read(struct query *q)
+{
+	char *buf;
+	ssize_t r;
+
+	buf = realloc(q->buf, q->len + 512);
+	if (!buf)
+		return -1;
+
+	q->buf = buf;
+	r = read(q->fd, q->buf + q->len, 512);
+	if (r < 0 && errno == EINTR)
+		return 0;
+	if (r <= 0)
+		return -1;
+
+	q->len += r;
+	return 0;
+}
+
+static void query_print(const struct query *q, int prefix)
+{
+	const char *p = q->buf, *e = q->buf + q->len, *nl;
+
+	while (p < e)
+	{
+		nl = memchr(p, '\n', e - p);
+		if (!nl)
+			break;
+
+		if (prefix)
+			printf("%s ", q->name);
+
+		fwrite(p, 1, nl - p + 1, stdout);
+		p = nl + 1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int timeout = 3;
+	int total = 0;
+	int parallel = MAX_PARALLEL;
+	int opt, i, n, next, running, ret;
+	long long now, end, wait;
+	struct query *q;
+	struct pollfd *pfd;
+	int *pq;
 	struct addrinfo hints = {
 		.ai_family   = AF_UNSPEC,
 		.ai_socktype = SOCK_STREAM,
@@ -47,7 +211,7 @@ int main(int argc, char **argv)
 		.ai_flags    = 0
 	};
 
-	while ((opt = getopt(argc, argv, "46t:h")) > -1)
+	while ((opt = getopt(argc, argv, "46t:T:p:h")) > -1)
 	{
 		switch ((char)opt)
 		{
@@ -65,6 +229,18 @@ int main(int argc, char **argv)
 					show_usage();
 				break;
 
+			case 'T':
+				total = atoi(optarg);
+				if (total <= 0)
+					show_usage();
+				break;
+
+			case 'p':
+				parallel = atoi(optarg);
+				if (parallel <= 0)
+					show_usage();
+				break;
+
 			case 'h':
 				show_usage();
 				break;
@@ -74,25 +250,108 @@ int main(int argc, char **argv)
 	if (!argv[optind])
 		show_usage();
 
-	sigaction(SIGALRM, &sa, NULL);
-	alarm(timeout);
+	n = argc - optind;
+	q = calloc(n, sizeof(*q));
+	pfd = calloc(n, sizeof(*pfd));
+	pq = calloc(n, sizeof(*pq));
+	if (!q || !pfd || !pq)
+		exit(RES_NOTFOUND);
+
+	for (i = 0; i < n; i++)
+	{
+		q[i].name = argv[optind + i];
+		q[i].fd = -1;
+		q[i].status = -1;
+	}
 
-	if (getaddrinfo(argv[optind], NULL, &hints, &res))
-		exit(2);
+	now = now_ms();
+	end = total ? now + total * 1000LL : 0;
+	next = running = 0;
 
-	for (rp = res; rp != NULL; rp = rp->ai_next)
+	while (next < n || running > 0)
 	{
-		addr = (rp->ai_family == AF_INET)
-			? (void *)&((struct sockaddr_in *)rp->ai_addr)->sin_addr
-			: (void *)&((struct sockaddr_in6 *)rp->ai_addr)->sin6_addr
-		;
+		now = now_ms();
 
-		if (!inet_ntop(rp->ai_family, addr, ipaddr, INET6_ADDRSTRLEN - 1))
-			exit(3);
+		/* overall deadline: drop the running ones, skip the rest */
+		if (end && now >= end)
+		{
+			for (i = 0; i < n; i++)
+			{
+				if (q[i].fd >= 0)
+					query_finish(&q[i], 1);
+				else if (q[i].status < 0)
+					q[i].status = RES_TIMEOUT;
+			}
+			break;
+		}
+
+		while (next < n && running < parallel)
+		{
+			if (query_start(&q[next], &hints, now + timeout * 1000LL))
+			{
+				/* out of processes, retry once one has finished */
+				if (running)
+					break;
+				q[next].status = RES_NOTFOUND;
+			}
+			else
+			{
+				running++;
+			}
+			next++;
+		}
+
+		wait = end ? end - now : -1;
+		for (i = 0, ret = 0; i < n; i++)
+		{
+			if (q[i].fd < 0)
+				continue;
+
+			if (q[i].deadline <= now)
+			{
+				query_finish(&q[i], 1);
+				running--;
+				continue;
+			}
+
+			if (wait < 0 || q[i].deadline - now < wait)
+				wait = q[i].deadline - now;
+
+			pfd[ret].fd = q[i].fd;
+			pfd[ret].events = POLLIN;
+			pq[ret++] = i;
+		}
+
+		if (!ret)
+			continue;
+
+		if (poll(pfd, ret, wait) < 0 && errno != EINTR)
+			break;
+
+		for (i = 0; i < ret; i++)
+		{
+			if (!pfd[i].revents)
+				continue;
+
+			if (query_read(&q[pq[i]]) < 0)
+			{
+				query_finish(&q[pq[i]], 0);
+				running--;
+			}
+		}
+	}
+
+	ret = RES_OK;
+	for (i = 0; i < n; i++)
+	{
+		if (q[i].fd >= 0)
+			query_finish(&q[i], 1);
+
+		query_print(&q[i], n > 1);
 
-		printf("%s\n", ipaddr);
+		if (ret == RES_OK && q[i].status != RES_OK)
+			ret = q[i].status < 0 ? RES_TIMEOUT : q[i].status;
 	}
 
-	freeaddrinfo(res);
-	exit(0);
+	exit(ret);
 }
@@ -26,21 +26,36 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/select.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <net/if.h>
+#include <linux/nl80211.h>
+
+#include <unl.h>
 
 #include "iwinfo.h"
 
 #define RUN_DIR			"/var/run"
 #define LEDS_BASEPATH		"/sys/class/leds/"
 #define BACKEND_RETRY_DELAY	500000
+#define POLL_BACKOFF_MAX	8	/* fallback polling, times refresh */
+#define POLL_CQM_FACTOR		16	/* safety polling with CQM events */
 
 char *ifname;
 int qual_max;
 
+/* nl80211 connection quality monitor */
+struct unl cqm_unl;
+struct unl cqm_ev;
+int cqm_ifindex;
+int cqm_state;		/* 0: not armed, 1: armed, -1: unsupported */
+int cqm_event;
+
 struct led {
 	char *sysfspath;
 	FILE *controlfd;
@@ -184,6 +199,124 @@ int open_backend(const struct iwinfo_ops **iw, const char *ifname)
 	return 0;
 }
 
+int cqm_init(const char *ifname)
+{
+	cqm_ifindex = if_nametoindex(ifname);
+	if ( ! cqm_ifindex )
+		goto return_error;
+
+	if ( unl_genl_init(&cqm_unl, "nl80211") )
+		goto return_error;
+
+	if ( unl_genl_init(&cqm_ev, "nl80211") )
+		goto cleanup_unl;
+
+	if ( unl_genl_subscribe(&cqm_ev, "mlme") )
+		goto cleanup_ev;
+
+	/* events carry no sequence numbers */
+	nl_socket_disable_seq_check(cqm_ev.sock);
+
+	if ( nl_socket_set_nonblocking(cqm_ev.sock) )
+		goto cleanup_ev;
+
+	return 0;
+
+cleanup_ev:
+	unl_free(&cqm_ev);
+cleanup_unl:
+	unl_free(&cqm_unl);
+return_error:
+	cqm_state = -1;
+	return -1;
+}
+
+/* ask for an event once the signal leaves thold +/- hyst (dBm) */
+int cqm_arm(int thold, int hyst)
+{
+	struct nl_msg *msg;
+	struct nlattr *cqm;
+	int err;
+
+	msg = unl_nl80211_vif_msg(&cqm_unl, cqm_ifindex, NL80211_CMD_SET_CQM, false);
+	if ( ! msg )
+		return -1;
+
+	cqm = nla_nest_start(msg, NL80211_ATTR_CQM);
+	if ( ! cqm )
+		goto nla_put_failure;
+
+	NLA_PUT_U32(msg, NL80211_ATTR_CQM_RSSI_THOLD, thold);
+	NLA_PUT_U32(msg, NL80211_ATTR_CQM_RSSI_HYST, hyst);
+	nla_nest_end(msg, cqm);
+
+	err = unl_genl_request(&cqm_unl, msg, NULL, NULL);
+	if ( err == -EOPNOTSUPP )
+		cqm_state = -1;
+	else
+		cqm_state = err ? 0 : 1;
+
+	return err;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return -1;
+}
+
+int cqm_event_cb(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *attr;
+
+	if ( gnlh->cmd != NL80211_CMD_NOTIFY_CQM )
+		return NL_SKIP;
+
+	attr = unl_find_attr(&cqm_ev, msg, NL80211_ATTR_IFINDEX);
+	if ( attr && nla_get_u32(attr) == cqm_ifindex )
+		cqm_event = 1;
+
+	return NL_SKIP;
+}
+
+/* wait up to timeout usecs for a CQM event on the interface */
+int cqm_wait(int timeout)
+{
+	struct timeval tv;
+	struct nl_cb *cb;
+	fd_set fds;
+	int fd;
+
+	if ( cqm_state < 0 )
+	{
+		usleep(timeout);
+		return 0;
+	}
+
+	fd = nl_socket_get_fd(cqm_ev.sock);
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+
+	tv.tv_sec = timeout / 1000000;
+	tv.tv_usec = timeout % 1000000;
+
+	if ( select(fd + 1, &fds, NULL, NULL, &tv) <= 0 )
+		return 0;
+
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if ( ! cb )
+		return 0;
+
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, cqm_event_cb, NULL);
+
+	cqm_event = 0;
+	while ( nl_recvmsgs(cqm_ev.sock, cb) > 0 );
+
+	nl_cb_put(cb);
+
+	return cqm_event;
+}
+
 void update_leds(rule_t *rules, int q)
 {
 	rule_t *rule = rules;
@@ -208,7 +341,7 @@ void update_leds(rule_t *rules, int q)
 
 int main(int argc, char **argv)
 {
-	int i,q,q0,r,s;
+	int i,q,q0,r,s,t,sig,hyst;
 	const struct iwinfo_ops *iw = NULL;
 	rule_t *headrule = NULL, *currentrule = NULL;
 
@@ -264,13 +397,31 @@ int main(int argc, char **argv)
 	}
 	log_rules(headrule);
 
+	if ( cqm_init(ifname) )
+		syslog(LOG_INFO, "no nl80211 events on %s, polling\n", ifname);
+
 	q0 = -1;
+	t = r;
 	do {
 		q = quality(iw, ifname);
 		if ( q < q0 - s || q > q0 + s ) {
 			update_leds(headrule, q);
 			q0=q;
-		};
+			t = r;
+
+			/* re-arm the monitor around the new level, one unit
+			 * of the nl80211 quality scale is one dB */
+			if ( q != -1 && cqm_state >= 0 && ! iw->signal(ifname, &sig) ) {
+				hyst = ( s * qual_max ) / 100;
+				cqm_arm(sig, hyst > 0 ? hyst : 1);
+			}
+		} else if ( cqm_state > 0 ) {
+			/* events drive updates, poll only as safety net */
+			t = r * POLL_CQM_FACTOR;
+		} else if ( t < r * POLL_BACKOFF_MAX ) {
+			/* stable signal, back off */
+			t *= 2;
+		}
 		// re-open backend...
 		if ( q == -1 && q0 == -1 ) {
 			if (iw) {
@@ -281,7 +432,7 @@ int main(int argc, char **argv)
 			while (open_backend(&iw, ifname))
 				usleep(BACKEND_RETRY_DELAY);
 		}
-		usleep(r);
+		cqm_wait(t);
 	} while(1);
 
 	iwinfo_finish();
@@ -0,0 +1,153 @@
+/*
+ * Kernel AES for the audio payload. This file is part of Shairport.
+ * Copyright (c) James Laird 2013
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "common.h"
+#include "aes_alg.h"
+
+#if defined(__linux__) && defined(AF_ALG)
+#include <linux/if_alg.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+static int tfm_fd = -1, op_fd = -1;
+
+// a round trip through the kernel only pays off with an engine (or an
+// arch specific cbc) behind it: the generic cbc(aes-generic) template
+// is slower than OpenSSL. picks the best cbc(aes) driver in /proc/crypto
+static int find_driver(char *driver, int size) {
+    char line[128], name[64] = "", drv[64] = "";
+    int prio, best = -1;
+    FILE *f = fopen("/proc/crypto", "r");
+
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "name : %63s", name) == 1)
+            continue;
+        if (sscanf(line, "driver : %63s", drv) == 1)
+            continue;
+        if (sscanf(line, "priority : %d", &prio) == 1 &&
+            !strcmp(name, "cbc(aes)") && prio > best) {
+            best = prio;
+            snprintf(driver, size, "%s", drv);
+        }
+    }
+    fclose(f);
+    if (best < 0 || !strncmp(driver, "cbc(", 4))
+        return -1;
+    return 0;
+}
+
+int aes_alg_open(const uint8_t *key) {
+    struct sockaddr_alg sa;
+
+    aes_alg_close();
+
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy((char *)sa.salg_type, "skcipher");
+    if (find_driver((char *)sa.salg_name, sizeof(sa.salg_name)) < 0)
+        return -1;
+
+    tfm_fd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    if (tfm_fd < 0)
+        return -1;
+    if (bind(tfm_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        setsockopt(tfm_fd, SOL_ALG, ALG_SET_KEY, key, 16) < 0 ||
+        (op_fd = accept(tfm_fd, NULL, 0)) < 0) {
+        aes_alg_close();
+        return -1;
+    }
+
+    debug(1, "decrypting with %s\n", sa.salg_name);
+    return 0;
+}
+
+int aes_alg_decrypt(uint8_t *buf, int len, const uint8_t *iv) {
+    char cbuf[CMSG_SPACE(sizeof(uint32_t)) +
+              CMSG_SPACE(sizeof(struct af_alg_iv) + 16)];
+    struct af_alg_iv *aiv;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+
+    memset(cbuf, 0, sizeof(cbuf));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_ALG;
+    cm->cmsg_type = ALG_SET_OP;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    *(uint32_t *)CMSG_DATA(cm) = ALG_OP_DECRYPT;
+
+    cm = CMSG_NXTHDR(&msg, cm);
+    cm->cmsg_level = SOL_ALG;
+    cm->cmsg_type = ALG_SET_IV;
+    cm->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + 16);
+    aiv = (struct af_alg_iv *)CMSG_DATA(cm);
+    aiv->ivlen = 16;
+    memcpy(aiv->iv, iv, 16);
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (sendmsg(op_fd, &msg, 0) != len)
+        return -1;
+    return read(op_fd, buf, len) == len ? 0 : -1;
+}
+
+void aes_alg_close(void) {
+    if (op_fd >= 0)
+        close(op_fd);
+    if (tfm_fd >= 0)
+        close(tfm_fd);
+    op_fd = tfm_fd = -1;
+}
+
+#else
+
+int aes_alg_open(const uint8_t *key) {
+    return -1;
+}
+
+int aes_alg_decrypt(uint8_t *buf, int len, const uint8_t *iv) {
+    return -1;
+}
+
+void aes_alg_close(void) {
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _AES_ALG_H
+#define _AES_ALG_H
+
+#include <stdint.h>
+
+// AES-128-CBC decryption through the kernel (AF_ALG), for targets where
+// a crypto engine drives cbc(aes). returns 0 when it is in use; otherwise
+// the caller decrypts in software
+int aes_alg_open(const uint8_t *key);
+// in place; len is a multiple of 16. returns 0 on success
+int aes_alg_decrypt(uint8_t *buf, int len, const uint8_t *iv);
+void aes_alg_close(void);
+
+#endif // _AES_ALG_H
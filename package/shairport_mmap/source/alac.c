@@ -183,36 +183,24 @@ static uint32_t readbits(alac_file *alac, int bits)
     return result;
 }
 
-/* reads a single bit */
-static int readbit(alac_file *alac)
+/* 64 bits of the stream from bit 'pos' on, msb first. at least 57 of
+ * them are valid, enough for a whole rice codeword from one load. reads
+ * up to 8 bytes past the current byte, see ALAC_INPUT_PADDING */
+static inline uint64_t peekbits_64(const unsigned char *base, uint32_t pos)
 {
-    int result;
-    int new_accumulator;
-
-    result = alac->input_buffer[0];
-
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result >> 7 & 1;
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + 1);
-
-    alac->input_buffer += (new_accumulator / 8);
-
-    alac->input_buffer_bitaccumulator = (new_accumulator % 8);
-
-    return result;
-}
-
-static void unreadbits(alac_file *alac, int bits)
-{
-    int new_accumulator = (alac->input_buffer_bitaccumulator - bits);
-
-    alac->input_buffer += (new_accumulator >> 3);
+    const unsigned char *p = base + (pos >> 3);
+    uint64_t v;
 
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
-    if (alac->input_buffer_bitaccumulator < 0)
-        alac->input_buffer_bitaccumulator *= -1;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&v, p, sizeof(v));
+    v = __builtin_bswap64(v);
+#else
+    v = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+        ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+        ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+        ((uint64_t)p[6] << 8)  |  (uint64_t)p[7];
+#endif
+    return v << (pos & 7);
 }
 
 /* various implementations of count_leading_zero:
@@ -308,44 +296,51 @@ found:
 
 #define RICE_THRESHOLD 8 // maximum number of bits for a rice prefix.
 
-static int32_t entropy_decode_value(alac_file* alac,
-                             int readSampleSize,
-                             int k,
-                             int rice_kmodifier_mask)
+/* decodes one value at bit *pos, from a single 64 bit window. gives the
+ * same result and stream position as reading it bit by bit */
+static inline int32_t entropy_decode_value(const unsigned char *base,
+                                           uint32_t *pos,
+                                           int readSampleSize,
+                                           int k,
+                                           int rice_kmodifier_mask)
 {
-    int32_t x = 0; // decoded value
+    uint64_t window = peekbits_64(base, *pos);
+    int32_t x; // decoded value
+    int ones;
 
     // read x, number of 1s before 0 represent the rice value.
-    while (x <= RICE_THRESHOLD && readbit(alac))
-    {
-        x++;
-    }
+    // the extra bit stops the count at RICE_THRESHOLD + 1
+    ones = count_leading_zeros(~(uint32_t)(window >> 32) |
+                               (0x80000000u >> (RICE_THRESHOLD + 1)));
 
-    if (x > RICE_THRESHOLD)
+    if (ones > RICE_THRESHOLD)
     {
         // read the number from the bit stream (raw value)
-        int32_t value;
-
-        value = readbits(alac, readSampleSize);
-
-        // mask value
-        value &= (((uint32_t)0xffffffff) >> (32 - readSampleSize));
-
-        x = value;
+        window <<= RICE_THRESHOLD + 1;
+        x = (uint32_t)(window >> (64 - readSampleSize));
+        *pos += RICE_THRESHOLD + 1 + readSampleSize;
     }
     else
     {
+        x = ones;
+        *pos += ones + 1; // and the 0
         if (k != 1)
         {
-            int extraBits = readbits(alac, k);
+            int extraBits = 0;
+
+            if (k)
+                extraBits = (uint32_t)((window << (ones + 1)) >> (64 - k));
 
             // x = x * (2^k - 1)
             x *= (((1 << k) - 1) & rice_kmodifier_mask);
 
             if (extraBits > 1)
+            {
                 x += extraBits - 1;
+                *pos += k;
+            }
             else
-                unreadbits(alac, 1);
+                *pos += k - 1; // the last bit belongs to the next value
         }
     }
 
@@ -364,6 +359,8 @@ static void entropy_rice_decode(alac_file* alac,
     int             outputCount;
     int             history = rice_initialhistory;
     int             signModifier = 0;
+    unsigned char  *base = alac->input_buffer;
+    uint32_t        pos = alac->input_buffer_bitaccumulator;
 
     for (outputCount = 0; outputCount < outputSize; outputCount++)
     {
@@ -377,7 +374,7 @@ static void entropy_rice_decode(alac_file* alac,
         else k = rice_kmodifier;
 
         // note: don't use rice_kmodifier_mask here (set mask to 0xFFFFFFFF)
-        decodedValue = entropy_decode_value(alac, readSampleSize, k, 0xFFFFFFFF);
+        decodedValue = entropy_decode_value(base, &pos, readSampleSize, k, 0xFFFFFFFF);
 
         decodedValue += signModifier;
         finalValue = (decodedValue + 1) / 2; // inc by 1 and shift out sign bit
@@ -405,12 +402,17 @@ static void entropy_rice_decode(alac_file* alac,
             k = count_leading_zeros(history) + ((history + 16) / 64) - 24;
 
             // note: blockSize is always 16bit
-            blockSize = entropy_decode_value(alac, 16, k, rice_kmodifier_mask);
+            blockSize = entropy_decode_value(base, &pos, 16, k, rice_kmodifier_mask);
 
             // got blockSize 0s
             if (blockSize > 0)
             {
-                memset(&outputBuffer[outputCount + 1], 0, blockSize * sizeof(*outputBuffer));
+                int zeros = blockSize;
+
+                // a corrupt block size must not run past the buffer
+                if (zeros > outputSize - outputCount - 1)
+                    zeros = outputSize - outputCount - 1;
+                memset(&outputBuffer[outputCount + 1], 0, zeros * sizeof(*outputBuffer));
                 outputCount += blockSize;
             }
 
@@ -420,6 +422,9 @@ static void entropy_rice_decode(alac_file* alac,
             history = 0;
         }
     }
+
+    alac->input_buffer = base + (pos >> 3);
+    alac->input_buffer_bitaccumulator = pos & 7;
 }
 
 #define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
@@ -429,6 +434,128 @@ static void entropy_rice_decode(alac_file* alac,
                                 ((v > 0) ? (1) : \
                                            (0)))
 
+/* the general case of predictor_decompress_fir_adapt below, unrolled for
+ * the predictor orders seen in practice: 4 and 8. only the low 32 bits of
+ * the sum are used, so a 64 bit accumulator gives the same result as the
+ * wrapping int sum */
+#if defined(__mips_dsp)
+typedef long long fir_acc_t;
+#define FIR_MAC(acc, a, b) (acc = __builtin_mips_madd(acc, (a), (b)))
+#else
+typedef int fir_acc_t;
+#define FIR_MAC(acc, a, b) (acc += (a) * (b))
+#endif
+
+/* one step of the coefficient adaptation, tap j of order n */
+#define FIR_ADAPT_POS(n, j) \
+    if (error_val > 0) \
+    { \
+        int val = b0 - buffer_out[j]; \
+        int sign = SIGN_ONLY(val); \
+        coef[(n) - (j)] -= sign; \
+        val *= sign; \
+        error_val -= (val >> quant) * (j); \
+    }
+#define FIR_ADAPT_NEG(n, j) \
+    if (error_val < 0) \
+    { \
+        int val = b0 - buffer_out[j]; \
+        int sign = - SIGN_ONLY(val); \
+        coef[(n) - (j)] -= sign; \
+        val *= sign; \
+        error_val -= (val >> quant) * (j); \
+    }
+
+static void predictor_fir_adapt_4(int32_t *error_buffer,
+                                  int32_t *buffer_out,
+                                  int output_size,
+                                  int readsamplesize,
+                                  int16_t *coef,
+                                  int quant)
+{
+    int i;
+
+    for (i = 4 + 1; i < output_size; i++)
+    {
+        int32_t b0 = buffer_out[0];
+        int error_val = error_buffer[i];
+        fir_acc_t sum = 0;
+        int outval;
+
+        FIR_MAC(sum, buffer_out[4] - b0, coef[0]);
+        FIR_MAC(sum, buffer_out[3] - b0, coef[1]);
+        FIR_MAC(sum, buffer_out[2] - b0, coef[2]);
+        FIR_MAC(sum, buffer_out[1] - b0, coef[3]);
+
+        outval = (1 << (quant-1)) + (int)sum;
+        outval = outval >> quant;
+        outval = outval + b0 + error_val;
+        buffer_out[4+1] = SIGN_EXTENDED32(outval, readsamplesize);
+
+        if (error_val > 0)
+        {
+            FIR_ADAPT_POS(4, 1) FIR_ADAPT_POS(4, 2)
+            FIR_ADAPT_POS(4, 3) FIR_ADAPT_POS(4, 4)
+        }
+        else if (error_val < 0)
+        {
+            FIR_ADAPT_NEG(4, 1) FIR_ADAPT_NEG(4, 2)
+            FIR_ADAPT_NEG(4, 3) FIR_ADAPT_NEG(4, 4)
+        }
+
+        buffer_out++;
+    }
+}
+
+static void predictor_fir_adapt_8(int32_t *error_buffer,
+                                  int32_t *buffer_out,
+                                  int output_size,
+                                  int readsamplesize,
+                                  int16_t *coef,
+                                  int quant)
+{
+    int i;
+
+    for (i = 8 + 1; i < output_size; i++)
+    {
+        int32_t b0 = buffer_out[0];
+        int error_val = error_buffer[i];
+        fir_acc_t sum = 0;
+        int outval;
+
+        FIR_MAC(sum, buffer_out[8] - b0, coef[0]);
+        FIR_MAC(sum, buffer_out[7] - b0, coef[1]);
+        FIR_MAC(sum, buffer_out[6] - b0, coef[2]);
+        FIR_MAC(sum, buffer_out[5] - b0, coef[3]);
+        FIR_MAC(sum, buffer_out[4] - b0, coef[4]);
+        FIR_MAC(sum, buffer_out[3] - b0, coef[5]);
+        FIR_MAC(sum, buffer_out[2] - b0, coef[6]);
+        FIR_MAC(sum, buffer_out[1] - b0, coef[7]);
+
+        outval = (1 << (quant-1)) + (int)sum;
+        outval = outval >> quant;
+        outval = outval + b0 + error_val;
+        buffer_out[8+1] = SIGN_EXTENDED32(outval, readsamplesize);
+
+        if (error_val > 0)
+        {
+            FIR_ADAPT_POS(8, 1) FIR_ADAPT_POS(8, 2)
+            FIR_ADAPT_POS(8, 3) FIR_ADAPT_POS(8, 4)
+            FIR_ADAPT_POS(8, 5) FIR_ADAPT_POS(8, 6)
+            FIR_ADAPT_POS(8, 7) FIR_ADAPT_POS(8, 8)
+        }
+        else if (error_val < 0)
+        {
+            FIR_ADAPT_NEG(8, 1) FIR_ADAPT_NEG(8, 2)
+            FIR_ADAPT_NEG(8, 3) FIR_ADAPT_NEG(8, 4)
+            FIR_ADAPT_NEG(8, 5) FIR_ADAPT_NEG(8, 6)
+            FIR_ADAPT_NEG(8, 7) FIR_ADAPT_NEG(8, 8)
+        }
+
+        buffer_out++;
+    }
+}
+
 static void predictor_decompress_fir_adapt(int32_t *error_buffer,
                                            int32_t *buffer_out,
                                            int output_size,
@@ -482,23 +609,22 @@ static void predictor_decompress_fir_adapt(int32_t *error_buffer,
         }
     }
 
-#if 0
-    /* 4 and 8 are very common cases (the only ones i've seen). these
-     * should be unrolled and optimised
-     */
+    /* 4 and 8 are very common cases (the only ones i've seen) */
     if (predictor_coef_num == 4)
     {
-        /* FIXME: optimised general case */
+        predictor_fir_adapt_4(error_buffer, buffer_out, output_size,
+                              readsamplesize, predictor_coef_table,
+                              predictor_quantitization);
         return;
     }
 
-    if (predictor_coef_table == 8)
+    if (predictor_coef_num == 8)
     {
-        /* FIXME: optimised general case */
+        predictor_fir_adapt_8(error_buffer, buffer_out, output_size,
+                              readsamplesize, predictor_coef_table,
+                              predictor_quantitization);
         return;
     }
-#endif
-
 
     /* general case */
     if (predictor_coef_num > 0)
@@ -578,6 +704,35 @@ static void deinterlace_16(int32_t *buffer_a, int32_t *buffer_b,
     int i;
     if (numsamples <= 0) return;
 
+    /* the usual case: stereo, little endian */
+    if (numchannels == 2 && !host_bigendian)
+    {
+        int16_t *out = buffer_out;
+
+        if (interlacing_leftweight)
+        {
+            for (i = 0; i < numsamples; i++)
+            {
+                int32_t difference = buffer_b[i];
+                int16_t right = buffer_a[i] - ((difference * interlacing_leftweight) >> interlacing_shift);
+
+                out[0] = right + difference;
+                out[1] = right;
+                out += 2;
+            }
+        }
+        else
+        {
+            for (i = 0; i < numsamples; i++)
+            {
+                out[0] = buffer_a[i];
+                out[1] = buffer_b[i];
+                out += 2;
+            }
+        }
+        return;
+    }
+
     /* weighted interlacing */
     if (interlacing_leftweight)
     {
@@ -664,13 +819,8 @@ static void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
                 right |= uncompressed_bytes_buffer_b[i] & mask;
             }
 
-            ((uint8_t*)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
-
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
+            ((int32_t*)buffer_out)[i * numchannels] = (uint32_t)left << 8;
+            ((int32_t*)buffer_out)[i * numchannels + 1] = (uint32_t)right << 8;
         }
 
         return;
@@ -694,13 +844,8 @@ static void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
             right |= uncompressed_bytes_buffer_b[i] & mask;
         }
 
-        ((uint8_t*)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
-
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
+        ((int32_t*)buffer_out)[i * numchannels] = (uint32_t)left << 8;
+        ((int32_t*)buffer_out)[i * numchannels + 1] = (uint32_t)right << 8;
 
     }
 
@@ -883,9 +1028,7 @@ void alac_decode_frame(alac_file *alac,
                     sample |= alac->uncompressed_bytes_buffer_a[i] & mask;
                 }
 
-                ((uint8_t*)outbuffer)[i * alac->numchannels * 3] = (sample) & 0xFF;
-                ((uint8_t*)outbuffer)[i * alac->numchannels * 3 + 1] = (sample >> 8) & 0xFF;
-                ((uint8_t*)outbuffer)[i * alac->numchannels * 3 + 2] = (sample >> 16) & 0xFF;
+                ((int32_t*)outbuffer)[i * alac->numchannels] = (uint32_t)sample << 8;
             }
             break;
         }
@@ -1131,7 +1274,8 @@ alac_file *alac_create(int samplesize, int numchannels)
 
     newfile->samplesize = samplesize;
     newfile->numchannels = numchannels;
-    newfile->bytespersample = (samplesize / 8) * numchannels;
+    // 24 bit samples come out in 32 bits, see alac.h
+    newfile->bytespersample = (samplesize == 24 ? 4 : samplesize / 8) * numchannels;
 
     return newfile;
 }
@@ -5,6 +5,12 @@
 
 typedef struct alac_file alac_file;
 
+/* the decoder reads ahead of the bit it is at: the input buffer must
+ * have this many readable bytes after the end of the frame */
+#define ALAC_INPUT_PADDING 8
+
+/* 16 bit samples are decoded to int16_t, 24 bit samples to int32_t
+ * with the audio in the top 24 bits */
 alac_file *alac_create(int samplesize, int numchannels);
 void alac_decode_frame(alac_file *alac,
                        unsigned char *inbuffer,
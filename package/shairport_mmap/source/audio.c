@@ -26,7 +26,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/timerfd.h>
 #include "audio.h"
+#include "common.h"
 #include "config.h"
 
 #ifdef CONFIG_SNDIO
@@ -41,7 +47,7 @@ extern audio_output audio_pulse;
 #ifdef CONFIG_ALSA
 extern audio_output audio_alsa;
 #endif
-extern audio_output audio_dummy, audio_pipe;
+extern audio_output audio_dummy, audio_pipe, audio_multi;
 
 static audio_output *outputs[] = {
 #ifdef CONFIG_SNDIO
@@ -58,6 +64,7 @@ static audio_output *outputs[] = {
 #endif
     &audio_dummy,
     &audio_pipe,
+    &audio_multi,
     NULL
 };
 
@@ -89,3 +96,61 @@ void audio_ls_outputs(void) {
         (*out)->help();
     }
 }
+
+static long long pace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void audio_pace_start(audio_pace *p, int sample_rate) {
+    if (p->fd < 0)
+        p->fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    p->rate = sample_rate;
+    p->start_ns = pace_now();
+    p->samples = 0;
+}
+
+void audio_pace_wait(audio_pace *p, int samples) {
+    long long deadline, now = pace_now();
+    struct itimerspec its;
+    struct timespec ts;
+    uint64_t expired;
+
+    p->samples += samples;
+    deadline = p->start_ns + p->samples * 1000000000LL / p->rate;
+
+    // after a stall, start over rather than rush to catch up
+    if (now - deadline > 1000000000LL) {
+        debug(1, "output pacing %lld ms behind, restarting the clock\n",
+              (now - deadline) / 1000000);
+        p->start_ns = now;
+        p->samples = 0;
+        return;
+    }
+    if (deadline <= now)
+        return;
+
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    if (p->fd >= 0) {
+        memset(&its, 0, sizeof(its));
+        its.it_value = ts;
+        if (timerfd_settime(p->fd, TFD_TIMER_ABSTIME, &its, NULL) == 0 &&
+            read(p->fd, &expired, sizeof(expired)) == sizeof(expired))
+            return;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+int audio_pace_delay(audio_pace *p) {
+    long long due = (pace_now() - p->start_ns) * p->rate / 1000000000LL;
+    return p->samples > due ? p->samples - due : 0;
+}
+
+void audio_pace_stop(audio_pace *p) {
+    if (p->fd >= 0)
+        close(p->fd);
+    p->fd = -1;
+}
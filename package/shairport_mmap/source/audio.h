@@ -11,15 +11,47 @@ typedef struct {
     void (*deinit)(void);
 
     void (*start)(int sample_rate);
-    // block of samples
+    // may be NULL, for 16 bit only. called instead of start() with the
+    // stream's sample size, 16 or 24; returns what play() and get_buffer()
+    // then take: 16, or int32_t samples with the audio in the top (32) or
+    // the low 24 bits (24). 16 bit streams are always played as 16 bit
+    int (*start_format)(int sample_rate, int bits);
+    // block of samples, in the format start_format picked
     void (*play)(short buf[], int samples);
     void (*stop)(void);
 
     // may be NULL, in which case soft volume is applied
     void (*volume)(double vol);
+
+    // may be NULL. room for at least 'samples' samples to be written in
+    // place, handed over by commit(); NULL when there is none right now,
+    // in which case the block goes through play() after all
+    short *(*get_buffer)(int samples);
+    void (*commit)(int samples);
+
+    // may be NULL. samples handed over that have not been played yet
+    int (*delay)(void);
 } audio_output;
 
 audio_output *audio_get_output(char *name);
 void audio_ls_outputs(void);
 
+// paces an output with no clock of its own against CLOCK_MONOTONIC,
+// from the samples handed over since start
+typedef struct {
+    int fd;                     // timerfd, or -1: clock_nanosleep
+    int rate;
+    long long start_ns;
+    long long samples;
+} audio_pace;
+
+#define AUDIO_PACE_INIT { .fd = -1 }
+
+void audio_pace_start(audio_pace *p, int sample_rate);
+// accounts for 'samples' more and blocks until they would have played
+void audio_pace_wait(audio_pace *p, int samples);
+// samples accounted for that are not yet due: the output's delay
+int audio_pace_delay(audio_pace *p);
+void audio_pace_stop(audio_pace *p);
+
 #endif //_AUDIO_H
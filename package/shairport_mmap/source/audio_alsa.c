@@ -37,9 +37,13 @@ static void help(void);
 static int init(int argc, char **argv);
 static void deinit(void);
 static void start(int sample_rate);
+static int start_format(int sample_rate, int bits);
 static void play(short buf[], int samples);
 static void stop(void);
 static void volume(double vol);
+static short *get_buffer(int samples);
+static void commit(int samples);
+static int delay(void);
 
 audio_output audio_alsa = {
     .name = "alsa",
@@ -47,13 +51,19 @@ audio_output audio_alsa = {
     .init = &init,
     .deinit = &deinit,
     .start = &start,
+    .start_format = &start_format,
     .stop = &stop,
     .play = &play,
-    .volume = NULL
+    .volume = NULL,
+    .get_buffer = &get_buffer,
+    .commit = &commit,
+    .delay = &delay
 };
 
 static snd_pcm_t *alsa_handle = NULL;
 static snd_pcm_hw_params_t *alsa_params = NULL;
+static snd_pcm_uframes_t alsa_mmap_offset;
+static int alsa_bits;       // sample format, as for start_format
 
 static snd_mixer_t *alsa_mix_handle = NULL;
 static snd_mixer_elem_t *alsa_mix_elem = NULL;
@@ -151,10 +161,22 @@ static void deinit(void) {
 }
 
 static void start(int sample_rate) {
-    if (sample_rate != 44100)
-        die("Unexpected sample rate!");
+    start_format(sample_rate, 16);
+}
 
-    int ret, dir = 0;
+// a 24 bit stream goes out as S32, or S24 in 32 bits, when the device
+// takes one natively; otherwise the player brings it down to S16
+static int start_format(int sample_rate, int bits) {
+    static const struct {
+        snd_pcm_format_t format;
+        int bits;
+    } formats[] = {
+        { SND_PCM_FORMAT_S32, 32 },
+        { SND_PCM_FORMAT_S24, 24 },
+        { SND_PCM_FORMAT_S16, 16 },
+    };
+    unsigned int rate = sample_rate;
+    int ret, dir = 0, i;
     snd_pcm_uframes_t frames = 64;
     ret = snd_pcm_open(&alsa_handle, alsa_out_dev, SND_PCM_STREAM_PLAYBACK, 0);
     if (ret < 0)
@@ -163,13 +185,22 @@ static void start(int sample_rate) {
     snd_pcm_hw_params_alloca(&alsa_params);
     snd_pcm_hw_params_any(alsa_handle, alsa_params);
     snd_pcm_hw_params_set_access(alsa_handle, alsa_params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
-    snd_pcm_hw_params_set_format(alsa_handle, alsa_params, SND_PCM_FORMAT_S16);
+    for (i = bits == 16 ? 2 : 0; i < 2; i++)
+        if (!snd_pcm_hw_params_test_format(alsa_handle, alsa_params, formats[i].format))
+            break;
+    snd_pcm_hw_params_set_format(alsa_handle, alsa_params, formats[i].format);
+    alsa_bits = formats[i].bits;
     snd_pcm_hw_params_set_channels(alsa_handle, alsa_params, 2);
-    snd_pcm_hw_params_set_rate_near(alsa_handle, alsa_params, (unsigned int *)&sample_rate, &dir);
+    snd_pcm_hw_params_set_rate_near(alsa_handle, alsa_params, &rate, &dir);
+    if (rate != sample_rate)
+        warn("the device plays %u Hz, not %d Hz", rate, sample_rate);
     snd_pcm_hw_params_set_period_size_near(alsa_handle, alsa_params, &frames, &dir);
     ret = snd_pcm_hw_params(alsa_handle, alsa_params);
     if (ret < 0)
         die("unable to set hw parameters: %s\n", snd_strerror(ret));
+
+    debug(1, "alsa: %d bit samples at %u Hz\n", alsa_bits, rate);
+    return alsa_bits;
 }
 
 static void play(short buf[], int samples) {
@@ -180,6 +211,64 @@ static void play(short buf[], int samples) {
         die("Failed to write to PCM device: %s\n", snd_strerror(err));
 }
 
+static void recover(int err) {
+    err = snd_pcm_recover(alsa_handle, err, 0);
+    if (err < 0)
+        die("Failed to write to PCM device: %s\n", snd_strerror(err));
+}
+
+// the player writes into the ring itself. only a block that fits before
+// the ring wraps is offered, the rest goes through play()
+static short *get_buffer(int samples) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t frames = samples;
+    snd_pcm_sframes_t avail;
+    int err, width;
+
+    for (;;) {
+        avail = snd_pcm_avail_update(alsa_handle);
+        if (avail < 0) {
+            recover(avail);
+            continue;
+        }
+        if (avail >= samples)
+            break;
+        err = snd_pcm_wait(alsa_handle, 1000);
+        if (err < 0)
+            recover(err);
+    }
+
+    err = snd_pcm_mmap_begin(alsa_handle, &areas, &alsa_mmap_offset, &frames);
+    if (err < 0) {
+        recover(err);
+        return NULL;
+    }
+    width = alsa_bits == 16 ? 16 : 32;
+    if (frames < samples || areas[0].step != 2 * width || areas[1].addr != areas[0].addr ||
+        areas[1].first != areas[0].first + width) {
+        snd_pcm_mmap_commit(alsa_handle, alsa_mmap_offset, 0);
+        return NULL;
+    }
+    return (short *)((char *)areas[0].addr + areas[0].first / 8 +
+                     alsa_mmap_offset * width / 4);
+}
+
+static void commit(int samples) {
+    snd_pcm_sframes_t err = snd_pcm_mmap_commit(alsa_handle, alsa_mmap_offset, samples);
+    if (err >= 0 && err != samples)
+        err = -EPIPE;
+    if (err < 0)
+        recover(err);
+}
+
+static int delay(void) {
+    snd_pcm_sframes_t frames;
+
+    if (snd_pcm_delay(alsa_handle, &frames) < 0)
+        return 0;
+    return frames;
+}
+
 static void stop(void) {
     if (alsa_handle) {
         snd_pcm_drain(alsa_handle);
@@ -26,11 +26,9 @@
 
 #include <stdio.h>
 #include <unistd.h>
-#include <sys/time.h>
 #include "audio.h"
 
-int Fs;
-long long starttime, samples_played;
+static audio_pace pace = AUDIO_PACE_INIT;
 
 static int init(int argc, char **argv) {
     return 0;
@@ -40,31 +38,20 @@ static void deinit(void) {
 }
 
 static void start(int sample_rate) {
-    Fs = sample_rate;
-    starttime = 0;
-    samples_played = 0;
+    audio_pace_start(&pace, sample_rate);
     printf("dummy audio output started at Fs=%d Hz\n", sample_rate);
 }
 
 static void play(short buf[], int samples) {
-    struct timeval tv;
-
-    // this is all a bit expensive but it's long-term stable.
-    gettimeofday(&tv, NULL);
-
-    long long nowtime = tv.tv_usec + 1e6*tv.tv_sec;
-
-    if (!starttime)
-        starttime = nowtime;
-
-    samples_played += samples;
-
-    long long finishtime = starttime + samples_played * 1e6 / Fs;
+    audio_pace_wait(&pace, samples);
+}
 
-    usleep(finishtime - nowtime);
+static int delay(void) {
+    return audio_pace_delay(&pace);
 }
 
 static void stop(void) {
+    audio_pace_stop(&pace);
     printf("dummy audio stopped\n");
 }
 
@@ -80,5 +67,6 @@ audio_output audio_dummy = {
     .start = &start,
     .stop = &stop,
     .play = &play,
-    .volume = NULL
+    .volume = NULL,
+    .delay = &delay
 };
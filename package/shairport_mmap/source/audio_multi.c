@@ -0,0 +1,312 @@
+/*
+ * Fan-out audio driver. This file is part of Shairport.
+ * Copyright (c) James Laird 2013
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// hands each block the player produces to several outputs at once. the
+// block is written once into a shared frame; every output has its own
+// queue of references to those frames and its own thread, and may run
+// behind by a fixed latency offset. the first output sets the pace: the
+// player blocks when its queue is full, while the others drop blocks
+// when they fall behind.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+#include "audio.h"
+
+#define MULTI_MAX       4       // outputs
+#define MULTI_QUEUE     8       // blocks queued per output
+#define MULTI_SILENCE   1024    // samples per block of the latency offset
+
+typedef struct multi_frame {
+    struct multi_frame *next;   // free list
+    int refs;                   // queues and outputs still holding it
+    int size, samples;
+    short data[];
+} multi_frame;
+
+typedef struct {
+    audio_output *out;
+    int offset_ms;
+    int silence;                // samples of the offset left to play
+    multi_frame *queue[MULTI_QUEUE];
+    int head, count;
+    int queued;                 // samples in the queue
+    int dropped;
+    pthread_cond_t more;
+    pthread_t thread;
+} multi_output;
+
+static multi_output outputs[MULTI_MAX];
+static int noutputs;
+static int stopping;
+
+static pthread_mutex_t multi_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t room = PTHREAD_COND_INITIALIZER;
+static multi_frame *free_frames;
+static multi_frame *pending;    // handed out by get_buffer
+
+static const short zeros[2 * MULTI_SILENCE];
+
+// multi_mutex held
+static void frame_release(multi_frame *f) {
+    if (--f->refs > 0)
+        return;
+    f->next = free_frames;
+    free_frames = f;
+}
+
+static multi_frame *frame_get(int samples) {
+    multi_frame *f;
+
+    pthread_mutex_lock(&multi_mutex);
+    f = free_frames;
+    if (f)
+        free_frames = f->next;
+    pthread_mutex_unlock(&multi_mutex);
+
+    if (f && f->size < samples) {
+        free(f);
+        f = NULL;
+    }
+    if (!f) {
+        f = malloc(sizeof(*f) + samples * 2 * sizeof(short));
+        if (!f)
+            die("could not allocate an output block");
+        f->size = samples;
+    }
+    f->samples = 0;
+    return f;
+}
+
+static void frame_push(multi_frame *f) {
+    multi_output *o;
+    int i;
+
+    pthread_mutex_lock(&multi_mutex);
+    while (outputs[0].count == MULTI_QUEUE && !stopping)
+        pthread_cond_wait(&room, &multi_mutex);
+
+    f->refs = 1;    // ours, until it is queued everywhere
+    for (i = 0; i < noutputs; i++) {
+        o = outputs + i;
+        if (o->count == MULTI_QUEUE) {
+            if (!o->dropped++)
+                warn("output %s cannot keep up, dropping audio", o->out->name);
+            continue;
+        }
+        o->queue[(o->head + o->count++) % MULTI_QUEUE] = f;
+        o->queued += f->samples;
+        f->refs++;
+        pthread_cond_signal(&o->more);
+    }
+    frame_release(f);
+    pthread_mutex_unlock(&multi_mutex);
+}
+
+static void *output_thread(void *arg) {
+    multi_output *o = arg;
+    multi_frame *f;
+    int n;
+
+    // the latency offset goes out as silence ahead of the stream
+    while (o->silence > 0 && !stopping) {
+        n = o->silence < MULTI_SILENCE ? o->silence : MULTI_SILENCE;
+        o->out->play((short *)zeros, n);
+        __atomic_sub_fetch(&o->silence, n, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&multi_mutex);
+    while (1) {
+        while (!o->count && !stopping)
+            pthread_cond_wait(&o->more, &multi_mutex);
+        if (!o->count)
+            break;
+        f = o->queue[o->head];
+        o->head = (o->head + 1) % MULTI_QUEUE;
+        o->count--;
+        o->queued -= f->samples;
+        if (o == outputs)
+            pthread_cond_signal(&room);
+        pthread_mutex_unlock(&multi_mutex);
+
+        o->out->play(f->data, f->samples);
+
+        pthread_mutex_lock(&multi_mutex);
+        frame_release(f);
+    }
+    pthread_mutex_unlock(&multi_mutex);
+
+    return NULL;
+}
+
+static void start(int sample_rate) {
+    multi_output *o;
+    int i;
+
+    stopping = 0;
+    for (i = 0; i < noutputs; i++) {
+        o = outputs + i;
+        o->out->start(sample_rate);
+        o->silence = o->offset_ms * sample_rate / 1000;
+        o->head = o->count = o->queued = 0;
+        o->dropped = 0;
+        pthread_create(&o->thread, NULL, output_thread, o);
+    }
+}
+
+static void play(short buf[], int samples) {
+    multi_frame *f = frame_get(samples);
+
+    memcpy(f->data, buf, samples * 2 * sizeof(short));
+    f->samples = samples;
+    frame_push(f);
+}
+
+// the player decodes straight into a shared frame
+static short *get_buffer(int samples) {
+    pending = frame_get(samples);
+    return pending->data;
+}
+
+static void commit(int samples) {
+    pending->samples = samples;
+    frame_push(pending);
+    pending = NULL;
+}
+
+// what is queued for the first output and its offset, then its own delay
+static int delay(void) {
+    multi_output *o = outputs;
+    int d;
+
+    pthread_mutex_lock(&multi_mutex);
+    d = o->queued + __atomic_load_n(&o->silence, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&multi_mutex);
+    if (o->out->delay)
+        d += o->out->delay();
+    return d;
+}
+
+// lets the queues drain
+static void stop(void) {
+    int i;
+
+    pthread_mutex_lock(&multi_mutex);
+    stopping = 1;
+    for (i = 0; i < noutputs; i++)
+        pthread_cond_signal(&outputs[i].more);
+    pthread_cond_broadcast(&room);
+    pthread_mutex_unlock(&multi_mutex);
+
+    for (i = 0; i < noutputs; i++) {
+        pthread_join(outputs[i].thread, NULL);
+        if (outputs[i].dropped)
+            debug(1, "output %s dropped %d blocks\n",
+                  outputs[i].out->name, outputs[i].dropped);
+        outputs[i].out->stop();
+    }
+}
+
+static int init(int argc, char **argv) {
+    multi_output *o;
+    char *name, *colon;
+    int i, j, first;
+
+    for (first = 0; first < argc; first = i + 1) {
+        // each output: NAME[:MS] [its own options] and '+' before the next
+        for (i = first; i < argc && strcmp(argv[i], "+"); i++)
+            ;
+        if (i == first)
+            die("empty output in multi arguments");
+        if (noutputs == MULTI_MAX)
+            die("multi takes at most %d outputs", MULTI_MAX);
+
+        o = outputs + noutputs;
+        name = strdup(argv[first]);
+        colon = strchr(name, ':');
+        if (colon) {
+            *colon = 0;
+            o->offset_ms = atoi(colon + 1);
+            if (o->offset_ms < 0)
+                die("bad latency offset for output %s", name);
+        }
+        o->out = audio_get_output(name);
+        if (!o->out || o->out->init == init)
+            die("invalid output %s in multi arguments", name);
+        for (j = 0; j < noutputs; j++)
+            if (outputs[j].out == o->out)
+                die("output %s given twice", name);
+        free(name);
+
+        // the backends run getopt over argv[-1..], which is the name here
+        o->out->init(i - first - 1, argv + first + 1);
+        pthread_cond_init(&o->more, NULL);
+        noutputs++;
+    }
+    if (!noutputs)
+        die("multi needs at least one output");
+
+    return 0;
+}
+
+static void deinit(void) {
+    multi_frame *f;
+    int i;
+
+    for (i = 0; i < noutputs; i++) {
+        outputs[i].out->deinit();
+        pthread_cond_destroy(&outputs[i].more);
+    }
+    noutputs = 0;
+    while ((f = free_frames)) {
+        free_frames = f->next;
+        free(f);
+    }
+}
+
+static void help(void) {
+    printf("    multi takes a list of outputs, separated by +:\n");
+    printf("        NAME[:MS] [options for NAME] + NAME[:MS] [options] ...\n");
+    printf("    each plays the same stream, MS milliseconds late (default 0).\n");
+    printf("    the first output sets the pace; volume is applied in software.\n");
+    printf("    e.g. -o multi -- alsa -d hw:0 + pipe:200 /tmp/shairport.fifo\n");
+}
+
+audio_output audio_multi = {
+    .name = "multi",
+    .help = &help,
+    .init = &init,
+    .deinit = &deinit,
+    .start = &start,
+    .stop = &stop,
+    .play = &play,
+    .volume = NULL,
+    .get_buffer = &get_buffer,
+    .commit = &commit,
+    .delay = &delay
+};
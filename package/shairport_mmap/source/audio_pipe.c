@@ -31,18 +31,18 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/time.h>
 #include "common.h"
 #include "audio.h"
 
 static int fd = -1;
 static char *pipename = NULL;
 static int Fs;
-static long long starttime, samples_played;
+static audio_pace pace = AUDIO_PACE_INIT;     // while there is no reader
 
 static void stop(void) {
     close(fd);
     fd = -1;
+    audio_pace_stop(&pace);
 }
 
 static void start(int sample_rate) {
@@ -62,35 +62,15 @@ static void start(int sample_rate) {
     }
 
     Fs = sample_rate;
-    starttime = 0;
-    samples_played = 0;
-}
-
-// Wait procedure taken from audio_dummy.c
-static void wait_samples(int samples) {
-    struct timeval tv;
-
-    // this is all a bit expensive but it's long-term stable.
-    gettimeofday(&tv, NULL);
-
-    long long nowtime = tv.tv_usec + 1e6*tv.tv_sec;
-
-    if (!starttime)
-        starttime = nowtime;
-
-    samples_played += samples;
-
-    long long finishtime = starttime + samples_played * 1e6 / Fs;
-
-    usleep(finishtime - nowtime);
+    audio_pace_start(&pace, sample_rate);
 }
 
 static void play(short buf[], int samples) {
     if (fd < 0) {
-        wait_samples(samples);
+        audio_pace_wait(&pace, samples);
 
         // check if the other end is ready every 5 seconds
-        if (samples_played > 5 * Fs)
+        if (pace.samples > 5 * Fs)
             start(Fs);
 
         return;
@@ -100,6 +80,11 @@ static void play(short buf[], int samples) {
         stop();
 }
 
+// with a reader, the pipe's own backpressure sets the pace
+static int delay(void) {
+    return fd < 0 ? audio_pace_delay(&pace) : 0;
+}
+
 static int init(int argc, char **argv) {
     struct stat sb;
 
@@ -136,5 +121,6 @@ audio_output audio_pipe = {
     .start = &start,
     .stop = &stop,
     .play = &play,
-    .volume = NULL
+    .volume = NULL,
+    .delay = &delay
 };
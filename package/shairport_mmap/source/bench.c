@@ -0,0 +1,474 @@
+/*
+ * Offline player benchmark. This file is part of Shairport.
+ * Copyright (c) James Laird 2013
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// replays a captured audio stream through the real player: the packets go
+// in through player_put_packet, the decoder thread decrypts and decodes
+// them, and the player thread takes them out through buffer_get_frame and
+// stuff_buffer into an output that only counts. the RTP layer is replaced
+// by the few calls the player makes into it; resend requests are counted,
+// not answered, so a lost packet stays lost.
+//
+// without -r the stream goes in as fast as the player takes it, with the
+// buffer kept around its starting fill. the CPU time of each thread is
+// reported per frame: the feeding thread is the receive stage, the
+// decoder thread the decode stage, the player thread the playout stage.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include "common.h"
+#include "player.h"
+#include "rtp.h"
+#include "stats.h"
+
+typedef struct {
+    uint8_t *data;
+    int len;
+} bench_packet;
+
+typedef struct {
+    int index;          // into the capture, times the loops
+    int64_t due;        // delivery time from the start, ns
+} bench_delivery;
+
+static bench_packet *packets;
+static int npackets, packets_size;
+
+static int realtime;
+static audio_pace pace = AUDIO_PACE_INIT;
+static uint64_t samples_out;
+static int64_t player_cpu;
+static uint32_t resends_asked;
+
+// without -r the player is held to what has been fed: it does not take
+// the buffer below its start fill, and the feeder does not go more than
+// FEED_AHEAD frames above it
+#define FEED_AHEAD      32
+#define BENCH_BATCH     16      // packets per player_put_packets, as RTP_BATCH
+static pthread_mutex_t feed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t feed_cond = PTHREAD_COND_INITIALIZER;
+static int fed, feed_done;
+static uint32_t frames0;
+
+static int played(void) {
+    return __atomic_load_n(&stats.frames, __ATOMIC_RELAXED) - frames0;
+}
+
+// the part of the RTP layer the player uses
+int64_t rtp_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void rtp_resend_missing(seq_t first, seq_t last) {
+    resends_asked += seq_diff(first, last) + 1;
+}
+
+void rtp_resend_arrived(seq_t seqno) {
+}
+
+void rtp_resend_poll(seq_t played) {
+}
+
+void rtp_resend_flush(void) {
+}
+
+void shairport_shutdown(int retval) {
+    exit(retval);
+}
+
+static int64_t cpu_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int init(int argc, char **argv) {
+    return 0;
+}
+
+static void deinit(void) {
+}
+
+static void start(int sample_rate) {
+    if (realtime)
+        audio_pace_start(&pace, sample_rate);
+}
+
+static void play(short buf[], int samples) {
+    if (realtime) {
+        audio_pace_wait(&pace, samples);
+    } else {
+        pthread_mutex_lock(&feed_mutex);
+        pthread_cond_broadcast(&feed_cond);
+        while (!feed_done && fed - played() < config.buffer_start_fill)
+            pthread_cond_wait(&feed_cond, &feed_mutex);
+        pthread_mutex_unlock(&feed_mutex);
+    }
+    __atomic_add_fetch(&samples_out, samples, __ATOMIC_RELAXED);
+    __atomic_store_n(&player_cpu, cpu_ns(CLOCK_THREAD_CPUTIME_ID), __ATOMIC_RELAXED);
+}
+
+static int delay(void) {
+    return realtime ? audio_pace_delay(&pace) : 0;
+}
+
+static void stop(void) {
+    if (realtime)
+        audio_pace_stop(&pace);
+}
+
+static audio_output audio_bench = {
+    .name = "bench",
+    .init = &init,
+    .deinit = &deinit,
+    .start = &start,
+    .stop = &stop,
+    .play = &play,
+    .volume = NULL,
+    .delay = &delay
+};
+
+static void add_packet(uint8_t *p, int len) {
+    int type;
+
+    if (len < 12 + 16 || (p[0] & 0xc0) != 0x80)
+        return;
+    type = p[1] & ~0x80;
+    if (type == 0x56) {     // resent: the original follows a short header
+        p += 4;
+        len -= 4;
+        if (len < 12 + 16)
+            return;
+        type = p[1] & ~0x80;
+    }
+    if (type != 0x60)
+        return;
+
+    if (npackets == packets_size) {
+        packets_size = packets_size ? 2 * packets_size : 1024;
+        packets = realloc(packets, packets_size * sizeof(*packets));
+        if (!packets)
+            die("out of memory");
+    }
+    packets[npackets].data = p;
+    packets[npackets].len = len;
+    npackets++;
+}
+
+// captures need not be aligned
+static uint32_t get32(uint8_t *p, int swap) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static int get16be(uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+// classic pcap, UDP over IPv4 on ethernet, Linux cooked or raw IP;
+// port 0 takes the audio packets on any port
+static int load_pcap(uint8_t *buf, size_t size, int port) {
+    uint32_t magic = get32(buf, 0);
+    int swap, link, off = 0, iphl;
+    uint8_t *p, *end = buf + size;
+    uint32_t caplen;
+
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+        swap = 0;
+    else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+        swap = 1;
+    else
+        return -1;
+    if (size < 24)
+        return -1;
+    link = get32(buf + 20, swap);
+
+    switch (link) {
+        case 1:   off = 14; break;  // ethernet
+        case 113: off = 16; break;  // linux cooked
+        case 101:
+        case 12:  off = 0;  break;  // raw IP
+        default:
+            die("unsupported pcap link type %d", link);
+    }
+
+    for (p = buf + 24; p + 16 <= end; p += 16 + caplen) {
+        caplen = get32(p + 8, swap);
+        if (p + 16 + caplen > end)
+            break;
+        uint8_t *ip = p + 16 + off;
+        if (caplen < off + 28 || (ip[0] >> 4) != 4 || ip[9] != 17)
+            continue;
+        if (link == 1 && (p[16 + 12] != 0x08 || p[16 + 13] != 0x00))
+            continue;
+        if (get16be(ip + 6) & 0x3fff)   // fragments
+            continue;
+        iphl = (ip[0] & 0xf) * 4;
+        uint8_t *udp = ip + iphl;
+        int ulen = get16be(udp + 4) - 8;
+        if (udp + 8 + ulen > p + 16 + caplen || ulen < 0)
+            continue;
+        if (port && get16be(udp + 2) != port)
+            continue;
+        add_packet(udp + 8, ulen);
+    }
+    return 0;
+}
+
+// a raw dump is each packet with its length ahead of it, 16 bits big endian
+static void load_raw(uint8_t *buf, size_t size) {
+    uint8_t *p = buf, *end = buf + size;
+    int len;
+
+    while (p + 2 <= end) {
+        len = get16be(p);
+        p += 2;
+        if (p + len > end)
+            break;
+        add_packet(p, len);
+        p += len;
+    }
+}
+
+static void load(const char *path, int port) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf;
+    long size;
+
+    if (!f)
+        die("could not open %s", path);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size + 4);
+    if (!buf || fread(buf, 1, size, f) != size)
+        die("could not read %s", path);
+    fclose(f);
+
+    if (size < 4 || load_pcap(buf, size, port) < 0)
+        load_raw(buf, size);
+    if (!npackets)
+        die("no audio packets in %s", path);
+}
+
+static void hex(uint8_t *out, const char *in, const char *what) {
+    unsigned int b;
+    int i;
+
+    if (strlen(in) != 32)
+        die("%s must be 32 hex digits", what);
+    for (i = 0; i < 16; i++) {
+        if (sscanf(in + 2*i, "%2x", &b) != 1)
+            die("bad %s", what);
+        out[i] = b;
+    }
+}
+
+static int by_due(const void *a, const void *b) {
+    int64_t d = ((bench_delivery *)a)->due - ((bench_delivery *)b)->due;
+    return d < 0 ? -1 : d > 0;
+}
+
+static void sleep_until(int64_t t) {
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000;
+    ts.tv_nsec = t % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+static void usage(char *progname) {
+    printf("Usage: %s [options...] CAPTURE\n", progname);
+    printf("    CAPTURE is a pcap file, or packets each after a 16 bit big endian length\n");
+    printf("    -f FMTP     the a=fmtp: line of the ANNOUNCE (required)\n");
+    printf("    -k KEY      the decrypted AES key, in hex (required)\n");
+    printf("    -i IV       the AES IV, in hex (required)\n");
+    printf("    -p PORT     in a pcap, take the audio sent to this UDP port\n");
+    printf("    -r          play at real time, not as fast as possible\n");
+    printf("    -l PERCENT  drop this share of the packets\n");
+    printf("    -j MS       delay packets by up to MS milliseconds, reordering them\n");
+    printf("    -n LOOPS    play the capture this many times\n");
+    printf("    -b FILL     starting fill, frames\n");
+    printf("    -S SIZE     buffer size, frames\n");
+    printf("    -v          verbose; repeat for more\n");
+}
+
+int main(int argc, char **argv) {
+    stream_cfg stream;
+    char *fmtp = NULL, *key = NULL, *iv = NULL, *p;
+    double loss = 0;
+    int jitter_ms = 0, loops = 1, port = 0;
+    int i, j, n, batch, frame, total, opt;
+    bench_delivery *order;
+    int64_t period, t0, t1, feed_cpu, decode_cpu, proc0, feed0;
+    uint32_t frames, underruns0;
+    sigset_t set;
+
+    memset(&config, 0, sizeof(config));
+    config.buffer_start_fill = 220;
+    config.buffer_frames = 512;
+
+    while ((opt = getopt(argc, argv, "hf:k:i:p:rl:j:n:b:S:v")) > 0) {
+        switch (opt) {
+            default:
+                usage(argv[0]);
+                exit(1);
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            case 'f': fmtp = optarg; break;
+            case 'k': key = optarg; break;
+            case 'i': iv = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'r': realtime = 1; break;
+            case 'l': loss = atof(optarg) / 100; break;
+            case 'j': jitter_ms = atoi(optarg); break;
+            case 'n': loops = atoi(optarg); break;
+            case 'b': config.buffer_start_fill = atoi(optarg); break;
+            case 'S': config.buffer_frames = atoi(optarg); break;
+            case 'v': debuglev++; break;
+        }
+    }
+    if (optind != argc - 1 || !fmtp || !key || !iv || loops < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // the pacing timer and the player's threads keep their signals to
+    // themselves, as in shairport
+    sigfillset(&set);
+    sigdelset(&set, SIGINT);
+    sigdelset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    hex(stream.aeskey, key, "key");
+    hex(stream.aesiv, iv, "IV");
+    p = fmtp;
+    for (i = 0; i < sizeof(stream.fmtp)/sizeof(stream.fmtp[0]); i++)
+        stream.fmtp[i] = atoi(strsep(&p, " \t") ? : "0");
+    frame = stream.fmtp[1];
+    if (frame <= 0 || stream.fmtp[11] <= 0)
+        die("bad fmtp: %s", fmtp);
+    period = (int64_t)frame * 1000000000 / stream.fmtp[11];
+
+    load(argv[optind], port);
+    total = npackets * loops;
+    debug(1, "%d packets, %d frames to play\n", npackets, total);
+
+    // delivery order: late by up to the jitter, and some never
+    order = malloc(total * sizeof(*order));
+    if (!order)
+        die("out of memory");
+    srand(1);
+    for (i = n = 0; i < total; i++) {
+        if (loss > 0 && rand() < loss * RAND_MAX)
+            continue;
+        order[n].index = i;
+        order[n].due = i * period;
+        if (jitter_ms)
+            order[n].due += (int64_t)(rand() % (jitter_ms * 1000)) * 1000;
+        n++;
+    }
+    qsort(order, n, sizeof(*order), by_due);
+    if (!n)
+        die("every packet was dropped");
+
+    config.output = &audio_bench;
+    frames0 = __atomic_load_n(&stats.frames, __ATOMIC_RELAXED);
+    underruns0 = __atomic_load_n(&stats.underruns, __ATOMIC_RELAXED);
+    proc0 = cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+    feed0 = cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (player_play(&stream))
+        die("could not start the player");
+
+    // fast mode hands packets over in batches, as the receiver does
+    t0 = rtp_clock_ns();
+    for (i = 0; i < n; i += batch) {
+        player_packet pp[BENCH_BATCH];
+        batch = realtime ? 1 : (n - i < BENCH_BATCH ? n - i : BENCH_BATCH);
+        if (realtime)
+            sleep_until(t0 + order[i].due);
+        for (j = 0; j < batch; j++) {
+            bench_packet *pk = packets + order[i+j].index % npackets;
+            pp[j].seqno = order[i+j].index;
+            pp[j].timestamp = order[i+j].index * frame;
+            pp[j].arrival = t0 + order[i+j].due;
+            pp[j].data = pk->data + 12;
+            pp[j].len = pk->len - 12;
+        }
+        player_put_packets(pp, batch);
+        if (!realtime) {
+            pthread_mutex_lock(&feed_mutex);
+            for (j = 0; j < batch; j++)
+                if (fed < order[i+j].index + 1)
+                    fed = order[i+j].index + 1;
+            pthread_cond_broadcast(&feed_cond);
+            while (fed - played() > config.buffer_start_fill + FEED_AHEAD)
+                pthread_cond_wait(&feed_cond, &feed_mutex);
+            pthread_mutex_unlock(&feed_mutex);
+        }
+    }
+    pthread_mutex_lock(&feed_mutex);
+    feed_done = 1;
+    pthread_cond_broadcast(&feed_cond);
+    pthread_mutex_unlock(&feed_mutex);
+
+    // the rest plays out, until the buffer runs dry
+    while (__atomic_load_n(&stats.frames, __ATOMIC_RELAXED) - frames0 < total &&
+           __atomic_load_n(&stats.underruns, __ATOMIC_RELAXED) == underruns0 &&
+           rtp_clock_ns() - t0 < (total + config.buffer_start_fill) * period + 2000000000LL)
+        usleep(1000);
+    t1 = rtp_clock_ns();
+    feed_cpu = cpu_ns(CLOCK_THREAD_CPUTIME_ID) - feed0;
+    // the process, less the other two and what this thread spent loading
+    decode_cpu = cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - proc0 - feed_cpu -
+                 __atomic_load_n(&player_cpu, __ATOMIC_RELAXED);
+    frames = __atomic_load_n(&stats.frames, __ATOMIC_RELAXED) - frames0;
+    player_stop();
+
+    if (!frames)
+        die("nothing played");
+    printf("%u frames of %d samples in %.3f s, %.1f times real time\n",
+           frames, frame, (t1 - t0) / 1e9,
+           (double)frames * period / (t1 - t0));
+    printf("dropped %d, missing %u, late %u, underruns %u, resends asked %u\n",
+           total - n, stats.missing_frames, stats.late_packets,
+           stats.underruns, resends_asked);
+    printf("stuffed %u, removed %u samples, drift %d ppb\n",
+           stats.stuffed, stats.dropped, stats.drift_ppb);
+    printf("receive  %8lld ns/frame\n", (long long)(feed_cpu / frames));
+    printf("decode   %8lld ns/frame\n", (long long)(decode_cpu / frames));
+    printf("playout  %8lld ns/frame\n", (long long)(player_cpu / frames));
+
+    return 0;
+}
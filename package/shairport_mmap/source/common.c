@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <openssl/rsa.h>
 #include <openssl/pem.h>
 #include <openssl/evp.h>
@@ -150,29 +151,105 @@ static char super_secret_key[] =
 "2gG0N5hvJpzwwhbhXqFKA4zaaSrw622wDniAK5MlIE0tIAKKP4yxNGjoD2QYjhBGuhvkWKY=\n"
 "-----END RSA PRIVATE KEY-----";
 
-uint8_t *rsa_apply(uint8_t *input, int inlen, int *outlen, int mode) {
-    static RSA *rsa = NULL;
+static RSA *rsa;
+static pthread_once_t rsa_once = PTHREAD_ONCE_INIT;
+
+static void rsa_load(void) {
+    BIO *bmem = BIO_new_mem_buf(super_secret_key, -1);
+    rsa = PEM_read_bio_RSAPrivateKey(bmem, NULL, NULL, NULL);
+    BIO_free(bmem);
+    if (!rsa)
+        die("could not load the RSA key");
+    // the blinding factor and the Montgomery contexts of the CRT primes
+    // are made on first use and kept with the key
+    RSA_blinding_on(rsa, NULL);
+}
+
+// the first private operation costs the most; it is done here, so that the
+// first client does not wait for it
+static void *rsa_warm_thread(void *arg) {
+    uint8_t in[RSA_SIZE] = {0}, out[RSA_SIZE];
+
+    pthread_once(&rsa_once, rsa_load);
+    RSA_private_encrypt(0x20, in, out, rsa, RSA_PKCS1_PADDING);
+    debug(2, "RSA key ready\n");
+    return NULL;
+}
+
+void rsa_setup(void) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, rsa_warm_thread, NULL))
+        return;     // then the first rsa_apply does it
+    pthread_detach(thread);
+}
+
+// a client that comes back after a pause announces the same session key
+// again, so the last few are kept, by their ciphertext
+#define RSA_KEY_CACHE   4
+
+typedef struct {
+    int inlen, outlen;
+    uint8_t in[RSA_SIZE], out[RSA_SIZE];
+} rsa_key_entry;
 
-    if (!rsa) {
-        BIO *bmem = BIO_new_mem_buf(super_secret_key, -1);
-        rsa = PEM_read_bio_RSAPrivateKey(bmem, NULL, NULL, NULL);
-        BIO_free(bmem);
+static pthread_mutex_t rsa_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rsa_key_entry rsa_cache[RSA_KEY_CACHE];
+static int rsa_cache_next;
+
+static int rsa_cache_find(uint8_t *input, int inlen, uint8_t *out) {
+    int i, outlen = -1;
+
+    pthread_mutex_lock(&rsa_cache_mutex);
+    for (i = 0; i < RSA_KEY_CACHE; i++) {
+        if (rsa_cache[i].inlen == inlen && !memcmp(rsa_cache[i].in, input, inlen)) {
+            outlen = rsa_cache[i].outlen;
+            memcpy(out, rsa_cache[i].out, outlen);
+            break;
+        }
     }
+    pthread_mutex_unlock(&rsa_cache_mutex);
+    return outlen;
+}
+
+static void rsa_cache_add(uint8_t *input, int inlen, uint8_t *out, int outlen) {
+    rsa_key_entry *e;
+
+    pthread_mutex_lock(&rsa_cache_mutex);
+    e = rsa_cache + rsa_cache_next;
+    rsa_cache_next = (rsa_cache_next + 1) % RSA_KEY_CACHE;
+    e->inlen = inlen;
+    e->outlen = outlen;
+    memcpy(e->in, input, inlen);
+    memcpy(e->out, out, outlen);
+    pthread_mutex_unlock(&rsa_cache_mutex);
+}
+
+int rsa_apply(uint8_t *input, int inlen, uint8_t *out, int mode) {
+    int outlen;
+
+    pthread_once(&rsa_once, rsa_load);
+    if (inlen > RSA_size(rsa))
+        return -1;
 
-    uint8_t *out = malloc(RSA_size(rsa));
     switch (mode) {
         case RSA_MODE_AUTH:
-            *outlen = RSA_private_encrypt(inlen, input, out, rsa,
-                                          RSA_PKCS1_PADDING);
+            outlen = RSA_private_encrypt(inlen, input, out, rsa,
+                                         RSA_PKCS1_PADDING);
             break;
         case RSA_MODE_KEY:
-            *outlen = RSA_private_decrypt(inlen, input, out, rsa,
-                                          RSA_PKCS1_OAEP_PADDING);
+            outlen = rsa_cache_find(input, inlen, out);
+            if (outlen >= 0)
+                break;
+            outlen = RSA_private_decrypt(inlen, input, out, rsa,
+                                         RSA_PKCS1_OAEP_PADDING);
+            if (outlen >= 0)
+                rsa_cache_add(input, inlen, out, outlen);
             break;
         default:
             die("bad rsa mode");
     }
-    return out;
+    return outlen;
 }
 
 void command_start(void) {
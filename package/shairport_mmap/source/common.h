@@ -27,10 +27,13 @@ typedef struct {
     char *mdns_name;
     mdns_backend *mdns;
     int buffer_start_fill;
+    int buffer_frames;
+    int buffer_min_fill, buffer_max_fill;   // adaptive fill range, 0: fixed
     int daemonise;
     char *cmd_start, *cmd_stop;
     int cmd_blocking;
     char *meta_dir;
+    char *stats_socket;
     char *pidfile;
     char *logfile;
     char *errfile;
@@ -53,7 +56,11 @@ char *base64_enc(uint8_t *input, int length);
 
 #define RSA_MODE_AUTH (0)
 #define RSA_MODE_KEY  (1)
-uint8_t *rsa_apply(uint8_t *input, int inlen, int *outlen, int mode);
+#define RSA_SIZE      256   // bytes, of the key and of what rsa_apply writes
+// loads the key and makes its first, costly operation in the background
+void rsa_setup(void);
+// writes to out, which has RSA_SIZE bytes. returns the length, or -1
+int rsa_apply(uint8_t *input, int inlen, uint8_t *out, int mode);
 
 void command_start(void);
 void command_stop(void);
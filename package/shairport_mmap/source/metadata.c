@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <openssl/md5.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -38,38 +40,96 @@
 #include "common.h"
 #include "metadata.h"
 
+// all output happens on a writer thread, so that a slow or absent FIFO
+// reader, or a slow disk, never holds up the RTSP thread. the RTSP thread
+// formats a record and hands it over; a record or image that is not picked
+// up before the next one arrives is replaced by it.
+
+#define METADATA_COVER_MAX  (4*1024*1024)
+
 metadata player_meta;
 static int fd = -1;
 static int dirty = 0;
+static char *fifo_path;
+
+static pthread_t metadata_thread;
+static int running;
+static pthread_mutex_t meta_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t meta_cond = PTHREAD_COND_INITIALIZER;
+
+// meta_mutex protects everything below, and player_meta
+static char *record;            // formatted, not yet picked up
+static char *last;              // the latest record, for a new reader
+
+typedef struct {
+    char *buf;
+    int len;
+    const char *ext;
+} cover_image;
+static cover_image cover;       // complete, not yet written
 
 void metadata_set(char** field, const char* value) {
+    pthread_mutex_lock(&meta_mutex);
     if (*field) {
-        if (!strcmp(*field, value))
+        if (!strcmp(*field, value)) {
+            pthread_mutex_unlock(&meta_mutex);
             return;
+        }
         free(*field);
     }
     *field = strdup(value);
     dirty = 1;
+    pthread_mutex_unlock(&meta_mutex);
 }
 
-void metadata_open(void) {
-    if (!config.meta_dir)
-        return;
+static int print_one(char *p, int size, const char *name, const char *value) {
+    return snprintf(p, size, "%s=%s\n", name, value ? value : "");
+}
 
-    const char fn[] = "now_playing";
-    size_t pl = strlen(config.meta_dir) + 1 + strlen(fn);
+#define write_one(name) \
+    len += print_one(buf + len, len < size ? size - len : 0, #name, player_meta.name)
 
-    char* path = malloc(pl+1);
-    snprintf(path, pl+1, "%s/%s", config.meta_dir, fn);
+// meta_mutex held
+static void format_record(void) {
+    char *buf = NULL;
+    int size = 0, len;
 
-    if (mkfifo(path, 0644) && errno != EEXIST)
-        die("Could not create metadata FIFO %s", path);
+    if (!dirty)
+        return;
+    dirty = 0;
 
-    fd = open(path, O_WRONLY | O_NONBLOCK);
-    if (fd < 0)
-        debug(1, "Could not open metadata FIFO %s. Will try again later.", path);
+    // once to size it, once to fill it
+    while (1) {
+        len = 0;
+        write_one(artist);
+        write_one(title);
+        write_one(album);
+        write_one(artwork);
+        write_one(genre);
+        write_one(comment);
+        len += snprintf(buf + len, len < size ? size - len : 0, "\n");
+        if (buf)
+            break;
+        size = len + 1;
+        buf = malloc(size);
+        if (!buf)
+            return;
+    }
 
-    free(path);
+    free(record);
+    record = buf;
+    free(last);
+    last = strdup(buf);
+    pthread_cond_signal(&meta_cond);
+}
+
+// readers may go away and come back
+static int fifo_open(void) {
+    fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+    debug(1, "metadata reader connected\n");
+    return 0;
 }
 
 static void metadata_close(void) {
@@ -77,89 +137,228 @@ static void metadata_close(void) {
     fd = -1;
 }
 
-static void print_one(const char *name, const char *value) {
-    write_unchecked(fd, name, strlen(name));
-    write_unchecked(fd, "=", 1);
-    if (value)
-        write_unchecked(fd, value, strlen(value));
-    write_unchecked(fd, "\n", 1);
-}
+static void cover_write(cover_image *img) {
+    char *dir = config.meta_dir;
+    char *prefix = "cover-";
+    uint8_t img_md5[16];
+    char img_md5_str[33];
+    char *tmp, *path;
+    size_t pl;
+    int i, tfd, ok;
 
-#define write_one(name) \
-    print_one(#name, player_meta.name)
+    MD5((const unsigned char *)img->buf, img->len, img_md5);
+    for (i = 0; i < 16; i++)
+        sprintf(&img_md5_str[i*2], "%02x", (uint8_t)img_md5[i]);
 
-void metadata_write(void) {
-    int ret;
+    pl = strlen(dir) + sizeof("/cover.tmp");
+    tmp = malloc(pl);
+    snprintf(tmp, pl, "%s/cover.tmp", dir);
 
-    // readers may go away and come back
-    if (fd < 0)
-        metadata_open();
-    if (fd < 0)
-        return;
+    pl = strlen(dir) + 1 + strlen(prefix) + strlen(img_md5_str) + 1 + strlen(img->ext);
+    path = malloc(pl+1);
+    snprintf(path, pl+1, "%s/%s%s.%s", dir, prefix, img_md5_str, img->ext);
 
-    if (!dirty)
-        return;
+    tfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (tfd < 0) {
+        warn("Could not open file %s for writing cover art", tmp);
+        goto out;
+    }
+    ok = write(tfd, img->buf, img->len) == img->len;
+    close(tfd);
+    if (!ok) {
+        warn("writing %s failed\n", tmp);
+        unlink(tmp);
+    } else if (rename(tmp, path) < 0) {
+        warn("Could not rename %s to %s", tmp, path);
+        unlink(tmp);
+    } else {
+        debug(1, "Cover Art file is %s\n", path);
+        metadata_set(&player_meta.artwork, path+strlen(dir)+1);
+        pthread_mutex_lock(&meta_mutex);
+        format_record();
+        pthread_mutex_unlock(&meta_mutex);
+    }
 
-    dirty = 0;
+out:
+    free(tmp);
+    free(path);
+}
+
+static void *metadata_thread_func(void *arg) {
+    char *out = NULL;   // the record being written
+    int off = 0, len = 0, n;
+    cover_image img;
+    struct pollfd pfd;
+
+    pthread_mutex_lock(&meta_mutex);
+    while (running) {
+        if (cover.buf) {
+            img = cover;
+            cover.buf = NULL;
+            pthread_mutex_unlock(&meta_mutex);
+            cover_write(&img);
+            free(img.buf);
+            pthread_mutex_lock(&meta_mutex);
+            continue;
+        }
 
-    write_one(artist);
-    write_one(title);
-    write_one(album);
-    write_one(artwork);
-    write_one(genre);
-    write_one(comment);
+        if (fd < 0 && (record || last)) {
+            pthread_mutex_unlock(&meta_mutex);
+            n = fifo_open();
+            pthread_mutex_lock(&meta_mutex);
+            if (n < 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += 1;
+                pthread_cond_timedwait(&meta_cond, &meta_mutex, &ts);
+                continue;
+            }
+            // a new reader gets what is playing now
+            if (!record && last)
+                record = strdup(last);
+        }
 
-    ret = write(fd, "\n", 1);
-    if (ret < 1)    // no reader
-        metadata_close();
+        if (!out && record) {
+            out = record;
+            record = NULL;
+            off = 0;
+            len = strlen(out);
+        }
+        if (!out || fd < 0) {
+            pthread_cond_wait(&meta_cond, &meta_mutex);
+            continue;
+        }
+
+        // a record is finished even when a newer one is waiting, so the
+        // reader never sees half of one
+        pthread_mutex_unlock(&meta_mutex);
+        n = write(fd, out + off, len - off);
+        if (n > 0) {
+            off += n;
+        } else if (n < 0 && errno == EAGAIN) {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, 200);
+        } else if (n < 0 && errno != EINTR) {
+            // no reader
+            metadata_close();
+            off = len;
+        }
+        if (off == len) {
+            free(out);
+            out = NULL;
+        }
+        pthread_mutex_lock(&meta_mutex);
+    }
+    pthread_mutex_unlock(&meta_mutex);
+
+    free(out);
+    return NULL;
 }
 
-void metadata_cover_image(const char *buf, int len, const char *ext) {
+void metadata_open(void) {
     if (!config.meta_dir)
         return;
-
-    if (buf) {
-        debug(1, "Cover Art set\n");
-    } else {
-        debug(1, "Cover Art cleared\n");
+    if (running)
         return;
-    }
 
-    uint8_t img_md5[16];
-    MD5_CTX ctx;
-    MD5_Init(&ctx);
-    MD5_Update(&ctx, buf, len);
-    MD5_Final(img_md5, &ctx);
+    const char fn[] = "now_playing";
+    size_t pl = strlen(config.meta_dir) + 1 + strlen(fn);
 
-    char img_md5_str[33];
-    int i;
-    for (i = 0; i < 16; i++)
-        sprintf(&img_md5_str[i*2], "%02x", (uint8_t)img_md5[i]);
+    fifo_path = malloc(pl+1);
+    snprintf(fifo_path, pl+1, "%s/%s", config.meta_dir, fn);
 
-    char *dir = config.meta_dir;
-    char *prefix = "cover-";
+    if (mkfifo(fifo_path, 0644) && errno != EEXIST)
+        die("Could not create metadata FIFO %s", fifo_path);
 
-    size_t pl = strlen(dir) + 1 + strlen(prefix) + strlen(img_md5_str) + 1 + strlen(ext);
+    if (fifo_open() < 0)
+        debug(1, "Could not open metadata FIFO %s. Will try again later.", fifo_path);
 
-    char *path = malloc(pl+1);
-    snprintf(path, pl+1, "%s/%s%s.%s", dir, prefix, img_md5_str, ext);
+    running = 1;
+    pthread_create(&metadata_thread, NULL, metadata_thread_func, NULL);
+}
 
-    int cover_fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+void metadata_write(void) {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&meta_mutex);
+    format_record();
+    pthread_mutex_unlock(&meta_mutex);
+}
 
-    if (cover_fd < 0) {
-        warn("Could not open file %s for writing cover art", path);
+// the image is gathered in memory while it comes in, then handed to the
+// writer thread, which names it after its MD5
+static char *cover_buf;
+static int cover_len, cover_size;
+static const char *cover_ext;
+
+void metadata_cover_begin(const char *ext) {
+    if (!running)
+        return;
+    if (cover_buf)
+        metadata_cover_end(0);
+
+    cover_size = 64*1024;
+    cover_buf = malloc(cover_size);
+    if (!cover_buf) {
+        warn("Could not allocate a buffer for cover art");
         return;
     }
+    cover_len = 0;
+    debug(1, "Cover Art set\n");
+    cover_ext = ext;
+}
+
+void metadata_cover_data(const char *buf, int len) {
+    char *p;
 
-    if (write(cover_fd, buf, len) < len) {
-        warn("writing %s failed\n", path);
-        free(path);
+    if (!cover_buf)
         return;
+    if (cover_len + len > cover_size) {
+        while (cover_len + len > cover_size)
+            cover_size *= 2;
+        p = cover_size <= METADATA_COVER_MAX ? realloc(cover_buf, cover_size) : NULL;
+        if (!p) {
+            warn("cover art too large, dropped");
+            metadata_cover_end(0);
+            return;
+        }
+        cover_buf = p;
     }
-    close(cover_fd);
+    memcpy(cover_buf + cover_len, buf, len);
+    cover_len += len;
+}
 
-    debug(1, "Cover Art file is %s\n", path);
-    metadata_set(&player_meta.artwork, path+strlen(dir)+1);
+void metadata_cover_end(int ok) {
+    if (!cover_buf)
+        return;
+    if (!ok) {
+        free(cover_buf);
+        cover_buf = NULL;
+        return;
+    }
 
-    free(path);
+    pthread_mutex_lock(&meta_mutex);
+    free(cover.buf);    // superseded before it was written
+    cover.buf = cover_buf;
+    cover.len = cover_len;
+    cover.ext = cover_ext;
+    pthread_cond_signal(&meta_cond);
+    pthread_mutex_unlock(&meta_mutex);
+    cover_buf = NULL;
+}
+
+void metadata_cover_image(const char *buf, int len, const char *ext) {
+    if (!config.meta_dir)
+        return;
+
+    if (!buf) {
+        debug(1, "Cover Art cleared\n");
+        return;
+    }
+
+    metadata_cover_begin(ext);
+    metadata_cover_data(buf, len);
+    metadata_cover_end(1);
 }
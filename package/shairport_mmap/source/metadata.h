@@ -16,6 +16,10 @@ void metadata_set(char** field, const char* value);
 void metadata_open(void);
 void metadata_write(void);
 void metadata_cover_image(const char *buf, int len, const char *ext);
+// the same, a piece at a time. ok: write the image, or drop it
+void metadata_cover_begin(const char *ext);
+void metadata_cover_data(const char *buf, int len);
+void metadata_cover_end(int ok);
 
 extern metadata player_meta;
 
@@ -0,0 +1,234 @@
+/*
+ * ALAC decoder microbenchmark. This file is part of Shairport.
+ * Copyright (c) James Laird 2013
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// times alac_decode_frame on synthetic frames, without a capture: unlike
+// shairport-bench this needs no stream and runs in the build's perf-tests.
+// the frames are 16 bit stereo, compressed with an order 8 predictor, as
+// iTunes sends them. the residuals are rice coded here with the decoder's
+// own history and k rules, and checked against what it decodes.
+//
+// prints one "<name>\t<value>\t<unit>" line per result, as expected by
+// scripts/perf-tests.sh.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "alac.h"
+
+#define FRAME_SIZE      352     // samples, as in the usual fmtp
+#define SAMPLE_RATE     44100
+#define HISTORY_MULT    40
+#define INITIAL_HISTORY 10
+#define KMODIFIER       14
+#define RICE_MODIFIER   4
+#define NFRAMES         16
+#define MIN_NS          (500 * 1000 * 1000LL)
+
+typedef struct {
+    uint8_t *data;
+    uint32_t pos;       // in bits
+} bitwriter;
+
+static void put_bits(bitwriter *bw, uint32_t value, int bits) {
+    while (bits-- > 0) {
+        if ((value >> bits) & 1)
+            bw->data[bw->pos >> 3] |= 0x80 >> (bw->pos & 7);
+        bw->pos++;
+    }
+}
+
+// the inverse of entropy_decode_value in alac.c
+static void put_value(bitwriter *bw, uint32_t x, int sample_size, int k, uint32_t kmodifier_mask) {
+    uint32_t m = k == 1 ? 1 : ((1u << k) - 1) & kmodifier_mask;
+    uint32_t q = x / m, r = x % m;
+
+    if (k == 1) {
+        q = x;
+        r = 0;
+    }
+    if (q > 8) {        // escape: nine ones and the raw value
+        put_bits(bw, 0x1ff, 9);
+        put_bits(bw, x, sample_size);
+        return;
+    }
+    put_bits(bw, (1u << (q + 1)) - 2, q + 1);
+    if (k == 1)
+        return;
+    if (r)
+        put_bits(bw, r + 1, k);
+    else
+        put_bits(bw, 0, k - 1);
+}
+
+static int clz(uint32_t v) {
+    int n = 0;
+    if (!v)
+        return 32;
+    while (!(v & 0x80000000u)) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+}
+
+// the inverse of entropy_rice_decode in alac.c, without zero runs: the
+// residuals are never 0 where a run could start
+static void put_residuals(bitwriter *bw, const int32_t *res, int n, int sample_size) {
+    int history = INITIAL_HISTORY;
+    int mult = RICE_MODIFIER * HISTORY_MULT / 4;
+    int sign_modifier = 0;
+    int i, k;
+
+    for (i = 0; i < n; i++) {
+        int32_t v = res[i] >= 0 ? 2 * res[i] : -2 * res[i] - 1;
+
+        k = 31 - KMODIFIER - clz((history >> 9) + 3);
+        if (k < 0)
+            k += KMODIFIER;
+        else
+            k = KMODIFIER;
+        put_value(bw, v - sign_modifier, sample_size, k, 0xffffffff);
+
+        sign_modifier = 0;
+        history += v * mult - ((history * mult) >> 9);
+        if (v > 0xffff)
+            history = 0xffff;
+
+        if (history < 128 && i + 1 < n) {
+            k = clz(history) + ((history + 16) / 64) - 24;
+            put_value(bw, 0, 16, k, (1u << KMODIFIER) - 1);
+            sign_modifier = 1;
+            history = 0;
+        }
+    }
+}
+
+// audio like residuals: mostly small, sometimes large, never 0
+static int32_t residual(uint32_t *seed) {
+    int32_t r;
+
+    *seed = *seed * 1103515245 + 12345;
+    r = (*seed >> 16) & 0x3ff;
+    if (!(*seed & 0x70000000))
+        r <<= 4;
+    r++;
+    return (*seed & 0x80000000) ? -r : r;
+}
+
+static int encode_frame(uint8_t *buf, int len, int32_t *res_a, int32_t *res_b, uint32_t *seed) {
+    static const int16_t coefs[8] = { 2040, -1570, 810, -420, 250, -140, 60, -20 };
+    bitwriter bw = { buf, 0 };
+    int ch, i;
+
+    memset(buf, 0, len);
+    put_bits(&bw, 1, 3);        // 2 channels
+    put_bits(&bw, 0, 4);
+    put_bits(&bw, 0, 12);
+    put_bits(&bw, 0, 1);        // no sample count
+    put_bits(&bw, 0, 2);        // no uncompressed bytes
+    put_bits(&bw, 0, 1);        // compressed
+    put_bits(&bw, 2, 8);        // interlacing shift
+    put_bits(&bw, 1, 8);        // interlacing left weight
+    for (ch = 0; ch < 2; ch++) {
+        put_bits(&bw, 0, 4);    // adaptive fir
+        put_bits(&bw, 9, 4);    // quantization
+        put_bits(&bw, RICE_MODIFIER, 3);
+        put_bits(&bw, 8, 5);
+        for (i = 0; i < 8; i++)
+            put_bits(&bw, (uint16_t)coefs[i], 16);
+    }
+    for (i = 0; i < FRAME_SIZE; i++) {
+        res_a[i] = residual(seed);
+        res_b[i] = residual(seed);
+    }
+    put_residuals(&bw, res_a, FRAME_SIZE, 17);
+    put_residuals(&bw, res_b, FRAME_SIZE, 17);
+
+    return (bw.pos + 7) / 8;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t frames[NFRAMES][8 * FRAME_SIZE + 256 + ALAC_INPUT_PADDING];
+    static int16_t out[2 * (FRAME_SIZE + 3)];
+    int32_t res_a[FRAME_SIZE], res_b[FRAME_SIZE];
+    uint32_t seed = 1;
+    long bytes = 0, ops = 0, i, n = 1;
+    int64_t start, ns;
+    alac_file *alac;
+    int outsize, f;
+
+    alac = alac_create(16, 2);
+    alac->setinfo_max_samples_per_frame = FRAME_SIZE;
+    alac->setinfo_7a = 0;
+    alac->setinfo_sample_size = 16;
+    alac->setinfo_rice_historymult = HISTORY_MULT;
+    alac->setinfo_rice_initialhistory = INITIAL_HISTORY;
+    alac->setinfo_rice_kmodifier = KMODIFIER;
+    alac->setinfo_7f = 2;
+    alac->setinfo_80 = 255;
+    alac->setinfo_82 = 0;
+    alac->setinfo_86 = 0;
+    alac->setinfo_8a_rate = SAMPLE_RATE;
+    alac_allocate_buffers(alac);
+
+    for (f = 0; f < NFRAMES; f++) {
+        bytes += encode_frame(frames[f], sizeof(frames[f]) - ALAC_INPUT_PADDING,
+                              res_a, res_b, &seed);
+        alac_decode_frame(alac, frames[f], out, &outsize);
+        if (outsize != FRAME_SIZE * 4 ||
+            memcmp(alac->predicterror_buffer_a, res_a, sizeof(res_a)) ||
+            memcmp(alac->predicterror_buffer_b, res_b, sizeof(res_b))) {
+            fprintf(stderr, "frame %d does not decode as encoded\n", f);
+            return 1;
+        }
+    }
+
+    start = now_ns();
+    do {
+        for (i = 0; i < n; i++)
+            alac_decode_frame(alac, frames[(ops + i) % NFRAMES], out, &outsize);
+        ops += n;
+        n *= 2;
+        ns = now_ns() - start;
+    } while (ns < MIN_NS);
+
+    printf("alac_decode_frame_%d\t%.1f\tns/op\n", FRAME_SIZE, (double)ns / ops);
+    printf("alac_decode_frame_%d_rate\t%.2f\tMB/s\n", FRAME_SIZE,
+           (double)bytes / NFRAMES * ops * 1000 / ns);
+    printf("alac_decode_frame_%d_realtime\t%.1f\tx\n", FRAME_SIZE,
+           (double)FRAME_SIZE * 1000000000 / SAMPLE_RATE * ops / ns);
+
+    alac_free(alac);
+    return 0;
+}
@@ -30,6 +30,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
 #include <openssl/aes.h>
 #include <math.h>
 #include <sys/stat.h>
@@ -41,6 +43,8 @@
 #include "common.h"
 #include "player.h"
 #include "rtp.h"
+#include "aes_alg.h"
+#include "stats.h"
 
 #ifdef FANCY_RESAMPLING
 #include <samplerate.h>
@@ -51,13 +55,20 @@
 // parameters from the source
 static unsigned char *aesiv;
 static AES_KEY aes;
+static int aes_kernel;      // decrypting through aes_alg
 static int sampling_rate, frame_size;
 
-#define FRAME_BYTES(frame_size) (4*frame_size)
+// decoded frames are 16 bit stereo, or with 24 bit streams 32 bit with the
+// audio on top. the output takes 16 bit, or 32 bit with the audio on top
+// (32) or in the low bits (24); see start_format
+static int in_bits = 16, out_bits = 16;
+#define SAMPLE_BYTES(bits) ((bits) == 16 ? 2 : 4)
+
+#define FRAME_BYTES(frame_size) (2*SAMPLE_BYTES(in_bits)*(frame_size))
 // maximal resampling shift - conservative
-#define OUTFRAME_BYTES(frame_size) (4*(frame_size+3))
+#define OUTFRAME_BYTES(frame_size) (2*SAMPLE_BYTES(out_bits)*((frame_size)+3))
 
-static pthread_t player_thread;
+static pthread_t player_thread, decoder_thread;
 static int please_stop;
 
 static alac_file *decoder_info;
@@ -73,31 +84,96 @@ static double volume = 1.0;
 static int fix_volume = 0x10000;
 static pthread_mutex_t vol_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// default buffer size
-// needs to be a power of 2 because of the way BUFIDX(seqno) works
-#define BUFFER_FRAMES  512
-#define MAX_PACKET      2048
-
-typedef struct audio_buffer_entry {   // decoded audio packets
-    int ready;
-    signed short *data;
+// buffer size limits; config.buffer_frames is rounded up to a power of 2
+// because of the way BUFIDX(seqno) works
+#define BUFFER_FRAMES_MIN   64
+#define BUFFER_FRAMES_MAX   2048
+// an ALAC frame the encoder could not compress is stored as it is: with
+// 24 bit samples that is more than 2048 bytes
+#define MAX_PACKET      (in_bits == 16 ? 2048 : 4096)
+
+// the receiver only stores the encrypted packet; the decoder thread
+// decrypts and decodes it ahead of the player.
+// nothing here is locked: a slot is handed over by storing its stamp
+// (epoch, seqno and state) with release ordering, and every reader
+// loads it with acquire ordering before touching the slot.
+#define AB_EMPTY        0
+#define AB_WRITING      1   // receiver is copying the packet in
+#define AB_RECEIVED     2   // packet stored, not decoded yet
+#define AB_DECODING     3   // decoder thread is working on it
+#define AB_READY        4   // data holds the decoded audio
+
+#define AB_STAMP(epoch, seqno, state) \
+    (((uint32_t)(epoch) << 19) | ((uint32_t)(seq_t)(seqno) << 3) | (state))
+#define AB_STAMP_STATE(stamp) ((stamp) & 7)
+
+typedef struct audio_buffer_entry {   // audio packets
+    uint32_t stamp;
+    uint32_t timestamp;     // RTP time of the first sample
+    int len;
+    uint8_t *packet;
+    void *data;
 } abuf_t;
-static abuf_t audio_buffer[BUFFER_FRAMES];
-#define BUFIDX(seqno) ((seq_t)(seqno) % BUFFER_FRAMES)
+static abuf_t *audio_buffer;
+static int ab_frames;   // slots in audio_buffer
+#define BUFIDX(seqno) ((seq_t)(seqno) & (ab_frames - 1))
+
+#define LOAD_ACQ(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static inline int cas_u32(uint32_t *p, uint32_t expect, uint32_t value) {
+    return __atomic_compare_exchange_n(p, &expect, value, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+static inline int cas_seq(seq_t *p, seq_t expect, seq_t value) {
+    return __atomic_compare_exchange_n(p, &expect, value, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
 
-// mutex-protected variables
+// shared between receiver, decoder and player threads.
+// ab_write is only moved by the receiver, ab_read by the player (and by the
+// receiver when it syncs to a new stream), ab_epoch by a flush.
 static seq_t ab_read, ab_write;
 static int ab_buffering = 1, ab_synced = 0;
-static pthread_mutex_t ab_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t ab_epoch;
+static sem_t ab_received, ab_decoded;   // wake the decoder / the player
+static int ab_player_waiting;
+
+// target fill, adapted between config.buffer_min_fill and buffer_max_fill
+// from the arrival jitter and the packets that did not make it in time
+static int ab_target_fill;
+static int ab_jitter16;         // arrival jitter in us, times 16
+static int ab_late;             // packets that came in after their playout
+
+// clock sync from the sender: the sample at sync_rtptime is due at the
+// output at sync_ns, on our clock (see rtp_clock_ns)
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int sync_valid;
+static uint32_t sync_rtptime;
+static int64_t sync_ns;
+static int sync_locked;         // player only: playout is aligned to it
+#define SYNC_RELOCK     (10 * frame_size)   // samples off before realigning
 
 static void bf_est_reset(short fill);
 
+// does the slot hold this packet of the current stream?
+static inline int ab_holds(uint32_t stamp, uint32_t epoch, seq_t seqno) {
+    return (stamp >> 3) == (AB_STAMP(epoch, seqno, 0) >> 3) &&
+           AB_STAMP_STATE(stamp) != AB_EMPTY;
+}
+
+static void ab_wake_player(void) {
+    if (__atomic_exchange_n(&ab_player_waiting, 0, __ATOMIC_SEQ_CST))
+        sem_post(&ab_decoded);
+}
+
+// all slots of the old epoch are stale from here on
 static void ab_resync(void) {
-    int i;
-    for (i=0; i<BUFFER_FRAMES; i++)
-        audio_buffer[i].ready = 0;
-    ab_synced = 0;
-    ab_buffering = 1;
+    __atomic_add_fetch(&ab_epoch, 1, __ATOMIC_ACQ_REL);
+    rtp_resend_flush();
+    STORE_REL(&ab_buffering, 1);
+    STORE_REL(&ab_synced, 0);
+    ab_wake_player();
 }
 
 // the sequence numbers will wrap pretty often.
@@ -107,19 +183,25 @@ static inline int seq_order(seq_t a, seq_t b) {
     return d > 0;
 }
 
-static void alac_decode(short *dest, uint8_t *buf, int len) {
-    unsigned char packet[MAX_PACKET];
-    assert(len<=MAX_PACKET);
-
+// decrypts in place: the slot has room for the decoder's padding and the
+// tail that is not a whole AES block is sent in the clear
+static void aes_decrypt(uint8_t *buf, int len) {
     unsigned char iv[16];
     int aeslen = len & ~0xf;
+
+    if (aes_kernel && !aes_alg_decrypt(buf, aeslen, aesiv))
+        return;
     memcpy(iv, aesiv, sizeof(iv));
-    AES_cbc_encrypt(buf, packet, aeslen, &aes, iv, AES_DECRYPT);
-    memcpy(packet+aeslen, buf+aeslen, len-aeslen);
+    AES_cbc_encrypt(buf, buf, aeslen, &aes, iv, AES_DECRYPT);
+}
+
+static void alac_decode(void *dest, uint8_t *buf, int len) {
+    assert(len<=MAX_PACKET);
+    memset(buf+len, 0, ALAC_INPUT_PADDING);
 
     int outsize;
 
-    alac_decode_frame(decoder_info, packet, dest, &outsize);
+    alac_decode_frame(decoder_info, buf, dest, &outsize);
 
     assert(outsize == FRAME_BYTES(frame_size));
 }
@@ -132,8 +214,12 @@ static int init_decoder(int32_t fmtp[12]) {
     sampling_rate = fmtp[11];
 
     int sample_size = fmtp[3];
-    if (sample_size != 16)
-        die("only 16-bit samples supported!");
+    if (sample_size != 16 && sample_size != 24)
+        die("only 16 and 24-bit samples supported!");
+    in_bits = sample_size == 16 ? 16 : 32;
+#ifdef FANCY_RESAMPLING
+    fancy_resampling = in_bits == 16;   // it works on 16 bit frames
+#endif
 
     alac = alac_create(sample_size, 2);
     if (!alac)
@@ -177,55 +263,236 @@ static void free_src(void) {
 
 static void init_buffer(void) {
     int i;
-    for (i=0; i<BUFFER_FRAMES; i++)
-        audio_buffer[i].data = malloc(OUTFRAME_BYTES(frame_size));
+
+    audio_buffer = malloc(ab_frames * sizeof(*audio_buffer));
+    for (i=0; i<ab_frames; i++) {
+        audio_buffer[i].data = malloc(FRAME_BYTES(frame_size + 3));
+        audio_buffer[i].packet = malloc(MAX_PACKET + ALAC_INPUT_PADDING);
+        audio_buffer[i].stamp = AB_EMPTY;
+    }
+    sem_init(&ab_received, 0, 0);
+    sem_init(&ab_decoded, 0, 0);
     ab_resync();
 }
 
 static void free_buffer(void) {
     int i;
-    for (i=0; i<BUFFER_FRAMES; i++)
+    for (i=0; i<ab_frames; i++) {
         free(audio_buffer[i].data);
+        free(audio_buffer[i].packet);
+    }
+    free(audio_buffer);
+    audio_buffer = 0;
+    sem_destroy(&ab_received);
+    sem_destroy(&ab_decoded);
+}
+
+// RFC 3550 style interarrival jitter of the in-order packets
+static void ab_note_arrival(seq_t seqno, int64_t now) {
+    static int64_t last;
+    static seq_t last_seqno;
+    int d;
+
+    if (last && now - last < 2000000000 &&
+        seq_diff(last_seqno, seqno) == 1) {
+        d = (now - last) / 1000;
+        d -= frame_size * 1000000 / sampling_rate;
+        if (d < 0)
+            d = -d;
+        __atomic_store_n(&ab_jitter16, ab_jitter16 + d - (ab_jitter16 >> 4), __ATOMIC_RELAXED);
+    }
+    last = now;
+    last_seqno = seqno;
+}
+
+// copies a packet into its slot. a resent duplicate of a packet we already
+// hold is dropped, and a slot the decoder is still busy with is left alone
+static int ab_store(abuf_t *abuf, uint32_t epoch, seq_t seqno,
+                    uint32_t timestamp, uint8_t *data, int len) {
+    uint32_t stamp = LOAD_ACQ(&abuf->stamp);
+
+    if (ab_holds(stamp, epoch, seqno) ||
+        AB_STAMP_STATE(stamp) == AB_DECODING ||
+        !cas_u32(&abuf->stamp, stamp, AB_STAMP(epoch, seqno, AB_WRITING)))
+        return 0;
+    memcpy(abuf->packet, data, len);
+    abuf->len = len;
+    abuf->timestamp = timestamp;
+    STORE_REL(&abuf->stamp, AB_STAMP(epoch, seqno, AB_RECEIVED));
+    return 1;
 }
 
-void player_put_packet(seq_t seqno, uint8_t *data, int len) {
+static void ab_check_buffering(int16_t buf_fill) {
+    if (LOAD_ACQ(&ab_buffering) && buf_fill >= LOAD_ACQ(&ab_target_fill)) {
+        debug(1, "buffering over. starting play\n");
+        bf_est_reset(buf_fill);
+        sync_locked = 0;
+        STORE_REL(&ab_buffering, 0);
+    }
+}
+
+// arrival: when the packet came in, on the rtp_clock_ns clock
+void player_put_packet(seq_t seqno, uint32_t timestamp, int64_t arrival,
+                       uint8_t *data, int len) {
     abuf_t *abuf = 0;
     int16_t buf_fill;
+    seq_t read;
+    uint32_t epoch;
+
+    if (len > MAX_PACKET) {
+        warn("oversized packet %04X (%d bytes)", seqno, len);
+        return;
+    }
 
-    pthread_mutex_lock(&ab_mutex);
-    if (!ab_synced) {
+    STATS_ADD(packets, 1);
+    epoch = LOAD_ACQ(&ab_epoch);
+    if (!LOAD_ACQ(&ab_synced)) {
         debug(2, "syncing to first seqno %04X\n", seqno);
-        ab_write = seqno-1;
-        ab_read = seqno;
-        ab_synced = 1;
+        STORE_REL(&ab_write, seqno-1);
+        STORE_REL(&ab_read, seqno);
+        STORE_REL(&ab_synced, 1);
     }
+    read = LOAD_ACQ(&ab_read);
     if (seq_diff(ab_write, seqno) == 1) {                  // expected packet
         abuf = audio_buffer + BUFIDX(seqno);
-        ab_write = seqno;
+        STORE_REL(&ab_write, seqno);
+        ab_note_arrival(seqno, arrival);
     } else if (seq_order(ab_write, seqno)) {    // newer than expected
-        rtp_request_resend(ab_write+1, seqno-1);
+        rtp_resend_missing(ab_write+1, seqno-1);
         abuf = audio_buffer + BUFIDX(seqno);
-        ab_write = seqno;
-    } else if (seq_order(ab_read, seqno)) {     // late but not yet played
+        STORE_REL(&ab_write, seqno);
+    } else if (seq_order(read, seqno)) {     // late but not yet played
         abuf = audio_buffer + BUFIDX(seqno);
+        rtp_resend_arrived(seqno);
     } else {    // too late.
-        debug(1, "late packet %04X (%04X:%04X)", seqno, ab_read, ab_write);
+        debug(1, "late packet %04X (%04X:%04X)", seqno, read, ab_write);
+        __atomic_add_fetch(&ab_late, 1, __ATOMIC_RELAXED);
+        STATS_ADD(late_packets, 1);
     }
-    buf_fill = seq_diff(ab_read, ab_write);
-    pthread_mutex_unlock(&ab_mutex);
+    buf_fill = seq_diff(read, ab_write);
+
+    if (abuf && ab_store(abuf, epoch, seqno, timestamp, data, len))
+        sem_post(&ab_received);
+
+    ab_check_buffering(buf_fill);
+}
+
+// the usual burst is a run of packets that each follow the last: those are
+// stored with one move of ab_write and one wakeup of the decoder. anything
+// else (a gap, a resend, a reordered packet) goes through player_put_packet
+void player_put_packets(player_packet *pkts, int n) {
+    seq_t first, read;
+    uint32_t epoch;
+    int i, run, stored;
+
+    while (n > 0) {
+        if (!LOAD_ACQ(&ab_synced) || seq_diff(ab_write, pkts->seqno) != 1) {
+            player_put_packet(pkts->seqno, pkts->timestamp, pkts->arrival,
+                              pkts->data, pkts->len);
+            pkts++;
+            n--;
+            continue;
+        }
+
+        first = pkts->seqno;
+        for (run = 0; run < n; run++)
+            if (pkts[run].seqno != (seq_t)(first + run) ||
+                pkts[run].len > MAX_PACKET)
+                break;
+        if (run < 2) {      // nothing to gain
+            player_put_packet(pkts->seqno, pkts->timestamp, pkts->arrival,
+                              pkts->data, pkts->len);
+            pkts++;
+            n--;
+            continue;
+        }
 
-    if (abuf) {
-        alac_decode(abuf->data, data, len);
-        abuf->ready = 1;
+        STATS_ADD(packets, run);
+        epoch = LOAD_ACQ(&ab_epoch);
+        stored = 0;
+        for (i = 0; i < run; i++) {
+            ab_note_arrival(pkts[i].seqno, pkts[i].arrival);
+            stored |= ab_store(audio_buffer + BUFIDX(pkts[i].seqno), epoch,
+                               pkts[i].seqno, pkts[i].timestamp,
+                               pkts[i].data, pkts[i].len);
+        }
+        // the decoder only looks up to ab_write, so the slots are complete
+        // before it can see them
+        STORE_REL(&ab_write, (seq_t)(first + run - 1));
+        if (stored)
+            sem_post(&ab_received);
+
+        read = LOAD_ACQ(&ab_read);
+        ab_check_buffering(seq_diff(read, ab_write));
+        pkts += run;
+        n -= run;
     }
+}
 
-    pthread_mutex_lock(&ab_mutex);
-    if (ab_buffering && buf_fill >= config.buffer_start_fill) {
-        debug(1, "buffering over. starting play\n");
-        ab_buffering = 0;
-        bf_est_reset(buf_fill);
+// claim the earliest stored packet that still needs decoding
+static abuf_t *ab_next_received(uint32_t *pstamp) {
+    seq_t seqno, last;
+    uint32_t epoch, stamp;
+    abuf_t *abuf;
+
+    if (!LOAD_ACQ(&ab_synced))
+        return 0;
+    epoch = LOAD_ACQ(&ab_epoch);
+    last = LOAD_ACQ(&ab_write);
+    // the player moves ab_read past a frame before it waits for it
+    for (seqno = LOAD_ACQ(&ab_read) - 1; seqno != (seq_t)(last+1); seqno++) {
+        abuf = audio_buffer + BUFIDX(seqno);
+        stamp = AB_STAMP(epoch, seqno, AB_RECEIVED);
+        if (LOAD_ACQ(&abuf->stamp) == stamp &&
+            cas_u32(&abuf->stamp, stamp, AB_STAMP(epoch, seqno, AB_DECODING))) {
+            *pstamp = stamp;
+            return abuf;
+        }
+    }
+    return 0;
+}
+
+#define DECODE_BATCH    4   // packets claimed per pass
+
+static void *decoder_thread_func(void *arg) {
+    abuf_t *batch[DECODE_BATCH];
+    uint32_t stamps[DECODE_BATCH];
+    int64_t t, t2;
+    int i, n;
+
+    while (!please_stop) {
+        sem_wait(&ab_received);
+        while (!please_stop) {
+            // take what has queued up, decrypt it in one go, then decode.
+            // the receiver does not touch a slot while it is being decoded
+            for (n = 0; n < DECODE_BATCH; n++)
+                if (!(batch[n] = ab_next_received(&stamps[n])))
+                    break;
+            if (!n)
+                break;
+            t = stats_enabled ? rtp_clock_ns() : 0;
+            for (i = 0; i < n; i++)
+                aes_decrypt(batch[i]->packet, batch[i]->len);
+            if (stats_enabled) {
+                t2 = rtp_clock_ns();
+                for (i = 0; i < n; i++)
+                    stats_hist_add(&stats.decrypt_us, (t2 - t) / 1000 / n);
+                t = t2;
+            }
+            for (i = 0; i < n; i++) {
+                alac_decode(batch[i]->data, batch[i]->packet, batch[i]->len);
+                STORE_REL(&batch[i]->stamp, (stamps[i] & ~7) | AB_READY);
+                ab_wake_player();
+                if (stats_enabled) {
+                    t2 = rtp_clock_ns();
+                    stats_hist_add(&stats.decode_us, (t2 - t) / 1000);
+                    t = t2;
+                }
+            }
+        }
     }
-    pthread_mutex_unlock(&ab_mutex);
+
+    return 0;
 }
 
 
@@ -235,20 +502,71 @@ static short lcg_rand(void) {
 	return lcg_prev & 0xffff;
 }
 
-static inline short dithered_vol(short sample) {
-    static short rand_a, rand_b;
-    long out;
+static short rand_a, rand_b;
+
+// dithered_vol over a run of samples, with the volume test out of the loop
+static void dithered_vol_block(short *outptr, short *inptr, int samples) {
+    long vol = fix_volume;
+    short a = rand_a, b = rand_b;
+    int i;
 
-    out = (long)sample * fix_volume;
-    if (fix_volume < 0x10000) {
-        rand_b = rand_a;
-        rand_a = lcg_rand();
-        out += rand_a;
-        out -= rand_b;
+    if (vol >= 0x10000) {
+        for (i=0; i<samples; i++)
+            outptr[i] = ((long)inptr[i] * vol) >> 16;
+        return;
+    }
+    for (i=0; i<samples; i++) {
+        b = a;
+        a = lcg_rand();
+        outptr[i] = ((long)inptr[i] * vol + a - b) >> 16;
     }
-    return out>>16;
+    rand_a = a;
+    rand_b = b;
 }
 
+// 24 bit audio to a 32 bit output: no bits are lost, so no dither.
+// shift: 16, or 24 for the audio in the low bits
+static void vol_block32(int32_t *outptr, int32_t *inptr, int samples, int shift) {
+    int64_t vol = fix_volume;
+    int i;
+
+    if (vol >= 0x10000 && shift == 16) {
+        memcpy(outptr, inptr, samples * sizeof(*outptr));
+        return;
+    }
+    for (i=0; i<samples; i++)
+        outptr[i] = (inptr[i] * vol) >> shift;
+}
+
+// 24 bit audio to a 16 bit output: the one truncation, always dithered
+static void dithered_vol_block32(short *outptr, int32_t *inptr, int samples) {
+    int64_t vol = fix_volume, out;
+    short a = rand_a, b = rand_b;
+    int i;
+
+    for (i=0; i<samples; i++) {
+        b = a;
+        a = lcg_rand();
+        out = (inptr[i] * vol + ((int64_t)(a - b) << 16)) >> 32;
+        if (out > 32767)
+            out = 32767;
+        outptr[i] = out;
+    }
+    rand_a = a;
+    rand_b = b;
+}
+
+// from the decoded format to the output's, with the volume
+static void vol_block(void *outptr, void *inptr, int samples) {
+    if (in_bits == 16)
+        dithered_vol_block(outptr, inptr, samples);
+    else if (out_bits == 16)
+        dithered_vol_block32(outptr, inptr, samples);
+    else
+        vol_block32(outptr, inptr, samples, out_bits == 24 ? 24 : 16);
+}
+
+#ifndef FIXED_POINT
 typedef struct {
     double hist[2];
     double a[2];
@@ -304,6 +622,32 @@ static void bf_est_reset(short fill) {
     desired_fill = fill_count = 0;
 }
 
+// move the fill the rate matching aims for. it gets there by stuffing,
+// without a resync
+static void bf_est_shift(int frames) {
+    if (fill_count > 1000)
+        desired_fill += frames;
+}
+
+#define CONTROL_A   (1e-4)
+#define CONTROL_B   (1e-1)
+
+// buf_delta: in frames, positive when output should speed up
+static void bf_est_step(double buf_delta) {
+    bf_est_err = biquad_filt(&bf_err_lpf, buf_delta);
+    double err_deriv = biquad_filt(&bf_err_deriv_lpf, bf_est_err - bf_last_err);
+    double adj_error = CONTROL_A * bf_est_err;
+
+    bf_est_drift = biquad_filt(&bf_drift_lpf, CONTROL_B*(adj_error + err_deriv) + bf_est_drift);
+
+    debug(3, "bf delta %f err %f drift %f desiring %f ed %f estd %f\n",
+          buf_delta, bf_est_err, bf_est_drift, desired_fill, err_deriv, err_deriv + adj_error);
+    bf_playback_rate = 1.0 + adj_error + bf_est_drift;
+    STATS_SET(drift_ppb, (int32_t)(bf_est_drift * 1e9));
+
+    bf_last_err = bf_est_err;
+}
+
 static void bf_est_update(short fill) {
     // the rate-matching system needs to decide how full to keep the buffer.
     // the initial fill is present when the system starts to output samples,
@@ -317,80 +661,342 @@ static void bf_est_update(short fill) {
         // this information could be used to help estimate our effective latency?
         debug(1, "established desired fill of %f frames, "
               "so output chain buffered about %f frames\n", desired_fill,
-              config.buffer_start_fill - desired_fill);
+              ab_target_fill - desired_fill);
         fill_count++;
     }
 
-#define CONTROL_A   (1e-4)
-#define CONTROL_B   (1e-1)
+    bf_est_step(fill - desired_fill);
+}
 
-    double buf_delta = fill - desired_fill;
-    bf_est_err = biquad_filt(&bf_err_lpf, buf_delta);
-    double err_deriv = biquad_filt(&bf_err_deriv_lpf, bf_est_err - bf_last_err);
-    double adj_error = CONTROL_A * bf_est_err;
+// with a clock sync the error is how late the output runs, not the fill
+static void bf_est_late(int samples) {
+    bf_est_step((double)samples / frame_size);
+}
 
-    bf_est_drift = biquad_filt(&bf_drift_lpf, CONTROL_B*(adj_error + err_deriv) + bf_est_drift);
+#else // FIXED_POINT
 
-    debug(3, "bf %d err %f drift %f desiring %f ed %f estd %f\n",
-          fill, bf_est_err, bf_est_drift, desired_fill, err_deriv, err_deriv + adj_error);
-    bf_playback_rate = 1.0 + adj_error + bf_est_drift;
+// integer rate estimator for targets without an FPU. buffer fill and
+// error are Q32 frames, the drift and the playback rate Q48.
+//
+// at these cutoffs (down to a few mHz at ~125 packets/s) the direct form
+// biquad coefficients are ~1e-8 and vanish in fixed point, so the same
+// 2-pole low-pass runs as a state-variable filter, whose coefficients
+// scale with the cutoff instead of its square.
+#define Q30_ONE     ((uint32_t)1 << 30)
+#define Q48_ONE     ((int64_t)1 << 48)
+#define Q24_2PI     105414357       // 2*pi in Q24
+
+typedef struct {
+    int64_t low, band;
+    int64_t f;      // Q24
+    int64_t q;      // 1/Q, Q16
+} svf_t;
+
+// period: of the cutoff frequency, in seconds. Q in hundredths
+static void svf_lpf(svf_t *sv, int period, int Q_pct) {
+    // f = 2*sin(w0/2), which is w0 to well within 1e-4 here
+    sv->f = (int64_t)Q24_2PI * frame_size / ((int64_t)period * sampling_rate);
+    sv->q = (100 << 16) / Q_pct;
+    sv->low = sv->band = 0;
+}
+
+static int64_t svf_filt(svf_t *sv, int64_t in) {
+    int64_t high;
+
+    sv->low += (sv->f * sv->band) >> 24;
+    high = in - sv->low - ((sv->q * sv->band) >> 16);
+    sv->band += (sv->f * high) >> 24;
+
+    return sv->low;
+}
+
+static int64_t bf_playback_rate = Q48_ONE;
+
+static int64_t bf_est_drift = 0;    // local clock is slower by
+static svf_t bf_drift_lpf;
+static int64_t bf_est_err = 0, bf_last_err;
+static svf_t bf_err_lpf, bf_err_deriv_lpf;
+static int64_t desired_fill;
+static int fill_count;
+
+static void bf_est_reset(short fill) {
+    svf_lpf(&bf_drift_lpf, 180, 30);
+    svf_lpf(&bf_err_lpf, 10, 25);
+    svf_lpf(&bf_err_deriv_lpf, 2, 20);
+    bf_playback_rate = Q48_ONE;
+    bf_est_drift = 0;
+    bf_est_err = bf_last_err = 0;
+    desired_fill = fill_count = 0;
+}
+
+static void bf_est_shift(int frames) {
+    if (fill_count > 1000)
+        desired_fill += (int64_t)frames << 32;
+}
+
+#define CONTROL_A_Q32   429497      // 1e-4
+#define CONTROL_B_Q16   6554        // 1e-1
+
+// buf_delta: Q32 frames
+static void bf_est_step(int64_t buf_delta) {
+    bf_est_err = svf_filt(&bf_err_lpf, buf_delta);
+    int64_t err_deriv = svf_filt(&bf_err_deriv_lpf, bf_est_err - bf_last_err) << 16;
+    int64_t adj_error = (bf_est_err >> 16) * CONTROL_A_Q32;
+
+    bf_est_drift = svf_filt(&bf_drift_lpf,
+                            ((adj_error + err_deriv) >> 16) * CONTROL_B_Q16 + bf_est_drift);
+
+    debug(3, "bf delta %d err %d drift %d desiring %d\n", (int)(buf_delta >> 16),
+          (int)(bf_est_err >> 16), (int)(bf_est_drift >> 32), (int)(desired_fill >> 16));
+    bf_playback_rate = Q48_ONE + adj_error + bf_est_drift;
+    STATS_SET(drift_ppb, (int32_t)(((bf_est_drift >> 16) * 1000000000) >> 32));
 
     bf_last_err = bf_est_err;
 }
 
-// get the next frame, when available. return 0 if underrun/stream reset.
-static short *buffer_get_frame(void) {
+static void bf_est_update(short fill) {
+    // see the floating point version
+    if (fill_count < 1000) {
+        desired_fill += fill;
+        fill_count++;
+        return;
+    } else if (fill_count == 1000) {
+        desired_fill = (desired_fill << 32) / 1000;
+        debug(1, "established desired fill of %d frames, "
+              "so output chain buffered about %d frames\n",
+              (int)(desired_fill >> 32),
+              ab_target_fill - (int)(desired_fill >> 32));
+        fill_count++;
+    }
+
+    bf_est_step(((int64_t)fill << 32) - desired_fill);
+}
+
+static void bf_est_late(int samples) {
+    bf_est_step(((int64_t)samples << 32) / frame_size);
+}
+
+static uint32_t lcg_rand32(void) {
+    static uint32_t lcg_prev = 12345;
+    lcg_prev = lcg_prev * 1664525 + 1013904223;
+    return lcg_prev;
+}
+
+// 1 - (1 - dev)^frame_size, in Q30
+static uint32_t stuff_probability(uint32_t dev) {
+    uint32_t x = Q30_ONE - dev, p = Q30_ONE;
+    int n = frame_size;
+
+    while (n) {
+        if (n & 1)
+            p = ((uint64_t)p * x) >> 30;
+        x = ((uint64_t)x * x) >> 30;
+        n >>= 1;
+    }
+    return Q30_ONE - p;
+}
+
+#endif // FIXED_POINT
+
+void player_sync(uint32_t rtptime, int64_t local_ns) {
+    pthread_mutex_lock(&sync_mutex);
+    sync_rtptime = rtptime;
+    sync_ns = local_ns;
+    sync_valid = 1;
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+// how many samples late the sample at 'timestamp' would reach the output
+// if it was handed over now. returns 0 when there is no sync yet
+static int sync_late(uint32_t timestamp, int *plate) {
+    uint32_t rtptime;
+    int64_t ns, due;
+    int valid;
+
+    pthread_mutex_lock(&sync_mutex);
+    valid = sync_valid;
+    rtptime = sync_rtptime;
+    ns = sync_ns;
+    pthread_mutex_unlock(&sync_mutex);
+    if (!valid)
+        return 0;
+
+    due = (rtp_clock_ns() - ns) * sampling_rate / 1000000000;
+    if (config.output->delay)
+        due += config.output->delay();
+    *plate = (int)(due - (int32_t)(timestamp - rtptime));
+    return 1;
+}
+
+#define ADAPT_PERIOD    256     // frames between adjustments, about 2s
+#define ADAPT_QUIET     8       // loss free periods before shrinking
+#define ADAPT_STEP      2       // frames per adjustment
+
+// called by the player once per frame; missing: the frame was not there
+static void ab_adapt_target(int missing) {
+    static int frames, misses, quiet;
+    int target, least, late, jitter;
+
+    if (!config.buffer_max_fill)
+        return;
+    misses += missing;
+    if (++frames < ADAPT_PERIOD)
+        return;
+    frames = 0;
+
+    late = __atomic_exchange_n(&ab_late, 0, __ATOMIC_RELAXED);
+    jitter = (__atomic_load_n(&ab_jitter16, __ATOMIC_RELAXED) >> 4) /
+             (frame_size * 1000000 / sampling_rate);   // in frames
+    STATS_SET(jitter_us, __atomic_load_n(&ab_jitter16, __ATOMIC_RELAXED) >> 4);
+    // room for a few times the jitter and the resends
+    least = 4 * jitter + 16;
+
+    target = ab_target_fill;
+    if (misses + late) {
+        target += ADAPT_STEP * (misses + late < 4 ? misses + late : 4);
+        quiet = 0;
+    } else if (target < least) {
+        target += ADAPT_STEP;
+    } else if (++quiet >= ADAPT_QUIET && target > least) {
+        target -= ADAPT_STEP;
+        quiet = ADAPT_QUIET - 1;
+    }
+    if (target < config.buffer_min_fill)
+        target = config.buffer_min_fill;
+    if (target > config.buffer_max_fill)
+        target = config.buffer_max_fill;
+
+    if (target != ab_target_fill) {
+        debug(1, "target fill %d -> %d (jitter %d frames, %d missing, %d late)\n",
+              ab_target_fill, target, jitter, misses, late);
+        bf_est_shift(target - ab_target_fill);
+        STORE_REL(&ab_target_fill, target);
+        STATS_SET(target_fill, target);
+    }
+    misses = 0;
+}
+
+// get the next frame, when available. return 0 if underrun/stream reset/missing.
+static void *buffer_get_frame(void) {
     int16_t buf_fill;
-    seq_t read, next;
+    seq_t read, write, next;
+    uint32_t epoch, stamp;
     abuf_t *abuf = 0;
-    int i;
+    int i, state, late, timed = 0;
 
-    if (ab_buffering)
+    if (LOAD_ACQ(&ab_buffering))
         return 0;
 
-    pthread_mutex_lock(&ab_mutex);
-
-    buf_fill = seq_diff(ab_read, ab_write);
-    if (buf_fill < 1 || !ab_synced) {
-        if (buf_fill < 1)
+    epoch = LOAD_ACQ(&ab_epoch);
+    read = LOAD_ACQ(&ab_read);
+    write = LOAD_ACQ(&ab_write);
+    buf_fill = seq_diff(read, write);
+    if (buf_fill < 1 || !LOAD_ACQ(&ab_synced)) {
+        if (buf_fill < 1) {
             warn("underrun.");
-        ab_buffering = 1;
-        pthread_mutex_unlock(&ab_mutex);
+            STATS_ADD(underruns, 1);
+            ab_adapt_target(1);
+        }
+        STORE_REL(&ab_buffering, 1);
         return 0;
     }
-    if (buf_fill >= BUFFER_FRAMES) {   // overrunning! uh-oh. restart at a sane distance
+    next = read;
+    if (buf_fill >= ab_frames) {   // overrunning! uh-oh. restart at a sane distance
         warn("overrun.");
-        ab_read = ab_write - config.buffer_start_fill;
-    }
-    read = ab_read;
-    ab_read++;
-    buf_fill = seq_diff(ab_read, ab_write);
-    bf_est_update(buf_fill);
-
-    // check if t+16, t+32, t+64, t+128, ... (buffer_start_fill / 2)
-    // packets have arrived... last-chance resend
-    if (!ab_buffering) {
-        for (i = 16; i < (config.buffer_start_fill / 2); i = (i * 2)) {
-            next = ab_read + i;
-            abuf = audio_buffer + BUFIDX(next);
-            if (!abuf->ready) {
-                rtp_request_resend(next, next);
+        STATS_ADD(overruns, 1);
+        next = write - ab_target_fill;
+    }
+
+    // with a clock sync, a frame goes out at the time the sender set for it
+    abuf = audio_buffer + BUFIDX(next);
+    if (ab_holds(LOAD_ACQ(&abuf->stamp), epoch, next) &&
+        sync_late(abuf->timestamp, &late)) {
+        if (sync_locked && (late > SYNC_RELOCK || late < -SYNC_RELOCK)) {
+            warn("playout %d samples off the sync, realigning", late);
+            sync_locked = 0;
+        }
+        if (!sync_locked) {
+            if (late < -frame_size)     // early: silence until it is due
+                return 0;
+            if (late >= frame_size) {   // late: skip ahead
+                int drop = late / frame_size;
+                if (drop > seq_diff(next, write))
+                    drop = seq_diff(next, write);
+                next += drop;
+                late -= drop * frame_size;
             }
+            debug(1, "playout aligned to the sync, %d samples late\n", late);
+            sync_locked = 1;
+        }
+        timed = 1;
+    }
+
+    // the receiver moves ab_read only when it resyncs to a new stream
+    if (!cas_seq(&ab_read, read, next+1))
+        return 0;
+    read = next;
+    buf_fill = seq_diff(read+1, write);
+    STATS_ADD(frames, 1);
+    STATS_SET(fill, buf_fill);
+    stats_hist_add(&stats.fill_hist, buf_fill > 0 ? buf_fill : 0);
+    if (timed)
+        bf_est_late(late);
+    else
+        bf_est_update(buf_fill);
+
+    // check if t+16, t+32, t+64, t+128, ... (target fill / 2)
+    // packets have arrived... last-chance resend. the resend manager
+    // leaves out what it is already asking for
+    for (i = 16; i < (ab_target_fill / 2); i = (i * 2)) {
+        next = read + 1 + i;
+        abuf = audio_buffer + BUFIDX(next);
+        if (!ab_holds(LOAD_ACQ(&abuf->stamp), epoch, next)) {
+            rtp_resend_missing(next, next);
         }
     }
+    rtp_resend_poll(read);
 
+    // the decoder works from the frame before ab_read, so this one is up next
     abuf_t *curframe = audio_buffer + BUFIDX(read);
-    if (!curframe->ready) {
-        debug(1, "missing frame %04X.", read);
-        memset(curframe->data, 0, FRAME_BYTES(frame_size));
+    for (;;) {
+        stamp = LOAD_ACQ(&curframe->stamp);
+        state = AB_STAMP_STATE(stamp);
+        if (!ab_holds(stamp, epoch, read) || state == AB_READY || please_stop)
+            break;
+        __atomic_store_n(&ab_player_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&curframe->stamp, __ATOMIC_SEQ_CST) == stamp &&
+            __atomic_load_n(&ab_epoch, __ATOMIC_SEQ_CST) == epoch)
+            sem_wait(&ab_decoded);
+        if (LOAD_ACQ(&ab_epoch) != epoch)   // flushed while waiting
+            return 0;
     }
-    curframe->ready = 0;
-    pthread_mutex_unlock(&ab_mutex);
 
+    if (!ab_holds(stamp, epoch, read) || state != AB_READY) {
+        debug(1, "missing frame %04X.", read);
+        STATS_ADD(missing_frames, 1);
+        ab_adapt_target(1);
+        return 0;
+    }
+    ab_adapt_target(0);
     return curframe->data;
 }
 
-static int stuff_buffer(double playback_rate, short *inptr, short *outptr) {
+#ifdef FIXED_POINT
+static int stuff_buffer(int64_t playback_rate, char *inptr, char *outptr) {
+    int i;
+    int stuffsamp = frame_size;
+    int stuff = 0;
+    int64_t d = playback_rate - Q48_ONE;
+    uint64_t dev = (d < 0 ? -d : d) >> 18;
+
+    if (dev > Q30_ONE)
+        dev = Q30_ONE;
+    if ((lcg_rand32() >> 2) < stuff_probability(dev)) {
+        stuff = d > 0 ? -1 : 1;
+        stuffsamp = ((uint64_t)lcg_rand32() * (frame_size - 1)) >> 32;
+    }
+#else
+static int stuff_buffer(double playback_rate, char *inptr, char *outptr) {
     int i;
     int stuffsamp = frame_size;
     int stuff = 0;
@@ -402,27 +1008,39 @@ static int stuff_buffer(double playback_rate, short *inptr, short *outptr) {
         stuff = playback_rate > 1.0 ? -1 : 1;
         stuffsamp = rand() % (frame_size - 1);
     }
+#endif
+
+    int in = 2*SAMPLE_BYTES(in_bits), out = 2*SAMPLE_BYTES(out_bits);
 
     pthread_mutex_lock(&vol_mutex);
-    for (i=0; i<stuffsamp; i++) {   // the whole frame, if no stuffing
-        *outptr++ = dithered_vol(*inptr++);
-        *outptr++ = dithered_vol(*inptr++);
-    };
+    // the whole frame, if no stuffing
+    vol_block(outptr, inptr, 2*stuffsamp);
+    outptr += out*stuffsamp;
+    inptr += in*stuffsamp;
     if (stuff) {
         if (stuff==1) {
             debug(2, "+++++++++\n");
+            STATS_ADD(stuffed, 1);
             // interpolate one sample
-            *outptr++ = dithered_vol(((long)inptr[-2] + (long)inptr[0]) >> 1);
-            *outptr++ = dithered_vol(((long)inptr[-1] + (long)inptr[1]) >> 1);
+            if (in_bits == 16) {
+                short *s = (short *)inptr, mid[2];
+                mid[0] = ((long)s[-2] + (long)s[0]) >> 1;
+                mid[1] = ((long)s[-1] + (long)s[1]) >> 1;
+                vol_block(outptr, mid, 2);
+            } else {
+                int32_t *s = (int32_t *)inptr, mid[2];
+                mid[0] = ((int64_t)s[-2] + s[0]) >> 1;
+                mid[1] = ((int64_t)s[-1] + s[1]) >> 1;
+                vol_block(outptr, mid, 2);
+            }
+            outptr += out;
         } else if (stuff==-1) {
             debug(2, "---------\n");
-            inptr++;
-            inptr++;
-        }
-        for (i=stuffsamp; i<frame_size + stuff; i++) {
-            *outptr++ = dithered_vol(*inptr++);
-            *outptr++ = dithered_vol(*inptr++);
+            STATS_ADD(dropped, 1);
+            inptr += in;
         }
+        i = frame_size + stuff - stuffsamp;
+        vol_block(outptr, inptr, 2*i);
     }
     pthread_mutex_unlock(&vol_mutex);
 
@@ -434,8 +1052,8 @@ static void *player_thread_func(void *arg) {
 
     signed short *inbuf, *outbuf, *silence;
     outbuf = malloc(OUTFRAME_BYTES(frame_size));
-    silence = malloc(OUTFRAME_BYTES(frame_size));
-    memset(silence, 0, OUTFRAME_BYTES(frame_size));
+    silence = malloc(FRAME_BYTES(frame_size + 3));
+    memset(silence, 0, FRAME_BYTES(frame_size + 3));
 
 #ifdef FANCY_RESAMPLING
     float *frame, *outframe;
@@ -467,14 +1085,29 @@ static void *player_thread_func(void *arg) {
                 frame[i] *= volume;
             }
             pthread_mutex_unlock(&vol_mutex);
+#ifdef FIXED_POINT
+            srcdat.src_ratio = (double)bf_playback_rate / Q48_ONE;
+#else
             srcdat.src_ratio = bf_playback_rate;
+#endif
             src_process(src, &srcdat);
             assert(srcdat.input_frames_used == FRAME_BYTES(frame_size));
             src_float_to_short_array(outframe, outbuf, FRAME_BYTES(frame_size)*2);
             play_samples = srcdat.output_frames_gen;
         } else
 #endif
-            play_samples = stuff_buffer(bf_playback_rate, inbuf, outbuf);
+        {
+            // straight into the output's own buffer, when it offers one
+            short *dest = 0;
+            if (config.output->get_buffer)
+                dest = config.output->get_buffer(frame_size + 1);
+            if (dest) {
+                config.output->commit(stuff_buffer(bf_playback_rate,
+                                                   (char *)inbuf, (char *)dest));
+                continue;
+            }
+            play_samples = stuff_buffer(bf_playback_rate, (char *)inbuf, (char *)outbuf);
+        }
 
         config.output->play(outbuf, play_samples);
     }
@@ -496,18 +1129,33 @@ void player_volume(double f) {
     }
 }
 void player_flush(void) {
-    pthread_mutex_lock(&ab_mutex);
     ab_resync();
-    pthread_mutex_unlock(&ab_mutex);
 }
 
 int player_play(stream_cfg *stream) {
-    if (config.buffer_start_fill > BUFFER_FRAMES)
+    ab_frames = BUFFER_FRAMES_MIN;
+    while (ab_frames < config.buffer_frames && ab_frames < BUFFER_FRAMES_MAX)
+        ab_frames *= 2;
+    if (config.buffer_start_fill > ab_frames)
         die("specified buffer starting fill %d > buffer size %d",
-            config.buffer_start_fill, BUFFER_FRAMES);
+            config.buffer_start_fill, ab_frames);
+    if (config.buffer_max_fill &&
+        (config.buffer_min_fill > config.buffer_max_fill || config.buffer_max_fill > ab_frames))
+        die("specified buffer fill range %d:%d does not fit buffer size %d",
+            config.buffer_min_fill, config.buffer_max_fill, ab_frames);
+    ab_target_fill = config.buffer_start_fill;
+    if (config.buffer_max_fill) {
+        if (ab_target_fill < config.buffer_min_fill)
+            ab_target_fill = config.buffer_min_fill;
+        if (ab_target_fill > config.buffer_max_fill)
+            ab_target_fill = config.buffer_max_fill;
+    }
+    STATS_ADD(streams, 1);
+    STATS_SET(target_fill, ab_target_fill);
 
     AES_set_decrypt_key(stream->aeskey, 128, &aes);
     aesiv = stream->aesiv;
+    aes_kernel = !aes_alg_open(stream->aeskey);
     init_decoder(stream->fmtp);
     // must be after decoder init
     init_buffer();
@@ -517,19 +1165,32 @@ int player_play(stream_cfg *stream) {
 
     please_stop = 0;
     command_start();
-    config.output->start(sampling_rate);
+    // the output picks the sample format, and the player converts to it
+    // once, on the way out
+    out_bits = 16;
+    if (config.output->start_format)
+        out_bits = config.output->start_format(sampling_rate, in_bits == 16 ? 16 : 24);
+    else
+        config.output->start(sampling_rate);
+    if (out_bits != 16 && (in_bits == 16 || (out_bits != 24 && out_bits != 32)))
+        die("output %s cannot take %d bit samples here", config.output->name, out_bits);
+    pthread_create(&decoder_thread, NULL, decoder_thread_func, NULL);
     pthread_create(&player_thread, NULL, player_thread_func, NULL);
 
     return 0;
 }
 
 void player_stop(void) {
-    please_stop = 1;
+    STORE_REL(&please_stop, 1);
+    sem_post(&ab_received);
+    sem_post(&ab_decoded);
     pthread_join(player_thread, NULL);
+    pthread_join(decoder_thread, NULL);
     config.output->stop();
     command_stop();
     free_buffer();
     free_decoder();
+    aes_alg_close();
 #ifdef FANCY_RESAMPLING
     free_src();
 #endif
@@ -27,6 +27,19 @@ void player_cover_clear();
 void player_flush(void);
 void player_resync(void);
 
-void player_put_packet(seq_t seqno, uint8_t *data, int len);
+void player_put_packet(seq_t seqno, uint32_t timestamp, int64_t arrival,
+                       uint8_t *data, int len);
+
+typedef struct {
+    seq_t seqno;
+    uint32_t timestamp;
+    int64_t arrival;
+    uint8_t *data;
+    int len;
+} player_packet;
+
+// the packets of one receive batch, in the order they came
+void player_put_packets(player_packet *pkts, int n);
+void player_sync(uint32_t rtptime, int64_t local_ns);
 
 #endif //_PLAYER_H
@@ -30,68 +30,320 @@
 #include <memory.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
 #include "common.h"
 #include "player.h"
+#include "rtp.h"
+#include "stats.h"
 
 // only one RTP session can be active at a time.
 static int running = 0;
 static int please_shutdown;
 
-static SOCKADDR rtp_client;
-static int sock;
-static pthread_t rtp_thread;
+static SOCKADDR rtp_client, rtp_timing;
+static int sock, csock;       // audio data, control and timing
+static pthread_t rtp_thread, timing_thread;
+static int resend_pending;       // ranges the resend manager tracks
+static uint32_t resend_asked, resend_recovered;     // packets
+
+// our clock for the timing protocol and the playout: CLOCK_MONOTONIC, in ns
+int64_t rtp_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ns_to_ntp(int64_t ns, uint8_t *p) {
+    uint32_t sec = ns / 1000000000;
+    uint32_t frac = ((uint64_t)(ns % 1000000000) << 32) / 1000000000;
+
+    *(uint32_t *)p = htonl(sec);
+    *(uint32_t *)(p+4) = htonl(frac);
+}
+
+static int64_t ntp_to_ns(uint8_t *p) {
+    uint32_t sec = ntohl(*(uint32_t *)p);
+    uint32_t frac = ntohl(*(uint32_t *)(p+4));
+
+    return (int64_t)sec * 1000000000 + (((uint64_t)frac * 1000000000) >> 32);
+}
+
+// clock filter, receiver thread only. of the last few exchanges the one
+// with the shortest round trip gives the offset (sender minus our clock);
+// the drift comes from the offsets of best samples at least
+// CLOCK_DRIFT_SPAN apart.
+#define CLOCK_SAMPLES       8
+#define CLOCK_DRIFT_SPAN    30000000000LL    // ns
+
+typedef struct {
+    int64_t local, offset, rtt;
+} clock_sample;
+
+static clock_sample clock_window[CLOCK_SAMPLES], clock_best, clock_anchor;
+static int clock_count;
+static int64_t clock_drift;     // ppb
+static int clock_valid;
+
+static void clock_reset(void) {
+    clock_count = 0;
+    clock_drift = 0;
+    clock_valid = 0;
+}
+
+static void clock_update(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    clock_sample *cs = clock_window + clock_count++ % CLOCK_SAMPLES;
+    int i, n = clock_count < CLOCK_SAMPLES ? clock_count : CLOCK_SAMPLES;
+
+    cs->local = t4;
+    cs->offset = ((t2 - t1) + (t3 - t4)) / 2;
+    cs->rtt = (t4 - t1) - (t3 - t2);
+
+    clock_best = clock_window[0];
+    for (i = 1; i < n; i++)
+        if (clock_window[i].rtt < clock_best.rtt)
+            clock_best = clock_window[i];
+
+    if (!clock_valid) {
+        clock_anchor = clock_best;
+        clock_valid = 1;
+    } else if (clock_best.local - clock_anchor.local >= CLOCK_DRIFT_SPAN) {
+        int64_t drift = (clock_best.offset - clock_anchor.offset) * 1000000000 /
+                        (clock_best.local - clock_anchor.local);
+        clock_drift += (drift - clock_drift) / 4;
+        clock_anchor = clock_best;
+    }
+    debug(2, "clock offset %lld ns, rtt %lld ns, drift %lld ppb\n",
+          (long long)clock_best.offset, (long long)clock_best.rtt, (long long)clock_drift);
+}
+
+// the sender's time as ours
+static int64_t clock_remote_to_local(int64_t remote) {
+    int64_t now = rtp_clock_ns();
+    return remote - (clock_best.offset + clock_drift * (now - clock_best.local) / 1000000000);
+}
+
+static void timing_send(SOCKADDR *to, uint8_t type, uint8_t *origin, int64_t received) {
+    uint8_t req[32];
+
+    memset(req, 0, sizeof(req));
+    req[0] = 0x80;
+    req[1] = type|0x80;
+    *(unsigned short *)(req+2) = htons(7);
+    if (origin)
+        memcpy(req+8, origin, 8);
+    if (received)
+        ns_to_ntp(received, req+16);
+    ns_to_ntp(rtp_clock_ns(), req+24);
+
+    sendto(csock, req, sizeof(req), 0, (struct sockaddr*)to, sizeof(*to));
+}
+
+// asks the sender for its time: quickly at first, then every few seconds
+static void *rtp_timing_sender(void *arg) {
+    int sent = 0, ticks = 0;
+
+    while (!please_shutdown) {
+        if (ticks-- <= 0) {
+            timing_send(&rtp_timing, 0x52, NULL, 0);
+            ticks = sent++ < 4 ? 2 : 30;
+        }
+        usleep(100000);
+    }
+    return NULL;
+}
+
+#define RTP_BATCH   16      // datagrams per receive
+#define RTP_PACKET  4096    // an uncompressed 24 bit frame, and headers
+
+// the audio of one receive batch, handed to the player together
+static player_packet rtp_burst[RTP_BATCH];
+static int rtp_burst_n;
+
+static void rtp_burst_flush(void) {
+    if (rtp_burst_n)
+        player_put_packets(rtp_burst, rtp_burst_n);
+    rtp_burst_n = 0;
+}
+
+// handles one datagram from either socket. now: its arrival time
+static void rtp_handle(uint8_t *packet, ssize_t nread, SOCKADDR *from, int64_t now) {
+    uint8_t *pktp;
+    ssize_t plen = nread;
+
+    if (nread < 4)
+        return;
+    uint8_t type = packet[1] & ~0x80;
+    if (type == 0x54) { // sync: this RTP time is due at that sender time
+        rtp_burst_flush();
+        if (nread >= 20 && clock_valid)
+            player_sync(ntohl(*(uint32_t *)(packet+4)),
+                        clock_remote_to_local(ntp_to_ns(packet+8)));
+        return;
+    }
+    if (type == 0x53) { // timing reply
+        if (nread >= 32)
+            clock_update(ntp_to_ns(packet+8), ntp_to_ns(packet+16),
+                         ntp_to_ns(packet+24), now);
+        return;
+    }
+    if (type == 0x52) { // timing request from the sender
+        if (nread >= 32)
+            timing_send(from, 0x53, packet+24, now);
+        return;
+    }
+    if (type == 0x60 || type == 0x56) {   // audio data / resend
+        pktp = packet;
+        if (type==0x56) {
+            pktp += 4;
+            plen -= 4;
+        }
+        if (plen < 12)
+            return;
+        seq_t seqno = ntohs(*(unsigned short *)(pktp+2));
+        uint32_t timestamp = ntohl(*(uint32_t *)(pktp+4));
+
+        pktp += 12;
+        plen -= 12;
+
+        // check if packet contains enough content to be reasonable
+        if (plen >= 16) {
+            player_packet *p = &rtp_burst[rtp_burst_n++];
+            p->seqno = seqno;
+            p->timestamp = timestamp;
+            p->arrival = now;
+            p->data = pktp;
+            p->len = plen;
+            return;
+        }
+        if (type == 0x56 && seqno == 0) {
+            debug(2, "resend-related request packet received, ignoring.\n");
+            return;
+        }
+        debug(1, "Unknown RTP packet of type 0x%02X length %d seqno %d\n", type, nread, seqno);
+        return;
+    }
+    warn("Unknown RTP packet of type 0x%02X length %d", type, nread);
+}
+
+// batched receive: up to RTP_BATCH datagrams per syscall into preallocated
+// slots, each with the kernel's receive time. the libc may not have
+// recvmmsg, so it is called by number with our own copy of the struct.
+
+struct rtp_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+static uint8_t rtp_packets[RTP_BATCH][RTP_PACKET];
+static SOCKADDR rtp_from[RTP_BATCH];
+static struct iovec rtp_iov[RTP_BATCH];
+static union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+} rtp_cmsg[RTP_BATCH];
+static struct rtp_mmsghdr rtp_msgs[RTP_BATCH];
+
+static int rtp_recv_batch(int fd) {
+    int i, n;
+
+    for (i = 0; i < RTP_BATCH; i++) {
+        struct msghdr *mh = &rtp_msgs[i].msg_hdr;
+        rtp_iov[i].iov_base = rtp_packets[i];
+        rtp_iov[i].iov_len = RTP_PACKET;
+        mh->msg_name = &rtp_from[i];
+        mh->msg_namelen = sizeof(rtp_from[i]);
+        mh->msg_iov = &rtp_iov[i];
+        mh->msg_iovlen = 1;
+        mh->msg_control = rtp_cmsg[i].buf;
+        mh->msg_controllen = sizeof(rtp_cmsg[i].buf);
+        mh->msg_flags = 0;
+    }
+
+#ifdef __NR_recvmmsg
+    n = syscall(__NR_recvmmsg, fd, rtp_msgs, RTP_BATCH, MSG_DONTWAIT, NULL);
+    if (n >= 0 || errno != ENOSYS)
+        return n;
+#endif
+    // older kernel: one at a time
+    n = recvmsg(fd, &rtp_msgs[0].msg_hdr, MSG_DONTWAIT);
+    if (n < 0)
+        return n;
+    rtp_msgs[0].msg_len = n;
+    return 1;
+}
+
+// the kernel stamps CLOCK_REALTIME; mono_real moves that to our clock.
+// without a stamp, the time the batch was read is the best we have
+static int64_t rtp_arrival(struct msghdr *mh, int64_t mono_real, int64_t now) {
+#ifdef SO_TIMESTAMPNS
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + mono_real;
+        }
+    }
+#endif
+    return now;
+}
 
 static void *rtp_receiver(void *arg) {
     // we inherit the signal mask (SIGUSR1)
-    uint8_t packet[2048], *pktp;
+    struct pollfd fds[2];
+    struct timespec real;
+    int64_t now, mono_real;
+    int i, j, n;
+
+    fds[0].fd = sock;
+    fds[1].fd = csock;
+    fds[0].events = fds[1].events = POLLIN;
 
-    ssize_t nread;
     while (1) {
         if (please_shutdown)
             break;
-        nread = recv(sock, packet, sizeof(packet), 0);
-        if (nread < 0)
+        // with a timeout, a shutdown signal just before poll is not lost
+        n = poll(fds, 2, 100);
+        if (n < 0)
             break;
 
-        ssize_t plen = nread;
-        uint8_t type = packet[1] & ~0x80;
-        if (type == 0x54) // sync
-            continue;
-        if (type == 0x60 || type == 0x56) {   // audio data / resend
-            pktp = packet;
-            if (type==0x56) {
-                pktp += 4;
-                plen -= 4;
+        for (i = 0; i < 2; i++) {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            n = rtp_recv_batch(fds[i].fd);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+                goto out;
             }
-            seq_t seqno = ntohs(*(unsigned short *)(pktp+2));
 
-            pktp += 12;
-            plen -= 12;
+            now = rtp_clock_ns();
+            clock_gettime(CLOCK_REALTIME, &real);
+            mono_real = now - ((int64_t)real.tv_sec * 1000000000 + real.tv_nsec);
 
-            // check if packet contains enough content to be reasonable
-            if (plen >= 16) {
-                player_put_packet(seqno, pktp, plen);
-                continue;
-            }
-            if (type == 0x56 && seqno == 0) {
-                debug(2, "resend-related request packet received, ignoring.\n");
-                continue;
-            }
-            debug(1, "Unknown RTP packet of type 0x%02X length %d seqno %d\n", type, nread, seqno);
-            continue;
+            for (j = 0; j < n; j++)
+                rtp_handle(rtp_packets[j], rtp_msgs[j].msg_len, &rtp_from[j],
+                           rtp_arrival(&rtp_msgs[j].msg_hdr, mono_real, now));
+            rtp_burst_flush();
         }
-        warn("Unknown RTP packet of type 0x%02X length %d", type, nread);
     }
 
+out:
     debug(1, "RTP thread interrupted. terminating.\n");
     close(sock);
+    close(csock);
 
     return NULL;
 }
 
-static int bind_port(SOCKADDR *remote) {
+static int bind_port(SOCKADDR *remote, int *psock) {
+    int sock;
     struct addrinfo hints, *info;
 
     memset(&hints, 0, sizeof(hints));
@@ -112,6 +364,13 @@ static int bind_port(SOCKADDR *remote) {
     if (ret < 0)
         die("could not bind a UDP port!");
 
+#ifdef SO_TIMESTAMPNS
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        debug(1, "no receive timestamps: %s\n", strerror(errno));
+#endif
+    *psock = sock;
+
     int sport;
     SOCKADDR local;
     socklen_t local_len = sizeof(local);
@@ -131,33 +390,40 @@ static int bind_port(SOCKADDR *remote) {
 }
 
 
-int rtp_setup(SOCKADDR *remote, int cport, int tport) {
+int rtp_setup(SOCKADDR *remote, int cport, int tport, int *lport) {
     if (running)
         die("rtp_setup called with active stream!");
 
     debug(1, "rtp_setup: cport=%d tport=%d\n", cport, tport);
 
-    // we do our own timing and ignore the timing port.
-    // an audio perfectionist may wish to learn the protocol.
-
     memcpy(&rtp_client, remote, sizeof(rtp_client));
+    memcpy(&rtp_timing, remote, sizeof(rtp_timing));
 #ifdef AF_INET6
     if (rtp_client.SAFAMILY == AF_INET6) {
         struct sockaddr_in6 *sa6 = (struct sockaddr_in6*)&rtp_client;
         sa6->sin6_port = htons(cport);
+        sa6 = (struct sockaddr_in6*)&rtp_timing;
+        sa6->sin6_port = htons(tport);
     } else
 #endif
     {
         struct sockaddr_in *sa = (struct sockaddr_in*)&rtp_client;
         sa->sin_port = htons(cport);
+        sa = (struct sockaddr_in*)&rtp_timing;
+        sa->sin_port = htons(tport);
     }
 
-    int sport = bind_port(remote);
+    int sport = bind_port(remote, &sock);
+    *lport = bind_port(remote, &csock);
 
-    debug(1, "rtp listening on port %d\n", sport);
+    debug(1, "rtp listening on port %d, control on %d\n", sport, *lport);
 
     please_shutdown = 0;
+    clock_reset();
+    rtp_resend_flush();
+    resend_asked = resend_recovered = 0;
     pthread_create(&rtp_thread, NULL, &rtp_receiver, NULL);
+    pthread_create(&timing_thread, NULL, &rtp_timing_sender, NULL);
 
     running = 1;
     return sport;
@@ -169,6 +435,7 @@ void rtp_shutdown(void) {
 
     debug(2, "shutting down RTP thread\n");
     please_shutdown = 1;
+    pthread_join(timing_thread, NULL);
     pthread_kill(rtp_thread, SIGUSR1);
     void *retval;
     pthread_join(rtp_thread, &retval);
@@ -189,5 +456,166 @@ void rtp_request_resend(seq_t first, seq_t last) {
     *(unsigned short *)(req+4) = htons(first);  // missed seqnum
     *(unsigned short *)(req+6) = htons(last-first+1);  // count
 
-    sendto(sock, req, sizeof(req), 0, (struct sockaddr*)&rtp_client, sizeof(rtp_client));
+    sendto(csock, req, sizeof(req), 0, (struct sockaddr*)&rtp_client, sizeof(rtp_client));
+}
+
+// resend manager. the receiver reports gaps and arrivals, the player
+// polls once a frame with the last packet it played. a gap is asked for
+// at once, then again with a backoff that doubles from about two round
+// trips, and given up after RESEND_TRIES or once it has been played.
+// gaps that have not been asked for yet are merged with their
+// neighbours, so a burst of losses goes out as one request.
+#define RESEND_RANGES   32
+#define RESEND_TRIES    4
+#define RESEND_MIN_NS   20000000LL      // first retry, when there is no rtt yet
+
+typedef struct {
+    seq_t first, last;
+    int tries;          // requests sent so far
+    int64_t due;        // time of the next request
+} resend_range;
+
+static pthread_mutex_t resend_mutex = PTHREAD_MUTEX_INITIALIZER;
+static resend_range resend_ranges[RESEND_RANGES];
+static int resend_count;                // ranges in use, first in the table
+
+static inline int seq_before(seq_t a, seq_t b) {
+    return (int16_t)(b - a) > 0;
+}
+
+static void resend_drop(int i) {
+    resend_ranges[i] = resend_ranges[--resend_count];
+}
+
+void rtp_resend_missing(seq_t first, seq_t last) {
+    resend_range *r;
+    int i;
+
+    pthread_mutex_lock(&resend_mutex);
+    for (i = 0; i < resend_count && !seq_before(last, first); i++) {
+        r = resend_ranges + i;
+        if (seq_before(r->last + 1, first) || seq_before(last + 1, r->first))
+            continue;       // neither overlapping nor adjacent
+        if (!r->tries) {    // not asked for yet: take it in
+            if (seq_before(first, r->first))
+                r->first = first;
+            if (seq_before(r->last, last))
+                r->last = last;
+            goto done;
+        }
+        // asked for already: keep to what is not covered
+        if (!seq_before(first, r->first) && !seq_before(r->last, last))
+            goto done;
+        if (!seq_before(first, r->first))
+            first = r->last + 1;
+        else if (!seq_before(r->last, last))
+            last = r->first - 1;
+    }
+    if (!seq_before(last, first) && resend_count < RESEND_RANGES) {
+        r = resend_ranges + resend_count++;
+        r->first = first;
+        r->last = last;
+        r->tries = 0;
+        r->due = 0;
+    }
+done:
+    __atomic_store_n(&resend_pending, resend_count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&resend_mutex);
+}
+
+void rtp_resend_arrived(seq_t seqno) {
+    resend_range *r;
+    int i;
+
+    if (!__atomic_load_n(&resend_pending, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&resend_mutex);
+    for (i = 0; i < resend_count; i++) {
+        r = resend_ranges + i;
+        if (seq_before(seqno, r->first) || seq_before(r->last, seqno))
+            continue;
+        if (r->tries) {
+            resend_recovered++;
+            STATS_ADD(resends_recovered, 1);
+        }
+        if (r->first == r->last)
+            resend_drop(i);
+        else if (seqno == r->first)
+            r->first++;
+        else if (seqno == r->last)
+            r->last--;
+        else if (resend_count < RESEND_RANGES) {    // split around it
+            resend_ranges[resend_count] = *r;
+            resend_ranges[resend_count++].first = seqno + 1;
+            r->last = seqno - 1;
+        }
+        break;
+    }
+    __atomic_store_n(&resend_pending, resend_count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&resend_mutex);
+}
+
+void rtp_resend_poll(seq_t played) {
+    static int polls;
+    resend_range *r;
+    int64_t now, backoff;
+    int i;
+
+    if (!__atomic_load_n(&resend_pending, __ATOMIC_RELAXED))
+        goto stats;
+    now = rtp_clock_ns();
+    pthread_mutex_lock(&resend_mutex);
+    // the clock filter belongs to the receiver; a torn read only skews a retry
+    backoff = clock_valid && 2 * clock_best.rtt > RESEND_MIN_NS ?
+              2 * clock_best.rtt : RESEND_MIN_NS;
+    for (i = 0; i < resend_count; i++) {
+        r = resend_ranges + i;
+        if (!seq_before(played, r->last) ||
+            seq_diff(played, r->last) > 0x4000) {   // played, or a new stream
+            resend_drop(i--);
+            continue;
+        }
+        if (!seq_before(played, r->first))
+            r->first = played + 1;
+        if (r->due > now)
+            continue;
+        if (r->tries == RESEND_TRIES) {
+            resend_drop(i--);
+            continue;
+        }
+        if (!r->tries) {
+            resend_asked += seq_diff(r->first, r->last) + 1;
+            STATS_ADD(resends_asked, seq_diff(r->first, r->last) + 1);
+        }
+        rtp_request_resend(r->first, r->last);
+        r->due = now + (backoff << r->tries);
+        r->tries++;
+    }
+    __atomic_store_n(&resend_pending, resend_count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&resend_mutex);
+
+stats:
+    if (++polls >= 1024) {  // about every 8s
+        polls = 0;
+        if (resend_asked)
+            debug(1, "resend: %u of %u packets recovered (%d%%)\n",
+                  resend_recovered, resend_asked, rtp_resend_success());
+    }
+}
+
+// percentage of the packets asked for that came in before their playout
+int rtp_resend_success(void) {
+    int rate;
+
+    pthread_mutex_lock(&resend_mutex);
+    rate = resend_asked ? (int)((uint64_t)resend_recovered * 100 / resend_asked) : 100;
+    pthread_mutex_unlock(&resend_mutex);
+    return rate;
+}
+
+void rtp_resend_flush(void) {
+    pthread_mutex_lock(&resend_mutex);
+    resend_count = 0;
+    __atomic_store_n(&resend_pending, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&resend_mutex);
 }
@@ -3,8 +3,14 @@
 
 #include <sys/socket.h>
 
-int rtp_setup(SOCKADDR *remote, int controlport, int timingport);
+int rtp_setup(SOCKADDR *remote, int controlport, int timingport, int *localcontrol);
 void rtp_shutdown(void);
 void rtp_request_resend(seq_t first, seq_t last);
+void rtp_resend_missing(seq_t first, seq_t last);
+void rtp_resend_arrived(seq_t seqno);
+void rtp_resend_poll(seq_t played);
+void rtp_resend_flush(void);
+int rtp_resend_success(void);
+int64_t rtp_clock_ns(void);
 
 #endif // _RTP_H
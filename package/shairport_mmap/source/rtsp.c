@@ -65,6 +65,11 @@ typedef struct {
     SOCKADDR remote;
     int running;
     pthread_t thread;
+
+    // requests are parsed in place here
+    char *buf;
+    int size, inbuf;
+    int used;           // bytes of the current request
 } rtsp_conn_info;
 
 // determine if we are the currently playing thread
@@ -146,35 +151,54 @@ static char *nextline(char *in, int inbuf) {
     return out;
 }
 
+#define RTSP_BUFFER     4096            // connection buffer: a request head and small bodies
+#define RTSP_MAX_CONTENT (256*1024)     // bodies that are read whole, not streamed
+
 typedef struct {
     int nheaders;
-    char *name[16];
+    char *name[16];     // requests: slices of the connection buffer
     char *value[16];
 
     int contentlength;
-    char *content;
+    char *content;      // NULL while the body is still on the socket
+    int headlen;        // where the body starts in the connection buffer
+    int body_left;      // bytes of the body not yet read
 
     // for requests
     char method[16];
 
     // for responses
     int respcode;
+    char store[1024];   // copies of the header strings
+    int stored;
 } rtsp_message;
 
-static rtsp_message * msg_init(void) {
-    rtsp_message *msg = malloc(sizeof(rtsp_message));
-    memset(msg, 0, sizeof(rtsp_message));
-    return msg;
+static void msg_init(rtsp_message *msg) {
+    msg->nheaders = 0;
+    msg->contentlength = 0;
+    msg->content = NULL;
+    msg->headlen = msg->body_left = 0;
+    msg->method[0] = 0;
+    msg->respcode = 0;
+    msg->stored = 0;
 }
 
 static int msg_add_header(rtsp_message *msg, char *name, char *value) {
+    int nlen = strlen(name) + 1, vlen = strlen(value) + 1;
+
     if (msg->nheaders >= sizeof(msg->name)/sizeof(char*)) {
         warn("too many headers?!");
         return 1;
     }
+    if (msg->stored + nlen + vlen > sizeof(msg->store)) {
+        warn("headers too long?!");
+        return 1;
+    }
 
-    msg->name[msg->nheaders] = strdup(name);
-    msg->value[msg->nheaders] = strdup(value);
+    msg->name[msg->nheaders] = memcpy(msg->store + msg->stored, name, nlen);
+    msg->stored += nlen;
+    msg->value[msg->nheaders] = memcpy(msg->store + msg->stored, value, vlen);
+    msg->stored += vlen;
     msg->nheaders++;
 
     return 0;
@@ -188,42 +212,28 @@ static char *msg_get_header(rtsp_message *msg, char *name) {
     return NULL;
 }
 
-static void msg_free(rtsp_message *msg) {
-    int i;
-    for (i=0; i<msg->nheaders; i++) {
-        free(msg->name[i]);
-        free(msg->value[i]);
-    }
-    if (msg->content)
-        free(msg->content);
-    free(msg);
-}
-
-
-static int msg_handle_line(rtsp_message **pmsg, char *line) {
-    rtsp_message *msg = *pmsg;
-
-    if (!msg) {
-        msg = msg_init();
-        *pmsg = msg;
+// the request line, headers and the empty line, parsed in place
+static int msg_handle_line(rtsp_message *msg, char *line) {
+    if (!msg->method[0]) {
         char *sp, *p;
 
         debug(1, "received request: %s\n", line);
 
         p = strtok_r(line, " ", &sp);
         if (!p)
-            goto fail;
+            return -2;
         strncpy(msg->method, p, sizeof(msg->method)-1);
+        msg->method[sizeof(msg->method)-1] = 0;
 
         p = strtok_r(NULL, " ", &sp);
         if (!p)
-            goto fail;
+            return -2;
 
         p = strtok_r(NULL, " ", &sp);
         if (!p)
-            goto fail;
+            return -2;
         if (strcmp(p, "RTSP/1.0"))
-            goto fail;
+            return -2;
 
         return -1;
     }
@@ -233,102 +243,154 @@ static int msg_handle_line(rtsp_message **pmsg, char *line) {
         p = strstr(line, ": ");
         if (!p) {
             warn("bad header: >>%s<<", line);
-            goto fail;
+            return -2;
         }
         *p = 0;
         p += 2;
-        msg_add_header(msg, line, p);
+        if (msg->nheaders >= sizeof(msg->name)/sizeof(char*)) {
+            warn("too many headers?!");
+        } else {
+            msg->name[msg->nheaders] = line;
+            msg->value[msg->nheaders] = p;
+            msg->nheaders++;
+        }
         debug(2, "    %s: %s\n", line, p);
         return -1;
     } else {
         char *cl = msg_get_header(msg, "Content-Length");
-        if (cl)
-            return atoi(cl);
-        else
-            return 0;
+        int len = cl ? atoi(cl) : 0;
+        return len < 0 ? -2 : len;
     }
-
-fail:
-    *pmsg = NULL;
-    msg_free(msg);
-    return 0;
 }
 
-static rtsp_message * rtsp_read_request(int fd) {
-    ssize_t buflen = 512;
-    char *buf = malloc(buflen+1);
-
-    rtsp_message *msg = NULL;
-
+static int conn_read(rtsp_conn_info *conn, int max) {
     ssize_t nread;
-    ssize_t inbuf = 0;
-    int msg_size = -1;
 
-    while (msg_size < 0) {
-        if (please_shutdown) {
-            debug(1, "RTSP shutdown requested\n");
-            goto shutdown;
+    while (1) {
+        nread = read(conn->fd, conn->buf + conn->inbuf, max);
+        if (nread > 0) {
+            conn->inbuf += nread;
+            return nread;
         }
-        nread = read(fd, buf+inbuf, buflen - inbuf);
         if (!nread) {
             debug(1, "RTSP connection closed\n");
-            goto shutdown;
+            return -1;
         }
-        if (nread < 0) {
-            if (errno==EINTR)
-                continue;
-            perror("read failure");
-            goto shutdown;
+        if (errno != EINTR || please_shutdown) {
+            if (errno != EINTR)
+                perror("read failure");
+            return -1;
         }
-        inbuf += nread;
-
-        char *next;
-        while (msg_size < 0 && (next = nextline(buf, inbuf))) {
-            msg_size = msg_handle_line(&msg, buf);
+    }
+}
 
-            if (!msg) {
-                warn("no RTSP header received");
-                goto shutdown;
-            }
+// the next piece of a body that is still on the socket, read into the
+// buffer after the head. returns its length, 0 at the end, -1 on error
+static int msg_body_next(rtsp_conn_info *conn, rtsp_message *msg, char **chunk) {
+    int n;
 
-            inbuf -= next-buf;
-            if (inbuf)
-                memmove(buf, next, inbuf);
-        }
+    if (!msg->body_left)
+        return 0;
+    // the first piece came in with the head
+    n = conn->inbuf - msg->headlen;
+    if (!n) {
+        n = conn->size - msg->headlen;
+        if (n > msg->body_left)
+            n = msg->body_left;
+        n = conn_read(conn, n);
+        if (n < 0)
+            return -1;
     }
+    *chunk = conn->buf + msg->headlen;
+    msg->body_left -= n;
+    conn->inbuf = msg->headlen;
+    return n;
+}
 
-    if (msg_size > buflen) {
-        buf = realloc(buf, msg_size);
-        if (!buf) {
-            warn("too much content");
-            goto shutdown;
-        }
-        buflen = msg_size;
+// reads a body that did not fit the buffer into it after all
+static int msg_load_body(rtsp_conn_info *conn, rtsp_message *msg) {
+    int i, need = msg->headlen + msg->body_left;
+    char *old = conn->buf;
+
+    if (!msg->body_left || msg->content)
+        return 0;
+    if (msg->body_left > RTSP_MAX_CONTENT) {
+        warn("too much content");
+        return -1;
     }
+    conn->buf = realloc(conn->buf, need + 1);
+    if (!conn->buf) {
+        warn("too much content");
+        conn->buf = old;
+        return -1;
+    }
+    conn->size = need;
+    // the headers are slices of the buffer that moved
+    for (i=0; i<msg->nheaders; i++) {
+        msg->name[i] = conn->buf + (msg->name[i] - old);
+        msg->value[i] = conn->buf + (msg->value[i] - old);
+    }
+    while (conn->inbuf < need)
+        if (conn_read(conn, need - conn->inbuf) < 0)
+            return -1;
+    msg->body_left = 0;
+    msg->content = conn->buf + msg->headlen;
+    conn->used = need;
+    return 0;
+}
 
-    while (inbuf < msg_size) {
-        nread = read(fd, buf+inbuf, msg_size-inbuf);
-        if (!nread)
-            goto shutdown;
-        if (nread==EINTR)
-            continue;
-        if (nread < 0) {
-            perror("read failure");
-            goto shutdown;
+// reads the next request head into the connection buffer, and the body
+// when it fits; a larger one is left for msg_body_next/msg_load_body.
+// returns 0 when the connection is to be closed
+static int rtsp_read_request(rtsp_conn_info *conn, rtsp_message *msg) {
+    int msg_size = -1, pos = 0, space;
+    char *next;
+
+    // drop what the previous request used, keeping anything pipelined
+    conn->inbuf -= conn->used;
+    if (conn->inbuf)
+        memmove(conn->buf, conn->buf + conn->used, conn->inbuf);
+    conn->used = 0;
+    msg_init(msg);
+
+    while (msg_size < 0) {
+        if (please_shutdown) {
+            debug(1, "RTSP shutdown requested\n");
+            return 0;
+        }
+        while (msg_size == -1 && (next = nextline(conn->buf + pos, conn->inbuf - pos))) {
+            msg_size = msg_handle_line(msg, conn->buf + pos);
+            pos = next - conn->buf;
+        }
+        if (msg_size == -2) {
+            warn("no RTSP header received");
+            return 0;
+        }
+        if (msg_size >= 0)
+            break;
+        if (conn->inbuf == conn->size) {
+            warn("RTSP request head too long");
+            return 0;
         }
-        inbuf += nread;
+        if (conn_read(conn, conn->size - conn->inbuf) < 0)
+            return 0;
     }
 
-    msg->contentlength = inbuf;
-    msg->content = buf;
-    return msg;
-
-shutdown:
-    free(buf);
-    if (msg) {
-        msg_free(msg);
+    msg->headlen = pos;
+    msg->contentlength = msg_size;
+    space = conn->size - pos;
+    if (msg_size > space) {     // streamed, or loaded for the handler
+        msg->body_left = msg_size;
+        conn->used = pos;
+        return 1;
     }
-    return NULL;
+
+    while (conn->inbuf < pos + msg_size)
+        if (conn_read(conn, conn->size - conn->inbuf) < 0)
+            return 0;
+    msg->content = conn->buf + pos;
+    conn->used = pos + msg_size;
+    return 1;
 }
 
 static void msg_write_response(int fd, rtsp_message *resp) {
@@ -388,7 +450,7 @@ static void handle_flush(rtsp_conn_info *conn,
 
 static void handle_setup(rtsp_conn_info *conn,
                          rtsp_message *req, rtsp_message *resp) {
-    int cport, tport;
+    int cport, tport, lport;
     char *hdr = msg_get_header(req, "Transport");
     if (!hdr)
         return;
@@ -407,7 +469,7 @@ static void handle_setup(rtsp_conn_info *conn,
     tport = atoi(p);
 
     rtsp_take_player();
-    int sport = rtp_setup(&conn->remote, cport, tport);
+    int sport = rtp_setup(&conn->remote, cport, tport, &lport);
     if (!sport)
         return;
 
@@ -416,7 +478,7 @@ static void handle_setup(rtsp_conn_info *conn,
     char resphdr[100];
     snprintf(resphdr, sizeof(resphdr),
              "RTP/AVP/UDP;unicast;mode=record;server_port=%d;control_port=%d;timing_port=%d",
-             sport, sport, sport);
+             sport, lport, lport);
     msg_add_header(resp, "Transport", resphdr);
 
     msg_add_header(resp, "Session", "1");
@@ -499,20 +561,33 @@ static void handle_set_parameter_metadata(rtsp_conn_info *conn,
     metadata_write();
 }
 
+// artwork goes to the metadata sink as it comes off the socket
 static void handle_set_parameter_coverart(rtsp_conn_info *conn,
                                           rtsp_message *req, rtsp_message *resp) {
-    char *cp = req->content;
-    int cl = req->contentlength;
-
     char *ct = msg_get_header(req, "Content-Type");
+    char *chunk;
+    int n;
 
     if (!strncmp(ct, "image/jpeg", 10)) {
-        metadata_cover_image(cp, cl, "jpg");
+        metadata_cover_begin("jpg");
     } else if (!strncmp(ct, "image/png", 9)) {
-        metadata_cover_image(cp, cl, "png");
+        metadata_cover_begin("png");
     } else {
         metadata_cover_image(NULL, 0, NULL);
+        return;
     }
+
+    if (req->content) {
+        metadata_cover_data(req->content, req->contentlength);
+    } else {
+        while ((n = msg_body_next(conn, req, &chunk)) > 0)
+            metadata_cover_data(chunk, n);
+        if (n < 0) {
+            metadata_cover_end(0);
+            return;
+        }
+    }
+    metadata_cover_end(1);
 }
 
 static void handle_set_parameter(rtsp_conn_info *conn,
@@ -589,16 +664,15 @@ static void handle_announce(rtsp_conn_info *conn,
     memcpy(conn->stream.aesiv, aesiv, 16);
     free(aesiv);
 
+    uint8_t aeskey[RSA_SIZE];
     uint8_t *rsaaeskey = base64_dec(prsaaeskey, &len);
-    uint8_t *aeskey = rsa_apply(rsaaeskey, len, &keylen, RSA_MODE_KEY);
+    keylen = rsa_apply(rsaaeskey, len, aeskey, RSA_MODE_KEY);
     free(rsaaeskey);
     if (keylen != 16) {
         warn("client announced rsaaeskey of %d bytes, wanted 16", keylen);
-        free(aeskey);
         return;
     }
     memcpy(conn->stream.aeskey, aeskey, 16);
-    free(aeskey);
 
     int i;
     for (i=0; i<sizeof(conn->stream.fmtp)/sizeof(conn->stream.fmtp[0]); i++)
@@ -669,7 +743,10 @@ static void apple_challenge(int fd, rtsp_message *req, rtsp_message *resp) {
     if (buflen < 0x20)
         buflen = 0x20;
 
-    uint8_t *challresp = rsa_apply(buf, buflen, &resplen, RSA_MODE_AUTH);
+    uint8_t challresp[RSA_SIZE];
+    resplen = rsa_apply(buf, buflen, challresp, RSA_MODE_AUTH);
+    if (resplen < 0)
+        return;
     char *encoded = base64_enc(challresp, resplen);
 
     // strip the padding.
@@ -678,7 +755,6 @@ static void apple_challenge(int fd, rtsp_message *req, rtsp_message *resp) {
         *padding = 0;
 
     msg_add_header(resp, "Apple-Response", encoded);
-    free(challresp);
     free(encoded);
 }
 
@@ -787,10 +863,16 @@ static void *rtsp_conversation_thread_func(void *pconn) {
 
     rtsp_conn_info *conn = pconn;
 
-    rtsp_message *req, *resp;
-    char *hdr, *auth_nonce = NULL;
-    while ((req = rtsp_read_request(conn->fd))) {
-        resp = msg_init();
+    rtsp_message request, response, *req = &request, *resp = &response;
+    char *hdr, *auth_nonce = NULL, *chunk;
+
+    conn->size = RTSP_BUFFER;
+    conn->buf = malloc(conn->size + 1);
+    if (!conn->buf)
+        die("could not allocate an RTSP buffer");
+
+    while (rtsp_read_request(conn, req)) {
+        msg_init(resp);
         resp->respcode = 400;
 
         apple_challenge(conn->fd, req, resp);
@@ -805,16 +887,23 @@ static void *rtsp_conversation_thread_func(void *pconn) {
         struct method_handler *mh;
         for (mh=method_handlers; mh->method; mh++) {
             if (!strcmp(mh->method, req->method)) {
+                hdr = msg_get_header(req, "Content-Type");
+                // only artwork is streamed; other handlers get the body whole
+                if (!(!strcmp(req->method, "SET_PARAMETER") && hdr && !strncmp(hdr, "image/", 6)) &&
+                    msg_load_body(conn, req) < 0)
+                    break;
                 mh->handler(conn, req, resp);
                 break;
             }
         }
 
 respond:
+        // whatever of the body was not used
+        while (msg_body_next(conn, req, &chunk) > 0)
+            ;
         msg_write_response(conn->fd, resp);
-        msg_free(req);
-        msg_free(resp);
     }
+    free(conn->buf);
 
     debug(1, "closing RTSP connection\n");
     if (conn->fd > 0)
@@ -38,6 +38,7 @@
 #include "mdns.h"
 #include "getopt_long.h"
 #include "metadata.h"
+#include "stats.h"
 
 static const char *version =
     #include "version.h"
@@ -54,6 +55,7 @@ void shairport_shutdown(int retval) {
     printf("Shutting down...\n");
     mdns_unregister();
     rtsp_shutdown_stream();
+    stats_close();
     if (config.output)
         config.output->deinit();
     daemon_exit(); // This does nothing if not in daemon mode
@@ -95,6 +97,10 @@ void usage(char *progname) {
     printf("    -k, --password=PW   require password to stream audio\n");
     printf("    -b FILL             set how full the buffer must be before audio output\n");
     printf("                        starts. This value is in frames; default %d\n", config.buffer_start_fill);
+    printf("    -S, --buffer-size=FRAMES  set the size of the jitter buffer, rounded up\n");
+    printf("                        to a power of 2 between 64 and 2048; default %d\n", config.buffer_frames);
+    printf("    -F, --fill-range=MIN:MAX  let the starting fill adapt to the network\n");
+    printf("                        between MIN and MAX frames; default fixed\n");
     printf("    -d, --daemon        fork (daemonise). The PID of the child process is\n");
     printf("                        written to stdout, unless a pidfile is used.\n");
     printf("    -P, --pidfile=FILE  write daemon's pid to FILE on startup.\n");
@@ -107,6 +113,7 @@ void usage(char *progname) {
     printf("    -E, --on-stop=COMMAND   run a shell command when playback ends\n");
     printf("    -w, --wait-cmd          block while the shell command(s) run\n");
     printf("    -M, --meta-dir=DIR      set a directory to write metadata and album cover art to\n");
+    printf("    -T, --stats=SOCKET      serve playback statistics as JSON on a UNIX socket\n");
 
     printf("    -o, --output=BACKEND    select audio output method\n");
     printf("    -m, --mdns=BACKEND      force the use of BACKEND to advertise the service\n");
@@ -137,13 +144,16 @@ int parse_options(int argc, char **argv) {
         {"on-stop",   required_argument,  NULL, 'E'},
         {"wait-cmd",  no_argument,        NULL, 'w'},
         {"meta-dir",  required_argument,  NULL, 'M'},
+        {"stats",     required_argument,  NULL, 'T'},
         {"mdns",      required_argument,  NULL, 'm'},
+        {"buffer-size", required_argument, NULL, 'S'},
+        {"fill-range", required_argument, NULL, 'F'},
         {NULL,        0,                  NULL,   0}
     };
 
     int opt;
     while ((opt = getopt_long(argc, argv,
-                              "+hdvP:l:e:p:a:k:o:b:B:E:M:wm:",
+                              "+hdvP:l:e:p:a:k:o:b:S:F:B:E:M:T:wm:",
                               long_options, NULL)) > 0) {
         switch (opt) {
             default:
@@ -173,6 +183,14 @@ int parse_options(int argc, char **argv) {
             case 'b':
                 config.buffer_start_fill = atoi(optarg);
                 break;
+            case 'S':
+                config.buffer_frames = atoi(optarg);
+                break;
+            case 'F':
+                if (sscanf(optarg, "%d:%d", &config.buffer_min_fill, &config.buffer_max_fill) != 2 ||
+                    config.buffer_max_fill <= 0)
+                    die("Invalid fill range: %s", optarg);
+                break;
             case 'B':
                 config.cmd_start = optarg;
                 break;
@@ -185,6 +203,9 @@ int parse_options(int argc, char **argv) {
             case 'M':
                 config.meta_dir = optarg;
                 break;
+            case 'T':
+                config.stats_socket = optarg;
+                break;
             case 'P':
                 config.pidfile = optarg;
                 break;
@@ -279,6 +300,7 @@ int main(int argc, char **argv) {
 
     // set defaults
     config.buffer_start_fill = 220;
+    config.buffer_frames = 512;
     config.port = 5002;
     char hostname[100];
     gethostname(hostname, 100);
@@ -312,8 +334,12 @@ int main(int argc, char **argv) {
     MD5_Final(ap_md5, &ctx);
     memcpy(config.hw_addr, ap_md5, sizeof(config.hw_addr));
 
+    rsa_setup();
+
     if (config.meta_dir)
         metadata_open();
+    if (config.stats_socket)
+        stats_open(config.stats_socket);
 
     rtsp_listen_loop();
 
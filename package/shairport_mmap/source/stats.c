@@ -0,0 +1,162 @@
+/*
+ * Playback health statistics. This file is part of Shairport.
+ * Copyright (c) James Laird 2013
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "common.h"
+#include "stats.h"
+
+shairport_stats stats;
+int stats_enabled;
+
+static int listen_fd = -1;
+static char *socket_path;
+static pthread_t stats_thread;
+static time_t started;
+
+void stats_hist_add(stats_hist *h, uint32_t value) {
+    int b = 0;
+
+    if (value)
+        b = 32 - __builtin_clz(value);
+    if (b >= STATS_BUCKETS)
+        b = STATS_BUCKETS - 1;
+    __atomic_store_n(&h->count[b], h->count[b] + 1, __ATOMIC_RELAXED);
+    h->sum += value;    // 64 bits are not atomic everywhere; a torn read
+                        // only skews one snapshot
+    if (value > h->max)
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+#define LOAD(field) __atomic_load_n(&stats.field, __ATOMIC_RELAXED)
+
+static int print_hist(char *p, int size, const char *name, stats_hist *h) {
+    uint32_t n = 0, count;
+    int i, len;
+
+    len = snprintf(p, size, ",\"%s\":{\"buckets\":[", name);
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        count = __atomic_load_n(&h->count[i], __ATOMIC_RELAXED);
+        n += count;
+        len += snprintf(p + len, len < size ? size - len : 0,
+                        "%s%u", i ? "," : "", count);
+    }
+    len += snprintf(p + len, len < size ? size - len : 0,
+                    "],\"count\":%u,\"sum\":%llu,\"max\":%u}", n,
+                    (unsigned long long)h->sum,
+                    __atomic_load_n(&h->max, __ATOMIC_RELAXED));
+    return len;
+}
+
+#define PRINT(fmt, ...) \
+    len += snprintf(buf + len, len < size ? size - len : 0, fmt, __VA_ARGS__)
+#define COUNTER(field) PRINT(",\"" #field "\":%u", LOAD(field))
+#define GAUGE(field) PRINT(",\"" #field "\":%d", LOAD(field))
+#define HIST(field) \
+    len += print_hist(buf + len, len < size ? size - len : 0, #field, &stats.field)
+
+static int stats_format(char *buf, int size) {
+    int len = 0;
+
+    PRINT("{\"uptime\":%ld", (long)(time(NULL) - started));
+    COUNTER(streams);
+    COUNTER(packets);
+    COUNTER(late_packets);
+    COUNTER(missing_frames);
+    COUNTER(underruns);
+    COUNTER(overruns);
+    COUNTER(resends_asked);
+    COUNTER(resends_recovered);
+    COUNTER(frames);
+    COUNTER(stuffed);
+    COUNTER(dropped);
+    GAUGE(fill);
+    GAUGE(target_fill);
+    GAUGE(jitter_us);
+    GAUGE(drift_ppb);
+    HIST(fill_hist);
+    HIST(decrypt_us);
+    HIST(decode_us);
+    PRINT("%s", "}\n");
+    return len;
+}
+
+static void *stats_thread_func(void *arg) {
+    char buf[2048];
+    int fd, len;
+
+    while (1) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        len = stats_format(buf, sizeof(buf));
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+        write_unchecked(fd, buf, len);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+void stats_open(const char *path) {
+    struct sockaddr_un sa;
+
+    started = time(NULL);
+    if (strlen(path) >= sizeof(sa.sun_path))
+        die("stats socket path too long: %s", path);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        listen(listen_fd, 4) < 0)
+        die("could not open stats socket %s", path);
+
+    socket_path = strdup(path);
+    stats_enabled = 1;
+    pthread_create(&stats_thread, NULL, stats_thread_func, NULL);
+    debug(1, "stats on %s\n", path);
+}
+
+void stats_close(void) {
+    if (!socket_path)
+        return;
+    close(listen_fd);
+    unlink(socket_path);
+    free(socket_path);
+    socket_path = NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+// playback health, to tune the buffer in the field without debug builds.
+// counters run from startup and only go up; gauges hold the latest value.
+// every connection to the stats socket is sent one JSON snapshot
+
+#define STATS_BUCKETS   16  // powers of two: 0, 1, 2-3, 4-7, ... up
+
+typedef struct {
+    uint32_t count[STATS_BUCKETS];
+    uint64_t sum;
+    uint32_t max;
+} stats_hist;
+
+typedef struct {
+    // counters
+    uint32_t streams;
+    uint32_t packets, late_packets, missing_frames;
+    uint32_t underruns, overruns;
+    uint32_t resends_asked, resends_recovered;
+    uint32_t frames, stuffed, dropped;  // samples inserted and removed
+    // gauges
+    int32_t fill, target_fill;          // frames
+    int32_t jitter_us;
+    int32_t drift_ppb;                  // local clock slower by
+    // histograms; each has a single writer
+    stats_hist fill_hist;               // once per played frame
+    stats_hist decrypt_us, decode_us;   // per packet
+} shairport_stats;
+
+extern shairport_stats stats;
+extern int stats_enabled;
+
+#define STATS_ADD(field, n) __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+#define STATS_SET(field, v) __atomic_store_n(&stats.field, (v), __ATOMIC_RELAXED)
+
+void stats_hist_add(stats_hist *h, uint32_t value);
+void stats_open(const char *path);
+void stats_close(void);
+
+#endif // _STATS_H
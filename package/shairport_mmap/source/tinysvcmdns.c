@@ -1061,6 +1061,16 @@ size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len
 #define SERVICES_DNS_SD_NLABEL \
                 ((uint8_t *) "\x09_services\x07_dns-sd\x04_udp\x05local")
 
+#define NAME_SLOTS      64      // hashed names we hold records for
+#define REPLY_CACHE     16      // encoded replies kept
+
+struct cached_reply {
+        int slot;               // name, as its slot in name_slot
+        uint16_t type;
+        uint8_t *pkt;
+        size_t len;
+};
+
 struct mdnsd {
         pthread_mutex_t data_lock;
         int sockfd;
@@ -1071,6 +1081,17 @@ struct mdnsd {
         struct rr_list *announce;
         struct rr_list *services;
         uint8_t *hostname;
+
+        // bumped under data_lock whenever the records change
+        unsigned int generation;
+
+        // main loop only, rebuilt when generation has moved on
+        unsigned int cache_generation;
+        int name_count;         // -1: too many names, no fast path
+        uint32_t name_hash[NAME_SLOTS];
+        uint8_t *name_slot[NAME_SLOTS];
+        struct cached_reply cache[REPLY_CACHE];
+        int cache_next;
 };
 
 struct mdns_service {
@@ -1386,11 +1407,208 @@ int close_pipe(int s) {
 #endif
 }
 
+// ----- fast path -----
+// most of what arrives on a busy network is queries for, and answers
+// from, other devices. the question names are matched in place against
+// a hash of the names we hold records for, so those are dropped without
+// parsing, and a plain query (one question, no known answers) is answered
+// with the reply encoded the last time it was asked.
+
+// FNV-1a over the uncompressed name, as it is stored in an nlabel
+static uint32_t name_hash_step(uint32_t h, uint8_t c) {
+        return (h ^ c) * 16777619;
+}
+
+static uint32_t nlabel_hash(const uint8_t *name) {
+        uint32_t h = 2166136261u;
+        for (; *name; name++)
+                h = name_hash_step(h, *name);
+        return h;
+}
+
+// hashes the (possibly compressed) name at off without copying it
+// returns the offset past the name in the packet, or 0 if it is malformed
+static size_t pkt_name_hash(const uint8_t *pkt_buf, size_t pkt_len, size_t off, uint32_t *hash) {
+        uint32_t h = 2166136261u;
+        size_t end = 0, total = 0;
+        int jumps = 0, i;
+
+        while (off < pkt_len) {
+                uint8_t len = pkt_buf[off];
+                if (len == 0) {
+                        *hash = h;
+                        return end ? end : off + 1;
+                }
+                if ((len & 0xC0) == 0xC0) {
+                        if (off + 1 >= pkt_len || ++jumps > 16)
+                                return 0;
+                        if (!end)
+                                end = off + 2;
+                        off = ((len & ~0xC0) << 8) | pkt_buf[off + 1];
+                        continue;
+                }
+                if (len > 63 || off + 1 + len > pkt_len || (total += len + 1) > 255)
+                        return 0;
+                for (i = 0; i <= len; i++)
+                        h = name_hash_step(h, pkt_buf[off + i]);
+                off += len + 1;
+        }
+        return 0;
+}
+
+// compares the name at off with an nlabel, byte for byte like cmp_nlabel
+static int pkt_name_equal(const uint8_t *pkt_buf, size_t pkt_len, size_t off, const uint8_t *name) {
+        int jumps = 0;
+
+        while (off < pkt_len) {
+                uint8_t len = pkt_buf[off];
+                if ((len & 0xC0) == 0xC0) {
+                        if (off + 1 >= pkt_len || ++jumps > 16)
+                                return 0;
+                        off = ((len & ~0xC0) << 8) | pkt_buf[off + 1];
+                        continue;
+                }
+                if (len != *name)
+                        return 0;
+                if (len == 0)
+                        return 1;
+                if (off + 1 + len > pkt_len || memcmp(pkt_buf + off + 1, name + 1, len))
+                        return 0;
+                off += len + 1;
+                name += len + 1;
+        }
+        return 0;
+}
+
+static void reply_cache_clear(struct mdnsd *svr) {
+        int i;
+        for (i = 0; i < REPLY_CACHE; i++) {
+                free(svr->cache[i].pkt);
+                svr->cache[i].pkt = NULL;
+        }
+}
+
+// drops the cached replies and rehashes our names if the records changed
+static void name_set_update(struct mdnsd *svr) {
+        struct rr_group *g;
+        int i;
+
+        pthread_mutex_lock(&svr->data_lock);
+        if (svr->generation == svr->cache_generation && svr->name_count) {
+                pthread_mutex_unlock(&svr->data_lock);
+                return;
+        }
+        svr->cache_generation = svr->generation;
+
+        reply_cache_clear(svr);
+        for (i = 0; i < NAME_SLOTS; i++) {
+                free(svr->name_slot[i]);
+                svr->name_slot[i] = NULL;
+        }
+        svr->name_count = 0;
+
+        for (g = svr->group; g && svr->name_count >= 0; g = g->next) {
+                uint32_t h = nlabel_hash(g->name);
+                // keep the table at most 3/4 full
+                if (++svr->name_count > NAME_SLOTS * 3 / 4) {
+                        svr->name_count = -1;
+                        break;
+                }
+                for (i = h % NAME_SLOTS; svr->name_slot[i]; i = (i + 1) % NAME_SLOTS)
+                        ;
+                svr->name_hash[i] = h;
+                svr->name_slot[i] = dup_nlabel(g->name);
+        }
+        pthread_mutex_unlock(&svr->data_lock);
+}
+
+// returns the slot of the name at off, or -1 if it is not ours
+static int name_set_find(struct mdnsd *svr, const uint8_t *pkt_buf, size_t pkt_len, size_t off, uint32_t h) {
+        int i;
+        for (i = h % NAME_SLOTS; svr->name_slot[i]; i = (i + 1) % NAME_SLOTS) {
+                if (svr->name_hash[i] == h &&
+                                pkt_name_equal(pkt_buf, pkt_len, off, svr->name_slot[i]))
+                        return i;
+        }
+        return -1;
+}
+
+// looks at the raw packet before it is parsed
+// returns -1 to drop it, 1 if a cached reply went out, 0 to process it.
+// for 0, *slot and *type give the cache key if the reply may be cached
+static int mdns_fast_path(struct mdnsd *svr, uint8_t *pkt_buf, size_t pkt_len, int *slot, uint16_t *type) {
+        uint16_t flags, num_qn, num_ans_rr;
+        size_t off = 12;
+        int i, s, matched = 0;
+
+        *slot = -1;
+        if (pkt_len < 12)
+                return -1;
+
+        flags = mdns_read_u16(pkt_buf + 2);
+        num_qn = mdns_read_u16(pkt_buf + 4);
+        num_ans_rr = mdns_read_u16(pkt_buf + 6);
+        // only standard queries get an answer
+        if ((flags & MDNS_FLAG_RESP) || MDNS_FLAG_GET_OPCODE(flags) != 0 || num_qn == 0)
+                return -1;
+
+        name_set_update(svr);
+        if (svr->name_count < 0)
+                return 0;
+
+        for (i = 0; i < num_qn; i++) {
+                uint32_t h;
+                size_t end = pkt_name_hash(pkt_buf, pkt_len, off, &h);
+                if (!end || end + 4 > pkt_len)
+                        return 0;       // let the parser deal with it
+                s = name_set_find(svr, pkt_buf, pkt_len, off, h);
+                // unicast queries are ignored
+                if (s >= 0 && !(pkt_buf[end + 2] & 0x80)) {
+                        matched++;
+                        *slot = s;
+                        *type = mdns_read_u16(pkt_buf + end);
+                }
+                off = end + 4;
+        }
+        if (!matched)
+                return -1;
+
+        if (num_qn != 1 || num_ans_rr != 0) {
+                *slot = -1;
+                return 0;
+        }
+        for (i = 0; i < REPLY_CACHE; i++) {
+                struct cached_reply *c = svr->cache + i;
+                if (c->pkt && c->slot == *slot && c->type == *type) {
+                        // the reply carries the query's transaction ID
+                        memcpy(c->pkt, pkt_buf, sizeof(uint16_t));
+                        send_packet(svr->sockfd, c->pkt, c->len);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static void reply_cache_add(struct mdnsd *svr, int slot, uint16_t type, const uint8_t *pkt, size_t len) {
+        struct cached_reply *c = svr->cache + svr->cache_next;
+
+        svr->cache_next = (svr->cache_next + 1) % REPLY_CACHE;
+        free(c->pkt);
+        c->pkt = malloc(len);
+        if (c->pkt == NULL)
+                return;
+        memcpy(c->pkt, pkt, len);
+        c->len = len;
+        c->slot = slot;
+        c->type = type;
+}
+
 // main loop to receive, process and send out MDNS replies
 // also handles MDNS service announces
 static void main_loop(struct mdnsd *svr) {
         fd_set sockfd_set;
         int max_fd = svr->sockfd;
+        int i;
         char notify_buf[2];     // buffer for reading of notify_pipe
 
         void *pkt_buffer = malloc(PACKET_SIZE);
@@ -1420,12 +1638,20 @@ static void main_loop(struct mdnsd *svr) {
                                 log_message(LOG_ERR, "recv(): %m");
                         }
 
-                        DEBUG_PRINTF("data from=%s size=%ld\n", inet_ntoa(fromaddr.sin_addr), (long) recvsize);
-                        struct mdns_pkt *mdns = mdns_parse_pkt(pkt_buffer, recvsize);
+                        // only parse what the fast path could not handle
+                        struct mdns_pkt *mdns = NULL;
+                        int slot = -1;
+                        uint16_t type = 0;
+                        if (recvsize >= 0 && mdns_fast_path(svr, pkt_buffer, recvsize, &slot, &type) == 0) {
+                                DEBUG_PRINTF("data from=%s size=%ld\n", inet_ntoa(fromaddr.sin_addr), (long) recvsize);
+                                mdns = mdns_parse_pkt(pkt_buffer, recvsize);
+                        }
                         if (mdns != NULL) {
                                 if (process_mdns_pkt(svr, mdns, mdns_reply)) {
                                         size_t replylen = mdns_encode_pkt(mdns_reply, pkt_buffer, PACKET_SIZE);
                                         send_packet(svr->sockfd, pkt_buffer, replylen);
+                                        if (slot >= 0 && replylen > 12 && replylen < PACKET_SIZE)
+                                                reply_cache_add(svr, slot, type, pkt_buffer, replylen);
                                 } else if (mdns->num_qn == 0) {
                                         DEBUG_PRINTF("(no questions in packet)\n\n");
                                 }
@@ -1482,6 +1708,10 @@ static void main_loop(struct mdnsd *svr) {
         mdns_init_reply(mdns_reply, 0);
         free(mdns_reply);
 
+        reply_cache_clear(svr);
+        for (i = 0; i < NAME_SLOTS; i++)
+                free(svr->name_slot[i]);
+
         free(pkt_buffer);
 
         close_pipe(svr->sockfd);
@@ -1509,6 +1739,7 @@ void mdnsd_set_hostname(struct mdnsd *svr, const char *hostname, uint32_t ip) {
         svr->hostname = create_nlabel(hostname);
         rr_group_add(&svr->group, a_e);
         rr_group_add(&svr->group, nsec_e);
+        svr->generation++;
         pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1530,12 +1761,14 @@ void mdnsd_set_hostname_v6(struct mdnsd *svr, const char *hostname, struct in6_a
         svr->hostname = create_nlabel(hostname);
         rr_group_add(&svr->group, aaaa_e);
         rr_group_add(&svr->group, nsec_e);
+        svr->generation++;
         pthread_mutex_unlock(&svr->data_lock);
 }
 
 void mdnsd_add_rr(struct mdnsd *svr, struct rr_entry *rr) {
         pthread_mutex_lock(&svr->data_lock);
         rr_group_add(&svr->group, rr);
+        svr->generation++;
         pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1593,6 +1826,7 @@ struct mdns_service *mdnsd_register_svc(struct mdnsd *svr, const char *instance_
         // append PTR entry to announce list
         rr_list_append(&svr->announce, ptr_e);
         rr_list_append(&svr->services, ptr_e);
+        svr->generation++;
 
         pthread_mutex_unlock(&svr->data_lock);
 
@@ -93,3 +93,55 @@ const uint32_t crc32_table[256] = {
 	0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
 	0x2d02ef8dL
 };
+
+/*
+ * Slice-by-8: crc32_slice[k][b] is the CRC of byte b followed by k zero
+ * bytes, so eight bytes fold into the CRC with eight lookups and no
+ * dependency between them. The bytes are gathered one at a time, which
+ * gives the same result on big and little endian targets.
+ */
+static uint32_t crc32_slice[8][256];
+static int crc32_slice_ready;
+
+static void
+crc32_slice_init(void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc32_slice[0][i] = crc32_table[i];
+		for (k = 1; k < 8; k++)
+			crc32_slice[k][i] = crc32_table[crc32_slice[k - 1][i] & 0xff] ^
+					    (crc32_slice[k - 1][i] >> 8);
+	}
+	crc32_slice_ready = 1;
+}
+
+uint32_t
+crc32(uint32_t val, const void *ss, int len)
+{
+	const unsigned char *s = ss;
+
+	if (len >= 64) {
+		if (!crc32_slice_ready)
+			crc32_slice_init();
+
+		while (len >= 8) {
+			val ^= s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t) s[3] << 24);
+			val = crc32_slice[7][val & 0xff] ^
+			      crc32_slice[6][(val >> 8) & 0xff] ^
+			      crc32_slice[5][(val >> 16) & 0xff] ^
+			      crc32_slice[4][val >> 24] ^
+			      crc32_slice[3][s[4]] ^
+			      crc32_slice[2][s[5]] ^
+			      crc32_slice[1][s[6]] ^
+			      crc32_slice[0][s[7]];
+			s += 8;
+			len -= 8;
+		}
+	}
+
+	while (--len >= 0)
+		val = crc32_table[(val ^ *s++) & 0xff] ^ (val >> 8);
+	return val;
+}
@@ -165,8 +165,8 @@ static void add_file(const char *name, int parent)
 	int inode, f_offset = 0, fd;
 	struct jffs2_raw_inode ri;
 	struct stat st;
-	char wbuf[4096];
 	const char *fname;
+	char *data;
 
 	if (stat(name, &st)) {
 		fprintf(stderr, "File %s does not exist\n", name);
@@ -212,10 +212,13 @@ static void add_file(const char *name, int parent)
 			prep_eraseblock();
 		}
 
-		if (len > sizeof(wbuf))
-			len = sizeof(wbuf);
+		/* a data node holds at most a page */
+		if (len > 4096)
+			len = 4096;
 
-		len = read(fd, wbuf, len);
+		/* read straight into the block, behind room for the node header */
+		data = buf + ofs + sizeof(ri);
+		len = read(fd, data, len);
 		if (len <= 0)
 			break;
 
@@ -225,10 +228,10 @@ static void add_file(const char *name, int parent)
 		ri.offset = f_offset;
 		ri.csize = ri.dsize = len;
 		ri.node_crc = crc32(0, &ri, sizeof(ri) - 8);
-		ri.data_crc = crc32(0, wbuf, len);
+		ri.data_crc = crc32(0, data, len);
 		f_offset += len;
-		add_data((char *) &ri, sizeof(ri));
-		add_data(wbuf, len);
+		memcpy(buf + ofs, &ri, sizeof(ri));
+		ofs += sizeof(ri) + len;
 		pad(4);
 		prep_eraseblock();
 	}
@@ -256,6 +259,19 @@ int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename)
 	return (mtdofs - ofs);
 }
 
+static void parse_dirent(const struct jffs2_raw_dirent *de, const char *dir)
+{
+	/* is this the right directory name and is it a subdirectory of / */
+	if (*dir && (de->pino == 1) && !strncmp((char *) de->name, dir, de->nsize))
+		target_ino = de->ino;
+
+	/* store the last inode and version numbers for adding extra files */
+	if (last_ino < de->ino)
+		last_ino = de->ino;
+	if (last_version < de->version)
+		last_version = de->version;
+}
+
 void mtd_parse_jffs2data(const char *buf, const char *dir)
 {
 	struct jffs2_unknown_node *node = (struct jffs2_unknown_node *) buf;
@@ -263,23 +279,47 @@ void mtd_parse_jffs2data(const char *buf, const char *dir)
 
 	while (ofs < erasesize) {
 		node = (struct jffs2_unknown_node *) (buf + ofs);
-		if (node->magic != 0x1985)
+		if (node->magic != 0x1985 || !node->totlen)
 			break;
 
 		ofs += PAD(node->totlen);
-		if (node->nodetype == JFFS2_NODETYPE_DIRENT) {
-			struct jffs2_raw_dirent *de = (struct jffs2_raw_dirent *) node;
-
-			/* is this the right directory name and is it a subdirectory of / */
-			if (*dir && (de->pino == 1) && !strncmp((char *) de->name, dir, de->nsize))
-				target_ino = de->ino;
-
-			/* store the last inode and version numbers for adding extra files */
-			if (last_ino < de->ino)
-				last_ino = de->ino;
-			if (last_version < de->version)
-				last_version = de->version;
+		if (node->nodetype == JFFS2_NODETYPE_DIRENT)
+			parse_dirent((struct jffs2_raw_dirent *) node, dir);
+	}
+}
+
+/*
+ * Same as mtd_parse_jffs2data, for an erase block still on flash: only the
+ * node headers and the dirents are read, the file data is stepped over
+ */
+static void parse_jffs2block(int fd, int start, const char *dir)
+{
+	union {
+		struct jffs2_unknown_node node;
+		struct jffs2_raw_dirent de;
+		char data[sizeof(struct jffs2_raw_dirent) + 256];
+	} n;
+	unsigned int ofs = 0;
+	int len;
+
+	while (ofs + sizeof(n.node) <= erasesize) {
+		if (pread(fd, &n.node, sizeof(n.node), start + ofs) != sizeof(n.node))
+			break;
+		if (n.node.magic != 0x1985 || !n.node.totlen)
+			break;
+
+		if (n.node.nodetype == JFFS2_NODETYPE_DIRENT) {
+			len = erasesize - ofs;
+			if (len > sizeof(n))
+				len = sizeof(n);
+			if (len < sizeof(n.de) ||
+			    pread(fd, &n, len, start + ofs) != len)
+				break;
+			if (n.de.nsize > len - sizeof(n.de))
+				n.de.nsize = len - sizeof(n.de);
+			parse_dirent(&n.de, dir);
 		}
+		ofs += PAD(n.node.totlen);
 	}
 }
 
@@ -306,25 +346,26 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 	/* parse the structure of the jffs2 first
 	 * locate the directory that the file is going to be placed in */
 	for(;;) {
-		struct jffs2_unknown_node *node = (struct jffs2_unknown_node *) buf;
+		struct jffs2_unknown_node node;
 
-		if (read(outfd, buf, erasesize) != erasesize) {
+		if (mtdofs + erasesize > mtdsize ||
+		    pread(outfd, &node, sizeof(node), mtdofs) != sizeof(node)) {
 			fdeof = 1;
 			break;
 		}
 		mtdofs += erasesize;
 
-		if (node->magic == 0x8519) {
+		if (node.magic == 0x8519) {
 			fprintf(stderr, "Error: wrong endianness filesystem\n");
 			goto done;
 		}
 
 		/* assume  no magic == end of filesystem
 		 * the filesystem will probably end with be32(0xdeadc0de) */
-		if (node->magic != 0x1985)
+		if (node.magic != 0x1985)
 			break;
 
-		mtd_parse_jffs2data(buf, dir);
+		parse_jffs2block(outfd, mtdofs - erasesize, dir);
 	}
 
 	if (fdeof) {
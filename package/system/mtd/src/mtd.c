@@ -32,6 +32,8 @@
 #include <sys/syscall.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <arpa/inet.h>
+#include <pthread.h>
 #include <time.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -51,11 +53,15 @@
 #define JFFS2_DEFAULT_DIR	"" /* directory name without /, empty means root dir */
 
 static char *buf = NULL;
+static char *cmpbuf = NULL;
 static char *imagefile = NULL;
 static char *jffs2file = NULL, *jffs2dir = JFFS2_DEFAULT_DIR;
 static int buflen = 0;
 int quiet;
 int no_erase;
+int compare;
+int erase_ahead;
+int sparse;
 int mtdsize = 0;
 int erasesize = 0;
 int jffs2_skip_bytes=0;
@@ -142,6 +148,29 @@ int mtd_erase_block(int fd, int offset)
 	return 0;
 }
 
+/*
+ * Check whether a block reads as erased. Only trusted on NOR: a NAND page
+ * of 0xff may still have been programmed, and then cannot be again
+ */
+static int
+mtd_block_is_erased(int fd, int offset, char *tmp)
+{
+	uint32_t *p = (uint32_t *) tmp;
+	int i;
+
+	if (mtdtype == MTD_NANDFLASH)
+		return 0;
+
+	if (pread(fd, tmp, erasesize, offset) != erasesize)
+		return 0;
+
+	for (i = 0; i < erasesize / 4; i++)
+		if (p[i] != 0xffffffff)
+			return 0;
+
+	return 1;
+}
+
 int mtd_write_buffer(int fd, const char *buf, int offset, int length)
 {
 	lseek(fd, offset, SEEK_SET);
@@ -185,6 +214,8 @@ static int mtd_check(const char *mtd)
 
 		if (!buf)
 			buf = malloc(erasesize);
+		if (compare && !cmpbuf)
+			cmpbuf = malloc(erasesize);
 
 		close(fd);
 		mtd = next;
@@ -243,6 +274,7 @@ mtd_erase(const char *mtd)
 {
 	int fd;
 	struct erase_info_user mtdEraseInfo;
+	char *tmp;
 
 	if (quiet < 2)
 		fprintf(stderr, "Erasing %s ...\n", mtd);
@@ -254,6 +286,7 @@ mtd_erase(const char *mtd)
 	}
 
 	mtdEraseInfo.length = erasesize;
+	tmp = malloc(erasesize);
 
 	for (mtdEraseInfo.start = 0;
 		 mtdEraseInfo.start < mtdsize;
@@ -261,6 +294,8 @@ mtd_erase(const char *mtd)
 		if (mtd_block_is_bad(fd, mtdEraseInfo.start)) {
 			if (!quiet)
 				fprintf(stderr, "\nSkipping bad block at 0x%x   ", mtdEraseInfo.start);
+		} else if (tmp && mtd_block_is_erased(fd, mtdEraseInfo.start, tmp)) {
+			continue;
 		} else {
 			ioctl(fd, MEMUNLOCK, &mtdEraseInfo);
 			if(ioctl(fd, MEMERASE, &mtdEraseInfo))
@@ -268,11 +303,76 @@ mtd_erase(const char *mtd)
 		}
 	}
 
+	free(tmp);
 	close(fd);
 	return 0;
 
 }
 
+/*
+ * Sparse dumps: after the magic, a sequence of records, each a big endian
+ * word with the length in the low 31 bits. With the top bit set it is a
+ * run of that many 0xff bytes, otherwise that many bytes follow as they are
+ */
+#define SPARSE_MAGIC	"MTD\xff"
+#define SPARSE_RUN	0x80000000
+#define SPARSE_MIN_RUN	64	/* shorter runs of 0xff stay in the data */
+
+static uint32_t sparse_run;	/* not yet written out */
+
+static void
+sparse_flush(void)
+{
+	uint32_t rec = htonl(SPARSE_RUN | sparse_run);
+
+	if (sparse_run)
+		fwrite(&rec, sizeof(rec), 1, stdout);
+	sparse_run = 0;
+}
+
+/* length of the run of 0xff at the start of s */
+static int
+sparse_ff(const char *s, int len)
+{
+	int i;
+
+	for (i = 0; i < len && (unsigned char) s[i] == 0xff; i++)
+		;
+	return i;
+}
+
+static void
+sparse_put(const char *s, int len)
+{
+	uint32_t rec;
+	int i, j, r;
+
+	for (i = 0; i < len; ) {
+		r = sparse_ff(s + i, len - i);
+		/* a run carries on from the last block, or is long enough */
+		if (r && (r >= SPARSE_MIN_RUN || i + r == len || (sparse_run && !i))) {
+			sparse_run += r;
+			i += r;
+			continue;
+		}
+
+		for (j = i + r; j < len; j++) {
+			if ((unsigned char) s[j] != 0xff)
+				continue;
+			r = sparse_ff(s + j, len - j);
+			if (r >= SPARSE_MIN_RUN || j + r == len)
+				break;
+			j += r - 1;
+		}
+
+		sparse_flush();
+		rec = htonl(j - i);
+		fwrite(&rec, sizeof(rec), 1, stdout);
+		fwrite(s + i, j - i, 1, stdout);
+		i = j;
+	}
+}
+
 static int
 mtd_dump(const char *mtd, int part_offset, int size)
 {
@@ -299,6 +399,10 @@ mtd_dump(const char *mtd, int part_offset, int size)
 	if (!buf)
 		return -1;
 
+	posix_fadvise(fd, part_offset, size, POSIX_FADV_SEQUENTIAL);
+	if (sparse)
+		fwrite(SPARSE_MAGIC, sizeof(SPARSE_MAGIC) - 1, 1, stdout);
+
 	do {
 		int len = (size > erasesize) ? (erasesize) : (size);
 		int rlen = read(fd, buf, len);
@@ -315,58 +419,115 @@ mtd_dump(const char *mtd, int part_offset, int size)
 			fprintf(stderr, "skipping bad block at 0x%08x\n", offset);
 		} else {
 			size -= rlen;
-			write(1, buf, rlen);
+			if (sparse)
+				sparse_put(buf, rlen);
+			else
+				write(1, buf, rlen);
 		}
 		offset += rlen;
 	} while (size > 0);
 
+	if (sparse) {
+		sparse_flush();
+		fflush(stdout);
+	}
+
 out:
 	close(fd);
 	return ret;
 }
 
+/* fill buf from fd, as far as len or the end of the input */
+static ssize_t
+read_full(int fd, char *buf, size_t len)
+{
+	ssize_t r, done = 0;
+
+	while (done < len) {
+		r = read(fd, buf + done, len - done);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		if (!r)
+			break;
+		done += r;
+	}
+	return done;
+}
+
+/*
+ * Read the file and the device side by side, an erase block at a time:
+ * both are hashed in that one pass, and the blocks are compared so that
+ * a difference stops the check right where it is
+ */
 static int
 mtd_verify(const char *mtd, char *file)
 {
 	uint32_t f_md5[4], m_md5[4];
-	struct stat s;
-	md5_ctx_t ctx;
-	int ret = 0;
-	int fd;
+	md5_ctx_t f_ctx, m_ctx;
+	char *fbuf = NULL, *mbuf = NULL;
+	size_t pos = 0;
+	ssize_t flen, mlen;
+	int ret = -1;
+	int fd, imgfd, i;
 
 	if (quiet < 2)
 		fprintf(stderr, "Verifying %s against %s ...\n", mtd, file);
 
-	if (stat(file, &s) || md5sum(file, f_md5) < 0) {
-		fprintf(stderr, "Failed to hash %s\n", file);
+	if (!strcmp(file, "-"))
+		imgfd = 0;
+	else if ((imgfd = open(file, O_RDONLY)) < 0) {
+		fprintf(stderr, "Failed to open %s\n", file);
 		return -1;
 	}
 
 	fd = mtd_check_open(mtd);
 	if(fd < 0) {
 		fprintf(stderr, "Could not open mtd device: %s\n", mtd);
-		return -1;
+		goto out_img;
 	}
 
-	md5_begin(&ctx);
-	do {
-		char buf[256];
-		int len = (s.st_size > sizeof(buf)) ? (sizeof(buf)) : (s.st_size);
-		int rlen = read(fd, buf, len);
+	fbuf = malloc(erasesize);
+	mbuf = malloc(erasesize);
+	if (!fbuf || !mbuf) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
 
-		if (rlen < 0) {
-			if (errno == EINTR)
-				continue;
-			ret = -1;
+	md5_begin(&f_ctx);
+	md5_begin(&m_ctx);
+	for (;;) {
+		flen = read_full(imgfd, fbuf, erasesize);
+		if (flen < 0) {
+			fprintf(stderr, "Failed to read %s\n", file);
 			goto out;
 		}
-		if (!rlen)
+		if (!flen)
 			break;
-		md5_hash(buf, rlen, &ctx);
-		s.st_size -= rlen;
-	} while (s.st_size > 0);
 
-	md5_end(m_md5, &ctx);
+		mlen = read_full(fd, mbuf, flen);
+		if (mlen < 0) {
+			fprintf(stderr, "Failed to read %s\n", mtd);
+			goto out;
+		}
+		if (mlen < flen || memcmp(fbuf, mbuf, flen)) {
+			for (i = 0; i < mlen && fbuf[i] == mbuf[i]; i++)
+				;
+			fprintf(stderr, "First mismatch at 0x%08zx\n", pos + i);
+			fprintf(stderr, "Failed\n");
+			ret = 1;
+			goto out;
+		}
+
+		md5_hash(fbuf, flen, &f_ctx);
+		md5_hash(mbuf, mlen, &m_ctx);
+		pos += flen;
+	}
+
+	md5_end(m_md5, &m_ctx);
+	md5_end(f_md5, &f_ctx);
 
 	fprintf(stderr, "%08x%08x%08x%08x - %s\n", m_md5[0], m_md5[1], m_md5[2], m_md5[3], mtd);
 	fprintf(stderr, "%08x%08x%08x%08x - %s\n", f_md5[0], f_md5[1], f_md5[2], f_md5[3], file);
@@ -378,10 +539,346 @@ mtd_verify(const char *mtd, char *file)
 		fprintf(stderr, "Failed\n");
 
 out:
+	free(fbuf);
+	free(mbuf);
 	close(fd);
+out_img:
+	if (imgfd > 0)
+		close(imgfd);
 	return ret;
 }
 
+/*
+ * Compare the erase block at the current position (which must be e, the
+ * next one to erase) against data, with one read of the whole block
+ */
+static int
+mtd_block_unchanged(int fd, ssize_t e, const char *data)
+{
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+
+	if (!cmpbuf || pos != e)
+		return 0;
+
+	if (pread(fd, cmpbuf, erasesize, pos) != erasesize)
+		return 0;
+
+	return !memcmp(cmpbuf, data, erasesize);
+}
+
+/*
+ * Image read-ahead: while a block is erased and written, a thread reads
+ * the next ones from imagefd, so a pipe from wget or gunzip keeps flowing
+ */
+#define READ_AHEAD	4
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd, running;
+	int size;			/* of each block */
+	char *block[READ_AHEAD];
+	int len[READ_AHEAD];
+	unsigned int head, tail;	/* blocks filled, blocks taken */
+	int pos;			/* taken from the tail block */
+	int eof, err;
+} ra;
+
+static void *
+image_reader(void *arg)
+{
+	char *b;
+	int len, r;
+
+	for (;;) {
+		pthread_mutex_lock(&ra.lock);
+		while (ra.head - ra.tail == READ_AHEAD)
+			pthread_cond_wait(&ra.cond, &ra.lock);
+		b = ra.block[ra.head % READ_AHEAD];
+		pthread_mutex_unlock(&ra.lock);
+
+		len = r = 0;
+		while (len < ra.size) {
+			r = read(ra.fd, b + len, ra.size - len);
+			if (r < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if (r <= 0)
+				break;
+			len += r;
+		}
+
+		pthread_mutex_lock(&ra.lock);
+		ra.len[ra.head % READ_AHEAD] = len;
+		if (len)
+			ra.head++;
+		if (r < 0)
+			ra.err = errno;
+		else if (r == 0)
+			ra.eof = 1;
+		pthread_cond_broadcast(&ra.cond);
+		pthread_mutex_unlock(&ra.lock);
+		if (r <= 0)
+			return NULL;
+	}
+}
+
+static void
+image_readahead_start(int fd)
+{
+	int i;
+
+	memset(&ra, 0, sizeof(ra));
+	ra.fd = fd;
+	ra.size = erasesize;
+	for (i = 0; i < READ_AHEAD; i++) {
+		ra.block[i] = malloc(ra.size);
+		if (!ra.block[i])
+			goto fail;
+	}
+	pthread_mutex_init(&ra.lock, NULL);
+	pthread_cond_init(&ra.cond, NULL);
+	if (pthread_create(&ra.thread, NULL, image_reader, NULL))
+		goto fail;
+	ra.running = 1;
+	return;
+
+fail:
+	/* not enough memory to read ahead, read as we go */
+	for (i = 0; i < READ_AHEAD; i++)
+		free(ra.block[i]);
+}
+
+static void
+image_readahead_stop(void)
+{
+	int i;
+
+	if (!ra.running)
+		return;
+
+	pthread_join(ra.thread, NULL);
+	for (i = 0; i < READ_AHEAD; i++)
+		free(ra.block[i]);
+	ra.running = 0;
+}
+
+/* like read(2) on the image */
+static ssize_t
+image_read(int fd, char *dest, size_t len)
+{
+	int t, n;
+
+	if (!ra.running)
+		return read(fd, dest, len);
+
+	pthread_mutex_lock(&ra.lock);
+	while (ra.head == ra.tail && !ra.eof && !ra.err)
+		pthread_cond_wait(&ra.cond, &ra.lock);
+	if (ra.head == ra.tail) {
+		n = ra.err ? -1 : 0;
+		errno = ra.err;
+		pthread_mutex_unlock(&ra.lock);
+		return n;
+	}
+	pthread_mutex_unlock(&ra.lock);
+
+	/* the reader does not touch the tail block until it is handed back */
+	t = ra.tail % READ_AHEAD;
+	n = ra.len[t] - ra.pos;
+	if (n > len)
+		n = len;
+	memcpy(dest, ra.block[t] + ra.pos, n);
+	ra.pos += n;
+
+	if (ra.pos == ra.len[t]) {
+		pthread_mutex_lock(&ra.lock);
+		ra.tail++;
+		ra.pos = 0;
+		pthread_cond_broadcast(&ra.cond);
+		pthread_mutex_unlock(&ra.lock);
+	}
+	return n;
+}
+
+/*
+ * Background erase: a thread erases the device from the start while the
+ * image is still coming in, and mtd_write only waits for it when it
+ * catches up. Blocks that already read as erased are left alone
+ */
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd, running, stop, done;
+	ssize_t frontier;		/* everything below is erased or bad */
+	ssize_t failed;			/* block that failed to erase, or -1 */
+} ea;
+
+static void *
+erase_ahead_thread(void *arg)
+{
+	char *tmp = arg;
+	ssize_t e;
+	int stop = 0;
+
+	for (e = 0; e < mtdsize && !stop; e += erasesize) {
+		if (!mtd_block_is_bad(ea.fd, e) &&
+		    !mtd_block_is_erased(ea.fd, e, tmp) &&
+		    mtd_erase_block(ea.fd, e) < 0) {
+			pthread_mutex_lock(&ea.lock);
+			ea.failed = e;
+			pthread_mutex_unlock(&ea.lock);
+			break;
+		}
+
+		pthread_mutex_lock(&ea.lock);
+		ea.frontier = e + erasesize;
+		stop = ea.stop;
+		pthread_cond_broadcast(&ea.cond);
+		pthread_mutex_unlock(&ea.lock);
+	}
+
+	pthread_mutex_lock(&ea.lock);
+	ea.done = 1;
+	pthread_cond_broadcast(&ea.cond);
+	pthread_mutex_unlock(&ea.lock);
+	free(tmp);
+	return NULL;
+}
+
+static void
+erase_ahead_start(int fd)
+{
+	char *tmp = malloc(erasesize);
+
+	memset(&ea, 0, sizeof(ea));
+	ea.fd = fd;
+	ea.failed = -1;
+	pthread_mutex_init(&ea.lock, NULL);
+	pthread_cond_init(&ea.cond, NULL);
+	if (!tmp || pthread_create(&ea.thread, NULL, erase_ahead_thread, tmp)) {
+		/* erase as we go */
+		free(tmp);
+		return;
+	}
+	ea.running = 1;
+}
+
+/* leaves the blocks it has not reached yet as they are */
+static void
+erase_ahead_stop(void)
+{
+	if (!ea.running)
+		return;
+
+	pthread_mutex_lock(&ea.lock);
+	ea.stop = 1;
+	pthread_mutex_unlock(&ea.lock);
+	pthread_join(ea.thread, NULL);
+	ea.running = 0;
+}
+
+/* erase block e, or wait for the eraser to get past it */
+static int
+erase_ahead_wait(int fd, ssize_t e)
+{
+	int reached, failed;
+
+	if (!ea.running)
+		return mtd_erase_block(fd, e);
+
+	pthread_mutex_lock(&ea.lock);
+	while (!ea.done && ea.frontier <= e)
+		pthread_cond_wait(&ea.cond, &ea.lock);
+	reached = ea.frontier > e;
+	failed = ea.failed == e;
+	pthread_mutex_unlock(&ea.lock);
+
+	if (reached)
+		return 0;
+	if (failed)
+		return -1;
+
+	/* stopped early, or past the end of the device */
+	return mtd_erase_block(fd, e);
+}
+
+/* fill len bytes of the image, short only at its end */
+static ssize_t
+image_read_full(int fd, char *dest, size_t len)
+{
+	ssize_t r, done = 0;
+
+	while (done < len) {
+		r = image_read(fd, dest + done, len - done);
+		if (r < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (r <= 0)
+			return done ? done : r;
+		done += r;
+	}
+	return done;
+}
+
+/* like image_read, with a sparse dump expanded on the way */
+static ssize_t
+image_read_sparse(int fd, char *dest, size_t len)
+{
+	static uint32_t left, run;
+	static int started;
+	char magic[sizeof(SPARSE_MAGIC) - 1];
+	uint32_t rec;
+	ssize_t r;
+
+	if (!started) {
+		if (image_read_full(fd, magic, sizeof(magic)) != sizeof(magic) ||
+		    memcmp(magic, SPARSE_MAGIC, sizeof(magic))) {
+			fprintf(stderr, "Not a sparse dump\n");
+			exit(1);
+		}
+		started = 1;
+	}
+
+	while (!left) {
+		r = image_read_full(fd, (char *) &rec, sizeof(rec));
+		if (r <= 0)
+			return r;
+		if (r != sizeof(rec)) {
+			fprintf(stderr, "Truncated sparse dump\n");
+			exit(1);
+		}
+		rec = ntohl(rec);
+		left = rec & ~SPARSE_RUN;
+		run = rec & SPARSE_RUN;
+	}
+
+	if (len > left)
+		len = left;
+	if (run)
+		memset(dest, 0xff, len);
+	else if ((r = image_read(fd, dest, len)) <= 0)
+		return r < 0 ? r : (errno = EINVAL, -1);
+	else
+		len = r;
+
+	left -= len;
+	return len;
+}
+
+/* a block that is all 0xff needs no writing once it is erased */
+static int
+block_is_blank(const char *data, int len)
+{
+	const uint32_t *p = (const uint32_t *) data;
+	int i;
+
+	for (i = 0; i < len / 4; i++)
+		if (p[i] != 0xffffffff)
+			return 0;
+	return 1;
+}
+
 static void
 indicate_writing(const char *mtd)
 {
@@ -392,6 +889,201 @@ indicate_writing(const char *mtd)
 		fprintf(stderr, " [ ]");
 }
 
+/*
+ * Parallel write of a chain of devices. When the image is a regular file,
+ * the part of it that goes to each device is known up front, so each
+ * device gets a writer thread of its own that reads its part with pread.
+ * The devices may differ in type and erase size, so nothing here uses
+ * the globals of the device opened last
+ */
+#define MAX_CHAIN	8
+
+struct chain_dev {
+	const char *name;
+	pthread_t thread;
+	int imagefd, fd;
+	struct mtd_info_user info;
+	off_t start;			/* in the image */
+	off_t len;			/* of the image that goes here */
+	off_t done;
+	int unchanged, finished;
+	const char *err;
+};
+
+static int
+chain_block_is_bad(struct chain_dev *d, loff_t o)
+{
+	if (d->info.type != MTD_NANDFLASH)
+		return 0;
+
+	return ioctl(d->fd, MEMGETBADBLOCK, &o) > 0;
+}
+
+static void *
+chain_writer(void *arg)
+{
+	struct chain_dev *d = arg;
+	struct erase_info_user ei;
+	char *data, *cur = NULL;
+	off_t ofs, e = 0;
+	ssize_t n, r, m;
+
+	data = malloc(d->info.erasesize);
+	if (compare)
+		cur = malloc(d->info.erasesize);
+	if (!data || (compare && !cur)) {
+		d->err = "out of memory";
+		goto out;
+	}
+
+	for (ofs = 0; ofs < d->len; ofs += n, e += d->info.erasesize) {
+		while (e < d->info.size && chain_block_is_bad(d, e))
+			e += d->info.erasesize;
+		if (e >= d->info.size) {
+			d->err = "insufficient space";
+			break;
+		}
+
+		n = d->len - ofs;
+		if (n > d->info.erasesize)
+			n = d->info.erasesize;
+		for (r = 0; r < n; r += m) {
+			m = pread(d->imagefd, data + r, n - r, d->start + ofs + r);
+			if (m < 0 && errno == EINTR)
+				m = 0;
+			else if (m <= 0) {
+				d->err = "error reading image";
+				goto out;
+			}
+		}
+		/* Pad block to eraseblock size */
+		memset(data + n, 0xff, d->info.erasesize - n);
+
+		if (compare &&
+		    pread(d->fd, cur, d->info.erasesize, e) == d->info.erasesize &&
+		    !memcmp(cur, data, d->info.erasesize)) {
+			d->unchanged++;
+			__atomic_store_n(&d->done, ofs + n, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (!no_erase) {
+			ei.start = e;
+			ei.length = d->info.erasesize;
+			ioctl(d->fd, MEMUNLOCK, &ei);
+			if (ioctl(d->fd, MEMERASE, &ei) < 0) {
+				d->err = "failed to erase block";
+				break;
+			}
+		}
+
+		if (pwrite(d->fd, data, d->info.erasesize, e) != d->info.erasesize) {
+			d->err = "error writing image";
+			break;
+		}
+		__atomic_store_n(&d->done, ofs + n, __ATOMIC_RELAXED);
+	}
+
+out:
+	free(data);
+	free(cur);
+	__atomic_store_n(&d->finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int
+mtd_write_chain(int imagefd, char *mtd, off_t start, off_t size)
+{
+	struct chain_dev dev[MAX_CHAIN];
+	off_t pos = 0, cap, o;
+	int n = 0, i, busy;
+
+	memset(dev, 0, sizeof(dev));
+	for (mtd = strtok(mtd, ":"); mtd; mtd = strtok(NULL, ":")) {
+		struct chain_dev *d = &dev[n];
+
+		if (n == MAX_CHAIN) {
+			fprintf(stderr, "Too many devices\n");
+			exit(1);
+		}
+
+		d->name = mtd;
+		d->imagefd = imagefd;
+		d->fd = mtd_open(mtd, false);
+		if (d->fd < 0 || ioctl(d->fd, MEMGETINFO, &d->info)) {
+			fprintf(stderr, "Could not open mtd device: %s\n", mtd);
+			exit(1);
+		}
+
+		/* each device takes as much as it has good blocks for */
+		cap = 0;
+		for (o = 0; o < d->info.size; o += d->info.erasesize)
+			if (!chain_block_is_bad(d, o))
+				cap += d->info.erasesize;
+
+		d->start = start + pos;
+		d->len = size - pos < cap ? size - pos : cap;
+		pos += d->len;
+		n++;
+	}
+
+	if (pos < size) {
+		fprintf(stderr, "Insufficient space.\n");
+		exit(1);
+	}
+
+	if (quiet < 2)
+		fprintf(stderr, "\nWriting from %s to %d devices in parallel ... ", imagefile, n);
+
+	for (i = 0; i < n; i++) {
+		if (!dev[i].len)
+			dev[i].finished = 1;
+		else if (pthread_create(&dev[i].thread, NULL, chain_writer, &dev[i])) {
+			/* one at a time then */
+			chain_writer(&dev[i]);
+			dev[i].len = 0;
+		}
+	}
+
+	/* progress of each device, until they are all done */
+	do {
+		busy = 0;
+		for (i = 0; i < n; i++)
+			if (!__atomic_load_n(&dev[i].finished, __ATOMIC_ACQUIRE))
+				busy = 1;
+
+		if (!quiet) {
+			fprintf(stderr, "\r");
+			for (i = 0; i < n; i++)
+				fprintf(stderr, "%s: %3d%%  ", dev[i].name, dev[i].len ?
+					(int) (__atomic_load_n(&dev[i].done, __ATOMIC_RELAXED) * 100 / dev[i].len) : 100);
+		}
+
+		if (busy)
+			usleep(250000);
+	} while (busy);
+
+	for (i = 0; i < n; i++) {
+		if (dev[i].len)
+			pthread_join(dev[i].thread, NULL);
+		close(dev[i].fd);
+	}
+
+	if (quiet < 2)
+		fprintf(stderr, "\n");
+
+	for (i = 0; i < n; i++) {
+		if (compare && quiet < 2)
+			fprintf(stderr, "%s: %d unchanged blocks skipped\n", dev[i].name, dev[i].unchanged);
+		if (dev[i].err) {
+			fprintf(stderr, "%s: %s\n", dev[i].name, dev[i].err);
+			exit(1);
+		}
+	}
+
+	return 0;
+}
+
 static int
 mtd_write(int imagefd, const char *mtd, char *fis_layout, size_t part_offset)
 {
@@ -403,6 +1095,8 @@ mtd_write(int imagefd, const char *mtd, char *fis_layout, size_t part_offset)
 	uint32_t offset = 0;
 	int jffs2_replaced = 0;
 	int skip_bad_blocks = 0;
+	int unchanged = 0, n_unchanged = 0;
+	struct stat st;
 
 #ifdef FIS_SUPPORT
 	static struct fis_part new_parts[MAX_ARGS];
@@ -464,7 +1158,18 @@ next:
 		mtd = str;
 	}
 
+	/* a chain written from a file: each device can go at once */
+	if (str && !sparse && !jffs2file && !fis_layout && !part_offset &&
+	    !fstat(imagefd, &st) && S_ISREG(st.st_mode)) {
+		off_t start = lseek(imagefd, 0, SEEK_CUR) - buflen;
+
+		mtd_write_chain(imagefd, str, start, st.st_size - start);
+		free(str);
+		return 0;
+	}
+
 	r = 0;
+	image_readahead_start(imagefd);
 
 resume:
 	next = strchr(mtd, ':');
@@ -485,11 +1190,15 @@ resume:
 
 	indicate_writing(mtd);
 
+	/* comparing needs the old contents, so it rules out erasing ahead */
+	if (erase_ahead && !no_erase && !compare)
+		erase_ahead_start(fd);
+
 	w = e = 0;
 	for (;;) {
 		/* buffer may contain data already (from trx check or last mtd partition write attempt) */
 		while (buflen < erasesize) {
-			r = read(imagefd, buf + buflen, erasesize - buflen);
+			r = (sparse ? image_read_sparse : image_read)(imagefd, buf + buflen, erasesize - buflen);
 			if (r < 0) {
 				if ((errno == EINTR) || (errno == EAGAIN))
 					continue;
@@ -530,6 +1239,7 @@ resume:
 				if (quiet < 2)
 					fprintf(stderr, "\nAppending jffs2 data from %s to %s...", jffs2file, mtd);
 				/* got an EOF marker - this is the place to add some jffs2 data */
+				erase_ahead_stop();
 				skip = mtd_replace_jffs2(mtd, fd, e, jffs2file);
 				jffs2_replaced = 1;
 
@@ -567,7 +1277,19 @@ resume:
 					continue;
 				}
 
-				if (mtd_erase_block(fd, e) < 0) {
+				/* a whole block that already holds this data needs
+				 * neither the erase nor the write */
+				if (compare && !offset && w == e - skip_bad_blocks &&
+				    mtd_block_unchanged(fd, e, buf)) {
+					if (!quiet)
+						fprintf(stderr, "\b\b\b[s]");
+					e += erasesize;
+					unchanged = 1;
+					break;
+				}
+
+				if (erase_ahead_wait(fd, e) < 0) {
+					erase_ahead_stop();
 					if (next) {
 						if (w < e) {
 							write(fd, buf + offset, e - w);
@@ -590,6 +1312,21 @@ resume:
 			}
 		}
 
+		/* freshly erased already holds it */
+		if (sparse && !no_erase && !offset && buflen == erasesize &&
+		    block_is_blank(buf, buflen))
+			unchanged = 1;
+
+		if (unchanged) {
+			lseek(fd, buflen, SEEK_CUR);
+			w += buflen;
+			n_unchanged++;
+			unchanged = 0;
+			buflen = 0;
+			offset = 0;
+			continue;
+		}
+
 		if (!quiet)
 			fprintf(stderr, "\b\b\b[w]");
 
@@ -608,6 +1345,9 @@ resume:
 		offset = 0;
 	}
 
+	image_readahead_stop();
+	erase_ahead_stop();
+
 	if (jffs2_replaced && trx_fixup) {
 		trx_fixup(fd, mtd);
 	}
@@ -615,8 +1355,11 @@ resume:
 	if (!quiet)
 		fprintf(stderr, "\b\b\b\b    ");
 
-	if (quiet < 2)
+	if (quiet < 2) {
+		if (compare)
+			fprintf(stderr, "\n%d unchanged blocks skipped", n_unchanged);
 		fprintf(stderr, "\n");
+	}
 
 #ifdef FIS_SUPPORT
 	if (fis_layout) {
@@ -657,6 +1400,12 @@ static void usage(void)
 	"        -q                      quiet mode (once: no [w] on writing,\n"
 	"                                           twice: no status messages)\n"
 	"        -n                      write without first erasing the blocks\n"
+	"        -c                      compare each block before writing, skip the\n"
+	"                                erase and write of blocks that already match\n"
+	"        -b                      erase the whole device in the background while\n"
+	"                                writing, skipping blocks that are already erased\n"
+	"        -z                      dump to, or write from, a sparse image that stores\n"
+	"                                runs of erased (0xff) flash in a few bytes\n"
 	"        -r                      reboot after successful command\n"
 	"        -f                      force write without trx checks\n"
 	"        -e <device>             erase <device> before executing the command\n"
@@ -719,12 +1468,15 @@ int main (int argc, char **argv)
 	buflen = 0;
 	quiet = 0;
 	no_erase = 0;
+	compare = 0;
+	erase_ahead = 0;
+	sparse = 0;
 
 	while ((ch = getopt(argc, argv,
 #ifdef FIS_SUPPORT
 			"F:"
 #endif
-			"frnqe:d:s:j:p:o:l:")) != -1)
+			"frncbzqe:d:s:j:p:o:l:")) != -1)
 		switch (ch) {
 			case 'f':
 				force = 1;
@@ -735,6 +1487,15 @@ int main (int argc, char **argv)
 			case 'n':
 				no_erase = 1;
 				break;
+			case 'c':
+				compare = 1;
+				break;
+			case 'b':
+				erase_ahead = 1;
+				break;
+			case 'z':
+				sparse = 1;
+				break;
 			case 'j':
 				jffs2file = optarg;
 				break;
@@ -841,7 +1602,7 @@ int main (int argc, char **argv)
 			exit(1);
 		}
 		/* check trx file before erasing or writing anything */
-		if (!image_check(imagefd, device) && !force) {
+		if (!sparse && !image_check(imagefd, device) && !force) {
 			fprintf(stderr, "Image check failed.\n");
 			exit(1);
 		}
@@ -0,0 +1,110 @@
+/*
+ * mtd-perf - microbenchmark of the checksums used by mtd
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License v2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Prints one "<name>\t<value>\t<unit>" line per result, as expected by
+ * scripts/perf-tests.sh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "crc32.h"
+#include "md5.h"
+
+#define PERF_MIN_NS	(500 * 1000 * 1000LL)
+
+static volatile uint32_t sink;
+
+static int64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+report(const char *name, int len, int64_t ns, long ops)
+{
+	printf("%s_%d\t%.1f\tns/op\n", name, len, (double) ns / ops);
+	printf("%s_%d_rate\t%.2f\tMB/s\n", name, len,
+	       (double) len * ops * 1000 / ns);
+}
+
+static void
+perf_crc32(const unsigned char *buf, int len)
+{
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+	uint32_t crc = 0;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; i++)
+			crc = crc32(crc, buf, len);
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while (ns < PERF_MIN_NS);
+	sink = crc;
+
+	report("crc32", len, ns, ops);
+}
+
+static void
+perf_md5(const unsigned char *buf, int len)
+{
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+	unsigned char hash[16];
+	MD5_CTX ctx;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; i++) {
+			MD5_Init(&ctx);
+			MD5_Update(&ctx, buf, len);
+			MD5_Final(hash, &ctx);
+		}
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while (ns < PERF_MIN_NS);
+	sink = hash[0];
+
+	report("md5", len, ns, ops);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int sizes[] = { 16, 256, 4096, 65536 };
+	unsigned char *buf;
+	unsigned int i;
+
+	buf = malloc(sizes[3]);
+	if (!buf)
+		return 1;
+	for (i = 0; i < sizes[3]; i++)
+		buf[i] = i * 2654435761u >> 24;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		perf_crc32(buf, sizes[i]);
+	perf_md5(buf, sizes[2]);
+	perf_md5(buf, sizes[3]);
+
+	free(buf);
+	return 0;
+}
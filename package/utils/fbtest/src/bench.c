@@ -0,0 +1,123 @@
+/*
+ * Fill and blit rates of a framebuffer surface
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Prints one "<name>\t<value>\t<unit>" line per result, as expected by
+ * scripts/perf-tests.sh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "blit.h"
+
+#define BENCH_MIN_NS		(500 * 1000 * 1000LL)
+
+/* a status line sized update, the common case on small LCDs */
+#define BENCH_DAMAGE_W		64
+#define BENCH_DAMAGE_H		16
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_fill(struct fb_surface *fb, const char *name)
+{
+	struct fb_box b = { 0, 0, fb->width, fb->height };
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; i++)
+			fb_fill(fb, &b, fb_pixel(fb, (ops + i) << 8, 0x8000, 0x4000, 0));
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while (ns < BENCH_MIN_NS);
+
+	printf("fill_%s\t%.2f\tMpixel/s\n", name,
+	       (double)ops * fb->width * fb->height * 1000 / ns);
+}
+
+static void bench_blit(struct fb_surface *fb, struct fb_surface *shadow,
+		       const char *name)
+{
+	struct fb_box b = { 0, 0, fb->width, fb->height };
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; i++)
+			fb_copy(fb, 0, 0, shadow, &b);
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while (ns < BENCH_MIN_NS);
+
+	printf("blit_%s\t%.2f\tMpixel/s\n", name,
+	       (double)ops * fb->width * fb->height * 1000 / ns);
+}
+
+/* draw a small box into the shadow and flush it, moving across the screen */
+static void bench_damage(struct fb_surface *fb, struct fb_surface *shadow,
+			 const char *name)
+{
+	struct fb_damage damage = {};
+	struct fb_box b = { 0, 0, BENCH_DAMAGE_W, BENCH_DAMAGE_H };
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+
+	if (fb->width < BENCH_DAMAGE_W || fb->height < BENCH_DAMAGE_H)
+		return;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; i++) {
+			b.x = ((ops + i) * 7) % (fb->width - BENCH_DAMAGE_W + 1);
+			b.y = ((ops + i) * 3) % (fb->height - BENCH_DAMAGE_H + 1);
+			fb_fill(shadow, &b, fb_pixel(shadow, 0xffff, (ops + i) << 8, 0, 0));
+			fb_damage_add(&damage, &b);
+			fb_damage_flush(fb, shadow, &damage);
+		}
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while (ns < BENCH_MIN_NS);
+
+	printf("update_%dx%d_%s\t%.2f\tus/update\n", BENCH_DAMAGE_W,
+	       BENCH_DAMAGE_H, name, (double)ns / ops / 1000);
+}
+
+void fb_bench(struct fb_surface *fb)
+{
+	struct fb_surface shadow = *fb;
+	struct fb_box b = { 0, 0, fb->width, fb->height };
+	char name[32];
+
+	snprintf(name, sizeof(name), "%ux%u_%ubpp", fb->width, fb->height, fb->bpp);
+
+	shadow.stride = fb->width * (fb->bpp / 8);
+	shadow.mem = malloc(shadow.stride * shadow.height);
+	if (!shadow.mem) {
+		fprintf(stderr, "fb_bench: out of memory\n");
+		return;
+	}
+	fb_fill(&shadow, &b, fb_pixel(&shadow, 0, 0, 0x8000, 0));
+
+	bench_fill(fb, name);
+	bench_blit(fb, &shadow, name);
+	bench_damage(fb, &shadow, name);
+
+	free(shadow.mem);
+}
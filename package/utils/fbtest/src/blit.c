@@ -0,0 +1,198 @@
+/*
+ * Rectangle fills and copies for linear framebuffers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Framebuffer memory is often uncached or write-combined, so fills store
+ * whole aligned words instead of single pixels, and the damage helpers
+ * copy only what changed from a shadow surface instead of redrawing the
+ * screen.
+ */
+
+#include <string.h>
+
+#include "blit.h"
+
+/* rounded c * (2^len - 1) / 65535, without division */
+static uint32_t fb_scale(uint16_t c, unsigned int len)
+{
+	return ((uint32_t)c * ((1u << len) - 1) + 0x8000) >> 16;
+}
+
+uint32_t fb_pixel(const struct fb_surface *s, uint16_t r, uint16_t g,
+		  uint16_t b, uint16_t a)
+{
+	return fb_scale(r, s->red.length) << s->red.offset |
+	       fb_scale(g, s->green.length) << s->green.offset |
+	       fb_scale(b, s->blue.length) << s->blue.offset |
+	       fb_scale(a, s->transp.length) << s->transp.offset;
+}
+
+int fb_clip(const struct fb_surface *s, struct fb_box *b)
+{
+	if (b->x < 0) {
+		b->width += b->x;
+		b->x = 0;
+	}
+	if (b->y < 0) {
+		b->height += b->y;
+		b->y = 0;
+	}
+	if (b->x + b->width > (int)s->width)
+		b->width = s->width - b->x;
+	if (b->y + b->height > (int)s->height)
+		b->height = s->height - b->y;
+
+	return b->width > 0 && b->height > 0;
+}
+
+/*
+ * Twelve bytes hold a whole number of pixels at every supported depth and
+ * are three words long, so a line is filled from three words rotated to
+ * the alignment of its first byte.
+ */
+static void fb_fill_line(uint8_t *p, unsigned int len, const uint8_t *pat)
+{
+	unsigned int head = (-(uintptr_t)p) & 3;
+	uint32_t w[3], *q;
+	unsigned int i;
+
+	if (head > len)
+		head = len;
+	for (i = 0; i < head; i++)
+		*p++ = pat[i];
+	len -= head;
+
+	for (i = 0; i < 3; i++)
+		memcpy(&w[i], &pat[(head + 4 * i) % 12], 4);
+
+	q = (uint32_t *)p;
+	for (; len >= 12; len -= 12) {
+		*q++ = w[0];
+		*q++ = w[1];
+		*q++ = w[2];
+	}
+
+	p = (uint8_t *)q;
+	for (i = 0; i < len; i++)
+		p[i] = pat[(head + i) % 12];
+}
+
+void fb_fill(struct fb_surface *s, const struct fb_box *b, uint32_t pixel)
+{
+	unsigned int bytes = s->bpp / 8;
+	struct fb_box c = *b;
+	uint16_t pixel16 = pixel;
+	uint8_t pat[24];
+	uint8_t *p;
+	int i;
+
+	if (!bytes || !fb_clip(s, &c))
+		return;
+
+	for (i = 0; i < 12; i += bytes) {
+		switch (bytes) {
+		case 1:
+			pat[i] = pixel;
+			break;
+		case 2:
+			memcpy(&pat[i], &pixel16, 2);
+			break;
+		case 3:
+			pat[i] = pixel;
+			pat[i + 1] = pixel >> 8;
+			pat[i + 2] = pixel >> 16;
+			break;
+		default:
+			memcpy(&pat[i], &pixel, 4);
+			break;
+		}
+	}
+	/* the head may start anywhere in the pattern */
+	memcpy(&pat[12], pat, 12);
+
+	p = s->mem + c.y * s->stride + c.x * bytes;
+	for (i = 0; i < c.height; i++, p += s->stride)
+		fb_fill_line(p, c.width * bytes, pat);
+}
+
+void fb_copy(struct fb_surface *dst, int dx, int dy,
+	     const struct fb_surface *src, const struct fb_box *b)
+{
+	unsigned int bytes = src->bpp / 8;
+	int ox = b->x - dx, oy = b->y - dy;
+	struct fb_box c = *b;
+	const uint8_t *s;
+	uint8_t *d;
+	int i;
+
+	if (!bytes || dst->bpp != src->bpp)
+		return;
+
+	/* clip in destination coordinates, then in source coordinates */
+	c.x = dx;
+	c.y = dy;
+	if (!fb_clip(dst, &c))
+		return;
+	c.x += ox;
+	c.y += oy;
+	if (!fb_clip(src, &c))
+		return;
+
+	s = src->mem + c.y * src->stride + c.x * bytes;
+	d = dst->mem + (c.y - oy) * dst->stride + (c.x - ox) * bytes;
+
+	if (dst->mem == src->mem) {
+		if (d > s) {
+			s += (c.height - 1) * src->stride;
+			d += (c.height - 1) * dst->stride;
+			for (i = 0; i < c.height; i++, s -= src->stride, d -= dst->stride)
+				memmove(d, s, c.width * bytes);
+		} else {
+			for (i = 0; i < c.height; i++, s += src->stride, d += dst->stride)
+				memmove(d, s, c.width * bytes);
+		}
+		return;
+	}
+
+	for (i = 0; i < c.height; i++, s += src->stride, d += dst->stride)
+		memcpy(d, s, c.width * bytes);
+}
+
+void fb_damage_add(struct fb_damage *d, const struct fb_box *b)
+{
+	int x2, y2;
+
+	if (b->width <= 0 || b->height <= 0)
+		return;
+
+	if (d->box.width <= 0 || d->box.height <= 0) {
+		d->box = *b;
+		return;
+	}
+
+	x2 = d->box.x + d->box.width;
+	y2 = d->box.y + d->box.height;
+	if (b->x + b->width > x2)
+		x2 = b->x + b->width;
+	if (b->y + b->height > y2)
+		y2 = b->y + b->height;
+	if (b->x < d->box.x)
+		d->box.x = b->x;
+	if (b->y < d->box.y)
+		d->box.y = b->y;
+	d->box.width = x2 - d->box.x;
+	d->box.height = y2 - d->box.y;
+}
+
+void fb_damage_flush(struct fb_surface *fb, const struct fb_surface *shadow,
+		     struct fb_damage *d)
+{
+	if (d->box.width > 0 && d->box.height > 0)
+		fb_copy(fb, d->box.x, d->box.y, shadow, &d->box);
+
+	memset(d, 0, sizeof(*d));
+}
@@ -0,0 +1,67 @@
+/*
+ * Rectangle fills and copies for linear framebuffers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __FBTEST_BLIT_H
+#define __FBTEST_BLIT_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+/*
+ * A mapped framebuffer or an off-screen image in the same format. Only 8,
+ * 16, 24 and 32 bits per pixel are handled, 24 bpp pixels are stored
+ * least significant byte first.
+ */
+struct fb_surface {
+	uint8_t *mem;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;		/* bytes per line */
+	unsigned int bpp;
+	struct fb_bitfield red;
+	struct fb_bitfield green;
+	struct fb_bitfield blue;
+	struct fb_bitfield transp;
+};
+
+struct fb_box {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+/* bounding box of everything drawn into a shadow surface since the last flush */
+struct fb_damage {
+	struct fb_box box;
+};
+
+/* packs 16 bit per channel colour into a pixel value, integer only */
+uint32_t fb_pixel(const struct fb_surface *s, uint16_t r, uint16_t g,
+		  uint16_t b, uint16_t a);
+
+/* clips b to the surface, returns 0 if nothing is left */
+int fb_clip(const struct fb_surface *s, struct fb_box *b);
+
+void fb_fill(struct fb_surface *s, const struct fb_box *b, uint32_t pixel);
+
+/* copies b of src to dx/dy of dst, both surfaces must have the same bpp */
+void fb_copy(struct fb_surface *dst, int dx, int dy,
+	     const struct fb_surface *src, const struct fb_box *b);
+
+void fb_damage_add(struct fb_damage *d, const struct fb_box *b);
+
+/* copies the damaged part of shadow to fb and resets the damage */
+void fb_damage_flush(struct fb_surface *fb, const struct fb_surface *shadow,
+		     struct fb_damage *d);
+
+/* prints fill and blit rates in the format of scripts/perf-tests.sh */
+void fb_bench(struct fb_surface *fb);
+
+#endif
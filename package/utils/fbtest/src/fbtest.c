@@ -39,6 +39,8 @@
 
 #include <linux/fb.h>
 
+#include "blit.h"
+
 #define FBDEV "/dev/fb0"
 
 struct vidsize{
@@ -156,31 +158,7 @@ struct rect{
 	int height;
 	const struct colour *col;
 };
-struct pixel{		// up to 32 bits of pixel information
-	char byte[4];
-};
 
-void col2pixel (struct pixel *pix, const struct pixelformat *pixf, const struct colour *col){
-	switch (pixf->pixenum){
-		case RGB565:
-			pix->byte[0]=(col->r&0xf8)|(col->g&0xfc)>>5;
-			pix->byte[1]=(col->g&0xfc)<<3|(col->b&0xf8)>>3;
-			break;
-		case ARGB1555:
-			pix->byte[0]=(col->a&0x80)|(col->r&0xf8)>>1|(col->g&0xf8)>>6;
-			pix->byte[1]=(col->g&0xf8)<<2|(col->b&0xf8)>>3;
-			break;
-		case ARGB:
-			pix->byte[0]=col->a;
-			pix->byte[1]=col->r;
-			pix->byte[2]=col->g;
-			pix->byte[3]=col->b;
-			break;
-		default:
-			printf ("unknown pixelformat\n");
-			exit(1);
-	}
-}
 
 int setmode(int fbd, const struct pixelformat *pixf,const struct vidsize *vids){
 	struct fb_var_screeninfo var;
@@ -204,55 +182,38 @@ int setmode(int fbd, const struct pixelformat *pixf,const struct vidsize *vids){
 	return 0;
 }
 
-// unefficient implementation, do NOT use it for your next ego shooter, please :)
 // for 4-Bit only rectangles with even width are supported
 // CLUT-modes use value of red component as index
 void drawrect(void *videoram, struct rect *r, const struct pixelformat *pixf, const struct vidsize *vids){
-	int x,y,corwidth, bpp = 0, tocopy = 1;
-	struct pixel pix;
-	unsigned char *pmem = videoram;
-	corwidth = r->width;	// actually only "corrected" for 4 Bit
+	struct fb_surface s = {
+		.mem = videoram, .width = vids->width, .height = vids->height,
+		.stride = (vids->width*pixf->bpp)>>3, .bpp = pixf->bpp,	// stride actually should be taken from "fix-info"
+		.red = pixf->red, .green = pixf->green, .blue = pixf->blue, .transp = pixf->transp
+	};
+	struct fb_box b = { .x = r->x, .y = r->y, .width = r->width, .height = r->height };
+	uint32_t pixel;
 
-	if (pixf->pixenum!=CLUT4&&pixf->pixenum!=CLUT8){
-		switch (pixf->pixenum){
-			case ARGB1555:
-			case RGB565:
-				bpp = 16;
-				tocopy = 2;
-				break;
-			case ARGB:
-				bpp = 32;
-				tocopy = 4;
-				break;
-			default:
-				printf ("drawrect: unknown pixelformat(%d) bpp:%d\n",pixf->pixenum,pixf->bpp);
-				exit(1);
-		}
-		col2pixel(&pix,pixf,r->col);
-	} else {
-		switch (pixf->pixenum){	// CLUT = Colour LookUp Table (palette)
-			case CLUT4:	// take red value as index in this case
-				pix.byte[0]=(r->col->r)<<4|(r->col->r&0xf);	// slightly cryptic... "rect->colour->red"
-				corwidth>>=1;	// we copy bytes
-				bpp=4;
-				tocopy=1;
-				break;
-			case CLUT8:
-				pix.byte[0]=(r->col->r&0xff);
-				bpp=8;
-				tocopy=1;
-				break;
-		}
-	}
-	pmem=videoram+((((r->y*vids->width)+r->x)*bpp)>>3);
-	for (y=0;y<r->height;y++){
-		int offset = 0;
-		for (x=0;x<corwidth;x++){
-			memcpy (pmem+offset,pix.byte,tocopy);
-			offset+=tocopy;
-		}
-		pmem +=((vids->width*bpp)>>3);	// skip one whole line, actually should be taken from "fix-info"
+	switch (pixf->pixenum){	// CLUT = Colour LookUp Table (palette)
+		case CLUT4:	// take red value as index, two pixels per byte
+			s.bpp = 8;
+			s.width >>= 1;
+			b.x >>= 1;
+			b.width >>= 1;
+			pixel = (r->col->r&0xf)<<4|(r->col->r&0xf);
+			break;
+		case CLUT8:
+			pixel = r->col->r&0xff;
+			break;
+		case ARGB1555:
+		case RGB565:
+		case ARGB:
+			pixel = fb_pixel(&s,r->col->r,r->col->g,r->col->b,r->col->a);
+			break;
+		default:
+			printf ("drawrect: unknown pixelformat(%d) bpp:%d\n",pixf->pixenum,pixf->bpp);
+			exit(1);
 	}
+	fb_fill(&s,&b,pixel);
 }
 			
 // create quick little test image, 4 colours from table
@@ -299,6 +260,10 @@ void usage(char *name){
 		"            disables clearing the framebuffer after drawing\n"
 		"            the testimage. This can be useful to keep the last\n"
 		"            drawn image onscreen.\n"
+		"         -b\n"
+		"            benchmarks fills and blits in the current mode\n"
+		"            instead of testing the modes. This overwrites\n"
+		"            the screen contents.\n"
 		"\nExample: %s -fRGB322\n",name,name);
 	exit(0);
 }
@@ -311,12 +276,12 @@ int main (int argc,char **argv){
 	int fbd;
 	unsigned char *pfb;
 	int stat;
-	int optchar,fmode=-1,smode=-1,clear=1;
+	int optchar,fmode=-1,smode=-1,clear=1,bench=0;
 	int i_cmap,i_size,i_pix;
 	extern char *optarg;
 	
 	if (argc!=0&&argc>4) usage(argv[0]);
-	while ( (optchar = getopt (argc,argv,"f:s:n"))!= -1){
+	while ( (optchar = getopt (argc,argv,"f:s:nb"))!= -1){
 		int i,height,width;
 		switch (optchar){
 			case 'f':
@@ -355,6 +320,9 @@ int main (int argc,char **argv){
 				clear = 0;
 				printf ("clearing framebuffer after drawing is disabled\n");
 				break;
+			case 'b':
+				bench = 1;
+				break;
 			case '?':
 				usage (argv[0]);
 		}
@@ -386,6 +354,22 @@ int main (int argc,char **argv){
 		return 1;
 	}
 
+	if (bench){
+		struct fb_surface s = {
+			.mem = pfb + var.yoffset*fix.line_length, .width = var.xres, .height = var.yres,
+			.stride = fix.line_length, .bpp = var.bits_per_pixel,
+			.red = var.red, .green = var.green, .blue = var.blue, .transp = var.transp
+		};
+		if (var.bits_per_pixel<8 || var.bits_per_pixel%8){
+			printf ("benchmark needs a mode with 8, 16, 24 or 32 bpp\n");
+			return 1;
+		}
+		fb_bench(&s);
+		munmap (pfb,fix.smem_len);
+		close (fbd);
+		return 0;
+	}
+
 	// iterate over all modes
 	for (i_pix=0;i_pix<PIXELFORMATNUM;i_pix++){
 		if (fmode!=-1 && pixelformattable[i_pix].pixenum != fmode) continue;
@@ -0,0 +1,59 @@
+/*
+ * Microbenchmark for the fbtest blits
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Runs on framebuffers in plain memory, sized like the small LCDs these
+ * devices have, so it works under qemu as well. fbtest -b measures a real
+ * framebuffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blit.h"
+
+#define PERF_WIDTH	320
+#define PERF_HEIGHT	240
+
+static const struct fb_surface perf_formats[] = {
+	{ .bpp = 16,
+	  .red = { .offset = 11, .length = 5 },
+	  .green = { .offset = 5, .length = 6 },
+	  .blue = { .offset = 0, .length = 5 } },
+	{ .bpp = 24,
+	  .red = { .offset = 16, .length = 8 },
+	  .green = { .offset = 8, .length = 8 },
+	  .blue = { .offset = 0, .length = 8 } },
+	{ .bpp = 32,
+	  .red = { .offset = 16, .length = 8 },
+	  .green = { .offset = 8, .length = 8 },
+	  .blue = { .offset = 0, .length = 8 },
+	  .transp = { .offset = 24, .length = 8 } },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(perf_formats) / sizeof(perf_formats[0]); i++) {
+		struct fb_surface fb = perf_formats[i];
+
+		fb.width = PERF_WIDTH;
+		fb.height = PERF_HEIGHT;
+		fb.stride = PERF_WIDTH * fb.bpp / 8;
+		fb.mem = malloc(fb.stride * fb.height);
+		if (!fb.mem) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		fb_bench(&fb);
+		free(fb.mem);
+	}
+
+	return 0;
+}
@@ -28,16 +28,75 @@
 static nvram_handle_t * nvram_open_rdonly(void)
 {
 	const char *file = nvram_find_staging();
-
-	if( file == NULL )
-		file = nvram_find_mtd();
+	nvram_handle_t *h;
+	int lock;
 
 	if( file != NULL )
 		return nvram_open(file, NVRAM_RO);
 
+	/* Read from flash: publish it for the readers that follow, before a
+	 * commit can change it */
+	if( (file = nvram_find_mtd()) != NULL )
+	{
+		lock = nvram_lock(LOCK_SH);
+
+		if( (h = nvram_open(file, NVRAM_RO)) != NULL )
+			nvram_snapshot_write(h);
+
+		if( lock > -1 )
+			close(lock);
+
+		return h;
+	}
+
 	return NULL;
 }
 
+/* Answer get and show from the snapshot, returns 0 if it can't */
+static int do_snapshot(int argc, const char *argv[], int *stat)
+{
+	nvram_snapshot_t *snap;
+	const char *val, *name;
+	uint32_t i, len;
+	int done = 0;
+
+	for( i = 1; i < argc; i++ )
+	{
+		if( !strcmp(argv[i], "get") && (i+1) < argc )
+			i++;
+		else if( strcmp(argv[i], "show") )
+			return 0;
+	}
+
+	if( nvram_find_staging() != NULL || (snap = nvram_snapshot_open()) == NULL )
+		return 0;
+
+	for( i = 1; i < argc; i++ )
+	{
+		if( !strcmp(argv[i], "show") )
+		{
+			for( len = 0; len < snap->header->data_len; len += strlen(val) + 1 )
+			{
+				name = snap->data + len;
+				val = name + strlen(name) + 1;
+				printf("%s=%s\n", name, val);
+				len += strlen(name) + 1;
+			}
+			*stat = 0;
+		}
+		else
+		{
+			if( (val = nvram_snapshot_get(snap, argv[++i])) != NULL )
+				printf("%s\n", val);
+			*stat = val ? 0 : 1;
+		}
+		done++;
+	}
+
+	nvram_snapshot_close(snap);
+	return done;
+}
+
 static nvram_handle_t * nvram_open_staging(void)
 {
 	if( nvram_find_staging() != NULL || nvram_to_staging() == 0 )
@@ -150,6 +209,9 @@ int main( int argc, const char *argv[] )
 		}
 
 
+	if( !write && do_snapshot(argc, argv, &stat) )
+		return stat;
+
 	nvram = write ? nvram_open_staging() : nvram_open_rdonly();
 
 	if( nvram != NULL && argc > 1 )
@@ -21,6 +21,9 @@
 /* Size of "nvram" MTD partition */
 size_t nvram_part_size = 0;
 
+/* Erase block size of "nvram" MTD partition */
+size_t nvram_erase_size = 0;
+
 
 /*
  * -- Helper functions --
@@ -37,59 +40,94 @@ static uint32_t hash(const char *s)
 	return hash;
 }
 
+#define NVRAM_ARENA_CHUNK	16384
+#define NVRAM_INDEX_MIN		512
+
+/* Allocate from the arena; freed all at once by _nvram_free(). */
+static void * _nvram_alloc(nvram_handle_t *h, size_t len)
+{
+	struct nvram_arena *a = h->arena;
+	void *p;
+
+	len = NVRAM_ROUNDUP(len, sizeof(void *));
+
+	if (!a || a->size - a->used < len) {
+		size_t size = len > NVRAM_ARENA_CHUNK ? len : NVRAM_ARENA_CHUNK;
+
+		if (!(a = malloc(sizeof(struct nvram_arena) + size)))
+			return NULL;
+
+		a->next = h->arena;
+		a->used = 0;
+		a->size = size;
+		h->arena = a;
+	}
+
+	p = a->data + a->used;
+	a->used += len;
+
+	return p;
+}
+
+static char * _nvram_strdup(nvram_handle_t *h, const char *s)
+{
+	char *p = _nvram_alloc(h, strlen(s) + 1);
+
+	if (p)
+		strcpy(p, s);
+
+	return p;
+}
+
 /* Free all tuples. */
 static void _nvram_free(nvram_handle_t *h)
 {
-	uint32_t i;
-	nvram_tuple_t *t, *next;
+	struct nvram_arena *a, *next;
 
-	/* Free hash table */
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
-		for (t = h->nvram_hash[i]; t; t = next) {
-			next = t->next;
-			free(t);
-		}
-		h->nvram_hash[i] = NULL;
+	for (a = h->arena; a; a = next) {
+		next = a->next;
+		free(a);
 	}
 
-	/* Free dead table */
-	for (t = h->nvram_dead; t; t = next) {
-		next = t->next;
-		free(t);
-	}
+	free(h->index);
 
-	h->nvram_dead = NULL;
+	h->arena = NULL;
+	h->index = NULL;
+	h->index_size = h->index_used = 0;
+	h->first = h->last = NULL;
 }
 
-/* (Re)allocate NVRAM tuples. */
-static nvram_tuple_t * _nvram_realloc( nvram_handle_t *h, nvram_tuple_t *t,
-	const char *name, const char *value )
+/* Find the slot of a name: either its tuple or the empty slot for it. */
+static nvram_tuple_t ** _nvram_slot(nvram_handle_t *h, const char *name)
 {
-	if ((strlen(value) + 1) > h->length - h->offset)
-		return NULL;
+	uint32_t i = hash(name) & (h->index_size - 1);
 
-	if (!t) {
-		if (!(t = malloc(sizeof(nvram_tuple_t) + strlen(name) + 1)))
-			return NULL;
+	while (h->index[i] && strcmp(h->index[i]->name, name))
+		i = (i + 1) & (h->index_size - 1);
 
-		/* Copy name */
-		t->name = (char *) &t[1];
-		strcpy(t->name, name);
+	return &h->index[i];
+}
 
-		t->value = NULL;
-	}
+/* Double the index once it is three quarters full. */
+static int _nvram_grow(nvram_handle_t *h)
+{
+	nvram_tuple_t **old = h->index, *t;
+	unsigned int size = h->index_size ? h->index_size * 2 : NVRAM_INDEX_MIN;
 
-	/* Copy value */
-	if (!t->value || strcmp(t->value, value))
-	{
-		if(!(t->value = (char *) realloc(t->value, strlen(value)+1)))
-			return NULL;
+	if (h->index && h->index_used * 4 < h->index_size * 3)
+		return 0;
 
-		strcpy(t->value, value);
-		t->value[strlen(value)] = '\0';
+	if (!(h->index = calloc(size, sizeof(nvram_tuple_t *)))) {
+		h->index = old;
+		return -1;
 	}
 
-	return t;
+	h->index_size = size;
+	for (t = h->first; t; t = t->next)
+		*_nvram_slot(h, t->name) = t;
+
+	free(old);
+	return 0;
 }
 
 /* (Re)initialize the hash table. */
@@ -132,6 +170,9 @@ static int _nvram_rehash(nvram_handle_t *h)
 		nvram_set(h, "sdram_ncdl", buf);
 	}
 
+	/* What was just read is what is stored */
+	h->dirty = 0;
+
 	return 0;
 }
 
@@ -149,80 +190,71 @@ nvram_header_t * nvram_header(nvram_handle_t *h)
 /* Get the value of an NVRAM variable. */
 char * nvram_get(nvram_handle_t *h, const char *name)
 {
-	uint32_t i;
 	nvram_tuple_t *t;
-	char *value;
 
-	if (!name)
+	if (!name || !h->index)
 		return NULL;
 
-	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
+	t = *_nvram_slot(h, name);
 
-	/* Find the associated tuple in the hash table */
-	for (t = h->nvram_hash[i]; t && strcmp(t->name, name); t = t->next);
-
-	value = t ? t->value : NULL;
-
-	return value;
+	return t ? t->value : NULL;
 }
 
 /* Set the value of an NVRAM variable. */
 int nvram_set(nvram_handle_t *h, const char *name, const char *value)
 {
-	uint32_t i;
-	nvram_tuple_t *t, *u, **prev;
+	nvram_tuple_t **slot, *t;
 
-	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
-
-	/* Find the associated tuple in the hash table */
-	for (prev = &h->nvram_hash[i], t = *prev;
-		 t && strcmp(t->name, name); prev = &t->next, t = *prev);
+	if ((strlen(value) + 1) > h->length - h->offset)
+		return -12; /* -ENOMEM */
 
-	/* (Re)allocate tuple */
-	if (!(u = _nvram_realloc(h, t, name, value)))
+	if (_nvram_grow(h))
 		return -12; /* -ENOMEM */
 
-	/* Value reallocated */
-	if (t && t == u)
+	slot = _nvram_slot(h, name);
+
+	/* Unchanged */
+	if ((t = *slot) != NULL && t->value && !strcmp(t->value, value))
 		return 0;
 
-	/* Move old tuple to the dead table */
-	if (t) {
-		*prev = t->next;
-		t->next = h->nvram_dead;
-		h->nvram_dead = t;
+	if (!t) {
+		if (!(t = _nvram_alloc(h, sizeof(nvram_tuple_t))) ||
+		    !(t->name = _nvram_strdup(h, name)))
+			return -12; /* -ENOMEM */
+
+		t->value = NULL;
+		t->next = NULL;
+
+		if (h->last)
+			h->last->next = t;
+		else
+			h->first = t;
+		h->last = t;
+
+		*slot = t;
+		h->index_used++;
 	}
 
-	/* Add new tuple to the hash table */
-	u->next = h->nvram_hash[i];
-	h->nvram_hash[i] = u;
+	/* The old value stays in the arena for callers still holding it */
+	if (!(t->value = _nvram_strdup(h, value)))
+		return -12; /* -ENOMEM */
 
+	h->dirty = 1;
 	return 0;
 }
 
 /* Unset the value of an NVRAM variable. */
 int nvram_unset(nvram_handle_t *h, const char *name)
 {
-	uint32_t i;
-	nvram_tuple_t *t, **prev;
+	nvram_tuple_t *t;
 
-	if (!name)
+	if (!name || !h->index)
 		return 0;
 
-	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
-
-	/* Find the associated tuple in the hash table */
-	for (prev = &h->nvram_hash[i], t = *prev;
-		 t && strcmp(t->name, name); prev = &t->next, t = *prev);
-
-	/* Move it to the dead table */
-	if (t) {
-		*prev = t->next;
-		t->next = h->nvram_dead;
-		h->nvram_dead = t;
+	/* The name keeps its slot, set again it keeps its place too */
+	if ((t = *_nvram_slot(h, name)) != NULL && t->value) {
+		t->value = NULL;
+		h->dirty = 1;
 	}
 
 	return 0;
@@ -231,24 +263,26 @@ int nvram_unset(nvram_handle_t *h, const char *name)
 /* Get all NVRAM variables. */
 nvram_tuple_t * nvram_getall(nvram_handle_t *h)
 {
-	int i;
-	nvram_tuple_t *t, *l, *x;
+	nvram_tuple_t *t, *l, *x, **tail;
 
 	l = NULL;
+	tail = &l;
 
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
-		for (t = h->nvram_hash[i]; t; t = t->next) {
-			if( (x = (nvram_tuple_t *) malloc(sizeof(nvram_tuple_t))) != NULL )
-			{
-				x->name  = t->name;
-				x->value = t->value;
-				x->next  = l;
-				l = x;
-			}
-			else
-			{
-				break;
-			}
+	for (t = h->first; t; t = t->next) {
+		if (!t->value)
+			continue;
+
+		if( (x = (nvram_tuple_t *) malloc(sizeof(nvram_tuple_t))) != NULL )
+		{
+			x->name  = t->name;
+			x->value = t->value;
+			x->next  = NULL;
+			*tail = x;
+			tail = &x->next;
+		}
+		else
+		{
+			break;
 		}
 	}
 
@@ -261,11 +295,14 @@ int nvram_commit(nvram_handle_t *h)
 	nvram_header_t *header = nvram_header(h);
 	char *init, *config, *refresh, *ncdl;
 	char *ptr, *end;
-	int i;
 	nvram_tuple_t *t;
 	nvram_header_t tmp;
 	uint8_t crc;
 
+	/* Nothing was set or unset since it was read */
+	if (!h->dirty)
+		return 0;
+
 	/* Regenerate header */
 	header->magic = NVRAM_MAGIC;
 	header->crc_ver_init = (NVRAM_VERSION << 8);
@@ -292,13 +329,14 @@ int nvram_commit(nvram_handle_t *h)
 	/* Leave space for a double NUL at the end */
 	end = (char *) header + nvram_part_size - h->offset - 2;
 
-	/* Write out all tuples */
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
-		for (t = h->nvram_hash[i]; t; t = t->next) {
-			if ((ptr + strlen(t->name) + 1 + strlen(t->value) + 1) > end)
-				break;
-			ptr += sprintf(ptr, "%s=%s", t->name, t->value) + 1;
-		}
+	/* Write out all tuples, in the order they were read and added, so
+	 * that a change moves as little of the data as possible */
+	for (t = h->first; t; t = t->next) {
+		if (!t->value)
+			continue;
+		if ((ptr + strlen(t->name) + 1 + strlen(t->value) + 1) > end)
+			break;
+		ptr += sprintf(ptr, "%s=%s", t->name, t->value) + 1;
 	}
 
 	/* End with a double NULL and pad to 4 bytes */
@@ -428,7 +466,7 @@ int nvram_close(nvram_handle_t *h)
 char * nvram_find_mtd(void)
 {
 	FILE *fp;
-	int i, part_size;
+	int i, part_size, erase_size;
 	char dev[PATH_MAX];
 	char *path = NULL;
 	struct stat s;
@@ -437,9 +475,10 @@ char * nvram_find_mtd(void)
 	{
 		while( fgets(dev, sizeof(dev), fp) )
 		{
-			if( strstr(dev, "nvram") && sscanf(dev, "mtd%d: %08x", &i, &part_size) )
+			if( strstr(dev, "nvram") && sscanf(dev, "mtd%d: %08x %08x", &i, &part_size, &erase_size) )
 			{
 				nvram_part_size = part_size;
+				nvram_erase_size = (erase_size > 0 && erase_size <= part_size) ? erase_size : 0;
 
 				sprintf(dev, "/dev/mtdblock%d", i);
 				if( stat(dev, &s) > -1 && (s.st_mode & S_IFBLK) )
@@ -504,14 +543,169 @@ int nvram_to_staging(void)
 	return stat;
 }
 
-/* Copy staging file to NVRAM device. */
+/* Serialise against NVRAM writers. */
+int nvram_lock(int op)
+{
+	int fd = open(NVRAM_LOCK, O_RDWR | O_CREAT, 0600);
+
+	if( fd > -1 )
+		flock(fd, op);
+
+	return fd;
+}
+
+/* Publish a snapshot of the variables of a handle. */
+int nvram_snapshot_write(nvram_handle_t *h)
+{
+	struct nvram_snapshot_header *sh;
+	nvram_tuple_t *t;
+	uint32_t *index, i, count = 0, size = 16, len = 0;
+	char *snap, *data;
+	size_t total;
+	int fd, stat = -1;
+
+	for (t = h->first; t; t = t->next) {
+		if (!t->value)
+			continue;
+		count++;
+		len += strlen(t->name) + 1 + strlen(t->value) + 1;
+	}
+
+	/* At most half full */
+	while (size < count * 2)
+		size *= 2;
+
+	total = sizeof(*sh) + size * sizeof(uint32_t) + len;
+	if (!(snap = calloc(1, total)))
+		return -1;
+
+	sh = (struct nvram_snapshot_header *) snap;
+	index = (uint32_t *) &sh[1];
+	data = (char *) &index[size];
+
+	sh->magic = NVRAM_SNAPSHOT_MAGIC;
+	sh->count = count;
+	sh->index_size = size;
+	sh->data_len = len;
+
+	for (len = 0, t = h->first; t; t = t->next) {
+		if (!t->value)
+			continue;
+
+		for (i = hash(t->name) & (size - 1); index[i]; i = (i + 1) & (size - 1));
+		index[i] = len + 1;
+
+		strcpy(data + len, t->name);
+		len += strlen(t->name) + 1;
+		strcpy(data + len, t->value);
+		len += strlen(t->value) + 1;
+	}
+
+	/* Readers only ever see a complete snapshot */
+	if( (fd = open(NVRAM_SNAPSHOT ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0600)) > -1 )
+	{
+		if( write(fd, snap, total) == total && !rename(NVRAM_SNAPSHOT ".tmp", NVRAM_SNAPSHOT) )
+			stat = 0;
+		else
+			unlink(NVRAM_SNAPSHOT ".tmp");
+
+		close(fd);
+	}
+
+	free(snap);
+	return stat;
+}
+
+/* Map the published snapshot, NULL if there is none. */
+nvram_snapshot_t * nvram_snapshot_open(void)
+{
+	nvram_snapshot_t *s;
+	struct stat st;
+	int fd;
+
+	if( (fd = open(NVRAM_SNAPSHOT, O_RDONLY)) < 0 )
+		return NULL;
+
+	if( fstat(fd, &st) || st.st_size < sizeof(struct nvram_snapshot_header) ||
+	    !(s = malloc(sizeof(*s))) )
+	{
+		close(fd);
+		return NULL;
+	}
+
+	s->size = st.st_size;
+	s->map = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if( s->map == MAP_FAILED )
+	{
+		free(s);
+		return NULL;
+	}
+
+	s->header = (struct nvram_snapshot_header *) s->map;
+	s->index = (uint32_t *) &s->header[1];
+	s->data = (char *) &s->index[s->header->index_size];
+
+	if( s->header->magic != NVRAM_SNAPSHOT_MAGIC ||
+	    (s->header->index_size & (s->header->index_size - 1)) ||
+	    s->size != sizeof(*s->header) + s->header->index_size * sizeof(uint32_t) + s->header->data_len )
+	{
+		nvram_snapshot_close(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+/* Get the value of an NVRAM variable from a snapshot. */
+const char * nvram_snapshot_get(nvram_snapshot_t *s, const char *name)
+{
+	uint32_t mask = s->header->index_size - 1;
+	uint32_t i;
+	char *n;
+
+	if (!name || !mask)
+		return NULL;
+
+	for (i = hash(name) & mask; s->index[i]; i = (i + 1) & mask) {
+		n = s->data + s->index[i] - 1;
+		if (!strcmp(n, name))
+			return n + strlen(n) + 1;
+	}
+
+	return NULL;
+}
+
+/* Unmap a snapshot. */
+void nvram_snapshot_close(nvram_snapshot_t *s)
+{
+	munmap(s->map, s->size);
+	free(s);
+}
+
+/* Remove the snapshot once NVRAM has changed. */
+void nvram_snapshot_drop(void)
+{
+	unlink(NVRAM_SNAPSHOT);
+}
+
+/* Copy staging file to NVRAM device, rewriting only the erase blocks
+ * whose contents differ. */
 int staging_to_nvram(void)
 {
-	int fdmtd, fdstg, stat;
+	int fdmtd, fdstg, stat, full, lock;
 	char *mtd = nvram_find_mtd();
 	char buf[nvram_part_size];
+	char cur[nvram_part_size];
+	size_t block, pos;
 
 	stat = -1;
+	block = nvram_erase_size ? nvram_erase_size : nvram_part_size;
+
+	/* No reader may publish what was there before */
+	lock = nvram_lock(LOCK_EX);
+	nvram_snapshot_drop();
 
 	if( (mtd != NULL) && (nvram_part_size > 0) )
 	{
@@ -519,12 +713,26 @@ int staging_to_nvram(void)
 		{
 			if( read(fdstg, buf, sizeof(buf)) == sizeof(buf) )
 			{
-				if( (fdmtd = open(mtd, O_WRONLY | O_SYNC)) > -1 )
+				if( (fdmtd = open(mtd, O_RDWR | O_SYNC)) > -1 )
 				{
-					write(fdmtd, buf, sizeof(buf));
+					/* Without the current contents, write it all */
+					full = read(fdmtd, cur, sizeof(cur)) != sizeof(cur);
+
+					stat = 0;
+					for( pos = 0; pos < sizeof(buf); pos += block )
+					{
+						if( block > sizeof(buf) - pos )
+							block = sizeof(buf) - pos;
+
+						if( !full && !memcmp(buf + pos, cur + pos, block) )
+							continue;
+
+						if( pwrite(fdmtd, buf + pos, block, pos) != block )
+							stat = -1;
+					}
+
 					fsync(fdmtd);
 					close(fdmtd);
-					stat = 0;
 				}
 			}
 
@@ -535,6 +743,9 @@ int staging_to_nvram(void)
 		}
 	}
 
+	if( lock > -1 )
+		close(lock);
+
 	free(mtd);
 	return stat;
 }
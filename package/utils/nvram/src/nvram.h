@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <linux/limits.h>
 
 #include "sdinitvals.h"
@@ -39,22 +40,56 @@ struct nvram_header {
 
 struct nvram_tuple {
 	char *name;
-	char *value;
+	char *value;			/* NULL once unset */
 	struct nvram_tuple *next;
 };
 
+/* Tuples and strings are allocated from chunks that live until the next
+ * rehash, so pointers returned by nvram_get stay valid across nvram_set. */
+struct nvram_arena {
+	struct nvram_arena *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
 struct nvram_handle {
 	int fd;
 	char *mmap;
 	unsigned int length;
 	unsigned int offset;
-	struct nvram_tuple *nvram_hash[257];
-	struct nvram_tuple *nvram_dead;
+	int dirty;			/* changed since the last commit */
+	struct nvram_arena *arena;
+	struct nvram_tuple **index;	/* open addressing, linear probing */
+	unsigned int index_size;	/* power of two */
+	unsigned int index_used;	/* slots taken, including unset names */
+	struct nvram_tuple *first;	/* in order of insertion */
+	struct nvram_tuple *last;
+};
+
+/* Read-only snapshot of all variables, published in tmpfs by the first
+ * reader so that later reads need neither the flash nor a rehash. */
+struct nvram_snapshot_header {
+	uint32_t magic;
+	uint32_t count;
+	uint32_t index_size;	/* power of two */
+	uint32_t data_len;
+	/* uint32_t index[index_size]: 1 + data offset of the name, 0: empty */
+	/* "name\0value\0" ... */
+} __attribute__((__packed__));
+
+struct nvram_snapshot {
+	char *map;
+	size_t size;
+	struct nvram_snapshot_header *header;
+	uint32_t *index;
+	char *data;
 };
 
 typedef struct nvram_handle nvram_handle_t;
 typedef struct nvram_header nvram_header_t;
 typedef struct nvram_tuple  nvram_tuple_t;
+typedef struct nvram_snapshot nvram_snapshot_t;
 
 
 /* Get nvram header. */
@@ -102,9 +137,31 @@ int staging_to_nvram(void);
 /* Check NVRAM staging file. */
 char * nvram_find_staging(void);
 
+/* Serialise against NVRAM writers, op is LOCK_SH or LOCK_EX. Returns
+ * a descriptor to close for unlocking. */
+int nvram_lock(int op);
+
+/* Publish a snapshot of the variables of a handle. */
+int nvram_snapshot_write(nvram_handle_t *h);
+
+/* Map the published snapshot, NULL if there is none. */
+nvram_snapshot_t * nvram_snapshot_open(void);
+
+/* Get the value of an NVRAM variable from a snapshot. */
+const char * nvram_snapshot_get(nvram_snapshot_t *s, const char *name);
+
+/* Unmap a snapshot. */
+void nvram_snapshot_close(nvram_snapshot_t *s);
+
+/* Remove the snapshot once NVRAM has changed. */
+void nvram_snapshot_drop(void);
+
 
 /* Staging file for NVRAM */
 #define NVRAM_STAGING		"/tmp/.nvram"
+#define NVRAM_SNAPSHOT		"/tmp/.nvram.snap"
+#define NVRAM_LOCK		"/tmp/.nvram.lock"
+#define NVRAM_SNAPSHOT_MAGIC	0x4E56534E	/* 'NVSN' */
 #define NVRAM_RO			1
 #define NVRAM_RW			0
 
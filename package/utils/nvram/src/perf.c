@@ -0,0 +1,144 @@
+/*
+ * Microbenchmark for libnvram
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Works on a scratch copy of a typical NVRAM in /tmp, never on the flash.
+ * Prints one "<name>\t<value>\t<unit>" line per result, as expected by
+ * scripts/perf-tests.sh.
+ */
+
+#include <time.h>
+#include "nvram.h"
+
+#define PERF_FILE		"/tmp/.nvram.perf"
+#define PERF_PART_SIZE		0x10000
+#define PERF_TUPLES		600
+#define PERF_MIN_NS		(500 * 1000 * 1000LL)
+
+extern size_t nvram_part_size;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int create_nvram(const char *file)
+{
+	char *buf, *ptr;
+	nvram_header_t *header;
+	int fd, i, ok;
+
+	if( (buf = malloc(PERF_PART_SIZE)) == NULL )
+		return -1;
+
+	memset(buf, 0xFF, PERF_PART_SIZE);
+	header = (nvram_header_t *) buf;
+	ptr = (char *) &header[1];
+
+	for( i = 0; i < PERF_TUPLES; i++ )
+		ptr += sprintf(ptr, "wl%d_perf_setting_%d=value-%08x",
+			i % 4, i, i * 2654435761u) + 1;
+	*ptr++ = '\0';
+
+	header->magic = NVRAM_MAGIC;
+	header->len = NVRAM_ROUNDUP(ptr - buf, 4);
+	header->crc_ver_init = NVRAM_VERSION << 8;
+	header->config_refresh = 0;
+	header->config_ncdl = 0;
+
+	ok = 0;
+	if( (fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0600)) > -1 )
+	{
+		ok = (write(fd, buf, PERF_PART_SIZE) == PERF_PART_SIZE);
+		close(fd);
+	}
+
+	free(buf);
+	return ok ? 0 : -1;
+}
+
+static void perf_commit(nvram_handle_t *h)
+{
+	char value[24];
+	int64_t start, ns;
+	long ops = 0, i, n = 1;
+
+	start = now_ns();
+	do {
+		for( i = 0; i < n; i++ )
+		{
+			sprintf(value, "%ld", ops + i);
+			nvram_set(h, "perf_counter", value);
+			nvram_commit(h);
+		}
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while( ns < PERF_MIN_NS );
+
+	printf("nvram_commit_%d\t%.1f\tns/op\n", PERF_TUPLES, (double) ns / ops);
+}
+
+static void perf_get(nvram_handle_t *h)
+{
+	char name[32];
+	int64_t start, ns;
+	long ops = 0, i, n = 1, found = 0;
+
+	start = now_ns();
+	do {
+		for( i = 0; i < n; i++ )
+		{
+			sprintf(name, "wl%ld_perf_setting_%ld",
+				(ops + i) % 4, (ops + i) % PERF_TUPLES);
+			found += (nvram_get(h, name) != NULL);
+		}
+		ops += n;
+		n *= 2;
+		ns = now_ns() - start;
+	} while( ns < PERF_MIN_NS );
+
+	if( found != ops )
+		fprintf(stderr, "nvram_get: %ld of %ld lookups failed\n",
+			ops - found, ops);
+
+	printf("nvram_get_%d\t%.1f\tns/op\n", PERF_TUPLES, (double) ns / ops);
+}
+
+int main(int argc, char **argv)
+{
+	nvram_handle_t *h;
+
+	if( create_nvram(PERF_FILE) )
+	{
+		perror("Could not create " PERF_FILE);
+		return 1;
+	}
+
+	nvram_part_size = PERF_PART_SIZE;
+	if( (h = nvram_open(PERF_FILE, NVRAM_RW)) == NULL )
+	{
+		fprintf(stderr, "Could not open " PERF_FILE "\n");
+		unlink(PERF_FILE);
+		return 1;
+	}
+
+	perf_get(h);
+	perf_commit(h);
+
+	nvram_close(h);
+	unlink(PERF_FILE);
+	return 0;
+}
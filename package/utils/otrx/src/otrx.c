@@ -11,6 +11,7 @@
 
 #include <byteswap.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,6 +32,9 @@
 #define TRX_FLAGS_OFFSET		12
 #define TRX_MAX_PARTS			3
 
+/* I/O block size, a multiple of the flash erase block sizes */
+#define OTRX_BUF_SIZE			(64 * 1024)
+
 struct trx_header {
 	uint32_t magic;
 	uint32_t length;
@@ -119,8 +123,42 @@ static const uint32_t crc32_tbl[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
 };
 
-uint32_t otrx_crc32(uint8_t *buf, size_t len) {
-	uint32_t crc = 0xffffffff;
+/* crc32_tbl8[k][i] is crc32_tbl[i] advanced by k + 1 more zero bytes */
+static uint32_t crc32_tbl8[7][256];
+
+static void otrx_crc32_init(void) {
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = crc32_tbl[i];
+		for (k = 0; k < 7; k++) {
+			c = crc32_tbl[c & 0xff] ^ (c >> 8);
+			crc32_tbl8[k][i] = c;
+		}
+	}
+}
+
+/* Updates crc with len bytes of buf, 8 bytes per step (slice-by-8) */
+uint32_t otrx_crc32(uint32_t crc, const uint8_t *buf, size_t len) {
+	static int initialized;
+	uint32_t a, b;
+
+	if (!initialized) {
+		otrx_crc32_init();
+		initialized = 1;
+	}
+
+	while (len >= 8) {
+		a = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24);
+		b = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+		crc = crc32_tbl8[6][a & 0xff] ^ crc32_tbl8[5][(a >> 8) & 0xff] ^
+		      crc32_tbl8[4][(a >> 16) & 0xff] ^ crc32_tbl8[3][a >> 24] ^
+		      crc32_tbl8[2][b & 0xff] ^ crc32_tbl8[1][(b >> 8) & 0xff] ^
+		      crc32_tbl8[0][(b >> 16) & 0xff] ^ crc32_tbl[b >> 24];
+		buf += 8;
+		len -= 8;
+	}
 
 	while (len) {
 		crc = crc32_tbl[(crc ^ *buf) & 0xff] ^ (crc >> 8);
@@ -131,6 +169,91 @@ uint32_t otrx_crc32(uint8_t *buf, size_t len) {
 	return crc;
 }
 
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+	uint32_t sum = 0;
+
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/*
+ * Advances crc over len zero bytes in O(log(len)), as zlib's crc32_combine.
+ * The crc of A followed by B is then otrx_crc32_zeros(crc of A, len of B)
+ * xor the crc of B started from 0.
+ */
+static uint32_t otrx_crc32_zeros(uint32_t crc, size_t len) {
+	uint32_t even[32], odd[32];
+	uint32_t row = 1;
+	int n;
+
+	/* operator for one zero bit */
+	odd[0] = 0xedb88320;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+	gf2_matrix_square(even, odd);	/* two bits */
+	gf2_matrix_square(odd, even);	/* four bits */
+
+	while (len) {
+		gf2_matrix_square(even, odd);
+		if (len & 1)
+			crc = gf2_matrix_times(even, crc);
+		len >>= 1;
+		if (!len)
+			break;
+		gf2_matrix_square(odd, even);
+		if (len & 1)
+			crc = gf2_matrix_times(odd, crc);
+		len >>= 1;
+	}
+
+	return crc;
+}
+
+/**************************************************
+ * MTD
+ **************************************************/
+
+/* Returns /dev/mtdN if path isn't a file but the name of an MTD partition */
+static char *otrx_mtd_path(char *path) {
+	static char mtd_path[32];
+	char line[128], dev[16], name[64];
+	FILE *f;
+
+	if (!access(path, F_OK))
+		return path;
+
+	f = fopen("/proc/mtd", "r");
+	if (!f)
+		return path;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%15[^:]: %*x %*x \"%63[^\"]\"", dev, name) == 2 &&
+		    !strcmp(name, path)) {
+			snprintf(mtd_path, sizeof(mtd_path), "/dev/%s", dev);
+			path = mtd_path;
+			break;
+		}
+	}
+	fclose(f);
+
+	return path;
+}
+
 /**************************************************
  * Check
  **************************************************/
@@ -148,12 +271,12 @@ static void otrx_check_parse_options(int argc, char **argv) {
 }
 
 static int otrx_check(int argc, char **argv) {
-	FILE *trx;
 	struct trx_header hdr;
-	size_t bytes, length;
-	uint8_t buf[1024];
+	size_t length, skip;
+	ssize_t bytes;
+	uint8_t *buf;
 	uint32_t crc32;
-	int i;
+	int fd;
 	int err = 0;
 
 	if (argc < 3) {
@@ -161,64 +284,76 @@ static int otrx_check(int argc, char **argv) {
 		err = -EINVAL;
 		goto out;
 	}
-	trx_path = argv[2];
+	trx_path = otrx_mtd_path(argv[2]);
 
 	optind = 3;
 	otrx_check_parse_options(argc, argv);
 
-	trx = fopen(trx_path, "r");
-	if (!trx) {
+	fd = open(trx_path, O_RDONLY);
+	if (fd < 0) {
 		fprintf(stderr, "Couldn't open %s\n", trx_path);
 		err = -EACCES;
 		goto out;
 	}
 
-	fseek(trx, trx_offset, SEEK_SET);
-	bytes = fread(&hdr, 1, sizeof(hdr), trx);
-	if (bytes != sizeof(hdr)) {
+	buf = malloc(OTRX_BUF_SIZE);
+	if (!buf) {
+		fprintf(stderr, "Couldn't alloc %d B buffer\n", OTRX_BUF_SIZE);
+		err = -ENOMEM;
+		goto err_close;
+	}
+
+	/* whole blocks from the TRX start, the header comes with the first */
+	lseek(fd, trx_offset, SEEK_SET);
+	bytes = read(fd, buf, OTRX_BUF_SIZE);
+	if (bytes < (ssize_t)sizeof(hdr)) {
 		fprintf(stderr, "Couldn't read %s header\n", trx_path);
 		err =  -EIO;
-		goto err_close;
+		goto err_free_buf;
 	}
+	memcpy(&hdr, buf, sizeof(hdr));
 
 	if (le32_to_cpu(hdr.magic) != TRX_MAGIC) {
 		fprintf(stderr, "Invalid TRX magic: 0x%08x\n", le32_to_cpu(hdr.magic));
 		err =  -EINVAL;
-		goto err_close;
+		goto err_free_buf;
 	}
 
 	length = le32_to_cpu(hdr.length);
 	if (length < sizeof(hdr)) {
 		fprintf(stderr, "Length read from TRX too low (%zu B)\n", length);
 		err = -EINVAL;
-		goto err_close;
+		goto err_free_buf;
 	}
 
 	crc32 = 0xffffffff;
-	fseek(trx, trx_offset + TRX_FLAGS_OFFSET, SEEK_SET);
+	skip = TRX_FLAGS_OFFSET;
 	length -= TRX_FLAGS_OFFSET;
-	while ((bytes = fread(buf, 1, otrx_min(sizeof(buf), length), trx)) > 0) {
-		for (i = 0; i < bytes; i++)
-			crc32 = crc32_tbl[(crc32 ^ buf[i]) & 0xff] ^ (crc32 >> 8);
+	do {
+		bytes = otrx_min(bytes - skip, length);
+		crc32 = otrx_crc32(crc32, buf + skip, bytes);
 		length -= bytes;
-	}
+		skip = 0;
+	} while (length && (bytes = read(fd, buf, OTRX_BUF_SIZE)) > 0);
 
 	if (length) {
 		fprintf(stderr, "Couldn't read last %zd B of data from %s\n", length, trx_path);
 		err = -EIO;
-		goto err_close;
+		goto err_free_buf;
 	}
 
 	if (crc32 != le32_to_cpu(hdr.crc32)) {
 		fprintf(stderr, "Invalid data crc32: 0x%08x instead of 0x%08x\n", crc32, le32_to_cpu(hdr.crc32));
 		err =  -EINVAL;
-		goto err_close;
+		goto err_free_buf;
 	}
 
 	printf("Found a valid TRX version %d\n", le32_to_cpu(hdr.version));
 
+err_free_buf:
+	free(buf);
 err_close:
-	fclose(trx);
+	close(fd);
 out:
 	return err;
 }
@@ -230,11 +365,14 @@ out:
 static void otrx_create_parse_options(int argc, char **argv) {
 }
 
+/* data_crc32 is the crc of everything after the header, started from 0 */
+static uint32_t data_crc32;
+
 static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
-	uint8_t buf[128];
+	uint8_t *buf;
 
 	in = fopen(in_path, "r");
 	if (!in) {
@@ -242,32 +380,41 @@ static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
 		return -EACCES;
 	}
 
-	while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
+	buf = malloc(OTRX_BUF_SIZE);
+	if (!buf) {
+		fclose(in);
+		return -ENOMEM;
+	}
+
+	while ((bytes = fread(buf, 1, OTRX_BUF_SIZE, in)) > 0) {
 		if (fwrite(buf, 1, bytes, trx) != bytes) {
 			fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, trx_path);
 			length = -EIO;
 			break;
 		}
+		data_crc32 = otrx_crc32(data_crc32, buf, bytes);
 		length += bytes;
 	}
 
+	free(buf);
 	fclose(in);
 
 	return length;
 }
 
 static ssize_t otrx_create_append_zeros(FILE *trx, size_t length) {
-	uint8_t *buf;
-
-	buf = malloc(length);
-	if (!buf)
-		return -ENOMEM;
-	memset(buf, 0, length);
-
-	if (fwrite(buf, 1, length, trx) != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, trx_path);
-		return -EIO;
+	static const uint8_t zeros[4096];
+	size_t bytes, left = length;
+
+	while (left) {
+		bytes = otrx_min(sizeof(zeros), left);
+		if (fwrite(zeros, 1, bytes, trx) != bytes) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, trx_path);
+			return -EIO;
+		}
+		left -= bytes;
 	}
+	data_crc32 = otrx_crc32_zeros(data_crc32, length);
 
 	return length;
 }
@@ -281,37 +428,18 @@ static ssize_t otrx_create_align(FILE *trx, size_t curr_offset, size_t alignment
 	return 0;
 }
 
+/* Patches the header in place, its crc32 covers the data appended so far */
 static int otrx_create_write_hdr(FILE *trx, struct trx_header *hdr) {
 	size_t bytes, length;
-	uint8_t *buf;
 	uint32_t crc32;
 
 	hdr->magic = cpu_to_le32(TRX_MAGIC);
 	hdr->version = 1;
 
-	fseek(trx, 0, SEEK_SET);
-	bytes = fwrite(hdr, 1, sizeof(struct trx_header), trx);
-	if (bytes != sizeof(struct trx_header)) {
-		fprintf(stderr, "Couldn't write TRX header to %s\n", trx_path);
-		return -EIO;
-	}
-
 	length = le32_to_cpu(hdr->length);
-
-	buf = malloc(length);
-	if (!buf) {
-		fprintf(stderr, "Couldn't alloc %zu B buffer\n", length);
-		return -ENOMEM;
-	}
-
-	fseek(trx, 0, SEEK_SET);
-	bytes = fread(buf, 1, length, trx);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
-		return -ENOMEM;
-	}
-
-	crc32 = otrx_crc32(buf + TRX_FLAGS_OFFSET, length - TRX_FLAGS_OFFSET);
+	crc32 = otrx_crc32(0xffffffff, (uint8_t *)hdr + TRX_FLAGS_OFFSET,
+			   sizeof(struct trx_header) - TRX_FLAGS_OFFSET);
+	crc32 = otrx_crc32_zeros(crc32, length - sizeof(struct trx_header)) ^ data_crc32;
 	hdr->crc32 = cpu_to_le32(crc32);
 
 	fseek(trx, 0, SEEK_SET);
@@ -343,13 +471,14 @@ static int otrx_create(int argc, char **argv) {
 	optind = 3;
 	otrx_create_parse_options(argc, argv);
 
-	trx = fopen(trx_path, "w+");
+	trx = fopen(trx_path, "w");
 	if (!trx) {
 		fprintf(stderr, "Couldn't open %s\n", trx_path);
 		err = -EACCES;
 		goto out;
 	}
 	fseek(trx, curr_offset, SEEK_SET);
+	data_crc32 = 0;
 
 	optind = 3;
 	while ((c = getopt(argc, argv, "f:b:")) != -1) {
@@ -428,7 +557,7 @@ static void otrx_extract_parse_options(int argc, char **argv) {
 
 static int otrx_extract_copy(FILE *trx, size_t offset, size_t length, char *out_path) {
 	FILE *out;
-	size_t bytes;
+	size_t bytes, left = length;
 	uint8_t *buf;
 	int err = 0;
 
@@ -439,26 +568,28 @@ static int otrx_extract_copy(FILE *trx, size_t offset, size_t length, char *out_
 		goto out;
 	}
 
-	buf = malloc(length);
+	buf = malloc(OTRX_BUF_SIZE);
 	if (!buf) {
-		fprintf(stderr, "Couldn't alloc %zu B buffer\n", length);
+		fprintf(stderr, "Couldn't alloc %d B buffer\n", OTRX_BUF_SIZE);
 		err =  -ENOMEM;
 		goto err_close;
 	}
 
 	fseek(trx, offset, SEEK_SET);
-	bytes = fread(buf, 1, length, trx);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
-	};
+	while (left) {
+		bytes = fread(buf, 1, otrx_min(OTRX_BUF_SIZE, left), trx);
+		if (!bytes) {
+			fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
+			err =  -EIO;
+			goto err_free_buf;
+		}
 
-	bytes = fwrite(buf, 1, length, out);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
+		if (fwrite(buf, 1, bytes, out) != bytes) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
+			err =  -EIO;
+			goto err_free_buf;
+		}
+		left -= bytes;
 	}
 
 	printf("Extracted 0x%zx bytes into %s\n", length, out_path);
@@ -542,6 +673,7 @@ static void usage() {
 	printf("\n");
 	printf("Checking TRX file:\n");
 	printf("\totrx check <file> [options]\tcheck if file is a valid TRX\n");
+	printf("\t\t\t\t\t<file> can also be the name of an MTD partition\n");
 	printf("\t-o offset\t\t\toffset of TRX data in file (default: 0)\n");
 	printf("\n");
 	printf("Creating new TRX file:\n");
@@ -1655,34 +1655,26 @@ static const int small_prime[] =
       953,  967,  971,  977,  983,  991,  997, -103
 };
 
+#define SMALL_PRIME_COUNT ( sizeof( small_prime ) / sizeof( int ) - 1 )
+
 /*
- * Miller-Rabin primality test  (HAC 4.24)
+ * Trial division by the small primes
+ *
+ * Returns 1 if X is itself one of them, 0 if it has none of them as
+ * a factor and POLARSSL_ERR_MPI_NOT_ACCEPTABLE otherwise.
  */
-int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
+static int mpi_check_small_factors( mpi *X )
 {
-    int ret, i, j, n, s, xs;
-    mpi W, R, T, A, RR;
-    unsigned char *p;
-
-    if( mpi_cmp_int( X, 0 ) == 0 )
-        return( 0 );
-
-    mpi_init( &W, &R, &T, &A, &RR, NULL );
-
-    xs = X->s; X->s = 1;
+    int ret, i;
+    t_int r;
 
-    /*
-     * test trivial factors first
-     */
     if( ( X->p[0] & 1 ) == 0 )
         return( POLARSSL_ERR_MPI_NOT_ACCEPTABLE );
 
     for( i = 0; small_prime[i] > 0; i++ )
     {
-        t_int r;
-
         if( mpi_cmp_int( X, small_prime[i] ) <= 0 )
-            return( 0 );
+            return( 1 );
 
         MPI_CHK( mpi_mod_int( &r, X, small_prime[i] ) );
 
@@ -1690,12 +1682,30 @@ int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
             return( POLARSSL_ERR_MPI_NOT_ACCEPTABLE );
     }
 
+cleanup:
+
+    return( ret );
+}
+
+/*
+ * Miller-Rabin rounds only  (HAC 4.24), X is positive, odd and larger
+ * than the biggest small prime.  RR is set up by the first mpi_exp_mod
+ * and then shared by all the following rounds.
+ */
+static int mpi_miller_rabin( mpi *X, int (*f_rng)(void *), void *p_rng )
+{
+    int ret, i, j, n, s;
+    mpi W, R, T, A, RR;
+    unsigned char *p;
+
+    mpi_init( &W, &R, &T, &A, &RR, NULL );
+
     /*
      * W = |X| - 1
      * R = W >> lsb( W )
      */
-    s = mpi_lsb( &W );
     MPI_CHK( mpi_sub_int( &W, X, 1 ) );
+    s = mpi_lsb( &W );
     MPI_CHK( mpi_copy( &R, &W ) );
     MPI_CHK( mpi_shift_r( &R, s ) );
 
@@ -1759,21 +1769,86 @@ int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
 
 cleanup:
 
+    mpi_free( &RR, &A, &T, &R, &W, NULL );
+
+    return( ret );
+}
+
+/*
+ * Miller-Rabin primality test  (HAC 4.24)
+ */
+int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
+{
+    int ret, xs;
+
+    if( mpi_cmp_int( X, 0 ) == 0 )
+        return( 0 );
+
+    xs = X->s; X->s = 1;
+
+    /*
+     * test trivial factors first
+     */
+    if( ( ret = mpi_check_small_factors( X ) ) == 0 )
+        ret = mpi_miller_rabin( X, f_rng, p_rng );
+    else if( ret == 1 )
+        ret = 0;
+
     X->s = xs;
 
-    mpi_free( &RR, &A, &T, &R, &W, NULL );
+    return( ret );
+}
+
+/*
+ * Residues of X modulo each of the small primes
+ */
+static int mpi_sieve_init( t_int *r, mpi *X )
+{
+    int ret = 0, i;
+
+    for( i = 0; i < (int) SMALL_PRIME_COUNT; i++ )
+        MPI_CHK( mpi_mod_int( &r[i], X, small_prime[i] ) );
+
+cleanup:
 
     return( ret );
 }
 
+/*
+ * Advance the residues by step, returns 0 if none of them ends up zero
+ */
+static int mpi_sieve_step( t_int *r, t_int step )
+{
+    int i, hit = 0;
+
+    for( i = 0; i < (int) SMALL_PRIME_COUNT; i++ )
+    {
+        r[i] += step;
+        while( r[i] >= (t_int) small_prime[i] )
+            r[i] -= small_prime[i];
+
+        hit |= ( r[i] == 0 );
+    }
+
+    return( hit );
+}
+
 /*
  * Prime number generation
+ *
+ * Candidates are walked upwards from a random start, two at a time
+ * (four with dh_flag).  Their residues modulo the small primes are
+ * computed once and then advanced along with the candidate, so trial
+ * division costs a few word additions per step and only the survivors
+ * get to Miller-Rabin.
  */
 int mpi_gen_prime( mpi *X, int nbits, int dh_flag,
                    int (*f_rng)(void *), void *p_rng )
 {
-    int ret, k, n;
+    int ret, k, n, hit;
     unsigned char *p;
+    t_int rx[SMALL_PRIME_COUNT];
+    t_int ry[SMALL_PRIME_COUNT];
     mpi Y;
 
     if( nbits < 3 )
@@ -1796,38 +1871,105 @@ int mpi_gen_prime( mpi *X, int nbits, int dh_flag,
 
     X->p[0] |= 3;
 
+    /*
+     * the sieve cannot tell a small prime from a multiple of one,
+     * so small sizes keep doing full tests on every candidate
+     */
+    if( nbits <= 11 )
+    {
+        if( dh_flag == 0 )
+        {
+            while( ( ret = mpi_is_prime( X, f_rng, p_rng ) ) != 0 )
+            {
+                if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+                    goto cleanup;
+
+                MPI_CHK( mpi_add_int( X, X, 2 ) );
+            }
+        }
+        else
+        {
+            MPI_CHK( mpi_sub_int( &Y, X, 1 ) );
+            MPI_CHK( mpi_shift_r( &Y, 1 ) );
+
+            while( 1 )
+            {
+                if( ( ret = mpi_is_prime( X, f_rng, p_rng ) ) == 0 )
+                {
+                    if( ( ret = mpi_is_prime( &Y, f_rng, p_rng ) ) == 0 )
+                        break;
+
+                    if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+                        goto cleanup;
+                }
+
+                if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+                    goto cleanup;
+
+                MPI_CHK( mpi_add_int( &Y, X, 1 ) );
+                MPI_CHK( mpi_add_int(  X, X, 2 ) );
+                MPI_CHK( mpi_shift_r( &Y, 1 ) );
+            }
+        }
+
+        goto cleanup;
+    }
+
+    MPI_CHK( mpi_sieve_init( rx, X ) );
+    hit = 0;
+    for( k = 0; k < (int) SMALL_PRIME_COUNT; k++ )
+        hit |= ( rx[k] == 0 );
+
     if( dh_flag == 0 )
     {
-        while( ( ret = mpi_is_prime( X, f_rng, p_rng ) ) != 0 )
+        while( 1 )
         {
-            if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
-                goto cleanup;
+            if( !hit )
+            {
+                if( ( ret = mpi_miller_rabin( X, f_rng, p_rng ) ) == 0 )
+                    break;
+
+                if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+                    goto cleanup;
+            }
 
             MPI_CHK( mpi_add_int( X, X, 2 ) );
+            hit = mpi_sieve_step( rx, 2 );
         }
     }
     else
     {
+        /*
+         * X = 3 mod 4 keeps Y = (X - 1) / 2 odd, so X moves by four
+         * and Y by two
+         */
         MPI_CHK( mpi_sub_int( &Y, X, 1 ) );
         MPI_CHK( mpi_shift_r( &Y, 1 ) );
+        MPI_CHK( mpi_sieve_init( ry, &Y ) );
+        for( k = 0; k < (int) SMALL_PRIME_COUNT; k++ )
+            hit |= ( ry[k] == 0 );
 
         while( 1 )
         {
-            if( ( ret = mpi_is_prime( X, f_rng, p_rng ) ) == 0 )
+            if( !hit )
             {
-                if( ( ret = mpi_is_prime( &Y, f_rng, p_rng ) ) == 0 )
-                    break;
+                if( ( ret = mpi_miller_rabin( X, f_rng, p_rng ) ) == 0 )
+                {
+                    if( ( ret = mpi_miller_rabin( &Y, f_rng, p_rng ) ) == 0 )
+                        break;
+
+                    if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+                        goto cleanup;
+                }
 
                 if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
                     goto cleanup;
             }
 
-            if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
-                goto cleanup;
-
-            MPI_CHK( mpi_add_int( &Y, X, 1 ) );
-            MPI_CHK( mpi_add_int(  X, X, 2 ) );
-            MPI_CHK( mpi_shift_r( &Y, 1 ) );
+            MPI_CHK( mpi_add_int( X, X, 4 ) );
+            MPI_CHK( mpi_add_int( &Y, &Y, 2 ) );
+            hit  = mpi_sieve_step( rx, 4 );
+            hit |= mpi_sieve_step( ry, 2 );
         }
     }
 
@@ -57,14 +57,26 @@
 
 /*
  * Uncomment if the compiler supports long long.
-#define POLARSSL_HAVE_LONGLONG
+ *
+ * Only useful when t_dbl really is twice as wide as t_int, i.e. on
+ * 32 bit targets and on 64 bit ones with a 128 bit integer type.
  */
+#if defined(__GNUC__) && \
+    ( __SIZEOF_LONG__ == 4 || defined(__SIZEOF_INT128__) )
+#define POLARSSL_HAVE_LONGLONG
+#endif
 
 
 /*
  * Uncomment to enable the use of assembly code.
+ *
+ * Only turned on for 32 bit MIPS, where multu is much faster than the
+ * generic long long multiply-accumulate.
  */
-/* #define POLARSSL_HAVE_ASM */
+#if defined(__GNUC__) && defined(__mips__) && !defined(__mips16) && \
+    __SIZEOF_LONG__ == 4
+#define POLARSSL_HAVE_ASM
+#endif
 
 /*
  * Uncomment if the CPU supports SSE2 (IA-32 specific).
@@ -59,6 +59,7 @@ typedef struct {
 	struct ifreq ifr;
 	int fd;
 	int et;			/* use private ioctls */
+	int page;		/* page selected last, -1 if unknown */
 } robo_t;
 
 static u16 mdio_read(robo_t *robo, u16 phy_id, u8 reg)
@@ -126,9 +127,12 @@ static int robo_reg(robo_t *robo, u8 page, u8 reg, u8 op)
 {
 	int i = 3;
 	
-	/* set page number */
-	mdio_write(robo, ROBO_PHY_ADDR, REG_MII_PAGE, 
-		(page << 8) | REG_MII_PAGE_ENABLE);
+	/* set page number, unless still selected by the previous access */
+	if (robo->page != page) {
+		mdio_write(robo, ROBO_PHY_ADDR, REG_MII_PAGE, 
+			(page << 8) | REG_MII_PAGE_ENABLE);
+		robo->page = page;
+	}
 	
 	/* set register address */
 	mdio_write(robo, ROBO_PHY_ADDR, REG_MII_ADDR, 
@@ -226,30 +230,37 @@ void usage()
 		"GNU General Public License for more details.\n\n");
 
 	fprintf(stderr, "Usage: robocfg <op> ... <op>\n"
+			"       robocfg -f <file|->\n"
 			"Operations are as below:\n"
 			"\tshow\n"
 			"\tswitch <enable|disable>\n"
 			"\tport <port_number> [state <%s|%s|%s|%s>]\n\t\t[stp %s|%s|%s|%s|%s|%s] [tag <vlan_tag>]\n"
 			"\t\t[media %s|%s|%s|%s|%s] [mdi-x %s|%s|%s]\n"
 			"\tvlan <vlan_number> [ports <ports_list>]\n"
-			"\tvlans <enable|disable|reset>\n\n"
+			"\tvlans <enable|disable|reset|dump>\n\n"
 			"\tports_list should be one argument, space separated, quoted if needed,\n"
 			"\tport number could be followed by 't' to leave packet vlan tagged (CPU \n"
 			"\tport default) or by 'u' to untag packet (other ports default) before \n"
 			"\tbringing it to the port, '*' is ignored\n"
+			"\t-f runs the operations of each line of <file> (or stdin) in turn,\n"
+			"\t'#' starts a comment; 'vlans dump' prints the VLAN table in this form\n"
 			"\nSamples:\n"
 			"1) ASUS WL-500g Deluxe stock config (eth0 is WAN, eth0.1 is LAN):\n"
 			"robocfg switch disable vlans enable reset vlan 0 ports \"0 5u\" vlan 1 ports \"1 2 3 4 5t\""
 			" port 0 state enabled stp none switch enable\n"
 			"2) WRT54g, WL-500g Deluxe OpenWrt config (vlan0 is LAN, vlan1 is WAN):\n"
 			"robocfg switch disable vlans enable reset vlan 0 ports \"1 2 3 4 5t\" vlan 1 ports \"0 5t\""
-			" port 0 state enabled stp none switch enable\n",
+			" port 0 state enabled stp none switch enable\n"
+			"3) Save and restore the VLAN table:\n"
+			"robocfg vlans dump > /tmp/vlans; robocfg -f /tmp/vlans\n",
 			rxtx[0], rxtx[1], rxtx[2], rxtx[3], stp[0], stp[1], stp[2], stp[3], stp[4], stp[5],
 			media[0].name, media[1].name, media[2].name, media[3].name, media[4].name,
 			mdix[0].name, mdix[1].name, mdix[2].name);
 }
 
 static robo_t robo;
+static int robo5350;
+
 int bcm53xx_probe(const char *dev)
 {
 	struct ethtool_drvinfo info;
@@ -259,6 +270,7 @@ int bcm53xx_probe(const char *dev)
 	fprintf(stderr, "probing %s\n", dev);
 
 	strcpy(robo.ifr.ifr_name, dev);
+	robo.page = -1;
 	memset(&info, 0, sizeof(info));
 	info.cmd = ETHTOOL_GDRVINFO;
 	robo.ifr.ifr_data = (caddr_t)&info;
@@ -328,30 +340,64 @@ int bcm53xx_probe(const char *dev)
 	return 0;
 }
 
-int
-main(int argc, char *argv[])
+/* reads VLAN table entry vid as a ports list, returns 0 if not valid */
+static int robo_vlan_ports(int vid, char *buf)
 {
 	u16 val16;
-	u16 mac[3];
-	int i = 0, j;
-	int robo5350 = 0;
-	u32 phyid;
-	
-	if ((robo.fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-		perror("socket");
-		exit(1);
+	u32 val32;
+	int j, untag_shift;
+
+	/* issue read */
+	val16 = (vid) /* vlan */ | (0 << 12) /* read */ | (1 << 13) /* enable */;
+
+	if (robo5350) {
+		robo_write16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_TABLE_ACCESS_5350, val16);
+		/* actual read */
+		val32 = robo_read32(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_READ);
+		if (!(val32 & (1 << 20)) /* valid */)
+			return 0;
+		untag_shift = 6;
+	} else {
+		robo_write16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_TABLE_ACCESS, val16);
+		/* actual read */
+		val32 = robo_read16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_READ);
+		if (!(val32 & (1 << 14)) /* valid */)
+			return 0;
+		untag_shift = 7;
 	}
 
-	if (bcm53xx_probe("eth1")) {
-		if (bcm53xx_probe("eth0")) {
-			perror("bcm53xx_probe");
-			exit(1);
+	*buf = 0;
+	for (j = 0; j < 6; j++) {
+		if (val32 & (1 << j)) {
+			buf += sprintf(buf, " %d%s", j, (val32 & (1 << (j + untag_shift))) ? 
+				(j == 5 ? "u" : "") : "t");
 		}
 	}
+	return 1;
+}
 
-	robo5350 = robo_vlan5350(&robo);
-	
-	for (i = 1; i < argc;) {
+/* prints the VLAN setup as operations for robocfg -f */
+static void robo_dump(void)
+{
+	char buf[32];
+	int i;
+
+	printf("vlans %s\n", robo_read16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_CTRL0) & (1 << 7) ?
+		"enable" : "disable");
+
+	for (i = 0; i <= (robo5350 ? VLAN_ID_MAX5350 : VLAN_ID_MAX); i++) {
+		if (robo_vlan_ports(i, buf))
+			printf("vlan %d ports \"%s\"\n", i, buf + 1);
+	}
+}
+
+/* runs the operations in argv, returns 1 when they end with show */
+static int robo_ops(int argc, char *argv[])
+{
+	u16 val16;
+	int i, j;
+
+	for (i = 0; i < argc;) {
 		if (strcasecmp(argv[i], "port") == 0 && (i + 1) < argc)
 		{
 			int index = atoi(argv[++i]);
@@ -478,6 +524,9 @@ main(int argc, char *argv[])
 						}
 					}
 				} else 
+				if (strcasecmp(argv[i], "dump") == 0) {
+					robo_dump();
+				} else 
 				if (strcasecmp(argv[i], "enable") == 0 || strcasecmp(argv[i], "disable") == 0) 
 				{
 					int disable = (*argv[i] == 'd') || (*argv[i] == 'D');
@@ -499,7 +548,7 @@ main(int argc, char *argv[])
 		} else
 		if (strcasecmp(argv[i], "show") == 0)
 		{
-			break;
+			return 1;
 		} else {
 			fprintf(stderr, "Invalid option %s\n", argv[i]);
 			usage();
@@ -507,13 +556,16 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (i == argc) {
-		if (argc == 1) usage();
-		return 0;
-	}
-	
-	/* show config */
-		
+	return 0;
+}
+
+static void robo_show(void)
+{
+	u16 val16;
+	u16 mac[3];
+	char buf[32];
+	int i;
+
 	printf("Switch: %sabled\n", robo_read16(&robo, ROBO_CTRL_PAGE, ROBO_SWITCH_MODE) & 2 ? "en" : "dis");
 
 	for (i = 0; i < 6; i++) {
@@ -543,40 +595,89 @@ main(int argc, char *argv[])
 	
 	/* scan VLANs */
 	for (i = 0; i <= (robo5350 ? VLAN_ID_MAX5350 : VLAN_ID_MAX); i++) {
-		/* issue read */
-		val16 = (i) /* vlan */ | (0 << 12) /* read */ | (1 << 13) /* enable */;
-		
-		if (robo5350) {
-			u32 val32;
-			robo_write16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_TABLE_ACCESS_5350, val16);
-			/* actual read */
-			val32 = robo_read32(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_READ);
-			if ((val32 & (1 << 20)) /* valid */) {
-				printf("vlan%d:", i);
-				for (j = 0; j < 6; j++) {
-					if (val32 & (1 << j)) {
-						printf(" %d%s", j, (val32 & (1 << (j + 6))) ? 
-							(j == 5 ? "u" : "") : "t");
-					}
-				}
-				printf("\n");
-			}
+		if (robo_vlan_ports(i, buf))
+			printf("vlan%d:%s\n", i, buf);
+	}
+}
+
+/* splits line into arguments at blanks, quotes keep blanks in one */
+static int robo_split(char *line, char *argv[], int max)
+{
+	int argc = 0;
+	char *p = line;
+
+	while (argc < max) {
+		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+			p++;
+		if (*p == 0 || *p == '#')
+			break;
+		if (*p == '"') {
+			argv[argc++] = ++p;
+			while (*p && *p != '"')
+				p++;
 		} else {
-			robo_write16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_TABLE_ACCESS, val16);
-			/* actual read */
-			val16 = robo_read16(&robo, ROBO_VLAN_PAGE, ROBO_VLAN_READ);
-			if ((val16 & (1 << 14)) /* valid */) {
-				printf("vlan%d:", i);
-				for (j = 0; j < 6; j++) {
-					if (val16 & (1 << j)) {
-						printf(" %d%s", j, (val16 & (1 << (j + 7))) ? 
-							(j == 5 ? "u" : "") : "t");
-					}
-				}
-				printf("\n");
-			}
+			argv[argc++] = p;
+			while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+				p++;
 		}
+		if (*p == 0)
+			break;
+		*p++ = 0;
 	}
+
+	return argc;
+}
+
+/* runs the operations of each line of file, in one process so that the
+ * switch is probed once and the page selection is kept between them */
+static void robo_batch(const char *file)
+{
+	FILE *f = stdin;
+	char line[512];
+	char *args[64];
+	int n;
+
+	if (strcmp(file, "-") && !(f = fopen(file, "r"))) {
+		perror(file);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		n = robo_split(line, args, 64);
+		if (n && robo_ops(n, args))
+			robo_show();
+	}
+
+	if (f != stdin)
+		fclose(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if ((robo.fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	if (bcm53xx_probe("eth1")) {
+		if (bcm53xx_probe("eth0")) {
+			perror("bcm53xx_probe");
+			exit(1);
+		}
+	}
+
+	robo5350 = robo_vlan5350(&robo);
+
+	if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+		robo_batch(argv[2]);
+		return 0;
+	}
+
+	if (robo_ops(argc - 1, argv + 1))
+		robo_show();
+	else if (argc == 1)
+		usage();
 	
 	return (0);
 }
@@ -72,6 +72,12 @@ enum {
 	S_DEF_COUNT
 };
 
+/* reverse dependency edge: 'sym' has to be recalculated when the owner changes */
+struct symbol_user {
+	struct symbol_user *next;
+	struct symbol *sym;
+};
+
 struct symbol {
 	struct symbol *next;
 	char *name;
@@ -83,6 +89,7 @@ struct symbol {
 	struct property *prop;
 	struct expr_value dir_dep;
 	struct expr_value rev_dep;
+	struct symbol_user *users;
 };
 
 #define for_all_symbols(i, sym) for (i = 0; i < SYMBOL_HASHSIZE; i++) for (sym = symbol_hash[i]; sym; sym = sym->next) if (sym->type != S_OTHER)
@@ -91,6 +98,7 @@ struct symbol {
 #define SYMBOL_CHECK      0x0008  /* used during dependency checking */
 #define SYMBOL_CHOICE     0x0010  /* start of a choice block (null name) */
 #define SYMBOL_CHOICEVAL  0x0020  /* used as a value in a choice block */
+#define SYMBOL_QUEUED     0x0040  /* queued by sym_invalidate() */
 #define SYMBOL_VALID      0x0080  /* set when symbol.curr is calculated */
 #define SYMBOL_OPTIONAL   0x0100  /* choice is optional - values can be 'n' */
 #define SYMBOL_WRITE      0x0200  /* write symbol to file (KCONFIG_CONFIG) */
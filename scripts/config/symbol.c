@@ -451,6 +451,126 @@ void sym_clear_all_valid(void)
 		sym_calc_value(modules_sym);
 }
 
+static bool sym_users_valid;
+
+static void sym_add_user(struct symbol *sym, struct symbol *user)
+{
+	struct symbol_user *u;
+
+	if (!sym || sym == user || sym->flags & SYMBOL_CONST)
+		return;
+	/* properties of one symbol tend to reference the same symbols */
+	if (sym->users && sym->users->sym == user)
+		return;
+	u = xmalloc(sizeof(*u));
+	u->sym = user;
+	u->next = sym->users;
+	sym->users = u;
+}
+
+static void sym_add_expr_users(struct expr *e, struct symbol *user)
+{
+	if (!e)
+		return;
+	switch (e->type) {
+	case E_OR:
+	case E_AND:
+		sym_add_expr_users(e->left.expr, user);
+		sym_add_expr_users(e->right.expr, user);
+		break;
+	case E_NOT:
+		sym_add_expr_users(e->left.expr, user);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_RANGE:
+		sym_add_user(e->left.sym, user);
+		sym_add_user(e->right.sym, user);
+		break;
+	case E_SYMBOL:
+		sym_add_user(e->left.sym, user);
+		break;
+	case E_LIST:
+		sym_add_user(e->right.sym, user);
+		sym_add_expr_users(e->left.expr, user);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Record for every symbol which other symbols reference it from their
+ * dependencies, selects, defaults, ranges and choice lists.  The graph is
+ * built once, after the whole tree has been parsed.
+ */
+static void sym_calc_users(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	for_all_symbols(i, sym) {
+		sym_add_expr_users(sym->dir_dep.expr, sym);
+		sym_add_expr_users(sym->rev_dep.expr, sym);
+		for (prop = sym->prop; prop; prop = prop->next) {
+			sym_add_expr_users(prop->expr, sym);
+			sym_add_expr_users(prop->visible.expr, sym);
+		}
+	}
+	sym_users_valid = true;
+}
+
+/*
+ * Invalidate sym and everything that (transitively) depends on it, instead
+ * of throwing away every calculated value in the tree like
+ * sym_clear_all_valid() does.
+ */
+static struct symbol **inval_queue;
+static int inval_queue_len, inval_queue_size;
+
+static void sym_queue_invalid(struct symbol *sym)
+{
+	if (sym->flags & SYMBOL_QUEUED)
+		return;
+	if (inval_queue_len == inval_queue_size) {
+		inval_queue_size = inval_queue_size ? inval_queue_size * 2 : 256;
+		inval_queue = xrealloc(inval_queue,
+				       inval_queue_size * sizeof(*inval_queue));
+	}
+	sym->flags |= SYMBOL_QUEUED;
+	inval_queue[inval_queue_len++] = sym;
+}
+
+static void sym_invalidate(struct symbol *sym)
+{
+	struct symbol_user *u;
+	int i;
+
+	if (sym == modules_sym) {
+		/* every tristate depends on modules_val */
+		sym_clear_all_valid();
+		return;
+	}
+	if (!sym_users_valid)
+		sym_calc_users();
+
+	inval_queue_len = 0;
+	sym_queue_invalid(sym);
+	for (i = 0; i < inval_queue_len; i++) {
+		sym = inval_queue[i];
+		sym->flags &= ~SYMBOL_VALID;
+		for (u = sym->users; u; u = u->next)
+			sym_queue_invalid(u->sym);
+	}
+	for (i = 0; i < inval_queue_len; i++)
+		inval_queue[i]->flags &= ~SYMBOL_QUEUED;
+
+	sym_add_change_count(1);
+	if (modules_sym)
+		sym_calc_value(modules_sym);
+}
+
 void sym_set_changed(struct symbol *sym)
 {
 	struct property *prop;
@@ -520,8 +640,11 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 	}
 
 	sym->def[S_DEF_USER].tri = val;
-	if (oldval != val)
-		sym_clear_all_valid();
+	if (oldval != val) {
+		sym_invalidate(sym);
+		if (sym_is_choice_value(sym))
+			sym_invalidate(prop_get_symbol(sym_get_choice_prop(sym)));
+	}
 
 	return true;
 }
@@ -678,7 +801,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_invalidate(sym);
 
 	return true;
 }
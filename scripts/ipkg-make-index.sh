@@ -8,17 +8,21 @@ if [ -z $pkg_dir ] || [ ! -d $pkg_dir ]; then
 	exit 1
 fi
 
-which md5sum >/dev/null 2>&1 || alias md5sum=md5
-empty=1
+# Stanzas are cached per package, keyed by path, size and mtime, so only
+# new or changed packages have to be unpacked and hashed again.
+cache_dir=${IPKG_INDEX_CACHE:-$pkg_dir/.ipkg-index-cache}
+jobs=${IPKG_INDEX_JOBS:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+
+if ! which md5sum >/dev/null 2>&1; then
+	md5sum() { md5 "$@"; }
+	export -f md5sum
+fi
+
+make_stanza() {
+	local pkg=$1 key=$2 file_size=$3
+	local md5sum sha256sum sed_safe_pkg
 
-for pkg in `find $pkg_dir -name '*.ipk' | sort`; do
-	empty=
-	name="${pkg##*/}"
-	name="${name%%_*}"
-	[[ "$name" = "kernel" ]] && continue
-	[[ "$name" = "libc" ]] && continue
 	echo "Generating index for package $pkg" >&2
-	file_size=$(ls -l $pkg | awk '{print $5}')
 	md5sum=$(md5sum $pkg | awk '{print $1}')
 	sha256sum=$(openssl dgst -sha256 $pkg | awk '{print $2}')
 	# Take pains to make variable value sed-safe
@@ -27,8 +31,40 @@ for pkg in `find $pkg_dir -name '*.ipk' | sort`; do
 Size: $file_size\\
 MD5Sum: $md5sum\\
 SHA256sum: $sha256sum\\
-Description:/"
-	echo ""
-done
-[ -n "$empty" ] && echo
+Description:/" > "$cache_dir/$key.tmp"
+	echo "" >> "$cache_dir/$key.tmp"
+	mv "$cache_dir/$key.tmp" "$cache_dir/$key"
+}
+export -f make_stanza
+export cache_dir
+
+mkdir -p "$cache_dir"
+rm -f "$cache_dir"/*.tmp
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+find $pkg_dir -name '*.ipk' | sort | xargs -r stat -c '%n %s %Y' > "$tmp/list"
+
+: > "$tmp/keys"
+: > "$tmp/todo"
+while read pkg file_size mtime; do
+	name="${pkg##*/}"
+	name="${name%%_*}"
+	[[ "$name" = "kernel" ]] && continue
+	[[ "$name" = "libc" ]] && continue
+	key="${pkg#./}"
+	key="${key//\//%}.$file_size.$mtime"
+	echo "$key" >> "$tmp/keys"
+	[ -f "$cache_dir/$key" ] || echo "$pkg $key $file_size" >> "$tmp/todo"
+done < "$tmp/list"
+
+xargs -r -n 3 -P "$jobs" bash -c 'make_stanza "$@"' _ < "$tmp/todo"
+
+# drop stanzas of packages which were removed or replaced
+(cd "$cache_dir" && ls) | sort > "$tmp/cached"
+sort "$tmp/keys" | comm -23 "$tmp/cached" - | (cd "$cache_dir" && xargs -r rm -f)
+
+(cd "$cache_dir" && xargs -r cat) < "$tmp/keys"
+[ -s "$tmp/list" ] || echo
 exit 0
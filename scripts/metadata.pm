@@ -121,6 +121,60 @@ sub clear_packages() {
 	%overrides = ();
 }
 
+# Parsed package metadata is kept next to the source file in Storable
+# format, keyed by a digest of its contents, so that repeated runs on an
+# unchanged file can skip the text parser.
+my $package_cache_version = 1;
+
+sub package_cache_digest($) {
+	my $file = shift;
+
+	eval { require Storable; require Digest::MD5; 1 } or return undef;
+	open my $fh, "<", $file or return undef;
+	binmode $fh;
+	my $digest = Digest::MD5->new->addfile($fh)->hexdigest;
+	close $fh;
+
+	return "$package_cache_version:$digest";
+}
+
+sub load_package_cache($$) {
+	my $file = shift;
+	my $digest = shift;
+
+	my $cache = eval { Storable::retrieve("$file.storable") };
+	$cache and $cache->{digest} and $cache->{digest} eq $digest or return undef;
+
+	%subdir = %{$cache->{subdir}};
+	%preconfig = %{$cache->{preconfig}};
+	%package = %{$cache->{package}};
+	%srcpackage = %{$cache->{srcpackage}};
+	%category = %{$cache->{category}};
+	%features = %{$cache->{features}};
+	%overrides = %{$cache->{overrides}};
+	return 1;
+}
+
+sub store_package_cache($$) {
+	my $file = shift;
+	my $digest = shift;
+	my $tmp = "$file.storable.$$";
+
+	eval {
+		Storable::nstore({
+			digest => $digest,
+			subdir => \%subdir,
+			preconfig => \%preconfig,
+			package => \%package,
+			srcpackage => \%srcpackage,
+			category => \%category,
+			features => \%features,
+			overrides => \%overrides,
+		}, $tmp) and rename($tmp, "$file.storable");
+	};
+	unlink $tmp;
+}
+
 sub parse_package_metadata($) {
 	my $file = shift;
 	my $pkg;
@@ -130,6 +184,13 @@ sub parse_package_metadata($) {
 	my $subdir;
 	my $src;
 	my $override;
+	my $digest;
+
+	# the cache only holds a single file, not data merged from several
+	if (!%package and !%srcpackage) {
+		$digest = package_cache_digest($file);
+		$digest and load_package_cache($file, $digest) and return 1;
+	}
 
 	open FILE, "<$file" or do {
 		warn "Cannot open '$file': $!\n";
@@ -253,6 +314,7 @@ sub parse_package_metadata($) {
 		/^Preconfig-Default:\s*(.*?)\s*$/ and $preconfig->{default} = $1;
 	}
 	close FILE;
+	$digest and store_package_cache($file, $digest);
 	return 1;
 }
 
@@ -0,0 +1,204 @@
+#!/usr/bin/env perl
+#
+# Copyright (C) 2015 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Build scheduling helper. include/subdir.mk appends one line per finished
+# build step to the build time log:
+#
+#   <subdir>/<builddir>[/<buildtype>] <start> <end>
+#
+# and include/toplevel.mk starts a new session in it for every build.
+#
+#   session <log>                 start a new session, drop old records
+#   order <packagedeps> <log>     print the package build order for make
+#   report <log> [<jobs>]         print job slot usage of the last session
+#
+
+use strict;
+
+my $KEEP_RECORDS = 3;
+
+sub parse_log($) {
+	my $file = shift;
+	my @session;
+	my %times;
+
+	open LOG, "<$file" or return ({}, []);
+	while (<LOG>) {
+		chomp;
+		if (/^session\s+\d+$/) {
+			@session = ();
+		} elsif (/^(\S+)\s+(\d+)\s+(\d+)$/) {
+			push @{$times{$1}}, $3 - $2;
+			push @session, [ $1, $2, $3 ];
+		}
+	}
+	close LOG;
+	return (\%times, \@session);
+}
+
+sub cmd_session($) {
+	my $file = shift;
+	my ($times) = parse_log($file);
+
+	open LOG, ">$file.new" or die "Cannot write $file.new: $!\n";
+	foreach my $step (sort keys %$times) {
+		my @t = @{$times->{$step}};
+		splice @t, 0, @t - $KEEP_RECORDS if @t > $KEEP_RECORDS;
+		print LOG "$step 0 $_\n" foreach @t;
+	}
+	print LOG "session ".time()."\n";
+	close LOG;
+	rename "$file.new", $file or die "Cannot replace $file: $!\n";
+}
+
+sub cmd_order($$) {
+	my $depfile = shift;
+	my ($times) = parse_log(shift);
+	my %deps;
+	my %cost;
+	my %weight;
+	my %rdeps;
+	my $default = 0;
+
+	open DEPS, "<$depfile" or die "Cannot open $depfile: $!\n";
+	while (<DEPS>) {
+		if (/^package-\S*\s*\+=\s*(\S+)/) {
+			$deps{$1} ||= {};
+		} elsif (/^\$\(curdir\)\/(\S+)\/compile\s*\+=\s*(.*)$/) {
+			my $pkg = $1;
+			my $line = $2;
+			while ($line =~ /\$\(curdir\)\/([^\s\)]+)\/compile/g) {
+				$deps{$pkg}->{$1} = 1;
+			}
+		}
+	}
+	close DEPS;
+
+	# Fold build types (package/host) into their source directory,
+	# conditional dependencies are all taken as real ones
+	foreach my $pkg (keys %deps) {
+		(my $dir = $pkg) =~ s/\/[^\/]+$//;
+		next unless $dir ne $pkg and exists $deps{$dir};
+		$deps{$dir}->{$_} = 1 foreach keys %{$deps{$pkg}};
+		delete $deps{$pkg};
+	}
+	foreach my $pkg (keys %deps) {
+		foreach my $dep (keys %{$deps{$pkg}}) {
+			(my $dir = $dep) =~ s/\/[^\/]+$//;
+			$dep = $dir unless exists $deps{$dep};
+			next if $dep eq $pkg or not exists $deps{$dep};
+			$rdeps{$dep}->{$pkg} = 1;
+		}
+	}
+
+	# Average of the last recorded builds of all build types
+	foreach my $step (keys %$times) {
+		next unless $step =~ /^package\/(.+)$/;
+		my $pkg = $1;
+		my @t = @{$times->{$step}};
+		my $sum = 0;
+		$sum += $_ foreach @t;
+		$pkg =~ s/\/[^\/]+$// unless exists $deps{$pkg};
+		next unless exists $deps{$pkg};
+		$cost{$pkg} += $sum / @t;
+	}
+	if (keys %cost > 0) {
+		my @c = sort { $a <=> $b } values %cost;
+		$default = $c[@c / 2];
+	}
+	$default = 1 if $default < 1;
+
+	# Weight of a package is the length of the longest chain of builds
+	# that cannot start before it is done
+	my $weight;
+	$weight = sub {
+		my $pkg = shift;
+		return $weight{$pkg} if defined $weight{$pkg};
+		$weight{$pkg} = 0;
+		my $max = 0;
+		foreach my $rdep (keys %{$rdeps{$pkg}}) {
+			my $w = &$weight($rdep);
+			$max = $w if $w > $max;
+		}
+		$weight{$pkg} = (defined $cost{$pkg} ? $cost{$pkg} : $default) + $max;
+		return $weight{$pkg};
+	};
+	&$weight($_) foreach keys %deps;
+
+	my @order = sort { $weight{$b} <=> $weight{$a} or $a cmp $b } keys %deps;
+	print "package-order := ".join(" ", @order)."\n";
+}
+
+sub cmd_report($$) {
+	my ($times, $session) = parse_log(shift);
+	my $jobs = shift;
+	my @events;
+	my ($first, $last);
+	my $busy = 0;
+
+	@$session > 0 or return;
+	foreach my $rec (@$session) {
+		my ($step, $start, $end) = @$rec;
+		push @events, [ $start, 1 ], [ $end, -1 ];
+		$first = $start if not defined $first or $start < $first;
+		$last = $end if not defined $last or $end > $last;
+		$busy += $end - $start;
+	}
+	@events = sort { $a->[0] <=> $b->[0] or $a->[1] <=> $b->[1] } @events;
+
+	my $running = 0;
+	my $peak = 0;
+	my $prev = $first;
+	my @usage;
+	foreach my $ev (@events) {
+		push @usage, [ $ev->[0] - $prev, $running ] if $ev->[0] > $prev;
+		$prev = $ev->[0];
+		$running += $ev->[1];
+		$peak = $running if $running > $peak;
+	}
+	$jobs = $peak unless $jobs and $jobs > 0;
+
+	my $wall = $last - $first;
+	my $idle = 0;
+	my $tail = 0;
+	foreach my $u (@usage) {
+		$idle += $u->[0] * ($jobs - $u->[1]) if $u->[1] < $jobs;
+	}
+	foreach my $u (reverse @usage) {
+		last if $u->[1] >= $jobs;
+		$tail += $u->[0];
+	}
+
+	printf "Build schedule: %d steps, %ds wall time, %d jobs\n",
+		scalar(@$session), $wall, $jobs;
+	printf "  busy %ds, idle %ds of job slot time (%d%% used)\n",
+		$busy, $idle, $wall ? 100 * $busy / ($wall * $jobs) : 100;
+	printf "  last %ds ran with free job slots\n", $tail;
+
+	my @longest = sort { ($b->[2] - $b->[1]) <=> ($a->[2] - $a->[1]) } @$session;
+	splice @longest, 5 if @longest > 5;
+	foreach my $rec (@longest) {
+		printf "  %6ds %s\n", $rec->[2] - $rec->[1], $rec->[0];
+	}
+}
+
+my $cmd = shift @ARGV;
+if ($cmd eq "session" and @ARGV == 1) {
+	cmd_session($ARGV[0]);
+} elsif ($cmd eq "order" and @ARGV == 2) {
+	cmd_order($ARGV[0], $ARGV[1]);
+} elsif ($cmd eq "report" and @ARGV >= 1) {
+	cmd_report($ARGV[0], $ARGV[1]);
+} else {
+	print <<EOF
+Usage: $0 session <log>
+       $0 order <packagedeps> <log>
+       $0 report <log> [<jobs>]
+EOF
+	;
+	exit 1;
+}
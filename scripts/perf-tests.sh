@@ -0,0 +1,133 @@
+#!/usr/bin/env bash
+#
+# Copyright (C) 2015 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Runs the microbenchmarks staged by packages with CONFIG_PERF_TESTS, see
+# 'make perf-tests'. Each benchmark prints "<name>\t<value>\t<unit>" lines,
+# which are collected as "<bench>\t<name>\t<value>\t<unit>".
+#
+#   run <dir> <results>       run all benchmarks in <dir>
+#   compare <old> <new>       print the changes between two result files
+#
+# run uses qemu user emulation of $ARCH with the libraries of $TOOLCHAIN_DIR
+# and $STAGING_DIR, or the device $PERF_HOST (user@host) over ssh when set.
+# Benchmarks get -s (scratch) under qemu only: they may then create the
+# state they measure, on a device they only use what is there.
+#
+
+export LANG=C
+export LC_ALL=C
+
+THRESHOLD="${PERF_THRESHOLD:-10}"
+
+die() {
+	echo "$@" >&2
+	exit 1
+}
+
+find_qemu() {
+	local arch="$ARCH"
+
+	case "$arch" in
+		powerpc) arch=ppc;;
+		i486|i586|i686) arch=i386;;
+	esac
+	for q in "$STAGING_DIR_HOST/bin/qemu-$arch" "$(which "qemu-$arch" 2>/dev/null)"; do
+		[ -x "$q" ] && { echo "$q"; return 0; }
+	done
+	return 1
+}
+
+run_qemu() {
+	"$QEMU" -L "$TOOLCHAIN_DIR" \
+		-E "LD_LIBRARY_PATH=$STAGING_DIR/usr/lib:$STAGING_DIR/lib" \
+		"$1" -s
+}
+
+run_device() {
+	local name="$(basename "$1")"
+
+	scp -q "$1" "$PERF_HOST:/tmp/$name" >&2 || return 1
+	ssh "$PERF_HOST" "/tmp/$name; ret=\$?; rm -f /tmp/$name; exit \$ret"
+}
+
+cmd_run() {
+	local dir="$1"
+	local results="$2"
+	local mode runner failed=0
+
+	[ -d "$dir" ] || die "No benchmarks in $dir, enable CONFIG_PERF_TESTS and rebuild"
+
+	if [ -n "$PERF_HOST" ]; then
+		mode="device $PERF_HOST"
+		runner=run_device
+	else
+		QEMU="$(find_qemu)" || die "No qemu-$ARCH found, install qemu user emulation or set PERF_HOST"
+		mode="qemu $QEMU"
+		runner=run_qemu
+	fi
+
+	mkdir -p "$(dirname "$results")"
+	[ -f "$results" ] && mv "$results" "$results.old"
+	{
+		echo "# date: $(date -u +%Y-%m-%dT%H:%M:%SZ)"
+		echo "# revision: $("${0%/*}/getver.sh" 2>/dev/null)"
+		echo "# arch: $ARCH"
+		echo "# mode: $mode"
+	} > "$results.tmp"
+
+	for bench in "$dir"/*; do
+		[ -x "$bench" ] || continue
+		echo "Running $(basename "$bench")" >&2
+		$runner "$bench" > "$results.out" || {
+			echo "$(basename "$bench") failed" >&2
+			failed=1
+		}
+		awk -F '\t' -v bench="$(basename "$bench")" \
+			'NF == 3 && $2 ~ /^[0-9.]+$/ { print bench "\t" $0 }' \
+			"$results.out" >> "$results.tmp"
+	done
+	rm -f "$results.out"
+	mv "$results.tmp" "$results"
+	echo "Results written to $results" >&2
+
+	[ -f "$results.old" ] && cmd_compare "$results.old" "$results"
+	return $failed
+}
+
+# Time per operation is better when lower, rates are better when higher
+cmd_compare() {
+	awk -F '\t' -v threshold="$THRESHOLD" '
+		/^#/ { next }
+		FNR == NR { old[$1 "\t" $2] = $3; next }
+		{
+			key = $1 "\t" $2
+			if (!(key in old) || old[key] == 0) {
+				printf "  %-40s %12s %s (new)\n", $1 "/" $2, $3, $4
+				next
+			}
+			change = ($3 - old[key]) * 100 / old[key]
+			worse = ($4 ~ /^ns\/|^us\/|^ms\//) ? change : -change
+			flag = worse > threshold ? "  REGRESSION" : (worse < -threshold ? "  improved" : "")
+			printf "  %-40s %12s %s %+6.1f%%%s\n", $1 "/" $2, $3, $4, change, flag
+		}
+	' "$1" "$2"
+}
+
+case "$1" in
+	run)
+		[ $# -eq 3 ] || die "Usage: $0 run <dir> <results>"
+		cmd_run "$2" "$3"
+		;;
+	compare)
+		[ $# -eq 3 ] || die "Usage: $0 compare <old> <new>"
+		cmd_compare "$2" "$3"
+		;;
+	*)
+		die "Usage: $0 run <dir> <results>
+       $0 compare <old> <new>"
+		;;
+esac
@@ -1,10 +1,19 @@
 #!/usr/bin/env bash
-# 
+#
 # Copyright (C) 2006 OpenWrt.org
 #
 # This is free software, licensed under the GNU General Public License v2.
 # See /LICENSE for more information.
 #
+# The files are classified with one run of file(1), and stripped with one
+# run of $STRIP for all programs and libraries and one of $STRIP_KMOD for
+# all kernel modules.
+#
+# With STRIP_CACHE set, the stripped result of each file is kept there under
+# the md5 of the original, in a directory per strip configuration. A file
+# seen before (the same package rebuilt, or the same binary in another
+# image) is then copied from there instead of stripped again.
+#
 SELF=${0##*/}
 
 [ -z "$STRIP" ] && {
@@ -20,16 +29,38 @@ TARGETS=$*
   exit 1
 }
 
-find $TARGETS -type f -a -exec file {} \; | \
-  sed -n -e 's/^\(.*\):.*ELF.*\(executable\|relocatable\|shared object\).*,.* stripped/\1:\2/p' | \
+WORK="$(mktemp -d)" || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+CACHE=
+[ -n "$STRIP_CACHE" ] && {
+  CACHE="$STRIP_CACHE/$(echo "$STRIP|$STRIP_KMOD|$CROSS|$NO_RENAME|$KEEP_SYMBOLS" | md5sum | cut -c1-8)"
+  mkdir -p "$CACHE" || CACHE=
+}
+
+find $TARGETS -type f -print0 | xargs -0 -r file | \
+  sed -n -e 's/^\(.*\):.*ELF.*\(executable\|relocatable\|shared object\).*,.* stripped/\1:\2/p' \
+  > "$WORK/files"
+
+if [ -n "$CACHE" ]; then
+  cut -d: -f1 "$WORK/files" | tr '\n' '\0' | xargs -0 -r md5sum | cut -d' ' -f1 > "$WORK/sums"
+else
+  sed -e 's/.*/-/' "$WORK/files" > "$WORK/sums"
+fi
+
+touch "$WORK/kmods" "$WORK/bins" "$WORK/new"
 (
   IFS=":"
-  while read F S; do
+  while read F S && read SUM <&3; do
+    [ -n "$CACHE" ] && [ -f "$CACHE/$SUM" ] && {
+      echo "$SELF: $F: $S (cached)"
+      cat "$CACHE/$SUM" > "$F"
+      continue
+    }
     echo "$SELF: $F: $S"
 	[ "${S}" = "relocatable" ] && {
-		eval "$STRIP_KMOD $F"
+		printf '%s\0' "$F" >> "$WORK/kmods"
 	} || {
-		b=$(stat -c '%a' $F)
 		[ -z "$PATCHELF" ] || [ -z "$TOPDIR" ] || {
 			old_rpath="$($PATCHELF --print-rpath $F)"; new_rpath=""
 			for path in $old_rpath; do
@@ -40,10 +71,35 @@ find $TARGETS -type f -a -exec file {} \; | \
 			done
 			[ "$new_rpath" = "$old_rpath" ] || $PATCHELF --set-rpath "$new_rpath" $F
 		}
-		eval "$STRIP $F"
-		a=$(stat -c '%a' $F)
-		[ "$a" = "$b" ] || chmod $b $F
+		printf '%s\0' "$F" >> "$WORK/bins"
 	}
+    [ -z "$CACHE" ] || echo "$SUM:$F" >> "$WORK/new"
   done
   true
+) < "$WORK/files" 3< "$WORK/sums"
+
+FAILED=
+eval "xargs -0 -r $STRIP_KMOD" < "$WORK/kmods" || FAILED=1
+
+# strip must not change the permissions
+xargs -0 -r stat -c '%a:%n' < "$WORK/bins" > "$WORK/modes"
+eval "xargs -0 -r $STRIP" < "$WORK/bins" || FAILED=1
+xargs -0 -r stat -c '%a:%n' < "$WORK/bins" | diff - "$WORK/modes" | \
+  sed -n -e 's/^> \([0-7]*\):\(.*\)$/\1:\2/p' | \
+(
+  IFS=":"
+  while read b F; do
+    chmod $b "$F"
+  done
 )
+
+# only results of a clean run are kept, renamed into place as parallel
+# builds share the cache
+[ -z "$FAILED" ] && (
+  IFS=":"
+  while read SUM F; do
+    cp "$F" "$CACHE/$SUM.$$" && mv "$CACHE/$SUM.$$" "$CACHE/$SUM"
+  done
+  true
+) < "$WORK/new"
+true
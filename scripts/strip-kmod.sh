@@ -4,10 +4,8 @@
 	exit 1
 }
 
-MODULE="$1"
-
-[ "$#" -ne 1 ] && {
-	echo "Usage: $0 <module>"
+[ "$#" -lt 1 ] && {
+	echo "Usage: $0 <module> [<module>...]"
 	exit 1
 }
 
@@ -18,33 +16,44 @@ else
 	ARGS="-x -G __this_module --strip-unneeded"
 fi
 
-${CROSS}objcopy \
-	-R .comment \
-	-R .pdr \
-	-R .mdebug.abi32 \
-	-R .note.gnu.build-id \
-	-R .gnu.attributes \
-	-R .reginfo \
-	$ARGS \
-	"$MODULE" "$MODULE.tmp"
-
-[ -n "$NO_RENAME" ] && {
-	mv "${MODULE}.tmp" "$MODULE"
-	exit 0
-}
-
-${CROSS}nm "$MODULE.tmp" | awk '
-BEGIN {
-	n = 0
-}
-
-$3 && $2 ~ /[brtd]/ && $3 !~ /\$LC/ && !def[$3] {
-	print "--redefine-sym "$3"=_"n;
-	n = n + 1
-	def[$3] = 1
+strip_module() {
+	local MODULE="$1"
+
+	${CROSS}objcopy \
+		-R .comment \
+		-R .pdr \
+		-R .mdebug.abi32 \
+		-R .note.gnu.build-id \
+		-R .gnu.attributes \
+		-R .reginfo \
+		$ARGS \
+		"$MODULE" "$MODULE.tmp" || return 1
+
+	[ -n "$NO_RENAME" ] && {
+		mv "${MODULE}.tmp" "$MODULE"
+		return 0
+	}
+
+	${CROSS}nm "$MODULE.tmp" | awk '
+	BEGIN {
+		n = 0
+	}
+
+	$3 && $2 ~ /[brtd]/ && $3 !~ /\$LC/ && !def[$3] {
+		print "--redefine-sym "$3"=_"n;
+		n = n + 1
+		def[$3] = 1
+	}
+	' > "$MODULE.tmp1"
+
+	${CROSS}objcopy `cat ${MODULE}.tmp1` ${MODULE}.tmp ${MODULE}.out
+	mv "${MODULE}.out" "${MODULE}"
+	rm -f "${MODULE}".t*
 }
-' > "$MODULE.tmp1"
 
-${CROSS}objcopy `cat ${MODULE}.tmp1` ${MODULE}.tmp ${MODULE}.out
-mv "${MODULE}.out" "${MODULE}"
-rm -f "${MODULE}".t*
+# one process for all modules of a package, see rstrip.sh
+RET=0
+for MODULE in "$@"; do
+	strip_module "$MODULE" || RET=1
+done
+exit $RET
@@ -29,7 +29,10 @@
 
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/ethtool.h>
 #include <linux/skbuff.h>
+#include <linux/log2.h>
+#include <net/xfrm.h>
 
 #include <asm/mipsregs.h>
 
@@ -61,17 +64,17 @@
 #define ETH_CSUM_LEN		4
 
 #define RX_MAX_PKTLEN	1550
-#define RX_RING_SIZE	64
-
-#define TX_RING_SIZE	32
-#define TX_QUEUE_LEN	28	/* Limit ring entries actually used. */
+#define RX_RING_SIZE_DEF	128
+#define RX_RING_SIZE_MIN	16
+#define RX_RING_SIZE_MAX	512
+#define RX_COPYBREAK_DEF	256
+
+#define TX_RING_SIZE_DEF	64
+#define TX_RING_SIZE_MIN	8
+#define TX_RING_SIZE_MAX	256
+#define TX_QUEUE_LEN	(tx_ring_size - 4) /* Limit ring entries actually used. */
 #define TX_TIMEOUT	(HZ * 400)
 
-#define RX_DESCS_SIZE	(RX_RING_SIZE * sizeof(struct dma_desc *))
-#define RX_SKBS_SIZE	(RX_RING_SIZE * sizeof(struct sk_buff *))
-#define TX_DESCS_SIZE	(TX_RING_SIZE * sizeof(struct dma_desc *))
-#define TX_SKBS_SIZE	(TX_RING_SIZE * sizeof(struct sk_buff *))
-
 #define SKB_ALLOC_LEN		(RX_MAX_PKTLEN + 32)
 #define SKB_RESERVE_LEN		(NET_IP_ALIGN + NET_SKB_PAD)
 
@@ -152,6 +155,18 @@ static struct sk_buff **rxl_skbuff;
 static unsigned int cur_rxl, dirty_rxl; /* producer/consumer ring indices */
 static unsigned int cur_txl, dirty_txl;
 
+/* Ring sizes are powers of two, as the indices above wrap around at 2^32 */
+static unsigned int rx_ring_size = RX_RING_SIZE_DEF;
+static unsigned int tx_ring_size = TX_RING_SIZE_DEF;
+
+/* Freed TX buffers which are big enough to be reused on the RX ring */
+static struct sk_buff_head rx_recycle;
+
+static int rx_copybreak = RX_COPYBREAK_DEF;
+module_param(rx_copybreak, int, 0644);
+MODULE_PARM_DESC(rx_copybreak,
+	"Received frames shorter than this are copied into a new skb");
+
 static unsigned int sw_used;
 
 static DEFINE_SPINLOCK(tx_lock);
@@ -356,6 +371,64 @@ static inline void adm5120_rx_dma_update(struct dma_desc *desc,
 		DESC_OWN | (end ? DESC_EOR : 0);
 }
 
+static struct sk_buff *adm5120_rx_skb_get(void)
+{
+	struct sk_buff *skb;
+
+	skb = skb_dequeue(&rx_recycle);
+	if (skb) {
+		/* don't let dirty lines of the sender land on the new data */
+		dma_cache_wback_inv((unsigned long)skb->data, RX_MAX_PKTLEN);
+		return skb;
+	}
+
+	skb = alloc_skb(SKB_ALLOC_LEN, GFP_ATOMIC);
+	if (skb)
+		skb_reserve(skb, SKB_RESERVE_LEN);
+
+	return skb;
+}
+
+/*
+ * Put a transmitted skb on the recycle list instead of freeing it, if it is
+ * a plain linear buffer at least as large as the ones on the RX ring. When
+ * routing, this is the buffer that was received a moment ago.
+ */
+static bool adm5120_skb_recycle(struct sk_buff *skb)
+{
+	struct skb_shared_info *shinfo;
+
+	if (irqs_disabled())
+		return false;
+
+	if (skb_queue_len(&rx_recycle) >= rx_ring_size)
+		return false;
+
+	if (skb_is_nonlinear(skb) || skb_shared(skb) || skb_cloned(skb) ||
+	    skb->fclone != SKB_FCLONE_UNAVAILABLE || skb->head_frag ||
+	    skb->pfmemalloc)
+		return false;
+
+	if (skb_end_offset(skb) < SKB_DATA_ALIGN(SKB_ALLOC_LEN))
+		return false;
+
+	skb_orphan(skb);
+	skb_dst_drop(skb);
+	nf_reset(skb);
+	secpath_reset(skb);
+
+	shinfo = skb_shinfo(skb);
+	memset(shinfo, 0, offsetof(struct skb_shared_info, dataref));
+	atomic_set(&shinfo->dataref, 1);
+
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->data = skb->head + SKB_RESERVE_LEN;
+	skb_reset_tail_pointer(skb);
+
+	skb_queue_head(&rx_recycle, skb);
+	return true;
+}
+
 static void adm5120_switch_rx_refill(void)
 {
 	unsigned int entry;
@@ -364,14 +437,13 @@ static void adm5120_switch_rx_refill(void)
 		struct dma_desc *desc;
 		struct sk_buff *skb;
 
-		entry = dirty_rxl % RX_RING_SIZE;
+		entry = dirty_rxl % rx_ring_size;
 		desc = &rxl_descs[entry];
 
 		skb = rxl_skbuff[entry];
 		if (skb == NULL) {
-			skb = alloc_skb(SKB_ALLOC_LEN, GFP_ATOMIC);
+			skb = adm5120_rx_skb_get();
 			if (skb) {
-				skb_reserve(skb, SKB_RESERVE_LEN);
 				rxl_skbuff[entry] = skb;
 			} else {
 				SW_ERR("no memory for skb\n");
@@ -399,7 +471,7 @@ static int adm5120_switch_rx(int limit)
 				limit, cur_rxl, dirty_rxl);
 
 	while (done < limit) {
-		int entry = cur_rxl % RX_RING_SIZE;
+		int entry = cur_rxl % rx_ring_size;
 		struct dma_desc *desc = &rxl_descs[entry];
 		struct net_device *rdev;
 		unsigned int port;
@@ -407,7 +479,7 @@ static int adm5120_switch_rx(int limit)
 		if (desc->buf1 & DESC_OWN)
 			break;
 
-		if (dirty_rxl + RX_RING_SIZE == cur_rxl)
+		if (dirty_rxl + rx_ring_size == cur_rxl)
 			break;
 
 		port = desc_get_srcport(desc);
@@ -431,26 +503,42 @@ static int adm5120_switch_rx(int limit)
 					rdev->stats.rx_crc_errors++;
 				SW_DBG("rx error, recycling skb %u\n", entry);
 			} else {
-				skb_put(skb, pktlen);
-
-				skb->dev = rdev;
-				skb->protocol = eth_type_trans(skb, rdev);
-				skb->ip_summed = CHECKSUM_UNNECESSARY;
+				struct sk_buff *rskb = NULL;
 
 				dma_cache_wback_inv((unsigned long)skb->data,
-					skb->len);
+					pktlen);
+
+				/*
+				 * Small frames are copied, which leaves the
+				 * full sized buffer on the ring.
+				 */
+				if (pktlen < rx_copybreak)
+					rskb = netdev_alloc_skb_ip_align(rdev,
+								pktlen);
+				if (rskb) {
+					skb_copy_to_linear_data(rskb,
+						skb->data, pktlen);
+				} else {
+					rskb = skb;
+					rxl_skbuff[entry] = NULL;
+				}
+
+				skb_put(rskb, pktlen);
+
+				rskb->dev = rdev;
+				rskb->protocol = eth_type_trans(rskb, rdev);
+				rskb->ip_summed = CHECKSUM_UNNECESSARY;
 
 #ifdef CONFIG_ADM5120_SWITCH_NAPI
-				netif_receive_skb(skb);
+				netif_receive_skb(rskb);
 #else
-				netif_rx(skb);
+				netif_rx(rskb);
 #endif
 
 				rdev->last_rx = jiffies;
 				rdev->stats.rx_packets++;
 				rdev->stats.rx_bytes += pktlen;
 
-				rxl_skbuff[entry] = NULL;
 				done++;
 			}
 		} else {
@@ -458,7 +546,7 @@ static int adm5120_switch_rx(int limit)
 		}
 
 		cur_rxl++;
-		if (cur_rxl - dirty_rxl > RX_RING_SIZE / 4)
+		if (cur_rxl - dirty_rxl > rx_ring_size / 4)
 			adm5120_switch_rx_refill();
 	}
 
@@ -475,7 +563,7 @@ static void adm5120_switch_tx(void)
 	unsigned int entry;
 
 	spin_lock(&tx_lock);
-	entry = dirty_txl % TX_RING_SIZE;
+	entry = dirty_txl % tx_ring_size;
 	while (dirty_txl != cur_txl) {
 		struct dma_desc *desc = &txl_descs[entry];
 		struct sk_buff *skb = txl_skbuff[entry];
@@ -488,9 +576,10 @@ static void adm5120_switch_tx(void)
 			skb->dev->stats.tx_packets++;
 		}
 
-		dev_kfree_skb_irq(skb);
+		if (!adm5120_skb_recycle(skb))
+			dev_kfree_skb_irq(skb);
 		txl_skbuff[entry] = NULL;
-		entry = (++dirty_txl) % TX_RING_SIZE;
+		entry = (++dirty_txl) % tx_ring_size;
 	}
 
 	if ((cur_txl - dirty_txl) < TX_QUEUE_LEN - 4) {
@@ -561,7 +650,7 @@ static irqreturn_t adm5120_switch_irq(int irq, void *dev_id)
 	sw_int_ack(status);
 
 	if (status & (SWITCH_INT_RLD | SWITCH_INT_LDF))
-		adm5120_switch_rx(RX_RING_SIZE);
+		adm5120_switch_rx(rx_ring_size);
 
 	if (status & SWITCH_INT_SLD)
 		adm5120_switch_tx();
@@ -607,12 +696,11 @@ static void adm5120_switch_rx_ring_reset(struct dma_desc *desc,
 
 	memset(desc, 0, num * sizeof(*desc));
 	for (i = 0; i < num; i++) {
-		skbl[i] = dev_alloc_skb(SKB_ALLOC_LEN);
+		skbl[i] = adm5120_rx_skb_get();
 		if (!skbl[i]) {
 			i = num;
 			break;
 		}
-		skb_reserve(skbl[i], SKB_RESERVE_LEN);
 		adm5120_rx_dma_update(&desc[i], skbl[i], (num - 1 == i));
 	}
 
@@ -620,95 +708,63 @@ static void adm5120_switch_rx_ring_reset(struct dma_desc *desc,
 	dirty_rxl = 0;
 }
 
-static int adm5120_switch_tx_ring_alloc(void)
+static int adm5120_switch_ring_alloc(struct dma_desc **descs,
+		dma_addr_t *descs_dma, struct sk_buff ***skbl, unsigned int num)
 {
-	int err;
-
-	txl_descs = dma_alloc_coherent(NULL, TX_DESCS_SIZE, &txl_descs_dma,
-					GFP_ATOMIC);
-	if (!txl_descs) {
-		err = -ENOMEM;
-		goto err;
-	}
-
-	txl_skbuff = kzalloc(TX_SKBS_SIZE, GFP_KERNEL);
-	if (!txl_skbuff) {
-		err = -ENOMEM;
-		goto err;
+	*descs = dma_alloc_coherent(NULL, num * sizeof(struct dma_desc),
+					descs_dma, GFP_ATOMIC);
+	if (!*descs)
+		return -ENOMEM;
+
+	*skbl = kcalloc(num, sizeof(struct sk_buff *), GFP_KERNEL);
+	if (!*skbl) {
+		dma_free_coherent(NULL, num * sizeof(struct dma_desc), *descs,
+			*descs_dma);
+		*descs = NULL;
+		return -ENOMEM;
 	}
 
 	return 0;
-
-err:
-	return err;
 }
 
-static void adm5120_switch_tx_ring_free(void)
+static void adm5120_switch_ring_free(struct dma_desc *descs,
+		dma_addr_t descs_dma, struct sk_buff **skbl, unsigned int num)
 {
-	int i;
+	unsigned int i;
 
-	if (txl_skbuff) {
-		for (i = 0; i < TX_RING_SIZE; i++)
-			if (txl_skbuff[i])
-				kfree_skb(txl_skbuff[i]);
-		kfree(txl_skbuff);
+	if (skbl) {
+		for (i = 0; i < num; i++)
+			if (skbl[i])
+				kfree_skb(skbl[i]);
+		kfree(skbl);
 	}
 
-	if (txl_descs)
-		dma_free_coherent(NULL, TX_DESCS_SIZE, txl_descs,
-			txl_descs_dma);
+	if (descs)
+		dma_free_coherent(NULL, num * sizeof(struct dma_desc), descs,
+			descs_dma);
 }
 
-static int adm5120_switch_rx_ring_alloc(void)
+static void adm5120_switch_rings_start(void)
 {
-	int err;
-	int i;
-
-	/* init RX ring */
-	rxl_descs = dma_alloc_coherent(NULL, RX_DESCS_SIZE, &rxl_descs_dma,
-					GFP_ATOMIC);
-	if (!rxl_descs) {
-		err = -ENOMEM;
-		goto err;
-	}
-
-	rxl_skbuff = kzalloc(RX_SKBS_SIZE, GFP_KERNEL);
-	if (!rxl_skbuff) {
-		err = -ENOMEM;
-		goto err;
-	}
-
-	for (i = 0; i < RX_RING_SIZE; i++) {
-		struct sk_buff *skb;
-		skb = alloc_skb(SKB_ALLOC_LEN, GFP_ATOMIC);
-		if (!skb) {
-			err = -ENOMEM;
-			goto err;
-		}
-		rxl_skbuff[i] = skb;
-		skb_reserve(skb, SKB_RESERVE_LEN);
-	}
-
-	return 0;
+	adm5120_switch_tx_ring_reset(txl_descs, txl_skbuff, tx_ring_size);
+	adm5120_switch_rx_ring_reset(rxl_descs, rxl_skbuff, rx_ring_size);
 
-err:
-	return err;
+	sw_write_reg(SWITCH_REG_SHDA, 0);
+	sw_write_reg(SWITCH_REG_SLDA, KSEG1ADDR(txl_descs));
+	sw_write_reg(SWITCH_REG_RHDA, 0);
+	sw_write_reg(SWITCH_REG_RLDA, KSEG1ADDR(rxl_descs));
 }
 
-static void adm5120_switch_rx_ring_free(void)
+static void adm5120_switch_rings_free(void)
 {
-	int i;
-
-	if (rxl_skbuff) {
-		for (i = 0; i < RX_RING_SIZE; i++)
-			if (rxl_skbuff[i])
-				kfree_skb(rxl_skbuff[i]);
-		kfree(rxl_skbuff);
-	}
-
-	if (rxl_descs)
-		dma_free_coherent(NULL, RX_DESCS_SIZE, rxl_descs,
-			rxl_descs_dma);
+	adm5120_switch_ring_free(txl_descs, txl_descs_dma, txl_skbuff,
+				 tx_ring_size);
+	adm5120_switch_ring_free(rxl_descs, rxl_descs_dma, rxl_skbuff,
+				 rx_ring_size);
+	txl_descs = rxl_descs = NULL;
+	txl_skbuff = rxl_skbuff = NULL;
+
+	skb_queue_purge(&rx_recycle);
 }
 
 static void adm5120_write_mac(struct net_device *dev)
@@ -881,7 +937,7 @@ static int adm5120_if_hard_start_xmit(struct sk_buff *skb,
 	spin_lock_irq(&tx_lock);
 
 	/* calculate the next TX descriptor entry. */
-	entry = cur_txl % TX_RING_SIZE;
+	entry = cur_txl % tx_ring_size;
 
 	desc = &txl_descs[entry];
 	if (desc->buf1 & DESC_OWN) {
@@ -1027,6 +1083,104 @@ static int adm5120_if_do_ioctl(struct net_device *dev, struct ifreq *rq,
 	return 0;
 }
 
+static void adm5120_if_get_ringparam(struct net_device *dev,
+		struct ethtool_ringparam *er)
+{
+	er->rx_max_pending = RX_RING_SIZE_MAX;
+	er->tx_max_pending = TX_RING_SIZE_MAX;
+	er->rx_pending = rx_ring_size;
+	er->tx_pending = tx_ring_size;
+}
+
+/*
+ * The rings are shared by all ports, so setting them on one interface stops
+ * and restarts the traffic on all of them.
+ */
+static int adm5120_if_set_ringparam(struct net_device *dev,
+		struct ethtool_ringparam *er)
+{
+	struct dma_desc *rx_descs, *tx_descs;
+	struct sk_buff **rx_skbl, **tx_skbl;
+	dma_addr_t rx_descs_dma, tx_descs_dma;
+	unsigned int rx_size, tx_size;
+	u32 cpup;
+	int err;
+	int i;
+
+	if (er->rx_mini_pending || er->rx_jumbo_pending)
+		return -EINVAL;
+
+	if (er->rx_pending < RX_RING_SIZE_MIN ||
+	    er->rx_pending > RX_RING_SIZE_MAX ||
+	    er->tx_pending < TX_RING_SIZE_MIN ||
+	    er->tx_pending > TX_RING_SIZE_MAX)
+		return -EINVAL;
+
+	rx_size = roundup_pow_of_two(er->rx_pending);
+	tx_size = roundup_pow_of_two(er->tx_pending);
+	if (rx_size == rx_ring_size && tx_size == tx_ring_size)
+		return 0;
+
+	/* get the new rings first, the old ones stay in use on failure */
+	err = adm5120_switch_ring_alloc(&rx_descs, &rx_descs_dma, &rx_skbl,
+					rx_size);
+	if (err)
+		return err;
+
+	err = adm5120_switch_ring_alloc(&tx_descs, &tx_descs_dma, &tx_skbl,
+					tx_size);
+	if (err) {
+		adm5120_switch_ring_free(rx_descs, rx_descs_dma, rx_skbl,
+					 rx_size);
+		return err;
+	}
+
+	for (i = 0; i < SWITCH_NUM_PORTS; i++) {
+		if (!adm5120_devs[i] || !netif_running(adm5120_devs[i]))
+			continue;
+		netif_stop_queue(adm5120_devs[i]);
+		adm5120_if_napi_disable(adm5120_devs[i]);
+	}
+
+	sw_int_mask(SWITCH_INTS_ALL);
+	cpup = sw_read_reg(SWITCH_REG_CPUP_CONF);
+	sw_write_reg(SWITCH_REG_CPUP_CONF, cpup | CPUP_CONF_DCPUP);
+
+	adm5120_switch_rings_free();
+
+	rxl_descs = rx_descs;
+	rxl_descs_dma = rx_descs_dma;
+	rxl_skbuff = rx_skbl;
+	rx_ring_size = rx_size;
+
+	txl_descs = tx_descs;
+	txl_descs_dma = tx_descs_dma;
+	txl_skbuff = tx_skbl;
+	tx_ring_size = tx_size;
+
+	adm5120_switch_rings_start();
+
+	sw_int_ack(SWITCH_INTS_ALL);
+	sw_write_reg(SWITCH_REG_CPUP_CONF, cpup);
+	if (sw_used)
+		sw_int_unmask(SWITCH_INTS_USED);
+
+	for (i = 0; i < SWITCH_NUM_PORTS; i++) {
+		if (!adm5120_devs[i] || !netif_running(adm5120_devs[i]))
+			continue;
+		adm5120_if_napi_enable(adm5120_devs[i]);
+		netif_wake_queue(adm5120_devs[i]);
+	}
+
+	return 0;
+}
+
+static const struct ethtool_ops adm5120sw_ethtool_ops = {
+	.get_link		= ethtool_op_get_link,
+	.get_ringparam		= adm5120_if_get_ringparam,
+	.set_ringparam		= adm5120_if_set_ringparam,
+};
+
 static const struct net_device_ops adm5120sw_netdev_ops = {
 	.ndo_open		= adm5120_if_open,
 	.ndo_stop		= adm5120_if_stop,
@@ -1053,6 +1207,7 @@ static struct net_device *adm5120_if_alloc(void)
 
 	dev->irq		= ADM5120_IRQ_SWITCH;
 	dev->netdev_ops		= &adm5120sw_netdev_ops;
+	dev->ethtool_ops	= &adm5120sw_ethtool_ops;
 	dev->watchdog_timeo	= TX_TIMEOUT;
 
 #ifdef CONFIG_ADM5120_SWITCH_NAPI
@@ -1079,8 +1234,7 @@ static void adm5120_switch_cleanup(void)
 		}
 	}
 
-	adm5120_switch_tx_ring_free();
-	adm5120_switch_rx_ring_free();
+	adm5120_switch_rings_free();
 }
 
 static int adm5120_switch_probe(struct platform_device *pdev)
@@ -1119,21 +1273,19 @@ static int adm5120_switch_probe(struct platform_device *pdev)
 	sw_int_mask(SWITCH_INTS_ALL);
 	sw_int_ack(SWITCH_INTS_ALL);
 
-	err = adm5120_switch_rx_ring_alloc();
+	skb_queue_head_init(&rx_recycle);
+
+	err = adm5120_switch_ring_alloc(&rxl_descs, &rxl_descs_dma,
+					&rxl_skbuff, rx_ring_size);
 	if (err)
 		goto err;
 
-	err = adm5120_switch_tx_ring_alloc();
+	err = adm5120_switch_ring_alloc(&txl_descs, &txl_descs_dma,
+					&txl_skbuff, tx_ring_size);
 	if (err)
 		goto err;
 
-	adm5120_switch_tx_ring_reset(txl_descs, txl_skbuff, TX_RING_SIZE);
-	adm5120_switch_rx_ring_reset(rxl_descs, rxl_skbuff, RX_RING_SIZE);
-
-	sw_write_reg(SWITCH_REG_SHDA, 0);
-	sw_write_reg(SWITCH_REG_SLDA, KSEG1ADDR(txl_descs));
-	sw_write_reg(SWITCH_REG_RHDA, 0);
-	sw_write_reg(SWITCH_REG_RLDA, KSEG1ADDR(rxl_descs));
+	adm5120_switch_rings_start();
 
 	for (i = 0; i < SWITCH_NUM_PORTS; i++) {
 		struct net_device *dev;
@@ -62,6 +62,7 @@
 static const char hcd_name[] = "admhc-hcd";
 
 #define	STATECHANGE_DELAY	msecs_to_jiffies(300)
+#define	TDC_MAX_PASSES		4	/* done list scans per interrupt */
 
 #include "adm5120.h"
 
@@ -141,12 +142,10 @@ static int admhc_urb_enqueue(struct usb_hcd *hcd, struct urb *urb,
 		break;
 	}
 
-	urb_priv = urb_priv_alloc(ahcd, td_cnt, mem_flags);
+	urb_priv = urb_priv_alloc(ahcd, ed, td_cnt, mem_flags);
 	if (!urb_priv)
 		return -ENOMEM;
 
-	urb_priv->ed = ed;
-
 	spin_lock_irqsave(&ahcd->lock, flags);
 	/* don't submit to a dead HC */
 	if (!HCD_HW_ACCESSIBLE(hcd)) {
@@ -303,6 +302,14 @@ sanitize:
 			break;
 		}
 		/* else FALL THROUGH */
+	case ED_OPER:		/* idle bulk EDs are left linked */
+		if (list_empty(&ed->td_list)) {
+			start_ed_unlink(ahcd, ed);
+			spin_unlock_irqrestore(&ahcd->lock, flags);
+			schedule_timeout_uninterruptible(1);
+			goto rescan;
+		}
+		/* else FALL THROUGH */
 	default:
 		/* caller was supposed to have unlinked any requests;
 		 * that's not our job.  can't recover; must leak ed.
@@ -693,12 +700,20 @@ static irqreturn_t admhc_irq(struct usb_hcd *hcd)
 	}
 
 	if (ints & ADMHC_INTR_TDC) {
+		int passes = TDC_MAX_PASSES;
+
 		admhc_vdbg(ahcd, "Transfer Descriptor Complete\n");
 		admhc_intr_ack(ahcd, ADMHC_INTR_TDC);
 		if (HC_IS_RUNNING(hcd->state))
 			admhc_intr_disable(ahcd, ADMHC_INTR_TDC);
 		spin_lock(&ahcd->lock);
 		admhc_td_complete(ahcd);
+		/* pick up the TDs retired meanwhile without another irq */
+		while (--passes && (admhc_readl(ahcd, &regs->int_status)
+					& ADMHC_INTR_TDC)) {
+			admhc_intr_ack(ahcd, ADMHC_INTR_TDC);
+			admhc_td_complete(ahcd);
+		}
 		spin_unlock(&ahcd->lock);
 		if (HC_IS_RUNNING(hcd->state))
 			admhc_intr_enable(ahcd, ADMHC_INTR_TDC);
@@ -96,6 +96,15 @@ static inline struct td *dma_to_td(struct admhcd *ahcd, dma_addr_t td_dma)
 }
 
 /* TDs ... */
+static void td_init(struct admhcd *ahcd, struct td *td, dma_addr_t dma)
+{
+	/* in case ahcd fetches it, make it look dead */
+	memset(td, 0, sizeof *td);
+	td->hwNextTD = cpu_to_hc32(ahcd, dma);
+	td->td_dma = dma;
+	/* hashed in td_fill */
+}
+
 static struct td *td_alloc(struct admhcd *ahcd, gfp_t mem_flags)
 {
 	dma_addr_t	dma;
@@ -105,16 +114,12 @@ static struct td *td_alloc(struct admhcd *ahcd, gfp_t mem_flags)
 	if (!td)
 		return NULL;
 
-	/* in case ahcd fetches it, make it look dead */
-	memset(td, 0, sizeof *td);
-	td->hwNextTD = cpu_to_hc32(ahcd, dma);
-	td->td_dma = dma;
-	/* hashed in td_fill */
+	td_init(ahcd, td, dma);
 
 	return td;
 }
 
-static void td_free(struct admhcd *ahcd, struct td *td)
+static void td_unhash(struct admhcd *ahcd, struct td *td)
 {
 	struct td **prev = &ahcd->td_hash[TD_HASH_FUNC(td->td_dma)];
 
@@ -130,9 +135,43 @@ static void td_free(struct admhcd *ahcd, struct td *td)
 	else if ((td->flags & TD_FLAG_DONE) != 0)
 		admhc_dbg(ahcd, "no hash for td %p\n", td);
 #endif
+}
+
+static void td_free(struct admhcd *ahcd, struct td *td)
+{
+	td_unhash(ahcd, td);
 	dma_pool_free(ahcd->td_cache, td, td->td_dma);
 }
 
+/* keep a retired TD on its ED for the next URB; caller holds ahcd->lock */
+static void td_put(struct admhcd *ahcd, struct ed *ed, struct td *td)
+{
+	if (ed->td_cached >= ED_TD_CACHE_MAX) {
+		td_free(ahcd, td);
+		return;
+	}
+
+	td_unhash(ahcd, td);
+	list_add(&td->td_list, &ed->td_cache);
+	ed->td_cached++;
+}
+
+/* take a spare TD from the ED, if any; caller holds ahcd->lock */
+static struct td *td_get(struct admhcd *ahcd, struct ed *ed)
+{
+	struct td	*td;
+
+	if (list_empty(&ed->td_cache))
+		return NULL;
+
+	td = list_first_entry(&ed->td_cache, struct td, td_list);
+	list_del(&td->td_list);
+	ed->td_cached--;
+	td_init(ahcd, td, td->td_dma);
+
+	return td;
+}
+
 /*-------------------------------------------------------------------------*/
 
 /* EDs ... */
@@ -149,6 +188,7 @@ static struct ed *ed_alloc(struct admhcd *ahcd, gfp_t mem_flags)
 	ed->dma = dma;
 
 	INIT_LIST_HEAD(&ed->td_list);
+	INIT_LIST_HEAD(&ed->td_cache);
 	INIT_LIST_HEAD(&ed->urb_list);
 
 	return ed;
@@ -156,47 +196,68 @@ static struct ed *ed_alloc(struct admhcd *ahcd, gfp_t mem_flags)
 
 static void ed_free(struct admhcd *ahcd, struct ed *ed)
 {
+	struct td	*td, *tmp;
+
+	list_for_each_entry_safe(td, tmp, &ed->td_cache, td_list)
+		dma_pool_free(ahcd->td_cache, td, td->td_dma);
+
 	dma_pool_free(ahcd->ed_cache, ed, ed->dma);
 }
 
 /*-------------------------------------------------------------------------*/
 
 /* URB priv ... */
+
+/* caller holds ahcd->lock; the TDs go back to the ED for its next URB */
 static void urb_priv_free(struct admhcd *ahcd, struct urb_priv *urb_priv)
 {
 	int i;
 
 	for (i = 0; i < urb_priv->td_cnt; i++)
 		if (urb_priv->td[i])
-			td_free(ahcd, urb_priv->td[i]);
+			td_put(ahcd, urb_priv->ed, urb_priv->td[i]);
 
 	list_del(&urb_priv->pending);
 	kfree(urb_priv);
 }
 
-static struct urb_priv *urb_priv_alloc(struct admhcd *ahcd, int num_tds,
-		gfp_t mem_flags)
+static struct urb_priv *urb_priv_alloc(struct admhcd *ahcd, struct ed *ed,
+		int num_tds, gfp_t mem_flags)
 {
 	struct urb_priv	*priv;
+	unsigned long	flags;
+	int		i;
 
 	/* allocate the private part of the URB */
-	priv = kzalloc(sizeof(*priv) + sizeof(struct td) * num_tds, mem_flags);
+	priv = kzalloc(sizeof(*priv) + sizeof(struct td *) * num_tds,
+			mem_flags);
 	if (!priv)
 		goto err;
 
-	/* allocate the TDs (deferring hash chain updates) */
+	priv->ed = ed;
+	INIT_LIST_HEAD(&priv->pending);
+
+	/* take the spare TDs of the ED first (deferring hash chain updates) */
+	spin_lock_irqsave(&ahcd->lock, flags);
 	for (priv->td_cnt = 0; priv->td_cnt < num_tds; priv->td_cnt++) {
+		priv->td[priv->td_cnt] = td_get(ahcd, ed);
+		if (priv->td[priv->td_cnt] == NULL)
+			break;
+	}
+	spin_unlock_irqrestore(&ahcd->lock, flags);
+
+	for (; priv->td_cnt < num_tds; priv->td_cnt++) {
 		priv->td[priv->td_cnt] = td_alloc(ahcd, mem_flags);
 		if (priv->td[priv->td_cnt] == NULL)
 			goto err_free;
 	}
 
-	INIT_LIST_HEAD(&priv->pending);
-
 	return priv;
 
 err_free:
-	urb_priv_free(ahcd, priv);
+	for (i = 0; i < priv->td_cnt; i++)
+		dma_pool_free(ahcd->td_cache, priv->td[i], priv->td[i]->td_dma);
+	kfree(priv);
 err:
 	return NULL;
 }
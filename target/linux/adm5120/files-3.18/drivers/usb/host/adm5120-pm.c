@@ -351,6 +351,7 @@ static int admhc_restart(struct admhcd *ahcd)
 	int temp;
 	int i;
 	struct urb_priv *priv;
+	struct ed *ed, *next;
 
 	/* mark any devices gone, so they do nothing till khubd disconnects.
 	 * recycle any "live" eds/tds (and urbs) right away.
@@ -386,6 +387,19 @@ static int admhc_restart(struct admhcd *ahcd)
 		if (!urb->unlinked)
 			urb->unlinked = -ESHUTDOWN;
 	}
+
+	/* idle bulk EDs are left linked, take them off as well */
+	for (ed = ahcd->ed_head; ed; ed = next) {
+		next = ed->ed_next;
+		if (ed->state != ED_OPER || !list_empty(&ed->td_list))
+			continue;
+
+		ed->hwINFO |= cpu_to_hc32(ahcd, ED_DEQUEUE);
+		ed_deschedule(ahcd, ed);
+
+		ed->ed_rm_next = ahcd->ed_rm_list;
+		ahcd->ed_rm_list = ed;
+	}
 	finish_unlinks(ahcd, 0);
 	spin_unlock_irq(&ahcd->lock);
 
@@ -916,9 +916,13 @@ static void ed_update(struct admhcd *ahcd, struct ed *ed)
 		if (urb_priv->td_idx == urb_priv->td_cnt)
 			finish_urb(ahcd, urb, status);
 
-		/* clean schedule:  unlink EDs that are no longer busy */
+		/* clean schedule:  unlink EDs that are no longer busy.
+		 * Bulk EDs stay linked, so the next URB of a transfer
+		 * doesn't wait a frame for the ED to be relinked; they
+		 * are unlinked when the endpoint is disabled.
+		 */
 		if (list_empty(&ed->td_list)) {
-			if (ed->state == ED_OPER)
+			if (ed->state == ED_OPER && ed->type != PIPE_BULK)
 				start_ed_unlink(ahcd, ed);
 
 		/* ... reenabling halted EDs only after fault cleanup */
@@ -30,6 +30,7 @@ typedef __u16 __bitwise __hc16;
  */
 
 #define TD_DATALEN_MAX	4096
+#define ED_TD_CACHE_MAX	32	/* spare TDs kept per ED, 128K of bulk data */
 
 #define ED_ALIGN	16
 #define ED_MASK	((u32)~(ED_ALIGN-1))	/* strip hw status in low addr bits */
@@ -69,6 +70,8 @@ struct ed {
 	struct ed		*ed_prev;	/* for non-interrupt EDs */
 	struct ed		*ed_rm_next;	/* on rm list */
 	struct list_head	td_list;	/* "shadow list" of our TDs */
+	struct list_head	td_cache;	/* spare TDs for the next URBs */
+	unsigned		td_cached;
 
 	/* create --> IDLE --> OPER --> ... --> IDLE --> destroy
 	 * usually:  OPER --> UNLINK --> (IDLE | OPER) --> ...
@@ -213,8 +213,10 @@ struct ar934x_nfc {
 	dma_addr_t buf_dma;
 	unsigned int buf_size;
 	int buf_index;
+	int buf_page;		/* page held raw with OOB in buf, or -1 */
 
 	bool read_id;
+	bool read_pending;
 
 	int erase1_page_addr;
 
@@ -355,11 +357,11 @@ ar934x_nfc_wait_irq(struct ar934x_nfc *nfc)
 }
 
 static int
-ar934x_nfc_wait_done(struct ar934x_nfc *nfc)
+ar934x_nfc_wait_done(struct ar934x_nfc *nfc, bool use_irq)
 {
 	int ret;
 
-	if (ar934x_nfc_use_irq(nfc))
+	if (use_irq)
 		ret = ar934x_nfc_wait_irq(nfc);
 	else
 		ret = ar934x_nfc_wait_dev_ready(nfc);
@@ -452,9 +454,20 @@ ar934x_nfc_do_rw_command(struct ar934x_nfc *nfc, int column, int page_addr,
 	int dir;
 	int err;
 	int retries = 0;
+	bool use_irq;
 
 	WARN_ON(len & 3);
 
+	/*
+	 * A page read completes in well under the time it takes to sleep
+	 * and get woken up again, so only programming waits for the IRQ.
+	 */
+	use_irq = ar934x_nfc_use_irq(nfc) && write;
+
+	/* the DMA is about to overwrite the buffer */
+	nfc->buf_page = -1;
+	nfc->read_pending = false;
+
 	if (WARN_ON(len > nfc->buf_size))
 		dev_err(nfc->parent, "len=%d > buf_size=%d", len, nfc->buf_size);
 
@@ -491,14 +504,20 @@ retry:
 	ar934x_nfc_wr(nfc, AR934X_NFC_REG_ECC_CTRL, nfc->ecc_ctrl_reg);
 	ar934x_nfc_wr(nfc, AR934X_NFC_REG_ECC_OFFSET, nfc->ecc_offset_reg);
 
-	if (ar934x_nfc_use_irq(nfc)) {
+	if (use_irq) {
+		nfc->irq_status = 0;
 		ar934x_nfc_wr(nfc, AR934X_NFC_REG_INT_MASK, AR934X_NFC_IRQ_MASK);
 		/* flush write */
 		ar934x_nfc_rr(nfc, AR934X_NFC_REG_INT_MASK);
+	} else if (ar934x_nfc_use_irq(nfc)) {
+		/* keep a late IRQ from completing the next waiter early */
+		ar934x_nfc_wr(nfc, AR934X_NFC_REG_INT_MASK, 0);
+		/* flush write */
+		ar934x_nfc_rr(nfc, AR934X_NFC_REG_INT_MASK);
 	}
 
 	ar934x_nfc_write_cmd_reg(nfc, cmd_reg);
-	err = ar934x_nfc_wait_done(nfc);
+	err = ar934x_nfc_wait_done(nfc, use_irq);
 	if (err) {
 		dev_dbg(nfc->parent, "%s operation stuck at page %d\n",
 			(write) ? "write" : "read", page_addr);
@@ -589,6 +608,8 @@ ar934x_nfc_send_erase(struct ar934x_nfc *nfc, unsigned command, int column,
 	nfc_dbg(nfc, "erase page %d, a0:%08x a1:%08x cmd:%08x ctrl:%08x\n",
 		page_addr, addr0, addr1, cmd_reg, ctrl_reg);
 
+	nfc->buf_page = -1;
+
 	ar934x_nfc_wr(nfc, AR934X_NFC_REG_INT_STATUS, 0);
 	ar934x_nfc_wr(nfc, AR934X_NFC_REG_CTRL, ctrl_reg);
 	ar934x_nfc_wr(nfc, AR934X_NFC_REG_ADDR0_0, addr0);
@@ -637,12 +658,37 @@ ar934x_nfc_read_status(struct ar934x_nfc *nfc)
 	nfc_dbg(nfc, "read status, cmd:%08x status:%02x\n",
 		cmd_reg, (status & 0xff));
 
+	nfc->buf_page = -1;
 	if (nfc->swap_dma)
 		nfc->buf[0 ^ 3] = status;
 	else
 		nfc->buf[0] = status;
 }
 
+/*
+ * The NAND core issues READ0 before every ecc.read_page and
+ * ecc.read_page_raw call, which do their own transfers. So a large page
+ * READ0 or RNDOUT only takes note of the page, and the page is fetched
+ * when the buffer is actually read through read_byte or read_buf.
+ */
+static void
+ar934x_nfc_do_pending_read(struct ar934x_nfc *nfc)
+{
+	struct mtd_info *mtd = &nfc->mtd;
+
+	if (!nfc->read_pending)
+		return;
+
+	nfc->read_pending = false;
+	if (nfc->buf_page == nfc->rndout_page_addr)
+		return;
+
+	if (!ar934x_nfc_send_read(nfc, nfc->rndout_read_cmd, 0,
+				  nfc->rndout_page_addr,
+				  mtd->writesize + mtd->oobsize))
+		nfc->buf_page = nfc->rndout_page_addr;
+}
+
 static void
 ar934x_nfc_cmdfunc(struct mtd_info *mtd, unsigned int command, int column,
 		   int page_addr)
@@ -651,6 +697,7 @@ ar934x_nfc_cmdfunc(struct mtd_info *mtd, unsigned int command, int column,
 	struct nand_chip *nand = mtd->priv;
 
 	nfc->read_id = false;
+	nfc->read_pending = false;
 	if (command != NAND_CMD_PAGEPROG)
 		nfc->buf_index = 0;
 
@@ -670,11 +717,10 @@ ar934x_nfc_cmdfunc(struct mtd_info *mtd, unsigned int command, int column,
 			ar934x_nfc_send_read(nfc, command, column, page_addr,
 					     mtd->writesize + mtd->oobsize);
 		} else {
-			ar934x_nfc_send_read(nfc, command, 0, page_addr,
-					     mtd->writesize + mtd->oobsize);
 			nfc->buf_index = column;
 			nfc->rndout_page_addr = page_addr;
 			nfc->rndout_read_cmd = command;
+			nfc->read_pending = true;
 		}
 		break;
 
@@ -683,6 +729,9 @@ ar934x_nfc_cmdfunc(struct mtd_info *mtd, unsigned int command, int column,
 			ar934x_nfc_send_read(nfc, NAND_CMD_READOOB,
 					     column, page_addr,
 					     mtd->oobsize);
+		else if (nfc->buf_page == page_addr)
+			/* the OOB is still in the buffer behind the data */
+			nfc->buf_index = mtd->writesize;
 		else
 			ar934x_nfc_send_read(nfc, NAND_CMD_READ0,
 					     mtd->writesize, page_addr,
@@ -694,10 +743,8 @@ ar934x_nfc_cmdfunc(struct mtd_info *mtd, unsigned int command, int column,
 			break;
 
 		/* emulate subpage read */
-		ar934x_nfc_send_read(nfc, nfc->rndout_read_cmd, 0,
-				     nfc->rndout_page_addr,
-				     mtd->writesize + mtd->oobsize);
 		nfc->buf_index = column;
+		nfc->read_pending = true;
 		break;
 
 	case NAND_CMD_ERASE1:
@@ -776,6 +823,8 @@ ar934x_nfc_read_byte(struct mtd_info *mtd)
 	struct ar934x_nfc *nfc = mtd_to_ar934x_nfc(mtd);
 	u8 data;
 
+	ar934x_nfc_do_pending_read(nfc);
+
 	WARN_ON(nfc->buf_index >= nfc->buf_size);
 
 	if (nfc->swap_dma || nfc->read_id)
@@ -796,6 +845,7 @@ ar934x_nfc_write_buf(struct mtd_info *mtd, const u8 *buf, int len)
 
 	WARN_ON(nfc->buf_index + len > nfc->buf_size);
 
+	nfc->buf_page = -1;
 	if (nfc->swap_dma) {
 		for (i = 0; i < len; i++) {
 			nfc->buf[nfc->buf_index ^ 3] = buf[i];
@@ -816,6 +866,8 @@ ar934x_nfc_read_buf(struct mtd_info *mtd, u8 *buf, int len)
 	int buf_index;
 	int i;
 
+	ar934x_nfc_do_pending_read(nfc);
+
 	WARN_ON(nfc->buf_index + len > nfc->buf_size);
 
 	buf_index = nfc->buf_index;
@@ -858,6 +910,12 @@ ar934x_nfc_read_oob(struct mtd_info *mtd, struct nand_chip *chip,
 
 	nfc_dbg(nfc, "read_oob: page:%d\n", page);
 
+	if (nfc->buf_page == page) {
+		memcpy(chip->oob_poi, &nfc->buf[mtd->writesize],
+		       mtd->oobsize);
+		return 0;
+	}
+
 	err = ar934x_nfc_send_read(nfc, NAND_CMD_READ0, mtd->writesize, page,
 				   mtd->oobsize);
 	if (err)
@@ -902,8 +960,10 @@ ar934x_nfc_read_page_raw(struct mtd_info *mtd, struct nand_chip *chip,
 
 	memcpy(buf, nfc->buf, mtd->writesize);
 
-	if (oob_required)
+	if (oob_required) {
 		memcpy(chip->oob_poi, &nfc->buf[mtd->writesize], mtd->oobsize);
+		nfc->buf_page = page;
+	}
 
 	return 0;
 }
@@ -1386,6 +1446,7 @@ ar934x_nfc_probe(struct platform_device *pdev)
 	nfc->parent = &pdev->dev;
 	nfc->select_chip = pdata->select_chip;
 	nfc->swap_dma = pdata->swap_dma;
+	nfc->buf_page = -1;
 
 	nand = &nfc->nand_chip;
 	mtd = &nfc->mtd;
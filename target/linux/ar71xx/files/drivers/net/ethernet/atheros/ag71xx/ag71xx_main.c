@@ -28,6 +28,11 @@ static int ag71xx_msg_level = -1;
 module_param_named(msg_level, ag71xx_msg_level, int, 0);
 MODULE_PARM_DESC(msg_level, "Message level (-1=defaults,0=none,...,16=all)");
 
+static int ag71xx_rx_copybreak = 256;
+
+module_param_named(rx_copybreak, ag71xx_rx_copybreak, int, 0644);
+MODULE_PARM_DESC(rx_copybreak, "Copy received frames up to this size (0=never)");
+
 #define ETH_SWITCH_HEADER_LEN	2
 
 static int ag71xx_tx_packets(struct ag71xx *ag, bool flush);
@@ -983,6 +988,31 @@ static int ag71xx_tx_packets(struct ag71xx *ag, bool flush)
 	return sent;
 }
 
+/*
+ * Copy a small frame into a right-sized skb so that the DMA buffer can be
+ * handed back to the hardware as is.
+ */
+static struct sk_buff *ag71xx_rx_copy(struct ag71xx *ag, struct ag71xx_buf *buf,
+				      int offset, int pktlen)
+{
+	struct sk_buff *skb;
+	int align = ag71xx_has_ar8216(ag) ? 0 : NET_IP_ALIGN;
+
+	skb = netdev_alloc_skb(ag->dev, pktlen + align);
+	if (!skb)
+		return NULL;
+
+	skb_reserve(skb, align);
+
+	dma_sync_single_for_cpu(&ag->dev->dev, buf->dma_addr + offset, pktlen,
+				DMA_FROM_DEVICE);
+	memcpy(skb_put(skb, pktlen), buf->rx_buf + offset, pktlen);
+	dma_sync_single_for_device(&ag->dev->dev, buf->dma_addr + offset,
+				   pktlen, DMA_FROM_DEVICE);
+
+	return skb;
+}
+
 static int ag71xx_rx_packets(struct ag71xx *ag, int limit)
 {
 	struct net_device *dev = ag->dev;
@@ -997,7 +1027,8 @@ static int ag71xx_rx_packets(struct ag71xx *ag, int limit)
 	while (done < limit) {
 		unsigned int i = ring->curr % ring->size;
 		struct ag71xx_desc *desc = ag71xx_ring_desc(ring, i);
-		struct sk_buff *skb;
+		struct ag71xx_buf *buf = &ring->buf[i];
+		struct sk_buff *skb = NULL;
 		int pktlen;
 		int err = 0;
 
@@ -1014,20 +1045,27 @@ static int ag71xx_rx_packets(struct ag71xx *ag, int limit)
 		pktlen = desc->ctrl & pktlen_mask;
 		pktlen -= ETH_FCS_LEN;
 
-		dma_unmap_single(&dev->dev, ring->buf[i].dma_addr,
-				 ag->rx_buf_size, DMA_FROM_DEVICE);
-
 		dev->stats.rx_packets++;
 		dev->stats.rx_bytes += pktlen;
 
-		skb = build_skb(ring->buf[i].rx_buf, 0);
+		if (pktlen <= ACCESS_ONCE(ag71xx_rx_copybreak))
+			skb = ag71xx_rx_copy(ag, buf, offset, pktlen);
+
 		if (!skb) {
-			kfree(ring->buf[i].rx_buf);
-			goto next;
-		}
+			skb = build_skb(buf->rx_buf, 0);
+			if (!skb) {
+				/* keep the buffer, refill re-arms it */
+				dev->stats.rx_dropped++;
+				goto next;
+			}
+
+			dma_unmap_single(&dev->dev, buf->dma_addr,
+					 ag->rx_buf_size, DMA_FROM_DEVICE);
+			buf->rx_buf = NULL;
 
-		skb_reserve(skb, offset);
-		skb_put(skb, pktlen);
+			skb_reserve(skb, offset);
+			skb_put(skb, pktlen);
+		}
 
 		if (ag71xx_has_ar8216(ag))
 			err = ag71xx_remove_ar8216_header(ag, skb, pktlen);
@@ -1043,7 +1081,6 @@ static int ag71xx_rx_packets(struct ag71xx *ag, int limit)
 		}
 
 next:
-		ring->buf[i].rx_buf = NULL;
 		done++;
 
 		ring->curr++;
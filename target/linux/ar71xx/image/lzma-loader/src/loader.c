@@ -132,6 +132,54 @@ static int lzma_init_props(void)
 	return res;
 }
 
+#if defined(CONFIG_FLASH_COPY) && !(LZMA_WRAPPER)
+/*
+ * Byte reads through the uncached KSEG1 flash window cost one bus
+ * transaction each. Copy the compressed kernel into RAM behind the
+ * lzma workspace instead, reading the flash through KSEG0 so that it
+ * is fetched in cache line bursts, and let LzmaDecode work on cached
+ * memory from there.
+ */
+static void lzma_copy_data(void)
+{
+	unsigned long lsize = CONFIG_CACHELINE_SIZE;
+	unsigned long probs;
+	unsigned long start;
+	uint32_t *src, *end, *dst;
+
+	probs = LzmaGetNumProbs(&lzma_state.Properties) * sizeof(CProb);
+
+	start = (unsigned long) lzma_data & ~(lsize - 1);
+	src = (uint32_t *) ((start & 0x1fffffffU) | KSEG0);
+	end = (uint32_t *) (((unsigned long) src +
+			     ((unsigned long) lzma_data - start) +
+			     lzma_datasize + lsize - 1) & ~(lsize - 1));
+	dst = (uint32_t *) (((unsigned long) workspace + probs + lsize - 1) &
+			    ~(lsize - 1));
+
+	lzma_data = (unsigned char *) dst + ((unsigned long) lzma_data - start);
+
+	/* the flash may have been rewritten since it was last read cached */
+	invalidate_dcache((unsigned long) src,
+			  (unsigned long) end - (unsigned long) src);
+
+	while (src < end) {
+		uint32_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+		w0 = src[0]; w1 = src[1]; w2 = src[2]; w3 = src[3];
+		w4 = src[4]; w5 = src[5]; w6 = src[6]; w7 = src[7];
+		dst[0] = w0; dst[1] = w1; dst[2] = w2; dst[3] = w3;
+		dst[4] = w4; dst[5] = w5; dst[6] = w6; dst[7] = w7;
+		src += 8;
+		dst += 8;
+	}
+}
+#else
+static inline void lzma_copy_data(void)
+{
+}
+#endif /* CONFIG_FLASH_COPY && !LZMA_WRAPPER */
+
 static int lzma_decompress(unsigned char *outStream)
 {
 	SizeT ip, op;
@@ -230,6 +278,8 @@ void loader_main(unsigned long reg_a0, unsigned long reg_a1,
 		halt();
 	}
 
+	lzma_copy_data();
+
 	printf("Decompressing kernel... ");
 
 	res = lzma_decompress((unsigned char *) kernel_la);
@@ -7,12 +7,39 @@
 
 static const char * const probes[] = { "bcm47xxpart", NULL };
 
+/* opcode and up to 4 address bytes */
+#define BCM53XXSF_CMD_MAX	5
+#define BCM53XXSF_PAGE_SIZE	256
+
+/*
+ * The MSPI controller releases CS at the end of every TX transfer, so the
+ * command and the data it carries can't be chained as two transfers and
+ * have to go out of one buffer. It is allocated once instead of for every
+ * command; spi-nor serializes all calls with nor->lock.
+ */
 struct bcm53xxsf {
 	struct spi_device *spi;
 	struct mtd_info mtd;
 	struct spi_nor nor;
+	u8 *buf;
+	size_t buf_len;
 };
 
+static int bcm53xxspiflash_cmd_addr(struct bcm53xxsf *b53sf, u8 *cmd,
+				    u8 opcode, loff_t addr)
+{
+	int i = 0;
+
+	cmd[i++] = opcode;
+	if (b53sf->mtd.size > 0x1000000)
+		cmd[i++] = (addr & 0xFF000000) >> 24;
+	cmd[i++] = (addr & 0x00FF0000) >> 16;
+	cmd[i++] = (addr & 0x0000FF00) >> 8;
+	cmd[i++] = (addr & 0x000000FF) >> 0;
+
+	return i;
+}
+
 /**************************************************
  * spi-nor API
  **************************************************/
@@ -29,19 +56,15 @@ static int bcm53xxspiflash_write_reg(struct spi_nor *nor, u8 opcode, u8 *buf,
 				     int len, int write_enable)
 {
 	struct bcm53xxsf *b53sf = nor->priv;
-	u8 *cmd = kzalloc(len + 1, GFP_KERNEL);
-	int err;
+	u8 *cmd = b53sf->buf;
 
-	if (!cmd)
-		return -ENOMEM;
+	if (len + 1 > b53sf->buf_len)
+		return -EINVAL;
 
 	cmd[0] = opcode;
 	memcpy(&cmd[1], buf, len);
-	err = spi_write(b53sf->spi, cmd, len + 1);
-
-	kfree(cmd);
 
-	return err;
+	return spi_write(b53sf->spi, cmd, len + 1);
 }
 
 static int bcm53xxspiflash_read(struct spi_nor *nor, loff_t from, size_t len,
@@ -50,18 +73,13 @@ static int bcm53xxspiflash_read(struct spi_nor *nor, loff_t from, size_t len,
 	struct bcm53xxsf *b53sf = nor->priv;
 	struct spi_message m;
 	struct spi_transfer t[2] = { { 0 }, { 0 } };
-	unsigned char cmd[5];
-	int cmd_len = 0;
+	unsigned char cmd[BCM53XXSF_CMD_MAX];
+	int cmd_len;
 	int err;
 
 	spi_message_init(&m);
 
-	cmd[cmd_len++] = SPINOR_OP_READ;
-	if (b53sf->mtd.size > 0x1000000)
-		cmd[cmd_len++] = (from & 0xFF000000) >> 24;
-	cmd[cmd_len++] = (from & 0x00FF0000) >> 16;
-	cmd[cmd_len++] = (from & 0x0000FF00) >> 8;
-	cmd[cmd_len++] = (from & 0x000000FF) >> 0;
+	cmd_len = bcm53xxspiflash_cmd_addr(b53sf, cmd, SPINOR_OP_READ, from);
 
 	t[0].tx_buf = cmd;
 	t[0].len = cmd_len;
@@ -87,21 +105,16 @@ static void bcm53xxspiflash_write(struct spi_nor *nor, loff_t to, size_t len,
 	struct bcm53xxsf *b53sf = nor->priv;
 	struct spi_message m;
 	struct spi_transfer t = { 0 };
-	u8 *cmd = kzalloc(len + 5, GFP_KERNEL);
-	int cmd_len = 0;
+	u8 *cmd = b53sf->buf;
+	int cmd_len;
 	int err;
 
-	if (!cmd)
+	if (len + BCM53XXSF_CMD_MAX > b53sf->buf_len)
 		return;
 
 	spi_message_init(&m);
 
-	cmd[cmd_len++] = nor->program_opcode;
-	if (b53sf->mtd.size > 0x1000000)
-		cmd[cmd_len++] = (to & 0xFF000000) >> 24;
-	cmd[cmd_len++] = (to & 0x00FF0000) >> 16;
-	cmd[cmd_len++] = (to & 0x0000FF00) >> 8;
-	cmd[cmd_len++] = (to & 0x000000FF) >> 0;
+	cmd_len = bcm53xxspiflash_cmd_addr(b53sf, cmd, nor->program_opcode, to);
 	memcpy(&cmd[cmd_len], buf, len);
 
 	t.tx_buf = cmd;
@@ -110,28 +123,19 @@ static void bcm53xxspiflash_write(struct spi_nor *nor, loff_t to, size_t len,
 
 	err = spi_sync(b53sf->spi, &m);
 	if (err)
-		goto out;
+		return;
 
 	if (retlen && m.actual_length > cmd_len)
 		*retlen += m.actual_length - cmd_len;
-
-out:
-	kfree(cmd);
 }
 
 static int bcm53xxspiflash_erase(struct spi_nor *nor, loff_t offs)
 {
 	struct bcm53xxsf *b53sf = nor->priv;
-	unsigned char cmd[5];
+	unsigned char cmd[BCM53XXSF_CMD_MAX];
 	int i;
 
-	i = 0;
-	cmd[i++] = nor->erase_opcode;
-	if (b53sf->mtd.size > 0x1000000)
-		cmd[i++] = (offs & 0xFF000000) >> 24;
-	cmd[i++] = ((offs & 0x00FF0000) >> 16);
-	cmd[i++] = ((offs & 0x0000FF00) >> 8);
-	cmd[i++] = ((offs & 0x000000FF) >> 0);
+	i = bcm53xxspiflash_cmd_addr(b53sf, cmd, nor->erase_opcode, offs);
 
 	return spi_write(b53sf->spi, cmd, i);
 }
@@ -185,6 +189,11 @@ static int bcm53xxspiflash_probe(struct spi_device *spi)
 		return -ENOMEM;
 	spi_set_drvdata(spi, b53sf);
 
+	b53sf->buf_len = BCM53XXSF_PAGE_SIZE + BCM53XXSF_CMD_MAX;
+	b53sf->buf = devm_kzalloc(&spi->dev, b53sf->buf_len, GFP_KERNEL);
+	if (!b53sf->buf)
+		return -ENOMEM;
+
 	nor = &b53sf->nor;
 	b53sf->spi = spi;
 	b53sf->mtd.priv = &b53sf->nor;
@@ -203,6 +212,14 @@ static int bcm53xxspiflash_probe(struct spi_device *spi)
 	if (err)
 		return err;
 
+	if (nor->page_size > BCM53XXSF_PAGE_SIZE) {
+		b53sf->buf_len = nor->page_size + BCM53XXSF_CMD_MAX;
+		b53sf->buf = devm_kzalloc(&spi->dev, b53sf->buf_len,
+					  GFP_KERNEL);
+		if (!b53sf->buf)
+			return -ENOMEM;
+	}
+
 	err = mtd_device_parse_register(&b53sf->mtd, probes, NULL, NULL, 0);
 	if (err)
 		return err;
@@ -22,6 +22,7 @@
 #include <linux/platform_device.h>
 #include <linux/platform_data/cns3xxx.h>
 #include <linux/skbuff.h>
+#include <linux/timer.h>
 
 #define DRV_NAME "cns3xxx_eth"
 
@@ -29,6 +30,11 @@
 #define TX_DESCS 128
 #define TX_DESC_RESERVE	20
 
+/* TX descriptors are reclaimed from NAPI, which xmit schedules once this
+ * many are in use, or a timer after this long otherwise */
+#define TX_COALESCE_FRAMES	32
+#define TX_COALESCE_USECS	1000
+
 #define RX_POOL_ALLOC_SIZE (sizeof(struct rx_desc) * RX_DESCS)
 #define TX_POOL_ALLOC_SIZE (sizeof(struct tx_desc) * TX_DESCS)
 #define REGS_SIZE 336
@@ -88,6 +94,12 @@
 #define QUEUE_THRESHOLD 0x000000f0
 #define CLR_FS_STATE 0x80000000
 
+/* Delayed Interrupt Defines, time unit is 20.48 us */
+#define DELAY_INTR_EN 0x00010000
+#define DELAY_INTR_CNT_OFFSET 8
+#define DELAY_INTR_MAX 0xff
+#define DELAY_INTR_TIME_NS 20480
+
 /* Interrupt Status Defines */
 #define MAC0_STATUS_CHANGE 0x00004000
 #define MAC1_STATUS_CHANGE 0x00008000
@@ -289,6 +301,11 @@ struct sw {
 	struct sk_buff *frag_first;
 	struct sk_buff *frag_last;
 	struct device *dev;
+	struct timer_list tx_timer;
+	u32 tx_coalesce_frames;
+	u32 tx_coalesce_usecs;
+	u32 rx_coalesce_frames;
+	u32 rx_coalesce_usecs;
 	int rx_irq;
 	int stat_irq;
 };
@@ -446,6 +463,13 @@ static void eth_schedule_poll(struct sw *sw)
 	__napi_schedule(&sw->napi);
 }
 
+static void eth_tx_timer(unsigned long data)
+{
+	struct sw *sw = (struct sw *) data;
+
+	eth_schedule_poll(sw);
+}
+
 irqreturn_t eth_rx_irq(int irq, void *pdev)
 {
 	struct net_device *dev = pdev;
@@ -584,13 +608,13 @@ static void eth_check_num_used(struct _tx_ring *tx_ring)
 	}
 }
 
-static void eth_complete_tx(struct sw *sw)
+static int eth_complete_tx(struct sw *sw, int budget)
 {
 	struct _tx_ring *tx_ring = &sw->tx_ring;
 	struct tx_desc *desc;
 	int i;
 	int index;
-	int num_used = tx_ring->num_used;
+	int num_used = min(tx_ring->num_used, budget);
 	struct sk_buff *skb;
 
 	index = tx_ring->free_index;
@@ -616,6 +640,8 @@ static void eth_complete_tx(struct sw *sw)
 	tx_ring->free_index = index;
 	tx_ring->num_used -= i;
 	eth_check_num_used(tx_ring);
+
+	return i;
 }
 
 static int eth_poll(struct napi_struct *napi, int budget)
@@ -627,6 +653,11 @@ static int eth_poll(struct napi_struct *napi, int budget)
 	unsigned int i = rx_ring->cur_index;
 	struct rx_desc *desc = &(rx_ring)->desc[i];
 	unsigned int alloc_count = rx_ring->alloc_count;
+	int tx_done;
+
+	spin_lock_bh(&tx_lock);
+	tx_done = eth_complete_tx(sw, budget);
+	spin_unlock_bh(&tx_lock);
 
 	while (desc->cown && alloc_count + received < RX_DESCS - 1) {
 		struct sk_buff *skb;
@@ -715,7 +746,17 @@ static int eth_poll(struct napi_struct *napi, int budget)
 	}
 
 	rx_ring->cur_index = i;
-	if (!received) {
+
+	cns3xxx_alloc_rx_buf(sw, received);
+
+	wmb();
+	enable_rx_dma(sw);
+
+	/* stay in polling while either ring used up its budget */
+	if (tx_done >= budget)
+		return budget;
+
+	if (received < budget) {
 		napi_complete(napi);
 		enable_irq(sw->rx_irq);
 
@@ -724,15 +765,6 @@ static int eth_poll(struct napi_struct *napi, int budget)
 			eth_schedule_poll(sw);
 	}
 
-	spin_lock_bh(&tx_lock);
-	eth_complete_tx(sw);
-	spin_unlock_bh(&tx_lock);
-
-	cns3xxx_alloc_rx_buf(sw, received);
-
-	wmb();
-	enable_rx_dma(sw);
-
 	return received;
 }
 
@@ -771,6 +803,8 @@ static int eth_xmit(struct sk_buff *skb, struct net_device *dev)
 	int len0;
 	unsigned int i;
 	u32 config0;
+	bool more = skb->xmit_more;
+	bool reclaim;
 
 	if (pmap == 8)
 		pmap = (1 << 4);
@@ -778,10 +812,12 @@ static int eth_xmit(struct sk_buff *skb, struct net_device *dev)
 	skb_walk_frags(skb, skb1)
 		nr_desc++;
 
-	eth_schedule_poll(sw);
 	spin_lock_bh(&tx_lock);
 	if ((tx_ring->num_used + nr_desc + 1) >= TX_DESCS) {
 		spin_unlock_bh(&tx_lock);
+		/* frames held back by xmit_more must not wait on us */
+		enable_tx_dma(sw);
+		eth_schedule_poll(sw);
 		return NETDEV_TX_BUSY;
 	}
 
@@ -822,6 +858,9 @@ static int eth_xmit(struct sk_buff *skb, struct net_device *dev)
 			     skb1->len, config0, pmap);
 	}
 
+	dev->stats.tx_packets++;
+	dev->stats.tx_bytes += skb->len;
+
 	tx_ring->buff_tab[index0] = skb;
 	eth_set_desc(sw, tx_ring, index0, index_last, skb->data, len0,
 		     config0 | FIRST_SEGMENT, pmap);
@@ -830,12 +869,20 @@ static int eth_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	spin_lock(&tx_lock);
 	tx_ring->num_used += nr_desc + 1;
+	eth_check_num_used(tx_ring);
+	reclaim = tx_ring->stopped ||
+		  (!more && tx_ring->num_used >= sw->tx_coalesce_frames);
 	spin_unlock(&tx_lock);
 
-	dev->stats.tx_packets++;
-	dev->stats.tx_bytes += skb->len;
+	/* the DMA is kicked once for a batch of frames from the stack */
+	if (!more || tx_ring->stopped)
+		enable_tx_dma(sw);
 
-	enable_tx_dma(sw);
+	if (reclaim)
+		eth_schedule_poll(sw);
+	else if (!timer_pending(&sw->tx_timer))
+		mod_timer(&sw->tx_timer, jiffies +
+			  usecs_to_jiffies(sw->tx_coalesce_usecs));
 
 	return NETDEV_TX_OK;
 }
@@ -876,12 +923,58 @@ static int cns3xxx_nway_reset(struct net_device *dev)
 	return phy_start_aneg(port->phydev);
 }
 
+static int cns3xxx_get_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec)
+{
+	struct port *port = netdev_priv(dev);
+	struct sw *sw = port->sw;
+
+	ec->rx_coalesce_usecs = sw->rx_coalesce_usecs;
+	ec->rx_max_coalesced_frames = sw->rx_coalesce_frames;
+	ec->tx_coalesce_usecs = sw->tx_coalesce_usecs;
+	ec->tx_max_coalesced_frames = sw->tx_coalesce_frames;
+	return 0;
+}
+
+/* RX uses the delayed interrupt of the switch, TX only sets how soon xmit
+ * has the descriptors reclaimed. Both are shared by all ports. */
+static int cns3xxx_set_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec)
+{
+	struct port *port = netdev_priv(dev);
+	struct sw *sw = port->sw;
+	u32 rx_time, cfg = 0;
+
+	if (ec->rx_coalesce_usecs > DELAY_INTR_MAX * DELAY_INTR_TIME_NS / 1000 ||
+	    ec->rx_max_coalesced_frames > DELAY_INTR_MAX)
+		return -EINVAL;
+
+	if (!ec->tx_max_coalesced_frames || !ec->tx_coalesce_usecs ||
+	    ec->tx_max_coalesced_frames > TX_DESCS - TX_DESC_RESERVE)
+		return -EINVAL;
+
+	rx_time = DIV_ROUND_UP(ec->rx_coalesce_usecs * 1000,
+			       DELAY_INTR_TIME_NS);
+	if (rx_time || ec->rx_max_coalesced_frames)
+		cfg = DELAY_INTR_EN | rx_time |
+		      (ec->rx_max_coalesced_frames << DELAY_INTR_CNT_OFFSET);
+	__raw_writel(cfg, &sw->regs->delay_intr_cfg);
+
+	sw->rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	sw->rx_coalesce_frames = ec->rx_max_coalesced_frames;
+	sw->tx_coalesce_usecs = ec->tx_coalesce_usecs;
+	sw->tx_coalesce_frames = ec->tx_max_coalesced_frames;
+	return 0;
+}
+
 static struct ethtool_ops cns3xxx_ethtool_ops = {
 	.get_drvinfo = cns3xxx_get_drvinfo,
 	.get_settings = cns3xxx_get_settings,
 	.set_settings = cns3xxx_set_settings,
 	.nway_reset = cns3xxx_nway_reset,
 	.get_link = ethtool_op_get_link,
+	.get_coalesce = cns3xxx_get_coalesce,
+	.set_coalesce = cns3xxx_set_coalesce,
 };
 
 
@@ -1059,6 +1152,7 @@ static int eth_close(struct net_device *dev)
 		disable_irq(sw->stat_irq);
 		free_irq(sw->stat_irq, napi_dev);
 		napi_disable(&sw->napi);
+		del_timer_sync(&sw->tx_timer);
 		netif_stop_queue(napi_dev);
 		temp = __raw_readl(&sw->regs->mac_cfg[2]);
 		temp |= (PORT_DISABLE);
@@ -1203,6 +1297,10 @@ static int eth_init_one(struct platform_device *pdev)
 	sw->regs = regs;
 	sw->dev = &pdev->dev;
 
+	sw->tx_coalesce_frames = TX_COALESCE_FRAMES;
+	sw->tx_coalesce_usecs = TX_COALESCE_USECS;
+	setup_timer(&sw->tx_timer, eth_tx_timer, (unsigned long) sw);
+
 	sw->rx_irq = platform_get_irq_byname(pdev, "eth_rx");
 	sw->stat_irq = platform_get_irq_byname(pdev, "eth_stat");
 
@@ -798,26 +798,18 @@ crypto_unblock(u_int32_t driverid, int what)
 }
 
 /*
- * Add a crypto request to a queue, to be processed by the kernel thread.
+ * Hand an admitted request to its driver, or queue it for the kernel
+ * thread if it asked for batching or the driver is blocked.  Called and
+ * returns with the queue lock held; *queued is set when the request was
+ * put on crp_q so the caller knows the thread needs a wakeup.
  */
-int
-crypto_dispatch(struct cryptop *crp)
+static int
+crypto_dispatch_locked(struct cryptop *crp, int hint, unsigned long *q_flagsp,
+		int *queued)
 {
 	struct cryptocap *cap;
+	unsigned long q_flags = *q_flagsp;
 	int result = -1;
-	unsigned long q_flags;
-
-	dprintk("%s()\n", __FUNCTION__);
-
-	cryptostats.cs_ops++;
-
-	CRYPTO_Q_LOCK();
-	if (crypto_q_cnt >= crypto_q_max) {
-		cryptostats.cs_drops++;
-		CRYPTO_Q_UNLOCK();
-		return ENOMEM;
-	}
-	crypto_q_cnt++;
 
 	/* make sure we are starting a fresh run on this crp. */
 	crp->crp_flags &= ~CRYPTO_F_DONE;
@@ -836,7 +828,7 @@ crypto_dispatch(struct cryptop *crp)
 			crypto_all_qblocked = 0;
 			crypto_drivers[hid].cc_unqblocked = 1;
 			CRYPTO_Q_UNLOCK();
-			result = crypto_invoke(cap, crp, 0);
+			result = crypto_invoke(cap, crp, hint);
 			CRYPTO_Q_LOCK();
 			if (result == ERESTART)
 				if (crypto_drivers[hid].cc_unqblocked)
@@ -844,6 +836,7 @@ crypto_dispatch(struct cryptop *crp)
 			crypto_drivers[hid].cc_unqblocked = 0;
 		}
 	}
+	*queued = 0;
 	if (result == ERESTART) {
 		/*
 		 * The driver ran out of resources, mark the
@@ -856,16 +849,88 @@ crypto_dispatch(struct cryptop *crp)
 		 */
 		list_add(&crp->crp_next, &crp_q);
 		cryptostats.cs_blocks++;
+		*queued = 1;
 		result = 0;
 	} else if (result == -1) {
 		TAILQ_INSERT_TAIL(&crp_q, crp, crp_next);
+		*queued = 1;
 		result = 0;
 	}
-	wake_up_interruptible(&cryptoproc_wait);
+	*q_flagsp = q_flags;
+	return result;
+}
+
+/*
+ * Add a crypto request to a queue, to be processed by the kernel thread.
+ */
+int
+crypto_dispatch(struct cryptop *crp)
+{
+	int result, queued;
+	unsigned long q_flags;
+
+	dprintk("%s()\n", __FUNCTION__);
+
+	cryptostats.cs_ops++;
+
+	CRYPTO_Q_LOCK();
+	if (crypto_q_cnt >= crypto_q_max) {
+		cryptostats.cs_drops++;
+		CRYPTO_Q_UNLOCK();
+		return ENOMEM;
+	}
+	crypto_q_cnt++;
+
+	result = crypto_dispatch_locked(crp, 0, &q_flags, &queued);
+	/* requests the driver took directly need no help from the thread */
+	if (queued)
+		wake_up_interruptible(&cryptoproc_wait);
 	CRYPTO_Q_UNLOCK();
 	return result;
 }
 
+/*
+ * Dispatch an array of crypto requests.  Admission against crypto_q_max
+ * is done once for the whole array, consecutive requests for the same
+ * driver are passed with CRYPTO_HINT_MORE so it can defer starting the
+ * hardware, and the kernel thread is woken at most once.  Returns the
+ * number of requests accepted; the remaining ones (from the end of the
+ * array) were dropped because the queue is full and are untouched.
+ */
+int
+crypto_dispatch_batch(struct cryptop **crps, int num)
+{
+	int i, accepted, hint, queued, anyqueued = 0;
+	unsigned long q_flags;
+
+	dprintk("%s(%d)\n", __FUNCTION__, num);
+
+	cryptostats.cs_ops += num;
+
+	CRYPTO_Q_LOCK();
+	accepted = crypto_q_max - crypto_q_cnt;
+	if (accepted < 0)
+		accepted = 0;
+	if (accepted > num)
+		accepted = num;
+	cryptostats.cs_drops += num - accepted;
+	crypto_q_cnt += accepted;
+
+	for (i = 0; i < accepted; i++) {
+		hint = 0;
+		if (i + 1 < accepted && CRYPTO_SESID2HID(crps[i + 1]->crp_sid) ==
+				CRYPTO_SESID2HID(crps[i]->crp_sid))
+			hint = CRYPTO_HINT_MORE;
+		crypto_dispatch_locked(crps[i], hint, &q_flags, &queued);
+		anyqueued |= queued;
+	}
+
+	if (anyqueued)
+		wake_up_interruptible(&cryptoproc_wait);
+	CRYPTO_Q_UNLOCK();
+	return accepted;
+}
+
 /*
  * Add an asymetric crypto request to a queue,
  * to be processed by the kernel thread.
@@ -1747,6 +1812,7 @@ EXPORT_SYMBOL(crypto_unregister);
 EXPORT_SYMBOL(crypto_unregister_all);
 EXPORT_SYMBOL(crypto_unblock);
 EXPORT_SYMBOL(crypto_dispatch);
+EXPORT_SYMBOL(crypto_dispatch_batch);
 EXPORT_SYMBOL(crypto_kdispatch);
 EXPORT_SYMBOL(crypto_freereq);
 EXPORT_SYMBOL(crypto_getreq);
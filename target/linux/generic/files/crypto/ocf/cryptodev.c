@@ -58,6 +58,8 @@ __FBSDID("$FreeBSD: src/sys/opencrypto/cryptodev.c,v 1.34 2007/05/09 19:37:02 gn
 #include <linux/file.h>
 #include <linux/mount.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
 #include <asm/uaccess.h>
 
 #include <cryptodev.h>
@@ -70,6 +72,19 @@ int cryptodev_debug = 0;
 module_param(cryptodev_debug, int, 0644);
 MODULE_PARM_DESC(cryptodev_debug, "Enable cryptodev debug");
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,27)
+/*
+ * In place requests (dst == src) can be run directly on the caller's
+ * pages.  The request then reaches the driver as one iovec per page,
+ * which not every driver copes with, so this is off by default.
+ */
+static int cryptodev_zerocopy = 0;
+module_param(cryptodev_zerocopy, int, 0644);
+MODULE_PARM_DESC(cryptodev_zerocopy,
+	   "Map in-place user buffers instead of copying them "
+	   "(driver must handle multi-segment requests)");
+#endif
+
 struct csession_info {
 	u_int16_t	blocksize;
 	u_int16_t	minkey, maxkey;
@@ -104,6 +119,9 @@ struct csession {
 	struct iovec	iovec;
 	struct uio	uio;
 	int		error;
+
+	struct page	**pages;	/* pinned user pages, zero-copy only */
+	int		npages;
 };
 
 struct fcrypt {
@@ -162,11 +180,92 @@ checkcrid(int crid)
 	return 0;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,27)
+/*
+ * Pin the user buffer of an in-place request and describe it with one
+ * iovec per page, plus a kernel iovec for the MAC trailer.  Returns
+ * non-zero if the buffer cannot be used directly, in which case the
+ * caller falls back to copying.
+ */
+static int
+cryptodev_map_user(struct csession *cse, struct crypt_op *cop)
+{
+	unsigned long start = (unsigned long) cop->src;
+	unsigned long off = start & ~PAGE_MASK;
+	int npages = (off + cop->len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	int i, n, len;
+	struct iovec *iov;
+
+	cse->pages = kmalloc(npages * sizeof(*cse->pages), GFP_KERNEL);
+	iov = kmalloc((npages + 1) * sizeof(*iov), GFP_KERNEL);
+	if (cse->pages == NULL || iov == NULL)
+		goto bail;
+
+	n = get_user_pages_fast(start & PAGE_MASK, npages, 1, cse->pages);
+	if (n < 0)
+		n = 0;
+	cse->npages = n;
+	if (n < npages)
+		goto bail;
+
+	len = cop->len;
+	for (i = 0; i < npages; i++) {
+		/* drivers want kernel virtual addresses */
+		if (PageHighMem(cse->pages[i]))
+			goto bail;
+		iov[i].iov_base = page_address(cse->pages[i]) + off;
+		iov[i].iov_len = min_t(int, len, PAGE_SIZE - off);
+		len -= iov[i].iov_len;
+		off = 0;
+	}
+
+	if (cse->info.authsize) {
+		iov[i].iov_base = kmalloc(cse->info.authsize, GFP_KERNEL);
+		if (iov[i].iov_base == NULL)
+			goto bail;
+		iov[i++].iov_len = cse->info.authsize;
+	}
+
+	cse->uio.uio_iov = iov;
+	cse->uio.uio_iovcnt = i;
+	return 0;
+
+bail:
+	for (i = 0; i < cse->npages; i++)
+		put_page(cse->pages[i]);
+	kfree(cse->pages);
+	kfree(iov);
+	cse->pages = NULL;
+	cse->npages = 0;
+	return -1;
+}
+
+static void
+cryptodev_unmap_user(struct csession *cse)
+{
+	int i;
+
+	for (i = 0; i < cse->npages; i++) {
+		set_page_dirty_lock(cse->pages[i]);
+		put_page(cse->pages[i]);
+	}
+	if (cse->info.authsize)
+		kfree(cse->uio.uio_iov[cse->uio.uio_iovcnt - 1].iov_base);
+	kfree(cse->uio.uio_iov);
+	kfree(cse->pages);
+	cse->pages = NULL;
+	cse->npages = 0;
+	cse->uio.uio_iov = &cse->iovec;
+	cse->uio.uio_iovcnt = 1;
+}
+#endif
+
 static int
 cryptodev_op(struct csession *cse, struct crypt_op *cop)
 {
 	struct cryptop *crp = NULL;
 	struct cryptodesc *crde = NULL, *crda = NULL;
+	caddr_t mac;
 	int error = 0;
 
 	dprintk("%s()\n", __FUNCTION__);
@@ -190,16 +289,27 @@ cryptodev_op(struct csession *cse, struct crypt_op *cop)
 	cse->uio.uio_rw = UIO_WRITE;
 	cse->uio.uio_td = td;
 #endif
-	cse->uio.uio_iov[0].iov_len = cop->len;
-	if (cse->info.authsize)
-		cse->uio.uio_iov[0].iov_len += cse->info.authsize;
-	cse->uio.uio_iov[0].iov_base = kmalloc(cse->uio.uio_iov[0].iov_len,
-			GFP_KERNEL);
+	cse->uio.uio_iov[0].iov_base = NULL;
 
-	if (cse->uio.uio_iov[0].iov_base == NULL) {
-		dprintk("%s: iov_base kmalloc(%d) failed\n", __FUNCTION__,
-				(int)cse->uio.uio_iov[0].iov_len);
-		return (ENOMEM);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,27)
+	if (cryptodev_zerocopy && cop->len && cop->dst == cop->src &&
+			cryptodev_map_user(cse, cop) == 0) {
+		mac = cse->uio.uio_iov[cse->uio.uio_iovcnt - 1].iov_base;
+	} else
+#endif
+	{
+		cse->uio.uio_iov[0].iov_len = cop->len;
+		if (cse->info.authsize)
+			cse->uio.uio_iov[0].iov_len += cse->info.authsize;
+		cse->uio.uio_iov[0].iov_base = kmalloc(cse->uio.uio_iov[0].iov_len,
+				GFP_KERNEL);
+
+		if (cse->uio.uio_iov[0].iov_base == NULL) {
+			dprintk("%s: iov_base kmalloc(%d) failed\n", __FUNCTION__,
+					(int)cse->uio.uio_iov[0].iov_len);
+			return (ENOMEM);
+		}
+		mac = (caddr_t)cse->uio.uio_iov[0].iov_base + cop->len;
 	}
 
 	crp = crypto_getreq((cse->info.blocksize != 0) + (cse->info.authsize != 0));
@@ -227,7 +337,8 @@ cryptodev_op(struct csession *cse, struct crypt_op *cop)
 		goto bail;
 	}
 
-	if ((error = copy_from_user(cse->uio.uio_iov[0].iov_base, cop->src,
+	if (cse->pages == NULL &&
+			(error = copy_from_user(cse->uio.uio_iov[0].iov_base, cop->src,
 					cop->len))) {
 		dprintk("%s: bad copy\n", __FUNCTION__);
 		goto bail;
@@ -256,7 +367,7 @@ cryptodev_op(struct csession *cse, struct crypt_op *cop)
 		crde->crd_klen = cse->keylen * 8;
 	}
 
-	crp->crp_ilen = cse->uio.uio_iov[0].iov_len;
+	crp->crp_ilen = cop->len + cse->info.authsize;
 	crp->crp_flags = CRYPTO_F_IOV | CRYPTO_F_CBIMM
 		       | (cop->flags & COP_F_BATCH);
 	crp->crp_buf = (caddr_t)&cse->uio;
@@ -343,16 +454,14 @@ cryptodev_op(struct csession *cse, struct crypt_op *cop)
 		goto bail;
 	}
 
-	if (cop->dst && (error = copy_to_user(cop->dst,
+	if (cop->dst && cse->pages == NULL && (error = copy_to_user(cop->dst,
 					cse->uio.uio_iov[0].iov_base, cop->len))) {
 		dprintk("%s bad dst copy\n", __FUNCTION__);
 		goto bail;
 	}
 
 	if (cop->mac &&
-			(error=copy_to_user(cop->mac,
-				(caddr_t)cse->uio.uio_iov[0].iov_base + cop->len,
-				cse->info.authsize))) {
+			(error=copy_to_user(cop->mac, mac, cse->info.authsize))) {
 		dprintk("%s bad mac copy\n", __FUNCTION__);
 		goto bail;
 	}
@@ -360,6 +469,11 @@ cryptodev_op(struct csession *cse, struct crypt_op *cop)
 bail:
 	if (crp)
 		crypto_freereq(crp);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,27)
+	if (cse->pages)
+		cryptodev_unmap_user(cse);
+	else
+#endif
 	if (cse->uio.uio_iov[0].iov_base)
 		kfree(cse->uio.uio_iov[0].iov_base);
 
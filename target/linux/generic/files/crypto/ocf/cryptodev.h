@@ -436,6 +436,7 @@ extern	int crypto_kregister(u_int32_t, int, u_int32_t);
 extern	int crypto_unregister(u_int32_t driverid, int alg);
 extern	int crypto_unregister_all(u_int32_t driverid);
 extern	int crypto_dispatch(struct cryptop *crp);
+extern	int crypto_dispatch_batch(struct cryptop **crps, int num);
 extern	int crypto_kdispatch(struct cryptkop *);
 #define CRYPTO_SYMQ	0x1
 #define CRYPTO_ASYMQ	0x2
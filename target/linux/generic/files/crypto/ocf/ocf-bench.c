@@ -85,6 +85,25 @@ static int request_size = 1488;
 module_param(request_size, int, 0);
 MODULE_PARM_DESC(request_size, "size of each request");
 
+/*
+ * optionally sweep a list of request sizes instead of request_size
+ */
+#define MAX_BENCH_SIZES 8
+static int request_sizes[MAX_BENCH_SIZES];
+static int request_nsizes;
+module_param_array(request_sizes, int, &request_nsizes, 0);
+MODULE_PARM_DESC(request_sizes, "list of request sizes to benchmark");
+
+/*
+ * optionally run against each of the named OCF drivers in turn,
+ * rather than letting crypto_newsession pick one
+ */
+#define MAX_BENCH_DRIVERS 8
+static char *request_drivers[MAX_BENCH_DRIVERS];
+static int request_ndrivers;
+module_param_array(request_drivers, charp, &request_ndrivers, 0);
+MODULE_PARM_DESC(request_drivers, "list of OCF drivers to benchmark (e.g. cryptosoft,hifn0)");
+
 /*
  * OCF batching of requests
  */
@@ -124,7 +143,7 @@ static int total;
 static uint64_t ocf_cryptoid;
 static unsigned long jstart, jstop;
 
-static int ocf_init(void);
+static int ocf_init(int crid);
 static int ocf_cb(struct cryptop *crp);
 static void ocf_request(void *arg);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,20)
@@ -132,7 +151,7 @@ static void ocf_request_wq(struct work_struct *work);
 #endif
 
 static int
-ocf_init(void)
+ocf_init(int crid)
 {
 	int error;
 	struct cryptoini crie, cria;
@@ -154,8 +173,7 @@ ocf_init(void)
 
 	crie.cri_next = &cria;
 
-	error = crypto_newsession(&ocf_cryptoid, &crie,
-				CRYPTOCAP_F_HARDWARE | CRYPTOCAP_F_SOFTWARE);
+	error = crypto_newsession(&ocf_cryptoid, &crie, crid);
 	if (error) {
 		printk("crypto_newsession failed %d\n", error);
 		return -1;
@@ -402,15 +420,68 @@ ixp_done(void)
 #endif /* BENCH_IXP_ACCESS_LIB */
 /*************************************************************************/
 
+/*
+ * run one OCF pass of request_size byte requests against crid
+ */
+static int
+ocf_run(const char *name, int crid)
+{
+	int i;
+	unsigned long mbps, usecs;
+	unsigned long flags;
+
+	printk("OCF: testing %s with %d byte requests ...\n", name, request_size);
+	if (ocf_init(crid) == -1)
+		return -EINVAL;
+
+	spin_lock_init(&ocfbench_counter_lock);
+	total = outstanding = 0;
+	jstart = jiffies;
+	for (i = 0; i < request_q_len; i++) {
+		spin_lock_irqsave(&ocfbench_counter_lock, flags);
+		outstanding++;
+		spin_unlock_irqrestore(&ocfbench_counter_lock, flags);
+		ocf_request(&requests[i]);
+	}
+	while (outstanding > 0)
+		schedule();
+	jstop = jiffies;
+
+	mbps = 0;
+	usecs = 0;
+	if (jstop > jstart) {
+		mbps = (unsigned long) total * (unsigned long) request_size * 8;
+		mbps /= ((jstop - jstart) * 1000) / HZ;
+	}
+	if (total)
+		usecs = jiffies_to_usecs(jstop - jstart) / total;
+	printk("OCF: %s: %d requests of %d bytes in %d jiffies (%d.%03d Mbps, %lu us/request)\n",
+			name, total, request_size, (int)(jstop - jstart),
+			((int)mbps) / 1000, ((int)mbps) % 1000, usecs);
+	ocf_done();
+	return 0;
+}
+
 int
 ocfbench_init(void)
 {
-	int i;
+	int i, j, crid, max_size;
+#ifdef BENCH_IXP_ACCESS_LIB
 	unsigned long mbps;
 	unsigned long flags;
+#endif
 
 	printk("Crypto Speed tests\n");
 
+	max_size = request_size;
+	for (i = 0; i < request_nsizes; i++)
+		if (request_sizes[i] > max_size)
+			max_size = request_sizes[i];
+	if (request_nsizes == 0) {
+		request_sizes[0] = request_size;
+		request_nsizes = 1;
+	}
+
 	requests = kmalloc(sizeof(request_t) * request_q_len, GFP_KERNEL);
 	if (!requests) {
 		printk("malloc failed\n");
@@ -424,43 +495,31 @@ ocfbench_init(void)
 #else
 		INIT_WORK(&requests[i].work, ocf_request, &requests[i]);
 #endif
-		requests[i].buffer = kmalloc(request_size + 128, GFP_DMA);
+		requests[i].buffer = kmalloc(max_size + 128, GFP_DMA);
 		if (!requests[i].buffer) {
 			printk("malloc failed\n");
 			return -EINVAL;
 		}
-		memset(requests[i].buffer, '0' + i, request_size + 128);
+		memset(requests[i].buffer, '0' + i, max_size + 128);
 	}
 
 	/*
-	 * OCF benchmark
+	 * OCF benchmark, every size against every requested driver so
+	 * the crossover point between hardware and software shows up
 	 */
-	printk("OCF: testing ...\n");
-	if (ocf_init() == -1)
-		return -EINVAL;
-
-	spin_lock_init(&ocfbench_counter_lock);
-	total = outstanding = 0;
-	jstart = jiffies;
-	for (i = 0; i < request_q_len; i++) {
-		spin_lock_irqsave(&ocfbench_counter_lock, flags);
-		outstanding++;
-		spin_unlock_irqrestore(&ocfbench_counter_lock, flags);
-		ocf_request(&requests[i]);
-	}
-	while (outstanding > 0)
-		schedule();
-	jstop = jiffies;
-
-	mbps = 0;
-	if (jstop > jstart) {
-		mbps = (unsigned long) total * (unsigned long) request_size * 8;
-		mbps /= ((jstop - jstart) * 1000) / HZ;
+	for (j = 0; j < request_nsizes; j++) {
+		request_size = request_sizes[j];
+		if (request_ndrivers == 0)
+			ocf_run("any", CRYPTOCAP_F_HARDWARE | CRYPTOCAP_F_SOFTWARE);
+		for (i = 0; i < request_ndrivers; i++) {
+			crid = crypto_find_driver(request_drivers[i]);
+			if (crid == -1) {
+				printk("OCF: no driver %s\n", request_drivers[i]);
+				continue;
+			}
+			ocf_run(request_drivers[i], crid);
+		}
 	}
-	printk("OCF: %d requests of %d bytes in %d jiffies (%d.%03d Mbps)\n",
-			total, request_size, (int)(jstop - jstart),
-			((int)mbps) / 1000, ((int)mbps) % 1000);
-	ocf_done();
 
 #ifdef BENCH_IXP_ACCESS_LIB
 	/*
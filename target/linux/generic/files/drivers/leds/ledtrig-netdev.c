@@ -21,9 +21,12 @@
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
 #include <linux/device.h>
 #include <linux/netdevice.h>
+#include <linux/skbuff.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
 #include <linux/ctype.h>
 #include <linux/leds.h>
 
@@ -41,6 +44,10 @@
  *   tx:   LED blinks on transmitted data
  *   rx:   LED blinks on receive data
  *
+ * All LEDs watching the same device share one timer, so its statistics are
+ * read once per tick. After idle_intervals ticks without traffic the timer
+ * is stopped and a packet tap on the device restarts it on the next packet.
+ *
  * Some suggestions:
  *
  *  Simple link status LED:
@@ -67,31 +74,387 @@
 #define MODE_TX   2
 #define MODE_RX   4
 
-struct led_netdev_data {
+static unsigned idle_intervals = 10;
+module_param(idle_intervals, uint, 0644);
+MODULE_PARM_DESC(idle_intervals,
+	"Stop polling after this many intervals without traffic, 0 to always poll");
+
+/* state shared by all LEDs watching the same device name */
+struct netdev_trig_watch {
+	struct list_head list;
+	struct list_head leds;
 	spinlock_t lock;
 
 	struct timer_list timer;
 	struct notifier_block notifier;
 
-	struct led_classdev *led_cdev;
+	char device_name[IFNAMSIZ];
 	struct net_device *net_dev;
+	unsigned link_up;
+
+	/* polling stopped, waiting for the tap to see a packet */
+	unsigned idle;
+	bool sleeping;
+	struct mutex tap_lock;
+	struct packet_type tap;
+	struct net_device *tap_dev;
+	struct work_struct tap_work;
+};
+
+struct led_netdev_data {
+	struct list_head list;
+	struct netdev_trig_watch *watch;
+
+	struct led_classdev *led_cdev;
 
 	char device_name[IFNAMSIZ];
 	unsigned interval;
 	unsigned mode;
-	unsigned link_up;
 	unsigned last_activity;
+	unsigned long next;
 };
 
+/* protects the watch list and the binding of LEDs to watches */
+static DEFINE_MUTEX(netdev_trig_mutex);
+static LIST_HEAD(netdev_trig_watches);
+
+static bool netdev_trig_polls(struct netdev_trig_watch *w,
+			      struct led_netdev_data *trigger_data)
+{
+	return w->link_up && w->net_dev &&
+	       (trigger_data->mode & (MODE_TX | MODE_RX)) != 0;
+}
+
 static void set_baseline_state(struct led_netdev_data *trigger_data)
 {
-	if ((trigger_data->mode & MODE_LINK) != 0 && trigger_data->link_up)
+	struct netdev_trig_watch *w = trigger_data->watch;
+
+	if ((trigger_data->mode & MODE_LINK) != 0 && w && w->link_up)
 		led_set_brightness(trigger_data->led_cdev, LED_FULL);
 	else
 		led_set_brightness(trigger_data->led_cdev, LED_OFF);
+}
+
+/* arm the timer for the LED due first, watch lock held */
+static void netdev_trig_schedule(struct netdev_trig_watch *w)
+{
+	struct led_netdev_data *trigger_data;
+	unsigned long next = 0;
+	bool armed = false;
+
+	list_for_each_entry(trigger_data, &w->leds, list) {
+		if (!netdev_trig_polls(w, trigger_data))
+			continue;
+
+		if (!armed || time_before(trigger_data->next, next))
+			next = trigger_data->next;
+		armed = true;
+	}
+
+	if (armed)
+		mod_timer(&w->timer, next);
+}
+
+/* leave idle mode, the tap is taken down from process context */
+static void netdev_trig_wake(struct netdev_trig_watch *w)
+{
+	w->idle = 0;
+	if (w->sleeping) {
+		w->sleeping = false;
+		schedule_work(&w->tap_work);
+	}
+}
+
+/* reset all LEDs of a watch to their base state, watch lock held */
+static void netdev_trig_update(struct netdev_trig_watch *w)
+{
+	struct led_netdev_data *trigger_data;
+
+	list_for_each_entry(trigger_data, &w->leds, list) {
+		set_baseline_state(trigger_data);
+		trigger_data->next = jiffies + trigger_data->interval;
+	}
+
+	netdev_trig_wake(w);
+	netdev_trig_schedule(w);
+}
+
+static int netdev_trig_tap_rcv(struct sk_buff *skb, struct net_device *dev,
+			       struct packet_type *pt,
+			       struct net_device *orig_dev)
+{
+	struct netdev_trig_watch *w = container_of(pt, struct netdev_trig_watch, tap);
+	struct led_netdev_data *trigger_data;
+
+	spin_lock(&w->lock);
+	if (w->sleeping) {
+		netdev_trig_wake(w);
+		list_for_each_entry(trigger_data, &w->leds, list)
+			trigger_data->next = jiffies;
+		netdev_trig_schedule(w);
+	}
+	spin_unlock(&w->lock);
+
+	kfree_skb(skb);
+	return 0;
+}
+
+/* bring the packet tap in line with the idle state of the watch */
+static void netdev_trig_tap_sync(struct work_struct *work)
+{
+	struct netdev_trig_watch *w = container_of(work, struct netdev_trig_watch, tap_work);
+	struct net_device *dev;
+
+	mutex_lock(&w->tap_lock);
+
+	spin_lock_bh(&w->lock);
+	dev = w->sleeping ? w->net_dev : NULL;
+	if (dev)
+		dev_hold(dev);
+	spin_unlock_bh(&w->lock);
 
-	if ((trigger_data->mode & (MODE_TX | MODE_RX)) != 0 && trigger_data->link_up)
-		mod_timer(&trigger_data->timer, jiffies + trigger_data->interval);
+	if (w->tap_dev && w->tap_dev != dev) {
+		dev_remove_pack(&w->tap);
+		dev_put(w->tap_dev);
+		w->tap_dev = NULL;
+	}
+
+	if (dev && !w->tap_dev) {
+		w->tap.dev = dev;
+		dev_add_pack(&w->tap);
+		w->tap_dev = dev;
+	} else if (dev) {
+		dev_put(dev);
+	}
+
+	mutex_unlock(&w->tap_lock);
+}
+
+static int netdev_trig_notify(struct notifier_block *nb,
+			      unsigned long evt,
+			      void *dv)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev((struct netdev_notifier_info *) dv);
+	struct netdev_trig_watch *w = container_of(nb, struct netdev_trig_watch, notifier);
+
+	if (evt != NETDEV_UP && evt != NETDEV_DOWN && evt != NETDEV_CHANGE && evt != NETDEV_REGISTER && evt != NETDEV_UNREGISTER && evt != NETDEV_CHANGENAME)
+		return NOTIFY_DONE;
+
+	if (strcmp(dev->name, w->device_name))
+		return NOTIFY_DONE;
+
+	spin_lock_bh(&w->lock);
+
+	if (evt == NETDEV_REGISTER || evt == NETDEV_CHANGENAME) {
+		if (w->net_dev != NULL)
+			dev_put(w->net_dev);
+
+		dev_hold(dev);
+		w->net_dev = dev;
+		w->link_up = 0;
+	} else if (evt == NETDEV_UNREGISTER) {
+		if (w->net_dev != NULL)
+			dev_put(w->net_dev);
+
+		w->net_dev = NULL;
+		w->link_up = 0;
+	} else {
+		/* UP / DOWN / CHANGE */
+		w->link_up = (evt != NETDEV_DOWN && netif_carrier_ok(dev));
+	}
+
+	netdev_trig_update(w);
+	spin_unlock_bh(&w->lock);
+
+	/* the tap holds a reference too, drop it before the device goes */
+	if (evt == NETDEV_UNREGISTER)
+		netdev_trig_tap_sync(&w->tap_work);
+
+	return NOTIFY_DONE;
+}
+
+/* here's the real work! */
+static void netdev_trig_timer(unsigned long arg)
+{
+	struct netdev_trig_watch *w = (struct netdev_trig_watch *)arg;
+	struct led_netdev_data *trigger_data;
+	struct rtnl_link_stats64 *dev_stats = NULL;
+	struct rtnl_link_stats64 temp;
+	bool active = false;
+
+	spin_lock(&w->lock);
+
+	list_for_each_entry(trigger_data, &w->leds, list) {
+		unsigned new_activity;
+
+		if (!netdev_trig_polls(w, trigger_data) ||
+		    time_before(jiffies, trigger_data->next))
+			continue;
+
+		/* one read of the counters serves every LED of the device */
+		if (!dev_stats)
+			dev_stats = dev_get_stats(w->net_dev, &temp);
+
+		new_activity =
+			((trigger_data->mode & MODE_TX) ? dev_stats->tx_packets : 0) +
+			((trigger_data->mode & MODE_RX) ? dev_stats->rx_packets : 0);
+
+		if (trigger_data->mode & MODE_LINK) {
+			/* base state is ON (link present) */
+			/* if there's no link, we don't get this far and the LED is off */
+
+			/* OFF -> ON always */
+			/* ON -> OFF on activity */
+			if (trigger_data->led_cdev->brightness == LED_OFF) {
+				led_set_brightness(trigger_data->led_cdev, LED_FULL);
+			} else if (trigger_data->last_activity != new_activity) {
+				led_set_brightness(trigger_data->led_cdev, LED_OFF);
+			}
+		} else {
+			/* base state is OFF */
+			/* ON -> OFF always */
+			/* OFF -> ON on activity */
+			if (trigger_data->led_cdev->brightness == LED_FULL) {
+				led_set_brightness(trigger_data->led_cdev, LED_OFF);
+			} else if (trigger_data->last_activity != new_activity) {
+				led_set_brightness(trigger_data->led_cdev, LED_FULL);
+			}
+		}
+
+		if (trigger_data->last_activity != new_activity)
+			active = true;
+
+		trigger_data->last_activity = new_activity;
+		trigger_data->next = jiffies + trigger_data->interval;
+	}
+
+	if (dev_stats) {
+		if (active)
+			w->idle = 0;
+		else
+			w->idle++;
+	}
+
+	/* every LED is back in its base state by now */
+	if (idle_intervals && w->idle >= idle_intervals) {
+		w->sleeping = true;
+		schedule_work(&w->tap_work);
+	} else {
+		netdev_trig_schedule(w);
+	}
+
+	spin_unlock(&w->lock);
+}
+
+static struct netdev_trig_watch *netdev_trig_watch_get(const char *name)
+{
+	struct netdev_trig_watch *w;
+
+	list_for_each_entry(w, &netdev_trig_watches, list)
+		if (!strcmp(w->device_name, name))
+			return w;
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return NULL;
+
+	INIT_LIST_HEAD(&w->leds);
+	spin_lock_init(&w->lock);
+	mutex_init(&w->tap_lock);
+	INIT_WORK(&w->tap_work, netdev_trig_tap_sync);
+	setup_timer(&w->timer, netdev_trig_timer, (unsigned long) w);
+	strcpy(w->device_name, name);
+
+	w->tap.type = htons(ETH_P_ALL);
+	w->tap.func = netdev_trig_tap_rcv;
+
+	w->notifier.notifier_call = netdev_trig_notify;
+	w->notifier.priority = 10;
+
+	list_add(&w->list, &netdev_trig_watches);
+
+	/* replays REGISTER and UP for a device that already exists */
+	register_netdevice_notifier(&w->notifier);
+
+	return w;
+}
+
+static void netdev_trig_watch_put(struct netdev_trig_watch *w)
+{
+	struct net_device *dev;
+
+	if (!list_empty(&w->leds))
+		return;
+
+	list_del(&w->list);
+	unregister_netdevice_notifier(&w->notifier);
+
+	/* nothing is left to rearm the timer once it is gone */
+	del_timer_sync(&w->timer);
+
+	spin_lock_bh(&w->lock);
+	w->sleeping = false;
+	dev = w->net_dev;
+	w->net_dev = NULL;
+	spin_unlock_bh(&w->lock);
+
+	cancel_work_sync(&w->tap_work);
+	netdev_trig_tap_sync(&w->tap_work);
+
+	if (dev)
+		dev_put(dev);
+
+	kfree(w);
+}
+
+static void netdev_trig_attach(struct led_netdev_data *trigger_data)
+{
+	struct netdev_trig_watch *w;
+
+	trigger_data->last_activity = 0;
+
+	if (trigger_data->device_name[0] != 0) {
+		w = netdev_trig_watch_get(trigger_data->device_name);
+		if (w) {
+			spin_lock_bh(&w->lock);
+			list_add_tail(&trigger_data->list, &w->leds);
+			trigger_data->watch = w;
+			netdev_trig_update(w);
+			spin_unlock_bh(&w->lock);
+			return;
+		}
+	}
+
+	set_baseline_state(trigger_data);
+}
+
+static void netdev_trig_detach(struct led_netdev_data *trigger_data)
+{
+	struct netdev_trig_watch *w = trigger_data->watch;
+
+	if (!w)
+		return;
+
+	spin_lock_bh(&w->lock);
+	list_del(&trigger_data->list);
+	trigger_data->watch = NULL;
+	spin_unlock_bh(&w->lock);
+
+	netdev_trig_watch_put(w);
+}
+
+/* apply a mode or interval change, netdev_trig_mutex held */
+static void netdev_trig_reconfigure(struct led_netdev_data *trigger_data)
+{
+	struct netdev_trig_watch *w = trigger_data->watch;
+
+	if (w) {
+		spin_lock_bh(&w->lock);
+		netdev_trig_update(w);
+		spin_unlock_bh(&w->lock);
+	} else {
+		set_baseline_state(trigger_data);
+	}
 }
 
 static ssize_t led_device_name_show(struct device *dev,
@@ -100,9 +463,9 @@ static ssize_t led_device_name_show(struct device *dev,
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
-	spin_lock_bh(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 	sprintf(buf, "%s\n", trigger_data->device_name);
-	spin_unlock_bh(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return strlen(buf) + 1;
 }
@@ -116,24 +479,15 @@ static ssize_t led_device_name_store(struct device *dev,
 	if (size < 0 || size >= IFNAMSIZ)
 		return -EINVAL;
 
-	spin_lock_bh(&trigger_data->lock);
-	del_timer_sync(&trigger_data->timer);
+	mutex_lock(&netdev_trig_mutex);
+	netdev_trig_detach(trigger_data);
 
 	strcpy(trigger_data->device_name, buf);
 	if (size > 0 && trigger_data->device_name[size-1] == '\n')
 		trigger_data->device_name[size-1] = 0;
-	trigger_data->link_up = 0;
-	trigger_data->last_activity = 0;
-
-	if (trigger_data->device_name[0] != 0) {
-		/* check for existing device to update from */
-		trigger_data->net_dev = dev_get_by_name(&init_net, trigger_data->device_name);
-		if (trigger_data->net_dev != NULL)
-			trigger_data->link_up = (dev_get_flags(trigger_data->net_dev) & IFF_LOWER_UP) != 0;
-	}
 
-	set_baseline_state(trigger_data);
-	spin_unlock_bh(&trigger_data->lock);
+	netdev_trig_attach(trigger_data);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return size;
 }
@@ -146,7 +500,7 @@ static ssize_t led_mode_show(struct device *dev,
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
-	spin_lock_bh(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 
 	if (trigger_data->mode == 0) {
 		strcpy(buf, "none\n");
@@ -160,7 +514,7 @@ static ssize_t led_mode_show(struct device *dev,
 		strcat(buf, "\n");
 	}
 
-	spin_unlock_bh(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return strlen(buf)+1;
 }
@@ -201,13 +555,18 @@ static ssize_t led_mode_store(struct device *dev,
 	if (new_mode == -1)
 		return -EINVAL;
 
-	spin_lock_bh(&trigger_data->lock);
-	del_timer_sync(&trigger_data->timer);
+	mutex_lock(&netdev_trig_mutex);
 
-	trigger_data->mode = new_mode;
+	if (trigger_data->watch) {
+		spin_lock_bh(&trigger_data->watch->lock);
+		trigger_data->mode = new_mode;
+		spin_unlock_bh(&trigger_data->watch->lock);
+	} else {
+		trigger_data->mode = new_mode;
+	}
 
-	set_baseline_state(trigger_data);
-	spin_unlock_bh(&trigger_data->lock);
+	netdev_trig_reconfigure(trigger_data);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return size;
 }
@@ -220,9 +579,9 @@ static ssize_t led_interval_show(struct device *dev,
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
-	spin_lock_bh(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 	sprintf(buf, "%u\n", jiffies_to_msecs(trigger_data->interval));
-	spin_unlock_bh(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return strlen(buf) + 1;
 }
@@ -242,13 +601,18 @@ static ssize_t led_interval_store(struct device *dev,
 
 	/* impose some basic bounds on the timer interval */
 	if (count == size && value >= 5 && value <= 10000) {
-		spin_lock_bh(&trigger_data->lock);
-		del_timer_sync(&trigger_data->timer);
-
-		trigger_data->interval = msecs_to_jiffies(value);
+		mutex_lock(&netdev_trig_mutex);
+
+		if (trigger_data->watch) {
+			spin_lock_bh(&trigger_data->watch->lock);
+			trigger_data->interval = msecs_to_jiffies(value);
+			spin_unlock_bh(&trigger_data->watch->lock);
+		} else {
+			trigger_data->interval = msecs_to_jiffies(value);
+		}
 
-		set_baseline_state(trigger_data); /* resets timer */
-		spin_unlock_bh(&trigger_data->lock);
+		netdev_trig_reconfigure(trigger_data); /* resets timer */
+		mutex_unlock(&netdev_trig_mutex);
 
 		ret = count;
 	}
@@ -258,94 +622,6 @@ static ssize_t led_interval_store(struct device *dev,
 
 static DEVICE_ATTR(interval, 0644, led_interval_show, led_interval_store);
 
-static int netdev_trig_notify(struct notifier_block *nb,
-			      unsigned long evt,
-			      void *dv)
-{
-	struct net_device *dev = netdev_notifier_info_to_dev((struct netdev_notifier_info *) dv);
-	struct led_netdev_data *trigger_data = container_of(nb, struct led_netdev_data, notifier);
-
-	if (evt != NETDEV_UP && evt != NETDEV_DOWN && evt != NETDEV_CHANGE && evt != NETDEV_REGISTER && evt != NETDEV_UNREGISTER && evt != NETDEV_CHANGENAME)
-		return NOTIFY_DONE;
-
-	spin_lock_bh(&trigger_data->lock);
-
-	if (strcmp(dev->name, trigger_data->device_name))
-		goto done;
-
-	del_timer_sync(&trigger_data->timer);
-
-	if (evt == NETDEV_REGISTER || evt == NETDEV_CHANGENAME) {
-		if (trigger_data->net_dev != NULL)
-			dev_put(trigger_data->net_dev);
-
-		dev_hold(dev);
-		trigger_data->net_dev = dev;
-		trigger_data->link_up = 0;
-		goto done;
-	}
-
-	if (evt == NETDEV_UNREGISTER && trigger_data->net_dev != NULL) {
-		dev_put(trigger_data->net_dev);
-		trigger_data->net_dev = NULL;
-		goto done;
-	}
-
-	/* UP / DOWN / CHANGE */
-
-	trigger_data->link_up = (evt != NETDEV_DOWN && netif_carrier_ok(dev));
-	set_baseline_state(trigger_data);
-
-done:
-	spin_unlock_bh(&trigger_data->lock);
-	return NOTIFY_DONE;
-}
-
-/* here's the real work! */
-static void netdev_trig_timer(unsigned long arg)
-{
-	struct led_netdev_data *trigger_data = (struct led_netdev_data *)arg;
-	struct rtnl_link_stats64 *dev_stats;
-	unsigned new_activity;
-	struct rtnl_link_stats64 temp;
-
-	if (!trigger_data->link_up || !trigger_data->net_dev || (trigger_data->mode & (MODE_TX | MODE_RX)) == 0) {
-		/* we don't need to do timer work, just reflect link state. */
-		led_set_brightness(trigger_data->led_cdev, ((trigger_data->mode & MODE_LINK) != 0 && trigger_data->link_up) ? LED_FULL : LED_OFF);
-		return;
-	}
-
-	dev_stats = dev_get_stats(trigger_data->net_dev, &temp);
-	new_activity =
-		((trigger_data->mode & MODE_TX) ? dev_stats->tx_packets : 0) +
-		((trigger_data->mode & MODE_RX) ? dev_stats->rx_packets : 0);
-
-	if (trigger_data->mode & MODE_LINK) {
-		/* base state is ON (link present) */
-		/* if there's no link, we don't get this far and the LED is off */
-
-		/* OFF -> ON always */
-		/* ON -> OFF on activity */
-		if (trigger_data->led_cdev->brightness == LED_OFF) {
-			led_set_brightness(trigger_data->led_cdev, LED_FULL);
-		} else if (trigger_data->last_activity != new_activity) {
-			led_set_brightness(trigger_data->led_cdev, LED_OFF);
-		}
-	} else {
-		/* base state is OFF */
-		/* ON -> OFF always */
-		/* OFF -> ON on activity */
-		if (trigger_data->led_cdev->brightness == LED_FULL) {
-			led_set_brightness(trigger_data->led_cdev, LED_OFF);
-		} else if (trigger_data->last_activity != new_activity) {
-			led_set_brightness(trigger_data->led_cdev, LED_FULL);
-		}
-	}
-
-	trigger_data->last_activity = new_activity;
-	mod_timer(&trigger_data->timer, jiffies + trigger_data->interval);
-}
-
 static void netdev_trig_activate(struct led_classdev *led_cdev)
 {
 	struct led_netdev_data *trigger_data;
@@ -355,20 +631,14 @@ static void netdev_trig_activate(struct led_classdev *led_cdev)
 	if (!trigger_data)
 		return;
 
-	spin_lock_init(&trigger_data->lock);
-
-	trigger_data->notifier.notifier_call = netdev_trig_notify;
-	trigger_data->notifier.priority = 10;
-
-	setup_timer(&trigger_data->timer, netdev_trig_timer, (unsigned long) trigger_data);
+	INIT_LIST_HEAD(&trigger_data->list);
 
 	trigger_data->led_cdev = led_cdev;
-	trigger_data->net_dev = NULL;
+	trigger_data->watch = NULL;
 	trigger_data->device_name[0] = 0;
 
 	trigger_data->mode = 0;
 	trigger_data->interval = msecs_to_jiffies(50);
-	trigger_data->link_up = 0;
 	trigger_data->last_activity = 0;
 
 	led_cdev->trigger_data = trigger_data;
@@ -383,7 +653,6 @@ static void netdev_trig_activate(struct led_classdev *led_cdev)
 	if (rc)
 		goto err_out_mode;
 
-	register_netdevice_notifier(&trigger_data->notifier);
 	return;
 
 err_out_mode:
@@ -400,21 +669,13 @@ static void netdev_trig_deactivate(struct led_classdev *led_cdev)
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
 	if (trigger_data) {
-		unregister_netdevice_notifier(&trigger_data->notifier);
-
 		device_remove_file(led_cdev->dev, &dev_attr_device_name);
 		device_remove_file(led_cdev->dev, &dev_attr_mode);
 		device_remove_file(led_cdev->dev, &dev_attr_interval);
 
-		spin_lock_bh(&trigger_data->lock);
-		del_timer_sync(&trigger_data->timer);
-
-		if (trigger_data->net_dev) {
-			dev_put(trigger_data->net_dev);
-			trigger_data->net_dev = NULL;
-		}
-
-		spin_unlock_bh(&trigger_data->lock);
+		mutex_lock(&netdev_trig_mutex);
+		netdev_trig_detach(trigger_data);
+		mutex_unlock(&netdev_trig_mutex);
 
 		kfree(trigger_data);
 	}
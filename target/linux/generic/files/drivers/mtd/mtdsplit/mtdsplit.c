@@ -19,6 +19,10 @@
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/byteorder/generic.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "mtdsplit.h"
 
@@ -28,6 +32,112 @@ struct squashfs_super_block {
 	__le64 bytes_used;
 };
 
+/*
+ * Several parsers may be tried on the same partition, and each of them
+ * looks at the start of the same erase blocks. The first bytes of every
+ * block are kept here, so a slow flash is read only once per block. The
+ * cache covers one partition and is dropped after a second without use.
+ */
+#define MTDSPLIT_HDR_LEN	128
+
+static struct {
+	struct mtd_info *mtd;
+	unsigned int n_blocks;
+	unsigned long *valid;
+	u8 *data;
+} hdr_cache;
+
+static DEFINE_MUTEX(hdr_cache_lock);
+
+static void mtdsplit_hdr_cache_free(void)
+{
+	vfree(hdr_cache.data);
+	kfree(hdr_cache.valid);
+	hdr_cache.data = NULL;
+	hdr_cache.valid = NULL;
+	hdr_cache.mtd = NULL;
+	hdr_cache.n_blocks = 0;
+}
+
+static void mtdsplit_hdr_cache_expire(struct work_struct *work)
+{
+	mutex_lock(&hdr_cache_lock);
+	mtdsplit_hdr_cache_free();
+	mutex_unlock(&hdr_cache_lock);
+}
+
+static DECLARE_DELAYED_WORK(hdr_cache_work, mtdsplit_hdr_cache_expire);
+
+/* called with hdr_cache_lock held */
+static u8 *mtdsplit_hdr_cache_get(struct mtd_info *mtd, unsigned int block)
+{
+	size_t retlen;
+	u8 *hdr;
+	int err;
+
+	if (hdr_cache.mtd != mtd) {
+		mtdsplit_hdr_cache_free();
+
+		hdr_cache.n_blocks = mtd_div_by_eb(mtd->size, mtd);
+		hdr_cache.data = vmalloc(hdr_cache.n_blocks * MTDSPLIT_HDR_LEN);
+		hdr_cache.valid = kcalloc(BITS_TO_LONGS(hdr_cache.n_blocks),
+					  sizeof(unsigned long), GFP_KERNEL);
+		if (!hdr_cache.data || !hdr_cache.valid) {
+			mtdsplit_hdr_cache_free();
+			return NULL;
+		}
+
+		hdr_cache.mtd = mtd;
+	}
+
+	mod_delayed_work(system_wq, &hdr_cache_work, HZ);
+
+	if (block >= hdr_cache.n_blocks)
+		return NULL;
+
+	hdr = &hdr_cache.data[block * MTDSPLIT_HDR_LEN];
+	if (!test_bit(block, hdr_cache.valid)) {
+		err = mtd_read(mtd, (loff_t) block * mtd->erasesize,
+			       MTDSPLIT_HDR_LEN, &retlen, hdr);
+		if (err || retlen != MTDSPLIT_HDR_LEN)
+			return NULL;
+
+		set_bit(block, hdr_cache.valid);
+	}
+
+	return hdr;
+}
+
+int mtd_read_header(struct mtd_info *mtd, size_t offset, void *buf,
+		    size_t len)
+{
+	size_t retlen;
+	u8 *hdr = NULL;
+	int err;
+
+	if (len <= MTDSPLIT_HDR_LEN && mtd->erasesize >= MTDSPLIT_HDR_LEN &&
+	    mtd_mod_by_eb(offset, mtd) == 0) {
+		mutex_lock(&hdr_cache_lock);
+		hdr = mtdsplit_hdr_cache_get(mtd, mtd_div_by_eb(offset, mtd));
+		if (hdr)
+			memcpy(buf, hdr, len);
+		mutex_unlock(&hdr_cache_lock);
+	}
+
+	if (hdr)
+		return 0;
+
+	err = mtd_read(mtd, offset, len, &retlen, buf);
+	if (err)
+		return err;
+
+	if (retlen != len)
+		return -EIO;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mtd_read_header);
+
 int mtd_get_squashfs_len(struct mtd_info *master,
 			 size_t offset,
 			 size_t *squashfs_len)
@@ -36,8 +146,8 @@ int mtd_get_squashfs_len(struct mtd_info *master,
 	size_t retlen;
 	int err;
 
-	err = mtd_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
-	if (err || (retlen != sizeof(sb))) {
+	err = mtd_read_header(master, offset, &sb, sizeof(sb));
+	if (err) {
 		pr_alert("error occured while reading from \"%s\"\n",
 			 master->name);
 		return -EIO;
@@ -73,17 +183,12 @@ static ssize_t mtd_next_eb(struct mtd_info *mtd, size_t offset)
 int mtd_check_rootfs_magic(struct mtd_info *mtd, size_t offset)
 {
 	u32 magic;
-	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, sizeof(magic), &retlen,
-		       (unsigned char *) &magic);
+	ret = mtd_read_header(mtd, offset, &magic, sizeof(magic));
 	if (ret)
 		return ret;
 
-	if (retlen != sizeof(magic))
-		return -EIO;
-
 	if (le32_to_cpu(magic) != SQUASHFS_MAGIC &&
 	    magic != 0x19852003)
 		return -EINVAL;
@@ -19,6 +19,9 @@
 #define ROOTFS_SPLIT_NAME	"rootfs_data"
 
 #ifdef CONFIG_MTD_SPLIT
+int mtd_read_header(struct mtd_info *mtd, size_t offset, void *buf,
+		    size_t len);
+
 int mtd_get_squashfs_len(struct mtd_info *master,
 			 size_t offset,
 			 size_t *squashfs_len);
@@ -31,6 +34,12 @@ int mtd_find_rootfs_from(struct mtd_info *mtd,
 			 size_t *ret_offset);
 
 #else
+static inline int mtd_read_header(struct mtd_info *mtd, size_t offset,
+				  void *buf, size_t len)
+{
+	return -ENODEV;
+}
+
 static inline int mtd_get_squashfs_len(struct mtd_info *master,
 				       size_t offset,
 				       size_t *squashfs_len)
@@ -87,19 +87,16 @@ static int mtdsplit_parse_tplink(struct mtd_info *master,
 				struct mtd_part_parser_data *data)
 {
 	struct tplink_fw_header hdr;
-	size_t hdr_len, retlen, kernel_size;
+	size_t hdr_len, kernel_size;
 	size_t rootfs_offset;
 	struct mtd_partition *parts;
 	int err;
 
 	hdr_len = sizeof(hdr);
-	err = mtd_read(master, 0, hdr_len, &retlen, (void *) &hdr);
+	err = mtd_read_header(master, 0, &hdr, hdr_len);
 	if (err)
 		return err;
 
-	if (retlen != hdr_len)
-		return -EIO;
-
 	switch (le32_to_cpu(hdr.version)) {
 	case 1:
 		if (be32_to_cpu(hdr.v1.kernel_ofs) != sizeof(hdr))
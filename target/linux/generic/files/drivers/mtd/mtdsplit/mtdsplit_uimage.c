@@ -57,21 +57,13 @@ static int
 read_uimage_header(struct mtd_info *mtd, size_t offset, u_char *buf,
 		   size_t header_len)
 {
-	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, header_len, &retlen, buf);
-	if (ret) {
+	ret = mtd_read_header(mtd, offset, buf, header_len);
+	if (ret)
 		pr_debug("read error in \"%s\"\n", mtd->name);
-		return ret;
-	}
-
-	if (retlen != header_len) {
-		pr_debug("short read in \"%s\"\n", mtd->name);
-		return -EIO;
-	}
 
-	return 0;
+	return ret;
 }
 
 /**
@@ -34,6 +34,7 @@
 #include <linux/ar8216_platform.h>
 #include <linux/workqueue.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
 
 #include "ar8216.h"
 
@@ -41,6 +42,9 @@ extern const struct ar8xxx_chip ar8327_chip;
 extern const struct ar8xxx_chip ar8337_chip;
 
 #define AR8XXX_MIB_WORK_DELAY	2000 /* msecs */
+#define AR8XXX_MIB_FRESH	1000 /* msecs */
+#define AR8XXX_MIB_BACKOFF_MAX	3
+#define AR8XXX_ARL_FRESH	1000 /* msecs */
 
 #define MIB_DESC(_s , _o, _n)	\
 	{			\
@@ -386,11 +390,12 @@ ar8xxx_mib_flush(struct ar8xxx_priv *priv)
 	return ar8xxx_mib_op(priv, AR8216_MIB_FUNC_FLUSH);
 }
 
-static void
+static bool
 ar8xxx_mib_fetch_port_stat(struct ar8xxx_priv *priv, int port, bool flush)
 {
 	unsigned int base;
 	u64 *mib_stats;
+	bool changed = false;
 	int i;
 
 	WARN_ON(port >= priv->dev.ports);
@@ -418,7 +423,52 @@ ar8xxx_mib_fetch_port_stat(struct ar8xxx_priv *priv, int port, bool flush)
 			mib_stats[i] = 0;
 		else
 			mib_stats[i] += t;
+		if (t)
+			changed = true;
 	}
+
+	return changed;
+}
+
+/*
+ * Capture and read the counters of one port, accounting the time spent
+ * on the bus.  Ports whose counters did not move are polled less often
+ * by the background work, up to 1 << AR8XXX_MIB_BACKOFF_MAX rounds.
+ */
+static int
+ar8xxx_mib_update_port(struct ar8xxx_priv *priv, int port, bool flush)
+{
+	struct ar8xxx_mib_port *mp = &priv->mib_port[port];
+	ktime_t start;
+	bool changed;
+	int ret;
+
+	start = ktime_get();
+
+	ret = ar8xxx_mib_capture(priv);
+	if (ret)
+		goto out;
+
+	changed = ar8xxx_mib_fetch_port_stat(priv, port, flush);
+	mp->stamp = jiffies;
+
+	if (changed || flush)
+		mp->backoff = 0;
+	else if (mp->backoff < AR8XXX_MIB_BACKOFF_MAX)
+		mp->backoff++;
+	mp->skip = (1 << mp->backoff) - 1;
+
+out:
+	priv->mib_captures++;
+	priv->mib_bus_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+static bool
+ar8xxx_mib_is_fresh(struct ar8xxx_priv *priv, int port)
+{
+	return time_before(jiffies, priv->mib_port[port].stamp +
+				    msecs_to_jiffies(AR8XXX_MIB_FRESH));
 }
 
 static void
@@ -1217,12 +1267,10 @@ ar8xxx_sw_set_port_reset_mib(struct switch_dev *dev,
 		return -EINVAL;
 
 	mutex_lock(&priv->mib_lock);
-	ret = ar8xxx_mib_capture(priv);
+	ret = ar8xxx_mib_update_port(priv, port, true);
 	if (ret)
 		goto unlock;
 
-	ar8xxx_mib_fetch_port_stat(priv, port, true);
-
 	ret = 0;
 
 unlock:
@@ -1251,11 +1299,13 @@ ar8xxx_sw_get_port_mib(struct switch_dev *dev,
 		return -EINVAL;
 
 	mutex_lock(&priv->mib_lock);
-	ret = ar8xxx_mib_capture(priv);
-	if (ret)
-		goto unlock;
-
-	ar8xxx_mib_fetch_port_stat(priv, port, false);
+	if (ar8xxx_mib_is_fresh(priv, port)) {
+		priv->mib_fresh_hits++;
+	} else {
+		ret = ar8xxx_mib_update_port(priv, port, false);
+		if (ret)
+			goto unlock;
+	}
 
 	len += snprintf(buf + len, sizeof(priv->buf) - len,
 			"Port %d MIB counters\n",
@@ -1279,28 +1329,97 @@ unlock:
 }
 
 int
-ar8xxx_sw_get_arl_table(struct switch_dev *dev,
-			const struct switch_attr *attr,
-			struct switch_val *val)
+ar8xxx_sw_get_mib_poll(struct switch_dev *dev,
+		       const struct switch_attr *attr,
+		       struct switch_val *val)
 {
 	struct ar8xxx_priv *priv = swdev_to_ar8xxx(dev);
-	struct mii_bus *bus = priv->mii_bus;
+	char *buf = priv->buf;
+	int i, len = 0;
+
+	if (!ar8xxx_has_mib_counters(priv))
+		return -EOPNOTSUPP;
+
+	mutex_lock(&priv->mib_lock);
+
+	len += snprintf(buf + len, sizeof(priv->buf) - len,
+			"captures    : %u\n"
+			"fresh hits  : %u\n"
+			"bus time    : %llu us\n",
+			priv->mib_captures, priv->mib_fresh_hits,
+			div_u64(priv->mib_bus_ns, NSEC_PER_USEC));
+
+	for (i = 0; i < dev->ports; i++)
+		len += snprintf(buf + len, sizeof(priv->buf) - len,
+				"port %d      : every %d rounds\n",
+				i, 1 << priv->mib_port[i].backoff);
+
+	val->value.s = buf;
+	val->len = len;
+
+	mutex_unlock(&priv->mib_lock);
+
+	return 0;
+}
+
+static int
+ar8xxx_arl_find(const struct arl_entry *t, int n, const struct arl_entry *a,
+		bool same_port)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (same_port && t[i].port != a->port)
+			continue;
+		if (!memcmp(t[i].mac, a->mac, sizeof(a->mac)))
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+ar8xxx_arl_event(struct ar8xxx_priv *priv, u8 type,
+		 const struct arl_entry *a, u8 old_port)
+{
+	struct ar8xxx_arl_event *ev;
+
+	ev = &priv->arl_events[priv->arl_gen % AR8XXX_ARL_EVENTS];
+	ev->gen = ++priv->arl_gen;
+	ev->type = type;
+	ev->port = a->port;
+	ev->old_port = old_port;
+	memcpy(ev->mac, a->mac, sizeof(ev->mac));
+}
+
+/*
+ * The hardware can only be walked from the start, so the walk is shared:
+ * readers within AR8XXX_ARL_FRESH of the last sweep get the shadow copy,
+ * and every sweep is compared with the previous one to record additions,
+ * aged out entries and station moves. Called with reg_mutex held.
+ */
+static void
+ar8xxx_arl_refresh(struct ar8xxx_priv *priv)
+{
+	DECLARE_BITMAP(old_seen, AR8XXX_NUM_ARL_RECORDS);
+	DECLARE_BITMAP(new_seen, AR8XXX_NUM_ARL_RECORDS);
 	const struct ar8xxx_chip *chip = priv->chip;
-	char *buf = priv->arl_buf;
-	int i, j, k, len = 0;
-	struct arl_entry *a, *a1;
+	struct mii_bus *bus = priv->mii_bus;
+	struct arl_entry *a;
 	u32 status;
+	int i, j, n;
 
-	if (!chip->get_arl_entry)
-		return -EOPNOTSUPP;
+	if (priv->arl_valid &&
+	    time_before(jiffies, priv->arl_stamp +
+				 msecs_to_jiffies(AR8XXX_ARL_FRESH)))
+		return;
 
-	mutex_lock(&priv->reg_mutex);
 	mutex_lock(&bus->mdio_lock);
 
 	chip->get_arl_entry(priv, NULL, NULL, AR8XXX_ARL_INITIALIZE);
 
-	for(i = 0; i < AR8XXX_NUM_ARL_RECORDS; ++i) {
-		a = &priv->arl_table[i];
+	for (n = 0; n < AR8XXX_NUM_ARL_RECORDS; ++n) {
+		a = &priv->arl_next[n];
 		duplicate:
 		chip->get_arl_entry(priv, a, &status, AR8XXX_ARL_GET_NEXT);
 
@@ -1311,33 +1430,93 @@ ar8xxx_sw_get_arl_table(struct switch_dev *dev,
 		 * ARL table can include multiple valid entries
 		 * per MAC, just with differing status codes
 		 */
-		for (j = 0; j < i; ++j) {
-			a1 = &priv->arl_table[j];
-			if (a->port == a1->port && !memcmp(a->mac, a1->mac, sizeof(a->mac)))
-				goto duplicate;
-		}
+		if (ar8xxx_arl_find(priv->arl_next, n, a, true) >= 0)
+			goto duplicate;
 	}
 
 	mutex_unlock(&bus->mdio_lock);
 
-	len += snprintf(buf + len, sizeof(priv->arl_buf) - len,
-                        "address resolution table\n");
+	bitmap_zero(old_seen, AR8XXX_NUM_ARL_RECORDS);
+	bitmap_zero(new_seen, AR8XXX_NUM_ARL_RECORDS);
+
+	/* unchanged entries first, so that they are not taken for moves */
+	for (i = 0; i < n; i++) {
+		j = ar8xxx_arl_find(priv->arl_table, priv->arl_count,
+				    &priv->arl_next[i], true);
+		if (j < 0)
+			continue;
+
+		set_bit(i, new_seen);
+		set_bit(j, old_seen);
+	}
+
+	for (i = 0; i < n; i++) {
+		a = &priv->arl_next[i];
+		if (test_bit(i, new_seen))
+			continue;
+
+		for (j = 0; j < priv->arl_count; j++)
+			if (!test_bit(j, old_seen) &&
+			    !memcmp(priv->arl_table[j].mac, a->mac, sizeof(a->mac)))
+				break;
+
+		if (j < priv->arl_count) {
+			set_bit(j, old_seen);
+			ar8xxx_arl_event(priv, AR8XXX_ARL_EV_MOVE, a,
+					 priv->arl_table[j].port);
+		} else {
+			ar8xxx_arl_event(priv, AR8XXX_ARL_EV_ADD, a, 0);
+		}
+	}
+
+	for (j = 0; j < priv->arl_count; j++)
+		if (!test_bit(j, old_seen))
+			ar8xxx_arl_event(priv, AR8XXX_ARL_EV_AGE,
+					 &priv->arl_table[j], 0);
+
+	memcpy(priv->arl_table, priv->arl_next, n * sizeof(*a));
+	priv->arl_count = n;
+	priv->arl_full = (n == AR8XXX_NUM_ARL_RECORDS);
+	priv->arl_stamp = jiffies;
+	priv->arl_valid = true;
+}
+
+int
+ar8xxx_sw_get_arl_table(struct switch_dev *dev,
+			const struct switch_attr *attr,
+			struct switch_val *val)
+{
+	struct ar8xxx_priv *priv = swdev_to_ar8xxx(dev);
+	char *buf = priv->arl_buf;
+	int j, k, len = 0;
+	struct arl_entry *a;
+
+	if (!priv->chip->get_arl_entry)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&priv->reg_mutex);
+
+	ar8xxx_arl_refresh(priv);
+
+	len += scnprintf(buf + len, sizeof(priv->arl_buf) - len,
+			 "address resolution table\n"
+			 "generation %u\n", priv->arl_gen);
 
-	if (i == AR8XXX_NUM_ARL_RECORDS)
-		len += snprintf(buf + len, sizeof(priv->arl_buf) - len,
-				"Too many entries found, displaying the first %d only!\n",
-				AR8XXX_NUM_ARL_RECORDS);
+	if (priv->arl_full)
+		len += scnprintf(buf + len, sizeof(priv->arl_buf) - len,
+				 "Too many entries found, displaying the first %d only!\n",
+				 AR8XXX_NUM_ARL_RECORDS);
 
 	for (j = 0; j < priv->dev.ports; ++j) {
-		for (k = 0; k < i; ++k) {
+		for (k = 0; k < priv->arl_count; ++k) {
 			a = &priv->arl_table[k];
 			if (a->port != j)
 				continue;
-			len += snprintf(buf + len, sizeof(priv->arl_buf) - len,
-					"Port %d: MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
-					j,
-					a->mac[5], a->mac[4], a->mac[3],
-					a->mac[2], a->mac[1], a->mac[0]);
+			len += scnprintf(buf + len, sizeof(priv->arl_buf) - len,
+					 "Port %d: MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
+					 j,
+					 a->mac[5], a->mac[4], a->mac[3],
+					 a->mac[2], a->mac[1], a->mac[0]);
 		}
 	}
 
@@ -1349,6 +1528,62 @@ ar8xxx_sw_get_arl_table(struct switch_dev *dev,
 	return 0;
 }
 
+/*
+ * Changes since older sweeps, one "<generation> add|age|move" line each.
+ * A reader keeps the newest generation it has seen; if that is below
+ * "oldest" it has missed events and has to start over from arl_table.
+ */
+int
+ar8xxx_sw_get_arl_changes(struct switch_dev *dev,
+			  const struct switch_attr *attr,
+			  struct switch_val *val)
+{
+	static const char * const types[] = {
+		[AR8XXX_ARL_EV_ADD] = "add",
+		[AR8XXX_ARL_EV_AGE] = "age",
+		[AR8XXX_ARL_EV_MOVE] = "move",
+	};
+	struct ar8xxx_priv *priv = swdev_to_ar8xxx(dev);
+	struct ar8xxx_arl_event *ev;
+	char *buf = priv->arl_buf;
+	int len = 0;
+	u32 gen, oldest;
+
+	if (!priv->chip->get_arl_entry)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&priv->reg_mutex);
+
+	ar8xxx_arl_refresh(priv);
+
+	oldest = 1;
+	if (priv->arl_gen > AR8XXX_ARL_EVENTS)
+		oldest = priv->arl_gen - AR8XXX_ARL_EVENTS + 1;
+
+	len += scnprintf(buf + len, sizeof(priv->arl_buf) - len,
+			 "generation %u oldest %u\n", priv->arl_gen, oldest);
+
+	for (gen = oldest; gen <= priv->arl_gen; gen++) {
+		ev = &priv->arl_events[(gen - 1) % AR8XXX_ARL_EVENTS];
+		len += scnprintf(buf + len, sizeof(priv->arl_buf) - len,
+				 "%u %s Port %d: MAC %02x:%02x:%02x:%02x:%02x:%02x",
+				 ev->gen, types[ev->type], ev->port,
+				 ev->mac[5], ev->mac[4], ev->mac[3],
+				 ev->mac[2], ev->mac[1], ev->mac[0]);
+		if (ev->type == AR8XXX_ARL_EV_MOVE)
+			len += scnprintf(buf + len, sizeof(priv->arl_buf) - len,
+					 " from %d", ev->old_port);
+		len += scnprintf(buf + len, sizeof(priv->arl_buf) - len, "\n");
+	}
+
+	val->value.s = buf;
+	val->len = len;
+
+	mutex_unlock(&priv->reg_mutex);
+
+	return 0;
+}
+
 
 static const struct switch_attr ar8xxx_sw_attr_globals[] = {
 	{
@@ -1404,6 +1639,20 @@ static const struct switch_attr ar8xxx_sw_attr_globals[] = {
 		.set = NULL,
 		.get = ar8xxx_sw_get_arl_table,
 	},
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "arl_changes",
+		.description = "Get ARL changes since older generations",
+		.set = NULL,
+		.get = ar8xxx_sw_get_arl_changes,
+	},
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "mib_poll",
+		.description = "Get MIB polling statistics",
+		.set = NULL,
+		.get = ar8xxx_sw_get_mib_poll,
+	},
 };
 
 const struct switch_attr ar8xxx_sw_attr_port[2] = {
@@ -1593,22 +1842,36 @@ static void
 ar8xxx_mib_work_func(struct work_struct *work)
 {
 	struct ar8xxx_priv *priv;
-	int err;
+	int i;
 
 	priv = container_of(work, struct ar8xxx_priv, mib_work.work);
 
 	mutex_lock(&priv->mib_lock);
 
-	err = ar8xxx_mib_capture(priv);
-	if (err)
-		goto next_port;
+	/*
+	 * Fetch the first port that is due; idle ports and ports a reader
+	 * has just refreshed are passed over without touching the bus.
+	 */
+	for (i = 0; i < priv->dev.ports; i++) {
+		struct ar8xxx_mib_port *mp;
+		int port = priv->mib_next_port;
+
+		priv->mib_next_port++;
+		if (priv->mib_next_port >= priv->dev.ports)
+			priv->mib_next_port = 0;
 
-	ar8xxx_mib_fetch_port_stat(priv, priv->mib_next_port, false);
+		mp = &priv->mib_port[port];
+		if (mp->skip) {
+			mp->skip--;
+			continue;
+		}
+
+		if (ar8xxx_mib_is_fresh(priv, port))
+			continue;
 
-next_port:
-	priv->mib_next_port++;
-	if (priv->mib_next_port >= priv->dev.ports)
-		priv->mib_next_port = 0;
+		ar8xxx_mib_update_port(priv, port, false);
+		break;
+	}
 
 	mutex_unlock(&priv->mib_lock);
 	schedule_delayed_work(&priv->mib_work,
@@ -1619,10 +1882,15 @@ static int
 ar8xxx_mib_init(struct ar8xxx_priv *priv)
 {
 	unsigned int len;
+	int i;
 
 	if (!ar8xxx_has_mib_counters(priv))
 		return 0;
 
+	for (i = 0; i < AR8X16_MAX_PORTS; i++)
+		priv->mib_port[i].stamp = jiffies -
+					  msecs_to_jiffies(AR8XXX_MIB_FRESH);
+
 	BUG_ON(!priv->chip->mib_decs || !priv->chip->num_mibs);
 
 	len = priv->dev.ports * priv->chip->num_mibs *
@@ -1777,7 +2045,7 @@ static bool
 ar8xxx_check_link_states(struct ar8xxx_priv *priv)
 {
 	bool link_new, changed = false;
-	u32 status;
+	u32 status, port_link = 0;
 	int i;
 
 	mutex_lock(&priv->reg_mutex);
@@ -1794,11 +2062,20 @@ ar8xxx_check_link_states(struct ar8xxx_priv *priv)
 			 i, link_new ? "up" : "down");
 	}
 
-	if (changed)
+	if (changed) {
 		priv->chip->atu_flush(priv);
+		priv->arl_valid = false;
+
+		for (i = 0; i < priv->dev.ports; i++)
+			if (priv->link_up[i])
+				port_link |= BIT(i);
+	}
 
 	mutex_unlock(&priv->reg_mutex);
 
+	if (changed)
+		swconfig_link_changed(&priv->dev, port_link);
+
 	return changed;
 }
 
@@ -349,6 +349,23 @@ struct arl_entry {
 	u8 mac[6];
 };
 
+#define AR8XXX_ARL_EVENTS	64
+
+enum ar8xxx_arl_event_type {
+	AR8XXX_ARL_EV_ADD,
+	AR8XXX_ARL_EV_AGE,
+	AR8XXX_ARL_EV_MOVE
+};
+
+/* one difference between two sweeps of the ARL */
+struct ar8xxx_arl_event {
+	u32 gen;
+	u8 type;
+	u8 port;
+	u8 old_port;		/* AR8XXX_ARL_EV_MOVE only */
+	u8 mac[6];
+};
+
 struct ar8xxx_priv;
 
 struct ar8xxx_mib_desc {
@@ -393,6 +410,12 @@ struct ar8xxx_chip {
 	unsigned mib_func;
 };
 
+struct ar8xxx_mib_port {
+	unsigned long stamp;	/* jiffies of the last fetch */
+	u8 backoff;		/* log2 of the idle poll interval */
+	u8 skip;		/* poll rounds left before next fetch */
+};
+
 struct ar8xxx_priv {
 	struct switch_dev dev;
 	struct mii_bus *mii_bus;
@@ -411,7 +434,14 @@ struct ar8xxx_priv {
 	bool port4_phy;
 	char buf[2048];
 	struct arl_entry arl_table[AR8XXX_NUM_ARL_RECORDS];
+	struct arl_entry arl_next[AR8XXX_NUM_ARL_RECORDS];
 	char arl_buf[AR8XXX_NUM_ARL_RECORDS * 32 + 256];
+	int arl_count;
+	bool arl_full;
+	bool arl_valid;
+	unsigned long arl_stamp;	/* jiffies of the last sweep */
+	u32 arl_gen;			/* generation of the newest event */
+	struct ar8xxx_arl_event arl_events[AR8XXX_ARL_EVENTS];
 	bool link_up[AR8X16_MAX_PORTS];
 
 	bool init;
@@ -420,6 +450,10 @@ struct ar8xxx_priv {
 	struct delayed_work mib_work;
 	int mib_next_port;
 	u64 *mib_stats;
+	struct ar8xxx_mib_port mib_port[AR8X16_MAX_PORTS];
+	u64 mib_bus_ns;
+	u32 mib_captures;
+	u32 mib_fresh_hits;
 
 	struct list_head list;
 	unsigned int use_count;
@@ -520,10 +554,18 @@ ar8xxx_sw_get_port_mib(struct switch_dev *dev,
                        const struct switch_attr *attr,
                        struct switch_val *val);
 int
+ar8xxx_sw_get_mib_poll(struct switch_dev *dev,
+		       const struct switch_attr *attr,
+		       struct switch_val *val);
+int
 ar8xxx_sw_get_arl_table(struct switch_dev *dev,
 			const struct switch_attr *attr,
 			struct switch_val *val);
 int
+ar8xxx_sw_get_arl_changes(struct switch_dev *dev,
+			  const struct switch_attr *attr,
+			  struct switch_val *val);
+int
 ar8216_wait_bit(struct ar8xxx_priv *priv, int reg, u32 mask, u32 val);
 
 static inline struct ar8xxx_priv *
@@ -1120,6 +1120,20 @@ static const struct switch_attr ar8327_sw_attr_globals[] = {
 		.set = NULL,
 		.get = ar8xxx_sw_get_arl_table,
 	},
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "arl_changes",
+		.description = "Get ARL changes since older generations",
+		.set = NULL,
+		.get = ar8xxx_sw_get_arl_changes,
+	},
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "mib_poll",
+		.description = "Get MIB polling statistics",
+		.set = NULL,
+		.get = ar8xxx_sw_get_mib_poll,
+	},
 };
 
 static const struct switch_attr ar8327_sw_attr_port[] = {
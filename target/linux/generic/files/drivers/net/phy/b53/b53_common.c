@@ -415,11 +415,10 @@ static void b53_enable_mib(struct b53_device *dev)
 	b53_write8(dev, B53_MGMT_PAGE, B53_GLOBAL_CONFIG, gc);
 }
 
-static int b53_apply(struct b53_device *dev)
+static void b53_clear_vlans(struct b53_device *dev)
 {
 	int i;
 
-	/* clear all vlan entries */
 	if (is5325(dev) || is5365(dev)) {
 		for (i = 1; i < dev->sw_dev.vlans; i++)
 			b53_set_vlan_entry(dev, i, 0, 0);
@@ -427,19 +426,70 @@ static int b53_apply(struct b53_device *dev)
 		b53_do_vlan_op(dev, VTA_CMD_CLEAR);
 	}
 
-	b53_enable_vlan(dev, dev->enable_vlan);
+	memset(dev->hw_vlans, 0, sizeof(*dev->hw_vlans) * dev->sw_dev.vlans);
+	dev->hw_vlans_valid = 1;
+}
 
-	/* fill VLAN table */
-	if (dev->enable_vlan) {
-		for (i = 0; i < dev->sw_dev.vlans; i++) {
-			struct b53_vlan *vlan = &dev->vlans[i];
+static bool b53_vlan_changed(struct b53_device *dev, int vid)
+{
+	struct b53_vlan *vlan = &dev->vlans[vid];
+	struct b53_vlan *hw = &dev->hw_vlans[vid];
 
-			if (!vlan->members)
-				continue;
+	if (!dev->enable_vlan || !vlan->members)
+		return hw->members != 0;
 
+	return hw->members != vlan->members || hw->untag != vlan->untag;
+}
+
+/*
+ * Brings the VLAN table to the configuration, writing only the entries that
+ * differ from what was programmed before. Where one clear command exists,
+ * it is used instead when that takes fewer table writes.
+ */
+static void b53_update_vlans(struct b53_device *dev)
+{
+	int i, changed = 0, used = 0;
+
+	if (!dev->hw_vlans_valid)
+		b53_clear_vlans(dev);
+
+	for (i = 0; i < dev->sw_dev.vlans; i++) {
+		if (b53_vlan_changed(dev, i))
+			changed++;
+		if (dev->enable_vlan && dev->vlans[i].members)
+			used++;
+	}
+
+	if (!is5325(dev) && !is5365(dev) && changed > used + 1)
+		b53_clear_vlans(dev);
+
+	for (i = 0; i < dev->sw_dev.vlans; i++) {
+		struct b53_vlan *vlan = &dev->vlans[i];
+		struct b53_vlan *hw = &dev->hw_vlans[i];
+
+		if (!b53_vlan_changed(dev, i))
+			continue;
+
+		if (dev->enable_vlan && vlan->members) {
 			b53_set_vlan_entry(dev, i, vlan->members, vlan->untag);
+			*hw = *vlan;
+		} else {
+			b53_set_vlan_entry(dev, i, 0, 0);
+			hw->members = 0;
+			hw->untag = 0;
 		}
+	}
+}
+
+static int b53_apply(struct b53_device *dev)
+{
+	int i;
+
+	b53_enable_vlan(dev, dev->enable_vlan);
+
+	b53_update_vlans(dev);
 
+	if (dev->enable_vlan) {
 		b53_for_each_port(dev, i)
 			b53_write16(dev, B53_VLAN_PAGE,
 				    B53_VLAN_PORT_DEF_TAG(i),
@@ -485,6 +535,9 @@ static int b53_switch_reset(struct b53_device *dev)
 
 	b53_switch_reset_gpio(dev);
 
+	/* the VLAN table may have been reset too */
+	dev->hw_vlans_valid = 0;
+
 	if (is539x(dev)) {
 		b53_write8(dev, B53_CTRL_PAGE, B53_SOFTRESET, 0x83);
 		b53_write8(dev, B53_CTRL_PAGE, B53_SOFTRESET, 0x00);
@@ -1329,6 +1382,12 @@ static int b53_switch_init(struct b53_device *dev)
 	if (!dev->vlans)
 		return -ENOMEM;
 
+	dev->hw_vlans = devm_kzalloc(dev->dev,
+				     sizeof(struct b53_vlan) * sw_dev->vlans,
+				     GFP_KERNEL);
+	if (!dev->hw_vlans)
+		return -ENOMEM;
+
 	dev->buf = devm_kzalloc(dev->dev, B53_BUF_SIZE, GFP_KERNEL);
 	if (!dev->buf)
 		return -ENOMEM;
@@ -20,6 +20,7 @@
 #include <linux/phy.h>
 #include <linux/module.h>
 
+#include "b53_regs.h"
 #include "b53_priv.h"
 
 #define B53_PSEUDO_PHY	0x1e /* Register Access Pseudo PHY */
@@ -322,10 +323,31 @@ static int b53_phy_config_aneg(struct phy_device *phydev)
 	return 0;
 }
 
+static void b53_phy_check_link(struct b53_device *priv)
+{
+	u16 lnk;
+
+	if (b53_read16(priv, B53_STAT_PAGE, B53_LINK_STAT, &lnk))
+		return;
+
+	lnk &= priv->enabled_ports;
+	lnk |= BIT(priv->sw_dev.cpu_port);
+
+	if (priv->port_link_valid && lnk == priv->port_link)
+		return;
+
+	priv->port_link = lnk;
+	priv->port_link_valid = 1;
+	swconfig_link_changed(&priv->sw_dev, lnk);
+}
+
 static int b53_phy_read_status(struct phy_device *phydev)
 {
 	struct b53_device *priv = phydev->priv;
 
+	/* phylib polls us anyway, one register tells all port links */
+	b53_phy_check_link(priv);
+
 	if (is5325(priv) || is5365(priv))
 		phydev->speed = 100;
 	else
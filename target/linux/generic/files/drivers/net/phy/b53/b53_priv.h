@@ -96,8 +96,16 @@ struct b53_device {
 	unsigned enable_jumbo:1;
 	unsigned allow_vid_4095:1;
 
+	/* hw_vlans mirrors the VLAN table if hw_vlans_valid */
+	unsigned hw_vlans_valid:1;
+
+	/* last link state passed to swconfig_link_changed() */
+	unsigned port_link_valid:1;
+	u16 port_link;
+
 	struct b53_port *ports;
 	struct b53_vlan *vlans;
+	struct b53_vlan *hw_vlans;
 
 	char *buf;
 };
@@ -13,6 +13,8 @@
 #include <linux/device.h>
 #include <linux/delay.h>
 #include <linux/gpio.h>
+#include <linux/gpio/driver.h>
+#include <linux/ktime.h>
 #include <linux/spinlock.h>
 #include <linux/skbuff.h>
 #include <linux/of.h>
@@ -31,9 +33,51 @@
 #define RTL8366_SMI_HW_STOP_DELAY		25	/* msecs */
 #define RTL8366_SMI_HW_START_DELAY		100	/* msecs */
 
+#define RTL8366_SMI_CALIBRATE_LOOPS		64
+
+/* MIB snapshots younger than this are returned instead of reading again */
+#define RTL8366_MIB_CACHE_TIME			(HZ / 2)
+
 static inline void rtl8366_smi_clk_delay(struct rtl8366_smi *smi)
 {
-	ndelay(smi->clk_delay);
+	if (smi->clk_ndelay)
+		ndelay(smi->clk_ndelay);
+}
+
+/*
+ * When both lines live on the same non-sleeping GPIO chip, its callbacks
+ * are used directly instead of going through gpiolib for every edge.
+ */
+static inline void rtl8366_smi_set(struct rtl8366_smi *smi,
+				   unsigned int gpio, unsigned int offset,
+				   int value)
+{
+	struct gpio_chip *gc = smi->gpio_chip;
+
+	if (gc)
+		gc->set(gc, offset, value);
+	else
+		gpio_set_value(gpio, value);
+}
+
+static inline void rtl8366_smi_set_sck(struct rtl8366_smi *smi, int value)
+{
+	rtl8366_smi_set(smi, smi->gpio_sck, smi->sck_offset, value);
+}
+
+static inline void rtl8366_smi_set_sda(struct rtl8366_smi *smi, int value)
+{
+	rtl8366_smi_set(smi, smi->gpio_sda, smi->sda_offset, value);
+}
+
+static inline int rtl8366_smi_get_sda(struct rtl8366_smi *smi)
+{
+	struct gpio_chip *gc = smi->gpio_chip;
+
+	if (gc)
+		return gc->get(gc, smi->sda_offset);
+
+	return gpio_get_value(smi->gpio_sda);
 }
 
 static void rtl8366_smi_start(struct rtl8366_smi *smi)
@@ -50,19 +94,19 @@ static void rtl8366_smi_start(struct rtl8366_smi *smi)
 	rtl8366_smi_clk_delay(smi);
 
 	/* CLK 1: 0 -> 1, 1 -> 0 */
-	gpio_set_value(sck, 1);
+	rtl8366_smi_set_sck(smi, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	rtl8366_smi_set_sck(smi, 0);
 	rtl8366_smi_clk_delay(smi);
 
 	/* CLK 2: */
-	gpio_set_value(sck, 1);
+	rtl8366_smi_set_sck(smi, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 0);
+	rtl8366_smi_set_sda(smi, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	rtl8366_smi_set_sck(smi, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 1);
+	rtl8366_smi_set_sda(smi, 1);
 }
 
 static void rtl8366_smi_stop(struct rtl8366_smi *smi)
@@ -71,22 +115,22 @@ static void rtl8366_smi_stop(struct rtl8366_smi *smi)
 	unsigned int sck = smi->gpio_sck;
 
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 0);
-	gpio_set_value(sck, 1);
+	rtl8366_smi_set_sda(smi, 0);
+	rtl8366_smi_set_sck(smi, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 1);
+	rtl8366_smi_set_sda(smi, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 1);
+	rtl8366_smi_set_sck(smi, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	rtl8366_smi_set_sck(smi, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 1);
+	rtl8366_smi_set_sck(smi, 1);
 
 	/* add a click */
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	rtl8366_smi_set_sck(smi, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 1);
+	rtl8366_smi_set_sck(smi, 1);
 
 	/* set GPIO pins to input mode */
 	gpio_direction_input(sda);
@@ -95,27 +139,23 @@ static void rtl8366_smi_stop(struct rtl8366_smi *smi)
 
 static void rtl8366_smi_write_bits(struct rtl8366_smi *smi, u32 data, u32 len)
 {
-	unsigned int sda = smi->gpio_sda;
-	unsigned int sck = smi->gpio_sck;
-
 	for (; len > 0; len--) {
 		rtl8366_smi_clk_delay(smi);
 
 		/* prepare data */
-		gpio_set_value(sda, !!(data & ( 1 << (len - 1))));
+		rtl8366_smi_set_sda(smi, !!(data & ( 1 << (len - 1))));
 		rtl8366_smi_clk_delay(smi);
 
 		/* clocking */
-		gpio_set_value(sck, 1);
+		rtl8366_smi_set_sck(smi, 1);
 		rtl8366_smi_clk_delay(smi);
-		gpio_set_value(sck, 0);
+		rtl8366_smi_set_sck(smi, 0);
 	}
 }
 
 static void rtl8366_smi_read_bits(struct rtl8366_smi *smi, u32 len, u32 *data)
 {
 	unsigned int sda = smi->gpio_sda;
-	unsigned int sck = smi->gpio_sck;
 
 	gpio_direction_input(sda);
 
@@ -125,10 +165,10 @@ static void rtl8366_smi_read_bits(struct rtl8366_smi *smi, u32 len, u32 *data)
 		rtl8366_smi_clk_delay(smi);
 
 		/* clocking */
-		gpio_set_value(sck, 1);
+		rtl8366_smi_set_sck(smi, 1);
 		rtl8366_smi_clk_delay(smi);
-		u = !!gpio_get_value(sda);
-		gpio_set_value(sck, 0);
+		u = !!rtl8366_smi_get_sda(smi);
+		rtl8366_smi_set_sck(smi, 0);
 
 		*data |= (u << (len - 1));
 	}
@@ -197,15 +237,12 @@ static int rtl8366_smi_read_byte1(struct rtl8366_smi *smi, u8 *data)
 	return 0;
 }
 
-int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
+static int __rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 {
-	unsigned long flags;
 	u8 lo = 0;
 	u8 hi = 0;
 	int ret;
 
-	spin_lock_irqsave(&smi->lock, flags);
-
 	rtl8366_smi_start(smi);
 
 	/* send READ command */
@@ -234,12 +271,44 @@ int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 
  out:
 	rtl8366_smi_stop(smi);
+
+	return ret;
+}
+
+int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&smi->lock, flags);
+	ret = __rtl8366_smi_read_reg(smi, addr, data);
 	spin_unlock_irqrestore(&smi->lock, flags);
 
 	return ret;
 }
 EXPORT_SYMBOL_GPL(rtl8366_smi_read_reg);
 
+/*
+ * Read @count consecutive registers starting at @addr back to back, without
+ * giving up the bus in between. Meant for multi-word MIB counters and table
+ * entries, so keep @count small.
+ */
+int rtl8366_smi_read_regs(struct rtl8366_smi *smi, u32 addr, u32 *data,
+			  unsigned int count)
+{
+	unsigned long flags;
+	unsigned int i;
+	int ret = 0;
+
+	spin_lock_irqsave(&smi->lock, flags);
+	for (i = 0; i < count && !ret; i++)
+		ret = __rtl8366_smi_read_reg(smi, addr + i, &data[i]);
+	spin_unlock_irqrestore(&smi->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(rtl8366_smi_read_regs);
+
 static int __rtl8366_smi_write_reg(struct rtl8366_smi *smi,
 				   u32 addr, u32 data, bool ack)
 {
@@ -314,8 +383,193 @@ int rtl8366_smi_rmwr(struct rtl8366_smi *smi, u32 addr, u32 mask, u32 data)
 }
 EXPORT_SYMBOL_GPL(rtl8366_smi_rmwr);
 
+/*
+ * The VLAN 4K table and the member configurations are accessed through
+ * shadows: an entry is read over SMI only the first time, and a write that
+ * doesn't change an entry is skipped. Re-applying a configuration then only
+ * costs the SMI transactions of what changed. The shadows are dropped when
+ * the chip is reset or its registers are written through debugfs.
+ */
+static void rtl8366_vlan_cache_flush(struct rtl8366_smi *smi)
+{
+	bitmap_zero(smi->vlan_4k_cached, RTL8366_NUM_VIDS);
+	bitmap_zero(smi->vlan_mc_cached, smi->num_vlan_mc);
+}
+
+static int rtl8366_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
+			       struct rtl8366_vlan_4k *vlan4k)
+{
+	int err;
+
+	if (vid >= RTL8366_NUM_VIDS)
+		return smi->ops->get_vlan_4k(smi, vid, vlan4k);
+
+	if (test_bit(vid, smi->vlan_4k_cached)) {
+		*vlan4k = smi->vlan_4k_cache[vid];
+		return 0;
+	}
+
+	err = smi->ops->get_vlan_4k(smi, vid, vlan4k);
+	if (err)
+		return err;
+
+	smi->vlan_4k_cache[vid] = *vlan4k;
+	set_bit(vid, smi->vlan_4k_cached);
+	return 0;
+}
+
+static int rtl8366_set_vlan_4k(struct rtl8366_smi *smi,
+			       const struct rtl8366_vlan_4k *vlan4k)
+{
+	struct rtl8366_vlan_4k *old;
+	u32 vid = vlan4k->vid;
+	int err;
+
+	if (vid >= RTL8366_NUM_VIDS)
+		return smi->ops->set_vlan_4k(smi, vlan4k);
+
+	old = &smi->vlan_4k_cache[vid];
+	if (test_bit(vid, smi->vlan_4k_cached) &&
+	    old->member == vlan4k->member &&
+	    old->untag == vlan4k->untag &&
+	    old->fid == vlan4k->fid)
+		return 0;
+
+	clear_bit(vid, smi->vlan_4k_cached);
+	err = smi->ops->set_vlan_4k(smi, vlan4k);
+	if (err)
+		return err;
+
+	*old = *vlan4k;
+	set_bit(vid, smi->vlan_4k_cached);
+	return 0;
+}
+
+static int rtl8366_get_vlan_mc(struct rtl8366_smi *smi, u32 index,
+			       struct rtl8366_vlan_mc *vlanmc)
+{
+	int err;
+
+	if (index >= smi->num_vlan_mc)
+		return smi->ops->get_vlan_mc(smi, index, vlanmc);
+
+	if (test_bit(index, smi->vlan_mc_cached)) {
+		*vlanmc = smi->vlan_mc_cache[index];
+		return 0;
+	}
+
+	err = smi->ops->get_vlan_mc(smi, index, vlanmc);
+	if (err)
+		return err;
+
+	smi->vlan_mc_cache[index] = *vlanmc;
+	set_bit(index, smi->vlan_mc_cached);
+	return 0;
+}
+
+static int rtl8366_set_vlan_mc(struct rtl8366_smi *smi, u32 index,
+			       const struct rtl8366_vlan_mc *vlanmc)
+{
+	struct rtl8366_vlan_mc *old;
+	int err;
+
+	if (index >= smi->num_vlan_mc)
+		return smi->ops->set_vlan_mc(smi, index, vlanmc);
+
+	old = &smi->vlan_mc_cache[index];
+	if (test_bit(index, smi->vlan_mc_cached) &&
+	    old->vid == vlanmc->vid &&
+	    old->member == vlanmc->member &&
+	    old->untag == vlanmc->untag &&
+	    old->fid == vlanmc->fid &&
+	    old->priority == vlanmc->priority)
+		return 0;
+
+	clear_bit(index, smi->vlan_mc_cached);
+	err = smi->ops->set_vlan_mc(smi, index, vlanmc);
+	if (err)
+		return err;
+
+	*old = *vlanmc;
+	set_bit(index, smi->vlan_mc_cached);
+	return 0;
+}
+
+void rtl8366_mib_cache_flush(struct rtl8366_smi *smi)
+{
+	smi->mib_cached = 0;
+}
+EXPORT_SYMBOL_GPL(rtl8366_mib_cache_flush);
+
+/*
+ * Returns all MIB counters of a port, read in one pass. The snapshot is
+ * kept with the time it was taken, and returned again while it is younger
+ * than RTL8366_MIB_CACHE_TIME, so monitoring that asks for many counters or
+ * ports in a row doesn't go through SMI for each one.
+ */
+int rtl8366_get_port_mibs(struct rtl8366_smi *smi, int port,
+			  const u64 **counters)
+{
+	unsigned long long counter;
+	u64 *mibs;
+	int i;
+
+	if (port < 0 || port >= smi->num_ports)
+		return -EINVAL;
+
+	mibs = &smi->mib_cache[port * smi->num_mib_counters];
+	*counters = mibs;
+
+	if ((smi->mib_cached & BIT(port)) &&
+	    time_before(jiffies, smi->mib_stamp[port] + RTL8366_MIB_CACHE_TIME))
+		return 0;
+
+	for (i = 0; i < smi->num_mib_counters; i++) {
+		if (smi->ops->get_mib_counter(smi, i, port, &counter))
+			mibs[i] = RTL8366_MIB_INVALID;
+		else
+			mibs[i] = counter;
+	}
+
+	smi->mib_stamp[port] = jiffies;
+	smi->mib_cached |= BIT(port);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(rtl8366_get_port_mibs);
+
+static int rtl8366_cache_init(struct rtl8366_smi *smi)
+{
+	smi->vlan_4k_cache = devm_kzalloc(smi->parent,
+			sizeof(*smi->vlan_4k_cache) * RTL8366_NUM_VIDS,
+			GFP_KERNEL);
+	smi->vlan_4k_cached = devm_kzalloc(smi->parent,
+			BITS_TO_LONGS(RTL8366_NUM_VIDS) * sizeof(long),
+			GFP_KERNEL);
+	smi->vlan_mc_cache = devm_kzalloc(smi->parent,
+			sizeof(*smi->vlan_mc_cache) * smi->num_vlan_mc,
+			GFP_KERNEL);
+	smi->vlan_mc_cached = devm_kzalloc(smi->parent,
+			BITS_TO_LONGS(smi->num_vlan_mc) * sizeof(long),
+			GFP_KERNEL);
+	smi->mib_cache = devm_kzalloc(smi->parent,
+			sizeof(*smi->mib_cache) * smi->num_ports *
+			smi->num_mib_counters, GFP_KERNEL);
+	smi->mib_stamp = devm_kzalloc(smi->parent,
+			sizeof(*smi->mib_stamp) * smi->num_ports, GFP_KERNEL);
+
+	if (!smi->vlan_4k_cache || !smi->vlan_4k_cached ||
+	    !smi->vlan_mc_cache || !smi->vlan_mc_cached ||
+	    !smi->mib_cache || !smi->mib_stamp)
+		return -ENOMEM;
+
+	return 0;
+}
+
 static int rtl8366_reset(struct rtl8366_smi *smi)
 {
+	rtl8366_vlan_cache_flush(smi);
+	rtl8366_mib_cache_flush(smi);
+
 	if (smi->hw_reset) {
 		smi->hw_reset(true);
 		msleep(RTL8366_SMI_HW_STOP_DELAY);
@@ -357,14 +611,14 @@ static int rtl8366_set_vlan(struct rtl8366_smi *smi, int vid, u32 member,
 	int i;
 
 	/* Update the 4K table */
-	err = smi->ops->get_vlan_4k(smi, vid, &vlan4k);
+	err = rtl8366_get_vlan_4k(smi, vid, &vlan4k);
 	if (err)
 		return err;
 
 	vlan4k.member = member;
 	vlan4k.untag = untag;
 	vlan4k.fid = fid;
-	err = smi->ops->set_vlan_4k(smi, &vlan4k);
+	err = rtl8366_set_vlan_4k(smi, &vlan4k);
 	if (err)
 		return err;
 
@@ -372,7 +626,7 @@ static int rtl8366_set_vlan(struct rtl8366_smi *smi, int vid, u32 member,
 	for (i = 0; i < smi->num_vlan_mc; i++) {
 		struct rtl8366_vlan_mc vlanmc;
 
-		err = smi->ops->get_vlan_mc(smi, i, &vlanmc);
+		err = rtl8366_get_vlan_mc(smi, i, &vlanmc);
 		if (err)
 			return err;
 
@@ -382,7 +636,7 @@ static int rtl8366_set_vlan(struct rtl8366_smi *smi, int vid, u32 member,
 			vlanmc.untag = untag;
 			vlanmc.fid = fid;
 
-			err = smi->ops->set_vlan_mc(smi, i, &vlanmc);
+			err = rtl8366_set_vlan_mc(smi, i, &vlanmc);
 			break;
 		}
 	}
@@ -400,7 +654,7 @@ static int rtl8366_get_pvid(struct rtl8366_smi *smi, int port, int *val)
 	if (err)
 		return err;
 
-	err = smi->ops->get_vlan_mc(smi, index, &vlanmc);
+	err = rtl8366_get_vlan_mc(smi, index, &vlanmc);
 	if (err)
 		return err;
 
@@ -418,12 +672,12 @@ static int rtl8366_set_pvid(struct rtl8366_smi *smi, unsigned port,
 
 	/* Try to find an existing MC entry for this VID */
 	for (i = 0; i < smi->num_vlan_mc; i++) {
-		err = smi->ops->get_vlan_mc(smi, i, &vlanmc);
+		err = rtl8366_get_vlan_mc(smi, i, &vlanmc);
 		if (err)
 			return err;
 
 		if (vid == vlanmc.vid) {
-			err = smi->ops->set_vlan_mc(smi, i, &vlanmc);
+			err = rtl8366_set_vlan_mc(smi, i, &vlanmc);
 			if (err)
 				return err;
 
@@ -434,13 +688,13 @@ static int rtl8366_set_pvid(struct rtl8366_smi *smi, unsigned port,
 
 	/* We have no MC entry for this VID, try to find an empty one */
 	for (i = 0; i < smi->num_vlan_mc; i++) {
-		err = smi->ops->get_vlan_mc(smi, i, &vlanmc);
+		err = rtl8366_get_vlan_mc(smi, i, &vlanmc);
 		if (err)
 			return err;
 
 		if (vlanmc.vid == 0 && vlanmc.member == 0) {
 			/* Update the entry from the 4K table */
-			err = smi->ops->get_vlan_4k(smi, vid, &vlan4k);
+			err = rtl8366_get_vlan_4k(smi, vid, &vlan4k);
 			if (err)
 				return err;
 
@@ -448,7 +702,7 @@ static int rtl8366_set_pvid(struct rtl8366_smi *smi, unsigned port,
 			vlanmc.member = vlan4k.member;
 			vlanmc.untag = vlan4k.untag;
 			vlanmc.fid = vlan4k.fid;
-			err = smi->ops->set_vlan_mc(smi, i, &vlanmc);
+			err = rtl8366_set_vlan_mc(smi, i, &vlanmc);
 			if (err)
 				return err;
 
@@ -467,7 +721,7 @@ static int rtl8366_set_pvid(struct rtl8366_smi *smi, unsigned port,
 
 		if (!used) {
 			/* Update the entry from the 4K table */
-			err = smi->ops->get_vlan_4k(smi, vid, &vlan4k);
+			err = rtl8366_get_vlan_4k(smi, vid, &vlan4k);
 			if (err)
 				return err;
 
@@ -475,7 +729,7 @@ static int rtl8366_set_pvid(struct rtl8366_smi *smi, unsigned port,
 			vlanmc.member = vlan4k.member;
 			vlanmc.untag = vlan4k.untag;
 			vlanmc.fid = vlan4k.fid;
-			err = smi->ops->set_vlan_mc(smi, i, &vlanmc);
+			err = rtl8366_set_vlan_mc(smi, i, &vlanmc);
 			if (err)
 				return err;
 
@@ -560,7 +814,7 @@ int rtl8366_reset_vlan(struct rtl8366_smi *smi)
 	vlanmc.untag = 0;
 	vlanmc.fid = 0;
 	for (i = 0; i < smi->num_vlan_mc; i++) {
-		err = smi->ops->set_vlan_mc(smi, i, &vlanmc);
+		err = rtl8366_set_vlan_mc(smi, i, &vlanmc);
 		if (err)
 			return err;
 	}
@@ -747,6 +1001,8 @@ static ssize_t rtl8366_write_debugfs_reg(struct file *file,
 		dev_err(smi->parent, "Invalid reg value %s\n", buf);
 	} else {
 		err = rtl8366_smi_write_reg(smi, reg, data);
+		rtl8366_vlan_cache_flush(smi);
+		rtl8366_mib_cache_flush(smi);
 		if (err) {
 			dev_err(smi->parent,
 				"writing reg 0x%04x val 0x%04lx failed\n",
@@ -997,11 +1253,13 @@ int rtl8366_sw_get_port_mib(struct switch_dev *dev,
 {
 	struct rtl8366_smi *smi = sw_to_rtl8366_smi(dev);
 	int i, len = 0;
-	unsigned long long counter = 0;
+	const u64 *counters;
 	char *buf = smi->buf;
+	int err;
 
-	if (val->port_vlan >= smi->num_ports)
-		return -EINVAL;
+	err = rtl8366_get_port_mibs(smi, val->port_vlan, &counters);
+	if (err)
+		return err;
 
 	len += snprintf(buf + len, sizeof(smi->buf) - len,
 			"Port %d MIB counters\n",
@@ -1010,10 +1268,9 @@ int rtl8366_sw_get_port_mib(struct switch_dev *dev,
 	for (i = 0; i < smi->num_mib_counters; ++i) {
 		len += snprintf(buf + len, sizeof(smi->buf) - len,
 				"%-36s: ", smi->mib_counters[i].name);
-		if (!smi->ops->get_mib_counter(smi, i, val->port_vlan,
-					       &counter))
+		if (counters[i] != RTL8366_MIB_INVALID)
 			len += snprintf(buf + len, sizeof(smi->buf) - len,
-					"%llu\n", counter);
+					"%llu\n", counters[i]);
 		else
 			len += snprintf(buf + len, sizeof(smi->buf) - len,
 					"%s\n", "error");
@@ -1041,7 +1298,7 @@ int rtl8366_sw_get_vlan_info(struct switch_dev *dev,
 
 	memset(buf, '\0', sizeof(smi->buf));
 
-	err = smi->ops->get_vlan_4k(smi, val->port_vlan, &vlan4k);
+	err = rtl8366_get_vlan_4k(smi, val->port_vlan, &vlan4k);
 	if (err)
 		return err;
 
@@ -1077,7 +1334,7 @@ int rtl8366_sw_get_vlan_ports(struct switch_dev *dev, struct switch_val *val)
 	if (!smi->ops->is_vlan_valid(smi, val->port_vlan))
 		return -EINVAL;
 
-	smi->ops->get_vlan_4k(smi, val->port_vlan, &vlan4k);
+	rtl8366_get_vlan_4k(smi, val->port_vlan, &vlan4k);
 
 	port = &val->value.ports[0];
 	val->len = 0;
@@ -1144,7 +1401,7 @@ int rtl8366_sw_get_vlan_fid(struct switch_dev *dev,
 	if (!smi->ops->is_vlan_valid(smi, val->port_vlan))
 		return -EINVAL;
 
-	err = smi->ops->get_vlan_4k(smi, val->port_vlan, &vlan4k);
+	err = rtl8366_get_vlan_4k(smi, val->port_vlan, &vlan4k);
 	if (err)
 		return err;
 
@@ -1168,7 +1425,7 @@ int rtl8366_sw_set_vlan_fid(struct switch_dev *dev,
 	if (val->value.i < 0 || val->value.i > attr->max)
 		return -EINVAL;
 
-	err = smi->ops->get_vlan_4k(smi, val->port_vlan, &vlan4k);
+	err = rtl8366_get_vlan_4k(smi, val->port_vlan, &vlan4k);
 	if (err)
 		return err;
 
@@ -1233,6 +1490,40 @@ struct rtl8366_smi *rtl8366_smi_alloc(struct device *parent)
 }
 EXPORT_SYMBOL_GPL(rtl8366_smi_alloc);
 
+static void rtl8366_smi_setup_gpio(struct rtl8366_smi *smi)
+{
+	struct gpio_chip *sda_chip, *sck_chip;
+	unsigned int cost;
+	ktime_t start;
+	int i;
+
+	smi->gpio_chip = NULL;
+	sda_chip = gpiod_to_chip(gpio_to_desc(smi->gpio_sda));
+	sck_chip = gpiod_to_chip(gpio_to_desc(smi->gpio_sck));
+	if (sda_chip && sda_chip == sck_chip && !sda_chip->can_sleep &&
+	    sda_chip->set && sda_chip->get) {
+		smi->gpio_chip = sda_chip;
+		smi->sda_offset = smi->gpio_sda - sda_chip->base;
+		smi->sck_offset = smi->gpio_sck - sck_chip->base;
+	}
+
+	/*
+	 * Every half clock period is one GPIO access plus the delay, so
+	 * take the cost of an access off the delay asked for.
+	 */
+	gpio_direction_input(smi->gpio_sda);
+	start = ktime_get();
+	for (i = 0; i < RTL8366_SMI_CALIBRATE_LOOPS; i++)
+		rtl8366_smi_get_sda(smi);
+	cost = (u32) ktime_to_ns(ktime_sub(ktime_get(), start)) /
+	       RTL8366_SMI_CALIBRATE_LOOPS;
+
+	smi->clk_ndelay = smi->clk_delay > cost ? smi->clk_delay - cost : 0;
+
+	pr_debug("rtl8366_smi: %s GPIO access, %u ns per access, delay %u ns\n",
+		 smi->gpio_chip ? "direct" : "gpiolib", cost, smi->clk_ndelay);
+}
+
 static int __rtl8366_smi_init(struct rtl8366_smi *smi, const char *name)
 {
 	int err;
@@ -1252,6 +1543,7 @@ static int __rtl8366_smi_init(struct rtl8366_smi *smi, const char *name)
 	}
 
 	spin_lock_init(&smi->lock);
+	rtl8366_smi_setup_gpio(smi);
 
 	/* start the switch */
 	if (smi->hw_reset) {
@@ -1322,6 +1614,10 @@ int rtl8366_smi_init(struct rtl8366_smi *smi)
 	if (!smi->ops)
 		return -EINVAL;
 
+	err = rtl8366_cache_init(smi);
+	if (err)
+		goto err_out;
+
 	err = __rtl8366_smi_init(smi, dev_name(smi->parent));
 	if (err)
 		goto err_out;
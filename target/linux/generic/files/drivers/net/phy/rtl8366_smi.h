@@ -17,11 +17,17 @@
 
 struct rtl8366_smi_ops;
 struct rtl8366_vlan_ops;
+struct gpio_chip;
 struct mii_bus;
 struct dentry;
 struct inode;
 struct file;
 
+#define RTL8366_NUM_VIDS	4096
+
+/* value of a counter in a MIB snapshot that could not be read */
+#define RTL8366_MIB_INVALID	(~0ULL)
+
 struct rtl8366_mib_counter {
 	unsigned	base;
 	unsigned	offset;
@@ -35,6 +41,10 @@ struct rtl8366_smi {
 	unsigned int		gpio_sck;
 	void			(*hw_reset)(bool active);
 	unsigned int		clk_delay;	/* ns */
+	unsigned int		clk_ndelay;	/* ns, calibrated */
+	struct gpio_chip	*gpio_chip;	/* if SDA and SCK share one */
+	unsigned int		sda_offset;
+	unsigned int		sck_offset;
 	u8			cmd_read;
 	u8			cmd_write;
 	spinlock_t		lock;
@@ -53,6 +63,17 @@ struct rtl8366_smi {
 	int			vlan_enabled;
 	int			vlan4k_enabled;
 
+	/* shadows of the VLAN tables, with a bitmap of the known entries */
+	struct rtl8366_vlan_4k	*vlan_4k_cache;
+	unsigned long		*vlan_4k_cached;
+	struct rtl8366_vlan_mc	*vlan_mc_cache;
+	unsigned long		*vlan_mc_cached;
+
+	/* MIB snapshots, num_mib_counters per port, and when they were taken */
+	u64			*mib_cache;
+	unsigned long		*mib_stamp;
+	unsigned long		mib_cached;	/* bitmap of ports */
+
 	char			buf[4096];
 #ifdef CONFIG_RTL8366_SMI_DEBUG_FS
 	struct dentry           *debugfs_root;
@@ -108,11 +129,16 @@ void rtl8366_smi_cleanup(struct rtl8366_smi *smi);
 int rtl8366_smi_write_reg(struct rtl8366_smi *smi, u32 addr, u32 data);
 int rtl8366_smi_write_reg_noack(struct rtl8366_smi *smi, u32 addr, u32 data);
 int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data);
+int rtl8366_smi_read_regs(struct rtl8366_smi *smi, u32 addr, u32 *data,
+			  unsigned int count);
 int rtl8366_smi_rmwr(struct rtl8366_smi *smi, u32 addr, u32 mask, u32 data);
 
 int rtl8366_reset_vlan(struct rtl8366_smi *smi);
 int rtl8366_enable_vlan(struct rtl8366_smi *smi, int enable);
 int rtl8366_enable_all_ports(struct rtl8366_smi *smi, int enable);
+int rtl8366_get_port_mibs(struct rtl8366_smi *smi, int port,
+			  const u64 **counters);
+void rtl8366_mib_cache_flush(struct rtl8366_smi *smi);
 
 #ifdef CONFIG_RTL8366_SMI_DEBUG_FS
 int rtl8366_debugfs_open(struct inode *inode, struct file *file);
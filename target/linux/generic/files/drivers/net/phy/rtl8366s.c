@@ -359,6 +359,8 @@ static int rtl8366_get_mib_counter(struct rtl8366_smi *smi, int counter,
 	int i;
 	int err;
 	u32 addr, data;
+	u32 words[4];
+	unsigned length;
 	u64 mibvalue;
 
 	if (port > RTL8366S_NUM_PORTS || counter >= RTL8366S_MIB_COUNT)
@@ -401,14 +403,17 @@ static int rtl8366_get_mib_counter(struct rtl8366_smi *smi, int counter,
 	if (data & RTL8366S_MIB_CTRL_RESET_MASK)
 		return -EIO;
 
-	mibvalue = 0;
-	for (i = rtl8366s_mib_counters[counter].length; i > 0; i--) {
-		err = rtl8366_smi_read_reg(smi, addr + (i - 1), &data);
-		if (err)
-			return err;
+	length = rtl8366s_mib_counters[counter].length;
+	if (length > ARRAY_SIZE(words))
+		return -EINVAL;
 
-		mibvalue = (mibvalue << 16) | (data & 0xFFFF);
-	}
+	err = rtl8366_smi_read_regs(smi, addr, words, length);
+	if (err)
+		return err;
+
+	mibvalue = 0;
+	for (i = length; i > 0; i--)
+		mibvalue = (mibvalue << 16) | (words[i - 1] & 0xFFFF);
 
 	*val = mibvalue;
 	return 0;
@@ -419,7 +424,6 @@ static int rtl8366s_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 {
 	u32 data[2];
 	int err;
-	int i;
 
 	memset(vlan4k, '\0', sizeof(struct rtl8366_vlan_4k));
 
@@ -438,13 +442,10 @@ static int rtl8366s_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 	if (err)
 		return err;
 
-	for (i = 0; i < 2; i++) {
-		err = rtl8366_smi_read_reg(smi,
-					   RTL8366S_VLAN_TABLE_READ_BASE + i,
-					   &data[i]);
-		if (err)
-			return err;
-	}
+	err = rtl8366_smi_read_regs(smi, RTL8366S_VLAN_TABLE_READ_BASE, data,
+				    ARRAY_SIZE(data));
+	if (err)
+		return err;
 
 	vlan4k->vid = vid;
 	vlan4k->untag = (data[1] >> RTL8366S_VLAN_UNTAG_SHIFT) &
@@ -626,6 +627,8 @@ static int rtl8366s_sw_reset_mibs(struct switch_dev *dev,
 {
 	struct rtl8366_smi *smi = sw_to_rtl8366_smi(dev);
 
+	rtl8366_mib_cache_flush(smi);
+
 	return rtl8366_smi_rmwr(smi, RTL8366S_MIB_CTRL_REG, 0, (1 << 2));
 }
 
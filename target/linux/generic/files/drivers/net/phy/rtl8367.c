@@ -1202,6 +1202,7 @@ static int rtl8367_get_mib_counter(struct rtl8366_smi *smi, int counter,
 	int i;
 	int err;
 	u32 addr, data;
+	u32 words[4];
 	u64 mibvalue;
 
 	if (port > RTL8367_NUM_PORTS || counter >= RTL8367_MIB_COUNT)
@@ -1230,11 +1231,19 @@ static int rtl8367_get_mib_counter(struct rtl8366_smi *smi, int counter,
 	else
 		offset = (mib->offset + 1) % 4;
 
+	if (mib->length > ARRAY_SIZE(words))
+		return -EINVAL;
+
+	/* the counter words are read from the top down */
+	err = rtl8366_smi_read_regs(smi,
+			RTL8367_MIB_COUNTER_REG(offset - mib->length + 1),
+			words, mib->length);
+	if (err)
+		return err;
+
 	mibvalue = 0;
-	for (i = 0; i < mib->length; i++) {
-		REG_RD(smi, RTL8367_MIB_COUNTER_REG(offset - i), &data);
-		mibvalue = (mibvalue << 16) | (data & 0xFFFF);
-	}
+	for (i = mib->length; i > 0; i--)
+		mibvalue = (mibvalue << 16) | (words[i - 1] & 0xFFFF);
 
 	*val = mibvalue;
 	return 0;
@@ -1245,7 +1254,6 @@ static int rtl8367_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 {
 	u32 data[RTL8367_TA_VLAN_DATA_SIZE];
 	int err;
-	int i;
 
 	memset(vlan4k, '\0', sizeof(struct rtl8366_vlan_4k));
 
@@ -1258,8 +1266,10 @@ static int rtl8367_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 	/* write table access control word */
 	REG_WR(smi, RTL8367_TA_CTRL_REG, RTL8367_TA_CTRL_CVLAN_READ);
 
-	for (i = 0; i < ARRAY_SIZE(data); i++)
-		REG_RD(smi, RTL8367_TA_DATA_REG(i), &data[i]);
+	err = rtl8366_smi_read_regs(smi, RTL8367_TA_DATA_REG(0), data,
+				    ARRAY_SIZE(data));
+	if (err)
+		return err;
 
 	vlan4k->vid = vid;
 	vlan4k->member = (data[0] >> RTL8367_TA_VLAN_MEMBER_SHIFT) &
@@ -1432,6 +1442,8 @@ static int rtl8367_sw_reset_mibs(struct switch_dev *dev,
 {
 	struct rtl8366_smi *smi = sw_to_rtl8366_smi(dev);
 
+	rtl8366_mib_cache_flush(smi);
+
 	return rtl8366_smi_rmwr(smi, RTL8367_MIB_CTRL_REG(0), 0,
 				RTL8367_MIB_CTRL_GLOBAL_RESET_MASK);
 }
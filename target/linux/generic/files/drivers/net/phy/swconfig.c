@@ -305,7 +305,7 @@ static struct genl_family switch_fam = {
 	.id = GENL_ID_GENERATE,
 	.name = "switch",
 	.hdrsize = 0,
-	.version = 1,
+	.version = SWITCH_DUMP_VERSION,
 	.maxattr = SWITCH_ATTR_MAX,
 };
 
@@ -318,6 +318,8 @@ static const struct nla_policy switch_policy[SWITCH_ATTR_MAX+1] = {
 	[SWITCH_ATTR_OP_VALUE_STR] = { .type = NLA_NUL_STRING },
 	[SWITCH_ATTR_OP_VALUE_PORTS] = { .type = NLA_NESTED },
 	[SWITCH_ATTR_TYPE] = { .type = NLA_U32 },
+	[SWITCH_ATTR_OP_LIST] = { .type = NLA_NESTED },
+	[SWITCH_ATTR_OP_GROUP] = { .type = NLA_U32 },
 };
 
 static const struct nla_policy port_policy[SWITCH_PORT_ATTR_MAX+1] = {
@@ -338,16 +340,16 @@ swconfig_unlock(void)
 }
 
 static struct switch_dev *
-swconfig_get_dev(struct genl_info *info)
+__swconfig_get_dev(struct nlattr **attrs)
 {
 	struct switch_dev *dev = NULL;
 	struct switch_dev *p;
 	int id;
 
-	if (!info->attrs[SWITCH_ATTR_ID])
+	if (!attrs[SWITCH_ATTR_ID])
 		goto done;
 
-	id = nla_get_u32(info->attrs[SWITCH_ATTR_ID]);
+	id = nla_get_u32(attrs[SWITCH_ATTR_ID]);
 	swconfig_lock();
 	list_for_each_entry(p, &swdevs, dev_list) {
 		if (id != p->id)
@@ -365,6 +367,12 @@ done:
 	return dev;
 }
 
+static inline struct switch_dev *
+swconfig_get_dev(struct genl_info *info)
+{
+	return __swconfig_get_dev(info->attrs);
+}
+
 static inline void
 swconfig_put_dev(struct switch_dev *dev)
 {
@@ -525,79 +533,121 @@ out:
 	return err;
 }
 
-static const struct switch_attr *
-swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
-		struct switch_val *val)
+static int
+swconfig_cmd_group(int cmd)
 {
-	struct genlmsghdr *hdr = nlmsg_data(info->nlhdr);
+	switch (cmd) {
+	case SWITCH_CMD_SET_GLOBAL:
+	case SWITCH_CMD_GET_GLOBAL:
+		return SWITCH_GROUP_GLOBAL;
+	case SWITCH_CMD_SET_VLAN:
+	case SWITCH_CMD_GET_VLAN:
+		return SWITCH_GROUP_VLAN;
+	case SWITCH_CMD_SET_PORT:
+	case SWITCH_CMD_GET_PORT:
+		return SWITCH_GROUP_PORT;
+	default:
+		WARN_ON(1);
+		return -1;
+	}
+}
+
+struct swconfig_attr_group {
 	const struct switch_attrlist *alist;
-	const struct switch_attr *attr = NULL;
-	int attr_id;
 
 	/* defaults */
 	struct switch_attr *def_list;
 	unsigned long *def_active;
 	int n_def;
+};
 
-	if (!info->attrs[SWITCH_ATTR_OP_ID])
-		goto done;
-
-	switch (hdr->cmd) {
-	case SWITCH_CMD_SET_GLOBAL:
-	case SWITCH_CMD_GET_GLOBAL:
-		alist = &dev->ops->attr_global;
-		def_list = default_global;
-		def_active = &dev->def_global;
-		n_def = ARRAY_SIZE(default_global);
+static int
+swconfig_get_group(struct switch_dev *dev, int group,
+		struct swconfig_attr_group *g)
+{
+	switch (group) {
+	case SWITCH_GROUP_GLOBAL:
+		g->alist = &dev->ops->attr_global;
+		g->def_list = default_global;
+		g->def_active = &dev->def_global;
+		g->n_def = ARRAY_SIZE(default_global);
 		break;
-	case SWITCH_CMD_SET_VLAN:
-	case SWITCH_CMD_GET_VLAN:
-		alist = &dev->ops->attr_vlan;
-		def_list = default_vlan;
-		def_active = &dev->def_vlan;
-		n_def = ARRAY_SIZE(default_vlan);
-		if (!info->attrs[SWITCH_ATTR_OP_VLAN])
-			goto done;
-		val->port_vlan = nla_get_u32(info->attrs[SWITCH_ATTR_OP_VLAN]);
-		if (val->port_vlan >= dev->vlans)
-			goto done;
+	case SWITCH_GROUP_VLAN:
+		g->alist = &dev->ops->attr_vlan;
+		g->def_list = default_vlan;
+		g->def_active = &dev->def_vlan;
+		g->n_def = ARRAY_SIZE(default_vlan);
 		break;
-	case SWITCH_CMD_SET_PORT:
-	case SWITCH_CMD_GET_PORT:
-		alist = &dev->ops->attr_port;
-		def_list = default_port;
-		def_active = &dev->def_port;
-		n_def = ARRAY_SIZE(default_port);
-		if (!info->attrs[SWITCH_ATTR_OP_PORT])
-			goto done;
-		val->port_vlan = nla_get_u32(info->attrs[SWITCH_ATTR_OP_PORT]);
-		if (val->port_vlan >= dev->ports)
-			goto done;
+	case SWITCH_GROUP_PORT:
+		g->alist = &dev->ops->attr_port;
+		g->def_list = default_port;
+		g->def_active = &dev->def_port;
+		g->n_def = ARRAY_SIZE(default_port);
 		break;
 	default:
-		WARN_ON(1);
-		goto done;
+		return -EINVAL;
 	}
 
-	if (!alist)
-		goto done;
+	return 0;
+}
+
+/* map an attribute id of a group to its descriptor */
+static const struct switch_attr *
+swconfig_get_group_attr(const struct swconfig_attr_group *g, int attr_id)
+{
+	const struct switch_attr *attr;
 
-	attr_id = nla_get_u32(info->attrs[SWITCH_ATTR_OP_ID]);
 	if (attr_id >= SWITCH_ATTR_DEFAULTS_OFFSET) {
 		attr_id -= SWITCH_ATTR_DEFAULTS_OFFSET;
-		if (attr_id >= n_def)
+		if (attr_id >= g->n_def)
+			return NULL;
+		if (!test_bit(attr_id, g->def_active))
+			return NULL;
+		attr = &g->def_list[attr_id];
+	} else {
+		if (attr_id >= g->alist->n_attr)
+			return NULL;
+		attr = &g->alist->attr[attr_id];
+	}
+
+	if (attr->disabled)
+		return NULL;
+
+	return attr;
+}
+
+static const struct switch_attr *
+__swconfig_lookup_attr(struct switch_dev *dev, int group,
+		struct nlattr **attrs, struct switch_val *val)
+{
+	struct swconfig_attr_group g;
+	const struct switch_attr *attr = NULL;
+
+	if (!attrs[SWITCH_ATTR_OP_ID])
+		goto done;
+
+	if (swconfig_get_group(dev, group, &g))
+		goto done;
+
+	switch (group) {
+	case SWITCH_GROUP_VLAN:
+		if (!attrs[SWITCH_ATTR_OP_VLAN])
 			goto done;
-		if (!test_bit(attr_id, def_active))
+		val->port_vlan = nla_get_u32(attrs[SWITCH_ATTR_OP_VLAN]);
+		if (val->port_vlan >= dev->vlans)
 			goto done;
-		attr = &def_list[attr_id];
-	} else {
-		if (attr_id >= alist->n_attr)
+		break;
+	case SWITCH_GROUP_PORT:
+		if (!attrs[SWITCH_ATTR_OP_PORT])
+			goto done;
+		val->port_vlan = nla_get_u32(attrs[SWITCH_ATTR_OP_PORT]);
+		if (val->port_vlan >= dev->ports)
 			goto done;
-		attr = &alist->attr[attr_id];
+		break;
 	}
 
-	if (attr->disabled)
-		attr = NULL;
+	attr = swconfig_get_group_attr(&g,
+			nla_get_u32(attrs[SWITCH_ATTR_OP_ID]));
 
 done:
 	if (!attr)
@@ -606,6 +656,16 @@ done:
 	return attr;
 }
 
+static const struct switch_attr *
+swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
+		struct switch_val *val)
+{
+	struct genlmsghdr *hdr = nlmsg_data(info->nlhdr);
+
+	return __swconfig_lookup_attr(dev, swconfig_cmd_group(hdr->cmd),
+			info->attrs, val);
+}
+
 static int
 swconfig_parse_ports(struct sk_buff *msg, struct nlattr *head,
 		struct switch_val *val, int max)
@@ -638,19 +698,15 @@ swconfig_parse_ports(struct sk_buff *msg, struct nlattr *head,
 }
 
 static int
-swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
+__swconfig_set_attr(struct switch_dev *dev, int group, struct nlattr **attrs,
+		struct sk_buff *skb)
 {
 	const struct switch_attr *attr;
-	struct switch_dev *dev;
 	struct switch_val val;
 	int err = -EINVAL;
 
-	dev = swconfig_get_dev(info);
-	if (!dev)
-		return -EINVAL;
-
 	memset(&val, 0, sizeof(val));
-	attr = swconfig_lookup_attr(dev, info, &val);
+	attr = __swconfig_lookup_attr(dev, group, attrs, &val);
 	if (!attr || !attr->set)
 		goto error;
 
@@ -659,16 +715,16 @@ swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
 	case SWITCH_TYPE_NOVAL:
 		break;
 	case SWITCH_TYPE_INT:
-		if (!info->attrs[SWITCH_ATTR_OP_VALUE_INT])
+		if (!attrs[SWITCH_ATTR_OP_VALUE_INT])
 			goto error;
 		val.value.i =
-			nla_get_u32(info->attrs[SWITCH_ATTR_OP_VALUE_INT]);
+			nla_get_u32(attrs[SWITCH_ATTR_OP_VALUE_INT]);
 		break;
 	case SWITCH_TYPE_STRING:
-		if (!info->attrs[SWITCH_ATTR_OP_VALUE_STR])
+		if (!attrs[SWITCH_ATTR_OP_VALUE_STR])
 			goto error;
 		val.value.s =
-			nla_data(info->attrs[SWITCH_ATTR_OP_VALUE_STR]);
+			nla_data(attrs[SWITCH_ATTR_OP_VALUE_STR]);
 		break;
 	case SWITCH_TYPE_PORTS:
 		val.value.ports = dev->portbuf;
@@ -676,9 +732,9 @@ swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
 			sizeof(struct switch_port) * dev->ports);
 
 		/* TODO: implement multipart? */
-		if (info->attrs[SWITCH_ATTR_OP_VALUE_PORTS]) {
+		if (attrs[SWITCH_ATTR_OP_VALUE_PORTS]) {
 			err = swconfig_parse_ports(skb,
-				info->attrs[SWITCH_ATTR_OP_VALUE_PORTS],
+				attrs[SWITCH_ATTR_OP_VALUE_PORTS],
 				&val, dev->ports);
 			if (err < 0)
 				goto error;
@@ -693,6 +749,69 @@ swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
 
 	err = attr->set(dev, attr, &val);
 error:
+	return err;
+}
+
+static int
+swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
+{
+	struct genlmsghdr *hdr = nlmsg_data(info->nlhdr);
+	struct switch_dev *dev;
+	int err;
+
+	dev = swconfig_get_dev(info);
+	if (!dev)
+		return -EINVAL;
+
+	err = __swconfig_set_attr(dev, swconfig_cmd_group(hdr->cmd),
+			info->attrs, skb);
+	swconfig_put_dev(dev);
+	return err;
+}
+
+static int
+swconfig_batch_group(struct nlattr **attrs)
+{
+	if (!attrs[SWITCH_ATTR_OP_GROUP])
+		return SWITCH_GROUP_GLOBAL;
+
+	return nla_get_u32(attrs[SWITCH_ATTR_OP_GROUP]);
+}
+
+/*
+ * Apply a list of SWITCH_ATTR_OP entries in order, under a single lock of
+ * the device. All entries are tried; the first error is returned.
+ */
+static int
+swconfig_set_batch(struct sk_buff *skb, struct genl_info *info)
+{
+	struct switch_dev *dev;
+	struct nlattr *nla;
+	int err = -EINVAL;
+	int rem;
+
+	dev = swconfig_get_dev(info);
+	if (!dev)
+		return -EINVAL;
+
+	if (!info->attrs[SWITCH_ATTR_OP_LIST])
+		goto out;
+
+	err = 0;
+	nla_for_each_nested(nla, info->attrs[SWITCH_ATTR_OP_LIST], rem) {
+		struct nlattr *tb[SWITCH_ATTR_MAX+1];
+		int ret;
+
+		ret = nla_parse_nested(tb, SWITCH_ATTR_MAX, nla,
+				switch_policy);
+		if (!ret)
+			ret = __swconfig_set_attr(dev, swconfig_batch_group(tb),
+					tb, skb);
+		if (ret && !err)
+			err = ret;
+	}
+
+out:
 	swconfig_put_dev(dev);
 	return err;
 }
@@ -847,6 +966,292 @@ error:
 	return err;
 }
 
+struct swconfig_batch_val {
+	int group;
+	u32 id;
+	const struct switch_attr *attr;
+	struct switch_val val;
+	int err;
+};
+
+static int
+swconfig_put_val(struct sk_buff *msg, u32 portid, u32 seq, int cmd,
+		const struct swconfig_batch_val *bv)
+{
+	const struct switch_val *val = &bv->val;
+	void *hdr;
+	int i;
+
+	hdr = genlmsg_put(msg, portid, seq, &switch_fam, NLM_F_MULTI, cmd);
+	if (IS_ERR_OR_NULL(hdr))
+		return -1;
+
+	if (nla_put_u32(msg, SWITCH_ATTR_OP_GROUP, bv->group))
+		goto nla_put_failure;
+	if (nla_put_u32(msg, SWITCH_ATTR_OP_ID, bv->id))
+		goto nla_put_failure;
+	if (bv->group == SWITCH_GROUP_PORT &&
+	    nla_put_u32(msg, SWITCH_ATTR_OP_PORT, val->port_vlan))
+		goto nla_put_failure;
+	if (bv->group == SWITCH_GROUP_VLAN &&
+	    nla_put_u32(msg, SWITCH_ATTR_OP_VLAN, val->port_vlan))
+		goto nla_put_failure;
+
+	if (bv->err) {
+		if (nla_put_u32(msg, SWITCH_ATTR_OP_ERROR, -bv->err))
+			goto nla_put_failure;
+		goto done;
+	}
+
+	switch (bv->attr->type) {
+	case SWITCH_TYPE_INT:
+		if (nla_put_u32(msg, SWITCH_ATTR_OP_VALUE_INT, val->value.i))
+			goto nla_put_failure;
+		break;
+	case SWITCH_TYPE_STRING:
+		if (nla_put_string(msg, SWITCH_ATTR_OP_VALUE_STR, val->value.s))
+			goto nla_put_failure;
+		break;
+	case SWITCH_TYPE_PORTS: {
+		struct nlattr *n;
+
+		n = nla_nest_start(msg, SWITCH_ATTR_OP_VALUE_PORTS);
+		if (!n)
+			goto nla_put_failure;
+		for (i = 0; i < val->len; i++) {
+			const struct switch_port *port = &val->value.ports[i];
+			struct nlattr *p;
+
+			p = nla_nest_start(msg, SWITCH_ATTR_PORT);
+			if (!p)
+				goto nla_put_failure;
+			if (nla_put_u32(msg, SWITCH_PORT_ID, port->id))
+				goto nla_put_failure;
+			if ((port->flags & (1 << SWITCH_PORT_FLAG_TAGGED)) &&
+			    nla_put_flag(msg, SWITCH_PORT_FLAG_TAGGED))
+				goto nla_put_failure;
+			nla_nest_end(msg, p);
+		}
+		nla_nest_end(msg, n);
+		break;
+	}
+	default:
+		break;
+	}
+
+done:
+	genlmsg_end(msg, hdr);
+	return msg->len;
+nla_put_failure:
+	genlmsg_cancel(msg, hdr);
+	return -EMSGSIZE;
+}
+
+static int
+swconfig_dump_val(struct swconfig_callback *cb, void *arg)
+{
+	struct genl_info *info = cb->info;
+
+	return swconfig_put_val(cb->msg, info->snd_portid, info->snd_seq,
+			SWITCH_CMD_GET_BATCH, arg);
+}
+
+/* fetch one value, leaving the outcome in bv->err */
+static void
+swconfig_batch_get(struct switch_dev *dev, struct swconfig_batch_val *bv)
+{
+	if (!bv->attr || !bv->attr->get) {
+		bv->err = -EINVAL;
+		return;
+	}
+
+	if (bv->attr->type == SWITCH_TYPE_PORTS) {
+		bv->val.value.ports = dev->portbuf;
+		memset(dev->portbuf, 0,
+			sizeof(struct switch_port) * dev->ports);
+	}
+
+	bv->err = bv->attr->get(dev, bv->attr, &bv->val);
+	if (!bv->err && bv->attr->type == SWITCH_TYPE_STRING &&
+	    (!bv->val.value.s ||
+	     strlen(bv->val.value.s) > NLMSG_GOODSIZE / 2))
+		bv->err = -EMSGSIZE;
+}
+
+/*
+ * Read a list of SWITCH_ATTR_OP entries, replying with one message per
+ * entry in request order. Entries that fail carry SWITCH_ATTR_OP_ERROR
+ * instead of a value.
+ */
+static int
+swconfig_get_batch(struct sk_buff *skb, struct genl_info *info)
+{
+	struct switch_dev *dev;
+	struct swconfig_callback cb;
+	struct swconfig_batch_val bv;
+	struct nlattr *nla;
+	int err = -EINVAL;
+	int rem;
+
+	dev = swconfig_get_dev(info);
+	if (!dev)
+		return -EINVAL;
+
+	if (!info->attrs[SWITCH_ATTR_OP_LIST])
+		goto out;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.info = info;
+	cb.fill = swconfig_dump_val;
+
+	nla_for_each_nested(nla, info->attrs[SWITCH_ATTR_OP_LIST], rem) {
+		struct nlattr *tb[SWITCH_ATTR_MAX+1];
+
+		memset(&bv, 0, sizeof(bv));
+		bv.err = nla_parse_nested(tb, SWITCH_ATTR_MAX, nla,
+				switch_policy);
+		if (bv.err)
+			goto send;
+
+		bv.group = swconfig_batch_group(tb);
+		if (tb[SWITCH_ATTR_OP_ID])
+			bv.id = nla_get_u32(tb[SWITCH_ATTR_OP_ID]);
+
+		bv.attr = __swconfig_lookup_attr(dev, bv.group, tb, &bv.val);
+		swconfig_batch_get(dev, &bv);
+
+send:
+		err = swconfig_send_multipart(&cb, &bv);
+		if (err < 0)
+			goto out;
+	}
+	swconfig_put_dev(dev);
+
+	if (!cb.msg)
+		return 0;
+
+	return genlmsg_reply(cb.msg, info);
+
+out:
+	swconfig_put_dev(dev);
+	return err;
+}
+
+/* dump order of the attribute groups */
+static const int swconfig_dump_groups[] = {
+	SWITCH_GROUP_GLOBAL,
+	SWITCH_GROUP_PORT,
+	SWITCH_GROUP_VLAN,
+};
+
+static int
+swconfig_group_attr_id(const struct swconfig_attr_group *g, int idx)
+{
+	if (idx < g->alist->n_attr)
+		return idx;
+
+	return SWITCH_ATTR_DEFAULTS_OFFSET + idx - g->alist->n_attr;
+}
+
+/* vlans without member ports are left out of the dump */
+static bool
+swconfig_dump_vlan(struct switch_dev *dev, const struct swconfig_attr_group *g,
+		int vlan)
+{
+	struct swconfig_batch_val bv;
+	int i;
+
+	memset(&bv, 0, sizeof(bv));
+	for (i = 0; i < g->alist->n_attr + g->n_def && !bv.attr; i++) {
+		const struct switch_attr *attr;
+
+		attr = swconfig_get_group_attr(g, swconfig_group_attr_id(g, i));
+		if (attr && attr->type == SWITCH_TYPE_PORTS &&
+		    !strcmp(attr->name, "ports"))
+			bv.attr = attr;
+	}
+
+	if (!bv.attr)
+		return true;
+
+	bv.val.port_vlan = vlan;
+	swconfig_batch_get(dev, &bv);
+
+	return !bv.err && bv.val.len;
+}
+
+/*
+ * Dump the current value of every global, port and vlan attribute.
+ * cb->args[0..2] hold the group, port/vlan and attribute index to resume
+ * from when the reply spans several messages.
+ */
+static int
+swconfig_dump_values(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *tb[SWITCH_ATTR_MAX+1];
+	struct switch_dev *dev;
+	int group_idx = cb->args[0];
+	int obj = cb->args[1];
+	int idx = cb->args[2];
+
+	if (nlmsg_parse(cb->nlh, GENL_HDRLEN + switch_fam.hdrsize, tb,
+			SWITCH_ATTR_MAX, switch_policy))
+		return -EINVAL;
+
+	dev = __swconfig_get_dev(tb);
+	if (!dev)
+		return -EINVAL;
+
+	for (; group_idx < ARRAY_SIZE(swconfig_dump_groups);
+	     group_idx++, obj = 0, idx = 0) {
+		int group = swconfig_dump_groups[group_idx];
+		struct swconfig_attr_group g;
+		int n_obj;
+
+		swconfig_get_group(dev, group, &g);
+		if (group == SWITCH_GROUP_PORT)
+			n_obj = dev->ports;
+		else if (group == SWITCH_GROUP_VLAN)
+			n_obj = dev->vlans;
+		else
+			n_obj = 1;
+
+		for (; obj < n_obj; obj++, idx = 0) {
+			if (group == SWITCH_GROUP_VLAN && !idx &&
+			    !swconfig_dump_vlan(dev, &g, obj))
+				continue;
+
+			for (; idx < g.alist->n_attr + g.n_def; idx++) {
+				struct swconfig_batch_val bv;
+
+				memset(&bv, 0, sizeof(bv));
+				bv.group = group;
+				bv.id = swconfig_group_attr_id(&g, idx);
+				bv.attr = swconfig_get_group_attr(&g, bv.id);
+				if (!bv.attr || bv.attr->type == SWITCH_TYPE_NOVAL)
+					continue;
+
+				bv.val.port_vlan = obj;
+				swconfig_batch_get(dev, &bv);
+
+				if (swconfig_put_val(skb,
+						NETLINK_CB(cb->skb).portid,
+						cb->nlh->nlmsg_seq,
+						SWITCH_CMD_DUMP_VALUES, &bv) < 0)
+					goto out;
+			}
+		}
+	}
+
+out:
+	swconfig_put_dev(dev);
+	cb->args[0] = group_idx;
+	cb->args[1] = obj;
+	cb->args[2] = idx;
+
+	return skb->len;
+}
+
 static int
 swconfig_send_switch(struct sk_buff *msg, u32 pid, u32 seq, int flags,
 		const struct switch_dev *dev)
@@ -974,6 +1379,22 @@ static struct genl_ops swconfig_ops[] = {
 		.doit = swconfig_set_attr,
 		.policy = switch_policy,
 	},
+	{
+		.cmd = SWITCH_CMD_SET_BATCH,
+		.doit = swconfig_set_batch,
+		.policy = switch_policy,
+	},
+	{
+		.cmd = SWITCH_CMD_GET_BATCH,
+		.doit = swconfig_get_batch,
+		.policy = switch_policy,
+	},
+	{
+		.cmd = SWITCH_CMD_DUMP_VALUES,
+		.dumpit = swconfig_dump_values,
+		.policy = switch_policy,
+		.done = swconfig_done,
+	},
 	{
 		.cmd = SWITCH_CMD_GET_SWITCH,
 		.dumpit = swconfig_dump_switches,
@@ -1108,6 +1529,13 @@ unregister_switch(struct switch_dev *dev)
 }
 EXPORT_SYMBOL_GPL(unregister_switch);
 
+void
+swconfig_link_changed(struct switch_dev *dev, u32 port_link)
+{
+	swconfig_led_link_changed(dev, port_link);
+}
+EXPORT_SYMBOL_GPL(swconfig_link_changed);
+
 
 static int __init
 swconfig_init(void)
@@ -18,6 +18,8 @@
 #include <linux/workqueue.h>
 
 #define SWCONFIG_LED_TIMER_INTERVAL	(HZ / 10)
+/* link polling interval once the driver reports link changes itself */
+#define SWCONFIG_LED_LINK_INTERVAL	(5 * HZ)
 #define SWCONFIG_LED_NUM_PORTS		32
 
 struct switch_led_trigger {
@@ -25,6 +27,9 @@ struct switch_led_trigger {
 	struct switch_dev *swdev;
 
 	struct delayed_work sw_led_work;
+	spinlock_t link_lock;
+	bool link_events;	/* driver calls swconfig_link_changed() */
+	unsigned long link_poll;	/* jiffies of the next link poll */
 	u32 port_mask;
 	u32 port_link;
 	unsigned long port_traffic[SWCONFIG_LED_NUM_PORTS];
@@ -79,6 +84,8 @@ swconfig_trig_update_port_mask(struct led_trigger *trigger)
 	read_unlock(&trigger->leddev_list_lock);
 
 	sw_trig->port_mask = port_mask;
+	/* ports may have been added, fetch their link state right away */
+	sw_trig->link_poll = jiffies;
 
 	if (port_mask)
 		schedule_delayed_work(&sw_trig->sw_led_work,
@@ -253,8 +260,10 @@ swconfig_led_work_func(struct work_struct *work)
 {
 	struct switch_led_trigger *sw_trig;
 	struct switch_dev *swdev;
+	unsigned long flags, delay;
 	u32 port_mask;
 	u32 link;
+	bool poll;
 	int i;
 
 	sw_trig = container_of(work, struct switch_led_trigger,
@@ -263,40 +272,91 @@ swconfig_led_work_func(struct work_struct *work)
 	port_mask = sw_trig->port_mask;
 	swdev = sw_trig->swdev;
 
-	link = 0;
-	for (i = 0; i < SWCONFIG_LED_NUM_PORTS; i++) {
-		u32 port_bit;
-
-		port_bit = BIT(i);
-		if ((port_mask & port_bit) == 0)
-			continue;
+	poll = !sw_trig->link_events ||
+	       !time_before(jiffies, sw_trig->link_poll);
 
-		if (swdev->ops->get_port_link) {
+	if (poll) {
+		link = 0;
+		for (i = 0; i < SWCONFIG_LED_NUM_PORTS; i++) {
 			struct switch_port_link port_link;
 
+			if ((port_mask & BIT(i)) == 0)
+				continue;
+
 			memset(&port_link, '\0', sizeof(port_link));
 			swdev->ops->get_port_link(swdev, i, &port_link);
 
 			if (port_link.link)
-				link |= port_bit;
+				link |= BIT(i);
 		}
 
-		if (swdev->ops->get_port_stats) {
-			struct switch_port_stats port_stats;
+		spin_lock_irqsave(&sw_trig->link_lock, flags);
+		sw_trig->port_link = link;
+		spin_unlock_irqrestore(&sw_trig->link_lock, flags);
 
-			memset(&port_stats, '\0', sizeof(port_stats));
-			swdev->ops->get_port_stats(swdev, i, &port_stats);
-			sw_trig->port_traffic[i] = port_stats.tx_bytes +
-						   port_stats.rx_bytes;
-		}
+		sw_trig->link_poll = jiffies + SWCONFIG_LED_LINK_INTERVAL;
 	}
 
-	sw_trig->port_link = link;
+	spin_lock_irqsave(&sw_trig->link_lock, flags);
+	link = sw_trig->port_link;
+	spin_unlock_irqrestore(&sw_trig->link_lock, flags);
+
+	/* traffic only matters for ports with link */
+	for (i = 0; i < SWCONFIG_LED_NUM_PORTS; i++) {
+		struct switch_port_stats port_stats;
+
+		if (!swdev->ops->get_port_stats)
+			break;
+
+		if ((port_mask & link & BIT(i)) == 0)
+			continue;
+
+		memset(&port_stats, '\0', sizeof(port_stats));
+		swdev->ops->get_port_stats(swdev, i, &port_stats);
+		sw_trig->port_traffic[i] = port_stats.tx_bytes +
+					   port_stats.rx_bytes;
+	}
 
 	swconfig_trig_update_leds(sw_trig);
 
-	schedule_delayed_work(&sw_trig->sw_led_work,
-			      SWCONFIG_LED_TIMER_INTERVAL);
+	/*
+	 * With link events and no link on any port there is nothing to
+	 * blink, so only the fallback link poll is left to do.
+	 */
+	delay = SWCONFIG_LED_TIMER_INTERVAL;
+	if (sw_trig->link_events && !(port_mask & link))
+		delay = time_before(jiffies, sw_trig->link_poll) ?
+			sw_trig->link_poll - jiffies : 0;
+
+	schedule_delayed_work(&sw_trig->sw_led_work, delay);
+}
+
+/*
+ * Called by switch drivers that learn about link changes, e.g. from a
+ * link interrupt, with the link state of all ports. May be called from
+ * interrupt context. Once a driver has called this, the link state is
+ * only polled every SWCONFIG_LED_LINK_INTERVAL as a fallback.
+ */
+static void
+swconfig_led_link_changed(struct switch_dev *swdev, u32 port_link)
+{
+	struct switch_led_trigger *sw_trig = swdev->led_trigger;
+	unsigned long flags;
+
+	if (!sw_trig)
+		return;
+
+	spin_lock_irqsave(&sw_trig->link_lock, flags);
+	sw_trig->port_link = port_link;
+	spin_unlock_irqrestore(&sw_trig->link_lock, flags);
+
+	if (!sw_trig->link_events) {
+		sw_trig->link_poll = jiffies + SWCONFIG_LED_LINK_INTERVAL;
+		sw_trig->link_events = true;
+	}
+
+	if (sw_trig->port_mask)
+		mod_delayed_work(system_wq, &sw_trig->sw_led_work, 0);
 }
 
 static int
@@ -313,6 +373,7 @@ swconfig_create_led_trigger(struct switch_dev *swdev)
 		return -ENOMEM;
 
 	sw_trig->swdev = swdev;
+	spin_lock_init(&sw_trig->link_lock);
 	sw_trig->trig.name = swdev->devname;
 	sw_trig->trig.activate = swconfig_trig_activate;
 	sw_trig->trig.deactivate = swconfig_trig_deactivate;
@@ -339,6 +400,7 @@ swconfig_destroy_led_trigger(struct switch_dev *swdev)
 
 	sw_trig = swdev->led_trigger;
 	if (sw_trig) {
+		swdev->led_trigger = NULL;
 		cancel_delayed_work_sync(&sw_trig->sw_led_work);
 		led_trigger_unregister(&sw_trig->trig);
 		kfree(sw_trig);
@@ -351,4 +413,7 @@ swconfig_create_led_trigger(struct switch_dev *swdev) { return 0; }
 
 static inline void
 swconfig_destroy_led_trigger(struct switch_dev *swdev) { }
+
+static inline void
+swconfig_led_link_changed(struct switch_dev *swdev, u32 port_link) { }
 #endif /* CONFIG_SWCONFIG_LEDS */
@@ -17,164 +17,182 @@
 #include "yportenv.h"
 
 /*
- * Each entry in yaffs_tnode_list and yaffs_obj_list hold blocks
- * of approx 100 objects that are themn allocated singly.
- * This is basically a simplified slab allocator.
+ * Tnodes and objects are handed out from whole pages, each page carrying a
+ * small header with its own free list. This is basically a simplified slab
+ * allocator.
  *
  * We don't use the Linux slab allocator because slab does not allow
  * us to dump all the objects in one hit when we do a umount and tear
  * down  all the tnodes and objects. slab requires that we first free
  * the individual objects.
  *
- * Once yaffs has been mainlined I shall try to motivate for a change
- * to slab to provide the extra features we need here.
+ * Because the page a slot lives in is found by masking its address, a page
+ * whose slots have all been freed is given back to the kernel. Memory use
+ * then follows the tnodes and objects in use rather than the most ever used.
  */
 
-struct yaffs_tnode_list {
-	struct yaffs_tnode_list *next;
-	struct yaffs_tnode *tnodes;
+#define YAFFS_ALLOC_ALIGN	8
+
+struct yaffs_alloc_page {
+	struct list_head list;	/* On the pool's partial or full list */
+	void *free;		/* Free slots, linked through their first word */
+	int n_used;
 };
 
-struct yaffs_obj_list {
-	struct yaffs_obj_list *next;
-	struct yaffs_obj *objects;
+#define YAFFS_ALLOC_HDR_SIZE \
+	((sizeof(struct yaffs_alloc_page) + YAFFS_ALLOC_ALIGN - 1) & \
+	 ~(YAFFS_ALLOC_ALIGN - 1))
+
+struct yaffs_pool {
+	struct list_head partial;	/* Pages with free slots */
+	struct list_head full;		/* Pages without */
+	int slot_size;
+	int slots_per_page;
+	int n_created;
+	int n_free;
+	int n_pages;
 };
 
 struct yaffs_allocator {
-	int n_tnodes_created;
-	struct yaffs_tnode *free_tnodes;
-	int n_free_tnodes;
-	struct yaffs_tnode_list *alloc_tnode_list;
-
-	int n_obj_created;
-	struct list_head free_objs;
-	int n_free_objects;
-
-	struct yaffs_obj_list *allocated_obj_list;
+	struct yaffs_pool tnodes;
+	struct yaffs_pool objs;
 };
 
-static void yaffs_deinit_raw_tnodes(struct yaffs_dev *dev)
+/* align must be a power of two, at most YAFFS_ALLOC_ALIGN */
+static void yaffs_pool_init(struct yaffs_pool *pool, int slot_size, int align)
 {
-	struct yaffs_allocator *allocator =
-	    (struct yaffs_allocator *)dev->allocator;
-	struct yaffs_tnode_list *tmp;
-
-	if (!allocator) {
-		BUG();
-		return;
-	}
-
-	while (allocator->alloc_tnode_list) {
-		tmp = allocator->alloc_tnode_list->next;
-
-		kfree(allocator->alloc_tnode_list->tnodes);
-		kfree(allocator->alloc_tnode_list);
-		allocator->alloc_tnode_list = tmp;
-	}
-
-	allocator->free_tnodes = NULL;
-	allocator->n_free_tnodes = 0;
-	allocator->n_tnodes_created = 0;
+	INIT_LIST_HEAD(&pool->partial);
+	INIT_LIST_HEAD(&pool->full);
+	pool->slot_size = (slot_size + align - 1) & ~(align - 1);
+	pool->slots_per_page = (PAGE_SIZE - YAFFS_ALLOC_HDR_SIZE) /
+			       pool->slot_size;
+	pool->n_created = 0;
+	pool->n_free = 0;
+	pool->n_pages = 0;
 }
 
-static void yaffs_init_raw_tnodes(struct yaffs_dev *dev)
+static void yaffs_pool_deinit(struct yaffs_pool *pool)
 {
-	struct yaffs_allocator *allocator = dev->allocator;
+	struct yaffs_alloc_page *pg;
 
-	if (!allocator) {
-		BUG();
-		return;
+	while (!list_empty(&pool->partial)) {
+		pg = list_entry(pool->partial.next,
+				struct yaffs_alloc_page, list);
+		list_del(&pg->list);
+		free_page((unsigned long)pg);
+	}
+
+	while (!list_empty(&pool->full)) {
+		pg = list_entry(pool->full.next,
+				struct yaffs_alloc_page, list);
+		list_del(&pg->list);
+		free_page((unsigned long)pg);
 	}
 
-	allocator->alloc_tnode_list = NULL;
-	allocator->free_tnodes = NULL;
-	allocator->n_free_tnodes = 0;
-	allocator->n_tnodes_created = 0;
+	pool->n_created = 0;
+	pool->n_free = 0;
+	pool->n_pages = 0;
 }
 
-static int yaffs_create_tnodes(struct yaffs_dev *dev, int n_tnodes)
+static int yaffs_pool_grow(struct yaffs_pool *pool)
 {
-	struct yaffs_allocator *allocator =
-	    (struct yaffs_allocator *)dev->allocator;
+	struct yaffs_alloc_page *pg;
+	u8 *slot;
 	int i;
-	struct yaffs_tnode *new_tnodes;
-	u8 *mem;
-	struct yaffs_tnode *curr;
-	struct yaffs_tnode *next;
-	struct yaffs_tnode_list *tnl;
 
-	if (!allocator) {
-		BUG();
+	if (pool->slots_per_page < 1)
 		return YAFFS_FAIL;
-	}
 
-	if (n_tnodes < 1)
-		return YAFFS_OK;
+	pg = (struct yaffs_alloc_page *)__get_free_page(GFP_NOFS);
+	if (!pg)
+		return YAFFS_FAIL;
 
-	/* make these things */
-	new_tnodes = kmalloc(n_tnodes * dev->tnode_size, GFP_NOFS);
-	mem = (u8 *) new_tnodes;
+	pg->free = NULL;
+	pg->n_used = 0;
 
-	if (!new_tnodes) {
-		yaffs_trace(YAFFS_TRACE_ERROR,
-			"yaffs: Could not allocate Tnodes");
-		return YAFFS_FAIL;
+	slot = (u8 *)pg + YAFFS_ALLOC_HDR_SIZE;
+	for (i = 0; i < pool->slots_per_page; i++) {
+		*(void **)slot = pg->free;
+		pg->free = slot;
+		slot += pool->slot_size;
 	}
 
-	/* New hookup for wide tnodes */
-	for (i = 0; i < n_tnodes - 1; i++) {
-		curr = (struct yaffs_tnode *)&mem[i * dev->tnode_size];
-		next = (struct yaffs_tnode *)&mem[(i + 1) * dev->tnode_size];
-		curr->internal[0] = next;
+	list_add(&pg->list, &pool->partial);
+	pool->n_pages++;
+	pool->n_created += pool->slots_per_page;
+	pool->n_free += pool->slots_per_page;
+
+	return YAFFS_OK;
+}
+
+static void *yaffs_pool_alloc(struct yaffs_pool *pool)
+{
+	struct yaffs_alloc_page *pg;
+	void *slot;
+
+	/* If there are none left make more */
+	if (list_empty(&pool->partial) && yaffs_pool_grow(pool) != YAFFS_OK)
+		return NULL;
+
+	pg = list_entry(pool->partial.next, struct yaffs_alloc_page, list);
+	slot = pg->free;
+	pg->free = *(void **)slot;
+	pg->n_used++;
+	pool->n_free--;
+
+	if (!pg->free) {
+		list_del(&pg->list);
+		list_add(&pg->list, &pool->full);
 	}
 
-	curr = (struct yaffs_tnode *)&mem[(n_tnodes - 1) * dev->tnode_size];
-	curr->internal[0] = allocator->free_tnodes;
-	allocator->free_tnodes = (struct yaffs_tnode *)mem;
+	return slot;
+}
 
-	allocator->n_free_tnodes += n_tnodes;
-	allocator->n_tnodes_created += n_tnodes;
+static void yaffs_pool_free(struct yaffs_pool *pool, void *slot)
+{
+	struct yaffs_alloc_page *pg =
+	    (struct yaffs_alloc_page *)((unsigned long)slot & PAGE_MASK);
 
-	/* Now add this bunch of tnodes to a list for freeing up.
-	 * NB If we can't add this to the management list it isn't fatal
-	 * but it just means we can't free this bunch of tnodes later.
+	/* Pages that fill up again go to the back, so the front ones fill
+	 * first and the others get a chance to empty.
 	 */
-	tnl = kmalloc(sizeof(struct yaffs_tnode_list), GFP_NOFS);
-	if (!tnl) {
-		yaffs_trace(YAFFS_TRACE_ERROR,
-			"Could not add tnodes to management list");
-		return YAFFS_FAIL;
-	} else {
-		tnl->tnodes = new_tnodes;
-		tnl->next = allocator->alloc_tnode_list;
-		allocator->alloc_tnode_list = tnl;
+	if (!pg->free) {
+		list_del(&pg->list);
+		list_add_tail(&pg->list, &pool->partial);
 	}
 
-	yaffs_trace(YAFFS_TRACE_ALLOCATE, "Tnodes added");
+	*(void **)slot = pg->free;
+	pg->free = slot;
+	pg->n_used--;
+	pool->n_free++;
 
-	return YAFFS_OK;
+	/* Keep a page's worth of free slots so that allocating and freeing
+	 * around a page boundary does not keep going back to the kernel.
+	 */
+	if (pg->n_used == 0 && pool->n_free > pool->slots_per_page) {
+		list_del(&pg->list);
+		free_page((unsigned long)pg);
+		pool->n_pages--;
+		pool->n_created -= pool->slots_per_page;
+		pool->n_free -= pool->slots_per_page;
+	}
 }
 
 struct yaffs_tnode *yaffs_alloc_raw_tnode(struct yaffs_dev *dev)
 {
 	struct yaffs_allocator *allocator =
 	    (struct yaffs_allocator *)dev->allocator;
-	struct yaffs_tnode *tn = NULL;
+	struct yaffs_tnode *tn;
 
 	if (!allocator) {
 		BUG();
 		return NULL;
 	}
 
-	/* If there are none left make more */
-	if (!allocator->free_tnodes)
-		yaffs_create_tnodes(dev, YAFFS_ALLOCATION_NTNODES);
-
-	if (allocator->free_tnodes) {
-		tn = allocator->free_tnodes;
-		allocator->free_tnodes = allocator->free_tnodes->internal[0];
-		allocator->n_free_tnodes--;
-	}
+	tn = yaffs_pool_alloc(&allocator->tnodes);
+	if (!tn)
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs: Could not allocate Tnodes");
 
 	return tn;
 }
@@ -189,151 +207,74 @@ void yaffs_free_raw_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 		return;
 	}
 
-	if (tn) {
-		tn->internal[0] = allocator->free_tnodes;
-		allocator->free_tnodes = tn;
-		allocator->n_free_tnodes++;
-	}
+	if (tn)
+		yaffs_pool_free(&allocator->tnodes, tn);
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
 }
 
 /*--------------- yaffs_obj alloaction ------------------------
  *
- * Free yaffs_objs are stored in a list using obj->siblings.
- * The blocks of allocated objects are stored in a linked list.
+ * Objects share the page handling with tnodes. A free object slot is
+ * linked through its first word, like a free tnode.
  */
 
-static void yaffs_init_raw_objs(struct yaffs_dev *dev)
-{
-	struct yaffs_allocator *allocator = dev->allocator;
-
-	if (!allocator) {
-		BUG();
-		return;
-	}
-
-	allocator->allocated_obj_list = NULL;
-	INIT_LIST_HEAD(&allocator->free_objs);
-	allocator->n_free_objects = 0;
-}
-
-static void yaffs_deinit_raw_objs(struct yaffs_dev *dev)
-{
-	struct yaffs_allocator *allocator = dev->allocator;
-	struct yaffs_obj_list *tmp;
-
-	if (!allocator) {
-		BUG();
-		return;
-	}
-
-	while (allocator->allocated_obj_list) {
-		tmp = allocator->allocated_obj_list->next;
-		kfree(allocator->allocated_obj_list->objects);
-		kfree(allocator->allocated_obj_list);
-		allocator->allocated_obj_list = tmp;
-	}
-
-	INIT_LIST_HEAD(&allocator->free_objs);
-	allocator->n_free_objects = 0;
-	allocator->n_obj_created = 0;
-}
-
-static int yaffs_create_free_objs(struct yaffs_dev *dev, int n_obj)
+struct yaffs_obj *yaffs_alloc_raw_obj(struct yaffs_dev *dev)
 {
+	struct yaffs_obj *obj;
 	struct yaffs_allocator *allocator = dev->allocator;
-	int i;
-	struct yaffs_obj *new_objs;
-	struct yaffs_obj_list *list;
 
 	if (!allocator) {
 		BUG();
-		return YAFFS_FAIL;
+		return NULL;
 	}
 
-	if (n_obj < 1)
-		return YAFFS_OK;
-
-	/* make these things */
-	new_objs = kmalloc(n_obj * sizeof(struct yaffs_obj), GFP_NOFS);
-	list = kmalloc(sizeof(struct yaffs_obj_list), GFP_NOFS);
-
-	if (!new_objs || !list) {
-		kfree(new_objs);
-		new_objs = NULL;
-		kfree(list);
-		list = NULL;
+	obj = yaffs_pool_alloc(&allocator->objs);
+	if (!obj)
 		yaffs_trace(YAFFS_TRACE_ALLOCATE,
 			"Could not allocate more objects");
-		return YAFFS_FAIL;
-	}
-
-	/* Hook them into the free list */
-	for (i = 0; i < n_obj; i++)
-		list_add(&new_objs[i].siblings, &allocator->free_objs);
-
-	allocator->n_free_objects += n_obj;
-	allocator->n_obj_created += n_obj;
-
-	/* Now add this bunch of Objects to a list for freeing up. */
 
-	list->objects = new_objs;
-	list->next = allocator->allocated_obj_list;
-	allocator->allocated_obj_list = list;
-
-	return YAFFS_OK;
+	return obj;
 }
 
-struct yaffs_obj *yaffs_alloc_raw_obj(struct yaffs_dev *dev)
+void yaffs_free_raw_obj(struct yaffs_dev *dev, struct yaffs_obj *obj)
 {
-	struct yaffs_obj *obj = NULL;
-	struct list_head *lh;
+
 	struct yaffs_allocator *allocator = dev->allocator;
 
 	if (!allocator) {
 		BUG();
-		return obj;
-	}
-
-	/* If there are none left make more */
-	if (list_empty(&allocator->free_objs))
-		yaffs_create_free_objs(dev, YAFFS_ALLOCATION_NOBJECTS);
-
-	if (!list_empty(&allocator->free_objs)) {
-		lh = allocator->free_objs.next;
-		obj = list_entry(lh, struct yaffs_obj, siblings);
-		list_del_init(lh);
-		allocator->n_free_objects--;
+		return;
 	}
 
-	return obj;
+	yaffs_pool_free(&allocator->objs, obj);
 }
 
-void yaffs_free_raw_obj(struct yaffs_dev *dev, struct yaffs_obj *obj)
+void yaffs_alloc_stats(struct yaffs_dev *dev, struct yaffs_alloc_stats *stats)
 {
-
 	struct yaffs_allocator *allocator = dev->allocator;
 
-	if (!allocator) {
-		BUG();
+	memset(stats, 0, sizeof(*stats));
+	if (!allocator)
 		return;
-	}
 
-	/* Link into the free list. */
-	list_add(&obj->siblings, &allocator->free_objs);
-	allocator->n_free_objects++;
+	stats->n_tnodes_created = allocator->tnodes.n_created;
+	stats->n_free_tnodes = allocator->tnodes.n_free;
+	stats->n_obj_created = allocator->objs.n_created;
+	stats->n_free_objects = allocator->objs.n_free;
+	stats->n_pages = allocator->tnodes.n_pages + allocator->objs.n_pages;
 }
 
 void yaffs_deinit_raw_tnodes_and_objs(struct yaffs_dev *dev)
 {
+	struct yaffs_allocator *allocator = dev->allocator;
 
-	if (!dev->allocator) {
+	if (!allocator) {
 		BUG();
 		return;
 	}
 
-	yaffs_deinit_raw_tnodes(dev);
-	yaffs_deinit_raw_objs(dev);
+	yaffs_pool_deinit(&allocator->tnodes);
+	yaffs_pool_deinit(&allocator->objs);
 	kfree(dev->allocator);
 	dev->allocator = NULL;
 }
@@ -350,8 +291,12 @@ void yaffs_init_raw_tnodes_and_objs(struct yaffs_dev *dev)
 	allocator = kmalloc(sizeof(struct yaffs_allocator), GFP_NOFS);
 	if (allocator) {
 		dev->allocator = allocator;
-		yaffs_init_raw_tnodes(dev);
-		yaffs_init_raw_objs(dev);
+		/* Tnodes are only read as u32s and linked through a pointer.
+		 * Objects hold 64 bit fields.
+		 */
+		yaffs_pool_init(&allocator->tnodes, dev->tnode_size,
+				sizeof(void *));
+		yaffs_pool_init(&allocator->objs, sizeof(struct yaffs_obj),
+				YAFFS_ALLOC_ALIGN);
 	}
 }
-
@@ -27,4 +27,14 @@ void yaffs_free_raw_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn);
 struct yaffs_obj *yaffs_alloc_raw_obj(struct yaffs_dev *dev);
 void yaffs_free_raw_obj(struct yaffs_dev *dev, struct yaffs_obj *obj);
 
+struct yaffs_alloc_stats {
+	int n_tnodes_created;	/* Tnode slots in pages held */
+	int n_free_tnodes;
+	int n_obj_created;	/* Object slots in pages held */
+	int n_free_objects;
+	int n_pages;		/* Pages held for both */
+};
+
+void yaffs_alloc_stats(struct yaffs_dev *dev, struct yaffs_alloc_stats *stats);
+
 #endif
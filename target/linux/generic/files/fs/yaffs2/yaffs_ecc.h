@@ -41,4 +41,8 @@ void yaffs_ecc_calc_other(const unsigned char *data, unsigned n_bytes,
 int yaffs_ecc_correct_other(unsigned char *data, unsigned n_bytes,
 			    struct yaffs_ecc_other *read_ecc,
 			    const struct yaffs_ecc_other *test_ecc);
+
+#ifdef CONFIG_YAFFS_ECC_SELFTEST
+int yaffs_ecc_selftest(void);
+#endif
 #endif
@@ -30,8 +30,6 @@
 #include "yaffs_attribs.h"
 #include "yaffs_summary.h"
 
-/* Note YAFFS_GC_GOOD_ENOUGH must be <= YAFFS_GC_PASSIVE_THRESHOLD */
-#define YAFFS_GC_GOOD_ENOUGH 2
 #define YAFFS_GC_PASSIVE_THRESHOLD 4
 
 #include "yaffs_ecc.h"
@@ -44,6 +42,8 @@ static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 static void yaffs_fix_null_name(struct yaffs_obj *obj, YCHAR *name,
 				int buffer_size);
 
+static void yaffs_gc_index_update(struct yaffs_dev *dev, int block_no);
+
 /* Function to calculate chunk and offset */
 
 void yaffs_addr_to_chunk(struct yaffs_dev *dev, loff_t addr,
@@ -438,6 +438,7 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 		/* If the block is full set the state to full */
 		if (dev->alloc_page >= dev->param.chunks_per_block) {
 			bi->block_state = YAFFS_BLOCK_STATE_FULL;
+			yaffs_gc_index_update(dev, dev->alloc_block);
 			dev->alloc_block = -1;
 		}
 
@@ -478,6 +479,7 @@ void yaffs_skip_rest_of_block(struct yaffs_dev *dev)
 		bi = yaffs_get_block_info(dev, dev->alloc_block);
 		if (bi->block_state == YAFFS_BLOCK_STATE_ALLOCATING) {
 			bi->block_state = YAFFS_BLOCK_STATE_FULL;
+			yaffs_gc_index_update(dev, dev->alloc_block);
 			dev->alloc_block = -1;
 		}
 	}
@@ -625,6 +627,7 @@ static void yaffs_retire_block(struct yaffs_dev *dev, int flash_block)
 	bi->block_state = YAFFS_BLOCK_STATE_DEAD;
 	bi->gc_prioritise = 0;
 	bi->needs_retiring = 0;
+	yaffs_gc_index_update(dev, flash_block);
 
 	dev->n_retired_blocks++;
 }
@@ -1256,6 +1259,7 @@ static void yaffs_soft_del_chunk(struct yaffs_dev *dev, int chunk)
 	if (the_block) {
 		the_block->soft_del_pages++;
 		dev->n_free_chunks++;
+		yaffs_gc_index_update(dev, block_no);
 		yaffs2_update_oldest_dirty_seq(dev, block_no, the_block);
 	}
 }
@@ -1429,20 +1433,55 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   In Linux, the page cache provides read buffering and the short op cache
  *   provides write buffering.
  *
- *   There are a small number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Caches holding a chunk are hashed on (object, chunk_id), kept on an LRU
+ *   list and linked to their object, so none of the operations below need
+ *   to look at every cache and n_caches can be in the hundreds.
  */
 
-static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
+static inline struct list_head *yaffs_cache_bucket(struct yaffs_dev *dev,
+						   const struct yaffs_obj *obj,
+						   int chunk_id)
+{
+	u32 h = obj->obj_id * 0x9e3779b1 + chunk_id;
+
+	return &dev->cache_bucket[h & dev->cache_bucket_mask];
+}
+
+static void yaffs_attach_cache(struct yaffs_cache *cache,
+			       struct yaffs_obj *obj, int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
-	struct yaffs_cache *cache;
-	int n_caches = obj->my_dev->param.n_caches;
 
-	for (i = 0; i < n_caches; i++) {
-		cache = &dev->cache[i];
-		if (cache->object == obj && cache->dirty)
+	cache->object = obj;
+	cache->chunk_id = chunk_id;
+	list_add(&cache->hash_link, yaffs_cache_bucket(dev, obj, chunk_id));
+	list_add_tail(&cache->obj_link, &obj->cached_chunks);
+	list_del(&cache->lru_link);
+	list_add(&cache->lru_link, &dev->cache_lru);
+}
+
+static void yaffs_detach_cache(struct yaffs_cache *cache)
+{
+	struct yaffs_dev *dev;
+
+	if (!cache->object)
+		return;
+
+	dev = cache->object->my_dev;
+	list_del_init(&cache->hash_link);
+	list_del_init(&cache->obj_link);
+	list_del(&cache->lru_link);
+	list_add(&cache->lru_link, &dev->cache_free);
+	cache->object = NULL;
+	cache->dirty = 0;
+}
+
+static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
+{
+	struct list_head *i;
+
+	list_for_each(i, &obj->cached_chunks) {
+		if (list_entry(i, struct yaffs_cache, obj_link)->dirty)
 			return 1;
 	}
 
@@ -1467,44 +1506,45 @@ static void yaffs_flush_single_cache(struct yaffs_cache *cache, int discard)
 	}
 
 	if (discard)
-		cache->object = NULL;
+		yaffs_detach_cache(cache);
 }
 
 static void yaffs_flush_file_cache(struct yaffs_obj *obj, int discard)
 {
-	struct yaffs_dev *dev = obj->my_dev;
-	int i;
-	struct yaffs_cache *cache;
-	int n_caches = obj->my_dev->param.n_caches;
+	struct list_head *i;
+	struct list_head *n;
 
-	if (n_caches < 1)
+	if (obj->my_dev->param.n_caches < 1)
 		return;
 
-
-	/* Find the chunks for this object and flush them. */
-	for (i = 0; i < n_caches; i++) {
-		cache = &dev->cache[i];
-		if (cache->object == obj)
-			yaffs_flush_single_cache(cache, discard);
-	}
-
+	/* The object's chunks are all on its own list, so they get
+	 * written back together. */
+	list_for_each_safe(i, n, &obj->cached_chunks)
+		yaffs_flush_single_cache(list_entry(i, struct yaffs_cache,
+						    obj_link), discard);
 }
 
 
 void yaffs_flush_whole_cache(struct yaffs_dev *dev, int discard)
 {
 	struct yaffs_obj *obj;
-	int n_caches = dev->param.n_caches;
-	int i;
+	struct yaffs_cache *cache;
+	struct list_head *i;
+
+	if (dev->param.n_caches < 1)
+		return;
 
 	/* Find a dirty object in the cache and flush it...
 	 * until there are no further dirty objects.
 	 */
 	do {
 		obj = NULL;
-		for (i = 0; i < n_caches && !obj; i++) {
-			if (dev->cache[i].object && dev->cache[i].dirty)
-				obj = dev->cache[i].object;
+		list_for_each(i, &dev->cache_lru) {
+			cache = list_entry(i, struct yaffs_cache, lru_link);
+			if (cache->dirty && !cache->locked) {
+				obj = cache->object;
+				break;
+			}
 		}
 		if (obj)
 			yaffs_flush_file_cache(obj, discard);
@@ -1514,28 +1554,21 @@ void yaffs_flush_whole_cache(struct yaffs_dev *dev, int discard)
 
 /* Grab us an unused cache chunk for use.
  * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then take the least recently used one, flushing it if it is dirty.
+ * The caller attaches it to its object with yaffs_attach_cache().
  */
 static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
 {
-	int i;
-
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (!dev->cache[i].object)
-				return &dev->cache[i];
-		}
-	}
+	if (list_empty(&dev->cache_free))
+		return NULL;
 
-	return NULL;
+	return list_entry(dev->cache_free.next, struct yaffs_cache, lru_link);
 }
 
 static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
 {
 	struct yaffs_cache *cache;
-	int usage;
-	int i;
+	struct list_head *i;
 
 	if (dev->param.n_caches < 1)
 		return NULL;
@@ -1552,26 +1585,15 @@ static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
 	 * Find the LRU cache and flush it if it is dirty.
 	 */
 
-	usage = -1;
-	cache = NULL;
-
-	for (i = 0; i < dev->param.n_caches; i++) {
-		if (dev->cache[i].object &&
-		    !dev->cache[i].locked &&
-		    (dev->cache[i].last_use < usage || !cache)) {
-				usage = dev->cache[i].last_use;
-				cache = &dev->cache[i];
+	for (i = dev->cache_lru.prev; i != &dev->cache_lru; i = i->prev) {
+		cache = list_entry(i, struct yaffs_cache, lru_link);
+		if (!cache->locked) {
+			yaffs_flush_single_cache(cache, 1);
+			return cache;
 		}
 	}
 
-#if 1
-	yaffs_flush_single_cache(cache, 1);
-#else
-	yaffs_flush_file_cache(cache->object, 1);
-	cache = yaffs_grab_chunk_worker(dev);
-#endif
-
-	return cache;
+	return NULL;
 }
 
 /* Find a cached chunk */
@@ -1579,17 +1601,19 @@ static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 						  int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
+	struct yaffs_cache *cache;
+	struct list_head *i;
 
 	if (dev->param.n_caches < 1)
 		return NULL;
 
-	for (i = 0; i < dev->param.n_caches; i++) {
-		if (dev->cache[i].object == obj &&
-		    dev->cache[i].chunk_id == chunk_id) {
+	list_for_each(i, yaffs_cache_bucket(dev, obj, chunk_id)) {
+		cache = list_entry(i, struct yaffs_cache, hash_link);
+		if (cache->object == obj &&
+		    cache->chunk_id == chunk_id) {
 			dev->cache_hits++;
 
-			return &dev->cache[i];
+			return cache;
 		}
 	}
 	return NULL;
@@ -1599,21 +1623,11 @@ static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 			    int is_write)
 {
-	int i;
-
 	if (dev->param.n_caches < 1)
 		return;
 
-	if (dev->cache_last_use < 0 ||
-		dev->cache_last_use > 100000000) {
-		/* Reset the cache usages */
-		for (i = 1; i < dev->param.n_caches; i++)
-			dev->cache[i].last_use = 0;
-
-		dev->cache_last_use = 0;
-	}
-	dev->cache_last_use++;
-	cache->last_use = dev->cache_last_use;
+	list_del(&cache->lru_link);
+	list_add(&cache->lru_link, &dev->cache_lru);
 
 	if (is_write)
 		cache->dirty = 1;
@@ -1631,7 +1645,7 @@ static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
 		cache = yaffs_find_chunk_cache(object, chunk_id);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_detach_cache(cache);
 	}
 }
 
@@ -1640,16 +1654,11 @@ static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
  */
 static void yaffs_invalidate_whole_cache(struct yaffs_obj *in)
 {
-	int i;
-	struct yaffs_dev *dev = in->my_dev;
+	struct list_head *i;
+	struct list_head *n;
 
-	if (dev->param.n_caches > 0) {
-		/* Invalidate it. */
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == in)
-				dev->cache[i].object = NULL;
-		}
-	}
+	list_for_each_safe(i, n, &in->cached_chunks)
+		yaffs_detach_cache(list_entry(i, struct yaffs_cache, obj_link));
 }
 
 static void yaffs_unhash_obj(struct yaffs_obj *obj)
@@ -1871,6 +1880,7 @@ static struct yaffs_obj *yaffs_alloc_empty_obj(struct yaffs_dev *dev)
 	INIT_LIST_HEAD(&(obj->hard_links));
 	INIT_LIST_HEAD(&(obj->hash_link));
 	INIT_LIST_HEAD(&obj->siblings);
+	INIT_LIST_HEAD(&obj->cached_chunks);
 
 	/* Now make the directory sane */
 	if (dev->root_dir) {
@@ -2296,6 +2306,129 @@ struct yaffs_obj *yaffs_link_obj(struct yaffs_obj *parent, const YCHAR * name,
 
 /*---------------------- Block Management and Page Allocation -------------*/
 
+/*
+ * The gc index keeps every FULL block on the list for its count of live pages
+ * (pages_in_use - soft_del_pages). Block counts only move one page at a time
+ * so an update is a constant time unlink and push, and the dirtiest block is
+ * found by walking up from the first non-empty list.
+ */
+
+static inline struct yaffs_gc_link *yaffs_get_gc_link(struct yaffs_dev *dev,
+						       int block_no)
+{
+	return &dev->gc_links[block_no - dev->internal_start_block];
+}
+
+static void yaffs_gc_index_unlink(struct yaffs_dev *dev, int block_no)
+{
+	struct yaffs_gc_link *link = yaffs_get_gc_link(dev, block_no);
+
+	if (link->key < 0)
+		return;
+
+	if (link->prev >= 0)
+		yaffs_get_gc_link(dev, link->prev)->next = link->next;
+	else
+		dev->gc_heads[link->key] = link->next;
+
+	if (link->next >= 0)
+		yaffs_get_gc_link(dev, link->next)->prev = link->prev;
+
+	link->key = -1;
+}
+
+/* Put the block on the right list for its state and page count */
+static void yaffs_gc_index_update(struct yaffs_dev *dev, int block_no)
+{
+	struct yaffs_block_info *bi;
+	struct yaffs_gc_link *link;
+	int key = -1;
+
+	if (!dev->gc_links ||
+	    block_no < dev->internal_start_block ||
+	    block_no > dev->internal_end_block)
+		return;
+
+	bi = yaffs_get_block_info(dev, block_no);
+	if (bi->block_state == YAFFS_BLOCK_STATE_FULL) {
+		key = bi->pages_in_use - bi->soft_del_pages;
+		if (key < 0)
+			key = 0;
+		if (key > dev->param.chunks_per_block)
+			key = dev->param.chunks_per_block;
+	}
+
+	link = yaffs_get_gc_link(dev, block_no);
+	if (link->key == key)
+		return;
+
+	yaffs_gc_index_unlink(dev, block_no);
+	if (key < 0)
+		return;
+
+	link->key = key;
+	link->prev = -1;
+	link->next = dev->gc_heads[key];
+	if (link->next >= 0)
+		yaffs_get_gc_link(dev, link->next)->prev = block_no;
+	dev->gc_heads[key] = block_no;
+}
+
+/* Scanning and checkpoint restore set block states directly, so rebuild. */
+static void yaffs_gc_index_rebuild(struct yaffs_dev *dev)
+{
+	int i;
+
+	if (!dev->gc_links || !dev->gc_heads)
+		return;
+
+	for (i = 0; i <= dev->param.chunks_per_block; i++)
+		dev->gc_heads[i] = -1;
+
+	for (i = dev->internal_start_block; i <= dev->internal_end_block; i++)
+		yaffs_get_gc_link(dev, i)->key = -1;
+
+	for (i = dev->internal_start_block; i <= dev->internal_end_block; i++)
+		yaffs_gc_index_update(dev, i);
+}
+
+/*
+ * Find the full block with the fewest live pages that may be collected,
+ * looking at no more than max_pages live pages and max_tries blocks.
+ * Stale entries are fixed up as they are passed over.
+ */
+static int yaffs_gc_index_find(struct yaffs_dev *dev, int max_pages,
+			       int max_tries)
+{
+	struct yaffs_block_info *bi;
+	int key;
+	int block_no;
+	int next;
+
+	if (max_pages >= dev->param.chunks_per_block)
+		max_pages = dev->param.chunks_per_block - 1;
+
+	for (key = 0; key <= max_pages && max_tries > 0; key++) {
+		for (block_no = dev->gc_heads[key];
+		     block_no >= 0 && max_tries > 0; block_no = next) {
+			next = yaffs_get_gc_link(dev, block_no)->next;
+			bi = yaffs_get_block_info(dev, block_no);
+
+			if (bi->block_state != YAFFS_BLOCK_STATE_FULL ||
+			    bi->pages_in_use - bi->soft_del_pages != key) {
+				yaffs_gc_index_update(dev, block_no);
+				continue;
+			}
+
+			max_tries--;
+			if (block_no > 0 && yaffs_block_ok_for_gc(dev, bi))
+				return block_no;
+		}
+	}
+
+	return 0;
+}
+
 static void yaffs_deinit_blocks(struct yaffs_dev *dev)
 {
 	if (dev->block_info_alt && dev->block_info)
@@ -2313,6 +2446,16 @@ static void yaffs_deinit_blocks(struct yaffs_dev *dev)
 		kfree(dev->chunk_bits);
 	dev->chunk_bits_alt = 0;
 	dev->chunk_bits = NULL;
+
+	if (dev->gc_links_alt && dev->gc_links)
+		vfree(dev->gc_links);
+	else
+		kfree(dev->gc_links);
+	dev->gc_links_alt = 0;
+	dev->gc_links = NULL;
+
+	kfree(dev->gc_heads);
+	dev->gc_heads = NULL;
 }
 
 static int yaffs_init_blocks(struct yaffs_dev *dev)
@@ -2321,6 +2464,8 @@ static int yaffs_init_blocks(struct yaffs_dev *dev)
 
 	dev->block_info = NULL;
 	dev->chunk_bits = NULL;
+	dev->gc_links = NULL;
+	dev->gc_heads = NULL;
 	dev->alloc_block = -1;	/* force it to get a new one */
 
 	/* If the first allocation strategy fails, thry the alternate one */
@@ -2351,9 +2496,25 @@ static int yaffs_init_blocks(struct yaffs_dev *dev)
 	if (!dev->chunk_bits)
 		goto alloc_error;
 
+	dev->gc_links =
+		kmalloc(n_blocks * sizeof(struct yaffs_gc_link), GFP_NOFS);
+	if (!dev->gc_links) {
+		dev->gc_links = vmalloc(n_blocks * sizeof(struct yaffs_gc_link));
+		dev->gc_links_alt = 1;
+	} else {
+		dev->gc_links_alt = 0;
+	}
+	if (!dev->gc_links)
+		goto alloc_error;
+
+	dev->gc_heads = kmalloc((dev->param.chunks_per_block + 1) *
+				sizeof(int), GFP_NOFS);
+	if (!dev->gc_heads)
+		goto alloc_error;
 
 	memset(dev->block_info, 0, n_blocks * sizeof(struct yaffs_block_info));
 	memset(dev->chunk_bits, 0, dev->chunk_bit_stride * n_blocks);
+	yaffs_gc_index_rebuild(dev);
 	return YAFFS_OK;
 
 alloc_error:
@@ -2380,6 +2541,7 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 	yaffs2_clear_oldest_dirty_seq(dev, bi);
 
 	bi->block_state = YAFFS_BLOCK_STATE_DIRTY;
+	yaffs_gc_index_update(dev, block_no);
 
 	/* If this is the block being garbage collected then stop gc'ing */
 	if (block_no == dev->gc_block)
@@ -2605,8 +2767,10 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 	/*yaffs_verify_free_chunks(dev); */
 
-	if (bi->block_state == YAFFS_BLOCK_STATE_FULL)
+	if (bi->block_state == YAFFS_BLOCK_STATE_FULL) {
 		bi->block_state = YAFFS_BLOCK_STATE_COLLECTING;
+		yaffs_gc_index_update(dev, block);
+	}
 
 	bi->has_shrink_hdr = 0;	/* clear the flag so that the block can erase */
 
@@ -2652,6 +2816,7 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 		 * because checkpointing does not restore gc.
 		 */
 		bi->block_state = YAFFS_BLOCK_STATE_FULL;
+		yaffs_gc_index_update(dev, block);
 	} else {
 		/* The gc completed. */
 		/* Do any required cleanups */
@@ -2738,10 +2903,11 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	 * block, and search harder.
 	 * else (leasurely gc), then we only bother to do this if the
 	 * block has only a few pages in use.
+	 * The gc index hands out the dirtiest blocks first, so the search
+	 * stops at the first block that may be collected.
 	 */
 
 	if (!selected) {
-		int pages_used;
 		int n_blocks =
 		    dev->internal_end_block - dev->internal_start_block + 1;
 		if (aggressive) {
@@ -2769,33 +2935,14 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 				iterations = 100;
 		}
 
-		for (i = 0;
-		     i < iterations &&
-		     (dev->gc_dirtiest < 1 ||
-		      dev->gc_pages_in_use > YAFFS_GC_GOOD_ENOUGH);
-		     i++) {
-			dev->gc_block_finder++;
-			if (dev->gc_block_finder < dev->internal_start_block ||
-			    dev->gc_block_finder > dev->internal_end_block)
-				dev->gc_block_finder =
-				    dev->internal_start_block;
-
-			bi = yaffs_get_block_info(dev, dev->gc_block_finder);
-
-			pages_used = bi->pages_in_use - bi->soft_del_pages;
-
-			if (bi->block_state == YAFFS_BLOCK_STATE_FULL &&
-			    pages_used < dev->param.chunks_per_block &&
-			    (dev->gc_dirtiest < 1 ||
-			     pages_used < dev->gc_pages_in_use) &&
-			    yaffs_block_ok_for_gc(dev, bi)) {
-				dev->gc_dirtiest = dev->gc_block_finder;
-				dev->gc_pages_in_use = pages_used;
-			}
-		}
-
-		if (dev->gc_dirtiest > 0 && dev->gc_pages_in_use <= threshold)
+		dev->gc_dirtiest = yaffs_gc_index_find(dev, threshold,
+						       iterations);
+		if (dev->gc_dirtiest > 0) {
+			bi = yaffs_get_block_info(dev, dev->gc_dirtiest);
+			dev->gc_pages_in_use =
+			    bi->pages_in_use - bi->soft_del_pages;
 			selected = dev->gc_dirtiest;
+		}
 	}
 
 	/*
@@ -2837,9 +2984,8 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	} else {
 		dev->gc_not_done++;
 		yaffs_trace(YAFFS_TRACE_GC,
-			"GC none: finder %d skip %d threshold %d dirtiest %d using %d oldest %d%s",
-			dev->gc_block_finder, dev->gc_not_done, threshold,
-			dev->gc_dirtiest, dev->gc_pages_in_use,
+			"GC none: skip %d threshold %d oldest %d%s",
+			dev->gc_not_done, threshold,
 			dev->oldest_dirty_block, background ? " bg" : "");
 	}
 
@@ -2863,9 +3009,12 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	int min_erased;
 	int erased_chunks;
 	int checkpt_block_adjust;
+	unsigned gc_control = YAFFS_GC_CONTROL_ENABLE;
+
+	if (dev->param.gc_control_fn)
+		gc_control = dev->param.gc_control_fn(dev);
 
-	if (dev->param.gc_control_fn &&
-		(dev->param.gc_control_fn(dev) & 1) == 0)
+	if ((gc_control & YAFFS_GC_CONTROL_ENABLE) == 0)
 		return YAFFS_OK;
 
 	if (dev->gc_disable)
@@ -2890,6 +3039,18 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 		if (dev->n_erased_blocks < min_erased)
 			aggressive = 1;
 		else {
+			/* Leave passive gc to the background thread unless
+			 * it is falling well behind.
+			 */
+			if (!background &&
+			    (gc_control & YAFFS_GC_CONTROL_BACKGROUND) &&
+			    erased_chunks > (dev->n_free_chunks / 8)) {
+				if (dev->param.gc_wake_fn &&
+				    erased_chunks < (dev->n_free_chunks / 2))
+					dev->param.gc_wake_fn(dev);
+				break;
+			}
+
 			if (!background
 			    && erased_chunks > (dev->n_free_chunks / 4))
 				break;
@@ -2950,15 +3111,22 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 /*
  * yaffs_bg_gc()
  * Garbage collects. Intended to be called from a background thread.
+ * Each pass copies a few chunks, higher urgency runs more passes.
  * Returns non-zero if at least half the free chunks are erased.
  */
 int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency)
 {
-	int erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
+	int erased_chunks;
+	int passes = 1 << (urgency > 2 ? 2 : urgency);
 
 	yaffs_trace(YAFFS_TRACE_BACKGROUND, "Background gc %u", urgency);
 
-	yaffs_check_gc(dev, 1);
+	do {
+		yaffs_check_gc(dev, 1);
+		erased_chunks =
+		    dev->n_erased_blocks * dev->param.chunks_per_block;
+	} while (--passes > 0 && erased_chunks <= dev->n_free_chunks / 2);
+
 	return erased_chunks > dev->n_free_chunks / 2;
 }
 
@@ -3030,6 +3198,7 @@ void yaffs_chunk_del(struct yaffs_dev *dev, int chunk_id, int mark_flash,
 		dev->n_free_chunks++;
 		yaffs_clear_chunk_bit(dev, block, page);
 		bi->pages_in_use--;
+		yaffs_gc_index_update(dev, block);
 
 		if (bi->pages_in_use == 0 &&
 		    !bi->has_shrink_hdr &&
@@ -3446,8 +3615,7 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 				if (!cache) {
 					cache =
 					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
+					yaffs_attach_cache(cache, in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_rd_data_obj(in, chunk,
@@ -3572,8 +3740,7 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 *buffer, loff_t offset,
 				if (!cache &&
 				    yaffs_check_alloc_available(dev, 1)) {
 					cache = yaffs_grab_chunk_cache(dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
+					yaffs_attach_cache(cache, in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_rd_data_obj(in, chunk,
@@ -4841,7 +5008,6 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
-	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
 	dev->n_deleted_files = 0;
@@ -4865,35 +5031,53 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		init_failed = 1;
 
 	dev->cache = NULL;
+	dev->cache_bucket = NULL;
 	dev->gc_cleanup_list = NULL;
+	INIT_LIST_HEAD(&dev->cache_lru);
+	INIT_LIST_HEAD(&dev->cache_free);
 
 	if (!init_failed && dev->param.n_caches > 0) {
 		int i;
 		void *buf;
-		int cache_bytes =
-		    dev->param.n_caches * sizeof(struct yaffs_cache);
+		int cache_bytes;
+		u32 n_buckets = 1;
 
 		if (dev->param.n_caches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.n_caches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		cache_bytes = dev->param.n_caches * sizeof(struct yaffs_cache);
+
+		/* About one chunk per bucket */
+		while (n_buckets < dev->param.n_caches)
+			n_buckets <<= 1;
+
 		dev->cache = kmalloc(cache_bytes, GFP_NOFS);
+		dev->cache_bucket = kmalloc(n_buckets *
+					    sizeof(struct list_head), GFP_NOFS);
+		dev->cache_bucket_mask = n_buckets - 1;
 
 		buf = (u8 *) dev->cache;
+		if (!dev->cache_bucket)
+			buf = NULL;
 
 		if (dev->cache)
 			memset(dev->cache, 0, cache_bytes);
 
+		for (i = 0; i < n_buckets && buf; i++)
+			INIT_LIST_HEAD(&dev->cache_bucket[i]);
+
 		for (i = 0; i < dev->param.n_caches && buf; i++) {
 			dev->cache[i].object = NULL;
-			dev->cache[i].last_use = 0;
 			dev->cache[i].dirty = 0;
+			INIT_LIST_HEAD(&dev->cache[i].hash_link);
+			INIT_LIST_HEAD(&dev->cache[i].obj_link);
+			list_add_tail(&dev->cache[i].lru_link,
+				      &dev->cache_free);
 			dev->cache[i].data = buf =
 			    kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->cache_last_use = 0;
 	}
 
 	dev->cache_hits = 0;
@@ -4968,6 +5152,8 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		yaffs_fix_hanging_objs(dev);
 		if (dev->param.empty_lost_n_found)
 			yaffs_empty_l_n_f(dev);
+
+		yaffs_gc_index_rebuild(dev);
 	}
 
 	if (init_failed) {
@@ -5020,6 +5206,9 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 			dev->cache = NULL;
 		}
 
+		kfree(dev->cache_bucket);
+		dev->cache_bucket = NULL;
+
 		kfree(dev->gc_cleanup_list);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
@@ -68,8 +68,6 @@
 
 
 
-#define YAFFS_ALLOCATION_NOBJECTS	100
-#define YAFFS_ALLOCATION_NTNODES	100
 #define YAFFS_ALLOCATION_NLINKS		100
 
 #define YAFFS_NOBJECT_BUCKETS		256
@@ -104,7 +102,7 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA	0x21
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	512
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -129,9 +127,11 @@
 
 /* ChunkCache is used for short read/write operations.*/
 struct yaffs_cache {
+	struct list_head hash_link;	/* dev->cache_bucket[] chain */
+	struct list_head lru_link;	/* dev->cache_lru or dev->cache_free */
+	struct list_head obj_link;	/* object->cached_chunks */
 	struct yaffs_obj *object;
 	int chunk_id;
-	int last_use;
 	int dirty;
 	int n_bytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -306,6 +306,20 @@ struct yaffs_block_info {
 
 };
 
+/* Full blocks are kept on lists by how many pages they still have in use so
+ * that gc can find the dirtiest without scanning the block array.
+ * Block numbers are used as links, -1 ends a list.
+ */
+struct yaffs_gc_link {
+	int next;
+	int prev;
+	int key;	/* List this block is on, -1 if none */
+};
+
+/* Bits returned by gc_control_fn */
+#define YAFFS_GC_CONTROL_ENABLE		1
+#define YAFFS_GC_CONTROL_BACKGROUND	2
+
 /* -------------------------- Object structure -------------------------------*/
 /* This is the object structure as stored on NAND */
 
@@ -438,6 +452,8 @@ struct yaffs_obj {
 
 	struct list_head hard_links;	/* hard linked object chain*/
 
+	struct list_head cached_chunks;	/* short op caches holding our data */
+
 	/* directory structure stuff */
 	/* also used for linking up the free list */
 	struct yaffs_obj *parent;
@@ -573,9 +589,15 @@ struct yaffs_param {
 	/* Callback to mark the superblock dirty */
 	void (*sb_dirty_fn) (struct yaffs_dev *dev);
 
-	/*  Callback to control garbage collection. */
+	/*  Callback to control garbage collection.
+	 * Bit 0 enables gc. Bit 1 says a background thread is doing passive
+	 * gc, so foreground writes only collect when space is short.
+	 */
 	unsigned (*gc_control_fn) (struct yaffs_dev *dev);
 
+	/* Callback to ask the background thread for gc before it is due */
+	void (*gc_wake_fn) (struct yaffs_dev *dev);
+
 	/* Debug control flags. Don't use unless you know what you're doing */
 	int use_header_file_size;	/* Flag to determine if we should use
 					 * file sizes from the header */
@@ -718,7 +740,9 @@ struct yaffs_dev {
 	unsigned has_pending_prioritised_gc;	/* We think this device might
 						have pending prioritised gcs */
 	unsigned gc_disable;
-	unsigned gc_block_finder;
+	struct yaffs_gc_link *gc_links;	/* Index of full blocks, per block */
+	int gc_links_alt;	/* Was allocated using alternative strategy */
+	int *gc_heads;		/* List heads, by pages in use */
 	unsigned gc_dirtiest;
 	unsigned gc_pages_in_use;
 	unsigned gc_not_done;
@@ -735,7 +759,10 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
-	int cache_last_use;
+	struct list_head *cache_bucket;	/* hashed on (object, chunk_id) */
+	u32 cache_bucket_mask;
+	struct list_head cache_lru;	/* caches in use, most recent first */
+	struct list_head cache_free;	/* caches not holding a chunk */
 
 	/* Stuff for background deletion and unlinked files. */
 	struct yaffs_obj *unlinked_dir;	/* Directory where unlinked and deleted
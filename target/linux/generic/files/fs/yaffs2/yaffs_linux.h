@@ -24,6 +24,12 @@ struct yaffs_linux_context {
 	struct super_block *super;
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
+	int bg_kick;		/* Foreground wants gc before it is due */
+	unsigned long bg_rate_stamp;	/* When bg_writes was sampled */
+	u32 bg_writes;		/* Chunks written, less gc copies, at stamp */
+	unsigned bg_write_rate;	/* Chunks written per second, smoothed */
+	unsigned long bg_last_write;	/* When writes were last seen */
+	u32 bg_checkpt_writes;	/* bg_writes at the last idle checkpoint */
 	struct mutex gross_lock;	/* Gross locking mutex*/
 	u8 *spare_buffer;	/* For mtdif2 use. Don't know the buffer size
 				 * at compile time so we have to allocate it.
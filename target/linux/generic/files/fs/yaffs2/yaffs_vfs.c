@@ -178,6 +178,8 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 #include "yaffs_mtdif.h"
 #include "yaffs_packedtags2.h"
 #include "yaffs_getblockinfo.h"
+#include "yaffs_allocator.h"
+#include "yaffs_ecc.h"
 
 unsigned int yaffs_trace_mask =
 		YAFFS_TRACE_BAD_BLOCKS |
@@ -189,6 +191,7 @@ unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
 unsigned int yaffs_auto_select = 1;
+unsigned int yaffs_idle_checkpoint = 10;	/* seconds, 0 to disable */
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_trace_mask, uint, 0644);
@@ -196,6 +199,7 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_idle_checkpoint, uint, 0644);
 #else
 MODULE_PARM(yaffs_trace_mask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
@@ -2016,12 +2020,17 @@ static void yaffs_fill_inode_from_obj(struct inode *inode,
  * The thread should not do any writing while the fs is in read only.
  */
 
+/*
+ * Urgency also weighs the erased space against the recent write rate, so a
+ * busy device is collected before the foreground has to do it.
+ */
 static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
 {
 	unsigned erased_chunks =
 	    dev->n_erased_blocks * dev->param.chunks_per_block;
 	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
 	unsigned scattered = 0;	/* Free chunks not in an erased block */
+	unsigned rate = context->bg_write_rate;
 
 	if (erased_chunks < dev->n_free_chunks)
 		scattered = (dev->n_free_chunks - erased_chunks);
@@ -2030,16 +2039,84 @@ static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
 		return 0;
 	else if (scattered < (dev->param.chunks_per_block * 2))
 		return 0;
-	else if (erased_chunks > dev->n_free_chunks / 2)
+	else if (erased_chunks > dev->n_free_chunks / 2 &&
+		 erased_chunks > rate * 4)
 		return 0;
-	else if (erased_chunks > dev->n_free_chunks / 4)
+	else if (erased_chunks > dev->n_free_chunks / 4 &&
+		 erased_chunks > rate)
 		return 1;
 	else
 		return 2;
 }
 
+/* Called from the foreground when it skipped passive gc */
+static void yaffs_gc_wake_callback(struct yaffs_dev *dev)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+
+	if (context->bg_thread && !context->bg_kick &&
+	    yaffs_bg_gc_urgency(dev) > 0) {
+		context->bg_kick = 1;
+		wake_up_process(context->bg_thread);
+	}
+}
+
 #ifdef YAFFS_COMPILE_BACKGROUND
 
+/* Sample the write rate, ignoring gc's own copies */
+static void yaffs_bg_update_write_rate(struct yaffs_dev *dev,
+				       unsigned long now)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+	unsigned long elapsed = now - context->bg_rate_stamp;
+	u32 writes = dev->n_page_writes - dev->n_gc_copies;
+	u32 delta;
+
+	if (elapsed < HZ / 4 + 1)
+		return;
+
+	delta = writes - context->bg_writes;
+	if (delta > 0)
+		context->bg_last_write = now;
+	if (delta > (1 << 20))
+		delta = 1 << 20;
+
+	context->bg_write_rate =
+	    (context->bg_write_rate * 3 + delta * HZ / elapsed) / 4;
+	context->bg_writes = writes;
+	context->bg_rate_stamp = now;
+}
+
+static void yaffs_flush_super(struct super_block *sb, int do_checkpoint);
+
+/*
+ * Write a checkpoint once the device has been quiet for a while, so that a
+ * mount after power loss can restore it instead of scanning. Only one
+ * attempt is made per burst of writes.
+ */
+static void yaffs_bg_idle_checkpoint(struct yaffs_dev *dev,
+				     unsigned long now)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+
+	if (!yaffs_idle_checkpoint ||
+	    dev->is_checkpointed ||
+	    dev->param.skip_checkpt_wr ||
+	    !context->super ||
+	    context->bg_checkpt_writes == context->bg_writes ||
+	    !time_after(now, context->bg_last_write +
+			yaffs_idle_checkpoint * HZ) ||
+	    yaffs_bg_gc_urgency(dev) > 0)
+		return;
+
+	yaffs_trace(YAFFS_TRACE_BACKGROUND | YAFFS_TRACE_CHECKPOINT,
+		"yaffs_background idle checkpoint");
+
+	context->bg_checkpt_writes = context->bg_writes;
+	yaffs_flush_super(context->super, 1);
+	yaffs_clear_super_dirty(dev);
+}
+
 void yaffs_background_waker(unsigned long data)
 {
 	wake_up_process((struct task_struct *)data);
@@ -2061,6 +2138,14 @@ static int yaffs_bg_thread_fn(void *data)
 	yaffs_trace(YAFFS_TRACE_BACKGROUND,
 		"yaffs_background starting for dev %p", (void *)dev);
 
+	context->bg_kick = 0;
+	context->bg_rate_stamp = now;
+	context->bg_writes = dev->n_page_writes - dev->n_gc_copies;
+	context->bg_write_rate = 0;
+	context->bg_last_write = now;
+	/* Differ so that a mount which had to scan gets a checkpoint */
+	context->bg_checkpt_writes = context->bg_writes - 1;
+
 #ifdef YAFFS_COMPILE_FREEZER
 	set_freezable();
 #endif
@@ -2077,13 +2162,16 @@ static int yaffs_bg_thread_fn(void *data)
 		yaffs_gross_lock(dev);
 
 		now = jiffies;
+		yaffs_bg_update_write_rate(dev, now);
 
 		if (time_after(now, next_dir_update) && yaffs_bg_enable) {
 			yaffs_update_dirty_dirs(dev);
 			next_dir_update = now + HZ;
 		}
 
-		if (time_after(now, next_gc) && yaffs_bg_enable) {
+		if ((context->bg_kick || time_after(now, next_gc)) &&
+		    yaffs_bg_enable) {
+			context->bg_kick = 0;
 			if (!dev->is_checkpointed) {
 				urgency = yaffs_bg_gc_urgency(dev);
 				gc_result = yaffs_bg_gc(dev, urgency);
@@ -2101,6 +2189,9 @@ static int yaffs_bg_thread_fn(void *data)
 				next_gc = next_dir_update;
                         }
 		}
+
+		if (yaffs_bg_enable)
+			yaffs_bg_idle_checkpoint(dev, now);
 		yaffs_gross_unlock(dev);
 #if 1
 		expires = next_dir_update;
@@ -2116,7 +2207,10 @@ static int yaffs_bg_thread_fn(void *data)
 
 		set_current_state(TASK_INTERRUPTIBLE);
 		add_timer(&timer);
-		schedule();
+		if (context->bg_kick)
+			__set_current_state(TASK_RUNNING);
+		else
+			schedule();
 		del_timer_sync(&timer);
 #else
 		msleep(10);
@@ -2250,7 +2344,12 @@ static void yaffs_put_super(struct super_block *sb)
 
 static unsigned yaffs_gc_control_callback(struct yaffs_dev *dev)
 {
-	return yaffs_gc_control;
+	unsigned control = yaffs_gc_control;
+
+	if (yaffs_bg_enable && yaffs_dev_to_lc(dev)->bg_thread)
+		control |= YAFFS_GC_CONTROL_BACKGROUND;
+
+	return control;
 }
 
 
@@ -2608,6 +2707,7 @@ struct yaffs_options {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int n_caches;
 	int tags_ecc_on;
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
@@ -2666,6 +2766,11 @@ static int yaffs_parse_options(struct yaffs_options *options,
 			options->empty_lost_and_found_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-cache")) {
 			options->no_cache = 1;
+		} else if (!strncmp(cur_opt, "caches=", 7)) {
+			options->n_caches =
+			    simple_strtol(cur_opt + 7, NULL, 10);
+			if (options->n_caches < 1)
+				error = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-read")) {
 			options->skip_checkpoint_read = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-write")) {
@@ -2856,7 +2961,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 
 
 	param->n_reserved_blocks = 5;
-	param->n_caches = (options.no_cache) ? 0 : 10;
+	param->n_caches = (options.no_cache) ? 0 :
+			  (options.n_caches) ? options.n_caches : 10;
 	param->inband_tags = inband_tags;
 
 	param->enable_xattr = 1;
@@ -2909,6 +3015,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 
 	param->sb_dirty_fn = yaffs_set_super_dirty;
 	param->gc_control_fn = yaffs_gc_control_callback;
+	param->gc_wake_fn = yaffs_gc_wake_callback;
 
 	yaffs_dev_to_lc(dev)->super = sb;
 
@@ -3143,6 +3250,10 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 
 static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 {
+	struct yaffs_alloc_stats as;
+
+	yaffs_alloc_stats(dev, &as);
+
 	buf += sprintf(buf, "max file size....... %lld\n",
 				(long long) yaffs_max_file_size(dev));
 	buf += sprintf(buf, "data_bytes_per_chunk. %d\n",
@@ -3155,6 +3266,12 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes............. %d\n", dev->n_tnodes);
 	buf += sprintf(buf, "n_obj................ %d\n", dev->n_obj);
+	buf += sprintf(buf, "n_tnodes_created..... %d\n", as.n_tnodes_created);
+	buf += sprintf(buf, "n_free_tnodes........ %d\n", as.n_free_tnodes);
+	buf += sprintf(buf, "n_obj_created........ %d\n", as.n_obj_created);
+	buf += sprintf(buf, "n_free_objects....... %d\n", as.n_free_objects);
+	buf += sprintf(buf, "alloc_kbytes......... %lu\n",
+				(unsigned long)as.n_pages * PAGE_SIZE / 1024);
 	buf += sprintf(buf, "n_free_chunks........ %d\n", dev->n_free_chunks);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_page_writes........ %u\n", dev->n_page_writes);
@@ -3566,6 +3683,10 @@ static int __init init_yaffs_fs(void)
 
 	mutex_init(&yaffs_context_lock);
 
+#ifdef CONFIG_YAFFS_ECC_SELFTEST
+	yaffs_ecc_selftest();
+#endif
+
 	error = yaffs_procfs_init();
 	if (error)
 		return error;
@@ -29,6 +29,9 @@ struct switch_led_trigger;
 int register_switch(struct switch_dev *dev, struct net_device *netdev);
 void unregister_switch(struct switch_dev *dev);
 
+/* port_link has a bit set for every port with link, may be called in irq context */
+void swconfig_link_changed(struct switch_dev *dev, u32 port_link);
+
 /**
  * struct switch_attrlist - attribute list
  *
@@ -53,9 +53,21 @@ enum {
 	SWITCH_ATTR_OP_DESCRIPTION,
 	/* port lists */
 	SWITCH_ATTR_PORT,
+	/* batched requests */
+	SWITCH_ATTR_OP_LIST,
+	SWITCH_ATTR_OP,
+	SWITCH_ATTR_OP_GROUP,
+	SWITCH_ATTR_OP_ERROR,
 	SWITCH_ATTR_MAX
 };
 
+/* attribute groups, used in batched requests */
+enum {
+	SWITCH_GROUP_GLOBAL,
+	SWITCH_GROUP_VLAN,
+	SWITCH_GROUP_PORT,
+};
+
 enum {
 	/* port map */
 	SWITCH_PORTMAP_PORTS,
@@ -77,9 +89,16 @@ enum {
 	SWITCH_CMD_SET_PORT,
 	SWITCH_CMD_LIST_VLAN,
 	SWITCH_CMD_GET_VLAN,
-	SWITCH_CMD_SET_VLAN
+	SWITCH_CMD_SET_VLAN,
+	SWITCH_CMD_SET_BATCH,
+	SWITCH_CMD_GET_BATCH,
+	SWITCH_CMD_DUMP_VALUES
 };
 
+/* family versions from which the commands above are available */
+#define SWITCH_BATCH_VERSION	2	/* SWITCH_CMD_{SET,GET}_BATCH */
+#define SWITCH_DUMP_VERSION	3	/* SWITCH_CMD_DUMP_VALUES */
+
 /* data types */
 enum switch_val_type {
 	SWITCH_TYPE_UNSPEC,
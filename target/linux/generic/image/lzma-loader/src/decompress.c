@@ -103,9 +103,9 @@ static char *buffer = (char *)(RAMSTART + RAMSIZE - 0x00020000);
 extern char lzma_start[];
 extern char lzma_end[];
 
-/* should be the first function */
-void entry(unsigned long icache_size, unsigned long icache_lsize, 
-	unsigned long dcache_size, unsigned long dcache_lsize)
+/* should be the first function, start.S passes line sizes first */
+void entry(unsigned long icache_lsize, unsigned long icache_size,
+	unsigned long dcache_lsize, unsigned long dcache_size)
 {
 	unsigned int i;  /* temp value */
 	unsigned int osize; /* uncompressed size */
@@ -26,6 +26,7 @@
 #include <linux/phy.h>
 #include <linux/clk.h>
 #include <linux/dma-mapping.h>
+#include <linux/log2.h>
 
 #include <asm/unaligned.h>
 #include <asm/sizes.h>
@@ -102,6 +103,7 @@
 #define RX_SKB_TAILROOM		128
 #define RX_SKB_HEADROOM		(RX_ALLOC_SIZE  - \
 				(MAX_ETH_FRAME_SIZE + RX_SKB_TAILROOM) + 0)
+#define RX_DMA_SIZE		(MAX_ETH_FRAME_SIZE + RX_SKB_TAILROOM)
 
 			/* WDT     Late COL    Lenght     COL      Type */
 #define ERROR_FILTER_MASK ((1<<14) | (1<<15) | (1<<16) | (1<<17) | (0<<18) | \
@@ -109,8 +111,17 @@
 			(1<<19) | (1<<20) | (1<<21) | (0<<24) | (1<<25) | \
 			/* Unsup   Missed */\
 			(1<<26) | (0<<31))
-#define  TX_RING_SIZE  30
-#define  RX_RING_SIZE  30
+#define  TX_RING_SIZE_DEF	64
+#define  TX_RING_SIZE_MIN	8
+#define  TX_RING_SIZE_MAX	512
+#define  RX_RING_SIZE_DEF	128
+#define  RX_RING_SIZE_MIN	16
+#define  RX_RING_SIZE_MAX	512
+#define  RX_COPYBREAK_DEF	256
+
+static int rx_copybreak = RX_COPYBREAK_DEF;
+module_param(rx_copybreak, int, 0644);
+MODULE_PARM_DESC(rx_copybreak, "Copy received frames below this size");
 
 static inline u32 nuport_mac_readl(void __iomem *reg)
 {
@@ -132,6 +143,16 @@ static inline void nuport_mac_writeb(u8 value, void __iomem *reg)
 	writel_relaxed(value, reg);
 }
 
+/* The DMA engines take one buffer at a time, the rings are kept by the
+ * driver only.
+ */
+struct nuport_mac_buf {
+	struct sk_buff	*skb;
+	dma_addr_t	addr;
+	unsigned int	len;
+	unsigned int	dma_owned;	/* RX: free for the DMA engine */
+};
+
 /* MAC private data */
 struct nuport_mac_priv {
 	spinlock_t lock;
@@ -145,19 +166,18 @@ struct nuport_mac_priv {
 	struct clk	*emac_clk;
 	struct clk	*ephy_clk;
 
-	/* Transmit buffers */
-	struct sk_buff *tx_skb[TX_RING_SIZE];
-	dma_addr_t tx_addr;
-	unsigned int valid_txskb[TX_RING_SIZE];
+	/* Transmit buffers, queued at cur_tx, sent up to dma_tx and
+	 * released up to dirty_tx; the indexes run free
+	 */
+	struct nuport_mac_buf *tx_buf;
+	unsigned int tx_ring_size;
 	unsigned int cur_tx;
 	unsigned int dma_tx;
-	unsigned int tx_full;
+	unsigned int dirty_tx;
 
-	/* Receive buffers */
-	struct sk_buff *rx_skb[RX_RING_SIZE];
-	dma_addr_t rx_addr;
-	unsigned int irq_rxskb[RX_RING_SIZE];
-	int pkt_len[RX_RING_SIZE];
+	/* Receive buffers, filled up to dma_rx and processed up to cur_rx */
+	struct nuport_mac_buf *rx_buf;
+	unsigned int rx_ring_size;
 	unsigned int cur_rx;
 	unsigned int dma_rx;
 	unsigned int rx_full;
@@ -241,7 +261,7 @@ static int nuport_mac_mii_reset(struct mii_bus *bus)
 }
 
 static int nuport_mac_start_tx_dma(struct nuport_mac_priv *priv,
-					struct sk_buff *skb)
+					struct nuport_mac_buf *buf)
 {
 	u32 reg;
 	unsigned int timeout = 2048;
@@ -258,15 +278,10 @@ static int nuport_mac_start_tx_dma(struct nuport_mac_priv *priv,
 	if (!timeout)
 		return -EBUSY;
 
-	priv->tx_addr = dma_map_single(&priv->pdev->dev, skb->data,
-			skb->len, DMA_TO_DEVICE);
-	if (dma_mapping_error(&priv->pdev->dev, priv->tx_addr))
-		return -ENOMEM;
-
 	/* enable enhanced mode */
 	nuport_mac_writel(TX_DMA_ENH_ENABLE, TX_DMA_ENH);
-	nuport_mac_writel(priv->tx_addr, TX_BUFFER_ADDR);
-	nuport_mac_writel((skb->len) - 1, TX_PKT_BYTES);
+	nuport_mac_writel(buf->addr, TX_BUFFER_ADDR);
+	nuport_mac_writel(buf->len - 1, TX_PKT_BYTES);
 	wmb();
 	reg = TX_DMA_ENABLE | TX_DMA_START_FRAME | TX_DMA_END_FRAME;
 	nuport_mac_writel(reg, TX_START_DMA);
@@ -284,7 +299,7 @@ static void nuport_mac_reset_tx_dma(struct nuport_mac_priv *priv)
 }
 
 static int nuport_mac_start_rx_dma(struct nuport_mac_priv *priv,
-					struct sk_buff *skb)
+					struct nuport_mac_buf *buf)
 {
 	u32 reg;
 	unsigned int timeout = 2048;
@@ -301,12 +316,7 @@ static int nuport_mac_start_rx_dma(struct nuport_mac_priv *priv,
 	if (!timeout)
 		return -EBUSY;
 
-	priv->rx_addr = dma_map_single(&priv->pdev->dev, skb->data,
-				RX_ALLOC_SIZE, DMA_FROM_DEVICE);
-	if (dma_mapping_error(&priv->pdev->dev, priv->rx_addr))
-		return -ENOMEM;
-
-	nuport_mac_writel(priv->rx_addr, RX_BUFFER_ADDR);
+	nuport_mac_writel(buf->addr, RX_BUFFER_ADDR);
 	wmb();
 	nuport_mac_writel(RX_DMA_ENABLE, RX_START_DMA);
 
@@ -322,16 +332,6 @@ static void nuport_mac_reset_rx_dma(struct nuport_mac_priv *priv)
 	nuport_mac_writel(reg, RX_START_DMA);
 }
 
-/* I suppose this might do something, but I am not sure actually */
-static void nuport_mac_disable_rx_dma(struct nuport_mac_priv *priv)
-{
-	u32 reg;
-
-	reg = nuport_mac_readl(RX_DMA_ENH);
-	reg &= ~RX_DMA_INT_ENABLE;
-	nuport_mac_writel(reg, RX_DMA_ENH);
-}
-
 static void nuport_mac_enable_rx_dma(struct nuport_mac_priv *priv)
 {
 	u32 reg;
@@ -346,43 +346,49 @@ static int nuport_mac_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	unsigned long flags;
 	struct nuport_mac_priv *priv = netdev_priv(dev);
+	struct nuport_mac_buf *buf;
+	dma_addr_t addr;
 	int ret;
 
-	if (netif_queue_stopped(dev)) {
-		netdev_warn(dev, "netif queue was stopped, restarting\n");
-		netif_start_queue(dev);
+	addr = dma_map_single(&priv->pdev->dev, skb->data, skb->len,
+				DMA_TO_DEVICE);
+	if (dma_mapping_error(&priv->pdev->dev, addr)) {
+		dev->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
 	}
 
 	spin_lock_irqsave(&priv->lock, flags);
+	buf = &priv->tx_buf[priv->cur_tx & (priv->tx_ring_size - 1)];
+	buf->skb = skb;
+	buf->addr = addr;
+	buf->len = skb->len;
+
 	if (priv->first_pkt) {
-		ret = nuport_mac_start_tx_dma(priv, skb);
+		ret = nuport_mac_start_tx_dma(priv, buf);
 		if (ret) {
+			buf->skb = NULL;
 			netif_stop_queue(dev);
 			spin_unlock_irqrestore(&priv->lock, flags);
+			dma_unmap_single(&priv->pdev->dev, addr, skb->len,
+					DMA_TO_DEVICE);
 			netdev_err(dev, "transmit path busy\n");
 			return NETDEV_TX_BUSY;
 		}
 		priv->first_pkt = 0;
 	}
 
-	priv->tx_skb[priv->cur_tx] = skb;
+	priv->cur_tx++;
 	dev->stats.tx_bytes += skb->len;
 	dev->stats.tx_packets++;
-	priv->valid_txskb[priv->cur_tx] = 1;
-	priv->cur_tx++;
 	dev->trans_start = jiffies;
 
-	if (priv->cur_tx >= TX_RING_SIZE)
-		priv->cur_tx = 0;
+	/* woken up again by nuport_mac_tx_reclaim() */
+	if (priv->cur_tx - priv->dirty_tx >= priv->tx_ring_size)
+		netif_stop_queue(dev);
 
 	spin_unlock_irqrestore(&priv->lock, flags);
 
-	if (priv->valid_txskb[priv->cur_tx]) {
-		priv->tx_full = 1;
-		netdev_err(dev, "stopping queue\n");
-		netif_stop_queue(dev);
-	}
-
 	return NETDEV_TX_OK;
 }
 
@@ -451,11 +457,13 @@ out:
 	return ret;
 }
 
+/* The DMA engine sends one frame at a time: the interrupt only starts the
+ * next one, the sent buffers are released from the NAPI poll.
+ */
 static irqreturn_t nuport_mac_tx_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = (struct net_device *)dev_id;
 	struct nuport_mac_priv *priv = netdev_priv(dev);
-	struct sk_buff *skb;
 	unsigned long flags;
 	int ret;
 	u32 reg;
@@ -472,166 +480,250 @@ static irqreturn_t nuport_mac_tx_interrupt(int irq, void *dev_id)
 	} else
 		netdev_dbg(dev, "no status word: %08x\n", reg);
 
-	skb = priv->tx_skb[priv->dma_tx];
-	priv->tx_skb[priv->dma_tx] = NULL;
-	priv->valid_txskb[priv->dma_tx] = 0;
-	dma_unmap_single(&priv->pdev->dev, priv->rx_addr, skb->len,
-				DMA_TO_DEVICE);
-	dev_kfree_skb_irq(skb);
-
-	priv->dma_tx++;
-	if (priv->dma_tx >= TX_RING_SIZE)
-		priv->dma_tx = 0;
+	if (priv->dma_tx != priv->cur_tx)
+		priv->dma_tx++;
 
-	if (!priv->valid_txskb[priv->dma_tx])
+	if (priv->dma_tx == priv->cur_tx)
 		priv->first_pkt = 1;
 	else {
-		ret = nuport_mac_start_tx_dma(priv, priv->tx_skb[priv->dma_tx]);
+		ret = nuport_mac_start_tx_dma(priv,
+			&priv->tx_buf[priv->dma_tx & (priv->tx_ring_size - 1)]);
 		if (ret)
 			netdev_err(dev, "failed to restart TX dma\n");
 	}
 
-	if (priv->tx_full) {
-		netdev_dbg(dev, "restarting transmit queue\n");
-		netif_wake_queue(dev);
-		priv->tx_full = 0;
-	}
-
 	spin_unlock_irqrestore(&priv->lock, flags);
 
+	napi_schedule(&priv->napi);
+
 	return IRQ_HANDLED;
 }
 
-static unsigned int nuport_mac_has_work(struct nuport_mac_priv *priv)
+/* Hand the next free RX buffer to the DMA engine, or note that the ring is
+ * full; called with priv->lock held.
+ */
+static void nuport_mac_rx_refill_dma(struct nuport_mac_priv *priv)
 {
-	unsigned int i;
-
-	for (i = 0; i < RX_RING_SIZE; i++)
-		if (priv->rx_skb[i])
-			return 1;
+	struct nuport_mac_buf *buf;
+	int ret;
 
-	return 0;
+	buf = &priv->rx_buf[priv->dma_rx & (priv->rx_ring_size - 1)];
+	if (buf->dma_owned) {
+		smp_rmb();
+		ret = nuport_mac_start_rx_dma(priv, buf);
+		if (ret)
+			netdev_err(priv->dev, "failed to start rx dma\n");
+		priv->rx_full = 0;
+	} else {
+		priv->rx_full = 1;
+		netdev_dbg(priv->dev, "RX ring full\n");
+	}
 }
 
 static irqreturn_t nuport_mac_rx_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = (struct net_device *)dev_id;
 	struct nuport_mac_priv *priv = netdev_priv(dev);
+	struct nuport_mac_buf *buf;
 	unsigned long flags;
-	int ret;
 
 	spin_lock_irqsave(&priv->lock, flags);
 	if (!priv->rx_full) {
-		priv->pkt_len[priv->dma_rx] = nuport_mac_readl(RX_ACT_BYTES) - 4;
-		priv->irq_rxskb[priv->dma_rx] = 0;
+		buf = &priv->rx_buf[priv->dma_rx & (priv->rx_ring_size - 1)];
+		buf->len = nuport_mac_readl(RX_ACT_BYTES) - 4;
+		buf->dma_owned = 0;
 		priv->dma_rx++;
+	}
 
-		if (priv->dma_rx >= RX_RING_SIZE)
-			priv->dma_rx = 0;
-	} else
-		priv->rx_full = 0;
+	nuport_mac_rx_refill_dma(priv);
+	spin_unlock_irqrestore(&priv->lock, flags);
 
-	if (priv->irq_rxskb[priv->dma_rx] == 1) {
-		ret = nuport_mac_start_rx_dma(priv, priv->rx_skb[priv->dma_rx]);
-		if (ret)
-			netdev_err(dev, "failed to start rx dma\n");
-	} else {
-		priv->rx_full = 1;
-		netdev_dbg(dev, "RX ring full\n");
+	napi_schedule(&priv->napi);
+
+	return IRQ_HANDLED;
+}
+
+/* Release the buffers the DMA engine has sent */
+static void nuport_mac_tx_reclaim(struct net_device *dev)
+{
+	struct nuport_mac_priv *priv = netdev_priv(dev);
+	struct nuport_mac_buf *buf;
+	unsigned int dirty, done;
+
+	spin_lock_irq(&priv->lock);
+	dirty = priv->dirty_tx;
+	done = priv->dma_tx;
+	spin_unlock_irq(&priv->lock);
+
+	if (dirty == done)
+		return;
+
+	while (dirty != done) {
+		buf = &priv->tx_buf[dirty & (priv->tx_ring_size - 1)];
+		dma_unmap_single(&priv->pdev->dev, buf->addr, buf->len,
+				DMA_TO_DEVICE);
+		dev_kfree_skb(buf->skb);
+		buf->skb = NULL;
+		dirty++;
 	}
 
-	if (likely(nuport_mac_has_work(priv))) {
-		/* find a way to disable DMA rx irq */
-		nuport_mac_disable_rx_dma(priv);
-		napi_schedule(&priv->napi);
+	spin_lock_irq(&priv->lock);
+	priv->dirty_tx = dirty;
+	if (netif_queue_stopped(dev) &&
+	    priv->cur_tx - priv->dirty_tx < priv->tx_ring_size) {
+		netdev_dbg(dev, "restarting transmit queue\n");
+		netif_wake_queue(dev);
 	}
-	spin_unlock_irqrestore(&priv->lock, flags);
+	spin_unlock_irq(&priv->lock);
+}
 
-	return IRQ_HANDLED;
+static void nuport_mac_rx_skb(struct net_device *dev, struct sk_buff *skb,
+				u32 status, int len)
+{
+	skb->protocol = eth_type_trans(skb, dev);
+	dev->stats.rx_packets++;
+
+	if (status & (1 << 29))
+		skb->pkt_type = PACKET_OTHERHOST;
+	if (status & (1 << 27))
+		skb->pkt_type = PACKET_MULTICAST;
+	if (status & (1 << 28))
+		skb->pkt_type = PACKET_BROADCAST;
+
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+	/* Pass the received packet to network layer */
+	if (netif_receive_skb(skb) != NET_RX_DROP)
+		dev->stats.rx_bytes += len - 4;	/* Without CRC */
+	else
+		dev->stats.rx_dropped++;
+
+	dev->last_rx = jiffies;
 }
 
-/* Process received packets in tasklet */
+/* Process received packets from the NAPI poll. The buffers go back to the
+ * DMA engine without taking the lock: a frame below rx_copybreak is copied
+ * out and its buffer reused, as is the buffer of a dropped frame.
+ */
 static int nuport_mac_rx(struct net_device *dev, int limit)
 {
 	struct nuport_mac_priv *priv = netdev_priv(dev);
-	struct sk_buff *skb;
-	int len, status;
+	struct device *dmadev = &priv->pdev->dev;
+	struct nuport_mac_buf *buf;
+	struct sk_buff *skb, *new_skb;
+	dma_addr_t new_addr;
+	int pkt_len, len, sync_len;
+	u32 status;
 	int count = 0;
 
-	while (count < limit && !priv->irq_rxskb[priv->cur_rx]) {
-		skb = priv->rx_skb[priv->cur_rx];
-		len = priv->pkt_len[priv->cur_rx];
+	while (count < limit) {
+		buf = &priv->rx_buf[priv->cur_rx & (priv->rx_ring_size - 1)];
+		if (buf->dma_owned)
+			break;
+		smp_rmb();
+
+		skb = buf->skb;
+		pkt_len = buf->len;
+		count++;
+
+		/* the status word follows the frame */
+		sync_len = min_t(int, pkt_len + sizeof(u32), RX_DMA_SIZE);
+		dma_sync_single_for_cpu(dmadev, buf->addr, sync_len,
+					DMA_FROM_DEVICE);
 
 		/* Remove 2 bytes added by RX buffer shifting */
-		len = len - priv->buffer_shifting_len;
-		skb->data = skb->data + priv->buffer_shifting_len;
+		len = pkt_len - priv->buffer_shifting_len;
+		if (len < ETH_HLEN || len > MAX_ETH_FRAME_SIZE) {
+			dev->stats.rx_length_errors++;
+			goto recycle;
+		}
 
 		/* Get packet status */
-		status = get_unaligned((u32 *) (skb->data + len));
-
-		dma_unmap_single(&priv->pdev->dev, priv->rx_addr, skb->len,
-				DMA_FROM_DEVICE);
+		status = get_unaligned((u32 *) (skb->data + pkt_len));
 
 		/* packet filter failed */
-		if (!(status & (1 << 30))) {
-			dev_kfree_skb_irq(skb);
-			goto exit;
-		}
+		if (!(status & (1 << 30)))
+			goto recycle;
 
 		/* missed frame */
 		if (status & (1 << 31)) {
 			dev->stats.rx_missed_errors++;
-			dev_kfree_skb_irq(skb);
-			goto exit;
+			goto recycle;
 		}
 
 		/* Not ethernet type */
 		if ((!(status & (1 << 18))) || (status & ERROR_FILTER_MASK))
 			dev->stats.rx_errors++;
 
-		if (len > MAX_ETH_FRAME_SIZE) {
-			dev_kfree_skb_irq(skb);
-			goto exit;
-		} else
-			skb_put(skb, len);
+		if (len < rx_copybreak) {
+			new_skb = netdev_alloc_skb_ip_align(dev, len);
+			if (!new_skb) {
+				dev->stats.rx_dropped++;
+				goto recycle;
+			}
+			skb_copy_to_linear_data(new_skb,
+				skb->data + priv->buffer_shifting_len, len);
+			skb_put(new_skb, len);
+			dma_sync_single_for_device(dmadev, buf->addr, sync_len,
+						DMA_FROM_DEVICE);
+			nuport_mac_rx_skb(dev, new_skb, status, len);
+			goto next;
+		}
 
-		skb->protocol = eth_type_trans(skb, dev);
-		dev->stats.rx_packets++;
+		new_skb = netdev_alloc_skb(dev, RX_ALLOC_SIZE);
+		if (!new_skb) {
+			dev->stats.rx_dropped++;
+			goto recycle;
+		}
+		skb_reserve(new_skb, RX_SKB_HEADROOM);
+		new_addr = dma_map_single(dmadev, new_skb->data, RX_DMA_SIZE,
+					DMA_FROM_DEVICE);
+		if (dma_mapping_error(dmadev, new_addr)) {
+			dev_kfree_skb(new_skb);
+			dev->stats.rx_dropped++;
+			goto recycle;
+		}
 
-		if (status & (1 << 29))
-			skb->pkt_type = PACKET_OTHERHOST;
-		if (status & (1 << 27))
-			skb->pkt_type = PACKET_MULTICAST;
-		if (status & (1 << 28))
-			skb->pkt_type = PACKET_BROADCAST;
+		dma_unmap_single(dmadev, buf->addr, RX_DMA_SIZE,
+				DMA_FROM_DEVICE);
+		buf->skb = new_skb;
+		buf->addr = new_addr;
+
+		skb_reserve(skb, priv->buffer_shifting_len);
+		skb_put(skb, len);
+		nuport_mac_rx_skb(dev, skb, status, len);
+		goto next;
+
+recycle:
+		dma_sync_single_for_device(dmadev, buf->addr, sync_len,
+					DMA_FROM_DEVICE);
+next:
+		smp_wmb();
+		buf->dma_owned = 1;
+		priv->cur_rx++;
+	}
 
-		skb->ip_summed = CHECKSUM_UNNECESSARY;
+	/* the DMA engine stopped for lack of buffers, restart it */
+	if (unlikely(priv->rx_full) && count) {
+		spin_lock_irq(&priv->lock);
+		if (priv->rx_full)
+			nuport_mac_rx_refill_dma(priv);
+		spin_unlock_irq(&priv->lock);
+	}
 
-		/* Pass the received packet to network layer */
-		status = netif_receive_skb(skb);
-		if (status != NET_RX_DROP)
-			dev->stats.rx_bytes += len - 4;	/* Without CRC */
-		else
-			dev->stats.rx_dropped++;
+	return count;
+}
 
-		dev->last_rx = jiffies;
+static unsigned int nuport_mac_has_work(struct nuport_mac_priv *priv)
+{
+	struct nuport_mac_buf *buf;
 
-exit:
-		skb = netdev_alloc_skb(dev, RX_ALLOC_SIZE);
-		if (!skb)
-			goto out;
+	if (ACCESS_ONCE(priv->dma_tx) != priv->dirty_tx)
+		return 1;
 
-		skb_reserve(skb, RX_SKB_HEADROOM);
-		priv->rx_skb[priv->cur_rx] = skb;
-		priv->irq_rxskb[priv->cur_rx] = 1;
-		priv->cur_rx++;
+	buf = &priv->rx_buf[priv->cur_rx & (priv->rx_ring_size - 1)];
 
-		if (priv->cur_rx >= RX_RING_SIZE)
-			priv->cur_rx = 0;
-		count++;
-	}
-out:
-	return count;
+	return !buf->dma_owned;
 }
 
 static int nuport_mac_poll(struct napi_struct *napi, int budget)
@@ -641,63 +733,110 @@ static int nuport_mac_poll(struct napi_struct *napi, int budget)
 	struct net_device *dev = priv->dev;
 	int work_done;
 
+	nuport_mac_tx_reclaim(dev);
+
 	work_done = nuport_mac_rx(dev, budget);
 
 	if (work_done < budget) {
 		napi_complete(napi);
-		nuport_mac_enable_rx_dma(priv);
+		/* the interrupts stay enabled to restart the DMA, catch what
+		 * they completed while we were polling
+		 */
+		if (nuport_mac_has_work(priv))
+			napi_schedule(napi);
 	}
 
 	return work_done;
 }
 
-static void nuport_mac_init_tx_ring(struct nuport_mac_priv *priv)
+static void nuport_mac_free_tx_ring(struct nuport_mac_priv *priv)
 {
-	int i;
+	struct nuport_mac_buf *buf;
 
-	priv->cur_tx = priv->dma_tx = priv->tx_full = 0;
-	for (i = 0; i < TX_RING_SIZE; i++) {
-		priv->tx_skb[i] = NULL;
-		priv->valid_txskb[i] = 0;
+	for (; priv->dirty_tx != priv->cur_tx; priv->dirty_tx++) {
+		buf = &priv->tx_buf[priv->dirty_tx & (priv->tx_ring_size - 1)];
+		dma_unmap_single(&priv->pdev->dev, buf->addr, buf->len,
+				DMA_TO_DEVICE);
+		dev_kfree_skb_any(buf->skb);
+		buf->skb = NULL;
 	}
+}
+
+static void nuport_mac_init_tx_ring(struct nuport_mac_priv *priv)
+{
+	priv->cur_tx = priv->dma_tx = priv->dirty_tx = 0;
 	priv->first_pkt = 1;
 }
 
+static void nuport_mac_free_rx_ring(struct nuport_mac_priv *priv)
+{
+	struct nuport_mac_buf *buf;
+	unsigned int i;
+
+	for (i = 0; i < priv->rx_ring_size; i++) {
+		buf = &priv->rx_buf[i];
+		if (!buf->skb)
+			continue;
+
+		dma_unmap_single(&priv->pdev->dev, buf->addr, RX_DMA_SIZE,
+				DMA_FROM_DEVICE);
+		dev_kfree_skb(buf->skb);
+		buf->skb = NULL;
+	}
+}
+
 static int nuport_mac_init_rx_ring(struct net_device *dev)
 {
 	struct nuport_mac_priv *priv = netdev_priv(dev);
+	struct nuport_mac_buf *buf;
 	struct sk_buff *skb;
-	int i;
+	unsigned int i;
 
 	priv->cur_rx = priv->dma_rx = priv->rx_full = 0;
 
-	for (i = 0; i < RX_RING_SIZE; i++) {
+	for (i = 0; i < priv->rx_ring_size; i++) {
+		buf = &priv->rx_buf[i];
 		skb = netdev_alloc_skb(dev, RX_ALLOC_SIZE);
 		if (!skb)
 			return -ENOMEM;
 		skb_reserve(skb, RX_SKB_HEADROOM);
-		priv->rx_skb[i] = skb;
-		priv->irq_rxskb[i] = 1;
+		buf->addr = dma_map_single(&priv->pdev->dev, skb->data,
+					RX_DMA_SIZE, DMA_FROM_DEVICE);
+		if (dma_mapping_error(&priv->pdev->dev, buf->addr)) {
+			dev_kfree_skb(skb);
+			return -ENOMEM;
+		}
+		buf->skb = skb;
+		buf->dma_owned = 1;
 	}
 
 	return 0;
 }
 
-static void nuport_mac_free_rx_ring(struct nuport_mac_priv *priv)
+static int nuport_mac_alloc_rings(struct nuport_mac_priv *priv)
 {
-	int i;
-
-	for (i = 0; i < RX_RING_SIZE; i++) {
-		if (!priv->rx_skb[i])
-			continue;
+	priv->tx_buf = kcalloc(priv->tx_ring_size, sizeof(*priv->tx_buf),
+				GFP_KERNEL);
+	if (!priv->tx_buf)
+		return -ENOMEM;
 
-		dev_kfree_skb(priv->rx_skb[i]);
-		priv->rx_skb[i] = NULL;
+	priv->rx_buf = kcalloc(priv->rx_ring_size, sizeof(*priv->rx_buf),
+				GFP_KERNEL);
+	if (!priv->rx_buf) {
+		kfree(priv->tx_buf);
+		priv->tx_buf = NULL;
+		return -ENOMEM;
 	}
 
-	if (priv->rx_addr)
-		dma_unmap_single(&priv->pdev->dev, priv->rx_addr, RX_ALLOC_SIZE,
-				DMA_TO_DEVICE);
+	return 0;
+}
+
+static void nuport_mac_free_rings(struct nuport_mac_priv *priv)
+{
+	kfree(priv->rx_buf);
+	priv->rx_buf = NULL;
+	kfree(priv->tx_buf);
+	priv->tx_buf = NULL;
 }
 
 static void nuport_mac_read_mac_address(struct net_device *dev)
@@ -749,10 +888,16 @@ static int nuport_mac_open(struct net_device *dev)
 	unsigned long flags;
 	u32 reg = 0;
 
+	ret = nuport_mac_alloc_rings(priv);
+	if (ret) {
+		netdev_err(dev, "failed to allocate rings\n");
+		return ret;
+	}
+
 	ret = clk_enable(priv->emac_clk);
 	if (ret) {
 		netdev_err(dev, "failed to enable EMAC clock\n");
-		return ret;
+		goto out_rings;
 	}
 
 	/* Set MAC into full duplex mode by default */
@@ -812,13 +957,14 @@ static int nuport_mac_open(struct net_device *dev)
 	nuport_mac_reset_tx_dma(priv);
 	nuport_mac_reset_rx_dma(priv);
 
+	napi_enable(&priv->napi);
+
 	/* Start RX DMA */
 	spin_lock_irqsave(&priv->lock, flags);
-	ret = nuport_mac_start_rx_dma(priv, priv->rx_skb[0]);
+	nuport_mac_enable_rx_dma(priv);
+	ret = nuport_mac_start_rx_dma(priv, &priv->rx_buf[0]);
 	spin_unlock_irqrestore(&priv->lock, flags);
 
-	napi_enable(&priv->napi);
-
 	return ret;
 
 out_rx_skb:
@@ -830,6 +976,8 @@ out_link_irq:
 	free_irq(priv->link_irq, dev);
 out_emac_clk:
 	clk_disable(priv->emac_clk);
+out_rings:
+	nuport_mac_free_rings(priv);
 	return ret;
 }
 
@@ -842,21 +990,26 @@ static int nuport_mac_close(struct net_device *dev)
 	reg = nuport_mac_readl(CTRL_REG);
 	reg &= ~(RX_ENABLE | TX_ENABLE);
 	nuport_mac_writel(reg, CTRL_REG);
+	/* disable PHY polling */
+	nuport_mac_writel(0, LINK_INT_CSR);
+	nuport_mac_writel(0, LINK_INT_POLL_TIME);
+	spin_unlock_irq(&priv->lock);
 
-	napi_disable(&priv->napi);
 	netif_stop_queue(dev);
+	napi_disable(&priv->napi);
 
 	free_irq(priv->link_irq, dev);
-	/* disable PHY polling */
-	nuport_mac_writel(0, LINK_INT_CSR);
-	nuport_mac_writel(0, LINK_INT_POLL_TIME);
 	phy_stop(priv->phydev);
 
 	free_irq(priv->tx_irq, dev);
 	free_irq(priv->rx_irq, dev);
-	spin_unlock_irq(&priv->lock);
 
+	nuport_mac_reset_tx_dma(priv);
+	nuport_mac_reset_rx_dma(priv);
+
+	nuport_mac_free_tx_ring(priv);
 	nuport_mac_free_rx_ring(priv);
+	nuport_mac_free_rings(priv);
 
 	clk_disable(priv->emac_clk);
 
@@ -877,8 +1030,11 @@ static void nuport_mac_tx_timeout(struct net_device *dev)
 	for (i = 0; i < DMA_CHAN_WIDTH; i += 4)
 		netdev_info(dev, "[%02x]: 0x%08x\n", i, nuport_mac_readl(RX_DMA_BASE + i));
 
-	nuport_mac_init_tx_ring(priv);
+	spin_lock_irq(&priv->lock);
 	nuport_mac_reset_tx_dma(priv);
+	nuport_mac_free_tx_ring(priv);
+	nuport_mac_init_tx_ring(priv);
+	spin_unlock_irq(&priv->lock);
 
 	netif_wake_queue(dev);
 }
@@ -979,6 +1135,50 @@ static u32 nuport_mac_get_msglevel(struct net_device *dev)
 	return priv->msg_level;
 }
 
+static void nuport_mac_get_ringparam(struct net_device *dev,
+					struct ethtool_ringparam *ring)
+{
+	struct nuport_mac_priv *priv = netdev_priv(dev);
+
+	ring->rx_max_pending = RX_RING_SIZE_MAX;
+	ring->tx_max_pending = TX_RING_SIZE_MAX;
+	ring->rx_pending = priv->rx_ring_size;
+	ring->tx_pending = priv->tx_ring_size;
+}
+
+static int nuport_mac_set_ringparam(struct net_device *dev,
+					struct ethtool_ringparam *ring)
+{
+	struct nuport_mac_priv *priv = netdev_priv(dev);
+	unsigned int rx_size, tx_size;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	/* the ring indexes are masked, keep the sizes a power of two */
+	rx_size = clamp_t(unsigned int, ring->rx_pending,
+			RX_RING_SIZE_MIN, RX_RING_SIZE_MAX);
+	tx_size = clamp_t(unsigned int, ring->tx_pending,
+			TX_RING_SIZE_MIN, TX_RING_SIZE_MAX);
+	rx_size = roundup_pow_of_two(rx_size);
+	tx_size = roundup_pow_of_two(tx_size);
+
+	if (rx_size == priv->rx_ring_size && tx_size == priv->tx_ring_size)
+		return 0;
+
+	if (!netif_running(dev)) {
+		priv->rx_ring_size = rx_size;
+		priv->tx_ring_size = tx_size;
+		return 0;
+	}
+
+	nuport_mac_close(dev);
+	priv->rx_ring_size = rx_size;
+	priv->tx_ring_size = tx_size;
+
+	return nuport_mac_open(dev);
+}
+
 static const struct ethtool_ops nuport_mac_ethtool_ops = {
 	.get_drvinfo		= nuport_mac_ethtool_drvinfo,
 	.get_link		= ethtool_op_get_link,
@@ -986,6 +1186,8 @@ static const struct ethtool_ops nuport_mac_ethtool_ops = {
 	.set_settings		= nuport_mac_ethtool_set_settings,
 	.set_msglevel		= nuport_mac_set_msglevel,
 	.get_msglevel		= nuport_mac_get_msglevel,
+	.get_ringparam		= nuport_mac_get_ringparam,
+	.set_ringparam		= nuport_mac_set_ringparam,
 };
 
 static const struct net_device_ops nuport_mac_ops = {
@@ -1080,7 +1282,9 @@ static int __init nuport_mac_probe(struct platform_device *pdev)
 	dev->ethtool_ops = &nuport_mac_ethtool_ops;
 	dev->watchdog_timeo = HZ;
 	dev->flags = IFF_BROADCAST;	/* Supports Broadcast */
-	dev->tx_queue_len = TX_RING_SIZE / 2;
+	dev->tx_queue_len = TX_RING_SIZE_DEF / 2;
+	priv->tx_ring_size = TX_RING_SIZE_DEF;
+	priv->rx_ring_size = RX_RING_SIZE_DEF;
 
 	netif_napi_add(dev, &priv->napi, nuport_mac_poll, 64);
 
@@ -34,6 +34,7 @@
 #include "ralink_soc_eth.h"
 
 #include <linux/ioport.h>
+#include <linux/workqueue.h>
 #include <linux/switch.h>
 #include <linux/mii.h>
 
@@ -190,6 +191,8 @@
 #define RT305X_ESW_NUM_LEDS		5
 
 #define RT5350_ESW_REG_PXTPC(_x)	(0x150 + (4 * _x))
+/* the 16 bit counters wrap in 0.44s at 100M line rate with small frames */
+#define RT305X_ESW_MIB_WORK_DELAY	250
 #define RT5350_EWS_REG_LED_POLARITY	0x168
 #define RT5350_RESET_EPHY		BIT(24)
 
@@ -209,6 +212,7 @@ enum {
 	RT305X_ESW_ATTR_PORT_RECV_GOOD,
 	RT5350_ESW_ATTR_PORT_TR_BAD,
 	RT5350_ESW_ATTR_PORT_TR_GOOD,
+	RT305X_ESW_ATTR_PORT_MIB,
 };
 
 struct esw_port {
@@ -224,10 +228,21 @@ struct esw_vlan {
 	u16	vid;
 };
 
+/* the hardware counters accumulated, and where they were last read */
+struct esw_mib {
+	u64	rx_good;
+	u64	rx_bad;
+	u64	tx_good;
+	u64	tx_bad;
+	u32	last_rx;
+	u32	last_tx;
+};
+
 struct rt305x_esw {
 	struct device		*dev;
 	void __iomem		*base;
 	int			irq;
+	u32			link;
 	const struct rt305x_esw_platform_data *pdata;
 	/* Protects against concurrent register rmw operations. */
 	spinlock_t		reg_rw_lock;
@@ -247,6 +262,10 @@ struct rt305x_esw {
 	struct esw_vlan vlans[RT305X_ESW_NUM_VLANS];
 	struct esw_port ports[RT305X_ESW_NUM_PORTS];
 
+	struct mutex		mib_lock;
+	struct delayed_work	mib_work;
+	struct esw_mib		mib[RT305X_ESW_NUM_LANWAN];
+	char			buf[256];
 };
 
 static inline void esw_w32(struct rt305x_esw *esw, u32 val, unsigned reg)
@@ -318,6 +337,58 @@ out:
 	return ret;
 }
 
+static bool esw_has_tx_counters(void)
+{
+	return (ralink_soc == RT305X_SOC_RT5350) ||
+		(ralink_soc == MT762X_SOC_MT7628AN);
+}
+
+/* fold what the counters moved by since the last read into the 64 bit
+ * totals; without count only the starting point is taken */
+static void esw_mib_update(struct rt305x_esw *esw, bool count)
+{
+	struct esw_mib *mib;
+	u32 reg;
+	int i;
+
+	for (i = 0; i < RT305X_ESW_NUM_LANWAN; i++) {
+		mib = &esw->mib[i];
+
+		reg = esw_r32(esw, RT305X_ESW_REG_PXPC(i));
+		if (count) {
+			mib->rx_good += (u16) (reg - mib->last_rx);
+			mib->rx_bad += (u16) ((reg >> 16) -
+					(mib->last_rx >> 16));
+		}
+		mib->last_rx = reg;
+
+		if (!esw_has_tx_counters())
+			continue;
+
+		reg = esw_r32(esw, RT5350_ESW_REG_PXTPC(i));
+		if (count) {
+			mib->tx_good += (u16) (reg - mib->last_tx);
+			mib->tx_bad += (u16) ((reg >> 16) -
+					(mib->last_tx >> 16));
+		}
+		mib->last_tx = reg;
+	}
+}
+
+static void esw_mib_work_func(struct work_struct *work)
+{
+	struct rt305x_esw *esw;
+
+	esw = container_of(work, struct rt305x_esw, mib_work.work);
+
+	mutex_lock(&esw->mib_lock);
+	esw_mib_update(esw, true);
+	mutex_unlock(&esw->mib_lock);
+
+	schedule_delayed_work(&esw->mib_work,
+			      msecs_to_jiffies(RT305X_ESW_MIB_WORK_DELAY));
+}
+
 static unsigned esw_get_vlan_id(struct rt305x_esw *esw, unsigned vlan)
 {
 	unsigned s;
@@ -723,6 +794,14 @@ static void esw_hw_init(struct rt305x_esw *esw)
 	esw_w32(esw, ~RT305X_ESW_PORT_ST_CHG, RT305X_ESW_REG_IMR);
 }
 
+static u32 esw_get_link(struct rt305x_esw *esw)
+{
+	u32 link = esw_r32(esw, RT305X_ESW_REG_POA);
+
+	link >>= RT305X_ESW_POA_LINK_SHIFT;
+	return link & RT305X_ESW_POA_LINK_MASK;
+}
+
 static irqreturn_t esw_interrupt(int irq, void *_esw)
 {
 	struct rt305x_esw *esw = (struct rt305x_esw *) _esw;
@@ -730,10 +809,15 @@ static irqreturn_t esw_interrupt(int irq, void *_esw)
 
 	status = esw_r32(esw, RT305X_ESW_REG_ISR);
 	if (status & RT305X_ESW_PORT_ST_CHG) {
-		u32 link = esw_r32(esw, RT305X_ESW_REG_POA);
-		link >>= RT305X_ESW_POA_LINK_SHIFT;
-		link &= RT305X_ESW_POA_LINK_MASK;
-		dev_info(esw->dev, "link changed 0x%02X\n", link);
+		u32 link = esw_get_link(esw);
+		unsigned long changed = link ^ esw->link;
+		int i;
+
+		for_each_set_bit(i, &changed, RT305X_ESW_NUM_LANWAN)
+			dev_info(esw->dev, "port %d link %s\n", i,
+				 (link & BIT(i)) ? "up" : "down");
+		esw->link = link;
+		swconfig_link_changed(&esw->swdev, link);
 	}
 	esw_w32(esw, status, RT305X_ESW_REG_ISR);
 
@@ -816,7 +900,13 @@ static int esw_reset_switch(struct switch_dev *dev)
 	esw->global_vlan_enable = 0;
 	memset(esw->ports, 0, sizeof(esw->ports));
 	memset(esw->vlans, 0, sizeof(esw->vlans));
+
+	/* a reset may clear the counters: keep what they had */
+	mutex_lock(&esw->mib_lock);
+	esw_mib_update(esw, true);
 	esw_hw_init(esw);
+	esw_mib_update(esw, false);
+	mutex_unlock(&esw->mib_lock);
 
 	return 0;
 }
@@ -1027,13 +1117,16 @@ static int esw_get_port_recv_badgood(struct switch_dev *dev,
 {
 	struct rt305x_esw *esw = container_of(dev, struct rt305x_esw, swdev);
 	int idx = val->port_vlan;
-	int shift = attr->id == RT305X_ESW_ATTR_PORT_RECV_GOOD ? 0 : 16;
-	u32 reg;
 
 	if (idx < 0 || idx >= RT305X_ESW_NUM_LANWAN)
 		return -EINVAL;
-	reg = esw_r32(esw, RT305X_ESW_REG_PXPC(idx));
-	val->value.i = (reg >> shift) & 0xffff;
+
+	mutex_lock(&esw->mib_lock);
+	if (attr->id == RT305X_ESW_ATTR_PORT_RECV_GOOD)
+		val->value.i = esw->mib[idx].rx_good;
+	else
+		val->value.i = esw->mib[idx].rx_bad;
+	mutex_unlock(&esw->mib_lock);
 
 	return 0;
 }
@@ -1046,17 +1139,69 @@ esw_get_port_tr_badgood(struct switch_dev *dev,
 	struct rt305x_esw *esw = container_of(dev, struct rt305x_esw, swdev);
 
 	int idx = val->port_vlan;
-	int shift = attr->id == RT5350_ESW_ATTR_PORT_TR_GOOD ? 0 : 16;
-	u32 reg;
 
-	if ((ralink_soc != RT305X_SOC_RT5350) && (ralink_soc != MT762X_SOC_MT7628AN))
+	if (!esw_has_tx_counters())
 		return -EINVAL;
 
 	if (idx < 0 || idx >= RT305X_ESW_NUM_LANWAN)
 		return -EINVAL;
 
-	reg = esw_r32(esw, RT5350_ESW_REG_PXTPC(idx));
-	val->value.i = (reg >> shift) & 0xffff;
+	mutex_lock(&esw->mib_lock);
+	if (attr->id == RT5350_ESW_ATTR_PORT_TR_GOOD)
+		val->value.i = esw->mib[idx].tx_good;
+	else
+		val->value.i = esw->mib[idx].tx_bad;
+	mutex_unlock(&esw->mib_lock);
+
+	return 0;
+}
+
+static int esw_get_port_mib(struct switch_dev *dev,
+			    const struct switch_attr *attr,
+			    struct switch_val *val)
+{
+	struct rt305x_esw *esw = container_of(dev, struct rt305x_esw, swdev);
+	int idx = val->port_vlan;
+	struct esw_mib *mib;
+	int len;
+
+	if (idx < 0 || idx >= RT305X_ESW_NUM_LANWAN)
+		return -EINVAL;
+
+	mutex_lock(&esw->mib_lock);
+	mib = &esw->mib[idx];
+	len = snprintf(esw->buf, sizeof(esw->buf),
+		       "Port %d MIB counters\n"
+		       "RxGood      : %llu\n"
+		       "RxBad       : %llu\n",
+		       idx, mib->rx_good, mib->rx_bad);
+	if (esw_has_tx_counters())
+		len += snprintf(esw->buf + len, sizeof(esw->buf) - len,
+				"TxGood      : %llu\n"
+				"TxBad       : %llu\n",
+				mib->tx_good, mib->tx_bad);
+	mutex_unlock(&esw->mib_lock);
+
+	val->value.s = esw->buf;
+	val->len = len;
+
+	return 0;
+}
+
+/* the switch only counts packets: what swconfig calls bytes are the good
+ * packets here, which is all its activity triggers look at */
+static int esw_get_port_stats(struct switch_dev *dev, int port,
+			      struct switch_port_stats *stats)
+{
+	struct rt305x_esw *esw = container_of(dev, struct rt305x_esw, swdev);
+
+	if (port < 0 || port >= RT305X_ESW_NUM_LANWAN)
+		return -EINVAL;
+
+	mutex_lock(&esw->mib_lock);
+	stats->rx_bytes = esw->mib[port].rx_good;
+	stats->tx_bytes = esw->mib[port].tx_good;
+	mutex_unlock(&esw->mib_lock);
 
 	return 0;
 }
@@ -1330,6 +1475,13 @@ static const struct switch_attr esw_port[] = {
 		.id = RT5350_ESW_ATTR_PORT_TR_GOOD,
 		.get = esw_get_port_tr_badgood,
 	},
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "mib",
+		.description = "Get port's MIB counters",
+		.id = RT305X_ESW_ATTR_PORT_MIB,
+		.get = esw_get_port_mib,
+	},
 };
 
 static const struct switch_attr esw_vlan[] = {
@@ -1353,6 +1505,7 @@ static const struct switch_dev_ops esw_ops = {
 	.get_port_pvid = esw_get_port_pvid,
 	.set_port_pvid = esw_set_port_pvid,
 	.get_port_link = esw_get_port_link,
+	.get_port_stats = esw_get_port_stats,
 	.apply_config = esw_apply_config,
 	.reset_switch = esw_reset_switch,
 };
@@ -1416,6 +1569,8 @@ static int esw_probe(struct platform_device *pdev)
 
 	esw->dev = &pdev->dev;
 	esw->irq = irq->start;
+	mutex_init(&esw->mib_lock);
+	INIT_DELAYED_WORK(&esw->mib_work, esw_mib_work_func);
 	esw->base = ioremap(res->start, resource_size(res));
 	if (!esw->base) {
 		dev_err(&pdev->dev, "ioremap failed\n");
@@ -1464,10 +1619,16 @@ static int esw_probe(struct platform_device *pdev)
 	spin_lock_init(&esw->reg_rw_lock);
 
 	esw_hw_init(esw);
+	esw_mib_update(esw, false);
+	schedule_delayed_work(&esw->mib_work,
+			      msecs_to_jiffies(RT305X_ESW_MIB_WORK_DELAY));
 
+	esw->link = esw_get_link(esw);
 	esw_w32(esw, RT305X_ESW_PORT_ST_CHG, RT305X_ESW_REG_ISR);
 	esw_w32(esw, ~RT305X_ESW_PORT_ST_CHG, RT305X_ESW_REG_IMR);
-	request_irq(esw->irq, esw_interrupt, 0, "esw", esw);
+	/* LED triggers follow the link interrupt from here on */
+	if (!request_irq(esw->irq, esw_interrupt, 0, "esw", esw))
+		swconfig_link_changed(swdev, esw->link);
 
 	return 0;
 
@@ -1484,6 +1645,7 @@ static int esw_remove(struct platform_device *pdev)
 
 	esw = platform_get_drvdata(pdev);
 	if (esw) {
+		cancel_delayed_work_sync(&esw->mib_work);
 		unregister_switch(&esw->swdev);
 		platform_set_drvdata(pdev, NULL);
 		iounmap(esw->base);
@@ -30,6 +30,7 @@
 #include <linux/of_mdio.h>
 #include <linux/of_irq.h>
 #include <linux/of_address.h>
+#include <linux/delay.h>
 #include <linux/switch.h>
 
 #include <asm/mach-ralink/ralink_regs.h>
@@ -49,6 +50,7 @@
 #include "mdio.h"
 
 #define GSW_REG_PHY_TIMEOUT	(5 * HZ)
+#define GSW_MDIO_SPIN		50 /* usecs */
 
 #ifdef CONFIG_SOC_MT7621
 #define MT7620A_GSW_REG_PIAC	0x0004
@@ -140,9 +142,21 @@ static inline u32 gsw_r32(struct mt7620_gsw *gsw, unsigned reg)
 	return ioread32(gsw->base + reg);
 }
 
+/*
+ * An MDIO transfer normally completes within a few tens of usecs, so spin
+ * for that long and sleep between polls after it. All callers run in
+ * process or threaded irq context.
+ */
 static int mt7620_mii_busy_wait(struct mt7620_gsw *gsw)
 {
 	unsigned long t_start = jiffies;
+	int i;
+
+	for (i = 0; i < GSW_MDIO_SPIN; i++) {
+		if (!(gsw_r32(gsw, MT7620A_GSW_REG_PIAC) & GSW_MDIO_ACCESS))
+			return 0;
+		udelay(1);
+	}
 
 	while (1) {
 		if (!(gsw_r32(gsw, MT7620A_GSW_REG_PIAC) & GSW_MDIO_ACCESS))
@@ -150,6 +164,7 @@ static int mt7620_mii_busy_wait(struct mt7620_gsw *gsw)
 		if (time_after(jiffies, t_start + GSW_REG_PHY_TIMEOUT)) {
 			break;
 		}
+		usleep_range(20, 100);
 	}
 
 	printk(KERN_ERR "mdio: MDIO timeout\n");
@@ -248,6 +263,23 @@ static unsigned char *fe_speed_str(int speed)
 	return "? ";
 }
 
+static int gsw_port_speed(u32 status)
+{
+	switch ((status >> 2) & 3) {
+	case 2:
+		return SPEED_1000;
+	case 1:
+		return SPEED_100;
+	}
+
+	return SPEED_10;
+}
+
+static int gsw_port_duplex(u32 status)
+{
+	return (status & 0x2) ? DUPLEX_FULL : DUPLEX_HALF;
+}
+
 int mt7620a_has_carrier(struct fe_priv *priv)
 {
         struct mt7620_gsw *gsw = (struct mt7620_gsw *) priv->soc->swpriv;
@@ -294,6 +326,11 @@ static irqreturn_t gsw_interrupt_mt7620(int irq, void *_priv)
 			u32 status = gsw_r32(gsw, GSW_REG_PORT_STATUS(i));
 			int link = status & 0x1;
 
+			if (fe_phy_link_event(priv, i, link,
+					      gsw_port_speed(status),
+					      gsw_port_duplex(status)))
+				continue;
+
 			if (link != priv->link[i]) {
 				if (link)
 					netdev_info(priv->netdev, "port %d link up (%sMbps/%s duplex)\n",
@@ -322,7 +359,13 @@ static irqreturn_t gsw_interrupt_mt7621(int irq, void *_priv)
 
 	for (i = 0; i < 5; i++)
 		if (reg & BIT(i)) {
-			unsigned int link = mt7530_mdio_r32(gsw, 0x3008 + (i * 0x100)) & 0x1;
+			u32 status = mt7530_mdio_r32(gsw, 0x3008 + (i * 0x100));
+			unsigned int link = status & 0x1;
+
+			if (fe_phy_link_event(priv, i, link,
+					      gsw_port_speed(status),
+					      gsw_port_duplex(status)))
+				continue;
 
 			if (link != priv->link[i]) {
 				priv->link[i] = link;
@@ -463,6 +506,9 @@ void mt7620_port_init(struct fe_priv *priv, struct device_node *np)
 
 		gsw_w32(gsw, val, GSW_REG_PORT_PMCR(id));
 		fe_connect_phy_node(priv, priv->phy->phy_node[id]);
+		/* the switch irq reports link changes, don't poll the phy */
+		if (gsw->irq && priv->phy->phy[id])
+			priv->phy->phy[id]->irq = PHY_IGNORE_INTERRUPT;
 		gsw->autopoll |= BIT(id);
 		gsw_auto_poll(gsw);
 		return;
@@ -789,10 +835,12 @@ int mt7620_gsw_probe(struct fe_priv *priv)
 	gsw->irq = irq_of_parse_and_map(np, 0);
 	if (gsw->irq) {
 		if (IS_ENABLED(CONFIG_SOC_MT7620)) {
-			request_irq(gsw->irq, gsw_interrupt_mt7620, 0, "gsw", priv);
+			request_threaded_irq(gsw->irq, NULL, gsw_interrupt_mt7620,
+					     IRQF_ONESHOT, "gsw", priv);
 			gsw_w32(gsw, ~PORT_IRQ_ST_CHG, GSW_REG_IMR);
 		} else {
-			request_irq(gsw->irq, gsw_interrupt_mt7621, 0, "gsw", priv);
+			request_threaded_irq(gsw->irq, NULL, gsw_interrupt_mt7621,
+					     IRQF_ONESHOT, "gsw", priv);
 			mt7530_mdio_w32(gsw, 0x7008, 0x1f);
 		}
 	}
@@ -73,6 +73,34 @@ static void fe_phy_link_adjust(struct net_device *dev)
 			}
 		}
 	}
+	spin_unlock_irqrestore(&priv->phy->lock, flags);
+}
+
+/*
+ * Feed a link change reported by the switch interrupt into a PHY that
+ * phylib has been told not to poll. Returns false if the port's PHY is
+ * not driven this way and the caller has to handle the event itself.
+ */
+bool fe_phy_link_event(struct fe_priv *priv, int port, int link,
+		       int speed, int duplex)
+{
+	struct phy_device *phydev;
+
+	if (!priv->phy || port >= 8)
+		return false;
+
+	phydev = priv->phy->phy[port];
+	if (!phydev || phydev->irq != PHY_IGNORE_INTERRUPT)
+		return false;
+
+	phydev->link = link;
+	if (link) {
+		phydev->speed = speed;
+		phydev->duplex = duplex;
+	}
+	phydev->adjust_link(priv->netdev);
+
+	return true;
 }
 
 int fe_connect_phy_node(struct fe_priv *priv, struct device_node *phy_node)
@@ -22,8 +22,12 @@
 extern int fe_mdio_init(struct fe_priv *priv);
 extern void fe_mdio_cleanup(struct fe_priv *priv);
 extern int fe_connect_phy_node(struct fe_priv *priv, struct device_node *phy_node);
+extern bool fe_phy_link_event(struct fe_priv *priv, int port, int link,
+			      int speed, int duplex);
 #else
 static inline int fe_mdio_init(struct fe_priv *priv) { return 0; }
 static inline void fe_mdio_cleanup(struct fe_priv *priv) {}
+static inline bool fe_phy_link_event(struct fe_priv *priv, int port, int link,
+				     int speed, int duplex) { return false; }
 #endif
 #endif
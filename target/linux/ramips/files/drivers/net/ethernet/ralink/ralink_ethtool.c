@@ -23,6 +23,22 @@ FE_STAT_REG_DECLARE
 #undef _FE
 };
 
+static const char fe_ring_str[][ETH_GSTRING_LEN] = {
+#define _FE(x...)	# x,
+FE_RING_STAT_DECLARE
+#undef _FE
+};
+
+/* the gdma counters only exist on some SoCs, the ring stats always */
+static int fe_gdma_count(struct net_device *dev)
+{
+	struct fe_priv *priv = netdev_priv(dev);
+
+	if (priv->soc->reg_table[FE_REG_FE_COUNTER_BASE])
+		return ARRAY_SIZE(fe_gdma_str);
+	return 0;
+}
+
 static int fe_get_settings(struct net_device *dev,
 		struct ethtool_cmd *cmd)
 {
@@ -74,14 +90,12 @@ static void fe_get_drvinfo (struct net_device *dev,
 		struct ethtool_drvinfo *info)
 {
 	struct fe_priv *priv = netdev_priv(dev);
-	struct fe_soc_data *soc = priv->soc;
 
 	strlcpy(info->driver, priv->device->driver->name, sizeof(info->driver));
 	strlcpy(info->version, FE_DRV_VERSION, sizeof(info->version));
 	strlcpy(info->bus_info, dev_name(priv->device), sizeof(info->bus_info));
 
-	if (soc->reg_table[FE_REG_FE_COUNTER_BASE])
-		info->n_stats = ARRAY_SIZE(fe_gdma_str);
+	info->n_stats = fe_gdma_count(dev) + ARRAY_SIZE(fe_ring_str);
 }
 
 static u32 fe_get_msglevel(struct net_device *dev)
@@ -142,14 +156,8 @@ static int fe_set_ringparam(struct net_device *dev,
 			(ring->tx_pending > MAX_DMA_DESC))
 		return -EINVAL;
 
-	dev->netdev_ops->ndo_stop(dev);
-
-	priv->tx_ring.tx_ring_size = BIT(fls(ring->tx_pending) - 1);
-	priv->rx_ring_size = BIT(fls(ring->rx_pending) - 1);
-
-	dev->netdev_ops->ndo_open(dev);
-
-	return 0;
+	return fe_set_ring_size(priv, BIT(fls(ring->tx_pending) - 1),
+			BIT(fls(ring->rx_pending) - 1));
 }
 
 static void fe_get_ringparam(struct net_device *dev,
@@ -163,11 +171,56 @@ static void fe_get_ringparam(struct net_device *dev,
 	ring->tx_pending = priv->tx_ring.tx_ring_size;
 }
 
+static int fe_get_coalesce(struct net_device *dev,
+		struct ethtool_coalesce *ec)
+{
+	struct fe_priv *priv = netdev_priv(dev);
+
+	ec->rx_coalesce_usecs = priv->coal.rx_usecs;
+	ec->rx_max_coalesced_frames = priv->coal.rx_frames;
+	ec->tx_coalesce_usecs = priv->coal.tx_usecs;
+	ec->tx_max_coalesced_frames = priv->coal.tx_frames;
+	ec->use_adaptive_rx_coalesce = priv->coal.rx_adaptive;
+
+	return 0;
+}
+
+static int fe_set_coalesce(struct net_device *dev,
+		struct ethtool_coalesce *ec)
+{
+	struct fe_priv *priv = netdev_priv(dev);
+	struct fe_coalesce coal;
+
+	if ((ec->rx_coalesce_usecs > FE_DELAY_MAX_PTIME * FE_DELAY_TIME) ||
+			(ec->tx_coalesce_usecs > FE_DELAY_MAX_PTIME * FE_DELAY_TIME) ||
+			(ec->rx_max_coalesced_frames > FE_DELAY_MAX_PINT) ||
+			(ec->tx_max_coalesced_frames > FE_DELAY_MAX_PINT))
+		return -EINVAL;
+
+	/* a frame limit alone never times out: usecs turns the delay on */
+	memset(&coal, 0, sizeof(coal));
+	coal.tx_usecs = ec->tx_coalesce_usecs;
+	coal.tx_frames = ec->tx_max_coalesced_frames;
+	coal.rx_adaptive = !!ec->use_adaptive_rx_coalesce;
+	if (!coal.rx_adaptive) {
+		coal.rx_usecs = ec->rx_coalesce_usecs;
+		coal.rx_frames = ec->rx_max_coalesced_frames;
+	}
+
+	fe_coalesce_set(priv, &coal);
+
+	return 0;
+}
+
 static void fe_get_strings(struct net_device *dev, u32 stringset, u8 *data)
 {
 	switch (stringset) {
 	case ETH_SS_STATS:
-		memcpy(data, *fe_gdma_str, sizeof(fe_gdma_str));
+		if (fe_gdma_count(dev)) {
+			memcpy(data, *fe_gdma_str, sizeof(fe_gdma_str));
+			data += sizeof(fe_gdma_str);
+		}
+		memcpy(data, *fe_ring_str, sizeof(fe_ring_str));
 		break;
 	}
 }
@@ -176,7 +229,7 @@ static int fe_get_sset_count(struct net_device *dev, int sset)
 {
 	switch (sset) {
 	case ETH_SS_STATS:
-		return ARRAY_SIZE(fe_gdma_str);
+		return fe_gdma_count(dev) + ARRAY_SIZE(fe_ring_str);
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -191,6 +244,9 @@ static void fe_get_ethtool_stats(struct net_device *dev,
 	unsigned int start;
 	int i;
 
+	if (!fe_gdma_count(dev))
+		goto ring_stats;
+
 	if (netif_running(dev) && netif_device_present(dev)) {
 		if (spin_trylock(&hwstats->stats_lock)) {
 			fe_stats_update(priv);
@@ -207,6 +263,12 @@ static void fe_get_ethtool_stats(struct net_device *dev,
 			*data_dst++ = *data_src++;
 
 	} while (u64_stats_fetch_retry_irq(&hwstats->syncp, start));
+	data += ARRAY_SIZE(fe_gdma_str);
+
+ring_stats:
+#define _FE(x) *data++ = priv->ring_stats.x;
+FE_RING_STAT_DECLARE
+#undef _FE
 }
 
 static struct ethtool_ops fe_ethtool_ops = {
@@ -219,6 +281,9 @@ static struct ethtool_ops fe_ethtool_ops = {
 	.get_link		= fe_get_link,
 	.set_ringparam		= fe_set_ringparam,
 	.get_ringparam		= fe_get_ringparam,
+	.get_strings		= fe_get_strings,
+	.get_sset_count		= fe_get_sset_count,
+	.get_ethtool_stats	= fe_get_ethtool_stats,
 };
 
 void fe_set_ethtool_ops(struct net_device *netdev)
@@ -226,10 +291,9 @@ void fe_set_ethtool_ops(struct net_device *netdev)
 	struct fe_priv *priv = netdev_priv(netdev);
 	struct fe_soc_data *soc = priv->soc;
 
-	if (soc->reg_table[FE_REG_FE_COUNTER_BASE]) {
-		fe_ethtool_ops.get_strings = fe_get_strings;
-		fe_ethtool_ops.get_sset_count = fe_get_sset_count;
-		fe_ethtool_ops.get_ethtool_stats = fe_get_ethtool_stats;
+	if (soc->rx_dly_int) {
+		fe_ethtool_ops.get_coalesce = fe_get_coalesce;
+		fe_ethtool_ops.set_coalesce = fe_set_coalesce;
 	}
 
 	netdev->ethtool_ops = &fe_ethtool_ops;
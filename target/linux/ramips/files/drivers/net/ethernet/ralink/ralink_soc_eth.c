@@ -39,6 +39,7 @@
 #include "esw_rt3052.h"
 #include "mdio.h"
 #include "ralink_ethtool.h"
+#include "ralink_trace.h"
 
 #define	MAX_RX_LENGTH		1536
 #define FE_RX_HLEN		(NET_SKB_PAD + VLAN_ETH_HLEN + VLAN_HLEN + \
@@ -143,6 +144,113 @@ static inline void fe_int_enable(u32 mask)
 	fe_reg_r32(FE_REG_FE_INT_ENABLE);
 }
 
+/* every interrupt the napi poll handles, done or delayed */
+static inline u32 fe_int_all(struct fe_priv *priv)
+{
+	struct fe_soc_data *soc = priv->soc;
+
+	return soc->tx_int | soc->rx_int | soc->tx_dly_int | soc->rx_dly_int;
+}
+
+static u32 fe_delay_chan(u32 usecs, u32 frames)
+{
+	u32 ptime = min_t(u32, DIV_ROUND_UP(usecs, FE_DELAY_TIME),
+			FE_DELAY_MAX_PTIME);
+
+	if (!frames || frames > FE_DELAY_MAX_PINT)
+		frames = FE_DELAY_MAX_PINT;
+
+	return ((FE_DELAY_EN_INT | frames) << 8) | ptime;
+}
+
+/* program the delay interrupt and pick the interrupts to unmask: a
+ * direction with coalescing only raises the delayed one */
+static void fe_coalesce_apply(struct fe_priv *priv)
+{
+	struct fe_coalesce *coal = &priv->coal;
+	struct fe_soc_data *soc = priv->soc;
+	u32 cfg = 0, mask = 0;
+
+	if (coal->rx_usecs && soc->rx_dly_int) {
+		cfg |= fe_delay_chan(coal->rx_usecs, coal->rx_frames);
+		mask |= soc->rx_dly_int;
+	} else
+		mask |= soc->rx_int;
+
+	if (coal->tx_usecs && soc->tx_dly_int) {
+		cfg |= fe_delay_chan(coal->tx_usecs, coal->tx_frames) << 16;
+		mask |= soc->tx_dly_int;
+	} else
+		mask |= soc->tx_int;
+
+	fe_reg_w32(cfg, FE_REG_DLY_INT_CFG);
+	priv->int_mask = mask;
+}
+
+void fe_coalesce_set(struct fe_priv *priv, const struct fe_coalesce *coal)
+{
+	if (!netif_running(priv->netdev)) {
+		priv->coal = *coal;
+		fe_coalesce_apply(priv);
+		return;
+	}
+
+	fe_int_disable(fe_int_all(priv));
+	napi_disable(&priv->rx_napi);
+	priv->coal = *coal;
+	priv->coal.stamp = jiffies;
+	fe_coalesce_apply(priv);
+	napi_enable(&priv->rx_napi);
+
+	/* the poll picks up whatever came in meanwhile and unmasks */
+	local_bh_disable();
+	napi_schedule(&priv->rx_napi);
+	local_bh_enable();
+}
+
+static const struct {
+	u16 usecs;
+	u16 frames;
+} fe_coal_levels[] = {
+	{ 0, 0 },
+	{ 20, 4 },
+	{ 60, 16 },
+	{ 120, 32 },
+};
+
+/* called from the poll with interrupts masked */
+static void fe_coalesce_adapt(struct fe_priv *priv, int rx_done)
+{
+	struct fe_coalesce *coal = &priv->coal;
+	int level = coal->level;
+	u32 avg;
+
+	coal->pkts += rx_done;
+	if (time_before(jiffies, coal->stamp + FE_COAL_INTERVAL))
+		return;
+
+	/* too many interrupts: batch more. few packets per interrupt
+	 * and a moderate rate: the delay only costs latency */
+	avg = coal->pkts / max_t(u32, coal->irqs, 1);
+	if (coal->irqs > FE_COAL_IRQS_HIGH)
+		level++;
+	else if (coal->irqs < FE_COAL_IRQS_HIGH / 2 &&
+			avg < fe_coal_levels[level].frames / 2)
+		level--;
+	level = clamp_t(int, level, 0, ARRAY_SIZE(fe_coal_levels) - 1);
+
+	if (level != coal->level) {
+		coal->level = level;
+		coal->rx_usecs = fe_coal_levels[level].usecs;
+		coal->rx_frames = fe_coal_levels[level].frames;
+		fe_coalesce_apply(priv);
+	}
+
+	coal->irqs = 0;
+	coal->pkts = 0;
+	coal->stamp = jiffies;
+}
+
 static inline void fe_hw_set_macaddr(struct fe_priv *priv, unsigned char *mac)
 {
 	unsigned long flags;
@@ -199,23 +307,70 @@ static inline void fe_set_txd(struct fe_tx_dma *txd, struct fe_tx_dma *dma_txd)
 	dma_txd->txd2 = txd->txd2;
 }
 
+static int fe_rx_buf_alloc(struct fe_priv *priv, struct fe_rx_buf *buf,
+		gfp_t gfp)
+{
+	struct device *dev = &priv->netdev->dev;
+	struct page *page;
+	dma_addr_t dma;
+
+	page = alloc_page(gfp | __GFP_COLD);
+	if (unlikely(!page))
+		return -ENOMEM;
+
+	dma = dma_map_page(dev, page, 0, PAGE_SIZE, DMA_FROM_DEVICE);
+	if (unlikely(dma_mapping_error(dev, dma))) {
+		__free_page(page);
+		return -ENOMEM;
+	}
+
+	buf->page = page;
+	buf->dma = dma;
+	buf->offset = 0;
+
+	return 0;
+}
+
+/* take the received buffer out of the slot and give the slot a fresh
+ * one: the other half of the same page if nobody holds it any more */
+static u8 *fe_rx_buf_take(struct fe_priv *priv, struct fe_rx_buf *buf,
+		int pad)
+{
+	struct device *dev = &priv->netdev->dev;
+	u8 *data = page_address(buf->page) + buf->offset;
+	dma_addr_t old = buf->dma;
+
+	if (priv->frag_size <= PAGE_SIZE / 2 && page_count(buf->page) == 1) {
+		get_page(buf->page);
+		buf->offset ^= PAGE_SIZE / 2;
+		dma_sync_single_range_for_device(dev, buf->dma,
+				buf->offset + NET_SKB_PAD + pad,
+				priv->rx_buf_size, DMA_FROM_DEVICE);
+		return data;
+	}
+
+	if (fe_rx_buf_alloc(priv, buf, GFP_ATOMIC))
+		return NULL;
+	dma_unmap_page(dev, old, PAGE_SIZE, DMA_FROM_DEVICE);
+
+	return data;
+}
+
 static void fe_clean_rx(struct fe_priv *priv)
 {
 	int i;
 
-	if (priv->rx_data) {
+	if (priv->rx_buf) {
 		for (i = 0; i < priv->rx_ring_size; i++)
-			if (priv->rx_data[i]) {
-				if (priv->rx_dma && priv->rx_dma[i].rxd1)
-					dma_unmap_single(&priv->netdev->dev,
-							priv->rx_dma[i].rxd1,
-							priv->rx_buf_size,
-							DMA_FROM_DEVICE);
-				put_page(virt_to_head_page(priv->rx_data[i]));
+			if (priv->rx_buf[i].page) {
+				dma_unmap_page(&priv->netdev->dev,
+						priv->rx_buf[i].dma,
+						PAGE_SIZE, DMA_FROM_DEVICE);
+				put_page(priv->rx_buf[i].page);
 			}
 
-		kfree(priv->rx_data);
-		priv->rx_data = NULL;
+		kfree(priv->rx_buf);
+		priv->rx_buf = NULL;
 	}
 
 	if (priv->rx_dma) {
@@ -227,21 +382,21 @@ static void fe_clean_rx(struct fe_priv *priv)
 	}
 }
 
+static void fe_rx_ring_setup(struct fe_priv *priv);
+
 static int fe_alloc_rx(struct fe_priv *priv)
 {
 	struct net_device *netdev = priv->netdev;
-	int i, pad;
+	int i;
 
-	priv->rx_data = kcalloc(priv->rx_ring_size, sizeof(*priv->rx_data),
+	priv->rx_buf = kcalloc(priv->rx_ring_size, sizeof(*priv->rx_buf),
 			GFP_KERNEL);
-	if (!priv->rx_data)
+	if (!priv->rx_buf)
 		goto no_rx_mem;
 
-	for (i = 0; i < priv->rx_ring_size; i++) {
-		priv->rx_data[i] = netdev_alloc_frag(priv->frag_size);
-		if (!priv->rx_data[i])
+	for (i = 0; i < priv->rx_ring_size; i++)
+		if (fe_rx_buf_alloc(priv, &priv->rx_buf[i], GFP_KERNEL))
 			goto no_rx_mem;
-	}
 
 	priv->rx_dma = dma_alloc_coherent(&netdev->dev,
 			priv->rx_ring_size * sizeof(*priv->rx_dma),
@@ -250,18 +405,25 @@ static int fe_alloc_rx(struct fe_priv *priv)
 	if (!priv->rx_dma)
 		goto no_rx_mem;
 
+	fe_rx_ring_setup(priv);
+
+	return 0;
+
+no_rx_mem:
+	return -ENOMEM;
+}
+
+static void fe_rx_ring_setup(struct fe_priv *priv)
+{
+	int i, pad;
+
 	if (priv->flags & FE_FLAG_RX_2B_OFFSET)
 		pad = 0;
 	else
 		pad = NET_IP_ALIGN;
 	for (i = 0; i < priv->rx_ring_size; i++) {
-		dma_addr_t dma_addr = dma_map_single(&netdev->dev,
-				priv->rx_data[i] + NET_SKB_PAD + pad,
-				priv->rx_buf_size,
-				DMA_FROM_DEVICE);
-		if (unlikely(dma_mapping_error(&netdev->dev, dma_addr)))
-			goto no_rx_mem;
-		priv->rx_dma[i].rxd1 = (unsigned int) dma_addr;
+		priv->rx_dma[i].rxd1 = (unsigned int) priv->rx_buf[i].dma +
+			priv->rx_buf[i].offset + NET_SKB_PAD + pad;
 
 		if (priv->flags & FE_FLAG_RX_SG_DMA)
 			priv->rx_dma[i].rxd2 = RX_DMA_PLEN0(priv->rx_buf_size);
@@ -272,13 +434,9 @@ static int fe_alloc_rx(struct fe_priv *priv)
 
 	fe_reg_w32(priv->rx_phys, FE_REG_RX_BASE_PTR0);
 	fe_reg_w32(priv->rx_ring_size, FE_REG_RX_MAX_CNT0);
-	fe_reg_w32((priv->rx_ring_size - 1), FE_REG_RX_CALC_IDX0);
+	priv->rx_calc_idx = priv->rx_ring_size - 1;
+	fe_reg_w32(priv->rx_calc_idx, FE_REG_RX_CALC_IDX0);
 	fe_reg_w32(FE_PST_DRX_IDX0, FE_REG_PDMA_RST_CFG);
-
-	return 0;
-
-no_rx_mem:
-	return -ENOMEM;
 }
 
 static void fe_txd_unmap(struct device *dev, struct fe_tx_buf *tx_buf)
@@ -331,24 +489,13 @@ static void fe_clean_tx(struct fe_priv *priv)
 	netdev_reset_queue(priv->netdev);
 }
 
-static int fe_alloc_tx(struct fe_priv *priv)
+static void fe_tx_ring_setup(struct fe_priv *priv)
 {
 	int i;
 	struct fe_tx_ring *ring = &priv->tx_ring;
 
 	ring->tx_free_idx = 0;
-
-	ring->tx_buf = kcalloc(ring->tx_ring_size, sizeof(*ring->tx_buf),
-			GFP_KERNEL);
-	if (!ring->tx_buf)
-		goto no_tx_mem;
-
-	ring->tx_dma = dma_alloc_coherent(&priv->netdev->dev,
-			ring->tx_ring_size * sizeof(*ring->tx_dma),
-			&ring->tx_phys,
-			GFP_ATOMIC | __GFP_ZERO);
-	if (!ring->tx_dma)
-		goto no_tx_mem;
+	ring->tx_next_idx = 0;
 
 	for (i = 0; i < ring->tx_ring_size; i++) {
 		if (priv->soc->tx_dma) {
@@ -362,6 +509,25 @@ static int fe_alloc_tx(struct fe_priv *priv)
 	fe_reg_w32(ring->tx_ring_size, FE_REG_TX_MAX_CNT0);
 	fe_reg_w32(0, FE_REG_TX_CTX_IDX0);
 	fe_reg_w32(FE_PST_DTX_IDX0, FE_REG_PDMA_RST_CFG);
+}
+
+static int fe_alloc_tx(struct fe_priv *priv)
+{
+	struct fe_tx_ring *ring = &priv->tx_ring;
+
+	ring->tx_buf = kcalloc(ring->tx_ring_size, sizeof(*ring->tx_buf),
+			GFP_KERNEL);
+	if (!ring->tx_buf)
+		goto no_tx_mem;
+
+	ring->tx_dma = dma_alloc_coherent(&priv->netdev->dev,
+			ring->tx_ring_size * sizeof(*ring->tx_dma),
+			&ring->tx_phys,
+			GFP_ATOMIC | __GFP_ZERO);
+	if (!ring->tx_dma)
+		goto no_tx_mem;
+
+	fe_tx_ring_setup(priv);
 
 	return 0;
 
@@ -645,13 +811,12 @@ static int fe_tx_map_dma(struct sk_buff *skb, struct net_device *dev,
 
 	/* store skb to cleanup */
 	tx_buf->skb = skb;
+	tx_buf->stamp = fe_trace_on() ? fe_trace_now() : 0;
 
 	netdev_sent_queue(dev, skb->len);
 	skb_tx_timestamp(skb);
 
-	j = NEXT_TX_DESP_IDX(j);
-	wmb();
-	fe_reg_w32(j, FE_REG_TX_CTX_IDX0);
+	ring->tx_next_idx = NEXT_TX_DESP_IDX(j);
 
 	return 0;
 
@@ -709,6 +874,19 @@ static inline u32 fe_empty_txd(struct fe_tx_ring *ring, u32 tx_fill_idx)
 				(ring->tx_ring_size - 1)));
 }
 
+/* a small ring (ethtool -G) still has to wake up again */
+static inline u32 fe_tx_thresh(struct fe_tx_ring *ring)
+{
+	return min_t(u32, FE_TX_STOP_THRESH, ring->tx_ring_size / 2);
+}
+
+/* start the dma on everything queued so far */
+static inline void fe_tx_kick(struct fe_tx_ring *ring)
+{
+	wmb();
+	fe_reg_w32(ring->tx_next_idx, FE_REG_TX_CTX_IDX0);
+}
+
 static inline int fe_cal_txd_req(struct sk_buff *skb)
 {
 	int i, nfrags;
@@ -732,20 +910,22 @@ static int fe_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct fe_priv *priv = netdev_priv(dev);
 	struct fe_tx_ring *ring = &priv->tx_ring;
 	struct net_device_stats *stats = &dev->stats;
-	u32 tx;
+	u32 tx, used;
 	int tx_num;
 	int len = skb->len;
+	bool more = skb->xmit_more;
 
 	if (fe_skb_padto(skb, priv)) {
 		netif_warn(priv, tx_err, dev, "tx padding failed!\n");
-		return NETDEV_TX_OK;
+		goto out;
 	}
 
 	tx_num = fe_cal_txd_req(skb);
-	tx = fe_reg_r32(FE_REG_TX_CTX_IDX0);
+	tx = ring->tx_next_idx;
 	if (unlikely(fe_empty_txd(ring, tx) <= tx_num))
 	{
 		netif_stop_queue(dev);
+		fe_tx_kick(ring);
 		netif_err(priv, tx_queued,dev,
 				"Tx Ring full when queue awake!\n");
 		return NETDEV_TX_BUSY;
@@ -758,6 +938,24 @@ static int fe_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		stats->tx_bytes += len;
 	}
 
+	used = ring->tx_ring_size - fe_empty_txd(ring, ring->tx_next_idx);
+	if (used > priv->ring_stats.tx_ring_hwm)
+		priv->ring_stats.tx_ring_hwm = used;
+
+	if (unlikely(fe_empty_txd(ring, ring->tx_next_idx) <=
+				fe_tx_thresh(ring))) {
+		netif_stop_queue(dev);
+		/* pairs with the barrier in fe_poll_tx */
+		smp_mb();
+		if (fe_empty_txd(ring, ring->tx_next_idx) > fe_tx_thresh(ring))
+			netif_start_queue(dev);
+	}
+
+out:
+	/* the doorbell waits for the last skb of a burst */
+	if (!more || netif_xmit_stopped(netdev_get_tx_queue(dev, 0)))
+		fe_tx_kick(ring);
+
 	return NETDEV_TX_OK;
 }
 
@@ -782,11 +980,13 @@ static int fe_poll_rx(struct napi_struct *napi, int budget,
 	struct net_device_stats *stats = &netdev->stats;
 	struct fe_soc_data *soc = priv->soc;
 	u32 checksum_bit;
-	int idx = fe_reg_r32(FE_REG_RX_CALC_IDX0);
+	int idx = priv->rx_calc_idx;
 	struct sk_buff *skb;
-	u8 *data, *new_data;
+	struct fe_rx_buf *buf;
+	u8 *data;
 	struct fe_rx_dma *rxd, trxd;
-	int done = 0, pad;
+	int done = 0, pending = 0, pad;
+	u32 used;
 	bool rx_vlan = netdev->features & NETIF_F_HW_VLAN_CTAG_RX;
 
 	if (netdev->features & NETIF_F_RXCSUM)
@@ -801,41 +1001,40 @@ static int fe_poll_rx(struct napi_struct *napi, int budget,
 
 	while (done < budget) {
 		unsigned int pktlen;
-		dma_addr_t dma_addr;
 		idx = NEXT_RX_DESP_IDX(idx);
 		rxd = &priv->rx_dma[idx];
-		data = priv->rx_data[idx];
+		buf = &priv->rx_buf[idx];
 
 		fe_get_rxd(&trxd, rxd);
 		if (!(trxd.rxd2 & RX_DMA_DONE))
 			break;
 
-		/* alloc new buffer */
-		new_data = netdev_alloc_frag(priv->frag_size);
-		if (unlikely(!new_data)) {
-			stats->rx_dropped++;
-			goto release_desc;
-		}
-		dma_addr = dma_map_single(&netdev->dev,
-				new_data + NET_SKB_PAD + pad,
-				priv->rx_buf_size,
+		/* only what the frame engine wrote needs to be synced */
+		pktlen = RX_DMA_PLEN0(trxd.rxd2);
+		dma_sync_single_range_for_cpu(&netdev->dev, buf->dma,
+				buf->offset + NET_SKB_PAD + pad, pktlen,
 				DMA_FROM_DEVICE);
-		if (unlikely(dma_mapping_error(&netdev->dev, dma_addr))) {
-			put_page(virt_to_head_page(new_data));
+
+		data = fe_rx_buf_take(priv, buf, pad);
+		if (unlikely(!data)) {
+			dma_sync_single_range_for_device(&netdev->dev,
+					buf->dma,
+					buf->offset + NET_SKB_PAD + pad,
+					pktlen, DMA_FROM_DEVICE);
+			stats->rx_dropped++;
+			priv->ring_stats.rx_no_buffer++;
 			goto release_desc;
 		}
 
 		/* receive data */
 		skb = build_skb(data, priv->frag_size);
 		if (unlikely(!skb)) {
-			put_page(virt_to_head_page(new_data));
+			put_page(virt_to_head_page(data));
+			stats->rx_dropped++;
 			goto release_desc;
 		}
 		skb_reserve(skb, NET_SKB_PAD + NET_IP_ALIGN);
 
-		dma_unmap_single(&netdev->dev, trxd.rxd1,
-				priv->rx_buf_size, DMA_FROM_DEVICE);
-		pktlen = RX_DMA_PLEN0(trxd.rxd2);
 		skb->dev = netdev;
 		skb_put(skb, pktlen);
 		if (trxd.rxd4 & checksum_bit) {
@@ -850,22 +1049,46 @@ static int fe_poll_rx(struct napi_struct *napi, int budget,
 		stats->rx_packets++;
 		stats->rx_bytes += pktlen;
 
-		napi_gro_receive(napi, skb);
-
-		priv->rx_data[idx] = new_data;
-		rxd->rxd1 = (unsigned int) dma_addr;
+		if (fe_trace_on())
+			fe_trace_rx(priv, napi, skb);
+		else
+			napi_gro_receive(napi, skb);
 
 release_desc:
+		rxd->rxd1 = (unsigned int) buf->dma + buf->offset +
+			NET_SKB_PAD + pad;
 		if (priv->flags & FE_FLAG_RX_SG_DMA)
 			rxd->rxd2 = RX_DMA_PLEN0(priv->rx_buf_size);
 		else
 			rxd->rxd2 = RX_DMA_LSO;
 
-		wmb();
-		fe_reg_w32(idx, FE_REG_RX_CALC_IDX0);
+		priv->rx_calc_idx = idx;
 		done++;
+
+		/* hand descriptors back in batches, each doorbell is an
+		 * uncached write */
+		if (++pending == FE_RX_BATCH) {
+			wmb();
+			fe_reg_w32(idx, FE_REG_RX_CALC_IDX0);
+			pending = 0;
+		}
 	}
 
+	if (pending) {
+		wmb();
+		fe_reg_w32(priv->rx_calc_idx, FE_REG_RX_CALC_IDX0);
+	}
+
+	/* a full budget may have left more behind: ask the dma where it is */
+	used = done;
+	if (done == budget)
+		used += (fe_reg_r32(FE_REG_RX_DRX_IDX0) - priv->rx_calc_idx - 1) &
+			(priv->rx_ring_size - 1);
+	if (used > priv->ring_stats.rx_ring_hwm)
+		priv->ring_stats.rx_ring_hwm = used;
+	if (used >= priv->rx_ring_size - 1)
+		priv->ring_stats.rx_ring_full++;
+
 	if (done < budget)
 		fe_reg_w32(rx_intr, FE_REG_FE_INT_STATUS);
 
@@ -881,11 +1104,13 @@ static int fe_poll_tx(struct fe_priv *priv, int budget, u32 tx_intr,
 	struct sk_buff *skb;
 	struct fe_tx_buf *tx_buf;
 	int done = 0;
-	u32 idx, hwidx;
+	u32 idx, hwidx, now = 0;
 	struct fe_tx_ring *ring = &priv->tx_ring;
 
 	idx = ring->tx_free_idx;
 	hwidx = fe_reg_r32(FE_REG_TX_DTX_IDX0);
+	if (fe_trace_on())
+		now = fe_trace_now();
 
 	while ((idx != hwidx) && budget) {
 		tx_buf = &ring->tx_buf[idx];
@@ -898,6 +1123,9 @@ static int fe_poll_tx(struct fe_priv *priv, int budget, u32 tx_intr,
 			bytes_compl += skb->len;
 			done++;
 			budget--;
+			if (unlikely(now && tx_buf->stamp))
+				fe_trace_hist(priv->trace.xmit_to_done,
+						now - tx_buf->stamp);
 		}
 		fe_txd_unmap(dev, tx_buf);
 		idx = NEXT_TX_DESP_IDX(idx);
@@ -916,8 +1144,12 @@ static int fe_poll_tx(struct fe_priv *priv, int budget, u32 tx_intr,
 
 	if (done) {
 		netdev_completed_queue(netdev, done, bytes_compl);
+		/* pairs with the barrier in fe_start_xmit */
+		smp_mb();
 		if (unlikely(netif_queue_stopped(netdev) &&
-					netif_carrier_ok(netdev))) {
+					netif_carrier_ok(netdev) &&
+					fe_empty_txd(ring, ring->tx_next_idx) >
+					fe_tx_thresh(ring))) {
 			netif_wake_queue(netdev);
 		}
 	}
@@ -932,10 +1164,14 @@ static int fe_poll(struct napi_struct *napi, int budget)
 	int tx_done, rx_done, tx_again;
 	u32 status, fe_status, status_reg, mask;
 	u32 tx_intr, rx_intr, status_intr;
+	u32 start = 0;
+
+	if (fe_trace_on())
+		start = fe_trace_poll_start(priv);
 
 	fe_status = status = fe_reg_r32(FE_REG_FE_INT_STATUS);
-	tx_intr = priv->soc->tx_int;
-	rx_intr = priv->soc->rx_int;
+	tx_intr = priv->soc->tx_int | priv->soc->tx_dly_int;
+	rx_intr = priv->soc->rx_int | priv->soc->rx_dly_int;
 	status_intr = priv->soc->status_int;
 	tx_done = rx_done = tx_again = 0;
 
@@ -966,13 +1202,20 @@ static int fe_poll(struct napi_struct *napi, int budget)
 				tx_done, rx_done, status, mask);
 	}
 
+	if (priv->coal.rx_adaptive)
+		fe_coalesce_adapt(priv, rx_done);
+
+	if (unlikely(start))
+		fe_trace_poll_end(priv, start, rx_done, tx_done);
+
 	if (!tx_again && (rx_done < budget)) {
 		status = fe_reg_r32(FE_REG_FE_INT_STATUS);
 		if (status & (tx_intr | rx_intr ))
 			goto poll_again;
 
+		priv->coal.irqs++;
 		napi_complete(napi);
-		fe_int_enable(tx_intr | rx_intr);
+		fe_int_enable(priv->int_mask);
 	}
 
 poll_again:
@@ -1019,10 +1262,12 @@ static irqreturn_t fe_handle_irq(int irq, void *dev)
 	if (unlikely(!status))
 		return IRQ_NONE;
 
-	int_mask = (priv->soc->rx_int | priv->soc->tx_int);
+	int_mask = fe_int_all(priv);
 	if (likely(status & int_mask)) {
 		if (likely(napi_schedule_prep(&priv->rx_napi))) {
 			fe_int_disable(int_mask);
+			if (fe_trace_on())
+				priv->trace.irq_stamp = fe_trace_now() ? : 1;
 			__napi_schedule(&priv->rx_napi);
 		}
 	} else {
@@ -1036,11 +1281,10 @@ static irqreturn_t fe_handle_irq(int irq, void *dev)
 static void fe_poll_controller(struct net_device *dev)
 {
 	struct fe_priv *priv = netdev_priv(dev);
-	u32 int_mask = priv->soc->tx_int | priv->soc->rx_int;
 
-	fe_int_disable(int_mask);
+	fe_int_disable(fe_int_all(priv));
 	fe_handle_irq(dev->irq, dev);
-	fe_int_enable(int_mask);
+	fe_int_enable(priv->int_mask);
 }
 #endif
 
@@ -1125,10 +1369,10 @@ static int fe_hw_init(struct net_device *dev)
 	else
 		fe_hw_set_macaddr(priv, dev->dev_addr);
 
-	/* disable delay interrupt */
-	fe_reg_w32(0, FE_REG_DLY_INT_CFG);
+	/* delay interrupt stays off until coalescing is asked for */
+	fe_coalesce_apply(priv);
 
-	fe_int_disable(priv->soc->tx_int | priv->soc->rx_int);
+	fe_int_disable(fe_int_all(priv));
 
         /* frame engine will push VLAN tag regarding to VIDX feild in Tx desc. */
 	if (fe_reg_table[FE_REG_FE_DMA_VID_BASE])
@@ -1149,16 +1393,10 @@ static int fe_hw_init(struct net_device *dev)
 	return 0;
 }
 
-static int fe_open(struct net_device *dev)
+static void fe_dma_start(struct fe_priv *priv)
 {
-	struct fe_priv *priv = netdev_priv(dev);
 	unsigned long flags;
 	u32 val;
-	int err;
-
-	err = fe_init_dma(priv);
-	if (err)
-		goto err_out;
 
 	spin_lock_irqsave(&priv->page_lock, flags);
 
@@ -1169,6 +1407,41 @@ static int fe_open(struct net_device *dev)
 	fe_reg_w32(val, FE_REG_PDMA_GLO_CFG);
 
 	spin_unlock_irqrestore(&priv->page_lock, flags);
+}
+
+static void fe_dma_stop(struct fe_priv *priv)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&priv->page_lock, flags);
+
+	fe_reg_w32(fe_reg_r32(FE_REG_PDMA_GLO_CFG) &
+		     ~(FE_TX_WB_DDONE | FE_RX_DMA_EN | FE_TX_DMA_EN),
+		     FE_REG_PDMA_GLO_CFG);
+	spin_unlock_irqrestore(&priv->page_lock, flags);
+
+	/* wait dma stop */
+	for (i = 0; i < 10; i++) {
+		if (fe_reg_r32(FE_REG_PDMA_GLO_CFG) &
+				(FE_TX_DMA_BUSY | FE_RX_DMA_BUSY)) {
+			msleep(10);
+			continue;
+		}
+		break;
+	}
+}
+
+static int fe_open(struct net_device *dev)
+{
+	struct fe_priv *priv = netdev_priv(dev);
+	int err;
+
+	err = fe_init_dma(priv);
+	if (err)
+		goto err_out;
+
+	fe_dma_start(priv);
 
 	if (priv->phy)
 		priv->phy->start(priv);
@@ -1177,7 +1450,7 @@ static int fe_open(struct net_device *dev)
 		netif_carrier_on(dev);
 
 	napi_enable(&priv->rx_napi);
-	fe_int_enable(priv->soc->tx_int | priv->soc->rx_int);
+	fe_int_enable(priv->int_mask);
 	netif_start_queue(dev);
 
 	return 0;
@@ -1190,36 +1463,102 @@ err_out:
 static int fe_stop(struct net_device *dev)
 {
 	struct fe_priv *priv = netdev_priv(dev);
-	unsigned long flags;
-	int i;
 
 	netif_tx_disable(dev);
-	fe_int_disable(priv->soc->tx_int | priv->soc->rx_int);
+	fe_int_disable(fe_int_all(priv));
 	napi_disable(&priv->rx_napi);
 
 	if (priv->phy)
 		priv->phy->stop(priv);
 
-	spin_lock_irqsave(&priv->page_lock, flags);
+	fe_dma_stop(priv);
+	fe_free_dma(priv);
 
-	fe_reg_w32(fe_reg_r32(FE_REG_PDMA_GLO_CFG) &
-		     ~(FE_TX_WB_DDONE | FE_RX_DMA_EN | FE_TX_DMA_EN),
-		     FE_REG_PDMA_GLO_CFG);
-	spin_unlock_irqrestore(&priv->page_lock, flags);
+	return 0;
+}
 
-	/* wait dma stop */
+/* the rings of a running device, while new ones are being set up */
+struct fe_rings {
+	struct fe_tx_ring tx_ring;
+	struct fe_rx_buf *rx_buf;
+	struct fe_rx_dma *rx_dma;
+	dma_addr_t rx_phys;
+	u16 rx_ring_size;
+};
+
+static void fe_rings_swap(struct fe_priv *priv, struct fe_rings *r)
+{
+	swap(priv->tx_ring, r->tx_ring);
+	swap(priv->rx_buf, r->rx_buf);
+	swap(priv->rx_dma, r->rx_dma);
+	swap(priv->rx_phys, r->rx_phys);
+	swap(priv->rx_ring_size, r->rx_ring_size);
+}
+
+/* resize the rings without taking the link down: what was queued is
+ * sent, what was received goes up the stack, then the dma restarts on
+ * the new rings. the old ones stay if the new cannot be allocated */
+int fe_set_ring_size(struct fe_priv *priv, u16 tx_size, u16 rx_size)
+{
+	struct net_device *dev = priv->netdev;
+	struct fe_tx_ring *ring = &priv->tx_ring;
+	struct fe_rings r;
+	int i, err;
+
+	if (!netif_running(dev)) {
+		ring->tx_ring_size = tx_size;
+		priv->rx_ring_size = rx_size;
+		return 0;
+	}
+
+	netif_tx_disable(dev);
+	fe_tx_kick(ring);
 	for (i = 0; i < 10; i++) {
-		if (fe_reg_r32(FE_REG_PDMA_GLO_CFG) &
-				(FE_TX_DMA_BUSY | FE_RX_DMA_BUSY)) {
-			msleep(10);
-			continue;
-		}
-		break;
+		if (fe_reg_r32(FE_REG_TX_DTX_IDX0) == ring->tx_next_idx)
+			break;
+		msleep(1);
 	}
 
-	fe_free_dma(priv);
+	fe_int_disable(fe_int_all(priv));
+	napi_disable(&priv->rx_napi);
+	fe_dma_stop(priv);
 
-	return 0;
+	local_bh_disable();
+	fe_poll_rx(&priv->rx_napi, priv->rx_ring_size, priv,
+			priv->soc->rx_int | priv->soc->rx_dly_int);
+	napi_gro_flush(&priv->rx_napi, false);
+	local_bh_enable();
+
+	memset(&r, 0, sizeof(r));
+	r.tx_ring.tx_ring_size = tx_size;
+	r.rx_ring_size = rx_size;
+
+	fe_rings_swap(priv, &r);
+	err = fe_init_dma(priv);
+	if (err) {
+		fe_free_dma(priv);
+		fe_rings_swap(priv, &r);
+
+		/* back to the old rings, emptied */
+		for (i = 0; i < ring->tx_ring_size; i++)
+			fe_txd_unmap(&dev->dev, &ring->tx_buf[i]);
+		netdev_reset_queue(dev);
+		fe_tx_ring_setup(priv);
+		fe_rx_ring_setup(priv);
+	} else {
+		fe_rings_swap(priv, &r);
+		fe_free_dma(priv);
+		fe_rings_swap(priv, &r);
+	}
+
+	memset(&priv->ring_stats, 0, sizeof(priv->ring_stats));
+
+	fe_dma_start(priv);
+	napi_enable(&priv->rx_napi);
+	fe_int_enable(priv->int_mask);
+	netif_wake_queue(dev);
+
+	return err;
 }
 
 static int __init fe_init(struct net_device *dev)
@@ -1507,6 +1846,7 @@ static int fe_probe(struct platform_device *pdev)
 	}
 
 	platform_set_drvdata(pdev, netdev);
+	fe_trace_init(priv);
 
 	netif_info(priv, probe, netdev, "ralink at 0x%08lx, irq %d\n",
 			netdev->base_addr, netdev->irq);
@@ -1532,6 +1872,7 @@ static int fe_remove(struct platform_device *pdev)
 
 	cancel_work_sync(&priv->pending_work);
 
+	fe_trace_exit(priv);
 	unregister_netdev(dev);
 	free_netdev(dev);
 	platform_set_drvdata(pdev, NULL);
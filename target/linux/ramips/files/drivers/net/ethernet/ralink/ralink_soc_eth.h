@@ -63,6 +63,10 @@ enum fe_work_flag {
 /* power of 2 to let NEXT_TX_DESP_IDX work */
 #define NUM_DMA_DESC		(1 << 7)
 #define MAX_DMA_DESC		0xfff
+/* rx descriptors returned per RX_CALC_IDX0 write */
+#define FE_RX_BATCH		16
+/* stop the queue while the worst case skb might not fit */
+#define FE_TX_STOP_THRESH	(MAX_SKB_FRAGS + 2)
 
 #define FE_DELAY_EN_INT		0x80
 #define FE_DELAY_MAX_INT	0x04
@@ -70,6 +74,8 @@ enum fe_work_flag {
 #define FE_DELAY_TIME		20
 #define FE_DELAY_CHAN		(((FE_DELAY_EN_INT | FE_DELAY_MAX_INT) << 8) | FE_DELAY_MAX_TOUT)
 #define FE_DELAY_INIT		((FE_DELAY_CHAN << 16) | FE_DELAY_CHAN)
+#define FE_DELAY_MAX_PINT	0x7f
+#define FE_DELAY_MAX_PTIME	0xff
 #define FE_PSE_FQFC_CFG_INIT	0x80504000
 #define FE_PSE_FQFC_CFG_256Q	0xff908000
 
@@ -403,6 +409,8 @@ struct fe_soc_data
 	u32 pdma_glo_cfg;
 	u32 rx_int;
 	u32 tx_int;
+	u32 rx_dly_int;
+	u32 tx_dly_int;
 	u32 status_int;
 	u32 checksum_bit;
 };
@@ -438,6 +446,20 @@ FE_STAT_REG_DECLARE
 #undef _FE
 };
 
+/* kept by the driver: ring occupancy high water marks and shortages */
+#define FE_RING_STAT_DECLARE		\
+	_FE(tx_ring_hwm)		\
+	_FE(rx_ring_hwm)		\
+	_FE(rx_ring_full)		\
+	_FE(rx_no_buffer)
+
+struct fe_ring_stats
+{
+#define _FE(x) u32 x;
+FE_RING_STAT_DECLARE
+#undef _FE
+};
+
 enum fe_tx_flags {
 	FE_TX_FLAGS_SINGLE0	= 0x01,
 	FE_TX_FLAGS_PAGE0	= 0x02,
@@ -448,12 +470,22 @@ struct fe_tx_buf
 {
 	struct sk_buff *skb;
 	u32 flags;
+	u32 stamp;		/* xmit time, only set while tracing */
 	DEFINE_DMA_UNMAP_ADDR(dma_addr0);
 	DEFINE_DMA_UNMAP_LEN(dma_len0);
 	DEFINE_DMA_UNMAP_ADDR(dma_addr1);
 	DEFINE_DMA_UNMAP_LEN(dma_len1);
 };
 
+/* an rx slot owns a mapped page and uses half of it when a frame fits,
+ * so the page can flip back once the stack is done with the other half */
+struct fe_rx_buf
+{
+	struct page *page;
+	dma_addr_t dma;
+	unsigned int offset;
+};
+
 struct fe_tx_ring
 {
 	struct fe_tx_dma *tx_dma;
@@ -461,6 +493,47 @@ struct fe_tx_ring
 	dma_addr_t tx_phys;
 	u16 tx_ring_size;
 	u16 tx_free_idx;
+	u16 tx_next_idx;
+};
+
+/* adaptive rx coalescing: steps through fe_coal_levels every interval */
+#define FE_COAL_INTERVAL	(HZ / 10)
+#define FE_COAL_IRQS_HIGH	500	/* per interval, 5000 irq/s */
+
+struct fe_coalesce
+{
+	u32 rx_usecs;
+	u32 rx_frames;
+	u32 tx_usecs;
+	u32 tx_frames;
+	bool rx_adaptive;
+
+	int level;
+	u32 irqs;
+	u32 pkts;
+	unsigned long stamp;
+};
+
+/* latency tracing, see ralink_trace.h */
+#define FE_TRACE_BUCKETS	16
+
+struct fe_trace
+{
+	bool enabled;
+	struct dentry *dir;
+
+	u32 irq_stamp;		/* irq that scheduled the poll, 0 if none */
+	u32 polls;
+	u32 irq_to_poll[FE_TRACE_BUCKETS];
+	u32 poll_time[FE_TRACE_BUCKETS];
+	u32 rx_per_poll[FE_TRACE_BUCKETS];
+	u32 tx_per_poll[FE_TRACE_BUCKETS];
+	u32 xmit_to_done[FE_TRACE_BUCKETS];
+
+	/* time spent handing rx packets to the stack */
+	u64 stack_time;
+	u32 stack_pkts;
+	u32 stack_max;
 };
 
 struct fe_priv
@@ -478,9 +551,12 @@ struct fe_priv
 	u16				frag_size;
 	u16				rx_buf_size;
 	struct fe_rx_dma		*rx_dma;
-	u8				**rx_data;
+	struct fe_rx_buf		*rx_buf;
 	dma_addr_t			rx_phys;
 	struct napi_struct		rx_napi;
+	u32				rx_calc_idx;
+	struct fe_coalesce		coal;
+	u32				int_mask;
 
 	struct fe_tx_ring               tx_ring;
 
@@ -492,6 +568,8 @@ struct fe_priv
 	int				link[8];
 
 	struct fe_hw_stats		*hw_stats;
+	struct fe_ring_stats		ring_stats;
+	struct fe_trace			trace;
 	unsigned long			vlan_map;
 	struct work_struct		pending_work;
 	DECLARE_BITMAP(pending_flags, FE_FLAG_MAX);
@@ -511,6 +589,8 @@ void fe_reg_w32(u32 val, enum fe_reg reg);
 u32 fe_reg_r32(enum fe_reg reg);
 
 void fe_reset(u32 reset_bits);
+void fe_coalesce_set(struct fe_priv *priv, const struct fe_coalesce *coal);
+int fe_set_ring_size(struct fe_priv *priv, u16 tx_size, u16 rx_size);
 
 static inline void *priv_netdev(struct fe_priv *priv)
 {
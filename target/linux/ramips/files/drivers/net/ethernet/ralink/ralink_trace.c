@@ -0,0 +1,221 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#include "ralink_soc_eth.h"
+#include "ralink_trace.h"
+
+/*
+ * debugfs/<device>/trace:	write 1/0 to start/stop tracing
+ * debugfs/<device>/latency:	histograms and ring watermarks,
+ *				any write clears them
+ */
+
+struct static_key fe_trace_key = STATIC_KEY_INIT_FALSE;
+static DEFINE_MUTEX(fe_trace_mutex);
+
+u32 fe_trace_poll_start(struct fe_priv *priv)
+{
+	struct fe_trace *t = &priv->trace;
+	u32 now = fe_trace_now() ? : 1;
+
+	/* a poll that napi repeated without a new irq has no irq time */
+	if (t->irq_stamp) {
+		fe_trace_hist(t->irq_to_poll, now - t->irq_stamp);
+		t->irq_stamp = 0;
+	}
+
+	return now;
+}
+
+void fe_trace_poll_end(struct fe_priv *priv, u32 start, int rx_done,
+		int tx_done)
+{
+	struct fe_trace *t = &priv->trace;
+
+	t->polls++;
+	fe_trace_hist(t->poll_time, fe_trace_now() - start);
+	fe_trace_hist(t->rx_per_poll, rx_done);
+	fe_trace_hist(t->tx_per_poll, tx_done);
+}
+
+void fe_trace_rx(struct fe_priv *priv, struct napi_struct *napi,
+		struct sk_buff *skb)
+{
+	struct fe_trace *t = &priv->trace;
+	u64 start = ktime_get_ns();
+	u32 delta;
+
+	napi_gro_receive(napi, skb);
+
+	delta = ktime_get_ns() - start;
+	t->stack_time += delta;
+	t->stack_pkts++;
+	if (delta > t->stack_max)
+		t->stack_max = delta;
+}
+
+static void fe_trace_clear(struct fe_priv *priv)
+{
+	struct fe_trace *t = &priv->trace;
+
+	memset(&t->irq_stamp, 0, sizeof(*t) - offsetof(struct fe_trace, irq_stamp));
+	memset(&priv->ring_stats, 0, sizeof(priv->ring_stats));
+}
+
+static void fe_trace_show_hist(struct seq_file *m, const char *name,
+		const u32 *hist, const char *unit)
+{
+	int i, last = 0;
+
+	for (i = 0; i < FE_TRACE_BUCKETS; i++)
+		if (hist[i])
+			last = i;
+
+	seq_printf(m, "%s (%s):\n", name, unit);
+	for (i = 0; i <= last; i++) {
+		if (i == FE_TRACE_BUCKETS - 1)
+			seq_printf(m, " >= %6u: %u\n", 1 << (i - 1), hist[i]);
+		else
+			seq_printf(m, "  < %6u: %u\n", 1 << i, hist[i]);
+	}
+}
+
+static int fe_trace_show(struct seq_file *m, void *v)
+{
+	struct fe_priv *priv = m->private;
+	struct fe_trace *t = &priv->trace;
+
+	seq_printf(m, "tracing: %s\npolls: %u\n",
+			t->enabled ? "on" : "off", t->polls);
+
+	fe_trace_show_hist(m, "irq to poll", t->irq_to_poll, "1024ns");
+	fe_trace_show_hist(m, "poll time", t->poll_time, "1024ns");
+	fe_trace_show_hist(m, "rx per poll", t->rx_per_poll, "packets");
+	fe_trace_show_hist(m, "tx per poll", t->tx_per_poll, "packets");
+	fe_trace_show_hist(m, "xmit to tx done", t->xmit_to_done, "1024ns");
+
+	seq_printf(m, "stack handoff: %u packets, avg %llu ns, max %u ns\n",
+			t->stack_pkts,
+			t->stack_pkts ? div_u64(t->stack_time, t->stack_pkts) : 0,
+			t->stack_max);
+	seq_printf(m, "tx ring hwm: %u/%u\nrx ring hwm: %u/%u\n",
+			priv->ring_stats.tx_ring_hwm, priv->tx_ring.tx_ring_size,
+			priv->ring_stats.rx_ring_hwm, priv->rx_ring_size);
+	seq_printf(m, "rx ring full: %u\nrx no buffer: %u\n",
+			priv->ring_stats.rx_ring_full,
+			priv->ring_stats.rx_no_buffer);
+
+	return 0;
+}
+
+static int fe_trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, fe_trace_show, inode->i_private);
+}
+
+static ssize_t fe_trace_clear_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct fe_priv *priv = ((struct seq_file *)file->private_data)->private;
+
+	fe_trace_clear(priv);
+
+	return count;
+}
+
+static const struct file_operations fe_trace_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = fe_trace_open,
+	.read = seq_read,
+	.write = fe_trace_clear_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void fe_trace_set(struct fe_priv *priv, bool enable)
+{
+	mutex_lock(&fe_trace_mutex);
+	if (enable && !priv->trace.enabled) {
+		fe_trace_clear(priv);
+		priv->trace.enabled = true;
+		static_key_slow_inc(&fe_trace_key);
+	} else if (!enable && priv->trace.enabled) {
+		priv->trace.enabled = false;
+		static_key_slow_dec(&fe_trace_key);
+	}
+	mutex_unlock(&fe_trace_mutex);
+}
+
+static ssize_t fe_trace_enable_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct fe_priv *priv = file->private_data;
+	char val[2] = { priv->trace.enabled ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(buf, count, ppos, val, sizeof(val));
+}
+
+static ssize_t fe_trace_enable_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct fe_priv *priv = file->private_data;
+	char val[8];
+	size_t len = min(count, sizeof(val) - 1);
+	bool enable;
+
+	if (copy_from_user(val, buf, len))
+		return -EFAULT;
+	val[len] = '\0';
+	if (strtobool(val, &enable))
+		return -EINVAL;
+
+	fe_trace_set(priv, enable);
+
+	return count;
+}
+
+static const struct file_operations fe_trace_enable_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = fe_trace_enable_read,
+	.write = fe_trace_enable_write,
+	.llseek = default_llseek,
+};
+
+void fe_trace_init(struct fe_priv *priv)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(priv->device), NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_file("trace", S_IRUSR | S_IWUSR, dir, priv,
+			&fe_trace_enable_fops);
+	debugfs_create_file("latency", S_IRUSR | S_IWUSR, dir, priv,
+			&fe_trace_latency_fops);
+	priv->trace.dir = dir;
+}
+
+void fe_trace_exit(struct fe_priv *priv)
+{
+	fe_trace_set(priv, false);
+	debugfs_remove_recursive(priv->trace.dir);
+	priv->trace.dir = NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef FE_TRACE_H
+#define FE_TRACE_H
+
+#include <linux/netdevice.h>
+#include <linux/static_key.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+
+/*
+ * Latency tracing of the irq -> napi -> stack path. The hooks sit behind a
+ * static key, so with tracing off they are a single nop in the hot paths.
+ * Times are kept in units of 1024 ns to stay in 32 bits.
+ */
+#ifdef CONFIG_DEBUG_FS
+extern struct static_key fe_trace_key;
+
+static inline bool fe_trace_on(void)
+{
+	return static_key_false(&fe_trace_key);
+}
+
+u32 fe_trace_poll_start(struct fe_priv *priv);
+void fe_trace_poll_end(struct fe_priv *priv, u32 start, int rx_done,
+		int tx_done);
+void fe_trace_rx(struct fe_priv *priv, struct napi_struct *napi,
+		struct sk_buff *skb);
+void fe_trace_init(struct fe_priv *priv);
+void fe_trace_exit(struct fe_priv *priv);
+#else
+static inline bool fe_trace_on(void)
+{
+	return false;
+}
+
+static inline u32 fe_trace_poll_start(struct fe_priv *priv)
+{
+	return 0;
+}
+
+static inline void fe_trace_poll_end(struct fe_priv *priv, u32 start,
+		int rx_done, int tx_done) {}
+
+static inline void fe_trace_rx(struct fe_priv *priv,
+		struct napi_struct *napi, struct sk_buff *skb)
+{
+	napi_gro_receive(napi, skb);
+}
+
+static inline void fe_trace_init(struct fe_priv *priv) {}
+static inline void fe_trace_exit(struct fe_priv *priv) {}
+#endif
+
+static inline u32 fe_trace_now(void)
+{
+	return ktime_get_ns() >> 10;
+}
+
+/* bucket 0 holds 0, bucket n holds [2^(n-1), 2^n) */
+static inline void fe_trace_hist(u32 *hist, u32 val)
+{
+	int b = fls(val);
+
+	if (b >= FE_TRACE_BUCKETS)
+		b = FE_TRACE_BUCKETS - 1;
+	hist[b]++;
+}
+
+#endif /* FE_TRACE_H */
@@ -241,6 +241,8 @@ static struct fe_soc_data mt7620_data = {
 	.pdma_glo_cfg = FE_PDMA_SIZE_16DWORDS,
 	.rx_int = RT5350_RX_DONE_INT,
 	.tx_int = RT5350_TX_DONE_INT,
+	.rx_dly_int = RT5350_RX_DLY_INT,
+	.tx_dly_int = RT5350_TX_DLY_INT,
 	.status_int = MT7620_FE_GDM1_AF,
 	.checksum_bit = MT7620_L4_VALID,
 	.has_carrier = mt7620a_has_carrier,
@@ -261,6 +263,8 @@ static struct fe_soc_data mt7621_data = {
 	.pdma_glo_cfg = FE_PDMA_SIZE_16DWORDS,
 	.rx_int = RT5350_RX_DONE_INT,
 	.tx_int = RT5350_TX_DONE_INT,
+	.rx_dly_int = RT5350_RX_DLY_INT,
+	.tx_dly_int = RT5350_TX_DLY_INT,
 	.status_int = (MT7621_FE_GDM1_AF | MT7621_FE_GDM2_AF),
 	.checksum_bit = MT7621_L4_VALID,
 	.has_carrier = mt7620a_has_carrier,
@@ -132,6 +132,8 @@ static struct fe_soc_data rt3050_data = {
 	.checksum_bit = RX_DMA_L4VALID,
 	.rx_int = FE_RX_DONE_INT,
 	.tx_int = FE_TX_DONE_INT,
+	.rx_dly_int = FE_RX_DLY_INT,
+	.tx_dly_int = FE_TX_DLY_INT,
 	.status_int = FE_CNT_GDM_AF,
 };
 
@@ -146,6 +148,8 @@ static struct fe_soc_data rt5350_data = {
 	.checksum_bit = RX_DMA_L4VALID,
 	.rx_int = RT5350_RX_DONE_INT,
 	.tx_int = RT5350_TX_DONE_INT,
+	.rx_dly_int = RT5350_RX_DLY_INT,
+	.tx_dly_int = RT5350_TX_DLY_INT,
 };
 
 const struct of_device_id of_fe_match[] = {
@@ -124,17 +124,57 @@ static const cyg_uint32 crc32_tab[] = {
       0x2d02ef8dL
    };
 
+/* Slice-by-8: crc32_slice[k][b] is the CRC of byte b followed by k zero
+   bytes, so eight bytes fold in with eight independent lookups. The
+   bytes are gathered one at a time, so any host byte order works. */
+static cyg_uint32 crc32_slice[8][256];
+static int crc32_slice_ready;
+
+static void
+crc32_slice_init(void)
+{
+  int i, k;
+
+  for (i = 0;  i < 256;  i++) {
+    crc32_slice[0][i] = crc32_tab[i];
+    for (k = 1;  k < 8;  k++)
+      crc32_slice[k][i] = crc32_tab[crc32_slice[k-1][i] & 0xff] ^
+                          (crc32_slice[k-1][i] >> 8);
+  }
+  crc32_slice_ready = 1;
+}
+
+static cyg_uint32
+crc32_update(cyg_uint32 crc32val, unsigned char *s, int len)
+{
+  if (len >= 64) {
+    if (!crc32_slice_ready)
+      crc32_slice_init();
+
+    for (;  len >= 8;  s += 8, len -= 8) {
+      crc32val ^= s[0] | (s[1] << 8) | (s[2] << 16) | ((cyg_uint32)s[3] << 24);
+      crc32val = crc32_slice[7][crc32val & 0xff] ^
+                 crc32_slice[6][(crc32val >> 8) & 0xff] ^
+                 crc32_slice[5][(crc32val >> 16) & 0xff] ^
+                 crc32_slice[4][crc32val >> 24] ^
+                 crc32_slice[3][s[4]] ^
+                 crc32_slice[2][s[5]] ^
+                 crc32_slice[1][s[6]] ^
+                 crc32_slice[0][s[7]];
+    }
+  }
+
+  while (--len >= 0)
+    crc32val = crc32_tab[(crc32val ^ *s++) & 0xff] ^ (crc32val >> 8);
+  return crc32val;
+}
+
 /* This is the standard Gary S. Brown's 32 bit CRC algorithm, but
    accumulate the CRC into the result of a previous CRC. */
 cyg_uint32 
 cyg_crc32_accumulate(cyg_uint32 crc32val, unsigned char *s, int len)
 {
-  int i;
-
-  for (i = 0;  i < len;  i++) {
-    crc32val = crc32_tab[(crc32val ^ s[i]) & 0xff] ^ (crc32val >> 8);
-  }
-  return crc32val;
+  return crc32_update(crc32val, s, len);
 }
 
 /* This is the standard Gary S. Brown's 32 bit CRC algorithm */
@@ -150,14 +190,9 @@ cyg_crc32(unsigned char *s, int len)
 cyg_uint32
 cyg_ether_crc32_accumulate(cyg_uint32 crc32val, unsigned char *s, int len)
 {
-  int i;
-
   if (s == 0) return 0L;
   
-  crc32val = crc32val ^ 0xffffffff;
-  for (i = 0;  i < len;  i++) {
-      crc32val = crc32_tab[(crc32val ^ s[i]) & 0xff] ^ (crc32val >> 8);
-  }
+  crc32val = crc32_update(crc32val ^ 0xffffffff, s, len);
   return crc32val ^ 0xffffffff;
 }
 
@@ -0,0 +1,134 @@
+/*
+ * Shared input helpers for the firmware image tools
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fwio.h"
+
+static ssize_t fwio_read_fd(int fd, void *buf, size_t maxlen)
+{
+	char *p = buf;
+	size_t len = 0;
+	ssize_t n;
+	char c;
+
+	while (len < maxlen) {
+		n = read(fd, p + len, maxlen - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			return len;
+		len += n;
+	}
+
+	/* the buffer is full, make sure the file ends here */
+	do {
+		n = read(fd, &c, 1);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+	if (n > 0) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	return len;
+}
+
+ssize_t fwio_read_file(const char *name, void *buf, size_t maxlen)
+{
+	ssize_t ret;
+	int err;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = fwio_read_fd(fd, buf, maxlen);
+	err = errno;
+	close(fd);
+	errno = err;
+
+	return ret;
+}
+
+int fwio_map_file(const char *name, struct fwio_map *map)
+{
+	struct stat st;
+	ssize_t n;
+	int err;
+	int fd;
+
+	map->data = NULL;
+	map->size = 0;
+	map->mapped = 0;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st))
+		goto err_close;
+
+	map->size = st.st_size;
+	if (S_ISREG(st.st_mode) && map->size) {
+		map->data = mmap(NULL, map->size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE, fd, 0);
+		if (map->data != MAP_FAILED) {
+			map->mapped = 1;
+			close(fd);
+			return 0;
+		}
+		map->data = NULL;
+	}
+
+	/* not mappable, read it the old way */
+	map->data = malloc(map->size ? map->size : 1);
+	if (!map->data)
+		goto err_close;
+
+	n = fwio_read_fd(fd, map->data, map->size);
+	if (n < 0)
+		goto err_free;
+
+	map->size = n;
+	close(fd);
+	return 0;
+
+err_free:
+	err = errno;
+	free(map->data);
+	map->data = NULL;
+	errno = err;
+err_close:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void fwio_unmap_file(struct fwio_map *map)
+{
+	if (map->mapped)
+		munmap(map->data, map->size);
+	else
+		free(map->data);
+
+	map->data = NULL;
+	map->size = 0;
+	map->mapped = 0;
+}
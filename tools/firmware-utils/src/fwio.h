@@ -0,0 +1,37 @@
+/*
+ * Shared input helpers for the firmware image tools
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#ifndef _FWIO_H
+#define _FWIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct fwio_map {
+	void	*data;
+	size_t	size;
+	int	mapped;
+};
+
+/*
+ * Map a whole file copy-on-write, so callers may patch the buffer (e.g. to
+ * recompute a header checksum) without touching the file.  Falls back to
+ * reading it into malloc()'d memory when it can not be mapped.
+ */
+int fwio_map_file(const char *name, struct fwio_map *map);
+void fwio_unmap_file(struct fwio_map *map);
+
+/*
+ * Read a file with plain read(2) calls straight into buf.  Returns the
+ * number of bytes read, or -1 with errno set; EFBIG means the file is
+ * larger than maxlen.
+ */
+ssize_t fwio_read_file(const char *name, void *buf, size_t maxlen);
+
+#endif /* _FWIO_H */
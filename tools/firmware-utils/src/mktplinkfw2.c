@@ -28,6 +28,7 @@
 #include <netinet/in.h>
 
 #include "md5.h"
+#include "fwio.h"
 
 #define ALIGN(x,a) ({ typeof(a) __a = (a); (((x) + __a - 1) & ~(__a - 1)); })
 
@@ -299,28 +300,15 @@ static int get_file_stat(struct file_info *fdata)
 
 static int read_to_buf(struct file_info *fdata, char *buf)
 {
-	FILE *f;
-	int ret = EXIT_FAILURE;
+	ssize_t n;
 
-	f = fopen(fdata->file_name, "r");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for reading", fdata->file_name);
-		goto out;
-	}
-
-	errno = 0;
-	fread(buf, fdata->file_size, 1, f);
-	if (errno != 0) {
+	n = fwio_read_file(fdata->file_name, buf, fdata->file_size);
+	if (n != fdata->file_size) {
 		ERRS("unable to read from file \"%s\"", fdata->file_name);
-		goto out_close;
+		return EXIT_FAILURE;
 	}
 
-	ret = EXIT_SUCCESS;
-
- out_close:
-	fclose(f);
- out:
-	return ret;
+	return EXIT_SUCCESS;
 }
 
 static int check_options(void)
@@ -711,21 +699,21 @@ static inline void inspect_fw_pmd5sum(char *label, uint8_t *val, char *text)
 
 static int inspect_fw(void)
 {
+	struct fwio_map map;
 	char *buf;
 	struct fw_header *hdr;
 	uint8_t md5sum[MD5SUM_LEN];
 	struct board_info *board;
 	int ret = EXIT_FAILURE;
 
-	buf = malloc(inspect_info.file_size);
-	if (!buf) {
-		ERR("no memory for buffer!\n");
+	/* the image is mapped copy-on-write, the header md5 gets patched */
+	if (fwio_map_file(inspect_info.file_name, &map) ||
+	    map.size != inspect_info.file_size) {
+		ERRS("unable to read from file \"%s\"", inspect_info.file_name);
 		goto out;
 	}
-
-	ret = read_to_buf(&inspect_info, buf);
-	if (ret)
-		goto out_free_buf;
+	ret = EXIT_SUCCESS;
+	buf = map.data;
 	hdr = (struct fw_header *)buf;
 
 	inspect_fw_pstr("File name", inspect_info.file_name);
@@ -865,7 +853,7 @@ static int inspect_fw(void)
 	}
 
  out_free_buf:
-	free(buf);
+	fwio_unmap_file(&map);
  out:
 	return ret;
 }
@@ -39,41 +39,47 @@ static int pad_len = sizeof(eof_mark);
 			progname, ## __VA_ARGS__, strerror(save)); \
 } while (0)
 
-#define BUF_SIZE	(64 * 1024)
+#define BUF_SIZE	(256 * 1024)
 #define ALIGN(_x,_y)	(((_x) + ((_y) - 1)) & ~((_y) - 1))
+#define MAX_VARIANTS	16
 
-static int pad_image(char *name, uint32_t pad_mask)
-{
-	char *buf;
-	int fd;
-	ssize_t in_len;
-	ssize_t out_len;
-	int ret = -1;
+struct variant {
+	char *name;
+	uint32_t pad_mask;
+};
 
-	buf = malloc(BUF_SIZE);
-	if (!buf) {
-		ERR("No memory for buffer");
-		goto out;
-	}
+static struct variant variants[MAX_VARIANTS];
+static int num_variants;
+static char *ff_buf;
 
-	fd = open(name, O_RDWR);
-	if (fd < 0) {
-		ERRS("Unable to open %s", name);
-		goto free_buf;
+static int write_all(int fd, const void *data, ssize_t len)
+{
+	const char *p = data;
+	ssize_t t;
+
+	while (len > 0) {
+		t = write(fd, p, len);
+		if (t < 0 && errno == EINTR)
+			continue;
+		if (t <= 0)
+			return -1;
+		p += t;
+		len -= t;
 	}
 
-	in_len = lseek(fd, 0, SEEK_END);
-	if (in_len < 0)
-		goto close;
+	return 0;
+}
 
-	memset(buf, '\xff', BUF_SIZE);
+/* append the padding to fd, which is positioned at its end of in_len */
+static int pad_fd(int fd, char *name, ssize_t in_len, uint32_t pad_mask)
+{
+	ssize_t out_len;
 
 	in_len += xtra_offset;
 
 	out_len = in_len;
 	while (pad_mask) {
 		uint32_t mask;
-		ssize_t t;
 		int i;
 
 		for (i = 10; i < 32; i++) {
@@ -99,30 +105,130 @@ static int pad_image(char *name, uint32_t pad_mask)
 			if (len > BUF_SIZE)
 				len = BUF_SIZE;
 
-			t = write(fd, buf, len);
-			if (t != len) {
+			if (write_all(fd, ff_buf, len)) {
 				ERRS("Unable to write to %s", name);
-				goto close;
+				return -1;
 			}
 
 			out_len += len;
 		}
 
 		/* write out the JFFS end-of-filesystem marker */
-		t = write(fd, pad, pad_len);
-		if (t != pad_len) {
+		if (write_all(fd, pad, pad_len)) {
 			ERRS("Unable to write to %s", name);
-			goto close;
+			return -1;
 		}
 		out_len += pad_len;
 	}
 
+	return 0;
+}
+
+/* read the unpadded input once, for all of the -o variants */
+static char *read_image(int fd, char *name, ssize_t len)
+{
+	char *buf;
+	ssize_t done, t;
+
+	buf = malloc(len ? len : 1);
+	if (!buf) {
+		ERR("No memory for %s", name);
+		return NULL;
+	}
+
+	for (done = 0; done < len; done += t) {
+		t = pread(fd, buf + done, len - done, done);
+		if (t < 0 && errno == EINTR) {
+			t = 0;
+			continue;
+		}
+		if (t <= 0) {
+			ERRS("Unable to read from %s", name);
+			free(buf);
+			return NULL;
+		}
+	}
+
+	return buf;
+}
+
+static int write_variant(struct variant *v, char *data, ssize_t len)
+{
+	int fd;
+	int ret;
+
+	fd = open(v->name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		ERRS("Unable to open %s", v->name);
+		return -1;
+	}
+
+	ret = write_all(fd, data, len);
+	if (ret)
+		ERRS("Unable to write to %s", v->name);
+	else
+		ret = pad_fd(fd, v->name, len, v->pad_mask);
+
+	if (close(fd) && !ret) {
+		ERRS("Unable to write to %s", v->name);
+		ret = -1;
+	}
+	if (ret)
+		unlink(v->name);
+
+	return ret;
+}
+
+static int pad_image(char *name, uint32_t pad_mask)
+{
+	char *data;
+	int fd;
+	ssize_t in_len;
+	int ret = -1;
+	int i;
+
+	ff_buf = malloc(BUF_SIZE);
+	if (!ff_buf) {
+		ERR("No memory for buffer");
+		goto out;
+	}
+
+	memset(ff_buf, '\xff', BUF_SIZE);
+
+	fd = open(name, O_RDWR);
+	if (fd < 0) {
+		ERRS("Unable to open %s", name);
+		goto free_buf;
+	}
+
+	in_len = lseek(fd, 0, SEEK_END);
+	if (in_len < 0)
+		goto close;
+
+	if (num_variants) {
+		data = read_image(fd, name, in_len);
+		if (!data)
+			goto close;
+
+		for (i = 0; i < num_variants; i++)
+			if (write_variant(&variants[i], data, in_len))
+				break;
+
+		free(data);
+		if (i < num_variants)
+			goto close;
+	}
+
+	/* the input itself is extended in place */
+	if (pad_mask && pad_fd(fd, name, in_len, pad_mask))
+		goto close;
+
 	ret = 0;
 
 close:
 	close(fd);
 free_buf:
-	free(buf);
+	free(ff_buf);
 out:
 	return ret;
 }
@@ -137,6 +243,8 @@ static int usage(void)
 		"                        This is used to work around broken boot loaders that\n"
 		"                        try to parse the entire firmware area as one big jffs2\n"
 		"  -j:                   (like -J, but little-endian instead of big-endian)\n"
+		"  -o <pad>:<file>:      Also write a copy of the unpadded file to <file>,\n"
+		"                        padded to <pad> KiB only (may be given multiple times)\n"
 		"\n",
 		progname);
 	return EXIT_FAILURE;
@@ -145,6 +253,7 @@ static int usage(void)
 int main(int argc, char* argv[])
 {
 	char *image;
+	char *sep;
 	uint32_t pad_mask;
 	int ret = EXIT_FAILURE;
 	int err;
@@ -160,7 +269,7 @@ int main(int argc, char* argv[])
 	argc--;
 
 	pad_mask = 0;
-	while ((ch = getopt(argc, argv, "x:Jj")) != -1) {
+	while ((ch = getopt(argc, argv, "x:Jjo:")) != -1) {
 		switch (ch) {
 		case 'x':
 			xtra_offset = strtoul(optarg, NULL, 0);
@@ -175,6 +284,18 @@ int main(int argc, char* argv[])
 			pad = jffs2_pad_le;
 			pad_len = sizeof(jffs2_pad_le) - 1;
 			break;
+		case 'o':
+			if (num_variants == MAX_VARIANTS) {
+				ERR("Too many variants");
+				return EXIT_FAILURE;
+			}
+			variants[num_variants].pad_mask =
+				strtoul(optarg, &sep, 0) * 1024;
+			if (*sep != ':' || !sep[1] ||
+			    !variants[num_variants].pad_mask)
+				return usage();
+			variants[num_variants++].name = sep + 1;
+			break;
 		default:
 			return usage();
 		}
@@ -183,7 +304,7 @@ int main(int argc, char* argv[])
 	for (i = optind; i < argc; i++)
 		pad_mask |= strtoul(argv[i], NULL, 0) * 1024;
 
-	if (pad_mask == 0)
+	if (pad_mask == 0 && !num_variants)
 		pad_mask = (4 * 1024) | (8 * 1024) | (64 * 1024) |
 			   (128 * 1024);
 